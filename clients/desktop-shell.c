@@ -39,11 +39,13 @@
 #include <libgen.h>
 #include <ctype.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <wayland-client.h>
 #include "window.h"
 #include "../shared/cairo-util.h"
 #include "../shared/config-parser.h"
+#include "../shared/image-loader.h"
 
 #include "desktop-shell-client-protocol.h"
 
@@ -66,6 +68,21 @@ struct desktop {
 	enum cursor_type grab_cursor;
 
 	int painted;
+
+	/* One timer for the clocks of all the panels, firing on minute
+	 * boundaries; see clock_timer_reset() */
+	struct task clock_task;
+	int clock_fd;
+
+	/* Decoded on a thread once for all the outputs, the backgrounds
+	 * show their color until then; see background_image_load() */
+	struct {
+		char *path;
+		pthread_t thread;
+		int fds[2];	/* -1 when no decode is running */
+		struct task task;
+		cairo_surface_t *image;
+	} background_image;
 };
 
 struct surface {
@@ -91,9 +108,12 @@ struct background {
 	struct widget *widget;
 	int painted;
 
-	char *image;
 	int type;
 	uint32_t color;
+
+	/* the image as drawn, at the buffer size */
+	cairo_surface_t *scaled;
+	int32_t scaled_width, scaled_height;
 };
 
 struct output {
@@ -119,8 +139,6 @@ struct panel_launcher {
 struct panel_clock {
 	struct widget *widget;
 	struct panel *panel;
-	struct task clock_task;
-	int clock_fd;
 };
 
 struct unlock_dialog {
@@ -287,6 +305,20 @@ panel_redraw_handler(struct widget *widget, void *data)
 	check_desktop_ready(panel->window);
 }
 
+/* Only the launcher's own spot on the panel changes; one pixel more
+ * to the bottom right, where a pressed icon is drawn. */
+static void
+panel_launcher_schedule_redraw(struct panel_launcher *launcher)
+{
+	struct rectangle allocation;
+
+	widget_get_allocation(launcher->widget, &allocation);
+	widget_schedule_redraw_area(launcher->widget,
+				    allocation.x, allocation.y,
+				    allocation.width + 1,
+				    allocation.height + 1);
+}
+
 static int
 panel_launcher_enter_handler(struct widget *widget, struct input *input,
 			     float x, float y, void *data)
@@ -294,7 +326,7 @@ panel_launcher_enter_handler(struct widget *widget, struct input *input,
 	struct panel_launcher *launcher = data;
 
 	launcher->focused = 1;
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 
 	return CURSOR_LEFT_PTR;
 }
@@ -307,7 +339,7 @@ panel_launcher_leave_handler(struct widget *widget,
 
 	launcher->focused = 0;
 	widget_destroy_tooltip(widget);
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 }
 
 static void
@@ -319,7 +351,7 @@ panel_launcher_button_handler(struct widget *widget,
 	struct panel_launcher *launcher;
 
 	launcher = widget_get_user_data(widget);
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 	if (state == WL_POINTER_BUTTON_STATE_RELEASED)
 		panel_launcher_activate(launcher);
 
@@ -334,7 +366,7 @@ panel_launcher_touch_down_handler(struct widget *widget, struct input *input,
 
 	launcher = widget_get_user_data(widget);
 	launcher->focused = 1;
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 }
 
 static void
@@ -346,22 +378,10 @@ panel_launcher_touch_up_handler(struct widget *widget, struct input *input,
 
 	launcher = widget_get_user_data(widget);
 	launcher->focused = 0;
-	widget_schedule_redraw(widget);
+	panel_launcher_schedule_redraw(launcher);
 	panel_launcher_activate(launcher);
 }
 
-static void
-clock_func(struct task *task, uint32_t events)
-{
-	struct panel_clock *clock =
-		container_of(task, struct panel_clock, clock_task);
-	uint64_t exp;
-
-	if (read(clock->clock_fd, &exp, sizeof exp) != sizeof exp)
-		abort();
-	widget_schedule_redraw(clock->widget);
-}
-
 static void
 panel_clock_redraw_handler(struct widget *widget, void *data)
 {
@@ -382,7 +402,12 @@ panel_clock_redraw_handler(struct widget *widget, void *data)
 	if (allocation.width == 0)
 		return;
 
-	cr = widget_cairo_create(clock->panel->widget);
+	cr = widget_cairo_create(clock->widget);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.0);
+	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
 	cairo_select_font_face(cr, "sans",
 			       CAIRO_FONT_SLANT_NORMAL,
 			       CAIRO_FONT_WEIGHT_NORMAL);
@@ -400,57 +425,36 @@ panel_clock_redraw_handler(struct widget *widget, void *data)
 	cairo_destroy(cr);
 }
 
-static int
-clock_timer_reset(struct panel_clock *clock)
-{
-	struct itimerspec its;
-
-	its.it_interval.tv_sec = 60;
-	its.it_interval.tv_nsec = 0;
-	its.it_value.tv_sec = 60;
-	its.it_value.tv_nsec = 0;
-	if (timerfd_settime(clock->clock_fd, 0, &its, NULL) < 0) {
-		fprintf(stderr, "could not set timerfd\n: %m");
-		return -1;
-	}
-
-	return 0;
-}
-
 static void
 panel_destroy_clock(struct panel_clock *clock)
 {
 	widget_destroy(clock->widget);
 
-	close(clock->clock_fd);
-
 	free(clock);
 }
 
+/* The clock is a sub-surface of its own, so that a tick redraws and
+ * commits its few pixels instead of the whole panel. */
 static void
 panel_add_clock(struct panel *panel)
 {
 	struct panel_clock *clock;
-	int timerfd;
-
-	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-	if (timerfd < 0) {
-		fprintf(stderr, "could not create timerfd\n: %m");
-		return;
-	}
+	struct display *display = window_get_display(panel->window);
+	struct wl_region *region;
 
 	clock = xzalloc(sizeof *clock);
 	clock->panel = panel;
 	panel->clock = clock;
-	clock->clock_fd = timerfd;
-
-	clock->clock_task.run = clock_func;
-	display_watch_fd(window_get_display(panel->window), clock->clock_fd,
-			 EPOLLIN, &clock->clock_task);
-	clock_timer_reset(clock);
 
-	clock->widget = widget_add_widget(panel->widget, clock);
+	clock->widget = window_add_subsurface(panel->window, clock,
+					      SUBSURFACE_DESYNCHRONIZED);
 	widget_set_redraw_handler(clock->widget, panel_clock_redraw_handler);
+
+	/* clicks go through to the panel */
+	region = wl_compositor_create_region(display_get_compositor(display));
+	wl_surface_set_input_region(widget_get_wl_surface(clock->widget),
+				    region);
+	wl_region_destroy(region);
 }
 
 static void
@@ -683,21 +687,93 @@ enum {
 	BACKGROUND_TILE
 };
 
-static void
-background_draw(struct widget *widget, void *data)
+/* Composes the image at the buffer size of the background once; a
+ * redraw is then a plain copy until the size or scale changes. */
+static cairo_surface_t *
+background_get_scaled(struct background *background, cairo_surface_t *image,
+		      int32_t width, int32_t height)
 {
-	struct background *background = data;
-	cairo_surface_t *surface, *image;
+	int32_t scale = window_get_buffer_scale(background->window);
 	cairo_pattern_t *pattern;
 	cairo_matrix_t matrix;
 	cairo_t *cr;
 	double im_w, im_h;
 	double sx, sy, s;
 	double tx, ty;
+
+	if (!image || background->type == -1 || width <= 0 || height <= 0)
+		return NULL;
+
+	if (background->scaled &&
+	    background->scaled_width == width * scale &&
+	    background->scaled_height == height * scale)
+		return background->scaled;
+
+	if (background->scaled)
+		cairo_surface_destroy(background->scaled);
+
+	background->scaled_width = width * scale;
+	background->scaled_height = height * scale;
+	background->scaled =
+		cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+					   background->scaled_width,
+					   background->scaled_height);
+
+	cr = cairo_create(background->scaled);
+	cairo_scale(cr, scale, scale);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+
+	im_w = cairo_image_surface_get_width(image);
+	im_h = cairo_image_surface_get_height(image);
+	sx = im_w / width;
+	sy = im_h / height;
+
+	pattern = cairo_pattern_create_for_surface(image);
+
+	switch (background->type) {
+	case BACKGROUND_SCALE:
+		cairo_matrix_init_scale(&matrix, sx, sy);
+		cairo_pattern_set_matrix(pattern, &matrix);
+		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+		break;
+	case BACKGROUND_SCALE_CROP:
+		s = (sx < sy) ? sx : sy;
+		/* align center */
+		tx = (im_w - s * width) * 0.5;
+		ty = (im_h - s * height) * 0.5;
+		cairo_matrix_init_translate(&matrix, tx, ty);
+		cairo_matrix_scale(&matrix, s, s);
+		cairo_pattern_set_matrix(pattern, &matrix);
+		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+		break;
+	case BACKGROUND_TILE:
+		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
+		break;
+	}
+
+	cairo_set_source(cr, pattern);
+	cairo_pattern_destroy(pattern);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+
+	return background->scaled;
+}
+
+static void
+background_draw(struct widget *widget, void *data)
+{
+	struct background *background = data;
+	cairo_surface_t *surface, *scaled;
+	cairo_t *cr;
+	int32_t scale;
 	struct rectangle allocation;
 	struct display *display;
+	struct desktop *desktop;
 	struct wl_region *opaque;
 
+	display = window_get_display(background->window);
+	desktop = display_get_user_data(display);
+
 	surface = window_get_surface(background->window);
 
 	cr = widget_cairo_create(background->widget);
@@ -706,53 +782,26 @@ background_draw(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	widget_get_allocation(widget, &allocation);
-	image = NULL;
-	if (background->image)
-		image = load_cairo_surface(background->image);
-	else if (background->color == 0)
-		image = load_cairo_surface(DATADIR "/weston/pattern.png");
-
-	if (image && background->type != -1) {
-		im_w = cairo_image_surface_get_width(image);
-		im_h = cairo_image_surface_get_height(image);
-		sx = im_w / allocation.width;
-		sy = im_h / allocation.height;
-
-		pattern = cairo_pattern_create_for_surface(image);
-
-		switch (background->type) {
-		case BACKGROUND_SCALE:
-			cairo_matrix_init_scale(&matrix, sx, sy);
-			cairo_pattern_set_matrix(pattern, &matrix);
-			cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
-			break;
-		case BACKGROUND_SCALE_CROP:
-			s = (sx < sy) ? sx : sy;
-			/* align center */
-			tx = (im_w - s * allocation.width) * 0.5;
-			ty = (im_h - s * allocation.height) * 0.5;
-			cairo_matrix_init_translate(&matrix, tx, ty);
-			cairo_matrix_scale(&matrix, s, s);
-			cairo_pattern_set_matrix(pattern, &matrix);
-			cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
-			break;
-		case BACKGROUND_TILE:
-			cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
-			break;
-		}
-
-		cairo_set_source(cr, pattern);
-		cairo_pattern_destroy (pattern);
-		cairo_surface_destroy(image);
-	} else {
+	scaled = background_get_scaled(background,
+				       desktop->background_image.image,
+				       allocation.width, allocation.height);
+
+	if (scaled) {
+		scale = window_get_buffer_scale(background->window);
+		cairo_translate(cr, allocation.x, allocation.y);
+		cairo_scale(cr, 1.0 / scale, 1.0 / scale);
+		cairo_set_source_surface(cr, scaled, 0, 0);
+		cairo_paint(cr);
+	} else if (background->color != 0 ||
+		   desktop->background_image.fds[0] == -1) {
+		/* the image failed or is not wanted */
 		set_hex_color(cr, background->color);
+		cairo_paint(cr);
 	}
 
-	cairo_paint(cr);
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
 
-	display = window_get_display(background->window);
 	opaque = wl_compositor_create_region(display_get_compositor(display));
 	wl_region_add(opaque, allocation.x, allocation.y,
 		      allocation.width, allocation.height);
@@ -763,6 +812,115 @@ background_draw(struct widget *widget, void *data)
 	check_desktop_ready(background->window);
 }
 
+static void *
+background_image_thread(void *data)
+{
+	struct desktop *desktop = data;
+	char c = 0;
+
+	desktop->background_image.image =
+		load_cairo_surface_scaled(desktop->background_image.path,
+					  0, 0, LOAD_IMAGE_CACHE);
+
+	if (write(desktop->background_image.fds[1], &c, sizeof c) < 0)
+		fprintf(stderr, "could not signal background decode: %m\n");
+
+	return NULL;
+}
+
+static void
+background_image_finish(struct desktop *desktop)
+{
+	pthread_join(desktop->background_image.thread, NULL);
+
+	display_unwatch_fd(desktop->display, desktop->background_image.fds[0]);
+	close(desktop->background_image.fds[0]);
+	close(desktop->background_image.fds[1]);
+	desktop->background_image.fds[0] = -1;
+	desktop->background_image.fds[1] = -1;
+}
+
+static void
+background_image_done(struct task *task, uint32_t events)
+{
+	struct desktop *desktop =
+		container_of(task, struct desktop, background_image.task);
+	struct output *output;
+	char c;
+
+	if (read(desktop->background_image.fds[0], &c, sizeof c) != sizeof c)
+		return;
+
+	background_image_finish(desktop);
+
+	wl_list_for_each(output, &desktop->outputs, link)
+		if (output->background)
+			widget_schedule_redraw(output->background->widget);
+}
+
+/* Decoding a large image takes long enough to hold up desktop_ready,
+ * so it runs on a thread while the backgrounds show their color. */
+static void
+background_image_load(struct desktop *desktop)
+{
+	struct weston_config_section *s;
+	uint32_t color;
+
+	desktop->background_image.fds[0] = -1;
+	desktop->background_image.fds[1] = -1;
+
+	s = weston_config_get_section(desktop->config, "shell", NULL, NULL);
+	weston_config_section_get_string(s, "background-image",
+					 &desktop->background_image.path,
+					 NULL);
+	weston_config_section_get_uint(s, "background-color", &color, 0);
+
+	if (!desktop->background_image.path && color == 0)
+		desktop->background_image.path =
+			strdup(DATADIR "/weston/pattern.png");
+	if (!desktop->background_image.path)
+		return;
+
+	if (pipe2(desktop->background_image.fds, O_CLOEXEC) < 0) {
+		fprintf(stderr, "could not create pipe: %m\n");
+		goto sync;
+	}
+
+	desktop->background_image.task.run = background_image_done;
+	display_watch_fd(desktop->display, desktop->background_image.fds[0],
+			 EPOLLIN, &desktop->background_image.task);
+
+	if (pthread_create(&desktop->background_image.thread, NULL,
+			   background_image_thread, desktop) != 0) {
+		fprintf(stderr, "could not start background decode\n");
+		display_unwatch_fd(desktop->display,
+				   desktop->background_image.fds[0]);
+		close(desktop->background_image.fds[0]);
+		close(desktop->background_image.fds[1]);
+		desktop->background_image.fds[0] = -1;
+		desktop->background_image.fds[1] = -1;
+		goto sync;
+	}
+
+	return;
+
+sync:
+	desktop->background_image.image =
+		load_cairo_surface_scaled(desktop->background_image.path,
+					  0, 0, LOAD_IMAGE_CACHE);
+}
+
+static void
+background_image_destroy(struct desktop *desktop)
+{
+	if (desktop->background_image.fds[0] != -1)
+		background_image_finish(desktop);
+
+	if (desktop->background_image.image)
+		cairo_surface_destroy(desktop->background_image.image);
+	free(desktop->background_image.path);
+}
+
 static void
 background_configure(void *data,
 		     struct desktop_shell *desktop_shell,
@@ -1039,7 +1197,8 @@ background_destroy(struct background *background)
 	widget_destroy(background->widget);
 	window_destroy(background->window);
 
-	free(background->image);
+	if (background->scaled)
+		cairo_surface_destroy(background->scaled);
 	free(background);
 }
 
@@ -1060,8 +1219,6 @@ background_create(struct desktop *desktop)
 				    WINDOW_PREFERRED_FORMAT_RGB565);
 
 	s = weston_config_get_section(desktop->config, "shell", NULL, NULL);
-	weston_config_section_get_string(s, "background-image",
-					 &background->image, NULL);
 	weston_config_section_get_uint(s, "background-color",
 				       &background->color, 0);
 
@@ -1307,6 +1464,78 @@ panel_add_launchers(struct panel *panel, struct desktop *desktop)
 	}
 }
 
+/* Arms the clock timer for the next minute of the wall clock, and
+ * to be woken if the wall clock is set meanwhile. */
+static int
+clock_timer_reset(struct desktop *desktop)
+{
+	struct itimerspec its;
+	struct timespec now;
+	int flags = TFD_TIMER_ABSTIME;
+
+#ifdef TFD_TIMER_CANCEL_ON_SET
+	flags |= TFD_TIMER_CANCEL_ON_SET;
+#endif
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	its.it_interval.tv_sec = 60;
+	its.it_interval.tv_nsec = 0;
+	its.it_value.tv_sec = (now.tv_sec / 60 + 1) * 60;
+	its.it_value.tv_nsec = 0;
+	if (timerfd_settime(desktop->clock_fd, flags, &its, NULL) < 0) {
+		fprintf(stderr, "could not set timerfd\n: %m");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+clock_func(struct task *task, uint32_t events)
+{
+	struct desktop *desktop =
+		container_of(task, struct desktop, clock_task);
+	struct output *output;
+	uint64_t exp;
+
+	if (read(desktop->clock_fd, &exp, sizeof exp) != sizeof exp) {
+		/* the wall clock was set */
+		if (errno != ECANCELED)
+			abort();
+		clock_timer_reset(desktop);
+	}
+
+	wl_list_for_each(output, &desktop->outputs, link)
+		if (output->panel && output->panel->clock)
+			widget_schedule_redraw(output->panel->clock->widget);
+}
+
+static void
+desktop_clock_init(struct desktop *desktop)
+{
+	desktop->clock_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+	if (desktop->clock_fd < 0) {
+		fprintf(stderr, "could not create timerfd\n: %m");
+		return;
+	}
+
+	desktop->clock_task.run = clock_func;
+	display_watch_fd(desktop->display, desktop->clock_fd,
+			 EPOLLIN, &desktop->clock_task);
+	clock_timer_reset(desktop);
+}
+
+static void
+desktop_clock_destroy(struct desktop *desktop)
+{
+	if (desktop->clock_fd < 0)
+		return;
+
+	display_unwatch_fd(desktop->display, desktop->clock_fd);
+	close(desktop->clock_fd);
+}
+
 int main(int argc, char *argv[])
 {
 	struct desktop desktop = { 0 };
@@ -1327,6 +1556,8 @@ int main(int argc, char *argv[])
 	}
 
 	display_set_user_data(desktop.display, &desktop);
+	background_image_load(&desktop);
+	desktop_clock_init(&desktop);
 	display_set_global_handler(desktop.display, global_handler);
 	display_set_global_handler_remove(desktop.display, global_handler_remove);
 
@@ -1345,6 +1576,8 @@ int main(int argc, char *argv[])
 	/* Cleanup */
 	grab_surface_destroy(&desktop);
 	desktop_destroy_outputs(&desktop);
+	background_image_destroy(&desktop);
+	desktop_clock_destroy(&desktop);
 	if (desktop.unlock_dialog)
 		unlock_dialog_destroy(desktop.unlock_dialog);
 	desktop_shell_destroy(desktop.shell);
@@ -50,6 +50,10 @@ struct dnd {
 	struct item *items[16];
 	int self_only;
 	struct dnd_drag *current_drag;
+
+	/* Drag icon buffers, refilled for every drag */
+	cairo_surface_t *drag_opaque;
+	cairo_surface_t *drag_translucent;
 };
 
 struct dnd_drag {
@@ -69,7 +73,7 @@ struct dnd_drag {
 };
 
 struct item {
-	cairo_surface_t *surface;
+	cairo_surface_t *surface;	/* rendered once, shared by seed */
 	int seed;
 	int x, y;
 };
@@ -86,8 +90,10 @@ static const int item_padding = 16;
 static const char flower_mime_type[] = "application/x-wayland-dnd-flower";
 static const char text_mime_type[] = "text/plain;charset=utf-8";
 
+/* Items with the same seed look the same, so a rendered surface
+ * can be passed in to share it instead of drawing the flower again. */
 static struct item *
-item_create(struct display *display, int x, int y, int seed)
+item_create(int x, int y, int seed, cairo_surface_t *surface)
 {
 	struct item *item;
 	struct timeval tv;
@@ -99,6 +105,14 @@ item_create(struct display *display, int x, int y, int seed)
 	
 	gettimeofday(&tv, NULL);
 	item->seed = seed ? seed : tv.tv_usec;
+	item->x = x;
+	item->y = y;
+
+	if (surface) {
+		item->surface = cairo_surface_reference(surface);
+		return item;
+	}
+
 	srandom(item->seed);
 	
 	const int petal_count = 3 + random() % 5;
@@ -111,16 +125,11 @@ item_create(struct display *display, int x, int y, int seed)
 	int i;
 	double t, dt = 2 * M_PI / (petal_count * 2);
 	double x1, y1, x2, y2, x3, y3;
-	struct rectangle rect;
-
 
-	rect.width = item_width;
-	rect.height = item_height;
-	item->surface =
-		display_create_surface(display, NULL, &rect, SURFACE_SHM);
-
-	item->x = x;
-	item->y = y;
+	/* Only ever a source for the window and the drag icons, so
+	 * it needs no buffer of its own */
+	item->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						   item_width, item_height);
 
 	cr = cairo_create(item->surface);
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
@@ -178,35 +187,68 @@ dnd_redraw_handler(struct widget *widget, void *data)
 {
 	struct dnd *dnd = data;
 	struct rectangle allocation;
+	struct item *item;
+	double x1, y1, x2, y2;
 	cairo_t *cr;
-	cairo_surface_t *surface;
 	unsigned int i;
 
-	surface = window_get_surface(dnd->window);
-	cr = cairo_create(surface);
+	/* Clipped to the area asked for in dnd_redraw_item(), the rest
+	 * of the buffer is still good */
+	cr = widget_cairo_create(dnd->widget);
 	widget_get_allocation(dnd->widget, &allocation);
 	cairo_rectangle(cr, allocation.x, allocation.y,
 			allocation.width, allocation.height);
+	cairo_clip(cr);
+	cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_set_source_rgba(cr, 0, 0, 0, 0.8);
-	cairo_fill(cr);
+	cairo_paint(cr);
 
-	cairo_rectangle(cr, allocation.x, allocation.y,
-			allocation.width, allocation.height);
-	cairo_clip(cr);
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 	for (i = 0; i < ARRAY_LENGTH(dnd->items); i++) {
-		if (!dnd->items[i])
+		item = dnd->items[i];
+		if (!item ||
+		    item->x + allocation.x >= x2 ||
+		    item->y + allocation.y >= y2 ||
+		    item->x + allocation.x + item_width <= x1 ||
+		    item->y + allocation.y + item_height <= y1)
 			continue;
-		cairo_set_source_surface(cr, dnd->items[i]->surface,
-					 dnd->items[i]->x + allocation.x,
-					 dnd->items[i]->y + allocation.y);
+		cairo_set_source_surface(cr, item->surface,
+					 item->x + allocation.x,
+					 item->y + allocation.y);
 		cairo_paint(cr);
 	}
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
+}
+
+static void
+dnd_redraw_item(struct dnd *dnd, struct item *item)
+{
+	struct rectangle allocation;
+
+	widget_get_allocation(dnd->widget, &allocation);
+	widget_schedule_redraw_area(dnd->widget,
+				    item->x + allocation.x,
+				    item->y + allocation.y,
+				    item_width, item_height);
+}
+
+/* A rendered surface for seed, if some item has one already */
+static cairo_surface_t *
+dnd_find_item_surface(struct dnd *dnd, int seed)
+{
+	unsigned int i;
+
+	if (dnd->current_drag && dnd->current_drag->item->seed == seed)
+		return dnd->current_drag->item->surface;
+
+	for (i = 0; i < ARRAY_LENGTH(dnd->items); i++)
+		if (dnd->items[i] && dnd->items[i]->seed == seed)
+			return dnd->items[i]->surface;
+
+	return NULL;
 }
 
 static void
@@ -324,8 +366,7 @@ data_source_cancelled(void *data, struct wl_data_source *source)
 
 	wl_surface_destroy(dnd_drag->drag_surface);
 
-	cairo_surface_destroy(dnd_drag->translucent);
-	cairo_surface_destroy(dnd_drag->opaque);
+	/* The icon buffers belong to dnd and serve the next drag too */
 	free(dnd_drag);
 }
 
@@ -336,7 +377,7 @@ static const struct wl_data_source_listener data_source_listener = {
 };
 
 static cairo_surface_t *
-create_drag_icon(struct dnd_drag *dnd_drag,
+create_drag_icon(struct dnd_drag *dnd_drag, cairo_surface_t **cache,
 		 struct item *item, int32_t x, int32_t y, double opacity)
 {
 	struct dnd *dnd = dnd_drag->dnd;
@@ -347,8 +388,10 @@ create_drag_icon(struct dnd_drag *dnd_drag,
 
 	rectangle.width = item_width;
 	rectangle.height = item_height;
-	surface = display_create_surface(dnd->display, NULL, &rectangle,
-					 SURFACE_SHM);
+	if (!*cache)
+		*cache = display_create_surface(dnd->display, NULL,
+						&rectangle, SURFACE_SHM);
+	surface = *cache;
 
 	cr = cairo_create(surface);
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
@@ -430,9 +473,11 @@ create_drag_source(struct dnd *dnd,
 					  serial);
 
 		dnd_drag->opaque =
-			create_drag_icon(dnd_drag, item, x, y, 1);
+			create_drag_icon(dnd_drag, &dnd->drag_opaque,
+					 item, x, y, 1);
 		dnd_drag->translucent =
-			create_drag_icon(dnd_drag, item, x, y, 0.2);
+			create_drag_icon(dnd_drag, &dnd->drag_translucent,
+					 item, x, y, 0.2);
 
 		if (dnd->self_only)
 			icon = dnd_drag->opaque;
@@ -447,7 +492,7 @@ create_drag_source(struct dnd *dnd,
 		wl_surface_commit(dnd_drag->drag_surface);
 
 		dnd->current_drag = dnd_drag;
-		window_schedule_redraw(dnd->window);
+		dnd_redraw_item(dnd, item);
 
 		return 0;
 	} else
@@ -558,13 +603,15 @@ dnd_receive_func(void *data, size_t len, int32_t x, int32_t y, void *user_data)
 	}
 		
 	widget_get_allocation(dnd->widget, &allocation);
-	item = item_create(dnd->display,
-			   x - message->x_offset - allocation.x,
+	item = item_create(x - message->x_offset - allocation.x,
 			   y - message->y_offset - allocation.y,
-			   message->seed);
+			   message->seed,
+			   dnd_find_item_surface(dnd, message->seed));
+	if (!item)
+		return;
 
 	dnd_add_item(dnd, item);
-	window_schedule_redraw(dnd->window);
+	dnd_redraw_item(dnd, item);
 }
 
 static void
@@ -614,7 +661,7 @@ dnd_create(struct display *display)
 		x = (i % 4) * (item_width + item_padding) + item_padding;
 		y = (i / 4) * (item_height + item_padding) + item_padding;
 		if ((i ^ (i >> 2)) & 1)
-			dnd->items[i] = item_create(display, x, y, 0);
+			dnd->items[i] = item_create(x, y, 0, NULL);
 		else
 			dnd->items[i] = NULL;
 	}
@@ -24,6 +24,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -63,6 +64,11 @@ struct text_entry {
 	} pending_commit;
 	struct wl_text_input *text_input;
 	PangoLayout *layout;
+	struct {
+		bool dirty;
+		uint32_t cursor;
+		int32_t start, end;
+	} layout_state;
 	struct {
 		xkb_mod_mask_t shift_mask;
 	} keysym;
@@ -174,6 +180,7 @@ static void text_entry_reset_preedit(struct text_entry *entry);
 static void text_entry_commit_and_reset(struct text_entry *entry);
 static void text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rectangle);
 static void text_entry_update(struct text_entry *entry);
+static void text_entry_update_layout(struct text_entry *entry);
 
 static void
 text_input_commit_string(void *data,
@@ -210,8 +217,6 @@ text_input_commit_string(void *data,
 				    entry->pending_commit.anchor);
 
 	memset(&entry->pending_commit, 0, sizeof entry->pending_commit);
-
-	widget_schedule_redraw(entry->widget);
 }
 
 static void
@@ -260,12 +265,13 @@ text_input_preedit_string(void *data,
 	text_entry_set_preedit(entry, text, entry->preedit_info.cursor);
 	entry->preedit.commit = strdup(commit);
 	entry->preedit.attr_list = pango_attr_list_ref(entry->preedit_info.attr_list);
+	entry->layout_state.dirty = true;
 
 	clear_pending_preedit(entry);
 
-	text_entry_update(entry);
+	text_entry_update_layout(entry);
 
-	widget_schedule_redraw(entry->widget);
+	text_entry_update(entry);
 }
 
 static void
@@ -404,7 +410,7 @@ text_input_keysym(void *data,
 
 		if (!(modifiers & entry->keysym.shift_mask))
 			entry->anchor = entry->cursor;
-		widget_schedule_redraw(entry->widget);
+		text_entry_update_layout(entry);
 
 		return;
 	}
@@ -421,7 +427,7 @@ text_input_keysym(void *data,
 
 		if (!(modifiers & entry->keysym.shift_mask))
 			entry->anchor = entry->cursor;
-		widget_schedule_redraw(entry->widget);
+		text_entry_update_layout(entry);
 
 		return;
 	}
@@ -593,14 +599,12 @@ static void
 redraw_handler(struct widget *widget, void *data)
 {
 	struct editor *editor = data;
-	cairo_surface_t *surface;
 	struct rectangle allocation;
 	cairo_t *cr;
 
-	surface = window_get_surface(editor->window);
 	widget_get_allocation(editor->widget, &allocation);
 
-	cr = cairo_create(surface);
+	cr = widget_cairo_create(editor->widget);
 	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
 	cairo_clip(cr);
 
@@ -617,7 +621,6 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
 }
 
 static void
@@ -672,11 +675,50 @@ text_entry_deactivate(struct text_entry *entry,
 				 seat);
 }
 
+static int
+text_offset_left(struct rectangle *allocation)
+{
+	return 10;
+}
+
+static int
+text_offset_top(struct rectangle *allocation)
+{
+	return allocation->height / 2;
+}
+
+/* The part of the layout text that depends on the cursor: the
+ * selection and the preedit string, as byte indices into the text. */
 static void
-text_entry_update_layout(struct text_entry *entry)
+text_entry_get_layout_span(struct text_entry *entry,
+			   int32_t *start, int32_t *end)
+{
+	*start = MIN(entry->cursor, entry->anchor);
+	*end = MAX(entry->cursor, entry->anchor);
+
+	if (entry->preedit.text)
+		*end += strlen(entry->preedit.text);
+}
+
+static bool
+text_entry_layout_is_current(struct text_entry *entry)
+{
+	int32_t start, end;
+
+	if (entry->layout_state.dirty)
+		return false;
+
+	text_entry_get_layout_span(entry, &start, &end);
+
+	return entry->layout_state.cursor == entry->cursor &&
+	       entry->layout_state.start == start &&
+	       entry->layout_state.end == end;
+}
+
+static char *
+text_entry_get_layout_text(struct text_entry *entry)
 {
 	char *text;
-	PangoAttrList *attr_list;
 
 	assert(entry->cursor <= (strlen(entry->text) +
 	       (entry->preedit.text ? strlen(entry->preedit.text) : 0)));
@@ -691,6 +733,14 @@ text_entry_update_layout(struct text_entry *entry)
 		text = strdup(entry->text);
 	}
 
+	return text;
+}
+
+static void
+text_entry_fill_layout(struct text_entry *entry, const char *text)
+{
+	PangoAttrList *attr_list;
+
 	if (entry->cursor != entry->anchor) {
 		int start_index = MIN(entry->cursor, entry->anchor);
 		int end_index = MAX(entry->cursor, entry->anchor);
@@ -726,13 +776,123 @@ text_entry_update_layout(struct text_entry *entry)
 		pango_attr_list_insert(attr_list, attr);
 	}
 
-	if (entry->layout) {
-		pango_layout_set_text(entry->layout, text, -1);
-		pango_layout_set_attributes(entry->layout, attr_list);
-	}
+	pango_layout_set_text(entry->layout, text, -1);
+	pango_layout_set_attributes(entry->layout, attr_list);
 
-	free(text);
 	pango_attr_list_unref(attr_list);
+
+	entry->layout_state.dirty = false;
+	entry->layout_state.cursor = entry->cursor;
+	text_entry_get_layout_span(entry,
+				   &entry->layout_state.start,
+				   &entry->layout_state.end);
+}
+
+/* Widens [*top, *bottom), in pango units, to the line holding index. */
+static void
+layout_extend_lines(PangoLayout *layout, int index, int *top, int *bottom)
+{
+	PangoRectangle pos;
+
+	pango_layout_get_cursor_pos(layout, index, &pos, NULL);
+	*top = MIN(*top, pos.y);
+	*bottom = MAX(*bottom, pos.y + pos.height);
+}
+
+/*
+ * Brings the layout up to date with the text, preedit and cursor, and
+ * schedules a redraw of the lines that changed: the ones the old and
+ * the new selection or preedit span, and the ones holding edited text,
+ * down to the bottom of the entry if lines were added or removed.  A
+ * cursor moving through plain text keeps the laid out text as it is.
+ */
+static void
+text_entry_update_layout(struct text_entry *entry)
+{
+	struct rectangle allocation;
+	const char *old_text;
+	char *text;
+	int top = INT_MAX, bottom = INT_MIN;
+	int length, old_length, prefix, suffix, lines, y;
+
+	if (!entry->layout) {
+		widget_schedule_redraw(entry->widget);
+		return;
+	}
+
+	if (text_entry_layout_is_current(entry))
+		return;
+
+	layout_extend_lines(entry->layout, entry->layout_state.start,
+			    &top, &bottom);
+	layout_extend_lines(entry->layout, entry->layout_state.end,
+			    &top, &bottom);
+
+	if (entry->layout_state.dirty || entry->preedit.text ||
+	    entry->cursor != entry->anchor ||
+	    entry->layout_state.start != entry->layout_state.end) {
+		text = text_entry_get_layout_text(entry);
+		old_text = pango_layout_get_text(entry->layout);
+		length = strlen(text);
+		old_length = strlen(old_text);
+
+		for (prefix = 0; prefix < MIN(length, old_length); prefix++)
+			if (text[prefix] != old_text[prefix])
+				break;
+		while (prefix > 0 && (text[prefix] & 0xc0) == 0x80)
+			prefix--;
+
+		for (suffix = 0; suffix < MIN(length, old_length) - prefix; suffix++)
+			if (text[length - suffix - 1] !=
+			    old_text[old_length - suffix - 1])
+				break;
+		while (suffix > 0 && (text[length - suffix] & 0xc0) == 0x80)
+			suffix--;
+
+		if (prefix < old_length || prefix < length) {
+			layout_extend_lines(entry->layout, prefix,
+					    &top, &bottom);
+			layout_extend_lines(entry->layout, old_length - suffix,
+					    &top, &bottom);
+		}
+
+		lines = pango_layout_get_line_count(entry->layout);
+		text_entry_fill_layout(entry, text);
+		if (pango_layout_get_line_count(entry->layout) != lines)
+			bottom = INT_MAX;
+
+		if (prefix < old_length || prefix < length) {
+			layout_extend_lines(entry->layout, prefix,
+					    &top, &bottom);
+			layout_extend_lines(entry->layout, length - suffix,
+					    &top, &bottom);
+		}
+
+		free(text);
+	} else {
+		entry->layout_state.cursor = entry->cursor;
+		text_entry_get_layout_span(entry,
+					   &entry->layout_state.start,
+					   &entry->layout_state.end);
+	}
+
+	layout_extend_lines(entry->layout, entry->layout_state.start,
+			    &top, &bottom);
+	layout_extend_lines(entry->layout, entry->layout_state.end,
+			    &top, &bottom);
+
+	/* A pixel around the lines for the antialiased cursor. */
+	widget_get_allocation(entry->widget, &allocation);
+	y = allocation.y + text_offset_top(&allocation) +
+		PANGO_PIXELS_FLOOR(top) - 1;
+	if (bottom == INT_MAX)
+		bottom = allocation.y + allocation.height;
+	else
+		bottom = allocation.y + text_offset_top(&allocation) +
+			PANGO_PIXELS_CEIL(bottom) + 1;
+
+	widget_schedule_redraw_area(entry->widget, allocation.x, y,
+				    allocation.width, bottom - y);
 }
 
 static void
@@ -773,6 +933,7 @@ text_entry_insert_at_cursor(struct text_entry *entry, const char *text,
 
 	free(entry->text);
 	entry->text = new_text;
+	entry->layout_state.dirty = true;
 	if (anchor >= 0)
 		entry->anchor = entry->cursor + strlen(text) + anchor;
 	else
@@ -785,8 +946,6 @@ text_entry_insert_at_cursor(struct text_entry *entry, const char *text,
 
 	text_entry_update_layout(entry);
 
-	widget_schedule_redraw(entry->widget);
-
 	text_entry_update(entry);
 }
 
@@ -803,6 +962,8 @@ text_entry_reset_preedit(struct text_entry *entry)
 
 	pango_attr_list_unref(entry->preedit.attr_list);
 	entry->preedit.attr_list = NULL;
+
+	entry->layout_state.dirty = true;
 }
 
 static void
@@ -819,6 +980,8 @@ text_entry_commit_and_reset(struct text_entry *entry)
 		free(commit);
 	}
 
+	text_entry_update_layout(entry);
+
 	wl_text_input_reset(entry->text_input);
 	text_entry_update(entry);
 	entry->reset_serial = entry->serial;
@@ -831,15 +994,15 @@ text_entry_set_preedit(struct text_entry *entry,
 {
 	text_entry_reset_preedit(entry);
 
-	if (!preedit_text)
+	if (!preedit_text) {
+		text_entry_update_layout(entry);
 		return;
+	}
 
 	entry->preedit.text = strdup(preedit_text);
 	entry->preedit.cursor = preedit_cursor;
 
 	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
 }
 
 static uint32_t
@@ -914,8 +1077,6 @@ text_entry_set_cursor_position(struct text_entry *entry,
 
 	text_entry_update_layout(entry);
 
-	widget_schedule_redraw(entry->widget);
-
 	text_entry_update(entry);
 }
 
@@ -933,6 +1094,7 @@ text_entry_delete_text(struct text_entry *entry,
 	memmove(entry->text + index,
 		entry->text + index + length,
 		l + 1);
+	entry->layout_state.dirty = true;
 
 	if (entry->cursor > (index + length))
 		entry->cursor -= length;
@@ -943,8 +1105,6 @@ text_entry_delete_text(struct text_entry *entry,
 
 	text_entry_update_layout(entry);
 
-	widget_schedule_redraw(entry->widget);
-
 	text_entry_update(entry);
 }
 
@@ -1011,30 +1171,16 @@ text_entry_draw_cursor(struct text_entry *entry, cairo_t *cr)
 	cairo_stroke(cr);
 }
 
-static int
-text_offset_left(struct rectangle *allocation)
-{
-	return 10;
-}
-
-static int
-text_offset_top(struct rectangle *allocation)
-{
-	return allocation->height / 2;
-}
-
 static void
 text_entry_redraw_handler(struct widget *widget, void *data)
 {
 	struct text_entry *entry = data;
-	cairo_surface_t *surface;
 	struct rectangle allocation;
 	cairo_t *cr;
 
-	surface = window_get_surface(entry->window);
 	widget_get_allocation(entry->widget, &allocation);
 
-	cr = cairo_create(surface);
+	cr = widget_cairo_create(entry->widget);
 	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
 	cairo_clip(cr);
 
@@ -1062,12 +1208,19 @@ text_entry_redraw_handler(struct widget *widget, void *data)
 			text_offset_left(&allocation),
 			text_offset_top(&allocation));
 
-	if (!entry->layout)
+	if (!entry->layout) {
 		entry->layout = pango_cairo_create_layout(cr);
-	else
+		entry->layout_state.dirty = true;
+	} else {
 		pango_cairo_update_layout(cr, entry->layout);
+	}
 
-	text_entry_update_layout(entry);
+	if (!text_entry_layout_is_current(entry)) {
+		char *text = text_entry_get_layout_text(entry);
+
+		text_entry_fill_layout(entry, text);
+		free(text);
+	}
 
 	pango_cairo_show_layout(cr, entry->layout);
 
@@ -1077,7 +1230,6 @@ text_entry_redraw_handler(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
 }
 
 static int
@@ -1262,7 +1414,6 @@ key_handler(struct window *window,
 				entry->cursor = new_char - entry->text;
 				if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 					entry->anchor = entry->cursor;
-				widget_schedule_redraw(entry->widget);
 			}
 			break;
 		case XKB_KEY_Right:
@@ -1273,7 +1424,6 @@ key_handler(struct window *window,
 				entry->cursor = new_char - entry->text;
 				if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 					entry->anchor = entry->cursor;
-				widget_schedule_redraw(entry->widget);
 			}
 			break;
 		case XKB_KEY_Up:
@@ -1282,7 +1432,6 @@ key_handler(struct window *window,
 			move_up(entry->text, &entry->cursor);
 			if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 				entry->anchor = entry->cursor;
-			widget_schedule_redraw(entry->widget);
 			break;
 		case XKB_KEY_Down:
 			text_entry_commit_and_reset(entry);
@@ -1290,7 +1439,6 @@ key_handler(struct window *window,
 			move_down(entry->text, &entry->cursor);
 			if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 				entry->anchor = entry->cursor;
-			widget_schedule_redraw(entry->widget);
 			break;
 		case XKB_KEY_Escape:
 			break;
@@ -1304,7 +1452,7 @@ key_handler(struct window *window,
 			break;
 	}
 
-	widget_schedule_redraw(entry->widget);
+	text_entry_update_layout(entry);
 }
 
 static void
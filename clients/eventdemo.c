@@ -27,6 +27,13 @@
  * Heavily commented demo program that can report all events that are
  * dispatched to the window. For other functionality, eg. opengl/egl,
  * drag and drop, etc. have a look at the other demos.
+ *
+ * With --stats it also measures the input path: the event rate, the
+ * jitter between event timestamps and the delay from an event's
+ * timestamp to the client receiving it, per kind of event. With
+ * --touch-marker it draws the last touch point together with the
+ * event and frame times, so a camera shot of the screen can be lined
+ * up with compositor traces.
  * \author Tim Wiederhake
  */
 
@@ -34,6 +41,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
 
 #include <cairo.h>
 
@@ -78,6 +92,58 @@ static int log_axis = 0;
 /** set to log motion events */
 static int log_motion = 0;
 
+/** if non-zero, seconds between input statistics reports */
+static int stats_interval = 0;
+
+/** set to draw the last touch point with frame timestamps */
+static int touch_marker = 0;
+
+/**
+ * \brief Kinds of events the statistics are kept for
+ */
+enum event_class {
+	EVENT_MOTION,
+	EVENT_BUTTON,
+	EVENT_AXIS,
+	EVENT_KEY,
+	EVENT_TOUCH,
+	EVENT_CLASS_COUNT
+};
+
+static const char * const event_class_names[] = {
+	[EVENT_MOTION] = "motion",
+	[EVENT_BUTTON] = "button",
+	[EVENT_AXIS] = "axis",
+	[EVENT_KEY] = "key",
+	[EVENT_TOUCH] = "touch",
+};
+
+/**
+ * \struct event_stats
+ * \brief Input statistics of one kind of event for one report period
+ *
+ * Intervals and jitter are taken from the event timestamps, so they
+ * show the device and compositor side. The delay compares the event
+ * timestamp to CLOCK_MONOTONIC on receipt, which is only meaningful
+ * when the compositor stamps events on that clock, as evdev does.
+ */
+struct event_stats {
+	uint32_t count;
+
+	int has_last;
+	uint32_t last_time;
+	int has_interval;
+	uint32_t last_interval;
+
+	uint64_t interval_sum;
+	uint32_t intervals;
+	uint64_t jitter_sum;
+	uint32_t jitters;
+
+	int64_t delay_sum;
+	int32_t delay_max;
+};
+
 /**
  * \struct eventdemo
  * \brief Holds all data the program needs per window
@@ -91,8 +157,218 @@ struct eventdemo {
 	struct display *display;
 
 	int x, y, w, h;
+
+	struct event_stats stats[EVENT_CLASS_COUNT];
+	struct timespec stats_start;
+	struct task stats_task;
+	int stats_fd;
+
+	/* last touch point, for --touch-marker */
+	int touch_active;
+	float touch_x, touch_y;
+	uint32_t touch_time;
+	uint32_t frame_count;
 };
 
+/**
+ * \brief Current CLOCK_MONOTONIC time in milliseconds, wrapping like
+ * the event timestamps do
+ */
+static uint32_t
+time_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * \brief Account an event in the statistics of its kind.
+ * \param e eventdemo instance
+ * \param class kind of the event
+ * \param time timestamp of the event
+ */
+static void
+stats_record(struct eventdemo *e, enum event_class class, uint32_t time)
+{
+	struct event_stats *s = &e->stats[class];
+	uint32_t interval;
+	int32_t delay;
+
+	if (!stats_interval)
+		return;
+
+	s->count++;
+
+	delay = (int32_t) (time_now_ms() - time);
+	s->delay_sum += delay;
+	if (s->count == 1 || delay > s->delay_max)
+		s->delay_max = delay;
+
+	if (s->has_last) {
+		interval = time - s->last_time;
+		s->interval_sum += interval;
+		s->intervals++;
+
+		/* Mean change between successive intervals, as RFC 3550
+		 * does for packets */
+		if (s->has_interval) {
+			s->jitter_sum += interval > s->last_interval ?
+				interval - s->last_interval :
+				s->last_interval - interval;
+			s->jitters++;
+		}
+		s->last_interval = interval;
+		s->has_interval = 1;
+	}
+	s->last_time = time;
+	s->has_last = 1;
+}
+
+/**
+ * \brief Print the statistics of the period that ended and start a new
+ * one.  Intervals carry over, so a steady stream of events does not
+ * lose one interval per period.
+ */
+static void
+stats_report(struct eventdemo *e)
+{
+	struct event_stats *s;
+	struct timespec now;
+	double period;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	period = (now.tv_sec - e->stats_start.tv_sec) +
+		(now.tv_nsec - e->stats_start.tv_nsec) / 1e9;
+	e->stats_start = now;
+
+	for (i = 0; i < EVENT_CLASS_COUNT; i++) {
+		s = &e->stats[i];
+		if (s->count == 0)
+			continue;
+
+		printf("stats %s: events: %u, rate: %.1f Hz, "
+		       "interval: %.2f ms, jitter: %.2f ms, "
+		       "delay: %.2f ms, max delay: %d ms\n",
+		       event_class_names[i], s->count,
+		       period > 0 ? s->count / period : 0.0,
+		       s->intervals ?
+				(double) s->interval_sum / s->intervals : 0.0,
+		       s->jitters ?
+				(double) s->jitter_sum / s->jitters : 0.0,
+		       (double) s->delay_sum / s->count, s->delay_max);
+
+		s->count = 0;
+		s->interval_sum = 0;
+		s->intervals = 0;
+		s->jitter_sum = 0;
+		s->jitters = 0;
+		s->delay_sum = 0;
+		s->delay_max = 0;
+	}
+	fflush(stdout);
+}
+
+/**
+ * \brief CALLBACK function, the statistics timer expired
+ * \param task task of the timer
+ * \param events epoll events
+ */
+static void
+stats_timer_func(struct task *task, uint32_t events)
+{
+	struct eventdemo *e = container_of(task, struct eventdemo, stats_task);
+	uint64_t exp;
+
+	if (read(e->stats_fd, &exp, sizeof exp) != sizeof exp &&
+	    errno != EAGAIN)
+		return;
+
+	stats_report(e);
+}
+
+/**
+ * \brief Start reporting statistics every \c stats_interval seconds.
+ * \param e eventdemo instance
+ */
+static void
+stats_init(struct eventdemo *e)
+{
+	struct itimerspec its;
+
+	e->stats_fd = -1;
+	memset(e->stats, 0, sizeof e->stats);
+	clock_gettime(CLOCK_MONOTONIC, &e->stats_start);
+
+	if (!stats_interval)
+		return;
+
+	e->stats_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (e->stats_fd < 0) {
+		fprintf(stderr, "could not create timerfd: %m\n");
+		stats_interval = 0;
+		return;
+	}
+
+	its.it_interval.tv_sec = stats_interval;
+	its.it_interval.tv_nsec = 0;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(e->stats_fd, 0, &its, NULL) < 0) {
+		fprintf(stderr, "could not set timerfd: %m\n");
+		close(e->stats_fd);
+		e->stats_fd = -1;
+		stats_interval = 0;
+		return;
+	}
+
+	e->stats_task.run = stats_timer_func;
+	display_watch_fd(e->display, e->stats_fd, EPOLLIN, &e->stats_task);
+}
+
+/**
+ * \brief Draw the last touch point and the times to match a photo of
+ * the screen against.
+ * \param e eventdemo instance
+ * \param cr cairo context of the window
+ *
+ * The frame time is taken when the frame is drawn, so it comes before
+ * the compositor's repaint of it by up to a frame.
+ */
+static void
+draw_touch_marker(struct eventdemo *e, cairo_t *cr)
+{
+	struct timespec now;
+	char text[128];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	e->frame_count++;
+
+	if (e->touch_active) {
+		cairo_set_source_rgba(cr, 1, 1, 1, 1);
+		cairo_set_line_width(cr, 2);
+		cairo_move_to(cr, e->touch_x - 20, e->touch_y);
+		cairo_line_to(cr, e->touch_x + 20, e->touch_y);
+		cairo_move_to(cr, e->touch_x, e->touch_y - 20);
+		cairo_line_to(cr, e->touch_x, e->touch_y + 20);
+		cairo_stroke(cr);
+	}
+
+	snprintf(text, sizeof text, "frame %u at %ld.%03ld, touch at %u",
+		 e->frame_count, (long) now.tv_sec,
+		 now.tv_nsec / 1000000, e->touch_time);
+	cairo_set_source_rgba(cr, 1, 1, 1, 1);
+	cairo_set_font_size(cr, 16);
+	cairo_move_to(cr, 10, 30);
+	cairo_show_text(cr, text);
+
+	printf("marker frame: %u, time: %ld.%06ld, x: %f, y: %f, "
+	       "touch time: %u\n",
+	       e->frame_count, (long) now.tv_sec, now.tv_nsec / 1000,
+	       e->touch_x, e->touch_y, e->touch_time);
+}
+
 /**
  * \brief CALLBACK function, Wayland requests the window to redraw.
  * \param widget widget to be redrawn
@@ -125,6 +401,9 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_set_source_rgba(cr, 1.0, 0, 0, 1);
 	cairo_fill(cr);
 
+	if (touch_marker)
+		draw_touch_marker(e, cr);
+
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
 }
@@ -196,8 +475,11 @@ key_handler(struct window *window, struct input *input, uint32_t time,
             uint32_t key, uint32_t unicode, enum wl_keyboard_key_state state,
 	    void *data)
 {
+	struct eventdemo *e = data;
 	uint32_t modifiers = input_get_modifiers(input);
 
+	stats_record(e, EVENT_KEY, time);
+
 	if(!log_key)
 		return;
 
@@ -221,8 +503,11 @@ static void
 button_handler(struct widget *widget, struct input *input, uint32_t time,
 	       uint32_t button, enum wl_pointer_button_state state, void *data)
 {
+	struct eventdemo *e = data;
 	int32_t x, y;
 
+	stats_record(e, EVENT_BUTTON, time);
+
 	if (!log_button)
 		return;
 
@@ -247,6 +532,10 @@ static void
 axis_handler(struct widget *widget, struct input *input, uint32_t time,
 	     uint32_t axis, wl_fixed_t value, void *data)
 {
+	struct eventdemo *e = data;
+
+	stats_record(e, EVENT_AXIS, time);
+
 	if (!log_axis)
 		return;
 
@@ -276,6 +565,8 @@ motion_handler(struct widget *widget, struct input *input, uint32_t time,
 {
 	struct eventdemo *e = data;
 
+	stats_record(e, EVENT_MOTION, time);
+
 	if (log_motion) {
 		printf("motion time: %d, x: %f, y: %f\n", time, x, y);
 	}
@@ -287,6 +578,78 @@ motion_handler(struct widget *widget, struct input *input, uint32_t time,
 	return CURSOR_LEFT_PTR;
 }
 
+/**
+ * \brief CALLBACK function, Wayland informs about a new touch point
+ * \param widget widget
+ * \param input input device that caused the touch event
+ * \param serial serial of the event
+ * \param time time the event happened
+ * \param id touch point id
+ * \param x x position relative to the window
+ * \param y y position relative to the window
+ * \param data user data associated to the window
+ */
+static void
+touch_down_handler(struct widget *widget, struct input *input,
+		   uint32_t serial, uint32_t time, int32_t id,
+		   float x, float y, void *data)
+{
+	struct eventdemo *e = data;
+
+	stats_record(e, EVENT_TOUCH, time);
+
+	if (!touch_marker)
+		return;
+
+	e->touch_active = 1;
+	e->touch_x = x;
+	e->touch_y = y;
+	e->touch_time = time;
+	widget_schedule_redraw(e->widget);
+}
+
+/**
+ * \brief CALLBACK function, Wayland informs about touch point motion
+ * \param widget widget
+ * \param input input device that caused the touch event
+ * \param time time the event happened
+ * \param id touch point id
+ * \param x x position relative to the window
+ * \param y y position relative to the window
+ * \param data user data associated to the window
+ */
+static void
+touch_motion_handler(struct widget *widget, struct input *input,
+		     uint32_t time, int32_t id, float x, float y, void *data)
+{
+	touch_down_handler(widget, input, 0, time, id, x, y, data);
+}
+
+/**
+ * \brief CALLBACK function, Wayland informs about a touch point lifting
+ * \param widget widget
+ * \param input input device that caused the touch event
+ * \param serial serial of the event
+ * \param time time the event happened
+ * \param id touch point id
+ * \param data user data associated to the window
+ */
+static void
+touch_up_handler(struct widget *widget, struct input *input,
+		 uint32_t serial, uint32_t time, int32_t id, void *data)
+{
+	struct eventdemo *e = data;
+
+	stats_record(e, EVENT_TOUCH, time);
+
+	if (!touch_marker)
+		return;
+
+	e->touch_active = 0;
+	e->touch_time = time;
+	widget_schedule_redraw(e->widget);
+}
+
 /**
  * \brief Create and initialise a new eventdemo window.
  * The returned eventdemo instance should be destroyed using \c eventdemo_destroy().
@@ -297,7 +660,7 @@ eventdemo_create(struct display *d)
 {
 	struct eventdemo *e;
 
-	e = malloc(sizeof (struct eventdemo));
+	e = zalloc(sizeof (struct eventdemo));
 	if(e == NULL)
 		return NULL;
 
@@ -348,6 +711,14 @@ eventdemo_create(struct display *d)
 	/* Set the callback axis handler for the window */
 	widget_set_axis_handler(e->widget, axis_handler);
 
+	/* Set the callback touch handlers for the window */
+	widget_set_touch_down_handler(e->widget, touch_down_handler);
+	widget_set_touch_motion_handler(e->widget, touch_motion_handler);
+	widget_set_touch_up_handler(e->widget, touch_up_handler);
+
+	/* Report input statistics periodically if asked to */
+	stats_init(e);
+
 	/* Initial drawing of the window */
 	window_schedule_resize(e->window, width, height);
 
@@ -359,6 +730,12 @@ eventdemo_create(struct display *d)
  */
 static void eventdemo_destroy(struct eventdemo * eventdemo)
 {
+	if (eventdemo->stats_fd >= 0) {
+		stats_report(eventdemo);
+		display_unwatch_fd(eventdemo->display, eventdemo->stats_fd);
+		close(eventdemo->stats_fd);
+	}
+
 	widget_destroy(eventdemo->widget);
 	window_destroy(eventdemo->window);
 	free(eventdemo);
@@ -380,6 +757,8 @@ static const struct weston_option eventdemo_options[] = {
 	{ WESTON_OPTION_BOOLEAN, "log-button", '0', &log_button },
 	{ WESTON_OPTION_BOOLEAN, "log-axis", '0', &log_axis },
 	{ WESTON_OPTION_BOOLEAN, "log-motion", '0', &log_motion },
+	{ WESTON_OPTION_INTEGER, "stats", 0, &stats_interval },
+	{ WESTON_OPTION_BOOLEAN, "touch-marker", 0, &touch_marker },
 };
 
 /**
@@ -42,6 +42,19 @@
 #include "window.h"
 #include "../shared/cairo-util.h"
 
+/* Zoomed out views are drawn from a pyramid of half size copies of the
+ * image, cut into tiles that are made on demand from the four tiles
+ * below them and kept in a cache of at most TILE_CACHE_SIZE bytes. */
+#define TILE_SIZE	256
+#define TILE_CACHE_SIZE	(64 * 1024 * 1024)
+
+struct tile {
+	struct wl_list link;
+	int level, x, y;
+	cairo_surface_t *surface;
+	size_t size;
+};
+
 struct image {
 	struct window *window;
 	struct widget *widget;
@@ -60,6 +73,10 @@ struct image {
 
 	bool initialized;
 	cairo_matrix_t matrix;
+
+	int max_level;
+	struct wl_list tiles;	/* most recently used first */
+	size_t tiles_size;
 };
 
 static double
@@ -71,6 +88,178 @@ get_scale(struct image *image)
 	return image->matrix.xx;
 }
 
+static int
+level_size(int size, int level)
+{
+	return (size + (1 << level) - 1) >> level;
+}
+
+static void
+tile_destroy(struct image *image, struct tile *tile)
+{
+	image->tiles_size -= tile->size;
+	cairo_surface_destroy(tile->surface);
+	wl_list_remove(&tile->link);
+	free(tile);
+}
+
+static struct tile *
+image_get_tile(struct image *image, int level, int x, int y)
+{
+	struct tile *tile, *next;
+	cairo_surface_t *source;
+	cairo_t *cr;
+	int width, height, i, j, cx, cy;
+
+	wl_list_for_each(tile, &image->tiles, link) {
+		if (tile->level == level && tile->x == x && tile->y == y) {
+			wl_list_remove(&tile->link);
+			wl_list_insert(&image->tiles, &tile->link);
+			return tile;
+		}
+	}
+
+	tile = zalloc(sizeof *tile);
+	if (!tile)
+		return NULL;
+
+	width = level_size(image->width, level) - x * TILE_SIZE;
+	height = level_size(image->height, level) - y * TILE_SIZE;
+	if (width > TILE_SIZE)
+		width = TILE_SIZE;
+	if (height > TILE_SIZE)
+		height = TILE_SIZE;
+
+	tile->level = level;
+	tile->x = x;
+	tile->y = y;
+	tile->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						   width, height);
+
+	/* Sampling bilinearly at exactly half size averages each 2x2
+	 * block of the level below. */
+	cr = cairo_create(tile->surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_scale(cr, 0.5, 0.5);
+	if (level == 1) {
+		cairo_set_source_surface(cr, image->image,
+					 -x * 2 * TILE_SIZE,
+					 -y * 2 * TILE_SIZE);
+		cairo_pattern_set_filter(cairo_get_source(cr),
+					 CAIRO_FILTER_BILINEAR);
+		cairo_pattern_set_extend(cairo_get_source(cr),
+					 CAIRO_EXTEND_PAD);
+		cairo_paint(cr);
+	} else {
+		for (j = 0; j < 2; j++) {
+			for (i = 0; i < 2; i++) {
+				cx = x * 2 + i;
+				cy = y * 2 + j;
+				if (cx * TILE_SIZE >=
+				    level_size(image->width, level - 1) ||
+				    cy * TILE_SIZE >=
+				    level_size(image->height, level - 1))
+					continue;
+
+				next = image_get_tile(image, level - 1, cx, cy);
+				if (!next)
+					continue;
+
+				source = next->surface;
+				cairo_set_source_surface(cr, source,
+							 i * TILE_SIZE,
+							 j * TILE_SIZE);
+				cairo_pattern_set_filter(cairo_get_source(cr),
+							 CAIRO_FILTER_BILINEAR);
+				cairo_pattern_set_extend(cairo_get_source(cr),
+							 CAIRO_EXTEND_PAD);
+				cairo_rectangle(cr, i * TILE_SIZE, j * TILE_SIZE,
+						cairo_image_surface_get_width(source),
+						cairo_image_surface_get_height(source));
+				cairo_fill(cr);
+			}
+		}
+	}
+	cairo_destroy(cr);
+
+	tile->size = cairo_image_surface_get_stride(tile->surface) * height;
+	image->tiles_size += tile->size;
+	wl_list_insert(&image->tiles, &tile->link);
+
+	while (image->tiles_size > TILE_CACHE_SIZE) {
+		next = container_of(image->tiles.prev, struct tile, link);
+		if (next == tile)
+			break;
+		tile_destroy(image, next);
+	}
+
+	return tile;
+}
+
+/* Draws the part of the image visible in the allocation from the
+ * pyramid level closest to, and no smaller than, the current scale. */
+static void
+image_draw_tiles(struct image *image, cairo_t *cr,
+		 struct rectangle *allocation)
+{
+	double scale = get_scale(image);
+	double x1, y1, x2, y2;
+	int level, tx, ty, tx1, ty1, tx2, ty2;
+	struct tile *tile;
+
+	level = 0;
+	while (level < image->max_level && scale * (2 << level) <= 1.0)
+		level++;
+
+	if (level == 0) {
+		cairo_set_source_surface(cr, image->image, 0, 0);
+		cairo_paint(cr);
+		return;
+	}
+
+	x1 = -image->matrix.x0 / scale;
+	y1 = -image->matrix.y0 / scale;
+	x2 = x1 + allocation->width / scale;
+	y2 = y1 + allocation->height / scale;
+
+	tx1 = floor(x1 / (TILE_SIZE << level));
+	ty1 = floor(y1 / (TILE_SIZE << level));
+	tx2 = ceil(x2 / (TILE_SIZE << level));
+	ty2 = ceil(y2 / (TILE_SIZE << level));
+	if (tx1 < 0)
+		tx1 = 0;
+	if (ty1 < 0)
+		ty1 = 0;
+	tx = (level_size(image->width, level) + TILE_SIZE - 1) / TILE_SIZE;
+	ty = (level_size(image->height, level) + TILE_SIZE - 1) / TILE_SIZE;
+	if (tx2 > tx)
+		tx2 = tx;
+	if (ty2 > ty)
+		ty2 = ty;
+
+	/* Without antialiasing neighbouring tiles meet without seams. */
+	cairo_scale(cr, 1 << level, 1 << level);
+	cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+
+	for (ty = ty1; ty < ty2; ty++) {
+		for (tx = tx1; tx < tx2; tx++) {
+			tile = image_get_tile(image, level, tx, ty);
+			if (!tile)
+				continue;
+
+			cairo_set_source_surface(cr, tile->surface,
+						 tx * TILE_SIZE,
+						 ty * TILE_SIZE);
+			cairo_pattern_set_extend(cairo_get_source(cr),
+						 CAIRO_EXTEND_PAD);
+			cairo_rectangle(cr, tx * TILE_SIZE, ty * TILE_SIZE,
+					cairo_image_surface_get_width(tile->surface),
+					cairo_image_surface_get_height(tile->surface));
+			cairo_fill(cr);
+		}
+	}
+}
+
 static void
 clamp_view(struct image *image)
 {
@@ -143,6 +332,11 @@ redraw_handler(struct widget *widget, void *data)
 		image->height = height;
 		cairo_matrix_init_scale(&image->matrix, scale, scale);
 
+		image->max_level = 0;
+		while (level_size(image->width, image->max_level) > TILE_SIZE ||
+		       level_size(image->height, image->max_level) > TILE_SIZE)
+			image->max_level++;
+
 		clamp_view(image);
 	}
 
@@ -151,9 +345,8 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_matrix_multiply(&matrix, &matrix, &translate);
 	cairo_set_matrix(cr, &matrix);
 
-	cairo_set_source_surface(cr, image->image, 0, 0);
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	cairo_paint(cr);
+	image_draw_tiles(image, cr, &allocation);
 
 	cairo_pop_group_to_source(cr);
 	cairo_paint(cr);
@@ -341,6 +534,7 @@ static void
 close_handler(void *data)
 {
 	struct image *image = data;
+	struct tile *tile, *next;
 
 	*image->image_counter -= 1;
 
@@ -350,6 +544,10 @@ close_handler(void *data)
 	widget_destroy(image->widget);
 	window_destroy(image->window);
 
+	wl_list_for_each_safe(tile, next, &image->tiles, link)
+		tile_destroy(image, tile);
+	cairo_surface_destroy(image->image);
+	free(image->filename);
 	free(image);
 }
 
@@ -386,6 +584,7 @@ image_create(struct display *display, const char *filename,
 	image->image_counter = image_counter;
 	*image_counter += 1;
 	image->initialized = false;
+	wl_list_init(&image->tiles);
 
 	window_set_user_data(image->window, image);
 	widget_set_redraw_handler(image->widget, redraw_handler);
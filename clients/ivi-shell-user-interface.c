@@ -35,6 +35,8 @@
 #include <wayland-cursor.h>
 #include "../shared/cairo-util.h"
 #include "../shared/config-parser.h"
+#include "../shared/image-loader.h"
+#include "../shared/os-compatibility.h"
 #include "ivi-application-client-protocol.h"
 #include "ivi-hmi-controller-client-protocol.h"
 
@@ -83,11 +85,24 @@ enum cursor_type {
 
     CURSOR_BLANK
 };
+
+/* The HMI's surfaces are all static, so they are sub-allocated from one
+ * shm pool rather than each having their own. The pool only grows;
+ * slots are addressed by offset, as growing it may move the mapping. */
+struct hmi_shm_pool {
+    struct wl_shm_pool      *pool;
+    int                     fd;
+    void                    *data;
+    int32_t                 size;
+    int32_t                 used;
+};
+
 struct wlContextCommon {
     struct wl_display      *wlDisplay;
     struct wl_registry     *wlRegistry;
     struct wl_compositor   *wlCompositor;
     struct wl_shm          *wlShm;
+    struct hmi_shm_pool    *shmPool;
     struct wl_seat         *wlSeat;
     struct wl_pointer      *wlPointer;
     struct wl_touch        *wlTouch;
@@ -110,7 +125,14 @@ struct wlContextStruct {
     struct wl_buffer        *wlBuffer;
     uint32_t                formats;
     cairo_surface_t         *ctx_image;
-    void                    *data;
+    int32_t                 offset;
+    int32_t                 width;
+    int32_t                 height;
+    int32_t                 stride;
+    /* a solid color surface is a single premultiplied pixel, scaled
+     * up to its destination rectangle by the compositor */
+    uint32_t                is_solid;
+    uint32_t                solid_color;
     uint32_t                id_surface;
     struct wl_list          link;
 };
@@ -135,6 +157,16 @@ hmi_homescreen_launcher {
     char*               icon;
     char*               path;
     struct wl_list      link;
+    struct wl_list      pending_link;
+};
+
+/* A decoded icon, already scaled to LAUNCHER_ICON_SIZE, shared by all the
+ * launchers showing the same file. */
+struct
+hmi_homescreen_icon {
+    char                *path;
+    cairo_surface_t     *image;
+    struct wl_list      link;
 };
 
 struct
@@ -151,6 +183,10 @@ hmi_homescreen_setting {
     struct wl_list workspace_list;
     struct wl_list launcher_list;
 
+    /* launchers of the later workspaces, drawn after UI_ready */
+    struct wl_list pending_launcher_list;
+    struct wl_list icon_list;
+
     char     *cursor_theme;
     int32_t  cursor_size;
 };
@@ -177,6 +213,13 @@ mem_alloc(size_t size, char* file, int32_t line)
 #define MEM_ALLOC(s) mem_alloc((s),__FILE__,__LINE__)
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
 
+/* the size hmi-controller lays launchers out at, see UI_ready there */
+#define LAUNCHER_ICON_SIZE 256
+
+/* enough for the default images; the pool grows for larger ones */
+#define SHM_POOL_INITIAL_SIZE (4 * 1024 * 1024)
+#define SHM_POOL_ALIGN 64
+
 /*****************************************************************************
  *  Event Handler
  ****************************************************************************/
@@ -630,7 +673,7 @@ registry_handle_global(void* data, struct wl_registry* registry, uint32_t name,
             break;
         }
         if (!strcmp(interface, "ivi_hmi_controller")) {
-            p_wlCtx->hmiCtrl = wl_registry_bind(registry, name, &ivi_hmi_controller_interface, 1);
+            p_wlCtx->hmiCtrl = wl_registry_bind(registry, name, &ivi_hmi_controller_interface, 2);
 
             if (p_wlCtx->hmiCtrl) {
                 ivi_hmi_controller_add_listener(p_wlCtx->hmiCtrl, &hmi_controller_listener, p_wlCtx);
@@ -803,60 +846,141 @@ destroy_cursors(struct wlContextCommon *cmm)
     free(cmm->cursors);
 }
 
+static int
+shm_pool_grow(struct hmi_shm_pool *shm, int32_t size)
+{
+    void *data = NULL;
+
+    if (os_resize_anonymous_file(shm->fd, size) < 0) {
+        fprintf(stderr, "growing the buffer file to %d B failed: %m\n",
+                size);
+        return -1;
+    }
+
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if (MAP_FAILED == data) {
+        fprintf(stderr, "mmap failed: %m\n");
+        return -1;
+    }
+
+    munmap(shm->data, shm->size);
+    shm->data = data;
+    shm->size = size;
+    wl_shm_pool_resize(shm->pool, size);
+
+    return 0;
+}
+
+static int
+shm_pool_create(struct wlContextCommon *cmm, int32_t size)
+{
+    struct hmi_shm_pool *shm = cmm->shmPool;
+
+    shm->fd = os_create_anonymous_file(size);
+    if (shm->fd < 0) {
+        fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
+                size);
+        return -1;
+    }
+
+    shm->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     shm->fd, 0);
+    if (MAP_FAILED == shm->data) {
+        fprintf(stderr, "mmap failed: %m\n");
+        close(shm->fd);
+        shm->fd = -1;
+        shm->data = NULL;
+        return -1;
+    }
+
+    shm->pool = wl_shm_create_pool(cmm->wlShm, shm->fd, size);
+    shm->size = size;
+    shm->used = 0;
+
+    return 0;
+}
+
+/* returns the offset of a new slot of size bytes, or -1 */
+static int32_t
+shm_pool_alloc(struct wlContextCommon *cmm, int32_t size)
+{
+    struct hmi_shm_pool *shm = cmm->shmPool;
+    int32_t offset = 0;
+    int32_t new_size = 0;
+
+    if (NULL == shm->pool) {
+        new_size = SHM_POOL_INITIAL_SIZE;
+        while (new_size < size) {
+            new_size *= 2;
+        }
+
+        if (shm_pool_create(cmm, new_size) < 0) {
+            return -1;
+        }
+    }
+
+    offset = (shm->used + SHM_POOL_ALIGN - 1) & ~(SHM_POOL_ALIGN - 1);
+    if (offset + size > shm->size) {
+        new_size = shm->size;
+        while (new_size < offset + size) {
+            new_size *= 2;
+        }
+
+        if (shm_pool_grow(shm, new_size) < 0) {
+            return -1;
+        }
+    }
+
+    shm->used = offset + size;
+
+    return offset;
+}
+
+static void
+shm_pool_destroy(struct hmi_shm_pool *shm)
+{
+    if (shm->pool) {
+        wl_shm_pool_destroy(shm->pool);
+        munmap(shm->data, shm->size);
+        close(shm->fd);
+    }
+
+    free(shm);
+}
+
 /**
  * Internal method to prepare parts of UI
  */
 static void
 createShmBuffer(struct wlContextStruct *p_wlCtx)
 {
-    struct wl_shm_pool *pool;
-
-    char filename[] = "/tmp/wayland-shm-XXXXXX";
-    int fd = -1;
-    int size = 0;
-    int width = 0;
-    int height = 0;
-    int stride = 0;
-
-    fd = mkstemp(filename);
-    if (fd < 0) {
-        fprintf(stderr, "open %s failed: %m\n", filename);
-        return;
-    }
-
-    width  = cairo_image_surface_get_width(p_wlCtx->ctx_image);
-    height = cairo_image_surface_get_height(p_wlCtx->ctx_image);
-    stride = cairo_image_surface_get_stride(p_wlCtx->ctx_image);
-
-    size = stride * height;
-    if (ftruncate(fd, size) < 0) {
-        fprintf(stderr, "ftruncate failed: %m\n");
-        close(fd);
-        return;
+    if (p_wlCtx->ctx_image) {
+        p_wlCtx->width  = cairo_image_surface_get_width(p_wlCtx->ctx_image);
+        p_wlCtx->height = cairo_image_surface_get_height(p_wlCtx->ctx_image);
+        p_wlCtx->stride = cairo_image_surface_get_stride(p_wlCtx->ctx_image);
+    } else {
+        p_wlCtx->width  = 1;
+        p_wlCtx->height = 1;
+        p_wlCtx->stride = 4;
     }
 
-    p_wlCtx->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-
-    if (MAP_FAILED == p_wlCtx->data) {
-        fprintf(stderr, "mmap failed: %m\n");
-        close(fd);
+    p_wlCtx->offset = shm_pool_alloc(&p_wlCtx->cmm,
+                                     p_wlCtx->stride * p_wlCtx->height);
+    if (p_wlCtx->offset < 0) {
         return;
     }
 
-    pool = wl_shm_create_pool(p_wlCtx->cmm.wlShm, fd, size);
-    p_wlCtx->wlBuffer = wl_shm_pool_create_buffer(pool, 0,
-                                                  width,
-                                                  height,
-                                                  stride,
+    p_wlCtx->wlBuffer = wl_shm_pool_create_buffer(p_wlCtx->cmm.shmPool->pool,
+                                                  p_wlCtx->offset,
+                                                  p_wlCtx->width,
+                                                  p_wlCtx->height,
+                                                  p_wlCtx->stride,
                                                   WL_SHM_FORMAT_ARGB8888);
 
     if (NULL == p_wlCtx->wlBuffer) {
         fprintf(stderr, "wl_shm_create_buffer failed: %m\n");
-        close(fd);
         return;
     }
-    wl_shm_pool_destroy(pool);
-    close(fd);
 
     return;
 }
@@ -866,6 +990,11 @@ destroyWLContextCommon(struct wlContextCommon *p_wlCtx)
 {
     destroy_cursors(p_wlCtx);
 
+    if (p_wlCtx->shmPool) {
+        shm_pool_destroy(p_wlCtx->shmPool);
+        p_wlCtx->shmPool = NULL;
+    }
+
     if (p_wlCtx->pointer_surface) {
         wl_surface_destroy(p_wlCtx->pointer_surface);
     }
@@ -882,6 +1011,10 @@ destroyWLContextStruct(struct wlContextStruct *p_wlCtx)
         wl_surface_destroy(p_wlCtx->wlSurface);
     }
 
+    if (p_wlCtx->wlBuffer) {
+        wl_buffer_destroy(p_wlCtx->wlBuffer);
+    }
+
     if (p_wlCtx->ctx_image) {
         cairo_surface_destroy(p_wlCtx->ctx_image);
         p_wlCtx->ctx_image = NULL;
@@ -913,21 +1046,28 @@ static void
 drawImage(struct wlContextStruct *p_wlCtx)
 {
     struct wl_callback *callback;
+    char *dst = NULL;
 
-    int width = 0;
-    int height = 0;
-    int stride = 0;
-    void *data = NULL;
+    if (NULL == p_wlCtx->wlBuffer) {
+        return;
+    }
 
-    width = cairo_image_surface_get_width(p_wlCtx->ctx_image);
-    height = cairo_image_surface_get_height(p_wlCtx->ctx_image);
-    stride = cairo_image_surface_get_stride(p_wlCtx->ctx_image);
-    data = cairo_image_surface_get_data(p_wlCtx->ctx_image);
+    dst = (char *)p_wlCtx->cmm.shmPool->data + p_wlCtx->offset;
 
-    memcpy(p_wlCtx->data, data, stride * height);
+    /* the pixels live in the pool from now on */
+    if (p_wlCtx->is_solid) {
+        memcpy(dst, &p_wlCtx->solid_color, sizeof(p_wlCtx->solid_color));
+    } else {
+        cairo_surface_flush(p_wlCtx->ctx_image);
+        memcpy(dst, cairo_image_surface_get_data(p_wlCtx->ctx_image),
+               p_wlCtx->stride * p_wlCtx->height);
+        cairo_surface_destroy(p_wlCtx->ctx_image);
+        p_wlCtx->ctx_image = NULL;
+    }
 
     wl_surface_attach(p_wlCtx->wlSurface, p_wlCtx->wlBuffer, 0, 0);
-    wl_surface_damage(p_wlCtx->wlSurface, 0, 0, width, height);
+    wl_surface_damage(p_wlCtx->wlSurface, 0, 0,
+                      p_wlCtx->width, p_wlCtx->height);
 
     callback = wl_surface_frame(p_wlCtx->wlSurface);
     wl_callback_add_listener(callback, &frame_listener, NULL);
@@ -938,15 +1078,72 @@ drawImage(struct wlContextStruct *p_wlCtx)
     wl_display_roundtrip(p_wlCtx->cmm.wlDisplay);
 }
 
+/* premultiplied, as wl_shm's ARGB8888 is */
+static uint32_t
+premultiply_color(uint32_t color)
+{
+    uint32_t a = color >> 24;
+    uint32_t r = ((color >> 16) & 0xff) * a / 255;
+    uint32_t g = ((color >>  8) & 0xff) * a / 255;
+    uint32_t b = ((color >>  0) & 0xff) * a / 255;
+
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/* Images which are a single color, like a plain background, need no
+ * more than one pixel; the destination rectangle does the rest. */
+static int32_t
+image_get_solid_color(cairo_surface_t *image, uint32_t *color)
+{
+    const uint8_t *data = NULL;
+    const uint32_t *row = NULL;
+    uint32_t opaque = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t stride = 0;
+    int32_t x = 0;
+    int32_t y = 0;
+
+    if (cairo_image_surface_get_format(image) != CAIRO_FORMAT_ARGB32 &&
+        cairo_image_surface_get_format(image) != CAIRO_FORMAT_RGB24) {
+        return 0;
+    }
+
+    cairo_surface_flush(image);
+    data   = cairo_image_surface_get_data(image);
+    width  = cairo_image_surface_get_width(image);
+    height = cairo_image_surface_get_height(image);
+    stride = cairo_image_surface_get_stride(image);
+
+    if (NULL == data || width <= 0 || height <= 0) {
+        return 0;
+    }
+
+    /* the alpha byte of RGB24 is undefined */
+    if (cairo_image_surface_get_format(image) == CAIRO_FORMAT_RGB24) {
+        opaque = 0xff000000;
+    }
+
+    *color = *(const uint32_t *)data | opaque;
+
+    for (y = 0; y < height; y++) {
+        row = (const uint32_t *)(data + y * stride);
+        for (x = 0; x < width; x++) {
+            if ((row[x] | opaque) != *color) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
 static void
-create_ivisurface(struct wlContextStruct *p_wlCtx,
-                  uint32_t id_surface,
-                  cairo_surface_t* surface)
+create_ivisurface_buffer(struct wlContextStruct *p_wlCtx,
+                         uint32_t id_surface)
 {
     struct ivi_surface *ivisurf = NULL;
 
-    p_wlCtx->ctx_image = surface;
-
     p_wlCtx->id_surface = id_surface;
     wl_list_init(&p_wlCtx->link);
     wl_list_insert(p_wlCtx->cmm.list_wlContextStruct, &p_wlCtx->link);
@@ -965,6 +1162,36 @@ create_ivisurface(struct wlContextStruct *p_wlCtx,
     wl_display_roundtrip(p_wlCtx->cmm.wlDisplay);
 }
 
+/* color is premultiplied */
+static void
+create_ivisurfaceSolid(struct wlContextStruct *p_wlCtx,
+                       uint32_t id_surface,
+                       uint32_t color)
+{
+    p_wlCtx->is_solid = 1;
+    p_wlCtx->solid_color = color;
+
+    create_ivisurface_buffer(p_wlCtx, id_surface);
+}
+
+static void
+create_ivisurface(struct wlContextStruct *p_wlCtx,
+                  uint32_t id_surface,
+                  cairo_surface_t* surface)
+{
+    uint32_t color = 0;
+
+    if (image_get_solid_color(surface, &color)) {
+        cairo_surface_destroy(surface);
+        create_ivisurfaceSolid(p_wlCtx, id_surface, color);
+        return;
+    }
+
+    p_wlCtx->ctx_image = surface;
+
+    create_ivisurface_buffer(p_wlCtx, id_surface);
+}
+
 static void
 create_ivisurfaceFromFile(struct wlContextStruct *p_wlCtx,
                           uint32_t id_surface,
@@ -980,35 +1207,12 @@ create_ivisurfaceFromFile(struct wlContextStruct *p_wlCtx,
     create_ivisurface(p_wlCtx, id_surface, surface);
 }
 
-static void
-set_hex_color(cairo_t *cr, uint32_t color)
-{
-    cairo_set_source_rgba(cr,
-        ((color >> 16) & 0xff) / 255.0,
-        ((color >>  8) & 0xff) / 255.0,
-        ((color >>  0) & 0xff) / 255.0,
-        ((color >> 24) & 0xff) / 255.0);
-}
-
 static void
 create_ivisurfaceFromColor(struct wlContextStruct *p_wlCtx,
                            uint32_t id_surface,
-                           uint32_t width, uint32_t height,
                            uint32_t color)
 {
-    cairo_surface_t *surface = NULL;
-    cairo_t *cr = NULL;
-
-    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-
-    cr = cairo_create(surface);
-    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-    cairo_rectangle(cr, 0, 0, width, height);
-    set_hex_color(cr, color);
-    cairo_fill(cr);
-    cairo_destroy(cr);
-
-    create_ivisurface(p_wlCtx, id_surface, surface);
+    create_ivisurfaceSolid(p_wlCtx, id_surface, premultiply_color(color));
 }
 
 static void
@@ -1021,17 +1225,30 @@ UI_ready(struct ivi_hmi_controller *controller)
  * Internal method to set up UI by using ivi-hmi-controller
  */
 static void
-create_background(struct wlContextStruct *p_wlCtx, const uint32_t id_surface,
-                  const char* imageFile)
+create_background(struct wlContextStruct *p_wlCtx,
+                  struct hmi_homescreen_srf *srf)
 {
-    create_ivisurfaceFromFile(p_wlCtx, id_surface, imageFile);
+    /* a color is drawn by the compositor, with no buffer at all */
+    if (srf->color) {
+        ivi_hmi_controller_create_solid_surface(p_wlCtx->cmm.hmiCtrl,
+                                                srf->id, srf->color);
+        return;
+    }
+
+    create_ivisurfaceFromFile(p_wlCtx, srf->id, srf->filePath);
 }
 
 static void
-create_panel(struct wlContextStruct *p_wlCtx, const uint32_t id_surface,
-             const char* imageFile)
+create_panel(struct wlContextStruct *p_wlCtx,
+             struct hmi_homescreen_srf *srf)
 {
-    create_ivisurfaceFromFile(p_wlCtx, id_surface, imageFile);
+    if (srf->color) {
+        ivi_hmi_controller_create_solid_surface(p_wlCtx->cmm.hmiCtrl,
+                                                srf->id, srf->color);
+        return;
+    }
+
+    create_ivisurfaceFromFile(p_wlCtx, srf->id, srf->filePath);
 }
 
 static void
@@ -1052,49 +1269,148 @@ static void
 create_workspace_background(
     struct wlContextStruct *p_wlCtx, struct hmi_homescreen_srf *srf)
 {
-    create_ivisurfaceFromColor(p_wlCtx, srf->id, 1, 1, srf->color);
+    create_ivisurfaceFromColor(p_wlCtx, srf->id, srf->color);
+}
+
+/**
+ * Icons are decoded once per file and pre-scaled to the size they are
+ * shown at; the server would scale every frame otherwise.
+ */
+static cairo_surface_t *
+load_launcher_icon(struct hmi_homescreen_setting *hmi_setting,
+                   const char *path)
+{
+    struct hmi_homescreen_icon *icon = NULL;
+    cairo_surface_t *image = NULL;
+    cairo_surface_t *scaled = NULL;
+    cairo_t *cr = NULL;
+    int32_t width = 0;
+    int32_t height = 0;
+
+    wl_list_for_each(icon, &hmi_setting->icon_list, link) {
+        if (0 == strcmp(icon->path, path)) {
+            return cairo_surface_reference(icon->image);
+        }
+    }
+
+    /* decoded at no less than the icon size and kept in the image
+     * cache, so only the final scale below is left for later starts */
+    image = load_cairo_surface_scaled(path, LAUNCHER_ICON_SIZE,
+                                      LAUNCHER_ICON_SIZE, LOAD_IMAGE_CACHE);
+    if (NULL == image) {
+        return NULL;
+    }
+
+    width  = cairo_image_surface_get_width(image);
+    height = cairo_image_surface_get_height(image);
+
+    scaled = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                        LAUNCHER_ICON_SIZE,
+                                        LAUNCHER_ICON_SIZE);
+    cr = cairo_create(scaled);
+    cairo_scale(cr, (double)LAUNCHER_ICON_SIZE / width,
+                (double)LAUNCHER_ICON_SIZE / height);
+    cairo_set_source_surface(cr, image, 0, 0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(image);
+
+    icon = MEM_ALLOC(sizeof(*icon));
+    icon->path = strdup(path);
+    icon->image = scaled;
+    wl_list_insert(&hmi_setting->icon_list, &icon->link);
+
+    return cairo_surface_reference(scaled);
 }
 
 static void
-create_launchers(struct wlContextCommon *cmm, struct wl_list *launcher_list)
+create_launcher(struct wlContextCommon *cmm,
+                struct hmi_homescreen_launcher *launcher)
 {
-    int launcher_count = wl_list_length(launcher_list);
+    struct wlContextStruct *p_wlCtx = NULL;
+    cairo_surface_t *image = NULL;
 
-    if (0 == launcher_count) {
+    image = load_launcher_icon(cmm->hmi_setting, launcher->icon);
+    if (NULL == image) {
+        fprintf(stderr, "Failed to load_cairo_surface %s\n", launcher->icon);
         return;
     }
 
-    struct hmi_homescreen_launcher** launchers;
-    launchers = MEM_ALLOC(launcher_count * sizeof(*launchers));
+    p_wlCtx = MEM_ALLOC(sizeof(*p_wlCtx));
+    p_wlCtx->cmm = *cmm;
+    create_ivisurface(p_wlCtx, launcher->icon_surface_id, image);
+}
 
-    int ii = 0;
+/**
+ * Only the launchers of the first workspace are drawn before UI_ready,
+ * so that the home screen comes up without waiting for all the icons.
+ * hmi-controller holds the others' places with placeholders; they are
+ * drawn one per turn of the main loop, see create_pending_launcher.
+ */
+static void
+create_launchers(struct wlContextCommon *cmm, struct wl_list *launcher_list)
+{
+    struct hmi_homescreen_setting *hmi_setting = cmm->hmi_setting;
     struct hmi_homescreen_launcher *launcher = NULL;
+    uint32_t first_workspace = UINT32_MAX;
 
     wl_list_for_each(launcher, launcher_list, link) {
-        launchers[ii] = launcher;
-        ii++;
+        if (launcher->workspace_id < first_workspace) {
+            first_workspace = launcher->workspace_id;
+        }
     }
 
-    int start = 0;
+    wl_list_for_each(launcher, launcher_list, link) {
+        if (launcher->workspace_id == first_workspace) {
+            create_launcher(cmm, launcher);
+        } else {
+            wl_list_insert(hmi_setting->pending_launcher_list.prev,
+                           &launcher->pending_link);
+        }
+    }
+}
 
-    for (ii = 0; ii < launcher_count; ii++) {
+/* The next workspace's launchers first, as the pages are swiped in
+ * order. */
+static int32_t
+create_pending_launcher(struct wlContextCommon *cmm)
+{
+    struct hmi_homescreen_setting *hmi_setting = cmm->hmi_setting;
+    struct hmi_homescreen_launcher *launcher = NULL;
+    struct hmi_homescreen_launcher *next = NULL;
 
-        if (ii != launcher_count -1 &&
-            launchers[ii]->workspace_id == launchers[ii + 1]->workspace_id) {
-            continue;
-        }
+    if (wl_list_empty(&hmi_setting->pending_launcher_list)) {
+        return 0;
+    }
 
-        int jj = 0;
-        for (jj = start; jj <= ii; jj++) {
-            struct wlContextStruct *p_wlCtx = MEM_ALLOC(sizeof(*p_wlCtx));
-            p_wlCtx->cmm = *cmm;
-            create_ivisurfaceFromFile(p_wlCtx,launchers[jj]->icon_surface_id, launchers[jj]->icon);
+    next = container_of(hmi_setting->pending_launcher_list.next,
+                        struct hmi_homescreen_launcher, pending_link);
+    wl_list_for_each(launcher, &hmi_setting->pending_launcher_list,
+                     pending_link) {
+        if (launcher->workspace_id < next->workspace_id) {
+            next = launcher;
         }
-
-        start = ii + 1;
     }
 
-    free(launchers);
+    wl_list_remove(&next->pending_link);
+    create_launcher(cmm, next);
+
+    return 1;
+}
+
+static void
+destroy_launcher_icons(struct hmi_homescreen_setting *hmi_setting)
+{
+    struct hmi_homescreen_icon *icon = NULL;
+    struct hmi_homescreen_icon *next = NULL;
+
+    wl_list_for_each_safe(icon, next, &hmi_setting->icon_list, link) {
+        wl_list_remove(&icon->link);
+        cairo_surface_destroy(icon->image);
+        free(icon->path);
+        free(icon);
+    }
 }
 
 static void sigFunc(int signum)
@@ -1112,6 +1428,8 @@ hmi_homescreen_setting_create(void)
 
     wl_list_init(&setting->workspace_list);
     wl_list_init(&setting->launcher_list);
+    wl_list_init(&setting->pending_launcher_list);
+    wl_list_init(&setting->icon_list);
 
     struct weston_config *config = NULL;
     config = weston_config_parse("weston.ini");
@@ -1135,6 +1453,9 @@ hmi_homescreen_setting_create(void)
     weston_config_section_get_uint(
         shellSection, "background-id", &setting->background.id, 1001);
 
+    weston_config_section_get_uint(
+        shellSection, "background-color", &setting->background.color, 0);
+
     weston_config_section_get_string(
         shellSection, "panel-image", &setting->panel.filePath,
         DATADIR "/weston/panel.png");
@@ -1142,6 +1463,9 @@ hmi_homescreen_setting_create(void)
     weston_config_section_get_uint(
         shellSection, "panel-id", &setting->panel.id, 1002);
 
+    weston_config_section_get_uint(
+        shellSection, "panel-color", &setting->panel.color, 0);
+
     weston_config_section_get_string(
         shellSection, "tiling-image", &setting->tiling.filePath,
         DATADIR "/weston/tiling.png");
@@ -1197,6 +1521,7 @@ hmi_homescreen_setting_create(void)
             struct hmi_homescreen_launcher *launcher = NULL;
             launcher = MEM_ALLOC(sizeof(*launcher));
             wl_list_init(&launcher->link);
+            wl_list_init(&launcher->pending_link);
 
             weston_config_section_get_string(section, "icon", &launcher->icon, NULL);
             weston_config_section_get_string(section, "path", &launcher->path, NULL);
@@ -1265,6 +1590,10 @@ int main(int argc, char **argv)
     wl_display_dispatch(wlCtxCommon.wlDisplay);
     wl_display_roundtrip(wlCtxCommon.wlDisplay);
 
+    /* shared by every copy of wlCtxCommon below */
+    wlCtxCommon.shmPool = MEM_ALLOC(sizeof(*wlCtxCommon.shmPool));
+    wlCtxCommon.shmPool->fd = -1;
+
     if (wlCtxCommon.hmi_setting->cursor_theme) {
         create_cursors(&wlCtxCommon);
 
@@ -1284,11 +1613,9 @@ int main(int argc, char **argv)
     wlCtx_WorkSpaceBackGround.cmm = wlCtxCommon;
 
     /* create desktop widgets */
-    create_background(&wlCtx_BackGround, hmi_setting->background.id,
-                      hmi_setting->background.filePath);
+    create_background(&wlCtx_BackGround, &hmi_setting->background);
 
-    create_panel(&wlCtx_Panel, hmi_setting->panel.id,
-                 hmi_setting->panel.filePath);
+    create_panel(&wlCtx_Panel, &hmi_setting->panel);
 
     create_button(&wlCtx_Button_1, hmi_setting->tiling.id,
                   hmi_setting->tiling.filePath, 0);
@@ -1317,7 +1644,13 @@ int main(int argc, char **argv)
     signal(SIGKILL, sigFunc);
 
     while(gRun) {
-        wl_display_dispatch(wlCtxCommon.wlDisplay);
+        if (wl_list_empty(&hmi_setting->pending_launcher_list)) {
+            wl_display_dispatch(wlCtxCommon.wlDisplay);
+            continue;
+        }
+
+        wl_display_dispatch_pending(wlCtxCommon.wlDisplay);
+        create_pending_launcher(&wlCtxCommon);
     }
 
     struct wlContextStruct* pWlCtxSt = NULL;
@@ -1326,6 +1659,7 @@ int main(int argc, char **argv)
     }
 
     destroyWLContextCommon(&wlCtxCommon);
+    destroy_launcher_icons(hmi_setting);
     free(wlCtxCommon.list_wlContextStruct);
 
     return 0;
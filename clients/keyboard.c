@@ -256,12 +256,31 @@ enum keyboard_state {
 	KEYBOARD_STATE_SYMBOLS
 };
 
+/* All the keys of a layout in one state, drawn once and copied to the
+ * window on redraws */
+struct keyboard_layer {
+	const struct layout *layout;
+	enum keyboard_state state;
+	uint32_t preedit_style;		/* shown on the style key */
+	int32_t scale;
+	cairo_surface_t *surface;
+};
+
+#define KEYBOARD_LAYERS 9		/* every layout in every state */
+
 struct keyboard {
 	struct virtual_keyboard *keyboard;
 	struct window *window;
 	struct widget *widget;
 
 	enum keyboard_state state;
+
+	struct keyboard_layer layers[KEYBOARD_LAYERS];
+	int next_layer;
+
+	/* The key shown pressed, if any */
+	const struct layout *pressed_layout;
+	const struct key *pressed_key;
 };
 
 static void __attribute__ ((format (printf, 1, 2)))
@@ -351,33 +370,27 @@ get_current_layout(struct virtual_keyboard *keyboard)
 }
 
 static void
-redraw_handler(struct widget *widget, void *data)
+draw_layer(struct keyboard *keyboard, struct keyboard_layer *layer)
 {
-	struct keyboard *keyboard = data;
-	cairo_surface_t *surface;
-	struct rectangle allocation;
-	cairo_t *cr;
+	const struct layout *layout = layer->layout;
 	unsigned int i;
 	unsigned int row = 0, col = 0;
-	const struct layout *layout;
-
-	layout = get_current_layout(keyboard->keyboard);
+	cairo_t *cr;
 
-	surface = window_get_surface(keyboard->window);
-	widget_get_allocation(keyboard->widget, &allocation);
+	if (!layer->surface)
+		layer->surface =
+			cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						   layout->columns * key_width * layer->scale,
+						   layout->rows * key_height * layer->scale);
 
-	cr = cairo_create(surface);
-	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
-	cairo_clip(cr);
+	cr = cairo_create(layer->surface);
+	cairo_scale(cr, layer->scale, layer->scale);
 
 	cairo_select_font_face(cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
 	cairo_set_font_size(cr, 16);
 
-	cairo_translate(cr, allocation.x, allocation.y);
-
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_set_source_rgba(cr, 1, 1, 1, 0.75);
-	cairo_rectangle(cr, 0, 0, layout->columns * key_width, layout->rows * key_height);
 	cairo_paint(cr);
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
@@ -393,7 +406,144 @@ redraw_handler(struct widget *widget, void *data)
 	}
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
+}
+
+/* Returns the layer of the current layout and state, drawing it only
+ * the first time it is shown.  The style key's label is the only one
+ * that changes within a layer. */
+static struct keyboard_layer *
+get_current_layer(struct keyboard *keyboard)
+{
+	const struct layout *layout = get_current_layout(keyboard->keyboard);
+	uint32_t style = keyboard->keyboard->preedit_style;
+	int32_t scale = window_get_buffer_scale(keyboard->window);
+	struct keyboard_layer *layer;
+	int i;
+
+	for (i = 0; i < KEYBOARD_LAYERS; i++) {
+		layer = &keyboard->layers[i];
+		if (layer->layout == layout && layer->state == keyboard->state)
+			break;
+	}
+
+	if (i == KEYBOARD_LAYERS) {
+		layer = &keyboard->layers[keyboard->next_layer];
+		keyboard->next_layer = (keyboard->next_layer + 1) % KEYBOARD_LAYERS;
+		if (layer->surface)
+			cairo_surface_destroy(layer->surface);
+		layer->surface = NULL;
+		layer->layout = layout;
+		layer->state = keyboard->state;
+	} else if (layer->surface &&
+		   layer->preedit_style == style && layer->scale == scale) {
+		return layer;
+	}
+
+	if (layer->surface && layer->scale != scale) {
+		cairo_surface_destroy(layer->surface);
+		layer->surface = NULL;
+	}
+	layer->preedit_style = style;
+	layer->scale = scale;
+	draw_layer(keyboard, layer);
+
+	return layer;
+}
+
+/* Finds the key at x, y in layout coordinates, and where it starts */
+static const struct key *
+layout_get_key(const struct layout *layout, int x, int y,
+	       unsigned int *key_row, unsigned int *key_col)
+{
+	unsigned int i;
+	unsigned int row = 0, col = 0;
+	int index;
+
+	if (x < 0 || y < 0)
+		return NULL;
+
+	index = x / key_width + (int) (y / key_height) * layout->columns;
+	for (i = 0; i < layout->count; ++i) {
+		index -= layout->keys[i].width;
+		if (index < 0) {
+			*key_row = row;
+			*key_col = col;
+			return &layout->keys[i];
+		}
+		col += layout->keys[i].width;
+		if (col >= layout->columns) {
+			row += 1;
+			col = 0;
+		}
+	}
+
+	return NULL;
+}
+
+static int
+layout_find_key(const struct layout *layout, const struct key *key,
+		unsigned int *key_row, unsigned int *key_col)
+{
+	unsigned int i;
+	unsigned int row = 0, col = 0;
+
+	for (i = 0; i < layout->count; ++i) {
+		if (&layout->keys[i] == key) {
+			*key_row = row;
+			*key_col = col;
+			return 1;
+		}
+		col += layout->keys[i].width;
+		if (col >= layout->columns) {
+			row += 1;
+			col = 0;
+		}
+	}
+
+	return 0;
+}
+
+static void
+redraw_handler(struct widget *widget, void *data)
+{
+	struct keyboard *keyboard = data;
+	struct keyboard_layer *layer;
+	struct rectangle allocation;
+	cairo_t *cr;
+	unsigned int row, col;
+	const struct layout *layout;
+
+	layout = get_current_layout(keyboard->keyboard);
+	layer = get_current_layer(keyboard);
+
+	widget_get_allocation(keyboard->widget, &allocation);
+
+	/* Clipped to the pressed key when only that changed */
+	cr = widget_cairo_create(widget);
+	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
+	cairo_clip(cr);
+
+	cairo_translate(cr, allocation.x, allocation.y);
+
+	cairo_save(cr);
+	cairo_rectangle(cr, 0, 0, layout->columns * key_width, layout->rows * key_height);
+	cairo_clip(cr);
+	cairo_scale(cr, 1.0 / layer->scale, 1.0 / layer->scale);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, layer->surface, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+
+	if (keyboard->pressed_key && keyboard->pressed_layout == layout &&
+	    layout_find_key(layout, keyboard->pressed_key, &row, &col)) {
+		cairo_set_source_rgba(cr, 0, 0, 0, 0.25);
+		cairo_rectangle(cr, col * key_width, row * key_height,
+				keyboard->pressed_key->width * key_width,
+				key_height);
+		cairo_fill(cr);
+	}
+
+	cairo_destroy(cr);
 }
 
 static void
@@ -656,73 +806,81 @@ keyboard_handle_key(struct keyboard *keyboard, uint32_t time, const struct key *
 	}
 }
 
+/* Redraws only the key whose highlight changed, unless the key press
+ * switched to another layer */
 static void
-button_handler(struct widget *widget,
-	       struct input *input, uint32_t time,
-	       uint32_t button,
-	       enum wl_pointer_button_state state, void *data)
+keyboard_schedule_key_redraw(struct keyboard *keyboard,
+			     const struct layout *layout,
+			     const struct key *key)
 {
-	struct keyboard *keyboard = data;
 	struct rectangle allocation;
-	int32_t x, y;
-	int row, col;
-	unsigned int i;
-	const struct layout *layout;
+	unsigned int row, col;
 
-	layout = get_current_layout(keyboard->keyboard);
-
-	if (button != BTN_LEFT) {
+	if (!key || !layout_find_key(layout, key, &row, &col))
 		return;
-	}
-
-	input_get_position(input, &x, &y);
 
 	widget_get_allocation(keyboard->widget, &allocation);
-	x -= allocation.x;
-	y -= allocation.y;
-
-	row = y / key_height;
-	col = x / key_width + row * layout->columns;
-	for (i = 0; i < layout->count; ++i) {
-		col -= layout->keys[i].width;
-		if (col < 0) {
-			keyboard_handle_key(keyboard, time, &layout->keys[i], input, state);
-			break;
-		}
-	}
-
-	widget_schedule_redraw(widget);
+	widget_schedule_redraw_area(keyboard->widget,
+				    allocation.x + col * key_width,
+				    allocation.y + row * key_height,
+				    key->width * key_width, key_height);
 }
 
 static void
-touch_handler(struct input *input, uint32_t time,
-	      float x, float y, uint32_t state, void *data)
+keyboard_press(struct keyboard *keyboard, struct input *input, uint32_t time,
+	       int32_t x, int32_t y, enum wl_pointer_button_state state)
 {
-	struct keyboard *keyboard = data;
 	struct rectangle allocation;
-	int row, col;
-	unsigned int i;
+	unsigned int row, col;
 	const struct layout *layout;
+	const struct key *key;
+	enum keyboard_state old_state = keyboard->state;
+	uint32_t old_style = keyboard->keyboard->preedit_style;
 
 	layout = get_current_layout(keyboard->keyboard);
 
 	widget_get_allocation(keyboard->widget, &allocation);
-
 	x -= allocation.x;
 	y -= allocation.y;
 
-	row = (int)y / key_height;
-	col = (int)x / key_width + row * layout->columns;
-	for (i = 0; i < layout->count; ++i) {
-		col -= layout->keys[i].width;
-		if (col < 0) {
-			keyboard_handle_key(keyboard, time,
-					    &layout->keys[i], input, state);
-			break;
-		}
+	key = layout_get_key(layout, x, y, &row, &col);
+	if (key)
+		keyboard_handle_key(keyboard, time, key, input, state);
+
+	if (keyboard->pressed_layout == layout)
+		keyboard_schedule_key_redraw(keyboard, layout,
+					     keyboard->pressed_key);
+
+	if (state == WL_POINTER_BUTTON_STATE_PRESSED && key) {
+		keyboard->pressed_layout = layout;
+		keyboard->pressed_key = key;
+		keyboard_schedule_key_redraw(keyboard, layout, key);
+	} else {
+		keyboard->pressed_layout = NULL;
+		keyboard->pressed_key = NULL;
 	}
 
-	widget_schedule_redraw(keyboard->widget);
+	if (keyboard->state != old_state ||
+	    keyboard->keyboard->preedit_style != old_style ||
+	    get_current_layout(keyboard->keyboard) != layout)
+		widget_schedule_redraw(keyboard->widget);
+}
+
+static void
+button_handler(struct widget *widget,
+	       struct input *input, uint32_t time,
+	       uint32_t button,
+	       enum wl_pointer_button_state state, void *data)
+{
+	struct keyboard *keyboard = data;
+	int32_t x, y;
+
+	if (button != BTN_LEFT) {
+		return;
+	}
+
+	input_get_position(input, &x, &y);
+	keyboard_press(keyboard, input, time, x, y, state);
 }
 
 static void
@@ -730,8 +888,8 @@ touch_down_handler(struct widget *widget, struct input *input,
 		   uint32_t serial, uint32_t time, int32_t id,
 		   float x, float y, void *data)
 {
-  touch_handler(input, time, x, y, 
-		WL_POINTER_BUTTON_STATE_PRESSED, data);
+  keyboard_press(data, input, time, x, y,
+		 WL_POINTER_BUTTON_STATE_PRESSED);
 }
 
 static void
@@ -743,8 +901,8 @@ touch_up_handler(struct widget *widget, struct input *input,
 
   input_get_touch(input, id, &x, &y);
 
-  touch_handler(input, time, x, y,
-		WL_POINTER_BUTTON_STATE_RELEASED, data);
+  keyboard_press(data, input, time, x, y,
+		 WL_POINTER_BUTTON_STATE_RELEASED);
 }
 
 static void
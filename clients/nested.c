@@ -141,6 +141,10 @@ struct nested_ss_surface {
 	struct wl_surface *surface;
 	struct wl_subsurface *subsurface;
 	struct wl_callback *frame_callback;
+
+	/* Set while the attached buffer can't be forwarded to the
+	 * parent compositor and is blitted into the window instead */
+	struct nested_blit_surface *blit;
 };
 
 struct nested_frame_callback {
@@ -154,6 +158,7 @@ struct nested_renderer {
 	void (* render_clients)(struct nested *nested, cairo_t *cr);
 	void (* surface_attach)(struct nested_surface *surface,
 				struct nested_buffer *buffer);
+	void (* surface_commit)(struct nested_surface *surface);
 };
 
 static const struct weston_option nested_options[] = {
@@ -573,19 +578,15 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 	}
 	surface->pending.newly_attached = 0;
 
-	/* wl_surface.damage */
-	empty_region(&surface->pending.damage);
-
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
 			    &surface->pending.frame_callback_list);
 	wl_list_init(&surface->pending.frame_callback_list);
 
-	/* FIXME: For the subsurface renderer we don't need to
-	 * actually redraw the window. However we do want to cause a
-	 * commit because the subsurface is synchronized. Ideally we
-	 * would just queue the commit */
-	window_schedule_redraw(nested->window);
+	nested->renderer->surface_commit(surface);
+
+	/* wl_surface.damage */
+	empty_region(&surface->pending.damage);
 }
 
 static void
@@ -842,8 +843,8 @@ nested_destroy(struct nested *nested)
 
 /*** blit renderer ***/
 
-static void
-blit_surface_init(struct nested_surface *surface)
+static struct nested_blit_surface *
+blit_surface_create(void)
 {
 	struct nested_blit_surface *blit_surface =
 		xzalloc(sizeof *blit_surface);
@@ -855,21 +856,98 @@ blit_surface_init(struct nested_surface *surface)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	surface->renderer_data = blit_surface;
+	return blit_surface;
 }
 
 static void
-blit_surface_fini(struct nested_surface *surface)
+blit_surface_destroy(struct nested_blit_surface *blit_surface)
 {
-	struct nested_blit_surface *blit_surface = surface->renderer_data;
-
 	nested_buffer_reference(&blit_surface->buffer_ref, NULL);
 
+	if (blit_surface->cairo_surface)
+		cairo_surface_destroy(blit_surface->cairo_surface);
+
 	glDeleteTextures(1, &blit_surface->texture);
 
 	free(blit_surface);
 }
 
+static void
+blit_surface_set_buffer(struct nested *nested,
+			struct nested_blit_surface *blit_surface,
+			struct nested_buffer *buffer)
+{
+	EGLint width, height;
+	cairo_device_t *device;
+
+	nested_buffer_reference(&blit_surface->buffer_ref, buffer);
+
+	if (blit_surface->cairo_surface)
+		cairo_surface_destroy(blit_surface->cairo_surface);
+	blit_surface->cairo_surface = NULL;
+
+	if (buffer == NULL)
+		return;
+
+	query_buffer(nested->egl_display, (void *) buffer->resource,
+		     EGL_WIDTH, &width);
+	query_buffer(nested->egl_display, (void *) buffer->resource,
+		     EGL_HEIGHT, &height);
+
+	device = display_get_cairo_device(nested->display);
+	blit_surface->cairo_surface =
+		cairo_gl_surface_create_for_texture(device,
+						    CAIRO_CONTENT_COLOR_ALPHA,
+						    blit_surface->texture,
+						    width, height);
+}
+
+static void
+blit_surface_draw(struct nested_surface *s,
+		  struct nested_blit_surface *blit_surface,
+		  cairo_t *cr)
+{
+	struct nested *nested = s->nested;
+	struct rectangle allocation;
+
+	if (blit_surface->cairo_surface == NULL)
+		return;
+
+	widget_get_allocation(nested->widget, &allocation);
+
+	display_acquire_window_surface(nested->display,
+				       nested->window, NULL);
+
+	glBindTexture(GL_TEXTURE_2D, blit_surface->texture);
+	image_target_texture_2d(GL_TEXTURE_2D, s->image);
+
+	display_release_window_surface(nested->display,
+				       nested->window);
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_surface(cr, blit_surface->cairo_surface,
+				 allocation.x + 10,
+				 allocation.y + 10);
+	cairo_rectangle(cr, allocation.x + 10,
+			allocation.y + 10,
+			allocation.width - 10,
+			allocation.height - 10);
+
+	cairo_fill(cr);
+}
+
+static void
+blit_surface_init(struct nested_surface *surface)
+{
+	surface->renderer_data = blit_surface_create();
+}
+
+static void
+blit_surface_fini(struct nested_surface *surface)
+{
+	blit_surface_destroy(surface->renderer_data);
+}
+
 static void
 blit_frame_callback(void *data, struct wl_callback *callback, uint32_t time)
 {
@@ -892,34 +970,10 @@ blit_render_clients(struct nested *nested,
 		    cairo_t *cr)
 {
 	struct nested_surface *s;
-	struct rectangle allocation;
 	struct wl_callback *callback;
 
-	widget_get_allocation(nested->widget, &allocation);
-
-	wl_list_for_each(s, &nested->surface_list, link) {
-		struct nested_blit_surface *blit_surface = s->renderer_data;
-
-		display_acquire_window_surface(nested->display,
-					       nested->window, NULL);
-
-		glBindTexture(GL_TEXTURE_2D, blit_surface->texture);
-		image_target_texture_2d(GL_TEXTURE_2D, s->image);
-
-		display_release_window_surface(nested->display,
-					       nested->window);
-
-		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-		cairo_set_source_surface(cr, blit_surface->cairo_surface,
-					 allocation.x + 10,
-					 allocation.y + 10);
-		cairo_rectangle(cr, allocation.x + 10,
-				allocation.y + 10,
-				allocation.width - 10,
-				allocation.height - 10);
-
-		cairo_fill(cr);
-	}
+	wl_list_for_each(s, &nested->surface_list, link)
+		blit_surface_draw(s, s->renderer_data, cr);
 
 	callback = wl_surface_frame(window_get_wl_surface(nested->window));
 	wl_callback_add_listener(callback, &blit_frame_listener, nested);
@@ -929,27 +983,14 @@ static void
 blit_surface_attach(struct nested_surface *surface,
 		    struct nested_buffer *buffer)
 {
-	struct nested *nested = surface->nested;
-	struct nested_blit_surface *blit_surface = surface->renderer_data;
-	EGLint width, height;
-	cairo_device_t *device;
-
-	nested_buffer_reference(&blit_surface->buffer_ref, buffer);
-
-	if (blit_surface->cairo_surface)
-		cairo_surface_destroy(blit_surface->cairo_surface);
-
-	query_buffer(nested->egl_display, (void *) buffer->resource,
-		     EGL_WIDTH, &width);
-	query_buffer(nested->egl_display, (void *) buffer->resource,
-		     EGL_HEIGHT, &height);
+	blit_surface_set_buffer(surface->nested,
+				surface->renderer_data, buffer);
+}
 
-	device = display_get_cairo_device(nested->display);
-	blit_surface->cairo_surface =
-		cairo_gl_surface_create_for_texture(device,
-						    CAIRO_CONTENT_COLOR_ALPHA,
-						    blit_surface->texture,
-						    width, height);
+static void
+blit_surface_commit(struct nested_surface *surface)
+{
+	window_schedule_redraw(surface->nested->window);
 }
 
 static const struct nested_renderer
@@ -957,7 +998,8 @@ nested_blit_renderer = {
 	.surface_init = blit_surface_init,
 	.surface_fini = blit_surface_fini,
 	.render_clients = blit_render_clients,
-	.surface_attach = blit_surface_attach
+	.surface_attach = blit_surface_attach,
+	.surface_commit = blit_surface_commit
 };
 
 /*** subsurface renderer ***/
@@ -973,10 +1015,12 @@ ss_surface_init(struct nested_surface *surface)
 	struct rectangle allocation;
 	struct wl_region *region;
 
+	/* Desynchronized so that a forwarded commit reaches the
+	 * parent compositor without redrawing our window */
 	ss_surface->widget =
 		window_add_subsurface(nested->window,
 				      nested,
-				      SUBSURFACE_SYNCHRONIZED);
+				      SUBSURFACE_DESYNCHRONIZED);
 
 	widget_set_use_cairo(ss_surface->widget, 0);
 
@@ -1003,6 +1047,9 @@ ss_surface_fini(struct nested_surface *surface)
 {
 	struct nested_ss_surface *ss_surface = surface->renderer_data;
 
+	if (ss_surface->blit)
+		blit_surface_destroy(ss_surface->blit);
+
 	widget_destroy(ss_surface->widget);
 
 	if (ss_surface->frame_callback)
@@ -1011,12 +1058,53 @@ ss_surface_fini(struct nested_surface *surface)
 	free(ss_surface);
 }
 
+static void
+ss_blit_frame_callback(void *data, struct wl_callback *callback,
+		       uint32_t time)
+{
+	struct nested *nested = data;
+	struct nested_surface *surface;
+	struct nested_ss_surface *ss_surface;
+
+	wl_list_for_each(surface, &nested->surface_list, link) {
+		ss_surface = surface->renderer_data;
+		if (ss_surface->blit)
+			flush_surface_frame_callback_list(surface, time);
+	}
+
+	if (callback)
+		wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener ss_blit_frame_listener = {
+	ss_blit_frame_callback
+};
+
 static void
 ss_render_clients(struct nested *nested,
 		  cairo_t *cr)
 {
-	/* The clients are composited by the parent compositor so we
-	 * don't need to do anything here */
+	struct nested_surface *s;
+	struct nested_ss_surface *ss_surface;
+	struct wl_callback *callback;
+	int blitted = 0;
+
+	/* Forwarded clients are composited by the parent compositor,
+	 * only the ones that fell back to blitting are drawn here */
+	wl_list_for_each(s, &nested->surface_list, link) {
+		ss_surface = s->renderer_data;
+		if (ss_surface->blit == NULL)
+			continue;
+
+		blit_surface_draw(s, ss_surface->blit, cr);
+		blitted = 1;
+	}
+
+	if (!blitted)
+		return;
+
+	callback = wl_surface_frame(window_get_wl_surface(nested->window));
+	wl_callback_add_listener(callback, &ss_blit_frame_listener, nested);
 }
 
 static void
@@ -1049,6 +1137,28 @@ static const struct wl_callback_listener ss_frame_listener = {
 	ss_frame_callback
 };
 
+/* Falls back to blitting the buffer into our window while it can't
+ * be shared with the parent compositor */
+static void
+ss_surface_fall_back(struct nested_surface *surface,
+		     struct nested_buffer *buffer)
+{
+	struct nested_ss_surface *ss_surface = surface->renderer_data;
+
+	if (ss_surface->blit == NULL) {
+		display_acquire_window_surface(surface->nested->display,
+					       surface->nested->window, NULL);
+		ss_surface->blit = blit_surface_create();
+		display_release_window_surface(surface->nested->display,
+					       surface->nested->window);
+
+		wl_surface_attach(ss_surface->surface, NULL, 0, 0);
+		wl_surface_commit(ss_surface->surface);
+	}
+
+	blit_surface_set_buffer(surface->nested, ss_surface->blit, buffer);
+}
+
 static void
 ss_surface_attach(struct nested_surface *surface,
 		  struct nested_buffer *buffer)
@@ -1056,8 +1166,6 @@ ss_surface_attach(struct nested_surface *surface,
 	struct nested *nested = surface->nested;
 	struct nested_ss_surface *ss_surface = surface->renderer_data;
 	struct wl_buffer *parent_buffer;
-	const pixman_box32_t *rects;
-	int n_rects, i;
 
 	if (buffer) {
 		/* Create a representation of the buffer in the parent
@@ -1068,6 +1176,10 @@ ss_surface_attach(struct nested_surface *surface,
 
 			buffer->parent_buffer =
 				create_wayland_buffer_from_image(edpy, image);
+			if (buffer->parent_buffer == NULL) {
+				ss_surface_fall_back(surface, buffer);
+				return;
+			}
 
 			wl_buffer_add_listener(buffer->parent_buffer,
 					       &ss_buffer_listener,
@@ -1084,7 +1196,30 @@ ss_surface_attach(struct nested_surface *surface,
 		parent_buffer = NULL;
 	}
 
+	if (ss_surface->blit) {
+		display_acquire_window_surface(nested->display,
+					       nested->window, NULL);
+		blit_surface_destroy(ss_surface->blit);
+		display_release_window_surface(nested->display,
+					       nested->window);
+		ss_surface->blit = NULL;
+		window_schedule_redraw(nested->window);
+	}
+
 	wl_surface_attach(ss_surface->surface, parent_buffer, 0, 0);
+}
+
+static void
+ss_surface_commit(struct nested_surface *surface)
+{
+	struct nested_ss_surface *ss_surface = surface->renderer_data;
+	const pixman_box32_t *rects;
+	int n_rects, i;
+
+	if (ss_surface->blit) {
+		window_schedule_redraw(surface->nested->window);
+		return;
+	}
 
 	rects = pixman_region32_rectangles(&surface->pending.damage, &n_rects);
 
@@ -1097,13 +1232,14 @@ ss_surface_attach(struct nested_surface *surface,
 				  rect->y2 - rect->y1);
 	}
 
-	if (ss_surface->frame_callback)
-		wl_callback_destroy(ss_surface->frame_callback);
-
-	ss_surface->frame_callback = wl_surface_frame(ss_surface->surface);
-	wl_callback_add_listener(ss_surface->frame_callback,
-				 &ss_frame_listener,
-				 surface);
+	if (ss_surface->frame_callback == NULL &&
+	    !wl_list_empty(&surface->frame_callback_list)) {
+		ss_surface->frame_callback =
+			wl_surface_frame(ss_surface->surface);
+		wl_callback_add_listener(ss_surface->frame_callback,
+					 &ss_frame_listener,
+					 surface);
+	}
 
 	wl_surface_commit(ss_surface->surface);
 }
@@ -1113,7 +1249,8 @@ nested_ss_renderer = {
 	.surface_init = ss_surface_init,
 	.surface_fini = ss_surface_fini,
 	.render_clients = ss_render_clients,
-	.surface_attach = ss_surface_attach
+	.surface_attach = ss_surface_attach,
+	.surface_commit = ss_surface_commit
 };
 
 int
@@ -32,6 +32,7 @@
 
 #include "window.h"
 #include "scaler-client-protocol.h"
+#include "scanout-bench.h"
 
 #define BUFFER_SCALE 2
 static const int BUFFER_WIDTH = 421 * BUFFER_SCALE;
@@ -59,6 +60,8 @@ struct box {
 		MODE_DST_ONLY,
 		MODE_SRC_DST
 	} mode;
+
+	struct scanout_bench *bench;
 };
 
 static void
@@ -116,6 +119,66 @@ set_my_viewport(struct box *box)
 	}
 }
 
+static void
+set_viewport(struct box *box, double src_x, double src_y,
+	     double src_width, double src_height,
+	     int32_t dst_width, int32_t dst_height)
+{
+	wl_fixed_t sx = wl_fixed_from_double(src_x);
+	wl_fixed_t sy = wl_fixed_from_double(src_y);
+	wl_fixed_t sw = wl_fixed_from_double(src_width);
+	wl_fixed_t sh = wl_fixed_from_double(src_height);
+
+	if (box->scaler_version < 2) {
+		wl_viewport_set(box->viewport, sx, sy, sw, sh,
+				dst_width, dst_height);
+	} else {
+		wl_viewport_set_source(box->viewport, sx, sy, sw, sh);
+		wl_viewport_set_destination(box->viewport,
+					    dst_width, dst_height);
+	}
+}
+
+/* Benchmark configurations, in surface coordinates of the whole
+ * buffer; the shell centers the fullscreen surface on the output. */
+static const char *
+bench_config(void *data, int index)
+{
+	struct box *box = data;
+	struct output *output = display_get_output(box->display);
+	struct rectangle out = { 0, 0, box->width, box->height };
+	double w = (double) BUFFER_WIDTH / BUFFER_SCALE;
+	double h = (double) BUFFER_HEIGHT / BUFFER_SCALE;
+
+	if (!box->viewport) {
+		if (index == 0)
+			fprintf(stderr, "Error: compositor has no wl_scaler\n");
+		return NULL;
+	}
+
+	if (output)
+		output_get_allocation(output, &out);
+
+	switch (index) {
+	case 0:
+		set_viewport(box, 0, 0, w, h, box->width, box->height);
+		return "viewport unscaled";
+	case 1:
+		set_viewport(box, 0, 0, w, h, out.width, out.height);
+		return "viewport scaled to output";
+	case 2:
+		set_viewport(box, 0, 0, w, h, out.width / 2, out.height / 2);
+		return "viewport scaled to half";
+	case 3:
+		set_viewport(box, RECT_X / BUFFER_SCALE, RECT_Y / BUFFER_SCALE,
+			     RECT_W / BUFFER_SCALE, RECT_H / BUFFER_SCALE,
+			     out.width, out.height);
+		return "viewport cropped to output";
+	default:
+		return NULL;
+	}
+}
+
 static void
 resize_handler(struct widget *widget,
 	       int32_t width, int32_t height, void *data)
@@ -179,6 +242,9 @@ redraw_handler(struct widget *widget, void *data)
 	/* TODO: buffer_transform */
 
 	cairo_surface_destroy(surface);
+
+	if (box->bench)
+		scanout_bench_frame(box->bench);
 }
 
 static void
@@ -197,8 +263,13 @@ global_handler(struct display *display, uint32_t name,
 		box->viewport = wl_scaler_get_viewport(box->scaler,
 			widget_get_wl_surface(box->widget));
 
-		set_my_viewport(box);
+		/* The benchmark sets its own viewports */
+		if (!box->bench)
+			set_my_viewport(box);
 	}
+
+	if (box->bench)
+		scanout_bench_global(box->bench, name, interface, version);
 }
 
 static void
@@ -235,7 +306,11 @@ usage(const char *progname)
 		"  -b\tset both src and dst in viewport (default)\n"
 		"  -d\tset only dst in viewport\n"
 		"  -s\tset only src in viewport\n"
-		"  -n\tdo not set viewport at all\n\n",
+		"  -n\tdo not set viewport at all\n"
+		"  --benchmark\trun fullscreen through a set of viewports and\n"
+		"\t\treport frame timing and plane placement, the latter\n"
+		"\t\twhen the compositor runs the weston-test module\n"
+		"  --frames <n>\tmeasure <n> frames per viewport\n\n",
 		progname);
 
 	fprintf(stderr, "Expected output with output_scale=1:\n");
@@ -272,6 +347,7 @@ main(int argc, char *argv[])
 	struct box box;
 	struct display *d;
 	struct timeval tv;
+	int benchmark = 0, frames = 300;
 	int i;
 
 	d = display_create(&argc, argv);
@@ -281,6 +357,9 @@ main(int argc, char *argv[])
 	}
 
 	box.mode = MODE_SRC_DST;
+	box.bench = NULL;
+	box.viewport = NULL;
+	box.scaler_version = 0;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp("-s", argv[i]) == 0)
@@ -291,6 +370,10 @@ main(int argc, char *argv[])
 			box.mode = MODE_SRC_DST;
 		else if (strcmp("-n", argv[i]) == 0)
 			box.mode = MODE_NO_VIEWPORT;
+		else if (strcmp("--benchmark", argv[i]) == 0)
+			benchmark = 1;
+		else if (strcmp("--frames", argv[i]) == 0 && i + 1 < argc)
+			frames = atoi(argv[++i]);
 		else {
 			usage(argv[0]);
 			exit(1);
@@ -316,11 +399,19 @@ main(int argc, char *argv[])
 
 	window_schedule_resize(box.window, box.width, box.height);
 
+	if (benchmark) {
+		box.bench = scanout_bench_create(d, box.window, frames,
+						 bench_config, &box);
+		window_set_fullscreen(box.window, 1);
+	}
+
 	display_set_user_data(box.display, &box);
 	display_set_global_handler(box.display, global_handler);
 
 	display_run(d);
 
+	if (box.bench)
+		scanout_bench_destroy(box.bench);
 	window_destroy(box.window);
 	return 0;
 }
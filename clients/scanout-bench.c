@@ -0,0 +1,236 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wayland-client.h>
+#include "scanout-bench.h"
+#include "wayland-test-client-protocol.h"
+
+/* Frames before a configuration is measured, for the compositor to
+ * settle on a plane assignment. */
+#define SCANOUT_BENCH_WARMUP_FRAMES 10
+
+struct scanout_bench {
+	struct display *display;
+	struct window *window;
+	struct wl_test *test;
+
+	scanout_bench_config_func_t config;
+	void *data;
+	int frames;
+
+	int index;
+	const char *label;
+	enum {
+		SCANOUT_BENCH_STARTING,
+		SCANOUT_BENCH_RUNNING,
+		SCANOUT_BENCH_QUERYING,
+		SCANOUT_BENCH_DONE
+	} state;
+
+	int frame;
+	struct timespec last;
+	uint64_t interval_sum;		/* usec */
+	uint32_t interval_max;
+	uint32_t intervals;
+};
+
+static const char * const plane_names[] = {
+	"none", "renderer", "scanout", "overlay", "cursor"
+};
+
+static void
+scanout_bench_next(struct scanout_bench *bench)
+{
+	bench->index++;
+	bench->label = bench->config(bench->data, bench->index);
+	if (!bench->label) {
+		bench->state = SCANOUT_BENCH_DONE;
+		display_exit(bench->display);
+		return;
+	}
+
+	bench->state = SCANOUT_BENCH_RUNNING;
+	bench->frame = 0;
+	bench->interval_sum = 0;
+	bench->interval_max = 0;
+	bench->intervals = 0;
+}
+
+static void
+scanout_bench_report(struct scanout_bench *bench, const char *plane)
+{
+	printf("%-28s frames: %u, interval: %.2f ms, max: %.2f ms, "
+	       "plane: %s\n", bench->label, bench->intervals,
+	       bench->intervals ?
+			bench->interval_sum / 1000.0 / bench->intervals : 0.0,
+	       bench->interval_max / 1000.0, plane);
+	fflush(stdout);
+}
+
+static void
+test_handle_pointer_position(void *data, struct wl_test *wl_test,
+			     wl_fixed_t x, wl_fixed_t y)
+{
+}
+
+static void
+test_handle_n_egl_buffers(void *data, struct wl_test *wl_test, uint32_t n)
+{
+}
+
+static void
+test_handle_repaint_stats(void *data, struct wl_test *wl_test,
+			  uint32_t repaints, uint32_t total_usec,
+			  uint32_t max_usec, uint32_t heap_bytes)
+{
+}
+
+static void
+test_handle_buffer_stats(void *data, struct wl_test *wl_test,
+			 uint32_t released, uint32_t unused,
+			 uint32_t attach_to_use_avg_usec,
+			 uint32_t attach_to_use_max_usec,
+			 uint32_t use_to_release_avg_usec,
+			 uint32_t use_to_release_max_usec,
+			 struct wl_array *release_repaints)
+{
+}
+
+static void
+test_handle_surface_plane(void *data, struct wl_test *wl_test,
+			  uint32_t plane)
+{
+	struct scanout_bench *bench = data;
+
+	if (bench->state != SCANOUT_BENCH_QUERYING)
+		return;
+
+	scanout_bench_report(bench, plane < ARRAY_LENGTH(plane_names) ?
+			     plane_names[plane] : "unknown");
+	scanout_bench_next(bench);
+}
+
+static const struct wl_test_listener test_listener = {
+	test_handle_pointer_position,
+	test_handle_n_egl_buffers,
+	test_handle_repaint_stats,
+	test_handle_buffer_stats,
+	test_handle_surface_plane
+};
+
+struct scanout_bench *
+scanout_bench_create(struct display *display, struct window *window,
+		     int frames, scanout_bench_config_func_t config,
+		     void *data)
+{
+	struct scanout_bench *bench;
+
+	bench = xzalloc(sizeof *bench);
+	bench->display = display;
+	bench->window = window;
+	bench->frames = frames;
+	bench->config = config;
+	bench->data = data;
+	bench->index = -1;
+	bench->state = SCANOUT_BENCH_STARTING;
+
+	return bench;
+}
+
+void
+scanout_bench_destroy(struct scanout_bench *bench)
+{
+	if (bench->test)
+		wl_test_destroy(bench->test);
+	free(bench);
+}
+
+/* To be called from the client's global handler */
+void
+scanout_bench_global(struct scanout_bench *bench, uint32_t name,
+		     const char *interface, uint32_t version)
+{
+	if (strcmp(interface, "wl_test") != 0)
+		return;
+
+	bench->test = display_bind(bench->display, name,
+				   &wl_test_interface, 1);
+	wl_test_add_listener(bench->test, &test_listener, bench);
+}
+
+/* To be called from the client's redraw handler, keeps the window
+ * redrawing every frame until all configurations have run */
+void
+scanout_bench_frame(struct scanout_bench *bench)
+{
+	struct timespec now;
+	uint32_t interval;
+
+	if (bench->state == SCANOUT_BENCH_DONE)
+		return;
+
+	window_schedule_redraw(bench->window);
+
+	if (bench->state == SCANOUT_BENCH_STARTING) {
+		if (!bench->test)
+			fprintf(stderr, "compositor has no weston-test "
+				"module, plane placement is not reported\n");
+		scanout_bench_next(bench);
+		return;
+	}
+
+	if (bench->state != SCANOUT_BENCH_RUNNING)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (++bench->frame > SCANOUT_BENCH_WARMUP_FRAMES) {
+		interval = (now.tv_sec - bench->last.tv_sec) * 1000000 +
+			(now.tv_nsec - bench->last.tv_nsec) / 1000;
+		bench->interval_sum += interval;
+		bench->intervals++;
+		if (interval > bench->interval_max)
+			bench->interval_max = interval;
+	}
+	bench->last = now;
+
+	if (bench->frame < SCANOUT_BENCH_WARMUP_FRAMES + bench->frames)
+		return;
+
+	if (!bench->test) {
+		scanout_bench_report(bench, "unknown");
+		scanout_bench_next(bench);
+		return;
+	}
+
+	/* Placement has settled by now, so the last repaint's stands for
+	 * the whole configuration */
+	bench->state = SCANOUT_BENCH_QUERYING;
+	wl_test_get_surface_plane(bench->test,
+				  window_get_wl_surface(bench->window));
+}
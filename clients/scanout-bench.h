@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SCANOUT_BENCH_H_
+#define _SCANOUT_BENCH_H_
+
+#include "window.h"
+
+/* Benchmark driver for the demo clients: runs each configuration the
+ * client sets up for a number of frames, then reports the frame
+ * timing and, when the compositor runs the weston-test module, the
+ * plane the surface was placed on. */
+
+struct scanout_bench;
+
+/* Applies configuration index and returns its label, or NULL when
+ * there are no more configurations. */
+typedef const char *(*scanout_bench_config_func_t)(void *data, int index);
+
+struct scanout_bench *
+scanout_bench_create(struct display *display, struct window *window,
+		     int frames, scanout_bench_config_func_t config,
+		     void *data);
+
+void
+scanout_bench_destroy(struct scanout_bench *bench);
+
+void
+scanout_bench_global(struct scanout_bench *bench, uint32_t name,
+		     const char *interface, uint32_t version);
+
+void
+scanout_bench_frame(struct scanout_bench *bench);
+
+#endif
@@ -29,6 +29,7 @@
 #include <math.h>
 #include <assert.h>
 #include <signal.h>
+#include <time.h>
 
 #include <linux/input.h>
 
@@ -87,6 +88,15 @@ struct geometry {
 	int width, height;
 };
 
+/* Timestamps in milliseconds, for the interval statistics printed at
+ * exit; recording stops once MAX_SAMPLES are stored. */
+#define MAX_SAMPLES (1 << 20)
+
+struct timestamps {
+	double *samples;
+	int count, size;
+};
+
 struct window {
 	struct display *display;
 	struct geometry geometry, window_size;
@@ -94,9 +104,13 @@ struct window {
 		GLuint rotation_uniform;
 		GLuint pos;
 		GLuint col;
+		GLfloat *verts, *colors;
 	} gl;
 
 	uint32_t benchmark_time, frames;
+	int triangles, fragment_loops, duration;
+	double start_time;
+	struct timestamps swap_times, frame_times;
 	struct wl_egl_window *native;
 	struct wl_surface *surface;
 	struct xdg_surface *xdg_surface;
@@ -123,8 +137,81 @@ static const char *frag_shader_text =
 	"  gl_FragColor = v_color;\n"
 	"}\n";
 
+/* Like frag_shader_text, but burns fragment_loops iterations of
+ * arithmetic per fragment first. */
+static const char *frag_shader_loop_text =
+	"precision mediump float;\n"
+	"varying vec4 v_color;\n"
+	"void main() {\n"
+	"  float a = 0.0;\n"
+	"  for (int i = 0; i < %d; i++)\n"
+	"    a = fract(a * 1.37 + sin(float(i) + v_color.r));\n"
+	"  gl_FragColor = v_color + vec4(a * 0.001);\n"
+	"}\n";
+
 static int running = 1;
 
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+timestamps_add(struct timestamps *ts, double t)
+{
+	double *samples;
+	int size;
+
+	if (ts->count == ts->size) {
+		if (ts->size >= MAX_SAMPLES)
+			return;
+		size = ts->size ? ts->size * 2 : 1024;
+		samples = realloc(ts->samples, size * sizeof *samples);
+		if (!samples)
+			return;
+		ts->samples = samples;
+		ts->size = size;
+	}
+
+	ts->samples[ts->count++] = t;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	const double *da = a, *db = b;
+
+	return (*da > *db) - (*da < *db);
+}
+
+static void
+print_intervals(const char *name, struct timestamps *ts)
+{
+	double *intervals;
+	int i, n = ts->count - 1;
+
+	if (n < 1)
+		return;
+
+	intervals = malloc(n * sizeof *intervals);
+	if (!intervals)
+		return;
+
+	for (i = 0; i < n; i++)
+		intervals[i] = ts->samples[i + 1] - ts->samples[i];
+	qsort(intervals, n, sizeof *intervals, compare_double);
+
+	printf("%s: %d intervals, min %.2f median %.2f p99 %.2f "
+	       "max %.2f ms\n", name, n, intervals[0], intervals[n / 2],
+	       intervals[(n - 1) * 99 / 100], intervals[n - 1]);
+
+	free(intervals);
+}
+
 static void
 init_egl(struct display *display, struct window *window)
 {
@@ -241,8 +328,18 @@ init_gl(struct window *window)
 	GLuint frag, vert;
 	GLuint program;
 	GLint status;
-
-	frag = create_shader(window, frag_shader_text, GL_FRAGMENT_SHADER);
+	char frag_text[512];
+	GLfloat scale, *v, *c;
+	int i;
+
+	if (window->fragment_loops > 0) {
+		snprintf(frag_text, sizeof frag_text, frag_shader_loop_text,
+			 window->fragment_loops);
+		frag = create_shader(window, frag_text, GL_FRAGMENT_SHADER);
+	} else {
+		frag = create_shader(window, frag_shader_text,
+				     GL_FRAGMENT_SHADER);
+	}
 	vert = create_shader(window, vert_shader_text, GL_VERTEX_SHADER);
 
 	program = glCreateProgram();
@@ -270,6 +367,26 @@ init_gl(struct window *window)
 
 	window->gl.rotation_uniform =
 		glGetUniformLocation(program, "rotation");
+
+	/* The triangle and copies of it shrinking towards the centre,
+	 * all overlapping, so each adds to the fragment load too. */
+	window->gl.verts = calloc(window->triangles * 6, sizeof (GLfloat));
+	window->gl.colors = calloc(window->triangles * 9, sizeof (GLfloat));
+	assert(window->gl.verts && window->gl.colors);
+
+	for (i = 0; i < window->triangles; i++) {
+		scale = 1.0 - 0.5 * i / window->triangles;
+		v = window->gl.verts + i * 6;
+		c = window->gl.colors + i * 9;
+
+		v[0] = -0.5 * scale;	v[1] = -0.5 * scale;
+		v[2] =  0.5 * scale;	v[3] = -0.5 * scale;
+		v[4] =  0.0;		v[5] =  0.5 * scale;
+
+		c[0] = 1;	c[1] = 0;	c[2] = 0;
+		c[3] = 0;	c[4] = 1;	c[5] = 0;
+		c[6] = 0;	c[7] = 0;	c[8] = 1;
+	}
 }
 
 static void
@@ -407,6 +524,19 @@ destroy_surface(struct window *window)
 		wl_callback_destroy(window->callback);
 }
 
+static void
+frame_timing_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct window *window = data;
+
+	timestamps_add(&window->frame_times, time);
+	wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener frame_timing_listener = {
+	frame_timing_done
+};
+
 static const struct wl_callback_listener frame_listener;
 
 static void
@@ -414,16 +544,7 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 {
 	struct window *window = data;
 	struct display *display = window->display;
-	static const GLfloat verts[3][2] = {
-		{ -0.5, -0.5 },
-		{  0.5, -0.5 },
-		{  0,    0.5 }
-	};
-	static const GLfloat colors[3][3] = {
-		{ 1, 0, 0 },
-		{ 0, 1, 0 },
-		{ 0, 0, 1 }
-	};
+	struct wl_callback *frame_callback;
 	GLfloat angle;
 	GLfloat rotation[4][4] = {
 		{ 1, 0, 0, 0 },
@@ -436,6 +557,7 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 	EGLint rect[4];
 	EGLint buffer_age = 0;
 	struct timeval tv;
+	double now;
 
 	assert(window->callback == callback);
 	window->callback = NULL;
@@ -474,12 +596,14 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 	glClearColor(0.0, 0.0, 0.0, 0.5);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	glVertexAttribPointer(window->gl.pos, 2, GL_FLOAT, GL_FALSE, 0, verts);
-	glVertexAttribPointer(window->gl.col, 3, GL_FLOAT, GL_FALSE, 0, colors);
+	glVertexAttribPointer(window->gl.pos, 2, GL_FLOAT, GL_FALSE, 0,
+			      window->gl.verts);
+	glVertexAttribPointer(window->gl.col, 3, GL_FLOAT, GL_FALSE, 0,
+			      window->gl.colors);
 	glEnableVertexAttribArray(window->gl.pos);
 	glEnableVertexAttribArray(window->gl.col);
 
-	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glDrawArrays(GL_TRIANGLES, 0, 3 * window->triangles);
 
 	glDisableVertexAttribArray(window->gl.pos);
 	glDisableVertexAttribArray(window->gl.col);
@@ -495,6 +619,11 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 		wl_surface_set_opaque_region(window->surface, NULL);
 	}
 
+	/* Goes out with the commit eglSwapBuffers() makes. */
+	frame_callback = wl_surface_frame(window->surface);
+	wl_callback_add_listener(frame_callback, &frame_timing_listener,
+				 window);
+
 	if (display->swap_buffers_with_damage && buffer_age > 0) {
 		rect[0] = window->geometry.width / 4 - 1;
 		rect[1] = window->geometry.height / 4 - 1;
@@ -507,6 +636,14 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 		eglSwapBuffers(display->egl.dpy, window->egl_surface);
 	}
 	window->frames++;
+
+	now = get_time();
+	timestamps_add(&window->swap_times, now);
+	if (window->start_time == 0)
+		window->start_time = now;
+	if (window->duration > 0 &&
+	    now - window->start_time >= window->duration * 1000.0)
+		running = 0;
 }
 
 static const struct wl_callback_listener frame_listener = {
@@ -792,7 +929,13 @@ usage(int error_code)
 		"  -o\tCreate an opaque surface\n"
 		"  -s\tUse a 16 bpp EGL config\n"
 		"  -b\tDon't sync to compositor redraw (eglSwapInterval 0)\n"
-		"  -h\tThis help text\n\n");
+		"  -d <seconds>\tExit after this long\n"
+		"  -t <count>\tDraw this many overlapping triangles (1)\n"
+		"  -l <count>\tLoop this many times in the fragment shader (0)\n"
+		"  -h\tThis help text\n\n"
+		"At exit, the min, median and 99th percentile of the intervals\n"
+		"between eglSwapBuffers() returns and between frame callback\n"
+		"timestamps are printed.\n\n");
 
 	exit(error_code);
 }
@@ -811,6 +954,7 @@ main(int argc, char **argv)
 	window.window_size.height = 250;
 	window.buffer_size = 32;
 	window.frame_sync = 1;
+	window.triangles = 1;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp("-f", argv[i]) == 0)
@@ -821,12 +965,21 @@ main(int argc, char **argv)
 			window.buffer_size = 16;
 		else if (strcmp("-b", argv[i]) == 0)
 			window.frame_sync = 0;
+		else if (strcmp("-d", argv[i]) == 0 && i + 1 < argc)
+			window.duration = atoi(argv[++i]);
+		else if (strcmp("-t", argv[i]) == 0 && i + 1 < argc)
+			window.triangles = atoi(argv[++i]);
+		else if (strcmp("-l", argv[i]) == 0 && i + 1 < argc)
+			window.fragment_loops = atoi(argv[++i]);
 		else if (strcmp("-h", argv[i]) == 0)
 			usage(EXIT_SUCCESS);
 		else
 			usage(EXIT_FAILURE);
 	}
 
+	if (window.triangles < 1)
+		usage(EXIT_FAILURE);
+
 	display.display = wl_display_connect(NULL);
 	assert(display.display);
 
@@ -859,6 +1012,13 @@ main(int argc, char **argv)
 
 	fprintf(stderr, "simple-egl exiting\n");
 
+	print_intervals("eglSwapBuffers", &window.swap_times);
+	print_intervals("frame callbacks", &window.frame_times);
+	free(window.swap_times.samples);
+	free(window.frame_times.samples);
+	free(window.gl.verts);
+	free(window.gl.colors);
+
 	if (window.display->ivi_application)
 	{
 		ivi_surface_destroy(window.ivi_surface);
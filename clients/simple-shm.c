@@ -25,15 +25,21 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 
 #include <wayland-client.h>
 #include "../shared/os-compatibility.h"
+#include "../shared/config-parser.h"
 #include "xdg-shell-client-protocol.h"
 #include "fullscreen-shell-client-protocol.h"
 
@@ -41,44 +47,165 @@
 #include "ivi-application-client-protocol.h"
 #define IVI_SURFACE_ID 9000
 
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+#define MAX_BUFFERS 16
+
+struct stat_counter {
+	uint32_t count;
+	double sum, min, max;
+};
+
+struct stats {
+	uint32_t frames;
+	uint32_t skipped;
+	struct stat_counter frame_latency;
+	struct stat_counter release_turnaround;
+	double begin;
+};
+
 struct display {
 	struct wl_display *display;
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
 	struct xdg_shell *shell;
 	struct _wl_fullscreen_shell *fshell;
 	struct wl_shm *shm;
 	uint32_t formats;
 	struct ivi_application *ivi_application;
+	struct wl_list window_list;
+	struct stats stats;
 };
 
 struct buffer {
+	struct window *window;
 	struct wl_buffer *buffer;
 	void *shm_data;
 	int busy;
+	double committed;
 };
 
 struct window {
 	struct display *display;
-	int width, height;
+	struct wl_list link;
+	int width, height, padding;
 	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
 	struct xdg_surface *xdg_surface;
 	struct ivi_surface *ivi_surface;
-	struct buffer buffers[2];
-	struct buffer *prev_buffer;
+	struct buffer buffers[MAX_BUFFERS];
 	struct wl_callback *callback;
+	double callback_committed;
+	uint32_t frame;
 };
 
 static int running = 1;
 
+static int32_t option_width = 250;
+static int32_t option_height = 250;
+static int32_t option_buffers = 2;
+static int32_t option_damage = 100;
+static int32_t option_random_damage;
+static int32_t option_unthrottled;
+static int32_t option_rate;
+static int32_t option_surfaces = 1;
+static int32_t option_subsurfaces;
+static int32_t option_report;
+static int32_t option_help;
+
+static const struct weston_option options[] = {
+	{ WESTON_OPTION_INTEGER, "width", 0, &option_width },
+	{ WESTON_OPTION_INTEGER, "height", 0, &option_height },
+	{ WESTON_OPTION_INTEGER, "buffers", 'b', &option_buffers },
+	{ WESTON_OPTION_INTEGER, "damage", 'd', &option_damage },
+	{ WESTON_OPTION_BOOLEAN, "random-damage", 0, &option_random_damage },
+	{ WESTON_OPTION_BOOLEAN, "unthrottled", 'u', &option_unthrottled },
+	{ WESTON_OPTION_INTEGER, "rate", 'r', &option_rate },
+	{ WESTON_OPTION_INTEGER, "surfaces", 's', &option_surfaces },
+	{ WESTON_OPTION_INTEGER, "subsurfaces", 0, &option_subsurfaces },
+	{ WESTON_OPTION_INTEGER, "report", 0, &option_report },
+	{ WESTON_OPTION_BOOLEAN, "help", 'h', &option_help },
+};
+
+static const char help_text[] =
+"Usage: %s [options]\n"
+"\n"
+"  --width=W, --height=H\tsize of each surface (250x250)\n"
+"  -b, --buffers=N\t\tbuffers per surface, 1 to 16 (2)\n"
+"  -d, --damage=PERCENT\t\tdamage and repaint this much of each\n"
+"\t\t\t\tsurface per frame, as a band sweeping down (100)\n"
+"  --random-damage\t\tplace the damage band at random instead\n"
+"  -u, --unthrottled\t\tcommit whenever a buffer is released\n"
+"  -r, --rate=HZ\t\t\tcommit at a fixed rate instead of on\n"
+"\t\t\t\tframe callbacks\n"
+"  -s, --surfaces=N\t\tnumber of top level surfaces (1)\n"
+"  --subsurfaces=N\t\tdesynchronized sub-surfaces per surface (0)\n"
+"  --report=SECONDS\t\tprint statistics this often (only at exit)\n"
+"\n"
+"Frame callback latency is the time from a commit to its frame\n"
+"callback, release turnaround the time from committing a buffer to\n"
+"its release.  Random damage uses a fixed seed, so runs repeat.\n";
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+stat_counter_add(struct stat_counter *counter, double value)
+{
+	if (counter->count == 0 || value < counter->min)
+		counter->min = value;
+	if (counter->count == 0 || value > counter->max)
+		counter->max = value;
+	counter->sum += value;
+	counter->count++;
+}
+
+static void
+stats_report(struct stats *stats)
+{
+	struct stat_counter *f = &stats->frame_latency;
+	struct stat_counter *r = &stats->release_turnaround;
+	double now = get_time(), elapsed = (now - stats->begin) / 1000.0;
+
+	fprintf(stderr, "%u commits in %.1f s (%.1f/s), %u skipped\n",
+		stats->frames, elapsed,
+		elapsed > 0 ? stats->frames / elapsed : 0.0, stats->skipped);
+	if (f->count)
+		fprintf(stderr, "  frame callback latency: "
+			"avg %.2f min %.2f max %.2f ms\n",
+			f->sum / f->count, f->min, f->max);
+	if (r->count)
+		fprintf(stderr, "  release turnaround: "
+			"avg %.2f min %.2f max %.2f ms\n",
+			r->sum / r->count, r->min, r->max);
+
+	memset(stats, 0, sizeof *stats);
+	stats->begin = now;
+}
+
+static void
+redraw(void *data, struct wl_callback *callback, uint32_t time);
+
 static void
 buffer_release(void *data, struct wl_buffer *buffer)
 {
 	struct buffer *mybuf = data;
+	struct window *window = mybuf->window;
 
 	mybuf->busy = 0;
-}
+	stat_counter_add(&window->display->stats.release_turnaround,
+			 get_time() - mybuf->committed);
 
+	if (option_unthrottled && running)
+		redraw(window, NULL, 0);
+}
 static const struct wl_buffer_listener buffer_listener = {
 	buffer_release
 };
@@ -160,7 +287,8 @@ static const struct xdg_surface_listener xdg_surface_listener = {
 };
 
 static struct window *
-create_window(struct display *display, int width, int height)
+create_window(struct display *display, int width, int height,
+	      struct window *parent, int index)
 {
 	struct window *window;
 
@@ -172,9 +300,19 @@ create_window(struct display *display, int width, int height)
 	window->display = display;
 	window->width = width;
 	window->height = height;
+	window->padding = parent ? 0 : 20;
 	window->surface = wl_compositor_create_surface(display->compositor);
-
-	if (display->shell) {
+	wl_list_insert(display->window_list.prev, &window->link);
+
+	if (parent) {
+		window->subsurface =
+			wl_subcompositor_get_subsurface(display->subcompositor,
+							window->surface,
+							parent->surface);
+		wl_subsurface_set_position(window->subsurface,
+					   20 + index * 16, 20 + index * 16);
+		wl_subsurface_set_desync(window->subsurface);
+	} else if (display->shell) {
 		window->xdg_surface =
 			xdg_shell_get_xdg_surface(display->shell,
 						  window->surface);
@@ -192,7 +330,8 @@ create_window(struct display *display, int width, int height)
 						     _WL_FULLSCREEN_SHELL_PRESENT_METHOD_DEFAULT,
 						     NULL);
 	} else if (display->ivi_application ) {
-		uint32_t id_ivisurf = IVI_SURFACE_ID + (uint32_t)getpid();
+		uint32_t id_ivisurf = IVI_SURFACE_ID + (uint32_t)getpid() +
+			((uint32_t)index << 24);
 		window->ivi_surface =
 			ivi_application_surface_create(display->ivi_application,
 						       id_ivisurf, window->surface);
@@ -210,31 +349,44 @@ create_window(struct display *display, int width, int height)
 static void
 destroy_window(struct window *window)
 {
+	int i;
+
 	if (window->callback)
 		wl_callback_destroy(window->callback);
 
-	if (window->buffers[0].buffer)
-		wl_buffer_destroy(window->buffers[0].buffer);
-	if (window->buffers[1].buffer)
-		wl_buffer_destroy(window->buffers[1].buffer);
+	for (i = 0; i < MAX_BUFFERS; i++)
+		if (window->buffers[i].buffer)
+			wl_buffer_destroy(window->buffers[i].buffer);
 
+	if (window->subsurface)
+		wl_subsurface_destroy(window->subsurface);
+	if (window->ivi_surface)
+		ivi_surface_destroy(window->ivi_surface);
 	if (window->xdg_surface)
 		xdg_surface_destroy(window->xdg_surface);
 	wl_surface_destroy(window->surface);
+	wl_list_remove(&window->link);
 	free(window);
 }
 
+static void
+paint_pixels(void *image, int padding, int width, int height,
+	     int top, int bottom, uint32_t time);
+
 static struct buffer *
 window_next_buffer(struct window *window)
 {
-	struct buffer *buffer;
-	int ret = 0;
+	struct buffer *buffer = NULL;
+	int i, ret = 0;
 
-	if (!window->buffers[0].busy)
-		buffer = &window->buffers[0];
-	else if (!window->buffers[1].busy)
-		buffer = &window->buffers[1];
-	else
+	for (i = 0; i < option_buffers; i++) {
+		if (!window->buffers[i].busy) {
+			buffer = &window->buffers[i];
+			break;
+		}
+	}
+
+	if (!buffer)
 		return NULL;
 
 	if (!buffer->buffer) {
@@ -245,16 +397,24 @@ window_next_buffer(struct window *window)
 		if (ret < 0)
 			return NULL;
 
-		/* paint the padding */
+		buffer->window = window;
+
+		/* paint the padding, and the rest for frames that only
+		 * repaint a part */
 		memset(buffer->shm_data, 0xff,
 		       window->width * window->height * 4);
+		paint_pixels(buffer->shm_data, window->padding,
+			     window->width, window->height,
+			     0, window->height, 0);
 	}
 
 	return buffer;
 }
 
+/* Paints rows top to bottom of the pattern, inside the padding. */
 static void
-paint_pixels(void *image, int padding, int width, int height, uint32_t time)
+paint_pixels(void *image, int padding, int width, int height,
+	     int top, int bottom, uint32_t time)
 {
 	const int halfh = padding + (height - padding * 2) / 2;
 	const int halfw = padding + (width  - padding * 2) / 2;
@@ -268,8 +428,13 @@ paint_pixels(void *image, int padding, int width, int height, uint32_t time)
 	or *= or;
 	ir *= ir;
 
-	pixel += padding * width;
-	for (y = padding; y < height - padding; y++) {
+	if (top < padding)
+		top = padding;
+	if (bottom > height - padding)
+		bottom = height - padding;
+
+	pixel += top * width;
+	for (y = top; y < bottom; y++) {
 		int x;
 		int y2 = (y - halfh) * (y - halfh);
 
@@ -301,33 +466,94 @@ paint_pixels(void *image, int padding, int width, int height, uint32_t time)
 
 static const struct wl_callback_listener frame_listener;
 
+/* Commits a new frame, repainting and damaging a band of
+ * option_damage percent of the area inside the padding. */
+static void
+window_commit(struct window *window, struct buffer *buffer, uint32_t time)
+{
+	struct display *display = window->display;
+	int inner = window->height - window->padding * 2;
+	int band, y;
+	double now;
+
+	band = inner * option_damage / 100;
+	if (band < 1)
+		band = 1;
+	if (band >= inner)
+		y = 0;
+	else if (option_random_damage)
+		y = random() % (inner - band + 1);
+	else
+		y = (window->frame * band) % (inner - band + 1);
+	y += window->padding;
+
+	paint_pixels(buffer->shm_data, window->padding,
+		     window->width, window->height, y, y + band, time);
+
+	wl_surface_attach(window->surface, buffer->buffer, 0, 0);
+	wl_surface_damage(window->surface, window->padding, y,
+			  window->width - window->padding * 2, band);
+
+	now = get_time();
+	if (!window->callback) {
+		window->callback = wl_surface_frame(window->surface);
+		wl_callback_add_listener(window->callback,
+					 &frame_listener, window);
+		window->callback_committed = now;
+	}
+	wl_surface_commit(window->surface);
+
+	buffer->busy = 1;
+	buffer->committed = now;
+	window->frame++;
+	display->stats.frames++;
+}
+
+/* Commits a frame on every surface that has a free buffer, for the
+ * unthrottled and fixed rate modes. */
+static void
+commit_all(struct display *display)
+{
+	struct window *window;
+	struct buffer *buffer;
+
+	wl_list_for_each(window, &display->window_list, link) {
+		buffer = window_next_buffer(window);
+		if (buffer)
+			window_commit(window, buffer, get_time());
+		else
+			display->stats.skipped++;
+	}
+}
+
 static void
 redraw(void *data, struct wl_callback *callback, uint32_t time)
 {
 	struct window *window = data;
 	struct buffer *buffer;
+	bool throttled = !option_unthrottled && !option_rate;
+
+	if (callback) {
+		stat_counter_add(&window->display->stats.frame_latency,
+				 get_time() - window->callback_committed);
+		wl_callback_destroy(callback);
+		window->callback = NULL;
+		if (!throttled)
+			return;
+	}
 
 	buffer = window_next_buffer(window);
 	if (!buffer) {
+		if (!callback && !throttled)
+			return;
+
 		fprintf(stderr,
 			!callback ? "Failed to create the first buffer.\n" :
-			"Both buffers busy at redraw(). Server bug?\n");
+			"All buffers busy at redraw(). Server bug?\n");
 		abort();
 	}
 
-	paint_pixels(buffer->shm_data, 20, window->width, window->height, time);
-
-	wl_surface_attach(window->surface, buffer->buffer, 0, 0);
-	wl_surface_damage(window->surface,
-			  20, 20, window->width - 40, window->height - 40);
-
-	if (callback)
-		wl_callback_destroy(callback);
-
-	window->callback = wl_surface_frame(window->surface);
-	wl_callback_add_listener(window->callback, &frame_listener, window);
-	wl_surface_commit(window->surface);
-	buffer->busy = 1;
+	window_commit(window, buffer, throttled ? time : get_time());
 }
 
 static const struct wl_callback_listener frame_listener = {
@@ -372,6 +598,10 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		d->compositor =
 			wl_registry_bind(registry,
 					 id, &wl_compositor_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		d->subcompositor =
+			wl_registry_bind(registry,
+					 id, &wl_subcompositor_interface, 1);
 	} else if (strcmp(interface, "xdg_shell") == 0) {
 		d->shell = wl_registry_bind(registry,
 					    id, &xdg_shell_interface, 1);
@@ -408,7 +638,7 @@ create_display(void)
 {
 	struct display *display;
 
-	display = malloc(sizeof *display);
+	display = calloc(1, sizeof *display);
 	if (display == NULL) {
 		fprintf(stderr, "out of memory\n");
 		exit(1);
@@ -416,7 +646,8 @@ create_display(void)
 	display->display = wl_display_connect(NULL);
 	assert(display->display);
 
-	display->formats = 0;
+	wl_list_init(&display->window_list);
+	display->stats.begin = get_time();
 	display->registry = wl_display_get_registry(display->display);
 	wl_registry_add_listener(display->registry,
 				 &registry_listener, display);
@@ -450,6 +681,12 @@ destroy_display(struct display *display)
 	if (display->fshell)
 		_wl_fullscreen_shell_release(display->fshell);
 
+	if (display->ivi_application)
+		ivi_application_destroy(display->ivi_application);
+
+	if (display->subcompositor)
+		wl_subcompositor_destroy(display->subcompositor);
+
 	if (display->compositor)
 		wl_compositor_destroy(display->compositor);
 
@@ -469,42 +706,156 @@ signal_int(int signum)
 	running = 0;
 }
 
+static int
+create_timer(int32_t interval_ms)
+{
+	struct itimerspec its;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "timerfd_create failed: %m\n");
+		exit(1);
+	}
+
+	its.it_interval.tv_sec = interval_ms / 1000;
+	its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+	its.it_value = its.it_interval;
+	timerfd_settime(fd, 0, &its, NULL);
+
+	return fd;
+}
+
+static void
+run(struct display *display)
+{
+	struct pollfd fds[3];
+	uint64_t expirations;
+	int i;
+
+	fds[0].fd = wl_display_get_fd(display->display);
+	fds[1].fd = option_rate > 0 ? create_timer(1000 / option_rate) : -1;
+	fds[2].fd = option_report > 0 ?
+		create_timer(option_report * 1000) : -1;
+	for (i = 0; i < 3; i++)
+		fds[i].events = POLLIN;
+
+	while (running) {
+		while (wl_display_prepare_read(display->display) != 0)
+			wl_display_dispatch_pending(display->display);
+
+		if (wl_display_flush(display->display) < 0 &&
+		    errno != EAGAIN) {
+			wl_display_cancel_read(display->display);
+			break;
+		}
+
+		if (poll(fds, 3, -1) < 0) {
+			wl_display_cancel_read(display->display);
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			if (wl_display_read_events(display->display) < 0)
+				break;
+		} else {
+			wl_display_cancel_read(display->display);
+		}
+
+		if (wl_display_dispatch_pending(display->display) < 0)
+			break;
+
+		if (fds[1].revents & POLLIN &&
+		    read(fds[1].fd, &expirations, sizeof expirations) > 0)
+			commit_all(display);
+
+		if (fds[2].revents & POLLIN &&
+		    read(fds[2].fd, &expirations, sizeof expirations) > 0)
+			stats_report(&display->stats);
+	}
+
+	for (i = 1; i < 3; i++)
+		if (fds[i].fd >= 0)
+			close(fds[i].fd);
+}
+
 int
 main(int argc, char **argv)
 {
 	struct sigaction sigint;
 	struct display *display;
-	struct window *window;
-	int ret = 0;
+	struct window *window, *parent, *tmp;
+	int i, j;
+
+	parse_options(options, ARRAY_LENGTH(options), &argc, argv);
+	if (option_help) {
+		printf(help_text, argv[0]);
+		return 0;
+	}
+
+	if (option_width <= 40 || option_height <= 40 ||
+	    option_buffers < 1 || option_buffers > MAX_BUFFERS ||
+	    option_damage < 1 || option_damage > 100 ||
+	    option_rate < 0 || option_rate > 1000 ||
+	    option_surfaces < 1 || option_subsurfaces < 0) {
+		fprintf(stderr, "invalid option value\n");
+		fprintf(stderr, help_text, argv[0]);
+		return 1;
+	}
 
 	display = create_display();
-	window = create_window(display, 250, 250);
-	if (!window)
+	if (option_subsurfaces > 0 && !display->subcompositor) {
+		fprintf(stderr, "No wl_subcompositor global\n");
 		return 1;
+	}
+
+	for (i = 0; i < option_surfaces; i++) {
+		parent = create_window(display, option_width, option_height,
+				       NULL, i);
+		if (!parent)
+			return 1;
+
+		for (j = 0; j < option_subsurfaces; j++)
+			if (!create_window(display, option_width / 2,
+					   option_height / 2, parent, j))
+				return 1;
+	}
 
 	sigint.sa_handler = signal_int;
 	sigemptyset(&sigint.sa_mask);
 	sigint.sa_flags = SA_RESETHAND;
 	sigaction(SIGINT, &sigint, NULL);
 
-	/* Initialise damage to full surface, so the padding gets painted */
-	wl_surface_damage(window->surface, 0, 0,
-			  window->width, window->height);
-
-	redraw(window, NULL, 0);
+	/* The damage band of the random mode repeats from run to run. */
+	srandom(1);
 
-	while (running && ret != -1)
-		ret = wl_display_dispatch(display->display);
+	wl_list_for_each(window, &display->window_list, link) {
+		/* Initialise damage to full surface, so the padding gets
+		 * painted */
+		wl_surface_damage(window->surface, 0, 0,
+				  window->width, window->height);
 
-	fprintf(stderr, "simple-shm exiting\n");
+		redraw(window, NULL, 0);
 
-	if (window->display->ivi_application)
-	{
-		ivi_surface_destroy(window->ivi_surface);
-		ivi_application_destroy(window->display->ivi_application);
+		/* Unthrottled, keep every buffer in flight: the
+		 * compositor releases each one as the next replaces it. */
+		if (option_unthrottled)
+			for (j = 1; j < option_buffers; j++)
+				redraw(window, NULL, 0);
 	}
 
-	destroy_window(window);
+	run(display);
+
+	fprintf(stderr, "simple-shm exiting\n");
+	stats_report(&display->stats);
+
+	wl_list_for_each_safe(window, tmp, &display->window_list, link)
+		if (window->subsurface)
+			destroy_window(window);
+	wl_list_for_each_safe(window, tmp, &display->window_list, link)
+		destroy_window(window);
 	destroy_display(display);
 
 	return 0;
@@ -0,0 +1,739 @@
+/*
+ * Copyright © 2011 Benjamin Franzke
+ * Copyright © 2010, 2013 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Puts many surfaces and deep sub-surface trees in front of the
+ * compositor and churns them: maps and unmaps surfaces, restacks
+ * sub-surfaces and moves them around every frame, in synchronized or
+ * desynchronized mode.  One line of timings per second goes to
+ * stdout, whitespace separated with '#' comment lines, so runs can be
+ * compared across releases.  Random choices use a fixed seed.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+
+#include <wayland-client.h>
+#include "../shared/os-compatibility.h"
+#include "../shared/config-parser.h"
+
+#include <sys/types.h>
+#include "ivi-application-client-protocol.h"
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+#define MAX_LEVELS	8
+#define MAX_NODES	100000
+#define MAX_SAMPLES	(1 << 20)
+
+/* ivi-shell surface ids: a block of 65536 per process. */
+#define IVI_SURFACE_ID(index) \
+	(0x10000000 + (((uint32_t) getpid() & 0xfff) << 16) + (index))
+
+struct node {
+	struct stress *stress;
+	struct node *parent;
+	struct wl_list children;
+	struct wl_list link;
+	int child_count;
+
+	struct wl_surface *surface;
+	struct wl_shell_surface *shell_surface;
+	struct ivi_surface *ivi_surface;
+	struct wl_subsurface *subsurface;
+
+	int level, index;
+	int x, y;
+	bool mapped;
+	bool dirty;
+};
+
+struct counters {
+	uint32_t frames;
+	double interval_max;
+	double sync_sum;
+	uint32_t sync_count;
+	uint32_t maps, unmaps, restacks;
+};
+
+struct stress {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	struct wl_shell *shell;
+	struct ivi_application *ivi_application;
+	struct wl_shm *shm;
+	uint32_t formats;
+
+	struct wl_buffer *buffers[MAX_LEVELS];
+	struct node **nodes;
+	int node_count;
+
+	struct wl_callback *frame_callback;
+	struct wl_callback *sync_callback;
+	double sync_time;
+
+	double start_time, last_frame, last_report;
+	double map_debt, restack_debt;
+	struct counters counters;
+	double *intervals;
+	int interval_count;
+	uint32_t total_frames;
+};
+
+static int running = 1;
+
+static int32_t option_surfaces = 100;
+static int32_t option_depth = 0;
+static int32_t option_fanout = 1;
+static int32_t option_size = 64;
+static int32_t option_map_rate;
+static int32_t option_restack_rate;
+static int32_t option_move;
+static int32_t option_sync;
+static int32_t option_duration = 10;
+static int32_t option_help;
+
+static const struct weston_option options[] = {
+	{ WESTON_OPTION_INTEGER, "surfaces", 's', &option_surfaces },
+	{ WESTON_OPTION_INTEGER, "depth", 'd', &option_depth },
+	{ WESTON_OPTION_INTEGER, "fanout", 'f', &option_fanout },
+	{ WESTON_OPTION_INTEGER, "size", 0, &option_size },
+	{ WESTON_OPTION_INTEGER, "map-rate", 'm', &option_map_rate },
+	{ WESTON_OPTION_INTEGER, "restack-rate", 'r', &option_restack_rate },
+	{ WESTON_OPTION_BOOLEAN, "move", 0, &option_move },
+	{ WESTON_OPTION_BOOLEAN, "sync", 0, &option_sync },
+	{ WESTON_OPTION_INTEGER, "duration", 't', &option_duration },
+	{ WESTON_OPTION_BOOLEAN, "help", 'h', &option_help },
+};
+
+static const char help_text[] =
+"Usage: %s [options]\n"
+"\n"
+"  -s, --surfaces=N\t\ttop level surfaces (100)\n"
+"  -d, --depth=N\t\t\tlevels of sub-surfaces below each (0)\n"
+"  -f, --fanout=N\t\tsub-surfaces per parent (1)\n"
+"  --size=PIXELS\t\t\tsize of the top level surfaces (64)\n"
+"  -m, --map-rate=N\t\tsurfaces unmapped or mapped again per second (0)\n"
+"  -r, --restack-rate=N\t\tsub-surfaces restacked per second (0)\n"
+"  --move\t\t\tmove every sub-surface on every frame\n"
+"  --sync\t\t\tuse synchronized sub-surfaces\n"
+"  -t, --duration=SECONDS\texit after this long, 0 to run until\n"
+"\t\t\t\tinterrupted (10)\n"
+"\n"
+"Every second a line with the elapsed time, frames, frames per second,\n"
+"the longest frame interval, the average wl_display.sync round trip\n"
+"after a frame's requests, and the maps, unmaps and restacks done is\n"
+"printed.  A summary with the median and 99th percentile frame\n"
+"interval follows at exit.\n";
+
+static inline void *
+xzalloc(size_t s)
+{
+	void *p;
+
+	p = calloc(1, s);
+	if (p == NULL) {
+		fprintf(stderr, "%s: out of memory\n", program_invocation_short_name);
+		exit(EXIT_FAILURE);
+	}
+
+	return p;
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int
+level_size(int level)
+{
+	int size = option_size >> level;
+
+	return size < 4 ? 4 : size;
+}
+
+/* One buffer per tree level, attached to every surface of that level
+ * at once, so the client's own cost stays out of the measurements. */
+static int
+create_buffers(struct stress *stress)
+{
+	struct wl_shm_pool *pool;
+	uint32_t *data;
+	int fd, i, j, size, offset = 0, total = 0;
+
+	for (i = 0; i <= option_depth; i++)
+		total += level_size(i) * level_size(i) * 4;
+
+	fd = os_create_anonymous_file(total);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
+			total);
+		return -1;
+	}
+
+	data = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(stress->shm, fd, total);
+	for (i = 0; i <= option_depth; i++) {
+		size = level_size(i);
+		for (j = 0; j < size * size; j++)
+			data[offset / 4 + j] = 0xff000000 |
+				(0x3f3f3f * (i + 1) & 0xffffff);
+
+		stress->buffers[i] =
+			wl_shm_pool_create_buffer(pool, offset, size, size,
+						  size * 4,
+						  WL_SHM_FORMAT_XRGB8888);
+		offset += size * size * 4;
+	}
+	wl_shm_pool_destroy(pool);
+	munmap(data, total);
+	close(fd);
+
+	return 0;
+}
+
+static void
+handle_ping(void *data, struct wl_shell_surface *shell_surface,
+	    uint32_t serial)
+{
+	wl_shell_surface_pong(shell_surface, serial);
+}
+
+static void
+handle_configure(void *data, struct wl_shell_surface *shell_surface,
+		 uint32_t edges, int32_t width, int32_t height)
+{
+}
+
+static void
+handle_popup_done(void *data, struct wl_shell_surface *shell_surface)
+{
+}
+
+static const struct wl_shell_surface_listener shell_surface_listener = {
+	handle_ping,
+	handle_configure,
+	handle_popup_done
+};
+
+static void
+node_map(struct node *node, bool map)
+{
+	struct stress *stress = node->stress;
+	int size = level_size(node->level);
+
+	wl_surface_attach(node->surface,
+			  map ? stress->buffers[node->level] : NULL, 0, 0);
+	if (map)
+		wl_surface_damage(node->surface, 0, 0, size, size);
+	node->mapped = map;
+	node->dirty = true;
+}
+
+/* Spreads the children of a parent over a grid inside it, from where
+ * --move swings them back and forth. */
+static void
+node_position(struct node *node, double t)
+{
+	int parent_size = level_size(node->level - 1);
+	int size = level_size(node->level);
+	int cells = 1, x, y;
+
+	while (cells * cells < node->parent->child_count)
+		cells++;
+
+	x = (node->index % cells) * parent_size / cells;
+	y = (node->index / cells) * parent_size / cells;
+	if (option_move) {
+		x += size / 2 * sin(t / 500.0 + node->index + node->level);
+		y += size / 2 * cos(t / 700.0 + node->index * 2);
+	}
+
+	if (x != node->x || y != node->y) {
+		node->x = x;
+		node->y = y;
+		wl_subsurface_set_position(node->subsurface, x, y);
+		node->parent->dirty = true;
+	}
+}
+
+static struct node *
+create_node(struct stress *stress, struct node *parent, int index)
+{
+	struct node *node;
+	int i;
+
+	if (stress->node_count == MAX_NODES) {
+		fprintf(stderr, "more than %d surfaces\n", MAX_NODES);
+		exit(EXIT_FAILURE);
+	}
+
+	node = xzalloc(sizeof *node);
+	node->stress = stress;
+	node->parent = parent;
+	node->index = index;
+	node->level = parent ? parent->level + 1 : 0;
+	node->x = node->y = -1;
+	wl_list_init(&node->children);
+	node->surface = wl_compositor_create_surface(stress->compositor);
+	stress->nodes[stress->node_count++] = node;
+
+	if (parent) {
+		node->subsurface =
+			wl_subcompositor_get_subsurface(stress->subcompositor,
+							node->surface,
+							parent->surface);
+		if (!option_sync)
+			wl_subsurface_set_desync(node->subsurface);
+		wl_list_insert(parent->children.prev, &node->link);
+		parent->child_count++;
+	} else if (stress->ivi_application) {
+		node->ivi_surface =
+			ivi_application_surface_create(stress->ivi_application,
+						       IVI_SURFACE_ID(index),
+						       node->surface);
+	} else {
+		node->shell_surface =
+			wl_shell_get_shell_surface(stress->shell,
+						   node->surface);
+		wl_shell_surface_add_listener(node->shell_surface,
+					      &shell_surface_listener, node);
+		wl_shell_surface_set_title(node->shell_surface,
+					   "surface-stress");
+		wl_shell_surface_set_toplevel(node->shell_surface);
+	}
+
+	node_map(node, true);
+
+	if (node->level < option_depth)
+		for (i = 0; i < option_fanout; i++)
+			create_node(stress, node, i);
+
+	return node;
+}
+
+static void
+destroy_node(struct node *node)
+{
+	if (node->subsurface)
+		wl_subsurface_destroy(node->subsurface);
+	if (node->shell_surface)
+		wl_shell_surface_destroy(node->shell_surface);
+	if (node->ivi_surface)
+		ivi_surface_destroy(node->ivi_surface);
+	wl_surface_destroy(node->surface);
+	free(node);
+}
+
+/* Nodes are created parents first, so committing in reverse order
+ * gets a synchronized child's state cached before its parent's
+ * commit applies it. */
+static void
+commit_nodes(struct stress *stress)
+{
+	struct node *node;
+	int i;
+
+	for (i = stress->node_count - 1; i >= 0; i--) {
+		node = stress->nodes[i];
+		if (!node->dirty)
+			continue;
+
+		wl_surface_commit(node->surface);
+		node->dirty = false;
+		if (option_sync && node->parent)
+			node->parent->dirty = true;
+	}
+}
+
+static void
+churn_map(struct stress *stress)
+{
+	struct node *node;
+
+	/* The first surface drives the frame callbacks. */
+	if (stress->node_count < 2)
+		return;
+
+	node = stress->nodes[1 + random() % (stress->node_count - 1)];
+	node_map(node, !node->mapped);
+	if (node->mapped)
+		stress->counters.maps++;
+	else
+		stress->counters.unmaps++;
+}
+
+static void
+churn_restack(struct stress *stress)
+{
+	struct node *node, *sibling;
+	int i, n;
+
+	if (option_depth == 0 || option_fanout < 2)
+		return;
+
+	do
+		node = stress->nodes[random() % stress->node_count];
+	while (!node->parent);
+
+	n = random() % node->parent->child_count;
+	i = 0;
+	wl_list_for_each(sibling, &node->parent->children, link)
+		if (i++ == n)
+			break;
+
+	if (sibling == node)
+		wl_subsurface_place_below(node->subsurface,
+					  node->parent->surface);
+	else if (random() & 1)
+		wl_subsurface_place_above(node->subsurface, sibling->surface);
+	else
+		wl_subsurface_place_below(node->subsurface, sibling->surface);
+
+	node->parent->dirty = true;
+	stress->counters.restacks++;
+}
+
+static void
+report(struct stress *stress, double now)
+{
+	struct counters *c = &stress->counters;
+	double elapsed = (now - stress->last_report) / 1000.0;
+
+	printf("%.3f %u %.1f %.2f %.3f %u %u %u\n",
+	       (now - stress->start_time) / 1000.0, c->frames,
+	       c->frames / elapsed, c->interval_max,
+	       c->sync_count ? c->sync_sum / c->sync_count : 0.0,
+	       c->maps, c->unmaps, c->restacks);
+	fflush(stdout);
+
+	memset(c, 0, sizeof *c);
+	stress->last_report = now;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	const double *da = a, *db = b;
+
+	return (*da > *db) - (*da < *db);
+}
+
+static void
+report_summary(struct stress *stress)
+{
+	int n = stress->interval_count;
+
+	if (n == 0)
+		return;
+
+	qsort(stress->intervals, n, sizeof *stress->intervals,
+	      compare_double);
+	printf("# summary frames=%u interval_median_ms=%.2f "
+	       "interval_p99_ms=%.2f interval_max_ms=%.2f\n",
+	       stress->total_frames, stress->intervals[n / 2],
+	       stress->intervals[(n - 1) * 99 / 100],
+	       stress->intervals[n - 1]);
+}
+
+static void
+sync_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct stress *stress = data;
+
+	stress->counters.sync_sum += get_time() - stress->sync_time;
+	stress->counters.sync_count++;
+	wl_callback_destroy(callback);
+	stress->sync_callback = NULL;
+}
+
+static const struct wl_callback_listener sync_listener = {
+	sync_done
+};
+
+static const struct wl_callback_listener frame_listener;
+
+static void
+frame(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct stress *stress = data;
+	double now = get_time(), interval, dt;
+	int i;
+
+	if (callback)
+		wl_callback_destroy(callback);
+
+	if (stress->last_frame > 0) {
+		interval = now - stress->last_frame;
+		dt = interval / 1000.0;
+		if (interval > stress->counters.interval_max)
+			stress->counters.interval_max = interval;
+		if (stress->interval_count < MAX_SAMPLES)
+			stress->intervals[stress->interval_count++] = interval;
+
+		stress->map_debt += option_map_rate * dt;
+		stress->restack_debt += option_restack_rate * dt;
+	}
+	stress->last_frame = now;
+	stress->counters.frames++;
+	stress->total_frames++;
+
+	for (; stress->map_debt >= 1.0; stress->map_debt -= 1.0)
+		churn_map(stress);
+	for (; stress->restack_debt >= 1.0; stress->restack_debt -= 1.0)
+		churn_restack(stress);
+
+	if (option_move)
+		for (i = 0; i < stress->node_count; i++)
+			if (stress->nodes[i]->parent)
+				node_position(stress->nodes[i], now);
+
+	stress->frame_callback = wl_surface_frame(stress->nodes[0]->surface);
+	wl_callback_add_listener(stress->frame_callback, &frame_listener,
+				 stress);
+	stress->nodes[0]->dirty = true;
+	commit_nodes(stress);
+
+	if (!stress->sync_callback) {
+		stress->sync_time = get_time();
+		stress->sync_callback = wl_display_sync(stress->display);
+		wl_callback_add_listener(stress->sync_callback,
+					 &sync_listener, stress);
+	}
+
+	if (now - stress->last_report >= 1000.0)
+		report(stress, now);
+
+	if (option_duration > 0 &&
+	    now - stress->start_time >= option_duration * 1000.0)
+		running = 0;
+}
+
+static const struct wl_callback_listener frame_listener = {
+	frame
+};
+
+static void
+shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+{
+	struct stress *stress = data;
+
+	stress->formats |= (1 << format);
+}
+
+struct wl_shm_listener shm_listener = {
+	shm_format
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t id, const char *interface, uint32_t version)
+{
+	struct stress *stress = data;
+
+	if (strcmp(interface, "wl_compositor") == 0) {
+		stress->compositor =
+			wl_registry_bind(registry,
+					 id, &wl_compositor_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		stress->subcompositor =
+			wl_registry_bind(registry,
+					 id, &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, "wl_shell") == 0) {
+		stress->shell = wl_registry_bind(registry,
+						 id, &wl_shell_interface, 1);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		stress->shm = wl_registry_bind(registry,
+					       id, &wl_shm_interface, 1);
+		wl_shm_add_listener(stress->shm, &shm_listener, stress);
+	} else if (strcmp(interface, "ivi_application") == 0) {
+		stress->ivi_application =
+			wl_registry_bind(registry, id,
+					 &ivi_application_interface, 1);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static void
+signal_int(int signum)
+{
+	running = 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sigint;
+	struct stress stress = { 0 };
+	long per_tree = 1, level_nodes = 1;
+	int i, ret = 0;
+
+	parse_options(options, ARRAY_LENGTH(options), &argc, argv);
+	if (option_help) {
+		printf(help_text, argv[0]);
+		return 0;
+	}
+
+	if (option_surfaces < 1 || option_surfaces > 0xffff ||
+	    option_depth < 0 ||
+	    option_depth >= MAX_LEVELS || option_fanout < 1 ||
+	    option_size < 4 || option_map_rate < 0 ||
+	    option_restack_rate < 0 || option_duration < 0) {
+		fprintf(stderr, "invalid option value\n");
+		fprintf(stderr, help_text, argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < option_depth && per_tree <= MAX_NODES; i++) {
+		level_nodes *= option_fanout;
+		per_tree += level_nodes;
+	}
+	if (per_tree * option_surfaces > MAX_NODES) {
+		fprintf(stderr, "more than %d surfaces\n", MAX_NODES);
+		return 1;
+	}
+
+	stress.display = wl_display_connect(NULL);
+	if (!stress.display) {
+		fprintf(stderr, "failed to connect to display: %m\n");
+		return 1;
+	}
+
+	stress.registry = wl_display_get_registry(stress.display);
+	wl_registry_add_listener(stress.registry,
+				 &registry_listener, &stress);
+	wl_display_roundtrip(stress.display);
+	wl_display_roundtrip(stress.display);
+
+	if (!stress.compositor || !stress.shm ||
+	    (!stress.shell && !stress.ivi_application) ||
+	    (option_depth > 0 && !stress.subcompositor)) {
+		fprintf(stderr, "missing wl_compositor, wl_shm, a shell "
+			"or wl_subcompositor\n");
+		return 1;
+	}
+	if (!(stress.formats & (1 << WL_SHM_FORMAT_XRGB8888))) {
+		fprintf(stderr, "WL_SHM_FORMAT_XRGB32 not available\n");
+		return 1;
+	}
+
+	if (create_buffers(&stress) < 0)
+		return 1;
+
+	stress.nodes = xzalloc(per_tree * option_surfaces *
+			       sizeof *stress.nodes);
+	stress.intervals = xzalloc(MAX_SAMPLES * sizeof *stress.intervals);
+
+	srandom(1);
+
+	stress.start_time = get_time();
+	for (i = 0; i < option_surfaces; i++)
+		create_node(&stress, NULL, i);
+
+	for (i = 0; i < stress.node_count; i++)
+		if (stress.nodes[i]->parent)
+			node_position(stress.nodes[i], stress.start_time);
+
+	printf("# surfaces=%d nodes=%d depth=%d fanout=%d size=%d "
+	       "map_rate=%d restack_rate=%d move=%d sync=%d\n",
+	       option_surfaces, stress.node_count, option_depth,
+	       option_fanout, option_size, option_map_rate,
+	       option_restack_rate, option_move, option_sync);
+	printf("# time_s frames fps interval_max_ms sync_ms "
+	       "maps unmaps restacks\n");
+
+	sigint.sa_handler = signal_int;
+	sigemptyset(&sigint.sa_mask);
+	sigint.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sigint, NULL);
+
+	stress.start_time = stress.last_report = get_time();
+	frame(&stress, NULL, 0);
+
+	while (running && ret != -1)
+		ret = wl_display_dispatch(stress.display);
+
+	report_summary(&stress);
+
+	if (stress.frame_callback)
+		wl_callback_destroy(stress.frame_callback);
+	if (stress.sync_callback)
+		wl_callback_destroy(stress.sync_callback);
+
+	for (i = stress.node_count - 1; i >= 0; i--)
+		destroy_node(stress.nodes[i]);
+	for (i = 0; i <= option_depth; i++)
+		wl_buffer_destroy(stress.buffers[i]);
+
+	free(stress.nodes);
+	free(stress.intervals);
+
+	if (stress.subcompositor)
+		wl_subcompositor_destroy(stress.subcompositor);
+	if (stress.ivi_application)
+		ivi_application_destroy(stress.ivi_application);
+	if (stress.shell)
+		wl_shell_destroy(stress.shell);
+	wl_shm_destroy(stress.shm);
+	wl_compositor_destroy(stress.compositor);
+	wl_registry_destroy(stress.registry);
+	wl_display_flush(stress.display);
+	wl_display_disconnect(stress.display);
+
+	return 0;
+}
@@ -50,6 +50,7 @@ static char *option_font;
 static int option_font_size;
 static char *option_term;
 static char *option_shell;
+static int option_scrollback_lines;
 
 static struct wl_list terminal_list;
 
@@ -424,6 +425,19 @@ enum {
 	SELECT_LINE
 };
 
+/* Glyphs for the characters drawn lately, so that redraws don't have to
+ * go through cairo_scaled_font_text_to_glyphs() for every cell. The
+ * glyph positions are relative to the cell origin. */
+#define GLYPH_CACHE_SIZE	512
+#define GLYPH_CACHE_GLYPHS	4
+
+struct glyph_cache_entry {
+	cairo_scaled_font_t *font;
+	uint32_t ch;
+	int count;
+	cairo_glyph_t glyphs[GLYPH_CACHE_GLYPHS];
+};
+
 struct terminal {
 	struct window *window;
 	struct widget *widget;
@@ -475,6 +489,15 @@ struct terminal {
 	int selection_start_row, selection_start_col;
 	int selection_end_row, selection_end_col;
 	struct wl_list link;
+
+	/* The cells as of the last redraw request, to tell which rows
+	 * changed since; see terminal_schedule_redraw(). */
+	union utf8_char *drawn_data;
+	uint32_t *drawn_attr;
+	int drawn_width, drawn_height;
+	int drawn_cursor_row, drawn_cursor_column, drawn_cursor_box;
+
+	struct glyph_cache_entry glyph_cache[GLYPH_CACHE_SIZE];
 };
 
 /* Create default tab stops, every 8 characters */
@@ -984,10 +1007,54 @@ glyph_run_flush(struct glyph_run *run, union decoded_attr attr)
 	run->attr = attr;
 }
 
+static struct glyph_cache_entry *
+glyph_cache_lookup(struct terminal *terminal, cairo_scaled_font_t *font,
+		   union utf8_char *c)
+{
+	struct glyph_cache_entry *entry;
+	cairo_glyph_t *glyphs;
+	cairo_status_t status;
+	uint32_t hash;
+	int count;
+
+	hash = (c->ch ^ (c->ch >> 15)) * 0x9e3779b1;
+	if (font == terminal->font_bold)
+		hash ^= 0x80000000;
+	entry = &terminal->glyph_cache[hash >> 23];
+
+	if (entry->font == font && entry->ch == c->ch)
+		return entry;
+
+	glyphs = entry->glyphs;
+	count = GLYPH_CACHE_GLYPHS;
+	status = cairo_scaled_font_text_to_glyphs(font, 0, 0,
+						  (char *) c->byte, 4,
+						  &glyphs, &count,
+						  NULL, NULL, NULL);
+	if (glyphs != entry->glyphs) {
+		/* More glyphs than fit; cairo allocated them */
+		cairo_glyph_free(glyphs);
+		entry->font = NULL;
+		return NULL;
+	}
+
+	if (status != CAIRO_STATUS_SUCCESS) {
+		entry->font = NULL;
+		return NULL;
+	}
+
+	entry->font = font;
+	entry->ch = c->ch;
+	entry->count = count;
+
+	return entry;
+}
+
 static void
 glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 {
-	int num_glyphs;
+	struct glyph_cache_entry *entry;
+	int num_glyphs, i;
 	cairo_scaled_font_t *font;
 
 	num_glyphs = ARRAY_LENGTH(run->glyphs) - run->count;
@@ -997,15 +1064,123 @@ glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 	else
 		font = run->terminal->font_normal;
 
-	cairo_move_to(run->cr, x, y);
-	cairo_scaled_font_text_to_glyphs (font, x, y,
-					  (char *) c->byte, 4,
-					  &run->g, &num_glyphs,
-					  NULL, NULL, NULL);
+	entry = glyph_cache_lookup(run->terminal, font, c);
+	if (entry && entry->count <= num_glyphs) {
+		for (i = 0; i < entry->count; i++) {
+			run->g[i].index = entry->glyphs[i].index;
+			run->g[i].x = entry->glyphs[i].x + x;
+			run->g[i].y = entry->glyphs[i].y + y;
+		}
+		num_glyphs = entry->count;
+	} else {
+		cairo_scaled_font_text_to_glyphs (font, x, y,
+						  (char *) c->byte, 4,
+						  &run->g, &num_glyphs,
+						  NULL, NULL, NULL);
+	}
 	run->g += num_glyphs;
 	run->count += num_glyphs;
 }
 
+/*
+ * Compare the cells with what they were at the last call, and redraw
+ * just the rows that changed, if any. The rows are compared as drawn,
+ * so the cursor, the selection and video inversion count as well.
+ */
+static void
+terminal_schedule_redraw(struct terminal *terminal)
+{
+	struct rectangle allocation;
+	union utf8_char *p_row, *drawn_row;
+	union decoded_attr attr;
+	uint32_t *drawn_attr;
+	int row, col, first = -1, last = -1, changed;
+	int cursor_box, size, top_margin;
+	double row_height = terminal->extents.height;
+
+	if (terminal->drawn_width != terminal->width ||
+	    terminal->drawn_height != terminal->height) {
+		size = terminal->width * terminal->height;
+		free(terminal->drawn_data);
+		free(terminal->drawn_attr);
+		terminal->drawn_data = xzalloc(size * sizeof *p_row);
+		terminal->drawn_attr = xzalloc(size * sizeof *drawn_attr);
+		terminal->drawn_width = terminal->width;
+		terminal->drawn_height = terminal->height;
+		first = 0;
+		last = terminal->height - 1;
+	}
+
+	for (row = 0; row < terminal->height; row++) {
+		p_row = terminal_get_row(terminal, row);
+		drawn_row = terminal->drawn_data + row * terminal->width;
+		drawn_attr = terminal->drawn_attr + row * terminal->width;
+
+		changed = memcmp(p_row, drawn_row,
+				 terminal->width * sizeof *p_row) != 0;
+		if (changed)
+			memcpy(drawn_row, p_row,
+			       terminal->width * sizeof *p_row);
+
+		for (col = 0; col < terminal->width; col++) {
+			terminal_decode_attr(terminal, row, col, &attr);
+			if (drawn_attr[col] != attr.key) {
+				drawn_attr[col] = attr.key;
+				changed = 1;
+			}
+		}
+
+		if (changed) {
+			if (first < 0 || row < first)
+				first = row;
+			if (row > last)
+				last = row;
+		}
+	}
+
+	/* The box drawn around the cursor when the window isn't focused */
+	cursor_box = (terminal->mode & MODE_SHOW_CURSOR) &&
+		!window_has_focus(terminal->window);
+	if (cursor_box != terminal->drawn_cursor_box ||
+	    terminal->row != terminal->drawn_cursor_row ||
+	    terminal->column != terminal->drawn_cursor_column) {
+		for (row = terminal->drawn_cursor_row;; row = terminal->row) {
+			if (row >= 0 && row < terminal->height) {
+				if (first < 0 || row < first)
+					first = row;
+				if (row > last)
+					last = row;
+			}
+			if (row == terminal->row)
+				break;
+		}
+		terminal->drawn_cursor_box = cursor_box;
+		terminal->drawn_cursor_row = terminal->row;
+		terminal->drawn_cursor_column = terminal->column;
+	}
+
+	if (first < 0)
+		return;
+
+	if (first == 0 && last == terminal->height - 1) {
+		widget_schedule_redraw(terminal->widget);
+		return;
+	}
+
+	/* Full width, and a row more on either side for glyphs that
+	 * stick out of their cells. */
+	widget_get_allocation(terminal->widget, &allocation);
+	top_margin = (allocation.height - terminal->height * row_height) / 2;
+	first = first > 0 ? first - 1 : 0;
+	last = last < terminal->height - 1 ? last + 1 : last;
+	widget_schedule_redraw_area(terminal->widget,
+				    allocation.x,
+				    allocation.y + top_margin +
+				    floor(first * row_height),
+				    allocation.width,
+				    ceil((last - first + 1) * row_height) + 1);
+}
+
 
 static void
 redraw_handler(struct widget *widget, void *data)
@@ -1024,6 +1199,8 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_font_extents_t extents;
 	double average_width;
 	double unichar_width;
+	double clip_x1, clip_y1, clip_x2, clip_y2;
+	int first_row, last_row;
 
 	surface = window_get_surface(terminal->window);
 	widget_get_allocation(terminal->widget, &allocation);
@@ -1031,6 +1208,7 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_rectangle(cr, allocation.x, allocation.y,
 			allocation.width, allocation.height);
 	cairo_clip(cr);
+	cairo_clip_extents(cr, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
 	cairo_push_group(cr);
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
@@ -1044,11 +1222,22 @@ redraw_handler(struct widget *widget, void *data)
 	side_margin = (allocation.width - terminal->width * average_width) / 2;
 	top_margin = (allocation.height - terminal->height * extents.height) / 2;
 
+	/* Only the rows in the area being redrawn, and their neighbours,
+	 * whose glyphs may reach into it. */
+	first_row = floor((clip_y1 - allocation.y - top_margin) /
+			  extents.height) - 1;
+	last_row = ceil((clip_y2 - allocation.y - top_margin) /
+			extents.height) + 1;
+	if (first_row < 0)
+		first_row = 0;
+	if (last_row > terminal->height)
+		last_row = terminal->height;
+
 	cairo_set_line_width(cr, 1.0);
 	cairo_translate(cr, allocation.x + side_margin,
 			allocation.y + top_margin);
 	/* paint the background */
-	for (row = 0; row < terminal->height; row++) {
+	for (row = first_row; row < last_row; row++) {
 		p_row = terminal_get_row(terminal, row);
 		for (col = 0; col < terminal->width; col++) {
 			/* get the attributes for this character cell */
@@ -1077,7 +1266,7 @@ redraw_handler(struct widget *widget, void *data)
 
 	/* paint the foreground */
 	glyph_run_init(&run, terminal, cr);
-	for (row = 0; row < terminal->height; row++) {
+	for (row = first_row; row < last_row; row++) {
 		p_row = terminal_get_row(terminal, row);
 		for (col = 0; col < terminal->width; col++) {
 			/* get the attributes for this character cell */
@@ -2002,14 +2191,83 @@ escape_append_utf8(struct terminal *terminal, union utf8_char utf8)
 	}
 }
 
+/*
+ * Put a run of printable ASCII straight into the current row, as far as
+ * it fits, short of going through handle_char() for each character.
+ * Returns how many bytes of data were taken.
+ */
+static size_t
+terminal_put_ascii(struct terminal *terminal, const char *data, size_t length)
+{
+	union utf8_char *row;
+	struct attr *attr_row;
+	size_t i, n;
+
+	if (terminal->state != escape_state_normal ||
+	    terminal->cs != CS_US || (terminal->mode & MODE_IRM) ||
+	    terminal->column >= terminal->width)
+		return 0;
+
+	switch (terminal->state_machine.state) {
+	case utf8state_start:
+	case utf8state_accept:
+	case utf8state_reject:
+		break;
+	default:
+		return 0;
+	}
+
+	n = terminal->width - terminal->column;
+	if (n > length)
+		n = length;
+	for (i = 0; i < n; i++)
+		if (data[i] < 0x20 || data[i] > 0x7e)
+			break;
+	if (i == 0)
+		return 0;
+	n = i;
+
+	row = terminal_get_row(terminal, terminal->row) + terminal->column;
+	attr_row = terminal_get_attr_row(terminal, terminal->row) +
+		terminal->column;
+	for (i = 0; i < n; i++) {
+		row[i].ch = 0;
+		row[i].byte[0] = data[i];
+		attr_row[i] = terminal->curr_attr;
+	}
+	terminal->column += n;
+	terminal->last_char = row[n - 1];
+
+	/* As handle_char() leaves it */
+	terminal->state_machine.state = utf8state_accept;
+	terminal->state_machine.s = row[n - 1];
+	terminal->state_machine.unicode = data[n - 1];
+
+	if (terminal->row + terminal->start + 1 > terminal->end)
+		terminal->end = terminal->row + terminal->start + 1;
+	if (terminal->end == terminal->buffer_height)
+		terminal->log_size = terminal->buffer_height;
+	else if (terminal->log_size < terminal->buffer_height)
+		terminal->log_size = terminal->end;
+
+	return n;
+}
+
 static void
 terminal_data(struct terminal *terminal, const char *data, size_t length)
 {
 	unsigned int i;
 	union utf8_char utf8;
 	enum utf8_state parser_state;
+	size_t n;
 
 	for (i = 0; i < length; i++) {
+		n = terminal_put_ascii(terminal, data + i, length - i);
+		if (n > 0) {
+			i += n - 1;
+			continue;
+		}
+
 		parser_state =
 			utf8_next_char(&terminal->state_machine, data[i]);
 		switch(parser_state) {
@@ -2149,7 +2407,7 @@ terminal_data(struct terminal *terminal, const char *data, size_t length)
 		} /* if */
 	} /* for */
 
-	window_schedule_redraw(terminal->window);
+	terminal_schedule_redraw(terminal);
 }
 
 static void
@@ -2850,7 +3108,12 @@ terminal_create(struct display *display)
 
 	terminal->display = display;
 	terminal->margin = 5;
-	terminal->buffer_height = 1024;
+
+	/* A power of two, so rows wrap around with a mask */
+	terminal->buffer_height = 64;
+	while (terminal->buffer_height < (uint32_t) option_scrollback_lines &&
+	       terminal->buffer_height < (1u << 20))
+		terminal->buffer_height *= 2;
 	terminal->end = 1;
 
 	window_set_user_data(terminal->window, terminal);
@@ -2920,6 +3183,8 @@ terminal_destroy(struct terminal *terminal)
 	if (wl_list_empty(&terminal_list))
 		display_exit(terminal->display);
 
+	free(terminal->drawn_data);
+	free(terminal->drawn_attr);
 	free(terminal->title);
 	free(terminal);
 }
@@ -2929,7 +3194,7 @@ io_handler(struct task *task, uint32_t events)
 {
 	struct terminal *terminal =
 		container_of(task, struct terminal, io_task);
-	char buffer[256];
+	char buffer[16384];
 	int len;
 
 	if (events & EPOLLHUP) {
@@ -3003,6 +3268,8 @@ int main(int argc, char *argv[])
 	weston_config_section_get_string(s, "font", &option_font, "mono");
 	weston_config_section_get_int(s, "font-size", &option_font_size, 14);
 	weston_config_section_get_string(s, "term", &option_term, "xterm");
+	weston_config_section_get_int(s, "scrollback-lines",
+				      &option_scrollback_lines, 1024);
 	weston_config_destroy(config);
 
 	d = display_create(&argc, argv);
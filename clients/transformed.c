@@ -33,6 +33,7 @@
 #include <linux/input.h>
 #include <wayland-client.h>
 #include "window.h"
+#include "scanout-bench.h"
 
 struct transformed {
 	struct display *display;
@@ -40,6 +41,12 @@ struct transformed {
 	struct widget *widget;
 	int width, height;
 	int fullscreen;
+	struct scanout_bench *bench;
+};
+
+static const char * const transform_names[] = {
+	"normal", "90", "180", "270",
+	"flipped", "flipped-90", "flipped-180", "flipped-270"
 };
 
 static void
@@ -121,13 +128,43 @@ redraw_handler(struct widget *widget, void *data)
 	draw_stuff(cr, allocation.width, allocation.height);
 
 	cairo_surface_destroy(surface);
+
+	if (transformed->bench)
+		scanout_bench_frame(transformed->bench);
+}
+
+static const char *
+bench_config(void *data, int index)
+{
+	struct transformed *transformed = data;
+	static char label[32];
+
+	if (index >= (int) ARRAY_LENGTH(transform_names))
+		return NULL;
+
+	window_set_buffer_transform(transformed->window, index);
+	snprintf(label, sizeof label, "transform %s", transform_names[index]);
+
+	return label;
+}
+
+static void
+global_handler(struct display *display, uint32_t name,
+	       const char *interface, uint32_t version, void *data)
+{
+	struct transformed *transformed = data;
+
+	scanout_bench_global(transformed->bench, name, interface, version);
 }
 
 static void
 output_handler(struct window *window, struct output *output, int enter,
 	       void *data)
 {
-	if (!enter)
+	struct transformed *transformed = data;
+
+	/* The benchmark picks the transforms itself */
+	if (!enter || transformed->bench)
 		return;
 
 	window_set_buffer_transform(window, output_get_transform(output));
@@ -228,7 +265,12 @@ usage(int error_code)
 		"   -d\t\tUse \"driver\" fullscreen method\n"
 		"   -w <width>\tSet window width to <width>\n"
 		"   -h <height>\tSet window height to <height>\n"
-		"   --help\tShow this help text\n\n");
+		"   --benchmark\tRun fullscreen through all buffer transforms\n"
+		"\t\tand report frame timing and plane placement\n"
+		"   --frames <n>\tMeasure <n> frames per transform\n"
+		"   --help\tShow this help text\n\n"
+		"Plane placement is reported when the compositor runs\n"
+		"the weston-test module.\n\n");
 
 	exit(error_code);
 }
@@ -237,11 +279,13 @@ int main(int argc, char *argv[])
 {
 	struct transformed transformed;
 	struct display *d;
+	int benchmark = 0, frames = 300;
 	int i;
 
 	transformed.width = 500;
 	transformed.height = 250;
 	transformed.fullscreen = 0;
+	transformed.bench = NULL;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-w") == 0) {
@@ -254,6 +298,13 @@ int main(int argc, char *argv[])
 				usage(EXIT_FAILURE);
 
 			transformed.height = atol(argv[i]);
+		} else if (strcmp(argv[i], "--benchmark") == 0) {
+			benchmark = 1;
+		} else if (strcmp(argv[i], "--frames") == 0) {
+			if (++i >= argc)
+				usage(EXIT_FAILURE);
+
+			frames = atol(argv[i]);
 		} else if (strcmp(argv[i], "--help") == 0)
 			usage(EXIT_SUCCESS);
 		else
@@ -289,7 +340,21 @@ int main(int argc, char *argv[])
 	window_schedule_resize(transformed.window,
 			       transformed.width, transformed.height);
 
+	if (benchmark) {
+		transformed.bench = scanout_bench_create(d, transformed.window,
+							 frames, bench_config,
+							 &transformed);
+		transformed.fullscreen = 1;
+		window_set_fullscreen(transformed.window, 1);
+
+		display_set_user_data(d, &transformed);
+		display_set_global_handler(d, global_handler);
+	}
+
 	display_run(d);
 
+	if (transformed.bench)
+		scanout_bench_destroy(transformed.bench);
+
 	return 0;
 }
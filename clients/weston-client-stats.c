@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+
+#include "client-stats-client-protocol.h"
+
+/* Prints what each client costs the compositor, once or every few
+ * seconds, through the weston_client_stats debugging interface.  The
+ * compositor only offers it with [core] client-stats=true. */
+
+struct stats_client {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct weston_client_stats *stats;
+	int done;
+};
+
+static void
+stats_handle_client(void *data, struct weston_client_stats *stats,
+		    int32_t pid, uint32_t uid,
+		    uint32_t surfaces, uint32_t views,
+		    uint32_t buffer_kb, uint32_t texture_kb,
+		    uint32_t commit_rate, uint32_t damage_rate,
+		    uint32_t cpu_rate, uint32_t flags)
+{
+	printf("%7d %6u %8u %5u %9u %9u %9u %10u %7u%s\n",
+	       pid, uid, surfaces, views, buffer_kb, texture_kb,
+	       commit_rate, damage_rate, cpu_rate,
+	       flags & WESTON_CLIENT_STATS_FLAGS_THROTTLED ?
+	       " throttled" : "");
+}
+
+static void
+stats_handle_done(void *data, struct weston_client_stats *stats)
+{
+	struct stats_client *client = data;
+
+	client->done = 1;
+}
+
+static const struct weston_client_stats_listener stats_listener = {
+	stats_handle_client,
+	stats_handle_done
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t id, const char *interface, uint32_t version)
+{
+	struct stats_client *client = data;
+
+	if (strcmp(interface, "weston_client_stats") == 0) {
+		client->stats =
+			wl_registry_bind(registry, id,
+					 &weston_client_stats_interface, 1);
+		weston_client_stats_add_listener(client->stats,
+						 &stats_listener, client);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static int
+sample(struct stats_client *client)
+{
+	printf("    pid    uid surfaces views buffer_kb texture_kb "
+	       "commits/s  damage/s   us/s\n");
+
+	client->done = 0;
+	weston_client_stats_sample(client->stats);
+	while (!client->done)
+		if (wl_display_dispatch(client->display) < 0)
+			return -1;
+
+	return 0;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-i seconds]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct stats_client client = { 0 };
+	int interval = 0, opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "i:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	client.display = wl_display_connect(NULL);
+	if (!client.display) {
+		fprintf(stderr, "failed to create display: %m\n");
+		return 1;
+	}
+
+	client.registry = wl_display_get_registry(client.display);
+	wl_registry_add_listener(client.registry, &registry_listener, &client);
+	wl_display_roundtrip(client.display);
+
+	if (!client.stats) {
+		fprintf(stderr, "weston_client_stats not available, "
+			"is client-stats enabled in weston.ini?\n");
+		ret = 1;
+		goto out;
+	}
+
+	do {
+		if (sample(&client) < 0) {
+			ret = 1;
+			break;
+		}
+		if (interval > 0) {
+			sleep(interval);
+			printf("\n");
+		}
+	} while (interval > 0);
+
+	weston_client_stats_destroy(client.stats);
+out:
+	wl_registry_destroy(client.registry);
+	wl_display_disconnect(client.display);
+
+	return ret;
+}
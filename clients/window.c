@@ -117,8 +117,14 @@ struct display {
 
 	struct theme *theme;
 
+	/* Loaded when a pointer first needs a cursor, see
+	 * display_get_cursor() */
+	char *cursor_theme_name;
+	int cursor_size;
+	int cursor_theme_failed;
 	struct wl_cursor_theme *cursor_theme;
-	struct wl_cursor **cursors;
+	struct wl_cursor *cursors[CURSOR_BLANK];
+	uint32_t cursors_missing;	/* 1 << enum cursor_type */
 
 	display_output_handler_t output_configure_handler;
 	display_global_handler_t global_handler;
@@ -159,13 +165,23 @@ struct toysurface {
 				    int32_t width, int32_t height, uint32_t flags,
 				    enum wl_output_transform buffer_transform, int32_t buffer_scale);
 
+	/*
+	 * Add to *damage the part of the buffer returned by prepare()
+	 * that doesn't hold what was last posted with swap(), in buffer
+	 * coordinates. Returns -1 if that is all of it, or unknown.
+	 */
+	int (*get_buffer_damage)(struct toysurface *base,
+				 struct rectangle *damage);
+
 	/*
 	 * Post the surface to the server, returning the server allocation
-	 * rectangle. The Cairo surface from prepare() must be destroyed
-	 * after calling this.
+	 * rectangle. Only damage, in buffer coordinates, has changed
+	 * since the last swap(); NULL means the whole buffer. The Cairo
+	 * surface from prepare() must be destroyed after calling this.
 	 */
 	void (*swap)(struct toysurface *base,
 		     enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		     struct rectangle *damage,
 		     struct rectangle *server_allocation);
 
 	/*
@@ -197,6 +213,13 @@ struct surface {
 	struct toysurface *toysurface;
 	struct widget *widget;
 	int redraw_needed;
+	/* While only parts of the surface asked to be redrawn, the
+	 * bounding box of those; and the area being redrawn, when that
+	 * is not the whole surface. Both in widget coordinates. */
+	int damage_partial;
+	struct rectangle damage;
+	int repaint_partial;
+	struct rectangle repaint;
 	struct wl_callback *frame_cb;
 	uint32_t last_time;
 
@@ -226,6 +249,17 @@ struct window {
 	int redraw_needed;
 	int redraw_task_scheduled;
 	struct task redraw_task;
+
+	/* Frame pacing, see window_set_frame_deadline() */
+	int32_t frame_deadline;		/* us, 0 if off */
+	int pacing_fd;
+	int pacing_armed;
+	struct task pacing_task;
+	int paced_redraw;
+	struct timespec frame_done;	/* main surface frame callback */
+	uint32_t frame_interval;	/* us, estimated */
+	uint32_t render_time;		/* us, estimated */
+
 	int resize_needed;
 	int custom;
 	int focused;
@@ -395,6 +429,7 @@ struct shm_pool {
 	size_t size;
 	size_t used;
 	void *data;
+	int fd;		/* kept open only for pools that can grow */
 };
 
 enum {
@@ -447,6 +482,50 @@ debug_print(void *proxy, int line, const char *func, const char *fmt, ...)
 
 #endif
 
+#define MIN(a,b) ((a) < (b) ? a : b)
+#define MAX(a,b) ((a) > (b) ? a : b)
+
+/* Grow dst to the bounding box of dst and src; empty ones don't count */
+static void
+rectangle_union(struct rectangle *dst, const struct rectangle *src)
+{
+	int32_t x1, y1, x2, y2;
+
+	if (src->width <= 0 || src->height <= 0)
+		return;
+
+	if (dst->width <= 0 || dst->height <= 0) {
+		*dst = *src;
+		return;
+	}
+
+	x1 = MIN(dst->x, src->x);
+	y1 = MIN(dst->y, src->y);
+	x2 = MAX(dst->x + dst->width, src->x + src->width);
+	y2 = MAX(dst->y + dst->height, src->y + src->height);
+
+	dst->x = x1;
+	dst->y = y1;
+	dst->width = x2 - x1;
+	dst->height = y2 - y1;
+}
+
+static void
+rectangle_intersect(struct rectangle *dst, const struct rectangle *src)
+{
+	int32_t x1, y1, x2, y2;
+
+	x1 = MAX(dst->x, src->x);
+	y1 = MAX(dst->y, src->y);
+	x2 = MIN(dst->x + dst->width, src->x + src->width);
+	y2 = MIN(dst->y + dst->height, src->y + src->height);
+
+	dst->x = x1;
+	dst->y = y1;
+	dst->width = MAX(x2 - x1, 0);
+	dst->height = MAX(y2 - y1, 0);
+}
+
 static void
 surface_to_buffer_size (enum wl_output_transform buffer_transform, int32_t buffer_scale, int32_t *width, int32_t *height)
 {
@@ -523,9 +602,18 @@ egl_window_surface_prepare(struct toysurface *base, int dx, int dy,
 	return cairo_surface_reference(surface->cairo_surface);
 }
 
+static int
+egl_window_surface_get_buffer_damage(struct toysurface *base,
+				     struct rectangle *damage)
+{
+	/* No buffer age without EGL_EXT_buffer_age */
+	return -1;
+}
+
 static void
 egl_window_surface_swap(struct toysurface *base,
 			enum wl_output_transform buffer_transform, int32_t buffer_scale,
+			struct rectangle *damage,
 			struct rectangle *server_allocation)
 {
 	struct egl_window_surface *surface = to_egl_window_surface(base);
@@ -613,6 +701,7 @@ egl_window_surface_create(struct display *display,
 		return NULL;
 
 	surface->base.prepare = egl_window_surface_prepare;
+	surface->base.get_buffer_damage = egl_window_surface_get_buffer_damage;
 	surface->base.swap = egl_window_surface_swap;
 	surface->base.acquire = egl_window_surface_acquire;
 	surface->base.release = egl_window_surface_release;
@@ -684,7 +773,7 @@ shm_surface_data_destroy(void *p)
 }
 
 static struct wl_shm_pool *
-make_shm_pool(struct display *display, int size, void **data)
+make_shm_pool(struct display *display, int size, void **data, int *fd_ret)
 {
 	struct wl_shm_pool *pool;
 	int fd;
@@ -703,23 +792,32 @@ make_shm_pool(struct display *display, int size, void **data)
 		return NULL;
 	}
 
+	os_advise_huge_pages(*data, size);
+
 	pool = wl_shm_create_pool(display->shm, fd, size);
 
-	close(fd);
+	if (fd_ret)
+		*fd_ret = fd;
+	else
+		close(fd);
 
 	return pool;
 }
 
 static struct shm_pool *
-shm_pool_create(struct display *display, size_t size)
+shm_pool_create_internal(struct display *display, size_t size, int growable)
 {
 	struct shm_pool *pool = malloc(sizeof *pool);
 
 	if (!pool)
 		return NULL;
 
-	pool->pool = make_shm_pool(display, size, &pool->data);
+	pool->fd = -1;
+	pool->pool = make_shm_pool(display, size, &pool->data,
+				   growable ? &pool->fd : NULL);
 	if (!pool->pool) {
+		if (pool->fd >= 0)
+			close(pool->fd);
 		free(pool);
 		return NULL;
 	}
@@ -730,6 +828,68 @@ shm_pool_create(struct display *display, size_t size)
 	return pool;
 }
 
+static struct shm_pool *
+shm_pool_create(struct display *display, size_t size)
+{
+	return shm_pool_create_internal(display, size, 0);
+}
+
+/* Pool sizes for growable pools go up in powers of two, so a window
+ * being resized bigger and bigger only grows its pool a handful of
+ * times. */
+static size_t
+shm_pool_size_for(size_t size)
+{
+	size_t pool_size = 64 * 1024;
+
+	while (pool_size < size)
+		pool_size *= 2;
+
+	return pool_size;
+}
+
+static struct shm_pool *
+shm_pool_create_growable(struct display *display, size_t size)
+{
+	return shm_pool_create_internal(display, shm_pool_size_for(size), 1);
+}
+
+/* Grow a growable pool to hold at least size bytes.  The old mapping
+ * goes away, so nothing may be allocated from the pool yet. */
+static int
+shm_pool_grow(struct shm_pool *pool, size_t size)
+{
+	void *data;
+
+	assert(pool->used == 0);
+
+	if (pool->fd < 0)
+		return -1;
+
+	size = shm_pool_size_for(size);
+	if (os_resize_anonymous_file(pool->fd, size) < 0) {
+		fprintf(stderr, "growing a buffer file to %zu B failed: %m\n",
+			size);
+		return -1;
+	}
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    pool->fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		return -1;
+	}
+
+	os_advise_huge_pages(data, size);
+
+	munmap(pool->data, pool->size);
+	wl_shm_pool_resize(pool->pool, size);
+	pool->data = data;
+	pool->size = size;
+
+	return 0;
+}
+
 static void *
 shm_pool_allocate(struct shm_pool *pool, size_t size, int *offset)
 {
@@ -748,6 +908,8 @@ shm_pool_destroy(struct shm_pool *pool)
 {
 	munmap(pool->data, pool->size);
 	wl_shm_pool_destroy(pool->pool);
+	if (pool->fd >= 0)
+		close(pool->fd);
 	free(pool);
 }
 
@@ -834,9 +996,13 @@ display_create_shm_surface(struct display *display,
 	struct shm_surface_data *data;
 	struct shm_pool *pool;
 	cairo_surface_t *surface;
+	int length;
 
 	if (alternate_pool) {
+		length = data_length_for_shm_surface(rectangle);
 		shm_pool_reset(alternate_pool);
+		if (alternate_pool->size < (size_t) length)
+			shm_pool_grow(alternate_pool, length);
 		surface = display_create_shm_surface_from_pool(display,
 							       rectangle,
 							       flags,
@@ -905,6 +1071,11 @@ struct shm_surface_leaf {
 
 	struct shm_pool *resize_pool;
 	int busy;
+
+	/* What other leaves posted since this one was, in buffer
+	 * coordinates; stale_all if the contents are of no use. */
+	int stale_all;
+	struct rectangle stale;
 };
 
 static void
@@ -1052,22 +1223,24 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 	if (leaf->cairo_surface)
 		cairo_surface_destroy(leaf->cairo_surface);
 
+	rect.width = width;
+	rect.height = height;
+
 #ifdef USE_RESIZE_POOL
 	if (resize_hint && !leaf->resize_pool) {
-		/* Create a big pool to allocate from, while continuously
+		/* Create a pool to allocate from, while continuously
 		 * resizing. Mmapping a new pool in the server
 		 * is relatively expensive, so reusing a pool performs
 		 * better, but may temporarily reserve unneeded memory.
+		 * The pool grows with the window and is dropped once
+		 * the resize is over.
 		 */
-		/* We should probably base this number on the output size. */
-		leaf->resize_pool = shm_pool_create(surface->display,
-						    6 * 1024 * 1024);
+		leaf->resize_pool =
+			shm_pool_create_growable(surface->display,
+						 data_length_for_shm_surface(&rect));
 	}
 #endif
 
-	rect.width = width;
-	rect.height = height;
-
 	leaf->cairo_surface =
 		display_create_shm_surface(surface->display, &rect,
 					   surface->flags,
@@ -1078,6 +1251,7 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 
 	wl_buffer_add_listener(leaf->data->buffer,
 			       &shm_surface_buffer_listener, surface);
+	leaf->stale_all = 1;
 
 out:
 	surface->current = leaf;
@@ -1085,13 +1259,32 @@ out:
 	return cairo_surface_reference(leaf->cairo_surface);
 }
 
+static int
+shm_surface_get_buffer_damage(struct toysurface *base,
+			      struct rectangle *damage)
+{
+	struct shm_surface *surface = to_shm_surface(base);
+	struct shm_surface_leaf *leaf = surface->current;
+
+	/* An attach offset moves the old contents too */
+	if (!leaf || leaf->stale_all || surface->dx || surface->dy)
+		return -1;
+
+	rectangle_union(damage, &leaf->stale);
+
+	return 0;
+}
+
 static void
 shm_surface_swap(struct toysurface *base,
 		 enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		 struct rectangle *damage,
 		 struct rectangle *server_allocation)
 {
 	struct shm_surface *surface = to_shm_surface(base);
 	struct shm_surface_leaf *leaf = surface->current;
+	struct shm_surface_leaf *other;
+	int i;
 
 	server_allocation->width =
 		cairo_image_surface_get_width(leaf->cairo_surface);
@@ -1104,10 +1297,27 @@ shm_surface_swap(struct toysurface *base,
 
 	wl_surface_attach(surface->surface, leaf->data->buffer,
 			  surface->dx, surface->dy);
-	wl_surface_damage(surface->surface, 0, 0,
-			  server_allocation->width, server_allocation->height);
+	if (damage)
+		wl_surface_damage(surface->surface, damage->x, damage->y,
+				  damage->width, damage->height);
+	else
+		wl_surface_damage(surface->surface, 0, 0,
+				  server_allocation->width,
+				  server_allocation->height);
 	wl_surface_commit(surface->surface);
 
+	for (i = 0; i < MAX_LEAVES; i++) {
+		other = &surface->leaf[i];
+		if (other == leaf) {
+			other->stale_all = 0;
+			memset(&other->stale, 0, sizeof other->stale);
+		} else if (!damage) {
+			other->stale_all = 1;
+		} else {
+			rectangle_union(&other->stale, damage);
+		}
+	}
+
 	DBG_OBJ(surface->surface, "leaf %d busy\n",
 		(int)(leaf - &surface->leaf[0]));
 
@@ -1152,6 +1362,7 @@ shm_surface_create(struct display *display, struct wl_surface *wl_surface,
 		return NULL;
 
 	surface->base.prepare = shm_surface_prepare;
+	surface->base.get_buffer_damage = shm_surface_get_buffer_damage;
 	surface->base.swap = shm_surface_swap;
 	surface->base.acquire = shm_surface_acquire;
 	surface->base.release = shm_surface_release;
@@ -1270,56 +1481,81 @@ static const struct cursor_alternatives cursors[] = {
 	{watches, ARRAY_LENGTH(watches)},
 };
 
+/* Only reads the settings; most clients never show anything but the
+ * arrow, many never get a pointer at all. */
 static void
 create_cursors(struct display *display)
 {
 	struct weston_config *config;
 	struct weston_config_section *s;
-	int size;
-	char *theme = NULL;
-	unsigned int i, j;
-	struct wl_cursor *cursor;
 
 	config = weston_config_parse("weston.ini");
 	s = weston_config_get_section(config, "shell", NULL, NULL);
-	weston_config_section_get_string(s, "cursor-theme", &theme, NULL);
-	weston_config_section_get_int(s, "cursor-size", &size, 32);
+	weston_config_section_get_string(s, "cursor-theme",
+					 &display->cursor_theme_name, NULL);
+	weston_config_section_get_int(s, "cursor-size",
+				      &display->cursor_size, 32);
 	weston_config_destroy(config);
+}
 
-	display->cursor_theme = wl_cursor_theme_load(theme, size, display->shm);
-	if (!display->cursor_theme) {
-		fprintf(stderr, "could not load theme '%s'\n", theme);
-		return;
+static void
+destroy_cursors(struct display *display)
+{
+	if (display->cursor_theme)
+		wl_cursor_theme_destroy(display->cursor_theme);
+	free(display->cursor_theme_name);
+}
+
+/* The theme is loaded on the first call, with the images of all its
+ * cursors in one shm pool shared by their buffers. The buffers are
+ * only created once an image is shown. */
+static struct wl_cursor *
+display_get_cursor(struct display *display, int pointer)
+{
+	struct wl_cursor *cursor = NULL;
+	unsigned int i;
+
+	if (pointer < 0 || pointer >= (int) ARRAY_LENGTH(cursors))
+		return NULL;
+
+	if (!display->cursor_theme && !display->cursor_theme_failed) {
+		display->cursor_theme =
+			wl_cursor_theme_load(display->cursor_theme_name,
+					     display->cursor_size,
+					     display->shm);
+		if (!display->cursor_theme) {
+			fprintf(stderr, "could not load theme '%s'\n",
+				display->cursor_theme_name);
+			display->cursor_theme_failed = 1;
+		}
 	}
-	free(theme);
-	display->cursors =
-		xmalloc(ARRAY_LENGTH(cursors) * sizeof display->cursors[0]);
 
-	for (i = 0; i < ARRAY_LENGTH(cursors); i++) {
-		cursor = NULL;
-		for (j = 0; !cursor && j < cursors[i].count; ++j)
-			cursor = wl_cursor_theme_get_cursor(
-			    display->cursor_theme, cursors[i].names[j]);
+	if (!display->cursor_theme)
+		return NULL;
+
+	if (display->cursors[pointer] ||
+	    display->cursors_missing & (1u << pointer))
+		return display->cursors[pointer];
 
-		if (!cursor)
-			fprintf(stderr, "could not load cursor '%s'\n",
-				cursors[i].names[0]);
+	for (i = 0; !cursor && i < cursors[pointer].count; ++i)
+		cursor = wl_cursor_theme_get_cursor(display->cursor_theme,
+						    cursors[pointer].names[i]);
 
-		display->cursors[i] = cursor;
+	if (!cursor) {
+		fprintf(stderr, "could not load cursor '%s'\n",
+			cursors[pointer].names[0]);
+		display->cursors_missing |= 1u << pointer;
 	}
-}
 
-static void
-destroy_cursors(struct display *display)
-{
-	wl_cursor_theme_destroy(display->cursor_theme);
-	free(display->cursors);
+	display->cursors[pointer] = cursor;
+
+	return cursor;
 }
 
 struct wl_cursor_image *
 display_get_pointer_image(struct display *display, int pointer)
 {
-	struct wl_cursor *cursor = display->cursors[pointer];
+	struct wl_cursor *cursor = display_get_cursor(display, pointer);
 
 	return cursor ? cursor->images[0] : NULL;
 }
@@ -1327,6 +1563,8 @@ display_get_pointer_image(struct display *display, int pointer)
 static void
 surface_flush(struct surface *surface)
 {
+	struct rectangle damage;
+
 	if (!surface->cairo_surface)
 		return;
 
@@ -1344,9 +1582,15 @@ surface_flush(struct surface *surface)
 		surface->input_region = NULL;
 	}
 
+	damage = surface->repaint;
+	damage.x -= surface->allocation.x;
+	damage.y -= surface->allocation.y;
+
 	surface->toysurface->swap(surface->toysurface,
 				  surface->buffer_transform, surface->buffer_scale,
+				  surface->repaint_partial ? &damage : NULL,
 				  &surface->server_allocation);
+	surface->repaint_partial = 0;
 
 	cairo_surface_destroy(surface->cairo_surface);
 	surface->cairo_surface = NULL;
@@ -1516,6 +1760,11 @@ window_destroy(struct window *window)
 
 	wl_list_remove(&window->redraw_task.link);
 
+	if (window->pacing_fd >= 0) {
+		display_unwatch_fd(display, window->pacing_fd);
+		close(window->pacing_fd);
+	}
+
 	wl_list_for_each(input, &display->input_list, link) {
 		if (input->touch_focus == window)
 			input->touch_focus = NULL;
@@ -1802,6 +2051,12 @@ widget_cairo_create(struct widget *widget)
 
 	cairo_translate(cr, -surface->allocation.x, -surface->allocation.y);
 
+	if (surface->repaint_partial) {
+		cairo_rectangle(cr, surface->repaint.x, surface->repaint.y,
+				surface->repaint.width, surface->repaint.height);
+		cairo_clip(cr);
+	}
+
 	return cr;
 }
 
@@ -1923,11 +2178,51 @@ widget_set_axis_handler(struct widget *widget,
 static void
 window_schedule_redraw_task(struct window *window);
 
+/* Mark rect, in widget coordinates, or the whole surface if NULL, as
+ * needing a redraw. */
+static void
+surface_add_damage(struct surface *surface, const struct rectangle *rect)
+{
+	if (!rect) {
+		surface->damage_partial = 0;
+	} else if (!surface->redraw_needed) {
+		surface->damage_partial = 1;
+		surface->damage = *rect;
+	} else if (surface->damage_partial) {
+		rectangle_union(&surface->damage, rect);
+	}
+
+	surface->redraw_needed = 1;
+}
+
 void
 widget_schedule_redraw(struct widget *widget)
 {
 	DBG_OBJ(widget->surface->surface, "widget %p\n", widget);
-	widget->surface->redraw_needed = 1;
+	surface_add_damage(widget->surface, NULL);
+	window_schedule_redraw_task(widget->window);
+}
+
+/*
+ * Like widget_schedule_redraw(), but only the given area, in the
+ * coordinates of widget allocations, is redrawn and posted to the
+ * compositor, as long as nothing else asks for more. The redraw
+ * handlers of all widgets on the surface still run, but cairo
+ * contexts from widget_cairo_create() are clipped to the area, and the
+ * rest of the buffer keeps its previous contents.
+ */
+void
+widget_schedule_redraw_area(struct widget *widget,
+			    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct rectangle rect = { x, y, width, height };
+
+	DBG_OBJ(widget->surface->surface, "widget %p %d,%d %dx%d\n",
+		widget, x, y, width, height);
+	if (width <= 0 || height <= 0)
+		return;
+
+	surface_add_damage(widget->surface, &rect);
 	window_schedule_redraw_task(widget->window);
 }
 
@@ -3434,7 +3729,7 @@ input_set_pointer_image_index(struct input *input, int index)
 	if (!input->pointer)
 		return;
 
-	cursor = input->display->cursors[input->current_cursor];
+	cursor = display_get_cursor(input->display, input->current_cursor);
 	if (!cursor)
 		return;
 
@@ -3485,7 +3780,7 @@ pointer_surface_frame_callback(void *data, struct wl_callback *callback,
 
 	if (input->current_cursor == CURSOR_UNSET)
 		return;
-	cursor = input->display->cursors[input->current_cursor];
+	cursor = display_get_cursor(input->display, input->current_cursor);
 	if (!cursor)
 		return;
 
@@ -4023,6 +4318,160 @@ widget_redraw(struct widget *widget)
 		widget_redraw(child);
 }
 
+/*
+ * Frame pacing: with a deadline set, a redraw asked for after a frame
+ * callback doesn't start right away, but late enough that it should
+ * be done the deadline before the next frame, going by the refresh
+ * interval seen in frame callbacks and by how long redraws have been
+ * taking. Input in the meantime goes into that same redraw.
+ */
+#define DEFAULT_FRAME_INTERVAL 16667
+
+static int64_t
+timespec_sub_to_us(const struct timespec *a, const struct timespec *b)
+{
+	return (int64_t) (a->tv_sec - b->tv_sec) * 1000000 +
+		(a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+static void
+window_frame_done(struct window *window, uint32_t last, uint32_t time)
+{
+	uint32_t interval;
+
+	clock_gettime(CLOCK_MONOTONIC, &window->frame_done);
+
+	/* Callbacks for frames back to back give the refresh interval,
+	 * longer gaps are frames the window had nothing to show for. */
+	if (last == 0 || time == last || time - last > 1000)
+		return;
+
+	interval = (time - last) * 1000;
+	if (interval < window->frame_interval * 3 / 2)
+		window->frame_interval =
+			(window->frame_interval * 7 + interval) / 8;
+}
+
+static void
+window_update_render_time(struct window *window,
+			  const struct timespec *start)
+{
+	struct timespec now;
+	int64_t t, late;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	t = timespec_sub_to_us(&now, start);
+
+	/* Missing the frame counts as rendering that much slower, so
+	 * the next redraw starts earlier. */
+	if (window->paced_redraw) {
+		late = timespec_sub_to_us(&now, &window->frame_done) -
+			window->frame_interval + window->frame_deadline;
+		if (late > 0)
+			t += late;
+		window->paced_redraw = 0;
+	}
+
+	if (t > window->frame_interval)
+		t = window->frame_interval;
+
+	/* Adapt at once to slower redraws, slowly to faster ones */
+	if (t > window->render_time)
+		window->render_time = t;
+	else
+		window->render_time = (window->render_time * 7 + t) / 8;
+}
+
+static void
+window_defer_redraw_task(struct window *window);
+
+static void
+pacing_func(struct task *task, uint32_t events)
+{
+	struct window *window =
+		container_of(task, struct window, pacing_task);
+	uint64_t exp;
+
+	if (read(window->pacing_fd, &exp, sizeof exp) != sizeof exp)
+		return;
+
+	window->pacing_armed = 0;
+	window->paced_redraw = 1;
+	window_defer_redraw_task(window);
+}
+
+/* Returns 1 if the redraw is put off until the deadline */
+static int
+window_pace_redraw(struct window *window)
+{
+	struct itimerspec its;
+	struct timespec now;
+	int64_t delay;
+
+	if (!window->frame_deadline)
+		return 0;
+
+	if (window->pacing_armed)
+		return 1;
+
+	/* The redraw waits for the frame callback anyway */
+	if (window->main_surface->frame_cb)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	delay = (int64_t) window->frame_interval - window->render_time -
+		window->frame_deadline -
+		timespec_sub_to_us(&now, &window->frame_done);
+	if (delay <= 0)
+		return 0;
+
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = 0;
+	its.it_value.tv_sec = delay / 1000000;
+	its.it_value.tv_nsec = (delay % 1000000) * 1000;
+	if (timerfd_settime(window->pacing_fd, 0, &its, NULL) < 0)
+		return 0;
+
+	window->pacing_armed = 1;
+
+	return 1;
+}
+
+/*
+ * Have redraws finish deadline microseconds before the next frame is
+ * expected, instead of starting them as soon as the previous frame is
+ * done. Smaller deadlines show input sooner but risk missing frames
+ * more often. 0 turns pacing off, which is the default unless the
+ * TOYTOOLKIT_FRAME_DEADLINE environment variable says otherwise.
+ */
+void
+window_set_frame_deadline(struct window *window, int32_t deadline)
+{
+	struct itimerspec its;
+
+	if (deadline > 0 && window->pacing_fd < 0) {
+		window->pacing_fd = timerfd_create(CLOCK_MONOTONIC,
+						   TFD_CLOEXEC | TFD_NONBLOCK);
+		if (window->pacing_fd < 0) {
+			fprintf(stderr, "could not create timerfd\n: %m");
+			return;
+		}
+
+		window->pacing_task.run = pacing_func;
+		display_watch_fd(window->display, window->pacing_fd,
+				 EPOLLIN, &window->pacing_task);
+	}
+
+	window->frame_deadline = deadline > 0 ? deadline : 0;
+
+	if (!window->frame_deadline && window->pacing_armed) {
+		memset(&its, 0, sizeof its);
+		timerfd_settime(window->pacing_fd, 0, &its, NULL);
+		window->pacing_armed = 0;
+		window_defer_redraw_task(window);
+	}
+}
+
 static void
 frame_callback(void *data, struct wl_callback *callback, uint32_t time)
 {
@@ -4033,6 +4482,8 @@ frame_callback(void *data, struct wl_callback *callback, uint32_t time)
 	wl_callback_destroy(callback);
 	surface->frame_cb = NULL;
 
+	if (surface == surface->window->main_surface)
+		window_frame_done(surface->window, surface->last_time, time);
 	surface->last_time = time;
 
 	if (surface->redraw_needed || surface->window->redraw_needed) {
@@ -4045,6 +4496,38 @@ static const struct wl_callback_listener listener = {
 	frame_callback
 };
 
+/*
+ * Work out what to redraw: the damage asked for, plus whatever the
+ * buffer we got from the toysurface missed of the previous frames.
+ * Fall back to everything when that isn't known or with buffer
+ * transforms, which partial redraws don't deal with.
+ */
+static void
+surface_set_repaint(struct surface *surface)
+{
+	struct rectangle buffer_damage = { 0, 0, 0, 0 };
+
+	surface->repaint_partial = 0;
+
+	if (!surface->damage_partial || surface->window->redraw_needed ||
+	    !surface->widget->use_cairo ||
+	    surface->buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    surface->buffer_scale != 1 ||
+	    !surface->toysurface->get_buffer_damage ||
+	    surface->toysurface->get_buffer_damage(surface->toysurface,
+						   &buffer_damage) < 0)
+		return;
+
+	surface->repaint = surface->damage;
+	buffer_damage.x += surface->allocation.x;
+	buffer_damage.y += surface->allocation.y;
+	rectangle_union(&surface->repaint, &buffer_damage);
+	rectangle_intersect(&surface->repaint, &surface->allocation);
+
+	surface->repaint_partial = 1;
+}
+
+/* Returns 1 if the surface was redrawn, -1 if that failed */
 static int
 surface_redraw(struct surface *surface)
 {
@@ -4070,6 +4553,8 @@ surface_redraw(struct surface *surface)
 		return -1;
 	}
 
+	surface_set_repaint(surface);
+
 	surface->frame_cb = wl_surface_frame(surface->surface);
 	wl_callback_add_listener(surface->frame_cb, &listener, surface);
 	DBG_OBJ(surface->frame_cb, "new\n");
@@ -4078,7 +4563,7 @@ surface_redraw(struct surface *surface)
 	DBG_OBJ(surface->surface, "-> widget_redraw\n");
 	widget_redraw(surface->widget);
 	DBG_OBJ(surface->surface, "done\n");
-	return 0;
+	return 1;
 }
 
 static void
@@ -4086,11 +4571,15 @@ idle_redraw(struct task *task, uint32_t events)
 {
 	struct window *window = container_of(task, struct window, redraw_task);
 	struct surface *surface;
+	struct timespec start;
 	int failed = 0;
 	int resized = 0;
+	int redrawn;
 
 	DBG(" --------- \n");
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	wl_list_init(&window->redraw_task.link);
 	window->redraw_task_scheduled = 0;
 
@@ -4105,7 +4594,8 @@ idle_redraw(struct task *task, uint32_t events)
 		resized = 1;
 	}
 
-	if (surface_redraw(window->main_surface) < 0) {
+	redrawn = surface_redraw(window->main_surface);
+	if (redrawn < 0) {
 		/*
 		 * Only main_surface failure will cause us to undo the resize.
 		 * If sub-surfaces fail, they will just be broken with old
@@ -4124,6 +4614,11 @@ idle_redraw(struct task *task, uint32_t events)
 	window->redraw_needed = 0;
 	window_flush(window);
 
+	if (redrawn > 0)
+		window_update_render_time(window, &start);
+	else
+		window->paced_redraw = 0;
+
 	wl_list_for_each(surface, &window->subsurface_list, link)
 		surface_set_synchronized_default(surface);
 
@@ -4134,7 +4629,7 @@ idle_redraw(struct task *task, uint32_t events)
 }
 
 static void
-window_schedule_redraw_task(struct window *window)
+window_defer_redraw_task(struct window *window)
 {
 	if (!window->redraw_task_scheduled) {
 		window->redraw_task.run = idle_redraw;
@@ -4143,6 +4638,15 @@ window_schedule_redraw_task(struct window *window)
 	}
 }
 
+static void
+window_schedule_redraw_task(struct window *window)
+{
+	if (window->redraw_task_scheduled || window_pace_redraw(window))
+		return;
+
+	window_defer_redraw_task(window);
+}
+
 void
 window_schedule_redraw(struct window *window)
 {
@@ -4151,7 +4655,7 @@ window_schedule_redraw(struct window *window)
 	DBG_OBJ(window->main_surface->surface, "window %p\n", window);
 
 	wl_list_for_each(surface, &window->subsurface_list, link)
-		surface->redraw_needed = 1;
+		surface_add_damage(surface, NULL);
 
 	window_schedule_redraw_task(window);
 }
@@ -4404,6 +4908,7 @@ window_create_internal(struct display *display, int custom)
 {
 	struct window *window;
 	struct surface *surface;
+	const char *deadline;
 
 	window = xzalloc(sizeof *window);
 	wl_list_init(&window->subsurface_list);
@@ -4423,6 +4928,12 @@ window_create_internal(struct display *display, int custom)
 	wl_list_insert(display->window_list.prev, &window->link);
 	wl_list_init(&window->redraw_task.link);
 
+	window->pacing_fd = -1;
+	window->frame_interval = DEFAULT_FRAME_INTERVAL;
+	deadline = getenv("TOYTOOLKIT_FRAME_DEADLINE");
+	if (deadline)
+		window_set_frame_deadline(window, atoi(deadline));
+
 	wl_list_init (&window->window_output_list);
 
 	return window;
@@ -4968,8 +5479,6 @@ fini_xkb(struct input *input)
 	xkb_map_unref(input->xkb.keymap);
 }
 
-#define MIN(a,b) ((a) < (b) ? a : b)
-
 static void
 display_add_input(struct display *d, uint32_t id)
 {
@@ -305,6 +305,9 @@ window_set_buffer_transform(struct window *window,
 uint32_t
 window_get_buffer_scale(struct window *window);
 
+void
+window_set_frame_deadline(struct window *window, int32_t deadline);
+
 void
 window_set_buffer_scale(struct window *window,
                         int32_t scale);
@@ -514,6 +517,9 @@ widget_set_axis_handler(struct widget *widget,
 void
 widget_schedule_redraw(struct widget *widget);
 void
+widget_schedule_redraw_area(struct widget *widget,
+			    int32_t x, int32_t y, int32_t width, int32_t height);
+void
 widget_set_use_cairo(struct widget *widget, int use_cairo);
 
 struct widget *
@@ -62,6 +62,7 @@ exposay_surface_destroy(struct exposay_surface *esurface)
 {
 	wl_list_remove(&esurface->link);
 	wl_list_remove(&esurface->view_destroy_listener.link);
+	weston_surface_set_thumbnail_size(esurface->view->surface, 0, 0);
 
 	if (esurface->shell->exposay.focus_current == esurface->view)
 		esurface->shell->exposay.focus_current = NULL;
@@ -315,6 +316,12 @@ exposay_layout(struct desktop_shell *shell, struct shell_output *shell_output)
 		esurface->width = view->surface->width * esurface->scale;
 		esurface->height = view->surface->height * esurface->scale;
 
+		/* Drawn from a copy of that size once scaled down, which is
+		 * only refreshed when the surface is damaged. */
+		weston_surface_set_thumbnail_size(view->surface,
+						  esurface->width,
+						  esurface->height);
+
 		if (shell->exposay.focus_current == esurface->view)
 			highlight = esurface;
 
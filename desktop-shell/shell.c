@@ -153,7 +153,9 @@ struct shell_surface {
 		struct weston_view *black_view;
 	} fullscreen;
 
-	struct weston_transform workspace_transform;
+	/* in workspaces.anim_sticky_list while kept in place by a
+	 * workspace change animation */
+	struct wl_list workspace_sticky_link;
 
 	struct weston_output *fullscreen_output;
 	struct weston_output *output;
@@ -499,15 +501,6 @@ focus_surface_configure(struct weston_surface *es, int32_t sx, int32_t sy)
 {
 }
 
-static struct focus_surface *
-get_focus_surface(struct weston_surface *surface)
-{
-	if (surface->configure == focus_surface_configure)
-		return surface->configure_private;
-	else
-		return NULL;
-}
-
 static bool
 is_focus_surface (struct weston_surface *es)
 {
@@ -559,8 +552,6 @@ create_focus_surface(struct weston_compositor *ec,
 	pixman_region32_fini(&surface->input);
 	pixman_region32_init(&surface->input);
 
-	wl_list_init(&fsurf->workspace_transform.link);
-
 	return fsurf;
 }
 
@@ -916,59 +907,101 @@ get_output_height(struct weston_output *output)
 }
 
 static void
-view_translate(struct workspace *ws, struct weston_view *view, double d)
+workspace_anchor_configure(struct weston_surface *es, int32_t sx, int32_t sy)
 {
-	struct weston_transform *transform;
+}
 
-	if (is_focus_view(view)) {
-		struct focus_surface *fsurf = get_focus_surface(view->surface);
-		transform = &fsurf->workspace_transform;
-	} else {
-		struct shell_surface *shsurf = get_shell_surface(view->surface);
-		transform = &shsurf->workspace_transform;
-	}
+static bool
+is_workspace_anchor(struct weston_view *view)
+{
+	return view != NULL &&
+		view->surface->configure == workspace_anchor_configure;
+}
 
-	if (wl_list_empty(&transform->link))
-		wl_list_insert(view->geometry.transformation_list.prev,
-			       &transform->link);
+static struct shell_output *
+find_shell_output(struct desktop_shell *shell, struct weston_output *output)
+{
+	struct shell_output *shell_output;
 
-	weston_matrix_init(&transform->matrix);
-	weston_matrix_translate(&transform->matrix,
-				0.0, d, 0.0);
-	weston_view_geometry_dirty(view);
+	wl_list_for_each(shell_output, &shell->output_list, link)
+		if (shell_output->output == output)
+			return shell_output;
+
+	return NULL;
 }
 
+/* Parents the views of a sliding workspace to the anchor of their
+ * output, so that a frame of the animation only moves the anchors.
+ * Views that have a parent of their own follow it, sticky ones stay. */
 static void
-workspace_translate_out(struct workspace *ws, double fraction)
+workspace_anchor_views(struct desktop_shell *shell, struct workspace *ws,
+		       int in)
 {
-	struct weston_view *view;
-	unsigned int height;
-	double d;
+	struct weston_view *view, *anchor;
+	struct shell_surface *shsurf;
+	struct shell_output *shell_output;
 
 	wl_list_for_each(view, &ws->layer.view_list, layer_link) {
-		height = get_output_height(view->surface->output);
-		d = height * fraction;
+		if (view->geometry.parent &&
+		    !is_workspace_anchor(view->geometry.parent))
+			continue;
+
+		shsurf = get_shell_surface(view->surface);
+		if (shsurf && !wl_list_empty(&shsurf->workspace_sticky_link))
+			continue;
+
+		shell_output = find_shell_output(shell, view->surface->output);
+		if (!shell_output || !shell_output->anchor_surface)
+			continue;
 
-		view_translate(ws, view, d);
+		anchor = in ? shell_output->anchor_in : shell_output->anchor_out;
+		if (view->geometry.parent != anchor)
+			weston_view_set_transform_parent(view, anchor);
 	}
 }
 
 static void
-workspace_translate_in(struct workspace *ws, double fraction)
+workspace_release_view(struct weston_view *view)
 {
-	struct weston_view *view;
+	if (is_workspace_anchor(view->geometry.parent))
+		weston_view_set_transform_parent(view, NULL);
+}
+
+static void
+workspace_anchors_reverse(struct desktop_shell *shell)
+{
+	struct shell_output *shell_output;
+	struct weston_view *anchor;
+
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		anchor = shell_output->anchor_out;
+		shell_output->anchor_out = shell_output->anchor_in;
+		shell_output->anchor_in = anchor;
+	}
+}
+
+static void
+workspace_anchors_translate(struct desktop_shell *shell, double fraction)
+{
+	struct shell_output *shell_output;
 	unsigned int height;
 	double d;
 
-	wl_list_for_each(view, &ws->layer.view_list, layer_link) {
-		height = get_output_height(view->surface->output);
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		if (!shell_output->anchor_surface)
+			continue;
+
+		height = get_output_height(shell_output->output);
+
+		weston_view_set_position(shell_output->anchor_out,
+					 0, height * fraction);
 
 		if (fraction > 0)
 			d = -(height - height * fraction);
 		else
 			d = height + height * fraction;
 
-		view_translate(ws, view, d);
+		weston_view_set_position(shell_output->anchor_in, 0, d);
 	}
 }
 
@@ -996,29 +1029,25 @@ reverse_workspace_change_animation(struct desktop_shell *shell,
 	shell->workspaces.anim_dir = -1 * shell->workspaces.anim_dir;
 	shell->workspaces.anim_timestamp = 0;
 
+	workspace_anchors_reverse(shell);
+
 	weston_compositor_schedule_repaint(shell->compositor);
 }
 
 static void
-workspace_deactivate_transforms(struct workspace *ws)
+workspace_release_views(struct workspace *ws)
 {
 	struct weston_view *view;
-	struct weston_transform *transform;
+	struct shell_surface *shsurf;
 
 	wl_list_for_each(view, &ws->layer.view_list, layer_link) {
-		if (is_focus_view(view)) {
-			struct focus_surface *fsurf = get_focus_surface(view->surface);
-			transform = &fsurf->workspace_transform;
-		} else {
-			struct shell_surface *shsurf = get_shell_surface(view->surface);
-			transform = &shsurf->workspace_transform;
-		}
+		workspace_release_view(view);
 
-		if (!wl_list_empty(&transform->link)) {
-			wl_list_remove(&transform->link);
-			wl_list_init(&transform->link);
+		shsurf = get_shell_surface(view->surface);
+		if (shsurf && !wl_list_empty(&shsurf->workspace_sticky_link)) {
+			wl_list_remove(&shsurf->workspace_sticky_link);
+			wl_list_init(&shsurf->workspace_sticky_link);
 		}
-		weston_view_geometry_dirty(view);
 	}
 }
 
@@ -1039,8 +1068,8 @@ finish_workspace_change_animation(struct desktop_shell *shell,
 		weston_view_damage_below(view);
 
 	wl_list_remove(&shell->workspaces.animation.link);
-	workspace_deactivate_transforms(from);
-	workspace_deactivate_transforms(to);
+	workspace_release_views(from);
+	workspace_release_views(to);
 	shell->workspaces.anim_to = NULL;
 
 	wl_list_remove(&shell->workspaces.anim_from->layer.link);
@@ -1087,8 +1116,8 @@ animate_workspace_change_frame(struct weston_animation *animation,
 	if (t < DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH) {
 		weston_compositor_schedule_repaint(shell->compositor);
 
-		workspace_translate_out(from, shell->workspaces.anim_dir * y);
-		workspace_translate_in(to, shell->workspaces.anim_dir * y);
+		workspace_anchors_translate(shell,
+					    shell->workspaces.anim_dir * y);
 		shell->workspaces.anim_current = y;
 
 		weston_compositor_schedule_repaint(shell->compositor);
@@ -1127,7 +1156,9 @@ animate_workspace_change(struct desktop_shell *shell,
 
 	wl_list_insert(from->layer.link.prev, &to->layer.link);
 
-	workspace_translate_in(to, 0);
+	workspace_anchor_views(shell, from, 0);
+	workspace_anchor_views(shell, to, 1);
+	workspace_anchors_translate(shell, 0);
 
 	restore_focus_state(shell, to);
 
@@ -1240,6 +1271,7 @@ move_surface_to_workspace(struct desktop_shell *shell,
 
 	wl_list_remove(&view->layer_link);
 	wl_list_insert(&to->layer.view_list, &view->layer_link);
+	workspace_release_view(view);
 
 	shell_surface_update_child_surface_layers(shsurf);
 
@@ -1294,6 +1326,8 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 		wl_list_insert(from->layer.link.prev, &to->layer.link);
 
 		reverse_workspace_change_animation(shell, index, from, to);
+		/* the taken view slides along with its new workspace */
+		workspace_anchor_views(shell, to, 1);
 		broadcast_current_workspace_state(shell);
 
 		return;
@@ -1309,9 +1343,9 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 		update_workspace(shell, index, from, to);
 	else {
 		if (shsurf != NULL &&
-		    wl_list_empty(&shsurf->workspace_transform.link))
+		    wl_list_empty(&shsurf->workspace_sticky_link))
 			wl_list_insert(&shell->workspaces.anim_sticky_list,
-				       &shsurf->workspace_transform.link);
+				       &shsurf->workspace_sticky_link);
 
 		animate_workspace_change(shell, index, from, to);
 	}
@@ -3266,7 +3300,7 @@ create_common_surface(struct shell_client *owner, void *shell,
 	wl_list_init(&shsurf->rotation.transform.link);
 	weston_matrix_init(&shsurf->rotation.rotation);
 
-	wl_list_init(&shsurf->workspace_transform.link);
+	wl_list_init(&shsurf->workspace_sticky_link);
 
 	wl_list_init(&shsurf->children_link);
 	wl_list_init(&shsurf->children_list);
@@ -5893,11 +5927,41 @@ handle_output_destroy(struct wl_listener *listener, void *data)
 
 	shell_for_each_layer(shell, shell_output_destroy_move_layer, output);
 
+	if (output_listener->anchor_surface)
+		weston_surface_destroy(output_listener->anchor_surface);
 	wl_list_remove(&output_listener->destroy_listener.link);
 	wl_list_remove(&output_listener->link);
 	free(output_listener);
 }
 
+/* The anchors are never in a layer and have no size, only their
+ * position is of use.  Without them the output's views just don't
+ * slide. */
+static void
+create_workspace_anchors(struct desktop_shell *shell,
+			 struct shell_output *shell_output)
+{
+	struct weston_surface *surface;
+
+	surface = weston_surface_create(shell->compositor);
+	if (surface == NULL)
+		return;
+
+	surface->configure = workspace_anchor_configure;
+	surface->configure_private = shell_output;
+
+	shell_output->anchor_out = weston_view_create(surface);
+	shell_output->anchor_in = weston_view_create(surface);
+	if (!shell_output->anchor_out || !shell_output->anchor_in) {
+		weston_surface_destroy(surface);
+		shell_output->anchor_out = NULL;
+		shell_output->anchor_in = NULL;
+		return;
+	}
+
+	shell_output->anchor_surface = surface;
+}
+
 static void
 create_shell_output(struct desktop_shell *shell,
 					struct weston_output *output)
@@ -5910,6 +5974,7 @@ create_shell_output(struct desktop_shell *shell,
 
 	shell_output->output = output;
 	shell_output->shell = shell;
+	create_workspace_anchors(shell, shell_output);
 	shell_output->destroy_listener.notify = handle_output_destroy;
 	wl_signal_add(&output->destroy_signal,
 		      &shell_output->destroy_listener);
@@ -5992,6 +6057,8 @@ shell_destroy(struct wl_listener *listener, void *data)
 	input_panel_destroy(shell);
 
 	wl_list_for_each_safe(shell_output, tmp, &shell->output_list, link) {
+		if (shell_output->anchor_surface)
+			weston_surface_destroy(shell_output->anchor_surface);
 		wl_list_remove(&shell_output->destroy_listener.link);
 		wl_list_remove(&shell_output->link);
 		free(shell_output);
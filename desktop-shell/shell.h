@@ -90,7 +90,6 @@ struct exposay {
 struct focus_surface {
 	struct weston_surface *surface;
 	struct weston_view *view;
-	struct weston_transform workspace_transform;
 };
 
 struct workspace {
@@ -108,6 +107,13 @@ struct shell_output {
 	struct desktop_shell  *shell;
 	struct weston_output  *output;
 	struct exposay_output eoutput;
+
+	/* Transform parents of the views of the workspaces sliding out
+	 * and in on this output during a workspace change animation */
+	struct weston_surface *anchor_surface;
+	struct weston_view    *anchor_out;
+	struct weston_view    *anchor_in;
+
 	struct wl_listener    destroy_listener;
 	struct wl_list        link;
 };
@@ -369,6 +369,11 @@ fs_output_scale_view(struct fs_output *fsout, float width, float height)
 		wl_list_insert(&fsout->view->geometry.transformation_list,
 			       &fsout->transform.link);
 
+		/* A buffer of the mode's size scaled back up to cover the
+		 * output (buffer_scale != output scale) can still be
+		 * scanned out; the backend checks the coverage. */
+		view->plane_hint |= WESTON_VIEW_PLANE_HINT_SCANOUT;
+
 		x = output->x + (output->width - width) / 2 - surf_x;
 		y = output->y + (output->height - height) / 2 - surf_y;
 
@@ -376,6 +381,64 @@ fs_output_scale_view(struct fs_output *fsout, float width, float height)
 	}
 }
 
+/*
+ * Returns non-zero if the buffer attached to the surface could be put
+ * on the output's primary plane as-is once the output runs a mode of
+ * the buffer's size: no sub-surface sticks out of it, no viewport crop
+ * or scaling, and a buffer transform matching the output's.
+ */
+static int
+fs_output_surface_scanout_capable(struct fs_output *fsout,
+				  struct weston_surface *surface)
+{
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	struct weston_buffer_viewport *vp = &surface->buffer_viewport;
+	int32_t surf_x, surf_y, surf_width, surf_height;
+
+	if (!buffer)
+		return 0;
+
+	surface_subsurfaces_boundingbox(surface, &surf_x, &surf_y,
+					&surf_width, &surf_height);
+
+	return surf_x == 0 && surf_y == 0 &&
+	       surf_width == surface->width &&
+	       surf_height == surface->height &&
+	       vp->buffer.src_width == wl_fixed_from_int(-1) &&
+	       vp->surface.width == -1 &&
+	       vp->buffer.transform == fsout->output->transform;
+}
+
+/*
+ * Looks for an advertised mode the size of the surface's buffer, so
+ * that the surface can be scanned out without going through the
+ * renderer.  Returns NULL if there is none or the buffer can't be
+ * scanned out anyway.
+ */
+static struct weston_mode *
+fs_output_find_scanout_mode(struct fs_output *fsout,
+			    struct weston_surface *surface)
+{
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	struct weston_mode *mode, *found = NULL;
+
+	if (!fs_output_surface_scanout_capable(fsout, surface))
+		return NULL;
+
+	wl_list_for_each(mode, &fsout->output->mode_list, link) {
+		if (mode->width != buffer->width ||
+		    mode->height != buffer->height)
+			continue;
+
+		if (mode == fsout->output->current_mode)
+			return mode;
+		if (!found || mode->flags & WL_OUTPUT_MODE_PREFERRED)
+			found = mode;
+	}
+
+	return found;
+}
+
 static void
 fs_output_configure(struct fs_output *fsout, struct weston_surface *surface);
 
@@ -384,6 +447,7 @@ fs_output_configure_simple(struct fs_output *fsout,
 			   struct weston_surface *configured_surface)
 {
 	struct weston_output *output = fsout->output;
+	struct weston_mode *mode;
 	float output_aspect, surface_aspect;
 	int32_t surf_x, surf_y, surf_width, surf_height;
 
@@ -392,7 +456,20 @@ fs_output_configure_simple(struct fs_output *fsout,
 
 	assert(fsout->view);
 
-	restore_output_mode(fsout->output);
+	/* Left to pick the placement, prefer a mode that lets the
+	 * buffer go straight to scanout over compositing it. */
+	mode = NULL;
+	if (fsout->method == _WL_FULLSCREEN_SHELL_PRESENT_METHOD_DEFAULT)
+		mode = fs_output_find_scanout_mode(fsout, fsout->surface);
+
+	if (mode && mode != output->current_mode &&
+	    weston_output_switch_mode(output, mode,
+				      fsout->surface->buffer_viewport.buffer.scale,
+				      WESTON_MODE_SWITCH_SET_TEMPORARY) != 0)
+		mode = NULL;
+
+	if (!mode)
+		restore_output_mode(fsout->output);
 
 	wl_list_remove(&fsout->transform.link);
 	wl_list_init(&fsout->transform.link);
@@ -453,6 +530,7 @@ fs_output_configure_for_mode(struct fs_output *fsout,
 {
 	int32_t surf_x, surf_y, surf_width, surf_height;
 	struct weston_mode mode;
+	int32_t buffer_scale;
 	int ret;
 
 	if (fsout->pending.surface != configured_surface) {
@@ -468,13 +546,31 @@ fs_output_configure_for_mode(struct fs_output *fsout,
 					&surf_width, &surf_height);
 
 	mode.flags = 0;
-	mode.width = surf_width * fsout->output->native_scale;
-	mode.height = surf_height * fsout->output->native_scale;
 	mode.refresh = fsout->pending.framerate;
 
-	ret = weston_output_switch_mode(fsout->output, &mode,
-					fsout->output->native_scale,
-					WESTON_MODE_SWITCH_SET_TEMPORARY);
+	/* The surface fills the output either way, so first try the
+	 * mode matching the buffer size: only that one can be scanned
+	 * out directly when the buffer scale differs from the output's. */
+	ret = -1;
+	buffer_scale = fsout->pending.surface->buffer_viewport.buffer.scale;
+	if (buffer_scale != fsout->output->native_scale &&
+	    fs_output_surface_scanout_capable(fsout, fsout->pending.surface)) {
+		mode.width = surf_width * buffer_scale;
+		mode.height = surf_height * buffer_scale;
+
+		ret = weston_output_switch_mode(fsout->output, &mode,
+						buffer_scale,
+						WESTON_MODE_SWITCH_SET_TEMPORARY);
+	}
+
+	if (ret != 0) {
+		mode.width = surf_width * fsout->output->native_scale;
+		mode.height = surf_height * fsout->output->native_scale;
+
+		ret = weston_output_switch_mode(fsout->output, &mode,
+						fsout->output->native_scale,
+						WESTON_MODE_SWITCH_SET_TEMPORARY);
+	}
 
 	if (ret != 0) {
 		/* The mode switch failed.  Clear the pending and
@@ -98,13 +98,6 @@ struct hmi_controller_animation {
     hmi_controller_animation_destroy_func destroy_func;
 };
 
-struct hmi_controller_animation_fade {
-    struct hmi_controller_animation base;
-    double start;
-    double end;
-    struct weston_spring spring;
-};
-
 struct hmi_controller_animation_move {
     struct hmi_controller_animation base;
     double pos;
@@ -117,12 +110,19 @@ struct hmi_controller_animation_move {
 
 struct hmi_controller_fade {
     int32_t isFadeIn;
-    struct hmi_controller_animation_fade *animation;
-    struct animation_set *anima_set;
     struct wl_list layer_list;
 };
 
+/*
+ * The animations are stepped from the animation_list of an output, once
+ * per repaint with its presentation time.  Only while there is no output
+ * to hook into, a timer does it instead.
+ */
 struct animation_set {
+    struct weston_compositor *compositor;
+    struct weston_animation  animation;
+    struct weston_output    *output;
+    struct wl_listener       output_destroyed_listener;
     struct wl_event_source  *event_source;
     struct wl_list          animation_list;
 };
@@ -234,6 +234,7 @@ compare_launcher_info(const void *lhs, const void *rhs)
  */
 static void
 mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
+                        struct ivi_layout_transaction *transaction,
                         struct ivi_layout_surface **ppSurface,
                         int32_t surface_length,
                         struct hmi_controller_layer *layer)
@@ -264,24 +265,26 @@ mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
                 surface_x = (int32_t)((num - 5) * (surface_width));
                 surface_y = (int32_t)surface_height;
             }
-            ret = ivi_layout_surfaceSetDestinationRectangle(ivisurf, surface_x, surface_y,
-                                                            surface_width, surface_height);
+            ret = ivi_layout_transactionSurfaceSetDestinationRectangle(
+                      transaction, ivisurf, surface_x, surface_y,
+                      surface_width, surface_height);
             assert(!ret);
 
-            ret = ivi_layout_surfaceSetVisibility(ivisurf, 1);
+            ret = ivi_layout_transactionSurfaceSetVisibility(transaction, ivisurf, 1);
             assert(!ret);
 
             num++;
             continue;
         }
 
-        ret = ivi_layout_surfaceSetVisibility(ivisurf, 0);
+        ret = ivi_layout_transactionSurfaceSetVisibility(transaction, ivisurf, 0);
         assert(!ret);
     }
 }
 
 static void
 mode_divided_into_sidebyside(struct hmi_controller *hmi_ctrl,
+                      struct ivi_layout_transaction *transaction,
                       struct ivi_layout_surface **ppSurface,
                       int32_t surface_length,
                       struct hmi_controller_layer *layer)
@@ -302,35 +305,37 @@ mode_divided_into_sidebyside(struct hmi_controller *hmi_ctrl,
         }
 
         if (num == 1) {
-            ret = ivi_layout_surfaceSetDestinationRectangle(ivisurf, 0, 0,
-                                                surface_width, surface_height);
+            ret = ivi_layout_transactionSurfaceSetDestinationRectangle(
+                      transaction, ivisurf, 0, 0, surface_width, surface_height);
             assert(!ret);
 
-            ret = ivi_layout_surfaceSetVisibility(ivisurf, 1);
+            ret = ivi_layout_transactionSurfaceSetVisibility(transaction, ivisurf, 1);
             assert(!ret);
 
             num++;
             continue;
         }
         else if (num == 2) {
-            ret = ivi_layout_surfaceSetDestinationRectangle(ivisurf, surface_width, 0,
-                                                surface_width, surface_height);
+            ret = ivi_layout_transactionSurfaceSetDestinationRectangle(
+                      transaction, ivisurf, surface_width, 0,
+                      surface_width, surface_height);
             assert(!ret);
 
-            ret = ivi_layout_surfaceSetVisibility(ivisurf, 1);
+            ret = ivi_layout_transactionSurfaceSetVisibility(transaction, ivisurf, 1);
             assert(!ret);
 
             num++;
             continue;
         }
 
-        ivi_layout_surfaceSetVisibility(ivisurf, 0);
+        ivi_layout_transactionSurfaceSetVisibility(transaction, ivisurf, 0);
         assert(!ret);
     }
 }
 
 static void
 mode_fullscreen_someone(struct hmi_controller *hmi_ctrl,
+                      struct ivi_layout_transaction *transaction,
                       struct ivi_layout_surface **ppSurface,
                       int32_t surface_length,
                       struct hmi_controller_layer *layer)
@@ -349,17 +354,18 @@ mode_fullscreen_someone(struct hmi_controller *hmi_ctrl,
             continue;
         }
 
-        ret = ivi_layout_surfaceSetDestinationRectangle(ivisurf, 0, 0,
-                                            surface_width, surface_height);
+        ret = ivi_layout_transactionSurfaceSetDestinationRectangle(
+                  transaction, ivisurf, 0, 0, surface_width, surface_height);
         assert(!ret);
 
-        ret = ivi_layout_surfaceSetVisibility(ivisurf, 1);
+        ret = ivi_layout_transactionSurfaceSetVisibility(transaction, ivisurf, 1);
         assert(!ret);
     }
 }
 
 static void
 mode_random_replace(struct hmi_controller *hmi_ctrl,
+                    struct ivi_layout_transaction *transaction,
                     struct ivi_layout_surface **ppSurface,
                     int32_t surface_length,
                     struct hmi_controller_layer *layer)
@@ -383,35 +389,29 @@ mode_random_replace(struct hmi_controller *hmi_ctrl,
         surface_x = rand() % (layer->width - surface_width);
         surface_y = rand() % (layer->height - surface_height);
 
-        ret = ivi_layout_surfaceSetDestinationRectangle(ivisurf, surface_x, surface_y,
-                                                  surface_width, surface_height);
+        ret = ivi_layout_transactionSurfaceSetDestinationRectangle(
+                  transaction, ivisurf, surface_x, surface_y,
+                  surface_width, surface_height);
         assert(!ret);
 
-        ret = ivi_layout_surfaceSetVisibility(ivisurf, 1);
+        ret = ivi_layout_transactionSurfaceSetVisibility(transaction, ivisurf, 1);
         assert(!ret);
     }
 }
 
 static int32_t
-has_applicatipn_surface(struct hmi_controller *hmi_ctrl,
-                        struct ivi_layout_surface **ppSurface,
-                        int32_t surface_length)
+is_application_surface(struct ivi_layout_surface *ivisurf, void *userdata)
 {
-    struct ivi_layout_surface *ivisurf  = NULL;
-    int32_t i = 0;
-
-    for (i = 0; i < surface_length; i++) {
-        ivisurf = ppSurface[i];
-
-        /* skip ui widgets */
-        if (is_surf_in_uiWidget(hmi_ctrl, ivisurf)) {
-            continue;
-        }
+    struct hmi_controller *hmi_ctrl = userdata;
 
-        return 1;
-    }
+    /* skip ui widgets */
+    return !is_surf_in_uiWidget(hmi_ctrl, ivisurf);
+}
 
-    return 0;
+static int32_t
+has_applicatipn_surface(struct hmi_controller *hmi_ctrl)
+{
+    return ivi_layout_forEachSurface(is_application_surface, hmi_ctrl) > 0;
 }
 
 /**
@@ -428,36 +428,48 @@ switch_mode(struct hmi_controller *hmi_ctrl,
 
     struct hmi_controller_layer *layer = &hmi_ctrl->application_layer;
     struct ivi_layout_surface **ppSurface = NULL;
+    struct ivi_layout_transaction *transaction = NULL;
     int32_t surface_length = 0;
     int32_t ret = 0;
 
     hmi_ctrl->layout_mode = layout_mode;
 
+    if (!has_applicatipn_surface(hmi_ctrl)) {
+        return;
+    }
+
     ret = ivi_layout_getSurfaces(&surface_length, &ppSurface);
     assert(!ret);
 
-    if (!has_applicatipn_surface(hmi_ctrl, ppSurface, surface_length)) {
+    /* The whole mode goes in one commit, nothing shows a layout
+     * halfway between two modes. */
+    transaction = ivi_layout_transactionCreate();
+    if (transaction == NULL) {
         free(ppSurface);
-        ppSurface = NULL;
         return;
     }
 
     switch (layout_mode) {
     case IVI_HMI_CONTROLLER_LAYOUT_MODE_TILING:
-        mode_divided_into_tiling(hmi_ctrl, ppSurface, surface_length, layer);
+        mode_divided_into_tiling(hmi_ctrl, transaction,
+                                 ppSurface, surface_length, layer);
         break;
     case IVI_HMI_CONTROLLER_LAYOUT_MODE_SIDE_BY_SIDE:
-        mode_divided_into_sidebyside(hmi_ctrl, ppSurface, surface_length, layer);
+        mode_divided_into_sidebyside(hmi_ctrl, transaction,
+                                     ppSurface, surface_length, layer);
         break;
     case IVI_HMI_CONTROLLER_LAYOUT_MODE_FULL_SCREEN:
-        mode_fullscreen_someone(hmi_ctrl, ppSurface, surface_length, layer);
+        mode_fullscreen_someone(hmi_ctrl, transaction,
+                                ppSurface, surface_length, layer);
         break;
     case IVI_HMI_CONTROLLER_LAYOUT_MODE_RANDOM:
-        mode_random_replace(hmi_ctrl, ppSurface, surface_length, layer);
+        mode_random_replace(hmi_ctrl, transaction,
+                            ppSurface, surface_length, layer);
         break;
     }
 
-    ivi_layout_commitChanges();
+    ivi_layout_transactionCommit(transaction);
+    ivi_layout_transactionDestroy(transaction);
 
     free(ppSurface);
     ppSurface = NULL;
@@ -480,6 +492,69 @@ hmi_controller_animation_frame(
     animation->frame_user_func(animation);
 }
 
+static void
+animation_set_step(struct animation_set *anima_set, uint32_t msec)
+{
+    struct link_animation *link_animation = NULL;
+    struct link_animation *next = NULL;
+
+    wl_list_for_each_safe(link_animation, next, &anima_set->animation_list, link) {
+        hmi_controller_animation_frame(link_animation->animation, msec);
+    }
+
+    ivi_layout_commitChanges();
+}
+
+static void
+animation_set_stop(struct animation_set *anima_set)
+{
+    if (anima_set->output != NULL) {
+        wl_list_remove(&anima_set->animation.link);
+        wl_list_init(&anima_set->animation.link);
+        anima_set->output = NULL;
+    }
+
+    wl_event_source_timer_update(anima_set->event_source, 0);
+}
+
+static void
+animation_set_start(struct animation_set *anima_set)
+{
+    struct weston_output *output = NULL;
+
+    if (anima_set->output != NULL) {
+        return;
+    }
+
+    wl_list_for_each(output, &anima_set->compositor->output_list, link) {
+        anima_set->output = output;
+        anima_set->animation.frame_counter = 0;
+        wl_list_insert(&output->animation_list, &anima_set->animation.link);
+        wl_event_source_timer_update(anima_set->event_source, 0);
+        weston_output_schedule_repaint(output);
+        return;
+    }
+
+    wl_event_source_timer_update(anima_set->event_source, 1);
+}
+
+static void
+animation_set_frame(struct weston_animation *animation,
+                    struct weston_output *output, uint32_t msecs)
+{
+    struct animation_set *anima_set =
+        container_of(animation, struct animation_set, animation);
+
+    animation_set_step(anima_set, msecs);
+
+    if (wl_list_empty(&anima_set->animation_list)) {
+        animation_set_stop(anima_set);
+        return;
+    }
+
+    weston_output_schedule_repaint(output);
+}
+
 static int
 animation_set_do_anima(void* data)
 {
@@ -487,25 +562,42 @@ animation_set_do_anima(void* data)
     int32_t fps = 30;
 
     if (wl_list_empty(&anima_set->animation_list)) {
-        wl_event_source_timer_update(anima_set->event_source, 0);
+        return 1;
+    }
+
+    /* an output may have come up meanwhile */
+    if (!wl_list_empty(&anima_set->compositor->output_list)) {
+        animation_set_start(anima_set);
         return 1;
     }
 
     wl_event_source_timer_update(anima_set->event_source, 1000 / fps);
 
+    /* the clock given to the frame hooks, so that nothing jumps when
+     * an animation moves between the two */
     struct timespec timestamp = {0};
-    clock_gettime(CLOCK_MONOTONIC, &timestamp);
-    int32_t msec = (1e+3 * timestamp.tv_sec + 1e-6 * timestamp.tv_nsec);
+    clock_gettime(anima_set->compositor->presentation_clock, &timestamp);
+    uint32_t msec = timestamp.tv_sec * 1000 + timestamp.tv_nsec / 1000000;
 
-    struct link_animation *link_animation = NULL;
-    struct link_animation *next = NULL;
+    animation_set_step(anima_set, msec);
+    return 1;
+}
 
-    wl_list_for_each_safe(link_animation, next, &anima_set->animation_list, link) {
-        hmi_controller_animation_frame(link_animation->animation, msec);
+static void
+animation_set_output_destroyed(struct wl_listener *listener, void *data)
+{
+    struct animation_set *anima_set =
+        container_of(listener, struct animation_set,
+                     output_destroyed_listener);
+
+    if (anima_set->output != data) {
+        return;
     }
 
-    ivi_layout_commitChanges();
-    return 1;
+    animation_set_stop(anima_set);
+    if (!wl_list_empty(&anima_set->animation_list)) {
+        animation_set_start(anima_set);
+    }
 }
 
 static struct animation_set *
@@ -513,8 +605,17 @@ animation_set_create(struct weston_compositor* ec)
 {
     struct animation_set *anima_set = MEM_ALLOC(sizeof(*anima_set));
 
+    anima_set->compositor = ec;
     wl_list_init(&anima_set->animation_list);
 
+    anima_set->animation.frame = animation_set_frame;
+    wl_list_init(&anima_set->animation.link);
+
+    anima_set->output_destroyed_listener.notify =
+        animation_set_output_destroyed;
+    wl_signal_add(&ec->output_destroyed_signal,
+                  &anima_set->output_destroyed_listener);
+
     struct wl_event_loop *loop = wl_display_get_event_loop(ec->wl_display);
     anima_set->event_source = wl_event_loop_add_timer(loop, animation_set_do_anima, anima_set);
     wl_event_source_timer_update(anima_set->event_source, 0);
@@ -535,7 +636,7 @@ animation_set_add_animation(struct animation_set *anima_set,
 
     link_anima->animation = anima;
     wl_list_insert(&anima_set->animation_list, &link_anima->link);
-    wl_event_source_timer_update(anima_set->event_source, 1);
+    animation_set_start(anima_set);
 }
 
 static void
@@ -554,18 +655,6 @@ animation_set_remove_animation(struct animation_set *anima_set,
     }
 }
 
-static void
-hmi_controller_animation_spring_frame(
-    struct hmi_controller_animation_fade *animation, int32_t timestamp)
-{
-    if (0 == animation->spring.timestamp) {
-        animation->spring.timestamp = timestamp;
-    }
-
-    weston_spring_update(&animation->spring, timestamp);
-    animation->base.is_done = weston_spring_done(&animation->spring);
-}
-
 static void
 hmi_controller_animation_move_frame(
     struct hmi_controller_animation_move *animation, int32_t timestamp)
@@ -594,37 +683,6 @@ hmi_controller_animation_destroy(struct hmi_controller_animation *animation)
     free(animation);
 }
 
-static void
-hmi_controller_fade_animation_destroy(struct hmi_controller_animation *animation)
-{
-    struct hmi_controller_fade *fade = animation->user_data;
-    animation_set_remove_animation(fade->anima_set, animation);
-    fade->animation = NULL;
-    animation->user_data = NULL;
-}
-
-static struct hmi_controller_animation_fade *
-hmi_controller_animation_fade_create(double start, double end, double k,
-    hmi_controller_animation_frame_user_func frame_user_func, void* user_data,
-    hmi_controller_animation_destroy_func destroy_func)
-{
-    struct hmi_controller_animation_fade* animation = MEM_ALLOC(sizeof(*animation));
-
-    animation->base.frame_user_func = frame_user_func;
-    animation->base.user_data = user_data;
-    animation->base.frame_func =
-        (hmi_controller_animation_frame_func)hmi_controller_animation_spring_frame;
-    animation->base.destroy_func = destroy_func;
-
-    animation->start = start;
-    animation->end = end;
-    weston_spring_init(&animation->spring, k, start, end);
-    animation->spring.friction = 1400;
-    animation->spring.previous = -(end - start) * 0.03;
-
-    return animation;
-}
-
 static struct hmi_controller_animation_move *
 hmi_controller_animation_move_create(
     double pos_start, double pos_end, double v_start, double v_end,
@@ -663,50 +721,12 @@ hmi_controller_animation_move_create(
     return animation;
 }
 
-static double
-hmi_controller_animation_fade_alpha_get(struct hmi_controller_animation_fade* animation)
-{
-    if (animation->spring.current > 0.999) {
-        return 1.0;
-    } else if (animation->spring.current < 0.001 ) {
-        return 0.0;
-    } else {
-        return animation->spring.current;
-    }
-}
-
 static int32_t
 hmi_controller_animation_is_done(struct hmi_controller_animation *animation)
 {
     return animation->is_done;
 }
 
-static void
-hmi_controller_fade_update(struct hmi_controller_animation_fade *animation, double end)
-{
-    animation->spring.target = end;
-}
-
-static void
-hmi_controller_anima_fade_user_frame(struct hmi_controller_animation_fade *animation)
-{
-    double alpha = hmi_controller_animation_fade_alpha_get(animation);
-    alpha = wl_fixed_from_double(alpha);
-    struct hmi_controller_fade *fade = animation->base.user_data;
-    struct link_layer *linklayer = NULL;
-    int32_t is_done = hmi_controller_animation_is_done(&animation->base);
-    int32_t is_visible = !is_done || fade->isFadeIn;
-
-    wl_list_for_each(linklayer, &fade->layer_list, link) {
-        ivi_layout_layerSetOpacity(linklayer->layout_layer, alpha);
-        ivi_layout_layerSetVisibility(linklayer->layout_layer, is_visible);
-    }
-
-    if (is_done) {
-        hmi_controller_animation_destroy(&animation->base);
-    }
-}
-
 static void
 hmi_controller_anima_move_user_frame(struct hmi_controller_animation_move *animation)
 {
@@ -725,21 +745,40 @@ hmi_controller_anima_move_user_frame(struct hmi_controller_animation_move *anima
     }
 }
 
+static void
+hmi_controller_fade_out_done(void *data)
+{
+    struct link_layer *linklayer = data;
+
+    ivi_layout_layerSetVisibility(linklayer->layout_layer, 0);
+    ivi_layout_commitChanges();
+}
+
+/**
+ * The fade is run by the transitions of ivi-layout, which go on from the
+ * current opacity when the direction changes half way.
+ */
 static void
 hmi_controller_fade_run(int32_t isFadeIn, struct hmi_controller_fade *fade)
 {
     double tint = isFadeIn ? 1.0 : 0.0;
+    struct link_layer *linklayer = NULL;
+
     fade->isFadeIn = isFadeIn;
 
-    if (fade->animation) {
-        hmi_controller_fade_update(fade->animation, tint);
-    } else {
-        fade->animation = hmi_controller_animation_fade_create(
-            1.0 - tint, tint, 300.0,
-            (hmi_controller_animation_frame_user_func)hmi_controller_anima_fade_user_frame,
-            fade, hmi_controller_fade_animation_destroy);
+    wl_list_for_each(linklayer, &fade->layer_list, link) {
+        if (isFadeIn) {
+            ivi_layout_layerSetVisibility(linklayer->layout_layer, 1);
+        }
 
-        animation_set_add_animation(fade->anima_set, &fade->animation->base);
+        ivi_layout_layerTransitionOpacity(linklayer->layout_layer,
+            wl_fixed_from_double(tint), 300,
+            IVI_LAYOUT_TRANSITION_EASING_EASE_OUT,
+            isFadeIn ? NULL : hmi_controller_fade_out_done, linklayer);
+    }
+
+    if (isFadeIn) {
+        ivi_layout_commitChanges();
     }
 }
 
@@ -888,6 +927,8 @@ hmi_controller_create(struct weston_compositor *ec)
     hmi_ctrl->base_layer.id_layer = hmi_ctrl->hmi_setting->base_layer_id;
 
     create_layer(iviscrn, &hmi_ctrl->base_layer);
+    /* background and panel change seldom */
+    ivi_layout_layerSetCacheable(hmi_ctrl->base_layer.ivilayer, 1);
 
     int32_t panel_height = hmi_ctrl->hmi_setting->panel_height;
 
@@ -922,6 +963,7 @@ hmi_controller_create(struct weston_compositor *ec)
     hmi_ctrl->workspace_layer.id_layer = hmi_ctrl->hmi_setting->workspace_layer_id;
 
     create_layer(iviscrn, &hmi_ctrl->workspace_layer);
+    ivi_layout_layerSetCacheable(hmi_ctrl->workspace_layer.ivilayer, 1);
     ivi_layout_layerSetOpacity(hmi_ctrl->workspace_layer.ivilayer, 0);
     ivi_layout_layerSetVisibility(hmi_ctrl->workspace_layer.ivilayer, 0);
 
@@ -935,7 +977,6 @@ hmi_controller_create(struct weston_compositor *ec)
     tmp_link_layer = MEM_ALLOC(sizeof(*tmp_link_layer));
     tmp_link_layer->layout_layer = hmi_ctrl->workspace_background_layer.ivilayer;
     wl_list_insert(&hmi_ctrl->workspace_fade.layer_list, &tmp_link_layer->link);
-    hmi_ctrl->workspace_fade.anima_set = hmi_ctrl->anima_set;
 
     ivi_layout_addNotificationCreateSurface(set_notification_create_surface, hmi_ctrl);
     ivi_layout_addNotificationRemoveSurface(set_notification_remove_surface, hmi_ctrl);
@@ -1163,7 +1204,8 @@ ivi_hmi_controller_set_workspacebackground(struct wl_resource *resource,
  * the scene graph of UI defined in hmi_controller_create.
  *
  * The workspace can have several pages to group surfaces of launcher. Each call
- * of this interface increments a number of page to add a group of surfaces
+ * of this interface increments a number of page to add a group of surfaces.
+ * Launchers whose surface is not there yet get a transparent placeholder.
  */
 static void
 ivi_hmi_controller_add_launchers(struct wl_resource *resource,
@@ -1265,6 +1307,12 @@ ivi_hmi_controller_add_launchers(struct wl_resource *resource,
 
         struct ivi_layout_surface* layout_surface = NULL;
         layout_surface = ivi_layout_getSurfaceFromId(data->surface_id);
+        if (layout_surface == NULL) {
+            /* the client draws the icons of later pages after UI_ready,
+             * they take this place when they come */
+            layout_surface = ivi_layout_surfaceCreatePlaceholder(
+                                data->surface_id, icon_size, icon_size, 0);
+        }
         assert(layout_surface);
 
         int32_t ret = 0;
@@ -1874,6 +1922,19 @@ ivi_hmi_controller_home(struct wl_client *client,
     }
 }
 
+/**
+ * Implementation of create_solid_surface. The surface is one pixel large,
+ * UI_ready scales it to the destination rectangle of its widget.
+ */
+static void
+ivi_hmi_controller_create_solid_surface(struct wl_client *client,
+                                        struct wl_resource *resource,
+                                        uint32_t id_surface,
+                                        uint32_t color)
+{
+    ivi_layout_surfaceCreateSolidColor(id_surface, 1, 1, color);
+}
+
 /**
  * binding ivi-hmi-controller implementation
  */
@@ -1881,7 +1942,8 @@ static const struct ivi_hmi_controller_interface ivi_hmi_controller_implementati
     ivi_hmi_controller_UI_ready,
     ivi_hmi_controller_workspace_control,
     ivi_hmi_controller_switch_mode,
-    ivi_hmi_controller_home
+    ivi_hmi_controller_home,
+    ivi_hmi_controller_create_solid_surface
 };
 
 static void
@@ -1896,7 +1958,7 @@ bind_hmi_controller(struct wl_client *client,
     struct wl_resource *resource = NULL;
 
     resource = wl_resource_create(
-            client, &ivi_hmi_controller_interface, 1, id);
+            client, &ivi_hmi_controller_interface, version, id);
 
     wl_resource_set_implementation(
             resource, &ivi_hmi_controller_implementation,
@@ -1948,7 +2010,7 @@ module_init(struct weston_compositor *ec,
     hmi_ctrl->compositor = ec;
 
     if (wl_global_create(ec->wl_display,
-                 &ivi_hmi_controller_interface, 1,
+                 &ivi_hmi_controller_interface, 2,
                  hmi_ctrl, bind_hmi_controller) == NULL) {
         return -1;
     }
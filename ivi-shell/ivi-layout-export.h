@@ -103,8 +103,24 @@ struct ivi_layout_LayerProperties
     int32_t  creatorPid;
 };
 
+/* Rendering cost of a surface, see struct weston_surface_stats.  The
+ * counters only grow; commitRate is the commits of the last full
+ * second. */
+struct ivi_layout_Statistics
+{
+    uint32_t commits;
+    uint32_t commitRate;
+    uint32_t framesPresented;
+    uint32_t framesDropped;
+    uint32_t framesOnPrimary;
+    uint32_t framesOnPlane;
+    uint64_t bytesUploaded;
+    uint64_t pixelsComposited;
+};
+
 struct ivi_layout_layer;
 struct ivi_layout_screen;
+struct ivi_layout_transaction;
 
 enum ivi_layout_notification_mask {
     IVI_NOTIFICATION_NONE        = 0,
@@ -118,9 +134,45 @@ enum ivi_layout_notification_mask {
     IVI_NOTIFICATION_PIXELFORMAT = (1 << 8),
     IVI_NOTIFICATION_ADD         = (1 << 9),
     IVI_NOTIFICATION_REMOVE      = (1 << 10),
+    IVI_NOTIFICATION_CHROMAKEY   = (1 << 11),
     IVI_NOTIFICATION_ALL         = 0xFFFF
 };
 
+/* Optimizations for ivi_layout_SetOptimizationMode. Each one is a hint
+ * to the backend's plane assignment for the views of a layer. */
+enum ivi_layout_optimization {
+    /* pin the layer's surfaces to hardware overlay planes */
+    IVI_LAYOUT_OPTIMIZATION_OVERLAY = 0,
+    /* scan out a surface that fills the screen directly */
+    IVI_LAYOUT_OPTIMIZATION_SCANOUT = 1,
+    IVI_LAYOUT_OPTIMIZATION_COUNT
+};
+
+enum ivi_layout_optimization_mode {
+    IVI_LAYOUT_OPTIMIZATION_MODE_FORCE_OFF = 0,  /* no layer gets the hint */
+    IVI_LAYOUT_OPTIMIZATION_MODE_FORCE_ON  = 1,  /* every layer gets it */
+    IVI_LAYOUT_OPTIMIZATION_MODE_HEURISTIC = 2,  /* layers which asked */
+    IVI_LAYOUT_OPTIMIZATION_MODE_TOGGLE    = 3   /* flip FORCE_OFF/ON */
+};
+
+enum ivi_layout_repaint_policy {
+    /* every frame, the default; for safety relevant layers */
+    IVI_LAYOUT_REPAINT_POLICY_FULL_RATE   = 0,
+    /* at most max_hz updates per second */
+    IVI_LAYOUT_REPAINT_POLICY_CAPPED      = 1,
+    /* throttled while the screen cannot keep up with its refresh */
+    IVI_LAYOUT_REPAINT_POLICY_BEST_EFFORT = 2
+};
+
+enum ivi_layout_transition_easing {
+    IVI_LAYOUT_TRANSITION_EASING_LINEAR      = 0,
+    IVI_LAYOUT_TRANSITION_EASING_EASE_IN     = 1,
+    IVI_LAYOUT_TRANSITION_EASING_EASE_OUT    = 2,
+    IVI_LAYOUT_TRANSITION_EASING_EASE_IN_OUT = 3
+};
+
+typedef void(*transitionDoneFunc)(void *userdata);
+
 typedef void(*layerPropertyNotificationFunc)(struct ivi_layout_layer *ivilayer,
                                             struct ivi_layout_LayerProperties*,
                                             enum ivi_layout_notification_mask mask,
@@ -146,6 +198,41 @@ typedef void(*surfaceRemoveNotificationFunc)(struct ivi_layout_surface *ivisurf,
 typedef void(*surfaceConfigureNotificationFunc)(struct ivi_layout_surface *ivisurf,
                                             void *userdata);
 
+/* One entry of a change set: an object and everything that happened to
+ * it since the previous set. */
+enum ivi_layout_change_object {
+    IVI_LAYOUT_CHANGE_OBJECT_SURFACE = 0,
+    IVI_LAYOUT_CHANGE_OBJECT_LAYER   = 1
+};
+
+enum ivi_layout_change_event {
+    IVI_LAYOUT_CHANGE_EVENT_CREATE    = (1 << 0),
+    IVI_LAYOUT_CHANGE_EVENT_REMOVE    = (1 << 1),
+    IVI_LAYOUT_CHANGE_EVENT_CONFIGURE = (1 << 2)
+};
+
+struct ivi_layout_change {
+    uint32_t id;        /* id of the surface or layer */
+    uint32_t object;    /* enum ivi_layout_change_object */
+    uint32_t events;    /* enum ivi_layout_change_event */
+    uint32_t mask;      /* enum ivi_layout_notification_mask */
+};
+
+typedef void(*changeSetNotificationFunc)(const struct ivi_layout_change *changes,
+                                            int32_t count,
+                                            void *userdata);
+
+/**
+ * Visitors for the ivi_layout_forEach* walks. A non-zero return stops
+ * the walk. They must not create, remove or reorder objects of the
+ * list being walked.
+ */
+typedef int32_t(*surfaceVisitorFunc)(struct ivi_layout_surface *ivisurf,
+                                     void *userdata);
+
+typedef int32_t(*layerVisitorFunc)(struct ivi_layout_layer *ivilayer,
+                                   void *userdata);
+
 typedef void(*ivi_controller_surface_content_callback)(struct ivi_layout_surface *ivisurf,
                                             int32_t content,
                                             void *userdata);
@@ -174,6 +261,22 @@ int32_t
 ivi_layout_addNotificationCreateLayer(layerCreateNotificationFunc callback,
                                       void *userdata);
 
+/**
+ * \brief register for batched notification of all changes
+ *
+ * Instead of one callback per object and event, the callback gets one
+ * array per commit with an entry per changed surface or layer. Changes
+ * made outside of ivi_layout_commitChanges, like surface creation and
+ * configuration, are delivered when the event loop goes idle.
+ */
+int32_t
+ivi_layout_addNotificationChangeSet(changeSetNotificationFunc callback,
+                                    void *userdata);
+
+void
+ivi_layout_removeNotificationChangeSet(changeSetNotificationFunc callback,
+                                       void *userdata);
+
 void
 ivi_layout_removeNotificationCreateLayer(layerCreateNotificationFunc callback,
                                          void *userdata);
@@ -314,6 +417,39 @@ ivi_layout_surfaceCreate(struct weston_surface *wl_surface,
                             uint32_t id_surface);
 */
 
+/**
+ * \brief Create a surface for an id no app has bound yet, showing a
+ *        solid color (0xAARRGGBB) of the given size meanwhile
+ *
+ * The surface can be laid out like any other.  An app binding the id
+ * takes it over, and its first buffer replaces the color in place:
+ * same layer, position and transforms, so best size the placeholder
+ * like the app's surface.  The placeholder takes no input.
+ *
+ * \return the surface if the method call was successful
+ * \return NULL if the id is in use or the method call was failed
+ */
+struct ivi_layout_surface *
+ivi_layout_surfaceCreatePlaceholder(uint32_t id_surface,
+                                    int32_t width, int32_t height,
+                                    uint32_t color);
+
+/**
+ * \brief Create a surface of a solid color (0xAARRGGBB) and the given
+ *        size, owned by the compositor
+ *
+ * Unlike a placeholder no app can take the id over; the surface lives
+ * until ivi_layout_surfaceRemove.  It has no buffer, so it costs neither
+ * memory nor texture bandwidth, and takes no input.
+ *
+ * \return the surface if the method call was successful
+ * \return NULL if the id is in use or the method call was failed
+ */
+struct ivi_layout_surface *
+ivi_layout_surfaceCreateSolidColor(uint32_t id_surface,
+                                   int32_t width, int32_t height,
+                                   uint32_t color);
+
 /**
  * \brief Set the native content of an application to be used as surface content.
  *        If wl_surface is NULL, remove the native content of a surface
@@ -468,6 +604,66 @@ ivi_layout_getSurfacesOnLayer(struct ivi_layout_layer *ivilayer,
                                  int32_t *pLength,
                                  struct ivi_layout_surface ***ppArray);
 
+/**
+ * \brief Call visitor for every Surface, without allocating
+ *
+ * \return the non-zero value the visitor stopped the walk with,
+ *         0 if it saw all surfaces
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_forEachSurface(surfaceVisitorFunc visitor, void *userdata);
+
+/**
+ * \brief Call visitor for every Layer, without allocating
+ *
+ * \return as ivi_layout_forEachSurface
+ */
+int32_t
+ivi_layout_forEachLayer(layerVisitorFunc visitor, void *userdata);
+
+/**
+ * \brief Call visitor for the Surfaces of a layer in render order
+ *
+ * \return as ivi_layout_forEachSurface
+ */
+int32_t
+ivi_layout_forEachSurfaceOnLayer(struct ivi_layout_layer *ivilayer,
+                                 surfaceVisitorFunc visitor,
+                                 void *userdata);
+
+/**
+ * \brief Call visitor for the Layers of a screen in render order
+ *
+ * \return as ivi_layout_forEachSurface
+ */
+int32_t
+ivi_layout_forEachLayerOnScreen(struct ivi_layout_screen *iviscrn,
+                                layerVisitorFunc visitor,
+                                void *userdata);
+
+/**
+ * \brief Get the number of Surfaces, Layers, Surfaces of a layer or
+ * Layers of a screen, what ivi_layout_getSurfaces and friends would
+ * return as pLength
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_getNumberOfSurfaces(int32_t *pLength);
+
+int32_t
+ivi_layout_getNumberOfLayers(int32_t *pLength);
+
+int32_t
+ivi_layout_getNumberOfSurfacesOnLayer(struct ivi_layout_layer *ivilayer,
+                                      int32_t *pLength);
+
+int32_t
+ivi_layout_getNumberOfLayersOnScreen(struct ivi_layout_screen *iviscrn,
+                                     int32_t *pLength);
+
 /**
  * \brief Create a layer which should be managed by the service
  *
@@ -624,6 +820,10 @@ ivi_layout_layerGetOrientation(struct ivi_layout_layer *ivilayer,
 /**
  * \brief Sets the color value which defines the transparency value.
  *
+ * pColor points to red, green and blue components in 0..255; pixels of
+ * the layer's surfaces with that color are not drawn.  NULL turns the
+ * key off.  A key set on a surface takes precedence.
+ *
  * \return  0 if the method call was successful
  * \return -1 if the method call was failed
  */
@@ -634,6 +834,10 @@ ivi_layout_layerSetChromaKey(struct ivi_layout_layer *ivilayer,
 /**
  * \brief Sets render order of surfaces within one layer
  *
+ * Replaces the pending order; surfaces not in pSurface leave the layer
+ * on commit, a NULL pSurface empties it. A surface listed twice counts
+ * once. An order equal to the pending one is not flagged as a change.
+ *
  * \return  0 if the method call was successful
  * \return -1 if the method call was failed
  */
@@ -819,6 +1023,9 @@ ivi_layout_surfaceGetPixelformat(struct ivi_layout_layer *ivisurf,
 /**
  * \brief Sets the color value which defines the transparency value of a surface.
  *
+ * pColor points to red, green and blue components in 0..255, NULL turns
+ * the key off and falls back to the key of the layer.
+ *
  * \return  0 if the method call was successful
  * \return -1 if the method call was failed
  */
@@ -839,6 +1046,8 @@ ivi_layout_screenAddLayer(struct ivi_layout_screen *iviscrn,
 /**
  * \brief Sets render order of layers on a display
  *
+ * Same rules as ivi_layout_layerSetRenderOrder.
+ *
  * \return  0 if the method call was successful
  * \return -1 if the method call was failed
  */
@@ -850,6 +1059,11 @@ ivi_layout_screenSetRenderOrder(struct ivi_layout_screen *iviscrn,
 /**
  * \brief Enable or disable a rendering optimization
  *
+ * id is an enum ivi_layout_optimization, mode an
+ * enum ivi_layout_optimization_mode. The default is
+ * IVI_LAYOUT_OPTIMIZATION_MODE_HEURISTIC. Applied at the next
+ * ivi_layout_commitChanges.
+ *
  * \return  0 if the method call was successful
  * \return -1 if the method call was failed
  */
@@ -865,6 +1079,169 @@ ivi_layout_SetOptimizationMode(uint32_t id, int32_t mode);
 int32_t
 ivi_layout_GetOptimizationMode(uint32_t id, int32_t *pMode);
 
+/**
+ * \brief Ask for an optimization on the surfaces of a layer
+ *
+ * Takes effect while the optimization is in
+ * IVI_LAYOUT_OPTIMIZATION_MODE_HEURISTIC, at the next
+ * ivi_layout_commitChanges.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerSetOptimizationHint(struct ivi_layout_layer *ivilayer,
+                                    uint32_t id, int32_t enabled);
+
+/**
+ * \brief Get whether a layer asks for an optimization
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerGetOptimizationHint(struct ivi_layout_layer *ivilayer,
+                                    uint32_t id, int32_t *pEnabled);
+
+/**
+ * \brief Mark a layer whose surfaces rarely change
+ *
+ * The renderer may then composite the layer's surfaces once and draw
+ * that result alone until one of them is damaged, moved or otherwise
+ * changed. Takes effect on ivi_layout_commitChanges.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerSetCacheable(struct ivi_layout_layer *ivilayer,
+                             int32_t cacheable);
+
+/**
+ * \brief Get whether a layer is marked cacheable
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerGetCacheable(struct ivi_layout_layer *ivilayer,
+                             int32_t *pCacheable);
+
+/**
+ * \brief Set how often the surfaces of a layer are updated
+ *
+ * policy is an enum ivi_layout_repaint_policy. Damage and frame
+ * callbacks of a capped surface are held back and merged into its
+ * next update, which leaves the frame time to the layers running at
+ * full rate. max_hz is the cap for IVI_LAYOUT_REPAINT_POLICY_CAPPED
+ * and also applies to IVI_LAYOUT_REPAINT_POLICY_BEST_EFFORT when not
+ * 0. Takes effect on ivi_layout_commitChanges.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerSetRepaintPolicy(struct ivi_layout_layer *ivilayer,
+                                 int32_t policy, uint32_t max_hz);
+
+/**
+ * \brief Get the repaint policy of a layer
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerGetRepaintPolicy(struct ivi_layout_layer *ivilayer,
+                                 int32_t *pPolicy, uint32_t *pMaxHz);
+
+/**
+ * \brief Get the rendering statistics of a surface
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_surfaceGetStatistics(struct ivi_layout_surface *ivisurf,
+                                struct ivi_layout_Statistics *pStats);
+
+/**
+ * \brief Get the rendering statistics of a layer, the sum over the
+ * surfaces in its render order
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerGetStatistics(struct ivi_layout_layer *ivilayer,
+                              struct ivi_layout_Statistics *pStats);
+
+/**
+ * \brief Move the opacity of a surface to a value over time
+ *
+ * Unlike the setters, a transition needs no ivi_layout_commitChanges:
+ * it is evaluated once per frame of the surface's output and updates the
+ * current and the pending property together. Property notifications
+ * are sent when it ends, then done is called. Starting another
+ * transition of the same property, or removing the surface, cancels it
+ * without calling done.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_surfaceTransitionOpacity(struct ivi_layout_surface *ivisurf,
+                                    float opacity, uint32_t duration,
+                                    enum ivi_layout_transition_easing easing,
+                                    transitionDoneFunc done, void *userdata);
+
+/**
+ * \brief Move the destination rectangle of a surface over time
+ *
+ * See ivi_layout_surfaceTransitionOpacity.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_surfaceTransitionDestinationRectangle(
+                                    struct ivi_layout_surface *ivisurf,
+                                    int32_t x, int32_t y,
+                                    int32_t width, int32_t height,
+                                    uint32_t duration,
+                                    enum ivi_layout_transition_easing easing,
+                                    transitionDoneFunc done, void *userdata);
+
+/**
+ * \brief Move the opacity of a layer to a value over time
+ *
+ * See ivi_layout_surfaceTransitionOpacity.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerTransitionOpacity(struct ivi_layout_layer *ivilayer,
+                                  float opacity, uint32_t duration,
+                                  enum ivi_layout_transition_easing easing,
+                                  transitionDoneFunc done, void *userdata);
+
+/**
+ * \brief Move the destination rectangle of a layer over time
+ *
+ * See ivi_layout_surfaceTransitionOpacity.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_layerTransitionDestinationRectangle(
+                                  struct ivi_layout_layer *ivilayer,
+                                  int32_t x, int32_t y,
+                                  int32_t width, int32_t height,
+                                  uint32_t duration,
+                                  enum ivi_layout_transition_easing easing,
+                                  transitionDoneFunc done, void *userdata);
+
 /**
  * \brief register for notification on property changes of layer
  *
@@ -945,6 +1322,166 @@ ivi_layout_screenGetOutput(struct ivi_layout_screen *);
 int32_t
 ivi_layout_commitChanges(void);
 
+/**
+ * \brief Create an empty transaction.
+ *
+ * A transaction stages properties and render orders without touching
+ * the pending state of the objects.  ivi_layout_transactionCommit
+ * checks all of it and applies it in a single commit, so no other
+ * commit can show part of it.  A transaction may be committed more
+ * than once.
+ *
+ * \return (struct ivi_layout_transaction *)
+ *              if the method call was successful
+ * \return NULL if the method call was failed
+ */
+struct ivi_layout_transaction *
+ivi_layout_transactionCreate(void);
+
+/**
+ * \brief Destroy a transaction and everything staged in it.
+ */
+void
+ivi_layout_transactionDestroy(struct ivi_layout_transaction *transaction);
+
+/**
+ * \brief Stage a surface property in a transaction.
+ *
+ * Same arguments as the ivi_layout_surfaceSet* counterpart; staging a
+ * property again replaces the earlier value.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_transactionSurfaceSetVisibility(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_surface *ivisurf,
+                        int32_t newVisibility);
+
+int32_t
+ivi_layout_transactionSurfaceSetOpacity(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_surface *ivisurf,
+                        float opacity);
+
+int32_t
+ivi_layout_transactionSurfaceSetSourceRectangle(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_surface *ivisurf,
+                        int32_t x, int32_t y,
+                        int32_t width, int32_t height);
+
+int32_t
+ivi_layout_transactionSurfaceSetDestinationRectangle(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_surface *ivisurf,
+                        int32_t x, int32_t y,
+                        int32_t width, int32_t height);
+
+/**
+ * \brief Stage a layer property in a transaction.
+ *
+ * Same arguments as the ivi_layout_layerSet* counterpart.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_transactionLayerSetVisibility(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        int32_t newVisibility);
+
+int32_t
+ivi_layout_transactionLayerSetOpacity(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        float opacity);
+
+int32_t
+ivi_layout_transactionLayerSetSourceRectangle(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        int32_t x, int32_t y,
+                        int32_t width, int32_t height);
+
+int32_t
+ivi_layout_transactionLayerSetDestinationRectangle(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        int32_t x, int32_t y,
+                        int32_t width, int32_t height);
+
+/**
+ * \brief Stage the complete render order of a layer or a screen.
+ *
+ * As with ivi_layout_layerSetRenderOrder, what is not listed leaves the
+ * layer or screen on commit.  number 0 empties it.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_transactionLayerSetRenderOrder(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        struct ivi_layout_surface **pSurface,
+                        int32_t number);
+
+int32_t
+ivi_layout_transactionScreenSetRenderOrder(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_screen *iviscrn,
+                        struct ivi_layout_layer **pLayer,
+                        int32_t number);
+
+/**
+ * \brief Validate a transaction and apply it in one commit.
+ *
+ * Fails without changing anything if an object in it is gone, an
+ * opacity is out of range, a rectangle has a negative size or a render
+ * order lists an object twice.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_transactionCommit(struct ivi_layout_transaction *transaction);
+
+/**
+ * \brief Save the committed layout under a name.
+ *
+ * Records visibility, opacity, source and destination rectangles of
+ * every surface and layer and the render orders of all layers and
+ * screens.  An earlier snapshot of the same name is replaced.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_snapshotSave(const char *name);
+
+/**
+ * \brief Reactivate a saved layout in one commit.
+ *
+ * Objects destroyed since the snapshot was saved are left out.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_snapshotRestore(const char *name);
+
+/**
+ * \brief Forget a saved layout.
+ *
+ * \return  0 if the method call was successful
+ * \return -1 if the method call was failed
+ */
+int32_t
+ivi_layout_snapshotRemove(const char *name);
+
 #ifdef __cplusplus
 } /**/
 #endif /* __cplusplus */
@@ -45,6 +45,9 @@
  */
 
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -127,14 +130,27 @@ struct link_surfaceConfigureNotification {
     struct wl_list link;
 };
 
+struct link_changeSetNotification {
+    changeSetNotificationFunc callback;
+    void *userdata;
+    struct wl_list link;
+};
+
 struct ivi_layout;
 
+/* Surfaces and layers are also hashed by id, for the id lookups every
+ * controller request starts with. */
+#define IVI_LAYOUT_HASH_BITS 8
+#define IVI_LAYOUT_HASH_SIZE (1 << IVI_LAYOUT_HASH_BITS)
+
 struct ivi_layout_surface {
     struct wl_list link;
+    struct wl_list hash_link;
     struct wl_list list_notification;
     struct wl_list list_layer;
     int32_t update_count;
     uint32_t id_surface;
+    uint32_t order_generation;  /* see next_order_generation() */
 
     struct ivi_layout *layout;
     struct weston_surface *surface;
@@ -148,6 +164,12 @@ struct ivi_layout_surface {
     struct ivi_layout_SurfaceProperties prop;
     int32_t pixelformat;
     uint32_t event_mask;
+    struct wl_list dirty_link;
+
+    /* entry in the change set being collected, if change_serial
+     * matches the layout's */
+    uint32_t change_serial;
+    int32_t change_index;
 
     struct {
         struct ivi_layout_SurfaceProperties prop;
@@ -163,22 +185,48 @@ struct ivi_layout_surface {
         ivi_controller_surface_content_callback callback;
         void* userdata;
     } content_observer;
+
+    /* Stand-in content until the app's first buffer, see
+     * ivi_layout_surfaceCreatePlaceholder.  surface is the placeholder
+     * meanwhile, native the app's surface once it bound the id. */
+    struct weston_surface *placeholder;
+    struct weston_surface *native;
+    struct wl_listener native_destroy_listener;
+
+    /* the surface of ivi_layout_surfaceCreateSolidColor, which the
+     * layout owns for good */
+    struct weston_surface *solid;
 };
 
 struct ivi_layout_layer {
     struct wl_list link;
+    struct wl_list hash_link;
     struct wl_list list_notification;
     struct wl_list list_screen;
     struct wl_list link_to_surface;
     uint32_t id_layer;
+    uint32_t order_generation;
 
     struct ivi_layout *layout;
 
     struct ivi_layout_LayerProperties prop;
+    uint32_t optimization;    /* 1 << enum ivi_layout_optimization */
+    int32_t cacheable;
+    uint32_t cache_group;     /* weston_view::cache_group of the views */
+    int32_t repaint_policy;   /* enum ivi_layout_repaint_policy */
+    uint32_t repaint_max_hz;
     uint32_t event_mask;
+    struct wl_list dirty_link;
+
+    uint32_t change_serial;
+    int32_t change_index;
 
     struct {
         struct ivi_layout_LayerProperties prop;
+        uint32_t optimization;
+        int32_t cacheable;
+        int32_t repaint_policy;
+        uint32_t repaint_max_hz;
         struct wl_list list_surface;
         struct wl_list link;
     } pending;
@@ -197,6 +245,10 @@ struct ivi_layout_screen {
     struct ivi_layout *layout;
     struct weston_output *output;
 
+    /* views of this screen, rebuilt when order_dirty is set */
+    struct weston_layer layer;
+    int32_t order_dirty;
+
     uint32_t event_mask;
 
     struct {
@@ -210,6 +262,38 @@ struct ivi_layout_screen {
     } order;
 };
 
+enum transaction_entry_type {
+    TRANSACTION_SURFACE,
+    TRANSACTION_LAYER,
+    TRANSACTION_LAYER_ORDER,
+    TRANSACTION_SCREEN_ORDER,
+};
+
+/* What a transaction stages for one object, by id so that a saved
+ * snapshot outlives the objects it was taken from. */
+struct ivi_layout_transaction_entry {
+    struct wl_list link;
+    enum transaction_entry_type type;
+    uint32_t id;
+    uint32_t mask;      /* IVI_NOTIFICATION_* of the staged properties */
+
+    int32_t visibility;
+    float opacity;
+    int32_t source[4];
+    int32_t dest[4];
+    struct wl_array order;  /* uint32_t ids, in the setter's order */
+};
+
+struct ivi_layout_transaction {
+    struct wl_list list_entry;
+};
+
+struct ivi_layout_snapshot {
+    struct wl_list link;
+    char *name;
+    struct ivi_layout_transaction transaction;
+};
+
 struct ivi_layout {
     struct weston_compositor *compositor;
 
@@ -217,6 +301,20 @@ struct ivi_layout {
     struct wl_list list_layer;
     struct wl_list list_screen;
 
+    struct wl_list hash_surface[IVI_LAYOUT_HASH_SIZE];
+    struct wl_list hash_layer[IVI_LAYOUT_HASH_SIZE];
+
+    /* Objects with a non-zero event_mask, i.e. those the next
+     * ivi_layout_commitChanges has to look at. */
+    struct wl_list list_dirty_surface;
+    struct wl_list list_dirty_layer;
+
+    int32_t optimization_mode[IVI_LAYOUT_OPTIMIZATION_COUNT];
+    uint32_t cache_group_serial;
+    uint32_t order_generation;
+
+    struct wl_list list_transition;
+
     struct {
         struct wl_list list_create;
         struct wl_list list_remove;
@@ -228,11 +326,43 @@ struct ivi_layout {
         struct wl_list list_configure;
     } surface_notification;
 
-    struct weston_layer layout_layer;
+    /* Changes collected for the change set listeners, one
+     * struct ivi_layout_change per object, delivered at the end of the
+     * commit or when the event loop goes idle. */
+    struct {
+        struct wl_list list_notification;
+        struct wl_array changes;
+        uint32_t serial;
+        struct wl_event_source *idle;
+    } change_set;
+
+    struct wl_list list_snapshot;
+
+    /* Properties and orders kept in a file across compositor
+     * restarts, see state_save().  restore holds what the file had at
+     * startup for the objects that did not come back yet. */
+    struct {
+        int fd;
+        void *map;
+        size_t map_size;
+        struct wl_event_source *save_timer;
+        int32_t save_pending;
+        struct ivi_layout_transaction restore;
+        struct wl_event_source *restore_timer;
+    } state;
 };
 
 static struct ivi_layout ivilayout = {0};
 
+static void
+state_restore_layer(struct ivi_layout *layout,
+                    struct ivi_layout_layer *ivilayer);
+static void
+state_restore_surface(struct ivi_layout *layout,
+                      struct ivi_layout_surface *ivisurf);
+static void
+state_schedule_save(struct ivi_layout *layout);
+
 static struct ivi_layout *
 get_instance(void)
 {
@@ -373,12 +503,65 @@ remove_orderlayer_from_screen(struct ivi_layout_layer *ivilayer)
 /**
  * Internal API to add/remove a layer from screen.
  */
+/**
+ * Internal API to record a pending change, so that ivi_layout_commitChanges
+ * only visits the surfaces and layers which were touched since the last
+ * commit.
+ */
+static void
+surface_mark_dirty(struct ivi_layout_surface *ivisurf, uint32_t mask)
+{
+    if (wl_list_empty(&ivisurf->dirty_link)) {
+        wl_list_insert(ivisurf->layout->list_dirty_surface.prev,
+                       &ivisurf->dirty_link);
+    }
+    ivisurf->event_mask |= mask;
+}
+
+static void
+layer_mark_dirty(struct ivi_layout_layer *ivilayer, uint32_t mask)
+{
+    if (wl_list_empty(&ivilayer->dirty_link)) {
+        wl_list_insert(ivilayer->layout->list_dirty_layer.prev,
+                       &ivilayer->dirty_link);
+    }
+    ivilayer->event_mask |= mask;
+}
+
+static uint32_t
+hash_id(uint32_t id)
+{
+    return (id * 2654435761u) >> (32 - IVI_LAYOUT_HASH_BITS);
+}
+
+/* A value no surface or layer carries yet, for the render order setters
+ * to mark what they have seen in one pass. */
+static uint32_t
+next_order_generation(struct ivi_layout *layout)
+{
+    if (++layout->order_generation == 0) {
+        struct ivi_layout_surface *ivisurf = NULL;
+        struct ivi_layout_layer *ivilayer = NULL;
+
+        wl_list_for_each(ivisurf, &layout->list_surface, link) {
+            ivisurf->order_generation = 0;
+        }
+        wl_list_for_each(ivilayer, &layout->list_layer, link) {
+            ivilayer->order_generation = 0;
+        }
+        layout->order_generation = 1;
+    }
+
+    return layout->order_generation;
+}
+
 static struct ivi_layout_surface *
-get_surface(struct wl_list *list_surf, uint32_t id_surface)
+get_surface(struct ivi_layout *layout, uint32_t id_surface)
 {
     struct ivi_layout_surface *ivisurf;
 
-    wl_list_for_each(ivisurf, list_surf, link) {
+    wl_list_for_each(ivisurf, &layout->hash_surface[hash_id(id_surface)],
+                     hash_link) {
         if (ivisurf->id_surface == id_surface) {
             return ivisurf;
         }
@@ -388,11 +571,12 @@ get_surface(struct wl_list *list_surf, uint32_t id_surface)
 }
 
 static struct ivi_layout_layer *
-get_layer(struct wl_list *list_layer, uint32_t id_layer)
+get_layer(struct ivi_layout *layout, uint32_t id_layer)
 {
     struct ivi_layout_layer *ivilayer;
 
-    wl_list_for_each(ivilayer, list_layer, link) {
+    wl_list_for_each(ivilayer, &layout->hash_layer[hash_id(id_layer)],
+                     hash_link) {
         if (ivilayer->id_layer == id_layer) {
             return ivilayer;
         }
@@ -484,6 +668,11 @@ create_screen(struct weston_compositor *ec)
         iviscrn->output = output;
         iviscrn->event_mask = 0;
 
+        /* Add the layer of the screen at the bottom of
+         * weston_compositor.layer_list */
+        weston_layer_init(&iviscrn->layer, ec->layer_list.prev);
+        iviscrn->order_dirty = 1;
+
         wl_list_init(&iviscrn->pending.list_layer);
         wl_list_init(&iviscrn->pending.link);
 
@@ -541,6 +730,36 @@ update_opacity(struct ivi_layout_layer *ivilayer,
     }
 }
 
+static void
+update_chromakey(struct ivi_layout_layer *ivilayer,
+                 struct ivi_layout_surface *ivisurf)
+{
+    struct weston_view *tmpview = NULL;
+    int32_t enabled = 0;
+    uint32_t key = 0;
+
+    /* Not only on IVI_NOTIFICATION_CHROMAKEY: a surface entering a
+     * keyed layer picks the key up too.  The surface's own key wins
+     * over the one of its layer. */
+    if (ivisurf->prop.chromaKeyEnabled) {
+        enabled = 1;
+        key = (ivisurf->prop.chromaKeyRed   & 0xff) << 16 |
+              (ivisurf->prop.chromaKeyGreen & 0xff) << 8 |
+              (ivisurf->prop.chromaKeyBlue  & 0xff);
+    } else if (ivilayer->prop.chromaKeyEnabled) {
+        enabled = 1;
+        key = (ivilayer->prop.chromaKeyRed   & 0xff) << 16 |
+              (ivilayer->prop.chromaKeyGreen & 0xff) << 8 |
+              (ivilayer->prop.chromaKeyBlue  & 0xff);
+    }
+
+    wl_list_for_each(tmpview, &ivisurf->surface->views, surface_link)
+    {
+        tmpview->colorkey_enabled = enabled;
+        tmpview->colorkey = key;
+    }
+}
+
 static void
 update_surface_orientation(struct ivi_layout_layer *ivilayer,
                            struct ivi_layout_surface *ivisurf)
@@ -812,12 +1031,70 @@ update_scale(struct ivi_layout_layer *ivilayer,
     weston_view_update_transform(view);
 }
 
+/* A layer that only moved, as in a workspace swipe, leaves its
+ * surfaces' transforms alone but for the translation in layer_pos.
+ * That is rewritten in place, and the view matrices are recomputed
+ * once at the repaint instead of after each step of update_prop. */
+static int
+update_layer_translation(struct ivi_layout_layer *ivilayer,
+                         struct ivi_layout_surface *ivisurf)
+{
+    struct weston_matrix *matrix = &ivisurf->layer_pos.matrix;
+    struct weston_view *view = NULL;
+
+    /* never placed by a full update yet */
+    if (ivisurf->surface == NULL ||
+        wl_list_empty(&ivisurf->surface->views) ||
+        wl_list_empty(&ivisurf->layer_pos.link)) {
+        return -1;
+    }
+
+    view = container_of(ivisurf->surface->views.next,
+                        struct weston_view, surface_link);
+
+    matrix->d[12] = (float)ivilayer->prop.destX;
+    matrix->d[13] = (float)ivilayer->prop.destY;
+    weston_view_geometry_dirty(view);
+
+    return 0;
+}
+
+/* The source rectangle crops the buffer through the surface's viewport
+ * rather than by a transform, so that the renderers sample only that
+ * part and a cropped, scaled surface can still go on an overlay plane.
+ * update_scale then scales the cropped surface to the destination. */
+static void
+update_source_crop(struct ivi_layout_surface *ivisurf)
+{
+    struct ivi_layout_SurfaceProperties *prop = &ivisurf->prop;
+
+    if (ivisurf->surface == NULL) {
+        return;
+    }
+
+    weston_surface_set_shell_crop(ivisurf->surface,
+                                  prop->sourceX, prop->sourceY,
+                                  prop->sourceWidth, prop->sourceHeight);
+}
+
 static void
 update_prop(struct ivi_layout_layer *ivilayer,
             struct ivi_layout_surface *ivisurf)
 {
+    if (ivilayer->event_mask == IVI_NOTIFICATION_POSITION &&
+        ivisurf->event_mask == 0 &&
+        update_layer_translation(ivilayer, ivisurf) == 0) {
+        ivisurf->update_count++;
+        return;
+    }
+
     if (ivilayer->event_mask | ivisurf->event_mask) {
+        /* the crop sizes the surface the transforms below act on */
+        if (ivisurf->event_mask & IVI_NOTIFICATION_SOURCE_RECT) {
+            update_source_crop(ivisurf);
+        }
         update_opacity(ivilayer, ivisurf);
+        update_chromakey(ivilayer, ivisurf);
         update_layer_orientation(ivilayer, ivisurf);
         update_layer_position(ivilayer, ivisurf);
         update_surface_position(ivisurf);
@@ -844,18 +1121,66 @@ update_prop(struct ivi_layout_layer *ivilayer,
     }
 }
 
+/**
+ * Internal APIs to flag the screens whose view list has to be rebuilt.
+ */
+static void
+mark_all_screens(struct ivi_layout *layout)
+{
+    struct ivi_layout_screen *iviscrn = NULL;
+
+    wl_list_for_each(iviscrn, &layout->list_screen, link) {
+        iviscrn->order_dirty = 1;
+    }
+}
+
+static void
+mark_layer_screens(struct ivi_layout_layer *ivilayer)
+{
+    struct link_screen *link_scrn = NULL;
+
+    wl_list_for_each(link_scrn, &ivilayer->list_screen, link) {
+        link_scrn->iviscrn->order_dirty = 1;
+    }
+}
+
+static void
+mark_surface_screens(struct ivi_layout_surface *ivisurf)
+{
+    struct link_layer *link_layer = NULL;
+
+    wl_list_for_each(link_layer, &ivisurf->list_layer, link) {
+        mark_layer_screens(link_layer->ivilayer);
+    }
+}
+
 static void
 commit_changes(struct ivi_layout *layout)
 {
-    struct ivi_layout_screen  *iviscrn  = NULL;
     struct ivi_layout_layer   *ivilayer = NULL;
     struct ivi_layout_surface *ivisurf  = NULL;
+    struct link_layer         *link_layer = NULL;
 
-    wl_list_for_each(iviscrn, &layout->list_screen, link) {
-        wl_list_for_each(ivilayer, &iviscrn->order.list_layer, order.link) {
-            wl_list_for_each(ivisurf, &ivilayer->order.list_surface, order.link) {
-                update_prop(ivilayer, ivisurf);
+    /* A changed layer updates every surface it holds. */
+    wl_list_for_each(ivilayer, &layout->list_dirty_layer, dirty_link) {
+        if (wl_list_empty(&ivilayer->order.link)) {
+            continue;
+        }
+        wl_list_for_each(ivisurf, &ivilayer->order.list_surface, order.link) {
+            update_prop(ivilayer, ivisurf);
+        }
+    }
+
+    /* A changed surface is updated in the unchanged layers it sits in;
+     * the changed ones were handled above. */
+    wl_list_for_each(ivisurf, &layout->list_dirty_surface, dirty_link) {
+        wl_list_for_each(link_layer, &ivisurf->list_layer, link) {
+            ivilayer = link_layer->ivilayer;
+            if (!wl_list_empty(&ivilayer->dirty_link) ||
+                wl_list_empty(&ivilayer->order.link)) {
+                continue;
             }
+            update_prop(ivilayer, ivisurf);
         }
     }
 }
@@ -865,7 +1190,7 @@ commit_list_surface(struct ivi_layout *layout)
 {
     struct ivi_layout_surface *ivisurf = NULL;
 
-    wl_list_for_each(ivisurf, &layout->list_surface, link) {
+    wl_list_for_each(ivisurf, &layout->list_dirty_surface, dirty_link) {
         ivisurf->prop = ivisurf->pending.prop;
     }
 }
@@ -877,8 +1202,22 @@ commit_list_layer(struct ivi_layout *layout)
     struct ivi_layout_surface *ivisurf  = NULL;
     struct ivi_layout_surface *next     = NULL;
 
-    wl_list_for_each(ivilayer, &layout->list_layer, link) {
+    wl_list_for_each(ivilayer, &layout->list_dirty_layer, dirty_link) {
         ivilayer->prop = ivilayer->pending.prop;
+        if (ivilayer->optimization != ivilayer->pending.optimization) {
+            ivilayer->optimization = ivilayer->pending.optimization;
+            mark_layer_screens(ivilayer);
+        }
+        if (ivilayer->cacheable != ivilayer->pending.cacheable) {
+            ivilayer->cacheable = ivilayer->pending.cacheable;
+            mark_layer_screens(ivilayer);
+        }
+        if (ivilayer->repaint_policy != ivilayer->pending.repaint_policy ||
+            ivilayer->repaint_max_hz != ivilayer->pending.repaint_max_hz) {
+            ivilayer->repaint_policy = ivilayer->pending.repaint_policy;
+            ivilayer->repaint_max_hz = ivilayer->pending.repaint_max_hz;
+            mark_layer_screens(ivilayer);
+        }
 
         if (!(ivilayer->event_mask &
               (IVI_NOTIFICATION_ADD | IVI_NOTIFICATION_REMOVE)) ) {
@@ -895,7 +1234,7 @@ commit_list_layer(struct ivi_layout *layout)
                 }
 
                 wl_list_init(&ivisurf->order.link);
-                ivisurf->event_mask |= IVI_NOTIFICATION_REMOVE;
+                surface_mark_dirty(ivisurf, IVI_NOTIFICATION_REMOVE);
             }
 
             wl_list_init(&ivilayer->order.list_surface);
@@ -924,10 +1263,119 @@ commit_list_layer(struct ivi_layout *layout)
                 wl_list_insert(&ivilayer->order.list_surface,
                                &ivisurf->order.link);
                 add_ordersurface_to_layer(ivisurf, ivilayer);
-                ivisurf->event_mask |= IVI_NOTIFICATION_ADD;
+                surface_mark_dirty(ivisurf, IVI_NOTIFICATION_ADD);
+            }
+        }
+    }
+}
+
+static uint32_t
+layer_plane_hint(struct ivi_layout *layout, struct ivi_layout_layer *ivilayer)
+{
+    static const uint32_t plane_hints[IVI_LAYOUT_OPTIMIZATION_COUNT] = {
+        [IVI_LAYOUT_OPTIMIZATION_OVERLAY] = WESTON_VIEW_PLANE_HINT_OVERLAY,
+        [IVI_LAYOUT_OPTIMIZATION_SCANOUT] = WESTON_VIEW_PLANE_HINT_SCANOUT,
+    };
+    uint32_t hint = 0;
+    int i;
+
+    for (i = 0; i < IVI_LAYOUT_OPTIMIZATION_COUNT; i++) {
+        switch (layout->optimization_mode[i]) {
+        case IVI_LAYOUT_OPTIMIZATION_MODE_FORCE_ON:
+            hint |= plane_hints[i];
+            break;
+        case IVI_LAYOUT_OPTIMIZATION_MODE_HEURISTIC:
+            if (ivilayer->optimization & (1u << i)) {
+                hint |= plane_hints[i];
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return hint;
+}
+
+static void
+surface_set_repaint_policy(struct weston_surface *surface,
+                           struct ivi_layout_layer *ivilayer)
+{
+    uint32_t hz = ivilayer->repaint_max_hz;
+
+    switch (ivilayer->repaint_policy) {
+    case IVI_LAYOUT_REPAINT_POLICY_CAPPED:
+    case IVI_LAYOUT_REPAINT_POLICY_BEST_EFFORT:
+        surface->update_interval = hz > 0 ? 1000 / hz : 0;
+        surface->update_best_effort = ivilayer->repaint_policy ==
+            IVI_LAYOUT_REPAINT_POLICY_BEST_EFFORT;
+        break;
+    default:
+        surface->update_interval = 0;
+        surface->update_best_effort = 0;
+        break;
+    }
+}
+
+static void
+build_screen_view_list(struct ivi_layout *layout,
+                       struct ivi_layout_screen *iviscrn)
+{
+    struct ivi_layout_layer   *ivilayer = NULL;
+    struct ivi_layout_surface *ivisurf  = NULL;
+    struct weston_view        *view     = NULL;
+    struct weston_view        *next     = NULL;
+    uint32_t plane_hint;
+    uint32_t cache_group;
+
+    wl_list_for_each_safe(view, next, &iviscrn->layer.view_list, layer_link) {
+        wl_list_remove(&view->layer_link);
+        wl_list_init(&view->layer_link);
+        view->surface->update_interval = 0;
+        view->surface->update_best_effort = 0;
+    }
+
+    wl_list_for_each(ivilayer, &iviscrn->order.list_layer, order.link) {
+
+        if (ivilayer->prop.visibility == 0)
+            continue;
+
+        plane_hint = layer_plane_hint(layout, ivilayer);
+        cache_group = ivilayer->cacheable ? ivilayer->cache_group : 0;
+
+        wl_list_for_each(ivisurf, &ivilayer->order.list_surface, order.link) {
+            struct weston_view *tmpview = NULL;
+
+            if (ivisurf->prop.visibility == 0)
+                continue;
+            if (ivisurf->surface == NULL)
+                continue;
+
+            wl_list_for_each(tmpview, &ivisurf->surface->views, surface_link)
+            {
+                if (tmpview != NULL) {
+                    break;
+                }
+            }
+
+            if (tmpview == NULL)
+                continue;
+
+            /* A view can only be in one layer, the screen built last
+             * gets a surface that is on several. */
+            if (!wl_list_empty(&tmpview->layer_link)) {
+                wl_list_remove(&tmpview->layer_link);
             }
+            wl_list_insert(&iviscrn->layer.view_list, &tmpview->layer_link);
+            tmpview->plane_hint = plane_hint;
+            tmpview->cache_group = cache_group;
+            surface_set_repaint_policy(ivisurf->surface, ivilayer);
+
+            ivisurf->surface->output = iviscrn->output;
         }
     }
+
+    iviscrn->order_dirty = 0;
 }
 
 static void
@@ -937,8 +1385,15 @@ commit_list_screen(struct ivi_layout *layout)
     struct ivi_layout_layer   *ivilayer = NULL;
     struct ivi_layout_layer   *next     = NULL;
     struct ivi_layout_surface *ivisurf  = NULL;
+    const uint32_t order_mask = IVI_NOTIFICATION_ADD |
+                                IVI_NOTIFICATION_REMOVE |
+                                IVI_NOTIFICATION_VISIBILITY;
 
     wl_list_for_each(iviscrn, &layout->list_screen, link) {
+        if (iviscrn->event_mask != 0) {
+            iviscrn->order_dirty = 1;
+        }
+
         if (iviscrn->event_mask & IVI_NOTIFICATION_REMOVE) {
             wl_list_for_each_safe(ivilayer, next,
                      &iviscrn->order.list_layer, order.link) {
@@ -949,7 +1404,7 @@ commit_list_screen(struct ivi_layout *layout)
                 }
 
                 wl_list_init(&ivilayer->order.link);
-                ivilayer->event_mask |= IVI_NOTIFICATION_REMOVE;
+                layer_mark_dirty(ivilayer, IVI_NOTIFICATION_REMOVE);
             }
         }
 
@@ -971,95 +1426,539 @@ commit_list_screen(struct ivi_layout *layout)
                 wl_list_insert(&iviscrn->order.list_layer,
                                &ivilayer->order.link);
                 add_orderlayer_to_screen(ivilayer, iviscrn);
-                ivilayer->event_mask |= IVI_NOTIFICATION_ADD;
+                layer_mark_dirty(ivilayer, IVI_NOTIFICATION_ADD);
             }
         }
 
         iviscrn->event_mask = 0;
+    }
 
-        /* Clear view list of layout layer */
-        wl_list_init(&layout->layout_layer.view_list);
+    /* Only a change of the render order or of the visibility of what is
+     * on a screen changes its view list. */
+    wl_list_for_each(ivilayer, &layout->list_dirty_layer, dirty_link) {
+        if (ivilayer->event_mask & order_mask) {
+            mark_layer_screens(ivilayer);
+        }
+    }
 
-        wl_list_for_each(ivilayer, &iviscrn->order.list_layer, order.link) {
+    wl_list_for_each(ivisurf, &layout->list_dirty_surface, dirty_link) {
+        if (ivisurf->event_mask & order_mask) {
+            mark_surface_screens(ivisurf);
+        }
+    }
 
-            if (ivilayer->prop.visibility == 0)
-                continue;
+    wl_list_for_each(iviscrn, &layout->list_screen, link) {
+        if (iviscrn->order_dirty) {
+            build_screen_view_list(layout, iviscrn);
+        }
+    }
+}
 
-            wl_list_for_each(ivisurf, &ivilayer->order.list_surface, order.link) {
-                struct weston_view *tmpview = NULL;
-                wl_list_for_each(tmpview, &ivisurf->surface->views, surface_link)
-                {
-                    if (tmpview != NULL) {
-                        break;
-                    }
-                }
+/**
+ * Internal APIs to collect changes for the change set listeners.
+ */
+static void
+flush_changes(struct ivi_layout *layout)
+{
+    struct link_changeSetNotification *notification = NULL;
+    struct wl_array changes;
 
-                if (ivisurf->prop.visibility == 0)
-                    continue;
-                if (ivisurf->surface == NULL || tmpview == NULL)
-                    continue;
+    if (layout->change_set.changes.size == 0) {
+        return;
+    }
 
-                wl_list_insert(&layout->layout_layer.view_list,
-                               &tmpview->layer_link);
+    /* Listeners may change things again; that goes to the next set. */
+    changes = layout->change_set.changes;
+    wl_array_init(&layout->change_set.changes);
+    layout->change_set.serial++;
 
-                ivisurf->surface->output = iviscrn->output;
-            }
+    wl_list_for_each(notification,
+            &layout->change_set.list_notification, link) {
+        notification->callback(changes.data,
+                               changes.size / sizeof(struct ivi_layout_change),
+                               notification->userdata);
+    }
+
+    if (layout->change_set.changes.size == 0) {
+        wl_array_release(&layout->change_set.changes);
+        changes.size = 0;
+        layout->change_set.changes = changes;
+    } else {
+        wl_array_release(&changes);
+    }
+}
+
+static void
+flush_changes_idle(void *data)
+{
+    struct ivi_layout *layout = data;
+
+    layout->change_set.idle = NULL;
+    flush_changes(layout);
+}
+
+static void
+queue_change(struct ivi_layout *layout,
+             uint32_t *serial, int32_t *index,
+             uint32_t object, uint32_t id, uint32_t events, uint32_t mask)
+{
+    struct ivi_layout_change *change = NULL;
+    struct wl_event_loop *loop = NULL;
+
+    if (wl_list_empty(&layout->change_set.list_notification)) {
+        return;
+    }
+
+    if (*serial == layout->change_set.serial) {
+        change = (struct ivi_layout_change *)layout->change_set.changes.data +
+                 *index;
+    } else {
+        change = wl_array_add(&layout->change_set.changes, sizeof *change);
+        if (change == NULL) {
+            weston_log("fails to allocate memory\n");
+            return;
         }
 
-        break;
+        *serial = layout->change_set.serial;
+        *index = layout->change_set.changes.size / sizeof *change - 1;
+        change->id = id;
+        change->object = object;
+        change->events = 0;
+        change->mask = 0;
+    }
+
+    change->events |= events;
+    change->mask |= mask;
+
+    if (layout->change_set.idle == NULL) {
+        loop = wl_display_get_event_loop(layout->compositor->wl_display);
+        layout->change_set.idle =
+            wl_event_loop_add_idle(loop, flush_changes_idle, layout);
     }
 }
 
 static void
-send_surface_prop(struct ivi_layout_surface *ivisurf)
+queue_surface_change(struct ivi_layout_surface *ivisurf,
+                     uint32_t events, uint32_t mask)
+{
+    queue_change(ivisurf->layout,
+                 &ivisurf->change_serial, &ivisurf->change_index,
+                 IVI_LAYOUT_CHANGE_OBJECT_SURFACE, ivisurf->id_surface,
+                 events, mask);
+}
+
+static void
+queue_layer_change(struct ivi_layout_layer *ivilayer,
+                   uint32_t events, uint32_t mask)
+{
+    queue_change(ivilayer->layout,
+                 &ivilayer->change_serial, &ivilayer->change_index,
+                 IVI_LAYOUT_CHANGE_OBJECT_LAYER, ivilayer->id_layer,
+                 events, mask);
+}
+
+static void
+notify_surface_prop(struct ivi_layout_surface *ivisurf, uint32_t mask)
 {
     struct link_surfacePropertyNotification *notification = NULL;
 
     wl_list_for_each(notification, &ivisurf->list_notification, link) {
-        notification->callback(ivisurf, &ivisurf->prop,
-                               ivisurf->event_mask,
+        notification->callback(ivisurf, &ivisurf->prop, mask,
                                notification->userdata);
     }
 
-    ivisurf->event_mask = 0;
+    if (mask != 0) {
+        queue_surface_change(ivisurf, 0, mask);
+    }
 }
 
 static void
-send_layer_prop(struct ivi_layout_layer *ivilayer)
+notify_layer_prop(struct ivi_layout_layer *ivilayer, uint32_t mask)
 {
     struct link_layerPropertyNotification *notification = NULL;
 
     wl_list_for_each(notification, &ivilayer->list_notification, link) {
-        notification->callback(ivilayer, &ivilayer->prop,
-                               ivilayer->event_mask,
+        notification->callback(ivilayer, &ivilayer->prop, mask,
                                notification->userdata);
     }
 
+    queue_layer_change(ivilayer, 0, mask);
+}
+
+static void
+send_surface_prop(struct ivi_layout_surface *ivisurf)
+{
+    notify_surface_prop(ivisurf, ivisurf->event_mask);
+
+    ivisurf->event_mask = 0;
+    wl_list_remove(&ivisurf->dirty_link);
+    wl_list_init(&ivisurf->dirty_link);
+}
+
+static void
+send_layer_prop(struct ivi_layout_layer *ivilayer)
+{
+    /* A hint change alone marks the layer dirty with an empty mask,
+     * there is nothing to report for it. */
+    if (ivilayer->event_mask != 0) {
+        notify_layer_prop(ivilayer, ivilayer->event_mask);
+    }
+
     ivilayer->event_mask = 0;
+    wl_list_remove(&ivilayer->dirty_link);
+    wl_list_init(&ivilayer->dirty_link);
 }
 
 static void
 send_prop(struct ivi_layout *layout)
 {
     struct ivi_layout_layer   *ivilayer = NULL;
+    struct ivi_layout_layer   *next_layer = NULL;
     struct ivi_layout_surface *ivisurf  = NULL;
+    struct ivi_layout_surface *next_surf = NULL;
 
-    wl_list_for_each_reverse(ivilayer, &layout->list_layer, link) {
+    wl_list_for_each_safe(ivilayer, next_layer,
+                          &layout->list_dirty_layer, dirty_link) {
         send_layer_prop(ivilayer);
     }
 
-    wl_list_for_each_reverse(ivisurf, &layout->list_surface, link) {
+    wl_list_for_each_safe(ivisurf, next_surf,
+                          &layout->list_dirty_surface, dirty_link) {
         send_surface_prop(ivisurf);
     }
 }
 
-static void
-clear_surface_pending_list(struct ivi_layout_layer *ivilayer)
-{
-    struct ivi_layout_surface *surface_link = NULL;
-    struct ivi_layout_surface *surface_next = NULL;
+/**
+ * Internal APIs for transitions. A transition moves one property of a
+ * surface or a layer to a target value over time. It is evaluated from
+ * the animation_list of an output, so it advances exactly once per
+ * frame, and it writes the current and the pending property together
+ * and updates only the views involved, without a commit.
+ */
+#define TRANSITION_VALUES_MAX 4
 
-    wl_list_for_each_safe(surface_link, surface_next,
+struct ivi_layout_transition {
+    struct weston_animation animation;
+    struct wl_list link;
+    struct ivi_layout *layout;
+
+    /* exactly one of the two is set */
+    struct ivi_layout_surface *ivisurf;
+    struct ivi_layout_layer *ivilayer;
+    uint32_t mask;
+
+    enum ivi_layout_transition_easing easing;
+    uint32_t duration;
+    uint32_t time_start;
+    int32_t count;
+    float start[TRANSITION_VALUES_MAX];
+    float end[TRANSITION_VALUES_MAX];
+
+    transitionDoneFunc done;
+    void *userdata;
+};
+
+static float
+transition_ease(enum ivi_layout_transition_easing easing, float t)
+{
+    switch (easing) {
+    case IVI_LAYOUT_TRANSITION_EASING_EASE_IN:
+        return t * t;
+    case IVI_LAYOUT_TRANSITION_EASING_EASE_OUT:
+        return 1.0f - (1.0f - t) * (1.0f - t);
+    case IVI_LAYOUT_TRANSITION_EASING_EASE_IN_OUT:
+        if (t < 0.5f) {
+            return 2.0f * t * t;
+        }
+        return 1.0f - 2.0f * (1.0f - t) * (1.0f - t);
+    case IVI_LAYOUT_TRANSITION_EASING_LINEAR:
+    default:
+        return t;
+    }
+}
+
+static void
+transition_destroy(struct ivi_layout_transition *transition)
+{
+    wl_list_remove(&transition->animation.link);
+    wl_list_remove(&transition->link);
+    free(transition);
+}
+
+/* Returns the values of the property as an array of floats; opacity
+ * has one value, a destination rectangle four. */
+static int32_t
+transition_get(struct ivi_layout_transition *transition, float *values)
+{
+    float opacity;
+    int32_t x, y, width, height;
+
+    if (transition->ivisurf != NULL) {
+        struct ivi_layout_SurfaceProperties *prop =
+            &transition->ivisurf->prop;
+
+        opacity = prop->opacity;
+        x = prop->destX;
+        y = prop->destY;
+        width = prop->destWidth;
+        height = prop->destHeight;
+    } else {
+        struct ivi_layout_LayerProperties *prop =
+            &transition->ivilayer->prop;
+
+        opacity = prop->opacity;
+        x = prop->destX;
+        y = prop->destY;
+        width = prop->destWidth;
+        height = prop->destHeight;
+    }
+
+    if (transition->mask == IVI_NOTIFICATION_OPACITY) {
+        values[0] = opacity;
+        return 1;
+    }
+
+    values[0] = x;
+    values[1] = y;
+    values[2] = width;
+    values[3] = height;
+    return 4;
+}
+
+static void
+transition_set_surface(struct ivi_layout_surface *ivisurf, uint32_t mask,
+                       const float *values)
+{
+    struct ivi_layout_SurfaceProperties *props[2] = {
+        &ivisurf->prop, &ivisurf->pending.prop
+    };
+    struct link_layer *link_layer = NULL;
+    uint32_t event_mask = ivisurf->event_mask;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (mask == IVI_NOTIFICATION_OPACITY) {
+            props[i]->opacity = values[0];
+        } else {
+            props[i]->destX = (int32_t)values[0];
+            props[i]->destY = (int32_t)values[1];
+            props[i]->destWidth = (int32_t)values[2];
+            props[i]->destHeight = (int32_t)values[3];
+        }
+    }
+
+    ivisurf->event_mask |= mask;
+    wl_list_for_each(link_layer, &ivisurf->list_layer, link) {
+        if (!wl_list_empty(&link_layer->ivilayer->order.link)) {
+            update_prop(link_layer->ivilayer, ivisurf);
+        }
+    }
+    ivisurf->event_mask = event_mask;
+}
+
+static void
+transition_set_layer(struct ivi_layout_layer *ivilayer, uint32_t mask,
+                     const float *values)
+{
+    struct ivi_layout_LayerProperties *props[2] = {
+        &ivilayer->prop, &ivilayer->pending.prop
+    };
+    struct ivi_layout_surface *ivisurf = NULL;
+    uint32_t event_mask = ivilayer->event_mask;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (mask == IVI_NOTIFICATION_OPACITY) {
+            props[i]->opacity = values[0];
+        } else {
+            props[i]->destX = (int32_t)values[0];
+            props[i]->destY = (int32_t)values[1];
+            props[i]->destWidth = (int32_t)values[2];
+            props[i]->destHeight = (int32_t)values[3];
+        }
+    }
+
+    if (wl_list_empty(&ivilayer->order.link)) {
+        return;
+    }
+
+    ivilayer->event_mask |= mask;
+    wl_list_for_each(ivisurf, &ivilayer->order.list_surface, order.link) {
+        update_prop(ivilayer, ivisurf);
+    }
+    ivilayer->event_mask = event_mask;
+}
+
+static void
+transition_frame(struct weston_animation *base,
+                 struct weston_output *output, uint32_t msecs)
+{
+    struct ivi_layout_transition *transition =
+        container_of(base, struct ivi_layout_transition, animation);
+    struct ivi_layout *layout = transition->layout;
+    struct ivi_layout_surface *ivisurf = NULL;
+    struct ivi_layout_layer *ivilayer = NULL;
+    transitionDoneFunc done = NULL;
+    void *userdata = NULL;
+    float values[TRANSITION_VALUES_MAX];
+    float t = 1.0f;
+    uint32_t mask;
+    int32_t i;
+
+    if (base->frame_counter <= 1) {
+        transition->time_start = msecs;
+    }
+
+    if (msecs - transition->time_start < transition->duration) {
+        t = (float)(msecs - transition->time_start) / transition->duration;
+    }
+    t = transition_ease(transition->easing, t);
+
+    for (i = 0; i < transition->count; i++) {
+        values[i] = transition->start[i] +
+                    (transition->end[i] - transition->start[i]) * t;
+    }
+
+    if (transition->ivisurf != NULL) {
+        transition_set_surface(transition->ivisurf, transition->mask, values);
+    } else {
+        transition_set_layer(transition->ivilayer, transition->mask, values);
+    }
+
+    weston_compositor_schedule_repaint(layout->compositor);
+
+    if (msecs - transition->time_start < transition->duration) {
+        return;
+    }
+
+    /* The callbacks may start or cancel transitions, so this one is
+     * gone before they run. */
+    ivisurf = transition->ivisurf;
+    ivilayer = transition->ivilayer;
+    mask = transition->mask;
+    done = transition->done;
+    userdata = transition->userdata;
+    transition_destroy(transition);
+
+    if (ivisurf != NULL) {
+        notify_surface_prop(ivisurf, mask);
+    } else {
+        notify_layer_prop(ivilayer, mask);
+    }
+
+    if (done != NULL) {
+        done(userdata);
+    }
+}
+
+/* Drops the transitions of a surface or a layer; with mask 0, all of
+ * them. Their done callbacks are not called. */
+static void
+transition_cancel(struct ivi_layout *layout,
+                  struct ivi_layout_surface *ivisurf,
+                  struct ivi_layout_layer *ivilayer, uint32_t mask)
+{
+    struct ivi_layout_transition *transition = NULL;
+    struct ivi_layout_transition *next = NULL;
+
+    wl_list_for_each_safe(transition, next, &layout->list_transition, link) {
+        if (transition->ivisurf != ivisurf ||
+            transition->ivilayer != ivilayer) {
+            continue;
+        }
+        if (mask != 0 && transition->mask != mask) {
+            continue;
+        }
+        transition_destroy(transition);
+    }
+}
+
+static struct weston_output *
+transition_output(struct ivi_layout *layout,
+                  struct ivi_layout_surface *ivisurf,
+                  struct ivi_layout_layer *ivilayer)
+{
+    struct ivi_layout_screen *iviscrn = NULL;
+    struct link_screen *link_scrn = NULL;
+
+    if (ivisurf != NULL && ivisurf->surface != NULL &&
+        ivisurf->surface->output != NULL) {
+        return ivisurf->surface->output;
+    }
+
+    if (ivilayer != NULL && !wl_list_empty(&ivilayer->list_screen)) {
+        link_scrn = container_of(ivilayer->list_screen.next,
+                                 struct link_screen, link);
+        return link_scrn->iviscrn->output;
+    }
+
+    wl_list_for_each(iviscrn, &layout->list_screen, link) {
+        return iviscrn->output;
+    }
+
+    return NULL;
+}
+
+static int32_t
+transition_start(struct ivi_layout_surface *ivisurf,
+                 struct ivi_layout_layer *ivilayer,
+                 uint32_t mask, const float *end,
+                 uint32_t duration,
+                 enum ivi_layout_transition_easing easing,
+                 transitionDoneFunc done, void *userdata)
+{
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_transition *transition = NULL;
+    struct weston_output *output = NULL;
+    int32_t i;
+
+    output = transition_output(layout, ivisurf, ivilayer);
+    if (output == NULL) {
+        weston_log("ivi-layout: no output to run a transition on\n");
+        return -1;
+    }
+
+    transition = calloc(1, sizeof *transition);
+    if (transition == NULL) {
+        weston_log("fails to allocate memory\n");
+        return -1;
+    }
+
+    /* A new transition of a property replaces the running one,
+     * starting from wherever that got to. */
+    transition_cancel(layout, ivisurf, ivilayer, mask);
+
+    transition->layout = layout;
+    transition->ivisurf = ivisurf;
+    transition->ivilayer = ivilayer;
+    transition->mask = mask;
+    transition->easing = easing;
+    transition->duration = duration;
+    transition->done = done;
+    transition->userdata = userdata;
+
+    transition->count = transition_get(transition, transition->start);
+    for (i = 0; i < transition->count; i++) {
+        transition->end[i] = end[i];
+    }
+
+    transition->animation.frame = transition_frame;
+    transition->animation.frame_counter = 0;
+    wl_list_insert(&output->animation_list, &transition->animation.link);
+    wl_list_insert(&layout->list_transition, &transition->link);
+
+    weston_output_schedule_repaint(output);
+
+    return 0;
+}
+
+static void
+clear_surface_pending_list(struct ivi_layout_layer *ivilayer)
+{
+    struct ivi_layout_surface *surface_link = NULL;
+    struct ivi_layout_surface *surface_next = NULL;
+
+    wl_list_for_each_safe(surface_link, surface_next,
                           &ivilayer->pending.list_surface, pending.link) {
         if (!wl_list_empty(&surface_link->pending.link)) {
             wl_list_remove(&surface_link->pending.link);
@@ -1068,7 +1967,7 @@ clear_surface_pending_list(struct ivi_layout_layer *ivilayer)
         wl_list_init(&surface_link->pending.link);
     }
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_REMOVE;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_REMOVE);
 }
 
 static void
@@ -1086,7 +1985,7 @@ clear_surface_order_list(struct ivi_layout_layer *ivilayer)
         wl_list_init(&surface_link->order.link);
     }
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_REMOVE;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_REMOVE);
 }
 
 /**
@@ -1139,6 +2038,53 @@ ivi_layout_removeNotificationCreateLayer(layerCreateNotificationFunc callback,
     }
 }
 
+WL_EXPORT int32_t
+ivi_layout_addNotificationChangeSet(changeSetNotificationFunc callback,
+                                    void *userdata)
+{
+    struct ivi_layout *layout = get_instance();
+    struct link_changeSetNotification *notification = NULL;
+
+    if (callback == NULL) {
+        weston_log("ivi_layout_addNotificationChangeSet: invalid argument\n");
+        return -1;
+    }
+
+    notification = malloc(sizeof *notification);
+    if (notification == NULL) {
+        weston_log("fails to allocate memory\n");
+        return -1;
+    }
+
+    notification->callback = callback;
+    notification->userdata = userdata;
+    wl_list_init(&notification->link);
+    wl_list_insert(&layout->change_set.list_notification, &notification->link);
+
+    return 0;
+}
+
+WL_EXPORT void
+ivi_layout_removeNotificationChangeSet(changeSetNotificationFunc callback,
+                                       void *userdata)
+{
+    struct ivi_layout *layout = get_instance();
+    struct link_changeSetNotification *link = NULL;
+    struct link_changeSetNotification *next = NULL;
+
+    wl_list_for_each_safe(link, next,
+            &layout->change_set.list_notification, link) {
+        if ((link->callback == callback) &&
+            (link->userdata == userdata)) {
+            if (!wl_list_empty(&link->link)) {
+                wl_list_remove(&link->link);
+            }
+
+            free(link);
+        }
+    }
+}
+
 WL_EXPORT int32_t
 ivi_layout_addNotificationRemoveLayer(layerRemoveNotificationFunc callback,
                                       void *userdata)
@@ -1339,30 +2285,16 @@ WL_EXPORT struct ivi_layout_layer *
 ivi_layout_getLayerFromId(uint32_t id_layer)
 {
     struct ivi_layout *layout = get_instance();
-    struct ivi_layout_layer *ivilayer = NULL;
-
-    wl_list_for_each(ivilayer, &layout->list_layer, link) {
-        if (ivilayer->id_layer == id_layer) {
-            return ivilayer;
-        }
-    }
 
-    return NULL;
+    return get_layer(layout, id_layer);
 }
 
 WL_EXPORT struct ivi_layout_surface *
 ivi_layout_getSurfaceFromId(uint32_t id_surface)
 {
     struct ivi_layout *layout = get_instance();
-    struct ivi_layout_surface *ivisurf = NULL;
-
-    wl_list_for_each(ivisurf, &layout->list_surface, link) {
-        if (ivisurf->id_surface == id_surface) {
-            return ivisurf;
-        }
-    }
 
-    return NULL;
+    return get_surface(layout, id_surface);
 }
 
 WL_EXPORT struct ivi_layout_screen *
@@ -1370,12 +2302,11 @@ ivi_layout_getScreenFromId(uint32_t id_screen)
 {
     struct ivi_layout *layout = get_instance();
     struct ivi_layout_screen *iviscrn = NULL;
-    (void)id_screen;
 
     wl_list_for_each(iviscrn, &layout->list_screen, link) {
-//FIXME : select iviscrn from list_screen by id_screen
-        return iviscrn;
-        break;
+        if (iviscrn->id_screen == id_screen) {
+            return iviscrn;
+        }
     }
 
     return NULL;
@@ -1468,6 +2399,14 @@ ivi_layout_surfaceRemove(struct ivi_layout_surface *ivisurf)
     if (!wl_list_empty(&ivisurf->link)) {
         wl_list_remove(&ivisurf->link);
     }
+    if (!wl_list_empty(&ivisurf->hash_link)) {
+        wl_list_remove(&ivisurf->hash_link);
+    }
+    if (!wl_list_empty(&ivisurf->dirty_link)) {
+        wl_list_remove(&ivisurf->dirty_link);
+    }
+    transition_cancel(layout, ivisurf, NULL, 0);
+    mark_surface_screens(ivisurf);
     remove_ordersurface_from_layer(ivisurf);
 
     wl_list_for_each(notification,
@@ -1476,8 +2415,20 @@ ivi_layout_surfaceRemove(struct ivi_layout_surface *ivisurf)
             notification->callback(ivisurf, notification->userdata);
         }
     }
+    queue_surface_change(ivisurf, IVI_LAYOUT_CHANGE_EVENT_REMOVE, 0);
     ivi_layout_surfaceRemoveNotification(ivisurf);
 
+    if (ivisurf->placeholder != NULL) {
+        if (ivisurf->native != NULL) {
+            wl_list_remove(&ivisurf->native_destroy_listener.link);
+        }
+        weston_surface_destroy(ivisurf->placeholder);
+    }
+
+    if (ivisurf->solid != NULL) {
+        weston_surface_destroy(ivisurf->solid);
+    }
+
     free(ivisurf);
 
     return 0;
@@ -1521,11 +2472,23 @@ WL_EXPORT int32_t
 ivi_layout_getNumberOfHardwareLayers(uint32_t id_screen,
                               int32_t *pNumberOfHardwareLayers)
 {
-    /* TODO */
-    (void)id_screen;
-    (void)pNumberOfHardwareLayers;
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_screen *iviscrn = NULL;
 
-    return 0;
+    if (pNumberOfHardwareLayers == NULL) {
+        weston_log("ivi_layout_getNumberOfHardwareLayers: invalid argument\n");
+        return -1;
+    }
+
+    wl_list_for_each(iviscrn, &layout->list_screen, link) {
+        if (iviscrn->id_screen == id_screen) {
+            *pNumberOfHardwareLayers = iviscrn->output->hardware_planes;
+            return 0;
+        }
+    }
+
+    weston_log("ivi_layout_getNumberOfHardwareLayers: screen is not found\n");
+    return -1;
 }
 
 WL_EXPORT int32_t
@@ -1652,7 +2615,7 @@ ivi_layout_getLayersOnScreen(struct ivi_layout_screen *iviscrn,
             return -1;
         }
 
-        wl_list_for_each(ivilayer, &iviscrn->order.list_layer, link) {
+        wl_list_for_each(ivilayer, &iviscrn->order.list_layer, order.link) {
             (*ppArray)[n++] = ivilayer;
         }
     }
@@ -1763,73 +2726,238 @@ ivi_layout_getSurfacesOnLayer(struct ivi_layout_layer *ivilayer,
     return 0;
 }
 
-WL_EXPORT struct ivi_layout_layer *
-ivi_layout_layerCreateWithDimension(uint32_t id_layer,
-                                       int32_t width, int32_t height)
+WL_EXPORT int32_t
+ivi_layout_forEachSurface(surfaceVisitorFunc visitor, void *userdata)
 {
     struct ivi_layout *layout = get_instance();
-    struct ivi_layout_layer *ivilayer = NULL;
-    struct link_layerCreateNotification *notification = NULL;
-
-    ivilayer = get_layer(&layout->list_layer, id_layer);
-    if (ivilayer != NULL) {
-        weston_log("id_layer is already created\n");
-        return ivilayer;
-    }
+    struct ivi_layout_surface *ivisurf = NULL;
+    int32_t ret = 0;
 
-    ivilayer = calloc(1, sizeof *ivilayer);
-    if (ivilayer == NULL) {
-        weston_log("fails to allocate memory\n");
-        return NULL;
+    if (visitor == NULL) {
+        weston_log("ivi_layout_forEachSurface: invalid argument\n");
+        return -1;
     }
 
-    wl_list_init(&ivilayer->link);
-    wl_list_init(&ivilayer->list_notification);
-    wl_list_init(&ivilayer->list_screen);
-    wl_list_init(&ivilayer->link_to_surface);
-    ivilayer->layout = layout;
-    ivilayer->id_layer = id_layer;
-
-    init_layerProperties(&ivilayer->prop, width, height);
-    ivilayer->event_mask = 0;
-
-    wl_list_init(&ivilayer->pending.list_surface);
-    wl_list_init(&ivilayer->pending.link);
-    ivilayer->pending.prop = ivilayer->prop;
-
-    wl_list_init(&ivilayer->order.list_surface);
-    wl_list_init(&ivilayer->order.link);
-
-    wl_list_insert(&layout->list_layer, &ivilayer->link);
-
-    wl_list_for_each(notification,
-            &layout->layer_notification.list_create, link) {
-        if (notification->callback != NULL) {
-            notification->callback(ivilayer, notification->userdata);
+    wl_list_for_each(ivisurf, &layout->list_surface, link) {
+        ret = visitor(ivisurf, userdata);
+        if (ret != 0) {
+            break;
         }
     }
 
-    return ivilayer;
+    return ret;
 }
 
 WL_EXPORT int32_t
-ivi_layout_layerRemove(struct ivi_layout_layer *ivilayer)
+ivi_layout_forEachLayer(layerVisitorFunc visitor, void *userdata)
 {
     struct ivi_layout *layout = get_instance();
-    struct link_layerRemoveNotification *notification = NULL;
+    struct ivi_layout_layer *ivilayer = NULL;
+    int32_t ret = 0;
 
-    if (ivilayer == NULL) {
-        weston_log("ivi_layout_layerRemove: invalid argument\n");
+    if (visitor == NULL) {
+        weston_log("ivi_layout_forEachLayer: invalid argument\n");
         return -1;
     }
 
-    wl_list_for_each(notification,
-            &layout->layer_notification.list_remove, link) {
-        if (notification->callback != NULL) {
-            notification->callback(ivilayer, notification->userdata);
+    wl_list_for_each(ivilayer, &layout->list_layer, link) {
+        ret = visitor(ivilayer, userdata);
+        if (ret != 0) {
+            break;
         }
     }
 
+    return ret;
+}
+
+WL_EXPORT int32_t
+ivi_layout_forEachSurfaceOnLayer(struct ivi_layout_layer *ivilayer,
+                                 surfaceVisitorFunc visitor,
+                                 void *userdata)
+{
+    struct ivi_layout_surface *ivisurf = NULL;
+    int32_t ret = 0;
+
+    if (ivilayer == NULL || visitor == NULL) {
+        weston_log("ivi_layout_forEachSurfaceOnLayer: invalid argument\n");
+        return -1;
+    }
+
+    wl_list_for_each(ivisurf, &ivilayer->order.list_surface, order.link) {
+        ret = visitor(ivisurf, userdata);
+        if (ret != 0) {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+WL_EXPORT int32_t
+ivi_layout_forEachLayerOnScreen(struct ivi_layout_screen *iviscrn,
+                                layerVisitorFunc visitor,
+                                void *userdata)
+{
+    struct ivi_layout_layer *ivilayer = NULL;
+    int32_t ret = 0;
+
+    if (iviscrn == NULL || visitor == NULL) {
+        weston_log("ivi_layout_forEachLayerOnScreen: invalid argument\n");
+        return -1;
+    }
+
+    wl_list_for_each(ivilayer, &iviscrn->order.list_layer, order.link) {
+        ret = visitor(ivilayer, userdata);
+        if (ret != 0) {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+WL_EXPORT int32_t
+ivi_layout_getNumberOfSurfaces(int32_t *pLength)
+{
+    struct ivi_layout *layout = get_instance();
+
+    if (pLength == NULL) {
+        weston_log("ivi_layout_getNumberOfSurfaces: invalid argument\n");
+        return -1;
+    }
+
+    *pLength = wl_list_length(&layout->list_surface);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_getNumberOfLayers(int32_t *pLength)
+{
+    struct ivi_layout *layout = get_instance();
+
+    if (pLength == NULL) {
+        weston_log("ivi_layout_getNumberOfLayers: invalid argument\n");
+        return -1;
+    }
+
+    *pLength = wl_list_length(&layout->list_layer);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_getNumberOfSurfacesOnLayer(struct ivi_layout_layer *ivilayer,
+                                      int32_t *pLength)
+{
+    if (ivilayer == NULL || pLength == NULL) {
+        weston_log("ivi_layout_getNumberOfSurfacesOnLayer: invalid argument\n");
+        return -1;
+    }
+
+    *pLength = wl_list_length(&ivilayer->order.list_surface);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_getNumberOfLayersOnScreen(struct ivi_layout_screen *iviscrn,
+                                     int32_t *pLength)
+{
+    if (iviscrn == NULL || pLength == NULL) {
+        weston_log("ivi_layout_getNumberOfLayersOnScreen: invalid argument\n");
+        return -1;
+    }
+
+    *pLength = wl_list_length(&iviscrn->order.list_layer);
+
+    return 0;
+}
+
+WL_EXPORT struct ivi_layout_layer *
+ivi_layout_layerCreateWithDimension(uint32_t id_layer,
+                                       int32_t width, int32_t height)
+{
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_layer *ivilayer = NULL;
+    struct link_layerCreateNotification *notification = NULL;
+
+    ivilayer = get_layer(layout, id_layer);
+    if (ivilayer != NULL) {
+        weston_log("id_layer is already created\n");
+        return ivilayer;
+    }
+
+    ivilayer = calloc(1, sizeof *ivilayer);
+    if (ivilayer == NULL) {
+        weston_log("fails to allocate memory\n");
+        return NULL;
+    }
+
+    wl_list_init(&ivilayer->link);
+    wl_list_init(&ivilayer->hash_link);
+    wl_list_init(&ivilayer->list_notification);
+    wl_list_init(&ivilayer->list_screen);
+    wl_list_init(&ivilayer->link_to_surface);
+    ivilayer->layout = layout;
+    ivilayer->id_layer = id_layer;
+
+    init_layerProperties(&ivilayer->prop, width, height);
+    ivilayer->optimization = 0;
+    ivilayer->pending.optimization = 0;
+    ivilayer->cacheable = 0;
+    ivilayer->pending.cacheable = 0;
+    ivilayer->repaint_policy = IVI_LAYOUT_REPAINT_POLICY_FULL_RATE;
+    ivilayer->pending.repaint_policy = IVI_LAYOUT_REPAINT_POLICY_FULL_RATE;
+    ivilayer->repaint_max_hz = 0;
+    ivilayer->pending.repaint_max_hz = 0;
+    ivilayer->cache_group = ++layout->cache_group_serial;
+    ivilayer->event_mask = 0;
+    wl_list_init(&ivilayer->dirty_link);
+
+    wl_list_init(&ivilayer->pending.list_surface);
+    wl_list_init(&ivilayer->pending.link);
+    ivilayer->pending.prop = ivilayer->prop;
+
+    wl_list_init(&ivilayer->order.list_surface);
+    wl_list_init(&ivilayer->order.link);
+
+    wl_list_insert(&layout->list_layer, &ivilayer->link);
+    wl_list_insert(&layout->hash_layer[hash_id(id_layer)],
+                   &ivilayer->hash_link);
+
+    state_restore_layer(layout, ivilayer);
+
+    wl_list_for_each(notification,
+            &layout->layer_notification.list_create, link) {
+        if (notification->callback != NULL) {
+            notification->callback(ivilayer, notification->userdata);
+        }
+    }
+    queue_layer_change(ivilayer, IVI_LAYOUT_CHANGE_EVENT_CREATE, 0);
+
+    return ivilayer;
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerRemove(struct ivi_layout_layer *ivilayer)
+{
+    struct ivi_layout *layout = get_instance();
+    struct link_layerRemoveNotification *notification = NULL;
+
+    if (ivilayer == NULL) {
+        weston_log("ivi_layout_layerRemove: invalid argument\n");
+        return -1;
+    }
+
+    wl_list_for_each(notification,
+            &layout->layer_notification.list_remove, link) {
+        if (notification->callback != NULL) {
+            notification->callback(ivilayer, notification->userdata);
+        }
+    }
+    queue_layer_change(ivilayer, IVI_LAYOUT_CHANGE_EVENT_REMOVE, 0);
+
     clear_surface_pending_list(ivilayer);
     clear_surface_order_list(ivilayer);
 
@@ -1842,6 +2970,14 @@ ivi_layout_layerRemove(struct ivi_layout_layer *ivilayer)
     if (!wl_list_empty(&ivilayer->link)) {
         wl_list_remove(&ivilayer->link);
     }
+    if (!wl_list_empty(&ivilayer->hash_link)) {
+        wl_list_remove(&ivilayer->hash_link);
+    }
+    if (!wl_list_empty(&ivilayer->dirty_link)) {
+        wl_list_remove(&ivilayer->dirty_link);
+    }
+    transition_cancel(layout, NULL, ivilayer, 0);
+    mark_layer_screens(ivilayer);
     remove_orderlayer_from_screen(ivilayer);
     remove_link_to_surface(ivilayer);
     ivi_layout_layerRemoveNotification(ivilayer);
@@ -1876,7 +3012,7 @@ ivi_layout_layerSetVisibility(struct ivi_layout_layer *ivilayer,
     prop = &ivilayer->pending.prop;
     prop->visibility = newVisibility;
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_VISIBILITY;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_VISIBILITY);
 
     return 0;
 }
@@ -1908,7 +3044,7 @@ ivi_layout_layerSetOpacity(struct ivi_layout_layer *ivilayer,
     prop = &ivilayer->pending.prop;
     prop->opacity = opacity;
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_OPACITY;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_OPACITY);
 
     return 0;
 }
@@ -1945,7 +3081,7 @@ ivi_layout_layerSetSourceRectangle(struct ivi_layout_layer *ivilayer,
     prop->sourceWidth = width;
     prop->sourceHeight = height;
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_SOURCE_RECT;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_SOURCE_RECT);
 
     return 0;
 }
@@ -1968,7 +3104,7 @@ ivi_layout_layerSetDestinationRectangle(struct ivi_layout_layer *ivilayer,
     prop->destWidth = width;
     prop->destHeight = height;
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_DEST_RECT;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_DEST_RECT);
 
     return 0;
 }
@@ -2004,7 +3140,7 @@ ivi_layout_layerSetDimension(struct ivi_layout_layer *ivilayer,
     prop->destWidth  = pDimension[0];
     prop->destHeight = pDimension[1];
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_DIMENSION;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_DIMENSION);
 
     return 0;
 }
@@ -2037,7 +3173,7 @@ ivi_layout_layerSetPosition(struct ivi_layout_layer *ivilayer, int32_t *pPositio
     prop->destX = pPosition[0];
     prop->destY = pPosition[1];
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_POSITION;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_POSITION);
 
     return 0;
 }
@@ -2056,7 +3192,7 @@ ivi_layout_layerSetOrientation(struct ivi_layout_layer *ivilayer,
     prop = &ivilayer->pending.prop;
     prop->orientation = orientation;
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_ORIENTATION;
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_ORIENTATION);
 
     return 0;
 }
@@ -2078,9 +3214,24 @@ ivi_layout_layerGetOrientation(struct ivi_layout_layer *ivilayer,
 WL_EXPORT int32_t
 ivi_layout_layerSetChromaKey(struct ivi_layout_layer *ivilayer, int32_t* pColor)
 {
-    /* TODO */
-    (void)ivilayer;
-    (void)pColor;
+    struct ivi_layout_LayerProperties *prop = NULL;
+
+    if (ivilayer == NULL) {
+        weston_log("ivi_layout_layerSetChromaKey: invalid argument\n");
+        return -1;
+    }
+
+    prop = &ivilayer->pending.prop;
+    if (pColor != NULL) {
+        prop->chromaKeyEnabled = 1;
+        prop->chromaKeyRed   = pColor[0];
+        prop->chromaKeyGreen = pColor[1];
+        prop->chromaKeyBlue  = pColor[2];
+    } else {
+        prop->chromaKeyEnabled = 0;
+    }
+
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_CHROMAKEY);
 
     return 0;
 }
@@ -2093,7 +3244,8 @@ ivi_layout_layerSetRenderOrder(struct ivi_layout_layer *ivilayer,
     struct ivi_layout *layout = get_instance();
     struct ivi_layout_surface *ivisurf = NULL;
     struct ivi_layout_surface *next = NULL;
-    uint32_t *id_surface = NULL;
+    struct wl_list *pos = NULL;
+    uint32_t generation = 0;
     int32_t i = 0;
 
     if (ivilayer == NULL) {
@@ -2102,36 +3254,56 @@ ivi_layout_layerSetRenderOrder(struct ivi_layout_layer *ivilayer,
     }
 
     if (pSurface == NULL) {
-        wl_list_for_each_safe(ivisurf, next, &ivilayer->pending.list_surface, pending.link) {
-            if (!wl_list_empty(&ivisurf->pending.link)) {
-                wl_list_remove(&ivisurf->pending.link);
-            }
+        number = 0;
+    }
 
-            wl_list_init(&ivisurf->pending.link);
+    /* The pending list is in reverse of the array. An order equal to
+     * it changes nothing and is not flagged. Marking each surface
+     * with the generation of this call lets a repeated one count
+     * once, the first time. */
+    generation = next_order_generation(layout);
+    pos = ivilayer->pending.list_surface.prev;
+    for (i = 0; i < number; i++) {
+        ivisurf = pSurface[i];
+        if (ivisurf == NULL || ivisurf->order_generation == generation) {
+            continue;
+        }
+        ivisurf->order_generation = generation;
+
+        if (pos == &ivilayer->pending.list_surface ||
+            pos != &ivisurf->pending.link) {
+            break;
         }
-        ivilayer->event_mask |= IVI_NOTIFICATION_REMOVE;
+        pos = pos->prev;
+    }
+
+    if (i == number && pos == &ivilayer->pending.list_surface) {
         return 0;
     }
 
-    for (i = 0; i < number; i++) {
-        id_surface = &pSurface[i]->id_surface;
+    wl_list_for_each_safe(ivisurf, next,
+                          &ivilayer->pending.list_surface, pending.link) {
+        wl_list_init(&ivisurf->pending.link);
+    }
+    wl_list_init(&ivilayer->pending.list_surface);
 
-        wl_list_for_each_safe(ivisurf, next, &layout->list_surface, pending.link) {
-            if (*id_surface != ivisurf->id_surface) {
-                continue;
-            }
+    generation = next_order_generation(layout);
+    for (i = 0; i < number; i++) {
+        ivisurf = pSurface[i];
+        if (ivisurf == NULL || ivisurf->order_generation == generation) {
+            continue;
+        }
+        ivisurf->order_generation = generation;
 
-            if (!wl_list_empty(&ivisurf->pending.link)) {
-                wl_list_remove(&ivisurf->pending.link);
-            }
-            wl_list_init(&ivisurf->pending.link);
-            wl_list_insert(&ivilayer->pending.list_surface,
-                           &ivisurf->pending.link);
-            break;
+        if (!wl_list_empty(&ivisurf->pending.link)) {
+            wl_list_remove(&ivisurf->pending.link);
         }
+        wl_list_insert(&ivilayer->pending.list_surface,
+                       &ivisurf->pending.link);
     }
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_ADD;
+    layer_mark_dirty(ivilayer, number > 0 ? IVI_NOTIFICATION_ADD :
+                                            IVI_NOTIFICATION_REMOVE);
 
     return 0;
 }
@@ -2172,7 +3344,7 @@ ivi_layout_surfaceSetVisibility(struct ivi_layout_surface *ivisurf,
     prop = &ivisurf->pending.prop;
     prop->visibility = newVisibility;
 
-    ivisurf->event_mask |= IVI_NOTIFICATION_VISIBILITY;
+    surface_mark_dirty(ivisurf, IVI_NOTIFICATION_VISIBILITY);
 
     return 0;
 }
@@ -2205,7 +3377,7 @@ ivi_layout_surfaceSetOpacity(struct ivi_layout_surface *ivisurf,
     prop = &ivisurf->pending.prop;
     prop->opacity = opacity;
 
-    ivisurf->event_mask |= IVI_NOTIFICATION_OPACITY;
+    surface_mark_dirty(ivisurf, IVI_NOTIFICATION_OPACITY);
 
     return 0;
 }
@@ -2260,7 +3432,7 @@ ivi_layout_surfaceSetDestinationRectangle(struct ivi_layout_surface *ivisurf,
     prop->destWidth = width;
     prop->destHeight = height;
 
-    ivisurf->event_mask |= IVI_NOTIFICATION_DEST_RECT;
+    surface_mark_dirty(ivisurf, IVI_NOTIFICATION_DEST_RECT);
 
     return 0;
 }
@@ -2279,7 +3451,7 @@ ivi_layout_surfaceSetDimension(struct ivi_layout_surface *ivisurf, int32_t *pDim
     prop->destWidth  = pDimension[0];
     prop->destHeight = pDimension[1];
 
-    ivisurf->event_mask |= IVI_NOTIFICATION_DIMENSION;
+    surface_mark_dirty(ivisurf, IVI_NOTIFICATION_DIMENSION);
 
     return 0;
 }
@@ -2314,7 +3486,7 @@ ivi_layout_surfaceSetPosition(struct ivi_layout_surface *ivisurf,
     prop->destX = pPosition[0];
     prop->destY = pPosition[1];
 
-    ivisurf->event_mask |= IVI_NOTIFICATION_POSITION;
+    surface_mark_dirty(ivisurf, IVI_NOTIFICATION_POSITION);
 
     return 0;
 }
@@ -2348,7 +3520,7 @@ ivi_layout_surfaceSetOrientation(struct ivi_layout_surface *ivisurf,
     prop = &ivisurf->pending.prop;
     prop->orientation = orientation;
 
-    ivisurf->event_mask |= IVI_NOTIFICATION_ORIENTATION;
+    surface_mark_dirty(ivisurf, IVI_NOTIFICATION_ORIENTATION);
 
     return 0;
 }
@@ -2380,9 +3552,24 @@ ivi_layout_surfaceGetPixelformat(struct ivi_layout_layer *ivisurf, int32_t *pPix
 WL_EXPORT int32_t
 ivi_layout_surfaceSetChromaKey(struct ivi_layout_surface *ivisurf, int32_t* pColor)
 {
-    /* TODO */
-    (void)ivisurf;
-    (void)pColor;
+    struct ivi_layout_SurfaceProperties *prop = NULL;
+
+    if (ivisurf == NULL) {
+        weston_log("ivi_layout_surfaceSetChromaKey: invalid argument\n");
+        return -1;
+    }
+
+    prop = &ivisurf->pending.prop;
+    if (pColor != NULL) {
+        prop->chromaKeyEnabled = 1;
+        prop->chromaKeyRed   = pColor[0];
+        prop->chromaKeyGreen = pColor[1];
+        prop->chromaKeyBlue  = pColor[2];
+    } else {
+        prop->chromaKeyEnabled = 0;
+    }
+
+    surface_mark_dirty(ivisurf, IVI_NOTIFICATION_CHROMAKEY);
 
     return 0;
 }
@@ -2432,7 +3619,9 @@ ivi_layout_screenSetRenderOrder(struct ivi_layout_screen *iviscrn,
     struct ivi_layout *layout = get_instance();
     struct ivi_layout_layer *ivilayer = NULL;
     struct ivi_layout_layer *next = NULL;
-    uint32_t *id_layer = NULL;
+    struct wl_list *pos = NULL;
+    uint32_t generation = 0;
+    int32_t count = pLayer != NULL ? number : 0;
     int32_t i = 0;
 
     if (iviscrn == NULL) {
@@ -2440,44 +3629,50 @@ ivi_layout_screenSetRenderOrder(struct ivi_layout_screen *iviscrn,
         return -1;
     }
 
+    /* same as ivi_layout_layerSetRenderOrder */
+    generation = next_order_generation(layout);
+    pos = iviscrn->pending.list_layer.prev;
+    for (i = 0; i < count; i++) {
+        ivilayer = pLayer[i];
+        if (ivilayer == NULL || ivilayer->order_generation == generation) {
+            continue;
+        }
+        ivilayer->order_generation = generation;
+
+        if (pos == &iviscrn->pending.list_layer ||
+            pos != &ivilayer->pending.link) {
+            break;
+        }
+        pos = pos->prev;
+    }
+
+    if (i == count && pos == &iviscrn->pending.list_layer) {
+        return 0;
+    }
+
     wl_list_for_each_safe(ivilayer, next,
                           &iviscrn->pending.list_layer, pending.link) {
         wl_list_init(&ivilayer->pending.link);
     }
-
     wl_list_init(&iviscrn->pending.list_layer);
 
-    if (pLayer == NULL) {
-        wl_list_for_each_safe(ivilayer, next, &iviscrn->pending.list_layer, pending.link) {
-            if (!wl_list_empty(&ivilayer->pending.link)) {
-                wl_list_remove(&ivilayer->pending.link);
-            }
-
-            wl_list_init(&ivilayer->pending.link);
+    generation = next_order_generation(layout);
+    for (i = 0; i < count; i++) {
+        ivilayer = pLayer[i];
+        if (ivilayer == NULL || ivilayer->order_generation == generation) {
+            continue;
         }
+        ivilayer->order_generation = generation;
 
-        iviscrn->event_mask |= IVI_NOTIFICATION_REMOVE;
-        return 0;
-    }
-
-    for (i = 0; i < number; i++) {
-        id_layer = &pLayer[i]->id_layer;
-        wl_list_for_each(ivilayer, &layout->list_layer, link) {
-            if (*id_layer != ivilayer->id_layer) {
-                continue;
-            }
-
-            if (!wl_list_empty(&ivilayer->pending.link)) {
-                wl_list_remove(&ivilayer->pending.link);
-            }
-            wl_list_init(&ivilayer->pending.link);
-            wl_list_insert(&iviscrn->pending.list_layer,
-                           &ivilayer->pending.link);
-            break;
+        if (!wl_list_empty(&ivilayer->pending.link)) {
+            wl_list_remove(&ivilayer->pending.link);
         }
+        wl_list_insert(&iviscrn->pending.list_layer,
+                       &ivilayer->pending.link);
     }
 
-    iviscrn->event_mask |= IVI_NOTIFICATION_ADD;
+    iviscrn->event_mask |= count > 0 ? IVI_NOTIFICATION_ADD :
+                                       IVI_NOTIFICATION_REMOVE;
 
     return 0;
 }
@@ -2491,9 +3686,36 @@ ivi_layout_screenGetOutput(struct ivi_layout_screen *iviscrn)
 WL_EXPORT int32_t
 ivi_layout_SetOptimizationMode(uint32_t id, int32_t mode)
 {
-    /* TODO */
-    (void)id;
-    (void)mode;
+    struct ivi_layout *layout = get_instance();
+
+    if (id >= IVI_LAYOUT_OPTIMIZATION_COUNT) {
+        weston_log("ivi_layout_SetOptimizationMode: invalid argument\n");
+        return -1;
+    }
+
+    /* The hints are handed to the views when the view lists are built. */
+    mark_all_screens(layout);
+
+    switch (mode) {
+    case IVI_LAYOUT_OPTIMIZATION_MODE_FORCE_OFF:
+    case IVI_LAYOUT_OPTIMIZATION_MODE_FORCE_ON:
+    case IVI_LAYOUT_OPTIMIZATION_MODE_HEURISTIC:
+        layout->optimization_mode[id] = mode;
+        break;
+    case IVI_LAYOUT_OPTIMIZATION_MODE_TOGGLE:
+        if (layout->optimization_mode[id] ==
+            IVI_LAYOUT_OPTIMIZATION_MODE_FORCE_OFF) {
+            layout->optimization_mode[id] =
+                IVI_LAYOUT_OPTIMIZATION_MODE_FORCE_ON;
+        } else {
+            layout->optimization_mode[id] =
+                IVI_LAYOUT_OPTIMIZATION_MODE_FORCE_OFF;
+        }
+        break;
+    default:
+        weston_log("ivi_layout_SetOptimizationMode: invalid argument\n");
+        return -1;
+    }
 
     return 0;
 }
@@ -2501,29 +3723,308 @@ ivi_layout_SetOptimizationMode(uint32_t id, int32_t mode)
 WL_EXPORT int32_t
 ivi_layout_GetOptimizationMode(uint32_t id, int32_t *pMode)
 {
-    /* TODO */
-    (void)id;
-    (void)pMode;
+    struct ivi_layout *layout = get_instance();
+
+    if (id >= IVI_LAYOUT_OPTIMIZATION_COUNT || pMode == NULL) {
+        weston_log("ivi_layout_GetOptimizationMode: invalid argument\n");
+        return -1;
+    }
+
+    *pMode = layout->optimization_mode[id];
 
     return 0;
 }
 
 WL_EXPORT int32_t
-ivi_layout_layerAddNotification(struct ivi_layout_layer *ivilayer,
-                                layerPropertyNotificationFunc callback,
-                                void *userdata)
+ivi_layout_layerSetOptimizationHint(struct ivi_layout_layer *ivilayer,
+                                    uint32_t id, int32_t enabled)
 {
-    struct link_layerPropertyNotification *notification = NULL;
-
-    if (ivilayer == NULL || callback == NULL) {
-        weston_log("ivi_layout_layerAddNotification: invalid argument\n");
+    if (ivilayer == NULL || id >= IVI_LAYOUT_OPTIMIZATION_COUNT) {
+        weston_log("ivi_layout_layerSetOptimizationHint: invalid argument\n");
         return -1;
     }
 
-    notification = malloc(sizeof *notification);
-    if (notification == NULL) {
-        weston_log("fails to allocate memory\n");
-        return -1;
+    if (enabled) {
+        ivilayer->pending.optimization |= 1u << id;
+    } else {
+        ivilayer->pending.optimization &= ~(1u << id);
+    }
+
+    layer_mark_dirty(ivilayer, 0);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerSetCacheable(struct ivi_layout_layer *ivilayer,
+                             int32_t cacheable)
+{
+    if (ivilayer == NULL) {
+        weston_log("ivi_layout_layerSetCacheable: invalid argument\n");
+        return -1;
+    }
+
+    ivilayer->pending.cacheable = !!cacheable;
+
+    layer_mark_dirty(ivilayer, 0);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerGetCacheable(struct ivi_layout_layer *ivilayer,
+                             int32_t *pCacheable)
+{
+    if (ivilayer == NULL || pCacheable == NULL) {
+        weston_log("ivi_layout_layerGetCacheable: invalid argument\n");
+        return -1;
+    }
+
+    *pCacheable = ivilayer->cacheable;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerSetRepaintPolicy(struct ivi_layout_layer *ivilayer,
+                                 int32_t policy, uint32_t max_hz)
+{
+    if (ivilayer == NULL ||
+        policy < IVI_LAYOUT_REPAINT_POLICY_FULL_RATE ||
+        policy > IVI_LAYOUT_REPAINT_POLICY_BEST_EFFORT ||
+        (policy == IVI_LAYOUT_REPAINT_POLICY_CAPPED && max_hz == 0) ||
+        max_hz > 1000) {
+        weston_log("ivi_layout_layerSetRepaintPolicy: invalid argument\n");
+        return -1;
+    }
+
+    ivilayer->pending.repaint_policy = policy;
+    ivilayer->pending.repaint_max_hz =
+        policy == IVI_LAYOUT_REPAINT_POLICY_FULL_RATE ? 0 : max_hz;
+
+    layer_mark_dirty(ivilayer, 0);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerGetRepaintPolicy(struct ivi_layout_layer *ivilayer,
+                                 int32_t *pPolicy, uint32_t *pMaxHz)
+{
+    if (ivilayer == NULL || pPolicy == NULL || pMaxHz == NULL) {
+        weston_log("ivi_layout_layerGetRepaintPolicy: invalid argument\n");
+        return -1;
+    }
+
+    *pPolicy = ivilayer->repaint_policy;
+    *pMaxHz = ivilayer->repaint_max_hz;
+
+    return 0;
+}
+
+static void
+statistics_add(struct ivi_layout_Statistics *total,
+               struct ivi_layout_surface *ivisurf, uint32_t now)
+{
+    struct weston_surface_stats *stats;
+    uint32_t age;
+
+    if (ivisurf->surface == NULL) {
+        return;
+    }
+
+    stats = &ivisurf->surface->stats;
+
+    /* commit_rate is only rolled over by the next commit; a surface
+     * that went quiet reports its last window, then nothing */
+    age = now - stats->rate_start;
+    if (age < 1000) {
+        total->commitRate += stats->commit_rate;
+    } else if (age < 2000) {
+        total->commitRate += stats->rate_count;
+    }
+
+    total->commits += stats->commits;
+    total->framesPresented += stats->frames_presented;
+    total->framesDropped += stats->frames_dropped;
+    total->framesOnPrimary += stats->frames_on_primary;
+    total->framesOnPlane += stats->frames_on_plane;
+    total->bytesUploaded += stats->bytes_uploaded;
+    total->pixelsComposited += stats->pixels_composited;
+}
+
+WL_EXPORT int32_t
+ivi_layout_surfaceGetStatistics(struct ivi_layout_surface *ivisurf,
+                                struct ivi_layout_Statistics *pStats)
+{
+    if (ivisurf == NULL || pStats == NULL) {
+        weston_log("ivi_layout_surfaceGetStatistics: invalid argument\n");
+        return -1;
+    }
+
+    memset(pStats, 0, sizeof *pStats);
+    statistics_add(pStats, ivisurf, weston_compositor_get_time());
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerGetStatistics(struct ivi_layout_layer *ivilayer,
+                              struct ivi_layout_Statistics *pStats)
+{
+    struct ivi_layout_surface *ivisurf = NULL;
+    uint32_t now = weston_compositor_get_time();
+
+    if (ivilayer == NULL || pStats == NULL) {
+        weston_log("ivi_layout_layerGetStatistics: invalid argument\n");
+        return -1;
+    }
+
+    memset(pStats, 0, sizeof *pStats);
+    wl_list_for_each(ivisurf, &ivilayer->order.list_surface, order.link) {
+        statistics_add(pStats, ivisurf, now);
+    }
+
+    return 0;
+}
+
+static void
+statistics_log(const char *name, uint32_t id,
+               struct ivi_layout_Statistics *stats)
+{
+    weston_log_continue(STAMP_SPACE "%s %u: %u commits (%u/s), "
+                        "%u presented, %u dropped, %u gpu, %u plane, "
+                        "%llu bytes uploaded, %llu pixels\n",
+                        name, id, stats->commits, stats->commitRate,
+                        stats->framesPresented, stats->framesDropped,
+                        stats->framesOnPrimary, stats->framesOnPlane,
+                        (unsigned long long) stats->bytesUploaded,
+                        (unsigned long long) stats->pixelsComposited);
+}
+
+static void
+statistics_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+                   void *data)
+{
+    struct ivi_layout *layout = data;
+    struct ivi_layout_layer *ivilayer = NULL;
+    struct ivi_layout_surface *ivisurf = NULL;
+    struct ivi_layout_Statistics stats;
+
+    weston_log("ivi-layout rendering statistics:\n");
+    wl_list_for_each(ivilayer, &layout->list_layer, link) {
+        ivi_layout_layerGetStatistics(ivilayer, &stats);
+        statistics_log("layer", ivilayer->id_layer, &stats);
+
+        wl_list_for_each(ivisurf, &ivilayer->order.list_surface,
+                         order.link) {
+            ivi_layout_surfaceGetStatistics(ivisurf, &stats);
+            statistics_log("  surface", ivisurf->id_surface, &stats);
+        }
+    }
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerGetOptimizationHint(struct ivi_layout_layer *ivilayer,
+                                    uint32_t id, int32_t *pEnabled)
+{
+    if (ivilayer == NULL || id >= IVI_LAYOUT_OPTIMIZATION_COUNT ||
+        pEnabled == NULL) {
+        weston_log("ivi_layout_layerGetOptimizationHint: invalid argument\n");
+        return -1;
+    }
+
+    *pEnabled = !!(ivilayer->optimization & (1u << id));
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_surfaceTransitionOpacity(struct ivi_layout_surface *ivisurf,
+                                    float opacity, uint32_t duration,
+                                    enum ivi_layout_transition_easing easing,
+                                    transitionDoneFunc done, void *userdata)
+{
+    if (ivisurf == NULL) {
+        weston_log("ivi_layout_surfaceTransitionOpacity: invalid argument\n");
+        return -1;
+    }
+
+    return transition_start(ivisurf, NULL, IVI_NOTIFICATION_OPACITY,
+                            &opacity, duration, easing, done, userdata);
+}
+
+WL_EXPORT int32_t
+ivi_layout_surfaceTransitionDestinationRectangle(
+                                    struct ivi_layout_surface *ivisurf,
+                                    int32_t x, int32_t y,
+                                    int32_t width, int32_t height,
+                                    uint32_t duration,
+                                    enum ivi_layout_transition_easing easing,
+                                    transitionDoneFunc done, void *userdata)
+{
+    float rect[4] = { x, y, width, height };
+
+    if (ivisurf == NULL) {
+        weston_log("ivi_layout_surfaceTransitionDestinationRectangle: invalid argument\n");
+        return -1;
+    }
+
+    return transition_start(ivisurf, NULL, IVI_NOTIFICATION_DEST_RECT,
+                            rect, duration, easing, done, userdata);
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerTransitionOpacity(struct ivi_layout_layer *ivilayer,
+                                  float opacity, uint32_t duration,
+                                  enum ivi_layout_transition_easing easing,
+                                  transitionDoneFunc done, void *userdata)
+{
+    if (ivilayer == NULL) {
+        weston_log("ivi_layout_layerTransitionOpacity: invalid argument\n");
+        return -1;
+    }
+
+    return transition_start(NULL, ivilayer, IVI_NOTIFICATION_OPACITY,
+                            &opacity, duration, easing, done, userdata);
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerTransitionDestinationRectangle(
+                                  struct ivi_layout_layer *ivilayer,
+                                  int32_t x, int32_t y,
+                                  int32_t width, int32_t height,
+                                  uint32_t duration,
+                                  enum ivi_layout_transition_easing easing,
+                                  transitionDoneFunc done, void *userdata)
+{
+    float rect[4] = { x, y, width, height };
+
+    if (ivilayer == NULL) {
+        weston_log("ivi_layout_layerTransitionDestinationRectangle: invalid argument\n");
+        return -1;
+    }
+
+    return transition_start(NULL, ivilayer, IVI_NOTIFICATION_DEST_RECT,
+                            rect, duration, easing, done, userdata);
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerAddNotification(struct ivi_layout_layer *ivilayer,
+                                layerPropertyNotificationFunc callback,
+                                void *userdata)
+{
+    struct link_layerPropertyNotification *notification = NULL;
+
+    if (ivilayer == NULL || callback == NULL) {
+        weston_log("ivi_layout_layerAddNotification: invalid argument\n");
+        return -1;
+    }
+
+    notification = malloc(sizeof *notification);
+    if (notification == NULL) {
+        weston_log("fails to allocate memory\n");
+        return -1;
     }
 
     notification->callback = callback;
@@ -2552,127 +4053,1476 @@ ivi_layout_layerRemoveNotification(struct ivi_layout_layer *ivilayer)
         }
         free(notification);
     }
-    wl_list_init(&ivilayer->list_notification);
+    wl_list_init(&ivilayer->list_notification);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_getPropertiesOfSurface(struct ivi_layout_surface *ivisurf,
+                    struct ivi_layout_SurfaceProperties *pSurfaceProperties)
+{
+    if (ivisurf == NULL || pSurfaceProperties == NULL) {
+        weston_log("ivi_layout_getPropertiesOfSurface: invalid argument\n");
+        return -1;
+    }
+
+    *pSurfaceProperties = ivisurf->prop;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerAddSurface(struct ivi_layout_layer *ivilayer,
+                           struct ivi_layout_surface *addsurf)
+{
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_surface *ivisurf = NULL;
+    struct ivi_layout_surface *next = NULL;
+    int is_surf_in_layer = 0;
+
+    if (ivilayer == NULL || addsurf == NULL) {
+        weston_log("ivi_layout_layerAddSurface: invalid argument\n");
+        return -1;
+    }
+
+    is_surf_in_layer = is_surface_in_layer(addsurf, ivilayer);
+    if (is_surf_in_layer == 1) {
+        weston_log("ivi_layout_layerAddSurface: addsurf is already available\n");
+        return 0;
+    }
+
+    wl_list_for_each_safe(ivisurf, next, &layout->list_surface, link) {
+        if (ivisurf->id_surface == addsurf->id_surface) {
+            if (!wl_list_empty(&ivisurf->pending.link)) {
+                wl_list_remove(&ivisurf->pending.link);
+            }
+            wl_list_init(&ivisurf->pending.link);
+            wl_list_insert(&ivilayer->pending.list_surface,
+                           &ivisurf->pending.link);
+            break;
+        }
+    }
+
+    layer_mark_dirty(ivilayer, IVI_NOTIFICATION_ADD);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_layerRemoveSurface(struct ivi_layout_layer *ivilayer,
+                              struct ivi_layout_surface *remsurf)
+{
+    struct ivi_layout_surface *ivisurf = NULL;
+    struct ivi_layout_surface *next = NULL;
+
+    if (ivilayer == NULL || remsurf == NULL) {
+        weston_log("ivi_layout_layerRemoveSurface: invalid argument\n");
+        return -1;
+    }
+
+    wl_list_for_each_safe(ivisurf, next,
+                          &ivilayer->pending.list_surface, pending.link) {
+        if (ivisurf->id_surface == remsurf->id_surface) {
+            if (!wl_list_empty(&ivisurf->pending.link)) {
+                wl_list_remove(&ivisurf->pending.link);
+            }
+            wl_list_init(&ivisurf->pending.link);
+            break;
+        }
+    }
+
+    surface_mark_dirty(remsurf, IVI_NOTIFICATION_REMOVE);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_surfaceSetSourceRectangle(struct ivi_layout_surface *ivisurf,
+                                     int32_t x, int32_t y,
+                                     int32_t width, int32_t height)
+{
+    struct ivi_layout_SurfaceProperties *prop = NULL;
+
+    if (ivisurf == NULL) {
+        weston_log("ivi_layout_surfaceSetSourceRectangle: invalid argument\n");
+        return -1;
+    }
+
+    prop = &ivisurf->pending.prop;
+    prop->sourceX = x;
+    prop->sourceY = y;
+    prop->sourceWidth = width;
+    prop->sourceHeight = height;
+
+    surface_mark_dirty(ivisurf, IVI_NOTIFICATION_SOURCE_RECT);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_commitChanges(void)
+{
+    struct ivi_layout *layout = get_instance();
+
+    commit_list_surface(layout);
+    commit_list_layer(layout);
+    commit_list_screen(layout);
+
+    commit_changes(layout);
+    send_prop(layout);
+    flush_changes(layout);
+    weston_compositor_schedule_repaint(layout->compositor);
+    state_schedule_save(layout);
+
+    return 0;
+}
+
+/**
+ * Transactions: properties staged away from the pending state, checked
+ * as a whole and applied in one commit.  Nothing reaches the pending
+ * state of the objects before ivi_layout_transactionCommit, so another
+ * commit in between can not show half of it.
+ */
+static void
+transaction_init(struct ivi_layout_transaction *transaction)
+{
+    wl_list_init(&transaction->list_entry);
+}
+
+static void
+transaction_clear(struct ivi_layout_transaction *transaction)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+    struct ivi_layout_transaction_entry *next  = NULL;
+
+    wl_list_for_each_safe(entry, next, &transaction->list_entry, link) {
+        wl_list_remove(&entry->link);
+        wl_array_release(&entry->order);
+        free(entry);
+    }
+}
+
+/* One entry per object and type, staging twice merges into it. */
+static struct ivi_layout_transaction_entry *
+transaction_get_entry(struct ivi_layout_transaction *transaction,
+                      enum transaction_entry_type type, uint32_t id)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+
+    wl_list_for_each(entry, &transaction->list_entry, link) {
+        if (entry->type == type && entry->id == id) {
+            return entry;
+        }
+    }
+
+    entry = calloc(1, sizeof *entry);
+    if (entry == NULL) {
+        weston_log("fails to allocate memory\n");
+        return NULL;
+    }
+
+    entry->type = type;
+    entry->id = id;
+    wl_array_init(&entry->order);
+    wl_list_insert(transaction->list_entry.prev, &entry->link);
+
+    return entry;
+}
+
+static struct ivi_layout_transaction_entry *
+transaction_surface_entry(struct ivi_layout_transaction *transaction,
+                          struct ivi_layout_surface *ivisurf, uint32_t mask)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+
+    if (transaction == NULL || ivisurf == NULL) {
+        return NULL;
+    }
+
+    entry = transaction_get_entry(transaction, TRANSACTION_SURFACE,
+                                  ivisurf->id_surface);
+    if (entry != NULL) {
+        entry->mask |= mask;
+    }
+
+    return entry;
+}
+
+static struct ivi_layout_transaction_entry *
+transaction_layer_entry(struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer, uint32_t mask)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+
+    if (transaction == NULL || ivilayer == NULL) {
+        return NULL;
+    }
+
+    entry = transaction_get_entry(transaction, TRANSACTION_LAYER,
+                                  ivilayer->id_layer);
+    if (entry != NULL) {
+        entry->mask |= mask;
+    }
+
+    return entry;
+}
+
+static int32_t
+transaction_set_order(struct ivi_layout_transaction_entry *entry,
+                      const uint32_t *ids, int32_t number)
+{
+    uint32_t *order = NULL;
+
+    entry->order.size = 0;
+    if (number <= 0) {
+        return 0;
+    }
+
+    order = wl_array_add(&entry->order, number * sizeof *order);
+    if (order == NULL) {
+        weston_log("fails to allocate memory\n");
+        return -1;
+    }
+    memcpy(order, ids, number * sizeof *order);
+
+    return 0;
+}
+
+static int32_t
+transaction_check_rect(const int32_t *rect)
+{
+    return rect[2] >= 0 && rect[3] >= 0;
+}
+
+static void *
+transaction_entry_object(struct ivi_layout *layout,
+                         struct ivi_layout_transaction_entry *entry)
+{
+    switch (entry->type) {
+    case TRANSACTION_SURFACE:
+        return get_surface(layout, entry->id);
+    case TRANSACTION_LAYER:
+    case TRANSACTION_LAYER_ORDER:
+        return get_layer(layout, entry->id);
+    case TRANSACTION_SCREEN_ORDER:
+        return ivi_layout_getScreenFromId(entry->id);
+    }
+
+    return NULL;
+}
+
+/* Looks every id up.  With skip_missing, objects that went away since
+ * the transaction was built are left out when it is applied; otherwise
+ * they fail it. */
+static int32_t
+transaction_validate(struct ivi_layout *layout,
+                     struct ivi_layout_transaction *transaction,
+                     int32_t skip_missing)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+    uint32_t *ids = NULL;
+    size_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+    int32_t found = 0;
+
+    wl_list_for_each(entry, &transaction->list_entry, link) {
+        if (transaction_entry_object(layout, entry) == NULL) {
+            if (skip_missing) {
+                continue;
+            }
+            weston_log("ivi_layout_transactionCommit: object %u is gone\n",
+                       entry->id);
+            return -1;
+        }
+
+        if ((entry->mask & IVI_NOTIFICATION_OPACITY) &&
+            (entry->opacity < 0.0f ||
+             entry->opacity > (float)wl_fixed_from_int(1))) {
+            weston_log("ivi_layout_transactionCommit: "
+                       "opacity of %u out of range\n", entry->id);
+            return -1;
+        }
+
+        if (((entry->mask & IVI_NOTIFICATION_SOURCE_RECT) &&
+             !transaction_check_rect(entry->source)) ||
+            ((entry->mask & IVI_NOTIFICATION_DEST_RECT) &&
+             !transaction_check_rect(entry->dest))) {
+            weston_log("ivi_layout_transactionCommit: "
+                       "negative size for %u\n", entry->id);
+            return -1;
+        }
+
+        if (entry->type != TRANSACTION_LAYER_ORDER &&
+            entry->type != TRANSACTION_SCREEN_ORDER) {
+            continue;
+        }
+
+        ids = entry->order.data;
+        count = entry->order.size / sizeof *ids;
+        for (i = 0; i < count; i++) {
+            found = entry->type == TRANSACTION_LAYER_ORDER ?
+                    get_surface(layout, ids[i]) != NULL :
+                    get_layer(layout, ids[i]) != NULL;
+            if (!found && !skip_missing) {
+                weston_log("ivi_layout_transactionCommit: "
+                           "%u in the order of %u is gone\n",
+                           ids[i], entry->id);
+                return -1;
+            }
+
+            for (j = 0; j < i; j++) {
+                if (ids[j] == ids[i]) {
+                    weston_log("ivi_layout_transactionCommit: "
+                               "%u twice in the order of %u\n",
+                               ids[i], entry->id);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void
+transaction_apply_order(struct ivi_layout *layout,
+                        struct ivi_layout_transaction_entry *entry)
+{
+    uint32_t *ids = entry->order.data;
+    int32_t size = entry->order.size / sizeof *ids;
+    void **objects = NULL;
+    int32_t count = 0;
+    int32_t i = 0;
+
+    if (size > 0) {
+        objects = calloc(size, sizeof *objects);
+        if (objects == NULL) {
+            weston_log("fails to allocate memory\n");
+            return;
+        }
+    }
+
+    /* only the members still there, see transaction_validate */
+    for (i = 0; i < size; i++) {
+        objects[count] = entry->type == TRANSACTION_LAYER_ORDER ?
+                         (void *)get_surface(layout, ids[i]) :
+                         (void *)get_layer(layout, ids[i]);
+        if (objects[count] != NULL) {
+            count++;
+        }
+    }
+
+    if (entry->type == TRANSACTION_LAYER_ORDER) {
+        struct ivi_layout_layer *ivilayer = get_layer(layout, entry->id);
+
+        ivi_layout_layerSetRenderOrder(ivilayer,
+            count > 0 ? (struct ivi_layout_surface **)objects : NULL, count);
+    } else {
+        struct ivi_layout_screen *iviscrn =
+            ivi_layout_getScreenFromId(entry->id);
+
+        ivi_layout_screenSetRenderOrder(iviscrn,
+            count > 0 ? (struct ivi_layout_layer **)objects : NULL, count);
+    }
+
+    free(objects);
+}
+
+static void
+transaction_apply(struct ivi_layout *layout,
+                  struct ivi_layout_transaction *transaction)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+
+    wl_list_for_each(entry, &transaction->list_entry, link) {
+        if (transaction_entry_object(layout, entry) == NULL) {
+            continue;
+        }
+
+        switch (entry->type) {
+        case TRANSACTION_SURFACE: {
+            struct ivi_layout_surface *ivisurf =
+                get_surface(layout, entry->id);
+
+            if (entry->mask & IVI_NOTIFICATION_VISIBILITY) {
+                ivi_layout_surfaceSetVisibility(ivisurf, entry->visibility);
+            }
+            if (entry->mask & IVI_NOTIFICATION_OPACITY) {
+                ivi_layout_surfaceSetOpacity(ivisurf, entry->opacity);
+            }
+            if (entry->mask & IVI_NOTIFICATION_SOURCE_RECT) {
+                ivi_layout_surfaceSetSourceRectangle(ivisurf,
+                    entry->source[0], entry->source[1],
+                    entry->source[2], entry->source[3]);
+            }
+            if (entry->mask & IVI_NOTIFICATION_DEST_RECT) {
+                ivi_layout_surfaceSetDestinationRectangle(ivisurf,
+                    entry->dest[0], entry->dest[1],
+                    entry->dest[2], entry->dest[3]);
+            }
+            break;
+        }
+        case TRANSACTION_LAYER: {
+            struct ivi_layout_layer *ivilayer = get_layer(layout, entry->id);
+
+            if (entry->mask & IVI_NOTIFICATION_VISIBILITY) {
+                ivi_layout_layerSetVisibility(ivilayer, entry->visibility);
+            }
+            if (entry->mask & IVI_NOTIFICATION_OPACITY) {
+                ivi_layout_layerSetOpacity(ivilayer, entry->opacity);
+            }
+            if (entry->mask & IVI_NOTIFICATION_SOURCE_RECT) {
+                ivi_layout_layerSetSourceRectangle(ivilayer,
+                    entry->source[0], entry->source[1],
+                    entry->source[2], entry->source[3]);
+            }
+            if (entry->mask & IVI_NOTIFICATION_DEST_RECT) {
+                ivi_layout_layerSetDestinationRectangle(ivilayer,
+                    entry->dest[0], entry->dest[1],
+                    entry->dest[2], entry->dest[3]);
+            }
+            break;
+        }
+        case TRANSACTION_LAYER_ORDER:
+        case TRANSACTION_SCREEN_ORDER:
+            transaction_apply_order(layout, entry);
+            break;
+        }
+    }
+}
+
+static int32_t
+transaction_commit(struct ivi_layout *layout,
+                   struct ivi_layout_transaction *transaction,
+                   int32_t skip_missing)
+{
+    if (transaction_validate(layout, transaction, skip_missing) != 0) {
+        return -1;
+    }
+
+    transaction_apply(layout, transaction);
+
+    return ivi_layout_commitChanges();
+}
+
+WL_EXPORT struct ivi_layout_transaction *
+ivi_layout_transactionCreate(void)
+{
+    struct ivi_layout_transaction *transaction = NULL;
+
+    transaction = calloc(1, sizeof *transaction);
+    if (transaction == NULL) {
+        weston_log("fails to allocate memory\n");
+        return NULL;
+    }
+
+    transaction_init(transaction);
+
+    return transaction;
+}
+
+WL_EXPORT void
+ivi_layout_transactionDestroy(struct ivi_layout_transaction *transaction)
+{
+    if (transaction == NULL) {
+        return;
+    }
+
+    transaction_clear(transaction);
+    free(transaction);
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionSurfaceSetVisibility(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_surface *ivisurf,
+                        int32_t newVisibility)
+{
+    struct ivi_layout_transaction_entry *entry =
+        transaction_surface_entry(transaction, ivisurf,
+                                  IVI_NOTIFICATION_VISIBILITY);
+
+    if (entry == NULL) {
+        weston_log("ivi_layout_transactionSurfaceSetVisibility: invalid argument\n");
+        return -1;
+    }
+
+    entry->visibility = newVisibility;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionSurfaceSetOpacity(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_surface *ivisurf,
+                        float opacity)
+{
+    struct ivi_layout_transaction_entry *entry =
+        transaction_surface_entry(transaction, ivisurf,
+                                  IVI_NOTIFICATION_OPACITY);
+
+    if (entry == NULL) {
+        weston_log("ivi_layout_transactionSurfaceSetOpacity: invalid argument\n");
+        return -1;
+    }
+
+    entry->opacity = opacity;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionSurfaceSetSourceRectangle(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_surface *ivisurf,
+                        int32_t x, int32_t y,
+                        int32_t width, int32_t height)
+{
+    struct ivi_layout_transaction_entry *entry =
+        transaction_surface_entry(transaction, ivisurf,
+                                  IVI_NOTIFICATION_SOURCE_RECT);
+
+    if (entry == NULL) {
+        weston_log("ivi_layout_transactionSurfaceSetSourceRectangle: invalid argument\n");
+        return -1;
+    }
+
+    entry->source[0] = x;
+    entry->source[1] = y;
+    entry->source[2] = width;
+    entry->source[3] = height;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionSurfaceSetDestinationRectangle(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_surface *ivisurf,
+                        int32_t x, int32_t y,
+                        int32_t width, int32_t height)
+{
+    struct ivi_layout_transaction_entry *entry =
+        transaction_surface_entry(transaction, ivisurf,
+                                  IVI_NOTIFICATION_DEST_RECT);
+
+    if (entry == NULL) {
+        weston_log("ivi_layout_transactionSurfaceSetDestinationRectangle: invalid argument\n");
+        return -1;
+    }
+
+    entry->dest[0] = x;
+    entry->dest[1] = y;
+    entry->dest[2] = width;
+    entry->dest[3] = height;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionLayerSetVisibility(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        int32_t newVisibility)
+{
+    struct ivi_layout_transaction_entry *entry =
+        transaction_layer_entry(transaction, ivilayer,
+                                IVI_NOTIFICATION_VISIBILITY);
+
+    if (entry == NULL) {
+        weston_log("ivi_layout_transactionLayerSetVisibility: invalid argument\n");
+        return -1;
+    }
+
+    entry->visibility = newVisibility;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionLayerSetOpacity(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        float opacity)
+{
+    struct ivi_layout_transaction_entry *entry =
+        transaction_layer_entry(transaction, ivilayer,
+                                IVI_NOTIFICATION_OPACITY);
+
+    if (entry == NULL) {
+        weston_log("ivi_layout_transactionLayerSetOpacity: invalid argument\n");
+        return -1;
+    }
+
+    entry->opacity = opacity;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionLayerSetSourceRectangle(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        int32_t x, int32_t y,
+                        int32_t width, int32_t height)
+{
+    struct ivi_layout_transaction_entry *entry =
+        transaction_layer_entry(transaction, ivilayer,
+                                IVI_NOTIFICATION_SOURCE_RECT);
+
+    if (entry == NULL) {
+        weston_log("ivi_layout_transactionLayerSetSourceRectangle: invalid argument\n");
+        return -1;
+    }
+
+    entry->source[0] = x;
+    entry->source[1] = y;
+    entry->source[2] = width;
+    entry->source[3] = height;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionLayerSetDestinationRectangle(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        int32_t x, int32_t y,
+                        int32_t width, int32_t height)
+{
+    struct ivi_layout_transaction_entry *entry =
+        transaction_layer_entry(transaction, ivilayer,
+                                IVI_NOTIFICATION_DEST_RECT);
+
+    if (entry == NULL) {
+        weston_log("ivi_layout_transactionLayerSetDestinationRectangle: invalid argument\n");
+        return -1;
+    }
+
+    entry->dest[0] = x;
+    entry->dest[1] = y;
+    entry->dest[2] = width;
+    entry->dest[3] = height;
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionLayerSetRenderOrder(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_layer *ivilayer,
+                        struct ivi_layout_surface **pSurface,
+                        int32_t number)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+    uint32_t *ids = NULL;
+    int32_t i = 0;
+    int32_t ret = 0;
+
+    if (transaction == NULL || ivilayer == NULL ||
+        (pSurface == NULL && number > 0)) {
+        weston_log("ivi_layout_transactionLayerSetRenderOrder: invalid argument\n");
+        return -1;
+    }
+
+    entry = transaction_get_entry(transaction, TRANSACTION_LAYER_ORDER,
+                                  ivilayer->id_layer);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    if (number > 0) {
+        ids = calloc(number, sizeof *ids);
+        if (ids == NULL) {
+            weston_log("fails to allocate memory\n");
+            return -1;
+        }
+        for (i = 0; i < number; i++) {
+            ids[i] = pSurface[i]->id_surface;
+        }
+    }
+
+    ret = transaction_set_order(entry, ids, number);
+    free(ids);
+
+    return ret;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionScreenSetRenderOrder(
+                        struct ivi_layout_transaction *transaction,
+                        struct ivi_layout_screen *iviscrn,
+                        struct ivi_layout_layer **pLayer,
+                        int32_t number)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+    uint32_t *ids = NULL;
+    int32_t i = 0;
+    int32_t ret = 0;
+
+    if (transaction == NULL || iviscrn == NULL ||
+        (pLayer == NULL && number > 0)) {
+        weston_log("ivi_layout_transactionScreenSetRenderOrder: invalid argument\n");
+        return -1;
+    }
+
+    entry = transaction_get_entry(transaction, TRANSACTION_SCREEN_ORDER,
+                                  iviscrn->id_screen);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    if (number > 0) {
+        ids = calloc(number, sizeof *ids);
+        if (ids == NULL) {
+            weston_log("fails to allocate memory\n");
+            return -1;
+        }
+        for (i = 0; i < number; i++) {
+            ids[i] = pLayer[i]->id_layer;
+        }
+    }
+
+    ret = transaction_set_order(entry, ids, number);
+    free(ids);
+
+    return ret;
+}
+
+WL_EXPORT int32_t
+ivi_layout_transactionCommit(struct ivi_layout_transaction *transaction)
+{
+    struct ivi_layout *layout = get_instance();
+
+    if (transaction == NULL) {
+        weston_log("ivi_layout_transactionCommit: invalid argument\n");
+        return -1;
+    }
+
+    return transaction_commit(layout, transaction, 0);
+}
+
+/**
+ * Snapshots: the committed state of every surface, layer and screen,
+ * kept as a transaction under a name.
+ */
+static struct ivi_layout_snapshot *
+get_snapshot(struct ivi_layout *layout, const char *name)
+{
+    struct ivi_layout_snapshot *snapshot = NULL;
+
+    wl_list_for_each(snapshot, &layout->list_snapshot, link) {
+        if (strcmp(snapshot->name, name) == 0) {
+            return snapshot;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+snapshot_destroy(struct ivi_layout_snapshot *snapshot)
+{
+    wl_list_remove(&snapshot->link);
+    transaction_clear(&snapshot->transaction);
+    free(snapshot->name);
+    free(snapshot);
+}
+
+static int32_t
+snapshot_record(struct ivi_layout *layout,
+                struct ivi_layout_transaction *transaction)
+{
+    struct ivi_layout_surface *ivisurf = NULL;
+    struct ivi_layout_layer   *ivilayer = NULL;
+    struct ivi_layout_screen  *iviscrn = NULL;
+    struct ivi_layout_transaction_entry *entry = NULL;
+    uint32_t *id = NULL;
+    const uint32_t all = IVI_NOTIFICATION_VISIBILITY |
+                         IVI_NOTIFICATION_OPACITY |
+                         IVI_NOTIFICATION_SOURCE_RECT |
+                         IVI_NOTIFICATION_DEST_RECT;
+
+    wl_list_for_each(ivisurf, &layout->list_surface, link) {
+        entry = transaction_surface_entry(transaction, ivisurf, all);
+        if (entry == NULL) {
+            return -1;
+        }
+        entry->visibility = ivisurf->prop.visibility;
+        entry->opacity = ivisurf->prop.opacity;
+        entry->source[0] = ivisurf->prop.sourceX;
+        entry->source[1] = ivisurf->prop.sourceY;
+        entry->source[2] = ivisurf->prop.sourceWidth;
+        entry->source[3] = ivisurf->prop.sourceHeight;
+        entry->dest[0] = ivisurf->prop.destX;
+        entry->dest[1] = ivisurf->prop.destY;
+        entry->dest[2] = ivisurf->prop.destWidth;
+        entry->dest[3] = ivisurf->prop.destHeight;
+    }
+
+    wl_list_for_each(ivilayer, &layout->list_layer, link) {
+        entry = transaction_layer_entry(transaction, ivilayer, all);
+        if (entry == NULL) {
+            return -1;
+        }
+        entry->visibility = ivilayer->prop.visibility;
+        entry->opacity = ivilayer->prop.opacity;
+        entry->source[0] = ivilayer->prop.sourceX;
+        entry->source[1] = ivilayer->prop.sourceY;
+        entry->source[2] = ivilayer->prop.sourceWidth;
+        entry->source[3] = ivilayer->prop.sourceHeight;
+        entry->dest[0] = ivilayer->prop.destX;
+        entry->dest[1] = ivilayer->prop.destY;
+        entry->dest[2] = ivilayer->prop.destWidth;
+        entry->dest[3] = ivilayer->prop.destHeight;
+
+        entry = transaction_get_entry(transaction, TRANSACTION_LAYER_ORDER,
+                                      ivilayer->id_layer);
+        if (entry == NULL) {
+            return -1;
+        }
+        wl_list_for_each(ivisurf, &ivilayer->order.list_surface,
+                         order.link) {
+            id = wl_array_add(&entry->order, sizeof *id);
+            if (id == NULL) {
+                return -1;
+            }
+            *id = ivisurf->id_surface;
+        }
+    }
+
+    wl_list_for_each(iviscrn, &layout->list_screen, link) {
+        entry = transaction_get_entry(transaction, TRANSACTION_SCREEN_ORDER,
+                                      iviscrn->id_screen);
+        if (entry == NULL) {
+            return -1;
+        }
+        wl_list_for_each(ivilayer, &iviscrn->order.list_layer,
+                         order.link) {
+            id = wl_array_add(&entry->order, sizeof *id);
+            if (id == NULL) {
+                return -1;
+            }
+            *id = ivilayer->id_layer;
+        }
+    }
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_snapshotSave(const char *name)
+{
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_snapshot *snapshot = NULL;
+    struct ivi_layout_snapshot *old = NULL;
+
+    if (name == NULL) {
+        weston_log("ivi_layout_snapshotSave: invalid argument\n");
+        return -1;
+    }
+
+    snapshot = calloc(1, sizeof *snapshot);
+    if (snapshot == NULL) {
+        weston_log("fails to allocate memory\n");
+        return -1;
+    }
+
+    snapshot->name = strdup(name);
+    transaction_init(&snapshot->transaction);
+    wl_list_init(&snapshot->link);
+
+    if (snapshot->name == NULL ||
+        snapshot_record(layout, &snapshot->transaction) != 0) {
+        weston_log("ivi_layout_snapshotSave: fails to allocate memory\n");
+        snapshot_destroy(snapshot);
+        return -1;
+    }
+
+    old = get_snapshot(layout, name);
+    if (old != NULL) {
+        snapshot_destroy(old);
+    }
+    wl_list_insert(&layout->list_snapshot, &snapshot->link);
+
+    return 0;
+}
+
+WL_EXPORT int32_t
+ivi_layout_snapshotRestore(const char *name)
+{
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_snapshot *snapshot = NULL;
+
+    if (name == NULL) {
+        weston_log("ivi_layout_snapshotRestore: invalid argument\n");
+        return -1;
+    }
+
+    snapshot = get_snapshot(layout, name);
+    if (snapshot == NULL) {
+        weston_log("ivi_layout_snapshotRestore: no snapshot %s\n", name);
+        return -1;
+    }
+
+    return transaction_commit(layout, &snapshot->transaction, 1);
+}
+
+WL_EXPORT int32_t
+ivi_layout_snapshotRemove(const char *name)
+{
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_snapshot *snapshot = NULL;
+
+    if (name == NULL) {
+        weston_log("ivi_layout_snapshotRemove: invalid argument\n");
+        return -1;
+    }
+
+    snapshot = get_snapshot(layout, name);
+    if (snapshot == NULL) {
+        weston_log("ivi_layout_snapshotRemove: no snapshot %s\n", name);
+        return -1;
+    }
+
+    snapshot_destroy(snapshot);
+
+    return 0;
+}
+
+/**
+ * Layout state across restarts: the properties and orders of all
+ * objects, recorded like a snapshot, are written to a small file mapped
+ * shared, at most every IVI_LAYOUT_STATE_SAVE_MSECS after a commit.
+ * Pages of a shared mapping outlive the compositor process, so a crash
+ * loses at most that much.  At startup, the objects created again get
+ * their properties and places in the orders back as they are created,
+ * before the controller hears of them.
+ *
+ * The file is native endian, it never leaves the machine.
+ */
+#define IVI_LAYOUT_STATE_MAGIC          0x534c5649  /* "IVLS" */
+#define IVI_LAYOUT_STATE_VERSION        1
+#define IVI_LAYOUT_STATE_SAVE_MSECS     500
+#define IVI_LAYOUT_STATE_RESTORE_MSECS  30000
+
+struct ivi_layout_state_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;      /* of the entries, 0 while they are written */
+    uint32_t count;
+};
+
+struct ivi_layout_state_entry {
+    uint32_t type;      /* enum transaction_entry_type */
+    uint32_t id;
+    uint32_t mask;
+    int32_t visibility;
+    float opacity;
+    int32_t source[4];
+    int32_t dest[4];
+    uint32_t order_count;   /* ids following the entry */
+};
+
+static int32_t
+state_map(struct ivi_layout *layout, size_t size)
+{
+    void *map = NULL;
+
+    if (size <= layout->state.map_size) {
+        return 0;
+    }
+
+    size = (size + 4095) & ~(size_t)4095;
+    if (ftruncate(layout->state.fd, size) < 0) {
+        return -1;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               layout->state.fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    if (layout->state.map != NULL) {
+        munmap(layout->state.map, layout->state.map_size);
+    }
+    layout->state.map = map;
+    layout->state.map_size = size;
+
+    return 0;
+}
+
+static int
+state_save(void *data)
+{
+    struct ivi_layout *layout = data;
+    struct ivi_layout_transaction transaction;
+    struct ivi_layout_transaction_entry *entry = NULL;
+    struct ivi_layout_state_header *header = NULL;
+    struct ivi_layout_state_entry *out = NULL;
+    size_t size = 0;
+    size_t order_size = 0;
+    uint32_t count = 0;
+    char *p = NULL;
+
+    layout->state.save_pending = 0;
+
+    transaction_init(&transaction);
+    if (snapshot_record(layout, &transaction) != 0) {
+        weston_log("ivi-layout: fails to record the layout state\n");
+        transaction_clear(&transaction);
+        return 0;
+    }
+
+    wl_list_for_each(entry, &transaction.list_entry, link) {
+        size += sizeof *out + entry->order.size;
+        count++;
+    }
+
+    if (state_map(layout, sizeof *header + size) != 0) {
+        weston_log("ivi-layout: fails to grow the layout state file: %m\n");
+        transaction_clear(&transaction);
+        return 0;
+    }
+
+    /* a crash from here on leaves a file that is ignored, not a torn one */
+    header = layout->state.map;
+    header->size = 0;
+
+    p = (char *)(header + 1);
+    wl_list_for_each(entry, &transaction.list_entry, link) {
+        out = (struct ivi_layout_state_entry *)p;
+        order_size = entry->order.size;
+        out->type = entry->type;
+        out->id = entry->id;
+        out->mask = entry->mask;
+        out->visibility = entry->visibility;
+        out->opacity = entry->opacity;
+        memcpy(out->source, entry->source, sizeof out->source);
+        memcpy(out->dest, entry->dest, sizeof out->dest);
+        out->order_count = order_size / sizeof(uint32_t);
+        memcpy(out + 1, entry->order.data, order_size);
+        p += sizeof *out + order_size;
+    }
+
+    header->magic = IVI_LAYOUT_STATE_MAGIC;
+    header->version = IVI_LAYOUT_STATE_VERSION;
+    header->count = count;
+    __sync_synchronize();
+    header->size = size;
+
+    transaction_clear(&transaction);
+
+    return 0;
+}
+
+static void
+state_schedule_save(struct ivi_layout *layout)
+{
+    /* nothing is written over the old state until it is all back */
+    if (layout->state.save_timer == NULL || layout->state.save_pending ||
+        !wl_list_empty(&layout->state.restore.list_entry)) {
+        return;
+    }
+
+    layout->state.save_pending = 1;
+    wl_event_source_timer_update(layout->state.save_timer,
+                                 IVI_LAYOUT_STATE_SAVE_MSECS);
+}
+
+static void
+state_restore_done(struct ivi_layout *layout)
+{
+    transaction_clear(&layout->state.restore);
+    if (layout->state.restore_timer != NULL) {
+        wl_event_source_remove(layout->state.restore_timer);
+        layout->state.restore_timer = NULL;
+    }
+    state_schedule_save(layout);
+}
+
+static int
+state_restore_timeout(void *data)
+{
+    struct ivi_layout *layout = data;
+
+    weston_log("ivi-layout: dropping the saved state of objects "
+               "not created again\n");
+    state_restore_done(layout);
+
+    return 0;
+}
+
+/* Every saved object has a properties entry, so once none is left all
+ * of them are back and the orders are of no more use. */
+static void
+state_restore_check_done(struct ivi_layout *layout)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+
+    wl_list_for_each(entry, &layout->state.restore.list_entry, link) {
+        if (entry->type == TRANSACTION_SURFACE ||
+            entry->type == TRANSACTION_LAYER) {
+            return;
+        }
+    }
+
+    state_restore_done(layout);
+}
+
+static struct ivi_layout_transaction_entry *
+state_find_entry(struct ivi_layout *layout,
+                 enum transaction_entry_type type, uint32_t id)
+{
+    struct ivi_layout_transaction_entry *entry = NULL;
+
+    wl_list_for_each(entry, &layout->state.restore.list_entry, link) {
+        if (entry->type == type && entry->id == id) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static int32_t
+state_order_index(struct ivi_layout_transaction_entry *entry, uint32_t id)
+{
+    uint32_t *ids = entry->order.data;
+    int32_t size = entry->order.size / sizeof *ids;
+    int32_t i = 0;
+
+    for (i = 0; i < size; i++) {
+        if (ids[i] == id) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Where id goes among the count ids of current, so that it keeps its
+ * saved place relative to them */
+static int32_t
+state_order_position(struct ivi_layout_transaction_entry *entry,
+                     uint32_t id, const uint32_t *current, int32_t count)
+{
+    uint32_t *ids = entry->order.data;
+    int32_t size = entry->order.size / sizeof *ids;
+    int32_t k = state_order_index(entry, id);
+    int32_t i = 0;
+    int32_t j = 0;
+
+    for (i = k - 1; i >= 0; i--) {
+        for (j = 0; j < count; j++) {
+            if (current[j] == ids[i]) {
+                return j + 1;
+            }
+        }
+    }
+
+    for (i = k + 1; i < size; i++) {
+        for (j = 0; j < count; j++) {
+            if (current[j] == ids[i]) {
+                return j;
+            }
+        }
+    }
+
+    return count;
+}
+
+/* Adds ivisurf to the pending order of ivilayer at its saved place. The
+ * pending list is in reverse of the array, see
+ * ivi_layout_layerSetRenderOrder. */
+static void
+state_insert_surface(struct ivi_layout_layer *ivilayer,
+                     struct ivi_layout_transaction_entry *entry,
+                     struct ivi_layout_surface *ivisurf)
+{
+    struct ivi_layout_surface **surfaces = NULL;
+    struct ivi_layout_surface *member = NULL;
+    uint32_t *ids = NULL;
+    int32_t count = wl_list_length(&ivilayer->pending.list_surface);
+    int32_t pos = 0;
+    int32_t i = count;
+
+    surfaces = calloc(count + 1, sizeof *surfaces);
+    ids = calloc(count + 1, sizeof *ids);
+    if (surfaces == NULL || ids == NULL) {
+        weston_log("fails to allocate memory\n");
+        free(surfaces);
+        free(ids);
+        return;
+    }
+
+    wl_list_for_each(member, &ivilayer->pending.list_surface, pending.link) {
+        i--;
+        surfaces[i] = member;
+        ids[i] = member->id_surface;
+    }
+
+    pos = state_order_position(entry, ivisurf->id_surface, ids, count);
+    memmove(&surfaces[pos + 1], &surfaces[pos],
+            (count - pos) * sizeof *surfaces);
+    surfaces[pos] = ivisurf;
+    ivi_layout_layerSetRenderOrder(ivilayer, surfaces, count + 1);
+
+    free(surfaces);
+    free(ids);
+}
+
+static void
+state_insert_layer(struct ivi_layout_screen *iviscrn,
+                   struct ivi_layout_transaction_entry *entry,
+                   struct ivi_layout_layer *ivilayer)
+{
+    struct ivi_layout_layer **layers = NULL;
+    struct ivi_layout_layer *member = NULL;
+    uint32_t *ids = NULL;
+    int32_t count = wl_list_length(&iviscrn->pending.list_layer);
+    int32_t pos = 0;
+    int32_t i = count;
+
+    layers = calloc(count + 1, sizeof *layers);
+    ids = calloc(count + 1, sizeof *ids);
+    if (layers == NULL || ids == NULL) {
+        weston_log("fails to allocate memory\n");
+        free(layers);
+        free(ids);
+        return;
+    }
+
+    wl_list_for_each(member, &iviscrn->pending.list_layer, pending.link) {
+        i--;
+        layers[i] = member;
+        ids[i] = member->id_layer;
+    }
 
-    return 0;
+    pos = state_order_position(entry, ivilayer->id_layer, ids, count);
+    memmove(&layers[pos + 1], &layers[pos], (count - pos) * sizeof *layers);
+    layers[pos] = ivilayer;
+    ivi_layout_screenSetRenderOrder(iviscrn, layers, count + 1);
+
+    free(layers);
+    free(ids);
 }
 
-WL_EXPORT int32_t
-ivi_layout_getPropertiesOfSurface(struct ivi_layout_surface *ivisurf,
-                    struct ivi_layout_SurfaceProperties *pSurfaceProperties)
+/* Nothing but restored state pending means nobody else is going to
+ * commit it soon; commit it from the idle handler then. */
+static void
+state_restore_commit(void *data)
 {
-    if (ivisurf == NULL || pSurfaceProperties == NULL) {
-        weston_log("ivi_layout_getPropertiesOfSurface: invalid argument\n");
-        return -1;
-    }
+    ivi_layout_commitChanges();
+}
 
-    *pSurfaceProperties = ivisurf->prop;
+static void
+state_restore_schedule_commit(struct ivi_layout *layout, int32_t was_clean)
+{
+    struct wl_event_loop *loop =
+        wl_display_get_event_loop(layout->compositor->wl_display);
 
-    return 0;
+    if (was_clean) {
+        wl_event_loop_add_idle(loop, state_restore_commit, layout);
+    }
 }
 
-WL_EXPORT int32_t
-ivi_layout_layerAddSurface(struct ivi_layout_layer *ivilayer,
-                           struct ivi_layout_surface *addsurf)
+static void
+state_restore_layer(struct ivi_layout *layout,
+                    struct ivi_layout_layer *ivilayer)
 {
-    struct ivi_layout *layout = get_instance();
-    struct ivi_layout_surface *ivisurf = NULL;
-    struct ivi_layout_surface *next = NULL;
-    int is_surf_in_layer = 0;
+    struct ivi_layout_transaction_entry *entry = NULL;
+    struct ivi_layout_transaction_entry *props = NULL;
+    struct ivi_layout_transaction_entry *order = NULL;
+    struct ivi_layout_screen *iviscrn = NULL;
+    int32_t was_clean = 0;
 
-    if (ivilayer == NULL || addsurf == NULL) {
-        weston_log("ivi_layout_layerAddSurface: invalid argument\n");
-        return -1;
+    if (wl_list_empty(&layout->state.restore.list_entry)) {
+        return;
     }
 
-    is_surf_in_layer = is_surface_in_layer(addsurf, ivilayer);
-    if (is_surf_in_layer == 1) {
-        weston_log("ivi_layout_layerAddSurface: addsurf is already available\n");
-        return 0;
+    was_clean = wl_list_empty(&layout->list_dirty_surface) &&
+                wl_list_empty(&layout->list_dirty_layer);
+
+    props = state_find_entry(layout, TRANSACTION_LAYER, ivilayer->id_layer);
+    if (props != NULL) {
+        ivi_layout_layerSetVisibility(ivilayer, props->visibility);
+        ivi_layout_layerSetOpacity(ivilayer, props->opacity);
+        ivi_layout_layerSetSourceRectangle(ivilayer,
+            props->source[0], props->source[1],
+            props->source[2], props->source[3]);
+        ivi_layout_layerSetDestinationRectangle(ivilayer,
+            props->dest[0], props->dest[1],
+            props->dest[2], props->dest[3]);
+        wl_list_remove(&props->link);
+        wl_array_release(&props->order);
+        free(props);
     }
 
-    wl_list_for_each_safe(ivisurf, next, &layout->list_surface, link) {
-        if (ivisurf->id_surface == addsurf->id_surface) {
-            if (!wl_list_empty(&ivisurf->pending.link)) {
-                wl_list_remove(&ivisurf->pending.link);
-            }
-            wl_list_init(&ivisurf->pending.link);
-            wl_list_insert(&ivilayer->pending.list_surface,
-                           &ivisurf->pending.link);
-            break;
-        }
+    /* surfaces that came back before their layer */
+    order = state_find_entry(layout, TRANSACTION_LAYER_ORDER,
+                             ivilayer->id_layer);
+    if (order != NULL) {
+        transaction_apply_order(layout, order);
     }
 
-    ivilayer->event_mask |= IVI_NOTIFICATION_ADD;
+    wl_list_for_each(entry, &layout->state.restore.list_entry, link) {
+        if (entry->type != TRANSACTION_SCREEN_ORDER ||
+            state_order_index(entry, ivilayer->id_layer) < 0) {
+            continue;
+        }
+        iviscrn = ivi_layout_getScreenFromId(entry->id);
+        if (iviscrn != NULL) {
+            state_insert_layer(iviscrn, entry, ivilayer);
+        }
+    }
 
-    return 0;
+    state_restore_schedule_commit(layout, was_clean);
+    state_restore_check_done(layout);
 }
 
-WL_EXPORT int32_t
-ivi_layout_layerRemoveSurface(struct ivi_layout_layer *ivilayer,
-                              struct ivi_layout_surface *remsurf)
+static void
+state_restore_surface(struct ivi_layout *layout,
+                      struct ivi_layout_surface *ivisurf)
 {
-    struct ivi_layout_surface *ivisurf = NULL;
-    struct ivi_layout_surface *next = NULL;
+    struct ivi_layout_transaction_entry *entry = NULL;
+    struct ivi_layout_transaction_entry *props = NULL;
+    struct ivi_layout_layer *ivilayer = NULL;
+    int32_t was_clean = 0;
 
-    if (ivilayer == NULL || remsurf == NULL) {
-        weston_log("ivi_layout_layerRemoveSurface: invalid argument\n");
-        return -1;
+    if (wl_list_empty(&layout->state.restore.list_entry)) {
+        return;
     }
 
-    wl_list_for_each_safe(ivisurf, next,
-                          &ivilayer->pending.list_surface, pending.link) {
-        if (ivisurf->id_surface == remsurf->id_surface) {
-            if (!wl_list_empty(&ivisurf->pending.link)) {
-                wl_list_remove(&ivisurf->pending.link);
-            }
-            wl_list_init(&ivisurf->pending.link);
-            break;
-        }
+    was_clean = wl_list_empty(&layout->list_dirty_surface) &&
+                wl_list_empty(&layout->list_dirty_layer);
+
+    props = state_find_entry(layout, TRANSACTION_SURFACE, ivisurf->id_surface);
+    if (props != NULL) {
+        ivi_layout_surfaceSetVisibility(ivisurf, props->visibility);
+        ivi_layout_surfaceSetOpacity(ivisurf, props->opacity);
+        ivi_layout_surfaceSetSourceRectangle(ivisurf,
+            props->source[0], props->source[1],
+            props->source[2], props->source[3]);
+        ivi_layout_surfaceSetDestinationRectangle(ivisurf,
+            props->dest[0], props->dest[1],
+            props->dest[2], props->dest[3]);
+        wl_list_remove(&props->link);
+        wl_array_release(&props->order);
+        free(props);
     }
 
-    remsurf->event_mask |= IVI_NOTIFICATION_REMOVE;
+    wl_list_for_each(entry, &layout->state.restore.list_entry, link) {
+        if (entry->type != TRANSACTION_LAYER_ORDER ||
+            state_order_index(entry, ivisurf->id_surface) < 0) {
+            continue;
+        }
+        ivilayer = get_layer(layout, entry->id);
+        if (ivilayer != NULL) {
+            state_insert_surface(ivilayer, entry, ivisurf);
+        }
+    }
 
-    return 0;
+    state_restore_schedule_commit(layout, was_clean);
+    state_restore_check_done(layout);
 }
 
-WL_EXPORT int32_t
-ivi_layout_surfaceSetSourceRectangle(struct ivi_layout_surface *ivisurf,
-                                     int32_t x, int32_t y,
-                                     int32_t width, int32_t height)
+/* Reads what the file holds into the restore transaction */
+static void
+state_load(struct ivi_layout *layout)
 {
-    struct ivi_layout_SurfaceProperties *prop = NULL;
-
-    if (ivisurf == NULL) {
-        weston_log("ivi_layout_surfaceSetSourceRectangle: invalid argument\n");
-        return -1;
+    struct ivi_layout_state_header *header = layout->state.map;
+    struct ivi_layout_state_entry *in = NULL;
+    struct ivi_layout_transaction_entry *entry = NULL;
+    char *p = (char *)(header + 1);
+    char *end = NULL;
+    uint32_t i = 0;
+
+    if (layout->state.map_size < sizeof *header ||
+        header->magic != IVI_LAYOUT_STATE_MAGIC ||
+        header->version != IVI_LAYOUT_STATE_VERSION ||
+        header->size == 0 ||
+        header->size > layout->state.map_size - sizeof *header) {
+        return;
     }
 
-    prop = &ivisurf->pending.prop;
-    prop->sourceX = x;
-    prop->sourceY = y;
-    prop->sourceWidth = width;
-    prop->sourceHeight = height;
+    end = p + header->size;
+    for (i = 0; i < header->count; i++) {
+        in = (struct ivi_layout_state_entry *)p;
+        if ((size_t)(end - p) < sizeof *in ||
+            in->order_count > (end - p - sizeof *in) / sizeof(uint32_t) ||
+            in->type > TRANSACTION_SCREEN_ORDER) {
+            weston_log("ivi-layout: the saved layout state is damaged\n");
+            transaction_clear(&layout->state.restore);
+            return;
+        }
 
-    ivisurf->event_mask |= IVI_NOTIFICATION_SOURCE_RECT;
+        entry = transaction_get_entry(&layout->state.restore,
+                                      in->type, in->id);
+        if (entry == NULL ||
+            transaction_set_order(entry, (uint32_t *)(in + 1),
+                                  in->order_count) != 0) {
+            transaction_clear(&layout->state.restore);
+            return;
+        }
+        entry->mask = in->mask;
+        entry->visibility = in->visibility;
+        entry->opacity = in->opacity;
+        memcpy(entry->source, in->source, sizeof entry->source);
+        memcpy(entry->dest, in->dest, sizeof entry->dest);
 
-    return 0;
+        p += sizeof *in + in->order_count * sizeof(uint32_t);
+    }
+
+    weston_log("ivi-layout: restoring %u saved layout objects\n", i);
 }
 
-WL_EXPORT int32_t
-ivi_layout_commitChanges(void)
+static void
+state_init(struct ivi_layout *layout, const char *path)
 {
-    struct ivi_layout *layout = get_instance();
+    struct wl_event_loop *loop =
+        wl_display_get_event_loop(layout->compositor->wl_display);
+    struct stat st;
+    void *map = NULL;
 
-    commit_list_surface(layout);
-    commit_list_layer(layout);
-    commit_list_screen(layout);
+    transaction_init(&layout->state.restore);
+    layout->state.fd = -1;
 
-    commit_changes(layout);
-    send_prop(layout);
-    weston_compositor_schedule_repaint(layout->compositor);
+    if (path == NULL) {
+        return;
+    }
 
-    return 0;
+    layout->state.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (layout->state.fd < 0) {
+        weston_log("ivi-layout: fails to open %s: %m\n", path);
+        return;
+    }
+
+    if (fstat(layout->state.fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   layout->state.fd, 0);
+        if (map != MAP_FAILED) {
+            layout->state.map = map;
+            layout->state.map_size = st.st_size;
+            state_load(layout);
+        }
+    }
+
+    layout->state.save_timer =
+        wl_event_loop_add_timer(loop, state_save, layout);
+
+    if (!wl_list_empty(&layout->state.restore.list_entry)) {
+        layout->state.restore_timer =
+            wl_event_loop_add_timer(loop, state_restore_timeout, layout);
+        if (layout->state.restore_timer != NULL) {
+            wl_event_source_timer_update(layout->state.restore_timer,
+                                         IVI_LAYOUT_STATE_RESTORE_MSECS);
+        }
+    }
 }
 
 /***called from ivi-shell**/
@@ -2690,6 +5540,116 @@ ivi_layout_get_weston_view(struct ivi_layout_surface *surface)
     return tmpview;
 }
 
+/**
+ * Internal APIs for placeholders: the app's surface is bound to a
+ * placeholder's id right away but only takes its place on the first
+ * buffer, until then the placeholder stays on screen.
+ */
+static void
+native_destroy_from_placeholder(struct wl_listener *listener, void *data)
+{
+    struct ivi_layout_surface *ivisurf =
+        container_of(listener, struct ivi_layout_surface,
+                     native_destroy_listener);
+
+    ivisurf->native = NULL;
+}
+
+static int32_t
+placeholder_bind(struct ivi_layout_surface *ivisurf,
+                 struct weston_surface *surface)
+{
+    if (surface == NULL) {
+        /* the app left before it drew anything */
+        if (ivisurf->native != NULL) {
+            wl_list_remove(&ivisurf->native_destroy_listener.link);
+            ivisurf->native = NULL;
+        }
+        return 0;
+    }
+
+    if (ivisurf->native != NULL) {
+        weston_log("id_surface(%d) is already created\n",
+                   ivisurf->id_surface);
+        return -1;
+    }
+
+    ivisurf->native = surface;
+    ivisurf->native_destroy_listener.notify =
+        native_destroy_from_placeholder;
+    wl_resource_add_destroy_listener(surface->resource,
+                                     &ivisurf->native_destroy_listener);
+
+    return 0;
+}
+
+/* Put the app's view where the placeholder's is, with the same
+ * transforms, so that the swap needs no layout pass. */
+static void
+placeholder_replace(struct ivi_layout_surface *ivisurf)
+{
+    struct weston_surface *placeholder = ivisurf->placeholder;
+    struct weston_surface *surface = ivisurf->native;
+    struct weston_view *from = NULL;
+    struct weston_view *to = NULL;
+    struct weston_transform *transform = NULL;
+    struct weston_transform *next = NULL;
+
+    from = container_of(placeholder->views.next,
+                        struct weston_view, surface_link);
+
+    to = weston_view_create(surface);
+    if (to == NULL) {
+        weston_log("fails to allocate memory\n");
+        return;
+    }
+
+    wl_list_remove(&ivisurf->native_destroy_listener.link);
+    ivisurf->native = NULL;
+    ivisurf->placeholder = NULL;
+
+    ivisurf->surface = surface;
+    ivisurf->surface_destroy_listener.notify =
+        westonsurface_destroy_from_ivisurface;
+    wl_resource_add_destroy_listener(surface->resource,
+                                     &ivisurf->surface_destroy_listener);
+
+    wl_list_remove(&to->transform.position.link);
+    wl_list_for_each_safe(transform, next,
+                          &from->geometry.transformation_list, link) {
+        if (transform == &from->transform.position) {
+            transform = &to->transform.position;
+        } else {
+            wl_list_remove(&transform->link);
+        }
+        wl_list_insert(to->geometry.transformation_list.prev,
+                       &transform->link);
+    }
+    wl_list_init(&from->geometry.transformation_list);
+
+    weston_view_set_position(to, from->geometry.x, from->geometry.y);
+    to->alpha = from->alpha;
+    to->colorkey_enabled = from->colorkey_enabled;
+    to->colorkey = from->colorkey;
+    to->plane_hint = from->plane_hint;
+    to->cache_group = from->cache_group;
+
+    if (!wl_list_empty(&from->layer_link)) {
+        wl_list_insert(&from->layer_link, &to->layer_link);
+        wl_list_remove(&from->layer_link);
+        wl_list_init(&from->layer_link);
+    }
+    surface->output = placeholder->output;
+
+    weston_view_geometry_dirty(to);
+    weston_surface_destroy(placeholder);
+
+    if (ivisurf->content_observer.callback) {
+        (*(ivisurf->content_observer.callback))(ivisurf,
+                                     1, ivisurf->content_observer.userdata);
+    }
+}
+
 static void
 ivi_layout_surfaceConfigure(struct ivi_layout_surface *ivisurf,
                                int32_t width, int32_t height)
@@ -2697,6 +5657,10 @@ ivi_layout_surfaceConfigure(struct ivi_layout_surface *ivisurf,
     struct ivi_layout *layout = get_instance();
     struct link_surfaceCreateNotification *notification = NULL;
 
+    if (ivisurf->native != NULL) {
+        placeholder_replace(ivisurf);
+    }
+
     ivisurf->surface->width_from_buffer  = width;
     ivisurf->surface->height_from_buffer = height;
 
@@ -2706,6 +5670,7 @@ ivi_layout_surfaceConfigure(struct ivi_layout_surface *ivisurf,
             notification->callback(ivisurf, notification->userdata);
         }
     }
+    queue_surface_change(ivisurf, IVI_LAYOUT_CHANGE_EVENT_CONFIGURE, 0);
 }
 
 static int32_t
@@ -2718,12 +5683,16 @@ ivi_layout_surfaceSetNativeContent(struct weston_surface *surface,
     struct ivi_layout_surface *ivisurf;
     struct link_surfaceCreateNotification *notification = NULL;
 
-    ivisurf = get_surface(&layout->list_surface, id_surface);
+    ivisurf = get_surface(layout, id_surface);
     if (ivisurf == NULL) {
         weston_log("layout surface is not found\n");
         return -1;
     }
 
+    if (ivisurf->placeholder != NULL) {
+        return placeholder_bind(ivisurf, surface);
+    }
+
     if (ivisurf->surface != NULL) {
         if (surface != NULL) {
             weston_log("id_surface(%d) is already set the native content\n",
@@ -2769,6 +5738,7 @@ ivi_layout_surfaceSetNativeContent(struct weston_surface *surface,
         weston_log("fails to allocate memory\n");
         return -1;
     }
+    mark_surface_screens(ivisurf);
 
     ivisurf->surface->width_from_buffer  = width;
     ivisurf->surface->height_from_buffer = height;
@@ -2780,6 +5750,7 @@ ivi_layout_surfaceSetNativeContent(struct weston_surface *surface,
             notification->callback(ivisurf, notification->userdata);
         }
     }
+    queue_surface_change(ivisurf, IVI_LAYOUT_CHANGE_EVENT_CREATE, 0);
 
     if (ivisurf->content_observer.callback) {
         (*(ivisurf->content_observer.callback))(ivisurf,
@@ -2803,22 +5774,30 @@ ivi_layout_surfaceSetContentObserver(struct ivi_layout_surface *ivisurf,
     return ret;
 }
 
+static struct ivi_layout_surface *
+create_surface(struct ivi_layout *layout, struct weston_surface *wl_surface,
+               uint32_t id_surface);
+
 static struct ivi_layout_surface*
 ivi_layout_surfaceCreate(struct weston_surface *wl_surface,
                          uint32_t id_surface)
 {
     struct ivi_layout *layout = get_instance();
     struct ivi_layout_surface *ivisurf = NULL;
-    struct link_surfaceCreateNotification *notification = NULL;
 
     if (wl_surface == NULL) {
         weston_log("ivi_layout_surfaceCreate: invalid argument\n");
         return NULL;
     }
 
-    ivisurf = get_surface(&layout->list_surface, id_surface);
+    ivisurf = get_surface(layout, id_surface);
     if (ivisurf != NULL) {
-        if (ivisurf->surface != NULL) {
+        if (ivisurf->placeholder != NULL) {
+            if (placeholder_bind(ivisurf, wl_surface) != 0) {
+                return NULL;
+            }
+            return ivisurf;
+        } else if (ivisurf->surface != NULL) {
             weston_log("id_surface(%d) is already created\n", id_surface);
             return NULL;
         } else {
@@ -2833,6 +5812,119 @@ ivi_layout_surfaceCreate(struct weston_surface *wl_surface,
         }
     }
 
+    return create_surface(layout, wl_surface, id_surface);
+}
+
+/* A client-less surface showing color (0xAARRGGBB), for placeholders
+ * and solid color surfaces alike. */
+static struct weston_surface *
+create_color_surface(struct ivi_layout *layout,
+                     int32_t width, int32_t height, uint32_t color)
+{
+    struct weston_surface *surface = NULL;
+    float alpha = ((color >> 24) & 0xff) / 255.0f;
+
+    surface = weston_surface_create(layout->compositor);
+    if (surface == NULL) {
+        weston_log("fails to allocate memory\n");
+        return NULL;
+    }
+
+    weston_surface_set_color(surface,
+                             ((color >> 16) & 0xff) / 255.0f,
+                             ((color >> 8) & 0xff) / 255.0f,
+                             (color & 0xff) / 255.0f,
+                             alpha);
+    if (alpha == 1.0f) {
+        pixman_region32_fini(&surface->opaque);
+        pixman_region32_init_rect(&surface->opaque, 0, 0, width, height);
+    }
+    /* neither takes input, a placeholder's goes to the app */
+    pixman_region32_fini(&surface->input);
+    pixman_region32_init(&surface->input);
+
+    weston_surface_set_size(surface, width, height);
+    surface->width_from_buffer  = width;
+    surface->height_from_buffer = height;
+
+    return surface;
+}
+
+WL_EXPORT struct ivi_layout_surface *
+ivi_layout_surfaceCreatePlaceholder(uint32_t id_surface,
+                                    int32_t width, int32_t height,
+                                    uint32_t color)
+{
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_surface *ivisurf = NULL;
+    struct weston_surface *surface = NULL;
+
+    if (width <= 0 || height <= 0) {
+        weston_log("ivi_layout_surfaceCreatePlaceholder: invalid argument\n");
+        return NULL;
+    }
+
+    if (get_surface(layout, id_surface) != NULL) {
+        weston_log("id_surface(%d) is already created\n", id_surface);
+        return NULL;
+    }
+
+    surface = create_color_surface(layout, width, height, color);
+    if (surface == NULL) {
+        return NULL;
+    }
+
+    ivisurf = create_surface(layout, surface, id_surface);
+    if (ivisurf == NULL) {
+        weston_surface_destroy(surface);
+        return NULL;
+    }
+    ivisurf->placeholder = surface;
+
+    return ivisurf;
+}
+
+WL_EXPORT struct ivi_layout_surface *
+ivi_layout_surfaceCreateSolidColor(uint32_t id_surface,
+                                   int32_t width, int32_t height,
+                                   uint32_t color)
+{
+    struct ivi_layout *layout = get_instance();
+    struct ivi_layout_surface *ivisurf = NULL;
+    struct weston_surface *surface = NULL;
+
+    if (width <= 0 || height <= 0) {
+        weston_log("ivi_layout_surfaceCreateSolidColor: invalid argument\n");
+        return NULL;
+    }
+
+    if (get_surface(layout, id_surface) != NULL) {
+        weston_log("id_surface(%d) is already created\n", id_surface);
+        return NULL;
+    }
+
+    surface = create_color_surface(layout, width, height, color);
+    if (surface == NULL) {
+        return NULL;
+    }
+
+    ivisurf = create_surface(layout, surface, id_surface);
+    if (ivisurf == NULL) {
+        weston_surface_destroy(surface);
+        return NULL;
+    }
+    ivisurf->solid = surface;
+
+    return ivisurf;
+}
+
+static struct ivi_layout_surface *
+create_surface(struct ivi_layout *layout, struct weston_surface *wl_surface,
+               uint32_t id_surface)
+{
+    struct ivi_layout_surface *ivisurf = NULL;
+    struct link_surfaceCreateNotification *notification = NULL;
+
     ivisurf = calloc(1, sizeof *ivisurf);
     if (ivisurf == NULL) {
         weston_log("fails to allocate memory\n");
@@ -2840,24 +5932,28 @@ ivi_layout_surfaceCreate(struct weston_surface *wl_surface,
     }
 
     wl_list_init(&ivisurf->link);
+    wl_list_init(&ivisurf->hash_link);
     wl_list_init(&ivisurf->list_notification);
     wl_list_init(&ivisurf->list_layer);
     ivisurf->id_surface = id_surface;
     ivisurf->layout = layout;
 
     ivisurf->surface = wl_surface;
-    ivisurf->surface_destroy_listener.notify =
-        westonsurface_destroy_from_ivisurface;
-    wl_resource_add_destroy_listener(wl_surface->resource,
-                                     &ivisurf->surface_destroy_listener);
 
     struct weston_view *tmpview = weston_view_create(wl_surface);
     if (tmpview == NULL) {
         weston_log("fails to allocate memory\n");
     }
 
-    ivisurf->surface->width_from_buffer  = 0;
-    ivisurf->surface->height_from_buffer = 0;
+    if (wl_surface->resource != NULL) {
+        ivisurf->surface_destroy_listener.notify =
+            westonsurface_destroy_from_ivisurface;
+        wl_resource_add_destroy_listener(wl_surface->resource,
+                                         &ivisurf->surface_destroy_listener);
+
+        ivisurf->surface->width_from_buffer  = 0;
+        ivisurf->surface->height_from_buffer = 0;
+    }
 
     weston_matrix_init(&ivisurf->surface_rotation.matrix);
     weston_matrix_init(&ivisurf->layer_rotation.matrix);
@@ -2874,6 +5970,7 @@ ivi_layout_surfaceCreate(struct weston_surface *wl_surface,
     init_surfaceProperties(&ivisurf->prop);
     ivisurf->pixelformat = IVI_LAYOUT_SURFACE_PIXELFORMAT_RGBA_8888;
     ivisurf->event_mask = 0;
+    wl_list_init(&ivisurf->dirty_link);
 
     ivisurf->pending.prop = ivisurf->prop;
     wl_list_init(&ivisurf->pending.link);
@@ -2882,6 +5979,10 @@ ivi_layout_surfaceCreate(struct weston_surface *wl_surface,
     wl_list_init(&ivisurf->order.list_layer);
 
     wl_list_insert(&layout->list_surface, &ivisurf->link);
+    wl_list_insert(&layout->hash_surface[hash_id(id_surface)],
+                   &ivisurf->hash_link);
+
+    state_restore_surface(layout, ivisurf);
 
     wl_list_for_each(notification,
             &layout->surface_notification.list_create, link) {
@@ -2889,6 +5990,7 @@ ivi_layout_surfaceCreate(struct weston_surface *wl_surface,
             notification->callback(ivisurf, notification->userdata);
         }
     }
+    queue_surface_change(ivisurf, IVI_LAYOUT_CHANGE_EVENT_CREATE, 0);
 
     return ivisurf;
 }
@@ -2897,6 +5999,7 @@ static void
 ivi_layout_initWithCompositor(struct weston_compositor *ec)
 {
     struct ivi_layout *layout = get_instance();
+    int i;
 
     layout->compositor = ec;
 
@@ -2904,6 +6007,19 @@ ivi_layout_initWithCompositor(struct weston_compositor *ec)
     wl_list_init(&layout->list_layer);
     wl_list_init(&layout->list_screen);
 
+    wl_list_init(&layout->list_dirty_surface);
+    wl_list_init(&layout->list_dirty_layer);
+    wl_list_init(&layout->list_transition);
+
+    for (i = 0; i < IVI_LAYOUT_OPTIMIZATION_COUNT; i++) {
+        layout->optimization_mode[i] = IVI_LAYOUT_OPTIMIZATION_MODE_HEURISTIC;
+    }
+
+    for (i = 0; i < IVI_LAYOUT_HASH_SIZE; i++) {
+        wl_list_init(&layout->hash_surface[i]);
+        wl_list_init(&layout->hash_layer[i]);
+    }
+
     wl_list_init(&layout->layer_notification.list_create);
     wl_list_init(&layout->layer_notification.list_remove);
 
@@ -2911,15 +6027,26 @@ ivi_layout_initWithCompositor(struct weston_compositor *ec)
     wl_list_init(&layout->surface_notification.list_remove);
     wl_list_init(&layout->surface_notification.list_configure);
 
-    /* Add layout_layer at the last of weston_compositor.layer_list */
-    weston_layer_init(&layout->layout_layer, ec->layer_list.prev);
+    wl_list_init(&layout->change_set.list_notification);
+    wl_array_init(&layout->change_set.changes);
+    layout->change_set.serial = 1;
+
+    wl_list_init(&layout->list_snapshot);
 
     create_screen(ec);
 
+    weston_compositor_add_debug_binding(ec, KEY_I,
+                                        statistics_binding, layout);
+
     struct weston_config *config = weston_config_parse("weston.ini");
     struct weston_config_section *s =
             weston_config_get_section(config, "ivi-shell", NULL, NULL);
 
+    char *state_path = NULL;
+    weston_config_section_get_string(s, "layout-state", &state_path, NULL);
+    state_init(layout, state_path);
+    free(state_path);
+
     /*A cursor is configured if weston.ini has keys.*/
     char* cursor_theme = NULL;
     weston_config_section_get_string(s, "cursor-theme", &cursor_theme, NULL);
@@ -2936,5 +6063,6 @@ WL_EXPORT struct ivi_layout_interface ivi_layout_interface = {
 	.surfaceConfigure = ivi_layout_surfaceConfigure,
 	.surfaceSetNativeContent = ivi_layout_surfaceSetNativeContent,
 	.surfaceCreate = ivi_layout_surfaceCreate,
+	.surfaceCreatePlaceholder = ivi_layout_surfaceCreatePlaceholder,
 	.initWithCompositor = ivi_layout_initWithCompositor
 };
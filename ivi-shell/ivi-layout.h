@@ -63,6 +63,10 @@ struct ivi_layout_interface {
                                            uint32_t id_surface);
 	struct ivi_layout_surface* (*surfaceCreate)(struct weston_surface *wl_surface,
 							      uint32_t id_surface);
+	struct ivi_layout_surface* (*surfaceCreatePlaceholder)(uint32_t id_surface,
+							       int32_t width,
+							       int32_t height,
+							       uint32_t color);
 	void (*initWithCompositor)(struct weston_compositor *ec);
 };
 
@@ -317,36 +317,52 @@ ivi_shell_setting_create(struct ivi_shell_setting *dest)
 }
 
 /**
- * Initialization of ivi-shell.
+ * Placeholders put on screen for the ids of [ivi-placeholder] sections
+ * until their apps commit a first buffer, so that a starting app shows
+ * up at once.
  */
-static int
-ivi_load_modules(struct weston_compositor *compositor, const char *modules,
-	     int *argc, char *argv[])
+static void
+ivi_create_placeholders(void)
 {
-	const char *p, *end;
-	char buffer[256];
-	int (*module_init)(struct weston_compositor *compositor,
-			   int *argc, char *argv[]);
-
-	if (modules == NULL)
-		return 0;
-
-	p = modules;
-	while (*p) {
-		end = strchrnul(p, ',');
-		snprintf(buffer, sizeof buffer, "%.*s", (int) (end - p), p);
-		module_init = weston_load_module(buffer, "module_init");
-		if (module_init)
-			module_init(compositor, argc, argv);
-		p = end;
-		while (*p == ',')
-			p++;
+    struct weston_config *config = NULL;
+    struct weston_config_section *section = NULL;
+    const char *name = NULL;
+    uint32_t id_surface = 0;
+    uint32_t color = 0;
+    int32_t width = 0;
+    int32_t height = 0;
 
-	}
+    config = weston_config_parse("weston.ini");
+
+    while (weston_config_next_section(config, &section, &name)) {
+        if (0 != strcmp(name, "ivi-placeholder")) {
+            continue;
+        }
+
+        if (weston_config_section_get_uint(section, "surface-id",
+                                           &id_surface, 0) != 0) {
+            weston_log("ivi-shell: ivi-placeholder without surface-id\n");
+            continue;
+        }
+
+        weston_config_section_get_int(section, "width", &width, 0);
+        weston_config_section_get_int(section, "height", &height, 0);
+        weston_config_section_get_uint(section, "color",
+                                       &color, 0xff000000);
+
+        if (ivi_layout->surfaceCreatePlaceholder(id_surface, width, height,
+                                                 color) == NULL) {
+            weston_log("ivi-shell: no placeholder for surface %u\n",
+                       id_surface);
+        }
+    }
 
-	return 0;
+    weston_config_destroy(config);
 }
 
+/**
+ * Initialization of ivi-shell.
+ */
 WL_EXPORT int
 module_init(struct weston_compositor *compositor,
             int *argc, char *argv[])
@@ -403,11 +419,15 @@ module_init(struct weston_compositor *compositor,
     }
 
     /*Call module_init of ivi-modules which are defined in weston.ini*/
-    if (ivi_load_modules(compositor,setting.ivi_module,argc,argv) < 0){
+    if (weston_compositor_load_modules(compositor, setting.ivi_module,
+                                       argc, argv) < 0) {
 	 free(setting.ivi_module);
 	 return -1;
     }
 
+    /* after the modules, so that their create notifications see them */
+    ivi_create_placeholders();
+
     free(setting.ivi_module);
     return 0;
 }
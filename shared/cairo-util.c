@@ -46,95 +46,138 @@ surface_flush_device(cairo_surface_t *surface)
 		cairo_device_flush(device);
 }
 
+/* The shadow blur approximates a gaussian of variance 35.5 (the
+ * 71-tap kernel this used to apply) with three box blurs of widths 11,
+ * 11 and 13.  Each box pass keeps a running sum per channel, so the
+ * cost per pixel doesn't depend on the radius.  Pixels outside the
+ * surface count as transparent; lines are padded by the sum of the
+ * radii so that what an early pass spreads past the edge still feeds
+ * the later ones. */
+static const int blur_box_radius[] = { 5, 5, 6 };
+#define BLUR_PAD 16
+
+static void
+box_blur_line(uint32_t *dst, const uint32_t *src, int n, int r)
+{
+	uint32_t sum[4] = { 0, 0, 0, 0 }, p;
+	uint32_t d = 2 * r + 1, scale = (1 << 24) / d + 1;
+	int j, k;
+
+	for (j = 0; j < r && j < n; j++) {
+		p = src[j];
+		sum[0] += p >> 24;
+		sum[1] += (p >> 16) & 0xff;
+		sum[2] += (p >> 8) & 0xff;
+		sum[3] += p & 0xff;
+	}
+
+	/* sum <= 255 * d, so sum * scale stays below 2^32 */
+	for (j = 0; j < n; j++) {
+		k = j + r;
+		if (k < n) {
+			p = src[k];
+			sum[0] += p >> 24;
+			sum[1] += (p >> 16) & 0xff;
+			sum[2] += (p >> 8) & 0xff;
+			sum[3] += p & 0xff;
+		}
+
+		dst[j] = ((sum[0] * scale) >> 24 << 24) |
+			 ((sum[1] * scale) >> 24 << 16) |
+			 ((sum[2] * scale) >> 24 << 8) |
+			 (sum[3] * scale) >> 24;
+
+		k = j - r;
+		if (k >= 0) {
+			p = src[k];
+			sum[0] -= p >> 24;
+			sum[1] -= (p >> 16) & 0xff;
+			sum[2] -= (p >> 8) & 0xff;
+			sum[3] -= p & 0xff;
+		}
+	}
+}
+
+/* Blurs the n pixels at line + BLUR_PAD in place.  The BLUR_PAD pixels
+ * on either side must be zero on entry; tmp needs as much room as
+ * line. */
+static void
+blur_line(uint32_t *line, uint32_t *tmp, int n)
+{
+	unsigned int i;
+
+	n += 2 * BLUR_PAD;
+	for (i = 0; i < ARRAY_LENGTH(blur_box_radius); i++) {
+		box_blur_line(tmp, line, n, blur_box_radius[i]);
+		memcpy(line, tmp, n * sizeof *line);
+	}
+}
+
 static int
 blur_surface(cairo_surface_t *surface, int margin)
 {
-	int32_t width, height, stride, x, y, z, w;
-	uint8_t *src, *dst;
-	uint32_t *s, *d, a, p;
-	int i, j, k, size, half;
-	uint32_t kernel[71];
-	double f;
-
-	size = ARRAY_LENGTH(kernel);
+	int32_t width, height, stride;
+	uint8_t *src;
+	uint32_t *s, *line, *tmp;
+	int i, j, n;
+
 	width = cairo_image_surface_get_width(surface);
 	height = cairo_image_surface_get_height(surface);
 	stride = cairo_image_surface_get_stride(surface);
 	src = cairo_image_surface_get_data(surface);
 
-	dst = malloc(height * stride);
-	if (dst == NULL)
+	n = (width > height ? width : height) + 2 * BLUR_PAD;
+	line = malloc(2 * n * sizeof *line);
+	if (line == NULL)
 		return -1;
+	tmp = line + n;
 
-	half = size / 2;
-	a = 0;
-	for (i = 0; i < size; i++) {
-		f = (i - half);
-		kernel[i] = exp(- f * f / ARRAY_LENGTH(kernel)) * 10000;
-		a += kernel[i];
-	}
+	cairo_surface_flush(surface);
 
 	for (i = 0; i < height; i++) {
 		s = (uint32_t *) (src + i * stride);
-		d = (uint32_t *) (dst + i * stride);
-		for (j = 0; j < width; j++) {
-			if (margin < j && j < width - margin) {
-				d[j] = s[j];
-				continue;
-			}
-
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (j - half + k < 0 || j - half + k >= width)
-					continue;
-				p = s[j - half + k];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
-			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
-		}
+		memset(line, 0, n * sizeof *line);
+		memcpy(line + BLUR_PAD, s, width * sizeof *s);
+		blur_line(line, tmp, width);
+		for (j = 0; j < width; j++)
+			if (j <= margin || j >= width - margin)
+				s[j] = line[BLUR_PAD + j];
 	}
 
-	for (i = 0; i < height; i++) {
-		s = (uint32_t *) (dst + i * stride);
-		d = (uint32_t *) (src + i * stride);
-		for (j = 0; j < width; j++) {
-			if (margin <= i && i < height - margin) {
-				d[j] = s[j];
+	for (j = 0; j < width; j++) {
+		memset(line, 0, n * sizeof *line);
+		for (i = 0; i < height; i++) {
+			s = (uint32_t *) (src + i * stride);
+			line[BLUR_PAD + i] = s[j];
+		}
+		blur_line(line, tmp, height);
+		for (i = 0; i < height; i++) {
+			if (margin <= i && i < height - margin)
 				continue;
-			}
-
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (i - half + k < 0 || i - half + k >= height)
-					continue;
-				s = (uint32_t *) (dst + (i - half + k) * stride);
-				p = s[j];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
-			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+			s = (uint32_t *) (src + i * stride);
+			s[j] = line[BLUR_PAD + i];
 		}
 	}
 
-	free(dst);
+	free(line);
 	cairo_surface_mark_dirty(surface);
 
 	return 0;
 }
 
+/* Mask with pattern inside a rectangle, on top of whatever clip the
+ * caller set up. */
+static void
+mask_rectangle(cairo_t *cr, cairo_pattern_t *pattern,
+	       int x, int y, int width, int height)
+{
+	cairo_save(cr);
+	cairo_rectangle(cr, x, y, width, height);
+	cairo_clip(cr);
+	cairo_mask(cr, pattern);
+	cairo_restore(cr);
+}
+
 void
 tile_mask(cairo_t *cr, cairo_surface_t *surface,
 	  int x, int y, int width, int height, int margin, int top_margin)
@@ -161,13 +204,10 @@ tile_mask(cairo_t *cr, cairo_surface_t *surface,
 		else
 			vmargin = top_margin;
 
-		cairo_reset_clip(cr);
-		cairo_rectangle(cr,
-				x + fx * (width - margin),
-				y + fy * (height - vmargin),
-				margin, vmargin);
-		cairo_clip (cr);
-		cairo_mask(cr, pattern);
+		mask_rectangle(cr, pattern,
+			       x + fx * (width - margin),
+			       y + fy * (height - vmargin),
+			       margin, vmargin);
 	}
 
 	/* Top stretch */
@@ -175,47 +215,28 @@ tile_mask(cairo_t *cr, cairo_surface_t *surface,
 	cairo_matrix_scale(&matrix, 8.0 / width, 1);
 	cairo_matrix_translate(&matrix, -x - width / 2, -y);
 	cairo_pattern_set_matrix(pattern, &matrix);
-	cairo_rectangle(cr, x + margin, y, width - 2 * margin, margin);
-
-	cairo_reset_clip(cr);
-	cairo_rectangle(cr,
-			x + margin,
-			y,
-			width - 2 * margin, margin);
-	cairo_clip (cr);
-	cairo_mask(cr, pattern);
+	mask_rectangle(cr, pattern, x + margin, y, width - 2 * margin, margin);
 
 	/* Bottom stretch */
 	cairo_matrix_translate(&matrix, 0, -height + 128);
 	cairo_pattern_set_matrix(pattern, &matrix);
-
-	cairo_reset_clip(cr);
-	cairo_rectangle(cr, x + margin, y + height - margin,
-			width - 2 * margin, margin);
-	cairo_clip (cr);
-	cairo_mask(cr, pattern);
+	mask_rectangle(cr, pattern, x + margin, y + height - margin,
+		       width - 2 * margin, margin);
 
 	/* Left stretch */
 	cairo_matrix_init_translate(&matrix, 0, 60);
 	cairo_matrix_scale(&matrix, 1, 8.0 / height);
 	cairo_matrix_translate(&matrix, -x, -y - height / 2);
 	cairo_pattern_set_matrix(pattern, &matrix);
-	cairo_reset_clip(cr);
-	cairo_rectangle(cr, x, y + margin, margin, height - 2 * margin);
-	cairo_clip (cr);
-	cairo_mask(cr, pattern);
+	mask_rectangle(cr, pattern, x, y + margin, margin, height - 2 * margin);
 
 	/* Right stretch */
 	cairo_matrix_translate(&matrix, -width + 128, 0);
 	cairo_pattern_set_matrix(pattern, &matrix);
-	cairo_rectangle(cr, x + width - margin, y + margin,
-			margin, height - 2 * margin);
-	cairo_reset_clip(cr);
-	cairo_clip (cr);
-	cairo_mask(cr, pattern);
+	mask_rectangle(cr, pattern, x + width - margin, y + margin,
+		       margin, height - 2 * margin);
 
 	cairo_pattern_destroy(pattern);
-	cairo_reset_clip(cr);
 }
 
 void
@@ -299,14 +320,24 @@ rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius)
 	cairo_close_path(cr);
 }
 
+static const cairo_user_data_key_t image_key;
+
+static void
+image_destroy_func(void *data)
+{
+	pixman_image_unref(data);
+}
+
 cairo_surface_t *
-load_cairo_surface(const char *filename)
+load_cairo_surface_scaled(const char *filename, int width, int height,
+			  uint32_t flags)
 {
 	pixman_image_t *image;
-	int width, height, stride;
+	cairo_surface_t *surface;
+	int stride;
 	void *data;
 
-	image = load_image(filename);
+	image = load_image_scaled(filename, width, height, flags);
 	if (image == NULL) {
 		return NULL;
 	}
@@ -316,8 +347,24 @@ load_cairo_surface(const char *filename)
 	height = pixman_image_get_height(image);
 	stride = pixman_image_get_stride(image);
 
-	return cairo_image_surface_create_for_data(data, CAIRO_FORMAT_ARGB32,
-						   width, height, stride);
+	surface = cairo_image_surface_create_for_data(data,
+						      CAIRO_FORMAT_ARGB32,
+						      width, height, stride);
+
+	/* The pixels may be mapped from the image cache, so they go away
+	 * with the image rather than with a free() of the data */
+	if (cairo_surface_set_user_data(surface, &image_key, image,
+					image_destroy_func) !=
+	    CAIRO_STATUS_SUCCESS)
+		pixman_image_unref(image);
+
+	return surface;
+}
+
+cairo_surface_t *
+load_cairo_surface(const char *filename)
+{
+	return load_cairo_surface_scaled(filename, 0, 0, 0);
 }
 
 void
@@ -336,6 +383,57 @@ theme_set_background_source(struct theme *t, cairo_t *cr, uint32_t flags)
 	}
 }
 
+/* The blurred shadow tile only depends on the frame radius, so every
+ * theme in the process shares it.  The cache doesn't hold a reference;
+ * it's cleared when the last theme using the tile lets go of it. */
+static struct {
+	cairo_surface_t *surface;
+	int radius;
+} shadow_cache;
+
+static const cairo_user_data_key_t shadow_key;
+
+static void
+shadow_cache_clear(void *data)
+{
+	if (shadow_cache.surface == data)
+		shadow_cache.surface = NULL;
+}
+
+static cairo_surface_t *
+theme_get_shadow(int radius)
+{
+	cairo_surface_t *shadow;
+	cairo_t *cr;
+	cairo_status_t status;
+
+	if (shadow_cache.surface && shadow_cache.radius == radius)
+		return cairo_surface_reference(shadow_cache.surface);
+
+	shadow = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 128, 128);
+	cr = cairo_create(shadow);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_rgba(cr, 0, 0, 0, 1);
+	rounded_rect(cr, 32, 32, 96, 96, radius);
+	cairo_fill(cr);
+	status = cairo_status(cr);
+	cairo_destroy(cr);
+
+	if (status != CAIRO_STATUS_SUCCESS || blur_surface(shadow, 64) == -1) {
+		cairo_surface_destroy(shadow);
+		return NULL;
+	}
+
+	if (cairo_surface_set_user_data(shadow, &shadow_key, shadow,
+					shadow_cache_clear) ==
+	    CAIRO_STATUS_SUCCESS) {
+		shadow_cache.surface = shadow;
+		shadow_cache.radius = radius;
+	}
+
+	return shadow;
+}
+
 struct theme *
 theme_create(void)
 {
@@ -350,17 +448,9 @@ theme_create(void)
 	t->width = 6;
 	t->titlebar_height = 27;
 	t->frame_radius = 3;
-	t->shadow = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
-	cr = cairo_create(t->shadow);
-	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	cairo_set_source_rgba(cr, 0, 0, 0, 1);
-	rounded_rect(cr, 32, 32, 96, 96, t->frame_radius);
-	cairo_fill(cr);
-	if (cairo_status (cr) != CAIRO_STATUS_SUCCESS)
-		goto err_shadow;
-	cairo_destroy(cr);
-	if (blur_surface(t->shadow, 64) == -1)
-		goto err_shadow;
+	t->shadow = theme_get_shadow(t->frame_radius);
+	if (t->shadow == NULL)
+		goto err_free;
 
 	t->active_frame =
 		cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
@@ -397,6 +487,7 @@ theme_create(void)
 	cairo_surface_destroy(t->active_frame);
  err_shadow:
 	cairo_surface_destroy(t->shadow);
+ err_free:
 	free(t);
 	return NULL;
 }
@@ -410,15 +501,136 @@ theme_destroy(struct theme *t)
 	free(t);
 }
 
+static void
+theme_set_title_font(cairo_t *cr)
+{
+	cairo_select_font_face(cr, "sans",
+			       CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, 14);
+}
+
+static void
+theme_show_title(cairo_t *cr, const char *title, int x, int y,
+		 uint32_t flags)
+{
+	if (flags & THEME_FRAME_ACTIVE) {
+		cairo_move_to(cr, x + 1, y  + 1);
+		cairo_set_source_rgb(cr, 1, 1, 1);
+		cairo_show_text(cr, title);
+		cairo_move_to(cr, x, y);
+		cairo_set_source_rgb(cr, 0, 0, 0);
+		cairo_show_text(cr, title);
+	} else {
+		cairo_move_to(cr, x, y);
+		cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
+		cairo_show_text(cr, title);
+	}
+}
+
+void
+theme_title_cache_release(struct theme_title_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (cache->text[i].surface)
+			cairo_surface_destroy(cache->text[i].surface);
+		cache->text[i].surface = NULL;
+	}
+
+	free(cache->title);
+	cache->title = NULL;
+}
+
+/* Measures the title, when it changed, with the font set on cr. */
+static int
+theme_title_cache_update(struct theme_title_cache *cache,
+			 cairo_t *cr, const char *title)
+{
+	cairo_font_extents_t font_extents;
+
+	if (cache->title && strcmp(cache->title, title) == 0)
+		return 0;
+
+	theme_title_cache_release(cache);
+	cache->title = strdup(title);
+	if (!cache->title)
+		return -1;
+
+	cairo_text_extents(cr, title, &cache->extents);
+	cairo_font_extents(cr, &font_extents);
+	cache->ascent = font_extents.ascent;
+	cache->descent = font_extents.descent;
+
+	return 0;
+}
+
+/* Renders the title in one focus state into a surface just covering
+ * its ink, shadow included, unless that's already there. */
+static cairo_surface_t *
+theme_title_cache_get_text(struct theme_title_cache *cache,
+			   uint32_t flags, int *x, int *y)
+{
+	int active = !!(flags & THEME_FRAME_ACTIVE);
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	int width, height;
+
+	if (!cache->text[active].surface) {
+		cache->text[active].x = 1 - floor(cache->extents.x_bearing);
+		cache->text[active].y = 1 - floor(cache->extents.y_bearing);
+		width = ceil(cache->extents.width) + 3;
+		height = ceil(cache->extents.height) + 3;
+
+		surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						     width, height);
+		cr = cairo_create(surface);
+		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+		theme_set_title_font(cr);
+		theme_show_title(cr, cache->title,
+				 cache->text[active].x, cache->text[active].y,
+				 flags);
+		cairo_destroy(cr);
+
+		if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy(surface);
+			return NULL;
+		}
+
+		cache->text[active].surface = surface;
+	}
+
+	*x = cache->text[active].x;
+	*y = cache->text[active].y;
+
+	return cache->text[active].surface;
+}
+
 void
 theme_render_frame(struct theme *t,
 		   cairo_t *cr, int width, int height,
 		   const char *title, uint32_t flags)
+{
+	theme_render_frame_cached(t, cr, width, height, title, flags, NULL);
+}
+
+/*
+ * Like theme_render_frame(), but takes the title text from the cache,
+ * which is only re-rendered when the title changes.  The frame pieces
+ * themselves are tiled from the theme's pre-rendered surfaces either
+ * way.
+ */
+void
+theme_render_frame_cached(struct theme *t,
+			  cairo_t *cr, int width, int height,
+			  const char *title, uint32_t flags,
+			  struct theme_title_cache *cache)
 {
 	cairo_text_extents_t extents;
 	cairo_font_extents_t font_extents;
-	cairo_surface_t *source;
-	int x, y, margin, top_margin;
+	cairo_surface_t *source, *text;
+	int x, y, margin, top_margin, text_x, text_y;
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_set_source_rgba(cr, 0, 0, 0, 0);
@@ -456,29 +668,34 @@ theme_render_frame(struct theme *t,
 		cairo_clip(cr);
 
 		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-		cairo_select_font_face(cr, "sans",
-				       CAIRO_FONT_SLANT_NORMAL,
-				       CAIRO_FONT_WEIGHT_BOLD);
-		cairo_set_font_size(cr, 14);
-		cairo_text_extents(cr, title, &extents);
-		cairo_font_extents (cr, &font_extents);
-		x = (width - extents.width) / 2;
-		y = margin +
-			(t->titlebar_height -
-			 font_extents.ascent - font_extents.descent) / 2 +
-			font_extents.ascent;
-
-		if (flags & THEME_FRAME_ACTIVE) {
-			cairo_move_to(cr, x + 1, y  + 1);
-			cairo_set_source_rgb(cr, 1, 1, 1);
-			cairo_show_text(cr, title);
-			cairo_move_to(cr, x, y);
-			cairo_set_source_rgb(cr, 0, 0, 0);
-			cairo_show_text(cr, title);
+		theme_set_title_font(cr);
+
+		text = NULL;
+		if (cache && theme_title_cache_update(cache, cr, title) == 0)
+			text = theme_title_cache_get_text(cache, flags,
+							  &text_x, &text_y);
+
+		if (text) {
+			x = (width - cache->extents.width) / 2;
+			y = margin +
+				(t->titlebar_height -
+				 cache->ascent - cache->descent) / 2 +
+				cache->ascent;
+
+			cairo_set_source_surface(cr, text,
+						 x - text_x, y - text_y);
+			cairo_paint(cr);
 		} else {
-			cairo_move_to(cr, x, y);
-			cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
-			cairo_show_text(cr, title);
+			cairo_text_extents(cr, title, &extents);
+			cairo_font_extents (cr, &font_extents);
+			x = (width - extents.width) / 2;
+			y = margin +
+				(t->titlebar_height -
+				 font_extents.ascent -
+				 font_extents.descent) / 2 +
+				font_extents.ascent;
+
+			theme_show_title(cr, title, x, y, flags);
 		}
 	}
 }
@@ -43,6 +43,10 @@ rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius);
 cairo_surface_t *
 load_cairo_surface(const char *filename);
 
+cairo_surface_t *
+load_cairo_surface_scaled(const char *filename, int width, int height,
+			  uint32_t flags);
+
 struct theme {
 	cairo_surface_t *active_frame;
 	cairo_surface_t *inactive_frame;
@@ -64,12 +68,31 @@ enum {
 	THEME_FRAME_NO_TITLE = 4
 };
 
+/* The title text as last rendered for a frame, once per focus state,
+ * so that repaints only composite it until the title changes. */
+struct theme_title_cache {
+	char *title;
+	cairo_text_extents_t extents;
+	double ascent, descent;
+	struct {
+		cairo_surface_t *surface;
+		int x, y;	/* pen position in the surface */
+	} text[2];		/* inactive, active */
+};
+
 void
 theme_set_background_source(struct theme *t, cairo_t *cr, uint32_t flags);
 void
 theme_render_frame(struct theme *t, 
 		   cairo_t *cr, int width, int height,
 		   const char *title, uint32_t flags);
+void
+theme_render_frame_cached(struct theme *t,
+			  cairo_t *cr, int width, int height,
+			  const char *title, uint32_t flags,
+			  struct theme_title_cache *cache);
+void
+theme_title_cache_release(struct theme_title_cache *cache);
 
 enum theme_location {
 	THEME_LOCATION_INTERIOR = 0,
@@ -45,19 +45,63 @@ struct weston_config_entry {
 	char *key;
 	char *value;
 	struct wl_list link;
+	struct weston_config_section *section;
+	struct weston_config_entry *key_next;
+	struct weston_config_entry *value_next;
 };
 
 struct weston_config_section {
 	char *name;
 	struct wl_list entry_list;
 	struct wl_list link;
+	struct weston_config_entry **key_index;
+	uint32_t key_index_mask;
+	struct weston_config_section *name_next;
 };
 
+/* Generated configs can have hundreds of sections that every module
+ * searches at startup, so weston_config_parse() indexes sections by
+ * name and by name, key and value, and every section's entries by key.
+ * The chains keep file order, so lookups return the first match, as a
+ * scan of the lists would. */
 struct weston_config {
 	struct wl_list section_list;
 	char path[PATH_MAX];
+	struct weston_config_section **name_index;
+	struct weston_config_entry **value_index;
+	uint32_t index_mask;
 };
 
+/* FNV-1a over the strings, with their terminators, so that "ab", "c"
+ * and "a", "bc" end up apart */
+static uint32_t
+hash_strings(const char *a, const char *b, const char *c)
+{
+	const char *strings[] = { a, b, c };
+	uint32_t hash = 2166136261u;
+	const char *p;
+	unsigned int i;
+
+	for (i = 0; i < 3 && strings[i]; i++) {
+		for (p = strings[i]; *p; p++)
+			hash = (hash ^ (unsigned char) *p) * 16777619u;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static uint32_t
+index_mask_for(int count)
+{
+	uint32_t size = 1;
+
+	while (size < (uint32_t) count)
+		size *= 2;
+
+	return size - 1;
+}
+
 static int
 open_config_file(struct weston_config *c, const char *name)
 {
@@ -121,9 +165,12 @@ config_section_get_entry(struct weston_config_section *section,
 {
 	struct weston_config_entry *e;
 
-	if (section == NULL)
+	if (section == NULL || section->key_index == NULL)
 		return NULL;
-	wl_list_for_each(e, &section->entry_list, link)
+
+	e = section->key_index[hash_strings(key, NULL, NULL) &
+			       section->key_index_mask];
+	for (; e; e = e->key_next)
 		if (strcmp(e->key, key) == 0)
 			return e;
 
@@ -137,19 +184,29 @@ weston_config_get_section(struct weston_config *config, const char *section,
 {
 	struct weston_config_section *s;
 	struct weston_config_entry *e;
+	uint32_t hash;
+
+	if (config == NULL || config->name_index == NULL)
+		return NULL;
+
+	if (key == NULL) {
+		hash = hash_strings(section, NULL, NULL);
+		s = config->name_index[hash & config->index_mask];
+		for (; s; s = s->name_next)
+			if (strcmp(s->name, section) == 0)
+				return s;
 
-	if (config == NULL)
 		return NULL;
-	wl_list_for_each(s, &config->section_list, link) {
-		if (strcmp(s->name, section) != 0)
-			continue;
-		if (key == NULL)
-			return s;
-		e = config_section_get_entry(s, key);
-		if (e && strcmp(e->value, value) == 0)
-			return s;
 	}
 
+	hash = hash_strings(section, key, value);
+	e = config->value_index[hash & config->index_mask];
+	for (; e; e = e->value_next)
+		if (strcmp(e->section->name, section) == 0 &&
+		    strcmp(e->key, key) == 0 &&
+		    strcmp(e->value, value) == 0)
+			return e->section;
+
 	return NULL;
 }
 
@@ -289,6 +346,7 @@ config_add_section(struct weston_config *config, const char *name)
 
 	section = malloc(sizeof *section);
 	section->name = strdup(name);
+	section->key_index = NULL;
 	wl_list_init(&section->entry_list);
 	wl_list_insert(config->section_list.prev, &section->link);
 
@@ -304,11 +362,84 @@ section_add_entry(struct weston_config_section *section,
 	entry = malloc(sizeof *entry);
 	entry->key = strdup(key);
 	entry->value = strdup(value);
+	entry->section = section;
 	wl_list_insert(section->entry_list.prev, &entry->link);
 
 	return entry;
 }
 
+static int
+section_build_index(struct weston_config_section *section)
+{
+	struct weston_config_entry *e, **head;
+	int count;
+
+	count = wl_list_length(&section->entry_list);
+	if (count == 0)
+		return 0;
+
+	section->key_index_mask = index_mask_for(count);
+	section->key_index = calloc(section->key_index_mask + 1,
+				    sizeof section->key_index[0]);
+	if (section->key_index == NULL)
+		return -1;
+
+	/* Inserting from the last entry leaves each chain in file order,
+	 * so of repeated keys the first one is found */
+	wl_list_for_each_reverse(e, &section->entry_list, link) {
+		head = &section->key_index[hash_strings(e->key, NULL, NULL) &
+					   section->key_index_mask];
+		e->key_next = *head;
+		*head = e;
+	}
+
+	return 0;
+}
+
+static int
+config_build_index(struct weston_config *config)
+{
+	struct weston_config_section *s, **section_head;
+	struct weston_config_entry *e, **entry_head;
+	uint32_t hash;
+	int count = 0;
+
+	wl_list_for_each(s, &config->section_list, link) {
+		if (section_build_index(s) < 0)
+			return -1;
+		count += 1 + wl_list_length(&s->entry_list);
+	}
+
+	config->index_mask = index_mask_for(count);
+	config->name_index = calloc(config->index_mask + 1,
+				    sizeof config->name_index[0]);
+	config->value_index = calloc(config->index_mask + 1,
+				     sizeof config->value_index[0]);
+	if (config->name_index == NULL || config->value_index == NULL)
+		return -1;
+
+	wl_list_for_each_reverse(s, &config->section_list, link) {
+		hash = hash_strings(s->name, NULL, NULL);
+		section_head = &config->name_index[hash & config->index_mask];
+		s->name_next = *section_head;
+		*section_head = s;
+
+		/* A section matches on the value of the first of its
+		 * repeated keys only */
+		wl_list_for_each_reverse(e, &s->entry_list, link) {
+			if (config_section_get_entry(s, e->key) != e)
+				continue;
+			hash = hash_strings(s->name, e->key, e->value);
+			entry_head = &config->value_index[hash &
+							  config->index_mask];
+			e->value_next = *entry_head;
+			*entry_head = e;
+		}
+	}
+
+	return 0;
+}
+
 struct weston_config *
 weston_config_parse(const char *name)
 {
@@ -323,6 +454,8 @@ weston_config_parse(const char *name)
 		return NULL;
 
 	wl_list_init(&config->section_list);
+	config->name_index = NULL;
+	config->value_index = NULL;
 
 	fd = open_config_file(config, name);
 	if (fd == -1) {
@@ -379,6 +512,11 @@ weston_config_parse(const char *name)
 
 	fclose(fp);
 
+	if (config_build_index(config) < 0) {
+		weston_config_destroy(config);
+		return NULL;
+	}
+
 	return config;
 }
 
@@ -426,9 +564,12 @@ weston_config_destroy(struct weston_config *config)
 			free(e->value);
 			free(e);
 		}
+		free(s->key_index);
 		free(s->name);
 		free(s);
 	}
 
+	free(config->name_index);
+	free(config->value_index);
 	free(config);
 }
@@ -99,6 +99,8 @@ struct frame {
 	struct wl_list buttons;
 	struct wl_list pointers;
 	struct wl_list touches;
+
+	struct theme_title_cache title_cache;
 };
 
 static struct frame_button *
@@ -293,6 +295,7 @@ frame_destroy(struct frame *frame)
 	wl_list_for_each_safe(pointer, next_pointer, &frame->pointers, link)
 		frame_pointer_destroy(pointer);
 
+	theme_title_cache_release(&frame->title_cache);
 	free(frame->title);
 	free(frame);
 }
@@ -851,8 +854,9 @@ frame_repaint(struct frame *frame, cairo_t *cr)
 		flags |= THEME_FRAME_ACTIVE;
 
 	cairo_save(cr);
-	theme_render_frame(frame->theme, cr, frame->width, frame->height,
-			   frame->title, flags);
+	theme_render_frame_cached(frame->theme, cr,
+				  frame->width, frame->height,
+				  frame->title, flags, &frame->title_cache);
 	cairo_restore(cr);
 
 	wl_list_for_each(button, &frame->buttons, link)
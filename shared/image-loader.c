@@ -26,11 +26,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <jpeglib.h>
 #include <png.h>
 #include <pixman.h>
 
 #include "image-loader.h"
+#include "pixel-convert.h"
 
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
 
@@ -44,21 +50,6 @@ stride_for_width(int width)
 	return width * 4;
 }
 
-static void
-swizzle_row(JSAMPLE *row, JDIMENSION width)
-{
-	JSAMPLE *s;
-	uint32_t *d;
-
-	s = row + (width - 1) * 3;
-	d = (uint32_t *) (row + (width - 1) * 4);
-	while (s >= row) {
-		*d = 0xff000000 | (s[0] << 16) | (s[1] << 8) | (s[2] << 0);
-		s -= 3;
-		d--;
-	}
-}
-
 static void
 error_exit(j_common_ptr cinfo)
 {
@@ -71,8 +62,29 @@ pixman_image_destroy_func(pixman_image_t *image, void *data)
 	free(data);
 }
 
+/* Picks the largest DCT scaling that keeps the image at least
+ * width x height; scaling inside the IDCT skips most of the work of a
+ * full size decode. */
+static unsigned int
+jpeg_scale_denom(struct jpeg_decompress_struct *cinfo, int width, int height)
+{
+	unsigned int denom;
+
+	if (width <= 0 || height <= 0)
+		return 1;
+
+	for (denom = 8; denom > 1; denom /= 2)
+		if ((cinfo->image_width + denom - 1) / denom >=
+		    (unsigned int) width &&
+		    (cinfo->image_height + denom - 1) / denom >=
+		    (unsigned int) height)
+			break;
+
+	return denom;
+}
+
 static pixman_image_t *
-load_jpeg(FILE *fp)
+load_jpeg(FILE *fp, int width, int height)
 {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
@@ -94,7 +106,16 @@ load_jpeg(FILE *fp)
 
 	jpeg_read_header(&cinfo, TRUE);
 
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = jpeg_scale_denom(&cinfo, width, height);
+
+#if defined(JCS_EXTENSIONS) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	/* libjpeg-turbo can write ARGB32 directly, with its own vector
+	 * color conversion, so there is nothing left to expand. */
+	cinfo.out_color_space = JCS_EXT_BGRA;
+#else
 	cinfo.out_color_space = JCS_RGB;
+#endif
 	jpeg_start_decompress(&cinfo);
 
 	stride = cinfo.output_width * 4;
@@ -110,8 +131,11 @@ load_jpeg(FILE *fp)
 			rows[i] = data + (first + i) * stride;
 
 		jpeg_read_scanlines(&cinfo, rows, ARRAY_LENGTH(rows));
+		if (cinfo.out_color_space != JCS_RGB)
+			continue;
+
 		for (i = 0; first + i < cinfo.output_scanline; i++)
-			swizzle_row(rows[i], cinfo.output_width);
+			pixel_expand_rgb(rows[i], cinfo.output_width);
 	}
 
 	jpeg_finish_decompress(&cinfo);
@@ -129,43 +153,12 @@ load_jpeg(FILE *fp)
 	return pixman_image;
 }
 
-static inline int
-multiply_alpha(int alpha, int color)
-{
-    int temp = (alpha * color) + 0x80;
-
-    return ((temp + (temp >> 8)) >> 8);
-}
-
 static void
 premultiply_data(png_structp   png,
 		 png_row_infop row_info,
 		 png_bytep     data)
 {
-    unsigned int i;
-    png_bytep p;
-
-    for (i = 0, p = data; i < row_info->rowbytes; i += 4, p += 4) {
-	png_byte  alpha = p[3];
-	uint32_t w;
-
-	if (alpha == 0) {
-		w = 0;
-	} else {
-		png_byte red   = p[0];
-		png_byte green = p[1];
-		png_byte blue  = p[2];
-
-		if (alpha != 0xff) {
-			red   = multiply_alpha(alpha, red);
-			green = multiply_alpha(alpha, green);
-			blue  = multiply_alpha(alpha, blue);
-		}
-		w = (alpha << 24) | (red << 16) | (green << 8) | (blue << 0);
-	}
-
-	* (uint32_t *) p = w;
-    }
+	pixel_premultiply_rgba(data, row_info->rowbytes);
 }
 
 static void
@@ -184,7 +177,7 @@ png_error_callback(png_structp png, png_const_charp error_msg)
 }
 
 static pixman_image_t *
-load_png(FILE *fp)
+load_png(FILE *fp, int target_width, int target_height)
 {
 	png_struct *png;
 	png_info *info;
@@ -286,7 +279,7 @@ load_png(FILE *fp)
 #ifdef HAVE_WEBP
 
 static pixman_image_t *
-load_webp(FILE *fp)
+load_webp(FILE *fp, int width, int height)
 {
 	WebPDecoderConfig config;
 	uint8_t buffer[16 * 1024];
@@ -352,10 +345,241 @@ load_webp(FILE *fp)
 #endif
 
 
+/* Halves an image with a 2x2 box filter.  The pixels are premultiplied,
+ * so averaging each channel is exact. */
+static pixman_image_t *
+downsample_half(pixman_image_t *image)
+{
+	pixman_image_t *half;
+	uint32_t *src, *dst, *s0, *s1, p[4], c;
+	int width, height, src_stride, dst_stride, x, y, i, shift;
+
+	width = pixman_image_get_width(image) / 2;
+	height = pixman_image_get_height(image) / 2;
+	src_stride = pixman_image_get_stride(image) / 4;
+	src = pixman_image_get_data(image);
+
+	dst_stride = stride_for_width(width);
+	dst = malloc(dst_stride * height);
+	if (!dst)
+		return NULL;
+	dst_stride /= 4;
+
+	for (y = 0; y < height; y++) {
+		s0 = src + y * 2 * src_stride;
+		s1 = s0 + src_stride;
+		for (x = 0; x < width; x++) {
+			p[0] = s0[x * 2];
+			p[1] = s0[x * 2 + 1];
+			p[2] = s1[x * 2];
+			p[3] = s1[x * 2 + 1];
+
+			c = 0;
+			for (shift = 0; shift < 32; shift += 8) {
+				uint32_t sum = 2;
+
+				for (i = 0; i < 4; i++)
+					sum += (p[i] >> shift) & 0xff;
+				c |= (sum / 4) << shift;
+			}
+			dst[y * dst_stride + x] = c;
+		}
+	}
+
+	half = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height,
+					dst, dst_stride * 4);
+	if (!half) {
+		free(dst);
+		return NULL;
+	}
+
+	pixman_image_set_destroy_function(half,
+				pixman_image_destroy_func, dst);
+
+	return half;
+}
+
+/*
+ * Decoded images are cached in $XDG_CACHE_HOME/weston, one file per
+ * source file and target size.  A cache file is a text header, keyed on
+ * the path, size and modification time of the source, padded to a page
+ * so the premultiplied ARGB32 pixels after it can be mapped in place.
+ */
+#define IMAGE_CACHE_MAGIC "weston-image-cache 1"
+#define IMAGE_CACHE_HEADER_SIZE 4096
+
+struct cache_mapping {
+	void *data;
+	size_t size;
+};
+
+static char *
+image_cache_key(const char *filename, int width, int height)
+{
+	struct stat st;
+	char *key;
+
+	if (stat(filename, &st) < 0)
+		return NULL;
+
+	if (asprintf(&key, "%s %s|%lld|%ld|%dx%d\n", IMAGE_CACHE_MAGIC,
+		     filename, (long long) st.st_size, (long) st.st_mtime,
+		     width, height) < 0)
+		return NULL;
+
+	if (strlen(key) + 32 > IMAGE_CACHE_HEADER_SIZE) {
+		free(key);
+		return NULL;
+	}
+
+	return key;
+}
+
+static char *
+image_cache_path(const char *key)
+{
+	const char *dir, *home;
+	char *weston_dir, *path;
+	uint32_t hash = 2166136261u;
+	const char *p;
+	int len;
+
+	/* FNV-1a, only to keep different images in different files */
+	for (p = key; *p; p++)
+		hash = (hash ^ (unsigned char) *p) * 16777619u;
+
+	dir = getenv("XDG_CACHE_HOME");
+	home = getenv("HOME");
+	if (dir)
+		len = asprintf(&weston_dir, "%s/weston", dir);
+	else if (home)
+		len = asprintf(&weston_dir, "%s/.cache/weston", home);
+	else
+		return NULL;
+	if (len < 0)
+		return NULL;
+
+	if (mkdir(weston_dir, 0700) < 0 && errno != EEXIST) {
+		free(weston_dir);
+		return NULL;
+	}
+
+	len = asprintf(&path, "%s/image-%08x.argb", weston_dir, hash);
+	free(weston_dir);
+
+	return len < 0 ? NULL : path;
+}
+
+static void
+cache_mapping_destroy_func(pixman_image_t *image, void *data)
+{
+	struct cache_mapping *mapping = data;
+
+	munmap(mapping->data, mapping->size);
+	free(mapping);
+}
+
+static pixman_image_t *
+image_cache_load(const char *path, const char *key)
+{
+	struct cache_mapping *mapping;
+	pixman_image_t *image;
+	size_t key_len = strlen(key);
+	int fd, width, height, stride;
+	struct stat st;
+	char *header;
+	void *data;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < IMAGE_CACHE_HEADER_SIZE) {
+		close(fd);
+		return NULL;
+	}
+
+	/* Private and writable, so the pixels can be handed to anything
+	 * that expects a malloc'ed image, and the file never changes. */
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	header = data;
+	if (memcmp(header, key, key_len) != 0 ||
+	    sscanf(header + key_len, "%d %d %d", &width, &height, &stride) != 3 ||
+	    width <= 0 || height <= 0 || stride < stride_for_width(width) ||
+	    st.st_size != IMAGE_CACHE_HEADER_SIZE + (off_t) stride * height) {
+		munmap(data, st.st_size);
+		return NULL;
+	}
+
+	mapping = malloc(sizeof *mapping);
+	if (!mapping) {
+		munmap(data, st.st_size);
+		return NULL;
+	}
+	mapping->data = data;
+	mapping->size = st.st_size;
+
+	image = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height,
+			(uint32_t *) (header + IMAGE_CACHE_HEADER_SIZE),
+			stride);
+	if (!image) {
+		cache_mapping_destroy_func(NULL, mapping);
+		return NULL;
+	}
+
+	pixman_image_set_destroy_function(image,
+				cache_mapping_destroy_func, mapping);
+
+	return image;
+}
+
+static void
+image_cache_store(pixman_image_t *image, const char *path, const char *key)
+{
+	char header[IMAGE_CACHE_HEADER_SIZE];
+	int width, height, stride, len;
+	char *tmp;
+	FILE *fp;
+	int ret;
+
+	width = pixman_image_get_width(image);
+	height = pixman_image_get_height(image);
+	stride = pixman_image_get_stride(image);
+
+	memset(header, 0, sizeof header);
+	len = snprintf(header, sizeof header, "%s%d %d %d\n",
+		       key, width, height, stride);
+	if (len < 0 || len >= (int) sizeof header)
+		return;
+
+	/* Written aside and renamed over, so that a reader never maps
+	 * half an image */
+	if (asprintf(&tmp, "%s.%d", path, (int) getpid()) < 0)
+		return;
+
+	fp = fopen(tmp, "we");
+	if (fp) {
+		ret = fwrite(header, sizeof header, 1, fp) == 1 &&
+			fwrite(pixman_image_get_data(image),
+			       (size_t) stride * height, 1, fp) == 1;
+		if (fclose(fp) == 0 && ret && rename(tmp, path) == 0)
+			tmp[0] = '\0';
+	}
+	if (tmp[0])
+		unlink(tmp);
+
+	free(tmp);
+}
+
 struct image_loader {
 	unsigned char header[4];
 	int header_size;
-	pixman_image_t *(*load)(FILE *fp);
+	pixman_image_t *(*load)(FILE *fp, int width, int height);
 };
 
 static const struct image_loader loaders[] = {
@@ -366,10 +590,10 @@ static const struct image_loader loaders[] = {
 #endif
 };
 
-pixman_image_t *
-load_image(const char *filename)
+static pixman_image_t *
+decode_image(const char *filename, int width, int height)
 {
-	pixman_image_t *image;
+	pixman_image_t *image, *half;
 	unsigned char header[4];
 	FILE *fp;
 	unsigned int i;
@@ -387,7 +611,7 @@ load_image(const char *filename)
 	for (i = 0; i < ARRAY_LENGTH(loaders); i++) {
 		if (memcmp(header, loaders[i].header,
 			   loaders[i].header_size) == 0) {
-			image = loaders[i].load(fp);
+			image = loaders[i].load(fp, width, height);
 			break;
 		}
 	}
@@ -401,5 +625,51 @@ load_image(const char *filename)
 		image = NULL;
 	}
 
+	if (!image || width <= 0 || height <= 0)
+		return image;
+
+	/* Whatever the decoder could not scale down by itself is halved
+	 * for as long as the result still covers the target size. */
+	while (pixman_image_get_width(image) / 2 >= width &&
+	       pixman_image_get_height(image) / 2 >= height) {
+		half = downsample_half(image);
+		if (!half)
+			break;
+		pixman_image_unref(image);
+		image = half;
+	}
+
 	return image;
 }
+
+pixman_image_t *
+load_image_scaled(const char *filename, int width, int height,
+		  uint32_t flags)
+{
+	pixman_image_t *image = NULL;
+	char *key = NULL, *path = NULL;
+
+	if (flags & LOAD_IMAGE_CACHE) {
+		key = image_cache_key(filename, width, height);
+		if (key)
+			path = image_cache_path(key);
+		if (path)
+			image = image_cache_load(path, key);
+	}
+
+	if (image == NULL) {
+		image = decode_image(filename, width, height);
+		if (image && path)
+			image_cache_store(image, path, key);
+	}
+	free(path);
+	free(key);
+
+	return image;
+}
+
+pixman_image_t *
+load_image(const char *filename)
+{
+	return load_image_scaled(filename, 0, 0, 0);
+}
@@ -23,9 +23,21 @@
 #ifndef _IMAGE_LOADER_H
 #define _IMAGE_LOADER_H
 
+#include <stdint.h>
 #include <pixman.h>
 
+/* Keep the decoded pixels in $XDG_CACHE_HOME/weston and map them from
+ * there the next time the same, unchanged file is loaded. */
+#define LOAD_IMAGE_CACHE	(1 << 0)
+
 pixman_image_t *
 load_image(const char *filename);
 
+/* Loads an image no smaller than width x height where the source allows,
+ * keeping its aspect ratio; callers still scale the result to the exact
+ * size.  A width or height of 0 loads the image at full size. */
+pixman_image_t *
+load_image_scaled(const char *filename, int width, int height,
+		  uint32_t flags);
+
 #endif
@@ -36,6 +36,12 @@
 
 #include "matrix.h"
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 
 /*
  * Matrices are stored in column-major order, that is the array indices are:
@@ -56,25 +62,177 @@ weston_matrix_init(struct weston_matrix *matrix)
 	memcpy(matrix, &identity, sizeof identity);
 }
 
-/* m <- n * m, that is, m is multiplied on the LEFT. */
-WL_EXPORT void
-weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
+/*
+ * Matrices built only from translations, scales and rotations in the
+ * xy plane, that is without WESTON_MATRIX_TRANSFORM_OTHER in their type,
+ * are affine with z kept apart:
+ *
+ *  a  c  0 tx
+ *  b  d  0 ty
+ *  0  0 sz tz
+ *  0  0  0  1
+ *
+ * That is what nearly every view and output transform is, and the
+ * functions below take shortcuts for it.  Code filling in d[] by hand
+ * must set the type to match.
+ */
+static inline int
+matrix_is_affine(const struct weston_matrix *m)
+{
+	return !(m->type & WESTON_MATRIX_TRANSFORM_OTHER);
+}
+
+/* m <- n * m for affine m and n; the entries that are 0 or 1 in both
+ * stay so in the product and are left alone */
+static void
+multiply_affine(struct weston_matrix *m, const struct weston_matrix *n)
+{
+	float *a = m->d;
+	const float *b = n->d;
+	float a0 = a[0], a1 = a[1], a4 = a[4], a5 = a[5];
+	float a12 = a[12], a13 = a[13];
+
+	a[0] = b[0] * a0 + b[4] * a1;
+	a[1] = b[1] * a0 + b[5] * a1;
+	a[4] = b[0] * a4 + b[4] * a5;
+	a[5] = b[1] * a4 + b[5] * a5;
+	a[12] = b[0] * a12 + b[4] * a13 + b[12];
+	a[13] = b[1] * a12 + b[5] * a13 + b[13];
+	a[14] = b[10] * a[14] + b[14];
+	a[10] = b[10] * a[10];
+}
+
+#if defined(__SSE__)
+
+/* The vector kernels add up the products in the same order as the
+ * scalar loops, so they give the same results. */
+static void
+multiply_general(struct weston_matrix *m, const struct weston_matrix *n)
+{
+	__m128 n0 = _mm_loadu_ps(n->d + 0);
+	__m128 n1 = _mm_loadu_ps(n->d + 4);
+	__m128 n2 = _mm_loadu_ps(n->d + 8);
+	__m128 n3 = _mm_loadu_ps(n->d + 12);
+	__m128 r[4];
+	int c;
+
+	for (c = 0; c < 4; c++) {
+		const float *col = m->d + c * 4;
+
+		r[c] = _mm_mul_ps(n0, _mm_set1_ps(col[0]));
+		r[c] = _mm_add_ps(r[c], _mm_mul_ps(n1, _mm_set1_ps(col[1])));
+		r[c] = _mm_add_ps(r[c], _mm_mul_ps(n2, _mm_set1_ps(col[2])));
+		r[c] = _mm_add_ps(r[c], _mm_mul_ps(n3, _mm_set1_ps(col[3])));
+	}
+
+	for (c = 0; c < 4; c++)
+		_mm_storeu_ps(m->d + c * 4, r[c]);
+}
+
+static void
+transform_general(const struct weston_matrix *matrix, struct weston_vector *v)
+{
+	__m128 t;
+
+	t = _mm_mul_ps(_mm_loadu_ps(matrix->d + 0), _mm_set1_ps(v->f[0]));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(matrix->d + 4),
+				     _mm_set1_ps(v->f[1])));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(matrix->d + 8),
+				     _mm_set1_ps(v->f[2])));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(matrix->d + 12),
+				     _mm_set1_ps(v->f[3])));
+
+	_mm_storeu_ps(v->f, t);
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+/* Separate multiplies and adds rather than vmla, which may be fused and
+ * round differently from the scalar loops. */
+static void
+multiply_general(struct weston_matrix *m, const struct weston_matrix *n)
 {
-	struct weston_matrix tmp;
+	float32x4_t n0 = vld1q_f32(n->d + 0);
+	float32x4_t n1 = vld1q_f32(n->d + 4);
+	float32x4_t n2 = vld1q_f32(n->d + 8);
+	float32x4_t n3 = vld1q_f32(n->d + 12);
+	float32x4_t r[4];
+	int c;
+
+	for (c = 0; c < 4; c++) {
+		const float *col = m->d + c * 4;
+
+		r[c] = vmulq_n_f32(n0, col[0]);
+		r[c] = vaddq_f32(r[c], vmulq_n_f32(n1, col[1]));
+		r[c] = vaddq_f32(r[c], vmulq_n_f32(n2, col[2]));
+		r[c] = vaddq_f32(r[c], vmulq_n_f32(n3, col[3]));
+	}
+
+	for (c = 0; c < 4; c++)
+		vst1q_f32(m->d + c * 4, r[c]);
+}
+
+static void
+transform_general(const struct weston_matrix *matrix, struct weston_vector *v)
+{
+	float32x4_t t;
+
+	t = vmulq_n_f32(vld1q_f32(matrix->d + 0), v->f[0]);
+	t = vaddq_f32(t, vmulq_n_f32(vld1q_f32(matrix->d + 4), v->f[1]));
+	t = vaddq_f32(t, vmulq_n_f32(vld1q_f32(matrix->d + 8), v->f[2]));
+	t = vaddq_f32(t, vmulq_n_f32(vld1q_f32(matrix->d + 12), v->f[3]));
+
+	vst1q_f32(v->f, t);
+}
+
+#else
+
+static void
+multiply_general(struct weston_matrix *m, const struct weston_matrix *n)
+{
+	float tmp[16];
 	const float *row, *column;
 	div_t d;
 	int i, j;
 
 	for (i = 0; i < 16; i++) {
-		tmp.d[i] = 0;
+		tmp[i] = 0;
 		d = div(i, 4);
 		row = m->d + d.quot * 4;
 		column = n->d + d.rem;
 		for (j = 0; j < 4; j++)
-			tmp.d[i] += row[j] * column[j * 4];
+			tmp[i] += row[j] * column[j * 4];
 	}
-	tmp.type = m->type | n->type;
-	memcpy(m, &tmp, sizeof tmp);
+	memcpy(m->d, tmp, sizeof tmp);
+}
+
+static void
+transform_general(const struct weston_matrix *matrix, struct weston_vector *v)
+{
+	int i, j;
+	struct weston_vector t;
+
+	for (i = 0; i < 4; i++) {
+		t.f[i] = 0;
+		for (j = 0; j < 4; j++)
+			t.f[i] += v->f[j] * matrix->d[i + j * 4];
+	}
+
+	*v = t;
+}
+
+#endif
+
+/* m <- n * m, that is, m is multiplied on the LEFT. */
+WL_EXPORT void
+weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
+{
+	if (matrix_is_affine(m) && matrix_is_affine(n))
+		multiply_affine(m, n);
+	else
+		multiply_general(m, n);
+
+	m->type |= n->type;
 }
 
 WL_EXPORT void
@@ -114,16 +272,17 @@ weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin)
 WL_EXPORT void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 {
-	int i, j;
-	struct weston_vector t;
+	const float *d = matrix->d;
+	float x = v->f[0], y = v->f[1], z = v->f[2], w = v->f[3];
 
-	for (i = 0; i < 4; i++) {
-		t.f[i] = 0;
-		for (j = 0; j < 4; j++)
-			t.f[i] += v->f[j] * matrix->d[i + j * 4];
+	if (!matrix_is_affine(matrix)) {
+		transform_general(matrix, v);
+		return;
 	}
 
-	*v = t;
+	v->f[0] = d[0] * x + d[4] * y + d[12] * w;
+	v->f[1] = d[1] * x + d[5] * y + d[13] * w;
+	v->f[2] = d[10] * z + d[14] * w;
 }
 
 static inline void
@@ -253,6 +412,44 @@ inverse_transform(const double *LU, const unsigned *p, float *v)
 		v[j] = b[j];
 }
 
+/* The inverse of an affine matrix is affine, and only the 2x2 xy block
+ * and the z scale need dividing out. */
+static int
+invert_affine(struct weston_matrix *inverse,
+	      const struct weston_matrix *matrix)
+{
+	const float *m = matrix->d;
+	unsigned int type = matrix->type;
+	double det, a, b, c, d, sz, tx, ty, tz;
+
+	det = (double) m[0] * m[5] - (double) m[4] * m[1];
+	if (fabs(det) < 1e-18 || fabs(m[10]) < 1e-9)
+		return -1; /* not invertible */
+
+	a = m[5] / det;
+	b = -m[1] / det;
+	c = -m[4] / det;
+	d = m[0] / det;
+	sz = 1.0 / m[10];
+	tx = m[12];
+	ty = m[13];
+	tz = m[14];
+
+	/* inverse may be matrix itself */
+	weston_matrix_init(inverse);
+	inverse->d[0] = a;
+	inverse->d[1] = b;
+	inverse->d[4] = c;
+	inverse->d[5] = d;
+	inverse->d[10] = sz;
+	inverse->d[12] = -(a * tx + c * ty);
+	inverse->d[13] = -(b * tx + d * ty);
+	inverse->d[14] = -sz * tz;
+	inverse->type = type;
+
+	return 0;
+}
+
 WL_EXPORT int
 weston_matrix_invert(struct weston_matrix *inverse,
 		     const struct weston_matrix *matrix)
@@ -261,6 +458,9 @@ weston_matrix_invert(struct weston_matrix *inverse,
 	unsigned perm[4];	/* permutation */
 	unsigned c;
 
+	if (matrix_is_affine(matrix))
+		return invert_affine(inverse, matrix);
+
 	if (matrix_invert(LU, perm, matrix) < 0)
 		return -1;
 
@@ -28,11 +28,15 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include "os-compatibility.h"
 
+/* Below this a mapping doesn't span enough huge pages to matter */
+#define HUGE_PAGE_ADVISE_MIN (4 * 1024 * 1024)
+
 static int
 set_cloexec_or_close(int fd)
 {
@@ -118,16 +122,58 @@ create_tmpfile_cloexec(char *tmpname)
 	return fd;
 }
 
+static int
+create_memfd(void)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	return memfd_create("weston-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int
+create_runtime_file(void)
+{
+	static const char template[] = "/weston-shared-XXXXXX";
+	const char *path;
+	char *name;
+	int fd;
+
+	path = getenv("XDG_RUNTIME_DIR");
+	if (!path) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	name = malloc(strlen(path) + sizeof(template));
+	if (!name)
+		return -1;
+
+	strcpy(name, path);
+	strcat(name, template);
+
+	fd = create_tmpfile_cloexec(name);
+
+	free(name);
+
+	return fd;
+}
+
 /*
  * Create a new, unique, anonymous file of the given size, and
  * return the file descriptor for it. The file descriptor is set
  * CLOEXEC. The file is immediately suitable for mmap()'ing
  * the given size at offset zero.
  *
- * The file should not have a permanent backing store like a disk,
- * but may have if XDG_RUNTIME_DIR is not properly implemented in OS.
- *
- * The file name is deleted from the file system.
+ * Where memfd_create() is available the file lives in memory and is
+ * sealed against shrinking, so whoever maps it, like the compositor
+ * mapping a client's shm pool, can't be made to fault by a truncate.
+ * It can still grow. Otherwise the file is created and unlinked in
+ * XDG_RUNTIME_DIR; it should not have a permanent backing store like a
+ * disk, but may have if XDG_RUNTIME_DIR is not properly implemented in
+ * OS.
  *
  * The file is suitable for buffer sharing between processes by
  * transmitting the file descriptor over Unix sockets using the
@@ -142,46 +188,160 @@ create_tmpfile_cloexec(char *tmpname)
 int
 os_create_anonymous_file(off_t size)
 {
-	static const char template[] = "/weston-shared-XXXXXX";
-	const char *path;
-	char *name;
 	int fd;
 	int ret;
 
-	path = getenv("XDG_RUNTIME_DIR");
-	if (!path) {
-		errno = ENOENT;
+	fd = create_memfd();
+	if (fd < 0)
+		fd = create_runtime_file();
+	if (fd < 0)
 		return -1;
-	}
 
-	name = malloc(strlen(path) + sizeof(template));
-	if (!name)
+#ifdef HAVE_POSIX_FALLOCATE
+	/* posix_fallocate() rejects an empty range */
+	ret = size > 0 ? posix_fallocate(fd, 0, size) : 0;
+	if (ret != 0) {
+		close(fd);
+		errno = ret;
 		return -1;
+	}
+#else
+	ret = ftruncate(fd, size);
+	if (ret < 0) {
+		close(fd);
+		return -1;
+	}
+#endif
 
-	strcpy(name, path);
-	strcat(name, template);
-
-	fd = create_tmpfile_cloexec(name);
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	/* Fails, harmlessly, for a file in XDG_RUNTIME_DIR */
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK);
+#endif
 
-	free(name);
+	return fd;
+}
 
-	if (fd < 0)
-		return -1;
+/*
+ * Grow a file from os_create_anonymous_file() to size bytes, with the
+ * same guarantees about the backing store.  Shrinking is not supported,
+ * since the file may be sealed against it.
+ */
+int
+os_resize_anonymous_file(int fd, off_t size)
+{
+	int ret;
 
 #ifdef HAVE_POSIX_FALLOCATE
 	ret = posix_fallocate(fd, 0, size);
 	if (ret != 0) {
-		close(fd);
 		errno = ret;
 		return -1;
 	}
 #else
 	ret = ftruncate(fd, size);
-	if (ret < 0) {
-		close(fd);
+	if (ret < 0)
 		return -1;
+#endif
+
+	return 0;
+}
+
+/*
+ * Hint that a shared mapping of an anonymous file may be backed by
+ * transparent huge pages. This only takes effect for memfd files, with
+ * /sys/kernel/mm/transparent_hugepage/shmem_enabled set to "advise",
+ * and is only worth it for mappings spanning a few huge pages, so
+ * smaller ones are left alone.
+ */
+void
+os_advise_huge_pages(void *data, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	if (size >= HUGE_PAGE_ADVISE_MIN)
+		madvise(data, size, MADV_HUGEPAGE);
+#endif
+}
+
+static int
+write_all(int fd, const char *data, size_t size)
+{
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, data, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return -1;
+		data += len;
+		size -= len;
 	}
+
+	return 0;
+}
+
+/*
+ * Create an empty anonymous file to be filled in and then sealed with
+ * os_seal_file(), for contents that aren't all known up front.
+ *
+ * Where memfd_create() is available the file lives in memory and
+ * supports sealing; otherwise it is an unlinked file in XDG_RUNTIME_DIR.
+ * The file descriptor is set CLOEXEC.
+ */
+int
+os_create_sealable_file(void)
+{
+	int fd;
+
+	fd = create_memfd();
+	if (fd >= 0)
+		return fd;
+
+	return create_runtime_file();
+}
+
+/*
+ * Seal a file from os_create_sealable_file() against writes and
+ * resizing, so no client can change what the others see.  Files that
+ * can't be sealed are left as they are, and -1 is returned.
+ */
+int
+os_seal_file(int fd)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	return fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+		     F_SEAL_WRITE | F_SEAL_SEAL);
+#else
+	return -1;
 #endif
+}
+
+/*
+ * Create an anonymous file holding a copy of the given data, for handing
+ * the same read-only contents, like a keymap, to any number of clients.
+ *
+ * Where memfd_create() is available the file is sealed against writes
+ * and resizing. Otherwise clients sharing it have to trust each other
+ * with it.
+ *
+ * The file descriptor is set CLOEXEC and positioned at the end of the
+ * data.
+ */
+int
+os_create_sealed_file(const void *data, size_t size)
+{
+	int fd;
+
+	fd = os_create_sealable_file();
+	if (fd < 0)
+		return -1;
+
+	if (write_all(fd, data, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	os_seal_file(fd);
 
 	return fd;
 }
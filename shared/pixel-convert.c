@@ -0,0 +1,250 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include "pixel-convert.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+/* The vector paths are picked at compile time, like the SSE2 path in
+ * wcap-decode: SSE2 is part of the x86-64 baseline and NEON of the
+ * aarch64 one, so distribution builds get them without any runtime
+ * dispatch.  All of them round exactly like multiply_alpha(), so the
+ * output does not depend on which path ran. */
+
+static inline int
+multiply_alpha(int alpha, int color)
+{
+	int temp = (alpha * color) + 0x80;
+
+	return ((temp + (temp >> 8)) >> 8);
+}
+
+static inline uint32_t
+premultiply_pixel(const uint8_t *p)
+{
+	uint8_t alpha = p[3];
+	uint8_t red, green, blue;
+
+	if (alpha == 0)
+		return 0;
+
+	red   = p[0];
+	green = p[1];
+	blue  = p[2];
+
+	if (alpha != 0xff) {
+		red   = multiply_alpha(alpha, red);
+		green = multiply_alpha(alpha, green);
+		blue  = multiply_alpha(alpha, blue);
+	}
+
+	return (alpha << 24) | (red << 16) | (green << 8) | (blue << 0);
+}
+
+#if defined(__SSE2__)
+
+/* Premultiplies two pixels unpacked to 16 bit lanes, r g b a each, and
+ * swaps red and blue so the packed result reads as ARGB32.  The alpha
+ * lane is multiplied by 0xff, which the rounding maps back to alpha. */
+static inline __m128i
+premultiply_sse2(__m128i v)
+{
+	const __m128i alpha_mask =
+		_mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i rounding = _mm_set1_epi16(0x80);
+	__m128i alpha, t;
+
+	alpha = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+	alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+	alpha = _mm_or_si128(_mm_andnot_si128(alpha_mask, alpha),
+			     _mm_and_si128(alpha_mask, _mm_set1_epi16(0xff)));
+
+	t = _mm_add_epi16(_mm_mullo_epi16(v, alpha), rounding);
+	t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+
+	t = _mm_shufflelo_epi16(t, _MM_SHUFFLE(3, 0, 1, 2));
+	return _mm_shufflehi_epi16(t, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+static size_t
+premultiply_vector(uint8_t *data, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, lo, hi;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((__m128i *) (data + i));
+		lo = premultiply_sse2(_mm_unpacklo_epi8(v, zero));
+		hi = premultiply_sse2(_mm_unpackhi_epi8(v, zero));
+		_mm_storeu_si128((__m128i *) (data + i),
+				 _mm_packus_epi16(lo, hi));
+	}
+
+	return i;
+}
+
+/* Expands the last four pixels of row[0 .. width * 3), width >= 4.  The
+ * load reads four bytes past them, which are either still unconverted
+ * source or already written output and are masked away either way. */
+static unsigned int
+expand_vector(uint8_t *row, unsigned int width)
+{
+	const __m128i lane0 = _mm_set_epi32(0, 0, 0, 0x00ffffff);
+	const __m128i lane1 = _mm_set_epi32(0, 0, 0x00ffffff, 0);
+	const __m128i lane2 = _mm_set_epi32(0, 0x00ffffff, 0, 0);
+	const __m128i lane3 = _mm_set_epi32(0x00ffffff, 0, 0, 0);
+	const __m128i green = _mm_set1_epi32(0x0000ff00);
+	const __m128i low = _mm_set1_epi32(0x000000ff);
+	const __m128i opaque = _mm_set1_epi32(0xff000000);
+	__m128i v, rgb, rb;
+	unsigned int i = width;
+
+	while (i >= 4) {
+		i -= 4;
+		v = _mm_loadu_si128((__m128i *) (row + i * 3));
+
+		/* Move pixel n from byte 3n to byte 4n. */
+		rgb = _mm_or_si128(
+			_mm_or_si128(_mm_and_si128(v, lane0),
+				     _mm_and_si128(_mm_slli_si128(v, 1),
+						   lane1)),
+			_mm_or_si128(_mm_and_si128(_mm_slli_si128(v, 2),
+						   lane2),
+				     _mm_and_si128(_mm_slli_si128(v, 3),
+						   lane3)));
+
+		rb = _mm_or_si128(
+			_mm_slli_epi32(_mm_and_si128(rgb, low), 16),
+			_mm_and_si128(_mm_srli_epi32(rgb, 16), low));
+		rgb = _mm_or_si128(_mm_and_si128(rgb, green),
+				   _mm_or_si128(rb, opaque));
+
+		_mm_storeu_si128((__m128i *) (row + i * 4), rgb);
+	}
+
+	return i;
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static inline uint8x8_t
+premultiply_neon(uint8x8_t alpha, uint8x8_t color)
+{
+	uint16x8_t t = vmull_u8(alpha, color);
+
+	/* ((t + 0x80) + ((t + 0x80) >> 8)) >> 8 */
+	return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+static size_t
+premultiply_vector(uint8_t *data, size_t len)
+{
+	uint8x8x4_t v, out;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = vld4_u8(data + i);
+		out.val[0] = premultiply_neon(v.val[3], v.val[2]);
+		out.val[1] = premultiply_neon(v.val[3], v.val[1]);
+		out.val[2] = premultiply_neon(v.val[3], v.val[0]);
+		out.val[3] = v.val[3];
+		vst4_u8(data + i, out);
+	}
+
+	return i;
+}
+
+static unsigned int
+expand_vector(uint8_t *row, unsigned int width)
+{
+	uint8x8x3_t v;
+	uint8x8x4_t out;
+	unsigned int i = width;
+
+	out.val[3] = vdup_n_u8(0xff);
+	while (i >= 8) {
+		i -= 8;
+		v = vld3_u8(row + i * 3);
+		out.val[0] = v.val[2];
+		out.val[1] = v.val[1];
+		out.val[2] = v.val[0];
+		vst4_u8(row + i * 4, out);
+	}
+
+	return i;
+}
+
+#else
+
+static size_t
+premultiply_vector(uint8_t *data, size_t len)
+{
+	return 0;
+}
+
+static unsigned int
+expand_vector(uint8_t *row, unsigned int width)
+{
+	return width;
+}
+
+#endif
+
+void
+pixel_premultiply_rgba(uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = premultiply_vector(data, len); i + 4 <= len; i += 4)
+		*(uint32_t *) (data + i) = premultiply_pixel(data + i);
+}
+
+void
+pixel_expand_rgb(uint8_t *row, unsigned int width)
+{
+	uint8_t *s;
+	uint32_t *d;
+	unsigned int i;
+
+	/* The vector path converts from the end of the row backwards, so
+	 * what is left for the scalar loop is the head of the row. */
+	i = expand_vector(row, width);
+	if (i == 0)
+		return;
+
+	s = row + (i - 1) * 3;
+	d = (uint32_t *) (row + (i - 1) * 4);
+	while (s >= row) {
+		*d = 0xff000000 | (s[0] << 16) | (s[1] << 8) | (s[2] << 0);
+		s -= 3;
+		d--;
+	}
+}
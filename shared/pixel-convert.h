@@ -0,0 +1,40 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#ifndef _PIXEL_CONVERT_H
+#define _PIXEL_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Converts a run of 8 bit RGBA pixels, as delivered by libpng, in place
+ * to premultiplied native endian ARGB32.  len is in bytes. */
+void
+pixel_premultiply_rgba(uint8_t *data, size_t len);
+
+/* Expands a row of 8 bit RGB pixels, packed at the start of the row, in
+ * place to native endian XRGB32 with the X byte set to 0xff.  The row
+ * must have room for width * 4 bytes. */
+void
+pixel_expand_rgb(uint8_t *row, unsigned int width);
+
+#endif
@@ -44,14 +44,130 @@ weston_spring_init(struct weston_spring *spring,
 	spring->clip = WESTON_SPRING_OVERSHOOT;
 	spring->min = 0.0;
 	spring->max = 1.0;
+	spring->step_count = 0;
+}
+
+/* Length of one integration step, in milliseconds and in the units the
+ * force is scaled by.
+ */
+#define SPRING_STEP_MSEC 4
+#define SPRING_STEP 0.01
+
+static void
+spring_step(struct weston_spring *spring)
+{
+	double force, v, current, step;
+
+	step = SPRING_STEP;
+	current = spring->current;
+	v = current - spring->previous;
+	force = spring->k * (spring->target - current) / 10.0 +
+		(spring->previous - current) - v * spring->friction;
+
+	spring->current =
+		current + (current - spring->previous) +
+		force * step * step;
+	spring->previous = current;
+
+	switch (spring->clip) {
+	case WESTON_SPRING_OVERSHOOT:
+		break;
+
+	case WESTON_SPRING_CLAMP:
+		if (spring->current > spring->max) {
+			spring->current = spring->max;
+			spring->previous = spring->max;
+		} else if (spring->current < 0.0) {
+			spring->current = spring->min;
+			spring->previous = spring->min;
+		}
+		break;
+
+	case WESTON_SPRING_BOUNCE:
+		if (spring->current > spring->max) {
+			spring->current =
+				2 * spring->max - spring->current;
+			spring->previous =
+				2 * spring->max - spring->previous;
+		} else if (spring->current < spring->min) {
+			spring->current =
+				2 * spring->min - spring->current;
+			spring->previous =
+				2 * spring->min - spring->previous;
+		}
+		break;
+	}
+}
+
+static void
+matrix2_multiply(double *r, const double *a, const double *b)
+{
+	double m[4];
+
+	m[0] = a[0] * b[0] + a[1] * b[2];
+	m[1] = a[0] * b[1] + a[1] * b[3];
+	m[2] = a[2] * b[0] + a[3] * b[2];
+	m[3] = a[2] * b[1] + a[3] * b[3];
+	memcpy(r, m, sizeof m);
+}
+
+/* Without clipping, one step of the integrator above is linear in the
+ * distance to the target:
+ *
+ *   e' = (1 + a - b) e - a p,  p' = e
+ *
+ * with e = current - target, p = previous - target,
+ * a = 1 - (1 + friction) step² and b = k step² / 10.  Advancing n steps
+ * is then a multiplication by the n-th power of that matrix, which we
+ * compute by squaring and cache: frames arrive at a steady rate, so n
+ * and the spring constants rarely change between updates.
+ */
+static void
+spring_advance(struct weston_spring *spring, uint32_t steps)
+{
+	double a, b, base[4], e, p;
+	uint32_t n;
+
+	if (spring->step_count != steps ||
+	    spring->step_k != spring->k ||
+	    spring->step_friction != spring->friction) {
+		a = 1.0 - (1.0 + spring->friction) * SPRING_STEP * SPRING_STEP;
+		b = spring->k * SPRING_STEP * SPRING_STEP / 10.0;
+		base[0] = 1.0 + a - b;
+		base[1] = -a;
+		base[2] = 1.0;
+		base[3] = 0.0;
+
+		spring->step_matrix[0] = 1.0;
+		spring->step_matrix[1] = 0.0;
+		spring->step_matrix[2] = 0.0;
+		spring->step_matrix[3] = 1.0;
+		for (n = steps; n; n >>= 1) {
+			if (n & 1)
+				matrix2_multiply(spring->step_matrix,
+						 spring->step_matrix, base);
+			matrix2_multiply(base, base, base);
+		}
+
+		spring->step_count = steps;
+		spring->step_k = spring->k;
+		spring->step_friction = spring->friction;
+	}
+
+	e = spring->current - spring->target;
+	p = spring->previous - spring->target;
+	spring->current = spring->target +
+		spring->step_matrix[0] * e + spring->step_matrix[1] * p;
+	spring->previous = spring->target +
+		spring->step_matrix[2] * e + spring->step_matrix[3] * p;
 }
 
 WL_EXPORT void
 weston_spring_update(struct weston_spring *spring, uint32_t msec)
 {
-	double force, v, current, step;
+	uint32_t steps, i;
 
-	/* Limit the number of executions of the loop below by ensuring that
+	/* Limit the number of integration steps below by ensuring that
 	 * the timestamp for last update of the spring is no more than 1s ago.
 	 * This handles the case where time moves backwards or forwards in
 	 * large jumps.
@@ -62,49 +178,23 @@ weston_spring_update(struct weston_spring *spring, uint32_t msec)
 		spring->timestamp = msec - 1000;
 	}
 
-	step = 0.01;
-	while (4 < msec - spring->timestamp) {
-		current = spring->current;
-		v = current - spring->previous;
-		force = spring->k * (spring->target - current) / 10.0 +
-			(spring->previous - current) - v * spring->friction;
-
-		spring->current =
-			current + (current - spring->previous) +
-			force * step * step;
-		spring->previous = current;
-
-		switch (spring->clip) {
-		case WESTON_SPRING_OVERSHOOT:
-			break;
-
-		case WESTON_SPRING_CLAMP:
-			if (spring->current > spring->max) {
-				spring->current = spring->max;
-				spring->previous = spring->max;
-			} else if (spring->current < 0.0) {
-				spring->current = spring->min;
-				spring->previous = spring->min;
-			}
-			break;
-
-		case WESTON_SPRING_BOUNCE:
-			if (spring->current > spring->max) {
-				spring->current =
-					2 * spring->max - spring->current;
-				spring->previous =
-					2 * spring->max - spring->previous;
-			} else if (spring->current < spring->min) {
-				spring->current =
-					2 * spring->min - spring->current;
-				spring->previous =
-					2 * spring->min - spring->previous;
-			}
-			break;
-		}
+	if (msec - spring->timestamp <= SPRING_STEP_MSEC)
+		return;
+
+	/* Step while more than one step's worth of time is left. */
+	steps = (msec - spring->timestamp - 1) / SPRING_STEP_MSEC;
+	spring->timestamp += steps * SPRING_STEP_MSEC;
 
-		spring->timestamp += 4;
+	/* Clipping has to be checked after every step, so only the
+	 * unclipped spring can take the closed form.
+	 */
+	if (spring->clip == WESTON_SPRING_OVERSHOOT) {
+		spring_advance(spring, steps);
+		return;
 	}
+
+	for (i = 0; i < steps; i++)
+		spring_step(spring);
 }
 
 WL_EXPORT int
@@ -154,30 +244,50 @@ handle_animation_view_destroy(struct wl_listener *listener, void *data)
 	weston_view_animation_destroy(animation);
 }
 
+/* All view animations on an output are driven by a single frame handler,
+ * which advances every spring before running any of the frame hooks and
+ * then schedules each affected output once, instead of once per view.
+ */
 static void
-weston_view_animation_frame(struct weston_animation *base,
+view_animation_output_frame(struct weston_animation *base,
 			    struct weston_output *output, uint32_t msecs)
 {
-	struct weston_view_animation *animation =
-		container_of(base,
-			     struct weston_view_animation, animation);
+	struct weston_view_animation *animation, *next;
+	struct weston_output *o;
+	uint32_t output_mask = 0;
 
-	if (base->frame_counter <= 1)
-		animation->spring.timestamp = msecs;
+	wl_list_for_each(animation,
+			 &output->view_animation_list, animation.link) {
+		animation->animation.frame_counter++;
+		if (animation->animation.frame_counter <= 1)
+			animation->spring.timestamp = msecs;
 
-	weston_spring_update(&animation->spring, msecs);
+		weston_spring_update(&animation->spring, msecs);
+	}
 
-	if (weston_spring_done(&animation->spring)) {
-		weston_view_schedule_repaint(animation->view);
-		weston_view_animation_destroy(animation);
-		return;
+	wl_list_for_each_safe(animation, next,
+			      &output->view_animation_list, animation.link) {
+		output_mask |= animation->view->output_mask;
+
+		if (weston_spring_done(&animation->spring)) {
+			weston_view_animation_destroy(animation);
+			continue;
+		}
+
+		if (animation->frame)
+			animation->frame(animation);
+
+		weston_view_geometry_dirty(animation->view);
 	}
 
-	if (animation->frame)
-		animation->frame(animation);
+	if (wl_list_empty(&output->view_animation_list)) {
+		wl_list_remove(&base->link);
+		wl_list_init(&base->link);
+	}
 
-	weston_view_geometry_dirty(animation->view);
-	weston_view_schedule_repaint(animation->view);
+	wl_list_for_each(o, &output->compositor->output_list, link)
+		if (output_mask & (1u << o->id))
+			weston_output_schedule_repaint(o);
 }
 
 static struct weston_view_animation *
@@ -190,6 +300,7 @@ weston_view_animation_create(struct weston_view *view,
 			     void *private)
 {
 	struct weston_view_animation *animation;
+	struct weston_output *output;
 
 	animation = malloc(sizeof *animation);
 	if (!animation)
@@ -208,13 +319,21 @@ weston_view_animation_create(struct weston_view *view,
 	wl_list_insert(&view->geometry.transformation_list,
 		       &animation->transform.link);
 
-	animation->animation.frame = weston_view_animation_frame;
+	animation->animation.frame = NULL;
+	animation->animation.frame_counter = 0;
 
 	animation->listener.notify = handle_animation_view_destroy;
 	wl_signal_add(&view->destroy_signal, &animation->listener);
 
-	wl_list_insert(&view->output->animation_list,
+	output = view->output;
+	wl_list_insert(&output->view_animation_list,
 		       &animation->animation.link);
+	if (wl_list_empty(&output->view_animation.link)) {
+		output->view_animation.frame = view_animation_output_frame;
+		output->view_animation.frame_counter = 0;
+		wl_list_insert(&output->animation_list,
+			       &output->view_animation.link);
+	}
 
 	return animation;
 }
@@ -223,7 +342,18 @@ static void
 weston_view_animation_run(struct weston_view_animation *animation)
 {
 	animation->animation.frame_counter = 0;
-	weston_view_animation_frame(&animation->animation, NULL, 0);
+
+	if (weston_spring_done(&animation->spring)) {
+		weston_view_schedule_repaint(animation->view);
+		weston_view_animation_destroy(animation);
+		return;
+	}
+
+	if (animation->frame)
+		animation->frame(animation);
+
+	weston_view_geometry_dirty(animation->view);
+	weston_view_schedule_repaint(animation->view);
 }
 
 static void
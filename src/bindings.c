@@ -26,6 +26,13 @@
 
 #include "compositor.h"
 
+enum binding_type {
+	BINDING_OTHER,
+	BINDING_KEY,
+	BINDING_BUTTON,
+	BINDING_AXIS
+};
+
 struct weston_binding {
 	uint32_t key;
 	uint32_t button;
@@ -34,8 +41,39 @@ struct weston_binding {
 	void *handler;
 	void *data;
 	struct wl_list link;
+
+	/* Key, button and axis bindings are also kept in
+	 * compositor->binding_hash, so that looking up the bindings of an
+	 * event only walks those sharing its bucket.  A bucket keeps the
+	 * order the bindings were added in. */
+	enum binding_type type;
+	struct wl_list hash_link;
 };
 
+static struct wl_list *
+binding_bucket(struct weston_compositor *compositor,
+	       enum binding_type type, uint32_t code, uint32_t modifier)
+{
+	uint32_t hash;
+
+	hash = (code ^ (modifier << 10) ^ (type << 14)) * 2654435761u;
+
+	return &compositor->binding_hash[(hash >> 16) &
+					 (WESTON_BINDING_HASH_SIZE - 1)];
+}
+
+static void
+binding_hash_insert(struct weston_compositor *compositor,
+		    struct weston_binding *binding,
+		    enum binding_type type, uint32_t code)
+{
+	struct wl_list *bucket;
+
+	bucket = binding_bucket(compositor, type, code, binding->modifier);
+	binding->type = type;
+	wl_list_insert(bucket->prev, &binding->hash_link);
+}
+
 static struct weston_binding *
 weston_compositor_add_binding(struct weston_compositor *compositor,
 			      uint32_t key, uint32_t button, uint32_t axis,
@@ -53,6 +91,8 @@ weston_compositor_add_binding(struct weston_compositor *compositor,
 	binding->modifier = modifier;
 	binding->handler = handler;
 	binding->data = data;
+	binding->type = BINDING_OTHER;
+	wl_list_init(&binding->hash_link);
 
 	return binding;
 }
@@ -71,6 +111,7 @@ weston_compositor_add_key_binding(struct weston_compositor *compositor,
 		return NULL;
 
 	wl_list_insert(compositor->key_binding_list.prev, &binding->link);
+	binding_hash_insert(compositor, binding, BINDING_KEY, key);
 
 	return binding;
 }
@@ -88,6 +129,8 @@ weston_compositor_add_modifier_binding(struct weston_compositor *compositor,
 	if (binding == NULL)
 		return NULL;
 
+	/* Primed, see weston_compositor_run_modifier_binding() */
+	binding->key = compositor->binding_input_serial;
 	wl_list_insert(compositor->modifier_binding_list.prev, &binding->link);
 
 	return binding;
@@ -107,6 +150,7 @@ weston_compositor_add_button_binding(struct weston_compositor *compositor,
 		return NULL;
 
 	wl_list_insert(compositor->button_binding_list.prev, &binding->link);
+	binding_hash_insert(compositor, binding, BINDING_BUTTON, button);
 
 	return binding;
 }
@@ -143,6 +187,7 @@ weston_compositor_add_axis_binding(struct weston_compositor *compositor,
 		return NULL;
 
 	wl_list_insert(compositor->axis_binding_list.prev, &binding->link);
+	binding_hash_insert(compositor, binding, BINDING_AXIS, axis);
 
 	return binding;
 }
@@ -167,6 +212,7 @@ WL_EXPORT void
 weston_binding_destroy(struct weston_binding *binding)
 {
 	wl_list_remove(&binding->link);
+	wl_list_remove(&binding->hash_link);
 	free(binding);
 }
 
@@ -262,16 +308,19 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 				  enum wl_keyboard_key_state state)
 {
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
 	if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
 		return;
 
 	/* Invalidate all active modifier bindings. */
-	wl_list_for_each(b, &compositor->modifier_binding_list, link)
-		b->key = key;
+	compositor->binding_input_serial++;
 
-	wl_list_for_each(b, &compositor->key_binding_list, link) {
-		if (b->key == key && b->modifier == seat->modifier_state) {
+	bucket = binding_bucket(compositor, BINDING_KEY,
+				key, seat->modifier_state);
+	wl_list_for_each(b, bucket, hash_link) {
+		if (b->type == BINDING_KEY &&
+		    b->key == key && b->modifier == seat->modifier_state) {
 			weston_key_binding_handler_t handler = b->handler;
 			handler(seat, time, key, b->data);
 
@@ -302,13 +351,14 @@ weston_compositor_run_modifier_binding(struct weston_compositor *compositor,
 		if (b->modifier != modifier)
 			continue;
 
-		/* Prime the modifier binding. */
+		/* Prime the modifier binding.  Any key, button or axis
+		 * event bumps the serial and so disarms all of them. */
 		if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-			b->key = 0;
+			b->key = compositor->binding_input_serial;
 			continue;
 		}
 		/* Ignore the binding if a key was pressed in between. */
-		else if (b->key != 0) {
+		else if (b->key != compositor->binding_input_serial) {
 			return;
 		}
 
@@ -323,16 +373,19 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 				     enum wl_pointer_button_state state)
 {
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
 	if (state == WL_POINTER_BUTTON_STATE_RELEASED)
 		return;
 
 	/* Invalidate all active modifier bindings. */
-	wl_list_for_each(b, &compositor->modifier_binding_list, link)
-		b->key = button;
+	compositor->binding_input_serial++;
 
-	wl_list_for_each(b, &compositor->button_binding_list, link) {
-		if (b->button == button && b->modifier == seat->modifier_state) {
+	bucket = binding_bucket(compositor, BINDING_BUTTON,
+				button, seat->modifier_state);
+	wl_list_for_each(b, bucket, hash_link) {
+		if (b->type == BINDING_BUTTON && b->button == button &&
+		    b->modifier == seat->modifier_state) {
 			weston_button_binding_handler_t handler = b->handler;
 			handler(seat, time, button, b->data);
 		}
@@ -364,13 +417,16 @@ weston_compositor_run_axis_binding(struct weston_compositor *compositor,
 				   wl_fixed_t value)
 {
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
 	/* Invalidate all active modifier bindings. */
-	wl_list_for_each(b, &compositor->modifier_binding_list, link)
-		b->key = axis;
+	compositor->binding_input_serial++;
 
-	wl_list_for_each(b, &compositor->axis_binding_list, link) {
-		if (b->axis == axis && b->modifier == seat->modifier_state) {
+	bucket = binding_bucket(compositor, BINDING_AXIS,
+				axis, seat->modifier_state);
+	wl_list_for_each(b, bucket, hash_link) {
+		if (b->type == BINDING_AXIS && b->axis == axis &&
+		    b->modifier == seat->modifier_state) {
 			weston_axis_binding_handler_t handler = b->handler;
 			handler(seat, time, axis, value, b->data);
 			return 1;
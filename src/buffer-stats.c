@@ -0,0 +1,295 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+
+/* Buffer lifecycle statistics: for every hold of a client buffer, from
+ * the commit that made the compositor reference it until the
+ * wl_buffer.release sent when the last reference is dropped, record
+ * when the buffer was first used by a repaint and how many further
+ * repaints it stayed busy for.  A client needs one buffer more than it
+ * has held at any time, so a shift in the release histogram is what
+ * tells whether double buffering still suffices.
+ *
+ * The references may sit anywhere, in the surface, a cached
+ * sub-surface state, the renderer or a scanout framebuffer; only the
+ * busy count going to and from zero is looked at. */
+
+struct weston_buffer_stats {
+	struct weston_compositor *compositor;
+	struct wl_listener destroy_listener;
+	int enabled;
+
+	struct wl_list held;	/* weston_buffer::stats_link */
+	uint32_t repaints;
+
+	struct weston_buffer_stats_summary summary;
+	uint64_t attach_to_use_sum;
+	uint64_t use_to_release_sum;
+};
+
+static uint64_t
+now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+buffer_untrack(struct weston_buffer *buffer)
+{
+	wl_list_remove(&buffer->stats_link);
+	buffer->stats = NULL;
+}
+
+/* Called before the compositor takes its first reference to a buffer
+ * on commit. */
+WL_EXPORT void
+weston_buffer_stats_attach(struct weston_compositor *ec,
+			   struct weston_buffer *buffer)
+{
+	struct weston_buffer_stats *stats = ec->buffer_stats;
+
+	if (!stats || !stats->enabled || !buffer || buffer->stats)
+		return;
+
+	buffer->stats = stats;
+	wl_list_insert(&stats->held, &buffer->stats_link);
+	buffer->attach_usec = now_usec();
+	buffer->use_usec = 0;
+}
+
+/* Called right before output->repaint(), so that renderers dropping
+ * their reference during the repaint, as after an shm upload, still
+ * count the buffer as used. */
+WL_EXPORT void
+weston_buffer_stats_repaint(struct weston_output *output)
+{
+	struct weston_buffer_stats *stats = output->compositor->buffer_stats;
+	struct weston_buffer *buffer;
+	struct weston_view **evp;
+	uint64_t now;
+
+	if (!stats || !stats->enabled)
+		return;
+
+	stats->repaints++;
+	now = now_usec();
+
+	wl_array_for_each(evp, &output->views) {
+		buffer = (*evp)->surface->buffer_ref.buffer;
+		if (!buffer || buffer->stats != stats || buffer->use_usec)
+			continue;
+
+		buffer->use_usec = now;
+		buffer->use_repaint = stats->repaints;
+	}
+}
+
+/* Called when the busy count of a buffer drops to zero. */
+WL_EXPORT void
+weston_buffer_stats_release(struct weston_buffer *buffer)
+{
+	struct weston_buffer_stats *stats = buffer->stats;
+	struct weston_buffer_stats_summary *s;
+	uint32_t attach_to_use, use_to_release, later;
+
+	if (!stats)
+		return;
+
+	s = &stats->summary;
+	s->released++;
+
+	if (!buffer->use_usec) {
+		s->unused++;
+		buffer_untrack(buffer);
+		return;
+	}
+
+	attach_to_use = buffer->use_usec - buffer->attach_usec;
+	use_to_release = now_usec() - buffer->use_usec;
+	later = stats->repaints - buffer->use_repaint;
+
+	stats->attach_to_use_sum += attach_to_use;
+	stats->use_to_release_sum += use_to_release;
+	if (attach_to_use > s->attach_to_use_max)
+		s->attach_to_use_max = attach_to_use;
+	if (use_to_release > s->use_to_release_max)
+		s->use_to_release_max = use_to_release;
+
+	if (later >= WESTON_BUFFER_STATS_REPAINTS)
+		later = WESTON_BUFFER_STATS_REPAINTS - 1;
+	s->release_repaints[later]++;
+
+	buffer_untrack(buffer);
+}
+
+/* A client destroying a buffer it is not done with is not a release. */
+WL_EXPORT void
+weston_buffer_stats_destroy_buffer(struct weston_buffer *buffer)
+{
+	if (buffer->stats)
+		buffer_untrack(buffer);
+}
+
+WL_EXPORT void
+weston_buffer_stats_enable(struct weston_compositor *ec)
+{
+	if (ec->buffer_stats)
+		ec->buffer_stats->enabled = 1;
+}
+
+WL_EXPORT void
+weston_buffer_stats_read(struct weston_compositor *ec,
+			 struct weston_buffer_stats_summary *summary,
+			 int reset)
+{
+	struct weston_buffer_stats *stats = ec->buffer_stats;
+	uint32_t used;
+
+	if (!stats) {
+		*summary = (struct weston_buffer_stats_summary) { 0 };
+		return;
+	}
+
+	*summary = stats->summary;
+	used = summary->released - summary->unused;
+	if (used) {
+		summary->attach_to_use_avg = stats->attach_to_use_sum / used;
+		summary->use_to_release_avg = stats->use_to_release_sum / used;
+	}
+
+	if (reset) {
+		stats->summary = (struct weston_buffer_stats_summary) { 0 };
+		stats->attach_to_use_sum = 0;
+		stats->use_to_release_sum = 0;
+	}
+}
+
+static void
+buffer_stats_dump(struct weston_buffer_stats *stats)
+{
+	struct weston_buffer_stats_summary s;
+	struct weston_buffer *buffer;
+	uint64_t now = now_usec();
+	int i;
+
+	weston_buffer_stats_read(stats->compositor, &s, 1);
+
+	weston_log("buffer stats: %u released, %u never repainted\n",
+		   s.released, s.unused);
+	weston_log_continue(STAMP_SPACE "attach to use  avg %u us, max %u us\n",
+			    s.attach_to_use_avg, s.attach_to_use_max);
+	weston_log_continue(STAMP_SPACE "use to release avg %u us, max %u us\n",
+			    s.use_to_release_avg, s.use_to_release_max);
+	for (i = 0; i < WESTON_BUFFER_STATS_REPAINTS; i++)
+		weston_log_continue(STAMP_SPACE "released after %d%s "
+				    "repaints: %u\n", i,
+				    i == WESTON_BUFFER_STATS_REPAINTS - 1 ?
+				    "+" : "", s.release_repaints[i]);
+
+	wl_list_for_each(buffer, &stats->held, stats_link) {
+		if (buffer->use_usec)
+			weston_log_continue(STAMP_SPACE "held %dx%d buffer %p: "
+					    "%u repaints since first use, "
+					    "busy for %u us\n",
+					    buffer->width, buffer->height,
+					    buffer,
+					    stats->repaints -
+					    buffer->use_repaint,
+					    (uint32_t) (now -
+							buffer->attach_usec));
+		else
+			weston_log_continue(STAMP_SPACE "held %dx%d buffer %p: "
+					    "not repainted yet, "
+					    "busy for %u us\n",
+					    buffer->width, buffer->height,
+					    buffer,
+					    (uint32_t) (now -
+							buffer->attach_usec));
+	}
+}
+
+static void
+buffer_stats_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		     void *data)
+{
+	struct weston_buffer_stats *stats = data;
+
+	if (!stats->enabled) {
+		stats->enabled = 1;
+		weston_log("started buffer statistics\n");
+	} else {
+		buffer_stats_dump(stats);
+	}
+}
+
+static void
+buffer_stats_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_buffer_stats *stats =
+		container_of(listener, struct weston_buffer_stats,
+			     destroy_listener);
+	struct weston_buffer *buffer, *next;
+
+	/* Buffers may outlive the compositor during shutdown. */
+	wl_list_for_each_safe(buffer, next, &stats->held, stats_link)
+		buffer_untrack(buffer);
+
+	stats->compositor->buffer_stats = NULL;
+	free(stats);
+}
+
+WL_EXPORT void
+weston_buffer_stats_create(struct weston_compositor *ec)
+{
+	struct weston_buffer_stats *stats;
+	struct weston_config_section *section;
+
+	stats = zalloc(sizeof *stats);
+	if (stats == NULL)
+		return;
+
+	stats->compositor = ec;
+	wl_list_init(&stats->held);
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "buffer-stats",
+				       &stats->enabled, 0);
+
+	weston_compositor_add_debug_binding(ec, KEY_U,
+					    buffer_stats_binding, stats);
+
+	stats->destroy_listener.notify = buffer_stats_destroy;
+	wl_signal_add(&ec->destroy_signal, &stats->destroy_listener);
+
+	ec->buffer_stats = stats;
+}
@@ -0,0 +1,563 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+#include "client-stats-server-protocol.h"
+
+/* Per-client accounting: the surfaces and views a client has, the
+ * buffers of it the compositor holds, the textures the renderer keeps
+ * for its surfaces, and the commits, damage and commit processing time
+ * it causes.  The numbers live in a struct hung off the client's
+ * destroy listener; surfaces and held buffers point back at it and are
+ * cut loose when the client goes, as they may outlive it.
+ *
+ * Limits are optional.  Going over the surface or buffer limit is a
+ * wl_display.no_memory error for the client.  Over the commit rate
+ * limit, its frame callbacks are let through at most at that rate,
+ * which slows down clients that wait for them. */
+
+struct weston_client_stats_list {
+	struct weston_compositor *compositor;
+	struct wl_listener destroy_listener;
+	struct wl_list clients;		/* weston_client_stats::link */
+	struct wl_global *global;
+
+	struct wl_event_source *throttle_timer;
+	int throttle_timer_armed;
+
+	uint32_t max_surfaces;
+	uint64_t max_buffer_bytes;
+	uint32_t max_commit_rate;
+};
+
+struct weston_client_stats {
+	struct weston_client_stats_list *list;
+	struct wl_client *client;
+	struct wl_listener destroy_listener;
+	struct wl_list link;
+	struct wl_list surface_list;	/* weston_surface::client_stats_link */
+	struct wl_list buffer_list;	/* weston_buffer::client_stats_link */
+
+	uint32_t surfaces, views;
+	uint64_t buffer_bytes, texture_bytes;
+
+	/* over the last full second */
+	uint32_t commit_rate, damage_rate, cpu_rate;
+
+	uint32_t rate_start;		/* ms */
+	uint32_t rate_commits;
+	uint64_t rate_damage, rate_cpu;
+
+	int throttled;
+	uint32_t frame_msecs;		/* frame callbacks last let through */
+	int over_buffer_limit;
+};
+
+WL_EXPORT uint64_t
+weston_client_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static pid_t
+client_pid(struct weston_client_stats *stats)
+{
+	pid_t pid;
+
+	wl_client_get_credentials(stats->client, &pid, NULL, NULL);
+
+	return pid;
+}
+
+static void
+stats_rate_update(struct weston_client_stats *stats, uint32_t now)
+{
+	struct weston_client_stats_list *list = stats->list;
+	uint32_t max = list->max_commit_rate;
+	int full;
+
+	if (now - stats->rate_start < 1000)
+		return;
+
+	/* a gap of more than a second holds no full second to report */
+	full = now - stats->rate_start < 2000;
+	stats->commit_rate = full ? stats->rate_commits : 0;
+	stats->damage_rate = full ? stats->rate_damage : 0;
+	stats->cpu_rate = full ? stats->rate_cpu : 0;
+	stats->rate_start = now;
+	stats->rate_commits = 0;
+	stats->rate_damage = 0;
+	stats->rate_cpu = 0;
+
+	if (!max)
+		return;
+
+	/* Paced at the limit, a client waiting for frame callbacks
+	 * commits about as often as the limit; only let go of it once
+	 * it stays well below. */
+	if (!stats->throttled && stats->commit_rate > max) {
+		stats->throttled = 1;
+		weston_log("client %d: %u commits/s, throttling to %u\n",
+			   client_pid(stats), stats->commit_rate, max);
+	} else if (stats->throttled && stats->commit_rate < max * 3 / 4) {
+		stats->throttled = 0;
+		weston_log("client %d: %u commits/s, no longer throttled\n",
+			   client_pid(stats), stats->commit_rate);
+	}
+}
+
+static void
+client_stats_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_client_stats *stats =
+		container_of(listener, struct weston_client_stats,
+			     destroy_listener);
+	struct weston_surface *surface, *snext;
+	struct weston_buffer *buffer, *bnext;
+
+	wl_list_for_each_safe(surface, snext, &stats->surface_list,
+			      client_stats_link) {
+		surface->client_stats = NULL;
+		wl_list_init(&surface->client_stats_link);
+	}
+
+	wl_list_for_each_safe(buffer, bnext, &stats->buffer_list,
+			      client_stats_link) {
+		buffer->client_stats = NULL;
+		wl_list_init(&buffer->client_stats_link);
+	}
+
+	wl_list_remove(&stats->link);
+	free(stats);
+}
+
+static struct weston_client_stats *
+client_stats_get(struct weston_client_stats_list *list,
+		 struct wl_client *client)
+{
+	struct weston_client_stats *stats;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+						  client_stats_destroy);
+	if (listener)
+		return container_of(listener, struct weston_client_stats,
+				    destroy_listener);
+
+	stats = zalloc(sizeof *stats);
+	if (!stats)
+		return NULL;
+
+	stats->list = list;
+	stats->client = client;
+	wl_list_init(&stats->surface_list);
+	wl_list_init(&stats->buffer_list);
+	stats->rate_start = weston_compositor_get_time();
+
+	stats->destroy_listener.notify = client_stats_destroy;
+	wl_client_add_destroy_listener(client, &stats->destroy_listener);
+	wl_list_insert(list->clients.prev, &stats->link);
+
+	return stats;
+}
+
+/* Returns -1 when the client is at its surface limit. */
+WL_EXPORT int
+weston_client_stats_add_surface(struct weston_surface *surface,
+				struct wl_client *client)
+{
+	struct weston_client_stats_list *list =
+		surface->compositor->client_stats;
+	struct weston_client_stats *stats;
+
+	wl_list_init(&surface->client_stats_link);
+
+	if (!list || !(stats = client_stats_get(list, client)))
+		return 0;
+
+	if (list->max_surfaces && stats->surfaces >= list->max_surfaces) {
+		weston_log("client %d: over the limit of %u surfaces\n",
+			   client_pid(stats), list->max_surfaces);
+		return -1;
+	}
+
+	surface->client_stats = stats;
+	wl_list_insert(&stats->surface_list, &surface->client_stats_link);
+	stats->surfaces++;
+
+	return 0;
+}
+
+/* After the views of the surface are gone. */
+WL_EXPORT void
+weston_client_stats_remove_surface(struct weston_surface *surface)
+{
+	struct weston_client_stats *stats = surface->client_stats;
+
+	if (!stats)
+		return;
+
+	stats->surfaces--;
+	stats->texture_bytes -= surface->stats.texture_bytes;
+	wl_list_remove(&surface->client_stats_link);
+	surface->client_stats = NULL;
+}
+
+WL_EXPORT void
+weston_client_stats_view(struct weston_view *view, int delta)
+{
+	if (view->surface->client_stats)
+		view->surface->client_stats->views += delta;
+}
+
+/* Called once the renderer has seen the buffer, for its size. */
+WL_EXPORT void
+weston_client_stats_hold_buffer(struct weston_surface *surface,
+				struct weston_buffer *buffer)
+{
+	struct weston_client_stats *stats = surface->client_stats;
+	struct weston_client_stats_list *list;
+	struct wl_shm_buffer *shm_buffer;
+
+	if (!stats || !buffer || buffer->client_stats || !buffer->busy_count)
+		return;
+
+	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (shm_buffer)
+		buffer->client_bytes =
+			(uint64_t) wl_shm_buffer_get_stride(shm_buffer) *
+			buffer->height;
+	else
+		buffer->client_bytes =
+			(uint64_t) buffer->width * buffer->height * 4;
+
+	buffer->client_stats = stats;
+	wl_list_insert(&stats->buffer_list, &buffer->client_stats_link);
+	stats->buffer_bytes += buffer->client_bytes;
+
+	list = stats->list;
+	if (!list->max_buffer_bytes ||
+	    stats->buffer_bytes <= list->max_buffer_bytes) {
+		stats->over_buffer_limit = 0;
+		return;
+	}
+
+	if (!stats->over_buffer_limit)
+		weston_log("client %d: holding %llu kB of buffers, "
+			   "over the limit of %llu kB\n", client_pid(stats),
+			   (unsigned long long) stats->buffer_bytes / 1024,
+			   (unsigned long long) list->max_buffer_bytes / 1024);
+	stats->over_buffer_limit = 1;
+	wl_resource_post_no_memory(surface->resource);
+}
+
+/* When the busy count drops to zero or the buffer goes away. */
+WL_EXPORT void
+weston_client_stats_release_buffer(struct weston_buffer *buffer)
+{
+	struct weston_client_stats *stats = buffer->client_stats;
+
+	if (!stats)
+		return;
+
+	stats->buffer_bytes -= buffer->client_bytes;
+	wl_list_remove(&buffer->client_stats_link);
+	buffer->client_stats = NULL;
+}
+
+/* Damage as committed, in surface coordinates. */
+WL_EXPORT void
+weston_client_stats_damage(struct weston_surface *surface,
+			   pixman_region32_t *damage)
+{
+	struct weston_client_stats *stats = surface->client_stats;
+	pixman_region32_t clipped;
+	pixman_box32_t *rects;
+	int i, n;
+
+	if (!stats || !pixman_region32_not_empty(damage))
+		return;
+
+	pixman_region32_init(&clipped);
+	pixman_region32_intersect_rect(&clipped, damage, 0, 0,
+				       surface->width, surface->height);
+	rects = pixman_region32_rectangles(&clipped, &n);
+	for (i = 0; i < n; i++)
+		stats->rate_damage += (uint64_t) (rects[i].x2 - rects[i].x1) *
+				      (rects[i].y2 - rects[i].y1);
+	pixman_region32_fini(&clipped);
+}
+
+/* At the end of a wl_surface.commit request that started at
+ * start_usec, see weston_client_stats_now(). */
+WL_EXPORT void
+weston_client_stats_commit(struct weston_surface *surface,
+			   uint64_t start_usec)
+{
+	struct weston_client_stats *stats = surface->client_stats;
+
+	if (!stats)
+		return;
+
+	stats_rate_update(stats, weston_compositor_get_time());
+	stats->rate_commits++;
+	stats->rate_cpu += weston_client_stats_now() - start_usec;
+}
+
+/* Whether to hold back the frame callbacks of the surface in this
+ * repaint.  The throttle timer brings the surface round again. */
+WL_EXPORT int
+weston_client_stats_defer_frame(struct weston_surface *surface)
+{
+	struct weston_client_stats *stats = surface->client_stats;
+	struct weston_client_stats_list *list;
+	uint32_t now, interval;
+
+	if (!stats || !stats->throttled ||
+	    wl_list_empty(&surface->frame_callback_list))
+		return 0;
+
+	list = stats->list;
+	interval = 1000 / list->max_commit_rate;
+	now = weston_compositor_get_time();
+
+	/* all surfaces of the client in one repaint go together */
+	if (now == stats->frame_msecs ||
+	    now - stats->frame_msecs >= interval) {
+		stats->frame_msecs = now;
+		return 0;
+	}
+
+	if (!list->throttle_timer_armed) {
+		wl_event_source_timer_update(list->throttle_timer,
+					     interval -
+					     (now - stats->frame_msecs));
+		list->throttle_timer_armed = 1;
+	}
+
+	return 1;
+}
+
+static int
+throttle_timer_handler(void *data)
+{
+	struct weston_client_stats_list *list = data;
+	struct weston_client_stats *stats;
+	struct weston_surface *surface;
+
+	list->throttle_timer_armed = 0;
+
+	wl_list_for_each(stats, &list->clients, link) {
+		if (!stats->throttled)
+			continue;
+
+		wl_list_for_each(surface, &stats->surface_list,
+				 client_stats_link)
+			if (surface->output &&
+			    !wl_list_empty(&surface->frame_callback_list))
+				weston_output_schedule_repaint(surface->output);
+	}
+
+	return 0;
+}
+
+/* The renderer's GPU memory for the surface, see texture_account() in
+ * gl-renderer.c. */
+WL_EXPORT void
+weston_surface_set_texture_bytes(struct weston_surface *surface,
+				 uint64_t bytes)
+{
+	if (surface->client_stats)
+		surface->client_stats->texture_bytes +=
+			bytes - surface->stats.texture_bytes;
+
+	surface->stats.texture_bytes = bytes;
+}
+
+static void
+client_stats_sample(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_client_stats_list *list =
+		wl_resource_get_user_data(resource);
+	struct weston_client_stats *stats;
+	uint32_t now = weston_compositor_get_time();
+	pid_t pid;
+	uid_t uid;
+
+	wl_list_for_each(stats, &list->clients, link) {
+		stats_rate_update(stats, now);
+		wl_client_get_credentials(stats->client, &pid, &uid, NULL);
+		weston_client_stats_send_client(resource, pid, uid,
+						stats->surfaces, stats->views,
+						stats->buffer_bytes / 1024,
+						stats->texture_bytes / 1024,
+						stats->commit_rate,
+						stats->damage_rate,
+						stats->cpu_rate,
+						stats->throttled ?
+						WESTON_CLIENT_STATS_FLAGS_THROTTLED :
+						0);
+	}
+
+	weston_client_stats_send_done(resource);
+}
+
+static void
+client_stats_destroy_request(struct wl_client *client,
+			     struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct weston_client_stats_interface client_stats_implementation = {
+	client_stats_destroy_request,
+	client_stats_sample
+};
+
+static void
+bind_client_stats(struct wl_client *client,
+		  void *data, uint32_t version, uint32_t id)
+{
+	struct weston_client_stats_list *list = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &weston_client_stats_interface,
+				      1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &client_stats_implementation,
+				       list, NULL);
+}
+
+static void
+client_stats_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		     void *data)
+{
+	struct weston_client_stats_list *list = data;
+	struct weston_client_stats *stats;
+	uint32_t now = weston_compositor_get_time();
+
+	weston_log("client stats:\n");
+	wl_list_for_each(stats, &list->clients, link) {
+		stats_rate_update(stats, now);
+		weston_log_continue(STAMP_SPACE "pid %d: %u surfaces, "
+				    "%u views, %llu kB buffers, "
+				    "%llu kB textures, %u commits/s, "
+				    "%u damage px/s, %u us/s%s\n",
+				    client_pid(stats),
+				    stats->surfaces, stats->views,
+				    (unsigned long long)
+				    stats->buffer_bytes / 1024,
+				    (unsigned long long)
+				    stats->texture_bytes / 1024,
+				    stats->commit_rate, stats->damage_rate,
+				    stats->cpu_rate,
+				    stats->throttled ? ", throttled" : "");
+	}
+}
+
+static void
+client_stats_list_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_client_stats_list *list =
+		container_of(listener, struct weston_client_stats_list,
+			     destroy_listener);
+	struct weston_client_stats *stats, *next;
+
+	/* Clients, and so their numbers, may outlive the compositor
+	 * during shutdown. */
+	wl_list_for_each_safe(stats, next, &list->clients, link) {
+		wl_list_remove(&stats->destroy_listener.link);
+		client_stats_destroy(&stats->destroy_listener, NULL);
+	}
+
+	if (list->global)
+		wl_global_destroy(list->global);
+	wl_event_source_remove(list->throttle_timer);
+
+	list->compositor->client_stats = NULL;
+	free(list);
+}
+
+WL_EXPORT void
+weston_client_stats_create(struct weston_compositor *ec)
+{
+	struct weston_client_stats_list *list;
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
+	uint32_t max_buffer_mb;
+	int enabled;
+
+	list = zalloc(sizeof *list);
+	if (list == NULL)
+		return;
+
+	list->compositor = ec;
+	wl_list_init(&list->clients);
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	list->throttle_timer =
+		wl_event_loop_add_timer(loop, throttle_timer_handler, list);
+	if (!list->throttle_timer) {
+		free(list);
+		return;
+	}
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "client-stats", &enabled, 0);
+	weston_config_section_get_uint(section, "client-max-surfaces",
+				       &list->max_surfaces, 0);
+	weston_config_section_get_uint(section, "client-max-buffer-mb",
+				       &max_buffer_mb, 0);
+	list->max_buffer_bytes = (uint64_t) max_buffer_mb << 20;
+	weston_config_section_get_uint(section, "client-max-commit-rate",
+				       &list->max_commit_rate, 0);
+	if (list->max_commit_rate > 1000)
+		list->max_commit_rate = 1000;
+
+	if (enabled)
+		list->global = wl_global_create(ec->wl_display,
+						&weston_client_stats_interface,
+						1, list, bind_client_stats);
+
+	weston_compositor_add_debug_binding(ec, KEY_P,
+					    client_stats_binding, list);
+
+	list->destroy_listener.notify = client_stats_list_destroy;
+	wl_signal_add(&ec->destroy_signal, &list->destroy_listener);
+
+	ec->client_stats = list;
+}
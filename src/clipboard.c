@@ -27,13 +27,23 @@
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 
 #include "compositor.h"
+#include "../shared/os-compatibility.h"
+
+/* The contents file starts at this size and doubles as it fills */
+#define CLIPBOARD_INITIAL_SIZE	(64 * 1024)
 
 struct clipboard_source {
 	struct weston_data_source base;
-	struct wl_array contents;
+	int contents_fd;	/* anonymous file holding the contents */
+	size_t size;		/* bytes read so far */
+	size_t alloc;		/* bytes allocated in contents_fd */
+	int no_splice;
+	struct wl_list clients;	/* waiting for the contents to be read */
 	struct clipboard *clipboard;
 	struct wl_event_source *event_source;
 	uint32_t serial;
@@ -46,9 +56,21 @@ struct clipboard {
 	struct wl_listener selection_listener;
 	struct wl_listener destroy_listener;
 	struct clipboard_source *source;
+	size_t max_size;	/* 0 for no limit */
+};
+
+struct clipboard_client {
+	struct wl_event_source *event_source;
+	struct wl_list link;
+	off_t offset;
+	int fd;
+	int no_sendfile;
+	struct clipboard_source *source;
 };
 
 static void clipboard_client_create(struct clipboard_source *source, int fd);
+static void clipboard_client_start(struct clipboard_client *client);
+static void clipboard_client_destroy(struct clipboard_client *client);
 
 static void
 clipboard_source_unref(struct clipboard_source *source)
@@ -68,35 +90,141 @@ clipboard_source_unref(struct clipboard_source *source)
 	s = source->base.mime_types.data;
 	free(*s);
 	wl_array_release(&source->base.mime_types);
-	wl_array_release(&source->contents);
+	close(source->contents_fd);
 	free(source);
 }
 
+static void
+clipboard_source_stop_reading(struct clipboard_source *source)
+{
+	wl_event_source_remove(source->event_source);
+	close(source->fd);
+	source->event_source = NULL;
+}
+
+/* Gives up on the selection: readers still waiting for it get nothing
+ * and the clipboard no longer offers it. */
+static void
+clipboard_source_fail(struct clipboard_source *source)
+{
+	struct clipboard *clipboard = source->clipboard;
+	struct clipboard_client *client, *next;
+
+	clipboard_source_stop_reading(source);
+
+	wl_list_for_each_safe(client, next, &source->clients, link)
+		clipboard_client_destroy(client);
+
+	if (clipboard->source == source) {
+		clipboard->source = NULL;
+		clipboard_source_unref(source);
+	}
+}
+
+static void
+clipboard_source_done(struct clipboard_source *source)
+{
+	struct clipboard_client *client, *next;
+
+	clipboard_source_stop_reading(source);
+
+	/* Drop the preallocated tail and make the contents immutable
+	 * before any reader sees them. */
+	ftruncate(source->contents_fd, source->size);
+	os_seal_file(source->contents_fd);
+
+	wl_list_for_each_safe(client, next, &source->clients, link) {
+		wl_list_remove(&client->link);
+		wl_list_init(&client->link);
+		clipboard_client_start(client);
+	}
+}
+
+/* Makes room for at least one more byte, doubling the allocation so
+ * that a large selection isn't grown a page at a time. */
+static int
+clipboard_source_reserve(struct clipboard_source *source)
+{
+	size_t alloc;
+
+	if (source->size < source->alloc)
+		return 0;
+
+	alloc = source->alloc ? source->alloc * 2 : CLIPBOARD_INITIAL_SIZE;
+	if (source->clipboard->max_size &&
+	    alloc > source->clipboard->max_size + 1)
+		alloc = source->clipboard->max_size + 1;
+
+#ifdef HAVE_POSIX_FALLOCATE
+	if (posix_fallocate(source->contents_fd, 0, alloc) != 0)
+		return -1;
+#else
+	if (ftruncate(source->contents_fd, alloc) < 0)
+		return -1;
+#endif
+	source->alloc = alloc;
+
+	return 0;
+}
+
+static ssize_t
+clipboard_source_copy(struct clipboard_source *source, int fd, size_t size)
+{
+	char buffer[4096];
+	loff_t offset = source->size;
+	ssize_t len;
+
+	if (!source->no_splice) {
+		/* Move the pipe pages straight into the file */
+		len = splice(fd, NULL, source->contents_fd, &offset, size,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (len >= 0 || errno != EINVAL)
+			return len;
+
+		source->no_splice = 1;
+	}
+
+	if (size > sizeof buffer)
+		size = sizeof buffer;
+
+	len = read(fd, buffer, size);
+	if (len <= 0)
+		return len;
+
+	if (pwrite(source->contents_fd, buffer, len, offset) != len)
+		return -1;
+
+	return len;
+}
+
 static int
 clipboard_source_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_source *source = data;
 	struct clipboard *clipboard = source->clipboard;
-	char *p;
-	int len, size;
+	ssize_t len;
 
-	if (source->contents.alloc - source->contents.size < 1024) {
-		wl_array_add(&source->contents, 1024);
-		source->contents.size -= 1024;
+	if (clipboard_source_reserve(source) < 0) {
+		weston_log("clipboard: out of space for the selection\n");
+		clipboard_source_fail(source);
+		return 1;
 	}
 
-	p = source->contents.data + source->contents.size;
-	size = source->contents.alloc - source->contents.size;
-	len = read(fd, p, size);
+	len = clipboard_source_copy(source, fd,
+				    source->alloc - source->size);
 	if (len == 0) {
-		wl_event_source_remove(source->event_source);
-		close(fd);
-		source->event_source = NULL;
+		clipboard_source_done(source);
 	} else if (len < 0) {
-		clipboard_source_unref(source);
-		clipboard->source = NULL;
+		if (errno != EAGAIN && errno != EINTR)
+			clipboard_source_fail(source);
 	} else {
-		source->contents.size += len;
+		source->size += len;
+		if (clipboard->max_size && source->size > clipboard->max_size) {
+			weston_log("clipboard: selection larger than %zu "
+				   "bytes, not keeping it\n",
+				   clipboard->max_size);
+			clipboard_source_fail(source);
+		}
 	}
 
 	return 1;
@@ -141,7 +269,14 @@ clipboard_source_create(struct clipboard *clipboard,
 	if (source == NULL)
 		return NULL;
 
-	wl_array_init(&source->contents);
+	source->contents_fd = os_create_sealable_file();
+	if (source->contents_fd < 0)
+		goto err_file;
+	source->size = 0;
+	source->alloc = 0;
+	source->no_splice = 0;
+	wl_list_init(&source->clients);
+
 	wl_array_init(&source->base.mime_types);
 	source->base.resource = NULL;
 	source->base.accept = clipboard_source_accept;
@@ -151,6 +286,7 @@ clipboard_source_create(struct clipboard *clipboard,
 	source->refcount = 1;
 	source->clipboard = clipboard;
 	source->serial = serial;
+	source->fd = fd;
 
 	s = wl_array_add(&source->base.mime_types, sizeof *s);
 	if (s == NULL)
@@ -158,6 +294,8 @@ clipboard_source_create(struct clipboard *clipboard,
 	*s = strdup(mime_type);
 	if (*s == NULL)
 		goto err_strdup;
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
 	source->event_source =
 		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
 				     clipboard_source_data, source);
@@ -171,57 +309,110 @@ clipboard_source_create(struct clipboard *clipboard,
  err_strdup:
 	wl_array_release(&source->base.mime_types);
  err_add:
+	close(source->contents_fd);
+ err_file:
 	free(source);
 
 	return NULL;
 }
 
-struct clipboard_client {
-	struct wl_event_source *event_source;
-	size_t offset;
-	struct clipboard_source *source;
-};
+static ssize_t
+clipboard_client_copy(struct clipboard_client *client)
+{
+	struct clipboard_source *source = client->source;
+	char buffer[4096];
+	size_t size = source->size - client->offset;
+	ssize_t len;
+
+	if (!client->no_sendfile) {
+		len = sendfile(client->fd, source->contents_fd,
+			       &client->offset, size);
+		if (len >= 0 || errno != EINVAL)
+			return len;
+
+		client->no_sendfile = 1;
+	}
+
+	if (size > sizeof buffer)
+		size = sizeof buffer;
+
+	len = pread(source->contents_fd, buffer, size, client->offset);
+	if (len <= 0)
+		return len;
+
+	len = write(client->fd, buffer, len);
+	if (len > 0)
+		client->offset += len;
+
+	return len;
+}
 
 static int
 clipboard_client_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_client *client = data;
-	char *p;
-	size_t size;
-	int len;
+	ssize_t len;
 
-	size = client->source->contents.size;
-	p = client->source->contents.data;
-	len = write(fd, p + client->offset, size - client->offset);
-	if (len > 0)
-		client->offset += len;
+	len = clipboard_client_copy(client);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 1;
 
-	if (client->offset == size || len <= 0) {
-		close(fd);
-		wl_event_source_remove(client->event_source);
-		clipboard_source_unref(client->source);
-		free(client);
-	}
+	if ((size_t) client->offset == client->source->size || len <= 0)
+		clipboard_client_destroy(client);
 
 	return 1;
 }
 
 static void
-clipboard_client_create(struct clipboard_source *source, int fd)
+clipboard_client_start(struct clipboard_client *client)
 {
-	struct weston_seat *seat = source->clipboard->seat;
-	struct clipboard_client *client;
+	struct weston_seat *seat = client->source->clipboard->seat;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(seat->compositor->wl_display);
 
-	client = malloc(sizeof *client);
+	client->event_source =
+		wl_event_loop_add_fd(loop, client->fd, WL_EVENT_WRITABLE,
+				     clipboard_client_data, client);
+	if (!client->event_source)
+		clipboard_client_destroy(client);
+}
+
+static void
+clipboard_client_destroy(struct clipboard_client *client)
+{
+	if (client->event_source)
+		wl_event_source_remove(client->event_source);
+	wl_list_remove(&client->link);
+	close(client->fd);
+	clipboard_source_unref(client->source);
+	free(client);
+}
+
+static void
+clipboard_client_create(struct clipboard_source *source, int fd)
+{
+	struct clipboard_client *client;
+
+	client = zalloc(sizeof *client);
+	if (client == NULL) {
+		close(fd);
+		return;
+	}
 
 	client->offset = 0;
+	client->fd = fd;
 	client->source = source;
 	source->refcount++;
-	client->event_source =
-		wl_event_loop_add_fd(loop, fd, WL_EVENT_WRITABLE,
-				     clipboard_client_data, client);
+	wl_list_init(&client->link);
+
+	fcntl(fd, F_SETFL, O_WRONLY | O_NONBLOCK);
+
+	/* Readers asking while the selection is still coming in get it
+	 * once it's all there. */
+	if (source->event_source)
+		wl_list_insert(&source->clients, &client->link);
+	else
+		clipboard_client_start(client);
 }
 
 static void
@@ -282,11 +473,19 @@ struct clipboard *
 clipboard_create(struct weston_seat *seat)
 {
 	struct clipboard *clipboard;
+	struct weston_config_section *s;
+	int max_size;
 
 	clipboard = zalloc(sizeof *clipboard);
 	if (clipboard == NULL)
 		return NULL;
 
+	s = weston_config_get_section(seat->compositor->config,
+				      "core", NULL, NULL);
+	weston_config_section_get_int(s, "clipboard-max-size",
+				      &max_size, 64 * 1024);
+	clipboard->max_size = max_size > 0 ? (size_t) max_size * 1024 : 0;
+
 	clipboard->seat = seat;
 	clipboard->selection_listener.notify = clipboard_set_selection;
 	clipboard->destroy_listener.notify = clipboard_destroy;
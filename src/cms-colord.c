@@ -481,9 +481,10 @@ colord_cms_output_destroy(gpointer data)
 	g_slice_free(struct cms_output, ocms);
 }
 
-WL_EXPORT int
-module_init(struct weston_compositor *ec,
-	    int *argc, char *argv[])
+/* Talking to colord and reading pnp.ids take a while, and the first
+ * frame doesn't need color profiles */
+static void
+colord_init(struct weston_compositor *ec, void *data)
 {
 	gboolean ret;
 	GError *error = NULL;
@@ -496,7 +497,7 @@ module_init(struct weston_compositor *ec,
 	/* create local state object */
 	cms = zalloc(sizeof *cms);
 	if (cms == NULL)
-		return -1;
+		return;
 	cms->ec = ec;
 #if !GLIB_CHECK_VERSION(2,36,0)
 	g_type_init();
@@ -507,7 +508,7 @@ module_init(struct weston_compositor *ec,
 		weston_log("colord: failed to contact daemon: %s\n", error->message);
 		g_error_free(error);
 		colord_module_destroy(cms);
-		return -1;
+		return;
 	}
 	g_mutex_init(&cms->pending_mutex);
 	cms->devices = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -536,7 +537,7 @@ module_init(struct weston_compositor *ec,
 	/* batch device<->profile updates */
 	if (pipe2(fd, O_CLOEXEC) == -1) {
 		colord_module_destroy(cms);
-		return -1;
+		return;
 	}
 	cms->readfd = fd[0];
 	cms->writefd = fd[1];
@@ -548,7 +549,14 @@ module_init(struct weston_compositor *ec,
 					    cms);
 	if (!cms->source) {
 		colord_module_destroy(cms);
-		return -1;
+		return;
 	}
-	return 0;
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *ec,
+	    int *argc, char *argv[])
+{
+	return weston_compositor_defer_init(ec, "cms-colord",
+					    colord_init, NULL);
 }
@@ -49,6 +49,93 @@ weston_cms_gamma_clear(struct weston_output *o)
 	o->set_gamma(o, o->gamma_size, red, red, red);
 	free(red);
 }
+
+/* Grid points per channel of the correction LUT; 33 is what most CMMs
+ * use and keeps the interpolation error below one 8-bit step. */
+#define CMS_LUT_SIZE 33
+
+/* Converts every point of an sRGB grid to the profile once, the
+ * renderer interpolates between them. */
+static int
+weston_cms_build_lut(struct weston_color_profile *p)
+{
+	cmsHPROFILE srgb;
+	cmsHTRANSFORM xform;
+	uint8_t *in, *out;
+	int n = CMS_LUT_SIZE * CMS_LUT_SIZE * CMS_LUT_SIZE;
+	int r, g, b, i;
+
+	if (p->lut)
+		return 0;
+
+	srgb = cmsCreate_sRGBProfile();
+	if (!srgb)
+		return -1;
+	xform = cmsCreateTransform(srgb, TYPE_RGB_8,
+				   p->lcms_handle, TYPE_RGB_8,
+				   INTENT_RELATIVE_COLORIMETRIC,
+				   cmsFLAGS_BLACKPOINTCOMPENSATION);
+	cmsCloseProfile(srgb);
+	if (!xform)
+		return -1;
+
+	in = malloc(n * 3);
+	out = malloc(n * 3);
+	p->lut = malloc(n * 4);
+	if (!in || !out || !p->lut) {
+		free(p->lut);
+		p->lut = NULL;
+		goto out;
+	}
+
+	i = 0;
+	for (b = 0; b < CMS_LUT_SIZE; b++)
+		for (g = 0; g < CMS_LUT_SIZE; g++)
+			for (r = 0; r < CMS_LUT_SIZE; r++) {
+				in[i++] = r * 255 / (CMS_LUT_SIZE - 1);
+				in[i++] = g * 255 / (CMS_LUT_SIZE - 1);
+				in[i++] = b * 255 / (CMS_LUT_SIZE - 1);
+			}
+	cmsDoTransform(xform, in, out, n);
+
+	for (i = 0; i < n; i++) {
+		p->lut[i * 4 + 0] = out[i * 3 + 0];
+		p->lut[i * 4 + 1] = out[i * 3 + 1];
+		p->lut[i * 4 + 2] = out[i * 3 + 2];
+		p->lut[i * 4 + 3] = 0xff;
+	}
+	p->lut_size = CMS_LUT_SIZE;
+
+out:
+	free(in);
+	free(out);
+	cmsDeleteTransform(xform);
+
+	return p->lut ? 0 : -1;
+}
+
+static void
+weston_cms_set_lut(struct weston_output *o, struct weston_color_profile *p)
+{
+	struct weston_renderer *renderer = o->compositor->renderer;
+
+	if (!renderer->output_set_color_lut)
+		return;
+
+	if (!p) {
+		renderer->output_set_color_lut(o, NULL, 0);
+		return;
+	}
+
+	if (weston_cms_build_lut(p) < 0) {
+		weston_log("failed to build a color LUT from %s\n",
+			   p->filename);
+		renderer->output_set_color_lut(o, NULL, 0);
+		return;
+	}
+
+	renderer->output_set_color_lut(o, p->lut, p->lut_size);
+}
 #endif
 
 void
@@ -64,6 +151,8 @@ weston_cms_set_color_profile(struct weston_output *o,
 	uint16_t *green = NULL;
 	uint16_t *blue = NULL;
 
+	weston_cms_set_lut(o, p);
+
 	if (!o->set_gamma)
 		return;
 	if (!p) {
@@ -103,6 +192,7 @@ weston_cms_destroy_profile(struct weston_color_profile *p)
 #ifdef HAVE_LCMS
 	cmsCloseProfile(p->lcms_handle);
 #endif
+	free(p->lut);
 	free(p->filename);
 	free(p);
 }
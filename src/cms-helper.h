@@ -56,6 +56,8 @@
 struct weston_color_profile {
 	char	*filename;
 	void	*lcms_handle;
+	uint8_t	*lut;		/* sRGB to profile, lut_size^3 RGBA */
+	int	 lut_size;
 };
 
 void
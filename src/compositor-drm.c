@@ -35,6 +35,9 @@
 #include <sys/mman.h>
 #include <dlfcn.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -47,14 +50,77 @@
 #include "compositor.h"
 #include "gl-renderer.h"
 #include "pixman-renderer.h"
+#include "linux-dmabuf.h"
 #include "udev-input.h"
 #include "launcher-util.h"
 #include "vaapi-recorder.h"
+#include "presentation_timing-server-protocol.h"
+#include "weston-sdt.h"
 
 #ifndef DRM_CAP_TIMESTAMP_MONOTONIC
 #define DRM_CAP_TIMESTAMP_MONOTONIC 0x6
 #endif
 
+#ifndef DRM_CLIENT_CAP_ATOMIC
+#define DRM_CLIENT_CAP_ATOMIC 3
+#endif
+
+/* Number of client buffers we keep a KMS fb around for */
+#define DRM_FB_CACHE_SIZE 16
+
+/* Longest we keep showing the boot fb with keep-boot-fb */
+#define DRM_BOOT_FB_TIMEOUT_MS 3000
+
+#ifndef GBM_BO_USE_LINEAR
+#define GBM_BO_USE_LINEAR (1 << 4)
+#endif
+
+/* Values of the plane "type" property, not exported by libdrm */
+enum wdrm_plane_type {
+	WDRM_PLANE_TYPE_OVERLAY = 0,
+	WDRM_PLANE_TYPE_PRIMARY = 1,
+	WDRM_PLANE_TYPE_CURSOR = 2,
+};
+
+/* Bits of the plane "rotation" property.  Rotation is counter-clockwise
+ * and applied after the reflection. */
+enum wdrm_plane_rotation {
+	WDRM_ROTATE_0 = (1 << 0),
+	WDRM_ROTATE_90 = (1 << 1),
+	WDRM_ROTATE_180 = (1 << 2),
+	WDRM_ROTATE_270 = (1 << 3),
+	WDRM_REFLECT_X = (1 << 4),
+	WDRM_REFLECT_Y = (1 << 5),
+};
+
+/* KMS properties used by the atomic path, in the order of the name
+ * tables below. */
+enum wdrm_plane_property {
+	WDRM_PLANE_TYPE = 0,
+	WDRM_PLANE_FB_ID,
+	WDRM_PLANE_CRTC_ID,
+	WDRM_PLANE_SRC_X,
+	WDRM_PLANE_SRC_Y,
+	WDRM_PLANE_SRC_W,
+	WDRM_PLANE_SRC_H,
+	WDRM_PLANE_CRTC_X,
+	WDRM_PLANE_CRTC_Y,
+	WDRM_PLANE_CRTC_W,
+	WDRM_PLANE_CRTC_H,
+	WDRM_PLANE__COUNT
+};
+
+enum wdrm_crtc_property {
+	WDRM_CRTC_MODE_ID = 0,
+	WDRM_CRTC_ACTIVE,
+	WDRM_CRTC__COUNT
+};
+
+enum wdrm_connector_property {
+	WDRM_CONNECTOR_CRTC_ID = 0,
+	WDRM_CONNECTOR__COUNT
+};
+
 static int option_current_mode = 0;
 
 enum output_config {
@@ -102,7 +168,57 @@ struct drm_compositor {
 
 	int cursors_are_broken;
 
+	/* Client buffer fbs, most recently used first */
+	struct wl_list fb_cache;
+	int fb_cache_count;
+	uint32_t fb_cache_hits, fb_cache_misses, fb_cache_evictions;
+
 	int use_pixman;
+	int pixman_shadow;
+	int threaded_planes;
+
+	/* [core] adaptive-renderer: pixman while the damage stays small,
+	 * GL once it doesn't, see drm_adaptive_frame() */
+	int adaptive_renderer;
+	struct {
+		uint32_t last_large;	/* msecs */
+		int large_frames;	/* in a row, while on pixman */
+		int switch_pending;
+	} adaptive;
+
+	int atomic_modeset;
+	int keep_boot_fb;
+
+	/* Display-only KMS devices, with multi-gpu enabled */
+	int multi_gpu;
+	struct wl_list secondary_list;
+
+	/* Parsed EDID of every connector we have seen */
+	struct wl_list edid_cache;
+
+	/* Connectors are probed for hotplug events in this thread, the
+	 * results are handed back through the eventfd. */
+	struct {
+		int running;
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		int quit;
+		int fd;
+		struct wl_event_source *source;
+
+		/* Next probe, connector_id 0 probes all of them */
+		int requested;
+		uint32_t connector_id;
+		struct udev_device *device;
+
+		/* Last probe, until the main thread has applied it */
+		int result_ready;
+		int result_full;
+		drmModeRes *resources;
+		struct wl_array probed;
+		struct udev_device *result_device;
+	} hotplug;
 
 	uint32_t prev_state;
 
@@ -113,6 +229,13 @@ struct drm_compositor {
 struct drm_mode {
 	struct weston_mode base;
 	drmModeModeInfo mode_info;
+	uint32_t blob_id;	/* atomic MODE_ID, created on first use */
+};
+
+/* A primary or cursor plane of an output driven with atomic commits */
+struct drm_output_plane {
+	uint32_t plane_id;
+	uint32_t props[WDRM_PLANE__COUNT];
 };
 
 struct drm_output;
@@ -129,6 +252,48 @@ struct drm_fb {
 
 	/* Used by dumb fbs */
 	void *map;
+
+	/* Used by client dmabuf fbs and by frames imported into a
+	 * secondary device, which only use the handles */
+	int is_dmabuf;
+	uint32_t dmabuf_handles[MAX_DMABUF_PLANES];
+	int num_dmabuf_handles;
+
+	/* Used by client fbs, which stay around in the fb cache while
+	 * the wl_buffer lives and are only freed once no longer busy */
+	struct drm_compositor *compositor;
+	struct weston_buffer *cache_buffer;
+	struct wl_listener cache_destroy_listener;
+	struct wl_list cache_link;
+	uint32_t format;
+	int busy;
+
+	/* The fb imported into the output's vaapi recorder */
+	struct vaapi_recorder_buffer *recorder_buffer;
+
+	/* Frames of a gbm surface that clone outputs scan out as well,
+	 * see drm_output_repaint_clone().  output owns the surface, the
+	 * fb goes back to it once clone_refs drops to 0. */
+	int clone_refs;
+	/* Holds only the fb id of a shared frame whose owner went away */
+	int orphan;
+};
+
+/* One sprite plane update, queued by the main thread and issued by
+ * the output's plane worker. */
+struct drm_plane_update {
+	struct drm_sprite *sprite;
+	uint32_t plane_id;
+	uint32_t fb_id;
+	int32_t src_x, src_y;
+	uint32_t src_w, src_h;
+	uint32_t dest_x, dest_y;
+	uint32_t dest_w, dest_h;
+	uint32_t vblank_type;
+	uint32_t colorkey_prop;		/* 0 when the key is unchanged */
+	uint64_t colorkey;
+	uint32_t rotation_prop;		/* 0 when the rotation is unchanged */
+	uint64_t rotation;
 };
 
 struct drm_edid {
@@ -138,9 +303,43 @@ struct drm_edid {
 	char serial_number[13];
 };
 
+/* A KMS device other than the one we render with.  Its outputs are
+ * rendered on the primary GPU and their frames imported as dmabufs. */
+struct drm_secondary {
+	struct wl_list link;
+	int fd;
+	char *filename;
+	struct wl_event_source *source;
+	uint32_t crtc_allocator;
+	uint32_t connector_allocator;
+};
+
+struct drm_edid_cache_entry {
+	struct wl_list link;
+	uint32_t connector_id;
+	uint32_t prop_id;	/* of the connector's EDID property */
+	uint32_t blob_id;	/* changes whenever the EDID does */
+	int valid;
+	struct drm_edid edid;
+};
+
+/* One connector probed for a hotplug event */
+struct drm_probed_connector {
+	uint32_t connector_id;
+	drmModeConnector *connector;	/* NULL if it went away */
+};
+
 struct drm_output {
 	struct weston_output   base;
 
+	/* The KMS device driving the output, either the compositor's or
+	 * that of secondary.  If linear is set, the secondary device
+	 * could only import frames rendered into linear buffers. */
+	int fd;
+	struct drm_secondary *secondary;
+	int linear;
+	int reinit_egl;
+
 	uint32_t crtc_id;
 	int pipe;
 	uint32_t connector_id;
@@ -149,6 +348,18 @@ struct drm_output {
 	drmModePropertyPtr dpms_prop;
 	uint32_t format;
 
+	/* Variable refresh: the CRTC's VRR_ENABLED property, if the
+	 * connector is capable, and whether adaptive-sync is on */
+	uint32_t vrr_prop_id;
+	int adaptive_sync;
+
+	/* [output] render-scale: GL draws at this fraction of the mode
+	 * size and the primary plane scales it up, see
+	 * drm_output_update_render_size().  render_scale_failed is set
+	 * once the plane turned out not to scale. */
+	double render_scale;
+	int render_scale_failed;
+
 	int vblank_pending;
 	int page_flip_pending;
 	int destroy_pending;
@@ -159,16 +370,77 @@ struct drm_output {
 	struct weston_plane fb_plane;
 	struct weston_view *cursor_view;
 	int current_cursor;
+
+	/* Cursor image tracking, so that moving the pointer doesn't
+	 * upload the same image again.  The view and buffer are only
+	 * compared against, never dereferenced. */
+	struct weston_view *cursor_last_view;
+	struct weston_buffer *cursor_last_buffer;
+	uint32_t cursor_hash[2];
+	int cursor_dirty;
+	int cursor_set;
 	struct drm_fb *current, *next;
 	struct backlight *backlight;
 
-	struct drm_fb *dumb[2];
-	pixman_image_t *image[2];
+	/* With flip-queue enabled, current is being scanned out, next is
+	 * the fb of the pending page flip and queued is a frame rendered
+	 * while that flip was pending, flipped to as soon as it is done.
+	 * finish_pending is set while the compositor waits on a
+	 * finish_frame from the page flip handler. */
+	int flip_queue;
+	struct drm_fb *queued;
+	int finish_pending;
+	struct wl_event_source *finish_source;
+
+	/* presentation_feedback for the frame of the pending page flip,
+	 * presented from its handler, and for the queued frame. */
+	struct wl_list flip_feedback;
+	struct wl_list queued_feedback;
+
+	/* The CRTC already ran our mode at startup.  If the fb on it had
+	 * our layout, boot_fb_pitch is its pitch and the first frame is
+	 * page flipped instead of doing a modeset.  With keep-boot-fb,
+	 * that fb stays up until clients have something on screen. */
+	uint32_t boot_fb_pitch;
+	uint32_t boot_fb_id;
+
+	/* The last frame of the renderer we switched away from, removed
+	 * once the new renderer's first frame is on screen */
+	uint32_t retired_fb_id;
+	int boot_fb_hold;
+	struct wl_event_source *boot_fb_timer;
+
+	struct drm_fb *dumb[3];
+	pixman_image_t *image[3];
+	int num_images;
 	int current_image;
 	pixman_region32_t previous_damage;
+	pixman_region32_t older_damage;
 
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
+
+	/* Atomic modesetting: the primary plane, optionally the cursor
+	 * plane and every overlay in use are updated with one commit. */
+	int atomic;
+	struct drm_output_plane primary;
+	struct drm_output_plane cursor;
+	uint32_t crtc_props[WDRM_CRTC__COUNT];
+	uint32_t connector_props[WDRM_CONNECTOR__COUNT];
+
+	/* Plane worker, only used with threaded-planes enabled.  The
+	 * updates array is owned by the worker while busy is set. */
+	struct {
+		int running;
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		int busy;
+		int quit;
+		struct wl_array updates;
+		int setplane_errno;
+		int vblank_errno;
+	} worker;
 };
 
 /*
@@ -186,8 +458,26 @@ struct drm_sprite {
 
 	uint32_t possible_crtcs;
 	uint32_t plane_id;
+	uint32_t props[WDRM_PLANE__COUNT];	/* with atomic modesetting */
 	uint32_t count_formats;
 
+	/* Optional "colorkey" plane property: 0xRRGGBB in the low bits,
+	 * bit 24 enables it.  colorkey is the value for the next frame,
+	 * colorkey_set what the legacy path last wrote. */
+	uint32_t colorkey_prop;
+	uint64_t colorkey, colorkey_set;
+
+	/* Optional "rotation" plane property and the WDRM_ROTATE_* and
+	 * WDRM_REFLECT_* bits it accepts, with the same next/set split. */
+	uint32_t rotation_prop;
+	uint64_t rotations;
+	uint64_t rotation, rotation_set;
+
+	/* Optional atomic "IN_FENCE_FD" property; in_fence_fd is our dup
+	 * of the client's acquire fence for the pending commit. */
+	uint32_t in_fence_prop;
+	int in_fence_fd;
+
 	int32_t src_x, src_y;
 	uint32_t src_w, src_h;
 	uint32_t dest_x, dest_y;
@@ -218,6 +508,10 @@ drm_sprite_crtc_supported(struct weston_output *output_base, uint32_t supported)
 	struct drm_output *output = (struct drm_output *) output_base;
 	int crtc;
 
+	/* The sprites belong to the primary device */
+	if (output->secondary)
+		return 0;
+
 	for (crtc = 0; crtc < c->num_crtcs; crtc++) {
 		if (c->crtcs[crtc] != output->crtc_id)
 			continue;
@@ -229,14 +523,29 @@ drm_sprite_crtc_supported(struct weston_output *output_base, uint32_t supported)
 	return 0;
 }
 
+static void
+drm_fb_close_dmabuf_handles(struct drm_fb *fb);
+
+static void
+drm_fb_release_recorder_buffer(struct drm_fb *fb)
+{
+#ifdef BUILD_VAAPI_RECORDER
+	if (fb->recorder_buffer)
+		vaapi_recorder_buffer_unref(fb->recorder_buffer);
+	fb->recorder_buffer = NULL;
+#endif
+}
+
 static void
 drm_fb_destroy_callback(struct gbm_bo *bo, void *data)
 {
 	struct drm_fb *fb = data;
-	struct gbm_device *gbm = gbm_bo_get_device(bo);
+
+	drm_fb_release_recorder_buffer(fb);
 
 	if (fb->fb_id)
-		drmModeRmFB(gbm_device_get_fd(gbm), fb->fb_id);
+		drmModeRmFB(fb->fd, fb->fb_id);
+	drm_fb_close_dmabuf_handles(fb);
 
 	weston_buffer_reference(&fb->buffer_ref, NULL);
 
@@ -308,6 +617,8 @@ drm_fb_destroy_dumb(struct drm_fb *fb)
 	if (!fb->map)
 		return;
 
+	drm_fb_release_recorder_buffer(fb);
+
 	if (fb->fb_id)
 		drmModeRmFB(fb->fd, fb->fb_id);
 
@@ -389,14 +700,282 @@ err_free:
 	return NULL;
 }
 
+static void
+drm_fb_close_dmabuf_handles(struct drm_fb *fb)
+{
+	struct drm_gem_close gem_close;
+	int i, j;
+
+	/* Planes in the same dmabuf share the handle, close it once */
+	for (i = 0; i < fb->num_dmabuf_handles; i++) {
+		for (j = 0; j < i; j++)
+			if (fb->dmabuf_handles[j] == fb->dmabuf_handles[i])
+				break;
+		if (j < i || fb->dmabuf_handles[i] == 0)
+			continue;
+
+		memset(&gem_close, 0, sizeof gem_close);
+		gem_close.handle = fb->dmabuf_handles[i];
+		drmIoctl(fb->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+	}
+}
+
+/* Import a frame rendered on the primary GPU into the secondary device
+ * that scans it out. */
+static struct drm_fb *
+drm_fb_get_for_secondary(struct gbm_bo *bo, struct drm_output *output)
+{
+	struct drm_fb *fb = gbm_bo_get_user_data(bo);
+	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	int prime_fd, ret;
+
+	if (fb)
+		return fb;
+
+	prime_fd = gbm_bo_get_fd(bo);
+	if (prime_fd < 0)
+		return NULL;
+
+	fb = zalloc(sizeof *fb);
+	if (!fb) {
+		close(prime_fd);
+		return NULL;
+	}
+
+	fb->bo = bo;
+	fb->fd = output->fd;
+	fb->stride = gbm_bo_get_stride(bo);
+	fb->size = fb->stride * gbm_bo_get_height(bo);
+
+	ret = drmPrimeFDToHandle(output->fd, prime_fd, &fb->dmabuf_handles[0]);
+	close(prime_fd);
+	if (ret < 0)
+		goto err_free;
+	fb->num_dmabuf_handles = 1;
+	fb->handle = fb->dmabuf_handles[0];
+
+	handles[0] = fb->handle;
+	pitches[0] = fb->stride;
+	ret = drmModeAddFB2(output->fd, gbm_bo_get_width(bo),
+			    gbm_bo_get_height(bo), output->format,
+			    handles, pitches, offsets, &fb->fb_id, 0);
+	if (ret) {
+		weston_log("failed to import frame into %s: %m\n",
+			   output->secondary->filename);
+		goto err_handles;
+	}
+
+	gbm_bo_set_user_data(bo, fb, drm_fb_destroy_callback);
+
+	return fb;
+
+err_handles:
+	drm_fb_close_dmabuf_handles(fb);
+err_free:
+	free(fb);
+	return NULL;
+}
+
+/* gbm can only import single plane dmabufs, so look up the GEM handles
+ * of the planes directly and create the fb with them. */
+static struct drm_fb *
+drm_fb_get_from_dmabuf(struct linux_dmabuf_buffer *dmabuf,
+		       struct drm_compositor *compositor, uint32_t format)
+{
+	struct dmabuf_attributes *attributes = &dmabuf->attributes;
+	struct drm_mode_fb_cmd2 cmd;
+	struct drm_fb *fb;
+	int i;
+
+	if (compositor->no_addfb2)
+		return NULL;
+
+	if (compositor->min_width > (uint32_t) attributes->width ||
+	    (uint32_t) attributes->width > compositor->max_width ||
+	    compositor->min_height > (uint32_t) attributes->height ||
+	    (uint32_t) attributes->height > compositor->max_height)
+		return NULL;
+
+	fb = zalloc(sizeof *fb);
+	if (!fb)
+		return NULL;
+
+	fb->fd = compositor->drm.fd;
+	fb->is_dmabuf = 1;
+
+	memset(&cmd, 0, sizeof cmd);
+	cmd.width = attributes->width;
+	cmd.height = attributes->height;
+	cmd.pixel_format = format;
+
+	for (i = 0; i < attributes->n_planes; i++) {
+		if (drmPrimeFDToHandle(fb->fd, attributes->fd[i],
+				       &fb->dmabuf_handles[i]) < 0)
+			goto err_handles;
+		fb->num_dmabuf_handles++;
+
+		cmd.handles[i] = fb->dmabuf_handles[i];
+		cmd.pitches[i] = attributes->stride[i];
+		cmd.offsets[i] = attributes->offset[i];
+
+		if (attributes->modifier[i] == 0)
+			continue;
+#ifdef DRM_MODE_FB_MODIFIERS
+		cmd.modifier[i] = attributes->modifier[i];
+		cmd.flags = DRM_MODE_FB_MODIFIERS;
+#else
+		goto err_handles;
+#endif
+	}
+
+	if (drmIoctl(fb->fd, DRM_IOCTL_MODE_ADDFB2, &cmd) < 0)
+		goto err_handles;
+
+	fb->fb_id = cmd.fb_id;
+	fb->handle = fb->dmabuf_handles[0];
+	fb->stride = attributes->stride[0];
+
+	return fb;
+
+err_handles:
+	drm_fb_close_dmabuf_handles(fb);
+	free(fb);
+	return NULL;
+}
+
+static void
+drm_fb_destroy_dmabuf(struct drm_fb *fb)
+{
+	drm_fb_release_recorder_buffer(fb);
+
+	if (fb->fb_id)
+		drmModeRmFB(fb->fd, fb->fb_id);
+
+	drm_fb_close_dmabuf_handles(fb);
+	weston_buffer_reference(&fb->buffer_ref, NULL);
+
+	free(fb);
+}
+
+static void
+drm_fb_destroy_client(struct drm_fb *fb)
+{
+	if (fb->is_dmabuf)
+		drm_fb_destroy_dmabuf(fb);
+	else
+		gbm_bo_destroy(fb->bo);
+}
+
+/* Drop fb from the cache.  If it is still on screen it is freed by
+ * drm_output_release_fb() when it comes off. */
+static void
+drm_fb_cache_evict(struct drm_fb *fb)
+{
+	wl_list_remove(&fb->cache_link);
+	wl_list_remove(&fb->cache_destroy_listener.link);
+	fb->compositor->fb_cache_count--;
+	fb->cache_buffer = NULL;
+
+	if (!fb->busy)
+		drm_fb_destroy_client(fb);
+}
+
+static void
+drm_fb_cache_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct drm_fb *fb =
+		container_of(listener, struct drm_fb, cache_destroy_listener);
+
+	drm_fb_cache_evict(fb);
+}
+
+static struct drm_fb *
+drm_fb_cache_find(struct weston_buffer *buffer)
+{
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&buffer->destroy_signal,
+				 drm_fb_cache_buffer_destroy);
+	if (!listener)
+		return NULL;
+
+	return container_of(listener, struct drm_fb, cache_destroy_listener);
+}
+
+/* Reuse the cached fb of a buffer, which must have been created with
+ * the KMS format we want now. */
+static struct drm_fb *
+drm_fb_cache_use(struct drm_compositor *c, struct drm_fb *fb)
+{
+	wl_list_remove(&fb->cache_link);
+	wl_list_insert(&c->fb_cache, &fb->cache_link);
+	c->fb_cache_hits++;
+
+	return fb;
+}
+
+/* Remember a newly created client fb for buffer, replacing the stale
+ * one if there was any. */
+static void
+drm_fb_cache_insert(struct drm_compositor *c, struct drm_fb *fb,
+		    struct weston_buffer *buffer, uint32_t format)
+{
+	struct drm_fb *old;
+
+	c->fb_cache_misses++;
+
+	old = drm_fb_cache_find(buffer);
+	if (old)
+		drm_fb_cache_evict(old);
+
+	fb->compositor = c;
+	fb->cache_buffer = buffer;
+	fb->format = format;
+	fb->cache_destroy_listener.notify = drm_fb_cache_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &fb->cache_destroy_listener);
+	wl_list_insert(&c->fb_cache, &fb->cache_link);
+	c->fb_cache_count++;
+
+	while (c->fb_cache_count > DRM_FB_CACHE_SIZE) {
+		old = container_of(c->fb_cache.prev,
+				   struct drm_fb, cache_link);
+		drm_fb_cache_evict(old);
+		c->fb_cache_evictions++;
+	}
+}
+
+static void
+drm_fb_cache_flush(struct drm_compositor *c)
+{
+	struct drm_fb *fb, *next;
+
+	wl_list_for_each_safe(fb, next, &c->fb_cache, cache_link)
+		drm_fb_cache_evict(fb);
+}
+
+/* A cached fb can be on several planes or in the flip queue more than
+ * once, hold one buffer reference for as long as it is busy. */
 static void
 drm_fb_set_buffer(struct drm_fb *fb, struct weston_buffer *buffer)
 {
-	assert(fb->buffer_ref.buffer == NULL);
+	assert(fb->busy > 0 || fb->buffer_ref.buffer == NULL);
 
 	fb->is_client_buffer = 1;
 
-	weston_buffer_reference(&fb->buffer_ref, buffer);
+	if (fb->busy++ == 0)
+		weston_buffer_reference(&fb->buffer_ref, buffer);
+}
+
+static int
+drm_output_is_dumb(struct drm_output *output, struct drm_fb *fb)
+{
+	int i;
+
+	for (i = 0; i < output->num_images; i++)
+		if (fb == output->dumb[i])
+			return 1;
+
+	return 0;
 }
 
 static void
@@ -405,15 +984,32 @@ drm_output_release_fb(struct drm_output *output, struct drm_fb *fb)
 	if (!fb)
 		return;
 
-	if (fb->map &&
-            (fb != output->dumb[0] && fb != output->dumb[1])) {
+	if (fb->orphan) {
+		if (--fb->clone_refs > 0)
+			return;
+		drmModeRmFB(fb->fd, fb->fb_id);
+		free(fb);
+		return;
+	}
+
+	if (fb->clone_refs > 0) {
+		fb->clone_refs--;
+		return;
+	}
+	if (fb->output)
+		output = fb->output;
+
+	if (fb->map && !drm_output_is_dumb(output, fb)) {
 		drm_fb_destroy_dumb(fb);
+	} else if (fb->is_client_buffer) {
+		if (--fb->busy > 0)
+			return;
+
+		weston_buffer_reference(&fb->buffer_ref, NULL);
+		if (!fb->cache_buffer)
+			drm_fb_destroy_client(fb);
 	} else if (fb->bo) {
-		if (fb->is_client_buffer)
-			gbm_bo_destroy(fb->bo);
-		else
-			gbm_surface_release_buffer(output->surface,
-						   fb->bo);
+		gbm_surface_release_buffer(output->surface, fb->bo);
 	}
 }
 
@@ -447,6 +1043,41 @@ drm_output_check_scanout_format(struct drm_output *output,
 	return 0;
 }
 
+/* An fd of -1 means the client did not attach an acquire fence. */
+static int
+drm_fence_signaled(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	if (fd < 0)
+		return 1;
+
+	return poll(&pfd, 1, 0) == 1;
+}
+
+static int
+drm_view_covers_output(struct drm_output *output, struct weston_view *ev)
+{
+	pixman_box32_t *box;
+
+	if (!ev->transform.enabled)
+		return ev->geometry.x == output->base.x &&
+		       ev->geometry.y == output->base.y;
+
+	/* Shells that place everything through transformations, like
+	 * ivi-layout, can allow scanout of a view that is only moved
+	 * and scaled to exactly cover the output. */
+	if (!(ev->plane_hint & WESTON_VIEW_PLANE_HINT_SCANOUT) ||
+	    ev->transform.matrix.type >= WESTON_MATRIX_TRANSFORM_ROTATE)
+		return 0;
+
+	box = pixman_region32_extents(&ev->transform.boundingbox);
+	return box->x1 == output->base.x &&
+	       box->y1 == output->base.y &&
+	       box->x2 == output->base.x + output->base.width &&
+	       box->y2 == output->base.y + output->base.height;
+}
+
 static struct weston_plane *
 drm_output_prepare_scanout_view(struct weston_output *_output,
 				struct weston_view *ev)
@@ -456,18 +1087,36 @@ drm_output_prepare_scanout_view(struct weston_output *_output,
 		(struct drm_compositor *) output->base.compositor;
 	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
 	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	struct drm_fb *cached;
 	struct gbm_bo *bo;
 	uint32_t format;
 
-	if (ev->geometry.x != output->base.x ||
-	    ev->geometry.y != output->base.y ||
+	if (!drm_view_covers_output(output, ev) ||
+	    ev->colorkey_enabled ||
+	    !drm_fence_signaled(ev->surface->acquire_fence_fd) ||
 	    buffer == NULL || c->gbm == NULL ||
+	    output->base.render_width ||
 	    buffer->width != output->base.current_mode->width ||
 	    buffer->height != output->base.current_mode->height ||
-	    output->base.transform != viewport->buffer.transform ||
-	    ev->transform.enabled)
+	    output->base.transform != viewport->buffer.transform)
+		return NULL;
+
+	cached = drm_fb_cache_find(buffer);
+	if (cached && cached->is_dmabuf)
 		return NULL;
 
+	if (cached) {
+		format = drm_output_check_scanout_format(output, ev->surface,
+							 cached->bo);
+		if (format == 0)
+			return NULL;
+		if (format == cached->format) {
+			output->next = drm_fb_cache_use(c, cached);
+			drm_fb_set_buffer(output->next, buffer);
+			return &output->fb_plane;
+		}
+	}
+
 	bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
 			   buffer->resource, GBM_BO_USE_SCANOUT);
 
@@ -487,6 +1136,7 @@ drm_output_prepare_scanout_view(struct weston_output *_output,
 		return NULL;
 	}
 
+	drm_fb_cache_insert(c, output->next, buffer, format);
 	drm_fb_set_buffer(output->next, buffer);
 
 	return &output->fb_plane;
@@ -507,10 +1157,20 @@ drm_output_render_gl(struct drm_output *output, pixman_region32_t *damage)
 		return;
 	}
 
-	output->next = drm_fb_get_from_bo(bo, c, output->format);
+	if (output->secondary)
+		output->next = drm_fb_get_for_secondary(bo, output);
+	else
+		output->next = drm_fb_get_from_bo(bo, c, output->format);
 	if (!output->next) {
 		weston_log("failed to get drm_fb for bo\n");
 		gbm_surface_release_buffer(output->surface, bo);
+
+		/* The display can't take the GPU's tiling, have the GPU
+		 * render into linear buffers instead. */
+		if (output->secondary && !output->linear && !output->current) {
+			output->linear = 1;
+			output->reinit_egl = 1;
+		}
 		return;
 	}
 }
@@ -526,10 +1186,18 @@ drm_output_render_pixman(struct drm_output *output, pixman_region32_t *damage)
 
 	pixman_region32_copy(&previous_damage, damage);
 
+	/* With three images, the one we draw into missed two frames */
 	pixman_region32_union(&total_damage, damage, &output->previous_damage);
+	if (output->num_images == 3) {
+		pixman_region32_union(&total_damage, &total_damage,
+				      &output->older_damage);
+		pixman_region32_copy(&output->older_damage,
+				     &output->previous_damage);
+	}
 	pixman_region32_copy(&output->previous_damage, &previous_damage);
 
-	output->current_image ^= 1;
+	output->current_image =
+		(output->current_image + 1) % output->num_images;
 
 	output->next = output->dumb[output->current_image];
 	pixman_renderer_output_set_buffer(&output->base,
@@ -562,7 +1230,6 @@ drm_output_set_gamma(struct weston_output *output_base,
 {
 	int rc;
 	struct drm_output *output = (struct drm_output *) output_base;
-	struct drm_compositor *compositor = (struct drm_compositor *) output->base.compositor;
 
 	/* check */
 	if (output_base->gamma_size != size)
@@ -570,7 +1237,7 @@ drm_output_set_gamma(struct weston_output *output_base,
 	if (!output->original_crtc)
 		return;
 
-	rc = drmModeCrtcSetGamma(compositor->drm.fd,
+	rc = drmModeCrtcSetGamma(output->fd,
 				 output->crtc_id,
 				 size, r, g, b);
 	if (rc)
@@ -578,94 +1245,1015 @@ drm_output_set_gamma(struct weston_output *output_base,
 }
 
 static int
-drm_output_repaint(struct weston_output *output_base,
-		   pixman_region32_t *damage)
+drm_plane_update_issue(int fd, uint32_t crtc_id,
+		       struct drm_plane_update *u, int *vblank_ret)
 {
-	struct drm_output *output = (struct drm_output *) output_base;
-	struct drm_compositor *compositor =
-		(struct drm_compositor *) output->base.compositor;
-	struct drm_sprite *s;
-	struct drm_mode *mode;
-	int ret = 0;
+	drmVBlank vbl = {
+		.request.type = u->vblank_type,
+		.request.sequence = 1,
+		.request.signal = (unsigned long) u->sprite,
+	};
+	int ret;
+
+	if (u->colorkey_prop)
+		drmModeObjectSetProperty(fd, u->plane_id,
+					 DRM_MODE_OBJECT_PLANE,
+					 u->colorkey_prop, u->colorkey);
+	if (u->rotation_prop)
+		drmModeObjectSetProperty(fd, u->plane_id,
+					 DRM_MODE_OBJECT_PLANE,
+					 u->rotation_prop, u->rotation);
+
+	ret = drmModeSetPlane(fd, u->plane_id, crtc_id, u->fb_id, 0,
+			      u->dest_x, u->dest_y, u->dest_w, u->dest_h,
+			      u->src_x, u->src_y, u->src_w, u->src_h);
+
+	/*
+	 * Queue a vblank signal so we know when the surface
+	 * becomes active on the display or has been replaced.
+	 */
+	*vblank_ret = drmWaitVBlank(fd, &vbl);
+
+	return ret;
+}
+
+static void *
+drm_output_plane_worker(void *data)
+{
+	struct drm_output *output = data;
+	struct drm_plane_update *u;
+	int vblank_ret;
+
+	pthread_mutex_lock(&output->worker.mutex);
+	while (1) {
+		while (!output->worker.busy && !output->worker.quit)
+			pthread_cond_wait(&output->worker.cond,
+					  &output->worker.mutex);
+		if (output->worker.quit)
+			break;
+
+		/* Legacy SetPlane may block until the next vblank on
+		 * some drivers, so do not hold the lock across it. */
+		pthread_mutex_unlock(&output->worker.mutex);
+		wl_array_for_each(u, &output->worker.updates) {
+			if (drm_plane_update_issue(output->fd, output->crtc_id,
+						   u, &vblank_ret))
+				output->worker.setplane_errno = errno;
+			if (vblank_ret)
+				output->worker.vblank_errno = errno;
+		}
+		pthread_mutex_lock(&output->worker.mutex);
+
+		output->worker.updates.size = 0;
+		output->worker.busy = 0;
+		pthread_cond_signal(&output->worker.cond);
+	}
+	pthread_mutex_unlock(&output->worker.mutex);
+
+	return NULL;
+}
+
+static int
+drm_output_worker_init(struct drm_output *output)
+{
+	wl_array_init(&output->worker.updates);
+	pthread_mutex_init(&output->worker.mutex, NULL);
+	pthread_cond_init(&output->worker.cond, NULL);
+
+	if (pthread_create(&output->worker.thread, NULL,
+			   drm_output_plane_worker, output) != 0) {
+		weston_log("failed to start plane worker for %s\n",
+			   output->base.name);
+		pthread_cond_destroy(&output->worker.cond);
+		pthread_mutex_destroy(&output->worker.mutex);
+		return -1;
+	}
+
+	output->worker.running = 1;
+
+	return 0;
+}
+
+/* Wait until the worker has issued all previously queued plane updates,
+ * after which the main thread may touch the planes again. */
+static void
+drm_output_worker_wait(struct drm_output *output)
+{
+	int setplane_errno, vblank_errno;
+
+	if (!output->worker.running)
+		return;
+
+	pthread_mutex_lock(&output->worker.mutex);
+	while (output->worker.busy)
+		pthread_cond_wait(&output->worker.cond, &output->worker.mutex);
+	setplane_errno = output->worker.setplane_errno;
+	vblank_errno = output->worker.vblank_errno;
+	output->worker.setplane_errno = 0;
+	output->worker.vblank_errno = 0;
+	pthread_mutex_unlock(&output->worker.mutex);
+
+	if (setplane_errno)
+		weston_log("setplane failed: %s\n", strerror(setplane_errno));
+	if (vblank_errno)
+		weston_log("vblank event request failed: %s\n",
+			   strerror(vblank_errno));
+}
+
+static void
+drm_output_worker_submit(struct drm_output *output)
+{
+	pthread_mutex_lock(&output->worker.mutex);
+	output->worker.busy = 1;
+	pthread_cond_signal(&output->worker.cond);
+	pthread_mutex_unlock(&output->worker.mutex);
+}
+
+static void
+drm_output_worker_fini(struct drm_output *output)
+{
+	if (!output->worker.running)
+		return;
+
+	pthread_mutex_lock(&output->worker.mutex);
+	output->worker.quit = 1;
+	pthread_cond_signal(&output->worker.cond);
+	pthread_mutex_unlock(&output->worker.mutex);
+
+	pthread_join(output->worker.thread, NULL);
+	pthread_cond_destroy(&output->worker.cond);
+	pthread_mutex_destroy(&output->worker.mutex);
+	wl_array_release(&output->worker.updates);
+	output->worker.running = 0;
+}
+
+static void
+drm_compositor_wait_plane_workers(struct drm_compositor *c)
+{
+	struct drm_output *output;
+
+	wl_list_for_each(output, &c->base.output_list, base.link)
+		drm_output_worker_wait(output);
+}
+
+#ifdef HAVE_DRM_ATOMIC
+static const char * const plane_prop_names[] = {
+	[WDRM_PLANE_TYPE] = "type",
+	[WDRM_PLANE_FB_ID] = "FB_ID",
+	[WDRM_PLANE_CRTC_ID] = "CRTC_ID",
+	[WDRM_PLANE_SRC_X] = "SRC_X",
+	[WDRM_PLANE_SRC_Y] = "SRC_Y",
+	[WDRM_PLANE_SRC_W] = "SRC_W",
+	[WDRM_PLANE_SRC_H] = "SRC_H",
+	[WDRM_PLANE_CRTC_X] = "CRTC_X",
+	[WDRM_PLANE_CRTC_Y] = "CRTC_Y",
+	[WDRM_PLANE_CRTC_W] = "CRTC_W",
+	[WDRM_PLANE_CRTC_H] = "CRTC_H",
+};
+
+static const char * const crtc_prop_names[] = {
+	[WDRM_CRTC_MODE_ID] = "MODE_ID",
+	[WDRM_CRTC_ACTIVE] = "ACTIVE",
+};
+
+static const char * const connector_prop_names[] = {
+	[WDRM_CONNECTOR_CRTC_ID] = "CRTC_ID",
+};
+
+/* Look up the ids of the named properties of a KMS object, and the
+ * current value of the first one.  Returns -1 if any is missing. */
+static int
+drm_object_get_props(int fd, uint32_t obj_id, uint32_t obj_type,
+		     const char * const *names, uint32_t *ids, int count,
+		     uint64_t *first_value)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	uint32_t i;
+	int j, found = 0;
+
+	memset(ids, 0, count * sizeof *ids);
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (!props)
+		return -1;
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		for (j = 0; j < count; j++) {
+			if (ids[j] || strcmp(prop->name, names[j]) != 0)
+				continue;
+
+			ids[j] = prop->prop_id;
+			if (j == 0 && first_value)
+				*first_value = props->prop_values[i];
+			found++;
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return found == count ? 0 : -1;
+}
+
+/* Point a plane at fb, or turn it off when fb is NULL.  src is in
+ * 16.16 fixed point, like drmModeSetPlane. */
+static int
+drm_atomic_add_plane(drmModeAtomicReq *req, uint32_t plane_id,
+		     const uint32_t *props, uint32_t crtc_id,
+		     struct drm_fb *fb,
+		     uint32_t src_x, uint32_t src_y,
+		     uint32_t src_w, uint32_t src_h,
+		     int32_t dest_x, int32_t dest_y,
+		     uint32_t dest_w, uint32_t dest_h)
+{
+	int ret = 0;
+
+	if (!fb) {
+		ret |= drmModeAtomicAddProperty(req, plane_id,
+						props[WDRM_PLANE_FB_ID], 0);
+		ret |= drmModeAtomicAddProperty(req, plane_id,
+						props[WDRM_PLANE_CRTC_ID], 0);
+		return ret < 0 ? -1 : 0;
+	}
+
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_FB_ID], fb->fb_id);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_CRTC_ID], crtc_id);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_SRC_X], src_x);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_SRC_Y], src_y);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_SRC_W], src_w);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_SRC_H], src_h);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_CRTC_X], dest_x);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_CRTC_Y], dest_y);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_CRTC_W], dest_w);
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props[WDRM_PLANE_CRTC_H], dest_h);
+
+	return ret < 0 ? -1 : 0;
+}
+
+static int
+drm_atomic_add_primary(drmModeAtomicReq *req, struct drm_output *output,
+		       struct drm_fb *fb)
+{
+	struct weston_mode *mode = output->base.current_mode;
+	int32_t width = mode->width, height = mode->height;
+
+	/* Our own frames may be drawn smaller, the plane scales them up */
+	if (fb && !fb->is_client_buffer && !fb->orphan &&
+	    output->base.render_width) {
+		width = output->base.render_width;
+		height = output->base.render_height;
+	}
+
+	return drm_atomic_add_plane(req, output->primary.plane_id,
+				    output->primary.props, output->crtc_id, fb,
+				    0, 0, width << 16, height << 16,
+				    0, 0, mode->width, mode->height);
+}
+
+static int
+drm_atomic_add_sprite(drmModeAtomicReq *req, struct drm_output *output,
+		      struct drm_sprite *s, struct drm_fb *fb)
+{
+	if (s->colorkey_prop &&
+	    drmModeAtomicAddProperty(req, s->plane_id, s->colorkey_prop,
+				     s->colorkey) < 0)
+		return -1;
+
+	if (s->rotation_prop &&
+	    drmModeAtomicAddProperty(req, s->plane_id, s->rotation_prop,
+				     s->rotation) < 0)
+		return -1;
+
+	if (fb && s->in_fence_fd >= 0 &&
+	    drmModeAtomicAddProperty(req, s->plane_id, s->in_fence_prop,
+				     s->in_fence_fd) < 0)
+		return -1;
+
+	return drm_atomic_add_plane(req, s->plane_id, s->props,
+				    output->crtc_id, fb,
+				    s->src_x, s->src_y, s->src_w, s->src_h,
+				    s->dest_x, s->dest_y, s->dest_w, s->dest_h);
+}
+
+static int
+drm_atomic_add_modeset(drmModeAtomicReq *req, struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_mode *mode =
+		container_of(output->base.current_mode, struct drm_mode, base);
+	int ret = 0;
+
+	/* The blobs go away with the DRM fd. */
+	if (!mode->blob_id &&
+	    drmModeCreatePropertyBlob(c->drm.fd, &mode->mode_info,
+				      sizeof mode->mode_info,
+				      &mode->blob_id) != 0) {
+		weston_log("failed to create mode blob: %m\n");
+		return -1;
+	}
+
+	ret |= drmModeAtomicAddProperty(req, output->crtc_id,
+					output->crtc_props[WDRM_CRTC_MODE_ID],
+					mode->blob_id);
+	ret |= drmModeAtomicAddProperty(req, output->crtc_id,
+					output->crtc_props[WDRM_CRTC_ACTIVE],
+					1);
+	ret |= drmModeAtomicAddProperty(req, output->connector_id,
+					output->connector_props[WDRM_CONNECTOR_CRTC_ID],
+					output->crtc_id);
+
+	return ret < 0 ? -1 : 0;
+}
+
+/* Ask the kernel whether the primary and the overlays assigned to this
+ * output so far can be shown together, without applying anything. */
+static int
+drm_output_test_planes(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_fb *fb = output->next ? output->next : output->current;
+	struct drm_sprite *s;
+	drmModeAtomicReq *req;
+	int ret = -1;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	if (fb && drm_atomic_add_primary(req, output, fb) < 0)
+		goto out;
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (!s->next || s->output != output)
+			continue;
+		if (drm_atomic_add_sprite(req, output, s, s->next) < 0)
+			goto out;
+	}
+
+	ret = drmModeAtomicCommit(c->drm.fd, req,
+				  DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+
+out:
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+static int
+drm_output_set_cursor_atomic(struct drm_output *output,
+			     drmModeAtomicReq *req);
+
+/* The kernel takes its own reference on the fences at commit time. */
+static void
+drm_output_clear_in_fences(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (s->output != output || s->in_fence_fd < 0)
+			continue;
+		close(s->in_fence_fd);
+		s->in_fence_fd = -1;
+	}
+}
+
+/* The primary, overlay and cursor planes of the output change in one
+ * commit and all take effect at the page flip. */
+static int
+drm_output_repaint_atomic(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
+	struct drm_sprite *s;
+	struct drm_fb *fb;
+	drmModeAtomicReq *req;
+	int legacy_cursor;
+
+	int inherit;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		goto err;
+
+	inherit = !output->current &&
+		  output->boot_fb_pitch == output->next->stride;
+	output->boot_fb_pitch = 0;
+
+	if ((!output->current && !inherit) ||
+	    (output->current &&
+	     output->current->stride != output->next->stride)) {
+		if (drm_atomic_add_modeset(req, output) < 0)
+			goto err;
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	if (drm_atomic_add_primary(req, output, output->next) < 0)
+		goto err;
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if ((!s->current && !s->next) ||
+		    !drm_sprite_crtc_supported(&output->base,
+					       s->possible_crtcs))
+			continue;
+
+		fb = c->sprites_hidden ? NULL : s->next;
+		if (drm_atomic_add_sprite(req, output, s, fb) < 0)
+			goto err;
+		s->output = output;
+	}
+
+	legacy_cursor = !output->cursor.plane_id || c->cursors_are_broken;
+	if (!legacy_cursor && drm_output_set_cursor_atomic(output, req) < 0)
+		goto err;
+
+	/* Not everything the boot fb was set up with carries over */
+	if (inherit &&
+	    drmModeAtomicCommit(c->drm.fd, req,
+				DRM_MODE_ATOMIC_TEST_ONLY, NULL) != 0) {
+		if (drm_atomic_add_modeset(req, output) < 0)
+			goto err;
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	if (drmModeAtomicCommit(c->drm.fd, req, flags, output) != 0) {
+		weston_log("atomic commit failed: %m\n");
+		if (output->base.render_width && !output->render_scale_failed) {
+			weston_log("%s: the primary plane doesn't scale, "
+				   "rendering at the mode size\n",
+				   output->base.name);
+			output->render_scale_failed = 1;
+			weston_output_damage(&output->base);
+		}
+		goto err;
+	}
+
+	drmModeAtomicFree(req);
+	drm_output_clear_in_fences(output);
+
+	if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET)
+		output->base.set_dpms(&output->base, WESTON_DPMS_ON);
+
+	output->page_flip_pending = 1;
+
+	if (legacy_cursor)
+		drm_output_set_cursor(output);
+
+	WESTON_TRACE2(drm_flip_submit, output->crtc_id, 1);
+	weston_timeline_point(&output->base, WESTON_TIMELINE_PAGE_FLIP_QUEUED);
+
+	return 0;
+
+err:
+	if (req)
+		drmModeAtomicFree(req);
+
+	drm_output_clear_in_fences(output);
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (s->output != output || !s->next)
+			continue;
+		drm_output_release_fb(output, s->next);
+		s->next = NULL;
+	}
+
+	output->cursor_view = NULL;
+	drm_output_release_fb(output, output->next);
+	output->next = NULL;
+
+	return -1;
+}
+
+/* Find the primary plane of the output and, if there is one, a cursor
+ * plane, plus the CRTC and connector properties for modesetting. */
+static int
+drm_output_init_atomic(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_output_plane plane, *target;
+	drmModePlaneRes *plane_res;
+	drmModePlane *p;
+	uint64_t type;
+	uint32_t i;
+
+	if (drm_object_get_props(c->drm.fd, output->crtc_id,
+				 DRM_MODE_OBJECT_CRTC, crtc_prop_names,
+				 output->crtc_props, WDRM_CRTC__COUNT,
+				 NULL) < 0 ||
+	    drm_object_get_props(c->drm.fd, output->connector_id,
+				 DRM_MODE_OBJECT_CONNECTOR,
+				 connector_prop_names, output->connector_props,
+				 WDRM_CONNECTOR__COUNT, NULL) < 0)
+		return -1;
+
+	plane_res = drmModeGetPlaneResources(c->drm.fd);
+	if (!plane_res)
+		return -1;
+
+	memset(&output->primary, 0, sizeof output->primary);
+	memset(&output->cursor, 0, sizeof output->cursor);
+
+	for (i = 0; i < plane_res->count_planes; i++) {
+		p = drmModeGetPlane(c->drm.fd, plane_res->planes[i]);
+		if (!p)
+			continue;
+
+		plane.plane_id = p->plane_id;
+		if (!(p->possible_crtcs & (1 << output->pipe)) ||
+		    drm_object_get_props(c->drm.fd, p->plane_id,
+					 DRM_MODE_OBJECT_PLANE,
+					 plane_prop_names, plane.props,
+					 WDRM_PLANE__COUNT, &type) < 0) {
+			drmModeFreePlane(p);
+			continue;
+		}
+		drmModeFreePlane(p);
+
+		if (type == WDRM_PLANE_TYPE_PRIMARY)
+			target = &output->primary;
+		else if (type == WDRM_PLANE_TYPE_CURSOR)
+			target = &output->cursor;
+		else
+			continue;
+
+		if (!target->plane_id)
+			*target = plane;
+	}
+
+	drmModeFreePlaneResources(plane_res);
+
+	if (!output->primary.plane_id)
+		return -1;
+
+	return 0;
+}
+#endif
+
+static void
+drm_output_finish_early(void *data)
+{
+	struct drm_output *output = data;
+
+	output->finish_source = NULL;
+	weston_output_finish_frame(&output->base, output->base.frame_time);
+}
+
+/* A flip is still pending, so render into a free buffer and leave the
+ * frame for the page flip handler to flip to. */
+static int
+drm_output_queue_frame(struct drm_output *output, pixman_region32_t *damage)
+{
+	struct drm_fb *pending = output->next;
+
+	assert(output->queued == NULL);
+
+	output->next = NULL;
+	drm_output_render(output, damage);
+	output->queued = output->next;
+	output->next = pending;
+
+	if (!output->queued)
+		return -1;
+
+	wl_list_insert_list(&output->queued_feedback,
+			    &output->base.feedback_list);
+	wl_list_init(&output->base.feedback_list);
+
+	output->finish_pending = 1;
+
+	return 0;
+}
+
+static int
+drm_output_flip_queued(struct drm_output *output)
+{
+	if (drmModePageFlip(output->fd, output->crtc_id,
+			    output->queued->fb_id,
+			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
+		weston_log("queueing pageflip failed: %m\n");
+		drm_output_release_fb(output, output->queued);
+		output->queued = NULL;
+		weston_presentation_feedback_discard_list(
+						&output->queued_feedback);
+		return -1;
+	}
+
+	WESTON_TRACE2(drm_flip_submit, output->crtc_id, 0);
+	output->next = output->queued;
+	output->queued = NULL;
+	wl_list_insert_list(&output->flip_feedback, &output->queued_feedback);
+	wl_list_init(&output->queued_feedback);
+
+	return 0;
+}
+
+static int
+drm_output_modeset(struct drm_output *output)
+{
+	struct drm_mode *mode;
+
+	mode = container_of(output->base.current_mode, struct drm_mode, base);
+	if (drmModeSetCrtc(output->fd, output->crtc_id,
+			   output->next->fb_id, 0, 0,
+			   &output->connector_id, 1, &mode->mode_info)) {
+		weston_log("set mode failed: %m\n");
+		return -1;
+	}
+
+	output->base.set_dpms(&output->base, WESTON_DPMS_ON);
+
+	return 0;
+}
+
+static void
+drm_output_end_boot_fb_hold(struct drm_output *output)
+{
+	if (!output->boot_fb_hold)
+		return;
+
+	output->boot_fb_hold = 0;
+	output->base.disable_planes--;
+	wl_event_source_remove(output->boot_fb_timer);
+	output->boot_fb_timer = NULL;
+}
+
+static int
+drm_output_boot_fb_timeout(void *data)
+{
+	struct drm_output *output = data;
+
+	drm_output_end_boot_fb_hold(output);
+	weston_output_schedule_repaint(&output->base);
+
+	return 0;
+}
+
+/* Whether a client surface is visible, as opposed to only the
+ * compositor's own black and fade surfaces. */
+static int
+drm_output_has_client_content(struct drm_output *output)
+{
+	struct weston_view **evp;
+
+	wl_array_for_each(evp, &output->base.views)
+		if ((*evp)->surface->resource &&
+		    (*evp)->surface->buffer_ref.buffer &&
+		    !(*evp)->occluded)
+			return 1;
+
+	return 0;
+}
+
+static int
+drm_output_reinit_egl(struct drm_output *output);
+static void
+drm_adaptive_frame(struct drm_output *output, pixman_region32_t *damage);
+static void
+drm_output_retire_fb(struct drm_output *output);
+static void
+drm_output_update_render_size(struct drm_output *output);
+
+/* Outputs at the same place, size and transform show the same pixels.
+ * The first of them in the output list renders, the others scan out
+ * its frames.  Not with a flip queue, the clones would hold on to more
+ * buffers than the gbm surface has, nor with a renderer that may go
+ * away under the shared frames. */
+static int
+drm_output_same_content(struct drm_output *a, struct drm_output *b)
+{
+	return a->base.x == b->base.x && a->base.y == b->base.y &&
+	       a->base.width == b->base.width &&
+	       a->base.height == b->base.height &&
+	       a->base.transform == b->base.transform &&
+	       a->base.current_scale == b->base.current_scale &&
+	       a->base.current_mode->width == b->base.current_mode->width &&
+	       a->base.current_mode->height == b->base.current_mode->height &&
+	       a->format == b->format &&
+	       a->base.render_width == b->base.render_width &&
+	       a->base.render_height == b->base.render_height &&
+	       !a->base.zoom.active && !b->base.zoom.active &&
+	       !a->secondary && !b->secondary &&
+	       !a->flip_queue && !b->flip_queue &&
+	       !a->destroy_pending && !b->destroy_pending;
+}
+
+static struct drm_output *
+drm_output_clone_source(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_output *o;
+
+	if (c->use_pixman || c->adaptive_renderer)
+		return NULL;
+
+	wl_list_for_each(o, &c->base.output_list, base.link) {
+		if (o == output)
+			break;
+		if (drm_output_same_content(o, output))
+			return o;
+	}
+
+	return NULL;
+}
+
+static int
+drm_output_is_cloned(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_output *o;
+
+	if (c->use_pixman || c->adaptive_renderer)
+		return 0;
+
+	wl_list_for_each(o, &c->base.output_list, base.link) {
+		if (o != output && drm_output_same_content(o, output))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Flip to the newest frame of the output we clone, instead of
+ * rendering the same thing again. */
+static void
+drm_output_repaint_clone(struct drm_output *output, pixman_region32_t *damage)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_output *src = drm_output_clone_source(output);
+	struct drm_fb *fb;
+
+	if (!src)
+		return;
+
+	fb = src->next ? src->next : src->current;
+	if (!fb || !fb->bo || fb->is_client_buffer)
+		return;
+
+	fb->output = src;
+	fb->clone_refs++;
+	output->next = fb;
+
+	pixman_region32_subtract(&c->base.primary_plane.damage,
+				 &c->base.primary_plane.damage, damage);
+}
+
+/* A clone may have repainted before its source did this time around */
+static void
+drm_output_schedule_clones(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_output *o;
+
+	if (!output->next || !drm_output_is_cloned(output))
+		return;
+
+	wl_list_for_each(o, &c->base.output_list, base.link) {
+		if (drm_output_clone_source(o) == output)
+			weston_output_schedule_repaint(&o->base);
+	}
+}
+
+/* The gbm surface of output goes away with its buffers.  Clones still
+ * scanning out one of its frames keep just the fb id, so their CRTC
+ * stays on until their next flip. */
+static void
+drm_output_orphan_clone_fbs(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_output *o, *p;
+	struct drm_fb **fbp, **slot, *fb, *orphan;
+	int i, j;
+
+	wl_list_for_each(o, &c->base.output_list, base.link) {
+		for (i = 0; i < 2; i++) {
+			fbp = i == 0 ? &o->current : &o->next;
+			fb = *fbp;
+			if (o == output || !fb || fb->orphan ||
+			    fb->output != output)
+				continue;
+
+			orphan = zalloc(sizeof *orphan);
+			if (!orphan)
+				continue;
+			orphan->fd = fb->fd;
+			orphan->fb_id = fb->fb_id;
+			orphan->stride = fb->stride;
+			orphan->orphan = 1;
+
+			/* Every clone's reference moves to the orphan, which
+			 * removes the fb id once the last one lets go */
+			wl_list_for_each(p, &c->base.output_list, base.link) {
+				for (j = 0; j < 2; j++) {
+					slot = j == 0 ? &p->current : &p->next;
+					if (p != output && *slot == fb) {
+						*slot = orphan;
+						orphan->clone_refs++;
+					}
+				}
+			}
+			fb->clone_refs = 0;
+			fb->fb_id = 0;
+		}
+	}
+}
+
+static int
+drm_output_repaint(struct weston_output *output_base,
+		   pixman_region32_t *damage)
+{
+	struct drm_output *output = (struct drm_output *) output_base;
+	struct drm_compositor *compositor =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_sprite *s;
+	struct drm_plane_update *u, update;
+	struct wl_event_loop *loop;
+	int ret = 0, vblank_ret, inherit;
 
 	if (output->destroy_pending)
 		return -1;
 
+	/* Nothing was rendered, so all damage is still there next time */
+	if (output->boot_fb_hold) {
+		if (!drm_output_has_client_content(output))
+			return -1;
+		drm_output_end_boot_fb_hold(output);
+	}
+
+	drm_output_worker_wait(output);
+
+	if (output->flip_queue && output->page_flip_pending)
+		return drm_output_queue_frame(output, damage);
+
+	if (output->render_scale_failed && output->base.render_width &&
+	    !output->page_flip_pending) {
+		drm_output_retire_fb(output);
+		drm_output_update_render_size(output);
+		if (drm_output_reinit_egl(output) < 0)
+			return -1;
+		pixman_region32_union(damage, damage, &output->base.region);
+	}
+
 	if (!output->next)
+		drm_output_repaint_clone(output, damage);
+
+	if (!output->next) {
 		drm_output_render(output, damage);
+		drm_output_schedule_clones(output);
+		if (!output->next && output->reinit_egl) {
+			output->reinit_egl = 0;
+			weston_log("rendering %s into linear buffers\n",
+				   output->base.name);
+			if (drm_output_reinit_egl(output) == 0)
+				drm_output_render(output, damage);
+		}
+	}
 	if (!output->next)
 		return -1;
 
-	mode = container_of(output->base.current_mode, struct drm_mode, base);
-	if (!output->current ||
-	    output->current->stride != output->next->stride) {
-		ret = drmModeSetCrtc(compositor->drm.fd, output->crtc_id,
-				     output->next->fb_id, 0, 0,
-				     &output->connector_id, 1,
-				     &mode->mode_info);
-		if (ret) {
-			weston_log("set mode failed: %m\n");
+	if (compositor->adaptive_renderer)
+		drm_adaptive_frame(output, damage);
+
+	/* Presented from page_flip_handler() once the flip is done */
+	wl_list_insert_list(&output->flip_feedback,
+			    &output->base.feedback_list);
+	wl_list_init(&output->base.feedback_list);
+
+#ifdef HAVE_DRM_ATOMIC
+	if (output->atomic) {
+		ret = drm_output_repaint_atomic(output);
+		if (ret < 0)
+			weston_presentation_feedback_discard_list(
+						&output->flip_feedback);
+		return ret;
+	}
+#endif
+
+	/* Flip from the boot fb without a modeset if we can, and fall
+	 * back to one if the driver won't flip between the two. */
+	inherit = !output->current &&
+		  output->boot_fb_pitch == output->next->stride;
+	output->boot_fb_pitch = 0;
+
+	if ((!output->current && !inherit) ||
+	    (output->current &&
+	     output->current->stride != output->next->stride)) {
+		if (drm_output_modeset(output) < 0)
 			goto err_pageflip;
-		}
-		output_base->set_dpms(output_base, WESTON_DPMS_ON);
 	}
 
-	if (drmModePageFlip(compositor->drm.fd, output->crtc_id,
+	if (drmModePageFlip(output->fd, output->crtc_id,
 			    output->next->fb_id,
-			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
+			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0 &&
+	    (!inherit || drm_output_modeset(output) < 0 ||
+	     drmModePageFlip(output->fd, output->crtc_id,
+			     output->next->fb_id,
+			     DRM_MODE_PAGE_FLIP_EVENT, output) < 0)) {
 		weston_log("queueing pageflip failed: %m\n");
 		goto err_pageflip;
 	}
 
 	output->page_flip_pending = 1;
 
+	/* Let the compositor start on the frame after this one right
+	 * away, it gets queued behind the flip. */
+	if (output->flip_queue && !output->finish_source) {
+		loop = wl_display_get_event_loop(compositor->base.wl_display);
+		output->finish_source =
+			wl_event_loop_add_idle(loop, drm_output_finish_early,
+					       output);
+	}
+
 	drm_output_set_cursor(output);
 
 	/*
 	 * Now, update all the sprite surfaces
 	 */
 	wl_list_for_each(s, &compositor->sprite_list, link) {
-		uint32_t flags = 0, fb_id = 0;
-		drmVBlank vbl = {
-			.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT,
-			.request.sequence = 1,
-		};
-
 		if ((!s->current && !s->next) ||
 		    !drm_sprite_crtc_supported(output_base, s->possible_crtcs))
 			continue;
 
+		update.sprite = s;
+		update.plane_id = s->plane_id;
+		update.fb_id = 0;
 		if (s->next && !compositor->sprites_hidden)
-			fb_id = s->next->fb_id;
-
-		ret = drmModeSetPlane(compositor->drm.fd, s->plane_id,
-				      output->crtc_id, fb_id, flags,
-				      s->dest_x, s->dest_y,
-				      s->dest_w, s->dest_h,
-				      s->src_x, s->src_y,
-				      s->src_w, s->src_h);
-		if (ret)
-			weston_log("setplane failed: %d: %s\n",
-				ret, strerror(errno));
-
-		if (output->pipe > 0)
-			vbl.request.type |= DRM_VBLANK_SECONDARY;
-
-		/*
-		 * Queue a vblank signal so we know when the surface
-		 * becomes active on the display or has been replaced.
-		 */
-		vbl.request.signal = (unsigned long)s;
-		ret = drmWaitVBlank(compositor->drm.fd, &vbl);
-		if (ret) {
-			weston_log("vblank event request failed: %d: %s\n",
-				ret, strerror(errno));
+			update.fb_id = s->next->fb_id;
+		update.src_x = s->src_x;
+		update.src_y = s->src_y;
+		update.src_w = s->src_w;
+		update.src_h = s->src_h;
+		update.dest_x = s->dest_x;
+		update.dest_y = s->dest_y;
+		update.dest_w = s->dest_w;
+		update.dest_h = s->dest_h;
+		update.vblank_type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+		update.colorkey_prop = 0;
+		update.colorkey = s->colorkey;
+		if (s->colorkey != s->colorkey_set) {
+			update.colorkey_prop = s->colorkey_prop;
+			s->colorkey_set = s->colorkey;
 		}
+		update.rotation_prop = 0;
+		update.rotation = s->rotation;
+		if (s->rotation != s->rotation_set) {
+			update.rotation_prop = s->rotation_prop;
+			s->rotation_set = s->rotation;
+		}
+		if (output->pipe > 0)
+			update.vblank_type |= DRM_VBLANK_SECONDARY;
 
 		s->output = output;
 		output->vblank_pending = 1;
+
+		if (output->worker.running) {
+			u = wl_array_add(&output->worker.updates, sizeof *u);
+			if (u) {
+				*u = update;
+				continue;
+			}
+		}
+
+		ret = drm_plane_update_issue(output->fd,
+					     output->crtc_id, &update,
+					     &vblank_ret);
+		if (ret)
+			weston_log("setplane failed: %d: %s\n",
+				ret, strerror(errno));
+		if (vblank_ret)
+			weston_log("vblank event request failed: %d: %s\n",
+				vblank_ret, strerror(errno));
 	}
 
+	if (output->worker.updates.size > 0)
+		drm_output_worker_submit(output);
+
+	WESTON_TRACE2(drm_flip_submit, output->crtc_id, 0);
+	weston_timeline_point(output_base, WESTON_TIMELINE_PAGE_FLIP_QUEUED);
+
 	return 0;
 
 err_pageflip:
@@ -674,6 +2262,7 @@ err_pageflip:
 		drm_output_release_fb(output, output->next);
 		output->next = NULL;
 	}
+	weston_presentation_feedback_discard_list(&output->flip_feedback);
 
 	return -1;
 }
@@ -691,6 +2280,17 @@ drm_output_start_repaint_loop(struct weston_output *output_base)
 	if (output->destroy_pending)
 		return;
 
+	/* The handler of the pending flip gives us the timestamp */
+	if (output->flip_queue && output->page_flip_pending) {
+		output->finish_pending = 1;
+		return;
+	}
+
+	/* With variable refresh the display waits for our flip, so there
+	 * is no vblank to line up with; repaint as soon as possible. */
+	if (output->adaptive_sync)
+		goto finish_frame;
+
 	if (!output->current) {
 		/* We can't page flip if there's no mode set */
 		goto finish_frame;
@@ -698,12 +2298,14 @@ drm_output_start_repaint_loop(struct weston_output *output_base)
 
 	fb_id = output->current->fb_id;
 
-	if (drmModePageFlip(compositor->drm.fd, output->crtc_id, fb_id,
+	if (drmModePageFlip(output->fd, output->crtc_id, fb_id,
 			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
 		weston_log("queueing pageflip failed: %m\n");
 		goto finish_frame;
 	}
 
+	output->finish_pending = 1;
+
 	return;
 
 finish_frame:
@@ -713,6 +2315,19 @@ finish_frame:
 	weston_output_finish_frame(output_base, msec);
 }
 
+/* Extend the kernel's 32-bit vblank sequence to the output's 64-bit
+ * MSC. */
+static void
+drm_output_update_msc(struct drm_output *output, unsigned int seq)
+{
+	uint64_t msc_hi = output->base.msc >> 32;
+
+	if (seq < (output->base.msc & 0xffffffff))
+		msc_hi++;
+
+	output->base.msc = (msc_hi << 32) + seq;
+}
+
 static void
 vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 	       void *data)
@@ -721,7 +2336,9 @@ vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 	struct drm_output *output = s->output;
 	uint32_t msecs;
 
+	WESTON_TRACE4(drm_vblank, output->crtc_id, frame, sec, usec);
 	output->vblank_pending = 0;
+	drm_output_update_msc(output, frame);
 
 	drm_output_release_fb(output, s->current);
 	s->current = s->next;
@@ -735,28 +2352,87 @@ vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 
 static void
 drm_output_destroy(struct weston_output *output_base);
+static void
+drm_adaptive_switch(struct drm_compositor *c, uint32_t msecs);
 
 static void
 page_flip_handler(int fd, unsigned int frame,
 		  unsigned int sec, unsigned int usec, void *data)
 {
 	struct drm_output *output = (struct drm_output *) data;
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_sprite *s;
+	struct timespec ts;
 	uint32_t msecs;
+	int still_pending = 0;
+
+	WESTON_TRACE4(drm_flip_complete, output->crtc_id, frame, sec, usec);
+	drm_output_update_msc(output, frame);
 
 	/* We don't set page_flip_pending on start_repaint_loop, in that case
 	 * we just want to page flip to the current buffer to get an accurate
 	 * timestamp */
 	if (output->page_flip_pending) {
+		ts.tv_sec = sec;
+		ts.tv_nsec = usec * 1000;
+		weston_presentation_feedback_present_list(
+				&output->flip_feedback, &output->base,
+				&ts, output->base.msc,
+				PRESENTATION_FEEDBACK_KIND_VSYNC |
+				PRESENTATION_FEEDBACK_KIND_HW_CLOCK |
+				PRESENTATION_FEEDBACK_KIND_HW_COMPLETION);
+
 		drm_output_release_fb(output, output->current);
 		output->current = output->next;
 		output->next = NULL;
+
+		/* The fb we started on is off screen now.  When weston-launch
+		 * restarted us on the DRM file of a crashed instance, the fb
+		 * was that one's last frame and is ours to remove; anyone
+		 * else's fb isn't found on our file. */
+		if (output->boot_fb_id) {
+			if (drmModeRmFB(output->fd, output->boot_fb_id) == 0) {
+				weston_log("Output %s: removed the fb left "
+					   "by the previous compositor\n",
+					   output->base.name);
+				output->original_crtc->buffer_id = 0;
+			}
+			output->boot_fb_id = 0;
+		}
+
+		if (output->retired_fb_id) {
+			drmModeRmFB(output->fd, output->retired_fb_id);
+			output->retired_fb_id = 0;
+		}
+
+		/* Atomic commits flip the overlays at the same time */
+		if (output->atomic) {
+			wl_list_for_each(s, &c->sprite_list, link) {
+				if (s->output != output)
+					continue;
+				drm_output_release_fb(output, s->current);
+				s->current = s->next;
+				s->next = NULL;
+			}
+		}
+
+		if (output->queued && !output->destroy_pending &&
+		    drm_output_flip_queued(output) == 0)
+			still_pending = 1;
 	}
 
-	output->page_flip_pending = 0;
+	output->page_flip_pending = still_pending;
+
+	if (c->adaptive.switch_pending)
+		drm_adaptive_switch(c, sec * 1000 + usec / 1000);
 
 	if (output->destroy_pending)
 		drm_output_destroy(&output->base);
+	else if (output->flip_queue && !output->finish_pending)
+		return;
 	else if (!output->vblank_pending) {
+		output->finish_pending = 0;
 		msecs = sec * 1000 + usec / 1000;
 		weston_output_finish_frame(&output->base, msecs);
 
@@ -769,11 +2445,9 @@ page_flip_handler(int fd, unsigned int frame,
 
 static uint32_t
 drm_output_check_sprite_format(struct drm_sprite *s,
-			       struct weston_view *ev, struct gbm_bo *bo)
+			       struct weston_view *ev, uint32_t format)
 {
-	uint32_t i, format;
-
-	format = gbm_bo_get_format(bo);
+	uint32_t i;
 
 	if (format == GBM_FORMAT_ARGB8888) {
 		pixman_region32_t r;
@@ -796,11 +2470,146 @@ drm_output_check_sprite_format(struct drm_sprite *s,
 	return 0;
 }
 
+/* Planes can scale and, with the rotation property, turn by multiples
+ * of 90 degrees, but nothing in between. */
 static int
 drm_view_transform_supported(struct weston_view *ev)
 {
-	return !ev->transform.enabled ||
-		(ev->transform.matrix.type < WESTON_MATRIX_TRANSFORM_ROTATE);
+	const struct weston_matrix *m = &ev->transform.matrix;
+
+	if (!ev->transform.enabled ||
+	    m->type < WESTON_MATRIX_TRANSFORM_ROTATE)
+		return 1;
+	if (m->type & WESTON_MATRIX_TRANSFORM_OTHER)
+		return 0;
+
+	return (m->d[1] == 0.0f && m->d[4] == 0.0f) ||
+	       (m->d[0] == 0.0f && m->d[5] == 0.0f);
+}
+
+static void
+drm_order_clamp(float *a, float *b, float max)
+{
+	float t;
+
+	if (*a > *b) {
+		t = *a;
+		*a = *b;
+		*b = t;
+	}
+	if (*a < 0.0f)
+		*a = 0.0f;
+	if (*b > max)
+		*b = max;
+}
+
+static int
+drm_axis_sign(float v)
+{
+	if (v > 0.001f)
+		return 1;
+	if (v < -0.001f)
+		return -1;
+	return 0;
+}
+
+/* Linear part, row major, of the buffer to framebuffer mapping that
+ * each plane rotation produces, see drm_rect_rotate() in the kernel. */
+static const struct {
+	uint32_t rotation;
+	int m[4];
+} drm_rotations[] = {
+	{ WDRM_ROTATE_0,			{  1,  0,  0,  1 } },
+	{ WDRM_ROTATE_90,			{  0,  1, -1,  0 } },
+	{ WDRM_ROTATE_180,			{ -1,  0,  0, -1 } },
+	{ WDRM_ROTATE_270,			{  0, -1,  1,  0 } },
+	{ WDRM_ROTATE_0 | WDRM_REFLECT_X,	{ -1,  0,  0,  1 } },
+	{ WDRM_ROTATE_90 | WDRM_REFLECT_X,	{  0,  1,  1,  0 } },
+	{ WDRM_ROTATE_180 | WDRM_REFLECT_X,	{  1,  0,  0, -1 } },
+	{ WDRM_ROTATE_270 | WDRM_REFLECT_X,	{  0, -1, -1,  0 } },
+};
+
+/* Work out the plane rotation that shows the buffer of the view the
+ * way the renderer would, from where the surface axes end up in the
+ * buffer and in the output framebuffer.  The buffer transform, the
+ * view transform and the output transform all feed into it. */
+static int
+drm_view_plane_rotation(struct weston_output *output,
+			struct weston_view *ev, uint32_t *rotation)
+{
+	struct weston_surface *surface = ev->surface;
+	float p[3][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 } };
+	float fb[3][2], buf[3][2];
+	int f[4], b[4], m[4];
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		weston_view_to_global_float(ev, p[i][0], p[i][1],
+					    &fb[i][0], &fb[i][1]);
+		weston_transformed_coord(output->width, output->height,
+					 output->transform,
+					 output->current_scale,
+					 fb[i][0] - output->x,
+					 fb[i][1] - output->y,
+					 &fb[i][0], &fb[i][1]);
+		weston_surface_to_buffer_float(surface, p[i][0], p[i][1],
+					       &buf[i][0], &buf[i][1]);
+	}
+
+	/* Columns are the images of the surface x and y axes. */
+	for (i = 0; i < 2; i++) {
+		f[i] = drm_axis_sign(fb[i + 1][0] - fb[0][0]);
+		f[i + 2] = drm_axis_sign(fb[i + 1][1] - fb[0][1]);
+		b[i] = drm_axis_sign(buf[i + 1][0] - buf[0][0]);
+		b[i + 2] = drm_axis_sign(buf[i + 1][1] - buf[0][1]);
+	}
+
+	/* Both are signed permutations, so the inverse of b is its
+	 * transpose. */
+	m[0] = f[0] * b[0] + f[1] * b[1];
+	m[1] = f[0] * b[2] + f[1] * b[3];
+	m[2] = f[2] * b[0] + f[3] * b[1];
+	m[3] = f[2] * b[2] + f[3] * b[3];
+
+	for (i = 0; i < ARRAY_LENGTH(drm_rotations); i++) {
+		if (memcmp(m, drm_rotations[i].m, sizeof m) == 0) {
+			*rotation = drm_rotations[i].rotation;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int
+drm_view_overlay_candidate(struct weston_output *output_base,
+			   struct weston_view *ev)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output_base->compositor;
+
+	if (c->gbm == NULL)
+		return 0;
+
+	if (c->sprites_are_broken)
+		return 0;
+
+	if (ev->output_mask != (1u << output_base->id))
+		return 0;
+
+	if (ev->surface->buffer_ref.buffer == NULL)
+		return 0;
+
+	if (ev->alpha != 1.0f)
+		return 0;
+
+	if (wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource))
+		return 0;
+
+	if (!drm_view_transform_supported(ev))
+		return 0;
+
+	return 1;
 }
 
 static struct weston_plane *
@@ -809,46 +2618,34 @@ drm_output_prepare_overlay_view(struct weston_output *output_base,
 {
 	struct weston_compositor *ec = output_base->compositor;
 	struct drm_compositor *c =(struct drm_compositor *) ec;
-	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
 	struct drm_sprite *s;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct weston_buffer *buffer;
+	struct drm_fb *cached;
 	int found = 0;
 	struct gbm_bo *bo;
 	pixman_region32_t dest_rect, src_rect;
 	pixman_box32_t *box, tbox;
 	uint32_t format;
-	wl_fixed_t sx1, sy1, sx2, sy2;
-
-	if (c->gbm == NULL)
-		return NULL;
-
-	if (viewport->buffer.transform != output_base->transform)
-		return NULL;
-
-	if (viewport->buffer.scale != output_base->current_scale)
-		return NULL;
-
-	if (c->sprites_are_broken)
-		return NULL;
-
-	if (ev->output_mask != (1u << output_base->id))
-		return NULL;
-
-	if (ev->surface->buffer_ref.buffer == NULL)
-		return NULL;
-
-	if (ev->alpha != 1.0f)
-		return NULL;
+	uint32_t rotation;
+	float sx1, sy1, sx2, sy2;
+	float bx1, by1, bx2, by2;
+	int wait_fence;
 
-	if (wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource))
-		return NULL;
-
-	if (!drm_view_transform_supported(ev))
+	if (!drm_view_overlay_candidate(output_base, ev) ||
+	    drm_view_plane_rotation(output_base, ev, &rotation) < 0)
 		return NULL;
 
 	wl_list_for_each(s, &c->sprite_list, link) {
 		if (!drm_sprite_crtc_supported(output_base, s->possible_crtcs))
 			continue;
 
+		if (ev->colorkey_enabled && !s->colorkey_prop)
+			continue;
+
+		if ((rotation & s->rotations) != rotation)
+			continue;
+
 		if (!s->next) {
 			found = 1;
 			break;
@@ -859,25 +2656,68 @@ drm_output_prepare_overlay_view(struct weston_output *output_base,
 	if (!found)
 		return NULL;
 
-	bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
-			   ev->surface->buffer_ref.buffer->resource,
-			   GBM_BO_USE_SCANOUT);
-	if (!bo)
+	/* Without IN_FENCE_FD the plane would scan out a buffer the GPU
+	 * may still be writing; leave it to the renderer, which waits. */
+	wait_fence = !drm_fence_signaled(ev->surface->acquire_fence_fd);
+	if (wait_fence && (!c->atomic_modeset || !s->in_fence_prop))
 		return NULL;
 
-	format = drm_output_check_sprite_format(s, ev, bo);
-	if (format == 0) {
-		gbm_bo_destroy(bo);
-		return NULL;
-	}
+	buffer = ev->surface->buffer_ref.buffer;
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	cached = drm_fb_cache_find(buffer);
+	if (dmabuf) {
+		/* The plane can't flip or deinterlace for us */
+		if (dmabuf->attributes.flags)
+			return NULL;
+
+		format = drm_output_check_sprite_format(s, ev,
+							dmabuf->attributes.format);
+		if (format == 0)
+			return NULL;
+
+		if (cached && cached->format == format) {
+			s->next = drm_fb_cache_use(c, cached);
+		} else {
+			s->next = drm_fb_get_from_dmabuf(dmabuf, c, format);
+			if (!s->next)
+				return NULL;
+			drm_fb_cache_insert(c, s->next, buffer, format);
+		}
+	} else if (cached && !cached->is_dmabuf &&
+		   (format = drm_output_check_sprite_format(s, ev,
+				gbm_bo_get_format(cached->bo))) != 0 &&
+		   format == cached->format) {
+		s->next = drm_fb_cache_use(c, cached);
+	} else {
+		bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
+				   buffer->resource, GBM_BO_USE_SCANOUT);
+		if (!bo)
+			return NULL;
+
+		format = drm_output_check_sprite_format(s, ev,
+							gbm_bo_get_format(bo));
+		if (format == 0) {
+			gbm_bo_destroy(bo);
+			return NULL;
+		}
 
-	s->next = drm_fb_get_from_bo(bo, c, format);
-	if (!s->next) {
-		gbm_bo_destroy(bo);
-		return NULL;
+		s->next = drm_fb_get_from_bo(bo, c, format);
+		if (!s->next) {
+			gbm_bo_destroy(bo);
+			return NULL;
+		}
+		drm_fb_cache_insert(c, s->next, buffer, format);
 	}
 
-	drm_fb_set_buffer(s->next, ev->surface->buffer_ref.buffer);
+	if (wait_fence)
+		s->in_fence_fd = dup(ev->surface->acquire_fence_fd);
+
+	drm_fb_set_buffer(s->next, buffer);
+	s->output = (struct drm_output *) output_base;
+	s->colorkey = ev->colorkey_enabled ?
+		(1 << 24) | (ev->colorkey & 0xffffff) : 0;
+	if (s->rotation_prop)
+		s->rotation = rotation;
 
 	box = pixman_region32_extents(&ev->transform.boundingbox);
 	s->plane.x = box->x1;
@@ -909,126 +2749,222 @@ drm_output_prepare_overlay_view(struct weston_output *output_base,
 				  &output_base->region);
 	box = pixman_region32_extents(&src_rect);
 
-	weston_view_from_global_fixed(ev,
-				      wl_fixed_from_int(box->x1),
-				      wl_fixed_from_int(box->y1),
-				      &sx1, &sy1);
-	weston_view_from_global_fixed(ev,
-				      wl_fixed_from_int(box->x2),
-				      wl_fixed_from_int(box->y2),
-				      &sx2, &sy2);
-
-	if (sx1 < 0)
-		sx1 = 0;
-	if (sy1 < 0)
-		sy1 = 0;
-	if (sx2 > wl_fixed_from_int(ev->surface->width))
-		sx2 = wl_fixed_from_int(ev->surface->width);
-	if (sy2 > wl_fixed_from_int(ev->surface->height))
-		sy2 = wl_fixed_from_int(ev->surface->height);
-
-	tbox.x1 = sx1;
-	tbox.y1 = sy1;
-	tbox.x2 = sx2;
-	tbox.y2 = sy2;
-
-	tbox = weston_transformed_rect(wl_fixed_from_int(ev->surface->width),
-				       wl_fixed_from_int(ev->surface->height),
-				       viewport->buffer.transform,
-				       viewport->buffer.scale,
-				       tbox);
-
-	s->src_x = tbox.x1 << 8;
-	s->src_y = tbox.y1 << 8;
-	s->src_w = (tbox.x2 - tbox.x1) << 8;
-	s->src_h = (tbox.y2 - tbox.y1) << 8;
+	/* With the view rotated, the corners come back swapped. */
+	weston_view_from_global_float(ev, box->x1, box->y1, &sx1, &sy1);
+	weston_view_from_global_float(ev, box->x2, box->y2, &sx2, &sy2);
+	drm_order_clamp(&sx1, &sx2, ev->surface->width);
+	drm_order_clamp(&sy1, &sy2, ev->surface->height);
+
+	/* This goes through the wl_scaler crop as well as the buffer
+	 * transform and scale. */
+	weston_surface_to_buffer_float(ev->surface, sx1, sy1, &bx1, &by1);
+	weston_surface_to_buffer_float(ev->surface, sx2, sy2, &bx2, &by2);
+	drm_order_clamp(&bx1, &bx2, buffer->width);
+	drm_order_clamp(&by1, &by2, buffer->height);
+
+	s->src_x = bx1 * 65536.0f;
+	s->src_y = by1 * 65536.0f;
+	s->src_w = (bx2 - bx1) * 65536.0f;
+	s->src_h = (by2 - by1) * 65536.0f;
 	pixman_region32_fini(&src_rect);
 
 	return &s->plane;
 }
 
-static struct weston_plane *
-drm_output_prepare_cursor_view(struct weston_output *output_base,
-			       struct weston_view *ev)
+static int
+drm_view_cursor_candidate(struct weston_output *output_base,
+			  struct weston_view *ev)
 {
 	struct drm_compositor *c =
 		(struct drm_compositor *) output_base->compositor;
 	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
-	struct drm_output *output = (struct drm_output *) output_base;
 
 	if (c->gbm == NULL)
-		return NULL;
-	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
-		return NULL;
+		return 0;
+	if (output_base->transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		return 0;
 	if (viewport->buffer.scale != output_base->current_scale)
-		return NULL;
-	if (output->cursor_view)
-		return NULL;
+		return 0;
 	if (ev->output_mask != (1u << output_base->id))
-		return NULL;
+		return 0;
 	if (c->cursors_are_broken)
-		return NULL;
+		return 0;
+	if (ev->colorkey_enabled)
+		return 0;
 	if (ev->surface->buffer_ref.buffer == NULL ||
 	    !wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource) ||
 	    ev->surface->width > 64 || ev->surface->height > 64)
+		return 0;
+
+	return 1;
+}
+
+static struct weston_plane *
+drm_output_prepare_cursor_view(struct weston_output *output_base,
+			       struct weston_view *ev)
+{
+	struct drm_output *output = (struct drm_output *) output_base;
+
+	if (output->cursor_view)
+		return NULL;
+	if (!drm_view_cursor_candidate(output_base, ev))
 		return NULL;
 
 	output->cursor_view = ev;
 
+	/* The surface damage is still pending here, it only reaches the
+	 * cursor plane along with the damage from moving the view. */
+	if (ev != output->cursor_last_view ||
+	    ev->surface->buffer_ref.buffer != output->cursor_last_buffer ||
+	    pixman_region32_not_empty(&ev->surface->damage))
+		output->cursor_dirty = 1;
+	output->cursor_last_view = ev;
+	output->cursor_last_buffer = ev->surface->buffer_ref.buffer;
+
 	return &output->cursor_plane;
 }
 
+/* FNV-1a over the cursor image */
+static uint32_t
+cursor_image_hash(const uint32_t *buf, int n)
+{
+	uint32_t hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		hash ^= buf[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Copy the cursor image into the next cursor bo if it changed.
+ * Returns the bo written, or NULL if the current one is still good. */
+static struct gbm_bo *
+drm_output_update_cursor_bo(struct drm_output *output, struct weston_view *ev)
+{
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	EGLint stride;
+	struct gbm_bo *bo;
+	uint32_t buf[64 * 64];
+	uint32_t hash;
+	unsigned char *s;
+	int i;
+
+	/* Damage from moving the cursor is of no interest, whether the
+	 * image changed was found out in prepare_cursor_view. */
+	pixman_region32_fini(&output->cursor_plane.damage);
+	pixman_region32_init(&output->cursor_plane.damage);
+
+	if (!buffer || !output->cursor_dirty)
+		return NULL;
+
+	output->cursor_dirty = 0;
+	memset(buf, 0, sizeof buf);
+	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	s = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (i = 0; i < ev->surface->height; i++)
+		memcpy(buf + i * 64, s + i * stride,
+		       ev->surface->width * 4);
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	/* Animated cursors often commit the same frame again */
+	hash = cursor_image_hash(buf, ARRAY_LENGTH(buf));
+	if (output->cursor_set &&
+	    hash == output->cursor_hash[output->current_cursor])
+		return NULL;
+
+	output->current_cursor ^= 1;
+	bo = output->cursor_bo[output->current_cursor];
+	if (gbm_bo_write(bo, buf, sizeof buf) < 0)
+		weston_log("failed update cursor: %m\n");
+	output->cursor_hash[output->current_cursor] = hash;
+
+	return bo;
+}
+
+#ifdef HAVE_DRM_ATOMIC
+static int
+drm_output_set_cursor_atomic(struct drm_output *output,
+			     drmModeAtomicReq *req)
+{
+	struct weston_view *ev = output->cursor_view;
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_fb *fb;
+	int x, y;
+
+	output->cursor_view = NULL;
+	if (ev == NULL) {
+		output->cursor_set = 0;
+		output->cursor_last_view = NULL;
+		return drm_atomic_add_plane(req, output->cursor.plane_id,
+					    output->cursor.props, 0, NULL,
+					    0, 0, 0, 0, 0, 0, 0, 0);
+	}
+
+	drm_output_update_cursor_bo(output, ev);
+	output->cursor_set = 1;
+
+	fb = drm_fb_get_from_bo(output->cursor_bo[output->current_cursor],
+				c, GBM_FORMAT_ARGB8888);
+	if (!fb) {
+		c->cursors_are_broken = 1;
+		return -1;
+	}
+
+	x = (ev->geometry.x - output->base.x) * output->base.current_scale;
+	y = (ev->geometry.y - output->base.y) * output->base.current_scale;
+	output->cursor_plane.x = x;
+	output->cursor_plane.y = y;
+
+	return drm_atomic_add_plane(req, output->cursor.plane_id,
+				    output->cursor.props, output->crtc_id, fb,
+				    0, 0, 64 << 16, 64 << 16, x, y, 64, 64);
+}
+#endif
+
 static void
 drm_output_set_cursor(struct drm_output *output)
 {
 	struct weston_view *ev = output->cursor_view;
-	struct weston_buffer *buffer;
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->base.compositor;
-	EGLint handle, stride;
+	EGLint handle;
 	struct gbm_bo *bo;
-	uint32_t buf[64 * 64];
-	unsigned char *s;
-	int i, x, y;
+	int x, y;
+
+	int moved;
 
 	output->cursor_view = NULL;
 	if (ev == NULL) {
-		drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
+		if (output->cursor_set)
+			drmModeSetCursor(output->fd, output->crtc_id, 0, 0, 0);
+		output->cursor_set = 0;
+		output->cursor_last_view = NULL;
 		return;
 	}
 
-	buffer = ev->surface->buffer_ref.buffer;
-
-	if (buffer &&
-	    pixman_region32_not_empty(&output->cursor_plane.damage)) {
-		pixman_region32_fini(&output->cursor_plane.damage);
-		pixman_region32_init(&output->cursor_plane.damage);
-		output->current_cursor ^= 1;
+	bo = drm_output_update_cursor_bo(output, ev);
+	moved = !output->cursor_set;
+	if (bo || !output->cursor_set) {
 		bo = output->cursor_bo[output->current_cursor];
-		memset(buf, 0, sizeof buf);
-		stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
-		s = wl_shm_buffer_get_data(buffer->shm_buffer);
-		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		for (i = 0; i < ev->surface->height; i++)
-			memcpy(buf + i * 64, s + i * stride,
-			       ev->surface->width * 4);
-		wl_shm_buffer_end_access(buffer->shm_buffer);
-
-		if (gbm_bo_write(bo, buf, sizeof buf) < 0)
-			weston_log("failed update cursor: %m\n");
-
 		handle = gbm_bo_get_handle(bo).s32;
-		if (drmModeSetCursor(c->drm.fd,
+		if (drmModeSetCursor(output->fd,
 				     output->crtc_id, handle, 64, 64)) {
 			weston_log("failed to set cursor: %m\n");
 			c->cursors_are_broken = 1;
 		}
+		output->cursor_set = 1;
 	}
 
 	x = (ev->geometry.x - output->base.x) * output->base.current_scale;
 	y = (ev->geometry.y - output->base.y) * output->base.current_scale;
-	if (output->cursor_plane.x != x || output->cursor_plane.y != y) {
-		if (drmModeMoveCursor(c->drm.fd, output->crtc_id, x, y)) {
+	if (moved ||
+	    output->cursor_plane.x != x || output->cursor_plane.y != y) {
+		if (drmModeMoveCursor(output->fd, output->crtc_id, x, y)) {
 			weston_log("failed to move cursor: %m\n");
 			c->cursors_are_broken = 1;
 		}
@@ -1038,14 +2974,189 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+/* With atomic modesetting, keep a plane only if the kernel accepts it
+ * alongside everything assigned before it. */
+static struct weston_plane *
+drm_output_check_plane(struct drm_output *output, struct weston_plane *plane)
+{
+#ifdef HAVE_DRM_ATOMIC
+	struct drm_sprite *s;
+
+	if (!plane || !output->atomic || drm_output_test_planes(output) == 0)
+		return plane;
+
+	if (plane == &output->fb_plane) {
+		drm_output_release_fb(output, output->next);
+		output->next = NULL;
+	} else {
+		s = container_of(plane, struct drm_sprite, plane);
+		drm_output_release_fb(output, s->next);
+		s->next = NULL;
+		if (s->in_fence_fd >= 0) {
+			close(s->in_fence_fd);
+			s->in_fence_fd = -1;
+		}
+	}
+
+	return NULL;
+#else
+	return plane;
+#endif
+}
+
+static int
+drm_view_on_sprite(struct drm_compositor *c, struct weston_view *ev)
+{
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &c->sprite_list, link)
+		if (ev->plane == &s->plane)
+			return 1;
+
+	return 0;
+}
+
+struct drm_overlay_candidate {
+	struct weston_view *view;
+	int hinted;
+	uint32_t score;
+};
+
+static int
+drm_overlay_candidate_compare(const void *a, const void *b)
+{
+	const struct drm_overlay_candidate *ca = a, *cb = b;
+
+	if (ca->hinted != cb->hinted)
+		return cb->hinted - ca->hinted;
+
+	if (ca->score != cb->score)
+		return ca->score < cb->score ? 1 : -1;
+
+	return 0;
+}
+
+/* Decide up front which views should get the free sprites of this
+ * output, so that a small view near the top of the stack no longer
+ * takes the only overlay away from a large one further down.
+ *
+ * A view can only go on a sprite if nothing that is composited above
+ * it overlaps it, and since the stacking order between the sprites
+ * themselves is not known, an overlapping view on another sprite is
+ * no better.  That makes each view's eligibility independent of the
+ * others, so the assignment that saves the most composited pixels is
+ * simply the best scoring eligible views, one per sprite.  The score
+ * is the visible area, with a bonus for a view that was already on a
+ * sprite last frame so similar sized views don't make the planes
+ * flip back and forth. */
+static void
+drm_output_choose_overlays(struct drm_output *output,
+			   struct wl_array *chosen)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_overlay_candidate *cand;
+	struct wl_array candidates;
+	struct weston_view *ev, **evp, *cursor = NULL;
+	struct drm_sprite *s;
+	pixman_region32_t above, clip;
+	pixman_box32_t *box;
+	int n_sprites = 0, n, i;
+
+	wl_list_for_each(s, &c->sprite_list, link)
+		if (drm_sprite_crtc_supported(&output->base, s->possible_crtcs) &&
+		    !s->next)
+			n_sprites++;
+	if (n_sprites == 0)
+		return;
+
+	wl_array_init(&candidates);
+	pixman_region32_init(&above);
+	pixman_region32_init(&clip);
+
+	wl_array_for_each(evp, &output->base.views) {
+		ev = *evp;
+
+		/* The cursor plane is above everything else. */
+		if (!cursor && drm_view_cursor_candidate(&output->base, ev)) {
+			cursor = ev;
+			continue;
+		}
+
+		pixman_region32_intersect(&clip, &above,
+					  &ev->transform.boundingbox);
+		if (!pixman_region32_not_empty(&clip) &&
+		    drm_view_overlay_candidate(&output->base, ev)) {
+			pixman_region32_intersect(&clip,
+						  &ev->transform.boundingbox,
+						  &output->base.region);
+			box = pixman_region32_extents(&clip);
+			cand = wl_array_add(&candidates, sizeof *cand);
+			if (cand) {
+				cand->view = ev;
+				cand->hinted = !!(ev->plane_hint &
+					WESTON_VIEW_PLANE_HINT_OVERLAY);
+				cand->score = (box->x2 - box->x1) *
+					      (box->y2 - box->y1);
+				if (drm_view_on_sprite(c, ev))
+					cand->score += cand->score / 4;
+			}
+		}
+
+		pixman_region32_union(&above, &above,
+				      &ev->transform.boundingbox);
+	}
+
+	n = candidates.size / sizeof *cand;
+	qsort(candidates.data, n, sizeof *cand,
+	      drm_overlay_candidate_compare);
+
+	cand = candidates.data;
+	for (i = 0; i < n && i < n_sprites; i++) {
+		evp = wl_array_add(chosen, sizeof *evp);
+		if (evp)
+			*evp = cand[i].view;
+	}
+
+	pixman_region32_fini(&clip);
+	pixman_region32_fini(&above);
+	wl_array_release(&candidates);
+}
+
+static int
+drm_view_is_chosen(struct wl_array *chosen, struct weston_view *ev)
+{
+	struct weston_view **evp;
+
+	wl_array_for_each(evp, chosen)
+		if (*evp == ev)
+			return 1;
+
+	return 0;
+}
+
+/* Why drm_assign_planes() put a view where it did, for tracing. */
+enum wdrm_plane_decision {
+	WDRM_PLANE_OVERLAPPED,		/* below something composited */
+	WDRM_PLANE_CURSOR,
+	WDRM_PLANE_SCANOUT,
+	WDRM_PLANE_OVERLAY,
+	WDRM_PLANE_COMPOSITED,		/* no plane would take it */
+};
+
 static void
 drm_assign_planes(struct weston_output *output)
 {
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->compositor;
-	struct weston_view *ev, *next;
+	struct drm_output *drm_output = (struct drm_output *) output;
+	struct weston_view *ev, **evp;
 	pixman_region32_t overlap, surface_overlap;
 	struct weston_plane *primary, *next_plane;
+	struct wl_array chosen;
+	int spare = 0, is_chosen;
+	enum wdrm_plane_decision decision;
+	int cloned = drm_output_is_cloned(drm_output);
 
 	/*
 	 * Find a surface for each sprite in the output using some heuristics:
@@ -1059,12 +3170,21 @@ drm_assign_planes(struct weston_output *output)
 	 * the main display surface may not need to update at all, and
 	 * the client buffer can be used directly for the sprite surface
 	 * as we do for flipping full screen surfaces.
+	 *
+	 * The sprites are handed out by drm_output_choose_overlays().  If
+	 * a chosen view turns out not to work on a sprite after all, its
+	 * sprite is offered to the eligible views further down instead.
 	 */
 	pixman_region32_init(&overlap);
 	primary = &c->base.primary_plane;
+	wl_array_init(&chosen);
+	drm_output_choose_overlays(drm_output, &chosen);
 
-	wl_list_for_each_safe(ev, next, &c->base.view_list, link) {
-		struct weston_surface *es = ev->surface;
+	wl_array_for_each(evp, &output->views) {
+		struct weston_surface *es;
+
+		ev = *evp;
+		es = ev->surface;
 
 		/* Test whether this buffer can ever go into a plane:
 		 * non-shm, or small enough to be a cursor.
@@ -1074,7 +3194,7 @@ drm_assign_planes(struct weston_output *output)
 		 * renderer and since the pixman renderer keeps a reference
 		 * to the buffer anyway, there is no side effects.
 		 */
-		if (c->use_pixman ||
+		if (c->use_pixman || c->adaptive_renderer ||
 		    (es->buffer_ref.buffer &&
 		    (!wl_shm_buffer_get(es->buffer_ref.buffer->resource) ||
 		     (ev->surface->width <= 64 && ev->surface->height <= 64))))
@@ -1087,29 +3207,62 @@ drm_assign_planes(struct weston_output *output)
 					  &ev->transform.boundingbox);
 
 		next_plane = NULL;
+		decision = WDRM_PLANE_OVERLAPPED;
 		if (pixman_region32_not_empty(&surface_overlap))
 			next_plane = primary;
-		if (next_plane == NULL)
+		/* The frame clones scan out has to have everything in it */
+		if (next_plane == NULL && cloned) {
+			decision = WDRM_PLANE_COMPOSITED;
+			next_plane = primary;
+		}
+		if (next_plane == NULL) {
+			decision = WDRM_PLANE_CURSOR;
 			next_plane = drm_output_prepare_cursor_view(output, ev);
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_scanout_view(output, ev);
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_overlay_view(output, ev);
-		if (next_plane == NULL)
+		}
+		if (next_plane == NULL) {
+			decision = WDRM_PLANE_SCANOUT;
+			next_plane = drm_output_check_plane(drm_output,
+				drm_output_prepare_scanout_view(output, ev));
+		}
+		if (next_plane == NULL) {
+			decision = WDRM_PLANE_OVERLAY;
+			is_chosen = drm_view_is_chosen(&chosen, ev);
+			if (is_chosen || spare > 0) {
+				next_plane = drm_output_check_plane(drm_output,
+					drm_output_prepare_overlay_view(output, ev));
+				if (is_chosen && next_plane == NULL)
+					spare++;
+				else if (!is_chosen && next_plane)
+					spare--;
+			}
+		}
+		if (next_plane == NULL) {
+			decision = WDRM_PLANE_COMPOSITED;
 			next_plane = primary;
+		}
+		WESTON_TRACE3(drm_assign_plane, drm_output->crtc_id, ev,
+			      decision);
 		weston_view_move_to_plane(ev, next_plane);
-		if (next_plane == primary)
+		if (next_plane == primary) {
+			es->stats.frames_on_primary++;
 			pixman_region32_union(&overlap, &overlap,
 					      &ev->transform.boundingbox);
+		} else {
+			es->stats.frames_on_plane++;
+		}
 
 		pixman_region32_fini(&surface_overlap);
 	}
 	pixman_region32_fini(&overlap);
+	wl_array_release(&chosen);
 }
 
 static void
 drm_output_fini_pixman(struct drm_output *output);
 
+static void
+drm_output_set_vrr(struct drm_output *output, int enable);
+
 static void
 drm_output_destroy(struct weston_output *output_base)
 {
@@ -1124,26 +3277,45 @@ drm_output_destroy(struct weston_output *output_base)
 		return;
 	}
 
+	drm_output_worker_fini(output);
+
+	if (output->finish_source)
+		wl_event_source_remove(output->finish_source);
+	drm_output_release_fb(output, output->queued);
+	weston_presentation_feedback_discard_list(&output->flip_feedback);
+	weston_presentation_feedback_discard_list(&output->queued_feedback);
+	drm_output_end_boot_fb_hold(output);
+
 	if (output->backlight)
 		backlight_destroy(output->backlight);
 
 	drmModeFreeProperty(output->dpms_prop);
 
+	if (output->adaptive_sync)
+		drm_output_set_vrr(output, 0);
+
 	/* Turn off hardware cursor */
-	drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
+	drmModeSetCursor(output->fd, output->crtc_id, 0, 0, 0);
 
 	/* Restore original CRTC state */
-	drmModeSetCrtc(c->drm.fd, origcrtc->crtc_id, origcrtc->buffer_id,
+	drmModeSetCrtc(output->fd, origcrtc->crtc_id, origcrtc->buffer_id,
 		       origcrtc->x, origcrtc->y,
 		       &output->connector_id, 1, &origcrtc->mode);
 	drmModeFreeCrtc(origcrtc);
 
-	c->crtc_allocator &= ~(1 << output->crtc_id);
-	c->connector_allocator &= ~(1 << output->connector_id);
+	if (output->secondary) {
+		output->secondary->crtc_allocator &= ~(1 << output->crtc_id);
+		output->secondary->connector_allocator &=
+			~(1 << output->connector_id);
+	} else {
+		c->crtc_allocator &= ~(1 << output->crtc_id);
+		c->connector_allocator &= ~(1 << output->connector_id);
+	}
 
 	if (c->use_pixman) {
 		drm_output_fini_pixman(output);
 	} else {
+		drm_output_orphan_clone_fbs(output);
 		gl_renderer->output_destroy(output_base);
 		gbm_surface_destroy(output->surface);
 	}
@@ -1224,7 +3396,8 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	/* reset rendering stuff. */
 	drm_output_release_fb(output, output->current);
 	drm_output_release_fb(output, output->next);
-	output->current = output->next = NULL;
+	drm_output_release_fb(output, output->queued);
+	output->current = output->next = output->queued = NULL;
 
 	if (ec->use_pixman) {
 		drm_output_fini_pixman(output);
@@ -1234,10 +3407,7 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 			return -1;
 		}
 	} else {
-		gl_renderer->output_destroy(&output->base);
-		gbm_surface_destroy(output->surface);
-
-		if (drm_output_init_egl(output, ec) < 0) {
+		if (drm_output_reinit_egl(output) < 0) {
 			weston_log("failed to init output egl state with "
 				   "new mode");
 			return -1;
@@ -1295,6 +3465,17 @@ init_drm(struct drm_compositor *ec, struct udev_device *device)
 		ec->clock = CLOCK_MONOTONIC;
 	else
 		ec->clock = CLOCK_REALTIME;
+	ec->base.presentation_clock = ec->clock;
+
+#ifdef HAVE_DRM_ATOMIC
+	if (ec->atomic_modeset &&
+	    drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0)
+		ec->atomic_modeset = 0;
+#else
+	ec->atomic_modeset = 0;
+#endif
+	weston_log("atomic modesetting: %s\n",
+		   ec->atomic_modeset ? "yes" : "no");
 
 	return 0;
 }
@@ -1469,17 +3650,69 @@ drm_get_prop(int fd, drmModeConnectorPtr connector, const char *name)
 	return NULL;
 }
 
+/* Look up the CRTC property that turns on variable refresh, if the
+ * sink and the driver support it. */
+static void
+drm_output_init_vrr(struct drm_output *output, drmModeConnectorPtr connector)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyPtr prop;
+	uint64_t capable = 0;
+	uint32_t i;
+	int j;
+
+	prop = drm_get_prop(output->fd, connector, "vrr_capable");
+	if (prop) {
+		for (j = 0; j < connector->count_props; j++)
+			if (connector->props[j] == prop->prop_id)
+				capable = connector->prop_values[j];
+		drmModeFreeProperty(prop);
+	}
+
+	if (!capable)
+		return;
+
+	props = drmModeObjectGetProperties(output->fd, output->crtc_id,
+					   DRM_MODE_OBJECT_CRTC);
+	if (!props)
+		return;
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(output->fd, props->props[i]);
+		if (!prop)
+			continue;
+		if (!strcmp(prop->name, "VRR_ENABLED"))
+			output->vrr_prop_id = prop->prop_id;
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+}
+
+static void
+drm_output_set_vrr(struct drm_output *output, int enable)
+{
+	if (!output->vrr_prop_id)
+		return;
+
+	if (drmModeObjectSetProperty(output->fd, output->crtc_id,
+				     DRM_MODE_OBJECT_CRTC,
+				     output->vrr_prop_id, enable) < 0) {
+		weston_log("failed to %s adaptive sync on %s: %m\n",
+			   enable ? "enable" : "disable", output->base.name);
+		output->adaptive_sync = 0;
+	}
+}
+
 static void
 drm_set_dpms(struct weston_output *output_base, enum dpms_enum level)
 {
 	struct drm_output *output = (struct drm_output *) output_base;
-	struct weston_compositor *ec = output_base->compositor;
-	struct drm_compositor *c = (struct drm_compositor *) ec;
 
 	if (!output->dpms_prop)
 		return;
 
-	drmModeConnectorSetProperty(c->drm.fd, output->connector_id,
+	drmModeConnectorSetProperty(output->fd, output->connector_id,
 				    output->dpms_prop->prop_id, level);
 }
 
@@ -1502,7 +3735,7 @@ static const char *connector_type_names[] = {
 };
 
 static int
-find_crtc_for_connector(struct drm_compositor *ec,
+find_crtc_for_connector(int fd, uint32_t crtc_allocator,
 			drmModeRes *resources, drmModeConnector *connector)
 {
 	drmModeEncoder *encoder;
@@ -1510,7 +3743,7 @@ find_crtc_for_connector(struct drm_compositor *ec,
 	int i, j;
 
 	for (j = 0; j < connector->count_encoders; j++) {
-		encoder = drmModeGetEncoder(ec->drm.fd, connector->encoders[j]);
+		encoder = drmModeGetEncoder(fd, connector->encoders[j]);
 		if (encoder == NULL) {
 			weston_log("Failed to get encoder.\n");
 			return -1;
@@ -1518,14 +3751,37 @@ find_crtc_for_connector(struct drm_compositor *ec,
 		possible_crtcs = encoder->possible_crtcs;
 		drmModeFreeEncoder(encoder);
 
-		for (i = 0; i < resources->count_crtcs; i++) {
-			if (possible_crtcs & (1 << i) &&
-			    !(ec->crtc_allocator & (1 << resources->crtcs[i])))
-				return i;
-		}
-	}
+		for (i = 0; i < resources->count_crtcs; i++) {
+			if (possible_crtcs & (1 << i) &&
+			    !(crtc_allocator & (1 << resources->crtcs[i])))
+				return i;
+		}
+	}
+
+	return -1;
+}
+
+/* Only atomic commits can have the primary plane scale, and only our
+ * own GL frames are drawn small. */
+static void
+drm_output_update_render_size(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct weston_mode *mode = output->base.current_mode;
+
+	output->base.render_width = 0;
+	output->base.render_height = 0;
 
-	return -1;
+	if (output->render_scale >= 1.0 || output->render_scale_failed ||
+	    c->use_pixman || output->secondary || output->flip_queue ||
+	    (!output->atomic && !c->atomic_modeset))
+		return;
+
+	output->base.render_width = (int32_t) (mode->width *
+					       output->render_scale) & ~1;
+	output->base.render_height = (int32_t) (mode->height *
+						output->render_scale) & ~1;
 }
 
 /* Init output state that depends on gl or gbm */
@@ -1535,12 +3791,19 @@ drm_output_init_egl(struct drm_output *output, struct drm_compositor *ec)
 	EGLint format = output->format;
 	int i, flags;
 
+	flags = GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING;
+	if (output->linear)
+		flags |= GBM_BO_USE_LINEAR;
+
+	drm_output_update_render_size(output);
 	output->surface = gbm_surface_create(ec->gbm,
+					     output->base.render_width ?
+					     output->base.render_width :
 					     output->base.current_mode->width,
+					     output->base.render_height ?
+					     output->base.render_height :
 					     output->base.current_mode->height,
-					     format,
-					     GBM_BO_USE_SCANOUT |
-					     GBM_BO_USE_RENDERING);
+					     format, flags);
 	if (!output->surface) {
 		weston_log("failed to create gbm surface\n");
 		return -1;
@@ -1554,6 +3817,10 @@ drm_output_init_egl(struct drm_output *output, struct drm_compositor *ec)
 		return -1;
 	}
 
+	/* Cursor bos on the primary device are of no use to another */
+	if (output->secondary)
+		return 0;
+
 	flags = GBM_BO_USE_CURSOR_64X64 | GBM_BO_USE_WRITE;
 
 	for (i = 0; i < 2; i++) {
@@ -1573,16 +3840,31 @@ drm_output_init_egl(struct drm_output *output, struct drm_compositor *ec)
 	return 0;
 }
 
+static int
+drm_output_reinit_egl(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+
+	drm_output_orphan_clone_fbs(output);
+	gl_renderer->output_destroy(&output->base);
+	gbm_surface_destroy(output->surface);
+
+	return drm_output_init_egl(output, c);
+}
+
 static int
 drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
 {
 	int w = output->base.current_mode->width;
 	int h = output->base.current_mode->height;
+	uint32_t flags = 0;
 	unsigned int i;
 
 	/* FIXME error checking */
 
-	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+	output->num_images = output->flip_queue ? 3 : 2;
+	for (i = 0; i < output->num_images; i++) {
 		output->dumb[i] = drm_fb_create_dumb(c, w, h);
 		if (!output->dumb[i])
 			goto err;
@@ -1595,16 +3877,23 @@ drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
 			goto err;
 	}
 
-	if (pixman_renderer_output_create(&output->base) < 0)
+	/* The dumb buffers alternate and previous_damage covers what the
+	 * other one missed, so the renderer can draw into them directly. */
+	if (c->pixman_shadow)
+		flags |= PIXMAN_RENDERER_OUTPUT_USE_SHADOW;
+
+	if (pixman_renderer_output_create(&output->base, flags) < 0)
 		goto err;
 
 	pixman_region32_init_rect(&output->previous_damage,
 				  output->base.x, output->base.y, output->base.width, output->base.height);
+	pixman_region32_init_rect(&output->older_damage,
+				  output->base.x, output->base.y, output->base.width, output->base.height);
 
 	return 0;
 
 err:
-	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+	for (i = 0; i < output->num_images; i++) {
 		if (output->dumb[i])
 			drm_fb_destroy_dumb(output->dumb[i]);
 		if (output->image[i])
@@ -1624,8 +3913,11 @@ drm_output_fini_pixman(struct drm_output *output)
 
 	pixman_renderer_output_destroy(&output->base);
 	pixman_region32_fini(&output->previous_damage);
+	pixman_region32_fini(&output->older_damage);
 
-	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+	for (i = 0; i < output->num_images; i++) {
+		if (!output->dumb[i])
+			continue;
 		drm_fb_destroy_dumb(output->dumb[i]);
 		pixman_image_unref(output->image[i]);
 		output->dumb[i] = NULL;
@@ -1728,33 +4020,104 @@ edid_parse(struct drm_edid *edid, const uint8_t *data, size_t length)
 	return 0;
 }
 
+static struct drm_edid_cache_entry *
+drm_edid_cache_get(struct drm_compositor *ec, uint32_t connector_id)
+{
+	struct drm_edid_cache_entry *entry;
+
+	wl_list_for_each(entry, &ec->edid_cache, link)
+		if (entry->connector_id == connector_id)
+			return entry;
+
+	entry = zalloc(sizeof *entry);
+	if (!entry)
+		return NULL;
+
+	entry->connector_id = connector_id;
+	wl_list_insert(&ec->edid_cache, &entry->link);
+
+	return entry;
+}
+
 static void
-find_and_parse_output_edid(struct drm_compositor *ec,
-			   struct drm_output *output,
-			   drmModeConnector *connector)
+drm_edid_cache_destroy(struct drm_compositor *ec)
+{
+	struct drm_edid_cache_entry *entry, *next;
+
+	wl_list_for_each_safe(entry, next, &ec->edid_cache, link)
+		free(entry);
+}
+
+/* Look up the EDID blob of a connector, and remember which property
+ * it is so that a connector seen before needs no property lookups. */
+static uint32_t
+drm_connector_get_edid_blob_id(int fd, drmModeConnector *connector,
+			       struct drm_edid_cache_entry *entry)
 {
-	drmModePropertyBlobPtr edid_blob = NULL;
 	drmModePropertyPtr property;
 	int i;
-	int rc;
 
-	for (i = 0; i < connector->count_props && !edid_blob; i++) {
-		property = drmModeGetProperty(ec->drm.fd, connector->props[i]);
+	for (i = 0; entry && entry->prop_id && i < connector->count_props; i++)
+		if (connector->props[i] == entry->prop_id)
+			return connector->prop_values[i];
+
+	for (i = 0; i < connector->count_props; i++) {
+		property = drmModeGetProperty(fd, connector->props[i]);
 		if (!property)
 			continue;
 		if ((property->flags & DRM_MODE_PROP_BLOB) &&
 		    !strcmp(property->name, "EDID")) {
-			edid_blob = drmModeGetPropertyBlob(ec->drm.fd,
-							   connector->prop_values[i]);
+			drmModeFreeProperty(property);
+			if (entry)
+				entry->prop_id = connector->props[i];
+			return connector->prop_values[i];
 		}
 		drmModeFreeProperty(property);
 	}
-	if (!edid_blob)
+
+	return 0;
+}
+
+static void
+find_and_parse_output_edid(struct drm_compositor *ec,
+			   struct drm_output *output,
+			   drmModeConnector *connector)
+{
+	drmModePropertyBlobPtr edid_blob = NULL;
+	struct drm_edid_cache_entry *entry;
+	uint32_t blob_id;
+	int rc;
+
+	/* Connector ids are only unique per device */
+	entry = NULL;
+	if (!output->secondary)
+		entry = drm_edid_cache_get(ec, connector->connector_id);
+	blob_id = drm_connector_get_edid_blob_id(output->fd, connector, entry);
+	if (!blob_id)
 		return;
 
-	rc = edid_parse(&output->edid,
-			edid_blob->data,
-			edid_blob->length);
+	if (entry && entry->blob_id == blob_id) {
+		if (!entry->valid)
+			return;
+		output->edid = entry->edid;
+		rc = 0;
+	} else {
+		edid_blob = drmModeGetPropertyBlob(output->fd, blob_id);
+		if (!edid_blob)
+			return;
+
+		rc = edid_parse(&output->edid,
+				edid_blob->data,
+				edid_blob->length);
+		drmModeFreePropertyBlob(edid_blob);
+
+		if (entry) {
+			entry->blob_id = blob_id;
+			entry->valid = !rc;
+			entry->edid = output->edid;
+		}
+	}
+
 	if (!rc) {
 		weston_log("EDID data '%s', '%s', '%s'\n",
 			   output->edid.pnp_id,
@@ -1767,7 +4130,6 @@ find_and_parse_output_edid(struct drm_compositor *ec,
 		if (output->edid.serial_number[0] != '\0')
 			output->base.serial_number = output->edid.serial_number;
 	}
-	drmModeFreePropertyBlob(edid_blob);
 }
 
 
@@ -1815,6 +4177,27 @@ parse_modeline(const char *s, drmModeModeInfo *mode)
 	return 0;
 }
 
+static int32_t
+parse_repaint_window(const char *s, const char *output_name)
+{
+	char *end;
+	long window;
+
+	if (strcmp(s, "measured") == 0)
+		return WESTON_REPAINT_WINDOW_MEASURED;
+
+	errno = 0;
+	window = strtol(s, &end, 10);
+	if (errno != 0 || end == s || *end != '\0' ||
+	    window < 0 || window > 1000) {
+		weston_log("Invalid repaint-window \"%s\" for output %s\n",
+			   s, output_name);
+		return 0;
+	}
+
+	return window;
+}
+
 static uint32_t
 parse_transform(const char *transform, const char *output_name)
 {
@@ -1888,14 +4271,65 @@ get_gbm_format_from_section(struct weston_config_section *section,
 	return ret;
 }
 
+/* Check whether the CRTC is already scanning out the mode we picked,
+ * typically with the firmware or bootsplash fb, and whether our first
+ * frame could be page flipped to from that fb. */
+static void
+drm_output_init_boot_fb(struct drm_output *output, uint32_t encoder_crtc_id)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_mode *mode = (struct drm_mode *) output->base.current_mode;
+	drmModeCrtcPtr crtc = output->original_crtc;
+	struct wl_event_loop *loop;
+	drmModeFBPtr fb;
+
+	if (!crtc || encoder_crtc_id != output->crtc_id ||
+	    !crtc->mode_valid || !crtc->buffer_id ||
+	    memcmp(&crtc->mode, &mode->mode_info, sizeof crtc->mode))
+		return;
+
+	fb = drmModeGetFB(output->fd, crtc->buffer_id);
+	if (fb) {
+		if (fb->width == (uint32_t) mode->base.width &&
+		    fb->height == (uint32_t) mode->base.height &&
+		    fb->bpp == 32 && fb->depth == 24 &&
+		    output->format == GBM_FORMAT_XRGB8888)
+			output->boot_fb_pitch = fb->pitch;
+		output->boot_fb_id = crtc->buffer_id;
+		drmModeFreeFB(fb);
+	}
+
+	weston_log("Output %s already in mode %dx%d%s\n", output->base.name,
+		   mode->base.width, mode->base.height,
+		   output->boot_fb_pitch ? ", skipping modeset" : "");
+
+	if (!c->keep_boot_fb)
+		return;
+
+	loop = wl_display_get_event_loop(c->base.wl_display);
+	output->boot_fb_timer =
+		wl_event_loop_add_timer(loop, drm_output_boot_fb_timeout,
+					output);
+	if (!output->boot_fb_timer)
+		return;
+
+	wl_event_source_timer_update(output->boot_fb_timer,
+				     DRM_BOOT_FB_TIMEOUT_MS);
+	output->boot_fb_hold = 1;
+	output->base.disable_planes++;
+}
+
 static int
 create_output_for_connector(struct drm_compositor *ec,
 			    drmModeRes *resources,
 			    drmModeConnector *connector,
-			    int x, int y, struct udev_device *drm_device)
+			    int x, int y, struct udev_device *drm_device,
+			    struct drm_secondary *secondary)
 {
 	struct drm_output *output;
 	struct drm_mode *drm_mode, *next, *preferred, *current, *configured, *best;
+	struct drm_sprite *sprite;
 	struct weston_mode *m;
 	struct weston_config_section *section;
 	drmModeEncoder *encoder;
@@ -1905,9 +4339,22 @@ create_output_for_connector(struct drm_compositor *ec,
 	char name[32], *s;
 	const char *type_name;
 	enum output_config config;
-	uint32_t transform;
+	uint32_t transform, encoder_crtc_id = 0;
+	uint32_t *crtc_allocator, *connector_allocator;
+	int32_t repaint_window;
+	int fd;
 
-	i = find_crtc_for_connector(ec, resources, connector);
+	if (secondary) {
+		fd = secondary->fd;
+		crtc_allocator = &secondary->crtc_allocator;
+		connector_allocator = &secondary->connector_allocator;
+	} else {
+		fd = ec->drm.fd;
+		crtc_allocator = &ec->crtc_allocator;
+		connector_allocator = &ec->connector_allocator;
+	}
+
+	i = find_crtc_for_connector(fd, *crtc_allocator, resources, connector);
 	if (i < 0) {
 		weston_log("No usable crtc/encoder pair for connector.\n");
 		return -1;
@@ -1917,11 +4364,16 @@ create_output_for_connector(struct drm_compositor *ec,
 	if (output == NULL)
 		return -1;
 
+	output->fd = fd;
+	output->secondary = secondary;
+
 	output->base.subpixel = drm_subpixel_to_wayland(connector->subpixel);
 	output->base.make = "unknown";
 	output->base.model = "unknown";
 	output->base.serial_number = "unknown";
 	wl_list_init(&output->base.mode_list);
+	wl_list_init(&output->flip_feedback);
+	wl_list_init(&output->queued_feedback);
 
 	if (connector->connector_type < ARRAY_LENGTH(connector_type_names))
 		type_name = connector_type_names[connector->connector_type];
@@ -1955,6 +4407,22 @@ create_output_for_connector(struct drm_compositor *ec,
 	transform = parse_transform(s, output->base.name);
 	free(s);
 
+	weston_config_section_get_string(section, "repaint-window", &s, "0");
+	repaint_window = parse_repaint_window(s, output->base.name);
+	free(s);
+
+	weston_config_section_get_bool(section, "flip-queue",
+				       &output->flip_queue, 0);
+	weston_config_section_get_bool(section, "adaptive-sync",
+				       &output->adaptive_sync, 0);
+	weston_config_section_get_double(section, "render-scale",
+					 &output->render_scale, 1.0);
+	if (output->render_scale < 0.25 || output->render_scale > 1.0) {
+		weston_log("Invalid render-scale %.2f for output %s\n",
+			   output->render_scale, output->base.name);
+		output->render_scale = 1.0;
+	}
+
 	if (get_gbm_format_from_section(section,
 					ec->format,
 					&output->format) == -1)
@@ -1966,19 +4434,20 @@ create_output_for_connector(struct drm_compositor *ec,
 
 	output->crtc_id = resources->crtcs[i];
 	output->pipe = i;
-	ec->crtc_allocator |= (1 << output->crtc_id);
+	*crtc_allocator |= (1 << output->crtc_id);
 	output->connector_id = connector->connector_id;
-	ec->connector_allocator |= (1 << output->connector_id);
+	*connector_allocator |= (1 << output->connector_id);
 
-	output->original_crtc = drmModeGetCrtc(ec->drm.fd, output->crtc_id);
-	output->dpms_prop = drm_get_prop(ec->drm.fd, connector, "DPMS");
+	output->original_crtc = drmModeGetCrtc(output->fd, output->crtc_id);
+	output->dpms_prop = drm_get_prop(output->fd, connector, "DPMS");
 
 	/* Get the current mode on the crtc that's currently driving
 	 * this connector. */
-	encoder = drmModeGetEncoder(ec->drm.fd, connector->encoder_id);
+	encoder = drmModeGetEncoder(output->fd, connector->encoder_id);
 	memset(&crtc_mode, 0, sizeof crtc_mode);
 	if (encoder != NULL) {
-		crtc = drmModeGetCrtc(ec->drm.fd, encoder->crtc_id);
+		encoder_crtc_id = encoder->crtc_id;
+		crtc = drmModeGetCrtc(output->fd, encoder->crtc_id);
 		drmModeFreeEncoder(encoder);
 		if (crtc == NULL)
 			goto err_free;
@@ -1995,7 +4464,7 @@ create_output_for_connector(struct drm_compositor *ec,
 
 	if (config == OUTPUT_CONFIG_OFF) {
 		weston_log("Disabling output %s\n", output->base.name);
-		drmModeSetCrtc(ec->drm.fd, output->crtc_id,
+		drmModeSetCrtc(output->fd, output->crtc_id,
 			       0, 0, 0, 0, 0, NULL);
 		goto err_free;
 	}
@@ -2053,6 +4522,23 @@ create_output_for_connector(struct drm_compositor *ec,
 	weston_output_init(&output->base, &ec->base, x, y,
 			   connector->mmWidth, connector->mmHeight,
 			   transform, scale);
+	output->base.repaint_window = repaint_window;
+
+	if (output->adaptive_sync) {
+		drm_output_init_vrr(output, connector);
+		if (!output->vrr_prop_id) {
+			weston_log("%s doesn't support adaptive sync\n",
+				   output->base.name);
+			output->adaptive_sync = 0;
+		} else {
+			/* Delaying the repaint only adds latency when the
+			 * next refresh starts with our flip. */
+			output->base.repaint_window = 0;
+			drm_output_set_vrr(output, 1);
+		}
+	}
+
+	drm_output_init_boot_fb(output, encoder_crtc_id);
 
 	if (ec->use_pixman) {
 		if (drm_output_init_pixman(output, ec) < 0) {
@@ -2075,6 +4561,42 @@ create_output_for_connector(struct drm_compositor *ec,
 		weston_log("Failed to initialize backlight\n");
 	}
 
+	/* Queued frames only cover the primary plane, keep everything
+	 * there so the other planes can't run ahead of it. */
+	if (output->flip_queue)
+		output->base.disable_planes++;
+
+	/* Secondary devices only get whole frames from the primary GPU
+	 * and are driven through the legacy, synchronous paths. */
+	if (secondary)
+		output->base.disable_planes++;
+
+#ifdef HAVE_DRM_ATOMIC
+	if (ec->atomic_modeset && !output->flip_queue && !secondary) {
+		if (drm_output_init_atomic(output) == 0)
+			output->atomic = 1;
+		else
+			weston_log("no atomic plane setup for %s, "
+				   "using legacy modesetting\n",
+				   output->base.name);
+	}
+#endif
+
+	/* The legacy calls can't scale, draw at the mode size after all */
+	if (output->base.render_width && !output->atomic) {
+		output->render_scale_failed = 1;
+		if (drm_output_reinit_egl(output) < 0) {
+			weston_log("Failed to init output gl state\n");
+			goto err_output;
+		}
+	}
+
+	/* Without a worker the plane updates are issued synchronously.
+	 * Atomic commits don't block, so they don't need one. */
+	if (ec->threaded_planes && !output->atomic && !output->flip_queue &&
+	    !secondary)
+		drm_output_worker_init(output);
+
 	wl_list_insert(ec->base.output_list.prev, &output->base.link);
 
 	find_and_parse_output_edid(ec, output, connector);
@@ -2091,15 +4613,24 @@ create_output_for_connector(struct drm_compositor *ec,
 	output->base.gamma_size = output->original_crtc->gamma_size;
 	output->base.set_gamma = drm_output_set_gamma;
 
+	wl_list_for_each(sprite, &ec->sprite_list, link)
+		if (drm_sprite_crtc_supported(&output->base,
+					      sprite->possible_crtcs))
+			output->base.hardware_planes++;
+
 	weston_plane_init(&output->cursor_plane, &ec->base, 0, 0);
 	weston_plane_init(&output->fb_plane, &ec->base, 0, 0);
+	output->cursor_plane.type = WESTON_PLANE_CURSOR;
+	output->fb_plane.type = WESTON_PLANE_SCANOUT;
 
 	weston_compositor_stack_plane(&ec->base, &output->cursor_plane, NULL);
 	weston_compositor_stack_plane(&ec->base, &output->fb_plane,
 				      &ec->base.primary_plane);
 
-	weston_log("Output %s, (connector %d, crtc %d)\n",
-		   output->base.name, output->connector_id, output->crtc_id);
+	weston_log("Output %s, (connector %d, crtc %d%s%s)\n",
+		   output->base.name, output->connector_id, output->crtc_id,
+		   secondary ? ", on " : "",
+		   secondary ? secondary->filename : "");
 	wl_list_for_each(m, &output->base.mode_list, link)
 		weston_log_continue(STAMP_SPACE "mode %dx%d@%.1f%s%s%s\n",
 				    m->width, m->height, m->refresh / 1000.0,
@@ -2113,6 +4644,7 @@ create_output_for_connector(struct drm_compositor *ec,
 	return 0;
 
 err_output:
+	drm_output_end_boot_fb_hold(output);
 	weston_output_destroy(&output->base);
 err_free:
 	wl_list_for_each_safe(drm_mode, next, &output->base.mode_list,
@@ -2122,13 +4654,68 @@ err_free:
 	}
 
 	drmModeFreeCrtc(output->original_crtc);
-	ec->crtc_allocator &= ~(1 << output->crtc_id);
-	ec->connector_allocator &= ~(1 << output->connector_id);
+	*crtc_allocator &= ~(1 << output->crtc_id);
+	*connector_allocator &= ~(1 << output->connector_id);
 	free(output);
 
 	return -1;
 }
 
+/* Id of an optional plane property, 0 when the driver lacks it. */
+static uint32_t
+drm_plane_find_prop(int fd, uint32_t plane_id, const char *name)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	uint32_t i, id = 0;
+
+	props = drmModeObjectGetProperties(fd, plane_id,
+					   DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return 0;
+
+	for (i = 0; i < props->count_props && !id; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+		if (strcmp(prop->name, name) == 0)
+			id = prop->prop_id;
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return id;
+}
+
+/* The rotations a plane accepts.  Without the property it can only
+ * show buffers upright. */
+static uint64_t
+drm_plane_get_rotations(int fd, uint32_t plane_id, uint32_t *prop_id)
+{
+	drmModePropertyRes *prop;
+	uint64_t mask = WDRM_ROTATE_0;
+	int i;
+
+	*prop_id = drm_plane_find_prop(fd, plane_id, "rotation");
+	if (!*prop_id)
+		return mask;
+
+	prop = drmModeGetProperty(fd, *prop_id);
+	if (!prop)
+		return mask;
+
+	if (prop->flags & DRM_MODE_PROP_BITMASK) {
+		mask = 0;
+		for (i = 0; i < prop->count_enums; i++)
+			mask |= 1ULL << prop->enums[i].value;
+	}
+
+	drmModeFreeProperty(prop);
+
+	return mask;
+}
+
 static void
 create_sprites(struct drm_compositor *ec)
 {
@@ -2136,6 +4723,10 @@ create_sprites(struct drm_compositor *ec)
 	drmModePlaneRes *plane_res;
 	drmModePlane *plane;
 	uint32_t i;
+#ifdef HAVE_DRM_ATOMIC
+	uint32_t props[WDRM_PLANE__COUNT];
+	uint64_t type;
+#endif
 
 	plane_res = drmModeGetPlaneResources(ec->drm.fd);
 	if (!plane_res) {
@@ -2149,6 +4740,20 @@ create_sprites(struct drm_compositor *ec)
 		if (!plane)
 			continue;
 
+#ifdef HAVE_DRM_ATOMIC
+		/* Atomic clients see the primary and cursor planes too,
+		 * those belong to the outputs. */
+		if (ec->atomic_modeset &&
+		    (drm_object_get_props(ec->drm.fd, plane->plane_id,
+					  DRM_MODE_OBJECT_PLANE,
+					  plane_prop_names, props,
+					  WDRM_PLANE__COUNT, &type) < 0 ||
+		     type != WDRM_PLANE_TYPE_OVERLAY)) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+#endif
+
 		sprite = zalloc(sizeof(*sprite) + ((sizeof(uint32_t)) *
 						   plane->count_formats));
 		if (!sprite) {
@@ -2160,6 +4765,23 @@ create_sprites(struct drm_compositor *ec)
 
 		sprite->possible_crtcs = plane->possible_crtcs;
 		sprite->plane_id = plane->plane_id;
+		sprite->colorkey_prop =
+			drm_plane_find_prop(ec->drm.fd, plane->plane_id,
+					    "colorkey");
+		sprite->rotations =
+			drm_plane_get_rotations(ec->drm.fd, plane->plane_id,
+						&sprite->rotation_prop);
+		sprite->rotation = WDRM_ROTATE_0;
+		sprite->rotation_set = WDRM_ROTATE_0;
+		sprite->in_fence_fd = -1;
+#ifdef HAVE_DRM_ATOMIC
+		memcpy(sprite->props, props, sizeof props);
+		if (ec->atomic_modeset)
+			sprite->in_fence_prop =
+				drm_plane_find_prop(ec->drm.fd,
+						    plane->plane_id,
+						    "IN_FENCE_FD");
+#endif
 		sprite->current = NULL;
 		sprite->next = NULL;
 		sprite->compositor = ec;
@@ -2186,6 +4808,8 @@ destroy_sprites(struct drm_compositor *compositor)
 	output = container_of(compositor->base.output_list.next,
 			      struct drm_output, base.link);
 
+	drm_compositor_wait_plane_workers(compositor);
+
 	wl_list_for_each_safe(sprite, next, &compositor->sprite_list, link) {
 		drmModeSetPlane(compositor->drm.fd,
 				sprite->plane_id,
@@ -2193,6 +4817,8 @@ destroy_sprites(struct drm_compositor *compositor)
 				0, 0, 0, 0, 0, 0, 0, 0);
 		drm_output_release_fb(output, sprite->current);
 		drm_output_release_fb(output, sprite->next);
+		if (sprite->in_fence_fd >= 0)
+			close(sprite->in_fence_fd);
 		weston_plane_release(&sprite->plane);
 		free(sprite);
 	}
@@ -2238,7 +4864,7 @@ create_outputs(struct drm_compositor *ec, uint32_t option_connector,
 		     connector->connector_id == option_connector)) {
 			if (create_output_for_connector(ec, resources,
 							connector, x, y,
-							drm_device) < 0) {
+							drm_device, NULL) < 0) {
 				drmModeFreeConnector(connector);
 				continue;
 			}
@@ -2248,88 +4874,338 @@ create_outputs(struct drm_compositor *ec, uint32_t option_connector,
 					  link)->width;
 		}
 
-		drmModeFreeConnector(connector);
+		drmModeFreeConnector(connector);
+	}
+
+	if (wl_list_empty(&ec->base.output_list)) {
+		weston_log("No currently active connector found.\n");
+		drmModeFreeResources(resources);
+		return -1;
+	}
+
+	drmModeFreeResources(resources);
+
+	return 0;
+}
+
+/* This is the slow part of handling a hotplug event, the kernel reads
+ * the EDID and scans for modes for each connector we probe.  Connector
+ * id 0 probes all of them.  Safe to call from the hotplug thread. */
+static void
+drm_probe_connectors(int fd, drmModeRes *resources, uint32_t connector_id,
+		     struct wl_array *probed)
+{
+	struct drm_probed_connector *p;
+	int i;
+
+	for (i = 0; i < resources->count_connectors; i++) {
+		if (connector_id &&
+		    resources->connectors[i] != connector_id)
+			continue;
+
+		p = wl_array_add(probed, sizeof *p);
+		if (!p)
+			return;
+		p->connector_id = resources->connectors[i];
+		p->connector = drmModeGetConnector(fd, p->connector_id);
+	}
+
+	/* A connector that is no longer listed went away */
+	if (connector_id && probed->size == 0) {
+		p = wl_array_add(probed, sizeof *p);
+		if (!p)
+			return;
+		p->connector_id = connector_id;
+		p->connector = NULL;
+	}
+}
+
+static void
+drm_probed_connectors_release(struct wl_array *probed)
+{
+	struct drm_probed_connector *p;
+
+	wl_array_for_each(p, probed)
+		if (p->connector)
+			drmModeFreeConnector(p->connector);
+	wl_array_release(probed);
+}
+
+/* Create outputs for probed connectors that got connected and destroy
+ * those of the ones that got disconnected.  After a full probe, every
+ * connector that was not probed is gone too. */
+static void
+drm_apply_probed_connectors(struct drm_compositor *ec, drmModeRes *resources,
+			    struct wl_array *probed, int full,
+			    struct udev_device *drm_device)
+{
+	struct drm_probed_connector *p;
+	drmModeConnector *connector;
+	struct drm_output *output, *next;
+	int x = 0, y = 0;
+	uint32_t connected = 0, probed_mask = 0, disconnects = 0;
+
+	/* collect new connects */
+	wl_array_for_each(p, probed) {
+		int connector_id = p->connector_id;
+
+		probed_mask |= (1 << connector_id);
+
+		connector = p->connector;
+		if (connector == NULL ||
+		    connector->connection != DRM_MODE_CONNECTED)
+			continue;
+
+		connected |= (1 << connector_id);
+
+		if (!(ec->connector_allocator & (1 << connector_id))) {
+			struct weston_output *last =
+				container_of(ec->base.output_list.prev,
+					     struct weston_output, link);
+
+			/* XXX: not yet needed, we die with 0 outputs */
+			if (!wl_list_empty(&ec->base.output_list))
+				x = last->x + last->width;
+			else
+				x = 0;
+			y = 0;
+			create_output_for_connector(ec, resources,
+						    connector, x, y,
+						    drm_device, NULL);
+			weston_log("connector %d connected\n", connector_id);
+
+		}
+	}
+
+	if (full)
+		disconnects = ec->connector_allocator & ~connected;
+	else
+		disconnects = ec->connector_allocator & probed_mask & ~connected;
+	if (disconnects) {
+		wl_list_for_each_safe(output, next, &ec->base.output_list,
+				      base.link) {
+			if (output->secondary)
+				continue;
+			if (disconnects & (1 << output->connector_id)) {
+				disconnects &= ~(1 << output->connector_id);
+				weston_log("connector %d disconnected\n",
+				       output->connector_id);
+				drm_output_destroy(&output->base);
+			}
+		}
+	}
+
+	/* FIXME: handle zero outputs, without terminating */	
+	if (ec->connector_allocator == 0)
+		wl_display_terminate(ec->base.wl_display);
+}
+
+static void
+update_outputs(struct drm_compositor *ec, struct udev_device *drm_device,
+	       uint32_t connector_id)
+{
+	drmModeRes *resources;
+	struct wl_array probed;
+
+	resources = drmModeGetResources(ec->drm.fd);
+	if (!resources) {
+		weston_log("drmModeGetResources failed\n");
+		return;
+	}
+
+	wl_array_init(&probed);
+	drm_probe_connectors(ec->drm.fd, resources, connector_id, &probed);
+	drm_apply_probed_connectors(ec, resources, &probed, connector_id == 0,
+				    drm_device);
+	drm_probed_connectors_release(&probed);
+	drmModeFreeResources(resources);
+}
+
+static void *
+drm_hotplug_thread(void *data)
+{
+	struct drm_compositor *ec = data;
+	struct udev_device *device;
+	drmModeRes *resources;
+	struct wl_array probed;
+	uint32_t connector_id;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&ec->hotplug.mutex);
+	for (;;) {
+		while (!ec->hotplug.quit &&
+		       (!ec->hotplug.requested || ec->hotplug.result_ready))
+			pthread_cond_wait(&ec->hotplug.cond,
+					  &ec->hotplug.mutex);
+		if (ec->hotplug.quit)
+			break;
+
+		connector_id = ec->hotplug.connector_id;
+		device = ec->hotplug.device;
+		ec->hotplug.device = NULL;
+		ec->hotplug.requested = 0;
+		pthread_mutex_unlock(&ec->hotplug.mutex);
+
+		wl_array_init(&probed);
+		resources = drmModeGetResources(ec->drm.fd);
+		if (resources)
+			drm_probe_connectors(ec->drm.fd, resources,
+					     connector_id, &probed);
+
+		pthread_mutex_lock(&ec->hotplug.mutex);
+		ec->hotplug.resources = resources;
+		ec->hotplug.probed = probed;
+		ec->hotplug.result_full = connector_id == 0;
+		ec->hotplug.result_device = device;
+		ec->hotplug.result_ready = 1;
+		if (write(ec->hotplug.fd, &one, sizeof one) != sizeof one)
+			weston_log("failed to signal hotplug probe: %m\n");
+	}
+	pthread_mutex_unlock(&ec->hotplug.mutex);
+
+	return NULL;
+}
+
+static int
+drm_hotplug_done(int fd, uint32_t mask, void *data)
+{
+	struct drm_compositor *ec = data;
+	struct udev_device *device;
+	drmModeRes *resources;
+	struct wl_array probed;
+	uint64_t count;
+	int full;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 1;
+
+	pthread_mutex_lock(&ec->hotplug.mutex);
+	if (!ec->hotplug.result_ready) {
+		pthread_mutex_unlock(&ec->hotplug.mutex);
+		return 1;
 	}
-
-	if (wl_list_empty(&ec->base.output_list)) {
-		weston_log("No currently active connector found.\n");
+	resources = ec->hotplug.resources;
+	probed = ec->hotplug.probed;
+	full = ec->hotplug.result_full;
+	device = ec->hotplug.result_device;
+	ec->hotplug.resources = NULL;
+	ec->hotplug.result_device = NULL;
+	pthread_mutex_unlock(&ec->hotplug.mutex);
+
+	if (resources) {
+		drm_apply_probed_connectors(ec, resources, &probed, full,
+					    device);
 		drmModeFreeResources(resources);
-		return -1;
+	} else {
+		weston_log("drmModeGetResources failed\n");
 	}
+	drm_probed_connectors_release(&probed);
+	if (device)
+		udev_device_unref(device);
 
-	drmModeFreeResources(resources);
+	/* Let the thread go on with what came in meanwhile */
+	pthread_mutex_lock(&ec->hotplug.mutex);
+	ec->hotplug.result_ready = 0;
+	pthread_cond_signal(&ec->hotplug.cond);
+	pthread_mutex_unlock(&ec->hotplug.mutex);
 
-	return 0;
+	return 1;
 }
 
 static void
-update_outputs(struct drm_compositor *ec, struct udev_device *drm_device)
+drm_hotplug_init(struct drm_compositor *ec)
 {
-	drmModeConnector *connector;
-	drmModeRes *resources;
-	struct drm_output *output, *next;
-	int x = 0, y = 0;
-	uint32_t connected = 0, disconnects = 0;
-	int i;
+	struct wl_event_loop *loop;
 
-	resources = drmModeGetResources(ec->drm.fd);
-	if (!resources) {
-		weston_log("drmModeGetResources failed\n");
+	ec->hotplug.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ec->hotplug.fd < 0)
 		return;
+
+	loop = wl_display_get_event_loop(ec->base.wl_display);
+	ec->hotplug.source =
+		wl_event_loop_add_fd(loop, ec->hotplug.fd, WL_EVENT_READABLE,
+				     drm_hotplug_done, ec);
+	if (!ec->hotplug.source)
+		goto err_fd;
+
+	pthread_mutex_init(&ec->hotplug.mutex, NULL);
+	pthread_cond_init(&ec->hotplug.cond, NULL);
+	if (pthread_create(&ec->hotplug.thread, NULL,
+			   drm_hotplug_thread, ec) != 0) {
+		weston_log("failed to start hotplug thread, "
+			   "probing connectors synchronously\n");
+		pthread_cond_destroy(&ec->hotplug.cond);
+		pthread_mutex_destroy(&ec->hotplug.mutex);
+		wl_event_source_remove(ec->hotplug.source);
+		goto err_fd;
 	}
 
-	/* collect new connects */
-	for (i = 0; i < resources->count_connectors; i++) {
-		int connector_id = resources->connectors[i];
+	ec->hotplug.running = 1;
 
-		connector = drmModeGetConnector(ec->drm.fd, connector_id);
-		if (connector == NULL)
-			continue;
+	return;
 
-		if (connector->connection != DRM_MODE_CONNECTED) {
-			drmModeFreeConnector(connector);
-			continue;
-		}
+err_fd:
+	close(ec->hotplug.fd);
+	ec->hotplug.fd = -1;
+}
 
-		connected |= (1 << connector_id);
+static void
+drm_hotplug_fini(struct drm_compositor *ec)
+{
+	if (!ec->hotplug.running)
+		return;
 
-		if (!(ec->connector_allocator & (1 << connector_id))) {
-			struct weston_output *last =
-				container_of(ec->base.output_list.prev,
-					     struct weston_output, link);
+	pthread_mutex_lock(&ec->hotplug.mutex);
+	ec->hotplug.quit = 1;
+	pthread_cond_signal(&ec->hotplug.cond);
+	pthread_mutex_unlock(&ec->hotplug.mutex);
+	pthread_join(ec->hotplug.thread, NULL);
+
+	if (ec->hotplug.result_ready) {
+		if (ec->hotplug.resources)
+			drmModeFreeResources(ec->hotplug.resources);
+		drm_probed_connectors_release(&ec->hotplug.probed);
+		if (ec->hotplug.result_device)
+			udev_device_unref(ec->hotplug.result_device);
+	}
+	if (ec->hotplug.device)
+		udev_device_unref(ec->hotplug.device);
+
+	pthread_cond_destroy(&ec->hotplug.cond);
+	pthread_mutex_destroy(&ec->hotplug.mutex);
+	wl_event_source_remove(ec->hotplug.source);
+	close(ec->hotplug.fd);
+	ec->hotplug.running = 0;
+}
 
-			/* XXX: not yet needed, we die with 0 outputs */
-			if (!wl_list_empty(&ec->base.output_list))
-				x = last->x + last->width;
-			else
-				x = 0;
-			y = 0;
-			create_output_for_connector(ec, resources,
-						    connector, x, y,
-						    drm_device);
-			weston_log("connector %d connected\n", connector_id);
+/* Kernels that know which connector changed tell us in the event, so
+ * only that one needs probing.  Events for different connectors that
+ * come in while a probe is running merge into one full probe. */
+static void
+drm_hotplug_request(struct drm_compositor *ec, struct udev_device *device)
+{
+	uint32_t connector_id = 0;
+	const char *val;
 
-		}
-		drmModeFreeConnector(connector);
-	}
-	drmModeFreeResources(resources);
+	val = udev_device_get_property_value(device, "CONNECTOR");
+	if (val)
+		connector_id = strtoul(val, NULL, 10);
 
-	disconnects = ec->connector_allocator & ~connected;
-	if (disconnects) {
-		wl_list_for_each_safe(output, next, &ec->base.output_list,
-				      base.link) {
-			if (disconnects & (1 << output->connector_id)) {
-				disconnects &= ~(1 << output->connector_id);
-				weston_log("connector %d disconnected\n",
-				       output->connector_id);
-				drm_output_destroy(&output->base);
-			}
-		}
+	if (!ec->hotplug.running) {
+		update_outputs(ec, device, connector_id);
+		return;
 	}
 
-	/* FIXME: handle zero outputs, without terminating */	
-	if (ec->connector_allocator == 0)
-		wl_display_terminate(ec->base.wl_display);
+	pthread_mutex_lock(&ec->hotplug.mutex);
+	if (ec->hotplug.requested && ec->hotplug.connector_id != connector_id)
+		connector_id = 0;
+	ec->hotplug.connector_id = connector_id;
+	ec->hotplug.requested = 1;
+	if (ec->hotplug.device)
+		udev_device_unref(ec->hotplug.device);
+	ec->hotplug.device = udev_device_ref(device);
+	pthread_cond_signal(&ec->hotplug.cond);
+	pthread_mutex_unlock(&ec->hotplug.mutex);
 }
 
 static int
@@ -2358,7 +5234,7 @@ udev_drm_event(int fd, uint32_t mask, void *data)
 	event = udev_monitor_receive_device(ec->udev_monitor);
 
 	if (udev_event_is_hotplug(ec, event))
-		update_outputs(ec, event);
+		drm_hotplug_request(ec, event);
 
 	udev_device_unref(event);
 
@@ -2371,13 +5247,26 @@ drm_restore(struct weston_compositor *ec)
 	weston_launcher_restore(ec->launcher);
 }
 
+static void
+drm_secondary_destroy(struct drm_secondary *secondary)
+{
+	wl_list_remove(&secondary->link);
+	if (secondary->source)
+		wl_event_source_remove(secondary->source);
+	close(secondary->fd);
+	free(secondary->filename);
+	free(secondary);
+}
+
 static void
 drm_destroy(struct weston_compositor *ec)
 {
 	struct drm_compositor *d = (struct drm_compositor *) ec;
+	struct drm_secondary *secondary, *next;
 
 	udev_input_destroy(&d->input);
 
+	drm_hotplug_fini(d);
 	wl_event_source_remove(d->udev_drm_source);
 	wl_event_source_remove(d->drm_source);
 
@@ -2385,6 +5274,12 @@ drm_destroy(struct weston_compositor *ec)
 
 	weston_compositor_shutdown(ec);
 
+	drm_fb_cache_flush(d);
+	drm_edid_cache_destroy(d);
+
+	wl_list_for_each_safe(secondary, next, &d->secondary_list, link)
+		drm_secondary_destroy(secondary);
+
 	if (d->gbm)
 		gbm_device_destroy(d->gbm);
 
@@ -2400,6 +5295,7 @@ drm_compositor_set_modes(struct drm_compositor *compositor)
 {
 	struct drm_output *output;
 	struct drm_mode *drm_mode;
+	drmModeCrtcPtr crtc;
 	int ret;
 
 	wl_list_for_each(output, &compositor->base.output_list, base.link) {
@@ -2414,7 +5310,23 @@ drm_compositor_set_modes(struct drm_compositor *compositor)
 		}
 
 		drm_mode = (struct drm_mode *) output->base.current_mode;
-		ret = drmModeSetCrtc(compositor->drm.fd, output->crtc_id,
+
+		/* Whoever had the device may have turned it off */
+		if (output->adaptive_sync)
+			drm_output_set_vrr(output, 1);
+
+		/* Nobody touched the CRTC while we were away */
+		crtc = drmModeGetCrtc(output->fd, output->crtc_id);
+		if (crtc && crtc->mode_valid &&
+		    crtc->buffer_id == output->current->fb_id &&
+		    !memcmp(&crtc->mode, &drm_mode->mode_info,
+			    sizeof crtc->mode)) {
+			drmModeFreeCrtc(crtc);
+			continue;
+		}
+		drmModeFreeCrtc(crtc);
+
+		ret = drmModeSetCrtc(output->fd, output->crtc_id,
 				     output->current->fb_id, 0, 0,
 				     &output->connector_id, 1,
 				     &drm_mode->mode_info);
@@ -2458,12 +5370,15 @@ session_notify(struct wl_listener *listener, void *data)
 
 		wl_list_for_each(output, &ec->base.output_list, base.link) {
 			output->base.repaint_needed = 0;
-			drmModeSetCursor(ec->drm.fd, output->crtc_id, 0, 0, 0);
+			drmModeSetCursor(output->fd, output->crtc_id, 0, 0, 0);
+			output->cursor_set = 0;
 		}
 
 		output = container_of(ec->base.output_list.next,
 				      struct drm_output, base.link);
 
+		drm_compositor_wait_plane_workers(ec);
+
 		wl_list_for_each(sprite, &ec->sprite_list, link)
 			drmModeSetPlane(ec->drm.fd,
 					sprite->plane_id,
@@ -2536,6 +5451,129 @@ find_primary_gpu(struct drm_compositor *ec, const char *seat)
 	return drm_device;
 }
 
+static struct drm_secondary *
+drm_secondary_create(struct drm_compositor *ec, struct udev_device *device)
+{
+	struct drm_secondary *secondary;
+	struct wl_event_loop *loop;
+	drmModeConnector *connector;
+	drmModeRes *resources;
+	const char *filename;
+	struct weston_output *last;
+	uint64_t cap;
+	int fd, i, x, created = 0;
+
+	filename = udev_device_get_devnode(device);
+	if (!filename)
+		return NULL;
+
+	fd = weston_launcher_open(ec->base.launcher, filename, O_RDWR);
+	if (fd < 0) {
+		weston_log("couldn't open %s, skipping\n", filename);
+		return NULL;
+	}
+
+	/* Render-only devices have no connectors, and a display without
+	 * dmabuf import can't show what the primary GPU rendered. */
+	if (drmGetCap(fd, DRM_CAP_PRIME, &cap) < 0 ||
+	    !(cap & DRM_PRIME_CAP_IMPORT) ||
+	    !(resources = drmModeGetResources(fd))) {
+		close(fd);
+		return NULL;
+	}
+
+	if (resources->count_connectors == 0) {
+		drmModeFreeResources(resources);
+		close(fd);
+		return NULL;
+	}
+
+	secondary = zalloc(sizeof *secondary);
+	if (!secondary) {
+		drmModeFreeResources(resources);
+		close(fd);
+		return NULL;
+	}
+
+	secondary->fd = fd;
+	secondary->filename = strdup(filename);
+	wl_list_insert(ec->secondary_list.prev, &secondary->link);
+
+	weston_log("using %s for display only\n", filename);
+
+	for (i = 0; i < resources->count_connectors; i++) {
+		connector = drmModeGetConnector(fd, resources->connectors[i]);
+		if (connector == NULL)
+			continue;
+
+		x = 0;
+		if (!wl_list_empty(&ec->base.output_list)) {
+			last = container_of(ec->base.output_list.prev,
+					    struct weston_output, link);
+			x = last->x + last->width;
+		}
+
+		if (connector->connection == DRM_MODE_CONNECTED &&
+		    create_output_for_connector(ec, resources, connector,
+						x, 0, device, secondary) == 0)
+			created++;
+
+		drmModeFreeConnector(connector);
+	}
+
+	drmModeFreeResources(resources);
+
+	if (!created) {
+		drm_secondary_destroy(secondary);
+		return NULL;
+	}
+
+	loop = wl_display_get_event_loop(ec->base.wl_display);
+	secondary->source = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+						 on_drm_input, ec);
+
+	return secondary;
+}
+
+/*
+ * Open secondary GPUs
+ * Other DRM devices on the seat, such as a USB display adapter or the
+ * discrete GPU of a laptop, get their connected outputs driven with
+ * frames rendered on the primary GPU.
+ */
+static void
+drm_open_secondary_gpus(struct drm_compositor *ec, const char *seat,
+			struct udev_device *primary)
+{
+	struct udev_enumerate *e;
+	struct udev_list_entry *entry;
+	const char *path, *device_seat;
+	struct udev_device *device;
+
+	e = udev_enumerate_new(ec->udev);
+	udev_enumerate_add_match_subsystem(e, "drm");
+	udev_enumerate_add_match_sysname(e, "card[0-9]*");
+
+	udev_enumerate_scan_devices(e);
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(e)) {
+		path = udev_list_entry_get_name(entry);
+		if (!strcmp(path, udev_device_get_syspath(primary)))
+			continue;
+
+		device = udev_device_new_from_syspath(ec->udev, path);
+		if (!device)
+			continue;
+		device_seat = udev_device_get_property_value(device, "ID_SEAT");
+		if (!device_seat)
+			device_seat = default_seat;
+		if (!strcmp(device_seat, seat))
+			drm_secondary_create(ec, device);
+		udev_device_unref(device);
+	}
+
+	udev_enumerate_unref(e);
+}
+
 static void
 planes_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *data)
 {
@@ -2556,6 +5594,18 @@ planes_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *data
 	}
 }
 
+static void
+fb_cache_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		 void *data)
+{
+	struct drm_compositor *c = data;
+
+	weston_log("fb cache: %d entries, %u hits, %u misses, "
+		   "%u evictions\n", c->fb_cache_count,
+		   c->fb_cache_hits, c->fb_cache_misses,
+		   c->fb_cache_evictions);
+}
+
 #ifdef BUILD_VAAPI_RECORDER
 static void
 recorder_destroy(struct drm_output *output)
@@ -2574,25 +5624,41 @@ recorder_frame_notify(struct wl_listener *listener, void *data)
 {
 	struct drm_output *output;
 	struct drm_compositor *c;
+	struct drm_fb *fb;
 	int fd, ret;
 
 	output = container_of(listener, struct drm_output,
 			      recorder_frame_listener);
 	c = (struct drm_compositor *) output->base.compositor;
 
-	if (!output->recorder)
+	if (!output->recorder || !output->current)
 		return;
 
-	ret = drmPrimeHandleToFD(c->drm.fd, output->current->handle,
-				 DRM_CLOEXEC, &fd);
-	if (ret) {
-		weston_log("[libva recorder] "
-			   "failed to create prime fd for front buffer\n");
-		return;
+	/* Import each fb once, the surface then lives as long as the fb.
+	 * The imported one may also belong to an earlier recording. */
+	fb = output->current;
+	if (fb->recorder_buffer &&
+	    !vaapi_recorder_buffer_is_valid(output->recorder,
+					    fb->recorder_buffer))
+		drm_fb_release_recorder_buffer(fb);
+
+	if (!fb->recorder_buffer) {
+		ret = drmPrimeHandleToFD(c->drm.fd, fb->handle,
+					 DRM_CLOEXEC, &fd);
+		if (ret) {
+			weston_log("[libva recorder] "
+				   "failed to create prime fd for front buffer\n");
+			return;
+		}
+
+		fb->recorder_buffer =
+			vaapi_recorder_import(output->recorder, fd, fb->stride);
+		close(fd);
+		if (!fb->recorder_buffer)
+			return;
 	}
 
-	ret = vaapi_recorder_frame(output->recorder, fd,
-				   output->current->stride);
+	ret = vaapi_recorder_frame(output->recorder, fb->recorder_buffer);
 	if (ret < 0) {
 		weston_log("[libva recorder] aborted: %m\n");
 		recorder_destroy(output);
@@ -2603,6 +5669,8 @@ static void *
 create_recorder(struct drm_compositor *c, int width, int height,
 		const char *filename)
 {
+	struct vaapi_recorder_config config;
+	struct weston_config_section *section;
 	int fd;
 	drm_magic_t magic;
 
@@ -2613,7 +5681,12 @@ create_recorder(struct drm_compositor *c, int width, int height,
 	drmGetMagic(fd, &magic);
 	drmAuthMagic(c->drm.fd, magic);
 
-	return vaapi_recorder_create(fd, width, height, filename);
+	section = weston_config_get_section(c->base.config, "recorder",
+					    NULL, NULL);
+	vaapi_recorder_config_init(&config);
+	vaapi_recorder_config_read(&config, section);
+
+	return vaapi_recorder_create(fd, width, height, filename, &config);
 }
 
 static void
@@ -2628,6 +5701,12 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 			      struct drm_output, base.link);
 
 	if (!output->recorder) {
+		if (output->secondary) {
+			weston_log("failed to start vaapi recorder: "
+				   "output on a secondary device\n");
+			return;
+		}
+
 		if (output->format != GBM_FORMAT_XRGB8888) {
 			weston_log("failed to start vaapi recorder: "
 				   "output format not supported\n");
@@ -2666,30 +5745,78 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 }
 #endif
 
+/* The frame on screen belongs to the renderer about to go away.  Keep
+ * its fb id so it stays up, and flip from it like from the boot fb. */
+static void
+drm_output_retire_fb(struct drm_output *output)
+{
+	struct drm_fb *fb = output->current;
+
+	if (!fb)
+		return;
+
+	if (output->retired_fb_id)
+		drmModeRmFB(output->fd, output->retired_fb_id);
+	output->retired_fb_id = fb->fb_id;
+	output->boot_fb_pitch = fb->stride;
+	fb->fb_id = 0;
+	output->current = NULL;
+}
+
+/* Hand the buffers the old renderer had to the new one.  Surfaces keep
+ * their SHM buffers while the renderer may change, see keep_buffer in
+ * drm_assign_planes(). */
+static void
+drm_reattach_surfaces(struct drm_compositor *c)
+{
+	struct weston_view *view;
+	struct weston_surface *surface;
+
+	wl_list_for_each(view, &c->base.view_list, link) {
+		surface = view->surface;
+		if (!surface->buffer_ref.buffer)
+			continue;
+
+		c->base.renderer->attach(surface, surface->buffer_ref.buffer);
+		pixman_region32_union_rect(&surface->damage, &surface->damage,
+					   0, 0, surface->width,
+					   surface->height);
+	}
+
+	weston_compositor_damage_all(&c->base);
+}
+
 static void
 switch_to_gl_renderer(struct drm_compositor *c)
 {
 	struct drm_output *output;
+	int created_gbm = 0;
 
 	if (!c->use_pixman)
 		return;
 
 	weston_log("Switching to GL renderer\n");
 
-	c->gbm = create_gbm_device(c->drm.fd);
 	if (!c->gbm) {
-		weston_log("Failed to create gbm device. "
-			   "Aborting renderer switch\n");
-		return;
+		c->gbm = create_gbm_device(c->drm.fd);
+		if (!c->gbm) {
+			weston_log("Failed to create gbm device. "
+				   "Aborting renderer switch\n");
+			return;
+		}
+		created_gbm = 1;
 	}
 
-	wl_list_for_each(output, &c->base.output_list, base.link)
-		pixman_renderer_output_destroy(&output->base);
+	wl_list_for_each(output, &c->base.output_list, base.link) {
+		drm_output_retire_fb(output);
+		drm_output_fini_pixman(output);
+	}
 
 	c->base.renderer->destroy(&c->base);
 
 	if (drm_compositor_create_gl_renderer(c) < 0) {
-		gbm_device_destroy(c->gbm);
+		if (created_gbm)
+			gbm_device_destroy(c->gbm);
 		weston_log("Failed to create GL renderer. Quitting.\n");
 		/* FIXME: we need a function to shutdown cleanly */
 		assert(0);
@@ -2699,6 +5826,124 @@ switch_to_gl_renderer(struct drm_compositor *c)
 		drm_output_init_egl(output, c);
 
 	c->use_pixman = 0;
+	drm_reattach_surfaces(c);
+}
+
+/* The gbm device stays, the cursor bos were allocated from it. */
+static void
+switch_to_pixman_renderer(struct drm_compositor *c)
+{
+	struct drm_output *output;
+
+	if (c->use_pixman)
+		return;
+
+	weston_log("Switching to pixman renderer\n");
+
+	wl_list_for_each(output, &c->base.output_list, base.link) {
+		drm_output_retire_fb(output);
+		gl_renderer->output_destroy(&output->base);
+		gbm_surface_destroy(output->surface);
+		output->surface = NULL;
+	}
+
+	c->base.renderer->destroy(&c->base);
+
+	if (init_pixman(c) < 0) {
+		weston_log("Failed to create pixman renderer. Quitting.\n");
+		/* FIXME: we need a function to shutdown cleanly */
+		assert(0);
+	}
+
+	c->use_pixman = 1;
+	wl_list_for_each(output, &c->base.output_list, base.link)
+		drm_output_init_pixman(output, c);
+
+	drm_reattach_surfaces(c);
+}
+
+/* Frames whose damage covers less of the output than this are cheaper
+ * to blit on the CPU than to wake the GPU for. */
+#define ADAPTIVE_SMALL_DAMAGE_PERCENT 5
+/* Large frames in a row before going to GL; one is likely a glitch */
+#define ADAPTIVE_GL_AFTER_FRAMES 3
+/* Time without a large frame before going back to pixman */
+#define ADAPTIVE_PIXMAN_AFTER_MSECS 3000
+
+static int
+drm_adaptive_frame_is_large(struct drm_output *output,
+			    pixman_region32_t *damage)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct weston_view *view;
+	pixman_box32_t *rects;
+	int64_t area = 0;
+	int n, i;
+
+	rects = pixman_region32_rectangles(damage, &n);
+	for (i = 0; i < n; i++)
+		area += (int64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	if (area * 100 > (int64_t) output->base.width * output->base.height *
+			 ADAPTIVE_SMALL_DAMAGE_PERCENT)
+		return 1;
+
+	/* pixman samples transformed views slowly, however small */
+	wl_list_for_each(view, &ec->view_list, link) {
+		if (view->output_mask & (1u << output->base.id) &&
+		    view->transform.enabled &&
+		    view->transform.matrix.type & ~WESTON_MATRIX_TRANSFORM_TRANSLATE)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Called for every frame rendered.  GL is picked as soon as a few
+ * large frames come in a row, pixman only after a while without any,
+ * so a workload on the boundary doesn't keep switching. */
+static void
+drm_adaptive_frame(struct drm_output *output, pixman_region32_t *damage)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	uint32_t now = output->base.frame_time;
+
+	if (drm_adaptive_frame_is_large(output, damage)) {
+		c->adaptive.last_large = now;
+		if (c->use_pixman &&
+		    ++c->adaptive.large_frames >= ADAPTIVE_GL_AFTER_FRAMES)
+			c->adaptive.switch_pending = 1;
+	} else {
+		c->adaptive.large_frames = 0;
+		if (!c->use_pixman &&
+		    now - c->adaptive.last_large >= ADAPTIVE_PIXMAN_AFTER_MSECS)
+			c->adaptive.switch_pending = 1;
+	}
+}
+
+/* Both renderers own the buffers of the flips in flight, so switch only
+ * once every output is done flipping. */
+static void
+drm_adaptive_switch(struct drm_compositor *c, uint32_t msecs)
+{
+	struct drm_output *output;
+
+	wl_list_for_each(output, &c->base.output_list, base.link) {
+		if (output->page_flip_pending || output->next ||
+		    output->queued || output->recorder)
+			return;
+	}
+
+	c->adaptive.switch_pending = 0;
+	c->adaptive.large_frames = 0;
+	c->adaptive.last_large = msecs;
+
+	if (c->use_pixman)
+		switch_to_gl_renderer(c);
+	else
+		switch_to_pixman_renderer(c);
 }
 
 static void
@@ -2741,6 +5986,29 @@ drm_compositor_create(struct wl_display *display,
 
 	ec->use_pixman = param->use_pixman;
 
+	weston_config_section_get_bool(section, "threaded-planes",
+				       &ec->threaded_planes, 0);
+	weston_config_section_get_bool(section, "pixman-shadow",
+				       &ec->pixman_shadow, 1);
+	weston_config_section_get_bool(section, "atomic-modeset",
+				       &ec->atomic_modeset, 1);
+	weston_config_section_get_bool(section, "keep-boot-fb",
+				       &ec->keep_boot_fb, 0);
+	weston_config_section_get_bool(section, "multi-gpu",
+				       &ec->multi_gpu, 0);
+	weston_config_section_get_bool(section, "adaptive-renderer",
+				       &ec->adaptive_renderer, 0);
+
+	/* Frames on other GPUs come from GL, and the renderer has to
+	 * start out as pixman: with GL, EGL clients may already hold
+	 * buffers pixman can't draw. */
+	if (ec->adaptive_renderer && ec->multi_gpu) {
+		weston_log("adaptive-renderer does not work with multi-gpu\n");
+		ec->adaptive_renderer = 0;
+	}
+	if (ec->adaptive_renderer)
+		ec->use_pixman = 1;
+
 	if (weston_compositor_init(&ec->base, display, argc, argv,
 				   config) < 0) {
 		weston_log("%s failed\n", __func__);
@@ -2803,6 +6071,10 @@ drm_compositor_create(struct wl_display *display,
 	wl_list_init(&ec->sprite_list);
 	create_sprites(ec);
 
+	wl_list_init(&ec->fb_cache);
+	wl_list_init(&ec->edid_cache);
+	wl_list_init(&ec->secondary_list);
+
 	if (udev_input_init(&ec->input,
 			    &ec->base, ec->udev, param->seat_id) < 0) {
 		weston_log("failed to create input devices\n");
@@ -2814,6 +6086,9 @@ drm_compositor_create(struct wl_display *display,
 		goto err_udev_input;
 	}
 
+	if (ec->multi_gpu && !ec->use_pixman)
+		drm_open_secondary_gpus(ec, param->seat_id, drm_device);
+
 	/* A this point we have some idea of whether or not we have a working
 	 * cursor plane. */
 	if (!ec->cursors_are_broken)
@@ -2843,6 +6118,8 @@ drm_compositor_create(struct wl_display *display,
 		goto err_udev_monitor;
 	}
 
+	drm_hotplug_init(ec);
+
 	udev_device_unref(drm_device);
 
 	weston_compositor_add_debug_binding(&ec->base, KEY_O,
@@ -2855,6 +6132,8 @@ drm_compositor_create(struct wl_display *display,
 					    recorder_binding, ec);
 	weston_compositor_add_debug_binding(&ec->base, KEY_W,
 					    renderer_switch_binding, ec);
+	weston_compositor_add_debug_binding(&ec->base, KEY_B,
+					    fb_cache_binding, ec);
 
 	return &ec->base;
 
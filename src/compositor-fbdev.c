@@ -34,6 +34,8 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <linux/fb.h>
 #include <linux/input.h>
 
@@ -52,6 +54,7 @@ struct fbdev_compositor {
 	struct udev *udev;
 	struct udev_input input;
 	int use_pixman;
+	int double_buffer;
 	struct wl_listener session_listener;
 };
 
@@ -87,12 +90,34 @@ struct fbdev_output {
 	pixman_image_t *shadow_surface;
 	void *shadow_buf;
 	uint8_t depth;
+
+	/* Double buffering by panning between the two halves of a frame
+	 * buffer with twice the visible height.  The pan and the wait for
+	 * the vblank run on a thread, which signals the eventfd when the
+	 * flip is done.  hw_surface_flip wraps the second buffer. */
+	struct {
+		int enabled;
+		int fd; /* for the frame buffer, for the thread */
+		struct fb_var_screeninfo varinfo;
+		pixman_image_t *hw_surface_flip;
+		int back; /* buffer the next frame goes to */
+		pixman_region32_t prev_damage;
+
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		int requested, busy, quit;
+		uint32_t yoffset;
+		int done_fd;
+		struct wl_event_source *done_source;
+	} flip;
 };
 
 struct fbdev_parameters {
 	int tty;
 	char *device;
 	int use_gl;
+	int double_buffer;
 };
 
 struct gl_renderer_interface *gl_renderer;
@@ -123,17 +148,13 @@ fbdev_output_start_repaint_loop(struct weston_output *output)
 }
 
 static void
-fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damage)
+fbdev_output_copy_shadow(struct fbdev_output *output, pixman_image_t *hw,
+			 pixman_region32_t *damage)
 {
-	struct fbdev_output *output = to_fbdev_output(base);
-	struct weston_compositor *ec = output->base.compositor;
+	struct weston_output *base = &output->base;
 	pixman_box32_t *rects;
 	int nrects, i, src_x, src_y, x1, y1, x2, y2, width, height;
 
-	/* Repaint the damaged region onto the back buffer. */
-	pixman_renderer_output_set_buffer(base, output->shadow_surface);
-	ec->renderer->repaint_output(base, damage);
-
 	/* Transform and composite onto the frame buffer. */
 	width = pixman_image_get_width(output->shadow_surface);
 	height = pixman_image_get_height(output->shadow_surface);
@@ -173,22 +194,259 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 		pixman_image_composite32(PIXMAN_OP_SRC,
 			output->shadow_surface, /* src */
 			NULL /* mask */,
-			output->hw_surface, /* dest */
+			hw, /* dest */
 			src_x, src_y, /* src_x, src_y */
 			0, 0, /* mask_x, mask_y */
 			x1, y1, /* dest_x, dest_y */
 			x2 - x1, /* width */
 			y2 - y1 /* height */);
 	}
+}
+
+static void *
+fbdev_flip_thread(void *data)
+{
+	struct fbdev_output *output = data;
+	struct fb_var_screeninfo varinfo;
+	uint32_t crtc = 0;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&output->flip.mutex);
+	while (!output->flip.quit) {
+		if (!output->flip.requested) {
+			pthread_cond_wait(&output->flip.cond,
+					  &output->flip.mutex);
+			continue;
+		}
+
+		output->flip.requested = 0;
+		output->flip.busy = 1;
+		varinfo = output->flip.varinfo;
+		varinfo.xoffset = 0;
+		varinfo.yoffset = output->flip.yoffset;
+		varinfo.activate = FB_ACTIVATE_VBL;
+		pthread_mutex_unlock(&output->flip.mutex);
+
+		/* Drivers differ in whether the pan itself waits for the
+		 * vblank, so wait for it explicitly as well.  Without
+		 * FBIO_WAITFORVSYNC we only lose the vblank alignment. */
+		ioctl(output->flip.fd, FBIOPAN_DISPLAY, &varinfo);
+		ioctl(output->flip.fd, FBIO_WAITFORVSYNC, &crtc);
+
+		if (write(output->flip.done_fd, &one, sizeof one) < 0)
+			weston_log("fbdev: failed to signal flip: %m\n");
+
+		pthread_mutex_lock(&output->flip.mutex);
+		output->flip.busy = 0;
+		pthread_cond_broadcast(&output->flip.cond);
+	}
+	pthread_mutex_unlock(&output->flip.mutex);
+
+	return NULL;
+}
+
+static int
+fbdev_flip_done(int fd, uint32_t mask, void *data)
+{
+	struct fbdev_output *output = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0)
+		return 1;
+
+	fbdev_output_start_repaint_loop(&output->base);
+
+	return 1;
+}
+
+/* Wait for the thread to be done with the frame buffer, and pan it to
+ * the first buffer, where anything else expects the screen to be. */
+static void
+fbdev_output_reset_flip(struct fbdev_output *output)
+{
+	struct fb_var_screeninfo varinfo;
+
+	pthread_mutex_lock(&output->flip.mutex);
+	while (output->flip.requested || output->flip.busy)
+		pthread_cond_wait(&output->flip.cond, &output->flip.mutex);
+	pthread_mutex_unlock(&output->flip.mutex);
+
+	varinfo = output->flip.varinfo;
+	varinfo.xoffset = 0;
+	varinfo.yoffset = 0;
+	varinfo.activate = FB_ACTIVATE_NOW;
+	ioctl(output->flip.fd, FBIOPAN_DISPLAY, &varinfo);
+
+	output->flip.back = 1;
+	pixman_region32_clear(&output->flip.prev_damage);
+}
+
+/* Make the frame buffer twice as high as the screen, and check that
+ * the driver lets us pan the screen between the two halves. */
+static int
+fbdev_output_setup_flip(struct fbdev_output *output)
+{
+	struct fb_var_screeninfo varinfo;
+	struct fb_fix_screeninfo fixinfo;
+	unsigned int yres = output->fb_info.y_resolution;
+	int fd = output->flip.fd;
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &varinfo) < 0)
+		return -1;
+
+	if (varinfo.yres_virtual < 2 * yres) {
+		varinfo.yres_virtual = 2 * yres;
+		varinfo.yoffset = 0;
+		varinfo.activate = FB_ACTIVATE_NOW;
+		if (ioctl(fd, FBIOPUT_VSCREENINFO, &varinfo) < 0 ||
+		    ioctl(fd, FBIOGET_VSCREENINFO, &varinfo) < 0 ||
+		    varinfo.yres_virtual < 2 * yres)
+			return -1;
+	}
+
+	if (ioctl(fd, FBIOGET_FSCREENINFO, &fixinfo) < 0 ||
+	    fixinfo.line_length != output->fb_info.line_length ||
+	    fixinfo.smem_len < 2 * yres * fixinfo.line_length)
+		return -1;
+
+	varinfo.xoffset = 0;
+	varinfo.yoffset = 0;
+	varinfo.activate = FB_ACTIVATE_NOW;
+	if (ioctl(fd, FBIOPAN_DISPLAY, &varinfo) < 0)
+		return -1;
+
+	output->flip.varinfo = varinfo;
+	output->flip.back = 1;
+	pixman_region32_clear(&output->flip.prev_damage);
+
+	return 0;
+}
+
+static int
+fbdev_output_init_flip(struct fbdev_output *output, int fb_fd)
+{
+	struct wl_event_loop *loop;
+
+	pixman_region32_init(&output->flip.prev_damage);
+
+	output->flip.fd = dup(fb_fd);
+	if (output->flip.fd < 0)
+		goto err_region;
+
+	if (fbdev_output_setup_flip(output) < 0) {
+		weston_log("Frame buffer can't pan, not double buffering.\n");
+		goto err_fd;
+	}
+
+	output->flip.done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (output->flip.done_fd < 0)
+		goto err_fd;
+
+	loop = wl_display_get_event_loop(output->compositor->base.wl_display);
+	output->flip.done_source =
+		wl_event_loop_add_fd(loop, output->flip.done_fd,
+				     WL_EVENT_READABLE, fbdev_flip_done,
+				     output);
+	if (!output->flip.done_source)
+		goto err_done_fd;
+
+	pthread_mutex_init(&output->flip.mutex, NULL);
+	pthread_cond_init(&output->flip.cond, NULL);
+	output->flip.quit = 0;
+	if (pthread_create(&output->flip.thread, NULL,
+			   fbdev_flip_thread, output) != 0)
+		goto err_source;
+
+	output->flip.enabled = 1;
+	weston_log("Double buffering by panning the frame buffer.\n");
+
+	return 0;
+
+err_source:
+	pthread_mutex_destroy(&output->flip.mutex);
+	pthread_cond_destroy(&output->flip.cond);
+	wl_event_source_remove(output->flip.done_source);
+	output->flip.done_source = NULL;
+err_done_fd:
+	close(output->flip.done_fd);
+err_fd:
+	close(output->flip.fd);
+err_region:
+	pixman_region32_fini(&output->flip.prev_damage);
+	return -1;
+}
+
+static void
+fbdev_output_fini_flip(struct fbdev_output *output)
+{
+	if (!output->flip.enabled)
+		return;
+
+	fbdev_output_reset_flip(output);
+
+	pthread_mutex_lock(&output->flip.mutex);
+	output->flip.quit = 1;
+	pthread_cond_signal(&output->flip.cond);
+	pthread_mutex_unlock(&output->flip.mutex);
+	pthread_join(output->flip.thread, NULL);
+
+	pthread_mutex_destroy(&output->flip.mutex);
+	pthread_cond_destroy(&output->flip.cond);
+	wl_event_source_remove(output->flip.done_source);
+	close(output->flip.done_fd);
+	close(output->flip.fd);
+	pixman_region32_fini(&output->flip.prev_damage);
+	output->flip.enabled = 0;
+}
+
+static void
+fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damage)
+{
+	struct fbdev_output *output = to_fbdev_output(base);
+	struct weston_compositor *ec = output->base.compositor;
+	pixman_region32_t copy;
+
+	/* Repaint the damaged region onto the back buffer. */
+	pixman_renderer_output_set_buffer(base, output->shadow_surface);
+	ec->renderer->repaint_output(base, damage);
+
+	if (output->flip.enabled && output->flip.hw_surface_flip) {
+		/* The buffer we go to last showed the frame before the
+		 * previous one, so it misses that frame's damage too. */
+		pixman_region32_init(&copy);
+		pixman_region32_union(&copy, damage, &output->flip.prev_damage);
+		fbdev_output_copy_shadow(output, output->flip.back ?
+					 output->flip.hw_surface_flip :
+					 output->hw_surface, &copy);
+		pixman_region32_fini(&copy);
+		pixman_region32_copy(&output->flip.prev_damage, damage);
+
+		pixman_region32_subtract(&ec->primary_plane.damage,
+					 &ec->primary_plane.damage, damage);
+
+		/* The flip thread finishes the frame at the vblank */
+		pthread_mutex_lock(&output->flip.mutex);
+		output->flip.yoffset =
+			output->flip.back * output->fb_info.y_resolution;
+		output->flip.requested = 1;
+		pthread_cond_signal(&output->flip.cond);
+		pthread_mutex_unlock(&output->flip.mutex);
+
+		output->flip.back ^= 1;
+		return;
+	}
+
+	fbdev_output_copy_shadow(output, output->hw_surface, damage);
 
 	/* Update the damage region. */
 	pixman_region32_subtract(&ec->primary_plane.damage,
 	                         &ec->primary_plane.damage, damage);
 
-	/* Schedule the end of the frame. We do not sync this to the frame
-	 * buffer clock because users who want that should be using the DRM
-	 * compositor. FBIO_WAITFORVSYNC blocks and FB_ACTIVATE_VBL requires
-	 * panning, which is broken in most kernel drivers.
+	/* Schedule the end of the frame. Unless double buffering was asked
+	 * for, we do not sync this to the frame buffer clock because users
+	 * who want that should be using the DRM compositor.
+	 * FBIO_WAITFORVSYNC blocks and FB_ACTIVATE_VBL requires panning,
+	 * which is broken in most kernel drivers.
 	 *
 	 * Finish the frame synchronised to the specified refresh rate. The
 	 * refresh rate is given in mHz and the interval in ms. */
@@ -441,6 +699,7 @@ fbdev_frame_buffer_open(struct fbdev_output *output, const char *fb_dev,
 static int
 fbdev_frame_buffer_map(struct fbdev_output *output, int fd)
 {
+	uint8_t *second;
 	int retval = -1;
 
 	weston_log("Mapping fbdev frame buffer.\n");
@@ -467,6 +726,23 @@ fbdev_frame_buffer_map(struct fbdev_output *output, int fd)
 		goto out_unmap;
 	}
 
+	/* The second buffer is below the first one; without it we just
+	 * draw to the first one, which the screen shows. */
+	if (output->flip.enabled) {
+		second = (uint8_t *) output->fb +
+			output->fb_info.y_resolution *
+			output->fb_info.line_length;
+		output->flip.hw_surface_flip =
+			pixman_image_create_bits(output->fb_info.pixel_format,
+			                         output->fb_info.x_resolution,
+			                         output->fb_info.y_resolution,
+			                         (uint32_t *) second,
+			                         output->fb_info.line_length);
+		if (output->flip.hw_surface_flip == NULL)
+			weston_log("Failed to create surface for second "
+			           "frame buffer.\n");
+	}
+
 	/* Success! */
 	retval = 0;
 
@@ -524,9 +800,12 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 		goto out_free;
 	}
 	if (compositor->use_pixman) {
+		if (compositor->double_buffer)
+			fbdev_output_init_flip(output, fb_fd);
+
 		if (fbdev_frame_buffer_map(output, fb_fd) < 0) {
 			weston_log("Mapping frame buffer failed.\n");
-			goto out_free;
+			goto out_flip;
 		}
 	} else {
 		close(fb_fd);
@@ -623,7 +902,8 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 		pixman_image_set_transform(output->shadow_surface, &transform);
 
 	if (compositor->use_pixman) {
-		if (pixman_renderer_output_create(&output->base) < 0)
+		if (pixman_renderer_output_create(&output->base,
+						  PIXMAN_RENDERER_OUTPUT_USE_SHADOW) < 0)
 			goto out_shadow_surface;
 	} else {
 		setenv("HYBRIS_EGLPLATFORM", "wayland", 1);
@@ -658,7 +938,9 @@ out_hw_surface:
 	pixman_image_unref(output->hw_surface);
 	output->hw_surface = NULL;
 	weston_output_destroy(&output->base);
-	fbdev_frame_buffer_destroy(output);
+	fbdev_output_disable(&output->base);
+out_flip:
+	fbdev_output_fini_flip(output);
 out_free:
 	free(output);
 
@@ -675,6 +957,7 @@ fbdev_output_destroy(struct weston_output *base)
 
 	/* Close the frame buffer. */
 	fbdev_output_disable(base);
+	fbdev_output_fini_flip(output);
 
 	if (compositor->use_pixman) {
 		if (base->renderer_state != NULL)
@@ -757,8 +1040,16 @@ fbdev_output_reenable(struct fbdev_compositor *compositor,
 		return 0;
 	}
 
-	/* Map the device if it has the same details as before. */
+	/* Map the device if it has the same details as before. Whoever had
+	 * the frame buffer may have changed its virtual size, too. */
 	if (compositor->use_pixman) {
+		if (output->flip.enabled &&
+		    fbdev_output_setup_flip(output) < 0) {
+			weston_log("Frame buffer can't pan any more, "
+			           "not double buffering.\n");
+			fbdev_output_fini_flip(output);
+		}
+
 		if (fbdev_frame_buffer_map(output, fb_fd) < 0) {
 			weston_log("Mapping frame buffer failed.\n");
 			goto err;
@@ -784,12 +1075,21 @@ fbdev_output_disable(struct weston_output *base)
 
 	if ( ! compositor->use_pixman) return;
 
+	if (output->flip.enabled)
+		fbdev_output_reset_flip(output);
+
+	if (output->flip.hw_surface_flip != NULL) {
+		pixman_image_unref(output->flip.hw_surface_flip);
+		output->flip.hw_surface_flip = NULL;
+	}
+
 	if (output->hw_surface != NULL) {
 		pixman_image_unref(output->hw_surface);
 		output->hw_surface = NULL;
 	}
 
-	fbdev_frame_buffer_destroy(output);
+	if (output->fb != NULL)
+		fbdev_frame_buffer_destroy(output);
 }
 
 static void
@@ -906,6 +1206,7 @@ fbdev_compositor_create(struct wl_display *display, int *argc, char *argv[],
 
 	compositor->prev_state = WESTON_COMPOSITOR_ACTIVE;
 	compositor->use_pixman = !param->use_gl;
+	compositor->double_buffer = param->double_buffer;
 
 	for (key = KEY_F1; key < KEY_F9; key++)
 		weston_compositor_add_key_binding(&compositor->base, key,
@@ -966,12 +1267,14 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 		.tty = 0, /* default to current tty */
 		.device = "/dev/fb0", /* default frame buffer */
 		.use_gl = 0,
+		.double_buffer = 0,
 	};
 
 	const struct weston_option fbdev_options[] = {
 		{ WESTON_OPTION_INTEGER, "tty", 0, &param.tty },
 		{ WESTON_OPTION_STRING, "device", 0, &param.device },
 		{ WESTON_OPTION_BOOLEAN, "use-gl", 0, &param.use_gl },
+		{ WESTON_OPTION_BOOLEAN, "double-buffer", 0, &param.double_buffer },
 	};
 
 	parse_options(fbdev_options, ARRAY_LENGTH(fbdev_options), argc, argv);
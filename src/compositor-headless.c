@@ -23,23 +23,239 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <malloc.h>
 
 #include "compositor.h"
+#include "pixman-renderer.h"
+
+enum benchmark_damage {
+	BENCHMARK_DAMAGE_FULL,
+	BENCHMARK_DAMAGE_PARTIAL,
+	BENCHMARK_DAMAGE_MOVE
+};
+
+struct headless_parameters {
+	int width;
+	int height;
+	int output_count;
+	int refresh;
+	int use_pixman;
+	int benchmark;
+	int benchmark_surfaces;
+	int benchmark_frames;
+	int benchmark_rate;
+	enum benchmark_damage benchmark_damage;
+};
+
+/* Synthetic load for --benchmark: solid colour surfaces that get
+ * damaged or moved before every frame, no clients involved. */
+struct headless_benchmark {
+	int enabled;
+	int surfaces;
+	int frames;
+	int rate;
+	enum benchmark_damage damage;
+
+	struct weston_layer layer;
+	struct weston_view **views;
+	int nviews;
+
+	int frame;
+	int renders;
+	struct timespec begin;
+	uint64_t render_total;	/* us */
+	uint32_t render_min, render_max;
+	int heap_begin;
+};
 
 struct headless_compositor {
 	struct weston_compositor base;
 	struct weston_seat fake_seat;
+	int use_pixman;
+	struct headless_benchmark benchmark;
 };
 
 struct headless_output {
 	struct weston_output base;
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	int frame_delay;	/* ms, 0 repaints unthrottled */
+	pixman_image_t *image;
 };
 
+static void
+benchmark_report(struct headless_compositor *c)
+{
+	struct headless_benchmark *b = &c->benchmark;
+	struct weston_output *output;
+	struct timespec end;
+	struct mallinfo heap;
+	double elapsed;
+	int frames = b->frame;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - b->begin.tv_sec) +
+		(end.tv_nsec - b->begin.tv_nsec) / 1e9;
+	heap = mallinfo();
+
+	weston_log("benchmark: %d surfaces, %d frames in %.3f s, %.1f fps\n",
+		   b->nviews, frames, elapsed,
+		   elapsed > 0 ? frames / elapsed : 0.0);
+	if (b->renders > 0)
+		weston_log("benchmark: render %u/%u/%u us min/avg/max\n",
+			   b->render_min,
+			   (uint32_t) (b->render_total / b->renders),
+			   b->render_max);
+	wl_list_for_each(output, &c->base.output_list, link)
+		weston_log("benchmark: output %s repaint %u us average\n",
+			   output->name, output->repaint_duration);
+	weston_log("benchmark: heap in use %d -> %d bytes\n",
+		   b->heap_begin, heap.uordblks);
+	weston_log_object_pools();
+
+	weston_timeline_stop(&c->base, "benchmark.wtl");
+}
+
+/* Damage the synthetic surfaces for the coming frame. */
+static void
+benchmark_frame(struct headless_compositor *c)
+{
+	struct headless_benchmark *b = &c->benchmark;
+	struct weston_output *output;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	int32_t size, x, y;
+	int i;
+
+	if (b->frames > 0 && b->frame >= b->frames) {
+		benchmark_report(c);
+		b->enabled = 0;
+		wl_display_terminate(c->base.wl_display);
+		return;
+	}
+
+	output = container_of(c->base.output_list.next,
+			      struct weston_output, link);
+
+	for (i = 0; i < b->nviews; i++) {
+		view = b->views[i];
+		surface = view->surface;
+
+		switch (b->damage) {
+		case BENCHMARK_DAMAGE_FULL:
+			weston_surface_damage(surface);
+			break;
+		case BENCHMARK_DAMAGE_PARTIAL:
+			size = surface->width / 8 + 1;
+			x = (b->frame * 7 + i * 13) % (surface->width - size + 1);
+			y = (b->frame * 5 + i * 11) % (surface->height - size + 1);
+			pixman_region32_union_rect(&surface->damage,
+						   &surface->damage,
+						   x, y, size, size);
+			weston_surface_schedule_repaint(surface);
+			break;
+		case BENCHMARK_DAMAGE_MOVE:
+			x = ((int32_t) view->geometry.x + 8) %
+				(output->width - surface->width + 1);
+			y = ((int32_t) view->geometry.y + 4) %
+				(output->height - surface->height + 1);
+			weston_view_set_position(view, x, y);
+			weston_view_schedule_repaint(view);
+			break;
+		}
+	}
+
+	b->frame++;
+}
+
+static int
+benchmark_init(struct headless_compositor *c,
+	       struct headless_parameters *param)
+{
+	struct headless_benchmark *b = &c->benchmark;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	int32_t w, h;
+	float alpha;
+	int i;
+
+	b->enabled = 1;
+	b->surfaces = param->benchmark_surfaces;
+	b->frames = param->benchmark_frames;
+	b->rate = param->benchmark_rate;
+	b->damage = param->benchmark_damage;
+	b->render_min = UINT32_MAX;
+
+	b->views = calloc(b->surfaces, sizeof *b->views);
+	if (b->surfaces > 0 && !b->views)
+		return -1;
+
+	weston_layer_init(&b->layer, &c->base.cursor_layer.link);
+
+	w = param->width / 4;
+	h = param->height / 4;
+	for (i = 0; i < b->surfaces; i++) {
+		surface = weston_surface_create(&c->base);
+		if (!surface)
+			return -1;
+		view = weston_view_create(surface);
+		if (!view) {
+			weston_surface_destroy(surface);
+			return -1;
+		}
+
+		/* Every other surface is translucent so that both the
+		 * opaque and the blended paths get exercised. */
+		alpha = (i & 1) ? 0.5 : 1.0;
+		weston_surface_set_color(surface, (i % 3) / 2.0,
+					 (i % 5) / 4.0, (i % 7) / 6.0, alpha);
+		if (alpha == 1.0) {
+			pixman_region32_fini(&surface->opaque);
+			pixman_region32_init_rect(&surface->opaque,
+						  0, 0, w, h);
+		}
+
+		weston_surface_set_size(surface, w, h);
+		weston_view_set_position(view,
+					 (i * 37) % (param->width - w + 1),
+					 (i * 23) % (param->height - h + 1));
+		wl_list_insert(&b->layer.view_list, &view->layer_link);
+		weston_view_schedule_repaint(view);
+
+		b->views[b->nviews++] = view;
+	}
+
+	weston_log("benchmark: %d surfaces, %s damage, %s repaint\n",
+		   b->nviews,
+		   b->damage == BENCHMARK_DAMAGE_FULL ? "full" :
+		   b->damage == BENCHMARK_DAMAGE_PARTIAL ? "partial" : "move",
+		   b->rate > 0 ? "fixed rate" : "unthrottled");
+
+	weston_timeline_start(&c->base);
+	b->heap_begin = mallinfo().uordblks;
+	clock_gettime(CLOCK_MONOTONIC, &b->begin);
+
+	return 0;
+}
+
+static void
+benchmark_fini(struct headless_compositor *c)
+{
+	struct headless_benchmark *b = &c->benchmark;
+	int i;
+
+	for (i = 0; i < b->nviews; i++)
+		weston_surface_destroy(b->views[i]->surface);
+	free(b->views);
+	b->views = NULL;
+	b->nviews = 0;
+}
+
 
 static void
 headless_output_start_repaint_loop(struct weston_output *output)
@@ -55,7 +271,15 @@ headless_output_start_repaint_loop(struct weston_output *output)
 static int
 finish_frame_handler(void *data)
 {
-	headless_output_start_repaint_loop(data);
+	struct weston_output *output = data;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->compositor;
+
+	/* The synthetic load advances with the first output only. */
+	if (c->benchmark.enabled && output->link.prev == &c->base.output_list)
+		benchmark_frame(c);
+
+	headless_output_start_repaint_loop(output);
 
 	return 1;
 }
@@ -66,13 +290,41 @@ headless_output_repaint(struct weston_output *output_base,
 {
 	struct headless_output *output = (struct headless_output *) output_base;
 	struct weston_compositor *ec = output->base.compositor;
+	struct headless_compositor *c = (struct headless_compositor *) ec;
+	struct headless_benchmark *b = &c->benchmark;
+	struct timespec begin, end;
+	int delay;
+	uint32_t duration;
 
+	clock_gettime(CLOCK_MONOTONIC, &begin);
 	ec->renderer->repaint_output(&output->base, damage);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	if (!b->enabled) {
+		wl_event_source_timer_update(output->finish_frame_timer,
+					     output->frame_delay > 0 ?
+					     output->frame_delay : 1);
+		return 0;
+	}
+
+	duration = (end.tv_sec - begin.tv_sec) * 1000000 +
+		(end.tv_nsec - begin.tv_nsec) / 1000;
+	b->renders++;
+	b->render_total += duration;
+	if (duration < b->render_min)
+		b->render_min = duration;
+	if (duration > b->render_max)
+		b->render_max = duration;
+
+	/* Unthrottled still goes through the shortest timer rather than
+	 * an idle source, so that clients and signals get dispatched
+	 * between frames. */
+	delay = b->rate > 0 ? 1000 / b->rate : 0;
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     delay > 0 ? delay : 1);
 
 	return 0;
 }
@@ -81,38 +333,73 @@ static void
 headless_output_destroy(struct weston_output *output_base)
 {
 	struct headless_output *output = (struct headless_output *) output_base;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
+
+	if (c->use_pixman) {
+		pixman_renderer_output_destroy(&output->base);
+		pixman_image_unref(output->image);
+	}
 
 	wl_event_source_remove(output->finish_frame_timer);
+	weston_output_destroy(&output->base);
 	free(output);
 
 	return;
 }
 
-static int
+static struct headless_output *
 headless_compositor_create_output(struct headless_compositor *c,
-				 int width, int height)
+				  int x, int width, int height, int refresh,
+				  const char *name, uint32_t transform,
+				  int32_t scale)
 {
 	struct headless_output *output;
 	struct wl_event_loop *loop;
 
 	output = zalloc(sizeof *output);
 	if (output == NULL)
-		return -1;
+		return NULL;
 
 	output->mode.flags =
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 	output->mode.width = width;
 	output->mode.height = height;
-	output->mode.refresh = 60;
+	output->mode.refresh = refresh * 1000;
 	wl_list_init(&output->base.mode_list);
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
+	output->frame_delay = refresh > 0 ? 1000 / refresh : 0;
+
 	output->base.current_mode = &output->mode;
-	weston_output_init(&output->base, &c->base, 0, 0, width, height,
-			   WL_OUTPUT_TRANSFORM_NORMAL, 1);
+	weston_output_init(&output->base, &c->base, x, 0, width, height,
+			   transform, scale);
 
 	output->base.make = "weston";
 	output->base.model = "headless";
+	output->base.name = strdup(name);
+
+	if (c->use_pixman) {
+		output->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+							 width, height,
+							 NULL, width * 4);
+		if (output->image == NULL) {
+			weston_output_destroy(&output->base);
+			free(output);
+			return NULL;
+		}
+
+		if (pixman_renderer_output_create(&output->base,
+						  PIXMAN_RENDERER_OUTPUT_USE_SHADOW) < 0) {
+			pixman_image_unref(output->image);
+			weston_output_destroy(&output->base);
+			free(output);
+			return NULL;
+		}
+
+		pixman_renderer_output_set_buffer(&output->base,
+						  output->image);
+	}
 
 	loop = wl_display_get_event_loop(c->base.wl_display);
 	output->finish_frame_timer =
@@ -128,6 +415,117 @@ headless_compositor_create_output(struct headless_compositor *c,
 
 	wl_list_insert(c->base.output_list.prev, &output->base.link);
 
+	weston_log("headless output %s: %dx%d at %d,0, %s\n",
+		   output->base.name, width, height, x,
+		   refresh > 0 ? "timed repaint" : "unthrottled repaint");
+
+	return output;
+}
+
+static uint32_t
+parse_transform(const char *transform, const char *output_name)
+{
+	static const struct { const char *name; uint32_t token; } names[] = {
+		{ "normal",	WL_OUTPUT_TRANSFORM_NORMAL },
+		{ "90",		WL_OUTPUT_TRANSFORM_90 },
+		{ "180",	WL_OUTPUT_TRANSFORM_180 },
+		{ "270",	WL_OUTPUT_TRANSFORM_270 },
+		{ "flipped",	WL_OUTPUT_TRANSFORM_FLIPPED },
+		{ "flipped-90",	WL_OUTPUT_TRANSFORM_FLIPPED_90 },
+		{ "flipped-180", WL_OUTPUT_TRANSFORM_FLIPPED_180 },
+		{ "flipped-270", WL_OUTPUT_TRANSFORM_FLIPPED_270 },
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(names); i++)
+		if (strcmp(names[i].name, transform) == 0)
+			return names[i].token;
+
+	weston_log("Invalid transform \"%s\" for output %s\n",
+		   transform, output_name);
+
+	return WL_OUTPUT_TRANSFORM_NORMAL;
+}
+
+/* Outputs come from the [output] sections whose name starts with
+ * "headless", laid out left to right, then unconfigured ones of the
+ * command line size are added until --output-count is reached.  Each
+ * repaints on its own timer, so different scenarios can run side by
+ * side in one compositor. */
+static int
+headless_compositor_create_outputs(struct headless_compositor *c,
+				   struct headless_parameters *param)
+{
+	struct headless_output *output;
+	struct weston_config_section *section;
+	const char *section_name;
+	char *name, *mode, *t;
+	char default_name[32];
+	int width, height, refresh, x = 0, count = 0;
+	int32_t scale;
+	uint32_t transform;
+
+	section = NULL;
+	while (weston_config_next_section(c->base.config,
+					  &section, &section_name)) {
+		if (param->output_count > 0 && count >= param->output_count)
+			break;
+		if (strcmp(section_name, "output") != 0)
+			continue;
+		weston_config_section_get_string(section, "name", &name, NULL);
+		if (name == NULL || strncmp(name, "headless", 8) != 0) {
+			free(name);
+			continue;
+		}
+
+		width = param->width;
+		height = param->height;
+		refresh = param->refresh;
+		weston_config_section_get_string(section, "mode", &mode, NULL);
+		if (mode && sscanf(mode, "%dx%d@%d",
+				   &width, &height, &refresh) < 2) {
+			weston_log("Invalid mode \"%s\" for output %s\n",
+				   mode, name);
+			width = param->width;
+			height = param->height;
+		}
+		free(mode);
+		if (refresh < 0)
+			refresh = 0;
+
+		weston_config_section_get_int(section, "scale", &scale, 1);
+		weston_config_section_get_string(section,
+						 "transform", &t, "normal");
+		transform = parse_transform(t, name);
+		free(t);
+
+		output = headless_compositor_create_output(c, x, width, height,
+							   refresh, name,
+							   transform, scale);
+		free(name);
+		if (output == NULL)
+			return -1;
+
+		x = pixman_region32_extents(&output->base.region)->x2;
+		count++;
+	}
+
+	while (count < param->output_count || count == 0) {
+		snprintf(default_name, sizeof default_name,
+			 "headless-%d", count + 1);
+		output = headless_compositor_create_output(c, x, param->width,
+							   param->height,
+							   param->refresh,
+							   default_name,
+							   WL_OUTPUT_TRANSFORM_NORMAL,
+							   1);
+		if (output == NULL)
+			return -1;
+
+		x = pixman_region32_extents(&output->base.region)->x2;
+		count++;
+	}
+
 	return 0;
 }
 
@@ -160,6 +558,7 @@ headless_destroy(struct weston_compositor *ec)
 {
 	struct headless_compositor *c = (struct headless_compositor *) ec;
 
+	benchmark_fini(c);
 	headless_input_destroy(c);
 	weston_compositor_shutdown(ec);
 
@@ -168,7 +567,8 @@ headless_destroy(struct weston_compositor *ec)
 
 static struct weston_compositor *
 headless_compositor_create(struct wl_display *display,
-			   int width, int height, const char *display_name,
+			   struct headless_parameters *param,
+			   const char *display_name,
 			   int *argc, char *argv[],
 			   struct weston_config *config)
 {
@@ -187,11 +587,23 @@ headless_compositor_create(struct wl_display *display,
 	c->base.destroy = headless_destroy;
 	c->base.restore = headless_restore;
 
-	if (headless_compositor_create_output(c, width, height) < 0)
+	c->use_pixman = param->use_pixman;
+	if (c->use_pixman) {
+		if (pixman_renderer_init(&c->base) < 0)
+			goto err_input;
+	} else {
+		if (noop_renderer_init(&c->base) < 0)
+			goto err_input;
+	}
+
+	if (headless_compositor_create_outputs(c, param) < 0)
 		goto err_input;
 
-	if (noop_renderer_init(&c->base) < 0)
+	if (param->benchmark && benchmark_init(c, param) < 0) {
+		weston_log("failed to create benchmark surfaces\n");
+		benchmark_fini(c);
 		goto err_input;
+	}
 
 	return &c->base;
 
@@ -208,17 +620,59 @@ WL_EXPORT struct weston_compositor *
 backend_init(struct wl_display *display, int *argc, char *argv[],
 	     struct weston_config *config)
 {
-	int width = 1024, height = 640;
+	struct headless_parameters param = {
+		.width = 1024,
+		.height = 640,
+		.refresh = 60,
+		.benchmark_surfaces = 16,
+		.benchmark_frames = 1000,
+		.benchmark_rate = 0,
+	};
 	char *display_name = NULL;
+	char *damage = NULL;
 
 	const struct weston_option headless_options[] = {
-		{ WESTON_OPTION_INTEGER, "width", 0, &width },
-		{ WESTON_OPTION_INTEGER, "height", 0, &height },
+		{ WESTON_OPTION_INTEGER, "width", 0, &param.width },
+		{ WESTON_OPTION_INTEGER, "height", 0, &param.height },
+		{ WESTON_OPTION_INTEGER, "output-count", 0,
+		  &param.output_count },
+		{ WESTON_OPTION_INTEGER, "refresh", 0, &param.refresh },
+		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &param.use_pixman },
+		{ WESTON_OPTION_BOOLEAN, "benchmark", 0, &param.benchmark },
+		{ WESTON_OPTION_INTEGER, "benchmark-surfaces", 0,
+		  &param.benchmark_surfaces },
+		{ WESTON_OPTION_INTEGER, "benchmark-frames", 0,
+		  &param.benchmark_frames },
+		{ WESTON_OPTION_INTEGER, "benchmark-rate", 0,
+		  &param.benchmark_rate },
+		{ WESTON_OPTION_STRING, "benchmark-damage", 0, &damage },
 	};
 
 	parse_options(headless_options,
 		      ARRAY_LENGTH(headless_options), argc, argv);
 
-	return headless_compositor_create(display, width, height, display_name,
+	if (damage == NULL || strcmp(damage, "full") == 0)
+		param.benchmark_damage = BENCHMARK_DAMAGE_FULL;
+	else if (strcmp(damage, "partial") == 0)
+		param.benchmark_damage = BENCHMARK_DAMAGE_PARTIAL;
+	else if (strcmp(damage, "move") == 0)
+		param.benchmark_damage = BENCHMARK_DAMAGE_MOVE;
+	else {
+		weston_log("invalid benchmark damage pattern \"%s\"\n",
+			   damage);
+		free(damage);
+		return NULL;
+	}
+	free(damage);
+
+	if (param.benchmark_surfaces < 0)
+		param.benchmark_surfaces = 0;
+	if (param.refresh < 0)
+		param.refresh = 0;
+	/* Output ids are bits of a 32 bit mask. */
+	if (param.output_count > 32)
+		param.output_count = 32;
+
+	return headless_compositor_create(display, &param, display_name,
 					  argc, argv, config);
 }
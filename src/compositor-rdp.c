@@ -25,7 +25,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <linux/input.h>
+#include <linux/sockios.h>
 
 #if HAVE_FREERDP_VERSION_H
 #include <freerdp/version.h>
@@ -51,6 +56,32 @@
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 #define RDP_MODE_FREQ 60 * 1000
 
+#define RDP_ENCODER_DEFAULT_THREADS 2
+#define RDP_ENCODER_MAX_THREADS 8
+
+/* Frames a peer may have queued, being encoded or waiting to be sent.
+ * Beyond that, new damage is coalesced into the peer's next frame. */
+#define RDP_PEER_MAX_PENDING 2
+
+/* Tiles are hashed on the RemoteFX tile grid */
+#define RDP_TILE_SIZE 64
+
+/* Link adaptation.  Peers that acknowledge frames may have that many
+ * unacknowledged before further damage is held back; for the others the
+ * bytes still queued in the socket are watched instead. */
+#define RDP_MAX_UNACKED_FRAMES 2
+#define RDP_ACK_TIMEOUT 2000
+#define RDP_MAX_SOCKET_BACKLOG (256 * 1024)
+#define RDP_FRAME_HISTORY 16
+#define RDP_MIN_FRAME_INTERVAL 16
+#define RDP_MAX_FRAME_INTERVAL 1000
+/* Throughput, in bytes per msec, from which the cheaper and bigger
+ * encodings are worth it */
+#define RDP_NSC_THROUGHPUT 12000
+#define RDP_RAW_THROUGHPUT 60000
+/* Smaller frames are dominated by latency, not throughput */
+#define RDP_THROUGHPUT_MIN_SAMPLE (16 * 1024)
+
 struct rdp_compositor_config {
 	int width;
 	int height;
@@ -61,9 +92,76 @@ struct rdp_compositor_config {
 	char *server_key;
 	int env_socket;
 	int no_clients_resize;
+	int encoder_threads;
 };
 
 struct rdp_output;
+struct rdp_peer_context;
+
+/* Only what goes out as surface bits.  H.264 (AVC420) needs the
+ * graphics pipeline channel, which FreeRDP 1.x doesn't implement on the
+ * server side; the screen-share module's stream= is what encodes an
+ * output to H.264 for now. */
+enum rdp_encode_codec {
+	RDP_ENCODE_RFX,
+	RDP_ENCODE_NSC,
+	RDP_ENCODE_RAW,
+};
+
+static const char *rdp_codec_names[] = {
+	[RDP_ENCODE_RFX] = "RemoteFX",
+	[RDP_ENCODE_NSC] = "NSCodec",
+	[RDP_ENCODE_RAW] = "raw",
+};
+
+/* What is known about the connection to a peer, from the frames it
+ * acknowledged so far */
+struct rdp_peer_link {
+	uint32_t frame_id;		/* last frame sent */
+	uint32_t acked_id;		/* last frame acknowledged */
+	int acks;			/* the peer acknowledges frames */
+	uint32_t sent_msec[RDP_FRAME_HISTORY];
+	uint32_t sent_bytes[RDP_FRAME_HISTORY];
+	uint32_t last_frame_msec;
+	uint32_t last_frame_bytes;
+
+	uint32_t rtt, rtt_min;		/* msec */
+	uint32_t throughput;		/* bytes per msec, 0 if unknown */
+	enum rdp_encode_codec codec;
+
+	struct wl_event_source *timer;
+};
+
+/* A snapshot of a peer's damage, encoded on one of the encoder threads
+ * and sent from the main thread once done. */
+struct rdp_encode_job {
+	struct rdp_peer_context *peer;
+	struct wl_list link;
+
+	enum rdp_encode_codec codec;
+	pixman_region32_t region;
+	pixman_image_t *image;		/* the region's extents */
+	wStream *stream;
+	RFX_RECT *rfx_rects;
+};
+
+/* FreeRDP's transport isn't safe to write to from several threads, so
+ * the workers only run the codecs; the main thread does all the
+ * SurfaceBits calls.  A peer never has more than one job encoding at a
+ * time, its RFX and NSC contexts aren't shared. */
+struct rdp_encoder {
+	int num_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t idle_cond;
+	struct wl_list jobs;		/* queued, oldest first */
+	struct wl_list done;		/* encoded, waiting to be sent */
+	int quit;
+
+	int done_fd;
+	struct wl_event_source *done_source;
+};
 
 struct rdp_compositor {
 	struct weston_compositor base;
@@ -71,6 +169,7 @@ struct rdp_compositor {
 	freerdp_listener *listener;
 	struct wl_event_source *listener_events[MAX_FREERDP_FDS];
 	struct rdp_output *output;
+	struct rdp_encoder *encoder;
 
 	char *server_cert;
 	char *server_key;
@@ -110,6 +209,25 @@ struct rdp_peer_context {
 	RFX_RECT *rfx_rects;
 	NSC_CONTEXT *nsc_context;
 
+	/* Bottom-up rows of the raw chunk being sent, kept across frames */
+	BYTE *raw_buffer;
+	size_t raw_buffer_size;
+
+	/* Stream of the last job sent, for the next one to encode into */
+	wStream *spare_stream;
+
+	/* Damage not handed to the encoder yet, and the number of jobs
+	 * in flight.  encoding is protected by the encoder mutex. */
+	pixman_region32_t pending_damage;
+	int pending;
+	int encoding;
+
+	/* Hash of every tile's content as last sent, 0 when unknown */
+	uint64_t *tile_hashes;
+	int tiles_width, tiles_height;
+
+	struct rdp_peer_link link;
+
 	struct rdp_peers_item item;
 };
 typedef struct rdp_peer_context RdpPeerContext;
@@ -125,9 +243,10 @@ rdp_compositor_config_init(struct rdp_compositor_config *config) {
 	config->server_key = NULL;
 	config->env_socket = 0;
 	config->no_clients_resize = 0;
+	config->encoder_threads = RDP_ENCODER_DEFAULT_THREADS;
 }
 
-static void
+static uint32_t
 rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
 {
 	int width, height, nrects, i;
@@ -178,10 +297,12 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	cmd->bitmapData = Stream_Buffer(context->encode_stream);
 
 	update->SurfaceBits(update->context, cmd);
+
+	return cmd->bitmapDataLength;
 }
 
 
-static void
+static uint32_t
 rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
 {
 	int width, height;
@@ -214,6 +335,8 @@ rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
 	cmd->bitmapData = Stream_Buffer(context->encode_stream);
 	update->SurfaceBits(update->context, cmd);
+
+	return cmd->bitmapDataLength;
 }
 
 static void
@@ -229,23 +352,21 @@ pixman_image_flipped_subrect(const pixman_box32_t *rect, pixman_image_t *img, BY
 		   memcpy(dest, src, toCopy);
 }
 
-static void
+static uint32_t
 rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_peer *peer)
 {
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 	rdpUpdate *update = peer->update;
 	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
 	pixman_box32_t *rect, subrect;
 	int nrects, i;
 	int heightIncrement, remainingHeight, top;
+	uint32_t bytes = 0;
+	BYTE *buffer;
 
 	rect = pixman_region32_rectangles(region, &nrects);
 	if (!nrects)
-		return;
-
-	marker->frameId++;
-	marker->frameAction = SURFACECMD_FRAMEACTION_BEGIN;
-	update->SurfaceFrameMarker(peer->context, marker);
+		return 0;
 
 	cmd->bpp = 32;
 	cmd->codecID = 0;
@@ -268,7 +389,16 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 			   cmd->destTop = top;
 			   cmd->destBottom = top + cmd->height;
 			   cmd->bitmapDataLength = cmd->width * cmd->height * 4;
-			   cmd->bitmapData = (BYTE *)realloc(cmd->bitmapData, cmd->bitmapDataLength);
+			   if (cmd->bitmapDataLength > context->raw_buffer_size) {
+				   buffer = realloc(context->raw_buffer, cmd->bitmapDataLength);
+				   if (!buffer) {
+					   weston_log("rdp: failed to allocate a raw update\n");
+					   goto out;
+				   }
+				   context->raw_buffer = buffer;
+				   context->raw_buffer_size = cmd->bitmapDataLength;
+			   }
+			   cmd->bitmapData = context->raw_buffer;
 
 			   subrect.y1 = top;
 			   subrect.y2 = top + cmd->height;
@@ -276,29 +406,666 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 
 			   /*weston_log("*  sending (%d,%d, %d,%d)\n", subrect.x1, subrect.y1, subrect.x2, subrect.y2); */
 			   update->SurfaceBits(peer->context, cmd);
+			   bytes += cmd->bitmapDataLength;
 
 			   remainingHeight -= cmd->height;
 			   top += cmd->height;
 		}
 	}
 
+out:
+	/* Don't leave the peer's buffer referenced from the update */
+	cmd->bitmapData = NULL;
+	cmd->bitmapDataLength = 0;
+
+	return bytes;
+}
+
+static uint64_t
+rdp_tile_hash(pixman_image_t *image, const pixman_box32_t *box)
+{
+	int stride = pixman_image_get_stride(image) / sizeof(uint32_t);
+	const uint32_t *row = pixman_image_get_data(image) +
+		box->y1 * stride + box->x1;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int x, y;
+
+	/* FNV-1a, over whole pixels rather than bytes */
+	for (y = box->y1; y < box->y2; y++, row += stride) {
+		for (x = 0; x < box->x2 - box->x1; x++) {
+			hash ^= row[x];
+			hash *= 0x100000001b3ULL;
+		}
+	}
+
+	/* 0 marks tiles whose content the peer doesn't know */
+	return hash ? hash : 1;
+}
+
+static void
+rdp_peer_reset_tile_hashes(RdpPeerContext *context)
+{
+	if (context->tile_hashes)
+		memset(context->tile_hashes, 0, context->tiles_width *
+		       context->tiles_height * sizeof *context->tile_hashes);
+}
+
+/* Removes from region the tiles whose content is the same as when they
+ * were last sent to the peer, and records the hash of the others for
+ * next time.  Must be called with the pixels that actually go out,
+ * so the hashes match what the peer will display. */
+static void
+rdp_peer_skip_unchanged_tiles(RdpPeerContext *context, pixman_image_t *image,
+			      pixman_region32_t *region)
+{
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+	int tiles_width = (width + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	int tiles_height = (height + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	pixman_region32_t unchanged;
+	pixman_box32_t *extents, tile;
+	uint64_t hash, *stored;
+	int tx, ty, tx1, ty1, tx2, ty2;
+
+	if (context->tiles_width != tiles_width ||
+	    context->tiles_height != tiles_height) {
+		free(context->tile_hashes);
+		context->tile_hashes = calloc(tiles_width * tiles_height,
+					      sizeof *context->tile_hashes);
+		context->tiles_width = tiles_width;
+		context->tiles_height = tiles_height;
+	}
+
+	if (!context->tile_hashes)
+		return;
+
+	extents = pixman_region32_extents(region);
+	if (extents->x2 <= 0 || extents->y2 <= 0 ||
+	    extents->x1 >= width || extents->y1 >= height)
+		return;
+
+	tx1 = extents->x1 > 0 ? extents->x1 / RDP_TILE_SIZE : 0;
+	ty1 = extents->y1 > 0 ? extents->y1 / RDP_TILE_SIZE : 0;
+	tx2 = (MIN(extents->x2, width) - 1) / RDP_TILE_SIZE;
+	ty2 = (MIN(extents->y2, height) - 1) / RDP_TILE_SIZE;
+
+	pixman_region32_init(&unchanged);
+	for (ty = ty1; ty <= ty2; ty++) {
+		for (tx = tx1; tx <= tx2; tx++) {
+			tile.x1 = tx * RDP_TILE_SIZE;
+			tile.y1 = ty * RDP_TILE_SIZE;
+			tile.x2 = MIN(tile.x1 + RDP_TILE_SIZE, width);
+			tile.y2 = MIN(tile.y1 + RDP_TILE_SIZE, height);
+
+			if (pixman_region32_contains_rectangle(region, &tile) ==
+			    PIXMAN_REGION_OUT)
+				continue;
+
+			hash = rdp_tile_hash(image, &tile);
+			stored = &context->tile_hashes[ty * tiles_width + tx];
+			if (*stored == hash)
+				pixman_region32_union_rect(&unchanged, &unchanged,
+							   tile.x1, tile.y1,
+							   tile.x2 - tile.x1,
+							   tile.y2 - tile.y1);
+			else
+				*stored = hash;
+		}
+	}
+
+	pixman_region32_subtract(region, region, &unchanged);
+	pixman_region32_fini(&unchanged);
+}
+
+/* Hands the job's stream back to the peer, so the next job doesn't have
+ * to grow a fresh one up to the size of a frame again */
+static void
+rdp_encode_job_destroy(struct rdp_encode_job *job)
+{
+	pixman_region32_fini(&job->region);
+	if (job->image)
+		pixman_image_unref(job->image);
+	if (job->stream && !job->peer->spare_stream)
+		job->peer->spare_stream = job->stream;
+	else if (job->stream)
+		Stream_Free(job->stream, TRUE);
+	free(job->rfx_rects);
+	free(job);
+}
+
+static void
+rdp_encode_job_run(struct rdp_encode_job *job)
+{
+	RdpPeerContext *context = job->peer;
+	pixman_box32_t *extents = pixman_region32_extents(&job->region);
+	pixman_box32_t *rects;
+	int width, height, stride, nrects, i;
+	BYTE *data;
+
+	width = extents->x2 - extents->x1;
+	height = extents->y2 - extents->y1;
+	stride = pixman_image_get_stride(job->image);
+	data = (BYTE *)pixman_image_get_data(job->image);
+
+	Stream_SetPosition(job->stream, 0);
+
+	if (job->codec == RDP_ENCODE_NSC) {
+		nsc_compose_message(context->nsc_context, job->stream, data,
+				    width, height, stride);
+		return;
+	}
+
+	rects = pixman_region32_rectangles(&job->region, &nrects);
+	for (i = 0; i < nrects; i++) {
+		job->rfx_rects[i].x = rects[i].x1 - extents->x1;
+		job->rfx_rects[i].y = rects[i].y1 - extents->y1;
+		job->rfx_rects[i].width = rects[i].x2 - rects[i].x1;
+		job->rfx_rects[i].height = rects[i].y2 - rects[i].y1;
+	}
+
+	rfx_compose_message(context->rfx_context, job->stream,
+			    job->rfx_rects, nrects, data, width, height, stride);
+}
+
+static struct rdp_encode_job *
+rdp_encoder_next_job(struct rdp_encoder *encoder)
+{
+	struct rdp_encode_job *job;
+
+	wl_list_for_each(job, &encoder->jobs, link) {
+		if (!job->peer->encoding)
+			return job;
+	}
+
+	return NULL;
+}
+
+static void *
+rdp_encoder_thread(void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_encode_job *job;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&encoder->mutex);
+	for (;;) {
+		while (!encoder->quit &&
+		       !(job = rdp_encoder_next_job(encoder)))
+			pthread_cond_wait(&encoder->work_cond, &encoder->mutex);
+		if (encoder->quit)
+			break;
+
+		wl_list_remove(&job->link);
+		job->peer->encoding = 1;
+		pthread_mutex_unlock(&encoder->mutex);
+
+		rdp_encode_job_run(job);
+
+		pthread_mutex_lock(&encoder->mutex);
+		job->peer->encoding = 0;
+		wl_list_insert(encoder->done.prev, &job->link);
+		if (write(encoder->done_fd, &one, sizeof one) != sizeof one)
+			weston_log("rdp encoder: failed to signal main thread\n");
+
+		/* The peer's next job may be waiting on this one */
+		pthread_cond_broadcast(&encoder->work_cond);
+		pthread_cond_broadcast(&encoder->idle_cond);
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return NULL;
+}
+
+static void
+rdp_peer_frame_begin(RdpPeerContext *context)
+{
+	rdpUpdate *update = context->item.peer->update;
+	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
+
+	marker->frameId = ++context->link.frame_id;
+	marker->frameAction = SURFACECMD_FRAMEACTION_BEGIN;
+	update->SurfaceFrameMarker(update->context, marker);
+}
+
+static void
+rdp_peer_frame_end(RdpPeerContext *context, uint32_t bytes)
+{
+	rdpUpdate *update = context->item.peer->update;
+	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
+	struct rdp_peer_link *link = &context->link;
+	int slot = link->frame_id % RDP_FRAME_HISTORY;
+
+	marker->frameId = link->frame_id;
 	marker->frameAction = SURFACECMD_FRAMEACTION_END;
-	update->SurfaceFrameMarker(peer->context, marker);
+	update->SurfaceFrameMarker(update->context, marker);
+
+	link->last_frame_msec = weston_compositor_get_time();
+	link->last_frame_bytes = bytes;
+	link->sent_msec[slot] = link->last_frame_msec;
+	link->sent_bytes[slot] = bytes;
 }
 
 static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+rdp_peer_send_job(struct rdp_encode_job *job)
 {
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
-	struct rdp_output *output = context->rdpCompositor->output;
-	rdpSettings *settings = peer->settings;
+	RdpPeerContext *context = job->peer;
+	freerdp_peer *peer = context->item.peer;
+	rdpUpdate *update = peer->update;
+	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
+	pixman_box32_t *extents = pixman_region32_extents(&job->region);
+
+	cmd->destLeft = extents->x1;
+	cmd->destTop = extents->y1;
+	cmd->destRight = extents->x2;
+	cmd->destBottom = extents->y2;
+	cmd->bpp = 32;
+	if (job->codec == RDP_ENCODE_NSC)
+		cmd->codecID = peer->settings->NSCodecId;
+	else
+		cmd->codecID = peer->settings->RemoteFxCodecId;
+	cmd->width = extents->x2 - extents->x1;
+	cmd->height = extents->y2 - extents->y1;
+	cmd->bitmapDataLength = Stream_GetPosition(job->stream);
+	cmd->bitmapData = Stream_Buffer(job->stream);
+
+	rdp_peer_frame_begin(context);
+	update->SurfaceBits(update->context, cmd);
+	rdp_peer_frame_end(context, cmd->bitmapDataLength);
+
+	/* Don't leave the job's buffer referenced from the peer */
+	cmd->bitmapData = NULL;
+	cmd->bitmapDataLength = 0;
+}
+
+/* Snapshots the peer's pending damage from the shadow surface and
+ * queues it for encoding.  Only the damaged rectangles are copied. */
+static void
+rdp_peer_submit(RdpPeerContext *context, enum rdp_encode_codec codec)
+{
+	struct rdp_compositor *c = context->rdpCompositor;
+	struct rdp_encoder *encoder = c->encoder;
+	pixman_image_t *shadow = c->output->shadow_surface;
+	struct rdp_encode_job *job;
+	pixman_box32_t *extents, *rects;
+	int nrects, i;
+
+	rdp_peer_skip_unchanged_tiles(context, shadow, &context->pending_damage);
+	if (!pixman_region32_not_empty(&context->pending_damage))
+		return;
+
+	job = zalloc(sizeof *job);
+	if (!job)
+		return;
+
+	job->peer = context;
+	job->codec = codec;
+
+	/* NSC encodes the whole bounding rectangle */
+	pixman_region32_init(&job->region);
+	if (job->codec == RDP_ENCODE_NSC)
+		pixman_region32_union_rect(&job->region, &job->region,
+			context->pending_damage.extents.x1,
+			context->pending_damage.extents.y1,
+			context->pending_damage.extents.x2 - context->pending_damage.extents.x1,
+			context->pending_damage.extents.y2 - context->pending_damage.extents.y1);
+	else
+		pixman_region32_copy(&job->region, &context->pending_damage);
+
+	extents = pixman_region32_extents(&job->region);
+	rects = pixman_region32_rectangles(&job->region, &nrects);
+
+	job->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+					      extents->x2 - extents->x1,
+					      extents->y2 - extents->y1,
+					      NULL, 0);
+	if (context->spare_stream) {
+		job->stream = context->spare_stream;
+		context->spare_stream = NULL;
+	} else {
+		job->stream = Stream_New(NULL, 65536);
+	}
+	job->rfx_rects = calloc(nrects, sizeof *job->rfx_rects);
+	if (!job->image || !job->stream || !job->rfx_rects) {
+		weston_log("rdp encoder: failed to allocate a job\n");
+		rdp_encode_job_destroy(job);
+		return;
+	}
+
+	for (i = 0; i < nrects; i++)
+		pixman_image_composite32(PIXMAN_OP_SRC, shadow, NULL,
+					 job->image,
+					 rects[i].x1, rects[i].y1, 0, 0,
+					 rects[i].x1 - extents->x1,
+					 rects[i].y1 - extents->y1,
+					 rects[i].x2 - rects[i].x1,
+					 rects[i].y2 - rects[i].y1);
+
+	pixman_region32_clear(&context->pending_damage);
+	context->pending++;
+
+	pthread_mutex_lock(&encoder->mutex);
+	wl_list_insert(encoder->jobs.prev, &job->link);
+	pthread_cond_signal(&encoder->work_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+}
 
-	if (settings->RemoteFxCodec)
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
+static enum rdp_encode_codec
+rdp_peer_choose_codec(RdpPeerContext *context)
+{
+	rdpSettings *settings = context->item.peer->settings;
+	uint32_t throughput = context->link.throughput;
+	enum rdp_encode_codec codec, current = context->link.codec;
+	uint32_t raw, nsc;
+
+	/* Leave some margin around the thresholds, so a link close to one
+	 * doesn't flip between codecs on every measurement */
+	raw = current == RDP_ENCODE_RAW ?
+		RDP_RAW_THROUGHPUT * 3 / 4 : RDP_RAW_THROUGHPUT * 5 / 4;
+	nsc = current == RDP_ENCODE_NSC ?
+		RDP_NSC_THROUGHPUT * 3 / 4 : RDP_NSC_THROUGHPUT * 5 / 4;
+
+	if (throughput && throughput >= raw)
+		codec = RDP_ENCODE_RAW;
+	else if (throughput && throughput >= nsc && settings->NSCodec)
+		codec = RDP_ENCODE_NSC;
+	else if (settings->RemoteFxCodec)
+		codec = RDP_ENCODE_RFX;
 	else if (settings->NSCodec)
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
+		codec = RDP_ENCODE_NSC;
 	else
-		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+		codec = RDP_ENCODE_RAW;
+
+	if (codec != current && context->link.frame_id)
+		weston_log("rdp: peer %s now at %u bytes/ms, rtt %ums, "
+			   "switching to %s\n",
+			   context->item.peer->hostname, throughput,
+			   context->link.rtt, rdp_codec_names[codec]);
+	context->link.codec = codec;
+
+	return codec;
+}
+
+/* Decides whether the link can take another frame now.  If not, and
+ * nothing else will wake the peer up, *delay says when to try again. */
+static int
+rdp_peer_link_ready(RdpPeerContext *context, uint32_t *delay)
+{
+	struct rdp_peer_link *link = &context->link;
+	uint32_t now = weston_compositor_get_time();
+	uint32_t interval, elapsed, oldest;
+	int backlog;
+
+	*delay = 0;
+
+	if (link->acks && link->frame_id - link->acked_id >= RDP_MAX_UNACKED_FRAMES) {
+		oldest = link->sent_msec[(link->acked_id + 1) % RDP_FRAME_HISTORY];
+		if (now - oldest < RDP_ACK_TIMEOUT) {
+			/* The next acknowledgement resumes the updates */
+			*delay = RDP_ACK_TIMEOUT - (now - oldest);
+			return 0;
+		}
+
+		/* The peer stopped acknowledging, fall back to watching
+		 * the socket */
+		link->acks = 0;
+		link->acked_id = link->frame_id;
+	}
+
+	if (!link->acks &&
+	    ioctl(context->item.peer->sockfd, SIOCOUTQ, &backlog) == 0 &&
+	    backlog > RDP_MAX_SOCKET_BACKLOG) {
+		*delay = RDP_MIN_FRAME_INTERVAL;
+		return 0;
+	}
+
+	/* Cap the frame rate to what the link carries */
+	interval = RDP_MIN_FRAME_INTERVAL;
+	if (link->throughput)
+		interval = link->last_frame_bytes / link->throughput;
+	if (interval < RDP_MIN_FRAME_INTERVAL)
+		interval = RDP_MIN_FRAME_INTERVAL;
+	if (interval > RDP_MAX_FRAME_INTERVAL)
+		interval = RDP_MAX_FRAME_INTERVAL;
+
+	elapsed = now - link->last_frame_msec;
+	if (link->frame_id && elapsed < interval) {
+		*delay = interval - elapsed;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Sends the peer's pending damage if the link allows it.  Otherwise the
+ * damage stays pending and coalesces with what comes next. */
+static void
+rdp_peer_update(RdpPeerContext *context)
+{
+	struct rdp_compositor *c = context->rdpCompositor;
+	pixman_image_t *shadow = c->output->shadow_surface;
+	freerdp_peer *peer = context->item.peer;
+	enum rdp_encode_codec codec;
+	uint32_t delay, bytes = 0;
+
+	if (!pixman_region32_not_empty(&context->pending_damage) ||
+	    !(context->item.flags & RDP_PEER_ACTIVATED) ||
+	    !(context->item.flags & RDP_PEER_OUTPUT_ENABLED))
+		return;
+
+	if (!rdp_peer_link_ready(context, &delay)) {
+		if (delay)
+			wl_event_source_timer_update(context->link.timer, delay);
+		return;
+	}
+
+	codec = rdp_peer_choose_codec(context);
+	if (c->encoder && codec != RDP_ENCODE_RAW) {
+		/* The peer is falling behind: the damage goes out with
+		 * the next frame once the backlog has drained. */
+		if (context->pending < RDP_PEER_MAX_PENDING)
+			rdp_peer_submit(context, codec);
+		return;
+	}
+
+	/* Frames still being encoded must go out first */
+	if (context->pending)
+		return;
+
+	rdp_peer_skip_unchanged_tiles(context, shadow, &context->pending_damage);
+	if (!pixman_region32_not_empty(&context->pending_damage))
+		return;
+
+	rdp_peer_frame_begin(context);
+	switch (codec) {
+	case RDP_ENCODE_RFX:
+		bytes = rdp_peer_refresh_rfx(&context->pending_damage, shadow, peer);
+		break;
+	case RDP_ENCODE_NSC:
+		bytes = rdp_peer_refresh_nsc(&context->pending_damage, shadow, peer);
+		break;
+	case RDP_ENCODE_RAW:
+		bytes = rdp_peer_refresh_raw(&context->pending_damage, shadow, peer);
+		break;
+	}
+	rdp_peer_frame_end(context, bytes);
+
+	pixman_region32_clear(&context->pending_damage);
+}
+
+static int
+rdp_peer_link_timer(void *data)
+{
+	rdp_peer_update(data);
+
+	return 1;
+}
+
+static int
+rdp_encoder_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_encode_job *job, *next;
+	RdpPeerContext *context;
+	struct wl_list done;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 0;
+
+	wl_list_init(&done);
+	pthread_mutex_lock(&encoder->mutex);
+	wl_list_insert_list(&done, &encoder->done);
+	wl_list_init(&encoder->done);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	wl_list_for_each_safe(job, next, &done, link) {
+		context = job->peer;
+
+		rdp_peer_send_job(job);
+		context->pending--;
+		wl_list_remove(&job->link);
+		rdp_encode_job_destroy(job);
+
+		rdp_peer_update(context);
+	}
+
+	return 1;
+}
+
+/* Takes back all of the peer's jobs and waits until none of them is
+ * being encoded anymore, so its codec contexts can be touched from the
+ * main thread.  The damage of the dropped jobs is kept pending. */
+static void
+rdp_encoder_flush_peer(struct rdp_encoder *encoder, RdpPeerContext *context)
+{
+	struct rdp_encode_job *job, *next;
+	struct wl_list *lists[2];
+	int i;
+
+	if (!encoder)
+		return;
+
+	lists[0] = &encoder->jobs;
+	lists[1] = &encoder->done;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while (context->encoding)
+		pthread_cond_wait(&encoder->idle_cond, &encoder->mutex);
+
+	for (i = 0; i < 2; i++) {
+		wl_list_for_each_safe(job, next, lists[i], link) {
+			if (job->peer != context)
+				continue;
+
+			pixman_region32_union(&context->pending_damage,
+					      &context->pending_damage,
+					      &job->region);
+			context->pending--;
+			wl_list_remove(&job->link);
+			rdp_encode_job_destroy(job);
+		}
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+}
+
+static void
+rdp_encoder_destroy(struct rdp_encoder *encoder)
+{
+	struct rdp_encode_job *job, *next;
+	int i;
+
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->quit = 1;
+	pthread_cond_broadcast(&encoder->work_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	for (i = 0; i < encoder->num_threads; i++)
+		pthread_join(encoder->threads[i], NULL);
+
+	wl_list_for_each_safe(job, next, &encoder->jobs, link)
+		rdp_encode_job_destroy(job);
+	wl_list_for_each_safe(job, next, &encoder->done, link)
+		rdp_encode_job_destroy(job);
+
+	if (encoder->done_source)
+		wl_event_source_remove(encoder->done_source);
+	close(encoder->done_fd);
+	pthread_cond_destroy(&encoder->idle_cond);
+	pthread_cond_destroy(&encoder->work_cond);
+	pthread_mutex_destroy(&encoder->mutex);
+	free(encoder->threads);
+	free(encoder);
+}
+
+static struct rdp_encoder *
+rdp_encoder_create(struct rdp_compositor *c, int num_threads)
+{
+	struct rdp_encoder *encoder;
+	struct wl_event_loop *loop;
+	int i;
+
+	if (num_threads > RDP_ENCODER_MAX_THREADS)
+		num_threads = RDP_ENCODER_MAX_THREADS;
+	if (num_threads <= 0)
+		return NULL;
+
+	encoder = zalloc(sizeof *encoder);
+	if (!encoder)
+		return NULL;
+
+	encoder->threads = calloc(num_threads, sizeof *encoder->threads);
+	if (!encoder->threads) {
+		free(encoder);
+		return NULL;
+	}
+
+	wl_list_init(&encoder->jobs);
+	wl_list_init(&encoder->done);
+	pthread_mutex_init(&encoder->mutex, NULL);
+	pthread_cond_init(&encoder->work_cond, NULL);
+	pthread_cond_init(&encoder->idle_cond, NULL);
+
+	encoder->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (encoder->done_fd < 0) {
+		weston_log("rdp encoder: failed to create eventfd: %m\n");
+		goto err;
+	}
+
+	loop = wl_display_get_event_loop(c->base.wl_display);
+	encoder->done_source =
+		wl_event_loop_add_fd(loop, encoder->done_fd, WL_EVENT_READABLE,
+				     rdp_encoder_dispatch, encoder);
+	if (!encoder->done_source)
+		goto err;
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&encoder->threads[i], NULL,
+				   rdp_encoder_thread, encoder) != 0) {
+			weston_log("failed to start rdp encoder thread %d\n", i);
+			break;
+		}
+	}
+	encoder->num_threads = i;
+	if (encoder->num_threads == 0)
+		goto err;
+
+	weston_log("rdp: encoding with %d threads\n", encoder->num_threads);
+
+	return encoder;
+
+err:
+	rdp_encoder_destroy(encoder);
+	return NULL;
+}
+
+static void
+rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+
+	pixman_region32_union(&context->pending_damage,
+			      &context->pending_damage, region);
+	rdp_peer_update(context);
 }
 
 static void
@@ -404,7 +1171,7 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode) {
 	output->current_mode->flags |= WL_OUTPUT_MODE_CURRENT;
 
 	pixman_renderer_output_destroy(output);
-	pixman_renderer_output_create(output);
+	pixman_renderer_output_create(output, PIXMAN_RENDERER_OUTPUT_USE_SHADOW);
 
 	new_shadow_buffer = pixman_image_create_bits(PIXMAN_x8r8g8b8, target_mode->width,
 			target_mode->height, 0, target_mode->width * 4);
@@ -470,7 +1237,8 @@ rdp_compositor_create_output(struct rdp_compositor *c, int width, int height)
 		goto out_output;
 	}
 
-	if (pixman_renderer_output_create(&output->base) < 0)
+	if (pixman_renderer_output_create(&output->base,
+					  PIXMAN_RENDERER_OUTPUT_USE_SHADOW) < 0)
 		goto out_shadow_surface;
 
 	loop = wl_display_get_event_loop(c->base.wl_display);
@@ -505,6 +1273,11 @@ rdp_restore(struct weston_compositor *ec)
 static void
 rdp_destroy(struct weston_compositor *ec)
 {
+	struct rdp_compositor *c = (struct rdp_compositor *)ec;
+
+	if (c->encoder)
+		rdp_encoder_destroy(c->encoder);
+
 	weston_compositor_shutdown(ec);
 
 	free(ec);
@@ -569,6 +1342,7 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 	nsc_context_set_pixel_format(context->nsc_context, RDP_PIXEL_FORMAT_B8G8R8A8);
 
 	context->encode_stream = Stream_New(NULL, 65536);
+	pixman_region32_init(&context->pending_damage);
 }
 
 static void
@@ -578,6 +1352,12 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 	if (!context)
 		return;
 
+	rdp_encoder_flush_peer(context->rdpCompositor->encoder, context);
+	pixman_region32_fini(&context->pending_damage);
+	free(context->tile_hashes);
+	if (context->link.timer)
+		wl_event_source_remove(context->link.timer);
+
 	wl_list_remove(&context->item.link);
 	for(i = 0; i < MAX_FREERDP_FDS; i++) {
 		if (context->events[i])
@@ -590,6 +1370,9 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 		weston_seat_release(&context->item.seat);
 	}
 	Stream_Free(context->encode_stream, TRUE);
+	if (context->spare_stream)
+		Stream_Free(context->spare_stream, TRUE);
+	free(context->raw_buffer);
 	nsc_context_free(context->nsc_context);
 	rfx_context_free(context->rfx_context);
 	free(context->rfx_rects);
@@ -745,6 +1528,7 @@ xf_peer_post_connect(freerdp_peer* client)
 	box.y2 = output->base.height;
 	pixman_region32_init_with_extents(&damage, &box);
 
+	rdp_peer_reset_tile_hashes(peerCtx);
 	rdp_peer_refresh_region(&damage, client);
 
 	pixman_region32_fini(&damage);
@@ -756,7 +1540,13 @@ static BOOL
 xf_peer_activate(freerdp_peer *client)
 {
 	RdpPeerContext *context = (RdpPeerContext *)client->context;
+
+	rdp_encoder_flush_peer(context->rdpCompositor->encoder, context);
 	rfx_context_reset(context->rfx_context);
+	rdp_peer_reset_tile_hashes(context);
+
+	/* Resend what was dropped by the flush with the fresh context */
+	rdp_peer_update(context);
 	return TRUE;
 }
 
@@ -839,6 +1629,7 @@ xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 	box.y2 = output->base.height;
 	pixman_region32_init_with_extents(&damage, &box);
 
+	rdp_peer_reset_tile_hashes(peerCtx);
 	rdp_peer_refresh_region(&damage, client);
 
 	pixman_region32_fini(&damage);
@@ -902,10 +1693,51 @@ xf_input_unicode_keyboard_event(rdpInput *input, UINT16 flags, UINT16 code)
 static void
 xf_suppress_output(rdpContext *context, BYTE allow, RECTANGLE_16 *area) {
 	RdpPeerContext *peerContext = (RdpPeerContext *)context;
-	if (allow)
+	if (allow) {
 		peerContext->item.flags |= RDP_PEER_OUTPUT_ENABLED;
-	else
+		rdp_peer_update(peerContext);
+	} else {
 		peerContext->item.flags &= (~RDP_PEER_OUTPUT_ENABLED);
+	}
+}
+
+static void
+xf_surface_frame_acknowledge(rdpContext *context, UINT32 frameId)
+{
+	RdpPeerContext *peerContext = (RdpPeerContext *)context;
+	struct rdp_peer_link *link = &peerContext->link;
+	uint32_t now = weston_compositor_get_time();
+	uint32_t elapsed, transfer, sample, bytes;
+	int slot;
+
+	/* Ignore duplicate, stale or bogus acknowledgements */
+	if ((int32_t)(frameId - link->acked_id) <= 0 ||
+	    (int32_t)(link->frame_id - frameId) < 0)
+		return;
+
+	if (link->frame_id - frameId < RDP_FRAME_HISTORY) {
+		slot = frameId % RDP_FRAME_HISTORY;
+		elapsed = now - link->sent_msec[slot];
+		bytes = link->sent_bytes[slot];
+
+		link->rtt = link->rtt ? (link->rtt * 7 + elapsed) / 8 : elapsed;
+		if (!link->rtt_min || elapsed < link->rtt_min)
+			link->rtt_min = elapsed;
+
+		/* Take the round trip latency out of the time it took
+		 * to get the frame across */
+		if (bytes >= RDP_THROUGHPUT_MIN_SAMPLE) {
+			transfer = elapsed - link->rtt_min;
+			sample = bytes / (transfer ? transfer : 1);
+			link->throughput = link->throughput ?
+				(link->throughput * 7 + sample) / 8 : sample;
+		}
+	}
+
+	link->acked_id = frameId;
+	link->acks = 1;
+
+	rdp_peer_update(peerContext);
 }
 
 static int
@@ -944,6 +1776,7 @@ rdp_peer_init(freerdp_peer *client, struct rdp_compositor *c)
 	client->Activate = xf_peer_activate;
 
 	client->update->SuppressOutput = xf_suppress_output;
+	client->update->SurfaceFrameAcknowledge = xf_surface_frame_acknowledge;
 
 	input = client->input;
 	input->SynchronizeEvent = xf_input_synchronize_event;
@@ -965,6 +1798,8 @@ rdp_peer_init(freerdp_peer *client, struct rdp_compositor *c)
 	}
 
 	loop = wl_display_get_event_loop(c->base.wl_display);
+	peerCtx->link.timer = wl_event_loop_add_timer(loop, rdp_peer_link_timer,
+						      peerCtx);
 	for(i = 0; i < rcount; i++) {
 		fd = (int)(long)(rfds[i]);
 
@@ -1026,6 +1861,8 @@ rdp_compositor_create(struct wl_display *display,
 
 	c->base.capabilities |= WESTON_CAP_ARBITRARY_MODES;
 
+	c->encoder = rdp_encoder_create(c, config->encoder_threads);
+
 	if(!config->env_socket) {
 		c->listener = freerdp_listener_new();
 		c->listener->PeerAccepted = rdp_incoming_peer;
@@ -1089,6 +1926,7 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 		{ WESTON_OPTION_STRING,  "address", 0, &config.bind_address },
 		{ WESTON_OPTION_INTEGER, "port", 0, &config.port },
 		{ WESTON_OPTION_BOOLEAN, "no-clients-resize", 0, &config.no_clients_resize },
+		{ WESTON_OPTION_INTEGER, "encoder-threads", 0, &config.encoder_threads },
 		{ WESTON_OPTION_STRING,  "rdp4-key", 0, &config.rdp_key },
 		{ WESTON_OPTION_STRING,  "rdp-tls-cert", 0, &config.server_cert },
 		{ WESTON_OPTION_STRING,  "rdp-tls-key", 0, &config.server_key }
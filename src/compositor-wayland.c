@@ -46,6 +46,12 @@
 
 #define WINDOW_TITLE "Weston Compositor"
 
+/* Number of shm buffers kept around per output.  Buffers allocated above
+ * this while the parent compositor holds on to all of them are freed when
+ * they are released again. */
+#define WAYLAND_SHM_RING_SIZE 3
+#define WAYLAND_DECORATION_RING_SIZE 2
+
 struct wayland_compositor {
 	struct weston_compositor base;
 
@@ -53,6 +59,7 @@ struct wayland_compositor {
 		struct wl_display *wl_display;
 		struct wl_registry *registry;
 		struct wl_compositor *compositor;
+		struct wl_subcompositor *subcompositor;
 		struct wl_shell *shell;
 		struct _wl_fullscreen_shell *fshell;
 		struct wl_shm *shm;
@@ -108,6 +115,15 @@ struct wayland_output {
 		struct wl_list free_buffers;
 	} shm;
 
+	/* With the pixman renderer the frame is drawn into its own
+	 * subsurface, so it is only uploaded when it actually changes */
+	struct {
+		struct wl_surface *surface;
+		struct wl_subsurface *subsurface;
+		struct wl_list buffers;
+		struct wl_list free_buffers;
+	} decoration;
+
 	struct weston_mode mode;
 	uint32_t scale;
 };
@@ -145,6 +161,12 @@ struct wayland_shm_buffer {
 	size_t size;
 	pixman_region32_t damage;
 	int frame_damaged;
+	int decoration;
+
+	/* Number of frames since this buffer was rendered to, or 0 if it
+	 * was never rendered to.  damage accumulates everything that
+	 * changed over those frames. */
+	int age;
 
 	pixman_image_t *pm_image;
 	cairo_surface_t *c_surface;
@@ -181,7 +203,8 @@ static void
 wayland_shm_buffer_destroy(struct wayland_shm_buffer *buffer)
 {
 	cairo_surface_destroy(buffer->c_surface);
-	pixman_image_unref(buffer->pm_image);
+	if (buffer->pm_image)
+		pixman_image_unref(buffer->pm_image);
 
 	wl_buffer_destroy(buffer->buffer);
 	munmap(buffer->data, buffer->size);
@@ -197,20 +220,54 @@ static void
 buffer_release(void *data, struct wl_buffer *buffer)
 {
 	struct wayland_shm_buffer *sb = data;
+	struct wl_list *buffers, *free_buffers;
+	int ring_size;
 
-	if (sb->output) {
-		wl_list_insert(&sb->output->shm.free_buffers, &sb->free_link);
-	} else {
+	if (!sb->output) {
 		wayland_shm_buffer_destroy(sb);
+		return;
 	}
+
+	if (sb->decoration) {
+		buffers = &sb->output->decoration.buffers;
+		free_buffers = &sb->output->decoration.free_buffers;
+		ring_size = WAYLAND_DECORATION_RING_SIZE;
+	} else {
+		buffers = &sb->output->shm.buffers;
+		free_buffers = &sb->output->shm.free_buffers;
+		ring_size = WAYLAND_SHM_RING_SIZE;
+	}
+
+	if (wl_list_length(buffers) > ring_size)
+		wayland_shm_buffer_destroy(sb);
+	else
+		wl_list_insert(free_buffers, &sb->free_link);
 }
 
 static const struct wl_buffer_listener buffer_listener = {
 	buffer_release
 };
 
+static void
+wayland_shm_buffers_discard(struct wl_list *buffers,
+			    struct wl_list *free_buffers)
+{
+	struct wayland_shm_buffer *buffer, *next;
+
+	wl_list_for_each_safe(buffer, next, free_buffers, free_link)
+		wayland_shm_buffer_destroy(buffer);
+
+	/* These will get thrown away when they get released */
+	wl_list_for_each_safe(buffer, next, buffers, link) {
+		buffer->output = NULL;
+		wl_list_remove(&buffer->link);
+		wl_list_init(&buffer->link);
+	}
+}
+
 static struct wayland_shm_buffer *
-wayland_output_get_shm_buffer(struct wayland_output *output)
+wayland_shm_buffer_create(struct wayland_output *output,
+			  int width, int height, int decoration)
 {
 	struct wayland_compositor *c =
 		(struct wayland_compositor *) output->base.compositor;
@@ -218,28 +275,11 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	struct wayland_shm_buffer *sb;
 
 	struct wl_shm_pool *pool;
-	int width, height, stride;
+	int stride;
 	int32_t fx, fy;
 	int fd;
 	unsigned char *data;
 
-	if (!wl_list_empty(&output->shm.free_buffers)) {
-		sb = container_of(output->shm.free_buffers.next,
-				  struct wayland_shm_buffer, free_link);
-		wl_list_remove(&sb->free_link);
-		wl_list_init(&sb->free_link);
-
-		return sb;
-	}
-
-	if (output->frame) {
-		width = frame_width(output->frame);
-		height = frame_height(output->frame);
-	} else {
-		width = output->base.current_mode->width;
-		height = output->base.current_mode->height;
-	}
-
 	stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
 
 	fd = os_create_anonymous_file(height * stride);
@@ -264,10 +304,15 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	}
 
 	sb->output = output;
+	sb->decoration = decoration;
 	wl_list_init(&sb->free_link);
-	wl_list_insert(&output->shm.buffers, &sb->link);
+	if (decoration)
+		wl_list_insert(&output->decoration.buffers, &sb->link);
+	else
+		wl_list_insert(&output->shm.buffers, &sb->link);
 
-	pixman_region32_init_rect(&sb->damage, 0, 0,
+	pixman_region32_init_rect(&sb->damage,
+				  output->base.x, output->base.y,
 				  output->base.width, output->base.height);
 	sb->frame_damaged = 1;
 
@@ -290,6 +335,9 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 		cairo_image_surface_create_for_data(data, CAIRO_FORMAT_ARGB32,
 						    width, height, stride);
 
+	if (decoration)
+		return sb;
+
 	fx = 0;
 	fy = 0;
 	if (output->frame)
@@ -302,6 +350,38 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	return sb;
 }
 
+static struct wayland_shm_buffer *
+wayland_output_get_shm_buffer(struct wayland_output *output)
+{
+	struct wayland_shm_buffer *sb, *best = NULL;
+	int width, height;
+
+	/* Prefer the buffer that was rendered to most recently: it has
+	 * the least accumulated damage to bring up to date.  Buffers that
+	 * were never rendered to need a full repaint, so they come last. */
+	wl_list_for_each(sb, &output->shm.free_buffers, free_link) {
+		if (!best || (sb->age && (!best->age || sb->age < best->age)))
+			best = sb;
+	}
+
+	if (best) {
+		wl_list_remove(&best->free_link);
+		wl_list_init(&best->free_link);
+
+		return best;
+	}
+
+	if (output->frame) {
+		width = frame_width(output->frame);
+		height = frame_height(output->frame);
+	} else {
+		width = output->base.current_mode->width;
+		height = output->base.current_mode->height;
+	}
+
+	return wayland_shm_buffer_create(output, width, height, 0);
+}
+
 static void
 frame_done(void *data, struct wl_callback *callback, uint32_t time)
 {
@@ -324,8 +404,11 @@ draw_initial_frame(struct wayland_output *output)
 
 	/* If we are rendering with GL, then orphan it so that it gets
 	 * destroyed immediately */
-	if (output->gl.egl_window)
+	if (output->gl.egl_window) {
 		sb->output = NULL;
+		wl_list_remove(&sb->link);
+		wl_list_init(&sb->link);
+	}
 
 	wl_surface_attach(output->parent.surface, sb->buffer, 0, 0);
 	wl_surface_damage(output->parent.surface, 0, 0,
@@ -449,19 +532,17 @@ wayland_output_repaint_gl(struct weston_output *output_base,
 }
 
 static void
-wayland_output_update_shm_border(struct wayland_shm_buffer *buffer)
+wayland_output_draw_border(struct wayland_output *output,
+			   cairo_surface_t *surface)
 {
 	int32_t ix, iy, iwidth, iheight, fwidth, fheight;
 	cairo_t *cr;
 
-	if (!buffer->output->frame || !buffer->frame_damaged)
-		return;
-
-	cr = cairo_create(buffer->c_surface);
+	cr = cairo_create(surface);
 
-	frame_interior(buffer->output->frame, &ix, &iy, &iwidth, &iheight);
-	fwidth = frame_width(buffer->output->frame);
-	fheight = frame_height(buffer->output->frame);
+	frame_interior(output->frame, &ix, &iy, &iwidth, &iheight);
+	fwidth = frame_width(output->frame);
+	fheight = frame_height(output->frame);
 
 	/* Set the clip so we don't unnecisaraly damage the surface */
 	cairo_move_to(cr, ix, iy);
@@ -480,7 +561,7 @@ wayland_output_update_shm_border(struct wayland_shm_buffer *buffer)
 
 	/* Draw using a pattern so that the final result gets clipped */
 	cairo_push_group(cr);
-	frame_repaint(buffer->output->frame, cr);
+	frame_repaint(output->frame, cr);
 	cairo_pop_group_to_source(cr);
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_paint(cr);
@@ -488,6 +569,50 @@ wayland_output_update_shm_border(struct wayland_shm_buffer *buffer)
 	cairo_destroy(cr);
 }
 
+static void
+wayland_output_update_shm_border(struct wayland_shm_buffer *buffer)
+{
+	if (!buffer->output->frame || !buffer->frame_damaged)
+		return;
+
+	wayland_output_draw_border(buffer->output, buffer->c_surface);
+}
+
+static void
+wayland_output_update_decoration(struct wayland_output *output)
+{
+	struct wayland_shm_buffer *sb;
+	int32_t fwidth, fheight;
+
+	if (!output->decoration.surface ||
+	    !(frame_status(output->frame) & FRAME_STATUS_REPAINT))
+		return;
+
+	fwidth = frame_width(output->frame);
+	fheight = frame_height(output->frame);
+
+	if (!wl_list_empty(&output->decoration.free_buffers)) {
+		sb = container_of(output->decoration.free_buffers.next,
+				  struct wayland_shm_buffer, free_link);
+		wl_list_remove(&sb->free_link);
+		wl_list_init(&sb->free_link);
+	} else {
+		sb = wayland_shm_buffer_create(output, fwidth, fheight, 1);
+		if (!sb)
+			return;
+	}
+
+	/* The interior of the buffer is never drawn to and stays
+	 * transparent, so the main surface shows through. */
+	wayland_output_draw_border(output, sb->c_surface);
+
+	/* The subsurface is synchronized, so this only takes effect
+	 * together with the next commit of the main surface. */
+	wl_surface_attach(output->decoration.surface, sb->buffer, 0, 0);
+	wl_surface_damage(output->decoration.surface, 0, 0, fwidth, fheight);
+	wl_surface_commit(output->decoration.surface);
+}
+
 static void
 wayland_shm_buffer_attach(struct wayland_shm_buffer *sb)
 {
@@ -497,11 +622,14 @@ wayland_shm_buffer_attach(struct wayland_shm_buffer *sb)
 	int i, n;
 
 	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &sb->damage);
+	pixman_region32_translate(&damage, -sb->output->base.x,
+				  -sb->output->base.y);
 	weston_transformed_region(sb->output->base.width,
 				  sb->output->base.height,
 				  sb->output->base.transform,
 				  sb->output->base.current_scale,
-				  &sb->damage, &damage);
+				  &damage, &damage);
 
 	if (sb->output->frame) {
 		frame_interior(sb->output->frame, &ix, &iy, &iwidth, &iheight);
@@ -531,8 +659,7 @@ wayland_shm_buffer_attach(struct wayland_shm_buffer *sb)
 				  rects[i].y1, rects[i].x2 - rects[i].x1,
 				  rects[i].y2 - rects[i].y1);
 
-	if (sb->output->frame)
-		pixman_region32_fini(&damage);
+	pixman_region32_fini(&damage);
 }
 
 static int
@@ -545,20 +672,38 @@ wayland_output_repaint_pixman(struct weston_output *output_base,
 	struct wl_callback *callback;
 	struct wayland_shm_buffer *sb;
 
-	if (output->frame) {
+	if (output->frame && !output->decoration.surface) {
 		if (frame_status(output->frame) & FRAME_STATUS_REPAINT)
 			wl_list_for_each(sb, &output->shm.buffers, link)
 				sb->frame_damaged = 1;
 	}
 
-	wl_list_for_each(sb, &output->shm.buffers, link)
+	wl_list_for_each(sb, &output->shm.buffers, link) {
 		pixman_region32_union(&sb->damage, &sb->damage, damage);
+		if (sb->age)
+			sb->age++;
+	}
 
 	sb = wayland_output_get_shm_buffer(output);
+	if (!sb)
+		return -1;
 
 	wayland_output_update_shm_border(sb);
+	wayland_output_update_decoration(output);
 	pixman_renderer_output_set_buffer(output_base, sb->pm_image);
-	c->base.renderer->repaint_output(output_base, &sb->damage);
+
+	/* The shadow image always holds the previous frame, so only the
+	 * new damage has to be rendered.  What else changed since this
+	 * buffer was last used is copied over from the shadow. */
+	if (sb->age) {
+		pixman_renderer_output_set_hw_extra_damage(output_base,
+							   &sb->damage);
+		c->base.renderer->repaint_output(output_base, damage);
+	} else {
+		pixman_renderer_output_set_hw_extra_damage(output_base, NULL);
+		c->base.renderer->repaint_output(output_base, &sb->damage);
+	}
+	sb->age = 1;
 
 	wayland_shm_buffer_attach(sb);
 
@@ -589,6 +734,10 @@ wayland_output_destroy(struct weston_output *output_base)
 		gl_renderer->output_destroy(output_base);
 	}
 
+	wayland_shm_buffers_discard(&output->shm.buffers,
+				    &output->shm.free_buffers);
+	wayland_output_destroy_decoration(output);
+
 	wl_egl_window_destroy(output->gl.egl_window);
 	wl_surface_destroy(output->parent.surface);
 	if (output->parent.shell_surface)
@@ -647,7 +796,8 @@ cleanup_window:
 static int
 wayland_output_init_pixman_renderer(struct wayland_output *output)
 {
-	return pixman_renderer_output_create(&output->base);
+	return pixman_renderer_output_create(&output->base,
+					     PIXMAN_RENDERER_OUTPUT_USE_SHADOW);
 }
 
 static void
@@ -655,7 +805,6 @@ wayland_output_resize_surface(struct wayland_output *output)
 {
 	struct wayland_compositor *c =
 		(struct wayland_compositor *)output->base.compositor;
-	struct wayland_shm_buffer *buffer, *next;
 	int32_t ix, iy, iwidth, iheight;
 	int32_t width, height;
 	struct wl_region *region;
@@ -720,11 +869,58 @@ wayland_output_resize_surface(struct wayland_output *output)
 	}
 
 	/* Throw away any remaining SHM buffers */
-	wl_list_for_each_safe(buffer, next, &output->shm.free_buffers, link)
-		wayland_shm_buffer_destroy(buffer);
-	/* These will get thrown away when they get released */
-	wl_list_for_each(buffer, &output->shm.buffers, link)
-		buffer->output = NULL;
+	wayland_shm_buffers_discard(&output->shm.buffers,
+				    &output->shm.free_buffers);
+	wayland_shm_buffers_discard(&output->decoration.buffers,
+				    &output->decoration.free_buffers);
+}
+
+static void
+wayland_output_create_decoration(struct wayland_output *output)
+{
+	struct wayland_compositor *c =
+		(struct wayland_compositor *)output->base.compositor;
+	struct wl_region *region;
+
+	if (!c->use_pixman || !c->parent.subcompositor)
+		return;
+
+	output->decoration.surface =
+		wl_compositor_create_surface(c->parent.compositor);
+	if (!output->decoration.surface)
+		return;
+
+	output->decoration.subsurface =
+		wl_subcompositor_get_subsurface(c->parent.subcompositor,
+						output->decoration.surface,
+						output->parent.surface);
+	if (!output->decoration.subsurface) {
+		wl_surface_destroy(output->decoration.surface);
+		output->decoration.surface = NULL;
+		return;
+	}
+	wl_subsurface_set_position(output->decoration.subsurface, 0, 0);
+
+	/* Leave all input to the main surface, which already handles the
+	 * frame's coordinates */
+	region = wl_compositor_create_region(c->parent.compositor);
+	wl_surface_set_input_region(output->decoration.surface, region);
+	wl_region_destroy(region);
+}
+
+static void
+wayland_output_destroy_decoration(struct wayland_output *output)
+{
+	wayland_shm_buffers_discard(&output->decoration.buffers,
+				    &output->decoration.free_buffers);
+
+	if (output->decoration.subsurface)
+		wl_subsurface_destroy(output->decoration.subsurface);
+	if (output->decoration.surface)
+		wl_surface_destroy(output->decoration.surface);
+
+	output->decoration.subsurface = NULL;
+	output->decoration.surface = NULL;
 }
 
 static int
@@ -765,6 +961,7 @@ wayland_output_set_windowed(struct wayland_output *output)
 	if (output->keyboard_count)
 		frame_set_flag(output->frame, FRAME_FLAG_ACTIVE);
 
+	wayland_output_create_decoration(output);
 	wayland_output_resize_surface(output);
 
 	wl_shell_surface_set_toplevel(output->parent.shell_surface);
@@ -781,6 +978,7 @@ wayland_output_set_fullscreen(struct wayland_output *output,
 		(struct wayland_compositor *)output->base.compositor;
 
 	if (output->frame) {
+		wayland_output_destroy_decoration(output);
 		frame_destroy(output->frame);
 		output->frame = NULL;
 	}
@@ -1022,6 +1220,8 @@ wayland_output_create(struct wayland_compositor *c, int x, int y,
 
 	wl_list_init(&output->shm.buffers);
 	wl_list_init(&output->shm.free_buffers);
+	wl_list_init(&output->decoration.buffers);
+	wl_list_init(&output->decoration.free_buffers);
 
 	weston_output_init(&output->base, &c->base, x, y, width, height,
 			   transform, scale);
@@ -1772,6 +1972,10 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 		c->parent.compositor =
 			wl_registry_bind(registry, name,
 					 &wl_compositor_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		c->parent.subcompositor =
+			wl_registry_bind(registry, name,
+					 &wl_subcompositor_interface, 1);
 	} else if (strcmp(interface, "wl_shell") == 0) {
 		c->parent.shell =
 			wl_registry_bind(registry, name,
@@ -1845,6 +2049,8 @@ wayland_destroy(struct weston_compositor *ec)
 
 	if (c->parent.shm)
 		wl_shm_destroy(c->parent.shm);
+	if (c->parent.subcompositor)
+		wl_subcompositor_destroy(c->parent.subcompositor);
 
 	free(ec);
 }
@@ -40,6 +40,9 @@
 #ifdef HAVE_XCB_XKB
 #include <xcb/xkb.h>
 #endif
+#ifdef HAVE_XCB_PRESENT
+#include <xcb/present.h>
+#endif
 
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>
@@ -71,6 +74,8 @@ struct x11_compositor {
 	struct xkb_keymap	*xkb_keymap;
 	unsigned int		 has_xkb;
 	uint8_t			 xkb_event_base;
+	unsigned int		 has_present;
+	uint8_t			 present_opcode;
 	int			 use_pixman;
 
 	int			 has_net_wm_state_fullscreen;
@@ -107,12 +112,22 @@ struct x11_output {
 	struct weston_mode	mode;
 	struct wl_event_source *finish_frame_timer;
 
+	/* With Present, frames finish on the host's vblank, see
+	 * x11_output_schedule_frame().  present_feedback is for the frame
+	 * of the notify with present_serial. */
+	uint32_t		present_eid;
+	uint32_t		present_serial;
+	struct wl_list		present_feedback;
+
 	xcb_gc_t		gc;
 	xcb_shm_seg_t		segment;
 	pixman_image_t	       *hw_surface;
 	int			shm_id;
+	int			use_shm;
 	void		       *buf;
 	uint8_t			depth;
+	uint8_t			bpp;
+	uint8_t			scanline_pad;
 	int32_t                 scale;
 };
 
@@ -336,15 +351,59 @@ x11_input_destroy(struct x11_compositor *compositor)
 	weston_seat_release(&compositor->core_seat);
 }
 
+/* Ask for a CompleteNotify at the host's next vblank, or without the
+ * Present extension, guess that a frame takes 10 ms. */
 static void
-x11_output_start_repaint_loop(struct weston_output *output)
+x11_output_schedule_frame(struct x11_output *output)
 {
+	struct x11_compositor *c =
+		(struct x11_compositor *) output->base.compositor;
+
+#ifdef HAVE_XCB_PRESENT
+	if (c->has_present) {
+		xcb_present_notify_msc(c->conn, output->window,
+				       ++output->present_serial, 0, 1, 0);
+		xcb_flush(c->conn);
+		return;
+	}
+#endif
+
+	wl_event_source_timer_update(output->finish_frame_timer, 10);
+}
+
+static void
+x11_output_start_repaint_loop(struct weston_output *output_base)
+{
+	struct x11_output *output = (struct x11_output *) output_base;
+	struct x11_compositor *c =
+		(struct x11_compositor *) output->base.compositor;
 	uint32_t msec;
 	struct timeval tv;
 
+	/* Line the first repaint up with the host's vblank too */
+	if (c->has_present) {
+		x11_output_schedule_frame(output);
+		return;
+	}
+
 	gettimeofday(&tv, NULL);
 	msec = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	weston_output_finish_frame(output, msec);
+	weston_output_finish_frame(output_base, msec);
+}
+
+/* Presented from x11_compositor_present_complete() */
+static void
+x11_output_queue_feedback(struct x11_output *output)
+{
+	struct x11_compositor *c =
+		(struct x11_compositor *) output->base.compositor;
+
+	if (!c->has_present)
+		return;
+
+	wl_list_insert_list(&output->present_feedback,
+			    &output->base.feedback_list);
+	wl_list_init(&output->base.feedback_list);
 }
 
 static int
@@ -359,62 +418,81 @@ x11_output_repaint_gl(struct weston_output *output_base,
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	x11_output_queue_feedback(output);
+	x11_output_schedule_frame(output);
 	return 0;
 }
 
+/* Damage rectangles beyond this many are sent as their extents */
+#define X11_MAX_PUT_RECTS 16
+
+/* Send the rows y to y + height of the damage rectangle at x from the
+ * image without MIT-SHM, packed into scanlines of the server's padding. */
 static void
-set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+x11_output_put_rows(struct x11_compositor *c, struct x11_output *output,
+		    int x, int y, int width, int height)
 {
-	struct x11_output *output = (struct x11_output *)output_base;
-	struct weston_compositor *ec = output->base.compositor;
-	struct x11_compositor *c = (struct x11_compositor *)ec;
-	pixman_region32_t transformed_region;
-	pixman_box32_t *rects;
-	xcb_rectangle_t *output_rects;
-	xcb_void_cookie_t cookie;
-	int nrects, i;
-	xcb_generic_error_t *err;
+	int bytespp = output->bpp / 8;
+	int image_stride = pixman_image_get_stride(output->hw_surface);
+	int pad = output->scanline_pad / 8;
+	int stride = (width * bytespp + pad - 1) / pad * pad;
+	uint8_t *src = (uint8_t *) output->buf + y * image_stride + x * bytespp;
+	uint8_t *data;
+	int i;
+
+	if (stride == image_stride) {
+		data = src;
+	} else {
+		data = malloc(height * stride);
+		if (!data)
+			return;
+		for (i = 0; i < height; i++)
+			memcpy(data + i * stride, src + i * image_stride,
+			       width * bytespp);
+	}
 
-	pixman_region32_init(&transformed_region);
-	pixman_region32_copy(&transformed_region, region);
-	pixman_region32_translate(&transformed_region,
-				  -output_base->x, -output_base->y);
-	weston_transformed_region(output_base->width, output_base->height,
-				  output_base->transform,
-				  output_base->current_scale,
-				  &transformed_region, &transformed_region);
+	xcb_put_image(c->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, output->window,
+		      output->gc, width, height, x, y, 0, output->depth,
+		      height * stride, data);
 
-	rects = pixman_region32_rectangles(&transformed_region, &nrects);
-	output_rects = calloc(nrects, sizeof(xcb_rectangle_t));
+	if (data != src)
+		free(data);
+}
 
-	if (output_rects == NULL) {
-		pixman_region32_fini(&transformed_region);
+static void
+x11_output_put_rect(struct x11_compositor *c, struct x11_output *output,
+		    pixman_box32_t *rect)
+{
+	int width = rect->x2 - rect->x1;
+	int height = rect->y2 - rect->y1;
+	int pad = output->scanline_pad / 8;
+	int stride, rows, y;
+	uint32_t max_len;
+
+	if (output->use_shm) {
+		xcb_shm_put_image(c->conn, output->window, output->gc,
+				  pixman_image_get_width(output->hw_surface),
+				  pixman_image_get_height(output->hw_surface),
+				  rect->x1, rect->y1, width, height,
+				  rect->x1, rect->y1, output->depth,
+				  XCB_IMAGE_FORMAT_Z_PIXMAP,
+				  0, output->segment, 0);
 		return;
 	}
 
-	for (i = 0; i < nrects; i++) {
-		output_rects[i].x = rects[i].x1;
-		output_rects[i].y = rects[i].y1;
-		output_rects[i].width = rects[i].x2 - rects[i].x1;
-		output_rects[i].height = rects[i].y2 - rects[i].y1;
-	}
-
-	pixman_region32_fini(&transformed_region);
-
-	cookie = xcb_set_clip_rectangles_checked(c->conn, XCB_CLIP_ORDERING_UNSORTED,
-					output->gc,
-					0, 0, nrects,
-					output_rects);
-	err = xcb_request_check(c->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to set clip rects, err: %d\n", err->error_code);
-		free(err);
-	}
-	free(output_rects);
+	/* Split the rectangle so each request fits the server's limit,
+	 * leaving room for the request header */
+	stride = (width * output->bpp / 8 + pad - 1) / pad * pad;
+	max_len = xcb_get_maximum_request_length(c->conn) * 4 - 64;
+	rows = max_len / stride;
+	if (rows < 1)
+		rows = 1;
+
+	for (y = rect->y1; y < rect->y2; y += rows)
+		x11_output_put_rows(c, output, rect->x1, y, width,
+				    rows < rect->y2 - y ? rows : rect->y2 - y);
 }
 
-
 static int
 x11_output_repaint_shm(struct weston_output *output_base,
 		       pixman_region32_t *damage)
@@ -422,30 +500,42 @@ x11_output_repaint_shm(struct weston_output *output_base,
 	struct x11_output *output = (struct x11_output *)output_base;
 	struct weston_compositor *ec = output->base.compositor;
 	struct x11_compositor *c = (struct x11_compositor *)ec;
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
+	pixman_region32_t transformed_region;
+	pixman_box32_t *rects;
+	int nrects, i;
 
 	pixman_renderer_output_set_buffer(output_base, output->hw_surface);
 	ec->renderer->repaint_output(output_base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
-	set_clip_for_output(output_base, damage);
-	cookie = xcb_shm_put_image_checked(c->conn, output->window, output->gc,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0, output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
-					0, output->segment, 0);
-	err = xcb_request_check(c->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to put shm image, err: %d\n", err->error_code);
-		free(err);
+
+	/* Only send the damage, in window coordinates */
+	pixman_region32_init(&transformed_region);
+	pixman_region32_copy(&transformed_region, damage);
+	pixman_region32_translate(&transformed_region,
+				  -output_base->x, -output_base->y);
+	weston_transformed_region(output_base->width, output_base->height,
+				  output_base->transform,
+				  output_base->current_scale,
+				  &transformed_region, &transformed_region);
+
+	rects = pixman_region32_rectangles(&transformed_region, &nrects);
+	if (nrects > X11_MAX_PUT_RECTS) {
+		rects = pixman_region32_extents(&transformed_region);
+		nrects = 1;
 	}
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	for (i = 0; i < nrects; i++)
+		x11_output_put_rect(c, output, &rects[i]);
+
+	pixman_region32_fini(&transformed_region);
+
+	/* Errors come in as events, don't wait for them here */
+	xcb_flush(c->conn);
+
+	x11_output_queue_feedback(output);
+	x11_output_schedule_frame(output);
 	return 0;
 }
 
@@ -468,6 +558,11 @@ x11_output_deinit_shm(struct x11_compositor *c, struct x11_output *output)
 
 	pixman_image_unref(output->hw_surface);
 	output->hw_surface = NULL;
+	if (!output->use_shm) {
+		free(output->buf);
+		return;
+	}
+
 	cookie = xcb_shm_detach_checked(c->conn, output->segment);
 	err = xcb_request_check(c->conn, cookie);
 	if (err) {
@@ -485,6 +580,7 @@ x11_output_destroy(struct weston_output *output_base)
 		(struct x11_compositor *)output->base.compositor;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	weston_presentation_feedback_discard_list(&output->present_feedback);
 
 	if (compositor->use_pixman) {
 		pixman_renderer_output_destroy(output_base);
@@ -659,18 +755,9 @@ x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 	xcb_void_cookie_t cookie;
 	xcb_generic_error_t *err;
 	const xcb_query_extension_reply_t *ext;
-	int bitsperpixel = 0;
+	int bitsperpixel = 0, scanline_pad = 0;
 	pixman_format_code_t pixman_format;
 
-	/* Check if SHM is available */
-	ext = xcb_get_extension_data(c->conn, &xcb_shm_id);
-	if (ext == NULL || !ext->present) {
-		/* SHM is missing */
-		weston_log("SHM extension is not available\n");
-		errno = ENOENT;
-		return -1;
-	}
-
 	iter = xcb_setup_roots_iterator(xcb_get_setup(c->conn));
 	visual_type = find_visual_by_id(iter.data, iter.data->root_visual);
 	if (!visual_type) {
@@ -691,6 +778,7 @@ x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 	     xcb_format_next(&fmt)) {
 		if (fmt.data->depth == output->depth) {
 			bitsperpixel = fmt.data->bits_per_pixel;
+			scanline_pad = fmt.data->scanline_pad;
 			break;
 		}
 	}
@@ -715,6 +803,17 @@ x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 		return -1;
 	}
 
+	output->bpp = bitsperpixel;
+	output->scanline_pad = scanline_pad ? scanline_pad : 32;
+
+	/* SHM only works with a local server; with a remote one the
+	 * damage is sent with plain put image requests. */
+	ext = xcb_get_extension_data(c->conn, &xcb_shm_id);
+	if (ext == NULL || !ext->present) {
+		weston_log("SHM extension is not available, "
+			   "sending images over the connection\n");
+		goto no_shm;
+	}
 
 	/* Create SHM segment and attach it */
 	output->shm_id = shmget(IPC_PRIVATE, width * height * (bitsperpixel / 8), IPC_CREAT | S_IRWXU);
@@ -725,18 +824,31 @@ x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 	output->buf = shmat(output->shm_id, NULL, 0 /* read/write */);
 	if (-1 == (long)output->buf) {
 		weston_log("x11shm: failed to attach SHM segment\n");
+		shmctl(output->shm_id, IPC_RMID, NULL);
 		return -1;
 	}
 	output->segment = xcb_generate_id(c->conn);
 	cookie = xcb_shm_attach_checked(c->conn, output->segment, output->shm_id, 1);
 	err = xcb_request_check(c->conn, cookie);
+	shmctl(output->shm_id, IPC_RMID, NULL);
 	if (err) {
-		weston_log("x11shm: xcb_shm_attach error %d\n", err->error_code);
+		weston_log("x11shm: xcb_shm_attach error %d, "
+			   "sending images over the connection\n",
+			   err->error_code);
 		free(err);
-		return -1;
+		shmdt(output->buf);
+		goto no_shm;
 	}
 
-	shmctl(output->shm_id, IPC_RMID, NULL);
+	output->use_shm = 1;
+	goto create_image;
+
+no_shm:
+	output->buf = malloc(width * height * (bitsperpixel / 8));
+	if (!output->buf)
+		return -1;
+
+create_image:
 
 	/* Now create pixman image */
 	output->hw_surface = pixman_image_create_bits(pixman_format, width, height, output->buf,
@@ -888,7 +1000,8 @@ x11_compositor_create_output(struct x11_compositor *c, int x, int y,
 					output->mode.width,
 					output->mode.height) < 0)
 			return NULL;
-		if (pixman_renderer_output_create(&output->base) < 0) {
+		if (pixman_renderer_output_create(&output->base,
+						  PIXMAN_RENDERER_OUTPUT_USE_SHADOW) < 0) {
 			x11_output_deinit_shm(c, output);
 			return NULL;
 		}
@@ -905,6 +1018,16 @@ x11_compositor_create_output(struct x11_compositor *c, int x, int y,
 	output->finish_frame_timer =
 		wl_event_loop_add_timer(loop, finish_frame_handler, output);
 
+	wl_list_init(&output->present_feedback);
+#ifdef HAVE_XCB_PRESENT
+	if (c->has_present) {
+		output->present_eid = xcb_generate_id(c->conn);
+		xcb_present_select_input(c->conn, output->present_eid,
+					 output->window,
+					 XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+	}
+#endif
+
 	wl_list_insert(c->base.output_list.prev, &output->base.link);
 
 	weston_log("x11 output %dx%d, window id %d\n",
@@ -913,6 +1036,45 @@ x11_compositor_create_output(struct x11_compositor *c, int x, int y,
 	return output;
 }
 
+static void
+x11_compositor_setup_present(struct x11_compositor *c)
+{
+#ifndef HAVE_XCB_PRESENT
+	weston_log("XCB-Present not available during build, "
+		   "frame timing is estimated\n");
+	c->has_present = 0;
+#else
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_cookie_t cookie;
+	xcb_present_query_version_reply_t *reply;
+
+	c->has_present = 0;
+
+	ext = xcb_get_extension_data(c->conn, &xcb_present_id);
+	if (!ext || !ext->present) {
+		weston_log("Present extension not available on host X11 "
+			   "server, frame timing is estimated\n");
+		return;
+	}
+
+	cookie = xcb_present_query_version(c->conn,
+					   XCB_PRESENT_MAJOR_VERSION,
+					   XCB_PRESENT_MINOR_VERSION);
+	reply = xcb_present_query_version_reply(c->conn, cookie, NULL);
+	if (!reply) {
+		weston_log("couldn't start using the Present extension\n");
+		return;
+	}
+	free(reply);
+
+	c->present_opcode = ext->major_opcode;
+	c->has_present = 1;
+
+	/* The host reports UST on CLOCK_MONOTONIC, in microseconds */
+	c->base.presentation_clock = CLOCK_MONOTONIC;
+#endif
+}
+
 static struct x11_output *
 x11_compositor_find_output(struct x11_compositor *c, xcb_window_t window)
 {
@@ -926,6 +1088,33 @@ x11_compositor_find_output(struct x11_compositor *c, xcb_window_t window)
 	assert(0);
 }
 
+#ifdef HAVE_XCB_PRESENT
+static void
+x11_compositor_present_complete(struct x11_compositor *c,
+				xcb_present_complete_notify_event_t *notify)
+{
+	struct x11_output *output;
+	struct timespec ts;
+
+	output = x11_compositor_find_output(c, notify->window);
+
+	/* Superseded by a later notify, e.g. after a repaint failed */
+	if (notify->serial != output->present_serial)
+		return;
+
+	ts.tv_sec = notify->ust / 1000000;
+	ts.tv_nsec = (notify->ust % 1000000) * 1000;
+	output->base.msc = notify->msc;
+	weston_presentation_feedback_present_list(
+				&output->present_feedback, &output->base,
+				&ts, notify->msc,
+				PRESENTATION_FEEDBACK_KIND_VSYNC |
+				PRESENTATION_FEEDBACK_KIND_HW_CLOCK);
+
+	weston_output_finish_frame(&output->base, notify->ust / 1000);
+}
+#endif
+
 static void
 x11_compositor_delete_window(struct x11_compositor *c, xcb_window_t window)
 {
@@ -1138,6 +1327,9 @@ x11_compositor_handle_event(int fd, uint32_t mask, void *data)
 	xcb_keymap_notify_event_t *keymap_notify;
 	xcb_focus_in_event_t *focus_in;
 	xcb_expose_event_t *expose;
+#ifdef HAVE_XCB_PRESENT
+	xcb_ge_generic_event_t *ge;
+#endif
 	xcb_atom_t atom;
 	xcb_window_t window;
 	uint32_t *k;
@@ -1252,6 +1444,17 @@ x11_compositor_handle_event(int fd, uint32_t mask, void *data)
 			weston_output_schedule_repaint(&output->base);
 			break;
 
+#ifdef HAVE_XCB_PRESENT
+		case XCB_GE_GENERIC:
+			ge = (xcb_ge_generic_event_t *) event;
+			if (c->has_present &&
+			    ge->extension == c->present_opcode &&
+			    ge->event_type == XCB_PRESENT_EVENT_COMPLETE_NOTIFY)
+				x11_compositor_present_complete(c,
+					(xcb_present_complete_notify_event_t *) event);
+			break;
+#endif
+
 		case XCB_ENTER_NOTIFY:
 			x11_compositor_deliver_enter_event(c, event);
 			break;
@@ -1515,6 +1718,7 @@ x11_compositor_create(struct wl_display *display,
 
 	x11_compositor_get_resources(c);
 	x11_compositor_get_wm_info(c);
+	x11_compositor_setup_present(c);
 
 	if (!c->has_net_wm_state_fullscreen && fullscreen) {
 		weston_log("Can not fullscreen without window manager support"
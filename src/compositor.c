@@ -54,6 +54,9 @@
 
 #include "compositor.h"
 #include "scaler-server-protocol.h"
+#include "presentation_timing-server-protocol.h"
+#include "linux-explicit-synchronization.h"
+#include "weston-sdt.h"
 #include "../shared/os-compatibility.h"
 #include "git-version.h"
 #include "version.h"
@@ -95,6 +98,9 @@ weston_output_transform_scale_init(struct weston_output *output,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor);
 
+static void
+pick_grid_dirty(struct weston_compositor *compositor);
+
 WL_EXPORT int
 weston_output_switch_mode(struct weston_output *output, struct weston_mode *mode,
 		int32_t scale, enum weston_mode_switch_op op)
@@ -177,6 +183,7 @@ weston_output_switch_mode(struct weston_output *output, struct weston_mode *mode
 				  output->width, output->height);
 
 	weston_output_update_matrix(output);
+	pick_grid_dirty(output->compositor);
 
 	/* If a pointer falls outside the outputs new geometry, move it to its
 	 * lower-right corner */
@@ -343,15 +350,187 @@ region_init_infinite(pixman_region32_t *region)
 				  UINT32_MAX, UINT32_MAX);
 }
 
+static void
+region_swap(pixman_region32_t *a, pixman_region32_t *b)
+{
+	pixman_region32_t tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/* Moves the damage in src over to dst, leaving src empty. */
+static void
+region_move_union(pixman_region32_t *dst, pixman_region32_t *src)
+{
+	if (!pixman_region32_not_empty(src))
+		return;
+
+	if (!pixman_region32_not_empty(dst)) {
+		region_swap(dst, src);
+		return;
+	}
+
+	pixman_region32_union(dst, dst, src);
+	empty_region(src);
+}
+
+/* Sets dst to src clipped to the surface size, returns whether dst
+ * changed. Regions of at most one rectangle, which opaque and input
+ * regions usually are, are handled on their extents. */
+static int
+region_update_clipped(pixman_region32_t *dst, pixman_region32_t *src,
+		      int32_t width, int32_t height)
+{
+	pixman_region32_t clipped;
+	pixman_box32_t *e, box;
+	int changed;
+
+	if (pixman_region32_n_rects(src) <= 1 &&
+	    pixman_region32_n_rects(dst) <= 1) {
+		e = pixman_region32_extents(src);
+		box.x1 = e->x1 > 0 ? e->x1 : 0;
+		box.y1 = e->y1 > 0 ? e->y1 : 0;
+		box.x2 = e->x2 < width ? e->x2 : width;
+		box.y2 = e->y2 < height ? e->y2 : height;
+
+		if (box.x1 >= box.x2 || box.y1 >= box.y2) {
+			if (!pixman_region32_not_empty(dst))
+				return 0;
+			empty_region(dst);
+			return 1;
+		}
+
+		e = pixman_region32_extents(dst);
+		if (pixman_region32_not_empty(dst) &&
+		    e->x1 == box.x1 && e->y1 == box.y1 &&
+		    e->x2 == box.x2 && e->y2 == box.y2)
+			return 0;
+
+		pixman_region32_fini(dst);
+		pixman_region32_init_rect(dst, box.x1, box.y1,
+					  box.x2 - box.x1, box.y2 - box.y1);
+		return 1;
+	}
+
+	pixman_region32_init_rect(&clipped, 0, 0, width, height);
+	pixman_region32_intersect(&clipped, &clipped, src);
+
+	changed = !pixman_region32_equal(&clipped, dst);
+	if (changed)
+		pixman_region32_copy(dst, &clipped);
+
+	pixman_region32_fini(&clipped);
+
+	return changed;
+}
+
 static struct weston_subsurface *
 weston_surface_to_subsurface(struct weston_surface *surface);
 
+/* Free lists for the objects clients create and destroy all the time.
+ * They are process wide rather than per compositor: client resources,
+ * and with them surfaces and frame callbacks, are destroyed after the
+ * compositor at shutdown. */
+struct object_pool {
+	const char *name;
+	size_t size;
+	uint32_t max_free;
+	void *free_list;	/* linked through the first word */
+	uint32_t free_count;
+	uint32_t live;
+	uint32_t allocated;	/* from malloc, ever */
+	uint32_t reused;	/* from free_list, ever */
+};
+
+struct weston_frame_callback {
+	struct wl_resource *resource;
+	struct wl_list link;
+};
+
+struct weston_presentation_feedback {
+	struct wl_resource *resource;
+	struct wl_list link;
+	uint32_t psf_flags;	/* set when the surface is repainted */
+};
+
+static struct object_pool view_pool = {
+	"view", sizeof(struct weston_view), 64
+};
+static struct object_pool surface_pool = {
+	"surface", sizeof(struct weston_surface), 32
+};
+static struct object_pool frame_callback_pool = {
+	"frame callback", sizeof(struct weston_frame_callback), 256
+};
+
+static void *
+object_pool_alloc(struct object_pool *pool)
+{
+	void *object;
+
+	if (pool->free_list) {
+		object = pool->free_list;
+		pool->free_list = *(void **) object;
+		pool->free_count--;
+		pool->reused++;
+		memset(object, 0, pool->size);
+	} else {
+		object = calloc(1, pool->size);
+		if (object == NULL)
+			return NULL;
+		pool->allocated++;
+	}
+
+	pool->live++;
+
+	return object;
+}
+
+static void
+object_pool_free(struct object_pool *pool, void *object)
+{
+	pool->live--;
+
+	if (pool->free_count >= pool->max_free) {
+		free(object);
+		return;
+	}
+
+	*(void **) object = pool->free_list;
+	pool->free_list = object;
+	pool->free_count++;
+}
+
+static void
+object_pool_log(struct object_pool *pool)
+{
+	weston_log("%s pool: %u live, %u cached, %u allocated, %u reused\n",
+		   pool->name, pool->live, pool->free_count,
+		   pool->allocated, pool->reused);
+}
+
+WL_EXPORT void
+weston_log_object_pools(void)
+{
+	object_pool_log(&surface_pool);
+	object_pool_log(&view_pool);
+	object_pool_log(&frame_callback_pool);
+}
+
+static void
+object_pool_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		    void *data)
+{
+	weston_log_object_pools();
+}
+
 WL_EXPORT struct weston_view *
 weston_view_create(struct weston_surface *surface)
 {
 	struct weston_view *view;
 
-	view = calloc(1, sizeof *view);
+	view = object_pool_alloc(&view_pool);
 	if (view == NULL)
 		return NULL;
 
@@ -365,6 +544,10 @@ weston_view_create(struct weston_surface *surface)
 	wl_list_init(&view->layer_link);
 
 	view->plane = NULL;
+	view->plane_hint = 0;
+	view->colorkey_enabled = 0;
+	view->colorkey = 0;
+	view->cache_group = 0;
 
 	pixman_region32_init(&view->clip);
 
@@ -381,6 +564,8 @@ weston_view_create(struct weston_surface *surface)
 
 	view->output = NULL;
 
+	weston_client_stats_view(view, 1);
+
 	return view;
 }
 
@@ -389,7 +574,7 @@ weston_surface_create(struct weston_compositor *compositor)
 {
 	struct weston_surface *surface;
 
-	surface = calloc(1, sizeof *surface);
+	surface = object_pool_alloc(&surface_pool);
 	if (surface == NULL)
 		return NULL;
 
@@ -417,6 +602,8 @@ weston_surface_create(struct weston_compositor *compositor)
 	wl_list_init(&surface->views);
 
 	wl_list_init(&surface->frame_callback_list);
+	wl_list_init(&surface->feedback_list);
+	surface->acquire_fence_fd = -1;
 
 	surface->pending.buffer_destroy_listener.notify =
 		surface_handle_pending_buffer_destroy;
@@ -424,10 +611,14 @@ weston_surface_create(struct weston_compositor *compositor)
 	pixman_region32_init(&surface->pending.opaque);
 	region_init_infinite(&surface->pending.input);
 	wl_list_init(&surface->pending.frame_callback_list);
+	wl_list_init(&surface->pending.feedback_list);
+	surface->pending.acquire_fence_fd = -1;
 
 	wl_list_init(&surface->subsurface_list);
 	wl_list_init(&surface->subsurface_list_pending);
 
+	wl_list_init(&surface->client_stats_link);
+
 	return surface;
 }
 
@@ -438,6 +629,18 @@ weston_surface_set_color(struct weston_surface *surface,
 	surface->compositor->renderer->surface_set_color(surface, red, green, blue, alpha);
 }
 
+/* A hint for surfaces shown much smaller than their size for a while,
+ * as in window overviews; renderers without thumbnails ignore it. */
+WL_EXPORT void
+weston_surface_set_thumbnail_size(struct weston_surface *surface,
+				  int32_t width, int32_t height)
+{
+	struct weston_renderer *renderer = surface->compositor->renderer;
+
+	if (renderer->surface_set_thumbnail_size)
+		renderer->surface_set_thumbnail_size(surface, width, height);
+}
+
 WL_EXPORT void
 weston_view_to_global_float(struct weston_view *view,
 			    float sx, float sy, float *x, float *y)
@@ -636,6 +839,96 @@ weston_transformed_region(int width, int height,
 	free(dest_rects);
 }
 
+static int64_t
+box_area(const pixman_box32_t *box)
+{
+	return (int64_t) (box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static int64_t
+box_merge_waste(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	pixman_box32_t u;
+
+	u.x1 = MIN(a->x1, b->x1);
+	u.y1 = MIN(a->y1, b->y1);
+	u.x2 = MAX(a->x2, b->x2);
+	u.y2 = MAX(a->y2, b->y2);
+
+	return box_area(&u) - box_area(a) - box_area(b);
+}
+
+/* Below this many pixels, covering more is cheaper than another box
+ * whatever the damage area is. */
+#define REGION_SIMPLIFY_MIN_WASTE (64 * 64)
+
+/** Trade a little area for fewer boxes
+ *
+ * \param region The region to simplify, grown in place.
+ * \param max_boxes The number of boxes to get down to.
+ * \param max_waste_percent How much area may be added, relative to the
+ * area of the region.
+ *
+ * Neighbouring boxes, in the region's band order, are merged into their
+ * bounding box, the pair adding the least area first, until at most
+ * max_boxes are left or the next merge would take the added area over
+ * the budget.  The result always contains the original region, so it
+ * is fit for damage, not for opaque or input regions.
+ *
+ * Overlapping merged boxes are banded again by pixman, so the result
+ * can have a few more boxes than max_boxes.
+ */
+WL_EXPORT void
+weston_region_simplify(pixman_region32_t *region, int max_boxes,
+		       int max_waste_percent)
+{
+	pixman_box32_t *rects, *boxes;
+	int64_t area = 0, waste = 0, budget, cost, best_cost;
+	int n, i, best;
+
+	rects = pixman_region32_rectangles(region, &n);
+	if (n <= max_boxes)
+		return;
+
+	boxes = malloc(n * sizeof *boxes);
+	if (!boxes)
+		return;
+	memcpy(boxes, rects, n * sizeof *boxes);
+
+	for (i = 0; i < n; i++)
+		area += box_area(&boxes[i]);
+	budget = MAX(area * max_waste_percent / 100,
+		     REGION_SIMPLIFY_MIN_WASTE);
+
+	while (n > max_boxes) {
+		best = 0;
+		best_cost = box_merge_waste(&boxes[0], &boxes[1]);
+		for (i = 1; i < n - 1; i++) {
+			cost = box_merge_waste(&boxes[i], &boxes[i + 1]);
+			if (cost < best_cost) {
+				best_cost = cost;
+				best = i;
+			}
+		}
+
+		if (waste + best_cost > budget)
+			break;
+		waste += MAX(best_cost, 0);
+
+		boxes[best].x1 = MIN(boxes[best].x1, boxes[best + 1].x1);
+		boxes[best].y1 = MIN(boxes[best].y1, boxes[best + 1].y1);
+		boxes[best].x2 = MAX(boxes[best].x2, boxes[best + 1].x2);
+		boxes[best].y2 = MAX(boxes[best].y2, boxes[best + 1].y2);
+		memmove(&boxes[best + 1], &boxes[best + 2],
+			(n - best - 2) * sizeof *boxes);
+		n--;
+	}
+
+	pixman_region32_fini(region);
+	pixman_region32_init_rects(region, boxes, n);
+	free(boxes);
+}
+
 static void
 scaler_surface_to_buffer(struct weston_surface *surface,
 			 float sx, float sy, float *bx, float *by)
@@ -843,6 +1136,8 @@ weston_view_assign_output(struct weston_view *ev)
 	pixman_region32_fini(&region);
 
 	ev->output = new_output;
+	if (ev->output_mask != mask)
+		ec->output_views_dirty = 1;
 	ev->output_mask = mask;
 
 	weston_surface_assign_output(ev->surface);
@@ -915,7 +1210,7 @@ weston_view_update_transform_disable(struct weston_view *view)
 				  view->surface->width,
 				  view->surface->height);
 
-	if (view->alpha == 1.0) {
+	if (view->alpha == 1.0 && !view->colorkey_enabled) {
 		pixman_region32_copy(&view->transform.opaque,
 				     &view->surface->opaque);
 		pixman_region32_translate(&view->transform.opaque,
@@ -924,6 +1219,47 @@ weston_view_update_transform_disable(struct weston_view *view)
 	}
 }
 
+/* Rotations by 0 degrees and scales by 1 compose into a plain
+ * translation, so check the values rather than the matrix type. */
+static int
+matrix_is_translation(const struct weston_matrix *m)
+{
+	return m->d[0] == 1.0f && m->d[1] == 0.0f && m->d[2] == 0.0f &&
+	       m->d[3] == 0.0f && m->d[4] == 0.0f && m->d[5] == 1.0f &&
+	       m->d[6] == 0.0f && m->d[7] == 0.0f && m->d[8] == 0.0f &&
+	       m->d[9] == 0.0f && m->d[10] == 1.0f && m->d[11] == 0.0f &&
+	       m->d[15] == 1.0f;
+}
+
+static void
+weston_view_update_transform_translate(struct weston_view *view)
+{
+	struct weston_matrix *matrix = &view->transform.matrix;
+	struct weston_matrix *inverse = &view->transform.inverse;
+	float x1, y1, x2, y2;
+
+	matrix->type = WESTON_MATRIX_TRANSFORM_TRANSLATE;
+
+	*inverse = *matrix;
+	inverse->d[12] = -matrix->d[12];
+	inverse->d[13] = -matrix->d[13];
+	inverse->d[14] = -matrix->d[14];
+
+	if (view->surface->width == 0 || view->surface->height == 0) {
+		pixman_region32_init(&view->transform.boundingbox);
+		return;
+	}
+
+	/* what view_compute_bbox() would produce, minus the four
+	 * corner transformations */
+	x1 = floorf(matrix->d[12]);
+	y1 = floorf(matrix->d[13]);
+	x2 = ceilf(matrix->d[12] + view->surface->width);
+	y2 = ceilf(matrix->d[13] + view->surface->height);
+	pixman_region32_init_rect(&view->transform.boundingbox,
+				  x1, y1, x2 - x1, y2 - y1);
+}
+
 static int
 weston_view_update_transform_enable(struct weston_view *view)
 {
@@ -943,9 +1279,15 @@ weston_view_update_transform_enable(struct weston_view *view)
 	wl_list_for_each(tform, &view->geometry.transformation_list, link)
 		weston_matrix_multiply(matrix, &tform->matrix);
 
+	/* The parent's matrix is already composed all the way up. */
 	if (parent)
 		weston_matrix_multiply(matrix, &parent->transform.matrix);
 
+	if (matrix_is_translation(matrix)) {
+		weston_view_update_transform_translate(view);
+		return 0;
+	}
+
 	if (weston_matrix_invert(inverse, matrix) < 0) {
 		/* Oops, bad total transformation, not invertible */
 		weston_log("error: weston_view %p"
@@ -960,9 +1302,24 @@ weston_view_update_transform_enable(struct weston_view *view)
 	return 0;
 }
 
+static void
+weston_view_update_pick_offset(struct weston_view *view)
+{
+	struct weston_matrix *matrix = &view->transform.matrix;
+	float tx = matrix->d[12], ty = matrix->d[13];
+
+	view->transform.translate_only =
+		matrix->type == WESTON_MATRIX_TRANSFORM_TRANSLATE &&
+		tx == floorf(tx) && ty == floorf(ty) &&
+		fabsf(tx) < (1 << 22) && fabsf(ty) < (1 << 22);
+	view->transform.tx = tx;
+	view->transform.ty = ty;
+}
+
 WL_EXPORT void
 weston_view_update_transform(struct weston_view *view)
 {
+	static uint32_t transform_serial;
 	struct weston_view *parent = view->geometry.parent;
 
 	if (!view->transform.dirty)
@@ -991,9 +1348,16 @@ weston_view_update_transform(struct weston_view *view)
 			weston_view_update_transform_disable(view);
 	}
 
+	weston_view_update_pick_offset(view);
+
+	if (++transform_serial == 0)
+		transform_serial = 1;
+	view->transform.serial = transform_serial;
+
 	weston_view_damage_below(view);
 
 	weston_view_assign_output(view);
+	pick_grid_dirty(view->surface->compositor);
 
 	wl_signal_emit(&view->surface->compositor->transform_signal,
 		       view->surface);
@@ -1015,6 +1379,7 @@ weston_view_geometry_dirty(struct weston_view *view)
 		return;
 
 	view->transform.dirty = 1;
+	pick_grid_dirty(view->surface->compositor);
 
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link)
@@ -1257,6 +1622,61 @@ weston_surface_set_size_from_buffer(struct weston_surface *surface)
 	surface_set_size(surface, width, height);
 }
 
+/* The shell's crop goes in as a wl_viewport source would, so that the
+ * renderers and the plane assignment honour it as they do the client's.
+ * A source the client set itself wins. */
+static int
+surface_shell_crop_viewport(struct weston_surface *surface,
+			    struct weston_buffer_viewport *vp)
+{
+	if (surface->shell_crop.width <= 0 ||
+	    vp->buffer.src_width != wl_fixed_from_int(-1))
+		return 0;
+
+	vp->buffer.src_x = wl_fixed_from_int(surface->shell_crop.x);
+	vp->buffer.src_y = wl_fixed_from_int(surface->shell_crop.y);
+	vp->buffer.src_width = wl_fixed_from_int(surface->shell_crop.width);
+	vp->buffer.src_height = wl_fixed_from_int(surface->shell_crop.height);
+
+	return 1;
+}
+
+/* Show only the given rectangle of the surface's buffer, in buffer
+ * coordinates after buffer transform and scale; the surface takes its
+ * size.  A width or height <= 0 removes the crop. */
+WL_EXPORT void
+weston_surface_set_shell_crop(struct weston_surface *surface,
+			      int32_t x, int32_t y,
+			      int32_t width, int32_t height)
+{
+	struct weston_buffer_viewport *vp = &surface->buffer_viewport;
+
+	if (width <= 0 || height <= 0)
+		width = height = 0;
+
+	if (surface->shell_crop.x == x && surface->shell_crop.y == y &&
+	    surface->shell_crop.width == width &&
+	    surface->shell_crop.height == height)
+		return;
+
+	surface->shell_crop.x = x;
+	surface->shell_crop.y = y;
+	surface->shell_crop.width = width;
+	surface->shell_crop.height = height;
+
+	if (!surface->shell_crop.applied &&
+	    vp->buffer.src_width != wl_fixed_from_int(-1))
+		return;
+
+	vp->buffer.src_width = wl_fixed_from_int(-1);
+	surface->shell_crop.applied = surface_shell_crop_viewport(surface, vp);
+
+	if (surface->buffer_ref.buffer) {
+		weston_surface_set_size_from_buffer(surface);
+		weston_surface_damage(surface);
+	}
+}
+
 WL_EXPORT uint32_t
 weston_compositor_get_time(void)
 {
@@ -1267,19 +1687,254 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+/* Picking uses a uniform grid over the output space. Each cell lists,
+ * top to bottom, the views whose bounding box touches it. A cell whose
+ * area is completely inside the input region of a view that is only
+ * translated is closed by that view: nothing below it can be hit there.
+ */
+#define PICK_GRID_CELL_SHIFT	7
+#define PICK_GRID_CELL_SIZE	(1 << PICK_GRID_CELL_SHIFT)
+
+struct weston_pick_grid_cell {
+	struct wl_array views;	/* struct weston_view * */
+	int closed;
+};
+
+static void
+pick_grid_dirty(struct weston_compositor *compositor)
+{
+	compositor->pick_grid.dirty = 1;
+}
+
+static int
+view_input_is_bounded(struct weston_view *view)
+{
+	struct weston_surface *surface = view->surface;
+	pixman_box32_t *e = pixman_region32_extents(&surface->input);
+
+	return e->x1 >= 0 && e->y1 >= 0 &&
+	       e->x2 <= surface->width && e->y2 <= surface->height;
+}
+
+static int
+view_input_covers_box(struct weston_view *view, pixman_box32_t *box)
+{
+	pixman_box32_t local;
+
+	if (!view->transform.translate_only)
+		return 0;
+
+	local.x1 = box->x1 - view->transform.tx;
+	local.y1 = box->y1 - view->transform.ty;
+	local.x2 = box->x2 - view->transform.tx;
+	local.y2 = box->y2 - view->transform.ty;
+
+	return pixman_region32_contains_rectangle(&view->surface->input,
+						  &local) == PIXMAN_REGION_IN;
+}
+
+static void
+pick_grid_add_view(struct weston_compositor *compositor,
+		   struct weston_view *view)
+{
+	struct weston_view **entry;
+	struct weston_pick_grid_cell *cell;
+	pixman_region32_t bbox;
+	pixman_box32_t *e, box;
+	int bounded, x1, y1, x2, y2, i, j;
+
+	if (!pixman_region32_not_empty(&view->surface->input))
+		return;
+
+	bounded = view_input_is_bounded(view);
+	if (bounded) {
+		/* Picking truncates the view-local coordinates, which can
+		 * land up to one unit away from the surface edge. */
+		view_compute_bbox(view, -1, -1,
+				  view->surface->width + 2,
+				  view->surface->height + 2, &bbox);
+		e = pixman_region32_extents(&bbox);
+		x1 = (e->x1 - compositor->pick_grid.x) >> PICK_GRID_CELL_SHIFT;
+		y1 = (e->y1 - compositor->pick_grid.y) >> PICK_GRID_CELL_SHIFT;
+		x2 = (e->x2 - compositor->pick_grid.x) >> PICK_GRID_CELL_SHIFT;
+		y2 = (e->y2 - compositor->pick_grid.y) >> PICK_GRID_CELL_SHIFT;
+		pixman_region32_fini(&bbox);
+
+		if (x1 < 0)
+			x1 = 0;
+		if (y1 < 0)
+			y1 = 0;
+		if (x2 >= compositor->pick_grid.width)
+			x2 = compositor->pick_grid.width - 1;
+		if (y2 >= compositor->pick_grid.height)
+			y2 = compositor->pick_grid.height - 1;
+	} else {
+		x1 = 0;
+		y1 = 0;
+		x2 = compositor->pick_grid.width - 1;
+		y2 = compositor->pick_grid.height - 1;
+	}
+
+	for (j = y1; j <= y2; j++) {
+		for (i = x1; i <= x2; i++) {
+			cell = &compositor->pick_grid.cells[
+				j * compositor->pick_grid.width + i];
+			if (cell->closed)
+				continue;
+
+			entry = wl_array_add(&cell->views, sizeof *entry);
+			if (!entry) {
+				/* keep the grid usable, just degraded */
+				cell->closed = 1;
+				continue;
+			}
+			*entry = view;
+
+			box.x1 = compositor->pick_grid.x +
+				(i << PICK_GRID_CELL_SHIFT);
+			box.y1 = compositor->pick_grid.y +
+				(j << PICK_GRID_CELL_SHIFT);
+			box.x2 = box.x1 + PICK_GRID_CELL_SIZE;
+			box.y2 = box.y1 + PICK_GRID_CELL_SIZE;
+			if (bounded && view_input_covers_box(view, &box))
+				cell->closed = 1;
+		}
+	}
+}
+
+static void
+pick_grid_update(struct weston_compositor *compositor)
+{
+	struct weston_pick_grid_cell *cells;
+	struct weston_output *output;
+	struct weston_view *view;
+	int32_t x1 = INT32_MAX, y1 = INT32_MAX;
+	int32_t x2 = INT32_MIN, y2 = INT32_MIN;
+	int i, count;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output->x < x1)
+			x1 = output->x;
+		if (output->y < y1)
+			y1 = output->y;
+		if (output->x + output->width > x2)
+			x2 = output->x + output->width;
+		if (output->y + output->height > y2)
+			y2 = output->y + output->height;
+	}
+
+	if (x1 >= x2 || y1 >= y2) {
+		compositor->pick_grid.width = 0;
+		compositor->pick_grid.height = 0;
+		compositor->pick_grid.dirty = 0;
+		return;
+	}
+
+	compositor->pick_grid.x = x1;
+	compositor->pick_grid.y = y1;
+	compositor->pick_grid.width =
+		(x2 - x1 + PICK_GRID_CELL_SIZE - 1) >> PICK_GRID_CELL_SHIFT;
+	compositor->pick_grid.height =
+		(y2 - y1 + PICK_GRID_CELL_SIZE - 1) >> PICK_GRID_CELL_SHIFT;
+	count = compositor->pick_grid.width * compositor->pick_grid.height;
+
+	if (count > compositor->pick_grid.cells_allocated) {
+		cells = realloc(compositor->pick_grid.cells,
+				count * sizeof *cells);
+		if (!cells) {
+			compositor->pick_grid.width = 0;
+			compositor->pick_grid.height = 0;
+			return;
+		}
+
+		for (i = compositor->pick_grid.cells_allocated; i < count; i++)
+			wl_array_init(&cells[i].views);
+
+		compositor->pick_grid.cells = cells;
+		compositor->pick_grid.cells_allocated = count;
+	}
+
+	for (i = 0; i < count; i++) {
+		compositor->pick_grid.cells[i].views.size = 0;
+		compositor->pick_grid.cells[i].closed = 0;
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		pick_grid_add_view(compositor, view);
+
+	compositor->pick_grid.dirty = 0;
+}
+
+static void
+pick_grid_release(struct weston_compositor *compositor)
+{
+	int i;
+
+	for (i = 0; i < compositor->pick_grid.cells_allocated; i++)
+		wl_array_release(&compositor->pick_grid.cells[i].views);
+
+	free(compositor->pick_grid.cells);
+	compositor->pick_grid.cells = NULL;
+	compositor->pick_grid.cells_allocated = 0;
+}
+
+static int
+view_pick(struct weston_view *view, wl_fixed_t x, wl_fixed_t y,
+	  wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	/* Same result as the float path for whole pixel offsets, minus
+	 * the conversions and the matrix multiply per candidate. */
+	if (view->transform.translate_only) {
+		*vx = x - wl_fixed_from_int(view->transform.tx);
+		*vy = y - wl_fixed_from_int(view->transform.ty);
+	} else {
+		weston_view_from_global_fixed(view, x, y, vx, vy);
+	}
+
+	return pixman_region32_contains_point(&view->surface->input,
+					      wl_fixed_to_int(*vx),
+					      wl_fixed_to_int(*vy),
+					      NULL);
+}
+
 WL_EXPORT struct weston_view *
 weston_compositor_pick_view(struct weston_compositor *compositor,
 			    wl_fixed_t x, wl_fixed_t y,
 			    wl_fixed_t *vx, wl_fixed_t *vy)
 {
-	struct weston_view *view;
+	struct weston_pick_grid_cell *cell;
+	struct weston_view *view, **entry;
+	int i, j;
+
+	if (compositor->pick_grid.dirty)
+		pick_grid_update(compositor);
+
+	/* wl_fixed_t is 24.8, shifting floors also negative values */
+	i = ((x >> 8) - compositor->pick_grid.x) >> PICK_GRID_CELL_SHIFT;
+	j = ((y >> 8) - compositor->pick_grid.y) >> PICK_GRID_CELL_SHIFT;
+
+	if (i >= 0 && i < compositor->pick_grid.width &&
+	    j >= 0 && j < compositor->pick_grid.height) {
+		cell = &compositor->pick_grid.cells[
+			j * compositor->pick_grid.width + i];
+
+		/* The view that was hit last time is usually the top
+		 * entry in its cell, so it gets tested first. */
+		wl_array_for_each(entry, &cell->views) {
+			if (view_pick(*entry, x, y, vx, vy))
+				return *entry;
+		}
+
+		if (!cell->closed)
+			return NULL;
+
+		/* The closing view lost its input region since the grid
+		 * was built; fall back to walking the whole list. */
+		pick_grid_dirty(compositor);
+	}
 
 	wl_list_for_each(view, &compositor->view_list, link) {
-		weston_view_from_global_fixed(view, x, y, vx, vy);
-		if (pixman_region32_contains_point(&view->surface->input,
-						   wl_fixed_to_int(*vx),
-						   wl_fixed_to_int(*vy),
-						   NULL))
+		if (view_pick(view, x, y, vx, vy))
 			return view;
 	}
 
@@ -1315,6 +1970,9 @@ weston_view_unmap(struct weston_view *view)
 	wl_list_init(&view->link);
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
+	view->surface->compositor->view_list_needs_rebuild = 1;
+	view->surface->compositor->output_views_dirty = 1;
+	pick_grid_dirty(view->surface->compositor);
 
 	if (weston_surface_is_mapped(view->surface))
 		return;
@@ -1353,11 +2011,6 @@ weston_surface_reset_pending_buffer(struct weston_surface *surface)
 	surface->pending.newly_attached = 0;
 }
 
-struct weston_frame_callback {
-	struct wl_resource *resource;
-	struct wl_list link;
-};
-
 WL_EXPORT void
 weston_view_destroy(struct weston_view *view)
 {
@@ -1373,14 +2026,21 @@ weston_view_destroy(struct weston_view *view)
 	wl_list_remove(&view->link);
 	wl_list_remove(&view->layer_link);
 
+	/* view_list_stack, the output view arrays and the pick grid may
+	 * still point to this view */
+	view->surface->compositor->view_list_needs_rebuild = 1;
+	view->surface->compositor->output_views_dirty = 1;
+	pick_grid_dirty(view->surface->compositor);
+
 	pixman_region32_fini(&view->clip);
 	pixman_region32_fini(&view->transform.boundingbox);
 
 	weston_view_set_transform_parent(view, NULL);
 
 	wl_list_remove(&view->surface_link);
+	weston_client_stats_view(view, -1);
 
-	free(view);
+	object_pool_free(&view_pool, view);
 }
 
 WL_EXPORT void
@@ -1400,10 +2060,20 @@ weston_surface_destroy(struct weston_surface *surface)
 	wl_list_for_each_safe(ev, nv, &surface->views, surface_link)
 		weston_view_destroy(ev);
 
+	weston_client_stats_remove_surface(surface);
+
 	wl_list_for_each_safe(cb, next,
 			      &surface->pending.frame_callback_list, link)
 		wl_resource_destroy(cb->resource);
 
+	weston_presentation_feedback_discard_list(
+				&surface->pending.feedback_list);
+
+	if (surface->pending.acquire_fence_fd >= 0)
+		close(surface->pending.acquire_fence_fd);
+	if (surface->pending.buffer_release)
+		linux_buffer_release_send(surface->pending.buffer_release, -1);
+
 	pixman_region32_fini(&surface->pending.input);
 	pixman_region32_fini(&surface->pending.opaque);
 	pixman_region32_fini(&surface->pending.damage);
@@ -1420,7 +2090,12 @@ weston_surface_destroy(struct weston_surface *surface)
 	wl_list_for_each_safe(cb, next, &surface->frame_callback_list, link)
 		wl_resource_destroy(cb->resource);
 
-	free(surface);
+	weston_presentation_feedback_discard_list(&surface->feedback_list);
+
+	if (surface->acquire_fence_fd >= 0)
+		close(surface->acquire_fence_fd);
+
+	object_pool_free(&surface_pool, surface);
 }
 
 static void
@@ -1435,6 +2110,33 @@ destroy_surface(struct wl_resource *resource)
 	weston_surface_destroy(surface);
 }
 
+/* Send the explicit sync releases of the commits of this buffer */
+static void
+weston_buffer_send_release(struct weston_buffer *buffer)
+{
+	struct weston_buffer_release *release, *tmp;
+
+	wl_list_for_each_safe(release, tmp, &buffer->release_list, link)
+		linux_buffer_release_send(release, buffer->release_fence_fd);
+
+	if (buffer->release_fence_fd >= 0) {
+		close(buffer->release_fence_fd);
+		buffer->release_fence_fd = -1;
+	}
+}
+
+/* Set the fence that signals when the last rendering reading the
+ * buffer is done, taking ownership of fence_fd.  It is handed to
+ * clients with explicit sync once the buffer is released. */
+WL_EXPORT void
+weston_buffer_set_release_fence(struct weston_buffer *buffer, int fence_fd)
+{
+	if (buffer->release_fence_fd >= 0)
+		close(buffer->release_fence_fd);
+
+	buffer->release_fence_fd = fence_fd;
+}
+
 static void
 weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 {
@@ -1442,6 +2144,9 @@ weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_buffer, destroy_listener);
 
 	wl_signal_emit(&buffer->destroy_signal, buffer);
+	weston_buffer_stats_destroy_buffer(buffer);
+	weston_client_stats_release_buffer(buffer);
+	weston_buffer_send_release(buffer);
 	free(buffer);
 }
 
@@ -1466,6 +2171,9 @@ weston_buffer_from_resource(struct wl_resource *resource)
 	wl_signal_init(&buffer->destroy_signal);
 	buffer->destroy_listener.notify = weston_buffer_destroy_handler;
 	buffer->y_inverted = 1;
+	wl_list_init(&buffer->release_list);
+	buffer->release_fence_fd = -1;
+	wl_list_init(&buffer->client_stats_link);
 	wl_resource_add_destroy_listener(resource, &buffer->destroy_listener);
 
 	return buffer;
@@ -1491,8 +2199,12 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 		ref->buffer->busy_count--;
 		if (ref->buffer->busy_count == 0) {
 			assert(wl_resource_get_client(ref->buffer->resource));
+			WESTON_TRACE1(buffer_release, ref->buffer);
 			wl_resource_queue_event(ref->buffer->resource,
 						WL_BUFFER_RELEASE);
+			weston_buffer_send_release(ref->buffer);
+			weston_buffer_stats_release(ref->buffer);
+			weston_client_stats_release_buffer(ref->buffer);
 		}
 		wl_list_remove(&ref->destroy_listener.link);
 	}
@@ -1511,6 +2223,8 @@ static void
 weston_surface_attach(struct weston_surface *surface,
 		      struct weston_buffer *buffer)
 {
+	WESTON_TRACE2(buffer_attach, surface, buffer);
+	weston_buffer_stats_attach(surface->compositor, buffer);
 	weston_buffer_reference(&surface->buffer_ref, buffer);
 
 	if (!buffer) {
@@ -1518,7 +2232,9 @@ weston_surface_attach(struct weston_surface *surface,
 			weston_surface_unmap(surface);
 	}
 
+	surface->is_opaque = 0;
 	surface->compositor->renderer->attach(surface, buffer);
+	weston_client_stats_hold_buffer(surface, buffer);
 
 	weston_surface_set_size_from_buffer(surface);
 }
@@ -1543,9 +2259,138 @@ weston_output_damage(struct weston_output *output)
 	weston_output_schedule_repaint(output);
 }
 
+/* Read back a rectangle of the output, asynchronously when the renderer
+ * supports it.  Otherwise the pixels are read right away and done is
+ * called before this returns. */
+WL_EXPORT void
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data)
+{
+	struct weston_renderer *renderer = output->compositor->renderer;
+	void *pixels;
+
+	if (renderer->read_pixels_async &&
+	    renderer->read_pixels_async(output, format, x, y, width, height,
+					done, data) == 0)
+		return;
+
+	pixels = malloc(width * height * (PIXMAN_FORMAT_BPP(format) / 8));
+	if (pixels &&
+	    renderer->read_pixels(output, format, pixels,
+				  x, y, width, height) < 0) {
+		free(pixels);
+		pixels = NULL;
+	}
+
+	done(output, pixels, data);
+	free(pixels);
+}
+
+/* Returns how many ms an update of the surface is still held back by
+ * its rate cap, 0 if it may update now. Half a refresh of slack keeps
+ * vblank jitter from pushing updates a whole frame late. */
+static uint32_t
+weston_surface_update_delay(struct weston_surface *surface, uint32_t now)
+{
+	struct weston_output *output = surface->output;
+	uint32_t interval = surface->update_interval;
+	uint32_t period = 16, elapsed;
+
+	if (output && output->current_mode &&
+	    output->current_mode->refresh > 0)
+		period = 1000000 / output->current_mode->refresh;
+
+	if (surface->update_best_effort && output &&
+	    output->repaint_duration > period * 1000 &&
+	    interval < period * 4)
+		interval = period * 4;
+
+	if (interval == 0)
+		return 0;
+
+	elapsed = now - surface->update_time + period / 2;
+	if (elapsed >= interval)
+		return 0;
+
+	return interval - elapsed;
+}
+
+static void
+update_cap_timer_arm(struct weston_compositor *compositor,
+		     uint32_t now, uint32_t delay)
+{
+	uint32_t due = now + delay;
+
+	if (compositor->update_cap_timer_armed &&
+	    (int32_t) (compositor->update_cap_due - due) <= 0)
+		return;
+
+	wl_event_source_timer_update(compositor->update_cap_timer,
+				     delay > 0 ? delay : 1);
+	compositor->update_cap_timer_armed = 1;
+	compositor->update_cap_due = due;
+}
+
+static int
+update_cap_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_view *view;
+	struct weston_surface *surface;
+	uint32_t now = weston_compositor_get_time();
+	uint32_t delay;
+
+	compositor->update_cap_timer_armed = 0;
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		surface = view->surface;
+		if (!surface->update_deferred)
+			continue;
+
+		delay = weston_surface_update_delay(surface, now);
+		if (delay > 0) {
+			update_cap_timer_arm(compositor, now, delay);
+			continue;
+		}
+
+		surface->update_deferred = 0;
+		weston_surface_schedule_repaint(surface);
+	}
+
+	return 0;
+}
+
+/* Decides for this repaint whether the surface's update is held back
+ * and, if it has anything waiting, when to come back for it. */
+static void
+surface_check_update_cap(struct weston_surface *surface, uint32_t now)
+{
+	uint32_t delay;
+
+	delay = weston_surface_update_delay(surface, now);
+	surface->update_deferred = delay > 0;
+	if (!surface->update_deferred)
+		return;
+
+	if (pixman_region32_not_empty(&surface->damage) ||
+	    !wl_list_empty(&surface->frame_callback_list) ||
+	    !wl_list_empty(&surface->feedback_list))
+		update_cap_timer_arm(surface->compositor, now, delay);
+}
+
 static void
 surface_flush_damage(struct weston_surface *surface)
 {
+	WESTON_TRACE2(damage_flush, surface,
+		      pixman_region32_n_rects(&surface->damage));
+
+	if (pixman_region32_not_empty(&surface->damage))
+		surface->update_flushed = 1;
+
 	if (surface->buffer_ref.buffer &&
 	    wl_shm_buffer_get(surface->buffer_ref.buffer->resource))
 		surface->compositor->renderer->flush_damage(surface);
@@ -1553,12 +2398,57 @@ surface_flush_damage(struct weston_surface *surface)
 	empty_region(&surface->damage);
 }
 
+static int
+view_is_occluded(struct weston_view *view,
+		 pixman_region32_t *clip, pixman_region32_t *opaque)
+{
+	pixman_box32_t *extents;
+	pixman_region32_t visible;
+	int occluded;
+
+	extents = pixman_region32_extents(&view->transform.boundingbox);
+	if (pixman_region32_contains_rectangle(opaque, extents) ==
+	    PIXMAN_REGION_IN ||
+	    pixman_region32_contains_rectangle(clip, extents) ==
+	    PIXMAN_REGION_IN)
+		return 1;
+
+	if (!pixman_region32_not_empty(opaque) ||
+	    !pixman_region32_not_empty(clip))
+		return 0;
+
+	/* Covered only by the two together */
+	pixman_region32_init(&visible);
+	pixman_region32_subtract(&visible,
+				 &view->transform.boundingbox, opaque);
+	pixman_region32_subtract(&visible, &visible, clip);
+	occluded = !pixman_region32_not_empty(&visible);
+	pixman_region32_fini(&visible);
+
+	return occluded;
+}
+
 static void
 view_accumulate_damage(struct weston_view *view,
 		       pixman_region32_t *opaque)
 {
 	pixman_region32_t damage;
 
+	/* Anything drawn here ends up underneath opaque views. Nothing
+	 * gets uncovered without damaging the area again. */
+	if (view->occluded) {
+		pixman_region32_copy(&view->clip, opaque);
+		return;
+	}
+
+	/* Held back by the rate cap, merged into a later frame */
+	if (view->surface->update_deferred) {
+		pixman_region32_copy(&view->clip, opaque);
+		pixman_region32_union(opaque, opaque,
+				      &view->transform.opaque);
+		return;
+	}
+
 	pixman_region32_init(&damage);
 	if (view->transform.enabled) {
 		pixman_box32_t *extents;
@@ -1579,6 +2469,7 @@ view_accumulate_damage(struct weston_view *view,
 	}
 
 	pixman_region32_subtract(&damage, &damage, opaque);
+	weston_heatmap_damage(view, &damage);
 	pixman_region32_union(&view->plane->damage,
 			      &view->plane->damage, &damage);
 	pixman_region32_fini(&damage);
@@ -1587,11 +2478,48 @@ view_accumulate_damage(struct weston_view *view,
 }
 
 static void
-compositor_accumulate_damage(struct weston_compositor *ec)
+weston_compositor_update_output_views(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+	struct weston_view *view, **entry;
+	int complete = 1;
+
+	if (!compositor->output_views_dirty)
+		return;
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		output->views.size = 0;
+
+	/* Views on no output are shared by all outputs, so their damage
+	 * still gets flushed and their buffers released. */
+	wl_list_for_each(view, &compositor->view_list, link) {
+		wl_list_for_each(output, &compositor->output_list, link) {
+			if (view->output_mask &&
+			    !(view->output_mask & (1 << output->id)))
+				continue;
+
+			entry = wl_array_add(&output->views, sizeof *entry);
+			if (entry)
+				*entry = view;
+			else
+				complete = 0;
+		}
+	}
+
+	compositor->output_views_dirty = !complete;
+}
+
+static void
+compositor_accumulate_damage(struct weston_output *output)
 {
+	struct weston_compositor *ec = output->compositor;
 	struct weston_plane *plane;
-	struct weston_view *ev;
+	struct weston_view *ev, **evp;
 	pixman_region32_t opaque, clip;
+	uint32_t now = weston_compositor_get_time();
+
+	wl_array_for_each(evp, &output->views)
+		surface_check_update_cap((*evp)->surface, now);
 
 	pixman_region32_init(&clip);
 
@@ -1600,10 +2528,12 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 
 		pixman_region32_init(&opaque);
 
-		wl_list_for_each(ev, &ec->view_list, link) {
+		wl_array_for_each(evp, &output->views) {
+			ev = *evp;
 			if (ev->plane != plane)
 				continue;
 
+			ev->occluded = view_is_occluded(ev, &clip, &opaque);
 			view_accumulate_damage(ev, &opaque);
 		}
 
@@ -1613,14 +2543,20 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 
 	pixman_region32_fini(&clip);
 
-	wl_list_for_each(ev, &ec->view_list, link)
-		ev->surface->touched = 0;
+	wl_array_for_each(evp, &output->views)
+		(*evp)->surface->touched = 0;
 
-	wl_list_for_each(ev, &ec->view_list, link) {
+	wl_array_for_each(evp, &output->views) {
+		ev = *evp;
 		if (ev->surface->touched)
 			continue;
 		ev->surface->touched = 1;
 
+		/* The renderer keeps showing what it has, the buffer
+		 * stays referenced until the update goes through. */
+		if (ev->surface->update_deferred)
+			continue;
+
 		surface_flush_damage(ev->surface);
 
 		/* Both the renderer and the backend have seen the buffer
@@ -1735,13 +2671,25 @@ view_list_add(struct weston_compositor *compositor,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor)
 {
-	struct weston_view *view;
+	struct weston_view *view, **entry;
 	struct weston_layer *layer;
+	int stack_complete = 1;
 
-	wl_list_for_each(layer, &compositor->layer_list, link)
-		wl_list_for_each(view, &layer->view_list, layer_link)
+	compositor->view_list_stack.size = 0;
+
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		wl_list_for_each(view, &layer->view_list, layer_link) {
 			surface_stash_subsurface_views(view->surface);
 
+			entry = wl_array_add(&compositor->view_list_stack,
+					     sizeof *entry);
+			if (entry)
+				*entry = view;
+			else
+				stack_complete = 0;
+		}
+	}
+
 	wl_list_init(&compositor->view_list);
 	wl_list_for_each(layer, &compositor->layer_list, link) {
 		wl_list_for_each(view, &layer->view_list, layer_link) {
@@ -1752,44 +2700,353 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list, layer_link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	/* The unused views destroyed above were not in the stack. */
+	compositor->view_list_needs_rebuild = !stack_complete;
+	compositor->output_views_dirty = 1;
+	pick_grid_dirty(compositor);
+}
+
+static int
+view_list_stacking_changed(struct weston_compositor *compositor)
+{
+	struct weston_view **stack = compositor->view_list_stack.data;
+	size_t count = compositor->view_list_stack.size / sizeof *stack;
+	struct weston_layer *layer;
+	struct weston_view *view;
+	size_t i = 0;
+
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		wl_list_for_each(view, &layer->view_list, layer_link) {
+			if (i == count || stack[i] != view)
+				return 1;
+			i++;
+		}
+	}
+
+	return i != count;
+}
+
+/* Bring compositor->view_list up to date with the layers.
+ *
+ * Shells are free to move views in and out of layers directly, so the
+ * layer contents are compared with the order recorded at the last
+ * rebuild. Only when that changed, or something inside the compositor
+ * flagged view_list_needs_rebuild, the list is rebuilt from scratch;
+ * otherwise just the view transforms are refreshed.
+ */
+static void
+weston_compositor_update_view_list(struct weston_compositor *compositor)
+{
+	struct weston_view *view;
+
+	if (compositor->view_list_needs_rebuild ||
+	    view_list_stacking_changed(compositor)) {
+		weston_compositor_build_view_list(compositor);
+		return;
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		weston_view_update_transform(view);
+}
+
+static int
+occluded_frame_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_frame_callback *cb, *cnext;
+	struct weston_view *view;
+	uint32_t msecs = weston_compositor_get_time();
+
+	compositor->occluded_frame_timer_armed = 0;
+
+	/* Surfaces that became visible meanwhile got their callbacks
+	 * in the last repaint; only hidden ones are left. */
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!view->occluded || !view->surface->output)
+			continue;
+
+		wl_list_for_each_safe(cb, cnext,
+				      &view->surface->frame_callback_list,
+				      link) {
+			WESTON_TRACE2(frame_callback, cb->resource, msecs);
+			wl_callback_send_done(cb->resource, msecs);
+			wl_resource_destroy(cb->resource);
+		}
+	}
+
+	return 0;
+}
+
+static void
+occluded_frame_timer_arm(struct weston_compositor *compositor)
+{
+	if (compositor->occluded_frame_rate <= 0 ||
+	    compositor->occluded_frame_timer_armed)
+		return;
+
+	wl_event_source_timer_update(compositor->occluded_frame_timer,
+				     1000 / compositor->occluded_frame_rate);
+	compositor->occluded_frame_timer_armed = 1;
+}
+
+/* Set when main() starts, startup times are logged relative to it */
+static struct timespec startup_time;
+
+static double
+elapsed_ms(const struct timespec *begin)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - begin->tv_sec) * 1000.0 +
+		(now.tv_nsec - begin->tv_nsec) / 1000000.0;
+}
+
+struct weston_deferred_init {
+	struct wl_list link;
+	char *name;
+	weston_deferred_init_func_t func;
+	void *data;
+};
+
+/* Runs one deferred init per timer expiry, so that input and repaints
+ * get a turn in between. */
+static int
+deferred_init_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_deferred_init *init;
+	struct timespec begin;
+
+	if (wl_list_empty(&ec->deferred_init_list)) {
+		ec->first_frame_done = 1;
+		return 0;
+	}
+
+	if (!ec->first_frame_done) {
+		weston_log("No frame %.1f ms after startup, "
+			   "running deferred module init\n",
+			   elapsed_ms(&startup_time));
+		ec->first_frame_done = 1;
+	}
+
+	init = container_of(ec->deferred_init_list.next,
+			    struct weston_deferred_init, link);
+	wl_list_remove(&init->link);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	init->func(ec, init->data);
+	weston_log("Deferred init of '%s' done in %.1f ms\n",
+		   init->name, elapsed_ms(&begin));
+
+	free(init->name);
+	free(init);
+
+	if (!wl_list_empty(&ec->deferred_init_list))
+		wl_event_source_timer_update(ec->deferred_init_timer, 1);
+
+	return 0;
+}
+
+static void
+weston_compositor_first_frame(struct weston_compositor *ec)
+{
+	ec->first_frame_done = 1;
+	weston_log("First frame %.1f ms after startup\n",
+		   elapsed_ms(&startup_time));
+
+	if (!wl_list_empty(&ec->deferred_init_list))
+		wl_event_source_timer_update(ec->deferred_init_timer, 1);
+	else
+		wl_event_source_timer_update(ec->deferred_init_timer, 0);
+}
+
+/** Run part of a module's initialization after startup
+ *
+ * \param ec The compositor
+ * \param name Name for the startup log
+ * \param func Called once the first frame has been repainted
+ * \param data Passed to func
+ * \return 0 on success, -1 if out of memory
+ *
+ * For work in a module_init that is slow, like loading files or
+ * talking to daemons, and that the first frame doesn't need.  func is
+ * called from the main loop, one deferred init per loop iteration, in
+ * the order they were added.  If no output repaints within a second of
+ * starting, the deferred inits run anyway.  Once the first frame is out,
+ * func is called as soon as possible.  Deferred inits that haven't run
+ * at shutdown are dropped.
+ */
+WL_EXPORT int
+weston_compositor_defer_init(struct weston_compositor *ec, const char *name,
+			     weston_deferred_init_func_t func, void *data)
+{
+	struct weston_deferred_init *init;
+
+	init = zalloc(sizeof *init);
+	if (!init)
+		return -1;
+
+	init->name = strdup(name);
+	init->func = func;
+	init->data = data;
+	wl_list_insert(ec->deferred_init_list.prev, &init->link);
+
+	if (ec->first_frame_done)
+		wl_event_source_timer_update(ec->deferred_init_timer, 1);
+
+	return 0;
+}
+
+static void
+weston_presentation_feedback_discard(
+		struct weston_presentation_feedback *feedback)
+{
+	presentation_feedback_send_discarded(feedback->resource);
+	wl_resource_destroy(feedback->resource);
+}
+
+WL_EXPORT void
+weston_presentation_feedback_discard_list(struct wl_list *list)
+{
+	struct weston_presentation_feedback *feedback, *tmp;
+
+	wl_list_for_each_safe(feedback, tmp, list, link)
+		weston_presentation_feedback_discard(feedback);
+}
+
+static void
+weston_presentation_feedback_present(
+		struct weston_presentation_feedback *feedback,
+		struct weston_output *output,
+		uint32_t refresh_nsec,
+		const struct timespec *stamp,
+		uint64_t msc,
+		uint32_t flags)
+{
+	struct wl_client *client = wl_resource_get_client(feedback->resource);
+	struct wl_resource *o;
+	uint64_t secs;
+
+	wl_resource_for_each(o, &output->resource_list) {
+		if (wl_resource_get_client(o) != client)
+			continue;
+
+		presentation_feedback_send_sync_output(feedback->resource, o);
+	}
+
+	secs = stamp->tv_sec;
+	presentation_feedback_send_presented(feedback->resource,
+					     secs >> 32, secs & 0xffffffff,
+					     stamp->tv_nsec,
+					     refresh_nsec,
+					     msc >> 32, msc & 0xffffffff,
+					     flags | feedback->psf_flags);
+	wl_resource_destroy(feedback->resource);
+}
+
+/* Deliver presented events for a list of feedback taken from
+ * output->feedback_list.  stamp is on the compositor's
+ * presentation_clock, msc is the output's retrace counter for the frame
+ * and flags the presentation_feedback kind bits that apply to the whole
+ * frame; zero_copy is added per surface. */
+WL_EXPORT void
+weston_presentation_feedback_present_list(struct wl_list *list,
+					  struct weston_output *output,
+					  const struct timespec *stamp,
+					  uint64_t msc, uint32_t flags)
+{
+	struct weston_presentation_feedback *feedback, *tmp;
+	uint32_t refresh_nsec = 0;
+
+	if (output->current_mode && output->current_mode->refresh > 0)
+		refresh_nsec = 1000000000000LL / output->current_mode->refresh;
+
+	wl_list_for_each_safe(feedback, tmp, list, link)
+		weston_presentation_feedback_present(feedback, output,
+						     refresh_nsec, stamp,
+						     msc, flags);
 }
 
 static int
 weston_output_repaint(struct weston_output *output, uint32_t msecs)
 {
 	struct weston_compositor *ec = output->compositor;
-	struct weston_view *ev;
+	struct weston_view *ev, **evp;
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
+	struct weston_presentation_feedback *feedback;
 	struct wl_list frame_callback_list;
 	pixman_region32_t output_damage;
+	uint32_t now;
 	int r;
 
 	if (output->destroying)
 		return 0;
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	weston_timeline_point(output, WESTON_TIMELINE_REPAINT_BEGIN);
+	weston_latency_repaint(output);
+
+	/* Update the view list and view transforms up front. */
+	weston_compositor_update_view_list(ec);
+	weston_compositor_update_output_views(ec);
+	weston_timeline_point(output, WESTON_TIMELINE_VIEW_LIST);
+
+	if (output->assign_planes && !output->disable_planes)
+		output->assign_planes(output);
+	else
+		wl_array_for_each(evp, &output->views)
+			weston_view_move_to_plane(*evp, &ec->primary_plane);
+	weston_timeline_point(output, WESTON_TIMELINE_ASSIGN_PLANES);
+
+	compositor_accumulate_damage(output);
+	weston_timeline_point(output, WESTON_TIMELINE_ACCUMULATE_DAMAGE);
+
+	wl_list_init(&frame_callback_list);
+	now = weston_compositor_get_time();
+	wl_array_for_each(evp, &output->views) {
+		ev = *evp;
+		if (ev->surface->output != output)
+			continue;
+
+		if (ev->occluded && ec->occluded_frame_rate >= 0) {
+			if (!wl_list_empty(&ev->surface->frame_callback_list))
+				occluded_frame_timer_arm(ec);
+			continue;
+		}
+
+		if (ev->surface->update_deferred)
+			continue;
+
+		if (ev->surface->update_flushed ||
+		    !wl_list_empty(&ev->surface->frame_callback_list))
+			ev->surface->update_time = now;
+		ev->surface->update_flushed = 0;
 
-	if (output->assign_planes && !output->disable_planes)
-		output->assign_planes(output);
-	else
-		wl_list_for_each(ev, &ec->view_list, link)
-			weston_view_move_to_plane(ev, &ec->primary_plane);
+		if (ev->surface->stats.frame_pending) {
+			ev->surface->stats.frames_presented++;
+			ev->surface->stats.frame_pending = 0;
+		}
 
-	wl_list_init(&frame_callback_list);
-	wl_list_for_each(ev, &ec->view_list, link) {
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
-		if (ev->surface->output == output) {
+		if (!weston_client_stats_defer_frame(ev->surface)) {
 			wl_list_insert_list(&frame_callback_list,
 					    &ev->surface->frame_callback_list);
 			wl_list_init(&ev->surface->frame_callback_list);
 		}
-	}
 
-	compositor_accumulate_damage(ec);
+		wl_list_for_each(feedback, &ev->surface->feedback_list, link)
+			feedback->psf_flags =
+				ev->plane == &ec->primary_plane ? 0 :
+				PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+		wl_list_insert_list(&output->feedback_list,
+				    &ev->surface->feedback_list);
+		wl_list_init(&ev->surface->feedback_list);
+	}
 
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
@@ -1800,7 +3057,22 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	if (output->dirty)
 		weston_output_update_matrix(output);
 
+	/* Damage outside the zoomed area stays on the plane until it is
+	 * shown again; a pan or level change damages the whole output. */
+	if (output->zoom.active)
+		weston_output_zoom_clip_damage(output, &output_damage);
+
+	weston_buffer_stats_repaint(output);
 	r = output->repaint(output, &output_damage);
+	weston_timeline_point(output, WESTON_TIMELINE_OUTPUT_REPAINT);
+
+	/* Nothing will be presented for this frame */
+	if (r != 0)
+		weston_presentation_feedback_discard_list(
+						&output->feedback_list);
+
+	if (r == 0 && !ec->first_frame_done)
+		weston_compositor_first_frame(ec);
 
 	pixman_region32_fini(&output_damage);
 
@@ -1808,16 +3080,20 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 
 	weston_compositor_repick(ec);
 	wl_event_loop_dispatch(ec->input_loop, 0);
+	weston_timeline_point(output, WESTON_TIMELINE_INPUT);
 
 	wl_list_for_each_safe(cb, cnext, &frame_callback_list, link) {
+		WESTON_TRACE2(frame_callback, cb->resource, msecs);
 		wl_callback_send_done(cb->resource, msecs);
 		wl_resource_destroy(cb->resource);
 	}
+	weston_timeline_point(output, WESTON_TIMELINE_FRAME_CALLBACKS);
 
 	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
 		animation->frame_counter++;
 		animation->frame(animation, output, msecs);
 	}
+	weston_timeline_point(output, WESTON_TIMELINE_REPAINT_END);
 
 	return r;
 }
@@ -1832,20 +3108,74 @@ weston_compositor_read_input(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
-WL_EXPORT void
-weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
+/* Returns how many ms to wait after the vblank at msecs before
+ * repainting, so that the repaint is done just before the next one. */
+static int
+weston_output_repaint_delay(struct weston_output *output, uint32_t msecs)
+{
+	struct timespec ts;
+	uint32_t period, window, elapsed;
+
+	if (output->repaint_window == 0 || !output->repaint_timer ||
+	    !output->current_mode || output->current_mode->refresh <= 0)
+		return 0;
+
+	/* refresh is in mHz */
+	period = 1000000000 / output->current_mode->refresh;
+
+	if (output->repaint_window == WESTON_REPAINT_WINDOW_MEASURED)
+		window = output->repaint_duration * 3 / 2 + 1000;
+	else
+		window = output->repaint_window * 1000;
+
+	if (window >= period)
+		return 0;
+
+	/* Backends whose frame times are not on presentation_clock end
+	 * up with an elapsed time outside the period and repaint at
+	 * once, as without a window. */
+	clock_gettime(output->compositor->presentation_clock, &ts);
+	elapsed = (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) - msecs;
+	if (elapsed * 1000 >= period - window)
+		return 0;
+
+	return (period - window) / 1000 - elapsed;
+}
+
+static int
+weston_output_repaint_timed(struct weston_output *output, uint32_t msecs)
+{
+	struct timespec begin, end;
+	uint32_t duration;
+	int r;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	r = weston_output_repaint(output, msecs);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	duration = (end.tv_sec - begin.tv_sec) * 1000000 +
+		(end.tv_nsec - begin.tv_nsec) / 1000;
+	if (output->repaint_duration == 0)
+		output->repaint_duration = duration;
+	else
+		output->repaint_duration =
+			(output->repaint_duration * 7 + duration) / 8;
+
+	return r;
+}
+
+static void
+weston_output_finish_repaint(struct weston_output *output, uint32_t msecs)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(compositor->wl_display);
 	int fd, r;
 
-	output->frame_time = msecs;
-
 	if (output->repaint_needed &&
 	    compositor->state != WESTON_COMPOSITOR_SLEEPING &&
 	    compositor->state != WESTON_COMPOSITOR_OFFSCREEN) {
-		r = weston_output_repaint(output, msecs);
+		r = weston_output_repaint_timed(output, msecs);
 		if (!r)
 			return;
 	}
@@ -1860,6 +3190,50 @@ weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
 				     weston_compositor_read_input, compositor);
 }
 
+static int
+output_repaint_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	weston_output_finish_repaint(output, output->frame_time);
+
+	return 0;
+}
+
+WL_EXPORT void
+weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct timespec ts;
+	int delay;
+
+	weston_timeline_point(output, WESTON_TIMELINE_FRAME_FINISHED);
+	weston_latency_frame(output, msecs);
+	output->frame_time = msecs;
+
+	/* Backends that know when a frame hit the screen present its
+	 * feedback themselves; for the rest, this is the best guess. */
+	if (!wl_list_empty(&output->feedback_list)) {
+		clock_gettime(compositor->presentation_clock, &ts);
+		weston_presentation_feedback_present_list(&output->feedback_list,
+							  output, &ts,
+							  ++output->msc, 0);
+	}
+
+	if (output->repaint_needed &&
+	    compositor->state != WESTON_COMPOSITOR_SLEEPING &&
+	    compositor->state != WESTON_COMPOSITOR_OFFSCREEN) {
+		delay = weston_output_repaint_delay(output, msecs);
+		if (delay > 0) {
+			wl_event_source_timer_update(output->repaint_timer,
+						     delay);
+			return;
+		}
+	}
+
+	weston_output_finish_repaint(output, msecs);
+}
+
 static void
 idle_repaint(void *data)
 {
@@ -1888,6 +3262,7 @@ weston_output_schedule_repaint(struct weston_output *output)
 
 	loop = wl_display_get_event_loop(compositor->wl_display);
 	output->repaint_needed = 1;
+	weston_latency_schedule_repaint(output);
 	if (output->repaint_scheduled)
 		return;
 
@@ -1964,7 +3339,7 @@ destroy_frame_callback(struct wl_resource *resource)
 	struct weston_frame_callback *cb = wl_resource_get_user_data(resource);
 
 	wl_list_remove(&cb->link);
-	free(cb);
+	object_pool_free(&frame_callback_pool, cb);
 }
 
 static void
@@ -1974,7 +3349,7 @@ surface_frame(struct wl_client *client,
 	struct weston_frame_callback *cb;
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 
-	cb = malloc(sizeof *cb);
+	cb = object_pool_alloc(&frame_callback_pool);
 	if (cb == NULL) {
 		wl_resource_post_no_memory(resource);
 		return;
@@ -1983,7 +3358,7 @@ surface_frame(struct wl_client *client,
 	cb->resource = wl_resource_create(client, &wl_callback_interface, 1,
 					  callback);
 	if (cb->resource == NULL) {
-		free(cb);
+		object_pool_free(&frame_callback_pool, cb);
 		wl_resource_post_no_memory(resource);
 		return;
 	}
@@ -2009,6 +3384,7 @@ surface_set_opaque_region(struct wl_client *client,
 	} else {
 		empty_region(&surface->pending.opaque);
 	}
+	surface->pending.regions_set = 1;
 }
 
 static void
@@ -2027,6 +3403,91 @@ surface_set_input_region(struct wl_client *client,
 		pixman_region32_fini(&surface->pending.input);
 		region_init_infinite(&surface->pending.input);
 	}
+	surface->pending.regions_set = 1;
+}
+
+static void
+weston_surface_update_opaque(struct weston_surface *surface,
+			     pixman_region32_t *pending)
+{
+	struct weston_view *view;
+	pixman_region32_t whole;
+	int changed;
+
+	/* Buffers without alpha hide whatever is below them, whether the
+	 * client set an opaque region or not. */
+	if (surface->is_opaque) {
+		pixman_region32_init_rect(&whole, 0, 0,
+					  surface->width, surface->height);
+		changed = region_update_clipped(&surface->opaque, &whole,
+						surface->width,
+						surface->height);
+		pixman_region32_fini(&whole);
+	} else {
+		changed = region_update_clipped(&surface->opaque, pending,
+						surface->width,
+						surface->height);
+	}
+
+	if (changed)
+		wl_list_for_each(view, &surface->views, surface_link)
+			weston_view_geometry_dirty(view);
+}
+
+static void
+weston_surface_update_input(struct weston_surface *surface,
+			    pixman_region32_t *pending)
+{
+	if (region_update_clipped(&surface->input, pending,
+				  surface->width, surface->height))
+		pick_grid_dirty(surface->compositor);
+}
+
+static int
+subsurface_order_changed(struct weston_surface *surface)
+{
+	struct wl_list *cur = surface->subsurface_list.next;
+	struct wl_list *pending = surface->subsurface_list_pending.next;
+	struct weston_subsurface *sub;
+
+	while (cur != &surface->subsurface_list &&
+	       pending != &surface->subsurface_list_pending) {
+		sub = container_of(pending, struct weston_subsurface,
+				   parent_link_pending);
+		if (&sub->parent_link != cur)
+			return 1;
+
+		cur = cur->next;
+		pending = pending->next;
+	}
+
+	return cur != &surface->subsurface_list ||
+	       pending != &surface->subsurface_list_pending;
+}
+
+static void
+surface_stats_commit(struct weston_surface *surface, int newly_attached)
+{
+	struct weston_surface_stats *stats = &surface->stats;
+	uint32_t now = weston_compositor_get_time();
+
+	stats->commits++;
+	if (now - stats->rate_start >= 1000) {
+		/* a gap of more than a second holds no full second of
+		 * commits to report */
+		stats->commit_rate = now - stats->rate_start < 2000 ?
+				     stats->rate_count : 0;
+		stats->rate_start = now;
+		stats->rate_count = 0;
+	}
+	stats->rate_count++;
+
+	if (!newly_attached)
+		return;
+
+	if (stats->frame_pending)
+		stats->frames_dropped++;
+	stats->frame_pending = 1;
 }
 
 static void
@@ -2034,18 +3495,162 @@ weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (!subsurface_order_changed(surface))
+		return;
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 	}
+
+	surface->compositor->view_list_needs_rebuild = 1;
+}
+
+static int
+buffer_viewport_equal(const struct weston_buffer_viewport *a,
+		      const struct weston_buffer_viewport *b)
+{
+	return a->buffer.transform == b->buffer.transform &&
+	       a->buffer.scale == b->buffer.scale &&
+	       a->buffer.src_x == b->buffer.src_x &&
+	       a->buffer.src_y == b->buffer.src_y &&
+	       a->buffer.src_width == b->buffer.src_width &&
+	       a->buffer.src_height == b->buffer.src_height &&
+	       a->surface.width == b->surface.width &&
+	       a->surface.height == b->surface.height;
+}
+
+/* A commit with nothing in it but frame callbacks, as clients that
+ * only want to be told when to draw send them. */
+static int
+weston_surface_commit_is_noop(struct weston_surface *surface)
+{
+	struct weston_buffer_viewport vp = surface->pending.buffer_viewport;
+
+	surface_shell_crop_viewport(surface, &vp);
+
+	return !surface->pending.newly_attached &&
+	       !pixman_region32_not_empty(&surface->pending.damage) &&
+	       !surface->pending.regions_set &&
+	       wl_list_empty(&surface->pending.feedback_list) &&
+	       buffer_viewport_equal(&surface->buffer_viewport, &vp) &&
+	       !subsurface_order_changed(surface);
+}
+
+static int
+frame_only_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_frame_callback *cb, *cnext;
+	struct weston_view *view;
+	struct weston_surface *surface;
+	uint32_t msecs = weston_compositor_get_time();
+
+	compositor->frame_only_timer_armed = 0;
+
+	/* Anything repainted meanwhile took its callbacks along. */
+	wl_list_for_each(view, &compositor->view_list, link) {
+		surface = view->surface;
+		if (!surface->frame_only)
+			continue;
+		surface->frame_only = 0;
+
+		if (weston_client_stats_defer_frame(surface))
+			continue;
+
+		wl_list_for_each_safe(cb, cnext,
+				      &surface->frame_callback_list, link) {
+			WESTON_TRACE2(frame_callback, cb->resource, msecs);
+			wl_callback_send_done(cb->resource, msecs);
+			wl_resource_destroy(cb->resource);
+		}
+	}
+
+	return 0;
+}
+
+/* Deliver the frame callbacks of a no-op commit a refresh from now.
+ * When one of the surface's outputs is going to repaint anyway they
+ * go out with that repaint instead; a surface on no output keeps them
+ * until it gets shown, as with any other commit. */
+static void
+weston_surface_schedule_frame(struct weston_surface *surface)
+{
+	struct weston_compositor *ec = surface->compositor;
+	struct weston_output *output;
+	int32_t refresh;
+
+	uint32_t now, delay;
+
+	if (wl_list_empty(&surface->frame_callback_list) ||
+	    !surface->output_mask || !surface->output)
+		return;
+
+	/* A rate capped surface gets them with its next update */
+	now = weston_compositor_get_time();
+	delay = weston_surface_update_delay(surface, now);
+	if (delay > 0) {
+		surface->update_deferred = 1;
+		update_cap_timer_arm(ec, now, delay);
+		return;
+	}
+
+	wl_list_for_each(output, &ec->output_list, link)
+		if ((surface->output_mask & (1 << output->id)) &&
+		    output->repaint_needed)
+			return;
+
+	surface->frame_only = 1;
+	if (ec->frame_only_timer_armed)
+		return;
+
+	refresh = surface->output->current_mode ?
+		surface->output->current_mode->refresh : 0;
+	wl_event_source_timer_update(ec->frame_only_timer,
+				     refresh > 0 ? 1000000 / refresh : 16);
+	ec->frame_only_timer_armed = 1;
+}
+
+/* Repaint for a commit now, or once its rate cap lets it through */
+static void
+weston_surface_schedule_update(struct weston_surface *surface)
+{
+	uint32_t now, delay;
+
+	if (surface->update_interval == 0 && !surface->update_best_effort) {
+		weston_surface_schedule_repaint(surface);
+		return;
+	}
+
+	now = weston_compositor_get_time();
+	delay = weston_surface_update_delay(surface, now);
+	if (delay == 0) {
+		weston_surface_schedule_repaint(surface);
+		return;
+	}
+
+	surface->update_deferred = 1;
+	update_cap_timer_arm(surface->compositor, now, delay);
 }
 
 static void
 weston_surface_commit(struct weston_surface *surface)
 {
-	struct weston_view *view;
-	pixman_region32_t opaque;
+	WESTON_TRACE2(surface_commit, surface,
+		      surface->pending.newly_attached ?
+		      surface->pending.buffer : NULL);
+
+	/* Idle clients asking for frame callbacks only must not keep
+	 * the repaint loop going. */
+	if (weston_surface_commit_is_noop(surface)) {
+		surface_stats_commit(surface, 0);
+		wl_list_insert_list(&surface->frame_callback_list,
+				    &surface->pending.frame_callback_list);
+		wl_list_init(&surface->pending.frame_callback_list);
+		weston_surface_schedule_frame(surface);
+		return;
+	}
 
 	/* XXX: wl_viewport.set without an attach should call configure */
 
@@ -2053,6 +3658,19 @@ weston_surface_commit(struct weston_surface *surface)
 	/* wl_surface.set_buffer_scale */
 	/* wl_viewport.set */
 	surface->buffer_viewport = surface->pending.buffer_viewport;
+	surface->shell_crop.applied =
+		surface_shell_crop_viewport(surface, &surface->buffer_viewport);
+
+	surface_stats_commit(surface, surface->pending.newly_attached &&
+			     surface->pending.buffer);
+
+	/* zlinux_surface_synchronization.set_acquire_fence */
+	if (surface->pending.newly_attached) {
+		if (surface->acquire_fence_fd >= 0)
+			close(surface->acquire_fence_fd);
+		surface->acquire_fence_fd = surface->pending.acquire_fence_fd;
+		surface->pending.acquire_fence_fd = -1;
+	}
 
 	/* wl_surface.attach */
 	if (surface->pending.newly_attached)
@@ -2065,45 +3683,34 @@ weston_surface_commit(struct weston_surface *surface)
 	weston_surface_reset_pending_buffer(surface);
 
 	/* wl_surface.damage */
-	pixman_region32_union(&surface->damage, &surface->damage,
-			      &surface->pending.damage);
+	weston_client_stats_damage(surface, &surface->pending.damage);
+	region_move_union(&surface->damage, &surface->pending.damage);
 	pixman_region32_intersect_rect(&surface->damage, &surface->damage,
 				       0, 0,
 				       surface->width,
 				       surface->height);
-	empty_region(&surface->pending.damage);
 
 	/* wl_surface.set_opaque_region */
-	pixman_region32_init_rect(&opaque, 0, 0,
-				  surface->width,
-				  surface->height);
-	pixman_region32_intersect(&opaque,
-				  &opaque, &surface->pending.opaque);
-
-	if (!pixman_region32_equal(&opaque, &surface->opaque)) {
-		pixman_region32_copy(&surface->opaque, &opaque);
-		wl_list_for_each(view, &surface->views, surface_link)
-			weston_view_geometry_dirty(view);
-	}
-
-	pixman_region32_fini(&opaque);
+	weston_surface_update_opaque(surface, &surface->pending.opaque);
 
 	/* wl_surface.set_input_region */
-	pixman_region32_fini(&surface->input);
-	pixman_region32_init_rect(&surface->input, 0, 0,
-				  surface->width,
-				  surface->height);
-	pixman_region32_intersect(&surface->input,
-				  &surface->input, &surface->pending.input);
+	weston_surface_update_input(surface, &surface->pending.input);
+	surface->pending.regions_set = 0;
 
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
 			    &surface->pending.frame_callback_list);
 	wl_list_init(&surface->pending.frame_callback_list);
 
+	/* presentation.feedback: the previous commit was never shown */
+	weston_presentation_feedback_discard_list(&surface->feedback_list);
+	wl_list_insert_list(&surface->feedback_list,
+			    &surface->pending.feedback_list);
+	wl_list_init(&surface->pending.feedback_list);
+
 	weston_surface_commit_subsurface_order(surface);
 
-	weston_surface_schedule_repaint(surface);
+	weston_surface_schedule_update(surface);
 }
 
 static void
@@ -2118,9 +3725,14 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 {
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
+	uint64_t start = weston_client_stats_now();
+
+	if (linux_explicit_synchronization_commit(surface) < 0)
+		return;
 
 	if (sub) {
 		weston_subsurface_commit(sub);
+		weston_client_stats_commit(surface, start);
 		return;
 	}
 
@@ -2130,6 +3742,8 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 		if (sub->surface != surface)
 			weston_subsurface_parent_commit(sub, 0);
 	}
+
+	weston_client_stats_commit(surface, start);
 }
 
 static void
@@ -2176,6 +3790,12 @@ compositor_create_surface(struct wl_client *client,
 		return;
 	}
 
+	if (weston_client_stats_add_surface(surface, client) < 0) {
+		weston_surface_destroy(surface);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
 	surface->resource =
 		wl_resource_create(client, &wl_surface_interface,
 				   wl_resource_get_version(resource), id);
@@ -2267,13 +3887,24 @@ static void
 weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 {
 	struct weston_surface *surface = sub->surface;
-	struct weston_view *view;
-	pixman_region32_t opaque;
 
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
 	/* wl_viewport.set */
 	surface->buffer_viewport = sub->cached.buffer_viewport;
+	surface->shell_crop.applied =
+		surface_shell_crop_viewport(surface, &surface->buffer_viewport);
+
+	surface_stats_commit(surface, sub->cached.newly_attached &&
+			     sub->cached.buffer_ref.buffer);
+
+	/* zlinux_surface_synchronization.set_acquire_fence */
+	if (sub->cached.newly_attached) {
+		if (surface->acquire_fence_fd >= 0)
+			close(surface->acquire_fence_fd);
+		surface->acquire_fence_fd = sub->cached.acquire_fence_fd;
+		sub->cached.acquire_fence_fd = -1;
+	}
 
 	/* wl_surface.attach */
 	if (sub->cached.newly_attached)
@@ -2287,42 +3918,29 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 	sub->cached.newly_attached = 0;
 
 	/* wl_surface.damage */
-	pixman_region32_union(&surface->damage, &surface->damage,
-			      &sub->cached.damage);
+	region_move_union(&surface->damage, &sub->cached.damage);
 	pixman_region32_intersect_rect(&surface->damage, &surface->damage,
 				       0, 0,
 				       surface->width,
 				       surface->height);
-	empty_region(&sub->cached.damage);
 
 	/* wl_surface.set_opaque_region */
-	pixman_region32_init_rect(&opaque, 0, 0,
-				  surface->width,
-				  surface->height);
-	pixman_region32_intersect(&opaque,
-				  &opaque, &sub->cached.opaque);
-
-	if (!pixman_region32_equal(&opaque, &surface->opaque)) {
-		pixman_region32_copy(&surface->opaque, &opaque);
-		wl_list_for_each(view, &surface->views, surface_link)
-			weston_view_geometry_dirty(view);
-	}
-
-	pixman_region32_fini(&opaque);
+	weston_surface_update_opaque(surface, &sub->cached.opaque);
 
 	/* wl_surface.set_input_region */
-	pixman_region32_fini(&surface->input);
-	pixman_region32_init_rect(&surface->input, 0, 0,
-				  surface->width,
-				  surface->height);
-	pixman_region32_intersect(&surface->input,
-				  &surface->input, &sub->cached.input);
+	weston_surface_update_input(surface, &sub->cached.input);
 
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
 			    &sub->cached.frame_callback_list);
 	wl_list_init(&sub->cached.frame_callback_list);
 
+	/* presentation.feedback */
+	weston_presentation_feedback_discard_list(&surface->feedback_list);
+	wl_list_insert_list(&surface->feedback_list,
+			    &sub->cached.feedback_list);
+	wl_list_init(&sub->cached.feedback_list);
+
 	weston_surface_commit_subsurface_order(surface);
 
 	weston_surface_schedule_repaint(surface);
@@ -2343,14 +3961,21 @@ weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 	 */
 	pixman_region32_translate(&sub->cached.damage,
 				  -surface->pending.sx, -surface->pending.sy);
-	pixman_region32_union(&sub->cached.damage, &sub->cached.damage,
-			      &surface->pending.damage);
-	empty_region(&surface->pending.damage);
+	weston_client_stats_damage(surface, &surface->pending.damage);
+	region_move_union(&sub->cached.damage, &surface->pending.damage);
 
 	if (surface->pending.newly_attached) {
 		sub->cached.newly_attached = 1;
+		weston_buffer_stats_attach(surface->compositor,
+					   surface->pending.buffer);
 		weston_buffer_reference(&sub->cached.buffer_ref,
 					surface->pending.buffer);
+
+		if (sub->cached.acquire_fence_fd >= 0)
+			close(sub->cached.acquire_fence_fd);
+		sub->cached.acquire_fence_fd =
+			surface->pending.acquire_fence_fd;
+		surface->pending.acquire_fence_fd = -1;
 	}
 	sub->cached.sx += surface->pending.sx;
 	sub->cached.sy += surface->pending.sy;
@@ -2359,6 +3984,8 @@ weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 
 	sub->cached.buffer_viewport = surface->pending.buffer_viewport;
 
+	/* The pending regions stay in effect for later commits, so these
+	 * are copies; single rectangles copy without allocating. */
 	pixman_region32_copy(&sub->cached.opaque, &surface->pending.opaque);
 
 	pixman_region32_copy(&sub->cached.input, &surface->pending.input);
@@ -2367,6 +3994,11 @@ weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 			    &surface->pending.frame_callback_list);
 	wl_list_init(&surface->pending.frame_callback_list);
 
+	weston_presentation_feedback_discard_list(&sub->cached.feedback_list);
+	wl_list_insert_list(&sub->cached.feedback_list,
+			    &surface->pending.feedback_list);
+	wl_list_init(&surface->pending.feedback_list);
+
 	sub->cached.has_data = 1;
 }
 
@@ -2480,6 +4112,7 @@ subsurface_configure(struct weston_surface *surface, int32_t dx, int32_t dy)
 		assert(!wl_list_empty(&compositor->output_list));
 		surface->output = container_of(compositor->output_list.next,
 					       struct weston_output, link);
+		compositor->view_list_needs_rebuild = 1;
 	}
 }
 
@@ -2635,6 +4268,8 @@ weston_subsurface_cache_init(struct weston_subsurface *sub)
 	pixman_region32_init(&sub->cached.opaque);
 	pixman_region32_init(&sub->cached.input);
 	wl_list_init(&sub->cached.frame_callback_list);
+	wl_list_init(&sub->cached.feedback_list);
+	sub->cached.acquire_fence_fd = -1;
 	sub->cached.buffer_ref.buffer = NULL;
 }
 
@@ -2646,6 +4281,11 @@ weston_subsurface_cache_fini(struct weston_subsurface *sub)
 	wl_list_for_each_safe(cb, tmp, &sub->cached.frame_callback_list, link)
 		wl_resource_destroy(cb->resource);
 
+	weston_presentation_feedback_discard_list(&sub->cached.feedback_list);
+
+	if (sub->cached.acquire_fence_fd >= 0)
+		close(sub->cached.acquire_fence_fd);
+
 	weston_buffer_reference(&sub->cached.buffer_ref, NULL);
 	pixman_region32_fini(&sub->cached.damage);
 	pixman_region32_fini(&sub->cached.opaque);
@@ -2890,6 +4530,7 @@ subcompositor_get_subsurface(struct wl_client *client,
 
 	surface->configure = subsurface_configure;
 	surface->configure_private = sub;
+	surface->compositor->view_list_needs_rebuild = 1;
 }
 
 static void
@@ -3005,6 +4646,7 @@ weston_plane_init(struct weston_plane *plane,
 	plane->x = x;
 	plane->y = y;
 	plane->compositor = ec;
+	plane->type = WESTON_PLANE_OVERLAY;
 
 	/* Init the link so that the call to wl_list_remove() when releasing
 	 * the plane without ever stacking doesn't lead to a crash */
@@ -3114,10 +4756,19 @@ weston_output_destroy(struct weston_output *output)
 
 	weston_compositor_remove_output(output->compositor, output);
 	wl_list_remove(&output->link);
+	pick_grid_dirty(output->compositor);
 
 	wl_signal_emit(&output->compositor->output_destroyed_signal, output);
 	wl_signal_emit(&output->destroy_signal, output);
 
+	if (output->repaint_timer)
+		wl_event_source_remove(output->repaint_timer);
+
+	weston_presentation_feedback_discard_list(&output->feedback_list);
+
+	wl_array_release(&output->views);
+	output->compositor->output_views_dirty = 1;
+
 	free(output->name);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
@@ -3200,7 +4851,7 @@ weston_output_update_matrix(struct weston_output *output)
 
 	if (output->zoom.active) {
 		magnification = 1 / (1 - output->zoom.spring_z.current);
-		weston_output_update_zoom(output);
+		weston_output_update_zoom_transform(output);
 		weston_matrix_translate(&output->matrix, -output->zoom.trans_x,
 					output->zoom.trans_y, 0);
 		weston_matrix_scale(&output->matrix, magnification,
@@ -3252,6 +4903,8 @@ weston_output_init_geometry(struct weston_output *output, int x, int y)
 	pixman_region32_init_rect(&output->region, x, y,
 				  output->width,
 				  output->height);
+
+	pick_grid_dirty(output->compositor);
 }
 
 WL_EXPORT void
@@ -3315,8 +4968,20 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	wl_signal_init(&output->frame_signal);
 	wl_signal_init(&output->destroy_signal);
 	wl_list_init(&output->animation_list);
+	wl_list_init(&output->feedback_list);
+	wl_list_init(&output->view_animation.link);
+	wl_list_init(&output->view_animation_list);
 	wl_list_init(&output->resource_list);
 
+	wl_array_init(&output->views);
+	c->output_views_dirty = 1;
+
+	output->repaint_window = 0;
+	output->repaint_duration = 0;
+	output->repaint_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(c->wl_display),
+					output_repaint_timer_handler, output);
+
 	output->id = ffs(~output->compositor->output_id_pool) - 1;
 	output->compositor->output_id_pool |= 1 << output->id;
 
@@ -3585,6 +5250,82 @@ bind_scaler(struct wl_client *client,
 				       NULL, NULL);
 }
 
+static void
+presentation_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+destroy_presentation_feedback(struct wl_resource *feedback_resource)
+{
+	struct weston_presentation_feedback *feedback;
+
+	feedback = wl_resource_get_user_data(feedback_resource);
+
+	wl_list_remove(&feedback->link);
+	free(feedback);
+}
+
+static void
+presentation_feedback(struct wl_client *client,
+		      struct wl_resource *presentation_resource,
+		      struct wl_resource *surface_resource,
+		      uint32_t callback)
+{
+	struct weston_surface *surface;
+	struct weston_presentation_feedback *feedback;
+
+	surface = wl_resource_get_user_data(surface_resource);
+
+	feedback = zalloc(sizeof *feedback);
+	if (feedback == NULL)
+		goto err_calloc;
+
+	feedback->resource = wl_resource_create(client,
+					&presentation_feedback_interface,
+					1, callback);
+	if (!feedback->resource)
+		goto err_create;
+
+	wl_resource_set_implementation(feedback->resource, NULL, feedback,
+				       destroy_presentation_feedback);
+
+	wl_list_insert(&surface->pending.feedback_list, &feedback->link);
+
+	return;
+
+err_create:
+	free(feedback);
+
+err_calloc:
+	wl_client_post_no_memory(client);
+}
+
+static const struct presentation_interface presentation_implementation = {
+	presentation_destroy,
+	presentation_feedback
+};
+
+static void
+bind_presentation(struct wl_client *client,
+		  void *data, uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &presentation_interface,
+				      MIN(version, 1), id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &presentation_implementation,
+				       compositor, NULL);
+	presentation_send_clock_id(resource, compositor->presentation_clock);
+}
+
 static void
 compositor_bind(struct wl_client *client,
 		void *data, uint32_t version, uint32_t id)
@@ -3646,6 +5387,7 @@ weston_compositor_init(struct weston_compositor *ec,
 	struct wl_event_loop *loop;
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
+	int i;
 
 	ec->config = config;
 	ec->wl_display = display;
@@ -3680,7 +5422,16 @@ weston_compositor_init(struct weston_compositor *ec,
 			      ec, bind_scaler))
 		return -1;
 
+	if (!wl_global_create(ec->wl_display, &presentation_interface, 1,
+			      ec, bind_presentation))
+		return -1;
+
 	wl_list_init(&ec->view_list);
+	wl_array_init(&ec->view_list_stack);
+	ec->view_list_needs_rebuild = 1;
+	/* matches weston_compositor_get_time() */
+	ec->presentation_clock = CLOCK_REALTIME;
+	ec->pick_grid.dirty = 1;
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
@@ -3691,10 +5442,16 @@ weston_compositor_init(struct weston_compositor *ec,
 	wl_list_init(&ec->touch_binding_list);
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
+	for (i = 0; i < WESTON_BINDING_HASH_SIZE; i++)
+		wl_list_init(&ec->binding_hash[i]);
 
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
+	ec->primary_plane.type = WESTON_PLANE_RENDERER;
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
 
+	weston_compositor_add_debug_binding(ec, KEY_M,
+					    object_pool_binding, NULL);
+
 	s = weston_config_get_section(ec->config, "keyboard", NULL, NULL);
 	weston_config_section_get_string(s, "keymap_rules",
 					 (char **) &xkb_names.rules, NULL);
@@ -3711,6 +5468,11 @@ weston_compositor_init(struct weston_compositor *ec,
 		return -1;
 
 	text_backend_init(ec);
+	weston_timeline_create(ec);
+	weston_latency_create(ec);
+	weston_buffer_stats_create(ec);
+	weston_client_stats_create(ec);
+	weston_heatmap_create(ec);
 
 	wl_data_device_manager_init(ec->wl_display);
 
@@ -3720,8 +5482,42 @@ weston_compositor_init(struct weston_compositor *ec,
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
 	wl_event_source_timer_update(ec->idle_source, ec->idle_time * 1000);
 
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_int(s, "occluded-frame-rate",
+				      &ec->occluded_frame_rate, -1);
+	if (ec->occluded_frame_rate > 1000)
+		ec->occluded_frame_rate = 1000;
+	ec->occluded_frame_timer =
+		wl_event_loop_add_timer(loop, occluded_frame_handler, ec);
+	ec->frame_only_timer =
+		wl_event_loop_add_timer(loop, frame_only_handler, ec);
+	ec->update_cap_timer =
+		wl_event_loop_add_timer(loop, update_cap_handler, ec);
+	weston_config_section_get_bool(s, "motion-coalescing",
+				       &ec->coalesce_motion, 0);
+	weston_config_section_get_bool(s, "touch-resampling",
+				       &ec->touch_resampling, 0);
+	weston_config_section_get_int(s, "touch-prediction",
+				      &ec->touch_prediction, 0);
+	if (ec->touch_prediction < 0)
+		ec->touch_prediction = 0;
+	if (ec->touch_prediction > 16)
+		ec->touch_prediction = 16;
+	weston_config_section_get_int(s, "data-device-relay-size",
+				      &ec->data_relay_size, 0);
+	if (ec->data_relay_size < 0)
+		ec->data_relay_size = 0;
+	if (ec->data_relay_size > 64 * 1024)
+		ec->data_relay_size = 64 * 1024;
+	ec->data_relay_size *= 1024;
+
 	ec->input_loop = wl_event_loop_create();
 
+	wl_list_init(&ec->deferred_init_list);
+	ec->deferred_init_timer =
+		wl_event_loop_add_timer(loop, deferred_init_handler, ec);
+	wl_event_source_timer_update(ec->deferred_init_timer, 1000);
+
 	weston_layer_init(&ec->fade_layer, &ec->layer_list);
 	weston_layer_init(&ec->cursor_layer, &ec->fade_layer.link);
 
@@ -3734,8 +5530,17 @@ WL_EXPORT void
 weston_compositor_shutdown(struct weston_compositor *ec)
 {
 	struct weston_output *output, *next;
+	struct weston_deferred_init *init, *inext;
 
 	wl_event_source_remove(ec->idle_source);
+	wl_event_source_remove(ec->occluded_frame_timer);
+	wl_event_source_remove(ec->frame_only_timer);
+	wl_event_source_remove(ec->update_cap_timer);
+	wl_event_source_remove(ec->deferred_init_timer);
+	wl_list_for_each_safe(init, inext, &ec->deferred_init_list, link) {
+		free(init->name);
+		free(init);
+	}
 	if (ec->input_loop_source)
 		wl_event_source_remove(ec->input_loop_source);
 
@@ -3754,6 +5559,9 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 
 	weston_plane_release(&ec->primary_plane);
 
+	wl_array_release(&ec->view_list_stack);
+	pick_grid_release(ec);
+
 	wl_event_loop_destroy(ec->input_loop);
 
 	weston_config_destroy(ec->config);
@@ -3908,6 +5716,7 @@ on_caught_signal(int s, siginfo_t *siginfo, void *context)
 	weston_log("caught signal: %d\n", s);
 
 	print_backtrace();
+	weston_log_flush();
 
 	segv_compositor->restore(segv_compositor);
 
@@ -3952,14 +5761,18 @@ weston_load_module(const char *name, const char *entrypoint)
 	return init;
 }
 
-static int
-load_modules(struct weston_compositor *ec, const char *modules,
-	     int *argc, char *argv[])
+/** Load and initialize a comma separated list of modules
+ *
+ * Logs how long each module took to load and initialize. */
+WL_EXPORT int
+weston_compositor_load_modules(struct weston_compositor *ec,
+			       const char *modules, int *argc, char *argv[])
 {
 	const char *p, *end;
 	char buffer[256];
 	int (*module_init)(struct weston_compositor *ec,
 			   int *argc, char *argv[]);
+	struct timespec begin;
 
 	if (modules == NULL)
 		return 0;
@@ -3968,9 +5781,13 @@ load_modules(struct weston_compositor *ec, const char *modules,
 	while (*p) {
 		end = strchrnul(p, ',');
 		snprintf(buffer, sizeof buffer, "%.*s", (int) (end - p), p);
+		clock_gettime(CLOCK_MONOTONIC, &begin);
 		module_init = weston_load_module(buffer, "module_init");
-		if (module_init)
+		if (module_init) {
 			module_init(ec, argc, argv);
+			weston_log("Module '%s' initialized in %.1f ms\n",
+				   buffer, elapsed_ms(&begin));
+		}
 		p = end;
 		while (*p == ',')
 			p++;
@@ -4056,7 +5873,8 @@ usage(int error_code)
 	fprintf(stderr,
 		"Options for fbdev-backend.so:\n\n"
 		"  --tty=TTY\t\tThe tty to use\n"
-		"  --device=DEVICE\tThe framebuffer device to use\n\n");
+		"  --device=DEVICE\tThe framebuffer device to use\n"
+		"  --double-buffer\tFlip between two buffers at vblank\n\n");
 
 	fprintf(stderr,
 		"Options for x11-backend.so:\n\n"
@@ -4067,6 +5885,19 @@ usage(int error_code)
 		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --no-input\t\tDont create input devices\n\n");
 
+	fprintf(stderr,
+		"Options for headless-backend.so:\n\n"
+		"  --width=WIDTH\t\tWidth of the output\n"
+		"  --height=HEIGHT\tHeight of the output\n"
+		"  --output-count=COUNT\tCreate multiple outputs\n"
+		"  --refresh=HZ\t\tRepaint rate, 0 repaints unthrottled\n"
+		"  --use-pixman\t\tUse the pixman (CPU) renderer\n"
+		"  --benchmark\t\tRepaint synthetic surfaces and report timings\n"
+		"  --benchmark-surfaces=N\tNumber of synthetic surfaces\n"
+		"  --benchmark-frames=N\tExit after N frames, 0 runs forever\n"
+		"  --benchmark-rate=HZ\tRepaint rate, 0 repaints unthrottled\n"
+		"  --benchmark-damage=PATTERN\tOne of full, partial or move\n\n");
+
 	fprintf(stderr,
 		"Options for wayland-backend.so:\n\n"
 		"  --width=WIDTH\t\tWidth of Wayland surface\n"
@@ -4099,6 +5930,8 @@ usage(int error_code)
        "  --address=ADDR\tThe address to bind\n"
        "  --port=PORT\tThe port to listen on\n"
        "  --no-clients-resize\tThe RDP peers will be forced to the size of the desktop\n"
+       "  --encoder-threads=N\tNumber of threads encoding RemoteFX and NSCodec\n"
+       "\t\t\tupdates, 0 encodes on the main thread (default: 2)\n"
        "  --rdp4-key=FILE\tThe file containing the key for RDP4 encryption\n"
        "  --rdp-tls-cert=FILE\tThe file containing the certificate for TLS encryption\n"
        "  --rdp-tls-key=FILE\tThe file containing the private key for TLS encryption\n"
@@ -4171,6 +6004,8 @@ int main(int argc, char *argv[])
 		{ WESTON_OPTION_BOOLEAN, "no-config", 0, &noconfig },
 	};
 
+	clock_gettime(CLOCK_MONOTONIC, &startup_time);
+
 	parse_options(core_options, ARRAY_LENGTH(core_options), &argc, argv);
 
 	if (help)
@@ -4257,20 +6092,21 @@ int main(int argc, char *argv[])
 		weston_config_section_get_string(section, "shell", &shell,
 						 "desktop-shell.so");
 
-	if (load_modules(ec, shell, &argc, argv) < 0) {
+	if (weston_compositor_load_modules(ec, shell, &argc, argv) < 0) {
 		free(shell);
 		goto out;
 	}
 	free(shell);
 
 	weston_config_section_get_string(section, "modules", &modules, "");
-	if (load_modules(ec, modules, &argc, argv) < 0) {
+	if (weston_compositor_load_modules(ec, modules, &argc, argv) < 0) {
 		free(modules);
 		goto out;
 	}
 	free(modules);
 
-	if (load_modules(ec, option_modules, &argc, argv) < 0)
+	if (weston_compositor_load_modules(ec, option_modules,
+					   &argc, argv) < 0)
 		goto out;
 
 	for (i = 1; i < argc; i++)
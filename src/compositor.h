@@ -28,6 +28,7 @@
 extern "C" {
 #endif
 
+#include <time.h>
 #include <pixman.h>
 #include <xkbcommon/xkbcommon.h>
 
@@ -43,6 +44,10 @@ extern "C" {
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
 #endif
 
+#ifndef MAX
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
+#endif
+
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
 
 #define container_of(ptr, type, member) ({				\
@@ -137,6 +142,12 @@ struct weston_spring {
 	double min, max;
 	uint32_t timestamp;
 	uint32_t clip;
+
+	/* Transition matrix for step_count integration steps with the
+	 * given constants, see weston_spring_update(). */
+	double step_k, step_friction;
+	uint32_t step_count;
+	double step_matrix[4];
 };
 
 struct weston_fixed_point {
@@ -173,6 +184,32 @@ enum weston_mode_switch_op {
 	WESTON_MODE_SWITCH_RESTORE_NATIVE
 };
 
+/* Stages of a repaint recorded by weston_timeline_point(), in the order
+ * they happen; the timeline file stores the point names.  The GPU stages
+ * are measured by the renderer and recorded with
+ * weston_timeline_duration() once the results are available. */
+enum weston_timeline_point {
+	WESTON_TIMELINE_REPAINT_BEGIN = 0,
+	WESTON_TIMELINE_VIEW_LIST,
+	WESTON_TIMELINE_ASSIGN_PLANES,
+	WESTON_TIMELINE_ACCUMULATE_DAMAGE,
+	WESTON_TIMELINE_RENDER_BEGIN,
+	WESTON_TIMELINE_RENDER_VIEWS,
+	WESTON_TIMELINE_RENDER_SWAP,
+	WESTON_TIMELINE_PAGE_FLIP_QUEUED,
+	WESTON_TIMELINE_OUTPUT_REPAINT,
+	WESTON_TIMELINE_INPUT,
+	WESTON_TIMELINE_FRAME_CALLBACKS,
+	WESTON_TIMELINE_REPAINT_END,
+	WESTON_TIMELINE_FRAME_FINISHED,
+	WESTON_TIMELINE_GPU_FRAME,
+	WESTON_TIMELINE_GPU_VIEW,
+	WESTON_TIMELINE_POINT_COUNT
+};
+
+/* weston_output::repaint_window derived from measured repaint times */
+#define WESTON_REPAINT_WINDOW_MEASURED	-1
+
 struct weston_output {
 	uint32_t id;
 	char *name;
@@ -185,12 +222,19 @@ struct weston_output {
 	struct weston_compositor *compositor;
 	struct weston_matrix matrix;
 	struct wl_list animation_list;
+	/* View animations are advanced together by one entry on
+	 * animation_list, see animation.c. */
+	struct weston_animation view_animation;
+	struct wl_list view_animation_list;
 	int32_t x, y, width, height;
 	int32_t mm_width, mm_height;
 	pixman_region32_t region;
 	pixman_region32_t previous_damage;
 	int repaint_needed;
 	int repaint_scheduled;
+	/* struct weston_view *, in view_list order, of the views on this
+	 * output and of those on no output; valid during repaint. */
+	struct wl_array views;
 	struct weston_output_zoom zoom;
 	int dirty;
 	struct wl_signal frame_signal;
@@ -198,8 +242,19 @@ struct weston_output {
 	struct wl_signal move_signal;
 	int move_x, move_y;
 	uint32_t frame_time;
+	uint64_t msc;		/* vertical retrace counter, see presentation */
+	/* presentation_feedback for the frame being presented */
+	struct wl_list feedback_list;
 	int disable_planes;
+	int hardware_planes;	/* overlay planes assign_planes can use */
 	int destroying;
+	struct weston_output_latency *latency;	/* see latency.c */
+
+	/* Repaint this many ms before the predicted next vblank instead
+	 * of right after the previous one; 0 disables the delay. */
+	int32_t repaint_window;
+	uint32_t repaint_duration;	/* running average, us */
+	struct wl_event_source *repaint_timer;
 
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
@@ -208,6 +263,12 @@ struct weston_output {
 	int32_t current_scale;
 	int32_t original_scale;
 
+	/* When non-zero, the renderer draws into buffers of this size and
+	 * the backend scales them up to the current mode.  Only the
+	 * viewport changes, the output matrix maps to clip space the same
+	 * way at any size. */
+	int32_t render_width, render_height;
+
 	struct weston_mode *native_mode;
 	struct weston_mode *current_mode;
 	struct weston_mode *original_mode;
@@ -292,6 +353,7 @@ struct weston_data_offer {
 	struct wl_resource *resource;
 	struct weston_data_source *source;
 	struct wl_listener source_destroy_listener;
+	struct weston_compositor *compositor;
 };
 
 struct weston_data_source {
@@ -337,6 +399,22 @@ struct weston_pointer {
 };
 
 
+/* Touch points whose motion a seat holds back, or keeps the history
+ * of for resampling, at most */
+#define WESTON_BINDING_HASH_SIZE	64	/* power of two */
+
+#define WESTON_COALESCE_TOUCH_POINTS	16
+#define WESTON_TOUCH_HISTORY_SIZE	4
+
+struct weston_touch_history {
+	int32_t id;
+	int count;		/* samples, 0 when the entry is unused */
+	struct {
+		uint32_t time;
+		wl_fixed_t x, y;
+	} sample[WESTON_TOUCH_HISTORY_SIZE];	/* newest first */
+};
+
 struct weston_touch {
 	struct weston_seat *seat;
 
@@ -356,6 +434,8 @@ struct weston_touch {
 	wl_fixed_t grab_x, grab_y;
 	uint32_t grab_serial;
 	uint32_t grab_time;
+
+	struct weston_touch_history history[WESTON_COALESCE_TOUCH_POINTS];
 };
 
 struct weston_pointer *
@@ -432,7 +512,6 @@ struct weston_xkb_info {
 	struct xkb_keymap *keymap;
 	int keymap_fd;
 	size_t keymap_size;
-	char *keymap_area;
 	int32_t ref_count;
 	xkb_mod_index_t shift_mod;
 	xkb_mod_index_t caps_mod;
@@ -516,6 +595,25 @@ struct weston_seat {
 	uint32_t slot_map;
 	struct input_method *input_method;
 	char *seat_name;
+
+	/* Motion held back while the compositor coalesces motion, until
+	 * the input being dispatched is done or another event needs
+	 * the pointer and touch points where they really are. */
+	struct {
+		struct wl_event_source *idle;
+
+		int pointer;		/* pointer motion pending */
+		uint32_t pointer_time;
+		wl_fixed_t x, y;
+
+		int touch_count;
+		struct {
+			int32_t id;
+			uint32_t time;
+			wl_fixed_t x, y;
+		} touch[WESTON_COALESCE_TOUCH_POINTS];
+		int touch_frame;	/* a touch frame ends the motion */
+	} coalesce;
 };
 
 enum {
@@ -531,19 +629,66 @@ struct weston_layer {
 	struct wl_list link;
 };
 
+/* What shows a plane's views; for reporting where views ended up. */
+enum weston_plane_type {
+	WESTON_PLANE_RENDERER,	/* composited by the renderer */
+	WESTON_PLANE_SCANOUT,	/* a client buffer is the output's fb */
+	WESTON_PLANE_OVERLAY,
+	WESTON_PLANE_CURSOR,
+};
+
 struct weston_plane {
 	struct weston_compositor *compositor;
 	pixman_region32_t damage;
 	pixman_region32_t clip;
 	int32_t x, y;
 	struct wl_list link;
+	enum weston_plane_type type;	/* WESTON_PLANE_OVERLAY by default */
+};
+
+struct weston_pick_grid_cell;
+struct weston_timeline;
+struct weston_latency;
+struct weston_output_latency;
+struct weston_buffer_stats;
+struct weston_client_stats;
+struct weston_client_stats_list;
+struct weston_heatmap;
+
+#define WESTON_BUFFER_STATS_REPAINTS	4
+
+/* Buffer holds since the last reset, times in microseconds. */
+struct weston_buffer_stats_summary {
+	uint32_t released;	/* holds ended by wl_buffer.release */
+	uint32_t unused;	/* of those, never repainted */
+	uint32_t attach_to_use_avg, attach_to_use_max;
+	uint32_t use_to_release_avg, use_to_release_max;
+	/* released after 0, 1, 2 and 3 or more further repaints */
+	uint32_t release_repaints[WESTON_BUFFER_STATS_REPAINTS];
 };
 
+struct linux_dmabuf_buffer;
+
+/* Pixels are only valid until the callback returns, NULL if the
+ * readback failed. */
+typedef void (*weston_read_pixels_done_func_t)(struct weston_output *output,
+					       void *pixels, void *data);
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height);
+	/* Start reading back the current output contents without waiting
+	 * for the GPU.  done is called from the event loop once the pixels
+	 * are available, in the order the reads were started.  Returns -1
+	 * if the read could not be started and done will not be called. */
+	int (*read_pixels_async)(struct weston_output *output,
+				 pixman_format_code_t format,
+				 uint32_t x, uint32_t y,
+				 uint32_t width, uint32_t height,
+				 weston_read_pixels_done_func_t done,
+				 void *data);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
 	void (*flush_damage)(struct weston_surface *surface);
@@ -552,6 +697,24 @@ struct weston_renderer {
 			       float red, float green,
 			       float blue, float alpha);
 	void (*destroy)(struct weston_compositor *ec);
+
+	/* Import a buffer created through linux_dmabuf, before it is
+	 * handed to the client.  Returns -1 if the renderer can't use it,
+	 * the client is told so and the buffer is never attached. */
+	int (*import_dmabuf)(struct weston_compositor *ec,
+			     struct linux_dmabuf_buffer *buffer);
+
+	/* Keep a copy of the surface's content downscaled to width x
+	 * height, in surface coordinates, and draw views shown at that
+	 * size or smaller from it.  0x0 drops the copy.  Optional. */
+	void (*surface_set_thumbnail_size)(struct weston_surface *surface,
+					   int32_t width, int32_t height);
+
+	/* Pass every repaint of the output through a 3D lookup table of
+	 * size^3 RGBA entries, red varying fastest, then green, then
+	 * blue.  NULL removes it.  Optional. */
+	void (*output_set_color_lut)(struct weston_output *output,
+				     const uint8_t *lut, int size);
 };
 
 enum weston_capability {
@@ -606,6 +769,23 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;
 	struct wl_list view_list;
+	/* Set when view_list must be rebuilt from the layers, i.e. views
+	 * were unmapped or destroyed or a sub-surface tree changed.
+	 * Layer contents are compared against view_list_stack, so shells
+	 * moving views between layers do not need to set this. */
+	int view_list_needs_rebuild;
+	struct wl_array view_list_stack; /* struct weston_view *, layer order */
+	int output_views_dirty;		/* weston_output::views */
+
+	/* Grid over view bounding boxes for weston_compositor_pick_view(),
+	 * rebuilt lazily when dirty. */
+	struct {
+		int dirty;
+		int32_t x, y;		/* origin in global coordinates */
+		int width, height;	/* in cells */
+		int cells_allocated;
+		struct weston_pick_grid_cell *cells;
+	} pick_grid;
 	struct wl_list plane_list;
 	struct wl_list key_binding_list;
 	struct wl_list modifier_binding_list;
@@ -613,18 +793,62 @@ struct weston_compositor {
 	struct wl_list touch_binding_list;
 	struct wl_list axis_binding_list;
 	struct wl_list debug_binding_list;
+	/* Key, button and axis bindings by (code, modifier) */
+	struct wl_list binding_hash[WESTON_BINDING_HASH_SIZE];
+	uint32_t binding_input_serial;
 
 	uint32_t state;
 	struct wl_event_source *idle_source;
 	uint32_t idle_inhibit;
 	int idle_time;			/* timeout, s */
 
+	/* Frame callbacks of occluded surfaces are sent at this rate,
+	 * in Hz; 0 holds them until visible, -1 doesn't throttle. */
+	int32_t occluded_frame_rate;
+	struct wl_event_source *occluded_frame_timer;
+	int occluded_frame_timer_armed;
+
+	/* Sends the frame callbacks of commits that changed nothing
+	 * while their outputs are idle, see weston_surface_commit(). */
+	struct wl_event_source *frame_only_timer;
+	int frame_only_timer_armed;
+
+	/* Repaints rate capped surfaces once their update is due */
+	struct wl_event_source *update_cap_timer;
+	int update_cap_timer_armed;
+	uint32_t update_cap_due;
+
+	/* Merge pointer and touch motion between other input events */
+	int coalesce_motion;
+
+	/* Move touch points to where they are when the frame showing
+	 * them is presented, minus a few ms plus touch_prediction */
+	int touch_resampling;
+	int32_t touch_prediction;	/* ms */
+
+	/* Buffer up to this many bytes of each data offer transfer in
+	 * the compositor, so the source doesn't wait for slow receivers;
+	 * 0 hands the receiver's fd straight to the source. */
+	int32_t data_relay_size;
+
 	const struct weston_pointer_grab_interface *default_pointer_grab;
 
 	/* Repaint state. */
 	struct weston_plane primary_plane;
+	clockid_t presentation_clock;	/* of weston_output_finish_frame() */
+	struct weston_timeline *timeline;
+	struct weston_latency *latency;
+	struct weston_buffer_stats *buffer_stats;
+	struct weston_client_stats_list *client_stats;
+	struct weston_heatmap *heatmap;
 	uint32_t capabilities; /* combination of enum weston_capability */
 
+	/* Module init work put off until the first frame is out, see
+	 * weston_compositor_defer_init() */
+	struct wl_list deferred_init_list;
+	struct wl_event_source *deferred_init_timer;
+	int first_frame_done;
+
 	struct weston_renderer *renderer;
 
 	pixman_format_code_t read_format;
@@ -657,6 +881,30 @@ struct weston_buffer {
 	int32_t width, height;
 	uint32_t busy_count;
 	int y_inverted;
+
+	/* Current hold, while tracked, see buffer-stats.c */
+	struct weston_buffer_stats *stats;
+	struct wl_list stats_link;
+	uint64_t attach_usec, use_usec;
+	uint32_t use_repaint;
+
+	/* Counted against its client while busy, see client-stats.c */
+	struct weston_client_stats *client_stats;
+	struct wl_list client_stats_link;
+	uint64_t client_bytes;
+
+	/* Explicit sync: the struct weston_buffer_release of the commits
+	 * of this buffer, sent once it is no longer busy, with
+	 * release_fence_fd if the renderer set one. */
+	struct wl_list release_list;
+	int release_fence_fd;
+};
+
+/* A zlinux_buffer_release, see linux-explicit-synchronization.c */
+struct weston_buffer_release {
+	struct wl_resource *resource;
+	struct wl_list link;		/* weston_buffer::release_list */
+	struct weston_surface *surface;	/* while pending on it */
 };
 
 struct weston_buffer_reference {
@@ -733,6 +981,12 @@ struct weston_subsurface {
 		/* wl_surface.frame */
 		struct wl_list frame_callback_list;
 
+		/* presentation.feedback */
+		struct wl_list feedback_list;
+
+		/* zlinux_surface_synchronization.set_acquire_fence */
+		int acquire_fence_fd;
+
 		/* wl_surface.set_buffer_transform */
 		/* wl_surface.set_buffer_scale */
 		struct weston_buffer_viewport buffer_viewport;
@@ -774,6 +1028,15 @@ struct weston_subsurface {
  *    Mparent * Mn * ... * M2 * M1
  */
 
+/* Placement hints a shell can give the backend's plane assignment. */
+enum weston_view_plane_hint {
+	/* prefer an overlay plane over the views competing for one */
+	WESTON_VIEW_PLANE_HINT_OVERLAY = (1 << 0),
+	/* allow direct scanout when the transformation only moves the
+	 * view onto the output */
+	WESTON_VIEW_PLANE_HINT_SCANOUT = (1 << 1),
+};
+
 struct weston_view {
 	struct weston_surface *surface;
 	struct wl_list surface_link;
@@ -784,6 +1047,18 @@ struct weston_view {
 	struct weston_plane *plane;
 
 	pixman_region32_t clip;
+	/* Bounding box completely covered by opaque views above, on this
+	 * or higher planes; updated by weston_output_repaint(). */
+	int occluded;
+	uint32_t plane_hint;		/* enum weston_view_plane_hint */
+	/* Pixels matching colorkey (0xRRGGBB) are left out of the
+	 * view.  Only the GL renderer and planes with a colorkey
+	 * property honour it; keyed views never count as opaque. */
+	int colorkey_enabled;
+	uint32_t colorkey;
+	/* Adjacent views with the same non-zero value change rarely;
+	 * a renderer may composite them once and reuse the result. */
+	uint32_t cache_group;
 	float alpha;                     /* part of geometry, see below */
 
 	void *renderer_state;
@@ -822,6 +1097,16 @@ struct weston_view {
 		struct weston_matrix inverse;
 
 		struct weston_transform position; /* matrix from x, y */
+
+		/* Set when the total transformation is a translation by
+		 * whole pixels, the common case for subsurfaces; picking
+		 * then maps coordinates with integer math alone. */
+		int translate_only;
+		int32_t tx, ty;
+
+		/* Changes every time the above is recomputed, and is
+		 * never reused by another view; 0 if never computed. */
+		uint32_t serial;
 	} transform;
 
 	/*
@@ -838,6 +1123,26 @@ struct weston_view {
 	uint32_t output_mask;
 };
 
+/* Running counters for what a surface costs, for shells that want to
+ * tell which client is eating the frame time.  Never reset; sample and
+ * subtract for rates.  Frames count buffers committed, presented when
+ * they made it into a repaint and dropped when replaced before that. */
+struct weston_surface_stats {
+	uint32_t commits;
+	uint32_t commit_rate;		/* commits in the last full second */
+	uint32_t frames_presented;
+	uint32_t frames_dropped;
+	uint32_t frames_on_primary;	/* repaints composited by the renderer */
+	uint32_t frames_on_plane;	/* repaints scanned out of a hw plane */
+	uint64_t bytes_uploaded;	/* shm contents copied to textures */
+	uint64_t pixels_composited;	/* output pixels the renderer drew */
+	uint64_t texture_bytes;		/* GPU memory the renderer holds now */
+
+	uint32_t rate_start;		/* ms, start of the commit_rate window */
+	uint32_t rate_count;
+	int frame_pending;		/* committed buffer not yet repainted */
+};
+
 struct weston_surface {
 	struct wl_resource *resource;
 	struct wl_signal destroy_signal;
@@ -855,6 +1160,10 @@ struct weston_surface {
 
 	void *renderer_state;
 
+	/* Set by the renderer on attach when the buffer has no alpha
+	 * channel; the whole surface then counts as opaque. */
+	int is_opaque;
+
 	struct wl_list views;
 
 	/*
@@ -871,16 +1180,49 @@ struct weston_surface {
 	uint32_t output_mask;
 
 	struct wl_list frame_callback_list;
+	struct wl_list feedback_list;
+	int frame_only;		/* callbacks wait for frame_only_timer */
+
+	/* Rate cap set by the shell: damage, frame callbacks and
+	 * presentation feedback are held back until update_interval ms
+	 * have passed since the last update. A best effort surface is
+	 * held back to a quarter of the refresh rate while its output
+	 * repaints slower than the refresh rate. */
+	uint32_t update_interval;
+	int update_best_effort;
+	uint32_t update_time;
+	int update_flushed;
+	int update_deferred;
 
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
 	int32_t width_from_buffer; /* before applying viewport */
 	int32_t height_from_buffer;
+
+	/* Source crop set by the shell, see weston_surface_set_shell_crop.
+	 * applied is set while it stands in buffer_viewport. */
+	struct {
+		int32_t x, y, width, height;
+		int applied;
+	} shell_crop;
+
 	int keep_buffer; /* bool for backends to prevent early release */
 
+	struct weston_surface_stats stats;
+
+	/* NULL for the compositor's own surfaces, see client-stats.c */
+	struct weston_client_stats *client_stats;
+	struct wl_list client_stats_link;
+
 	/* wl_viewport resource for this surface */
 	struct wl_resource *viewport_resource;
 
+	/* zlinux_surface_synchronization resource for this surface, and
+	 * the acquire fence of the current buffer, -1 if none.  Renderers
+	 * and backends wait on it before reading the buffer. */
+	struct wl_resource *synchronization_resource;
+	int acquire_fence_fd;
+
 	/* All the pending state, that wl_surface.commit will apply. */
 	struct {
 		/* wl_surface.attach */
@@ -899,9 +1241,20 @@ struct weston_surface {
 		/* wl_surface.set_input_region */
 		pixman_region32_t input;
 
+		/* either region was set since the last commit */
+		int regions_set;
+
 		/* wl_surface.frame */
 		struct wl_list frame_callback_list;
 
+		/* presentation.feedback */
+		struct wl_list feedback_list;
+
+		/* zlinux_surface_synchronization.set_acquire_fence */
+		int acquire_fence_fd;
+		/* zlinux_surface_synchronization.get_release */
+		struct weston_buffer_release *buffer_release;
+
 		/* wl_surface.set_buffer_transform */
 		/* wl_surface.set_scaling_factor */
 		/* wl_viewport.set */
@@ -1032,10 +1385,24 @@ weston_compositor_stack_plane(struct weston_compositor *ec,
 void
 weston_output_finish_frame(struct weston_output *output, uint32_t msecs);
 void
+weston_presentation_feedback_present_list(struct wl_list *list,
+					  struct weston_output *output,
+					  const struct timespec *stamp,
+					  uint64_t msc, uint32_t flags);
+void
+weston_presentation_feedback_discard_list(struct wl_list *list);
+void
 weston_output_schedule_repaint(struct weston_output *output);
 void
 weston_output_damage(struct weston_output *output);
 void
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data);
+void
 weston_compositor_schedule_repaint(struct weston_compositor *compositor);
 void
 weston_compositor_fade(struct weston_compositor *compositor, float tint);
@@ -1163,6 +1530,9 @@ weston_view_create(struct weston_surface *surface);
 void
 weston_view_destroy(struct weston_view *view);
 
+void
+weston_log_object_pools(void);
+
 void
 weston_view_set_position(struct weston_view *view,
 			 float x, float y);
@@ -1184,6 +1554,11 @@ WL_EXPORT void
 weston_surface_set_size(struct weston_surface *surface,
 			int32_t width, int32_t height);
 
+void
+weston_surface_set_shell_crop(struct weston_surface *surface,
+			      int32_t x, int32_t y,
+			      int32_t width, int32_t height);
+
 void
 weston_surface_schedule_repaint(struct weston_surface *surface);
 
@@ -1212,6 +1587,9 @@ void
 weston_buffer_reference(struct weston_buffer_reference *ref,
 			struct weston_buffer *buffer);
 
+void
+weston_buffer_set_release_fence(struct weston_buffer *buffer, int fence_fd);
+
 uint32_t
 weston_compositor_get_time(void);
 
@@ -1225,6 +1603,19 @@ weston_output_init_zoom(struct weston_output *output);
 void
 weston_output_update_zoom(struct weston_output *output);
 void
+weston_output_update_zoom_transform(struct weston_output *output);
+void
+weston_output_zoom_clip_damage(struct weston_output *output,
+			       pixman_region32_t *damage);
+void
+weston_output_zoom_region_to_output(struct weston_output *output,
+				    pixman_region32_t *src,
+				    pixman_region32_t *dest);
+void
+weston_output_zoom_region_from_output(struct weston_output *output,
+				      pixman_region32_t *src,
+				      pixman_region32_t *dest);
+void
 weston_output_activate_zoom(struct weston_output *output);
 void
 weston_output_update_matrix(struct weston_output *output);
@@ -1275,6 +1666,8 @@ void
 weston_log_file_open(const char *filename);
 void
 weston_log_file_close(void);
+void
+weston_log_flush(void);
 int
 weston_vlog(const char *fmt, va_list ap);
 int
@@ -1306,6 +1699,106 @@ tty_activate_vt(struct tty *tty, int vt);
 void
 screenshooter_create(struct weston_compositor *ec);
 
+void
+weston_timeline_create(struct weston_compositor *ec);
+
+void
+weston_timeline_point(struct weston_output *output,
+		      enum weston_timeline_point point);
+
+void
+weston_timeline_duration(struct weston_output *output,
+			 enum weston_timeline_point point, uint64_t nsec);
+
+int
+weston_timeline_start(struct weston_compositor *ec);
+
+int
+weston_timeline_stop(struct weston_compositor *ec, const char *filename);
+
+void
+weston_latency_create(struct weston_compositor *ec);
+
+void
+weston_latency_input(struct weston_compositor *ec, uint32_t time);
+
+void
+weston_latency_schedule_repaint(struct weston_output *output);
+
+void
+weston_latency_repaint(struct weston_output *output);
+
+void
+weston_latency_frame(struct weston_output *output, uint32_t msecs);
+
+void
+weston_buffer_stats_create(struct weston_compositor *ec);
+
+void
+weston_buffer_stats_enable(struct weston_compositor *ec);
+
+void
+weston_buffer_stats_attach(struct weston_compositor *ec,
+			   struct weston_buffer *buffer);
+
+void
+weston_buffer_stats_repaint(struct weston_output *output);
+
+void
+weston_buffer_stats_release(struct weston_buffer *buffer);
+
+void
+weston_buffer_stats_destroy_buffer(struct weston_buffer *buffer);
+
+void
+weston_buffer_stats_read(struct weston_compositor *ec,
+			 struct weston_buffer_stats_summary *summary,
+			 int reset);
+
+void
+weston_client_stats_create(struct weston_compositor *ec);
+
+int
+weston_client_stats_add_surface(struct weston_surface *surface,
+				struct wl_client *client);
+
+void
+weston_client_stats_remove_surface(struct weston_surface *surface);
+
+void
+weston_client_stats_view(struct weston_view *view, int delta);
+
+void
+weston_client_stats_hold_buffer(struct weston_surface *surface,
+				struct weston_buffer *buffer);
+
+void
+weston_client_stats_release_buffer(struct weston_buffer *buffer);
+
+void
+weston_client_stats_damage(struct weston_surface *surface,
+			   pixman_region32_t *damage);
+
+void
+weston_client_stats_commit(struct weston_surface *surface,
+			   uint64_t start_usec);
+
+uint64_t
+weston_client_stats_now(void);
+
+int
+weston_client_stats_defer_frame(struct weston_surface *surface);
+
+void
+weston_surface_set_texture_bytes(struct weston_surface *surface,
+				 uint64_t bytes);
+
+void
+weston_heatmap_create(struct weston_compositor *ec);
+
+void
+weston_heatmap_damage(struct weston_view *view, pixman_region32_t *damage);
+
 enum weston_screenshooter_outcome {
 	WESTON_SCREENSHOOTER_SUCCESS,
 	WESTON_SCREENSHOOTER_NO_MEMORY,
@@ -1317,6 +1810,13 @@ typedef void (*weston_screenshooter_done_func_t)(void *data,
 int
 weston_screenshooter_shoot(struct weston_output *output, struct weston_buffer *buffer,
 			   weston_screenshooter_done_func_t done, void *data);
+int
+weston_screenshooter_shoot_region(struct weston_output *output,
+				  struct weston_buffer *buffer,
+				  int32_t x, int32_t y,
+				  int32_t width, int32_t height,
+				  weston_screenshooter_done_func_t done,
+				  void *data);
 
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
@@ -1379,6 +1879,10 @@ void
 weston_surface_set_color(struct weston_surface *surface,
 			 float red, float green, float blue, float alpha);
 
+void
+weston_surface_set_thumbnail_size(struct weston_surface *surface,
+				  int32_t width, int32_t height);
+
 void
 weston_surface_destroy(struct weston_surface *surface);
 
@@ -1412,9 +1916,22 @@ weston_transformed_region(int width, int height,
 			  enum wl_output_transform transform,
 			  int32_t scale,
 			  pixman_region32_t *src, pixman_region32_t *dest);
+void
+weston_region_simplify(pixman_region32_t *region, int max_boxes,
+		       int max_waste_percent);
 
 void *
 weston_load_module(const char *name, const char *entrypoint);
+int
+weston_compositor_load_modules(struct weston_compositor *ec,
+			       const char *modules, int *argc, char *argv[]);
+
+typedef void (*weston_deferred_init_func_t)(struct weston_compositor *ec,
+					    void *data);
+
+int
+weston_compositor_defer_init(struct weston_compositor *ec, const char *name,
+			     weston_deferred_init_func_t func, void *data);
 
 #ifdef  __cplusplus
 }
@@ -27,6 +27,11 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "compositor.h"
 
@@ -73,16 +78,221 @@ data_offer_accept(struct wl_client *client, struct wl_resource *resource,
 		offer->source->accept(offer->source, serial, mime_type);
 }
 
+/*
+ * A transfer the compositor relays from the source to the receiver
+ * through a pipe of its own.  The pipe soaks up to capacity bytes, so
+ * that the source can write everything and move on or exit while a
+ * slow receiver catches up.  Once that much is queued the source is no
+ * longer read from until the receiver has drained some of it.
+ *
+ * Data only moves between pipes with splice(), the compositor never
+ * copies it.  The relay lives on its own after the offer is gone.
+ */
+struct data_relay {
+	int source_fd;		/* read end of the pipe the source fills */
+	int queue[2];		/* the buffering pipe */
+	int target_fd;		/* the receiver's fd */
+	size_t queued;		/* bytes in queue */
+	size_t capacity;
+	struct wl_event_source *source_event;
+	struct wl_event_source *target_event;
+};
+
+static void
+data_relay_destroy(struct data_relay *relay)
+{
+	if (relay->source_event)
+		wl_event_source_remove(relay->source_event);
+	wl_event_source_remove(relay->target_event);
+
+	if (relay->source_fd >= 0)
+		close(relay->source_fd);
+	close(relay->queue[0]);
+	close(relay->queue[1]);
+	close(relay->target_fd);
+	free(relay);
+}
+
+/* splice() to a receiver that went away raises SIGPIPE; keep it from
+ * taking the compositor down and report EPIPE instead. */
+static ssize_t
+splice_nosigpipe(int fd_in, int fd_out, size_t len)
+{
+	sigset_t pipe_set, old_set;
+	struct timespec zero = { 0, 0 };
+	ssize_t ret;
+	int err;
+
+	sigemptyset(&pipe_set);
+	sigaddset(&pipe_set, SIGPIPE);
+	sigprocmask(SIG_BLOCK, &pipe_set, &old_set);
+
+	ret = splice(fd_in, NULL, fd_out, NULL, len,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	err = errno;
+
+	if (ret < 0 && err == EPIPE)
+		sigtimedwait(&pipe_set, NULL, &zero);
+
+	sigprocmask(SIG_SETMASK, &old_set, NULL);
+	errno = err;
+
+	return ret;
+}
+
+static int
+data_relay_target_writable(int fd, uint32_t mask, void *data)
+{
+	struct data_relay *relay = data;
+	ssize_t len;
+
+	len = splice_nosigpipe(relay->queue[0], relay->target_fd,
+			       relay->queued);
+	if (len < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			data_relay_destroy(relay);
+		return 1;
+	}
+
+	relay->queued -= len;
+
+	/* Room again, take more from the source */
+	if (relay->source_event && relay->queued < relay->capacity)
+		wl_event_source_fd_update(relay->source_event,
+					  WL_EVENT_READABLE);
+
+	if (relay->queued == 0) {
+		if (!relay->source_event)
+			data_relay_destroy(relay);
+		else
+			wl_event_source_fd_update(relay->target_event, 0);
+	}
+
+	return 1;
+}
+
+static int
+data_relay_source_readable(int fd, uint32_t mask, void *data)
+{
+	struct data_relay *relay = data;
+	ssize_t len;
+
+	len = splice(relay->source_fd, NULL, relay->queue[1], NULL,
+		     relay->capacity - relay->queued,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 1;
+
+	if (len <= 0) {
+		/* Source done (or failed): flush what's queued */
+		wl_event_source_remove(relay->source_event);
+		relay->source_event = NULL;
+		close(relay->source_fd);
+		relay->source_fd = -1;
+
+		if (relay->queued == 0)
+			data_relay_destroy(relay);
+		return 1;
+	}
+
+	relay->queued += len;
+	wl_event_source_fd_update(relay->target_event, WL_EVENT_WRITABLE);
+
+	/* Full: leave the rest in the source's pipe for now */
+	if (relay->queued >= relay->capacity)
+		wl_event_source_fd_update(relay->source_event, 0);
+
+	return 1;
+}
+
+/* Asks the source to write into a relay feeding fd.  Returns -1,
+ * leaving fd alone, if the transfer can't be relayed. */
+static int
+data_relay_create(struct weston_data_source *source,
+		  struct weston_compositor *compositor,
+		  const char *mime_type, int fd)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(compositor->wl_display);
+	struct data_relay *relay;
+	struct stat st;
+	int p[2], size;
+
+	/* Only pipes and sockets can be both polled and spliced into */
+	if (fstat(fd, &st) < 0 ||
+	    !(S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+		return -1;
+
+	relay = zalloc(sizeof *relay);
+	if (relay == NULL)
+		return -1;
+
+	if (pipe2(relay->queue, O_CLOEXEC | O_NONBLOCK) < 0)
+		goto err_free;
+	if (pipe2(p, O_CLOEXEC | O_NONBLOCK) < 0)
+		goto err_queue;
+
+	/* The kernel may cap this at /proc/sys/fs/pipe-max-size */
+	size = fcntl(relay->queue[1], F_SETPIPE_SZ,
+		     compositor->data_relay_size);
+	if (size < 0)
+		size = fcntl(relay->queue[1], F_GETPIPE_SZ);
+	if (size <= 0)
+		goto err_pipe;
+	relay->capacity = size;
+
+	relay->source_fd = p[0];
+	relay->target_fd = fd;
+
+	relay->source_event =
+		wl_event_loop_add_fd(loop, relay->source_fd,
+				     WL_EVENT_READABLE,
+				     data_relay_source_readable, relay);
+	if (relay->source_event == NULL)
+		goto err_pipe;
+
+	relay->target_event =
+		wl_event_loop_add_fd(loop, relay->target_fd, 0,
+				     data_relay_target_writable, relay);
+	if (relay->target_event == NULL)
+		goto err_source_event;
+
+	fcntl(fd, F_SETFL, O_WRONLY | O_NONBLOCK);
+	source->send(source, mime_type, p[1]);
+
+	return 0;
+
+ err_source_event:
+	wl_event_source_remove(relay->source_event);
+ err_pipe:
+	close(p[0]);
+	close(p[1]);
+ err_queue:
+	close(relay->queue[0]);
+	close(relay->queue[1]);
+ err_free:
+	free(relay);
+
+	return -1;
+}
+
 static void
 data_offer_receive(struct wl_client *client, struct wl_resource *resource,
 		   const char *mime_type, int32_t fd)
 {
 	struct weston_data_offer *offer = wl_resource_get_user_data(resource);
 
-	if (offer->source)
-		offer->source->send(offer->source, mime_type, fd);
-	else
+	if (!offer->source) {
 		close(fd);
+		return;
+	}
+
+	if (offer->compositor->data_relay_size > 0 &&
+	    data_relay_create(offer->source, offer->compositor,
+			      mime_type, fd) == 0)
+		return;
+
+	offer->source->send(offer->source, mime_type, fd);
 }
 
 static void
@@ -122,6 +332,7 @@ static struct wl_resource *
 weston_data_source_send_offer(struct weston_data_source *source,
 			      struct wl_resource *target)
 {
+	struct weston_seat *seat = wl_resource_get_user_data(target);
 	struct weston_data_offer *offer;
 	char **p;
 
@@ -141,6 +352,7 @@ weston_data_source_send_offer(struct weston_data_source *source,
 				       offer, destroy_data_offer);
 
 	offer->source = source;
+	offer->compositor = seat->compositor;
 	offer->source_destroy_listener.notify = destroy_offer_data_source;
 	wl_signal_add(&source->destroy_signal,
 		      &offer->source_destroy_listener);
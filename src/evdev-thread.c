@@ -0,0 +1,378 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <mtdev.h>
+
+#include "compositor.h"
+#include "evdev.h"
+
+/* The input thread reads the evdev devices as soon as they have events,
+ * also while the compositor is repainting and not looking at
+ * the input loop.  The events wait in a ring per device, which only the
+ * thread writes and only the main thread reads, so neither side locks
+ * to hand events over.  The kernel timestamps of the events are kept,
+ * so their timing doesn't depend on when the compositor gets to them.
+ *
+ * The mutex only guards adding and removing devices, and pausing a
+ * device whose ring is full.  Such a device is left alone until the
+ * main thread has caught up, and its events wait in the kernel. */
+
+#define EVDEV_QUEUE_SIZE	1024	/* a power of two */
+
+struct evdev_queue {
+	struct input_event events[EVDEV_QUEUE_SIZE];
+	uint32_t head;		/* written by the input thread */
+	uint32_t tail;		/* written by the main thread */
+
+	/* Protected by the thread mutex */
+	int paused;		/* ring full, fd taken out of the epoll set */
+	int dead;		/* reading failed, fd taken out as well */
+};
+
+struct evdev_input_thread {
+	struct weston_compositor *compositor;
+	struct wl_list devices;		/* evdev_device::thread_link */
+
+	int epoll_fd;
+	int quit_fd;			/* main thread to input thread */
+	int wake_fd;			/* input thread to main thread */
+	struct wl_event_source *wake_source;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	uint32_t generation;		/* bumped when a device goes away */
+};
+
+static int
+queue_add_events(struct evdev_device *device)
+{
+	struct evdev_queue *queue = device->queue;
+	struct input_event *ev;
+	uint32_t head, tail, room;
+	int len;
+
+	head = queue->head;
+	tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+	room = EVDEV_QUEUE_SIZE - (head - tail);
+	if (room == 0)
+		return 0;
+
+	/* Read straight into the ring, up to where it wraps */
+	ev = &queue->events[head & (EVDEV_QUEUE_SIZE - 1)];
+	if (room > EVDEV_QUEUE_SIZE - (head & (EVDEV_QUEUE_SIZE - 1)))
+		room = EVDEV_QUEUE_SIZE - (head & (EVDEV_QUEUE_SIZE - 1));
+
+	if (device->mtdev)
+		len = mtdev_get(device->mtdev, device->fd, ev, room) *
+			sizeof (struct input_event);
+	else
+		len = read(device->fd, ev, room * sizeof *ev);
+
+	if (len < 0 || len % sizeof *ev != 0)
+		return len < 0 && errno != EAGAIN && errno != EINTR ? -1 : 0;
+
+	__atomic_store_n(&queue->head, head + len / sizeof *ev,
+			 __ATOMIC_RELEASE);
+
+	return len / sizeof *ev;
+}
+
+/* Called with the mutex held */
+static void
+thread_read_device(struct evdev_input_thread *thread,
+		   struct evdev_device *device)
+{
+	struct evdev_queue *queue = device->queue;
+	uint32_t tail;
+	int n;
+
+	do
+		n = queue_add_events(device);
+	while (n > 0);
+
+	tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+	if (n < 0) {
+		__atomic_store_n(&queue->dead, 1, __ATOMIC_RELAXED);
+		epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+	} else if (queue->head - tail == EVDEV_QUEUE_SIZE) {
+		__atomic_store_n(&queue->paused, 1, __ATOMIC_RELAXED);
+		epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+	}
+}
+
+static void *
+input_thread_function(void *data)
+{
+	struct evdev_input_thread *thread = data;
+	struct epoll_event ep[16];
+	const uint64_t one = 1;
+	uint32_t generation;
+	sigset_t signals;
+	int i, count;
+
+	/* Signals are for the main thread's signalfds */
+	sigfillset(&signals);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	while (1) {
+		pthread_mutex_lock(&thread->mutex);
+		generation = thread->generation;
+		pthread_mutex_unlock(&thread->mutex);
+
+		count = epoll_wait(thread->epoll_fd, ep, ARRAY_LENGTH(ep), -1);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			break;
+
+		pthread_mutex_lock(&thread->mutex);
+
+		/* A device may have gone away since epoll_wait() picked
+		 * it; the others are still readable on the next round. */
+		if (thread->generation != generation) {
+			pthread_mutex_unlock(&thread->mutex);
+			continue;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (ep[i].data.ptr == NULL) {
+				pthread_mutex_unlock(&thread->mutex);
+				return NULL;
+			}
+
+			thread_read_device(thread, ep[i].data.ptr);
+		}
+
+		pthread_mutex_unlock(&thread->mutex);
+
+		if (write(thread->wake_fd, &one, sizeof one) != sizeof one)
+			weston_log("failed to signal input events: %m\n");
+	}
+
+	weston_log("input thread: epoll_wait failed: %m\n");
+
+	return NULL;
+}
+
+static void
+device_drain_queue(struct evdev_input_thread *thread,
+		   struct evdev_device *device)
+{
+	struct evdev_queue *queue = device->queue;
+	struct epoll_event ep;
+	uint32_t head, tail, count;
+	int dead;
+
+	head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+	tail = queue->tail;
+
+	while (tail != head) {
+		count = head - tail;
+		if (count > EVDEV_QUEUE_SIZE - (tail & (EVDEV_QUEUE_SIZE - 1)))
+			count = EVDEV_QUEUE_SIZE -
+				(tail & (EVDEV_QUEUE_SIZE - 1));
+
+		/* Events that came in while the session was away are
+		 * dropped, like the direct path leaves them unread */
+		if (thread->compositor->session_active)
+			evdev_process_events(device,
+				&queue->events[tail & (EVDEV_QUEUE_SIZE - 1)],
+				count);
+
+		tail += count;
+		__atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	/* The thread only sets these under the mutex and then signals
+	 * the wake fd, so a set flag is never missed for long */
+	if (!__atomic_load_n(&queue->paused, __ATOMIC_RELAXED) &&
+	    !__atomic_load_n(&queue->dead, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&thread->mutex);
+	dead = queue->dead;
+	if (queue->paused) {
+		queue->paused = 0;
+		ep.events = EPOLLIN;
+		ep.data.ptr = device;
+		epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, device->fd, &ep);
+	}
+	queue->dead = 0;
+	pthread_mutex_unlock(&thread->mutex);
+
+	if (dead) {
+		weston_log("device %s died\n", device->devnode);
+		wl_list_remove(&device->thread_link);
+		wl_list_init(&device->thread_link);
+	}
+}
+
+static int
+input_thread_wake(int fd, uint32_t mask, void *data)
+{
+	struct evdev_input_thread *thread = data;
+	struct evdev_device *device, *next;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 1;
+
+	wl_list_for_each_safe(device, next, &thread->devices, thread_link)
+		device_drain_queue(thread, device);
+
+	return 1;
+}
+
+struct evdev_input_thread *
+evdev_input_thread_create(struct weston_compositor *compositor)
+{
+	struct evdev_input_thread *thread;
+	struct epoll_event ep;
+
+	thread = zalloc(sizeof *thread);
+	if (!thread)
+		return NULL;
+
+	thread->compositor = compositor;
+	wl_list_init(&thread->devices);
+
+	thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (thread->epoll_fd < 0)
+		goto err_free;
+
+	thread->quit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->quit_fd < 0)
+		goto err_epoll;
+
+	thread->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->wake_fd < 0)
+		goto err_quit;
+
+	ep.events = EPOLLIN;
+	ep.data.ptr = NULL;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD,
+		      thread->quit_fd, &ep) < 0)
+		goto err_wake;
+
+	/* Handled on the input loop, so the events are still delivered
+	 * once per frame while repainting, like directly read ones */
+	thread->wake_source =
+		wl_event_loop_add_fd(compositor->input_loop, thread->wake_fd,
+				     WL_EVENT_READABLE,
+				     input_thread_wake, thread);
+	if (!thread->wake_source)
+		goto err_wake;
+
+	pthread_mutex_init(&thread->mutex, NULL);
+	if (pthread_create(&thread->thread, NULL,
+			   input_thread_function, thread) != 0) {
+		pthread_mutex_destroy(&thread->mutex);
+		wl_event_source_remove(thread->wake_source);
+		goto err_wake;
+	}
+
+	return thread;
+
+err_wake:
+	close(thread->wake_fd);
+err_quit:
+	close(thread->quit_fd);
+err_epoll:
+	close(thread->epoll_fd);
+err_free:
+	free(thread);
+
+	return NULL;
+}
+
+void
+evdev_input_thread_destroy(struct evdev_input_thread *thread)
+{
+	const uint64_t one = 1;
+
+	/* All devices are gone by now */
+	if (write(thread->quit_fd, &one, sizeof one) != sizeof one)
+		weston_log("failed to stop the input thread: %m\n");
+	pthread_join(thread->thread, NULL);
+
+	pthread_mutex_destroy(&thread->mutex);
+	wl_event_source_remove(thread->wake_source);
+	close(thread->wake_fd);
+	close(thread->quit_fd);
+	close(thread->epoll_fd);
+	free(thread);
+}
+
+int
+evdev_input_thread_add_device(struct evdev_input_thread *thread,
+			      struct evdev_device *device)
+{
+	struct epoll_event ep;
+
+	device->queue = zalloc(sizeof *device->queue);
+	if (!device->queue)
+		return -1;
+
+	ep.events = EPOLLIN;
+	ep.data.ptr = device;
+
+	pthread_mutex_lock(&thread->mutex);
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, device->fd, &ep) < 0) {
+		pthread_mutex_unlock(&thread->mutex);
+		free(device->queue);
+		device->queue = NULL;
+		return -1;
+	}
+	pthread_mutex_unlock(&thread->mutex);
+
+	device->thread = thread;
+	wl_list_insert(thread->devices.prev, &device->thread_link);
+
+	return 0;
+}
+
+void
+evdev_input_thread_remove_device(struct evdev_input_thread *thread,
+				 struct evdev_device *device)
+{
+	pthread_mutex_lock(&thread->mutex);
+	epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+	thread->generation++;
+	pthread_mutex_unlock(&thread->mutex);
+
+	wl_list_remove(&device->thread_link);
+	free(device->queue);
+	device->queue = NULL;
+	device->thread = NULL;
+}
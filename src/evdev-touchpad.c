@@ -54,8 +54,7 @@ enum touchpad_event {
 	TOUCHPAD_EVENT_NONE	    = 0,
 	TOUCHPAD_EVENT_ABSOLUTE_ANY = (1 << 0),
 	TOUCHPAD_EVENT_ABSOLUTE_X   = (1 << 1),
-	TOUCHPAD_EVENT_ABSOLUTE_Y   = (1 << 2),
-	TOUCHPAD_EVENT_REPORT	    = (1 << 3)
+	TOUCHPAD_EVENT_ABSOLUTE_Y   = (1 << 2)
 };
 
 struct touchpad_model_spec {
@@ -78,7 +77,11 @@ enum touchpad_state {
 	TOUCHPAD_STATE_MOVE  = (1 << 1)
 };
 
-#define TOUCHPAD_HISTORY_LENGTH 4
+#define TOUCHPAD_HISTORY_LENGTH 4	/* power of two */
+
+/* Touches, releases and a motion between two runs of the state machine;
+ * a frame needs at most three of them. */
+#define TOUCHPAD_FSM_EVENTS_MAX 8
 
 struct touchpad_motion {
 	int32_t x;
@@ -119,6 +122,9 @@ struct touchpad_dispatch {
 	double min_accel_factor;
 	double max_accel_factor;
 
+	struct accel_profile_table *profile_table;
+	double profile_velocity_scale;
+
 	unsigned int event_mask;
 	unsigned int event_mask_filter;
 
@@ -127,7 +133,8 @@ struct touchpad_dispatch {
 	struct {
 		bool enable;
 
-		struct wl_array events;
+		enum fsm_event events[TOUCHPAD_FSM_EVENTS_MAX];
+		int event_count;
 		enum fsm_state state;
 		struct wl_event_source *timer_source;
 	} fsm;
@@ -208,6 +215,11 @@ touchpad_profile(struct weston_motion_filter *filter,
 
 	double accel_factor;
 
+	if (touchpad->profile_table)
+		return accel_profile_table_lookup(touchpad->profile_table,
+						  velocity *
+						  touchpad->profile_velocity_scale);
+
 	accel_factor = velocity * touchpad->constant_accel_factor;
 
 	if (accel_factor > touchpad->max_accel_factor)
@@ -222,8 +234,8 @@ static inline struct touchpad_motion *
 motion_history_offset(struct touchpad_dispatch *touchpad, int offset)
 {
 	int offset_index =
-		(touchpad->motion_index - offset + TOUCHPAD_HISTORY_LENGTH) %
-		TOUCHPAD_HISTORY_LENGTH;
+		(touchpad->motion_index - offset) &
+		(TOUCHPAD_HISTORY_LENGTH - 1);
 
 	return &touchpad->motion_history[offset_index];
 }
@@ -303,17 +315,17 @@ static void
 process_fsm_events(struct touchpad_dispatch *touchpad, uint32_t time)
 {
 	uint32_t timeout = UINT32_MAX;
-	enum fsm_event *pevent;
 	enum fsm_event event;
+	int i;
 
 	if (!touchpad->fsm.enable)
 		return;
 
-	if (touchpad->fsm.events.size == 0)
+	if (touchpad->fsm.event_count == 0)
 		return;
 
-	wl_array_for_each(pevent, &touchpad->fsm.events) {
-		event = *pevent;
+	for (i = 0; i < touchpad->fsm.event_count; i++) {
+		event = touchpad->fsm.events[i];
 		timeout = 0;
 
 		switch (touchpad->fsm.state) {
@@ -390,22 +402,18 @@ process_fsm_events(struct touchpad_dispatch *touchpad, uint32_t time)
 		wl_event_source_timer_update(touchpad->fsm.timer_source,
 					     timeout);
 
-	wl_array_release(&touchpad->fsm.events);
-	wl_array_init(&touchpad->fsm.events);
+	touchpad->fsm.event_count = 0;
 }
 
 static void
 push_fsm_event(struct touchpad_dispatch *touchpad,
 	       enum fsm_event event)
 {
-	enum fsm_event *pevent;
-
 	if (!touchpad->fsm.enable)
 		return;
 
-	pevent = wl_array_add(&touchpad->fsm.events, sizeof event);
-	if (pevent)
-		*pevent = event;
+	if (touchpad->fsm.event_count < TOUCHPAD_FSM_EVENTS_MAX)
+		touchpad->fsm.events[touchpad->fsm.event_count++] = event;
 	else
 		touchpad->fsm.state = FSM_IDLE;
 }
@@ -415,7 +423,7 @@ fsm_timout_handler(void *data)
 {
 	struct touchpad_dispatch *touchpad = data;
 
-	if (touchpad->fsm.events.size == 0) {
+	if (touchpad->fsm.event_count == 0) {
 		push_fsm_event(touchpad, FSM_EVENT_TIMEOUT);
 		process_fsm_events(touchpad, weston_compositor_get_time());
 	}
@@ -423,6 +431,30 @@ fsm_timout_handler(void *data)
 	return 1;
 }
 
+/* A touch, a release or a change in the number of fingers restarts the
+ * motion tracking right away; whatever the frame carries after it is
+ * the first sample of the new motion. */
+static int
+touchpad_check_reset(struct touchpad_dispatch *touchpad, uint32_t time)
+{
+	if (!touchpad->reset &&
+	    touchpad->last_finger_state == touchpad->finger_state)
+		return 0;
+
+	touchpad->reset = 0;
+	touchpad->motion_count = 0;
+	touchpad->event_mask = TOUCHPAD_EVENT_NONE;
+	touchpad->event_mask_filter =
+		TOUCHPAD_EVENT_ABSOLUTE_X | TOUCHPAD_EVENT_ABSOLUTE_Y;
+
+	touchpad->last_finger_state = touchpad->finger_state;
+
+	process_fsm_events(touchpad, time);
+
+	return 1;
+}
+
+/* Runs once per SYN_REPORT, on the state the whole frame left behind */
 static void
 touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 {
@@ -430,26 +462,8 @@ touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 	int center_x, center_y;
 	double dx = 0.0, dy = 0.0;
 
-	if (touchpad->reset ||
-	    touchpad->last_finger_state != touchpad->finger_state) {
-		touchpad->reset = 0;
-		touchpad->motion_count = 0;
-		touchpad->event_mask = TOUCHPAD_EVENT_NONE;
-		touchpad->event_mask_filter =
-			TOUCHPAD_EVENT_ABSOLUTE_X | TOUCHPAD_EVENT_ABSOLUTE_Y;
-
-		touchpad->last_finger_state = touchpad->finger_state;
-
-		process_fsm_events(touchpad, time);
-
-		return;
-	}
-	touchpad->last_finger_state = touchpad->finger_state;
-
-	if (!(touchpad->event_mask & TOUCHPAD_EVENT_REPORT))
+	if (touchpad_check_reset(touchpad, time))
 		return;
-	else
-		touchpad->event_mask &= ~TOUCHPAD_EVENT_REPORT;
 
 	if ((touchpad->event_mask & touchpad->event_mask_filter) !=
 	    touchpad->event_mask_filter)
@@ -477,7 +491,8 @@ touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 	touchpad->hw_abs.y = center_y;
 
 	/* Update motion history tracker */
-	motion_index = (touchpad->motion_index + 1) % TOUCHPAD_HISTORY_LENGTH;
+	motion_index = (touchpad->motion_index + 1) &
+		(TOUCHPAD_HISTORY_LENGTH - 1);
 	touchpad->motion_index = motion_index;
 	touchpad->motion_history[motion_index].x = touchpad->hw_abs.x;
 	touchpad->motion_history[motion_index].y = touchpad->hw_abs.y;
@@ -642,8 +657,8 @@ touchpad_process(struct evdev_dispatch *dispatch,
 	switch (e->type) {
 	case EV_SYN:
 		if (e->code == SYN_REPORT)
-			touchpad->event_mask |= TOUCHPAD_EVENT_REPORT;
-		break;
+			touchpad_update_state(touchpad, time);
+		return;
 	case EV_ABS:
 		process_absolute(touchpad, device, e);
 		break;
@@ -652,7 +667,7 @@ touchpad_process(struct evdev_dispatch *dispatch,
 		break;
 	}
 
-	touchpad_update_state(touchpad, time);
+	touchpad_check_reset(touchpad, time);
 }
 
 static void
@@ -662,6 +677,8 @@ touchpad_destroy(struct evdev_dispatch *dispatch)
 		(struct touchpad_dispatch *) dispatch;
 
 	touchpad->filter->interface->destroy(touchpad->filter);
+	if (touchpad->profile_table)
+		accel_profile_table_destroy(touchpad->profile_table);
 	wl_event_source_remove(touchpad->fsm.timer_source);
 	free(dispatch);
 }
@@ -680,6 +697,7 @@ touchpad_parse_config(struct touchpad_dispatch *touchpad, double diagonal)
 	double constant_accel_factor;
 	double min_accel_factor;
 	double max_accel_factor;
+	char *profile;
 
 	s = weston_config_get_section(compositor->config,
 				      "touchpad", NULL, NULL);
@@ -697,6 +715,19 @@ touchpad_parse_config(struct touchpad_dispatch *touchpad, double diagonal)
 		constant_accel_factor / diagonal;
 	touchpad->min_accel_factor = min_accel_factor;
 	touchpad->max_accel_factor = max_accel_factor;
+
+	/* The profile table is indexed by touchpad diagonals per second, so
+	 * that one table fits pads of any size and resolution. */
+	touchpad->profile_table = NULL;
+	touchpad->profile_velocity_scale = 1000.0 / diagonal;
+	weston_config_section_get_string(s, "accel_profile", &profile, NULL);
+	if (profile) {
+		touchpad->profile_table = accel_profile_table_create(profile);
+		if (touchpad->profile_table == NULL)
+			weston_log("touchpad: invalid accel_profile \"%s\", "
+				   "using the default profile\n", profile);
+		free(profile);
+	}
 }
 
 static int
@@ -765,7 +796,7 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	touchpad->last_finger_state = 0;
 	touchpad->finger_state = 0;
 
-	wl_array_init(&touchpad->fsm.events);
+	touchpad->fsm.event_count = 0;
 	touchpad->fsm.state = FSM_IDLE;
 
 	loop = wl_display_get_event_loop(device->seat->compositor->wl_display);
@@ -36,6 +36,12 @@
 
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 
+/* Events per read(); room for a full frame of a ten finger panel */
+#define EVDEV_READ_BATCH 256
+
+/* Key changes replayed at most after the kernel dropped events */
+#define RESYNC_MAX_KEYS 64
+
 void
 evdev_led_update(struct evdev_device *device, enum weston_led leds)
 {
@@ -404,19 +410,169 @@ fallback_dispatch_create(void)
 	return dispatch;
 }
 
+static inline int
+sync_key_get(struct evdev_device *device, int code)
+{
+	return (device->sync.keys[code >> 3] >> (code & 7)) & 1;
+}
+
+static inline void
+sync_key_set(struct evdev_device *device, int code, int value)
+{
+	if (value)
+		device->sync.keys[code >> 3] |= 1 << (code & 7);
+	else
+		device->sync.keys[code >> 3] &= ~(1 << (code & 7));
+}
+
+/* Follows the state the kernel reported, whichever dispatch handles the
+ * events. */
 static void
+evdev_sync_track(struct evdev_device *device, struct input_event *e)
+{
+	switch (e->type) {
+	case EV_KEY:
+		if (e->value != 2 && e->code < KEY_CNT)
+			sync_key_set(device, e->code, e->value);
+		break;
+	case EV_ABS:
+		if (e->code == ABS_MT_SLOT)
+			device->sync.slot = e->value;
+		else if (e->code == ABS_MT_TRACKING_ID &&
+			 device->sync.slot >= 0 &&
+			 device->sync.slot < MAX_SLOTS)
+			device->sync.tracking_id[device->sync.slot] = e->value;
+		break;
+	}
+}
+
+static struct input_event *
+sync_add(struct input_event *ev, int *count, int type, int code, int value)
+{
+	struct input_event *e = &ev[(*count)++];
+
+	memset(e, 0, sizeof *e);
+	e->type = type;
+	e->code = code;
+	e->value = value;
+
+	return e;
+}
+
+/* The kernel overflowed its buffer and threw away events up to the next
+ * SYN_REPORT.  Read back its current key, touch and axis state and run
+ * the difference through the dispatch as one synthetic frame, so no key
+ * or touch point stays stuck down. */
+static void
+evdev_resync(struct evdev_device *device, uint32_t time)
+{
+	struct evdev_dispatch *dispatch = device->dispatch;
+	struct input_event ev[RESYNC_MAX_KEYS + MAX_SLOTS * 5 + 2];
+	unsigned char keys[(KEY_CNT + 7) / 8];
+	struct {
+		uint32_t code;
+		int32_t values[MAX_SLOTS];
+	} ids, xs, ys;
+	struct input_absinfo absinfo;
+	int count = 0, i, n, slot, down;
+
+	if (ioctl(device->fd, EVIOCGKEY(sizeof keys), keys) >= 0) {
+		for (i = 0; i < KEY_CNT && count < RESYNC_MAX_KEYS; i++) {
+			down = (keys[i >> 3] >> (i & 7)) & 1;
+			if (down != sync_key_get(device, i))
+				sync_add(ev, &count, EV_KEY, i, down);
+		}
+	}
+
+	if (device->is_mt && !device->mtdev) {
+		ids.code = ABS_MT_TRACKING_ID;
+		xs.code = ABS_MT_POSITION_X;
+		ys.code = ABS_MT_POSITION_Y;
+		if (ioctl(device->fd, EVIOCGMTSLOTS(sizeof ids), &ids) < 0 ||
+		    ioctl(device->fd, EVIOCGMTSLOTS(sizeof xs), &xs) < 0 ||
+		    ioctl(device->fd, EVIOCGMTSLOTS(sizeof ys), &ys) < 0 ||
+		    ioctl(device->fd, EVIOCGABS(ABS_MT_SLOT), &absinfo) < 0)
+			goto dispatch;
+
+		n = absinfo.maximum + 1 < MAX_SLOTS ?
+			absinfo.maximum + 1 : MAX_SLOTS;
+		for (slot = 0; slot < n; slot++) {
+			if (device->sync.tracking_id[slot] < 0 &&
+			    ids.values[slot] < 0)
+				continue;
+
+			sync_add(ev, &count, EV_ABS, ABS_MT_SLOT, slot);
+
+			/* A contact that ended, or that ended and was
+			 * replaced by another while events were lost */
+			if (device->sync.tracking_id[slot] >= 0 &&
+			    device->sync.tracking_id[slot] != ids.values[slot])
+				sync_add(ev, &count, EV_ABS,
+					 ABS_MT_TRACKING_ID, -1);
+
+			if (ids.values[slot] < 0)
+				continue;
+
+			if (device->sync.tracking_id[slot] != ids.values[slot])
+				sync_add(ev, &count, EV_ABS,
+					 ABS_MT_TRACKING_ID, ids.values[slot]);
+			sync_add(ev, &count, EV_ABS,
+				 ABS_MT_POSITION_X, xs.values[slot]);
+			sync_add(ev, &count, EV_ABS,
+				 ABS_MT_POSITION_Y, ys.values[slot]);
+		}
+
+		sync_add(ev, &count, EV_ABS, ABS_MT_SLOT, absinfo.value);
+	} else if (device->sync.abs) {
+		if (ioctl(device->fd, EVIOCGABS(ABS_X), &absinfo) >= 0)
+			sync_add(ev, &count, EV_ABS, ABS_X, absinfo.value);
+		if (ioctl(device->fd, EVIOCGABS(ABS_Y), &absinfo) >= 0)
+			sync_add(ev, &count, EV_ABS, ABS_Y, absinfo.value);
+	}
+
+dispatch:
+	sync_add(ev, &count, EV_SYN, SYN_REPORT, 0);
+
+	weston_log("input device %s dropped events, resynced %d\n",
+		   device->devnode, count - 1);
+
+	for (i = 0; i < count; i++) {
+		evdev_sync_track(device, &ev[i]);
+		dispatch->interface->process(dispatch, device, &ev[i], time);
+	}
+}
+
+void
 evdev_process_events(struct evdev_device *device,
 		     struct input_event *ev, int count)
 {
 	struct evdev_dispatch *dispatch = device->dispatch;
 	struct input_event *e, *end;
 	uint32_t time = 0;
+	int frame_start = 1;
 
 	e = ev;
 	end = e + count;
 	for (e = ev; e < end; e++) {
-		time = e->time.tv_sec * 1000 + e->time.tv_usec / 1000;
+		/* The kernel stamps all events of a frame alike */
+		if (frame_start)
+			time = e->time.tv_sec * 1000 + e->time.tv_usec / 1000;
+		frame_start = e->type == EV_SYN;
+
+		if (device->sync.dropped) {
+			if (e->type == EV_SYN && e->code == SYN_REPORT) {
+				device->sync.dropped = 0;
+				evdev_resync(device, time);
+			}
+			continue;
+		}
+
+		if (e->type == EV_SYN && e->code == SYN_DROPPED) {
+			device->sync.dropped = 1;
+			continue;
+		}
 
+		evdev_sync_track(device, e);
 		dispatch->interface->process(dispatch, device, e, time);
 	}
 }
@@ -426,7 +582,7 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 {
 	struct weston_compositor *ec;
 	struct evdev_device *device = data;
-	struct input_event ev[32];
+	struct input_event ev[EVDEV_READ_BATCH];
 	int len;
 
 	ec = device->seat->compositor;
@@ -462,14 +618,48 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
+/* Only ioctls on the fd, safe to call from any thread */
+void
+evdev_device_probe(int fd, struct evdev_probe *probe)
+{
+	memset(probe, 0, sizeof *probe);
+	strcpy(probe->name, "unknown");
+
+	ioctl(fd, EVIOCGNAME(sizeof(probe->name)), probe->name);
+	probe->name[sizeof(probe->name) - 1] = '\0';
+
+	ioctl(fd, EVIOCGBIT(0, sizeof(probe->ev_bits)), probe->ev_bits);
+	if (TEST_BIT(probe->ev_bits, EV_ABS)) {
+		ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(probe->abs_bits)),
+		      probe->abs_bits);
+		if (TEST_BIT(probe->abs_bits, ABS_X))
+			ioctl(fd, EVIOCGABS(ABS_X), &probe->abs_x);
+		if (TEST_BIT(probe->abs_bits, ABS_Y))
+			ioctl(fd, EVIOCGABS(ABS_Y), &probe->abs_y);
+		if (TEST_BIT(probe->abs_bits, ABS_MT_POSITION_X) &&
+		    TEST_BIT(probe->abs_bits, ABS_MT_POSITION_Y)) {
+			ioctl(fd, EVIOCGABS(ABS_MT_POSITION_X), &probe->mt_x);
+			ioctl(fd, EVIOCGABS(ABS_MT_POSITION_Y), &probe->mt_y);
+		}
+		if (TEST_BIT(probe->abs_bits, ABS_MT_SLOT))
+			ioctl(fd, EVIOCGABS(ABS_MT_SLOT), &probe->mt_slot);
+	}
+	if (TEST_BIT(probe->ev_bits, EV_REL))
+		ioctl(fd, EVIOCGBIT(EV_REL, sizeof(probe->rel_bits)),
+		      probe->rel_bits);
+	if (TEST_BIT(probe->ev_bits, EV_KEY))
+		ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(probe->key_bits)),
+		      probe->key_bits);
+}
+
 static int
-evdev_configure_device(struct evdev_device *device)
+evdev_configure_device(struct evdev_device *device,
+		       const struct evdev_probe *probe)
 {
-	struct input_absinfo absinfo;
-	unsigned long ev_bits[NBITS(EV_MAX)];
-	unsigned long abs_bits[NBITS(ABS_MAX)];
-	unsigned long rel_bits[NBITS(REL_MAX)];
-	unsigned long key_bits[NBITS(KEY_MAX)];
+	const unsigned long *ev_bits = probe->ev_bits;
+	const unsigned long *abs_bits = probe->abs_bits;
+	const unsigned long *rel_bits = probe->rel_bits;
+	const unsigned long *key_bits = probe->key_bits;
 	int has_abs, has_rel, has_mt;
 	int has_button, has_keyboard, has_touch;
 	unsigned int i;
@@ -481,36 +671,28 @@ evdev_configure_device(struct evdev_device *device)
 	has_keyboard = 0;
 	has_touch = 0;
 
-	ioctl(device->fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
 	if (TEST_BIT(ev_bits, EV_ABS)) {
-		ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)),
-		      abs_bits);
-
 		if (TEST_BIT(abs_bits, ABS_X)) {
-			ioctl(device->fd, EVIOCGABS(ABS_X), &absinfo);
-			device->abs.min_x = absinfo.minimum;
-			device->abs.max_x = absinfo.maximum;
+			device->abs.min_x = probe->abs_x.minimum;
+			device->abs.max_x = probe->abs_x.maximum;
 			has_abs = 1;
 		}
 		if (TEST_BIT(abs_bits, ABS_Y)) {
-			ioctl(device->fd, EVIOCGABS(ABS_Y), &absinfo);
-			device->abs.min_y = absinfo.minimum;
-			device->abs.max_y = absinfo.maximum;
+			device->abs.min_y = probe->abs_y.minimum;
+			device->abs.max_y = probe->abs_y.maximum;
 			has_abs = 1;
 		}
+		device->sync.abs = TEST_BIT(abs_bits, ABS_X) &&
+			TEST_BIT(abs_bits, ABS_Y);
                 /* We only handle the slotted Protocol B in weston.
                    Devices with ABS_MT_POSITION_* but not ABS_MT_SLOT
                    require mtdev for conversion. */
 		if (TEST_BIT(abs_bits, ABS_MT_POSITION_X) &&
 		    TEST_BIT(abs_bits, ABS_MT_POSITION_Y)) {
-			ioctl(device->fd, EVIOCGABS(ABS_MT_POSITION_X),
-			      &absinfo);
-			device->abs.min_x = absinfo.minimum;
-			device->abs.max_x = absinfo.maximum;
-			ioctl(device->fd, EVIOCGABS(ABS_MT_POSITION_Y),
-			      &absinfo);
-			device->abs.min_y = absinfo.minimum;
-			device->abs.max_y = absinfo.maximum;
+			device->abs.min_x = probe->mt_x.minimum;
+			device->abs.max_x = probe->mt_x.maximum;
+			device->abs.min_y = probe->mt_y.minimum;
+			device->abs.max_y = probe->mt_y.maximum;
 			device->is_mt = 1;
 			has_touch = 1;
 			has_mt = 1;
@@ -524,21 +706,16 @@ evdev_configure_device(struct evdev_device *device)
 				}
 				device->mt.slot = device->mtdev->caps.slot.value;
 			} else {
-				ioctl(device->fd, EVIOCGABS(ABS_MT_SLOT),
-				      &absinfo);
-				device->mt.slot = absinfo.value;
+				device->mt.slot = probe->mt_slot.value;
+				device->sync.slot = probe->mt_slot.value;
 			}
 		}
 	}
 	if (TEST_BIT(ev_bits, EV_REL)) {
-		ioctl(device->fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)),
-		      rel_bits);
 		if (TEST_BIT(rel_bits, REL_X) || TEST_BIT(rel_bits, REL_Y))
 			has_rel = 1;
 	}
 	if (TEST_BIT(ev_bits, EV_KEY)) {
-		ioctl(device->fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)),
-		      key_bits);
 		if (TEST_BIT(key_bits, BTN_TOOL_FINGER) &&
 		    !TEST_BIT(key_bits, BTN_TOOL_PEN) &&
 		    (has_abs || has_mt)) {
@@ -626,11 +803,25 @@ evdev_device_set_output(struct evdev_device *device,
 }
 
 struct evdev_device *
-evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
+evdev_device_create(struct weston_seat *seat, const char *path, int device_fd,
+		    struct evdev_input_thread *thread)
+{
+	struct evdev_probe probe;
+
+	evdev_device_probe(device_fd, &probe);
+
+	return evdev_device_create_probed(seat, path, device_fd, &probe,
+					  thread);
+}
+
+struct evdev_device *
+evdev_device_create_probed(struct weston_seat *seat, const char *path,
+			   int device_fd, const struct evdev_probe *probe,
+			   struct evdev_input_thread *thread)
 {
 	struct evdev_device *device;
 	struct weston_compositor *ec;
-	char devname[256] = "unknown";
+	int i;
 
 	device = zalloc(sizeof *device);
 	if (device == NULL)
@@ -648,15 +839,20 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	device->dispatch = NULL;
 	device->fd = device_fd;
 	device->pending_event = EVDEV_NONE;
+	device->sync.slot = -1;
+	for (i = 0; i < MAX_SLOTS; i++)
+		device->sync.tracking_id[i] = -1;
 	wl_list_init(&device->link);
+	wl_list_init(&device->thread_link);
 
-	ioctl(device->fd, EVIOCGNAME(sizeof(devname)), devname);
-	devname[sizeof(devname) - 1] = '\0';
-	device->devname = strdup(devname);
+	device->devname = strdup(probe->name);
 
-	if (evdev_configure_device(device) == -1)
+	if (evdev_configure_device(device, probe) == -1)
 		goto err;
 
+	ioctl(device->fd, EVIOCGKEY(sizeof device->sync.keys),
+	      device->sync.keys);
+
 	if (device->seat_caps == 0) {
 		evdev_device_destroy(device);
 		return EVDEV_UNHANDLED_DEVICE;
@@ -668,6 +864,13 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	if (device->dispatch == NULL)
 		goto err;
 
+	if (thread) {
+		if (evdev_input_thread_add_device(thread, device) == 0)
+			return device;
+		weston_log("failed to read %s on the input thread\n",
+			   device->devnode);
+	}
+
 	device->source = wl_event_loop_add_fd(ec->input_loop, device->fd,
 					      WL_EVENT_READABLE,
 					      evdev_device_data, device);
@@ -697,6 +900,8 @@ evdev_device_destroy(struct evdev_device *device)
 	if (dispatch)
 		dispatch->interface->destroy(dispatch);
 
+	if (device->thread)
+		evdev_input_thread_remove_device(device->thread, device);
 	if (device->source)
 		wl_event_source_remove(device->source);
 	if (device->output)
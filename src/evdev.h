@@ -84,6 +84,21 @@ struct evdev_device {
 	enum evdev_device_seat_capability seat_caps;
 
 	int is_mt;
+
+	/* Kernel state as far as the events read so far tell, to resync
+	 * from when the kernel dropped some (SYN_DROPPED) */
+	struct {
+		int dropped;
+		int abs;		/* has ABS_X and ABS_Y */
+		int slot;
+		int32_t tracking_id[MAX_SLOTS];
+		unsigned char keys[(KEY_CNT + 7) / 8];
+	} sync;
+
+	/* Set when the device is read by the input thread */
+	struct evdev_input_thread *thread;
+	struct wl_list thread_link;
+	struct evdev_queue *queue;
 };
 
 /* copied from udev/extras/input_id/input_id.c */
@@ -98,6 +113,18 @@ struct evdev_device {
 
 #define EVDEV_UNHANDLED_DEVICE ((struct evdev_device *) 1)
 
+/* What the kernel tells about a device, read without touching any
+ * compositor state so that devices can be probed on other threads */
+struct evdev_probe {
+	char name[256];
+	unsigned long ev_bits[NBITS(EV_MAX)];
+	unsigned long abs_bits[NBITS(ABS_MAX)];
+	unsigned long rel_bits[NBITS(REL_MAX)];
+	unsigned long key_bits[NBITS(KEY_MAX)];
+	struct input_absinfo abs_x, abs_y;
+	struct input_absinfo mt_x, mt_y, mt_slot;
+};
+
 struct evdev_dispatch;
 
 struct evdev_dispatch_interface {
@@ -121,8 +148,21 @@ evdev_touchpad_create(struct evdev_device *device);
 void
 evdev_led_update(struct evdev_device *device, enum weston_led leds);
 
+void
+evdev_device_probe(int fd, struct evdev_probe *probe);
+
 struct evdev_device *
-evdev_device_create(struct weston_seat *seat, const char *path, int device_fd);
+evdev_device_create(struct weston_seat *seat, const char *path, int device_fd,
+		    struct evdev_input_thread *thread);
+
+struct evdev_device *
+evdev_device_create_probed(struct weston_seat *seat, const char *path,
+			   int device_fd, const struct evdev_probe *probe,
+			   struct evdev_input_thread *thread);
+
+void
+evdev_process_events(struct evdev_device *device,
+		     struct input_event *ev, int count);
 
 void
 evdev_device_set_output(struct evdev_device *device,
@@ -134,4 +174,15 @@ void
 evdev_notify_keyboard_focus(struct weston_seat *seat,
 			    struct wl_list *evdev_devices);
 
+struct evdev_input_thread *
+evdev_input_thread_create(struct weston_compositor *compositor);
+void
+evdev_input_thread_destroy(struct evdev_input_thread *thread);
+int
+evdev_input_thread_add_device(struct evdev_input_thread *thread,
+			      struct evdev_device *device);
+void
+evdev_input_thread_remove_device(struct evdev_input_thread *thread,
+				 struct evdev_device *device);
+
 #endif /* EVDEV_H */
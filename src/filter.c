@@ -44,13 +44,19 @@ weston_filter_dispatch(struct weston_motion_filter *filter,
  * Pointer acceleration filter
  */
 
-#define MAX_VELOCITY_DIFF	1.0
+/* Tracker deltas are kept in 24.8 fixed point and velocities in 16.16
+ * fixed point, so that tracking a motion event costs a handful of integer
+ * additions per tracker instead of a sqrt() and an atan2() each. */
+#define DELTA_SHIFT		8
+#define VELOCITY_SHIFT		16
+
+#define MAX_VELOCITY_DIFF	(1 << VELOCITY_SHIFT) /* 1.0 units/ms */
 #define MOTION_TIMEOUT		300 /* (ms) */
 #define NUM_POINTER_TRACKERS	16
 
 struct pointer_tracker {
-	double dx;
-	double dy;
+	int32_t dx;
+	int32_t dy;
 	uint32_t time;
 	int dir;
 };
@@ -82,12 +88,21 @@ enum directions {
 	UNDEFINED_DIRECTION = 0xff
 };
 
+/* Angle of the vector (1, t / 256) in 1/256ths of an octant, for t in
+ * [0 .. 256].  Uses atan(x) ~= π/4·x + 0.273·x·(1 - x), which stays within
+ * 0.3° of the real thing; plenty for picking octants. */
+static int
+octant_angle(int t)
+{
+	return t + ((89 * t * (256 - t)) >> 16);
+}
+
 static int
 get_direction(int dx, int dy)
 {
 	int dir = UNDEFINED_DIRECTION;
 	int d1, d2;
-	double r;
+	int ax, ay, r;
 
 	if (abs(dx) < 2 && abs(dy) < 2) {
 		if (dx > 0 && dy > 0)
@@ -108,19 +123,29 @@ get_direction(int dx, int dy)
 			dir = NE | N | NW;
 	}
 	else {
-		/* Calculate r within the interval  [0 to 8)
-		 *
-		 * r = [0 .. 2π] where 0 is North
-		 * d_f = r / 2π  ([0 .. 1))
-		 * d_8 = 8 * d_f
-		 */
-		r = atan2(dy, dx);
-		r = fmod(r + 2.5*M_PI, 2*M_PI);
-		r *= 4*M_1_PI;
+		/* Calculate r within the interval [0 to 8·256), in 1/256ths
+		 * of an octant, where 0 is North and angles grow clockwise.
+		 * The first quadrant angle is folded out of the octant
+		 * approximation and then mirrored into place. */
+		ax = abs(dx);
+		ay = abs(dy);
+		if (ax >= ay)
+			r = octant_angle(ay * 256 / ax);
+		else
+			r = 512 - octant_angle(ax * 256 / ay);
+
+		if (dx < 0 && dy >= 0)
+			r = 1024 - r;
+		else if (dx < 0)
+			r = 1024 + r;
+		else if (dy < 0)
+			r = 2048 - r;
+
+		r = (r + 512) & 2047;
 
 		/* Mark one or two close enough octants */
-		d1 = (int)(r + 0.9) % 8;
-		d2 = (int)(r + 0.1) % 8;
+		d1 = ((r + 230) >> 8) & 7;
+		d2 = ((r + 26) >> 8) & 7;
 
 		dir = (1 << d1) | (1 << d2);
 	}
@@ -135,17 +160,19 @@ feed_trackers(struct pointer_accelerator *accel,
 {
 	int i, current;
 	struct pointer_tracker *trackers = accel->trackers;
+	int32_t fdx = dx * (1 << DELTA_SHIFT);
+	int32_t fdy = dy * (1 << DELTA_SHIFT);
 
 	for (i = 0; i < NUM_POINTER_TRACKERS; i++) {
-		trackers[i].dx += dx;
-		trackers[i].dy += dy;
+		trackers[i].dx += fdx;
+		trackers[i].dy += fdy;
 	}
 
 	current = (accel->cur_tracker + 1) % NUM_POINTER_TRACKERS;
 	accel->cur_tracker = current;
 
-	trackers[current].dx = 0.0;
-	trackers[current].dy = 0.0;
+	trackers[current].dx = 0;
+	trackers[current].dy = 0;
 	trackers[current].time = time;
 	trackers[current].dir = get_direction(dx, dy);
 }
@@ -159,27 +186,50 @@ tracker_by_offset(struct pointer_accelerator *accel, unsigned int offset)
 	return &accel->trackers[index];
 }
 
-static double
+/* Length of (dx, dy) as max(hi, 7/8·hi + 1/2·lo), which is never more
+ * than 1% over or 3% under the euclidean distance. */
+static int64_t
+approximate_distance(int32_t dx, int32_t dy)
+{
+	int64_t hi = dx < 0 ? -(int64_t) dx : dx;
+	int64_t lo = dy < 0 ? -(int64_t) dy : dy;
+	int64_t t, d;
+
+	if (lo > hi) {
+		t = hi;
+		hi = lo;
+		lo = t;
+	}
+
+	d = hi - (hi >> 3) + (lo >> 1);
+
+	return d > hi ? d : hi;
+}
+
+static uint32_t
+tracker_elapsed(struct pointer_tracker *tracker, uint32_t time)
+{
+	uint32_t elapsed = time - tracker->time;
+
+	return elapsed ? elapsed : 1;
+}
+
+static int64_t
 calculate_tracker_velocity(struct pointer_tracker *tracker, uint32_t time)
 {
-	int dx;
-	int dy;
-	double distance;
-
-	dx = tracker->dx;
-	dy = tracker->dy;
-	distance = sqrt(dx*dx + dy*dy);
-	return distance / (double)(time - tracker->time);
+	return (approximate_distance(tracker->dx, tracker->dy) <<
+		(VELOCITY_SHIFT - DELTA_SHIFT)) /
+		tracker_elapsed(tracker, time);
 }
 
 static double
 calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 {
 	struct pointer_tracker *tracker;
-	double velocity;
-	double result = 0.0;
-	double initial_velocity;
-	double velocity_diff;
+	struct pointer_tracker *result = NULL;
+	int64_t initial_velocity = 0;
+	int64_t distance, velocity_diff;
+	uint32_t elapsed;
 	unsigned int offset;
 
 	unsigned int dir = tracker_by_offset(accel, 0)->dir;
@@ -191,9 +241,9 @@ calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 		if (time <= tracker->time)
 			continue;
 
-		result = initial_velocity =
-			calculate_tracker_velocity(tracker, time);
-		if (initial_velocity > 0.0)
+		result = tracker;
+		initial_velocity = calculate_tracker_velocity(tracker, time);
+		if (initial_velocity > 0)
 			break;
 	}
 
@@ -212,17 +262,26 @@ calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 		if (dir == 0)
 			break;
 
-		velocity = calculate_tracker_velocity(tracker, time);
-
-		/* Stop if velocity differs too much from initial */
-		velocity_diff = fabs(initial_velocity - velocity);
-		if (velocity_diff > MAX_VELOCITY_DIFF)
+		/* Stop if velocity differs too much from initial.  The
+		 * comparison is scaled by the elapsed time so that only the
+		 * velocity finally picked needs a division. */
+		elapsed = tracker_elapsed(tracker, time);
+		distance = approximate_distance(tracker->dx, tracker->dy) <<
+			(VELOCITY_SHIFT - DELTA_SHIFT);
+		velocity_diff = initial_velocity * elapsed - distance;
+		if (velocity_diff < 0)
+			velocity_diff = -velocity_diff;
+		if (velocity_diff > (int64_t) MAX_VELOCITY_DIFF * elapsed)
 			break;
 
-		result = velocity;
+		result = tracker;
 	}
 
-	return result;
+	if (result == NULL)
+		return 0.0;
+
+	return (double) calculate_tracker_velocity(result, time) /
+		(1 << VELOCITY_SHIFT);
 }
 
 static double
@@ -335,3 +394,97 @@ create_pointer_accelator_filter(accel_profile_func_t profile)
 
 	return &filter->base;
 }
+
+/*
+ * Table driven acceleration profile
+ */
+
+#define MAX_PROFILE_POINTS	32
+
+struct accel_profile_point {
+	double velocity;
+	double factor;
+};
+
+struct accel_profile_table {
+	int count;
+	struct accel_profile_point points[MAX_PROFILE_POINTS];
+};
+
+struct accel_profile_table *
+accel_profile_table_create(const char *spec)
+{
+	struct accel_profile_table *table;
+	struct accel_profile_point *point;
+	const char *p = spec;
+	char *end;
+
+	table = calloc(1, sizeof *table);
+	if (table == NULL)
+		return NULL;
+
+	while (*p) {
+		while (*p == ' ' || *p == '\t' || *p == ',')
+			p++;
+		if (*p == '\0')
+			break;
+
+		if (table->count == MAX_PROFILE_POINTS)
+			goto err;
+		point = &table->points[table->count];
+
+		point->velocity = strtod(p, &end);
+		if (end == p || *end != ':')
+			goto err;
+		p = end + 1;
+
+		point->factor = strtod(p, &end);
+		if (end == p || point->factor < 0.0)
+			goto err;
+		p = end;
+
+		if (table->count > 0 &&
+		    point->velocity <= point[-1].velocity)
+			goto err;
+
+		table->count++;
+	}
+
+	if (table->count == 0)
+		goto err;
+
+	return table;
+
+err:
+	free(table);
+	return NULL;
+}
+
+double
+accel_profile_table_lookup(const struct accel_profile_table *table,
+			   double velocity)
+{
+	const struct accel_profile_point *a, *b;
+	int i;
+
+	if (velocity <= table->points[0].velocity)
+		return table->points[0].factor;
+
+	for (i = 1; i < table->count; i++) {
+		b = &table->points[i];
+		if (velocity < b->velocity) {
+			a = b - 1;
+			return a->factor + (b->factor - a->factor) *
+				(velocity - a->velocity) /
+				(b->velocity - a->velocity);
+		}
+	}
+
+	return table->points[table->count - 1].factor;
+}
+
+void
+accel_profile_table_destroy(struct accel_profile_table *table)
+{
+	free(table);
+}
@@ -63,4 +63,19 @@ typedef double (*accel_profile_func_t)(struct weston_motion_filter *filter,
 WL_EXPORT struct weston_motion_filter *
 create_pointer_accelator_filter(accel_profile_func_t filter);
 
+/* Piecewise linear velocity to acceleration factor mapping, parsed from a
+ * list of "velocity:factor" points with increasing velocities, separated by
+ * spaces or commas.  Velocities outside the table clamp to its ends. */
+struct accel_profile_table;
+
+WL_EXPORT struct accel_profile_table *
+accel_profile_table_create(const char *spec);
+
+WL_EXPORT double
+accel_profile_table_lookup(const struct accel_profile_table *table,
+			   double velocity);
+
+WL_EXPORT void
+accel_profile_table_destroy(struct accel_profile_table *table);
+
 #endif // _FILTER_H_
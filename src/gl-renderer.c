@@ -26,13 +26,21 @@
 #include <GLES2/gl2ext.h>
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <linux/input.h>
 
 #include "gl-renderer.h"
+#include "linux-dmabuf.h"
+#include "linux-dmabuf-server-protocol.h"
+#include "linux-explicit-synchronization.h"
 #include "vertex-clipping.h"
 
 #include <EGL/eglext.h>
@@ -45,11 +53,93 @@ struct gl_shader {
 	GLint tex_uniforms[3];
 	GLint alpha_uniform;
 	GLint color_uniform;
+	GLint colorkey_uniform;
+	GLint lut_size_uniform;
 	const char *vertex_source, *fragment_source;
+	int colorkey;			/* discards fragments matching the key */
+	struct gl_shader *keyed;	/* colour keyed variant, or NULL */
 };
 
 #define BUFFER_DAMAGE_COUNT 2
 
+/* Pixel buffer objects are core in GL ES 3, but we build against the
+ * GL ES 2 headers and look the entry points up at runtime. */
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER		0x88EC
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT		0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#define GL_MAP_INVALIDATE_BUFFER_BIT	0x0008
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER		0x88EB
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT			0x0001
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ			0x88E1
+#endif
+
+typedef void *(*gl_map_buffer_range_func_t)(GLenum target, GLintptr offset,
+					    GLsizeiptr length,
+					    GLbitfield access);
+typedef GLboolean (*gl_unmap_buffer_func_t)(GLenum target);
+
+#ifndef GL_EXT_disjoint_timer_query
+#define GL_QUERY_RESULT_EXT		0x8866
+#define GL_QUERY_RESULT_AVAILABLE_EXT	0x8867
+#define GL_TIME_ELAPSED_EXT		0x88BF
+#define GL_GPU_DISJOINT_EXT		0x8FBB
+#endif
+
+typedef void (*gl_gen_queries_func_t)(GLsizei n, GLuint *ids);
+typedef void (*gl_delete_queries_func_t)(GLsizei n, const GLuint *ids);
+typedef void (*gl_begin_query_func_t)(GLenum target, GLuint id);
+typedef void (*gl_end_query_func_t)(GLenum target);
+typedef void (*gl_get_query_objectuiv_func_t)(GLuint id, GLenum pname,
+					      GLuint *params);
+typedef void (*gl_get_query_objectui64v_func_t)(GLuint id, GLenum pname,
+						uint64_t *params);
+
+/* DRM_FORMAT codes of dmabufs, without depending on libdrm */
+#define GL_RENDERER_FOURCC(a, b, c, d) \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+	 ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#ifndef DRM_FORMAT_R8
+#define DRM_FORMAT_R8		GL_RENDERER_FOURCC('R', '8', ' ', ' ')
+#define DRM_FORMAT_GR88		GL_RENDERER_FOURCC('G', 'R', '8', '8')
+#define DRM_FORMAT_RGB565	GL_RENDERER_FOURCC('R', 'G', '1', '6')
+#define DRM_FORMAT_XRGB8888	GL_RENDERER_FOURCC('X', 'R', '2', '4')
+#define DRM_FORMAT_ARGB8888	GL_RENDERER_FOURCC('A', 'R', '2', '4')
+#define DRM_FORMAT_XBGR8888	GL_RENDERER_FOURCC('X', 'B', '2', '4')
+#define DRM_FORMAT_ABGR8888	GL_RENDERER_FOURCC('A', 'B', '2', '4')
+#define DRM_FORMAT_YUYV		GL_RENDERER_FOURCC('Y', 'U', 'Y', 'V')
+#define DRM_FORMAT_NV12		GL_RENDERER_FOURCC('N', 'V', '1', '2')
+#define DRM_FORMAT_YUV420	GL_RENDERER_FOURCC('Y', 'U', '1', '2')
+#endif
+
+enum gpu_timer_mode {
+	GPU_TIMER_OFF = 0,
+	GPU_TIMER_FRAME,	/* one query around the whole frame */
+	GPU_TIMER_VIEW		/* one query per draw_view() or batch */
+};
+
+/* Timer query results are read back this many frames later at most;
+ * frames are not measured while all slots are still pending. */
+#define GPU_TIMER_FRAMES 4
+#define GPU_OVERLAY_SAMPLES 64
+
+struct gl_gpu_timer_frame {
+	enum gpu_timer_mode mode;
+	int pending;
+	struct wl_array queries;	/* GLuint, reused between frames */
+	int nqueries;
+};
+
 enum gl_border_status {
 	BORDER_STATUS_CLEAN = 0,
 	BORDER_TOP_DIRTY = 1 << GL_RENDERER_BORDER_TOP,
@@ -73,6 +163,106 @@ struct gl_output_state {
 	enum gl_border_status border_damage[BUFFER_DAMAGE_COUNT];
 	struct gl_border_image borders[4];
 	enum gl_border_status border_status;
+
+	struct gl_gpu_timer_frame gpu_frames[GPU_TIMER_FRAMES];
+	uint32_t gpu_frame_head;	/* next slot to record, the oldest */
+	uint32_t gpu_samples[GPU_OVERLAY_SAMPLES];	/* us per frame */
+	uint32_t gpu_sample_count;
+	struct wl_event_source *gpu_overlay_idle;
+
+	struct wl_list readbacks;	/* gl_readback::link, oldest first */
+	struct wl_event_source *readback_timer;
+
+	struct wl_list layer_caches;	/* gl_layer_cache::link */
+	uint32_t repaint_frame;
+
+	/* 3D LUT color correction: the output is drawn into fbo and
+	 * copied to the EGL surface through the LUT, see
+	 * color_correction_begin() */
+	struct {
+		GLuint lut_tex;
+		int lut_size;		/* 0 without correction */
+		GLuint fbo, tex;
+		int32_t width, height;
+		int valid;		/* fbo holds the previous frame */
+	} color;
+};
+
+/* glReadPixels into a pixel pack buffer returns once the copy is queued;
+ * the buffer is mapped when the fence says the GPU is done with it. */
+#define READBACK_POLL_MS 4
+#define READBACK_NO_FENCE_MS 16
+
+struct gl_readback {
+	struct wl_list link;
+	GLuint pbo;
+	GLsizeiptr size;
+	EGLSyncKHR fence;
+	weston_read_pixels_done_func_t done;
+	void *data;
+};
+
+/* Clipped vertices of a view from a previous frame, reused while the view
+ * transform, the regions and the texture layout stay the same. */
+#define GEOMETRY_CACHE_SIZE 4
+
+struct gl_geometry_cache {
+	struct wl_list link;
+
+	struct weston_view *view;
+	uint32_t transform_serial;
+	int32_t width, height;
+	int pitch, buffer_height, y_inverted;
+	int32_t atlas_x, atlas_y;
+	struct weston_buffer_viewport viewport;
+	pixman_region32_t region;
+	pixman_region32_t surf_region;
+
+	struct wl_array vertices;
+	struct wl_array vtxcnt;
+};
+
+/* Damage is coarsened to a few boxes before it is uploaded or drawn:
+ * each box is a glTexSubImage2D call, or a pass of geometry per view,
+ * which costs more than a few extra pixels. */
+#define DAMAGE_MAX_BOXES_UPLOAD 8
+#define DAMAGE_MAX_BOXES_REPAINT 16
+#define DAMAGE_MAX_WASTE_PERCENT 50
+
+/* Small SHM surfaces share one texture, allocated in shelves: rows of
+ * slots of similar height filled from the left.  A shelf becomes
+ * available again once every slot on it has been released. */
+#define ATLAS_SIZE 1024
+#define ATLAS_MAX_SURFACE 128
+#define ATLAS_MAX_SHELVES 64
+
+struct gl_atlas_shelf {
+	int32_t y, height;
+	int32_t x;		/* start of the free space */
+	int live;		/* slots in use */
+};
+
+/* The EGLImages of a linux_dmabuf buffer, created once when the client
+ * creates the buffer and owned by it. */
+struct dmabuf_image {
+	struct linux_dmabuf_buffer *dmabuf;
+	int num_images;
+	EGLImageKHR images[3];
+	GLenum target;
+	struct gl_shader *shader;
+	struct wl_list link;	/* gl_renderer::dmabuf_images */
+};
+
+/* The EGLImages of a wl_drm style buffer, kept from its first attach
+ * until the buffer is destroyed */
+struct egl_buffer_image {
+	struct gl_renderer *renderer;
+	struct weston_buffer *buffer;
+	struct wl_listener destroy_listener;
+	uint32_t format;
+	int num_planes;
+	EGLImageKHR images[3];
+	struct wl_list link;	/* gl_renderer::egl_buffer_images */
 };
 
 enum buffer_type {
@@ -96,6 +286,29 @@ struct gl_surface_state {
 	GLenum gl_format;
 	GLenum gl_pixel_type;
 
+	/* Planes of multi-planar SHM formats, each uploaded to its own
+	 * texture from offset in the buffer and subsampled by hsub and
+	 * vsub. 1 plane for the RGB formats, which use gl_format. */
+	int num_planes;
+	GLenum plane_format[3];
+	int plane_bpp[3];
+	int offset[3];
+	int hsub[3];
+	int vsub[3];
+
+	/* Staging buffer for streaming SHM uploads */
+	GLuint pbo;
+
+	/* Mip levels of textures[0] for views drawn minified, see
+	 * view_uses_mipmaps(). valid until the next upload. */
+	int mipmap_allocated;
+	int mipmap_valid;
+
+	/* Slot in the texture atlas; textures[0] is then the atlas
+	 * texture which is not owned by the surface. */
+	int atlas_shelf;	/* -1 when not in the atlas */
+	int32_t atlas_x, atlas_y;
+
 	EGLImageKHR images[3];
 	GLenum target;
 	int num_images;
@@ -108,6 +321,30 @@ struct gl_surface_state {
 
 	struct weston_surface *surface;
 
+	struct wl_list geometry_cache;	/* most recently used first */
+	int geometry_cache_count;
+
+	/* changes whenever the texture contents may have */
+	uint32_t content_serial;
+
+	/* Downscaled copy of the texture for views drawn small, see
+	 * gl_renderer_surface_set_thumbnail_size() */
+	struct {
+		int32_t width, height;	/* requested, surface coordinates */
+		GLuint fbo, tex;
+		int32_t tex_width, tex_height;
+		uint32_t content_serial;
+		int valid;
+	} thumbnail;
+
+	/* GPU memory of the textures above that the surface owns, and
+	 * when a view of it was last on an output, see
+	 * texture_budget_enforce() */
+	struct wl_list lru_link;	/* gl_renderer::texture_lru */
+	uint64_t texture_bytes;
+	uint32_t last_shown;		/* ms */
+	int evicted;
+
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
@@ -116,8 +353,10 @@ struct gl_renderer {
 	struct weston_renderer base;
 	int fragment_shader_debug;
 	int fan_debug;
+	int gpu_overlay;
 	struct weston_binding *fragment_binding;
 	struct weston_binding *fan_binding;
+	struct weston_binding *gpu_overlay_binding;
 
 	EGLDisplay egl_display;
 	EGLContext egl_context;
@@ -125,6 +364,29 @@ struct gl_renderer {
 
 	struct wl_array vertices;
 	struct wl_array vtxcnt;
+	struct wl_array indices;
+
+	/* scratch for compute_texture_region(), reused between views */
+	struct wl_array clip_boxes;	/* struct clip_box */
+	struct wl_array clip_pieces;	/* struct polygon8 */
+
+	/* Solid colour and atlas views batched into a single draw, see
+	 * batch_add_view() */
+	struct wl_array batch_vertices;
+	struct wl_array batch_indices;
+	struct gl_shader *batch_shader;
+	GLint batch_filter;
+
+	/* Views drawn at less than this fraction of their SHM texture's
+	 * size sample mipmaps, 0 disables them */
+	float mipmap_scale;
+	int has_texture_npot;
+
+	int has_atlas;
+	GLuint atlas_texture;
+	struct gl_atlas_shelf atlas_shelves[ATLAS_MAX_SHELVES];
+	int atlas_num_shelves;
+	int32_t atlas_next_y;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -133,30 +395,88 @@ struct gl_renderer {
 #ifdef EGL_EXT_swap_buffers_with_damage
 	PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
 #endif
+	PFNEGLSETDAMAGEREGIONKHRPROC set_damage_region;
 
 	int has_unpack_subimage;
 
+	int has_pbo;
+	gl_map_buffer_range_func_t map_buffer_range;
+	gl_unmap_buffer_func_t unmap_buffer;
+
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+
+	/* Explicit sync with clients: wait on their acquire fences on
+	 * the GPU and hand out release fences */
+	int has_native_fence_sync;
+	PFNEGLWAITSYNCKHRPROC wait_sync;
+	PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup_native_fence_fd;
+
+	/* On-disk cache of linked shader programs */
+	int has_program_binary;
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+	char *program_cache_dir;
+	uint64_t program_cache_key;	/* hash of the GL implementation */
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
 	int has_bind_display;
 
+	/* [core] adaptive-renderer: the backend swaps this renderer for
+	 * pixman and back, so clients only get to use SHM buffers */
+	int shm_only;
+
 	int has_egl_image_external;
 
 	int has_egl_buffer_age;
 
 	int has_configless_context;
 
+	int has_dmabuf_import;
+	int has_dmabuf_import_modifiers;
+	struct wl_list dmabuf_images;
+
+	struct wl_list egl_buffer_images;
+
+	int has_timer_query;
+	enum gpu_timer_mode gpu_timer_mode;
+	struct gl_gpu_timer_frame *gpu_frame;	/* being recorded */
+	int gpu_query_active;
+	gl_gen_queries_func_t gen_queries;
+	gl_delete_queries_func_t delete_queries;
+	gl_begin_query_func_t begin_query;
+	gl_end_query_func_t end_query;
+	gl_get_query_objectuiv_func_t get_query_objectuiv;
+	gl_get_query_objectui64v_func_t get_query_objectui64v;
+
 	struct gl_shader texture_shader_rgba;
 	struct gl_shader texture_shader_rgbx;
 	struct gl_shader texture_shader_egl_external;
 	struct gl_shader texture_shader_y_uv;
 	struct gl_shader texture_shader_y_u_v;
 	struct gl_shader texture_shader_y_xuxv;
+	/* keyed variants of the six texture shaders above */
+	struct gl_shader keyed_shaders[6];
 	struct gl_shader invert_color_shader;
 	struct gl_shader solid_shader;
+	struct gl_shader solid_batch_shader;
+	struct gl_shader atlas_batch_shader;
+	struct gl_shader color_lut_shader;
 	struct gl_shader *current_shader;
 
+	uint32_t content_serial;	/* last gl_surface_state one */
+
+	/* Textures of surfaces hidden for longer than texture_evict_age
+	 * go, least recently shown first, while the total is over
+	 * texture_budget.  No budget when 0. */
+	uint64_t texture_budget;
+	uint64_t texture_bytes;
+	uint32_t texture_evict_age;	/* ms */
+	struct wl_list texture_lru;	/* most recently shown first */
+
 	struct wl_signal destroy_signal;
 };
 
@@ -220,91 +540,47 @@ gl_renderer_print_egl_error_state(void)
 		egl_error_string(code), (long)code);
 }
 
-#define max(a, b) (((a) > (b)) ? (a) : (b))
-#define min(a, b) (((a) > (b)) ? (b) : (a))
-
 /*
- * Compute the boundary vertices of the intersection of the global coordinate
- * aligned rectangle 'rect', and an arbitrary quadrilateral produced from
- * 'surf_rect' when transformed from surface coordinates into global coordinates.
- * The vertices are written to 'ex' and 'ey', and the return value is the
- * number of vertices. Vertices are produced in clockwise winding order.
- * Guarantees to produce either zero vertices, or 3-8 vertices with non-zero
+ * Transform the surface coordinate aligned rectangle 'surf_rect' into
+ * the quadrilateral it covers in global coordinates.  Clipping that
+ * with clip_boxes() against the global coordinate aligned rectangles of
+ * the damage gives the boundary vertices of each intersection, in
+ * clockwise winding order, either none or 3-8 of them with non-zero
  * polygon area.
  */
-static int
-calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
-		pixman_box32_t *surf_rect, GLfloat *ex, GLfloat *ey)
+static void
+surface_rect_to_global(struct weston_view *ev, pixman_box32_t *surf_rect,
+		       struct polygon8 *surf)
 {
+	int i;
 
-	struct clip_context ctx;
-	int i, n;
-	GLfloat min_x, max_x, min_y, max_y;
-	struct polygon8 surf = {
-		{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
-		{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
-		4
-	};
-
-	ctx.clip.x1 = rect->x1;
-	ctx.clip.y1 = rect->y1;
-	ctx.clip.x2 = rect->x2;
-	ctx.clip.y2 = rect->y2;
-
-	/* transform surface to screen space: */
-	for (i = 0; i < surf.n; i++)
-		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
-					    &surf.x[i], &surf.y[i]);
-
-	/* find bounding box: */
-	min_x = max_x = surf.x[0];
-	min_y = max_y = surf.y[0];
-
-	for (i = 1; i < surf.n; i++) {
-		min_x = min(min_x, surf.x[i]);
-		max_x = max(max_x, surf.x[i]);
-		min_y = min(min_y, surf.y[i]);
-		max_y = max(max_y, surf.y[i]);
-	}
-
-	/* First, simple bounding box check to discard early transformed
-	 * surface rects that do not intersect with the clip region:
-	 */
-	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
-	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
-		return 0;
-
-	/* Simple case, bounding box edges are parallel to surface edges,
-	 * there will be only four edges.  We just need to clip the surface
-	 * vertices to the clip rect bounds:
-	 */
-	if (!ev->transform.enabled)
-		return clip_simple(&ctx, &surf, ex, ey);
-
-	/* Transformed case: use a general polygon clipping algorithm to
-	 * clip the surface rectangle with each side of 'rect'.
-	 * The algorithm is Sutherland-Hodgman, as explained in
-	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
-	 * but without looking at any of that code.
-	 */
-	n = clip_transformed(&ctx, &surf, ex, ey);
-
-	if (n < 3)
-		return 0;
-
-	return n;
+	surf->x[0] = surf_rect->x1;
+	surf->y[0] = surf_rect->y1;
+	surf->x[1] = surf_rect->x2;
+	surf->y[1] = surf_rect->y1;
+	surf->x[2] = surf_rect->x2;
+	surf->y[2] = surf_rect->y2;
+	surf->x[3] = surf_rect->x1;
+	surf->y[3] = surf_rect->y2;
+	surf->n = 4;
+
+	for (i = 0; i < surf->n; i++)
+		weston_view_to_global_float(ev, surf->x[i], surf->y[i],
+					    &surf->x[i], &surf->y[i]);
 }
 
 static int
-texture_region(struct weston_view *ev, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
+compute_texture_region(struct weston_view *ev, pixman_region32_t *region,
+		       pixman_region32_t *surf_region)
 {
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v, inv_width, inv_height;
+	GLfloat *v, inv_width, inv_height, off_x, off_y;
 	unsigned int *vtxcnt, nvtx = 0;
 	pixman_box32_t *rects, *surf_rects;
+	struct clip_box *boxes;
+	struct polygon8 surf, *pieces;
 	int i, j, k, nrects, nsurf;
 
 	rects = pixman_region32_rectangles(region, &nrects);
@@ -316,61 +592,231 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
 	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
 
+	gr->clip_boxes.size = 0;
+	gr->clip_pieces.size = 0;
+	boxes = wl_array_add(&gr->clip_boxes, nrects * sizeof *boxes);
+	pieces = wl_array_add(&gr->clip_pieces, nrects * sizeof *pieces);
+	if (!boxes || !pieces)
+		return 0;
+
+	for (i = 0; i < nrects; i++) {
+		boxes[i].x1 = rects[i].x1;
+		boxes[i].y1 = rects[i].y1;
+		boxes[i].x2 = rects[i].x2;
+		boxes[i].y2 = rects[i].y2;
+	}
+
 	inv_width = 1.0 / gs->pitch;
         inv_height = 1.0 / gs->height;
+	off_x = off_y = 0;
 
-	for (i = 0; i < nrects; i++) {
-		pixman_box32_t *rect = &rects[i];
-		for (j = 0; j < nsurf; j++) {
-			pixman_box32_t *surf_rect = &surf_rects[j];
+	if (gs->atlas_shelf >= 0) {
+		inv_width = inv_height = 1.0 / ATLAS_SIZE;
+		off_x = gs->atlas_x;
+		off_y = gs->atlas_y;
+	}
+
+	for (j = 0; j < nsurf; j++) {
+		/* The transformed surface, after clipping to the clip region,
+		 * can have as many as eight sides, emitted as a triangle-fan.
+		 * The first vertex in the triangle fan can be chosen arbitrarily,
+		 * since the area is guaranteed to be convex.
+		 *
+		 * If a corner of the transformed surface falls outside of the
+		 * clip region, instead of emitting one vertex for the corner
+		 * of the surface, up to two are emitted for two corresponding
+		 * intersection point(s) between the surface and the clip region.
+		 *
+		 * To do this, we first calculate the (up to eight) points that
+		 * form the intersection of each clip rect and the transformed
+		 * surface, all clip rects at once.
+		 */
+		surface_rect_to_global(ev, &surf_rects[j], &surf);
+		if (clip_boxes(&surf, boxes, nrects, pieces) == 0)
+			continue;
+
+		for (i = 0; i < nrects; i++) {
+			struct polygon8 *piece = &pieces[i];
 			GLfloat sx, sy, bx, by;
-			GLfloat ex[8], ey[8];          /* edge points in screen space */
-			int n;
-
-			/* The transformed surface, after clipping to the clip region,
-			 * can have as many as eight sides, emitted as a triangle-fan.
-			 * The first vertex in the triangle fan can be chosen arbitrarily,
-			 * since the area is guaranteed to be convex.
-			 *
-			 * If a corner of the transformed surface falls outside of the
-			 * clip region, instead of emitting one vertex for the corner
-			 * of the surface, up to two are emitted for two corresponding
-			 * intersection point(s) between the surface and the clip region.
-			 *
-			 * To do this, we first calculate the (up to eight) points that
-			 * form the intersection of the clip rect and the transformed
-			 * surface.
-			 */
-			n = calculate_edges(ev, rect, surf_rect, ex, ey);
-			if (n < 3)
+
+			if (piece->n < 3)
 				continue;
 
 			/* emit edge points: */
-			for (k = 0; k < n; k++) {
-				weston_view_from_global_float(ev, ex[k], ey[k],
+			for (k = 0; k < piece->n; k++) {
+				weston_view_from_global_float(ev,
+							      piece->x[k],
+							      piece->y[k],
 							      &sx, &sy);
 				/* position: */
-				*(v++) = ex[k];
-				*(v++) = ey[k];
+				*(v++) = piece->x[k];
+				*(v++) = piece->y[k];
 				/* texcoord: */
 				weston_surface_to_buffer_float(ev->surface,
 							       sx, sy,
 							       &bx, &by);
-				*(v++) = bx * inv_width;
+				*(v++) = (off_x + bx) * inv_width;
 				if (gs->y_inverted) {
-					*(v++) = by * inv_height;
+					*(v++) = (off_y + by) * inv_height;
 				} else {
 					*(v++) = (gs->height - by) * inv_height;
 				}
 			}
 
-			vtxcnt[nvtx++] = n;
+			vtxcnt[nvtx++] = piece->n;
 		}
 	}
 
 	return nvtx;
 }
 
+static void
+geometry_cache_entry_destroy(struct gl_geometry_cache *entry)
+{
+	wl_list_remove(&entry->link);
+	pixman_region32_fini(&entry->region);
+	pixman_region32_fini(&entry->surf_region);
+	wl_array_release(&entry->vertices);
+	wl_array_release(&entry->vtxcnt);
+	free(entry);
+}
+
+static int
+geometry_cache_match(struct gl_geometry_cache *entry,
+		     struct weston_view *ev, struct gl_surface_state *gs,
+		     pixman_region32_t *region, pixman_region32_t *surf_region)
+{
+	struct weston_surface *surface = ev->surface;
+
+	return entry->view == ev &&
+		entry->transform_serial == ev->transform.serial &&
+		entry->width == surface->width &&
+		entry->height == surface->height &&
+		entry->pitch == gs->pitch &&
+		entry->buffer_height == gs->height &&
+		entry->y_inverted == gs->y_inverted &&
+		entry->atlas_x == gs->atlas_x &&
+		entry->atlas_y == gs->atlas_y &&
+		memcmp(&entry->viewport, &surface->buffer_viewport,
+		       sizeof entry->viewport) == 0 &&
+		pixman_region32_equal(&entry->region, region) &&
+		pixman_region32_equal(&entry->surf_region, surf_region);
+}
+
+static void
+geometry_cache_store(struct gl_surface_state *gs, struct weston_view *ev,
+		     pixman_region32_t *region, pixman_region32_t *surf_region,
+		     GLfloat *v, unsigned int *vtxcnt, int nfans)
+{
+	struct gl_geometry_cache *entry;
+	unsigned int nvtx = 0;
+	void *dst;
+	int i;
+
+	for (i = 0; i < nfans; i++)
+		nvtx += vtxcnt[i];
+
+	if (gs->geometry_cache_count == GEOMETRY_CACHE_SIZE) {
+		entry = container_of(gs->geometry_cache.prev,
+				     struct gl_geometry_cache, link);
+		geometry_cache_entry_destroy(entry);
+		gs->geometry_cache_count--;
+	}
+
+	entry = zalloc(sizeof *entry);
+	if (!entry)
+		return;
+
+	if (nvtx > 0) {
+		dst = wl_array_add(&entry->vertices, nvtx * 4 * sizeof *v);
+		if (!dst)
+			goto err;
+		memcpy(dst, v, nvtx * 4 * sizeof *v);
+
+		dst = wl_array_add(&entry->vtxcnt, nfans * sizeof *vtxcnt);
+		if (!dst)
+			goto err;
+		memcpy(dst, vtxcnt, nfans * sizeof *vtxcnt);
+	}
+
+	entry->view = ev;
+	entry->transform_serial = ev->transform.serial;
+	entry->width = ev->surface->width;
+	entry->height = ev->surface->height;
+	entry->pitch = gs->pitch;
+	entry->buffer_height = gs->height;
+	entry->y_inverted = gs->y_inverted;
+	entry->atlas_x = gs->atlas_x;
+	entry->atlas_y = gs->atlas_y;
+	entry->viewport = ev->surface->buffer_viewport;
+	pixman_region32_init(&entry->region);
+	pixman_region32_copy(&entry->region, region);
+	pixman_region32_init(&entry->surf_region);
+	pixman_region32_copy(&entry->surf_region, surf_region);
+
+	wl_list_insert(&gs->geometry_cache, &entry->link);
+	gs->geometry_cache_count++;
+
+	return;
+
+err:
+	wl_array_release(&entry->vertices);
+	wl_array_release(&entry->vtxcnt);
+	free(entry);
+}
+
+/* Fill gr->vertices and gr->vtxcnt with the triangle fans covering the
+ * intersection of region and surf_region, reusing the result of an
+ * earlier frame when nothing it depends on has changed. */
+static int
+texture_region(struct weston_view *ev, pixman_region32_t *region,
+		pixman_region32_t *surf_region)
+{
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_renderer *gr = get_renderer(ev->surface->compositor);
+	struct gl_geometry_cache *entry;
+	size_t vertices_start, vtxcnt_start;
+	GLfloat *v;
+	unsigned int *vtxcnt;
+	int nfans;
+
+	if (ev->transform.serial == 0)
+		return compute_texture_region(ev, region, surf_region);
+
+	wl_list_for_each(entry, &gs->geometry_cache, link) {
+		if (!geometry_cache_match(entry, ev, gs, region, surf_region))
+			continue;
+
+		wl_list_remove(&entry->link);
+		wl_list_insert(&gs->geometry_cache, &entry->link);
+
+		if (entry->vtxcnt.size == 0)
+			return 0;
+
+		v = wl_array_add(&gr->vertices, entry->vertices.size);
+		vtxcnt = wl_array_add(&gr->vtxcnt, entry->vtxcnt.size);
+		if (!v || !vtxcnt)
+			return 0;
+		memcpy(v, entry->vertices.data, entry->vertices.size);
+		memcpy(vtxcnt, entry->vtxcnt.data, entry->vtxcnt.size);
+
+		return entry->vtxcnt.size / sizeof *vtxcnt;
+	}
+
+	vertices_start = gr->vertices.size;
+	vtxcnt_start = gr->vtxcnt.size;
+	nfans = compute_texture_region(ev, region, surf_region);
+
+	geometry_cache_store(gs, ev, region, surf_region,
+			     (GLfloat *) ((char *) gr->vertices.data +
+					  vertices_start),
+			     (unsigned int *) ((char *) gr->vtxcnt.data +
+					       vtxcnt_start),
+			     nfans);
+
+	return nfans;
+}
+
 static void
 triangle_fan_debug(struct weston_view *view, int first, int count)
 {
@@ -411,6 +857,39 @@ triangle_fan_debug(struct weston_view *view, int first, int count)
 	free(buffer);
 }
 
+/* Append the triangles of nfans consecutive triangle fans, whose
+ * vertices start at index base, to the index array. */
+static int
+fans_to_triangles(struct wl_array *indices, unsigned int *vtxcnt, int nfans,
+		  unsigned int base)
+{
+	unsigned int i, k, nvtx = 0, ntri = 0;
+	GLushort *index;
+
+	for (i = 0; i < (unsigned int) nfans; i++) {
+		nvtx += vtxcnt[i];
+		ntri += vtxcnt[i] - 2;
+	}
+
+	if (base + nvtx > 65536)
+		return -1;
+
+	index = wl_array_add(indices, ntri * 3 * sizeof *index);
+	if (!index)
+		return -1;
+
+	for (i = 0; i < (unsigned int) nfans; i++) {
+		for (k = 1; k + 1 < vtxcnt[i]; k++) {
+			*index++ = base;
+			*index++ = base + k;
+			*index++ = base + k + 1;
+		}
+		base += vtxcnt[i];
+	}
+
+	return 0;
+}
+
 static void
 repaint_region(struct weston_view *ev, pixman_region32_t *region,
 		pixman_region32_t *surf_region)
@@ -442,6 +921,17 @@ repaint_region(struct weston_view *ev, pixman_region32_t *region,
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
 	glEnableVertexAttribArray(1);
 
+	/* Draw all the fans with a single call when they fit in 16 bit
+	 * indices; the fan debug mode needs them one by one. */
+	if (!gr->fan_debug && nfans > 1 &&
+	    fans_to_triangles(&gr->indices, vtxcnt, nfans, 0) == 0) {
+		glDrawElements(GL_TRIANGLES,
+			       gr->indices.size / sizeof(GLushort),
+			       GL_UNSIGNED_SHORT, gr->indices.data);
+		gr->indices.size = 0;
+		nfans = 0;
+	}
+
 	for (i = 0, first = 0; i < nfans; i++) {
 		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
 		if (gr->fan_debug)
@@ -515,133 +1005,1103 @@ shader_uniforms(struct gl_shader *shader,
 			   1, GL_FALSE, output->matrix.d);
 	glUniform4fv(shader->color_uniform, 1, gs->color);
 	glUniform1f(shader->alpha_uniform, view->alpha);
+	if (shader->colorkey)
+		glUniform3f(shader->colorkey_uniform,
+			    ((view->colorkey >> 16) & 0xff) / 255.0f,
+			    ((view->colorkey >> 8) & 0xff) / 255.0f,
+			    (view->colorkey & 0xff) / 255.0f);
 
 	for (i = 0; i < gs->num_textures; i++)
 		glUniform1i(shader->tex_uniforms[i], i);
 }
 
+static GLuint
+gpu_timer_next_query(struct gl_renderer *gr, struct gl_gpu_timer_frame *frame)
+{
+	GLuint *q;
+
+	if (frame->nqueries * sizeof *q < frame->queries.size) {
+		q = frame->queries.data;
+		return q[frame->nqueries++];
+	}
+
+	q = wl_array_add(&frame->queries, sizeof *q);
+	if (!q)
+		return 0;
+
+	gr->gen_queries(1, q);
+	frame->nqueries++;
+
+	return *q;
+}
+
+/* Start measuring the GPU time of what is drawn until gpu_timer_end(),
+ * if the frame being recorded measures at this granularity. */
 static void
-draw_view(struct weston_view *ev, struct weston_output *output,
-	  pixman_region32_t *damage) /* in global coordinates */
+gpu_timer_begin(struct gl_renderer *gr, enum gpu_timer_mode mode)
 {
-	struct weston_compositor *ec = ev->surface->compositor;
-	struct gl_renderer *gr = get_renderer(ec);
-	struct gl_surface_state *gs = get_surface_state(ev->surface);
-	/* repaint bounding region in global coordinates: */
-	pixman_region32_t repaint;
-	/* non-opaque region in surface coordinates: */
-	pixman_region32_t surface_blend;
-	GLint filter;
-	int i;
+	GLuint query;
 
-	/* In case of a runtime switch of renderers, we may not have received
-	 * an attach for this surface since the switch. In that case we don't
-	 * have a valid buffer or a proper shader set up so skip rendering. */
-	if (!gs->shader)
+	if (!gr->gpu_frame || gr->gpu_frame->mode != mode)
 		return;
 
-	pixman_region32_init(&repaint);
-	pixman_region32_intersect(&repaint,
-				  &ev->transform.boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
-
-	if (!pixman_region32_not_empty(&repaint))
-		goto out;
+	query = gpu_timer_next_query(gr, gr->gpu_frame);
+	if (!query)
+		return;
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	gr->begin_query(GL_TIME_ELAPSED_EXT, query);
+	gr->gpu_query_active = 1;
+}
 
-	if (gr->fan_debug) {
-		use_shader(gr, &gr->solid_shader);
-		shader_uniforms(&gr->solid_shader, ev, output);
-	}
+static void
+gpu_timer_end(struct gl_renderer *gr)
+{
+	if (!gr->gpu_query_active)
+		return;
 
-	use_shader(gr, gs->shader);
-	shader_uniforms(gs->shader, ev, output);
+	gr->end_query(GL_TIME_ELAPSED_EXT);
+	gr->gpu_query_active = 0;
+}
 
+static GLint
+view_texture_filter(struct weston_view *ev, struct weston_output *output)
+{
 	if (ev->transform.enabled || output->zoom.active ||
 	    output->current_scale != ev->surface->buffer_viewport.buffer.scale)
-		filter = GL_LINEAR;
-	else
-		filter = GL_NEAREST;
+		return GL_LINEAR;
 
-	for (i = 0; i < gs->num_textures; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
-	}
+	return GL_NEAREST;
+}
 
-	/* blended region is whole surface minus opaque region: */
-	pixman_region32_init_rect(&surface_blend, 0, 0,
-				  ev->surface->width, ev->surface->height);
-	pixman_region32_subtract(&surface_blend, &surface_blend, &ev->surface->opaque);
+static struct gl_shader *
+view_shader(struct weston_view *ev, struct gl_shader *shader)
+{
+	if (ev->colorkey_enabled && shader->keyed)
+		return shader->keyed;
 
-	/* XXX: Should we be using ev->transform.opaque here? */
-	if (pixman_region32_not_empty(&ev->surface->opaque)) {
-		if (gs->shader == &gr->texture_shader_rgba) {
-			/* Special case for RGBA textures with possibly
-			 * bad data in alpha channel: use the shader
-			 * that forces texture alpha = 1.0.
-			 * Xwayland surfaces need this.
-			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, ev, output);
-		}
+	return shader;
+}
 
-		if (ev->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint64_t area = 0;
+	int i, n;
 
-		repaint_region(ev, &repaint, &ev->surface->opaque);
-	}
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (uint64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
 
-	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
-		glEnable(GL_BLEND);
-		repaint_region(ev, &repaint, &surface_blend);
-	}
+	return area;
+}
 
-	pixman_region32_fini(&surface_blend);
+/* Texels of all planes of a multi-planar SHM surface, in bytes */
+static uint64_t
+planes_size(struct gl_surface_state *gs)
+{
+	uint64_t size = 0;
+	int i;
 
-out:
-	pixman_region32_fini(&repaint);
+	for (i = 0; i < gs->num_planes; i++)
+		size += (uint64_t) (gs->pitch / gs->hsub[i]) *
+			(gs->height / gs->vsub[i]) * gs->plane_bpp[i];
+
+	return size;
 }
 
+/* Recount the GPU memory the surface allocated itself.  EGL and dmabuf
+ * textures only wrap client buffers and atlas slots are shared, so
+ * neither counts against the budget. */
 static void
-repaint_views(struct weston_output *output, pixman_region32_t *damage)
+texture_account(struct gl_renderer *gr, struct gl_surface_state *gs)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	uint64_t bytes = 0, size;
+
+	if (gs->buffer_type == BUFFER_TYPE_SHM) {
+		if (gs->num_planes > 1)
+			size = planes_size(gs);
+		else
+			size = (uint64_t) gs->pitch * gs->height *
+				(gs->gl_pixel_type == GL_UNSIGNED_BYTE ? 4 : 2);
+		if (gs->atlas_shelf < 0 && gs->num_textures > 0)
+			bytes += size;
+		if (gs->atlas_shelf < 0 && gs->num_textures > 0 &&
+		    gs->mipmap_allocated)
+			bytes += size / 3;
+		if (gs->pbo)
+			bytes += size;
+	}
+	bytes += (uint64_t) gs->thumbnail.tex_width *
+		 gs->thumbnail.tex_height * 4;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	gr->texture_bytes = gr->texture_bytes - gs->texture_bytes + bytes;
+	gs->texture_bytes = bytes;
+	weston_surface_set_texture_bytes(gs->surface, bytes);
 }
 
-static void
-draw_output_border_texture(struct gl_output_state *go,
-			   enum gl_renderer_border_side side,
-			   int32_t x, int32_t y,
-			   int32_t width, int32_t height)
+/* The thumbnail covers the whole texture like the texture itself, so
+ * the texture coordinates of the surface apply to it unchanged.  Its
+ * resolution is a fraction of the texture's, 0 when there is none. */
+static float
+thumbnail_scale(struct gl_surface_state *gs)
 {
-	struct gl_border_image *img = &go->borders[side];
-	static GLushort indices [] = { 0, 1, 3, 3, 1, 2 };
+	struct weston_surface *surface = gs->surface;
+	float sx, sy;
 
-	if (!img->data) {
-		if (img->tex) {
-			glDeleteTextures(1, &img->tex);
-			img->tex = 0;
-		}
+	if (gs->thumbnail.width == 0 || gs->num_textures == 0 ||
+	    gs->atlas_shelf >= 0 ||
+	    surface->width == 0 || surface->height == 0)
+		return 0.0f;
 
-		return;
-	}
+	sx = gs->thumbnail.width / (float) surface->width;
+	sy = gs->thumbnail.height / (float) surface->height;
+	if (sx < sy)
+		sx = sy;
 
-	if (!img->tex) {
-		glGenTextures(1, &img->tex);
-		glBindTexture(GL_TEXTURE_2D, img->tex);
+	/* nothing to save */
+	if (sx >= 1.0f)
+		return 0.0f;
 
-		glTexParameteri(GL_TEXTURE_2D,
+	return sx;
+}
+
+static void
+thumbnail_release(struct gl_surface_state *gs)
+{
+	if (gs->thumbnail.fbo)
+		glDeleteFramebuffers(1, &gs->thumbnail.fbo);
+	if (gs->thumbnail.tex)
+		glDeleteTextures(1, &gs->thumbnail.tex);
+
+	gs->thumbnail.fbo = 0;
+	gs->thumbnail.tex = 0;
+	gs->thumbnail.tex_width = 0;
+	gs->thumbnail.tex_height = 0;
+	gs->thumbnail.valid = 0;
+}
+
+/* Whether ev lands on the output with no more pixels per texel than
+ * the thumbnail has. */
+static int
+view_uses_thumbnail(struct weston_view *ev, struct weston_output *output,
+		    float scale)
+{
+	struct weston_matrix *m = &ev->transform.matrix;
+	float limit, view_scale2;
+
+	if (scale == 0.0f || output->zoom.active)
+		return 0;
+
+	limit = scale * ev->surface->buffer_viewport.buffer.scale /
+		output->current_scale * 1.01f;
+
+	view_scale2 = 1.0f;
+	if (ev->transform.enabled)
+		view_scale2 = m->d[0] * m->d[0] + m->d[1] * m->d[1];
+
+	return view_scale2 <= limit * limit;
+}
+
+static int
+is_power_of_two(int32_t n)
+{
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
+/* Whether ev lands on the output at less than gl-mipmap-below of its
+ * texture's size, and that texture can have mip levels: an RGB wl_shm
+ * texture of its own, and a power of two unless GL_OES_texture_npot. */
+static int
+view_uses_mipmaps(struct gl_renderer *gr, struct weston_view *ev,
+		  struct weston_output *output)
+{
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct weston_matrix *m = &ev->transform.matrix;
+	float limit, view_scale2;
+
+	if (gr->mipmap_scale <= 0.0f || output->zoom.active ||
+	    gs->buffer_type != BUFFER_TYPE_SHM || gs->num_planes != 1 ||
+	    gs->atlas_shelf >= 0 || gs->num_textures == 0)
+		return 0;
+
+	if (!gr->has_texture_npot &&
+	    (!is_power_of_two(gs->pitch) || !is_power_of_two(gs->height)))
+		return 0;
+
+	limit = gr->mipmap_scale * ev->surface->buffer_viewport.buffer.scale /
+		output->current_scale;
+
+	view_scale2 = 1.0f;
+	if (ev->transform.enabled)
+		view_scale2 = m->d[0] * m->d[0] + m->d[1] * m->d[1];
+
+	return view_scale2 < limit * limit;
+}
+
+/* Regenerated on the first minified draw after an upload only, views
+ * at full size keep sampling level 0 with GL_LINEAR. */
+static void
+mipmap_update(struct gl_renderer *gr, struct gl_surface_state *gs)
+{
+	if (gs->mipmap_valid)
+		return;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	gs->mipmap_valid = 1;
+	if (!gs->mipmap_allocated) {
+		gs->mipmap_allocated = 1;
+		texture_account(gr, gs);
+	}
+}
+
+/* Renders the texture into the thumbnail if it changed since, with the
+ * surface's own shader so that any format ends up as RGBA. */
+static int
+thumbnail_update(struct gl_renderer *gr, struct gl_surface_state *gs,
+		 float scale)
+{
+	struct gl_shader *shader = gs->shader;
+	struct weston_matrix identity;
+	int32_t width = gs->pitch * scale + 1;
+	int32_t height = gs->height * scale + 1;
+	GLint viewport[4];
+	GLint fbo;
+	int i;
+	static const GLfloat v[] = {
+		-1.0f, -1.0f, 0.0f, 0.0f,
+		 1.0f, -1.0f, 1.0f, 0.0f,
+		 1.0f,  1.0f, 1.0f, 1.0f,
+		-1.0f,  1.0f, 0.0f, 1.0f,
+	};
+
+	if (gs->thumbnail.valid &&
+	    gs->thumbnail.content_serial == gs->content_serial &&
+	    gs->thumbnail.tex_width == width &&
+	    gs->thumbnail.tex_height == height)
+		return 0;
+
+	/* a layer cache may be being filled */
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+
+	if (!gs->thumbnail.fbo || gs->thumbnail.tex_width != width ||
+	    gs->thumbnail.tex_height != height) {
+		if (!gs->thumbnail.tex)
+			glGenTextures(1, &gs->thumbnail.tex);
+		glBindTexture(GL_TEXTURE_2D, gs->thumbnail.tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+				GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+				GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+		if (!gs->thumbnail.fbo)
+			glGenFramebuffers(1, &gs->thumbnail.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, gs->thumbnail.fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				       GL_TEXTURE_2D, gs->thumbnail.tex, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+		    GL_FRAMEBUFFER_COMPLETE) {
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+			thumbnail_release(gs);
+			return -1;
+		}
+		gs->thumbnail.tex_width = width;
+		gs->thumbnail.tex_height = height;
+	} else {
+		glBindFramebuffer(GL_FRAMEBUFFER, gs->thumbnail.fbo);
+	}
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, width, height);
+	glDisable(GL_BLEND);
+
+	use_shader(gr, shader);
+	weston_matrix_init(&identity);
+	glUniformMatrix4fv(shader->proj_uniform, 1, GL_FALSE, identity.d);
+	glUniform4fv(shader->color_uniform, 1, gs->color);
+	glUniform1f(shader->alpha_uniform, 1.0f);
+
+	for (i = 0; i < gs->num_textures; i++) {
+		glUniform1i(shader->tex_uniforms[i], i);
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(gs->target, gs->textures[i]);
+		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	gs->thumbnail.content_serial = gs->content_serial;
+	gs->thumbnail.valid = 1;
+
+	return 0;
+}
+
+static void
+draw_view(struct weston_view *ev, struct weston_output *output,
+	  pixman_region32_t *damage) /* in global coordinates */
+{
+	struct weston_compositor *ec = ev->surface->compositor;
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	/* repaint bounding region in global coordinates: */
+	pixman_region32_t repaint;
+	/* non-opaque region in surface coordinates: */
+	pixman_region32_t surface_blend;
+	struct gl_shader *base, *shader;
+	GLint filter, min_filter;
+	float scale;
+	int i, thumbnail;
+
+	/* In case of a runtime switch of renderers, we may not have received
+	 * an attach for this surface since the switch. In that case we don't
+	 * have a valid buffer or a proper shader set up so skip rendering. */
+	if (!gs->shader)
+		return;
+
+	pixman_region32_init(&repaint);
+	pixman_region32_intersect(&repaint,
+				  &ev->transform.boundingbox, damage);
+	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
+
+	if (!pixman_region32_not_empty(&repaint))
+		goto out;
+
+	ev->surface->stats.pixels_composited += region_area(&repaint);
+
+	scale = thumbnail_scale(gs);
+	thumbnail = view_uses_thumbnail(ev, output, scale) &&
+		thumbnail_update(gr, gs, scale) == 0;
+	texture_account(gr, gs);
+	base = thumbnail ? &gr->texture_shader_rgba : gs->shader;
+
+	gpu_timer_begin(gr, GPU_TIMER_VIEW);
+
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	if (gr->fan_debug) {
+		use_shader(gr, &gr->solid_shader);
+		shader_uniforms(&gr->solid_shader, ev, output);
+	}
+
+	shader = view_shader(ev, base);
+	use_shader(gr, shader);
+	shader_uniforms(shader, ev, output);
+
+	filter = view_texture_filter(ev, output);
+	min_filter = filter;
+
+	if (!thumbnail && view_uses_mipmaps(gr, ev, output)) {
+		mipmap_update(gr, gs);
+		min_filter = GL_LINEAR_MIPMAP_LINEAR;
+	}
+
+	if (thumbnail) {
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, gs->thumbnail.tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+				GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+				GL_LINEAR);
+	}
+
+	for (i = 0; !thumbnail && i < gs->num_textures; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(gs->target, gs->textures[i]);
+		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER,
+				i == 0 ? min_filter : filter);
+		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
+	}
+
+	/* blended region is whole surface minus opaque region: */
+	pixman_region32_init_rect(&surface_blend, 0, 0,
+				  ev->surface->width, ev->surface->height);
+	pixman_region32_subtract(&surface_blend, &surface_blend, &ev->surface->opaque);
+
+	/* XXX: Should we be using ev->transform.opaque here? */
+	if (pixman_region32_not_empty(&ev->surface->opaque)) {
+		if (base == &gr->texture_shader_rgba) {
+			/* Special case for RGBA textures with possibly
+			 * bad data in alpha channel: use the shader
+			 * that forces texture alpha = 1.0.
+			 * Xwayland surfaces need this.
+			 */
+			shader = view_shader(ev, &gr->texture_shader_rgbx);
+			use_shader(gr, shader);
+			shader_uniforms(shader, ev, output);
+		}
+
+		if (ev->alpha < 1.0)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+
+		repaint_region(ev, &repaint, &ev->surface->opaque);
+	}
+
+	if (pixman_region32_not_empty(&surface_blend)) {
+		use_shader(gr, view_shader(ev, base));
+		glEnable(GL_BLEND);
+		repaint_region(ev, &repaint, &surface_blend);
+	}
+
+	pixman_region32_fini(&surface_blend);
+
+	gpu_timer_end(gr);
+
+out:
+	pixman_region32_fini(&repaint);
+}
+
+static void
+batch_flush(struct gl_renderer *gr, struct weston_output *output)
+{
+	struct gl_shader *shader = gr->batch_shader;
+	GLfloat *v = gr->batch_vertices.data;
+
+	if (gr->batch_indices.size == 0)
+		return;
+
+	gpu_timer_begin(gr, GPU_TIMER_VIEW);
+
+	use_shader(gr, shader);
+	glUniformMatrix4fv(shader->proj_uniform,
+			   1, GL_FALSE, output->matrix.d);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 6 * sizeof *v, &v[0]);
+	glEnableVertexAttribArray(0);
+
+	if (shader == &gr->atlas_batch_shader) {
+		glUniform1i(shader->tex_uniforms[0], 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, gr->atlas_texture);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_MIN_FILTER, gr->batch_filter);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_MAG_FILTER, gr->batch_filter);
+
+		/* texcoord: */
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE,
+				      6 * sizeof *v, &v[2]);
+		glEnableVertexAttribArray(1);
+
+		/* view alpha, forced texture alpha: */
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE,
+				      6 * sizeof *v, &v[4]);
+		glEnableVertexAttribArray(3);
+
+		glDrawElements(GL_TRIANGLES,
+			       gr->batch_indices.size / sizeof(GLushort),
+			       GL_UNSIGNED_SHORT, gr->batch_indices.data);
+
+		glDisableVertexAttribArray(3);
+		glDisableVertexAttribArray(1);
+	} else {
+		/* premultiplied colour: */
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE,
+				      6 * sizeof *v, &v[2]);
+		glEnableVertexAttribArray(2);
+
+		glDrawElements(GL_TRIANGLES,
+			       gr->batch_indices.size / sizeof(GLushort),
+			       GL_UNSIGNED_SHORT, gr->batch_indices.data);
+
+		glDisableVertexAttribArray(2);
+	}
+
+	glDisableVertexAttribArray(0);
+
+	gpu_timer_end(gr);
+
+	gr->batch_vertices.size = 0;
+	gr->batch_indices.size = 0;
+}
+
+/* Append the fans covering repaint and surf_region to the batch.  Every
+ * vertex gets the position followed by four attributes: attr itself for
+ * solid views, or the texcoord and attr[0..1] for atlas views. */
+static void
+batch_add_region(struct weston_view *ev, struct weston_output *output,
+		 pixman_region32_t *repaint, pixman_region32_t *surf_region,
+		 const GLfloat *attr, int textured)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	GLfloat *v, *bv;
+	unsigned int *vtxcnt, base, nvtx, i;
+	int nfans, k;
+
+	nfans = texture_region(ev, repaint, surf_region);
+
+	v = gr->vertices.data;
+	vtxcnt = gr->vtxcnt.data;
+	for (k = 0, nvtx = 0; k < nfans; k++)
+		nvtx += vtxcnt[k];
+
+	base = gr->batch_vertices.size / (6 * sizeof *bv);
+	if (base + nvtx > 65536) {
+		batch_flush(gr, output);
+		base = 0;
+	}
+
+	bv = wl_array_add(&gr->batch_vertices, nvtx * 6 * sizeof *bv);
+	if (!bv || fans_to_triangles(&gr->batch_indices,
+				     vtxcnt, nfans, base) < 0) {
+		if (bv)
+			gr->batch_vertices.size -= nvtx * 6 * sizeof *bv;
+		weston_log("failed to batch view %p\n", ev);
+		goto out;
+	}
+
+	for (i = 0; i < nvtx; i++) {
+		*(bv++) = v[i * 4];
+		*(bv++) = v[i * 4 + 1];
+		if (textured) {
+			*(bv++) = v[i * 4 + 2];
+			*(bv++) = v[i * 4 + 3];
+			*(bv++) = attr[0];
+			*(bv++) = attr[1];
+		} else {
+			for (k = 0; k < 4; k++)
+				*(bv++) = attr[k];
+		}
+	}
+
+out:
+	gr->vertices.size = 0;
+	gr->vtxcnt.size = 0;
+}
+
+static int
+view_is_batchable(struct weston_view *ev)
+{
+	struct gl_renderer *gr = get_renderer(ev->surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+
+	if (gr->fan_debug)
+		return 0;
+
+	if (gs->shader && ev->colorkey_enabled && gs->shader->keyed)
+		return 0;
+
+	if (gs->shader == &gr->solid_shader)
+		return 1;
+
+	return gs->atlas_shelf >= 0 &&
+		(gs->shader == &gr->texture_shader_rgba ||
+		 gs->shader == &gr->texture_shader_rgbx);
+}
+
+/* Solid colour views only differ in their colour, so consecutive ones
+ * are collected with the colour as a vertex attribute and drawn in one
+ * call.  Views in the texture atlas are batched the same way, with the
+ * view alpha and whether the texture alpha is ignored (opaque region or
+ * RGBX format) as attributes.  Blending is always on for the batch,
+ * which gives the same result for opaque views. */
+static void
+batch_add_view(struct weston_view *ev, struct weston_output *output,
+	       pixman_region32_t *damage)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	pixman_region32_t repaint, surface_rect;
+	struct gl_shader *shader;
+	GLfloat attr[4];
+	GLint filter;
+	int k;
+
+	pixman_region32_init(&repaint);
+	pixman_region32_intersect(&repaint,
+				  &ev->transform.boundingbox, damage);
+	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
+
+	if (!pixman_region32_not_empty(&repaint))
+		goto out;
+
+	ev->surface->stats.pixels_composited += region_area(&repaint);
+
+	if (gs->shader == &gr->solid_shader) {
+		shader = &gr->solid_batch_shader;
+		filter = GL_NEAREST;
+	} else {
+		shader = &gr->atlas_batch_shader;
+		filter = view_texture_filter(ev, output);
+	}
+
+	if (shader != gr->batch_shader || filter != gr->batch_filter) {
+		batch_flush(gr, output);
+		gr->batch_shader = shader;
+		gr->batch_filter = filter;
+	}
+
+	pixman_region32_init_rect(&surface_rect, 0, 0,
+				  ev->surface->width, ev->surface->height);
+
+	if (shader == &gr->solid_batch_shader) {
+		for (k = 0; k < 4; k++)
+			attr[k] = gs->color[k] * ev->alpha;
+		batch_add_region(ev, output, &repaint, &surface_rect, attr, 0);
+	} else if (gs->shader == &gr->texture_shader_rgbx) {
+		attr[0] = ev->alpha;
+		attr[1] = 1.0;
+		batch_add_region(ev, output, &repaint, &surface_rect, attr, 1);
+	} else {
+		attr[0] = ev->alpha;
+		attr[1] = 1.0;
+		if (pixman_region32_not_empty(&ev->surface->opaque))
+			batch_add_region(ev, output, &repaint,
+					 &ev->surface->opaque, attr, 1);
+
+		pixman_region32_subtract(&surface_rect, &surface_rect,
+					 &ev->surface->opaque);
+		attr[1] = 0.0;
+		if (pixman_region32_not_empty(&surface_rect))
+			batch_add_region(ev, output, &repaint,
+					 &surface_rect, attr, 1);
+	}
+
+	pixman_region32_fini(&surface_rect);
+out:
+	pixman_region32_fini(&repaint);
+}
+
+/* Cached composition of a group of views sharing a non-zero
+ * weston_view::cache_group.  Once the members have stayed the same for
+ * a frame they are rendered into a texture the size of the output and,
+ * until one of them changes, drawn back as that texture alone. */
+struct gl_layer_cache_member {
+	struct weston_view *view;
+	uint32_t transform_serial;
+	uint32_t content_serial;
+	float alpha;
+	int colorkey_enabled;
+	uint32_t colorkey;
+};
+
+struct gl_layer_cache {
+	struct wl_list link;		/* gl_output_state::layer_caches */
+	uint32_t group;
+	uint32_t frame;			/* last repaint the group was seen */
+	struct wl_array members;	/* gl_layer_cache_member, bottom first */
+	int valid;
+	GLuint fbo, tex;
+	int32_t width, height;
+};
+
+static void
+layer_cache_destroy(struct gl_layer_cache *cache)
+{
+	wl_list_remove(&cache->link);
+	if (cache->fbo)
+		glDeleteFramebuffers(1, &cache->fbo);
+	if (cache->tex)
+		glDeleteTextures(1, &cache->tex);
+	wl_array_release(&cache->members);
+	free(cache);
+}
+
+static struct gl_layer_cache *
+layer_cache_get(struct weston_output *output, uint32_t group)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_layer_cache *cache;
+
+	wl_list_for_each(cache, &go->layer_caches, link)
+		if (cache->group == group)
+			return cache;
+
+	cache = zalloc(sizeof *cache);
+	if (!cache)
+		return NULL;
+
+	cache->group = group;
+	wl_array_init(&cache->members);
+	wl_list_insert(&go->layer_caches, &cache->link);
+
+	return cache;
+}
+
+/* Drops the caches of groups that are no longer on the output. */
+static void
+layer_cache_expire(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_layer_cache *cache, *next;
+
+	wl_list_for_each_safe(cache, next, &go->layer_caches, link)
+		if (cache->frame != go->repaint_frame)
+			layer_cache_destroy(cache);
+}
+
+/* Compares the views from views[first] down to views[last] with what
+ * the cache holds and records them.  Returns 1 if nothing changed. */
+static int
+layer_cache_check(struct gl_layer_cache *cache, struct weston_view **views,
+		  int first, int last)
+{
+	struct weston_compositor *ec = views[first]->surface->compositor;
+	struct gl_layer_cache_member *m, *old;
+	struct wl_array members;
+	int i, same;
+
+	wl_array_init(&members);
+	for (i = first; i >= last; i--) {
+		if (views[i]->plane != &ec->primary_plane)
+			continue;
+
+		m = wl_array_add(&members, sizeof *m);
+		if (!m) {
+			wl_array_release(&members);
+			cache->members.size = 0;
+			cache->valid = 0;
+			return 0;
+		}
+		m->view = views[i];
+		m->transform_serial = views[i]->transform.serial;
+		m->content_serial =
+			get_surface_state(views[i]->surface)->content_serial;
+		m->alpha = views[i]->alpha;
+		m->colorkey_enabled = views[i]->colorkey_enabled;
+		m->colorkey = views[i]->colorkey;
+	}
+
+	same = members.size == cache->members.size;
+	old = cache->members.data;
+	for (i = 0; same && i < (int) (members.size / sizeof *m); i++) {
+		m = (struct gl_layer_cache_member *) members.data + i;
+		same = m->view == old[i].view &&
+			m->transform_serial == old[i].transform_serial &&
+			m->content_serial == old[i].content_serial &&
+			m->alpha == old[i].alpha &&
+			m->colorkey_enabled == old[i].colorkey_enabled &&
+			m->colorkey == old[i].colorkey;
+	}
+
+	if (!same) {
+		wl_array_release(&cache->members);
+		cache->members = members;
+		cache->valid = 0;
+	} else {
+		wl_array_release(&members);
+	}
+
+	return same;
+}
+
+/* The size of the output's buffers, without the borders */
+static void
+output_render_size(struct weston_output *output,
+		   int32_t *width, int32_t *height)
+{
+	if (output->render_width) {
+		*width = output->render_width;
+		*height = output->render_height;
+	} else {
+		*width = output->current_mode->width;
+		*height = output->current_mode->height;
+	}
+}
+
+/* Scales a region in buffer coordinates of the mode size to the render
+ * size, growing the boxes to whole pixels so no damage is lost */
+static void
+output_scale_region(pixman_region32_t *region, int32_t from_width,
+		    int32_t from_height, int32_t to_width, int32_t to_height)
+{
+	pixman_box32_t *rects, *boxes;
+	int n, i;
+
+	rects = pixman_region32_rectangles(region, &n);
+	boxes = malloc(n * sizeof *boxes);
+	if (!boxes)
+		return;
+
+	for (i = 0; i < n; i++) {
+		boxes[i].x1 = (int64_t) rects[i].x1 * to_width / from_width;
+		boxes[i].y1 = (int64_t) rects[i].y1 * to_height / from_height;
+		boxes[i].x2 = ((int64_t) rects[i].x2 * to_width +
+			       from_width - 1) / from_width;
+		boxes[i].y2 = ((int64_t) rects[i].y2 * to_height +
+			       from_height - 1) / from_height;
+	}
+
+	pixman_region32_fini(region);
+	pixman_region32_init_rects(region, boxes, n);
+	free(boxes);
+}
+
+static int
+layer_cache_update(struct gl_layer_cache *cache, struct weston_output *output)
+{
+	struct gl_layer_cache_member *m;
+	pixman_region32_t clip;
+	int32_t width, height;
+	GLint viewport[4], fbo;
+
+	output_render_size(output, &width, &height);
+
+	/* the output may be drawn offscreen for color correction */
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+
+	if (!cache->fbo || cache->width != width || cache->height != height) {
+		if (!cache->tex)
+			glGenTextures(1, &cache->tex);
+		glBindTexture(GL_TEXTURE_2D, cache->tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+				GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+				GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+				GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+				GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+		if (!cache->fbo)
+			glGenFramebuffers(1, &cache->fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				       GL_TEXTURE_2D, cache->tex, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+		    GL_FRAMEBUFFER_COMPLETE) {
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+			return -1;
+		}
+		cache->width = width;
+		cache->height = height;
+	} else {
+		glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+	}
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, width, height);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	/* The members only cover each other in the cache, what is above
+	 * the group is left to the output. */
+	pixman_region32_init(&clip);
+	wl_array_for_each(m, &cache->members) {
+		pixman_region32_copy(&clip, &m->view->clip);
+		pixman_region32_clear(&m->view->clip);
+		draw_view(m->view, output, &output->region);
+		pixman_region32_copy(&m->view->clip, &clip);
+	}
+	pixman_region32_fini(&clip);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	cache->valid = 1;
+
+	return 0;
+}
+
+static void
+layer_cache_draw(struct gl_layer_cache *cache, struct weston_output *output,
+		 struct weston_view *top, pixman_region32_t *damage)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_shader *shader = &gr->texture_shader_rgba;
+	struct gl_layer_cache_member *m;
+	struct weston_vector p;
+	pixman_region32_t repaint;
+	pixman_box32_t *rects;
+	GLfloat *v;
+	int i, k, n;
+	static const int corners[6][2] = {
+		{ 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 0, 1 }
+	};
+
+	pixman_region32_init(&repaint);
+	wl_array_for_each(m, &cache->members)
+		pixman_region32_union(&repaint, &repaint,
+				      &m->view->transform.boundingbox);
+	pixman_region32_intersect(&repaint, &repaint, damage);
+	pixman_region32_subtract(&repaint, &repaint, &top->clip);
+
+	rects = pixman_region32_rectangles(&repaint, &n);
+	if (n == 0)
+		goto out;
+
+	v = wl_array_add(&gr->vertices, n * 6 * 4 * sizeof *v);
+	if (!v)
+		goto out;
+
+	/* texture coordinates are where the output matrix puts a point */
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < 6; k++) {
+			p.f[0] = corners[k][0] ? rects[i].x2 : rects[i].x1;
+			p.f[1] = corners[k][1] ? rects[i].y2 : rects[i].y1;
+			p.f[2] = 0.0f;
+			p.f[3] = 1.0f;
+			*v++ = p.f[0];
+			*v++ = p.f[1];
+			weston_matrix_transform(&output->matrix, &p);
+			*v++ = (p.f[0] / p.f[3] + 1.0f) * 0.5f;
+			*v++ = (p.f[1] / p.f[3] + 1.0f) * 0.5f;
+		}
+	}
+
+	use_shader(gr, shader);
+	glUniformMatrix4fv(shader->proj_uniform, 1, GL_FALSE,
+			   output->matrix.d);
+	glUniform1f(shader->alpha_uniform, 1.0f);
+	glUniform1i(shader->tex_uniforms[0], 0);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, cache->tex);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_BLEND);
+
+	v = gr->vertices.data;
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	glDrawArrays(GL_TRIANGLES, 0, n * 6);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+out:
+	gr->vertices.size = 0;
+	pixman_region32_fini(&repaint);
+}
+
+/* Handles the group starting at views[first], the bottom-most of its
+ * members.  Returns the index of its top-most member, or -1 if the
+ * views have to be drawn one by one. */
+static int
+repaint_cached_group(struct weston_output *output, struct weston_view **views,
+		     int first, pixman_region32_t *damage)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_layer_cache *cache;
+	uint32_t group = views[first]->cache_group;
+	int last = first;
+
+	while (last > 0 && views[last - 1]->cache_group == group)
+		last--;
+
+	/* nothing to gain for a single view */
+	if (last == first || gr->fan_debug)
+		return -1;
+
+	cache = layer_cache_get(output, group);
+	if (!cache)
+		return -1;
+	cache->frame = go->repaint_frame;
+
+	/* A group that just changed is drawn directly; only one that
+	 * stays put for a frame is worth rendering twice. */
+	if (!layer_cache_check(cache, views, first, last))
+		return -1;
+
+	batch_flush(gr, output);
+
+	if (!cache->valid && layer_cache_update(cache, output) < 0) {
+		cache->members.size = 0;
+		return -1;
+	}
+
+	layer_cache_draw(cache, output, views[last], damage);
+
+	return last;
+}
+
+static void
+repaint_views(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct gl_renderer *gr = get_renderer(compositor);
+	struct weston_view **views = output->views.data;
+	int count = output->views.size / sizeof *views;
+	pixman_region32_t zoom_damage;
+	int i, last;
+
+	pixman_region32_init(&zoom_damage);
+	if (output->zoom.active) {
+		weston_output_zoom_region_from_output(output, damage,
+						      &zoom_damage);
+		damage = &zoom_damage;
+	}
+
+	for (i = count - 1; i >= 0; i--) {
+		/* the bottom-most view of a cache group */
+		if (views[i]->cache_group &&
+		    (i == count - 1 ||
+		     views[i + 1]->cache_group != views[i]->cache_group)) {
+			last = repaint_cached_group(output, views, i, damage);
+			if (last >= 0) {
+				i = last;
+				continue;
+			}
+		}
+
+		if (views[i]->plane != &compositor->primary_plane ||
+		    views[i]->occluded)
+			continue;
+
+		if (view_is_batchable(views[i])) {
+			batch_add_view(views[i], output, damage);
+			continue;
+		}
+
+		batch_flush(gr, output);
+		draw_view(views[i], output, damage);
+	}
+
+	batch_flush(gr, output);
+	pixman_region32_fini(&zoom_damage);
+}
+
+static void
+draw_output_border_texture(struct gl_output_state *go,
+			   enum gl_renderer_border_side side,
+			   int32_t x, int32_t y,
+			   int32_t width, int32_t height)
+{
+	struct gl_border_image *img = &go->borders[side];
+	static GLushort indices [] = { 0, 1, 3, 3, 1, 2 };
+
+	if (!img->data) {
+		if (img->tex) {
+			glDeleteTextures(1, &img->tex);
+			img->tex = 0;
+		}
+
+		return;
+	}
+
+	if (!img->tex) {
+		glGenTextures(1, &img->tex);
+		glBindTexture(GL_TEXTURE_2D, img->tex);
+
+		glTexParameteri(GL_TEXTURE_2D,
 				GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D,
 				GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -653,204 +2113,893 @@ draw_output_border_texture(struct gl_output_state *go,
 		glBindTexture(GL_TEXTURE_2D, img->tex);
 	}
 
-	if (go->border_status & (1 << side)) {
-#ifdef GL_EXT_unpack_subimage
-		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
-#endif
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
-			     img->tex_width, img->height, 0,
-			     GL_BGRA_EXT, GL_UNSIGNED_BYTE, img->data);
+	if (go->border_status & (1 << side)) {
+#ifdef GL_EXT_unpack_subimage
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+#endif
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
+			     img->tex_width, img->height, 0,
+			     GL_BGRA_EXT, GL_UNSIGNED_BYTE, img->data);
+	}
+
+	GLfloat texcoord[] = {
+		0.0f, 0.0f,
+		(GLfloat)img->width / (GLfloat)img->tex_width, 0.0f,
+		(GLfloat)img->width / (GLfloat)img->tex_width, 1.0f,
+		0.0f, 1.0f,
+	};
+
+	GLfloat verts[] = {
+		x, y,
+		x + width, y,
+		x + width, y + height,
+		x, y + height
+	};
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoord);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+}
+
+static int
+output_has_borders(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+
+	return go->borders[GL_RENDERER_BORDER_TOP].data ||
+	       go->borders[GL_RENDERER_BORDER_RIGHT].data ||
+	       go->borders[GL_RENDERER_BORDER_BOTTOM].data ||
+	       go->borders[GL_RENDERER_BORDER_LEFT].data;
+}
+
+static void
+draw_output_borders(struct weston_output *output,
+		    enum gl_border_status border_status)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_shader *shader = &gr->texture_shader_rgba;
+	struct gl_border_image *top, *bottom, *left, *right;
+	struct weston_matrix matrix;
+	int full_width, full_height;
+
+	if (border_status == BORDER_STATUS_CLEAN)
+		return; /* Clean. Nothing to do. */
+
+	top = &go->borders[GL_RENDERER_BORDER_TOP];
+	bottom = &go->borders[GL_RENDERER_BORDER_BOTTOM];
+	left = &go->borders[GL_RENDERER_BORDER_LEFT];
+	right = &go->borders[GL_RENDERER_BORDER_RIGHT];
+
+	full_width = output->current_mode->width + left->width + right->width;
+	full_height = output->current_mode->height + top->height + bottom->height;
+
+	glDisable(GL_BLEND);
+	use_shader(gr, shader);
+
+	glViewport(0, 0, full_width, full_height);
+
+	weston_matrix_init(&matrix);
+	weston_matrix_translate(&matrix, -full_width/2.0, -full_height/2.0, 0);
+	weston_matrix_scale(&matrix, 2.0/full_width, -2.0/full_height, 1);
+	glUniformMatrix4fv(shader->proj_uniform, 1, GL_FALSE, matrix.d);
+
+	glUniform1i(shader->tex_uniforms[0], 0);
+	glUniform1f(shader->alpha_uniform, 1);
+	glActiveTexture(GL_TEXTURE0);
+
+	if (border_status & BORDER_TOP_DIRTY)
+		draw_output_border_texture(go, GL_RENDERER_BORDER_TOP,
+					   0, 0,
+					   full_width, top->height);
+	if (border_status & BORDER_LEFT_DIRTY)
+		draw_output_border_texture(go, GL_RENDERER_BORDER_LEFT,
+					   0, top->height,
+					   left->width, output->current_mode->height);
+	if (border_status & BORDER_RIGHT_DIRTY)
+		draw_output_border_texture(go, GL_RENDERER_BORDER_RIGHT,
+					   full_width - right->width, top->height,
+					   right->width, output->current_mode->height);
+	if (border_status & BORDER_BOTTOM_DIRTY)
+		draw_output_border_texture(go, GL_RENDERER_BORDER_BOTTOM,
+					   0, full_height - bottom->height,
+					   full_width, bottom->height);
+}
+
+static void
+output_get_border_damage(struct weston_output *output,
+			 enum gl_border_status border_status,
+			 pixman_region32_t *damage)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_border_image *top, *bottom, *left, *right;
+	int full_width, full_height;
+
+	if (border_status == BORDER_STATUS_CLEAN)
+		return; /* Clean. Nothing to do. */
+
+	top = &go->borders[GL_RENDERER_BORDER_TOP];
+	bottom = &go->borders[GL_RENDERER_BORDER_BOTTOM];
+	left = &go->borders[GL_RENDERER_BORDER_LEFT];
+	right = &go->borders[GL_RENDERER_BORDER_RIGHT];
+
+	full_width = output->current_mode->width + left->width + right->width;
+	full_height = output->current_mode->height + top->height + bottom->height;
+	if (border_status & BORDER_TOP_DIRTY)
+		pixman_region32_union_rect(damage, damage,
+					   0, 0,
+					   full_width, top->height);
+	if (border_status & BORDER_LEFT_DIRTY)
+		pixman_region32_union_rect(damage, damage,
+					   0, top->height,
+					   left->width, output->current_mode->height);
+	if (border_status & BORDER_RIGHT_DIRTY)
+		pixman_region32_union_rect(damage, damage,
+					   full_width - right->width, top->height,
+					   right->width, output->current_mode->height);
+	if (border_status & BORDER_BOTTOM_DIRTY)
+		pixman_region32_union_rect(damage, damage,
+					   0, full_height - bottom->height,
+					   full_width, bottom->height);
+}
+
+static void
+output_get_damage(struct weston_output *output,
+		  pixman_region32_t *buffer_damage, uint32_t *border_damage)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	EGLint buffer_age = 0;
+	EGLBoolean ret;
+	int i;
+
+	if (gr->has_egl_buffer_age) {
+		ret = eglQuerySurface(gr->egl_display, go->egl_surface,
+				      EGL_BUFFER_AGE_EXT, &buffer_age);
+		if (ret == EGL_FALSE) {
+			weston_log("buffer age query failed.\n");
+			gl_renderer_print_egl_error_state();
+		}
+	}
+
+	if (buffer_age == 0 || buffer_age - 1 > BUFFER_DAMAGE_COUNT) {
+		pixman_region32_copy(buffer_damage, &output->region);
+		*border_damage = BORDER_ALL_DIRTY;
+	} else {
+		for (i = 0; i < buffer_age - 1; i++)
+			*border_damage |= go->border_damage[i];
+
+		if (*border_damage & BORDER_SIZE_CHANGED) {
+			/* If we've had a resize, we have to do a full
+			 * repaint. */
+			*border_damage |= BORDER_ALL_DIRTY;
+			pixman_region32_copy(buffer_damage, &output->region);
+		} else {
+			for (i = 0; i < buffer_age - 1; i++)
+				pixman_region32_union(buffer_damage,
+						      buffer_damage,
+						      &go->buffer_damage[i]);
+		}
+	}
+}
+
+static void
+output_rotate_damage(struct weston_output *output,
+		     pixman_region32_t *output_damage,
+		     enum gl_border_status border_status)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	int i;
+
+	if (!gr->has_egl_buffer_age)
+		return;
+
+	for (i = BUFFER_DAMAGE_COUNT - 1; i >= 1; i--) {
+		go->border_damage[i] = go->border_damage[i - 1];
+		pixman_region32_copy(&go->buffer_damage[i],
+				     &go->buffer_damage[i - 1]);
+	}
+
+	go->border_damage[0] = border_status;
+	pixman_region32_copy(&go->buffer_damage[0], output_damage);
+}
+
+/* Convert damage in output coordinates, plus the damaged borders, into
+ * the bottom-up rectangles in buffer coordinates that EGL expects.
+ * Returns a malloc'ed array of 4 * nrects values. */
+static EGLint *
+output_damage_to_egl_rects(struct weston_output *output,
+			   pixman_region32_t *damage,
+			   enum gl_border_status border_status, int *nrects)
+{
+	struct gl_output_state *go = get_output_state(output);
+	pixman_region32_t buffer_damage;
+	pixman_box32_t *rects;
+	EGLint *egl_damage, *d;
+	int i, buffer_height, width, height;
+
+	pixman_region32_init(&buffer_damage);
+	weston_transformed_region(output->width, output->height,
+				  output->transform,
+				  output->current_scale,
+				  damage, &buffer_damage);
+
+	output_render_size(output, &width, &height);
+	if (output->render_width)
+		output_scale_region(&buffer_damage,
+				    output->current_mode->width,
+				    output->current_mode->height,
+				    width, height);
+
+	if (output_has_borders(output)) {
+		pixman_region32_translate(&buffer_damage,
+					  go->borders[GL_RENDERER_BORDER_LEFT].width,
+					  go->borders[GL_RENDERER_BORDER_TOP].height);
+		output_get_border_damage(output, border_status,
+					 &buffer_damage);
+	}
+
+	rects = pixman_region32_rectangles(&buffer_damage, nrects);
+	egl_damage = malloc(*nrects * 4 * sizeof(EGLint));
+	if (!egl_damage) {
+		pixman_region32_fini(&buffer_damage);
+		return NULL;
+	}
+
+	buffer_height = go->borders[GL_RENDERER_BORDER_TOP].height +
+			height +
+			go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	d = egl_damage;
+	for (i = 0; i < *nrects; ++i) {
+		*d++ = rects[i].x1;
+		*d++ = buffer_height - rects[i].y2;
+		*d++ = rects[i].x2 - rects[i].x1;
+		*d++ = rects[i].y2 - rects[i].y1;
+	}
+
+	pixman_region32_fini(&buffer_damage);
+
+	return egl_damage;
+}
+
+/* With EGL_KHR_partial_update, tell the driver up front which part of
+ * the back buffer this frame will touch, so that tiled GPUs only load
+ * and resolve those tiles. */
+static void
+output_set_damage_region(struct weston_output *output,
+			 pixman_region32_t *damage,
+			 enum gl_border_status border_status)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	EGLint *egl_damage;
+	int nrects;
+
+	egl_damage = output_damage_to_egl_rects(output, damage,
+						border_status, &nrects);
+	if (!egl_damage)
+		return;
+
+	if (!gr->set_damage_region(gr->egl_display, go->egl_surface,
+				   egl_damage, nrects)) {
+		weston_log("failed to set damage region\n");
+		gl_renderer_print_egl_error_state();
+	}
+
+	free(egl_damage);
+}
+
+static enum gpu_timer_mode
+gpu_timer_mode(struct gl_renderer *gr)
+{
+	if (!gr->has_timer_query)
+		return GPU_TIMER_OFF;
+
+	/* The overlay needs at least the frame times */
+	if (gr->gpu_timer_mode == GPU_TIMER_OFF && gr->gpu_overlay)
+		return GPU_TIMER_FRAME;
+
+	return gr->gpu_timer_mode;
+}
+
+/* Read back the results of earlier frames that are available by now,
+ * without waiting for the GPU, and record them in the timeline. */
+static void
+gpu_timer_collect(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_gpu_timer_frame *frame;
+	GLuint *queries, available;
+	GLint disjoint = 0;
+	uint64_t ns, sum;
+	int i, j;
+
+	if (!gr->has_timer_query)
+		return;
+
+	/* Results are meaningless across a disjoint operation like a
+	 * GPU frequency change; drop everything in flight then. */
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+	for (i = 0; i < GPU_TIMER_FRAMES; i++) {
+		frame = &go->gpu_frames[(go->gpu_frame_head + i) %
+					GPU_TIMER_FRAMES];
+		if (!frame->pending)
+			continue;
+
+		queries = frame->queries.data;
+		if (disjoint) {
+			frame->pending = 0;
+			continue;
+		}
+
+		gr->get_query_objectuiv(queries[frame->nqueries - 1],
+					GL_QUERY_RESULT_AVAILABLE_EXT,
+					&available);
+		if (!available)
+			break;
+
+		for (j = 0, sum = 0; j < frame->nqueries; j++) {
+			gr->get_query_objectui64v(queries[j],
+						  GL_QUERY_RESULT_EXT, &ns);
+			if (frame->mode == GPU_TIMER_VIEW)
+				weston_timeline_duration(output,
+							 WESTON_TIMELINE_GPU_VIEW,
+							 ns);
+			sum += ns;
+		}
+
+		weston_timeline_duration(output, WESTON_TIMELINE_GPU_FRAME,
+					 sum);
+		go->gpu_samples[go->gpu_sample_count++ % GPU_OVERLAY_SAMPLES] =
+			sum / 1000;
+		frame->pending = 0;
+	}
+}
+
+static void
+gpu_timer_frame_begin(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_gpu_timer_frame *frame;
+	enum gpu_timer_mode mode;
+
+	mode = gpu_timer_mode(gr);
+	if (mode == GPU_TIMER_OFF)
+		return;
+
+	frame = &go->gpu_frames[go->gpu_frame_head % GPU_TIMER_FRAMES];
+	if (frame->pending)
+		return;
+
+	frame->mode = mode;
+	frame->nqueries = 0;
+	gr->gpu_frame = frame;
+
+	gpu_timer_begin(gr, GPU_TIMER_FRAME);
+}
+
+static void
+gpu_timer_frame_end(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+
+	if (!gr->gpu_frame)
+		return;
+
+	gpu_timer_end(gr);
+
+	if (gr->gpu_frame->nqueries > 0) {
+		gr->gpu_frame->pending = 1;
+		go->gpu_frame_head++;
 	}
 
-	GLfloat texcoord[] = {
-		0.0f, 0.0f,
-		(GLfloat)img->width / (GLfloat)img->tex_width, 0.0f,
-		(GLfloat)img->width / (GLfloat)img->tex_width, 1.0f,
-		0.0f, 1.0f,
-	};
+	gr->gpu_frame = NULL;
+}
 
-	GLfloat verts[] = {
-		x, y,
-		x + width, y,
-		x + width, y + height,
-		x, y + height
+static void
+gpu_timer_fini(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_gpu_timer_frame *frame;
+	int i;
+
+	for (i = 0; i < GPU_TIMER_FRAMES; i++) {
+		frame = &go->gpu_frames[i];
+		if (frame->queries.size > 0)
+			gr->delete_queries(frame->queries.size /
+					   sizeof(GLuint),
+					   frame->queries.data);
+		wl_array_release(&frame->queries);
+	}
+}
+
+static void
+gpu_overlay_get_rect(struct weston_output *output, pixman_region32_t *rect)
+{
+	pixman_region32_init_rect(rect, output->x + 8, output->y + 8,
+				  GPU_OVERLAY_SAMPLES * 4, 100);
+	pixman_region32_intersect(rect, rect, &output->region);
+}
+
+static void
+gpu_overlay_add_quad(struct gl_renderer *gr, GLfloat x1, GLfloat y1,
+		     GLfloat x2, GLfloat y2, const GLfloat *color)
+{
+	unsigned int vtxcnt = 4;
+	GLfloat corners[4][2] = {
+		{ x1, y1 }, { x2, y1 }, { x2, y2 }, { x1, y2 }
 	};
+	unsigned int base;
+	GLfloat *v;
+	int i, k;
 
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoord);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
+	base = gr->batch_vertices.size / (6 * sizeof *v);
+	v = wl_array_add(&gr->batch_vertices, 4 * 6 * sizeof *v);
+	if (!v)
+		return;
 
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+	if (fans_to_triangles(&gr->batch_indices, &vtxcnt, 1, base) < 0) {
+		gr->batch_vertices.size -= 4 * 6 * sizeof *v;
+		return;
+	}
 
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(0);
+	for (i = 0; i < 4; i++) {
+		*(v++) = corners[i][0];
+		*(v++) = corners[i][1];
+		for (k = 0; k < 4; k++)
+			*(v++) = color[k];
+	}
 }
 
-static int
-output_has_borders(struct weston_output *output)
+/* Bar graph of the GPU time of the last frames, newest on the right.
+ * The line marks one refresh period, the graph is two periods high. */
+static void
+gpu_overlay_draw(struct weston_output *output)
 {
 	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	static const GLfloat background[] = { 0.0, 0.0, 0.0, 0.6 };
+	static const GLfloat line[] = { 0.5, 0.5, 0.5, 0.5 };
+	static const GLfloat fast[] = { 0.0, 0.8, 0.0, 1.0 };
+	static const GLfloat slow[] = { 0.9, 0.0, 0.0, 1.0 };
+	GLfloat x, y, scale, h;
+	uint32_t period, us, i, n;
+
+	period = 16667;
+	if (output->current_mode && output->current_mode->refresh > 0)
+		period = 1000000000 / output->current_mode->refresh;
+	scale = 100.0 / (2 * period);
+
+	x = output->x + 8;
+	y = output->y + 8;
+
+	gpu_overlay_add_quad(gr, x, y, x + GPU_OVERLAY_SAMPLES * 4, y + 100,
+			     background);
+	gpu_overlay_add_quad(gr, x, y + 50, x + GPU_OVERLAY_SAMPLES * 4,
+			     y + 51, line);
+
+	n = go->gpu_sample_count < GPU_OVERLAY_SAMPLES ?
+		go->gpu_sample_count : GPU_OVERLAY_SAMPLES;
+	for (i = 0; i < n; i++) {
+		us = go->gpu_samples[(go->gpu_sample_count - n + i) %
+				     GPU_OVERLAY_SAMPLES];
+		h = us * scale;
+		if (h > 100)
+			h = 100;
+		gpu_overlay_add_quad(gr,
+				     x + (GPU_OVERLAY_SAMPLES - n + i) * 4,
+				     y + 100 - h,
+				     x + (GPU_OVERLAY_SAMPLES - n + i) * 4 + 3,
+				     y + 100,
+				     us > period ? slow : fast);
+	}
 
-	return go->borders[GL_RENDERER_BORDER_TOP].data ||
-	       go->borders[GL_RENDERER_BORDER_RIGHT].data ||
-	       go->borders[GL_RENDERER_BORDER_BOTTOM].data ||
-	       go->borders[GL_RENDERER_BORDER_LEFT].data;
+	gr->batch_shader = &gr->solid_batch_shader;
+	batch_flush(gr, output);
 }
 
+/* The overlay changes every frame, keep repainting it.  This can't be
+ * done from the repaint itself, which clears repaint_needed after. */
 static void
-draw_output_borders(struct weston_output *output,
-		    enum gl_border_status border_status)
+gpu_overlay_idle(void *data)
+{
+	struct weston_output *output = data;
+	struct gl_output_state *go = get_output_state(output);
+	struct weston_compositor *ec = output->compositor;
+	pixman_region32_t rect;
+
+	go->gpu_overlay_idle = NULL;
+
+	gpu_overlay_get_rect(output, &rect);
+	pixman_region32_union(&ec->primary_plane.damage,
+			      &ec->primary_plane.damage, &rect);
+	pixman_region32_fini(&rect);
+
+	weston_output_schedule_repaint(output);
+}
+
+static void
+readback_finish(struct gl_renderer *gr, struct gl_readback *rb,
+		struct weston_output *output)
+{
+	void *map;
+
+	wl_list_remove(&rb->link);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	map = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER, 0, rb->size,
+				   GL_MAP_READ_BIT);
+	rb->done(output, map, rb->data);
+	if (map)
+		gr->unmap_buffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	glDeleteBuffers(1, &rb->pbo);
+	if (rb->fence != EGL_NO_SYNC_KHR)
+		gr->destroy_sync(gr->egl_display, rb->fence);
+	free(rb);
+}
+
+/* Deliver the readbacks the GPU has completed.  They are handed out in
+ * order, so stop at the first one still in flight.  With force set,
+ * wait for all of them. */
+static void
+readback_process(struct weston_output *output, int force)
 {
 	struct gl_output_state *go = get_output_state(output);
 	struct gl_renderer *gr = get_renderer(output->compositor);
-	struct gl_shader *shader = &gr->texture_shader_rgba;
-	struct gl_border_image *top, *bottom, *left, *right;
-	struct weston_matrix matrix;
-	int full_width, full_height;
+	struct gl_readback *rb, *next;
+	EGLint status;
 
-	if (border_status == BORDER_STATUS_CLEAN)
-		return; /* Clean. Nothing to do. */
+	if (wl_list_empty(&go->readbacks))
+		return;
 
-	top = &go->borders[GL_RENDERER_BORDER_TOP];
-	bottom = &go->borders[GL_RENDERER_BORDER_BOTTOM];
-	left = &go->borders[GL_RENDERER_BORDER_LEFT];
-	right = &go->borders[GL_RENDERER_BORDER_RIGHT];
+	if (use_output(output) < 0) {
+		if (!force)
+			return;
 
-	full_width = output->current_mode->width + left->width + right->width;
-	full_height = output->current_mode->height + top->height + bottom->height;
+		/* Leaving for good, the buffers go with the context. */
+		wl_list_for_each_safe(rb, next, &go->readbacks, link) {
+			wl_list_remove(&rb->link);
+			rb->done(output, NULL, rb->data);
+			free(rb);
+		}
+		return;
+	}
 
-	glDisable(GL_BLEND);
-	use_shader(gr, shader);
+	wl_list_for_each_safe(rb, next, &go->readbacks, link) {
+		if (!force && rb->fence != EGL_NO_SYNC_KHR) {
+			status = gr->client_wait_sync(gr->egl_display,
+						      rb->fence, 0, 0);
+			if (status != EGL_CONDITION_SATISFIED_KHR)
+				break;
+		}
 
-	glViewport(0, 0, full_width, full_height);
+		readback_finish(gr, rb, output);
+	}
 
-	weston_matrix_init(&matrix);
-	weston_matrix_translate(&matrix, -full_width/2.0, -full_height/2.0, 0);
-	weston_matrix_scale(&matrix, 2.0/full_width, -2.0/full_height, 1);
-	glUniformMatrix4fv(shader->proj_uniform, 1, GL_FALSE, matrix.d);
+	if (!wl_list_empty(&go->readbacks))
+		wl_event_source_timer_update(go->readback_timer,
+					     READBACK_POLL_MS);
+}
+
+static int
+readback_timer_func(void *data)
+{
+	readback_process(data, 0);
+
+	return 0;
+}
+
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      pixman_format_code_t format,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_read_pixels_done_func_t done, void *data)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb;
+	GLenum gl_format;
+
+	if (!gr->has_pbo || !go->readback_timer)
+		return -1;
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	rb = zalloc(sizeof *rb);
+	if (rb == NULL)
+		return -1;
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	rb->size = width * height * 4;
+	rb->done = done;
+	rb->data = data;
+
+	glGenBuffers(1, &rb->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, rb->size, NULL, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	rb->fence = EGL_NO_SYNC_KHR;
+	if (gr->create_sync)
+		rb->fence = gr->create_sync(gr->egl_display,
+					    EGL_SYNC_FENCE_KHR, NULL);
+	if (rb->fence != EGL_NO_SYNC_KHR)
+		glFlush();
+
+	wl_list_insert(go->readbacks.prev, &rb->link);
+
+	/* Without a fence, give the GPU about a frame before mapping. */
+	wl_event_source_timer_update(go->readback_timer,
+				     rb->fence != EGL_NO_SYNC_KHR ?
+				     READBACK_POLL_MS : READBACK_NO_FENCE_MS);
+
+	return 0;
+}
+
+static void
+color_correction_release(struct gl_output_state *go)
+{
+	if (go->color.fbo)
+		glDeleteFramebuffers(1, &go->color.fbo);
+	if (go->color.tex)
+		glDeleteTextures(1, &go->color.tex);
+	if (go->color.lut_tex)
+		glDeleteTextures(1, &go->color.lut_tex);
+	memset(&go->color, 0, sizeof go->color);
+}
+
+/* Redirects the repaint of an output with a LUT into its offscreen
+ * copy, the size of the whole EGL surface including the borders.
+ * Returns -1 if the output is drawn directly. */
+static int
+color_correction_begin(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	int32_t width, height;
 
+	if (!go->color.lut_size)
+		return -1;
+
+	output_render_size(output, &width, &height);
+	width += go->borders[GL_RENDERER_BORDER_LEFT].width +
+		 go->borders[GL_RENDERER_BORDER_RIGHT].width;
+	height += go->borders[GL_RENDERER_BORDER_TOP].height +
+		  go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	if (go->color.fbo &&
+	    go->color.width == width && go->color.height == height) {
+		glBindFramebuffer(GL_FRAMEBUFFER, go->color.fbo);
+		return 0;
+	}
+
+	if (!go->color.tex)
+		glGenTextures(1, &go->color.tex);
+	glBindTexture(GL_TEXTURE_2D, go->color.tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	if (!go->color.fbo)
+		glGenFramebuffers(1, &go->color.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, go->color.fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, go->color.tex, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+	    GL_FRAMEBUFFER_COMPLETE) {
+		weston_log("color correction disabled on output %s: "
+			   "incomplete framebuffer\n", output->name);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		color_correction_release(go);
+		return -1;
+	}
+
+	go->color.width = width;
+	go->color.height = height;
+	go->color.valid = 0;
+
+	return 0;
+}
+
+/* Copies the offscreen output to the EGL surface through the LUT.  The
+ * whole surface is covered, so the scene only has to be redrawn where
+ * it changed, whatever the age of the back buffer. */
+static void
+color_correction_draw(struct weston_output *output)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_shader *shader = &gr->color_lut_shader;
+	struct weston_matrix identity;
+	static const GLfloat v[] = {
+		-1.0f, -1.0f, 0.0f, 0.0f,
+		 1.0f, -1.0f, 1.0f, 0.0f,
+		 1.0f,  1.0f, 1.0f, 1.0f,
+		-1.0f,  1.0f, 0.0f, 1.0f,
+	};
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, go->color.width, go->color.height);
+	glDisable(GL_BLEND);
+
+	use_shader(gr, shader);
+	weston_matrix_init(&identity);
+	glUniformMatrix4fv(shader->proj_uniform, 1, GL_FALSE, identity.d);
 	glUniform1i(shader->tex_uniforms[0], 0);
-	glUniform1f(shader->alpha_uniform, 1);
+	glUniform1i(shader->tex_uniforms[1], 1);
+	glUniform1f(shader->lut_size_uniform, go->color.lut_size);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, go->color.lut_tex);
 	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, go->color.tex);
 
-	if (border_status & BORDER_TOP_DIRTY)
-		draw_output_border_texture(go, GL_RENDERER_BORDER_TOP,
-					   0, 0,
-					   full_width, top->height);
-	if (border_status & BORDER_LEFT_DIRTY)
-		draw_output_border_texture(go, GL_RENDERER_BORDER_LEFT,
-					   0, top->height,
-					   left->width, output->current_mode->height);
-	if (border_status & BORDER_RIGHT_DIRTY)
-		draw_output_border_texture(go, GL_RENDERER_BORDER_RIGHT,
-					   full_width - right->width, top->height,
-					   right->width, output->current_mode->height);
-	if (border_status & BORDER_BOTTOM_DIRTY)
-		draw_output_border_texture(go, GL_RENDERER_BORDER_BOTTOM,
-					   0, full_height - bottom->height,
-					   full_width, bottom->height);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+	go->color.valid = 1;
 }
 
 static void
-output_get_border_damage(struct weston_output *output,
-			 enum gl_border_status border_status,
-			 pixman_region32_t *damage)
+gl_renderer_output_set_color_lut(struct weston_output *output,
+				 const uint8_t *lut, int size)
 {
 	struct gl_output_state *go = get_output_state(output);
-	struct gl_border_image *top, *bottom, *left, *right;
-	int full_width, full_height;
 
-	if (border_status == BORDER_STATUS_CLEAN)
-		return; /* Clean. Nothing to do. */
+	if (!go || use_output(output) < 0)
+		return;
+
+	if (!lut) {
+		color_correction_release(go);
+		weston_output_damage(output);
+		return;
+	}
+
+	/* size slices of size x size texels stacked vertically, blue
+	 * selects the slice; red and green are interpolated by the
+	 * sampler, blue in the shader. */
+	if (!go->color.lut_tex)
+		glGenTextures(1, &go->color.lut_tex);
+	glBindTexture(GL_TEXTURE_2D, go->color.lut_tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (get_renderer(output->compositor)->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size * size, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, lut);
+
+	go->color.lut_size = size;
+	go->color.valid = 0;
+	weston_output_damage(output);
+}
 
-	top = &go->borders[GL_RENDERER_BORDER_TOP];
-	bottom = &go->borders[GL_RENDERER_BORDER_BOTTOM];
-	left = &go->borders[GL_RENDERER_BORDER_LEFT];
-	right = &go->borders[GL_RENDERER_BORDER_RIGHT];
+static uint32_t
+texture_time_ms(void)
+{
+	struct timespec ts;
 
-	full_width = output->current_mode->width + left->width + right->width;
-	full_height = output->current_mode->height + top->height + bottom->height;
-	if (border_status & BORDER_TOP_DIRTY)
-		pixman_region32_union_rect(damage, damage,
-					   0, 0,
-					   full_width, top->height);
-	if (border_status & BORDER_LEFT_DIRTY)
-		pixman_region32_union_rect(damage, damage,
-					   0, top->height,
-					   left->width, output->current_mode->height);
-	if (border_status & BORDER_RIGHT_DIRTY)
-		pixman_region32_union_rect(damage, damage,
-					   full_width - right->width, top->height,
-					   right->width, output->current_mode->height);
-	if (border_status & BORDER_BOTTOM_DIRTY)
-		pixman_region32_union_rect(damage, damage,
-					   0, full_height - bottom->height,
-					   full_width, bottom->height);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+/* Frees what texture_account() counts.  A wl_shm texture comes back
+ * from the held buffer in gl_renderer_flush_damage(), or with the next
+ * attach, thumbnails when next drawn. */
 static void
-output_get_damage(struct weston_output *output,
-		  pixman_region32_t *buffer_damage, uint32_t *border_damage)
+texture_evict(struct gl_renderer *gr, struct gl_surface_state *gs,
+	      uint32_t now)
 {
-	struct gl_output_state *go = get_output_state(output);
-	struct gl_renderer *gr = get_renderer(output->compositor);
-	EGLint buffer_age = 0;
-	EGLBoolean ret;
-	int i;
+	weston_log("gl-renderer: evicting %llu kB of textures of a %dx%d "
+		   "surface, hidden for %u s\n",
+		   (unsigned long long) gs->texture_bytes / 1024,
+		   gs->surface->width, gs->surface->height,
+		   (now - gs->last_shown) / 1000);
 
-	if (gr->has_egl_buffer_age) {
-		ret = eglQuerySurface(gr->egl_display, go->egl_surface,
-				      EGL_BUFFER_AGE_EXT, &buffer_age);
-		if (ret == EGL_FALSE) {
-			weston_log("buffer age query failed.\n");
-			gl_renderer_print_egl_error_state();
-		}
-	}
+	thumbnail_release(gs);
 
-	if (buffer_age == 0 || buffer_age - 1 > BUFFER_DAMAGE_COUNT) {
-		pixman_region32_copy(buffer_damage, &output->region);
-		*border_damage = BORDER_ALL_DIRTY;
-	} else {
-		for (i = 0; i < buffer_age - 1; i++)
-			*border_damage |= go->border_damage[i];
+	if (gs->pbo) {
+		glDeleteBuffers(1, &gs->pbo);
+		gs->pbo = 0;
+	}
 
-		if (*border_damage & BORDER_SIZE_CHANGED) {
-			/* If we've had a resize, we have to do a full
-			 * repaint. */
-			*border_damage |= BORDER_ALL_DIRTY;
-			pixman_region32_copy(buffer_damage, &output->region);
-		} else {
-			for (i = 0; i < buffer_age - 1; i++)
-				pixman_region32_union(buffer_damage,
-						      buffer_damage,
-						      &go->buffer_damage[i]);
-		}
+	if (gs->buffer_type == BUFFER_TYPE_SHM && gs->atlas_shelf < 0 &&
+	    gs->num_textures > 0) {
+		glDeleteTextures(gs->num_textures, gs->textures);
+		gs->num_textures = 0;
+		gs->needs_full_upload = 1;
+		gs->evicted = 1;
+		gs->mipmap_allocated = 0;
+		gs->mipmap_valid = 0;
 	}
+
+	texture_account(gr, gs);
 }
 
+/* Surfaces with a view on the output count as shown, on any plane.
+ * Over budget, evict from the least recently shown end of the list for
+ * as long as those have been hidden long enough. */
 static void
-output_rotate_damage(struct weston_output *output,
-		     pixman_region32_t *output_damage,
-		     enum gl_border_status border_status)
+texture_budget_enforce(struct gl_renderer *gr, struct weston_output *output)
 {
-	struct gl_output_state *go = get_output_state(output);
-	struct gl_renderer *gr = get_renderer(output->compositor);
-	int i;
+	struct weston_view **evp;
+	struct gl_surface_state *gs;
+	struct wl_list *link;
+	uint32_t now;
 
-	if (!gr->has_egl_buffer_age)
+	if (!gr->texture_budget)
 		return;
 
-	for (i = BUFFER_DAMAGE_COUNT - 1; i >= 1; i--) {
-		go->border_damage[i] = go->border_damage[i - 1];
-		pixman_region32_copy(&go->buffer_damage[i],
-				     &go->buffer_damage[i - 1]);
+	now = texture_time_ms();
+
+	wl_array_for_each(evp, &output->views) {
+		gs = (*evp)->surface->renderer_state;
+		if (!gs)
+			continue;
+		gs->last_shown = now;
+		wl_list_remove(&gs->lru_link);
+		wl_list_insert(&gr->texture_lru, &gs->lru_link);
 	}
 
-	go->border_damage[0] = border_status;
-	pixman_region32_copy(&go->buffer_damage[0], output_damage);
+	for (link = gr->texture_lru.prev;
+	     link != &gr->texture_lru &&
+	     gr->texture_bytes > gr->texture_budget;
+	     link = link->prev) {
+		gs = container_of(link, struct gl_surface_state, lru_link);
+		if (now - gs->last_shown < gr->texture_evict_age)
+			break;
+		if (gs->texture_bytes > 0)
+			texture_evict(gr, gs, now);
+	}
 }
 
 static void
@@ -863,22 +3012,84 @@ gl_renderer_repaint_output(struct weston_output *output,
 	EGLBoolean ret;
 	static int errored;
 #ifdef EGL_EXT_swap_buffers_with_damage
-	int i, nrects, buffer_height;
-	EGLint *egl_damage, *d;
-	pixman_box32_t *rects;
+	int nrects;
+	EGLint *egl_damage;
 #endif
-	pixman_region32_t buffer_damage, total_damage;
+	pixman_region32_t buffer_damage, total_damage, zoom_damage;
 	enum gl_border_status border_damage = BORDER_STATUS_CLEAN;
+	int corrected;
+	int32_t width, height;
 
 	/* Calculate the viewport */
+	output_render_size(output, &width, &height);
 	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
 		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
-		   output->current_mode->width,
-		   output->current_mode->height);
+		   width, height);
 
 	if (use_output(output) < 0)
 		return;
 
+	weston_timeline_point(output, WESTON_TIMELINE_RENDER_BEGIN);
+
+	gpu_timer_collect(output);
+	gpu_timer_frame_begin(output);
+
+	readback_process(output, 0);
+
+	/* Damage arrives in global coordinates.  While zoomed, track it
+	 * where it lands in the buffer; repaint_views() maps it back. */
+	pixman_region32_init(&zoom_damage);
+	if (output->zoom.active) {
+		weston_output_zoom_region_to_output(output, output_damage,
+						    &zoom_damage);
+		output_damage = &zoom_damage;
+	}
+
+	/* The overlay is drawn over whatever is below it every frame */
+	if (gr->gpu_overlay) {
+		pixman_region32_t rect;
+
+		gpu_overlay_get_rect(output, &rect);
+		pixman_region32_union(output_damage, output_damage, &rect);
+		pixman_region32_fini(&rect);
+	}
+
+	pixman_region32_init(&total_damage);
+	pixman_region32_init(&buffer_damage);
+
+	output_get_damage(output, &buffer_damage, &border_damage);
+	output_rotate_damage(output, output_damage, go->border_status);
+
+	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
+	border_damage |= go->border_status;
+
+	/* The offscreen copy is always one frame old; the correction pass
+	 * then rewrites the whole back buffer. */
+	corrected = color_correction_begin(output) == 0;
+	if (corrected) {
+		if (go->color.valid) {
+			pixman_region32_copy(&total_damage, output_damage);
+			border_damage = go->border_status;
+		} else {
+			pixman_region32_copy(&total_damage, &output->region);
+			border_damage = BORDER_ALL_DIRTY;
+		}
+	}
+
+	weston_region_simplify(&total_damage, DAMAGE_MAX_BOXES_REPAINT,
+			       DAMAGE_MAX_WASTE_PERCENT);
+
+	/* The damage region has to be set after the buffer age query
+	 * and before anything is drawn. */
+	if (gr->set_damage_region) {
+		if (gr->fan_debug || corrected)
+			output_set_damage_region(output, &output->region,
+						 BORDER_ALL_DIRTY);
+		else
+			output_set_damage_region(output, &total_damage,
+						 border_damage);
+	}
+
 	/* if debugging, redraw everything outside the damage to clean up
 	 * debug lines from the previous draw on this buffer:
 	 */
@@ -893,60 +3104,47 @@ gl_renderer_repaint_output(struct weston_output *output,
 		pixman_region32_fini(&undamaged);
 	}
 
-	pixman_region32_init(&total_damage);
-	pixman_region32_init(&buffer_damage);
-
-	output_get_damage(output, &buffer_damage, &border_damage);
-	output_rotate_damage(output, output_damage, go->border_status);
-
-	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
-	border_damage |= go->border_status;
-
+	go->repaint_frame++;
 	repaint_views(output, &total_damage);
+	layer_cache_expire(output);
 
 	pixman_region32_fini(&total_damage);
 	pixman_region32_fini(&buffer_damage);
 
 	draw_output_borders(output, border_damage);
 
+	gpu_timer_frame_end(output);
+
+	if (gr->gpu_overlay) {
+		gpu_overlay_draw(output);
+		if (!go->gpu_overlay_idle)
+			go->gpu_overlay_idle =
+				wl_event_loop_add_idle(
+					wl_display_get_event_loop(
+						compositor->wl_display),
+					gpu_overlay_idle, output);
+	}
+
 	pixman_region32_copy(&output->previous_damage, output_damage);
+	/* Readbacks see the output before color correction. */
 	wl_signal_emit(&output->frame_signal, output);
+	if (corrected)
+		color_correction_draw(output);
+	update_buffer_release_fences(output);
+	texture_budget_enforce(gr, output);
+	weston_timeline_point(output, WESTON_TIMELINE_RENDER_VIEWS);
 
 #ifdef EGL_EXT_swap_buffers_with_damage
-	if (gr->swap_buffers_with_damage) {
-		pixman_region32_init(&buffer_damage);
-		weston_transformed_region(output->width, output->height,
-					  output->transform,
-					  output->current_scale,
-					  output_damage, &buffer_damage);
-
-		if (output_has_borders(output)) {
-			pixman_region32_translate(&buffer_damage,
-						  go->borders[GL_RENDERER_BORDER_LEFT].width,
-						  go->borders[GL_RENDERER_BORDER_TOP].height);
-			output_get_border_damage(output, go->border_status,
-						 &buffer_damage);
-		}
-
-		rects = pixman_region32_rectangles(&buffer_damage, &nrects);
-		egl_damage = malloc(nrects * 4 * sizeof(EGLint));
-
-		buffer_height = go->borders[GL_RENDERER_BORDER_TOP].height +
-				output->current_mode->height +
-				go->borders[GL_RENDERER_BORDER_BOTTOM].height;
-
-		d = egl_damage;
-		for (i = 0; i < nrects; ++i) {
-			*d++ = rects[i].x1;
-			*d++ = buffer_height - rects[i].y2;
-			*d++ = rects[i].x2 - rects[i].x1;
-			*d++ = rects[i].y2 - rects[i].y1;
-		}
+	egl_damage = NULL;
+	if (gr->swap_buffers_with_damage)
+		egl_damage = output_damage_to_egl_rects(output, output_damage,
+							go->border_status,
+							&nrects);
+	if (egl_damage) {
 		ret = gr->swap_buffers_with_damage(gr->egl_display,
 						   go->egl_surface,
 						   egl_damage, nrects);
 		free(egl_damage);
-		pixman_region32_fini(&buffer_damage);
 	} else {
 		ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
 	}
@@ -954,12 +3152,15 @@ gl_renderer_repaint_output(struct weston_output *output,
 	ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
 #endif
 
+	weston_timeline_point(output, WESTON_TIMELINE_RENDER_SWAP);
+
 	if (ret == EGL_FALSE && !errored) {
 		errored = 1;
 		weston_log("Failed in eglSwapBuffers.\n");
 		gl_renderer_print_egl_error_state();
 	}
 
+	pixman_region32_fini(&zoom_damage);
 	go->border_status = BORDER_STATUS_CLEAN;
 }
 
@@ -996,6 +3197,274 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+#ifdef GL_EXT_unpack_subimage
+/* Copy the damaged part of the SHM buffer into the surface's pixel
+ * buffer object and let the GPU pull it into the texture from there.
+ * The client buffer is no longer needed once the copy is done, and the
+ * texture upload no longer stalls the repaint. */
+static int
+texture_upload_pbo(struct gl_renderer *gr, struct gl_surface_state *gs,
+		   struct weston_surface *surface,
+		   struct weston_buffer *buffer)
+{
+	pixman_box32_t *rectangles = NULL, r;
+	int32_t stride, bpp, x1, x2, y1, y2;
+	uint8_t *data, *map;
+	int i, n = 0;
+
+	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	bpp = stride / gs->pitch;
+
+	if (!gs->pbo)
+		glGenBuffers(1, &gs->pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gs->pbo);
+
+	/* Respecifying the storage orphans whatever the GPU may still be
+	 * reading from the previous upload, so the copy below never has
+	 * to wait for it to finish. */
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, stride * buffer->height,
+		     NULL, GL_STREAM_DRAW);
+	map = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER, 0,
+				   stride * buffer->height,
+				   GL_MAP_WRITE_BIT |
+				   GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return -1;
+	}
+
+	if (!gs->needs_full_upload)
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	if (gs->needs_full_upload) {
+		memcpy(map, data, stride * buffer->height);
+	} else {
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+			x1 = r.x1 < 0 ? 0 : r.x1;
+			x2 = r.x2 > gs->pitch ? gs->pitch : r.x2;
+			y1 = r.y1 < 0 ? 0 : r.y1;
+			y2 = r.y2 > buffer->height ? buffer->height : r.y2;
+			if (x2 <= x1)
+				continue;
+			for (; y1 < y2; y1++)
+				memcpy(map + y1 * stride + x1 * bpp,
+				       data + y1 * stride + x1 * bpp,
+				       (x2 - x1) * bpp);
+		}
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	if (!gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return -1;
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
+
+	if (gs->needs_full_upload) {
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
+			     gs->pitch, buffer->height, 0,
+			     gs->gl_format, gs->gl_pixel_type, NULL);
+	} else {
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
+					r.x2 - r.x1, r.y2 - r.y1,
+					gs->gl_format, gs->gl_pixel_type,
+					NULL);
+		}
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	return 0;
+}
+#endif
+
+#ifdef GL_EXT_unpack_subimage
+static void
+atlas_sub_image(struct gl_surface_state *gs, void *data,
+		int32_t x, int32_t y, int32_t dx, int32_t dy,
+		int32_t width, int32_t height)
+{
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y);
+	glTexSubImage2D(GL_TEXTURE_2D, 0,
+			gs->atlas_x + dx, gs->atlas_y + dy, width, height,
+			gs->gl_format, gs->gl_pixel_type, data);
+}
+
+/* Upload a rectangle of the buffer into the atlas slot.  Where it
+ * touches the slot border the edge texels are repeated into the gutter,
+ * so that linear filtering doesn't pick up the neighbouring slots. */
+static void
+atlas_upload_rect(struct gl_surface_state *gs, void *data,
+		  int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+{
+	int32_t width = x2 - x1, height = y2 - y1;
+
+	atlas_sub_image(gs, data, x1, y1, x1, y1, width, height);
+
+	if (x1 == 0)
+		atlas_sub_image(gs, data, 0, y1, -1, y1, 1, height);
+	if (x2 == gs->pitch)
+		atlas_sub_image(gs, data, x2 - 1, y1, x2, y1, 1, height);
+	if (y1 == 0)
+		atlas_sub_image(gs, data, x1, 0, x1, -1, width, 1);
+	if (y2 == gs->height)
+		atlas_sub_image(gs, data, x1, y2 - 1, x1, y2, width, 1);
+}
+
+static void
+atlas_upload(struct gl_surface_state *gs, struct weston_surface *surface,
+	     struct weston_buffer *buffer)
+{
+	pixman_box32_t *rectangles, r;
+	int32_t x1, y1, x2, y2;
+	void *data;
+	int i, n;
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+
+	if (gs->needs_full_upload) {
+		atlas_upload_rect(gs, data, 0, 0, gs->pitch, gs->height);
+		wl_shm_buffer_end_access(buffer->shm_buffer);
+		return;
+	}
+
+	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
+	for (i = 0; i < n; i++) {
+		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+
+		/* Never write outside of the slot */
+		x1 = r.x1 < 0 ? 0 : r.x1;
+		x2 = r.x2 > gs->pitch ? gs->pitch : r.x2;
+		y1 = r.y1 < 0 ? 0 : r.y1;
+		y2 = r.y2 > gs->height ? gs->height : r.y2;
+		if (x2 <= x1 || y2 <= y1)
+			continue;
+
+		atlas_upload_rect(gs, data, x1, y1, x2, y2);
+	}
+
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+}
+#endif
+
+/* What the upload below is going to copy, for the surface's stats */
+static uint64_t
+upload_size(struct gl_renderer *gr, struct gl_surface_state *gs,
+	    struct weston_surface *surface, struct weston_buffer *buffer)
+{
+	int32_t stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	pixman_box32_t *rectangles, r;
+	uint64_t pixels = 0;
+	int i, n;
+
+	if (gs->num_planes > 1)
+		return planes_size(gs);
+
+	if (!gr->has_unpack_subimage || gs->needs_full_upload)
+		return (uint64_t) stride * buffer->height;
+
+	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
+	for (i = 0; i < n; i++) {
+		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+		pixels += (uint64_t) (r.x2 - r.x1) * (r.y2 - r.y1);
+	}
+
+	return pixels * (stride / gs->pitch);
+}
+
+/* Upload the planes of a YUV buffer as separate textures, the shader
+ * combines them.  Damage is scaled down to each plane's subsampling and
+ * rounded outwards. */
+static void
+texture_upload_planes(struct gl_renderer *gr, struct gl_surface_state *gs,
+		      struct weston_surface *surface,
+		      struct weston_buffer *buffer)
+{
+	uint8_t *data;
+	int32_t width, height;
+	int j;
+#ifdef GL_EXT_unpack_subimage
+	pixman_box32_t *rectangles, r;
+	int32_t x1, y1, x2, y2;
+	int i, n;
+#endif
+
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	/* Chroma rows are not necessarily 4 byte aligned */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+
+	for (j = 0; j < gs->num_planes; j++) {
+		width = gs->pitch / gs->hsub[j];
+		height = buffer->height / gs->vsub[j];
+
+		glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
+
+		if (!gr->has_unpack_subimage || gs->needs_full_upload) {
+#ifdef GL_EXT_unpack_subimage
+			if (gr->has_unpack_subimage) {
+				glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, width);
+				glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+				glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+			}
+#endif
+			glTexImage2D(GL_TEXTURE_2D, 0, gs->plane_format[j],
+				     width, height, 0, gs->plane_format[j],
+				     GL_UNSIGNED_BYTE, data + gs->offset[j]);
+			continue;
+		}
+
+#ifdef GL_EXT_unpack_subimage
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, width);
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+			x1 = r.x1 < 0 ? 0 : r.x1 / gs->hsub[j];
+			y1 = r.y1 < 0 ? 0 : r.y1 / gs->vsub[j];
+			x2 = (r.x2 + gs->hsub[j] - 1) / gs->hsub[j];
+			y2 = (r.y2 + gs->vsub[j] - 1) / gs->vsub[j];
+			if (x2 > width)
+				x2 = width;
+			if (y2 > height)
+				y2 = height;
+			if (x2 <= x1 || y2 <= y1)
+				continue;
+
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x1);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x1, y1,
+					x2 - x1, y2 - y1,
+					gs->plane_format[j], GL_UNSIGNED_BYTE,
+					data + gs->offset[j]);
+		}
+#endif
+	}
+
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
@@ -1011,6 +3480,9 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	int i, n;
 #endif
 
+	if (pixman_region32_not_empty(&surface->damage))
+		gs->content_serial = ++gr->content_serial;
+
 	pixman_region32_union(&gs->texture_damage,
 			      &gs->texture_damage, &surface->damage);
 
@@ -1032,10 +3504,26 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	if (!texture_used)
 		return;
 
+	if (gs->evicted) {
+		ensure_textures(gs, gs->num_planes);
+		gs->evicted = 0;
+	}
+
 	if (!pixman_region32_not_empty(&gs->texture_damage) &&
 	    !gs->needs_full_upload)
 		goto done;
 
+	weston_region_simplify(&gs->texture_damage, DAMAGE_MAX_BOXES_UPLOAD,
+			       DAMAGE_MAX_WASTE_PERCENT);
+
+	surface->stats.bytes_uploaded += upload_size(gr, gs, surface, buffer);
+	gs->mipmap_valid = 0;
+
+	if (gs->num_planes > 1) {
+		texture_upload_planes(gr, gs, surface, buffer);
+		goto done;
+	}
+
 	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
 
 	if (!gr->has_unpack_subimage) {
@@ -1050,6 +3538,15 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	}
 
 #ifdef GL_EXT_unpack_subimage
+	if (gs->atlas_shelf >= 0) {
+		atlas_upload(gs, surface, buffer);
+		goto done;
+	}
+
+	if (gr->has_pbo &&
+	    texture_upload_pbo(gr, gs, surface, buffer) == 0)
+		goto done;
+
 	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
@@ -1084,8 +3581,12 @@ done:
 	pixman_region32_fini(&gs->texture_damage);
 	pixman_region32_init(&gs->texture_damage);
 	gs->needs_full_upload = 0;
+	texture_account(gr, gs);
 
-	weston_buffer_reference(&gs->buffer_ref, NULL);
+	/* Under a budget, hold on to the buffer to upload it again from
+	 * should the texture get evicted. */
+	if (!gr->texture_budget)
+		weston_buffer_reference(&gs->buffer_ref, NULL);
 }
 
 static void
@@ -1108,6 +3609,99 @@ ensure_textures(struct gl_surface_state *gs, int num_textures)
 	glBindTexture(gs->target, 0);
 }
 
+static int
+atlas_create_texture(struct gl_renderer *gr)
+{
+	void *clear;
+
+	/* Start out transparent, the gutters between slots are sampled
+	 * at the border of surfaces not touching it. */
+	clear = zalloc(ATLAS_SIZE * ATLAS_SIZE * 4);
+	if (!clear)
+		return -1;
+
+	glGenTextures(1, &gr->atlas_texture);
+	glBindTexture(GL_TEXTURE_2D, gr->atlas_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT, ATLAS_SIZE, ATLAS_SIZE,
+		     0, GL_BGRA_EXT, GL_UNSIGNED_BYTE, clear);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	free(clear);
+
+	return 0;
+}
+
+/* Find a slot of width x height plus a one pixel gutter in the atlas.
+ * Returns -1 if the atlas is full, the surface keeps a texture of its
+ * own then. */
+static int
+atlas_alloc(struct gl_renderer *gr, struct gl_surface_state *gs,
+	    int32_t width, int32_t height)
+{
+	struct gl_atlas_shelf *shelf;
+	int32_t w = width + 2, h = height + 2;
+	int i;
+
+	if (!gr->atlas_texture && atlas_create_texture(gr) < 0)
+		return -1;
+
+	for (i = 0; i < gr->atlas_num_shelves; i++) {
+		shelf = &gr->atlas_shelves[i];
+
+		/* Don't waste a high shelf on a low surface, unless
+		 * the shelf is empty anyway. */
+		if (shelf->height < h || shelf->x + w > ATLAS_SIZE ||
+		    (shelf->live > 0 && shelf->height > 2 * h))
+			continue;
+
+		break;
+	}
+
+	if (i == gr->atlas_num_shelves) {
+		h = (h + 7) & ~7;
+		if (i == ATLAS_MAX_SHELVES ||
+		    gr->atlas_next_y + h > ATLAS_SIZE)
+			return -1;
+
+		shelf = &gr->atlas_shelves[i];
+		shelf->y = gr->atlas_next_y;
+		shelf->height = h;
+		shelf->x = 0;
+		shelf->live = 0;
+		gr->atlas_next_y += h;
+		gr->atlas_num_shelves++;
+	}
+
+	gs->atlas_shelf = i;
+	gs->atlas_x = shelf->x + 1;
+	gs->atlas_y = shelf->y + 1;
+	shelf->x += w;
+	shelf->live++;
+
+	return 0;
+}
+
+static void
+atlas_release(struct gl_renderer *gr, struct gl_surface_state *gs)
+{
+	struct gl_atlas_shelf *shelf;
+
+	if (gs->atlas_shelf < 0)
+		return;
+
+	shelf = &gr->atlas_shelves[gs->atlas_shelf];
+	if (--shelf->live == 0)
+		shelf->x = 0;
+
+	gs->atlas_shelf = -1;
+	gs->atlas_x = gs->atlas_y = -1;
+
+	/* textures[0] was the atlas texture, nothing to delete */
+	gs->num_textures = 0;
+}
+
 static void
 gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 		       struct wl_shm_buffer *shm_buffer)
@@ -1116,14 +3710,19 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(es);
 	GLenum gl_format, gl_pixel_type;
-	int pitch;
+	int pitch, num_planes = 1;
 
 	buffer->shm_buffer = shm_buffer;
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(shm_buffer);
 
+	gs->offset[0] = 0;
+	gs->hsub[0] = 1;
+	gs->vsub[0] = 1;
+
 	switch (wl_shm_buffer_get_format(shm_buffer)) {
 	case WL_SHM_FORMAT_XRGB8888:
+		es->is_opaque = 1;
 		gs->shader = &gr->texture_shader_rgbx;
 		pitch = wl_shm_buffer_get_stride(shm_buffer) / 4;
 		gl_format = GL_BGRA_EXT;
@@ -1136,17 +3735,69 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 		gl_pixel_type = GL_UNSIGNED_BYTE;
 		break;
 	case WL_SHM_FORMAT_RGB565:
+		es->is_opaque = 1;
 		gs->shader = &gr->texture_shader_rgbx;
 		pitch = wl_shm_buffer_get_stride(shm_buffer) / 2;
 		gl_format = GL_RGB;
 		gl_pixel_type = GL_UNSIGNED_SHORT_5_6_5;
 		break;
+	case WL_SHM_FORMAT_YUV420:
+		es->is_opaque = 1;
+		gs->shader = &gr->texture_shader_y_u_v;
+		pitch = wl_shm_buffer_get_stride(shm_buffer);
+		gl_format = GL_LUMINANCE;
+		gl_pixel_type = GL_UNSIGNED_BYTE;
+		num_planes = 3;
+		gs->plane_format[1] = GL_LUMINANCE;
+		gs->plane_bpp[1] = 1;
+		gs->offset[1] = pitch * buffer->height;
+		gs->hsub[1] = 2;
+		gs->vsub[1] = 2;
+		gs->plane_format[2] = GL_LUMINANCE;
+		gs->plane_bpp[2] = 1;
+		gs->offset[2] = gs->offset[1] +
+			(pitch / 2) * (buffer->height / 2);
+		gs->hsub[2] = 2;
+		gs->vsub[2] = 2;
+		break;
+	case WL_SHM_FORMAT_NV12:
+		/* UV pairs land in luminance and alpha */
+		es->is_opaque = 1;
+		gs->shader = &gr->texture_shader_y_xuxv;
+		pitch = wl_shm_buffer_get_stride(shm_buffer);
+		gl_format = GL_LUMINANCE;
+		gl_pixel_type = GL_UNSIGNED_BYTE;
+		num_planes = 2;
+		gs->plane_format[1] = GL_LUMINANCE_ALPHA;
+		gs->plane_bpp[1] = 2;
+		gs->offset[1] = pitch * buffer->height;
+		gs->hsub[1] = 2;
+		gs->vsub[1] = 2;
+		break;
+	case WL_SHM_FORMAT_YUYV:
+		/* The same data twice: Y as luminance of Y/U and Y/V
+		 * pairs, then U and V as green and alpha of Y0 U Y1 V */
+		es->is_opaque = 1;
+		gs->shader = &gr->texture_shader_y_xuxv;
+		pitch = wl_shm_buffer_get_stride(shm_buffer) / 2;
+		gl_format = GL_LUMINANCE_ALPHA;
+		gl_pixel_type = GL_UNSIGNED_BYTE;
+		num_planes = 2;
+		gs->plane_format[1] = GL_BGRA_EXT;
+		gs->plane_bpp[1] = 4;
+		gs->offset[1] = 0;
+		gs->hsub[1] = 2;
+		gs->vsub[1] = 1;
+		break;
 	default:
 		weston_log("warning: unknown shm buffer format: %08x\n",
 			   wl_shm_buffer_get_format(shm_buffer));
 		return;
 	}
 
+	gs->plane_format[0] = gl_format;
+	gs->plane_bpp[0] = gl_format == GL_LUMINANCE ? 1 : 2;
+
 	/* Only allocate a texture if it doesn't match existing one.
 	 * If a switch from DRM allocated buffer to a SHM buffer is
 	 * happening, we need to allocate a new texture buffer. */
@@ -1154,96 +3805,578 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	    buffer->height != gs->height ||
 	    gl_format != gs->gl_format ||
 	    gl_pixel_type != gs->gl_pixel_type ||
-	    gs->buffer_type != BUFFER_TYPE_SHM) {
+	    num_planes != gs->num_planes ||
+	    gs->buffer_type != BUFFER_TYPE_SHM || gs->evicted) {
 		gs->pitch = pitch;
 		gs->height = buffer->height;
 		gs->target = GL_TEXTURE_2D;
 		gs->gl_format = gl_format;
 		gs->gl_pixel_type = gl_pixel_type;
+		gs->num_planes = num_planes;
+		gs->mipmap_allocated = 0;
+		gs->mipmap_valid = 0;
 		gs->buffer_type = BUFFER_TYPE_SHM;
 		gs->needs_full_upload = 1;
 		gs->y_inverted = 1;
+		gs->evicted = 0;
+
+		gs->surface = es;
+
+		atlas_release(gr, gs);
+		if (gr->has_atlas && gl_pixel_type == GL_UNSIGNED_BYTE &&
+		    num_planes == 1 &&
+		    pitch <= ATLAS_MAX_SURFACE &&
+		    buffer->height <= ATLAS_MAX_SURFACE &&
+		    atlas_alloc(gr, gs, pitch, buffer->height) == 0) {
+			glDeleteTextures(gs->num_textures, gs->textures);
+			gs->textures[0] = gr->atlas_texture;
+			gs->num_textures = 1;
+		}
+
+		ensure_textures(gs, num_planes);
+	}
+}
+
+static void
+egl_buffer_image_destroy(struct gl_renderer *gr,
+			 struct egl_buffer_image *image)
+{
+	int i;
+
+	for (i = 0; i < image->num_planes; i++)
+		if (image->images[i])
+			gr->destroy_image(gr->egl_display, image->images[i]);
+
+	wl_list_remove(&image->destroy_listener.link);
+	wl_list_remove(&image->link);
+	free(image);
+}
+
+static void
+egl_buffer_image_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct egl_buffer_image *image =
+		container_of(listener, struct egl_buffer_image,
+			     destroy_listener);
+
+	egl_buffer_image_destroy(image->renderer, image);
+}
+
+/* Returns the images of buffer, created on its first attach.  Clients
+ * cycle through a few buffers, after a frame or two nothing is
+ * imported any more. */
+static struct egl_buffer_image *
+egl_buffer_image_get(struct gl_renderer *gr, struct weston_buffer *buffer,
+		     uint32_t format, int num_planes)
+{
+	struct egl_buffer_image *image;
+	struct wl_listener *listener;
+	EGLint attribs[3];
+	int i;
+
+	listener = wl_signal_get(&buffer->destroy_signal,
+				 egl_buffer_image_handle_destroy);
+	if (listener) {
+		image = container_of(listener, struct egl_buffer_image,
+				     destroy_listener);
+		if (image->format == format)
+			return image;
+		egl_buffer_image_destroy(gr, image);
+	}
+
+	image = zalloc(sizeof *image);
+	if (!image)
+		return NULL;
+
+	image->renderer = gr;
+	image->buffer = buffer;
+	image->format = format;
+	image->num_planes = num_planes;
+
+	for (i = 0; i < num_planes; i++) {
+		attribs[0] = EGL_WAYLAND_PLANE_WL;
+		attribs[1] = i;
+		attribs[2] = EGL_NONE;
+		image->images[i] = gr->create_image(gr->egl_display,
+						    NULL,
+						    EGL_WAYLAND_BUFFER_WL,
+						    buffer->legacy_buffer,
+						    attribs);
+		if (!image->images[i])
+			weston_log("failed to create img for plane %d\n", i);
+	}
+
+	image->destroy_listener.notify = egl_buffer_image_handle_destroy;
+	wl_signal_add(&buffer->destroy_signal, &image->destroy_listener);
+	wl_list_insert(&gr->egl_buffer_images, &image->link);
+
+	return image;
+}
+
+static void
+gl_renderer_attach_egl(struct weston_surface *es, struct weston_buffer *buffer,
+		       uint32_t format)
+{
+	struct weston_compositor *ec = es->compositor;
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_surface_state *gs = get_surface_state(es);
+	struct egl_buffer_image *image;
+	int i, num_planes;
+
+	buffer->legacy_buffer = (struct wl_buffer *)buffer->resource;
+	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
+			 EGL_WIDTH, &buffer->width);
+	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
+			 EGL_HEIGHT, &buffer->height);
+	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
+			 EGL_WAYLAND_Y_INVERTED_WL, &buffer->y_inverted);
+
+	for (i = 0; i < gs->num_images; i++)
+		gr->destroy_image(gr->egl_display, gs->images[i]);
+	gs->num_images = 0;
+	atlas_release(gr, gs);
+	gs->target = GL_TEXTURE_2D;
+	switch (format) {
+	case EGL_TEXTURE_RGB:
+	case EGL_TEXTURE_RGBA:
+	default:
+		num_planes = 1;
+		gs->shader = &gr->texture_shader_rgba;
+		es->is_opaque = format == EGL_TEXTURE_RGB;
+		break;
+	case EGL_TEXTURE_EXTERNAL_WL:
+		num_planes = 1;
+		gs->target = GL_TEXTURE_EXTERNAL_OES;
+		gs->shader = &gr->texture_shader_egl_external;
+		break;
+	case EGL_TEXTURE_Y_UV_WL:
+		num_planes = 2;
+		gs->shader = &gr->texture_shader_y_uv;
+		es->is_opaque = 1;
+		break;
+	case EGL_TEXTURE_Y_U_V_WL:
+		num_planes = 3;
+		gs->shader = &gr->texture_shader_y_u_v;
+		es->is_opaque = 1;
+		break;
+	case EGL_TEXTURE_Y_XUXV_WL:
+		num_planes = 2;
+		gs->shader = &gr->texture_shader_y_xuxv;
+		es->is_opaque = 1;
+		break;
+	}
+
+	/* The images belong to the buffer now, binding one of them to
+	 * our texture again only takes a reference. */
+	image = egl_buffer_image_get(gr, buffer, format, num_planes);
+
+	ensure_textures(gs, num_planes);
+	for (i = 0; image && i < num_planes; i++) {
+		if (!image->images[i])
+			continue;
+
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(gs->target, gs->textures[i]);
+		gr->image_target_texture_2d(gs->target, image->images[i]);
+	}
+
+	gs->pitch = buffer->width;
+	gs->height = buffer->height;
+	gs->buffer_type = BUFFER_TYPE_EGL;
+	gs->y_inverted = buffer->y_inverted;
+}
+
+static const EGLint dmabuf_plane_attribs[3][5] = {
+	{ EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+	  EGL_DMA_BUF_PLANE0_PITCH_EXT,
+	  EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+	  EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT },
+	{ EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+	  EGL_DMA_BUF_PLANE1_PITCH_EXT,
+	  EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+	  EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT },
+	{ EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+	  EGL_DMA_BUF_PLANE2_PITCH_EXT,
+	  EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+	  EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT },
+};
+
+static EGLImageKHR
+import_simple_dmabuf(struct gl_renderer *gr,
+		     struct dmabuf_attributes *attributes)
+{
+	EGLint attribs[7 + 3 * 10];
+	int atti = 0, i;
+
+	if (attributes->n_planes > 3)
+		return NULL;
+
+	attribs[atti++] = EGL_WIDTH;
+	attribs[atti++] = attributes->width;
+	attribs[atti++] = EGL_HEIGHT;
+	attribs[atti++] = attributes->height;
+	attribs[atti++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[atti++] = attributes->format;
+
+	for (i = 0; i < attributes->n_planes; i++) {
+		attribs[atti++] = dmabuf_plane_attribs[i][0];
+		attribs[atti++] = attributes->fd[i];
+		attribs[atti++] = dmabuf_plane_attribs[i][1];
+		attribs[atti++] = attributes->offset[i];
+		attribs[atti++] = dmabuf_plane_attribs[i][2];
+		attribs[atti++] = attributes->stride[i];
+
+		if (attributes->modifier[i] == 0)
+			continue;
+
+		attribs[atti++] = dmabuf_plane_attribs[i][3];
+		attribs[atti++] = attributes->modifier[i] & 0xffffffff;
+		attribs[atti++] = dmabuf_plane_attribs[i][4];
+		attribs[atti++] = attributes->modifier[i] >> 32;
+	}
+
+	attribs[atti++] = EGL_NONE;
+
+	return gr->create_image(gr->egl_display, EGL_NO_CONTEXT,
+				EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+}
+
+/* How to sample a YUV format from one R8 or GR88 image per plane, for
+ * drivers that can't import the YUV format as a whole. */
+struct yuv_plane_descriptor {
+	int width_divisor;
+	int height_divisor;
+	uint32_t format;
+	int plane_index;
+};
+
+struct yuv_format_descriptor {
+	uint32_t format;
+	int input_planes;
+	int output_planes;
+	struct gl_shader *(*shader)(struct gl_renderer *gr);
+	struct yuv_plane_descriptor plane[3];
+};
+
+static struct gl_shader *
+yuv_shader_y_uv(struct gl_renderer *gr)
+{
+	return &gr->texture_shader_y_uv;
+}
+
+static struct gl_shader *
+yuv_shader_y_u_v(struct gl_renderer *gr)
+{
+	return &gr->texture_shader_y_u_v;
+}
+
+static struct gl_shader *
+yuv_shader_y_xuxv(struct gl_renderer *gr)
+{
+	return &gr->texture_shader_y_xuxv;
+}
+
+static const struct yuv_format_descriptor yuv_formats[] = {
+	{
+		.format = DRM_FORMAT_YUYV,
+		.input_planes = 1,
+		.output_planes = 2,
+		.shader = yuv_shader_y_xuxv,
+		{{
+			.width_divisor = 1,
+			.height_divisor = 1,
+			.format = DRM_FORMAT_GR88,
+			.plane_index = 0
+		}, {
+			.width_divisor = 2,
+			.height_divisor = 1,
+			.format = DRM_FORMAT_ARGB8888,
+			.plane_index = 0
+		}}
+	}, {
+		.format = DRM_FORMAT_NV12,
+		.input_planes = 2,
+		.output_planes = 2,
+		.shader = yuv_shader_y_uv,
+		{{
+			.width_divisor = 1,
+			.height_divisor = 1,
+			.format = DRM_FORMAT_R8,
+			.plane_index = 0
+		}, {
+			.width_divisor = 2,
+			.height_divisor = 2,
+			.format = DRM_FORMAT_GR88,
+			.plane_index = 1
+		}}
+	}, {
+		.format = DRM_FORMAT_YUV420,
+		.input_planes = 3,
+		.output_planes = 3,
+		.shader = yuv_shader_y_u_v,
+		{{
+			.width_divisor = 1,
+			.height_divisor = 1,
+			.format = DRM_FORMAT_R8,
+			.plane_index = 0
+		}, {
+			.width_divisor = 2,
+			.height_divisor = 2,
+			.format = DRM_FORMAT_R8,
+			.plane_index = 1
+		}, {
+			.width_divisor = 2,
+			.height_divisor = 2,
+			.format = DRM_FORMAT_R8,
+			.plane_index = 2
+		}}
+	}
+};
+
+static const struct yuv_format_descriptor *
+yuv_format_lookup(uint32_t format)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(yuv_formats); i++)
+		if (yuv_formats[i].format == format)
+			return &yuv_formats[i];
+
+	return NULL;
+}
+
+static int
+import_yuv_dmabuf(struct gl_renderer *gr, struct dmabuf_image *image,
+		  const struct yuv_format_descriptor *format)
+{
+	struct dmabuf_attributes *attributes = &image->dmabuf->attributes;
+	struct dmabuf_attributes plane;
+	const struct yuv_plane_descriptor *desc;
+	int i, index;
+
+	if (attributes->n_planes != format->input_planes)
+		return -1;
+
+	for (i = 0; i < format->output_planes; i++) {
+		desc = &format->plane[i];
+		index = desc->plane_index;
+
+		memset(&plane, 0, sizeof plane);
+		plane.width = attributes->width / desc->width_divisor;
+		plane.height = attributes->height / desc->height_divisor;
+		plane.format = desc->format;
+		plane.n_planes = 1;
+		plane.fd[0] = attributes->fd[index];
+		plane.offset[0] = attributes->offset[index];
+		plane.stride[0] = attributes->stride[index];
+		plane.modifier[0] = attributes->modifier[index];
+
+		image->images[i] = import_simple_dmabuf(gr, &plane);
+		if (!image->images[i]) {
+			while (i--)
+				gr->destroy_image(gr->egl_display,
+						  image->images[i]);
+			return -1;
+		}
+	}
+
+	image->num_images = format->output_planes;
+	image->target = GL_TEXTURE_2D;
+	image->shader = format->shader(gr);
+
+	return 0;
+}
+
+static void
+dmabuf_image_destroy(struct gl_renderer *gr, struct dmabuf_image *image)
+{
+	int i;
+
+	for (i = 0; i < image->num_images; i++)
+		gr->destroy_image(gr->egl_display, image->images[i]);
+
+	wl_list_remove(&image->link);
+	free(image);
+}
+
+static void
+gl_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
+{
+	struct dmabuf_image *image = linux_dmabuf_buffer_get_user_data(dmabuf);
+
+	dmabuf_image_destroy(get_renderer(dmabuf->compositor), image);
+}
+
+/* Single plane RGB formats are sampled directly.  YUV formats are
+ * imported as a whole into an external texture where the driver can
+ * convert them, or else plane by plane for the YUV shaders. */
+static int
+gl_renderer_import_dmabuf(struct weston_compositor *ec,
+			  struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	const struct yuv_format_descriptor *yuv;
+	struct dmabuf_image *image;
+	int i;
+
+	for (i = 0; i < dmabuf->attributes.n_planes; i++)
+		if (dmabuf->attributes.modifier[i] != 0 &&
+		    !gr->has_dmabuf_import_modifiers)
+			return -1;
+
+	image = zalloc(sizeof *image);
+	if (!image)
+		return -1;
+
+	image->dmabuf = dmabuf;
+	yuv = yuv_format_lookup(dmabuf->attributes.format);
+
+	if (!yuv || gr->has_egl_image_external)
+		image->images[0] =
+			import_simple_dmabuf(gr, &dmabuf->attributes);
+
+	if (image->images[0]) {
+		image->num_images = 1;
+		if (yuv) {
+			image->target = GL_TEXTURE_EXTERNAL_OES;
+			image->shader = &gr->texture_shader_egl_external;
+		} else {
+			image->target = GL_TEXTURE_2D;
+			image->shader = &gr->texture_shader_rgba;
+		}
+	} else if (!yuv || import_yuv_dmabuf(gr, image, yuv) < 0) {
+		free(image);
+		return -1;
+	}
+
+	wl_list_insert(&gr->dmabuf_images, &image->link);
+	linux_dmabuf_buffer_set_user_data(dmabuf, image,
+					  gl_renderer_destroy_dmabuf);
+
+	return 0;
+}
+
+static void
+gl_renderer_attach_dmabuf(struct weston_surface *surface,
+			  struct weston_buffer *buffer,
+			  struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct dmabuf_image *image;
+	int i;
+
+	image = linux_dmabuf_buffer_get_user_data(dmabuf);
+	if (!image) {
+		weston_log("dmabuf buffer was not imported\n");
+		weston_buffer_reference(&gs->buffer_ref, NULL);
+		gs->buffer_type = BUFFER_TYPE_NULL;
+		return;
+	}
+
+	buffer->width = dmabuf->attributes.width;
+	buffer->height = dmabuf->attributes.height;
+	buffer->y_inverted = !(dmabuf->attributes.flags &
+			       ZLINUX_BUFFER_PARAMS_FLAGS_Y_INVERT);
+
+	/* The images belong to the buffer, only drop our own ones */
+	for (i = 0; i < gs->num_images; i++)
+		gr->destroy_image(gr->egl_display, gs->images[i]);
+	gs->num_images = 0;
+	atlas_release(gr, gs);
+
+	gs->target = image->target;
+	ensure_textures(gs, image->num_images);
+	for (i = 0; i < image->num_images; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(gs->target, gs->textures[i]);
+		gr->image_target_texture_2d(gs->target, image->images[i]);
+	}
+
+	gs->shader = image->shader;
+	gs->pitch = buffer->width;
+	gs->height = buffer->height;
+	gs->buffer_type = BUFFER_TYPE_EGL;
+	gs->y_inverted = buffer->y_inverted;
+}
+
+/* Make the GPU wait for a client's acquire fence before anything
+ * queued after this reads the buffer; the CPU does not block. */
+static void
+gl_renderer_wait_fence(struct gl_renderer *gr, int fence_fd)
+{
+	EGLint attribs[] = {
+		EGL_SYNC_NATIVE_FENCE_FD_ANDROID, 0,
+		EGL_NONE
+	};
+	EGLSyncKHR sync;
+	int fd;
 
-		gs->surface = es;
+	/* EGL owns the fd once the sync is created */
+	fd = dup(fence_fd);
+	if (fd < 0)
+		return;
 
-		ensure_textures(gs, 1);
+	attribs[1] = fd;
+	sync = gr->create_sync(gr->egl_display,
+			       EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+	if (sync == EGL_NO_SYNC_KHR) {
+		weston_log("failed to import acquire fence\n");
+		close(fd);
+		return;
 	}
+
+	gr->wait_sync(gr->egl_display, sync, 0);
+	gr->destroy_sync(gr->egl_display, sync);
 }
 
+/* Give the client buffers drawn in this frame a fence that signals when
+ * the frame's rendering is done, for their explicit sync release. */
 static void
-gl_renderer_attach_egl(struct weston_surface *es, struct weston_buffer *buffer,
-		       uint32_t format)
+update_buffer_release_fences(struct weston_output *output)
 {
-	struct weston_compositor *ec = es->compositor;
-	struct gl_renderer *gr = get_renderer(ec);
-	struct gl_surface_state *gs = get_surface_state(es);
-	EGLint attribs[3];
-	int i, num_planes;
+	struct weston_compositor *compositor = output->compositor;
+	struct gl_renderer *gr = get_renderer(compositor);
+	struct weston_view **evp;
+	struct weston_buffer *buffer;
+	struct gl_surface_state *gs;
+	EGLSyncKHR sync;
+	int fd = -1;
 
-	buffer->legacy_buffer = (struct wl_buffer *)buffer->resource;
-	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
-			 EGL_WIDTH, &buffer->width);
-	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
-			 EGL_HEIGHT, &buffer->height);
-	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
-			 EGL_WAYLAND_Y_INVERTED_WL, &buffer->y_inverted);
+	if (!gr->has_native_fence_sync)
+		return;
 
-	for (i = 0; i < gs->num_images; i++)
-		gr->destroy_image(gr->egl_display, gs->images[i]);
-	gs->num_images = 0;
-	gs->target = GL_TEXTURE_2D;
-	switch (format) {
-	case EGL_TEXTURE_RGB:
-	case EGL_TEXTURE_RGBA:
-	default:
-		num_planes = 1;
-		gs->shader = &gr->texture_shader_rgba;
-		break;
-	case EGL_TEXTURE_EXTERNAL_WL:
-		num_planes = 1;
-		gs->target = GL_TEXTURE_EXTERNAL_OES;
-		gs->shader = &gr->texture_shader_egl_external;
-		break;
-	case EGL_TEXTURE_Y_UV_WL:
-		num_planes = 2;
-		gs->shader = &gr->texture_shader_y_uv;
-		break;
-	case EGL_TEXTURE_Y_U_V_WL:
-		num_planes = 3;
-		gs->shader = &gr->texture_shader_y_u_v;
-		break;
-	case EGL_TEXTURE_Y_XUXV_WL:
-		num_planes = 2;
-		gs->shader = &gr->texture_shader_y_xuxv;
-		break;
-	}
+	wl_array_for_each(evp, &output->views) {
+		if ((*evp)->plane != &compositor->primary_plane ||
+		    (*evp)->occluded)
+			continue;
 
-	ensure_textures(gs, num_planes);
-	for (i = 0; i < num_planes; i++) {
-		attribs[0] = EGL_WAYLAND_PLANE_WL;
-		attribs[1] = i;
-		attribs[2] = EGL_NONE;
-		gs->images[i] = gr->create_image(gr->egl_display,
-						 NULL,
-						 EGL_WAYLAND_BUFFER_WL,
-						 buffer->legacy_buffer,
-						 attribs);
-		if (!gs->images[i]) {
-			weston_log("failed to create img for plane %d\n", i);
+		gs = get_surface_state((*evp)->surface);
+		buffer = gs->buffer_ref.buffer;
+		if (!buffer || gs->buffer_type != BUFFER_TYPE_EGL ||
+		    wl_list_empty(&buffer->release_list))
 			continue;
+
+		if (fd < 0) {
+			sync = gr->create_sync(gr->egl_display,
+					       EGL_SYNC_NATIVE_FENCE_ANDROID,
+					       NULL);
+			if (sync == EGL_NO_SYNC_KHR)
+				return;
+
+			/* The fd exists only once the fence is flushed */
+			glFlush();
+			fd = gr->dup_native_fence_fd(gr->egl_display, sync);
+			gr->destroy_sync(gr->egl_display, sync);
+			if (fd == EGL_NO_NATIVE_FENCE_FD_ANDROID)
+				return;
 		}
-		gs->num_images++;
 
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		gr->image_target_texture_2d(gs->target,
-					    gs->images[i]);
+		weston_buffer_set_release_fence(buffer, dup(fd));
 	}
 
-	gs->pitch = buffer->width;
-	gs->height = buffer->height;
-	gs->buffer_type = BUFFER_TYPE_EGL;
-	gs->y_inverted = buffer->y_inverted;
+	if (fd >= 0)
+		close(fd);
 }
 
 static void
@@ -1253,10 +4386,12 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(es);
 	struct wl_shm_buffer *shm_buffer;
+	struct linux_dmabuf_buffer *dmabuf;
 	EGLint format;
 	int i;
 
 	weston_buffer_reference(&gs->buffer_ref, buffer);
+	gs->content_serial = ++gr->content_serial;
 
 	if (!buffer) {
 		for (i = 0; i < gs->num_images; i++) {
@@ -1264,10 +4399,13 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 			gs->images[i] = NULL;
 		}
 		gs->num_images = 0;
+		atlas_release(gr, gs);
 		glDeleteTextures(gs->num_textures, gs->textures);
 		gs->num_textures = 0;
 		gs->buffer_type = BUFFER_TYPE_NULL;
 		gs->y_inverted = 1;
+		gs->evicted = 0;
+		texture_account(gr, gs);
 		return;
 	}
 
@@ -1275,6 +4413,8 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 
 	if (shm_buffer)
 		gl_renderer_attach_shm(es, buffer, shm_buffer);
+	else if ((dmabuf = linux_dmabuf_buffer_get(buffer->resource)))
+		gl_renderer_attach_dmabuf(es, buffer, dmabuf);
 	else if (gr->query_buffer(gr->egl_display, (void *) buffer->resource,
 				  EGL_TEXTURE_FORMAT, &format))
 		gl_renderer_attach_egl(es, buffer, format);
@@ -1284,6 +4424,12 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		gs->buffer_type = BUFFER_TYPE_NULL;
 		gs->y_inverted = 1;
 	}
+
+	if (gs->buffer_type == BUFFER_TYPE_EGL && es->acquire_fence_fd >= 0 &&
+	    gr->has_native_fence_sync)
+		gl_renderer_wait_fence(gr, es->acquire_fence_fd);
+
+	texture_account(gr, gs);
 }
 
 static void
@@ -1301,9 +4447,36 @@ gl_renderer_surface_set_color(struct weston_surface *surface,
 	gs->shader = &gr->solid_shader;
 }
 
+static void
+gl_renderer_surface_set_thumbnail_size(struct weston_surface *surface,
+				       int32_t width, int32_t height)
+{
+	/* not get_surface_state(), the surface may be on its way out */
+	struct gl_surface_state *gs = surface->renderer_state;
+
+	if (width <= 0 || height <= 0) {
+		if (gs) {
+			thumbnail_release(gs);
+			gs->thumbnail.width = 0;
+			gs->thumbnail.height = 0;
+			texture_account(get_renderer(surface->compositor), gs);
+		}
+		return;
+	}
+
+	gs = get_surface_state(surface);
+	if (!gs)
+		return;
+
+	gs->thumbnail.width = width;
+	gs->thumbnail.height = height;
+	gs->thumbnail.valid = 0;
+}
+
 static void
 surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 {
+	struct gl_geometry_cache *entry, *next;
 	int i;
 
 	wl_list_remove(&gs->surface_destroy_listener.link);
@@ -1311,8 +4484,21 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 
 	gs->surface->renderer_state = NULL;
 
+	wl_list_remove(&gs->lru_link);
+	gr->texture_bytes -= gs->texture_bytes;
+	weston_surface_set_texture_bytes(gs->surface, 0);
+
+	atlas_release(gr, gs);
 	glDeleteTextures(gs->num_textures, gs->textures);
 
+	if (gs->pbo)
+		glDeleteBuffers(1, &gs->pbo);
+
+	thumbnail_release(gs);
+
+	wl_list_for_each_safe(entry, next, &gs->geometry_cache, link)
+		geometry_cache_entry_destroy(entry);
+
 	for (i = 0; i < gs->num_images; i++)
 		gr->destroy_image(gr->egl_display, gs->images[i]);
 
@@ -1365,12 +4551,18 @@ gl_renderer_create_surface(struct weston_surface *surface)
 	 */
 	gs->pitch = 1;
 	gs->y_inverted = 1;
+	gs->atlas_shelf = -1;
+	gs->atlas_x = gs->atlas_y = -1;
 
 	gs->surface = surface;
 
 	pixman_region32_init(&gs->texture_damage);
+	wl_list_init(&gs->geometry_cache);
 	surface->renderer_state = gs;
 
+	gs->last_shown = texture_time_ms();
+	wl_list_insert(&gr->texture_lru, &gs->lru_link);
+
 	gs->surface_destroy_listener.notify =
 		surface_state_handle_surface_destroy;
 	wl_signal_add(&surface->destroy_signal,
@@ -1416,11 +4608,19 @@ static const char fragment_debug[] =
 static const char fragment_brace[] =
 	"}\n";
 
+/* Compares against the key scaled by the output alpha, as the shaders
+ * above leave gl_FragColor premultiplied; half a step either way. */
+static const char fragment_colorkey[] =
+	"  if (all(lessThan(abs(gl_FragColor.rgb - colorkey * gl_FragColor.a),\n"
+	"                   vec3(gl_FragColor.a * 0.5 / 255.0))))\n"
+	"    discard;\n";
+
 static const char texture_fragment_shader_rgba[] =
 	"precision mediump float;\n"
 	"varying vec2 v_texcoord;\n"
 	"uniform sampler2D tex;\n"
 	"uniform float alpha;\n"
+	"uniform vec3 colorkey;\n"
 	"void main()\n"
 	"{\n"
 	"   gl_FragColor = alpha * texture2D(tex, v_texcoord)\n;"
@@ -1431,6 +4631,7 @@ static const char texture_fragment_shader_rgbx[] =
 	"varying vec2 v_texcoord;\n"
 	"uniform sampler2D tex;\n"
 	"uniform float alpha;\n"
+	"uniform vec3 colorkey;\n"
 	"void main()\n"
 	"{\n"
 	"   gl_FragColor.rgb = alpha * texture2D(tex, v_texcoord).rgb\n;"
@@ -1443,6 +4644,7 @@ static const char texture_fragment_shader_egl_external[] =
 	"varying vec2 v_texcoord;\n"
 	"uniform samplerExternalOES tex;\n"
 	"uniform float alpha;\n"
+	"uniform vec3 colorkey;\n"
 	"void main()\n"
 	"{\n"
 	"   gl_FragColor = alpha * texture2D(tex, v_texcoord)\n;"
@@ -1454,6 +4656,7 @@ static const char texture_fragment_shader_y_uv[] =
 	"uniform sampler2D tex1;\n"
 	"varying vec2 v_texcoord;\n"
 	"uniform float alpha;\n"
+	"uniform vec3 colorkey;\n"
 	"void main() {\n"
 	"  float y = 1.16438356 * (texture2D(tex, v_texcoord).x - 0.0625);\n"
 	"  float u = texture2D(tex1, v_texcoord).r - 0.5;\n"
@@ -1468,6 +4671,7 @@ static const char texture_fragment_shader_y_u_v[] =
 	"uniform sampler2D tex2;\n"
 	"varying vec2 v_texcoord;\n"
 	"uniform float alpha;\n"
+	"uniform vec3 colorkey;\n"
 	"void main() {\n"
 	"  float y = 1.16438356 * (texture2D(tex, v_texcoord).x - 0.0625);\n"
 	"  float u = texture2D(tex1, v_texcoord).x - 0.5;\n"
@@ -1481,6 +4685,7 @@ static const char texture_fragment_shader_y_xuxv[] =
 	"uniform sampler2D tex1;\n"
 	"varying vec2 v_texcoord;\n"
 	"uniform float alpha;\n"
+	"uniform vec3 colorkey;\n"
 	"void main() {\n"
 	"  float y = 1.16438356 * (texture2D(tex, v_texcoord).x - 0.0625);\n"
 	"  float u = texture2D(tex1, v_texcoord).g - 0.5;\n"
@@ -1488,6 +4693,53 @@ static const char texture_fragment_shader_y_xuxv[] =
 	FRAGMENT_CONVERT_YUV
 	;
 
+static const char vertex_shader_color[] =
+	"uniform mat4 proj;\n"
+	"attribute vec2 position;\n"
+	"attribute vec4 color;\n"
+	"varying vec4 v_color;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_Position = proj * vec4(position, 0.0, 1.0);\n"
+	"   v_color = color;\n"
+	"}\n";
+
+static const char solid_batch_fragment_shader[] =
+	"precision mediump float;\n"
+	"varying vec4 v_color;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_FragColor = v_color\n;"
+	;
+
+static const char vertex_shader_atlas[] =
+	"uniform mat4 proj;\n"
+	"attribute vec2 position;\n"
+	"attribute vec2 texcoord;\n"
+	"attribute vec2 opacity;\n"
+	"varying vec2 v_texcoord;\n"
+	"varying vec2 v_opacity;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_Position = proj * vec4(position, 0.0, 1.0);\n"
+	"   v_texcoord = texcoord;\n"
+	"   v_opacity = opacity;\n"
+	"}\n";
+
+/* v_opacity.x is the view alpha, v_opacity.y forces texture alpha = 1.0
+ * for the opaque region and RGBX buffers. */
+static const char atlas_batch_fragment_shader[] =
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"varying vec2 v_opacity;\n"
+	"uniform sampler2D tex;\n"
+	"void main()\n"
+	"{\n"
+	"   vec4 c = texture2D(tex, v_texcoord);\n"
+	"   c.a = max(c.a, v_opacity.y);\n"
+	"   gl_FragColor = v_opacity.x * c\n;"
+	;
+
 static const char solid_fragment_shader[] =
 	"precision mediump float;\n"
 	"uniform vec4 color;\n"
@@ -1497,6 +4749,31 @@ static const char solid_fragment_shader[] =
 	"   gl_FragColor = alpha * color\n;"
 	;
 
+/* tex is the output, tex1 the LUT as lut_size slices of lut_size^2
+ * texels stacked vertically.  The texture coordinates need more than
+ * mediump precision for the larger LUTs. */
+static const char color_lut_fragment_shader[] =
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n"
+	"#else\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"uniform sampler2D tex1;\n"
+	"uniform float lut_size;\n"
+	"void main()\n"
+	"{\n"
+	"   float s = lut_size - 1.0;\n"
+	"   vec3 p = texture2D(tex, v_texcoord).rgb * s;\n"
+	"   float z0 = floor(p.b);\n"
+	"   float z1 = min(z0 + 1.0, s);\n"
+	"   vec2 xy = (p.rg + 0.5) / vec2(lut_size, lut_size * lut_size);\n"
+	"   vec3 c0 = texture2D(tex1, xy + vec2(0.0, z0 / lut_size)).rgb;\n"
+	"   vec3 c1 = texture2D(tex1, xy + vec2(0.0, z1 / lut_size)).rgb;\n"
+	"   gl_FragColor = vec4(mix(c0, c1, p.b - z0), 1.0);\n"
+	;
+
 static int
 compile_shader(GLenum type, int count, const char **sources)
 {
@@ -1517,29 +4794,225 @@ compile_shader(GLenum type, int count, const char **sources)
 	return s;
 }
 
+#define PROGRAM_CACHE_MAGIC 0x57504231	/* "WPB1" */
+
+struct program_cache_header {
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	uint32_t length;
+};
+
+/* 64 bit FNV-1a */
+static uint64_t
+hash_string(uint64_t hash, const char *s)
+{
+	if (!hash)
+		hash = 0xcbf29ce484222325ULL;
+
+	for (; s && *s; s++) {
+		hash ^= (unsigned char) *s;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static void
+program_cache_path(struct gl_renderer *gr, uint64_t key,
+		   char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016llx.bin",
+		 gr->program_cache_dir, (unsigned long long) key);
+}
+
+static GLuint
+program_cache_load(struct gl_renderer *gr, uint64_t key)
+{
+	struct program_cache_header header;
+	char path[256];
+	GLuint program;
+	GLint status;
+	void *binary;
+	FILE *fp;
+
+	program_cache_path(gr, key, path, sizeof path);
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != PROGRAM_CACHE_MAGIC || header.key != key ||
+	    header.length == 0 || header.length > 16 * 1024 * 1024) {
+		fclose(fp);
+		return 0;
+	}
+
+	binary = malloc(header.length);
+	if (!binary || fread(binary, header.length, 1, fp) != 1) {
+		free(binary);
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+
+	program = glCreateProgram();
+	gr->program_binary(program, header.format, binary, header.length);
+	free(binary);
+
+	/* A driver update may reject old binaries; fall back to the
+	 * sources and overwrite the entry then. */
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+static void
+program_cache_store(struct gl_renderer *gr, uint64_t key, GLuint program)
+{
+	struct program_cache_header header;
+	char path[256], tmp[264];
+	GLint length = 0;
+	GLenum format;
+	void *binary;
+	FILE *fp;
+	int ok;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0)
+		return;
+
+	binary = malloc(length);
+	if (!binary)
+		return;
+
+	gr->get_program_binary(program, length, &length, &format, binary);
+
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.format = format;
+	header.key = key;
+	header.length = length;
+
+	program_cache_path(gr, key, path, sizeof path);
+	snprintf(tmp, sizeof tmp, "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		free(binary);
+		return;
+	}
+	ok = fwrite(&header, sizeof header, 1, fp) == 1 &&
+		fwrite(binary, length, 1, fp) == 1;
+	if (fclose(fp) != 0)
+		ok = 0;
+	free(binary);
+
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+static void
+program_cache_init(struct gl_renderer *gr, const char *extensions)
+{
+	const char *base;
+	char path[256];
+	int len;
+
+	if (!strstr(extensions, "GL_OES_get_program_binary"))
+		return;
+
+	gr->get_program_binary =
+		(void *) eglGetProcAddress("glGetProgramBinaryOES");
+	gr->program_binary =
+		(void *) eglGetProcAddress("glProgramBinaryOES");
+	if (!gr->get_program_binary || !gr->program_binary)
+		return;
+
+	base = getenv("XDG_CACHE_HOME");
+	if (base && base[0] == '/') {
+		len = snprintf(path, sizeof path, "%s", base);
+	} else {
+		base = getenv("HOME");
+		if (!base)
+			return;
+		len = snprintf(path, sizeof path, "%s/.cache", base);
+	}
+	if (len <= 0 || (size_t) len >= sizeof path - 32)
+		return;
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return;
+	strcat(path, "/weston");
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return;
+
+	gr->program_cache_dir = strdup(path);
+	if (!gr->program_cache_dir)
+		return;
+
+	gr->program_cache_key =
+		hash_string(0, (const char *) glGetString(GL_VENDOR));
+	gr->program_cache_key =
+		hash_string(gr->program_cache_key,
+			    (const char *) glGetString(GL_RENDERER));
+	gr->program_cache_key =
+		hash_string(gr->program_cache_key,
+			    (const char *) glGetString(GL_VERSION));
+	gr->has_program_binary = 1;
+}
+
+static void
+shader_get_locations(struct gl_shader *shader)
+{
+	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
+	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
+	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
+	shader->tex_uniforms[2] = glGetUniformLocation(shader->program, "tex2");
+	shader->alpha_uniform = glGetUniformLocation(shader->program, "alpha");
+	shader->color_uniform = glGetUniformLocation(shader->program, "color");
+	shader->colorkey_uniform =
+		glGetUniformLocation(shader->program, "colorkey");
+	shader->lut_size_uniform =
+		glGetUniformLocation(shader->program, "lut_size");
+}
+
 static int
 shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		   const char *vertex_source, const char *fragment_source)
 {
 	char msg[512];
 	GLint status;
-	int count;
-	const char *sources[3];
+	int count, i;
+	const char *sources[4];
+	uint64_t key = 0;
+
+	count = 0;
+	sources[count++] = fragment_source;
+	if (shader->colorkey)
+		sources[count++] = fragment_colorkey;
+	if (renderer->fragment_shader_debug)
+		sources[count++] = fragment_debug;
+	sources[count++] = fragment_brace;
+
+	if (renderer->has_program_binary) {
+		key = hash_string(renderer->program_cache_key, vertex_source);
+		for (i = 0; i < count; i++)
+			key = hash_string(key, sources[i]);
+
+		shader->program = program_cache_load(renderer, key);
+		if (shader->program) {
+			shader_get_locations(shader);
+			return 0;
+		}
+	}
 
 	shader->vertex_shader =
 		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
 
-	if (renderer->fragment_shader_debug) {
-		sources[0] = fragment_source;
-		sources[1] = fragment_debug;
-		sources[2] = fragment_brace;
-		count = 3;
-	} else {
-		sources[0] = fragment_source;
-		sources[1] = fragment_brace;
-		count = 2;
-	}
-
 	shader->fragment_shader =
 		compile_shader(GL_FRAGMENT_SHADER, count, sources);
 
@@ -1548,6 +5021,8 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 	glAttachShader(shader->program, shader->fragment_shader);
 	glBindAttribLocation(shader->program, 0, "position");
 	glBindAttribLocation(shader->program, 1, "texcoord");
+	glBindAttribLocation(shader->program, 2, "color");
+	glBindAttribLocation(shader->program, 3, "opacity");
 
 	glLinkProgram(shader->program);
 	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
@@ -1557,12 +5032,10 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		return -1;
 	}
 
-	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
-	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
-	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
-	shader->tex_uniforms[2] = glGetUniformLocation(shader->program, "tex2");
-	shader->alpha_uniform = glGetUniformLocation(shader->program, "alpha");
-	shader->color_uniform = glGetUniformLocation(shader->program, "color");
+	if (renderer->has_program_binary)
+		program_cache_store(renderer, key, shader->program);
+
+	shader_get_locations(shader);
 
 	return 0;
 }
@@ -1783,6 +5256,12 @@ gl_renderer_output_create(struct weston_output *output,
 	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
 		pixman_region32_init(&go->buffer_damage[i]);
 
+	wl_list_init(&go->readbacks);
+	wl_list_init(&go->layer_caches);
+	go->readback_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(ec->wl_display),
+					readback_timer_func, output);
+
 	output->renderer_state = go;
 
 	log_egl_config_info(gr->egl_display, egl_config);
@@ -1795,11 +5274,25 @@ gl_renderer_output_destroy(struct weston_output *output)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
+	struct gl_layer_cache *cache, *next;
 	int i;
 
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
+	gpu_timer_fini(output);
+	if (go->gpu_overlay_idle)
+		wl_event_source_remove(go->gpu_overlay_idle);
+
+	readback_process(output, 1);
+	if (go->readback_timer)
+		wl_event_source_remove(go->readback_timer);
+
+	wl_list_for_each_safe(cache, next, &go->layer_caches, link)
+		layer_cache_destroy(cache);
+
+	color_correction_release(go);
+
 	eglDestroySurface(gr->egl_display, go->egl_surface);
 
 	free(go);
@@ -1816,8 +5309,23 @@ gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
 
+	struct dmabuf_image *image, *next;
+	struct egl_buffer_image *egl_image, *egl_next;
+
 	wl_signal_emit(&gr->destroy_signal, gr);
 
+	/* Buffers may outlive the renderer, forget about their images */
+	wl_list_for_each_safe(image, next, &gr->dmabuf_images, link) {
+		linux_dmabuf_buffer_set_user_data(image->dmabuf, NULL, NULL);
+		dmabuf_image_destroy(gr, image);
+	}
+	wl_list_for_each_safe(egl_image, egl_next,
+			      &gr->egl_buffer_images, link)
+		egl_buffer_image_destroy(gr, egl_image);
+
+	if (gr->atlas_texture)
+		glDeleteTextures(1, &gr->atlas_texture);
+
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
@@ -1831,11 +5339,20 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	wl_array_release(&gr->vertices);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->indices);
+	wl_array_release(&gr->clip_boxes);
+	wl_array_release(&gr->clip_pieces);
+	wl_array_release(&gr->batch_vertices);
+	wl_array_release(&gr->batch_indices);
+
+	free(gr->program_cache_dir);
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
 	if (gr->fan_binding)
 		weston_binding_destroy(gr->fan_binding);
+	if (gr->gpu_overlay_binding)
+		weston_binding_destroy(gr->gpu_overlay_binding);
 
 	free(gr);
 }
@@ -1844,6 +5361,7 @@ static int
 gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
+	struct weston_config_section *section;
 	const char *extensions;
 	EGLBoolean ret;
 
@@ -1863,7 +5381,12 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 		return -1;
 	}
 
-	if (strstr(extensions, "EGL_WL_bind_wayland_display"))
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "adaptive-renderer",
+				       &gr->shm_only, 0);
+
+	if (strstr(extensions, "EGL_WL_bind_wayland_display") &&
+	    !gr->shm_only)
 		gr->has_bind_display = 1;
 	if (gr->has_bind_display) {
 		ret = gr->bind_display(gr->egl_display, ec->wl_display);
@@ -1871,14 +5394,24 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 			gr->has_bind_display = 0;
 	}
 
-	if (strstr(extensions, "EGL_EXT_buffer_age"))
+	/* EGL_KHR_partial_update includes the buffer age query, with
+	 * the same token as EGL_EXT_buffer_age. */
+	if (strstr(extensions, "EGL_KHR_partial_update"))
+		gr->set_damage_region =
+			(void *) eglGetProcAddress("eglSetDamageRegionKHR");
+
+	if (strstr(extensions, "EGL_EXT_buffer_age") || gr->set_damage_region)
 		gr->has_egl_buffer_age = 1;
 	else
 		weston_log("warning: EGL_EXT_buffer_age not supported. "
 			   "Performance could be affected.\n");
 
 #ifdef EGL_EXT_swap_buffers_with_damage
-	if (strstr(extensions, "EGL_EXT_swap_buffers_with_damage"))
+	/* The KHR and EXT entry points share the same signature. */
+	if (strstr(extensions, "EGL_KHR_swap_buffers_with_damage"))
+		gr->swap_buffers_with_damage =
+			(void *) eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	else if (strstr(extensions, "EGL_EXT_swap_buffers_with_damage"))
 		gr->swap_buffers_with_damage =
 			(void *) eglGetProcAddress("eglSwapBuffersWithDamageEXT");
 	else
@@ -1891,6 +5424,34 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 		gr->has_configless_context = 1;
 #endif
 
+	if (strstr(extensions, "EGL_KHR_fence_sync")) {
+		gr->create_sync =
+			(void *) eglGetProcAddress("eglCreateSyncKHR");
+		gr->destroy_sync =
+			(void *) eglGetProcAddress("eglDestroySyncKHR");
+		gr->client_wait_sync =
+			(void *) eglGetProcAddress("eglClientWaitSyncKHR");
+		if (!gr->destroy_sync || !gr->client_wait_sync)
+			gr->create_sync = NULL;
+	}
+
+	if (gr->create_sync &&
+	    strstr(extensions, "EGL_ANDROID_native_fence_sync") &&
+	    strstr(extensions, "EGL_KHR_wait_sync")) {
+		gr->wait_sync =
+			(void *) eglGetProcAddress("eglWaitSyncKHR");
+		gr->dup_native_fence_fd =
+			(void *) eglGetProcAddress("eglDupNativeFenceFDANDROID");
+		gr->has_native_fence_sync =
+			gr->wait_sync && gr->dup_native_fence_fd;
+	}
+
+	if (strstr(extensions, "EGL_EXT_image_dma_buf_import") &&
+	    !gr->shm_only)
+		gr->has_dmabuf_import = 1;
+	if (strstr(extensions, "EGL_EXT_image_dma_buf_import_modifiers"))
+		gr->has_dmabuf_import_modifiers = 1;
+
 	return 0;
 }
 
@@ -1927,11 +5488,16 @@ gl_renderer_create(struct weston_compositor *ec, EGLNativeDisplayType display,
 		return -1;
 
 	gr->base.read_pixels = gl_renderer_read_pixels;
+	gr->base.read_pixels_async = gl_renderer_read_pixels_async;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
 	gr->base.surface_set_color = gl_renderer_surface_set_color;
+	gr->base.surface_set_thumbnail_size =
+		gl_renderer_surface_set_thumbnail_size;
 	gr->base.destroy = gl_renderer_destroy;
+	gr->base.import_dmabuf = gl_renderer_import_dmabuf;
+	gr->base.output_set_color_lut = gl_renderer_output_set_color_lut;
 
 	gr->egl_display = eglGetDisplay(display);
 	if (gr->egl_display == EGL_NO_DISPLAY) {
@@ -1957,8 +5523,14 @@ gl_renderer_create(struct weston_compositor *ec, EGLNativeDisplayType display,
 		goto err_egl;
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUV420);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_NV12);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUYV);
 
 	wl_signal_init(&gr->destroy_signal);
+	wl_list_init(&gr->dmabuf_images);
+	wl_list_init(&gr->egl_buffer_images);
+	wl_list_init(&gr->texture_lru);
 
 	return 0;
 
@@ -1978,6 +5550,16 @@ static int
 compile_shaders(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_shader *texture_shaders[] = {
+		&gr->texture_shader_rgba,
+		&gr->texture_shader_rgbx,
+		&gr->texture_shader_egl_external,
+		&gr->texture_shader_y_uv,
+		&gr->texture_shader_y_u_v,
+		&gr->texture_shader_y_xuxv,
+	};
+	struct gl_shader *keyed;
+	unsigned int i;
 
 	gr->texture_shader_rgba.vertex_source = vertex_shader;
 	gr->texture_shader_rgba.fragment_source = texture_fragment_shader_rgba;
@@ -2003,6 +5585,23 @@ compile_shaders(struct weston_compositor *ec)
 	gr->solid_shader.vertex_source = vertex_shader;
 	gr->solid_shader.fragment_source = solid_fragment_shader;
 
+	gr->solid_batch_shader.vertex_source = vertex_shader_color;
+	gr->solid_batch_shader.fragment_source = solid_batch_fragment_shader;
+
+	gr->atlas_batch_shader.vertex_source = vertex_shader_atlas;
+	gr->atlas_batch_shader.fragment_source = atlas_batch_fragment_shader;
+
+	gr->color_lut_shader.vertex_source = vertex_shader;
+	gr->color_lut_shader.fragment_source = color_lut_fragment_shader;
+
+	for (i = 0; i < ARRAY_LENGTH(texture_shaders); i++) {
+		keyed = &gr->keyed_shaders[i];
+		keyed->vertex_source = texture_shaders[i]->vertex_source;
+		keyed->fragment_source = texture_shaders[i]->fragment_source;
+		keyed->colorkey = 1;
+		texture_shaders[i]->keyed = keyed;
+	}
+
 	return 0;
 }
 
@@ -2013,6 +5612,7 @@ fragment_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	struct weston_compositor *ec = data;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct weston_output *output;
+	unsigned int i;
 
 	gr->fragment_shader_debug ^= 1;
 
@@ -2023,6 +5623,10 @@ fragment_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	shader_release(&gr->texture_shader_y_u_v);
 	shader_release(&gr->texture_shader_y_xuxv);
 	shader_release(&gr->solid_shader);
+	shader_release(&gr->solid_batch_shader);
+	shader_release(&gr->atlas_batch_shader);
+	for (i = 0; i < ARRAY_LENGTH(gr->keyed_shaders); i++)
+		shader_release(&gr->keyed_shaders[i]);
 
 	/* Force use_shader() to call glUseProgram(), since we need to use
 	 * the recompiled version of the shader. */
@@ -2043,11 +5647,31 @@ fan_debug_repaint_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+gpu_overlay_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		    void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+
+	if (!gr->has_timer_query) {
+		weston_log("GPU timer queries not supported\n");
+		return;
+	}
+
+	gr->gpu_overlay = !gr->gpu_overlay;
+	weston_compositor_damage_all(compositor);
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
 	struct gl_renderer *gr = get_renderer(ec);
-	const char *extensions;
+	const char *extensions, *version;
+	struct weston_config_section *section;
+	char *timer_mode;
+	uint32_t budget_mb, evict_after;
+	double mipmap_scale;
 	EGLConfig context_config;
 	EGLBoolean ret;
 
@@ -2109,11 +5733,96 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 #ifdef GL_EXT_unpack_subimage
 	if (strstr(extensions, "GL_EXT_unpack_subimage"))
 		gr->has_unpack_subimage = 1;
+
+	if (strstr(extensions, "GL_OES_texture_npot"))
+		gr->has_texture_npot = 1;
 #endif
 
+	version = (const char *) glGetString(GL_VERSION);
+	if ((version && strncmp(version, "OpenGL ES 3", 11) == 0) ||
+	    strstr(extensions, "GL_NV_pixel_buffer_object")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRange");
+		if (!gr->map_buffer_range)
+			gr->map_buffer_range = (void *)
+				eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer = (void *) eglGetProcAddress("glUnmapBuffer");
+		if (!gr->unmap_buffer)
+			gr->unmap_buffer =
+				(void *) eglGetProcAddress("glUnmapBufferOES");
+		if (gr->map_buffer_range && gr->unmap_buffer)
+			gr->has_pbo = 1;
+	}
+
 	if (strstr(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	if (gr->has_dmabuf_import) {
+		static const uint32_t dmabuf_formats[] = {
+			DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,
+			DRM_FORMAT_XBGR8888, DRM_FORMAT_ABGR8888,
+			DRM_FORMAT_RGB565, DRM_FORMAT_YUYV,
+			DRM_FORMAT_NV12, DRM_FORMAT_YUV420
+		};
+
+		if (linux_dmabuf_setup(ec, dmabuf_formats,
+				       ARRAY_LENGTH(dmabuf_formats)) < 0)
+			gr->has_dmabuf_import = 0;
+	}
+
+	if (gr->has_native_fence_sync && !gr->shm_only &&
+	    linux_explicit_synchronization_setup(ec) < 0)
+		gr->has_native_fence_sync = 0;
+
+	/* The atlas relies on sub-image uploads to fill its slots */
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "gl-texture-atlas",
+				       &gr->has_atlas, 0);
+	if (!gr->has_unpack_subimage)
+		gr->has_atlas = 0;
+
+	if (strstr(extensions, "GL_EXT_disjoint_timer_query")) {
+		gr->gen_queries =
+			(void *) eglGetProcAddress("glGenQueriesEXT");
+		gr->delete_queries =
+			(void *) eglGetProcAddress("glDeleteQueriesEXT");
+		gr->begin_query =
+			(void *) eglGetProcAddress("glBeginQueryEXT");
+		gr->end_query = (void *) eglGetProcAddress("glEndQueryEXT");
+		gr->get_query_objectuiv =
+			(void *) eglGetProcAddress("glGetQueryObjectuivEXT");
+		gr->get_query_objectui64v =
+			(void *) eglGetProcAddress("glGetQueryObjectui64vEXT");
+		if (gr->gen_queries && gr->delete_queries &&
+		    gr->begin_query && gr->end_query &&
+		    gr->get_query_objectuiv && gr->get_query_objectui64v)
+			gr->has_timer_query = 1;
+	}
+
+	weston_config_section_get_uint(section, "gl-texture-budget",
+				       &budget_mb, 0);
+	gr->texture_budget = (uint64_t) budget_mb << 20;
+	weston_config_section_get_uint(section, "gl-texture-evict-after",
+				       &evict_after, 60);
+	gr->texture_evict_age = evict_after * 1000;
+
+	weston_config_section_get_double(section, "gl-mipmap-below",
+					 &mipmap_scale, 0.0);
+	gr->mipmap_scale = mipmap_scale > 0.0 && mipmap_scale < 1.0 ?
+		mipmap_scale : 0.0f;
+
+	weston_config_section_get_string(section, "gl-timer-queries",
+					 &timer_mode, "none");
+	if (strcmp(timer_mode, "frame") == 0)
+		gr->gpu_timer_mode = GPU_TIMER_FRAME;
+	else if (strcmp(timer_mode, "view") == 0)
+		gr->gpu_timer_mode = GPU_TIMER_VIEW;
+	else if (strcmp(timer_mode, "none") != 0)
+		weston_log("invalid gl-timer-queries \"%s\"\n", timer_mode);
+	free(timer_mode);
+
+	program_cache_init(gr, extensions);
+
 	glActiveTexture(GL_TEXTURE0);
 
 	if (compile_shaders(ec))
@@ -2127,14 +5836,36 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->gpu_overlay_binding =
+		weston_compositor_add_debug_binding(ec, KEY_G,
+						    gpu_overlay_binding, ec);
 
 	weston_log("GL ES 2 renderer features:\n");
 	weston_log_continue(STAMP_SPACE "read-back format: %s\n",
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm upload through PBO: %s\n",
+			    gr->has_pbo ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "texture atlas: %s\n",
+			    gr->has_atlas ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "GPU timer queries: %s\n",
+			    gr->has_timer_query ? "yes" : "no");
+	if (gr->texture_budget)
+		weston_log_continue(STAMP_SPACE "texture budget: %u MB, "
+				    "evicting after %u s hidden\n",
+				    budget_mb, evict_after);
+	else
+		weston_log_continue(STAMP_SPACE "texture budget: none\n");
+	weston_log_continue(STAMP_SPACE "shader program cache: %s\n",
+			    gr->has_program_binary ?
+			    gr->program_cache_dir : "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "dmabuf import: %s\n",
+			    gr->has_dmabuf_import ?
+			    (gr->has_dmabuf_import_modifiers ?
+			     "yes, with modifiers" : "yes") : "no");
 
 
 	return 0;
@@ -0,0 +1,608 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+
+/* Repaint heatmap: while enabled, every damaged area composited on the
+ * primary plane is counted into a grid of tiles over the output space,
+ * together with the shm bytes uploaded for it, in one second buckets
+ * over a sliding window.  Once a second the tiles are shown as
+ * translucent solid colour views on top of everything, blue for
+ * rarely repainted ones through red for those repainted every frame,
+ * and the clients that damaged the most are logged.
+ *
+ * The overlay is made of compositor surfaces, so it works the same
+ * with every renderer; surfaces without a client, the overlay itself
+ * included, are not counted. */
+
+#define HEATMAP_TILE_SHIFT	6
+#define HEATMAP_TILE_SIZE	(1 << HEATMAP_TILE_SHIFT)
+#define HEATMAP_TOP_CLIENTS	5
+
+struct heatmap_client {
+	struct weston_heatmap *heatmap;
+	struct wl_client *client;
+	struct wl_listener destroy_listener;
+	struct wl_list link;		/* weston_heatmap::clients */
+
+	uint64_t *pixels;		/* per bucket */
+	uint64_t *upload;		/* bytes per bucket */
+};
+
+struct weston_heatmap {
+	struct weston_compositor *compositor;
+	struct wl_listener destroy_listener;
+	struct wl_event_source *timer;
+	int enabled;
+
+	uint32_t seconds;		/* window, one bucket each */
+	uint32_t bucket;
+	uint32_t ticks;
+
+	int32_t x, y;			/* grid origin */
+	int32_t width, height;		/* in tiles */
+	uint32_t *repaints;		/* [tile * seconds + bucket] */
+	uint32_t *upload;		/* bytes, same layout */
+	uint32_t *stamp;		/* per tile, last damage call */
+	uint32_t serial;
+
+	struct weston_layer layer;
+	struct weston_view **views;	/* per tile, NULL until hot */
+
+	struct wl_list clients;		/* heatmap_client::link */
+};
+
+static void
+heatmap_client_destroy(struct heatmap_client *hc)
+{
+	wl_list_remove(&hc->destroy_listener.link);
+	wl_list_remove(&hc->link);
+	free(hc->pixels);
+	free(hc->upload);
+	free(hc);
+}
+
+static void
+heatmap_client_destroyed(struct wl_listener *listener, void *data)
+{
+	struct heatmap_client *hc =
+		container_of(listener, struct heatmap_client,
+			     destroy_listener);
+
+	heatmap_client_destroy(hc);
+}
+
+static struct heatmap_client *
+heatmap_client_get(struct weston_heatmap *heat, struct wl_client *client)
+{
+	struct heatmap_client *hc;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+						  heatmap_client_destroyed);
+	if (listener)
+		return container_of(listener, struct heatmap_client,
+				    destroy_listener);
+
+	hc = zalloc(sizeof *hc);
+	if (hc == NULL)
+		return NULL;
+
+	hc->pixels = calloc(heat->seconds, sizeof *hc->pixels);
+	hc->upload = calloc(heat->seconds, sizeof *hc->upload);
+	if (!hc->pixels || !hc->upload) {
+		free(hc->pixels);
+		free(hc->upload);
+		free(hc);
+		return NULL;
+	}
+
+	hc->heatmap = heat;
+	hc->client = client;
+	hc->destroy_listener.notify = heatmap_client_destroyed;
+	wl_client_add_destroy_listener(client, &hc->destroy_listener);
+	wl_list_insert(&heat->clients, &hc->link);
+
+	return hc;
+}
+
+static uint64_t
+sum64(const uint64_t *v, uint32_t n)
+{
+	uint64_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < n; i++)
+		sum += v[i];
+
+	return sum;
+}
+
+static void
+heatmap_log_clients(struct weston_heatmap *heat)
+{
+	struct heatmap_client *hc, *top[HEATMAP_TOP_CLIENTS];
+	uint64_t pixels, top_pixels[HEATMAP_TOP_CLIENTS];
+	uint32_t seconds = heat->ticks < heat->seconds ?
+		heat->ticks + 1 : heat->seconds;
+	int i, j, n = 0;
+	pid_t pid;
+
+	wl_list_for_each(hc, &heat->clients, link) {
+		pixels = sum64(hc->pixels, heat->seconds);
+		if (pixels == 0)
+			continue;
+
+		for (i = 0; i < n && top_pixels[i] >= pixels; i++)
+			;
+		if (i == HEATMAP_TOP_CLIENTS)
+			continue;
+		if (n < HEATMAP_TOP_CLIENTS)
+			n++;
+		for (j = n - 1; j > i; j--) {
+			top[j] = top[j - 1];
+			top_pixels[j] = top_pixels[j - 1];
+		}
+		top[i] = hc;
+		top_pixels[i] = pixels;
+	}
+
+	weston_log("heatmap: top damage over the last %u s:\n", seconds);
+	for (i = 0; i < n; i++) {
+		wl_client_get_credentials(top[i]->client, &pid, NULL, NULL);
+		weston_log_continue(STAMP_SPACE "pid %d: %llu kpx/s repainted, "
+				    "%llu kB/s uploaded\n", pid,
+				    (unsigned long long)
+				    (top_pixels[i] / seconds / 1000),
+				    (unsigned long long)
+				    (sum64(top[i]->upload, heat->seconds) /
+				     seconds / 1024));
+	}
+	if (n == 0)
+		weston_log_continue(STAMP_SPACE "nothing\n");
+}
+
+static void
+heatmap_hide_view(struct weston_view *view)
+{
+	if (weston_view_is_mapped(view)) {
+		weston_view_unmap(view);
+	} else {
+		wl_list_remove(&view->layer_link);
+		wl_list_init(&view->layer_link);
+	}
+}
+
+static struct weston_view *
+heatmap_create_view(struct weston_heatmap *heat, int i, int j)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	surface = weston_surface_create(heat->compositor);
+	if (surface == NULL)
+		return NULL;
+
+	view = weston_view_create(surface);
+	if (view == NULL) {
+		weston_surface_destroy(surface);
+		return NULL;
+	}
+
+	/* Purely visual, pointer events go to whatever is below. */
+	pixman_region32_fini(&surface->input);
+	pixman_region32_init(&surface->input);
+
+	weston_surface_set_size(surface, HEATMAP_TILE_SIZE,
+				HEATMAP_TILE_SIZE);
+	weston_view_set_position(view,
+				 heat->x + (i << HEATMAP_TILE_SHIFT),
+				 heat->y + (j << HEATMAP_TILE_SHIFT));
+
+	return view;
+}
+
+/* Blue through green to red with the share of frames the tile was
+ * repainted in. */
+static void
+heatmap_color(float heat, float *r, float *g, float *b)
+{
+	if (heat > 1.0f)
+		heat = 1.0f;
+
+	if (heat < 0.5f) {
+		*r = 0.0f;
+		*g = heat * 2.0f;
+		*b = 1.0f - heat * 2.0f;
+	} else {
+		*r = (heat - 0.5f) * 2.0f;
+		*g = 1.0f - (heat - 0.5f) * 2.0f;
+		*b = 0.0f;
+	}
+}
+
+static void
+heatmap_update_overlay(struct weston_heatmap *heat)
+{
+	struct weston_view *view;
+	uint32_t seconds = heat->ticks < heat->seconds ?
+		heat->ticks + 1 : heat->seconds;
+	uint32_t sum, *repaints;
+	float r, g, b;
+	int i, j, k, tile;
+
+	for (j = 0; j < heat->height; j++) {
+		for (i = 0; i < heat->width; i++) {
+			tile = j * heat->width + i;
+			repaints = &heat->repaints[tile * heat->seconds];
+			sum = 0;
+			for (k = 0; k < (int) heat->seconds; k++)
+				sum += repaints[k];
+
+			view = heat->views[tile];
+			if (sum == 0) {
+				if (view)
+					heatmap_hide_view(view);
+				continue;
+			}
+
+			if (view == NULL) {
+				view = heatmap_create_view(heat, i, j);
+				if (view == NULL)
+					continue;
+				heat->views[tile] = view;
+			}
+
+			if (wl_list_empty(&view->layer_link)) {
+				wl_list_insert(&heat->layer.view_list,
+					       &view->layer_link);
+				weston_view_geometry_dirty(view);
+				weston_view_update_transform(view);
+			}
+
+			heatmap_color(sum / (seconds * 60.0f), &r, &g, &b);
+			weston_surface_set_color(view->surface, r, g, b, 0.4);
+			weston_surface_damage(view->surface);
+		}
+	}
+}
+
+static void
+heatmap_fini_grid(struct weston_heatmap *heat)
+{
+	int i;
+
+	if (heat->views) {
+		for (i = 0; i < heat->width * heat->height; i++)
+			if (heat->views[i])
+				weston_surface_destroy(heat->views[i]->surface);
+	}
+
+	free(heat->views);
+	free(heat->repaints);
+	free(heat->upload);
+	free(heat->stamp);
+	heat->views = NULL;
+	heat->repaints = NULL;
+	heat->upload = NULL;
+	heat->stamp = NULL;
+	heat->width = 0;
+	heat->height = 0;
+}
+
+static void
+heatmap_output_extents(struct weston_compositor *ec, pixman_box32_t *box)
+{
+	struct weston_output *output;
+
+	box->x1 = INT32_MAX;
+	box->y1 = INT32_MAX;
+	box->x2 = INT32_MIN;
+	box->y2 = INT32_MIN;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (output->x < box->x1)
+			box->x1 = output->x;
+		if (output->y < box->y1)
+			box->y1 = output->y;
+		if (output->x + output->width > box->x2)
+			box->x2 = output->x + output->width;
+		if (output->y + output->height > box->y2)
+			box->y2 = output->y + output->height;
+	}
+}
+
+static int
+heatmap_init_grid(struct weston_heatmap *heat)
+{
+	pixman_box32_t box;
+	int tiles;
+
+	heatmap_output_extents(heat->compositor, &box);
+	if (box.x1 >= box.x2 || box.y1 >= box.y2)
+		return -1;
+
+	heat->x = box.x1;
+	heat->y = box.y1;
+	heat->width = (box.x2 - box.x1 + HEATMAP_TILE_SIZE - 1) >>
+		HEATMAP_TILE_SHIFT;
+	heat->height = (box.y2 - box.y1 + HEATMAP_TILE_SIZE - 1) >>
+		HEATMAP_TILE_SHIFT;
+	tiles = heat->width * heat->height;
+
+	heat->repaints = calloc(tiles * heat->seconds,
+				sizeof *heat->repaints);
+	heat->upload = calloc(tiles * heat->seconds, sizeof *heat->upload);
+	heat->stamp = calloc(tiles, sizeof *heat->stamp);
+	heat->views = calloc(tiles, sizeof *heat->views);
+	if (!heat->repaints || !heat->upload || !heat->stamp ||
+	    !heat->views) {
+		heatmap_fini_grid(heat);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+heatmap_clear_bucket(struct weston_heatmap *heat, uint32_t bucket)
+{
+	struct heatmap_client *hc;
+	int tile;
+
+	for (tile = 0; tile < heat->width * heat->height; tile++) {
+		heat->repaints[tile * heat->seconds + bucket] = 0;
+		heat->upload[tile * heat->seconds + bucket] = 0;
+	}
+
+	wl_list_for_each(hc, &heat->clients, link) {
+		hc->pixels[bucket] = 0;
+		hc->upload[bucket] = 0;
+	}
+}
+
+static int
+heatmap_timer_handler(void *data)
+{
+	struct weston_heatmap *heat = data;
+	pixman_box32_t box;
+
+	/* Start over when the output layout changed under us. */
+	heatmap_output_extents(heat->compositor, &box);
+	if (box.x1 != heat->x || box.y1 != heat->y ||
+	    (box.x2 - box.x1 + HEATMAP_TILE_SIZE - 1) >> HEATMAP_TILE_SHIFT !=
+	    heat->width ||
+	    (box.y2 - box.y1 + HEATMAP_TILE_SIZE - 1) >> HEATMAP_TILE_SHIFT !=
+	    heat->height) {
+		heatmap_fini_grid(heat);
+		if (heatmap_init_grid(heat) < 0) {
+			heat->enabled = 0;
+			return 0;
+		}
+		heat->ticks = 0;
+	}
+
+	heatmap_update_overlay(heat);
+
+	heat->ticks++;
+	heat->bucket = (heat->bucket + 1) % heat->seconds;
+	if (heat->bucket == 0)
+		heatmap_log_clients(heat);
+	heatmap_clear_bucket(heat, heat->bucket);
+
+	wl_event_source_timer_update(heat->timer, 1000);
+
+	return 0;
+}
+
+/* Called with the damage a view causes on its plane, in global
+ * coordinates, after occluded parts were taken out. */
+WL_EXPORT void
+weston_heatmap_damage(struct weston_view *view, pixman_region32_t *damage)
+{
+	struct weston_compositor *ec = view->surface->compositor;
+	struct weston_heatmap *heat = ec->heatmap;
+	struct weston_buffer *buffer = view->surface->buffer_ref.buffer;
+	struct heatmap_client *hc;
+	struct wl_shm_buffer *shm = NULL;
+	pixman_box32_t *rects, tile_box;
+	uint32_t bpp = 0, pixels, bytes;
+	uint64_t total_pixels = 0, total_bytes = 0;
+	int n, k, i, j, i1, j1, i2, j2, tile, x1, y1, x2, y2;
+
+	if (!heat || !heat->enabled || !heat->repaints ||
+	    !view->surface->resource || view->plane != &ec->primary_plane)
+		return;
+
+	if (buffer)
+		shm = wl_shm_buffer_get(buffer->resource);
+	if (shm && wl_shm_buffer_get_width(shm) > 0)
+		bpp = wl_shm_buffer_get_stride(shm) /
+			wl_shm_buffer_get_width(shm);
+
+	if (++heat->serial == 0)
+		heat->serial = 1;
+
+	rects = pixman_region32_rectangles(damage, &n);
+	for (k = 0; k < n; k++) {
+		i1 = (rects[k].x1 - heat->x) >> HEATMAP_TILE_SHIFT;
+		j1 = (rects[k].y1 - heat->y) >> HEATMAP_TILE_SHIFT;
+		i2 = (rects[k].x2 - 1 - heat->x) >> HEATMAP_TILE_SHIFT;
+		j2 = (rects[k].y2 - 1 - heat->y) >> HEATMAP_TILE_SHIFT;
+		if (i1 < 0)
+			i1 = 0;
+		if (j1 < 0)
+			j1 = 0;
+		if (i2 >= heat->width)
+			i2 = heat->width - 1;
+		if (j2 >= heat->height)
+			j2 = heat->height - 1;
+
+		for (j = j1; j <= j2; j++) {
+			for (i = i1; i <= i2; i++) {
+				tile = j * heat->width + i;
+				tile_box.x1 = heat->x +
+					(i << HEATMAP_TILE_SHIFT);
+				tile_box.y1 = heat->y +
+					(j << HEATMAP_TILE_SHIFT);
+				tile_box.x2 = tile_box.x1 + HEATMAP_TILE_SIZE;
+				tile_box.y2 = tile_box.y1 + HEATMAP_TILE_SIZE;
+
+				x1 = rects[k].x1 > tile_box.x1 ?
+					rects[k].x1 : tile_box.x1;
+				y1 = rects[k].y1 > tile_box.y1 ?
+					rects[k].y1 : tile_box.y1;
+				x2 = MIN(rects[k].x2, tile_box.x2);
+				y2 = MIN(rects[k].y2, tile_box.y2);
+				pixels = (x2 - x1) * (y2 - y1);
+				bytes = pixels * bpp;
+
+				/* One repaint per view and frame, however
+				 * many rectangles hit the tile. */
+				if (heat->stamp[tile] != heat->serial) {
+					heat->stamp[tile] = heat->serial;
+					heat->repaints[tile * heat->seconds +
+						       heat->bucket]++;
+				}
+				heat->upload[tile * heat->seconds +
+					     heat->bucket] += bytes;
+				total_pixels += pixels;
+				total_bytes += bytes;
+			}
+		}
+	}
+
+	if (total_pixels == 0)
+		return;
+
+	hc = heatmap_client_get(heat,
+				wl_resource_get_client(view->surface->resource));
+	if (hc) {
+		hc->pixels[heat->bucket] += total_pixels;
+		hc->upload[heat->bucket] += total_bytes;
+	}
+}
+
+static void
+heatmap_disable(struct weston_heatmap *heat)
+{
+	struct heatmap_client *hc, *next;
+
+	heatmap_log_clients(heat);
+
+	wl_event_source_timer_update(heat->timer, 0);
+	heatmap_fini_grid(heat);
+	wl_list_for_each_safe(hc, next, &heat->clients, link)
+		heatmap_client_destroy(hc);
+	heat->enabled = 0;
+}
+
+static void
+heatmap_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		void *data)
+{
+	struct weston_heatmap *heat = data;
+
+	if (heat->enabled) {
+		heatmap_disable(heat);
+		weston_compositor_damage_all(heat->compositor);
+		return;
+	}
+
+	if (heatmap_init_grid(heat) < 0) {
+		weston_log("heatmap: no outputs or out of memory\n");
+		return;
+	}
+
+	heat->bucket = 0;
+	heat->ticks = 0;
+	heat->enabled = 1;
+	wl_event_source_timer_update(heat->timer, 1000);
+	weston_log("heatmap: counting repaints in %dx%d tiles over %u s\n",
+		   HEATMAP_TILE_SIZE, HEATMAP_TILE_SIZE, heat->seconds);
+}
+
+static void
+heatmap_compositor_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_heatmap *heat =
+		container_of(listener, struct weston_heatmap,
+			     destroy_listener);
+	struct heatmap_client *hc, *next;
+
+	heatmap_fini_grid(heat);
+	wl_list_for_each_safe(hc, next, &heat->clients, link)
+		heatmap_client_destroy(hc);
+	wl_list_remove(&heat->layer.link);
+	wl_event_source_remove(heat->timer);
+
+	heat->compositor->heatmap = NULL;
+	free(heat);
+}
+
+WL_EXPORT void
+weston_heatmap_create(struct weston_compositor *ec)
+{
+	struct weston_heatmap *heat;
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
+
+	heat = zalloc(sizeof *heat);
+	if (heat == NULL)
+		return;
+
+	heat->compositor = ec;
+	wl_list_init(&heat->clients);
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	heat->timer = wl_event_loop_add_timer(loop, heatmap_timer_handler,
+					      heat);
+	if (!heat->timer) {
+		free(heat);
+		return;
+	}
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_uint(section, "heatmap-seconds",
+				       &heat->seconds, 10);
+	if (heat->seconds < 1)
+		heat->seconds = 1;
+	if (heat->seconds > 600)
+		heat->seconds = 600;
+
+	/* Above everything but the cursor. */
+	weston_layer_init(&heat->layer, &ec->cursor_layer.link);
+
+	weston_compositor_add_debug_binding(ec, KEY_H,
+					    heatmap_binding, heat);
+
+	heat->destroy_listener.notify = heatmap_compositor_destroy;
+	wl_signal_add(&ec->destroy_signal, &heat->destroy_listener);
+
+	ec->heatmap = heat;
+}
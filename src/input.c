@@ -30,9 +30,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "../shared/os-compatibility.h"
 #include "compositor.h"
+#include "weston-sdt.h"
 
 static void
 empty_region(pixman_region32_t *region)
@@ -937,6 +941,282 @@ weston_pointer_handle_output_destroy(struct wl_listener *listener, void *data)
 	weston_pointer_move(pointer, fx, fy);
 }
 
+static void
+process_touch(struct weston_seat *seat, uint32_t time, int touch_id,
+	      wl_fixed_t x, wl_fixed_t y, int touch_type);
+
+/* Touch resampling aims this many ms before the presentation, so that
+ * it mostly interpolates between real samples */
+#define TOUCH_RESAMPLE_LATENCY	5
+
+/* and extrapolates at most this much past the newest sample, on top
+ * of touch_prediction */
+#define TOUCH_EXTRAPOLATE_MAX	8
+
+static struct weston_touch_history *
+touch_history_get(struct weston_touch *touch, int32_t id, int create)
+{
+	struct weston_touch_history *history, *unused = NULL;
+	int i;
+
+	for (i = 0; i < WESTON_COALESCE_TOUCH_POINTS; i++) {
+		history = &touch->history[i];
+		if (history->count > 0 && history->id == id)
+			return history;
+		if (history->count == 0 && !unused)
+			unused = history;
+	}
+
+	if (create && unused)
+		unused->id = id;
+
+	return create ? unused : NULL;
+}
+
+static void
+touch_history_add(struct weston_touch *touch, int32_t id, uint32_t time,
+		  wl_fixed_t x, wl_fixed_t y)
+{
+	struct weston_touch_history *history;
+
+	history = touch_history_get(touch, id, 1);
+	if (!history)
+		return;
+
+	/* Events of the same ms only leave the newest position, and
+	 * ones going back in time start the history over */
+	if (history->count > 0 &&
+	    (int32_t) (time - history->sample[0].time) <= 0) {
+		if (time != history->sample[0].time)
+			history->count = 0;
+		else
+			history->count--;
+	}
+
+	memmove(&history->sample[1], &history->sample[0],
+		(WESTON_TOUCH_HISTORY_SIZE - 1) * sizeof history->sample[0]);
+	history->sample[0].time = time;
+	history->sample[0].x = x;
+	history->sample[0].y = y;
+	if (history->count < WESTON_TOUCH_HISTORY_SIZE)
+		history->count++;
+}
+
+static void
+touch_history_remove(struct weston_touch *touch, int32_t id)
+{
+	struct weston_touch_history *history;
+
+	history = touch_history_get(touch, id, 0);
+	if (history)
+		history->count = 0;
+}
+
+/* When the frame showing motion delivered now should be presented on
+ * the output under x, y, in ms of weston_compositor_get_time() like the
+ * input events.  The next repaint makes the first vblank after it, or
+ * the one after that when a frame is still waiting for its vblank. */
+static int
+touch_presentation_time(struct weston_compositor *ec,
+			wl_fixed_t x, wl_fixed_t y, uint32_t *time)
+{
+	struct weston_output *output = NULL, *o;
+	struct timespec ts;
+	uint32_t period, elapsed, ahead;
+
+	wl_list_for_each(o, &ec->output_list, link) {
+		if (pixman_region32_contains_point(&o->region,
+						   wl_fixed_to_int(x),
+						   wl_fixed_to_int(y), NULL)) {
+			output = o;
+			break;
+		}
+	}
+	if (!output)
+		return -1;
+
+	if (!output->current_mode || output->current_mode->refresh <= 0)
+		return -1;
+
+	/* refresh is in mHz, period and the rest in us */
+	period = 1000000000 / output->current_mode->refresh;
+
+	clock_gettime(ec->presentation_clock, &ts);
+	elapsed = ((uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) -
+		   output->frame_time) * 1000 + ts.tv_nsec / 1000 % 1000;
+
+	/* An idle output starts its repaint loop first */
+	if (elapsed > 1000000)
+		ahead = 2 * period;
+	else
+		ahead = period - elapsed % period;
+
+	if (output->repaint_scheduled && !output->repaint_needed)
+		ahead += period;
+
+	*time = weston_compositor_get_time() + ahead / 1000;
+
+	return 0;
+}
+
+static void
+touch_resample(struct weston_seat *seat, int32_t id,
+	       wl_fixed_t *x, wl_fixed_t *y)
+{
+	struct weston_compositor *ec = seat->compositor;
+	struct weston_touch_history *history;
+	uint32_t target;
+	int32_t ahead, limit;
+	double t;
+	int i;
+
+	history = touch_history_get(seat->touch, id, 0);
+	if (!history || history->count < 2)
+		return;
+
+	if (touch_presentation_time(ec, *x, *y, &target) < 0)
+		return;
+	target += ec->touch_prediction - TOUCH_RESAMPLE_LATENCY;
+
+	/* Backends stamping events with another clock get raw motion */
+	ahead = target - history->sample[0].time;
+	if (ahead < -1000 || ahead > 1000)
+		return;
+
+	/* Extrapolate from the newest two samples, or interpolate
+	 * between the two around the target */
+	if (ahead > 0) {
+		limit = TOUCH_EXTRAPOLATE_MAX + ec->touch_prediction;
+		if (ahead > limit)
+			target = history->sample[0].time + limit;
+		i = 1;
+	} else {
+		for (i = 1; i < history->count; i++)
+			if ((int32_t) (target - history->sample[i].time) >= 0)
+				break;
+		if (i == history->count)
+			return;
+	}
+
+	/* Sample times are strictly increasing, see touch_history_add() */
+	t = (double) (int32_t) (target - history->sample[i].time) /
+		(history->sample[i - 1].time - history->sample[i].time);
+
+	*x = history->sample[i].x + wl_fixed_from_double(t *
+		wl_fixed_to_double(history->sample[i - 1].x -
+				   history->sample[i].x));
+	*y = history->sample[i].y + wl_fixed_from_double(t *
+		wl_fixed_to_double(history->sample[i - 1].y -
+				   history->sample[i].y));
+}
+
+/* With motion-coalescing, motion events only update the position a
+ * seat's pointer and touch points are headed for.  The grabs and clients
+ * see one motion per pointer and touch point once the events being
+ * dispatched are handled, which while repainting is once per frame.
+ * Any other event delivers the pending motion first, so buttons, keys,
+ * touch down and up and bindings still happen where they should. */
+static void
+seat_flush_motion(struct weston_seat *seat)
+{
+	struct weston_pointer *pointer = seat->pointer;
+	struct weston_touch *touch = seat->touch;
+	wl_fixed_t x, y;
+	int i, count;
+
+	if (seat->coalesce.pointer) {
+		seat->coalesce.pointer = 0;
+		pointer->grab->interface->motion(pointer->grab,
+						 seat->coalesce.pointer_time,
+						 seat->coalesce.x,
+						 seat->coalesce.y);
+	}
+
+	count = seat->coalesce.touch_count;
+	seat->coalesce.touch_count = 0;
+	for (i = 0; i < count; i++) {
+		x = seat->coalesce.touch[i].x;
+		y = seat->coalesce.touch[i].y;
+		if (seat->compositor->touch_resampling)
+			touch_resample(seat, seat->coalesce.touch[i].id,
+				       &x, &y);
+
+		process_touch(seat, seat->coalesce.touch[i].time,
+			      seat->coalesce.touch[i].id, x, y,
+			      WL_TOUCH_MOTION);
+	}
+
+	if (seat->coalesce.touch_frame) {
+		seat->coalesce.touch_frame = 0;
+		touch->grab->interface->frame(touch->grab);
+	}
+}
+
+static void
+seat_flush_motion_idle(void *data)
+{
+	struct weston_seat *seat = data;
+
+	seat->coalesce.idle = NULL;
+	seat_flush_motion(seat);
+}
+
+static void
+seat_schedule_motion_flush(struct weston_seat *seat)
+{
+	struct wl_event_loop *loop;
+
+	if (seat->coalesce.idle)
+		return;
+
+	loop = wl_display_get_event_loop(seat->compositor->wl_display);
+	seat->coalesce.idle =
+		wl_event_loop_add_idle(loop, seat_flush_motion_idle, seat);
+}
+
+static void
+seat_queue_pointer_motion(struct weston_seat *seat, uint32_t time,
+			  wl_fixed_t x, wl_fixed_t y)
+{
+	/* Clamp every step, like moving for each event would */
+	weston_pointer_clamp(seat->pointer, &x, &y);
+
+	seat->coalesce.pointer = 1;
+	seat->coalesce.pointer_time = time;
+	seat->coalesce.x = x;
+	seat->coalesce.y = y;
+
+	seat_schedule_motion_flush(seat);
+}
+
+static void
+seat_queue_touch_motion(struct weston_seat *seat, uint32_t time,
+			int touch_id, wl_fixed_t x, wl_fixed_t y)
+{
+	int i;
+
+	for (i = 0; i < seat->coalesce.touch_count; i++)
+		if (seat->coalesce.touch[i].id == touch_id)
+			break;
+
+	if (i == WESTON_COALESCE_TOUCH_POINTS) {
+		seat_flush_motion(seat);
+		i = 0;
+	}
+	if (i == seat->coalesce.touch_count)
+		seat->coalesce.touch_count++;
+
+	seat->coalesce.touch[i].id = touch_id;
+	seat->coalesce.touch[i].time = time;
+	seat->coalesce.touch[i].x = x;
+	seat->coalesce.touch[i].y = y;
+
+	if (seat->compositor->touch_resampling)
+		touch_history_add(seat->touch, touch_id, time, x, y);
+
+	seat_schedule_motion_flush(seat);
+}
+
 WL_EXPORT void
 notify_motion(struct weston_seat *seat,
 	      uint32_t time, wl_fixed_t dx, wl_fixed_t dy)
@@ -944,7 +1224,22 @@ notify_motion(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
+	WESTON_TRACE4(notify_motion, seat, time, dx, dy);
 	weston_compositor_wake(ec);
+	weston_latency_input(ec, time);
+
+	if (ec->coalesce_motion) {
+		if (seat->coalesce.pointer)
+			seat_queue_pointer_motion(seat, time,
+						  seat->coalesce.x + dx,
+						  seat->coalesce.y + dy);
+		else
+			seat_queue_pointer_motion(seat, time,
+						  pointer->x + dx,
+						  pointer->y + dy);
+		return;
+	}
+
 	pointer->grab->interface->motion(pointer->grab, time, pointer->x + dx, pointer->y + dy);
 }
 
@@ -991,7 +1286,15 @@ notify_motion_absolute(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
+	WESTON_TRACE4(notify_motion_absolute, seat, time, x, y);
 	weston_compositor_wake(ec);
+	weston_latency_input(ec, time);
+
+	if (ec->coalesce_motion) {
+		seat_queue_pointer_motion(seat, time, x, y);
+		return;
+	}
+
 	pointer->grab->interface->motion(pointer->grab, time, x, y);
 }
 
@@ -1016,6 +1319,10 @@ notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
+	WESTON_TRACE4(notify_button, seat, time, button, state);
+	weston_latency_input(compositor, time);
+	seat_flush_motion(seat);
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		if (pointer->button_count == 0) {
@@ -1049,7 +1356,10 @@ notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
 	struct wl_resource *resource;
 	struct wl_list *resource_list;
 
+	WESTON_TRACE4(notify_axis, seat, time, axis, value);
 	weston_compositor_wake(compositor);
+	weston_latency_input(compositor, time);
+	seat_flush_motion(seat);
 
 	if (!value)
 		return;
@@ -1267,6 +1577,12 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t *k, *end;
 
+	WESTON_TRACE4(notify_key, seat, time, key, state);
+	weston_latency_input(compositor, time);
+
+	/* Bindings like Super + button drag look at the pointer */
+	seat_flush_motion(seat);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		keyboard->grab_key = key;
@@ -1315,6 +1631,8 @@ WL_EXPORT void
 notify_pointer_focus(struct weston_seat *seat, struct weston_output *output,
 		     wl_fixed_t x, wl_fixed_t y)
 {
+	seat_flush_motion(seat);
+
 	if (output) {
 		weston_pointer_move(seat->pointer, x, y);
 	} else {
@@ -1374,6 +1692,8 @@ notify_keyboard_focus_out(struct weston_seat *seat)
 	struct weston_keyboard *keyboard = seat->keyboard;
 	uint32_t *k, serial;
 
+	seat_flush_motion(seat);
+
 	serial = wl_display_next_serial(compositor->wl_display);
 	wl_array_for_each(k, &keyboard->keys) {
 		weston_compositor_idle_release(compositor);
@@ -1446,6 +1766,37 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
              wl_fixed_t x, wl_fixed_t y, int touch_type)
 {
 	struct weston_compositor *ec = seat->compositor;
+
+	WESTON_TRACE4(notify_touch, seat, time, touch_id, touch_type);
+	weston_latency_input(ec, time);
+
+	/* Resampling works on the motion held back until the flush */
+	if (ec->coalesce_motion || ec->touch_resampling) {
+		if (touch_type == WL_TOUCH_MOTION) {
+			seat_queue_touch_motion(seat, time, touch_id, x, y);
+			return;
+		}
+
+		seat_flush_motion(seat);
+	}
+
+	if (ec->touch_resampling) {
+		if (touch_type == WL_TOUCH_DOWN) {
+			touch_history_remove(seat->touch, touch_id);
+			touch_history_add(seat->touch, touch_id, time, x, y);
+		} else if (touch_type == WL_TOUCH_UP) {
+			touch_history_remove(seat->touch, touch_id);
+		}
+	}
+
+	process_touch(seat, time, touch_id, x, y, touch_type);
+}
+
+static void
+process_touch(struct weston_seat *seat, uint32_t time, int touch_id,
+	      wl_fixed_t x, wl_fixed_t y, int touch_type)
+{
+	struct weston_compositor *ec = seat->compositor;
 	struct weston_touch *touch = seat->touch;
 	struct weston_touch_grab *grab = touch->grab;
 	struct weston_view *ev;
@@ -1528,6 +1879,12 @@ notify_touch_frame(struct weston_seat *seat)
 	struct weston_touch *touch = seat->touch;
 	struct weston_touch_grab *grab = touch->grab;
 
+	/* One frame for all the motion it ends, once that is sent */
+	if (seat->coalesce.touch_count > 0) {
+		seat->coalesce.touch_frame = 1;
+		return;
+	}
+
 	grab->interface->frame(grab);
 }
 
@@ -1866,8 +2223,6 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 	if (xkb_info->keymap)
 		xkb_map_unref(xkb_info->keymap);
 
-	if (xkb_info->keymap_area)
-		munmap(xkb_info->keymap_area, xkb_info->keymap_size);
 	if (xkb_info->keymap_fd >= 0)
 		close(xkb_info->keymap_fd);
 	free(xkb_info);
@@ -1934,28 +2289,19 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 	}
 	xkb_info->keymap_size = strlen(keymap_str) + 1;
 
-	xkb_info->keymap_fd = os_create_anonymous_file(xkb_info->keymap_size);
+	/* Every client of every seat sharing this keymap gets this one
+	 * fd, so it must not be writable by any of them */
+	xkb_info->keymap_fd = os_create_sealed_file(keymap_str,
+						    xkb_info->keymap_size);
 	if (xkb_info->keymap_fd < 0) {
 		weston_log("creating a keymap file for %lu bytes failed: %m\n",
 			(unsigned long) xkb_info->keymap_size);
 		goto err_keymap_str;
 	}
-
-	xkb_info->keymap_area = mmap(NULL, xkb_info->keymap_size,
-				     PROT_READ | PROT_WRITE,
-				     MAP_SHARED, xkb_info->keymap_fd, 0);
-	if (xkb_info->keymap_area == MAP_FAILED) {
-		weston_log("failed to mmap() %lu bytes\n",
-			(unsigned long) xkb_info->keymap_size);
-		goto err_dev_zero;
-	}
-	strcpy(xkb_info->keymap_area, keymap_str);
 	free(keymap_str);
 
 	return xkb_info;
 
-err_dev_zero:
-	close(xkb_info->keymap_fd);
 err_keymap_str:
 	free(keymap_str);
 err_keymap:
@@ -1964,17 +2310,180 @@ err_keymap:
 	return NULL;
 }
 
+/*
+ * Compiling a keymap from RMLVO names walks and parses a good part of
+ * xkeyboard-config and takes tens of milliseconds; parsing the serialized
+ * result back is several times cheaper.  The global keymap is therefore
+ * cached in $XDG_CACHE_HOME/weston, keyed on the names and the age of the
+ * rules file, so that a change to either compiles afresh.
+ */
+#define KEYMAP_CACHE_MAGIC "weston-keymap-cache 1"
+
+static char *
+keymap_cache_key(struct weston_compositor *ec)
+{
+	const struct xkb_rule_names *names = &ec->xkb_names;
+	const char *root;
+	char *path, *key;
+	struct stat st;
+	long mtime = 0;
+
+	root = getenv("XKB_CONFIG_ROOT");
+	if (!root)
+		root = "/usr/share/X11/xkb";
+	if (asprintf(&path, "%s/rules/%s", root, names->rules) < 0)
+		return NULL;
+	if (stat(path, &st) == 0)
+		mtime = st.st_mtime;
+	free(path);
+
+	if (asprintf(&key, "%s %s|%s|%s|%s|%s|%ld\n", KEYMAP_CACHE_MAGIC,
+		     names->rules, names->model, names->layout,
+		     names->variant ? names->variant : "",
+		     names->options ? names->options : "", mtime) < 0)
+		return NULL;
+
+	return key;
+}
+
+static char *
+keymap_cache_path(const char *key)
+{
+	const char *dir, *home;
+	char *weston_dir, *path;
+	uint32_t hash = 2166136261u;
+	const char *p;
+	int len;
+
+	/* FNV-1a, only to keep different names in different files */
+	for (p = key; *p; p++)
+		hash = (hash ^ (unsigned char) *p) * 16777619u;
+
+	dir = getenv("XDG_CACHE_HOME");
+	home = getenv("HOME");
+	if (dir)
+		len = asprintf(&weston_dir, "%s/weston", dir);
+	else if (home)
+		len = asprintf(&weston_dir, "%s/.cache/weston", home);
+	else
+		return NULL;
+	if (len < 0)
+		return NULL;
+
+	if (mkdir(weston_dir, 0700) < 0 && errno != EEXIST) {
+		free(weston_dir);
+		return NULL;
+	}
+
+	len = asprintf(&path, "%s/keymap-%08x.xkb", weston_dir, hash);
+	free(weston_dir);
+
+	return len < 0 ? NULL : path;
+}
+
+static struct xkb_keymap *
+keymap_cache_load(struct weston_compositor *ec, const char *path,
+		  const char *key)
+{
+	struct xkb_keymap *keymap;
+	size_t key_len = strlen(key);
+	struct stat st;
+	char *data;
+	FILE *fp;
+
+	fp = fopen(path, "re");
+	if (!fp)
+		return NULL;
+
+	if (fstat(fileno(fp), &st) < 0 || (size_t) st.st_size <= key_len) {
+		fclose(fp);
+		return NULL;
+	}
+
+	data = malloc(st.st_size + 1);
+	if (!data || fread(data, 1, st.st_size, fp) != (size_t) st.st_size) {
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	data[st.st_size] = '\0';
+
+	keymap = NULL;
+	if (memcmp(data, key, key_len) == 0)
+		keymap = xkb_keymap_new_from_string(ec->xkb_context,
+						    data + key_len,
+						    XKB_KEYMAP_FORMAT_TEXT_V1,
+						    0);
+	free(data);
+
+	return keymap;
+}
+
+static void
+keymap_cache_store(struct xkb_keymap *keymap, const char *path,
+		   const char *key)
+{
+	char *keymap_str, *tmp;
+	FILE *fp;
+	int ret;
+
+	keymap_str = xkb_keymap_get_as_string(keymap,
+					      XKB_KEYMAP_FORMAT_TEXT_V1);
+	if (!keymap_str)
+		return;
+
+	/* Written aside and renamed over, so that a compositor starting
+	 * up meanwhile never reads half a keymap */
+	if (asprintf(&tmp, "%s.%d", path, (int) getpid()) < 0) {
+		free(keymap_str);
+		return;
+	}
+
+	fp = fopen(tmp, "we");
+	if (fp) {
+		ret = fputs(key, fp) >= 0 && fputs(keymap_str, fp) >= 0;
+		if (fclose(fp) == 0 && ret && rename(tmp, path) == 0)
+			tmp[0] = '\0';
+	}
+	if (tmp[0])
+		unlink(tmp);
+
+	free(tmp);
+	free(keymap_str);
+}
+
 static int
 weston_compositor_build_global_keymap(struct weston_compositor *ec)
 {
-	struct xkb_keymap *keymap;
+	struct weston_config_section *s;
+	struct xkb_keymap *keymap = NULL;
+	char *key = NULL, *path = NULL;
+	int use_cache;
 
 	if (ec->xkb_info != NULL)
 		return 0;
 
-	keymap = xkb_map_new_from_names(ec->xkb_context,
-					&ec->xkb_names,
-					0);
+	s = weston_config_get_section(ec->config, "keyboard", NULL, NULL);
+	weston_config_section_get_bool(s, "keymap_cache", &use_cache, 1);
+	if (use_cache) {
+		key = keymap_cache_key(ec);
+		if (key)
+			path = keymap_cache_path(key);
+		if (path)
+			keymap = keymap_cache_load(ec, path, key);
+	}
+
+	if (keymap == NULL) {
+		keymap = xkb_map_new_from_names(ec->xkb_context,
+						&ec->xkb_names,
+						0);
+		if (keymap && path)
+			keymap_cache_store(keymap, path, key);
+	}
+	free(path);
+	free(key);
+
 	if (keymap == NULL) {
 		weston_log("failed to compile global XKB keymap\n");
 		weston_log("  tried rules %s, model %s, layout %s, variant %s, "
@@ -2146,6 +2655,7 @@ weston_seat_release_pointer(struct weston_seat *seat)
 
 	seat->pointer_device_count--;
 	if (seat->pointer_device_count == 0) {
+		seat->coalesce.pointer = 0;
 		weston_pointer_set_focus(pointer, NULL,
 					 wl_fixed_from_int(0),
 					 wl_fixed_from_int(0));
@@ -2187,6 +2697,9 @@ weston_seat_release_touch(struct weston_seat *seat)
 {
 	seat->touch_device_count--;
 	if (seat->touch_device_count == 0) {
+		seat->coalesce.touch_count = 0;
+		seat->coalesce.touch_frame = 0;
+		memset(seat->touch->history, 0, sizeof seat->touch->history);
 		weston_touch_set_focus(seat, NULL);
 		weston_touch_cancel_grab(seat->touch);
 		weston_touch_reset_state(seat->touch);
@@ -2226,6 +2739,9 @@ weston_seat_release(struct weston_seat *seat)
 {
 	wl_list_remove(&seat->link);
 
+	if (seat->coalesce.idle)
+		wl_event_source_remove(seat->coalesce.idle);
+
 	if (seat->saved_kbd_focus)
 		wl_list_remove(&seat->saved_kbd_focus_listener.link);
 
@@ -0,0 +1,343 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+
+/* Event-to-photon latency: the age of the oldest input event a frame
+ * could reflect, at the moment that frame hit the screen.
+ *
+ * Input is stamped by the backends in weston_compositor_get_time() ms,
+ * presentation in compositor->presentation_clock, so every sample is
+ * taken as "input age now" minus "presentation age now" rather than by
+ * subtracting timestamps of different clocks. */
+
+#define LATENCY_BUCKETS		100	/* 1 ms each, the last one open */
+#define LATENCY_MAX_AGE		10000	/* ms, anything older is bogus */
+#define LATENCY_CLAIM_TIMEOUT	250	/* ms, input that caused no repaint */
+
+struct latency_histogram {
+	uint32_t count;
+	uint64_t sum;
+	uint32_t max;
+	uint32_t bucket[LATENCY_BUCKETS];
+};
+
+struct weston_output_latency {
+	struct weston_output *output;
+	struct wl_listener destroy_listener;
+
+	int pending;		/* input waiting for the next repaint */
+	uint32_t pending_time;
+	int in_flight;		/* input in the frame being presented */
+	uint32_t input_time;
+	uint32_t repaint_time;
+
+	struct latency_histogram total;		/* input to present */
+	struct latency_histogram pipeline;	/* repaint to present */
+	struct latency_histogram delivery;	/* present to flip event */
+};
+
+struct weston_latency {
+	struct weston_compositor *compositor;
+	struct wl_listener destroy_listener;
+	int enabled;
+
+	int pending;		/* input no repaint has claimed yet */
+	uint32_t pending_time;
+};
+
+static void
+histogram_add(struct latency_histogram *h, int32_t ms)
+{
+	if (ms < 0)
+		ms = 0;
+
+	h->count++;
+	h->sum += ms;
+	if ((uint32_t) ms > h->max)
+		h->max = ms;
+	h->bucket[ms < LATENCY_BUCKETS ? ms : LATENCY_BUCKETS - 1]++;
+}
+
+static uint32_t
+histogram_percentile(const struct latency_histogram *h, uint32_t percent)
+{
+	uint32_t target = (h->count * (uint64_t) percent + 99) / 100;
+	uint32_t seen = 0;
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+		seen += h->bucket[i];
+		if (seen >= target)
+			return i;
+	}
+
+	return h->max;
+}
+
+static void
+output_latency_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_output_latency *latency =
+		container_of(listener, struct weston_output_latency,
+			     destroy_listener);
+
+	latency->output->latency = NULL;
+	wl_list_remove(&latency->destroy_listener.link);
+	free(latency);
+}
+
+static struct weston_output_latency *
+output_latency_get(struct weston_output *output)
+{
+	struct weston_latency *latency = output->compositor->latency;
+	struct weston_output_latency *ol;
+
+	if (!latency || !latency->enabled)
+		return NULL;
+
+	if (output->latency)
+		return output->latency;
+
+	ol = zalloc(sizeof *ol);
+	if (!ol)
+		return NULL;
+
+	ol->output = output;
+	ol->destroy_listener.notify = output_latency_destroy;
+	wl_signal_add(&output->destroy_signal, &ol->destroy_listener);
+	output->latency = ol;
+
+	return ol;
+}
+
+/* Called for every input event handed to the seats, with the kernel
+ * timestamp of the event; keeps the oldest one not yet claimed by a
+ * repaint. */
+WL_EXPORT void
+weston_latency_input(struct weston_compositor *ec, uint32_t time)
+{
+	struct weston_latency *latency = ec->latency;
+	int32_t age;
+
+	if (!latency || !latency->enabled || latency->pending)
+		return;
+
+	/* Backends stamping events with another clock are not measured */
+	age = weston_compositor_get_time() - time;
+	if (age < 0 || age > LATENCY_MAX_AGE)
+		return;
+
+	latency->pending = 1;
+	latency->pending_time = time;
+}
+
+/* The first output scheduled after an input event owns it. */
+WL_EXPORT void
+weston_latency_schedule_repaint(struct weston_output *output)
+{
+	struct weston_latency *latency = output->compositor->latency;
+	struct weston_output_latency *ol;
+	uint32_t age;
+
+	if (!latency || !latency->pending)
+		return;
+
+	/* Input like a modifier press doesn't repaint anything; don't pin
+	 * it on whatever happens to repaint next. */
+	age = weston_compositor_get_time() - latency->pending_time;
+	if (age > LATENCY_CLAIM_TIMEOUT) {
+		latency->pending = 0;
+		return;
+	}
+
+	ol = output_latency_get(output);
+	if (!ol)
+		return;
+
+	if (!ol->pending ||
+	    (int32_t) (latency->pending_time - ol->pending_time) < 0) {
+		ol->pending = 1;
+		ol->pending_time = latency->pending_time;
+	}
+	latency->pending = 0;
+}
+
+WL_EXPORT void
+weston_latency_repaint(struct weston_output *output)
+{
+	struct weston_output_latency *ol = output_latency_get(output);
+
+	if (!ol)
+		return;
+
+	ol->repaint_time = weston_compositor_get_time();
+	ol->in_flight = ol->pending;
+	ol->input_time = ol->pending_time;
+	ol->pending = 0;
+}
+
+/* Called from weston_output_finish_frame(), which the DRM backend runs
+ * from its page flip handler, with the presentation time of the frame. */
+WL_EXPORT void
+weston_latency_frame(struct weston_output *output, uint32_t msecs)
+{
+	struct weston_output_latency *ol = output->latency;
+	struct timespec ts;
+	uint32_t now;
+	int32_t presented;
+
+	if (!ol || !ol->repaint_time)
+		return;
+
+	clock_gettime(output->compositor->presentation_clock, &ts);
+	presented = (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) -
+		msecs;
+	if (presented < 0 || presented > LATENCY_MAX_AGE) {
+		ol->in_flight = 0;
+		ol->repaint_time = 0;
+		return;
+	}
+
+	now = weston_compositor_get_time();
+	histogram_add(&ol->delivery, presented);
+	histogram_add(&ol->pipeline, now - ol->repaint_time - presented);
+	if (ol->in_flight)
+		histogram_add(&ol->total, now - ol->input_time - presented);
+
+	ol->in_flight = 0;
+	ol->repaint_time = 0;
+}
+
+static void
+histogram_log(const char *name, const struct latency_histogram *h)
+{
+	uint32_t i, first, last;
+
+	if (h->count == 0) {
+		weston_log_continue(STAMP_SPACE "%-9s no samples\n", name);
+		return;
+	}
+
+	weston_log_continue(STAMP_SPACE "%-9s %u samples, avg %.1f ms, "
+			    "p50 %u, p95 %u, p99 %u, max %u ms\n",
+			    name, h->count, (double) h->sum / h->count,
+			    histogram_percentile(h, 50),
+			    histogram_percentile(h, 95),
+			    histogram_percentile(h, 99), h->max);
+
+	for (first = 0; !h->bucket[first]; first++)
+		;
+	for (last = LATENCY_BUCKETS - 1; !h->bucket[last]; last--)
+		;
+	for (i = first; i <= last; i++)
+		weston_log_continue(STAMP_SPACE "  %3u%s ms %u\n", i,
+				    i == LATENCY_BUCKETS - 1 ? "+" : " ",
+				    h->bucket[i]);
+}
+
+static void
+latency_dump(struct weston_latency *latency)
+{
+	struct weston_compositor *ec = latency->compositor;
+	struct weston_output_latency *ol;
+	struct weston_output *output;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		ol = output->latency;
+		if (!ol)
+			continue;
+
+		weston_log("latency of output %s:\n",
+			   output->name ? output->name : "(unnamed)");
+		histogram_log("input", &ol->total);
+		histogram_log("repaint", &ol->pipeline);
+		histogram_log("flip", &ol->delivery);
+
+		ol->total = (struct latency_histogram) { 0 };
+		ol->pipeline = (struct latency_histogram) { 0 };
+		ol->delivery = (struct latency_histogram) { 0 };
+	}
+}
+
+static void
+latency_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		void *data)
+{
+	struct weston_latency *latency = data;
+
+	if (!latency->enabled) {
+		latency->enabled = 1;
+		weston_log("started latency measurement\n");
+	} else {
+		latency_dump(latency);
+	}
+}
+
+static void
+latency_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_latency *latency =
+		container_of(listener, struct weston_latency,
+			     destroy_listener);
+	struct weston_output *output;
+
+	wl_list_for_each(output, &latency->compositor->output_list, link)
+		if (output->latency)
+			output_latency_destroy(
+				&output->latency->destroy_listener, NULL);
+
+	latency->compositor->latency = NULL;
+	free(latency);
+}
+
+WL_EXPORT void
+weston_latency_create(struct weston_compositor *ec)
+{
+	struct weston_latency *latency;
+	struct weston_config_section *section;
+
+	latency = zalloc(sizeof *latency);
+	if (latency == NULL)
+		return;
+
+	latency->compositor = ec;
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "latency-stats",
+				       &latency->enabled, 0);
+
+	weston_compositor_add_debug_binding(ec, KEY_L,
+					    latency_binding, latency);
+
+	latency->destroy_listener.notify = latency_destroy;
+	wl_signal_add(&ec->destroy_signal, &latency->destroy_listener);
+
+	ec->latency = latency;
+}
@@ -186,6 +186,33 @@ weston_launcher_open(struct weston_launcher *launcher,
 	return data->fd;
 }
 
+/** Open a device without waiting for the launcher
+ *
+ * func is called from the event loop with the fd, or -1 if the device
+ * couldn't be opened.  Only the logind launcher opens devices
+ * asynchronously; for the others this returns NULL and the device has
+ * to be opened with weston_launcher_open().  A request that is
+ * cancelled before it completes doesn't call func. */
+struct weston_device_request *
+weston_launcher_open_async(struct weston_launcher *launcher,
+			   const char *path, int flags,
+			   weston_device_opened_func_t func, void *data)
+{
+	if (launcher->logind)
+		return weston_logind_open_async(launcher->logind, path, flags,
+						func, data);
+
+	return NULL;
+}
+
+void
+weston_launcher_cancel(struct weston_launcher *launcher,
+		       struct weston_device_request *request)
+{
+	if (launcher->logind)
+		weston_logind_cancel(launcher->logind, request);
+}
+
 void
 weston_launcher_close(struct weston_launcher *launcher, int fd)
 {
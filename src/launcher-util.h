@@ -29,6 +29,11 @@
 
 struct weston_launcher;
 
+/* An open in flight, see weston_launcher_open_async() */
+struct weston_device_request;
+
+typedef void (*weston_device_opened_func_t)(int fd, void *data);
+
 struct weston_launcher *
 weston_launcher_connect(struct weston_compositor *compositor, int tty,
 			const char *seat_id);
@@ -40,6 +45,15 @@ int
 weston_launcher_open(struct weston_launcher *launcher,
 		     const char *path, int flags);
 
+struct weston_device_request *
+weston_launcher_open_async(struct weston_launcher *launcher,
+			   const char *path, int flags,
+			   weston_device_opened_func_t func, void *data);
+
+void
+weston_launcher_cancel(struct weston_launcher *launcher,
+		       struct weston_device_request *request);
+
 void
 weston_launcher_close(struct weston_launcher *launcher, int fd);
 
@@ -0,0 +1,376 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "compositor.h"
+#include "linux-explicit-synchronization.h"
+#include "linux-explicit-synchronization-server-protocol.h"
+
+struct linux_explicit_synchronization {
+	struct weston_compositor *compositor;
+	struct wl_global *global;
+	struct wl_listener destroy_listener;
+};
+
+struct linux_surface_synchronization {
+	struct wl_resource *resource;
+	struct weston_surface *surface;
+	struct wl_listener surface_destroy_listener;
+};
+
+static void
+destroy_buffer_release(struct wl_resource *resource)
+{
+	struct weston_buffer_release *release =
+		wl_resource_get_user_data(resource);
+
+	if (release->surface &&
+	    release->surface->pending.buffer_release == release)
+		release->surface->pending.buffer_release = NULL;
+
+	wl_list_remove(&release->link);
+	free(release);
+}
+
+/** Tell the client the buffer of a commit is free again
+ *
+ * With fence_fd >= 0 the client is told to wait on it before writing
+ * to the buffer; the fd stays owned by the caller.  The release object
+ * is destroyed.
+ */
+WL_EXPORT void
+linux_buffer_release_send(struct weston_buffer_release *release,
+			  int fence_fd)
+{
+	if (fence_fd >= 0)
+		zlinux_buffer_release_send_fenced_release(release->resource,
+							  fence_fd);
+	else
+		zlinux_buffer_release_send_immediate_release(release->resource);
+
+	wl_resource_destroy(release->resource);
+}
+
+static void
+surface_synchronization_destroy(struct wl_client *client,
+				struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+surface_synchronization_set_acquire_fence(struct wl_client *client,
+					  struct wl_resource *resource,
+					  int32_t fd)
+{
+	struct linux_surface_synchronization *sync =
+		wl_resource_get_user_data(resource);
+	struct weston_surface *surface = sync->surface;
+
+	if (!surface) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_NO_SURFACE,
+			"surface no longer exists");
+		close(fd);
+		return;
+	}
+
+	if (surface->pending.acquire_fence_fd >= 0) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_DUPLICATE_FENCE,
+			"already have a fence for this commit");
+		close(fd);
+		return;
+	}
+
+	surface->pending.acquire_fence_fd = fd;
+}
+
+static void
+surface_synchronization_get_release(struct wl_client *client,
+				    struct wl_resource *resource,
+				    uint32_t id)
+{
+	struct linux_surface_synchronization *sync =
+		wl_resource_get_user_data(resource);
+	struct weston_surface *surface = sync->surface;
+	struct weston_buffer_release *release;
+
+	if (!surface) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_NO_SURFACE,
+			"surface no longer exists");
+		return;
+	}
+
+	if (surface->pending.buffer_release) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_DUPLICATE_RELEASE,
+			"already have a release for this commit");
+		return;
+	}
+
+	release = zalloc(sizeof *release);
+	if (!release)
+		goto err_out;
+
+	release->resource =
+		wl_resource_create(client, &zlinux_buffer_release_interface,
+				   wl_resource_get_version(resource), id);
+	if (!release->resource)
+		goto err_dealloc;
+
+	wl_list_init(&release->link);
+	release->surface = surface;
+	wl_resource_set_implementation(release->resource, NULL, release,
+				       destroy_buffer_release);
+
+	surface->pending.buffer_release = release;
+
+	return;
+
+err_dealloc:
+	free(release);
+
+err_out:
+	wl_resource_post_no_memory(resource);
+}
+
+static const struct zlinux_surface_synchronization_interface
+surface_synchronization_implementation = {
+	surface_synchronization_destroy,
+	surface_synchronization_set_acquire_fence,
+	surface_synchronization_get_release
+};
+
+static void
+surface_synchronization_surface_destroyed(struct wl_listener *listener,
+					  void *data)
+{
+	struct linux_surface_synchronization *sync =
+		container_of(listener, struct linux_surface_synchronization,
+			     surface_destroy_listener);
+
+	sync->surface = NULL;
+	wl_list_remove(&sync->surface_destroy_listener.link);
+	wl_list_init(&sync->surface_destroy_listener.link);
+}
+
+static void
+destroy_surface_synchronization(struct wl_resource *resource)
+{
+	struct linux_surface_synchronization *sync =
+		wl_resource_get_user_data(resource);
+	struct weston_surface *surface = sync->surface;
+
+	if (surface) {
+		surface->synchronization_resource = NULL;
+		if (surface->pending.acquire_fence_fd >= 0) {
+			close(surface->pending.acquire_fence_fd);
+			surface->pending.acquire_fence_fd = -1;
+		}
+	}
+
+	wl_list_remove(&sync->surface_destroy_listener.link);
+	free(sync);
+}
+
+static void
+linux_explicit_synchronization_destroy(struct wl_client *client,
+				       struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+linux_explicit_synchronization_get_synchronization(
+				struct wl_client *client,
+				struct wl_resource *resource,
+				uint32_t id,
+				struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct linux_surface_synchronization *sync;
+
+	if (surface->synchronization_resource) {
+		wl_resource_post_error(resource,
+			ZLINUX_EXPLICIT_SYNCHRONIZATION_ERROR_SYNCHRONIZATION_EXISTS,
+			"wl_surface@%u already has a synchronization object",
+			wl_resource_get_id(surface_resource));
+		return;
+	}
+
+	sync = zalloc(sizeof *sync);
+	if (!sync)
+		goto err_out;
+
+	sync->resource =
+		wl_resource_create(client,
+				   &zlinux_surface_synchronization_interface,
+				   wl_resource_get_version(resource), id);
+	if (!sync->resource)
+		goto err_dealloc;
+
+	sync->surface = surface;
+	sync->surface_destroy_listener.notify =
+		surface_synchronization_surface_destroyed;
+	wl_signal_add(&surface->destroy_signal,
+		      &sync->surface_destroy_listener);
+
+	wl_resource_set_implementation(sync->resource,
+				       &surface_synchronization_implementation,
+				       sync, destroy_surface_synchronization);
+
+	surface->synchronization_resource = sync->resource;
+
+	return;
+
+err_dealloc:
+	free(sync);
+
+err_out:
+	wl_resource_post_no_memory(resource);
+}
+
+static const struct zlinux_explicit_synchronization_interface
+linux_explicit_synchronization_implementation = {
+	linux_explicit_synchronization_destroy,
+	linux_explicit_synchronization_get_synchronization
+};
+
+/** Check the explicit synchronization state of a commit
+ *
+ * Called at wl_surface.commit before anything is applied.  Posts a
+ * protocol error and returns -1 if the fence or release requests do
+ * not go with the buffer of this commit.  Otherwise the release, if
+ * any, starts waiting for that buffer to be released.
+ */
+WL_EXPORT int
+linux_explicit_synchronization_commit(struct weston_surface *surface)
+{
+	struct weston_buffer_release *release = surface->pending.buffer_release;
+	struct weston_buffer *buffer = NULL;
+
+	if (surface->pending.newly_attached)
+		buffer = surface->pending.buffer;
+
+	if (surface->synchronization_resource) {
+		if ((surface->pending.acquire_fence_fd >= 0 || release) &&
+		    !buffer) {
+			wl_resource_post_error(surface->synchronization_resource,
+				ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_NO_BUFFER,
+				"no buffer attached");
+			return -1;
+		}
+
+		if (surface->pending.acquire_fence_fd >= 0 &&
+		    wl_shm_buffer_get(buffer->resource)) {
+			wl_resource_post_error(surface->synchronization_resource,
+				ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_UNSUPPORTED_BUFFER,
+				"fences are not supported for wl_shm buffers");
+			return -1;
+		}
+	}
+
+	if (release) {
+		surface->pending.buffer_release = NULL;
+		release->surface = NULL;
+		if (buffer)
+			wl_list_insert(&buffer->release_list, &release->link);
+		else
+			linux_buffer_release_send(release, -1);
+	}
+
+	return 0;
+}
+
+static void
+bind_linux_explicit_synchronization(struct wl_client *client,
+				    void *data, uint32_t version,
+				    uint32_t id)
+{
+	struct linux_explicit_synchronization *sync = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &zlinux_explicit_synchronization_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+			&linux_explicit_synchronization_implementation,
+			sync, NULL);
+}
+
+static void
+linux_explicit_synchronization_compositor_destroy(struct wl_listener *listener,
+						  void *data)
+{
+	struct linux_explicit_synchronization *sync =
+		container_of(listener, struct linux_explicit_synchronization,
+			     destroy_listener);
+
+	wl_global_destroy(sync->global);
+	free(sync);
+}
+
+/** Advertise explicit synchronization support
+ *
+ * Called by the renderer once it knows it can wait on acquire fences
+ * on the GPU and hand out release fences.
+ *
+ * \return 0 on success, -1 on failure.
+ */
+WL_EXPORT int
+linux_explicit_synchronization_setup(struct weston_compositor *compositor)
+{
+	struct linux_explicit_synchronization *sync;
+
+	sync = zalloc(sizeof *sync);
+	if (!sync)
+		return -1;
+
+	sync->compositor = compositor;
+	sync->global =
+		wl_global_create(compositor->wl_display,
+				 &zlinux_explicit_synchronization_interface, 1,
+				 sync, bind_linux_explicit_synchronization);
+	if (!sync->global) {
+		free(sync);
+		return -1;
+	}
+
+	sync->destroy_listener.notify =
+		linux_explicit_synchronization_compositor_destroy;
+	wl_signal_add(&compositor->destroy_signal, &sync->destroy_listener);
+
+	return 0;
+}
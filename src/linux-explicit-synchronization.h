@@ -0,0 +1,41 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef WESTON_LINUX_EXPLICIT_SYNCHRONIZATION_H
+#define WESTON_LINUX_EXPLICIT_SYNCHRONIZATION_H
+
+struct weston_compositor;
+struct weston_surface;
+struct weston_buffer_release;
+
+int
+linux_explicit_synchronization_setup(struct weston_compositor *compositor);
+
+int
+linux_explicit_synchronization_commit(struct weston_surface *surface);
+
+void
+linux_buffer_release_send(struct weston_buffer_release *release,
+			  int fence_fd);
+
+#endif /* WESTON_LINUX_EXPLICIT_SYNCHRONIZATION_H */
@@ -26,47 +26,441 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 
 #include <wayland-util.h>
 
 #include "compositor.h"
 
+/* Messages are formatted on the calling thread and queued in a ring,
+ * which a writer thread empties into the log file, so a slow disk
+ * never holds up a repaint.  Any thread may log: a message reserves
+ * its room by moving the reserve position with a compare and swap,
+ * copies itself in and then publishes its size, which the writer waits
+ * for.  A message that doesn't fit is dropped and counted instead of
+ * blocking, and the count is logged once the writer catches up.
+ *
+ * Without the writer thread, in forked children and if the thread
+ * can't be started, messages are written directly. */
+
+#define LOG_RING_SIZE		(256 * 1024)	/* a power of two */
+#define LOG_RING_MASK		(LOG_RING_SIZE - 1)
+#define LOG_LINE_SIZE		512
+#define LOG_MESSAGE_MAX		(LOG_RING_SIZE / 8)
+#define LOG_WRITE_BATCH		64
+
+struct log_record {
+	uint32_t size;		/* 0 until published, 8-byte aligned */
+	uint32_t len;		/* of the text following, 0 for padding */
+};
+
+struct log_ring {
+	char *data;
+	uint32_t reserve;	/* moved by the logging threads */
+	uint32_t tail;		/* moved by the writer thread */
+	uint32_t dropped;
+	int sleeping;		/* the writer waits on wake_fd */
+	int quit;
+
+	int running;
+	int fd;
+	int wake_fd;
+	pthread_t thread;
+};
+
+static struct log_ring log_ring;
+
 static FILE *weston_logfile = NULL;
 
 static int cached_tm_mday = -1;
 
-static int weston_log_timestamp(void)
+/* A message being formatted, on the stack unless it's long */
+struct log_line {
+	char *text;
+	size_t len, size;
+	char buffer[LOG_LINE_SIZE];
+};
+
+static void
+log_line_init(struct log_line *line)
+{
+	line->text = line->buffer;
+	line->len = 0;
+	line->size = sizeof line->buffer;
+}
+
+static void
+log_line_release(struct log_line *line)
+{
+	if (line->text != line->buffer)
+		free(line->text);
+}
+
+static int
+log_line_vprintf(struct log_line *line, const char *fmt, va_list ap)
+{
+	va_list aq;
+	size_t size;
+	char *text;
+	int n;
+
+	va_copy(aq, ap);
+	n = vsnprintf(line->text + line->len, line->size - line->len,
+		      fmt, aq);
+	va_end(aq);
+	if (n < 0)
+		return 0;
+
+	if ((size_t) n >= line->size - line->len) {
+		size = line->len + n + 1;
+		text = line->text == line->buffer ?
+			malloc(size) : realloc(line->text, size);
+		if (!text) {
+			line->len = line->size - 1;
+			return n;
+		}
+		if (line->text == line->buffer)
+			memcpy(text, line->buffer, line->len);
+		line->text = text;
+		line->size = size;
+		vsnprintf(line->text + line->len, line->size - line->len,
+			  fmt, ap);
+	}
+
+	line->len += n;
+
+	return n;
+}
+
+static int
+log_line_printf(struct log_line *line, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = log_line_vprintf(line, fmt, ap);
+	va_end(ap);
+
+	return n;
+}
+
+static int weston_log_timestamp(struct log_line *line)
 {
 	struct timeval tv;
-	struct tm *brokendown_time;
+	struct tm tm, *brokendown_time;
 	char string[128];
 
 	gettimeofday(&tv, NULL);
 
-	brokendown_time = localtime(&tv.tv_sec);
+	/* Other threads log as well */
+	brokendown_time = localtime_r(&tv.tv_sec, &tm);
 	if (brokendown_time == NULL)
-		return fprintf(weston_logfile, "[(NULL)localtime] ");
+		return log_line_printf(line, "[(NULL)localtime] ");
 
-	if (brokendown_time->tm_mday != cached_tm_mday) {
+	if (__atomic_exchange_n(&cached_tm_mday, brokendown_time->tm_mday,
+				__ATOMIC_RELAXED) != brokendown_time->tm_mday) {
 		strftime(string, sizeof string, "%Y-%m-%d %Z", brokendown_time);
-		fprintf(weston_logfile, "Date: %s\n", string);
-
-		cached_tm_mday = brokendown_time->tm_mday;
+		log_line_printf(line, "Date: %s\n", string);
 	}
 
 	strftime(string, sizeof string, "%H:%M:%S", brokendown_time);
 
-	return fprintf(weston_logfile, "[%s.%03li] ", string, tv.tv_usec/1000);
+	return log_line_printf(line, "[%s.%03li] ",
+			       string, tv.tv_usec/1000);
+}
+
+static void
+log_ring_wake(void)
+{
+	const uint64_t one = 1;
+
+	if (write(log_ring.wake_fd, &one, sizeof one) != sizeof one)
+		return;
+}
+
+static void
+log_ring_push(const char *text, uint32_t len)
+{
+	struct log_record *rec;
+	uint32_t head, tail, pos, pad, need;
+
+	if (len > LOG_MESSAGE_MAX)
+		len = LOG_MESSAGE_MAX;
+	need = (sizeof *rec + len + 7) & ~7u;
+
+	head = __atomic_load_n(&log_ring.reserve, __ATOMIC_RELAXED);
+	do {
+		tail = __atomic_load_n(&log_ring.tail, __ATOMIC_ACQUIRE);
+
+		/* Records don't wrap, the end is skipped instead */
+		pos = head & LOG_RING_MASK;
+		pad = LOG_RING_SIZE - pos < need ? LOG_RING_SIZE - pos : 0;
+
+		if (head + pad + need - tail > LOG_RING_SIZE) {
+			__atomic_add_fetch(&log_ring.dropped, 1,
+					   __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&log_ring.reserve, &head,
+					      head + pad + need, 0,
+					      __ATOMIC_ACQUIRE,
+					      __ATOMIC_RELAXED));
+
+	if (pad) {
+		rec = (struct log_record *) &log_ring.data[pos];
+		rec->len = 0;
+		__atomic_store_n(&rec->size, pad, __ATOMIC_SEQ_CST);
+		pos = 0;
+	}
+
+	rec = (struct log_record *) &log_ring.data[pos];
+	rec->len = len;
+	memcpy(rec + 1, text, len);
+	__atomic_store_n(&rec->size, need, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&log_ring.sleeping, __ATOMIC_SEQ_CST))
+		log_ring_wake();
+}
+
+static int
+log_ring_ready(void)
+{
+	struct log_record *rec;
+
+	rec = (struct log_record *)
+		&log_ring.data[log_ring.tail & LOG_RING_MASK];
+
+	return __atomic_load_n(&rec->size, __ATOMIC_SEQ_CST) != 0;
+}
+
+static void
+log_write_all(int fd, struct iovec *iov, int count)
+{
+	ssize_t n;
+
+	while (count > 0) {
+		n = writev(fd, iov, count);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return;
+
+		while (count > 0 && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+/* Only called by the writer thread, or once it has stopped */
+static void
+log_ring_drain(void)
+{
+	struct iovec iov[LOG_WRITE_BATCH];
+	struct log_record *rec;
+	uint32_t tail, size, dropped;
+	char note[64];
+	int count;
+
+	do {
+		tail = log_ring.tail;
+		count = 0;
+		while (count < LOG_WRITE_BATCH) {
+			rec = (struct log_record *)
+				&log_ring.data[tail & LOG_RING_MASK];
+			size = __atomic_load_n(&rec->size, __ATOMIC_ACQUIRE);
+			if (size == 0)
+				break;
+			if (rec->len) {
+				iov[count].iov_base = rec + 1;
+				iov[count].iov_len = rec->len;
+				count++;
+			}
+			tail += size;
+		}
+
+		log_write_all(log_ring.fd, iov, count);
+
+		/* Free room reads as zero, so that the writer never takes
+		 * old text for the size of a record still being copied */
+		while (log_ring.tail != tail) {
+			rec = (struct log_record *)
+				&log_ring.data[log_ring.tail & LOG_RING_MASK];
+			size = rec->size;
+			memset(rec, 0, size);
+			__atomic_store_n(&log_ring.tail, log_ring.tail + size,
+					 __ATOMIC_RELEASE);
+		}
+	} while (count == LOG_WRITE_BATCH);
+
+	dropped = __atomic_exchange_n(&log_ring.dropped, 0, __ATOMIC_RELAXED);
+	if (dropped) {
+		iov[0].iov_base = note;
+		iov[0].iov_len = snprintf(note, sizeof note,
+					  "[%u log messages dropped]\n",
+					  dropped);
+		log_write_all(log_ring.fd, iov, 1);
+	}
+}
+
+static void *
+log_thread_function(void *data)
+{
+	uint64_t count;
+
+	while (1) {
+		log_ring_drain();
+
+		__atomic_store_n(&log_ring.sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!log_ring_ready()) {
+			if (__atomic_load_n(&log_ring.quit, __ATOMIC_ACQUIRE))
+				break;
+			if (read(log_ring.wake_fd, &count, sizeof count) < 0 &&
+			    errno != EINTR)
+				break;
+		}
+		__atomic_store_n(&log_ring.sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+
+	log_ring_drain();
+
+	return NULL;
+}
+
+/* A forked child only has the thread that forked */
+static void
+log_atfork_child(void)
+{
+	log_ring.running = 0;
+}
+
+static void
+log_thread_start(void)
+{
+	static int atfork_registered;
+	sigset_t signals, saved;
+
+	log_ring.data = calloc(1, LOG_RING_SIZE);
+	if (!log_ring.data)
+		return;
+
+	log_ring.wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (log_ring.wake_fd < 0)
+		goto err_free;
+
+	fflush(weston_logfile);
+	log_ring.fd = fileno(weston_logfile);
+	log_ring.reserve = 0;
+	log_ring.tail = 0;
+	log_ring.dropped = 0;
+	log_ring.sleeping = 0;
+	log_ring.quit = 0;
+
+	/* Signals are for the main thread's signalfds */
+	sigfillset(&signals);
+	pthread_sigmask(SIG_BLOCK, &signals, &saved);
+	if (pthread_create(&log_ring.thread, NULL,
+			   log_thread_function, NULL) != 0) {
+		pthread_sigmask(SIG_SETMASK, &saved, NULL);
+		goto err_fd;
+	}
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (!atfork_registered) {
+		pthread_atfork(NULL, NULL, log_atfork_child);
+		atfork_registered = 1;
+	}
+
+	log_ring.running = 1;
+
+	return;
+
+err_fd:
+	close(log_ring.wake_fd);
+err_free:
+	free(log_ring.data);
+	log_ring.data = NULL;
+}
+
+static void
+log_thread_stop(void)
+{
+	if (!log_ring.running)
+		return;
+
+	log_ring.running = 0;
+	__atomic_store_n(&log_ring.quit, 1, __ATOMIC_RELEASE);
+	log_ring_wake();
+	pthread_join(log_ring.thread, NULL);
+
+	close(log_ring.wake_fd);
+	free(log_ring.data);
+	log_ring.data = NULL;
+}
+
+/* Writes out everything logged so far.  Also used when crashing, so
+ * it only waits a bounded time for the writer. */
+WL_EXPORT void
+weston_log_flush(void)
+{
+	struct timespec ts = { 0, 1000000 };
+	uint32_t target;
+	int i;
+
+	if (!log_ring.running) {
+		fflush(weston_logfile);
+		return;
+	}
+
+	if (pthread_equal(pthread_self(), log_ring.thread)) {
+		log_ring_drain();
+		return;
+	}
+
+	target = __atomic_load_n(&log_ring.reserve, __ATOMIC_ACQUIRE);
+	log_ring_wake();
+	for (i = 0; i < 1000; i++) {
+		if ((int32_t) (target -
+			       __atomic_load_n(&log_ring.tail,
+					       __ATOMIC_ACQUIRE)) <= 0)
+			break;
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void
+weston_log_write(struct log_line *line)
+{
+	if (log_ring.running)
+		log_ring_push(line->text, line->len);
+	else
+		fwrite(line->text, 1, line->len, weston_logfile);
 }
 
 static void
 custom_handler(const char *fmt, va_list arg)
 {
-	weston_log_timestamp();
-	fprintf(weston_logfile, "libwayland: ");
-	vfprintf(weston_logfile, fmt, arg);
+	struct log_line line;
+
+	log_line_init(&line);
+	weston_log_timestamp(&line);
+	log_line_printf(&line, "libwayland: ");
+	log_line_vprintf(&line, fmt, arg);
+	weston_log_write(&line);
+	log_line_release(&line);
 }
 
 void
@@ -81,11 +475,15 @@ weston_log_file_open(const char *filename)
 		weston_logfile = stderr;
 	else
 		setvbuf(weston_logfile, NULL, _IOLBF, 256);
+
+	log_thread_start();
 }
 
 void
 weston_log_file_close()
 {
+	log_thread_stop();
+
 	if ((weston_logfile != stderr) && (weston_logfile != NULL))
 		fclose(weston_logfile);
 	weston_logfile = stderr;
@@ -94,10 +492,14 @@ weston_log_file_close()
 WL_EXPORT int
 weston_vlog(const char *fmt, va_list ap)
 {
+	struct log_line line;
 	int l;
 
-	l = weston_log_timestamp();
-	l += vfprintf(weston_logfile, fmt, ap);
+	log_line_init(&line);
+	l = weston_log_timestamp(&line);
+	l += log_line_vprintf(&line, fmt, ap);
+	weston_log_write(&line);
+	log_line_release(&line);
 
 	return l;
 }
@@ -118,7 +520,15 @@ weston_log(const char *fmt, ...)
 WL_EXPORT int
 weston_vlog_continue(const char *fmt, va_list argp)
 {
-	return vfprintf(weston_logfile, fmt, argp);
+	struct log_line line;
+	int l;
+
+	log_line_init(&line);
+	l = log_line_vprintf(&line, fmt, argp);
+	weston_log_write(&line);
+	log_line_release(&line);
+
+	return l;
 }
 
 WL_EXPORT int
@@ -65,52 +65,85 @@ struct weston_logind {
 	DBusPendingCall *pending_active;
 };
 
-static int
-weston_logind_take_device(struct weston_logind *wl, uint32_t major,
-			  uint32_t minor, bool *paused_out)
+/* A TakeDevice call waiting for its reply */
+struct weston_device_request {
+	struct weston_logind *wl;
+	DBusPendingCall *pending;
+	uint32_t major, minor;
+	int flags;
+	weston_device_opened_func_t func;
+	void *data;
+};
+
+static DBusMessage *
+weston_logind_take_device_message(struct weston_logind *wl, uint32_t major,
+				  uint32_t minor)
 {
-	DBusMessage *m, *reply;
+	DBusMessage *m;
 	bool b;
-	int r, fd;
-	dbus_bool_t paused;
 
 	m = dbus_message_new_method_call("org.freedesktop.login1",
 					 wl->spath,
 					 "org.freedesktop.login1.Session",
 					 "TakeDevice");
 	if (!m)
-		return -ENOMEM;
+		return NULL;
 
 	b = dbus_message_append_args(m,
 				     DBUS_TYPE_UINT32, &major,
 				     DBUS_TYPE_UINT32, &minor,
 				     DBUS_TYPE_INVALID);
 	if (!b) {
-		r = -ENOMEM;
-		goto err_unref;
+		dbus_message_unref(m);
+		return NULL;
 	}
 
-	reply = dbus_connection_send_with_reply_and_block(wl->dbus, m,
-							  -1, NULL);
-	if (!reply) {
-		r = -ENODEV;
-		goto err_unref;
-	}
+	return m;
+}
+
+static int
+weston_logind_take_device_reply(DBusMessage *reply, bool *paused_out)
+{
+	dbus_bool_t paused;
+	bool b;
+	int fd;
+
+	if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_METHOD_RETURN)
+		return -ENODEV;
 
 	b = dbus_message_get_args(reply, NULL,
 				  DBUS_TYPE_UNIX_FD, &fd,
 				  DBUS_TYPE_BOOLEAN, &paused,
 				  DBUS_TYPE_INVALID);
-	if (!b) {
-		r = -ENODEV;
-		goto err_reply;
-	}
+	if (!b)
+		return -ENODEV;
 
-	r = fd;
 	if (paused_out)
 		*paused_out = paused;
 
-err_reply:
+	return fd;
+}
+
+static int
+weston_logind_take_device(struct weston_logind *wl, uint32_t major,
+			  uint32_t minor, bool *paused_out)
+{
+	DBusMessage *m, *reply;
+	int r;
+
+	m = weston_logind_take_device_message(wl, major, minor);
+	if (!m)
+		return -ENOMEM;
+
+	reply = dbus_connection_send_with_reply_and_block(wl->dbus, m,
+							  -1, NULL);
+	if (!reply) {
+		r = -ENODEV;
+		goto err_unref;
+	}
+
+	r = weston_logind_take_device_reply(reply, paused_out);
+
 	dbus_message_unref(reply);
 err_unref:
 	dbus_message_unref(m);
@@ -161,12 +194,46 @@ weston_logind_pause_device_complete(struct weston_logind *wl, uint32_t major,
 	}
 }
 
+/* Compared to weston_launcher_open() we cannot specify the open-mode
+ * directly. Instead, logind passes us an fd with sane default modes.
+ * For DRM and evdev this means O_RDWR | O_CLOEXEC. If we want
+ * something else, we need to change it afterwards. We currently
+ * only support dropping FD_CLOEXEC and setting O_NONBLOCK. Changing
+ * access-modes is not possible so accept whatever logind passes us. */
+static int
+weston_logind_set_flags(int fd, int flags)
+{
+	int fl;
+
+	fl = fcntl(fd, F_GETFL);
+	if (fl < 0)
+		return -errno;
+
+	if (flags & O_NONBLOCK)
+		fl |= O_NONBLOCK;
+
+	if (fcntl(fd, F_SETFL, fl) < 0)
+		return -errno;
+
+	fl = fcntl(fd, F_GETFD);
+	if (fl < 0)
+		return -errno;
+
+	if (!(flags & O_CLOEXEC))
+		fl &= ~FD_CLOEXEC;
+
+	if (fcntl(fd, F_SETFD, fl) < 0)
+		return -errno;
+
+	return 0;
+}
+
 WL_EXPORT int
 weston_logind_open(struct weston_logind *wl, const char *path,
 		   int flags)
 {
 	struct stat st;
-	int fl, r, fd;
+	int r, fd;
 
 	r = stat(path, &st);
 	if (r < 0)
@@ -181,51 +248,123 @@ weston_logind_open(struct weston_logind *wl, const char *path,
 	if (fd < 0)
 		return fd;
 
-	/* Compared to weston_launcher_open() we cannot specify the open-mode
-	 * directly. Instead, logind passes us an fd with sane default modes.
-	 * For DRM and evdev this means O_RDWR | O_CLOEXEC. If we want
-	 * something else, we need to change it afterwards. We currently
-	 * only support dropping FD_CLOEXEC and setting O_NONBLOCK. Changing
-	 * access-modes is not possible so accept whatever logind passes us. */
+	r = weston_logind_set_flags(fd, flags);
+	if (r < 0) {
+		close(fd);
+		weston_logind_release_device(wl, major(st.st_rdev),
+					     minor(st.st_rdev));
+		errno = -r;
+		return -1;
+	}
 
-	fl = fcntl(fd, F_GETFL);
-	if (fl < 0) {
-		r = -errno;
-		goto err_close;
+	return fd;
+}
+
+static void
+take_device_cb(DBusPendingCall *pending, void *data)
+{
+	struct weston_device_request *request = data;
+	struct weston_logind *wl = request->wl;
+	DBusMessage *m;
+	int fd = -ENODEV, r;
+
+	m = dbus_pending_call_steal_reply(pending);
+	dbus_pending_call_unref(request->pending);
+
+	if (m) {
+		fd = weston_logind_take_device_reply(m, NULL);
+		dbus_message_unref(m);
 	}
 
-	if (flags & O_NONBLOCK)
-		fl |= O_NONBLOCK;
+	if (fd >= 0) {
+		r = weston_logind_set_flags(fd, request->flags);
+		if (r < 0) {
+			close(fd);
+			weston_logind_release_device(wl, request->major,
+						     request->minor);
+			fd = r;
+		}
+	}
 
-	r = fcntl(fd, F_SETFL, fl);
-	if (r < 0) {
-		r = -errno;
-		goto err_close;
+	if (fd < 0) {
+		errno = -fd;
+		fd = -1;
 	}
 
-	fl = fcntl(fd, F_GETFD);
-	if (fl < 0) {
-		r = -errno;
-		goto err_close;
+	request->func(fd, request->data);
+	free(request);
+}
+
+/* Sends TakeDevice and returns right away, so that taking many devices
+ * costs one round trip to logind instead of one each. */
+WL_EXPORT struct weston_device_request *
+weston_logind_open_async(struct weston_logind *wl, const char *path,
+			 int flags, weston_device_opened_func_t func,
+			 void *data)
+{
+	struct weston_device_request *request;
+	struct stat st;
+	DBusMessage *m;
+	bool b;
+
+	if (stat(path, &st) < 0)
+		return NULL;
+	if (!S_ISCHR(st.st_mode)) {
+		errno = ENODEV;
+		return NULL;
 	}
 
-	if (!(flags & O_CLOEXEC))
-		fl &= ~FD_CLOEXEC;
+	request = zalloc(sizeof *request);
+	if (!request)
+		return NULL;
 
-	r = fcntl(fd, F_SETFD, fl);
-	if (r < 0) {
-		r = -errno;
-		goto err_close;
+	request->wl = wl;
+	request->major = major(st.st_rdev);
+	request->minor = minor(st.st_rdev);
+	request->flags = flags;
+	request->func = func;
+	request->data = data;
+
+	m = weston_logind_take_device_message(wl, request->major,
+					      request->minor);
+	if (!m)
+		goto err_free;
+
+	b = dbus_connection_send_with_reply(wl->dbus, m,
+					    &request->pending, -1);
+	dbus_message_unref(m);
+	if (!b || !request->pending)
+		goto err_free;
+
+	b = dbus_pending_call_set_notify(request->pending, take_device_cb,
+					 request, NULL);
+	if (!b) {
+		dbus_pending_call_cancel(request->pending);
+		dbus_pending_call_unref(request->pending);
+		weston_logind_release_device(wl, request->major,
+					     request->minor);
+		goto err_free;
 	}
 
-	return fd;
+	return request;
 
-err_close:
-	close(fd);
-	weston_logind_release_device(wl, major(st.st_rdev),
-				     minor(st.st_rdev));
-	errno = -r;
-	return -1;
+err_free:
+	free(request);
+	errno = ENOMEM;
+	return NULL;
+}
+
+WL_EXPORT void
+weston_logind_cancel(struct weston_logind *wl,
+		     struct weston_device_request *request)
+{
+	dbus_pending_call_cancel(request->pending);
+	dbus_pending_call_unref(request->pending);
+
+	/* logind still handles the TakeDevice, and in order, so this
+	 * gives the device back once it's ours */
+	weston_logind_release_device(wl, request->major, request->minor);
+	free(request);
 }
 
 WL_EXPORT void
@@ -28,6 +28,7 @@
 #include <string.h>
 
 #include "compositor.h"
+#include "launcher-util.h"
 
 struct weston_logind;
 
@@ -39,6 +40,15 @@ int
 weston_logind_open(struct weston_logind *wl, const char *path,
 		   int flags);
 
+struct weston_device_request *
+weston_logind_open_async(struct weston_logind *wl, const char *path,
+			 int flags, weston_device_opened_func_t func,
+			 void *data);
+
+void
+weston_logind_cancel(struct weston_logind *wl,
+		     struct weston_device_request *request);
+
 void
 weston_logind_close(struct weston_logind *wl, int fd);
 
@@ -88,6 +98,20 @@ weston_logind_open(struct weston_logind *wl, const char *path,
 	return -ENOSYS;
 }
 
+static inline struct weston_device_request *
+weston_logind_open_async(struct weston_logind *wl, const char *path,
+			 int flags, weston_device_opened_func_t func,
+			 void *data)
+{
+	return NULL;
+}
+
+static inline void
+weston_logind_cancel(struct weston_logind *wl,
+		     struct weston_device_request *request)
+{
+}
+
 static inline void
 weston_logind_close(struct weston_logind *wl, int fd)
 {
@@ -25,6 +25,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "pixman-renderer.h"
 
@@ -34,12 +35,14 @@ struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+	pixman_region32_t hw_extra_damage;
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	pixman_color_t color;	/* of image, if a solid fill */
 	struct weston_buffer_reference buffer_ref;
 
 	struct wl_listener buffer_destroy_listener;
@@ -47,6 +50,30 @@ struct pixman_surface_state {
 	struct wl_listener renderer_destroy_listener;
 };
 
+/* One composite of a view, recorded by repaint_region() when the
+ * repaint is split over threads.  Every band composites it with images
+ * of its own, pixman images can't be shared between threads. */
+struct pixman_job {
+	pixman_op_t op;
+	pixman_region32_t region;	/* output coordinates */
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+	struct wl_shm_buffer *shm_buffer;
+	pixman_format_code_t format;
+	int width, height, stride;
+	void *bits;			/* NULL for a solid fill */
+	pixman_color_t color;
+	uint16_t alpha;			/* 0xffff if no mask */
+};
+
+struct pixman_worker {
+	struct pixman_renderer *renderer;
+	pthread_t thread;
+	int index;
+};
+
+#define PIXMAN_MAX_THREADS 16
+
 struct pixman_renderer {
 	struct weston_renderer base;
 
@@ -55,6 +82,30 @@ struct pixman_renderer {
 	struct weston_binding *debug_binding;
 
 	struct wl_signal destroy_signal;
+
+	/* With more than one thread, the damage is cut into horizontal
+	 * bands, one per thread.  The main thread paints band 0 and waits
+	 * for the num_threads - 1 workers to finish theirs. */
+	int num_threads;
+	struct pixman_worker *workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	uint32_t generation;
+	int pending;
+	int quit;
+	/* wl_shm_buffer_begin_access() isn't thread safe */
+	pthread_mutex_t shm_mutex;
+
+	struct wl_array jobs;		/* struct pixman_job */
+	pixman_format_code_t job_format;
+	void *job_bits;
+	int job_width, job_height, job_stride;
+	int job_y1, job_y2;
+};
+
+static const pixman_color_t debug_red = {
+	0x3fff, 0x0000, 0x0000, 0x3fff
 };
 
 static inline struct pixman_output_state *
@@ -63,6 +114,14 @@ get_output_state(struct weston_output *output)
 	return (struct pixman_output_state *)output->renderer_state;
 }
 
+/* Without a shadow buffer, views are composited into the hardware
+ * buffer directly. */
+static inline pixman_image_t *
+get_target_image(struct pixman_output_state *po)
+{
+	return po->shadow_image ? po->shadow_image : po->hw_buffer;
+}
+
 static int
 pixman_renderer_create_surface(struct weston_surface *surface);
 
@@ -167,6 +226,217 @@ transform_apply_viewport(pixman_transform_t *transform,
 	pixman_transform_translate(transform, NULL, D2F(src_x), D2F(src_y));
 }
 
+static void
+queue_job(struct pixman_renderer *pr, struct pixman_surface_state *ps,
+	  pixman_op_t op, pixman_region32_t *region,
+	  pixman_transform_t *transform, pixman_filter_t filter, float alpha)
+{
+	struct pixman_job *job;
+
+	job = wl_array_add(&pr->jobs, sizeof *job);
+	if (!job) {
+		weston_log("pixman renderer: out of memory\n");
+		return;
+	}
+
+	job->op = op;
+	pixman_region32_init(&job->region);
+	pixman_region32_copy(&job->region, region);
+	job->transform = *transform;
+	job->filter = filter;
+	job->shm_buffer = ps->buffer_ref.buffer ?
+		ps->buffer_ref.buffer->shm_buffer : NULL;
+	job->format = pixman_image_get_format(ps->image);
+	job->width = pixman_image_get_width(ps->image);
+	job->height = pixman_image_get_height(ps->image);
+	job->stride = pixman_image_get_stride(ps->image);
+	job->bits = pixman_image_get_data(ps->image);
+	job->color = ps->color;
+	job->alpha = alpha < 1.0 ? 0xffff * alpha : 0xffff;
+}
+
+static void
+run_job(struct pixman_renderer *pr, struct pixman_job *job,
+	pixman_image_t *dest, pixman_region32_t *band,
+	pixman_image_t *debug_color)
+{
+	pixman_region32_t clip;
+	pixman_image_t *src, *mask_image = NULL;
+	pixman_color_t mask = { 0, };
+
+	pixman_region32_init(&clip);
+	pixman_region32_intersect(&clip, &job->region, band);
+	if (!pixman_region32_not_empty(&clip))
+		goto out;
+
+	if (job->bits)
+		src = pixman_image_create_bits(job->format,
+					       job->width, job->height,
+					       job->bits, job->stride);
+	else
+		src = pixman_image_create_solid_fill(&job->color);
+	if (!src)
+		goto out;
+
+	pixman_image_set_transform(src, &job->transform);
+	pixman_image_set_filter(src, job->filter, NULL, 0);
+
+	if (job->alpha < 0xffff) {
+		mask.alpha = job->alpha;
+		mask_image = pixman_image_create_solid_fill(&mask);
+	}
+
+	pixman_image_set_clip_region32(dest, &clip);
+
+	if (job->shm_buffer) {
+		pthread_mutex_lock(&pr->shm_mutex);
+		wl_shm_buffer_begin_access(job->shm_buffer);
+		pthread_mutex_unlock(&pr->shm_mutex);
+	}
+
+	pixman_image_composite32(job->op,
+				 src, /* src */
+				 mask_image, /* mask */
+				 dest, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 pr->job_width, /* width */
+				 pr->job_height /* height */);
+
+	if (job->shm_buffer) {
+		pthread_mutex_lock(&pr->shm_mutex);
+		wl_shm_buffer_end_access(job->shm_buffer);
+		pthread_mutex_unlock(&pr->shm_mutex);
+	}
+
+	if (debug_color)
+		pixman_image_composite32(PIXMAN_OP_OVER,
+					 debug_color, /* src */
+					 NULL /* mask */,
+					 dest, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 pr->job_width, /* width */
+					 pr->job_height /* height */);
+
+	if (mask_image)
+		pixman_image_unref(mask_image);
+	pixman_image_unref(src);
+
+out:
+	pixman_region32_fini(&clip);
+}
+
+/* Composite every queued job on band 'index' of the damage. */
+static void
+run_band(struct pixman_renderer *pr, int index)
+{
+	struct pixman_job *job;
+	pixman_region32_t band;
+	pixman_image_t *dest, *debug_color = NULL;
+	int y1, y2, h;
+
+	h = pr->job_y2 - pr->job_y1;
+	y1 = pr->job_y1 + h * index / pr->num_threads;
+	y2 = pr->job_y1 + h * (index + 1) / pr->num_threads;
+	if (y1 == y2)
+		return;
+
+	dest = pixman_image_create_bits(pr->job_format,
+					pr->job_width, pr->job_height,
+					pr->job_bits, pr->job_stride);
+	if (!dest)
+		return;
+
+	if (pr->repaint_debug)
+		debug_color = pixman_image_create_solid_fill(&debug_red);
+
+	pixman_region32_init_rect(&band, 0, y1, pr->job_width, y2 - y1);
+	wl_array_for_each(job, &pr->jobs)
+		run_job(pr, job, dest, &band, debug_color);
+	pixman_region32_fini(&band);
+
+	if (debug_color)
+		pixman_image_unref(debug_color);
+	pixman_image_unref(dest);
+}
+
+static void *
+pixman_worker_thread(void *data)
+{
+	struct pixman_worker *worker = data;
+	struct pixman_renderer *pr = worker->renderer;
+	uint32_t generation = 0;
+
+	pthread_mutex_lock(&pr->mutex);
+	while (1) {
+		while (pr->generation == generation && !pr->quit)
+			pthread_cond_wait(&pr->work_cond, &pr->mutex);
+		if (pr->quit)
+			break;
+
+		generation = pr->generation;
+		pthread_mutex_unlock(&pr->mutex);
+
+		run_band(pr, worker->index);
+
+		pthread_mutex_lock(&pr->mutex);
+		if (--pr->pending == 0)
+			pthread_cond_signal(&pr->done_cond);
+	}
+	pthread_mutex_unlock(&pr->mutex);
+
+	return NULL;
+}
+
+/* Hand the jobs queued for this repaint to the workers, paint the
+ * first band here and wait for the rest before the copy to hardware. */
+static void
+run_jobs(struct pixman_renderer *pr, struct weston_output *output,
+	 pixman_region32_t *damage)
+{
+	pixman_image_t *target = get_target_image(get_output_state(output));
+	struct pixman_job *job;
+	pixman_region32_t output_damage;
+	pixman_box32_t *extents;
+
+	if (pr->jobs.size == 0)
+		return;
+
+	pixman_region32_init(&output_damage);
+	pixman_region32_copy(&output_damage, damage);
+	region_global_to_output(output, &output_damage);
+	extents = pixman_region32_extents(&output_damage);
+
+	pthread_mutex_lock(&pr->mutex);
+	pr->job_format = pixman_image_get_format(target);
+	pr->job_bits = pixman_image_get_data(target);
+	pr->job_width = pixman_image_get_width(target);
+	pr->job_height = pixman_image_get_height(target);
+	pr->job_stride = pixman_image_get_stride(target);
+	pr->job_y1 = extents->y1;
+	pr->job_y2 = extents->y2;
+	pr->pending = pr->num_threads - 1;
+	pr->generation++;
+	pthread_cond_broadcast(&pr->work_cond);
+	pthread_mutex_unlock(&pr->mutex);
+
+	pixman_region32_fini(&output_damage);
+
+	run_band(pr, 0);
+
+	pthread_mutex_lock(&pr->mutex);
+	while (pr->pending > 0)
+		pthread_cond_wait(&pr->done_cond, &pr->mutex);
+	pthread_mutex_unlock(&pr->mutex);
+
+	wl_array_for_each(job, &pr->jobs)
+		pixman_region32_fini(&job->region);
+	pr->jobs.size = 0;
+}
+
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
 	       pixman_region32_t *region, pixman_region32_t *surf_region,
@@ -175,12 +445,13 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	struct pixman_renderer *pr =
 		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
+	pixman_image_t *target = get_target_image(get_output_state(output));
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
 	pixman_region32_t final_region;
 	float view_x, view_y;
 	pixman_transform_t transform;
 	pixman_fixed_t fw, fh;
+	pixman_filter_t filter;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
 
@@ -211,9 +482,6 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	/* Convert from global to output coord */
 	region_global_to_output(output, &final_region);
 
-	/* And clip to it */
-	pixman_image_set_clip_region32 (po->shadow_image, &final_region);
-
 	/* Set up the source transformation based on the surface
 	   position, the output position/transform/scale and the client
 	   specified buffer transform/scale */
@@ -332,12 +600,23 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 			       pixman_double_to_fixed(vp->buffer.scale),
 			       pixman_double_to_fixed(vp->buffer.scale));
 
-	pixman_image_set_transform(ps->image, &transform);
-
 	if (ev->transform.enabled || output->current_scale != vp->buffer.scale)
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+		filter = PIXMAN_FILTER_BILINEAR;
 	else
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+		filter = PIXMAN_FILTER_NEAREST;
+
+	if (pr->num_threads > 1) {
+		queue_job(pr, ps, pixman_op, &final_region, &transform,
+			  filter, ev->alpha);
+		pixman_region32_fini(&final_region);
+		return;
+	}
+
+	/* Clip to the final region */
+	pixman_image_set_clip_region32 (target, &final_region);
+
+	pixman_image_set_transform(ps->image, &transform);
+	pixman_image_set_filter(ps->image, filter, NULL, 0);
 
 	if (ps->buffer_ref.buffer)
 		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
@@ -352,12 +631,12 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	pixman_image_composite32(pixman_op,
 				 ps->image, /* src */
 				 mask_image, /* mask */
-				 po->shadow_image, /* dest */
+				 target, /* dest */
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->shadow_image), /* width */
-				 pixman_image_get_height (po->shadow_image) /* height */);
+				 pixman_image_get_width (target), /* width */
+				 pixman_image_get_height (target) /* height */);
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
@@ -369,14 +648,14 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		pixman_image_composite32(PIXMAN_OP_OVER,
 					 pr->debug_color, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 target, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (target), /* width */
+					 pixman_image_get_height (target) /* height */);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_image_set_clip_region32 (target, NULL);
 
 	pixman_region32_fini(&final_region);
 }
@@ -437,11 +716,13 @@ static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **views = output->views.data;
+	int i;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	for (i = output->views.size / sizeof *views - 1; i >= 0; i--)
+		if (views[i]->plane == &compositor->primary_plane &&
+		    !views[i]->occluded)
+			draw_view(views[i], output, damage);
 }
 
 static void
@@ -475,12 +756,22 @@ pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	pixman_region32_t hw_damage;
 
 	if (!po->hw_buffer)
 		return;
 
 	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	if (pr->num_threads > 1)
+		run_jobs(pr, output, output_damage);
+	if (po->shadow_image) {
+		pixman_region32_init(&hw_damage);
+		pixman_region32_union(&hw_damage, output_damage,
+				      &po->hw_extra_damage);
+		copy_to_hw_buffer(output, &hw_damage);
+		pixman_region32_fini(&hw_damage);
+	}
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -543,12 +834,14 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	switch (wl_shm_buffer_get_format(shm_buffer)) {
 	case WL_SHM_FORMAT_XRGB8888:
 		pixman_format = PIXMAN_x8r8g8b8;
+		es->is_opaque = 1;
 		break;
 	case WL_SHM_FORMAT_ARGB8888:
 		pixman_format = PIXMAN_a8r8g8b8;
 		break;
 	case WL_SHM_FORMAT_RGB565:
 		pixman_format = PIXMAN_r5g6b5;
+		es->is_opaque = 1;
 		break;
 	default:
 		weston_log("Unsupported SHM buffer format\n");
@@ -652,6 +945,7 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 0xffff;
 	color.blue = blue * 0xffff;
 	color.alpha = alpha * 0xffff;
+	ps->color = color;
 	
 	if (ps->image) {
 		pixman_image_unref(ps->image);
@@ -661,6 +955,63 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	ps->image = pixman_image_create_solid_fill(&color);
 }
 
+static void
+pixman_renderer_fini_workers(struct pixman_renderer *pr)
+{
+	int i;
+
+	pthread_mutex_lock(&pr->mutex);
+	pr->quit = 1;
+	pthread_cond_broadcast(&pr->work_cond);
+	pthread_mutex_unlock(&pr->mutex);
+
+	for (i = 1; i < pr->num_threads; i++)
+		pthread_join(pr->workers[i].thread, NULL);
+
+	free(pr->workers);
+	pthread_cond_destroy(&pr->done_cond);
+	pthread_cond_destroy(&pr->work_cond);
+	pthread_mutex_destroy(&pr->shm_mutex);
+	pthread_mutex_destroy(&pr->mutex);
+	wl_array_release(&pr->jobs);
+}
+
+static void
+pixman_renderer_init_workers(struct pixman_renderer *pr, int num_threads)
+{
+	int i;
+
+	pr->num_threads = 1;
+	wl_array_init(&pr->jobs);
+	pthread_mutex_init(&pr->mutex, NULL);
+	pthread_mutex_init(&pr->shm_mutex, NULL);
+	pthread_cond_init(&pr->work_cond, NULL);
+	pthread_cond_init(&pr->done_cond, NULL);
+
+	if (num_threads > PIXMAN_MAX_THREADS)
+		num_threads = PIXMAN_MAX_THREADS;
+	if (num_threads <= 1)
+		return;
+
+	pr->workers = calloc(num_threads, sizeof *pr->workers);
+	if (!pr->workers)
+		return;
+
+	/* Worker 0 is the main thread. */
+	for (i = 1; i < num_threads; i++) {
+		pr->workers[i].renderer = pr;
+		pr->workers[i].index = i;
+		if (pthread_create(&pr->workers[i].thread, NULL,
+				   pixman_worker_thread, &pr->workers[i]) != 0) {
+			weston_log("failed to start pixman worker %d\n", i);
+			break;
+		}
+	}
+
+	pr->num_threads = i;
+	weston_log("pixman renderer: repainting with %d threads\n", i);
+}
+
 static void
 pixman_renderer_destroy(struct weston_compositor *ec)
 {
@@ -668,6 +1019,7 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	pixman_renderer_fini_workers(pr);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -683,11 +1035,7 @@ debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	pr->repaint_debug ^= 1;
 
 	if (pr->repaint_debug) {
-		pixman_color_t red = {
-			0x3fff, 0x0000, 0x0000, 0x3fff
-		};
-
-		pr->debug_color = pixman_image_create_solid_fill(&red);
+		pr->debug_color = pixman_image_create_solid_fill(&debug_red);
 	} else {
 		pixman_image_unref(pr->debug_color);
 		weston_compositor_damage_all(ec);
@@ -698,11 +1046,18 @@ WL_EXPORT int
 pixman_renderer_init(struct weston_compositor *ec)
 {
 	struct pixman_renderer *renderer;
+	struct weston_config_section *section;
+	int32_t num_threads;
 
 	renderer = calloc(1, sizeof *renderer);
 	if (renderer == NULL)
 		return -1;
 
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_int(section, "pixman-threads",
+				      &num_threads, 1);
+	pixman_renderer_init_workers(renderer, num_threads);
+
 	renderer->repaint_debug = 0;
 	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
@@ -741,8 +1096,20 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 	}
 }
 
+WL_EXPORT void
+pixman_renderer_output_set_hw_extra_damage(struct weston_output *output,
+					   pixman_region32_t *extra_damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	if (extra_damage)
+		pixman_region32_copy(&po->hw_extra_damage, extra_damage);
+	else
+		pixman_region32_clear(&po->hw_extra_damage);
+}
+
 WL_EXPORT int
-pixman_renderer_output_create(struct weston_output *output)
+pixman_renderer_output_create(struct weston_output *output, uint32_t flags)
 {
 	struct pixman_output_state *po = calloc(1, sizeof *po);
 	int w, h;
@@ -750,6 +1117,13 @@ pixman_renderer_output_create(struct weston_output *output)
 	if (!po)
 		return -1;
 
+	pixman_region32_init(&po->hw_extra_damage);
+
+	if (!(flags & PIXMAN_RENDERER_OUTPUT_USE_SHADOW)) {
+		output->renderer_state = po;
+		return 0;
+	}
+
 	/* set shadow image transformation */
 	w = output->current_mode->width;
 	h = output->current_mode->height;
@@ -757,6 +1131,7 @@ pixman_renderer_output_create(struct weston_output *output)
 	po->shadow_buffer = malloc(w * h * 4);
 
 	if (!po->shadow_buffer) {
+		pixman_region32_fini(&po->hw_extra_damage);
 		free(po);
 		return -1;
 	}
@@ -767,6 +1142,7 @@ pixman_renderer_output_create(struct weston_output *output)
 
 	if (!po->shadow_image) {
 		free(po->shadow_buffer);
+		pixman_region32_fini(&po->hw_extra_damage);
 		free(po);
 		return -1;
 	}
@@ -781,11 +1157,16 @@ pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
-	pixman_image_unref(po->shadow_image);
+	if (po->shadow_image) {
+		pixman_image_unref(po->shadow_image);
+		free(po->shadow_buffer);
+	}
 
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
 
+	pixman_region32_fini(&po->hw_extra_damage);
+
 	po->shadow_image = NULL;
 	po->hw_buffer = NULL;
 
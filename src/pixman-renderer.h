@@ -27,11 +27,27 @@
 int
 pixman_renderer_init(struct weston_compositor *ec);
 
+enum pixman_renderer_output_flags {
+	/* Composite into a buffer in system memory and copy the damage to
+	 * the hardware buffer.  Without it the hardware buffer is drawn to
+	 * directly, and must hold the previous frame's contents wherever
+	 * there is no damage. */
+	PIXMAN_RENDERER_OUTPUT_USE_SHADOW = (1 << 0),
+};
+
 int
-pixman_renderer_output_create(struct weston_output *output);
+pixman_renderer_output_create(struct weston_output *output, uint32_t flags);
 
 void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer);
 
+/* Additional damage, on top of the repaint damage, to copy from the
+ * shadow image to the hardware buffer.  Lets backends that cycle through
+ * several hardware buffers bring a stale buffer up to date without
+ * re-rendering it.  Only meaningful with PIXMAN_RENDERER_OUTPUT_USE_SHADOW. */
+void
+pixman_renderer_output_set_hw_extra_damage(struct weston_output *output,
+					   pixman_region32_t *extra_damage);
+
 void
 pixman_renderer_output_destroy(struct weston_output *output);
@@ -82,6 +82,12 @@
 /* If we had a vc_dispmanx_element_set_opaque_rect()... */
 /*#define HAVE_ELEMENT_SET_OPAQUE_RECT 1*/
 
+/* Released resources kept around for reuse by a surface of the same
+ * size, instead of deleting and creating them again */
+#define RPI_RESOURCE_POOL_SIZE 4
+
+struct rpi_resource_pool;
+
 struct rpi_resource {
 	DISPMANX_RESOURCE_HANDLE_T handle;
 	int width;
@@ -90,6 +96,12 @@ struct rpi_resource {
 	int buffer_height; /* height of the buffer */
 	int enable_opaque_regions;
 	VC_IMAGE_TYPE_T ifmt;
+	struct rpi_resource_pool *pool; /* NULL if not pooled */
+};
+
+struct rpi_resource_pool {
+	struct rpi_resource entries[RPI_RESOURCE_POOL_SIZE]; /* oldest first */
+	int count;
 };
 
 struct rpir_output;
@@ -142,6 +154,13 @@ struct rpir_view {
 	DISPMANX_ELEMENT_HANDLE_T handle;
 	int layer;
 
+	/* The Element attributes as last sent, to send only changes */
+	uint8_t alpha;
+	VC_RECT_T src_rect;
+	VC_RECT_T dst_rect;
+	VC_IMAGE_TRANSFORM_T flipmask;
+	DISPMANX_RESOURCE_HANDLE_T resource_handle;
+
 	struct wl_listener view_destroy_listener;
 };
 
@@ -159,14 +178,22 @@ struct rpir_output {
 
 	struct rpi_resource capture_buffer;
 	uint8_t *capture_data;
+
+	/* Elements keep their layer while that keeps the stacking order,
+	 * so the numbers creep up; start over when they get this high. */
+	int renumber_layers;
 };
 
+#define RPIR_MAX_LAYER 10000
+
 struct rpi_renderer {
 	struct weston_renderer base;
 
 	int single_buffer;
 	int enable_opaque_regions;
 
+	struct rpi_resource_pool resource_pool;
+
 #ifdef ENABLE_EGL
 	EGLDisplay egl_display;
 
@@ -242,6 +269,54 @@ static void
 rpi_resource_init(struct rpi_resource *resource)
 {
 	resource->handle = DISPMANX_NO_HANDLE;
+	resource->pool = NULL;
+}
+
+static void
+rpi_resource_pool_put(struct rpi_resource_pool *pool,
+		      struct rpi_resource *resource)
+{
+	if (pool->count == RPI_RESOURCE_POOL_SIZE) {
+		vc_dispmanx_resource_delete(pool->entries[0].handle);
+		memmove(&pool->entries[0], &pool->entries[1],
+			--pool->count * sizeof pool->entries[0]);
+	}
+
+	pool->entries[pool->count++] = *resource;
+}
+
+static int
+rpi_resource_pool_get(struct rpi_resource_pool *pool,
+		      struct rpi_resource *resource, VC_IMAGE_TYPE_T ifmt,
+		      int width, int height, int stride, int buffer_height)
+{
+	struct rpi_resource *entry;
+	int i;
+
+	for (i = pool->count - 1; i >= 0; i--) {
+		entry = &pool->entries[i];
+		if (entry->width == width &&
+		    entry->height == height &&
+		    entry->stride == stride &&
+		    entry->buffer_height == buffer_height &&
+		    entry->ifmt == ifmt)
+			break;
+	}
+
+	if (i < 0)
+		return -1;
+
+	resource->handle = entry->handle;
+	memmove(entry, entry + 1, (--pool->count - i) * sizeof *entry);
+
+	return 0;
+}
+
+static void
+rpi_resource_pool_release(struct rpi_resource_pool *pool)
+{
+	while (pool->count > 0)
+		vc_dispmanx_resource_delete(pool->entries[--pool->count].handle);
 }
 
 static void
@@ -250,7 +325,10 @@ rpi_resource_release(struct rpi_resource *resource)
 	if (resource->handle == DISPMANX_NO_HANDLE)
 		return;
 
-	vc_dispmanx_resource_delete(resource->handle);
+	if (resource->pool)
+		rpi_resource_pool_put(resource->pool, resource);
+	else
+		vc_dispmanx_resource_delete(resource->handle);
 	DBG("resource %p release\n", resource);
 	resource->handle = DISPMANX_NO_HANDLE;
 }
@@ -271,6 +349,13 @@ rpi_resource_realloc(struct rpi_resource *resource, VC_IMAGE_TYPE_T ifmt,
 
 	rpi_resource_release(resource);
 
+	/* A recycled resource holds stale pixels, so it counts as newly
+	 * allocated and gets written in full. */
+	if (resource->pool &&
+	    rpi_resource_pool_get(resource->pool, resource, ifmt, width,
+				  height, stride, buffer_height) == 0)
+		goto done;
+
 	/* NOTE: if stride is not a multiple of 16 pixels in bytes,
 	 * the vc_image_* functions may break. Dispmanx elements
 	 * should be fine, though. Buffer_height probably has similar
@@ -284,6 +369,7 @@ rpi_resource_realloc(struct rpi_resource *resource, VC_IMAGE_TYPE_T ifmt,
 	if (resource->handle == DISPMANX_NO_HANDLE)
 		return -1;
 
+done:
 	resource->width = width;
 	resource->height = height;
 	resource->stride = stride;
@@ -364,8 +450,9 @@ rpi_resource_update(struct rpi_resource *resource, struct weston_buffer *buffer,
 	int stride;
 	int ret;
 	int applied_opaque_region = 0;
-#ifdef HAVE_RESOURCE_WRITE_DATA_RECT
 	int n;
+#ifndef HAVE_RESOURCE_WRITE_DATA_RECT
+	int i, j, y1, y2;
 #endif
 
 	if (!buffer)
@@ -429,14 +516,29 @@ rpi_resource_update(struct rpi_resource *resource, struct weston_buffer *buffer,
 	 * To be able to write more than one scanline at a time,
 	 * the resource must have been created with the same stride
 	 * as used here, and we must write full scanlines.
+	 *
+	 * Write each band of damaged scanlines on its own rather than
+	 * everything between the first and last one, merging bands
+	 * that touch.
 	 */
 
-	r = pixman_region32_extents(&write_region);
-	vc_dispmanx_rect_set(&rect, 0, r->y1, width, r->y2 - r->y1);
-	ret = vc_dispmanx_resource_write_data(resource->handle,
-					      ifmt, stride, pixels, &rect);
-	DBG("%s: %p %ux%u@%u,%u, ret %d\n", __func__, resource,
-	    width, r->y2 - r->y1, 0, r->y1, ret);
+	ret = 0;
+	r = pixman_region32_rectangles(&write_region, &n);
+	for (i = 0; i < n; i = j) {
+		y1 = r[i].y1;
+		y2 = r[i].y2;
+		for (j = i + 1; j < n && r[j].y1 <= y2; j++)
+			y2 = int_max(y2, r[j].y2);
+
+		vc_dispmanx_rect_set(&rect, 0, y1, width, y2 - y1);
+		ret = vc_dispmanx_resource_write_data(resource->handle,
+						      ifmt, stride, pixels,
+						      &rect);
+		DBG("%s: %p %ux%u@%u,%u, ret %d\n", __func__, resource,
+		    width, y2 - y1, 0, y1, ret);
+		if (ret)
+			break;
+	}
 #endif
 
 	wl_shm_buffer_end_access(buffer->shm_buffer);
@@ -510,6 +612,8 @@ rpir_surface_create(struct rpi_renderer *renderer)
 
 	surface->front->enable_opaque_regions = renderer->enable_opaque_regions;
 	surface->back->enable_opaque_regions = renderer->enable_opaque_regions;
+	surface->resources[0].pool = &renderer->resource_pool;
+	surface->resources[1].pool = &renderer->resource_pool;
 
 	surface->buffer_type = BUFFER_TYPE_NULL;
 
@@ -1020,6 +1124,12 @@ rpir_view_dmx_add(struct rpir_view *view, struct rpir_output *output,
 		return -1;
 #endif
 
+	view->alpha = alphasetup.opacity;
+	view->src_rect = src_rect;
+	view->dst_rect = dst_rect;
+	view->flipmask = flipmask;
+	view->resource_handle = resource_handle;
+
 	view->surface->visible_views++;
 
 	return 1;
@@ -1053,10 +1163,9 @@ rpir_view_dmx_move(struct rpir_view *view,
 	VC_RECT_T dst_rect;
 	VC_RECT_T src_rect;
 	VC_IMAGE_TRANSFORM_T flipmask;
+	uint32_t change_flags = 0;
 	int ret;
 
-	/* XXX: return early, if all attributes stay the same */
-
 	if (view->surface->buffer_type == BUFFER_TYPE_EGL) {
 		DISPMANX_RESOURCE_HANDLE_T resource_handle;
 
@@ -1066,23 +1175,40 @@ rpir_view_dmx_move(struct rpir_view *view,
 			return 0;
 		}
 
-		vc_dispmanx_element_change_source(update,
-						  view->handle,
-						  resource_handle);
+		if (resource_handle != view->resource_handle)
+			vc_dispmanx_element_change_source(update,
+							  view->handle,
+							  resource_handle);
+		view->resource_handle = resource_handle;
 	}
 
 	ret = rpir_view_compute_rects(view, &src_rect, &dst_rect, &flipmask);
 	if (ret < 0)
 		return 0;
 
+	if (layer != view->layer)
+		change_flags |= ELEMENT_CHANGE_LAYER;
+	if (alpha != view->alpha)
+		change_flags |= ELEMENT_CHANGE_OPACITY;
+	if (flipmask != view->flipmask)
+		change_flags |= ELEMENT_CHANGE_TRANSFORM;
+	if (memcmp(&dst_rect, &view->dst_rect, sizeof dst_rect))
+		change_flags |= ELEMENT_CHANGE_DEST_RECT;
+	if (memcmp(&src_rect, &view->src_rect, sizeof src_rect))
+		change_flags |= ELEMENT_CHANGE_SRC_RECT;
+
+	if (!change_flags)
+		return 1;
+
+	view->alpha = alpha;
+	view->src_rect = src_rect;
+	view->dst_rect = dst_rect;
+	view->flipmask = flipmask;
+
 	ret = vc_dispmanx_element_change_attributes(
 		update,
 		view->handle,
-		ELEMENT_CHANGE_LAYER |
-			ELEMENT_CHANGE_OPACITY |
-			ELEMENT_CHANGE_TRANSFORM |
-			ELEMENT_CHANGE_DEST_RECT |
-			ELEMENT_CHANGE_SRC_RECT,
+		change_flags,
 		layer,
 		alpha,
 		&dst_rect,
@@ -1155,9 +1281,11 @@ is_view_not_visible(struct weston_view *view)
 	return ret;
 }
 
+/* layer is the layer of the Element below, and is updated to that of
+ * this one if it ends up on screen. */
 static void
 rpir_view_update(struct rpir_view *view, struct rpir_output *output,
-		 DISPMANX_UPDATE_HANDLE_T update, int layer)
+		 DISPMANX_UPDATE_HANDLE_T update, int *layer)
 {
 	int ret;
 	int obscured;
@@ -1175,11 +1303,19 @@ rpir_view_update(struct rpir_view *view, struct rpir_output *output,
 				       &view->link);
 		}
 
-		goto out;
+		return;
 	}
 
+	/* An Element keeps its layer if it is still above the one below,
+	 * so that adding or removing one doesn't move all above it. */
+	if (view->handle != DISPMANX_NO_HANDLE && view->layer > *layer &&
+	    !output->renumber_layers)
+		*layer = view->layer;
+	else
+		(*layer)++;
+
 	if (view->handle == DISPMANX_NO_HANDLE) {
-		ret = rpir_view_dmx_add(view, output, update, layer);
+		ret = rpir_view_dmx_add(view, output, update, *layer);
 		if (ret == 0) {
 			wl_list_remove(&view->link);
 			wl_list_init(&view->link);
@@ -1190,7 +1326,7 @@ rpir_view_update(struct rpir_view *view, struct rpir_output *output,
 		if (view->surface->need_swap)
 			rpir_view_dmx_swap(view, update);
 
-		ret = rpir_view_dmx_move(view, update, layer);
+		ret = rpir_view_dmx_move(view, update, *layer);
 		if (ret == 0) {
 			rpir_view_dmx_remove(view, update);
 
@@ -1202,8 +1338,7 @@ rpir_view_update(struct rpir_view *view, struct rpir_output *output,
 		}
 	}
 
-out:
-	view->layer = layer;
+	view->layer = *layer;
 }
 
 static int
@@ -1394,7 +1529,7 @@ rpi_renderer_repaint_output(struct weston_output *base,
 	struct weston_view *wv;
 	struct rpir_view *view;
 	struct wl_list done_list;
-	int layer = 1;
+	int layer = 0;
 
 	assert(output->update != DISPMANX_NO_HANDLE);
 
@@ -1451,9 +1586,11 @@ rpi_renderer_repaint_output(struct weston_output *base,
 
 		wl_list_remove(&view->link);
 		wl_list_insert(&done_list, &view->link);
-		rpir_view_update(view, output, output->update, layer++);
+		rpir_view_update(view, output, output->update, &layer);
 	}
 
+	output->renumber_layers = layer > RPIR_MAX_LAYER;
+
 	/* Mark all surfaces as swapped */
 	wl_list_for_each_reverse(wv, &compositor->view_list, link)
 		to_rpir_surface(wv->surface)->need_swap = 0;
@@ -1703,6 +1840,8 @@ rpi_renderer_destroy(struct weston_compositor *compositor)
 {
 	struct rpi_renderer *renderer = to_rpi_renderer(compositor);
 
+	rpi_resource_pool_release(&renderer->resource_pool);
+
 #if ENABLE_EGL
 	if (renderer->has_bind_display)
 		renderer->unbind_display(renderer->egl_display,
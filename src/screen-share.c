@@ -27,8 +27,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <linux/input.h>
 #include <errno.h>
@@ -39,6 +44,22 @@
 #include "../shared/os-compatibility.h"
 #include "fullscreen-shell-client-protocol.h"
 
+#ifdef BUILD_VAAPI_RECORDER
+#include "vaapi-recorder.h"
+#endif
+
+struct screen_share {
+	struct weston_compositor *compositor;
+
+	/* Where to stream H.264 to instead of sharing through RDP */
+	char *stream;
+	char *vaapi_device;
+	struct wl_list streams;
+#ifdef BUILD_VAAPI_RECORDER
+	struct vaapi_recorder_config encoder;
+#endif
+};
+
 struct shared_output {
 	struct weston_output *output;
 	struct wl_listener output_destroyed;
@@ -67,10 +88,28 @@ struct shared_output {
 		struct wl_list free_buffers;
 	} shm;
 
+	/* Current contents of the output, in buffer coordinates.  The shm
+	 * buffers are brought up to date from it. */
 	int cache_dirty;
 	pixman_image_t *cache_image;
-	uint32_t *tmp_data;
-	size_t tmp_data_size;
+
+	/* Readbacks of the last repaint still in flight, oldest first */
+	struct wl_list readbacks;
+	int in_readback;
+};
+
+/* Number of shm buffers kept around.  Extra buffers allocated while the
+ * parent holds on to all of them are freed when they are released. */
+#define SS_SHM_RING_SIZE 3
+
+struct ss_readback {
+	/* The one this readback is for, NULL once it is gone */
+	struct shared_output *output;
+	struct ss_stream *stream;
+
+	struct wl_list link;
+	pixman_box32_t rect;		/* in buffer coordinates */
+	int yflip;
 };
 
 struct ss_seat {
@@ -375,7 +414,8 @@ buffer_release(void *data, struct wl_buffer *buffer)
 {
 	struct ss_shm_buffer *sb = data;
 
-	if (sb->output) {
+	if (sb->output &&
+	    wl_list_length(&sb->output->shm.buffers) <= SS_SHM_RING_SIZE) {
 		wl_list_insert(&sb->output->shm.free_buffers, &sb->free_link);
 	} else {
 		ss_shm_buffer_destroy(sb);
@@ -405,12 +445,16 @@ shared_output_get_shm_buffer(struct shared_output *so)
 	    so->shm.height != height) {
 
 		/* Destroy free buffers */
-		wl_list_for_each_safe(sb, bnext, &so->shm.free_buffers, link)
+		wl_list_for_each_safe(sb, bnext, &so->shm.free_buffers,
+				      free_link)
 			ss_shm_buffer_destroy(sb);
 
 		/* Orphan in-use buffers so they get destroyed */
-		wl_list_for_each(sb, &so->shm.buffers, link)
+		wl_list_for_each_safe(sb, bnext, &so->shm.buffers, link) {
 			sb->output = NULL;
+			wl_list_remove(&sb->link);
+			wl_list_init(&sb->link);
+		}
 
 		so->shm.width = width;
 		so->shm.height = height;
@@ -532,42 +576,6 @@ output_compute_transform(struct weston_output *output,
 static void
 shared_output_destroy(struct shared_output *so);
 
-static int
-shared_output_ensure_tmp_data(struct shared_output *so,
-			      pixman_region32_t *region)
-{
-	pixman_box32_t *ext;
-	size_t size;
-
-	if (!pixman_region32_not_empty(region))
-		return 0;
-
-	ext = pixman_region32_extents(region);
-
-	/* Damage is in output coordinates.
-	 *
-	 * We are multiplying by 4 because the temporary data needs to be able
-	 * to store an 32 bit-per-pixel buffer.
-	 */
-	size = 4 * (ext->x2 - ext->x1) * (ext->y2 - ext->y1)
-		 * so->output->current_scale * so->output->current_scale;
-
-	if (so->tmp_data != NULL && size <= so->tmp_data_size)
-		return 0;
-
-	free(so->tmp_data);
-	so->tmp_data = malloc(size);
-	if (so->tmp_data == NULL) {
-		so->tmp_data_size = 0;
-		errno = ENOMEM;
-		return -1;
-	}
-
-	so->tmp_data_size = size;
-
-	return 0;
-}
-
 static void
 shared_output_update(struct shared_output *so);
 
@@ -597,8 +605,10 @@ shared_output_update(struct shared_output *so)
 	int i, nrects;
 	pixman_transform_t transform;
 
-	/* Only update if we need to */
-	if (!so->cache_dirty || so->parent.frame_cb)
+	/* Only update if we need to, and not before the cache holds all
+	 * of the damage the buffers were told about */
+	if (!so->cache_dirty || so->parent.frame_cb ||
+	    !wl_list_empty(&so->readbacks))
 		return;
 
 	sb = shared_output_get_shm_buffer(so);
@@ -763,6 +773,57 @@ struct _wl_fullscreen_shell_mode_feedback_listener mode_feedback_listener = {
 	mode_feedback_ok,
 };
 
+static void
+ss_readback_blit(struct ss_readback *rb, void *pixels, pixman_image_t *cache)
+{
+	int32_t x, y, width, height, stride;
+	uint32_t *cache_data;
+
+	x = rb->rect.x1;
+	y = rb->rect.y1;
+	width = rb->rect.x2 - rb->rect.x1;
+	height = rb->rect.y2 - rb->rect.y1;
+
+	/* The cache may have been resized since, in which case a full
+	 * readback follows anyway */
+	if (!pixels || !cache ||
+	    rb->rect.x2 > pixman_image_get_width(cache) ||
+	    rb->rect.y2 > pixman_image_get_height(cache))
+		return;
+
+	cache_data = pixman_image_get_data(cache);
+	stride = pixman_image_get_stride(cache) / 4;
+
+	if (rb->yflip)
+		pixman_blt(pixels, cache_data, -width, stride,
+			   32, 32, 0, 1 - height, x, y, width, height);
+	else
+		pixman_blt(pixels, cache_data, width, stride,
+			   32, 32, 0, 0, x, y, width, height);
+}
+
+static void
+shared_output_readback_done(struct weston_output *output, void *pixels,
+			    void *data)
+{
+	struct ss_readback *rb = data;
+	struct shared_output *so = rb->output;
+
+	wl_list_remove(&rb->link);
+
+	if (so)
+		ss_readback_blit(rb, pixels, so->cache_image);
+
+	free(rb);
+
+	if (!so || !wl_list_empty(&so->readbacks))
+		return;
+
+	so->cache_dirty = 1;
+	if (!so->in_readback)
+		shared_output_update(so);
+}
+
 static void
 shared_output_repainted(struct wl_listener *listener, void *data)
 {
@@ -770,10 +831,10 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 		container_of(listener, struct shared_output, frame_listener);
 	pixman_region32_t damage;
 	struct ss_shm_buffer *sb;
-	int32_t x, y, width, height, stride;
+	struct ss_readback *rb;
+	int32_t width, height, stride;
 	int i, nrects, do_yflip;
 	pixman_box32_t *r;
-	uint32_t *cache_data;
 
 	/* Damage in output coordinates */
 	pixman_region32_init(&damage);
@@ -814,41 +875,38 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 		pixman_region32_init_rect(&damage, 0, 0, width, height);
 	}
 
-	if (shared_output_ensure_tmp_data(so, &damage) < 0) {
-		shared_output_destroy(so);
-		return;
-	}
-
 	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
-	cache_data = pixman_image_get_data(so->cache_image);
+	/* Read the damage straight into the cache.  With a renderer that
+	 * reads back asynchronously the pixels arrive during the next
+	 * loop iterations, and the shm buffer is only updated once all
+	 * of them are there. */
+	so->in_readback = 1;
 	r = pixman_region32_rectangles(&damage, &nrects);
 	for (i = 0; i < nrects; ++i) {
-		x = r[i].x1;
-		y = r[i].y1;
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
-
-		if (do_yflip) {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, so->output->current_mode->height - r[i].y2,
-				width, height);
-
-			pixman_blt(so->tmp_data, cache_data, -width, stride,
-				   32, 32, 0, 1 - height, x, y, width, height);
-		} else {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, y, width, height);
-
-			pixman_blt(so->tmp_data, cache_data, width, stride,
-				   32, 32, 0, 0, x, y, width, height);
-		}
+		rb = zalloc(sizeof *rb);
+		if (!rb)
+			break;
+
+		rb->output = so;
+		rb->rect = r[i];
+		rb->yflip = do_yflip;
+		wl_list_insert(so->readbacks.prev, &rb->link);
+
+		weston_output_read_pixels_async(so->output, PIXMAN_a8r8g8b8,
+			r[i].x1,
+			do_yflip ? so->output->current_mode->height - r[i].y2 :
+				   r[i].y1,
+			r[i].x2 - r[i].x1, r[i].y2 - r[i].y1,
+			shared_output_readback_done, rb);
 	}
+	so->in_readback = 0;
 
 	pixman_region32_fini(&damage);
 
+	if (!wl_list_empty(&so->readbacks))
+		return;
+
 	so->cache_dirty = 1;
 
 	shared_output_update(so);
@@ -934,6 +992,7 @@ shared_output_create(struct weston_output *output, int parent_fd)
 	/* Ok, everything's created.  We should be good to go */
 	wl_list_init(&so->shm.buffers);
 	wl_list_init(&so->shm.free_buffers);
+	wl_list_init(&so->readbacks);
 
 	so->output = output;
 	so->output_destroyed.notify = output_destroyed;
@@ -961,9 +1020,17 @@ static void
 shared_output_destroy(struct shared_output *so)
 {
 	struct ss_shm_buffer *buffer, *bnext;
+	struct ss_readback *rb, *rbnext;
 
 	so->output->disable_planes--;
 
+	/* These get freed when their readback completes */
+	wl_list_for_each_safe(rb, rbnext, &so->readbacks, link) {
+		rb->output = NULL;
+		wl_list_remove(&rb->link);
+		wl_list_init(&rb->link);
+	}
+
 	wl_list_for_each_safe(buffer, bnext, &so->shm.buffers, link)
 		ss_shm_buffer_destroy(buffer);
 	wl_list_for_each_safe(buffer, bnext, &so->shm.free_buffers, link)
@@ -976,7 +1043,6 @@ shared_output_destroy(struct shared_output *so)
 	wl_list_remove(&so->frame_listener.link);
 
 	pixman_image_unref(so->cache_image);
-	free(so->tmp_data);
 
 	free(so);
 }
@@ -1036,6 +1102,321 @@ weston_output_share(struct weston_output *output,
 	return NULL;
 }
 
+#ifdef BUILD_VAAPI_RECORDER
+
+/* An output encoded to H.264 and written out as an elementary stream,
+ * for a player or a network sender on the other end of a pipe, socket
+ * or file.  Pixels are read back into a cache like for a shared output,
+ * and every repaint uploads the cache for encoding. */
+struct ss_stream {
+	struct screen_share *ss;
+	struct weston_output *output;
+	struct wl_list link;		/* screen_share::streams */
+	struct wl_listener output_destroyed;
+	struct wl_listener frame_listener;
+
+	struct vaapi_recorder *recorder;
+
+	/* Current contents of the output, in buffer coordinates */
+	pixman_image_t *cache_image;
+
+	/* Readbacks of the last repaint still in flight, oldest first */
+	struct wl_list readbacks;
+	int in_readback;
+};
+
+static void
+ss_stream_destroy(struct ss_stream *st)
+{
+	struct ss_readback *rb, *rbnext;
+
+	weston_log("screen-share: stopped streaming %s\n", st->output->name);
+
+	/* These get freed when their readback completes */
+	wl_list_for_each_safe(rb, rbnext, &st->readbacks, link) {
+		rb->stream = NULL;
+		wl_list_remove(&rb->link);
+		wl_list_init(&rb->link);
+	}
+
+	st->output->disable_planes--;
+
+	wl_list_remove(&st->link);
+	wl_list_remove(&st->output_destroyed.link);
+	wl_list_remove(&st->frame_listener.link);
+
+	vaapi_recorder_destroy(st->recorder);
+	pixman_image_unref(st->cache_image);
+
+	free(st);
+}
+
+static void
+ss_stream_send(struct ss_stream *st)
+{
+	int ret;
+
+	ret = vaapi_recorder_frame_data(st->recorder,
+					pixman_image_get_data(st->cache_image),
+					pixman_image_get_stride(st->cache_image));
+	if (ret < 0) {
+		weston_log("screen-share: stream failed: %m\n");
+		ss_stream_destroy(st);
+	}
+}
+
+static void
+ss_stream_readback_done(struct weston_output *output, void *pixels,
+			void *data)
+{
+	struct ss_readback *rb = data;
+	struct ss_stream *st = rb->stream;
+
+	wl_list_remove(&rb->link);
+
+	if (st)
+		ss_readback_blit(rb, pixels, st->cache_image);
+
+	free(rb);
+
+	if (!st || !wl_list_empty(&st->readbacks) || st->in_readback)
+		return;
+
+	ss_stream_send(st);
+}
+
+static void
+ss_stream_repainted(struct wl_listener *listener, void *data)
+{
+	struct ss_stream *st =
+		container_of(listener, struct ss_stream, frame_listener);
+	struct weston_output *output = st->output;
+	pixman_region32_t damage;
+	struct ss_readback *rb;
+	pixman_box32_t *r;
+	int i, nrects, do_yflip;
+
+	/* The encoder is set up for one size */
+	if (output->current_mode->width !=
+	    pixman_image_get_width(st->cache_image) ||
+	    output->current_mode->height !=
+	    pixman_image_get_height(st->cache_image)) {
+		weston_log("screen-share: mode of %s changed\n",
+			   output->name);
+		ss_stream_destroy(st);
+		return;
+	}
+
+	pixman_region32_init(&damage);
+	pixman_region32_intersect(&damage, &output->region,
+				  &output->previous_damage);
+	pixman_region32_translate(&damage, -output->x, -output->y);
+	weston_transformed_region(output->width, output->height,
+				  output->transform, output->current_scale,
+				  &damage, &damage);
+
+	do_yflip = !!(output->compositor->capabilities &
+		      WESTON_CAP_CAPTURE_YFLIP);
+
+	st->in_readback = 1;
+	r = pixman_region32_rectangles(&damage, &nrects);
+	for (i = 0; i < nrects; ++i) {
+		rb = zalloc(sizeof *rb);
+		if (!rb)
+			break;
+
+		rb->stream = st;
+		rb->rect = r[i];
+		rb->yflip = do_yflip;
+		wl_list_insert(st->readbacks.prev, &rb->link);
+
+		weston_output_read_pixels_async(output, PIXMAN_a8r8g8b8,
+			r[i].x1,
+			do_yflip ? output->current_mode->height - r[i].y2 :
+				   r[i].y1,
+			r[i].x2 - r[i].x1, r[i].y2 - r[i].y1,
+			ss_stream_readback_done, rb);
+	}
+	st->in_readback = 0;
+
+	pixman_region32_fini(&damage);
+
+	if (!wl_list_empty(&st->readbacks))
+		return;
+
+	ss_stream_send(st);
+}
+
+static void
+ss_stream_output_destroyed(struct wl_listener *l, void *data)
+{
+	struct ss_stream *st =
+		container_of(l, struct ss_stream, output_destroyed);
+
+	ss_stream_destroy(st);
+}
+
+/* Open the stream target: "tcp:host:port" or "unix:path" connect to a
+ * listening socket, anything else is a path to a fifo or a file. */
+static int
+ss_stream_open_target(const char *target)
+{
+	struct addrinfo hints, *res, *ai;
+	struct sockaddr_un addr;
+	char *host, *port;
+	int fd = -1, flag = 1;
+
+	if (strncmp(target, "tcp:", 4) == 0) {
+		host = strdup(target + 4);
+		if (!host)
+			return -1;
+
+		port = strrchr(host, ':');
+		if (!port) {
+			weston_log("screen-share: no port in %s\n", target);
+			free(host);
+			return -1;
+		}
+		*port++ = '\0';
+
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host, port, &hints, &res) != 0) {
+			weston_log("screen-share: cannot resolve %s\n", host);
+			free(host);
+			return -1;
+		}
+		free(host);
+
+		for (ai = res; ai; ai = ai->ai_next) {
+			fd = socket(ai->ai_family,
+				    ai->ai_socktype | SOCK_CLOEXEC,
+				    ai->ai_protocol);
+			if (fd < 0)
+				continue;
+			if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+
+		/* Don't hold back the tail of a frame */
+		if (fd >= 0)
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+				   &flag, sizeof flag);
+	} else if (strncmp(target, "unix:", 5) == 0) {
+		memset(&addr, 0, sizeof addr);
+		addr.sun_family = AF_UNIX;
+		if (strlen(target + 5) >= sizeof addr.sun_path)
+			return -1;
+		strcpy(addr.sun_path, target + 5);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0 &&
+		    connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	} else {
+		/* Opening a fifo without a reader fails instead of
+		 * blocking the compositor */
+		fd = open(target, O_WRONLY | O_CREAT | O_TRUNC |
+			  O_NONBLOCK | O_CLOEXEC, 0644);
+		if (fd >= 0)
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	}
+
+	return fd;
+}
+
+static struct ss_stream *
+ss_stream_create(struct screen_share *ss, struct weston_output *output)
+{
+	struct ss_stream *st;
+	int32_t width, height;
+	int drm_fd, fd;
+
+	st = zalloc(sizeof *st);
+	if (!st)
+		return NULL;
+
+	width = output->current_mode->width;
+	height = output->current_mode->height;
+
+	st->cache_image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+						   width, height, NULL, 0);
+	if (!st->cache_image)
+		goto err_free;
+
+	drm_fd = open(ss->vaapi_device, O_RDWR | O_CLOEXEC);
+	if (drm_fd < 0) {
+		weston_log("screen-share: cannot open %s: %m\n",
+			   ss->vaapi_device);
+		goto err_image;
+	}
+
+	fd = ss_stream_open_target(ss->stream);
+	if (fd < 0) {
+		weston_log("screen-share: cannot open stream %s: %m\n",
+			   ss->stream);
+		goto err_drm;
+	}
+
+	/* Takes over both fds */
+	st->recorder = vaapi_recorder_create_for_fd(drm_fd, width, height, fd,
+						    &ss->encoder);
+	if (!st->recorder) {
+		weston_log("screen-share: failed to set up the encoder\n");
+		close(fd);
+		goto err_drm;
+	}
+
+	st->ss = ss;
+	st->output = output;
+	wl_list_init(&st->readbacks);
+	wl_list_insert(&ss->streams, &st->link);
+
+	st->output_destroyed.notify = ss_stream_output_destroyed;
+	wl_signal_add(&output->destroy_signal, &st->output_destroyed);
+
+	st->frame_listener.notify = ss_stream_repainted;
+	wl_signal_add(&output->frame_signal, &st->frame_listener);
+	output->disable_planes++;
+	weston_output_damage(output);
+
+	weston_log("screen-share: streaming %s to %s\n",
+		   output->name, ss->stream);
+
+	return st;
+
+err_drm:
+	close(drm_fd);
+err_image:
+	pixman_image_unref(st->cache_image);
+err_free:
+	free(st);
+	return NULL;
+}
+
+static void
+ss_stream_toggle(struct screen_share *ss, struct weston_output *output)
+{
+	struct ss_stream *st;
+
+	wl_list_for_each(st, &ss->streams, link) {
+		if (st->output == output) {
+			ss_stream_destroy(st);
+			return;
+		}
+	}
+
+	ss_stream_create(ss, output);
+}
+
+#endif /* BUILD_VAAPI_RECORDER */
+
 static struct weston_output *
 weston_output_find(struct weston_compositor *c, int32_t x, int32_t y)
 {
@@ -1055,6 +1436,7 @@ static void
 share_output_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 		     void *data)
 {
+	struct screen_share *ss = data;
 	struct weston_output *output;
 	const char *path = BINDIR "/weston";
 
@@ -1071,6 +1453,13 @@ share_output_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 		return;
 	}
 
+#ifdef BUILD_VAAPI_RECORDER
+	if (ss->stream) {
+		ss_stream_toggle(ss, output);
+		return;
+	}
+#endif
+
 	char *const argv[] = {
 		"weston",
 		"--backend=rdp-backend.so",
@@ -1086,8 +1475,43 @@ WL_EXPORT int
 module_init(struct weston_compositor *compositor,
 	    int *argc, char *argv[])
 {
+	struct screen_share *ss;
+	struct weston_config_section *section;
+
+	ss = zalloc(sizeof *ss);
+	if (!ss)
+		return -1;
+
+	ss->compositor = compositor;
+	wl_list_init(&ss->streams);
+
+	section = weston_config_get_section(compositor->config,
+					    "screen-share", NULL, NULL);
+	weston_config_section_get_string(section, "stream", &ss->stream,
+					 NULL);
+	weston_config_section_get_string(section, "vaapi-device",
+					 &ss->vaapi_device,
+					 "/dev/dri/renderD128");
+
+#ifdef BUILD_VAAPI_RECORDER
+	/* Streams are watched live, so default to a steady bitrate with
+	 * a frame to start from every few seconds */
+	vaapi_recorder_config_init(&ss->encoder);
+	ss->encoder.rate_control = VAAPI_RECORDER_RC_CBR;
+	ss->encoder.idr_period = 120;
+	ss->encoder.low_latency = 1;
+	vaapi_recorder_config_read(&ss->encoder, section);
+#else
+	if (ss->stream) {
+		weston_log("screen-share: built without libva, "
+			   "sharing through RDP instead of streaming\n");
+		free(ss->stream);
+		ss->stream = NULL;
+	}
+#endif
+
 	weston_compositor_add_key_binding(compositor, KEY_S,
 				          MODIFIER_CTRL | MODIFIER_ALT,
-					  share_output_binding, compositor);
+					  share_output_binding, ss);
 	return 0;
 }
@@ -28,7 +28,24 @@
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <netdb.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define SWAP_RB_SSSE3 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SWAP_RB_NEON 1
+#endif
 
 #include "compositor.h"
 #include "screenshooter-server-protocol.h"
@@ -41,37 +58,42 @@ struct screenshooter {
 	struct wl_client *client;
 	struct weston_process process;
 	struct wl_listener destroy_listener;
+	char *recorder_stream;	/* address to stream to, or NULL */
 };
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
+	struct wl_listener buffer_destroy_listener;
 	struct weston_buffer *buffer;
+	int32_t x, y, width, height;
 	weston_screenshooter_done_func_t done;
 	void *data;
 };
 
+/* The row copies take the bytes per row to copy and the strides of
+ * both sides. A negative src_stride walks the source bottom up for
+ * renderers that read back upside down. */
+
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_bgra(uint8_t *dst, int dst_stride, uint8_t *src, int src_stride,
+	  int bytes, int height)
 {
-	uint8_t *end;
+	int i;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
+	if (dst_stride == bytes && src_stride == bytes) {
+		memcpy(dst, src, height * bytes);
+		return;
 	}
-}
 
-static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	/* TODO: optimize this out */
-	memcpy(dst, src, height * stride);
+	for (i = 0; i < height; i++) {
+		memcpy(dst, src, bytes);
+		dst += dst_stride;
+		src += src_stride;
+	}
 }
 
 static void
-copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
+copy_row_swap_RB_c(void *vdst, void *vsrc, int bytes)
 {
 	uint32_t *dst = vdst;
 	uint32_t *src = vsrc;
@@ -87,47 +109,103 @@ copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
 	}
 }
 
+#if defined(SWAP_RB_SSSE3)
+__attribute__((target("ssse3")))
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_row_swap_RB_ssse3(void *vdst, void *vsrc, int bytes)
 {
-	uint8_t *end;
+	const __m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+					   10, 9, 8, 11, 14, 13, 12, 15);
+	uint8_t *dst = vdst;
+	uint8_t *src = vsrc;
+	int i;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
+	for (i = 0; i + 16 <= bytes; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+		_mm_storeu_si128((__m128i *) (dst + i),
+				 _mm_shuffle_epi8(v, swap));
+	}
+
+	copy_row_swap_RB_c(dst + i, src + i, bytes - i);
+}
+#elif defined(SWAP_RB_NEON)
+static void
+copy_row_swap_RB_neon(void *vdst, void *vsrc, int bytes)
+{
+	uint8_t *dst = vdst;
+	uint8_t *src = vsrc;
+	uint8x16x4_t v;
+	uint8x16_t tmp;
+	int i;
+
+	/* De-interleaved loads put each channel in its own register */
+	for (i = 0; i + 64 <= bytes; i += 64) {
+		v = vld4q_u8(src + i);
+		tmp = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = tmp;
+		vst4q_u8(dst + i, v);
 	}
+
+	copy_row_swap_RB_c(dst + i, src + i, bytes - i);
 }
+#endif
+
+static void (*copy_row_swap_RB)(void *vdst, void *vsrc, int bytes) =
+	copy_row_swap_RB_c;
 
 static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_row_swap_RB_init(void)
 {
-	uint8_t *end;
+#if defined(SWAP_RB_SSSE3)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3"))
+		copy_row_swap_RB = copy_row_swap_RB_ssse3;
+#elif defined(SWAP_RB_NEON)
+	copy_row_swap_RB = copy_row_swap_RB_neon;
+#endif
+}
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src += stride;
+static void
+copy_rgba(uint8_t *dst, int dst_stride, uint8_t *src, int src_stride,
+	  int bytes, int height)
+{
+	int i;
+
+	for (i = 0; i < height; i++) {
+		copy_row_swap_RB(dst, src, bytes);
+		dst += dst_stride;
+		src += src_stride;
 	}
 }
 
 static void
-screenshooter_frame_notify(struct wl_listener *listener, void *data)
+screenshooter_buffer_destroyed(struct wl_listener *listener, void *data)
 {
 	struct screenshooter_frame_listener *l =
-		container_of(listener,
-			     struct screenshooter_frame_listener, listener);
-	struct weston_output *output = data;
-	struct weston_compositor *compositor = output->compositor;
-	int32_t stride;
-	uint8_t *pixels, *d, *s;
+		container_of(listener, struct screenshooter_frame_listener,
+			     buffer_destroy_listener);
 
-	output->disable_planes--;
 	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+	l->buffer = NULL;
+}
+
+static void
+screenshooter_read_done(struct weston_output *output, void *data_pixels,
+			void *data)
+{
+	struct screenshooter_frame_listener *l = data;
+	struct weston_compositor *compositor = output->compositor;
+	int32_t stride, src_stride, bytes;
+	uint8_t *pixels = data_pixels, *d, *s;
+
+	if (l->buffer == NULL) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		free(l);
+		return;
+	}
+
+	wl_list_remove(&l->buffer_destroy_listener.link);
 
 	if (pixels == NULL) {
 		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
@@ -135,32 +213,28 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 		return;
 	}
 
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
-
 	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
+	bytes = l->width * 4;
 
 	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP) {
+		s = pixels + bytes * (l->height - 1);
+		src_stride = -bytes;
+	} else {
+		s = pixels;
+		src_stride = bytes;
+	}
 
 	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
 
 	switch (compositor->read_format) {
 	case PIXMAN_a8r8g8b8:
 	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
+		copy_bgra(d, stride, s, src_stride, bytes, l->height);
 		break;
 	case PIXMAN_x8b8g8r8:
 	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
+		copy_rgba(d, stride, s, src_stride, bytes, l->height);
 		break;
 	default:
 		break;
@@ -169,14 +243,47 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 	wl_shm_buffer_end_access(l->buffer->shm_buffer);
 
 	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
-	free(pixels);
 	free(l);
 }
 
+static void
+screenshooter_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener,
+			     struct screenshooter_frame_listener, listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	int32_t y;
+
+	output->disable_planes--;
+	wl_list_remove(&listener->link);
+
+	if (l->buffer == NULL) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		free(l);
+		return;
+	}
+
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
+		y = output->current_mode->height - l->y - l->height;
+	else
+		y = l->y;
+
+	weston_output_read_pixels_async(output, compositor->read_format,
+					l->x, y, l->width, l->height,
+					screenshooter_read_done, l);
+}
+
+/* Captures the rectangle at x, y of the output's framebuffer into the
+ * top left corner of buffer. */
 WL_EXPORT int
-weston_screenshooter_shoot(struct weston_output *output,
-			   struct weston_buffer *buffer,
-			   weston_screenshooter_done_func_t done, void *data)
+weston_screenshooter_shoot_region(struct weston_output *output,
+				  struct weston_buffer *buffer,
+				  int32_t x, int32_t y,
+				  int32_t width, int32_t height,
+				  weston_screenshooter_done_func_t done,
+				  void *data)
 {
 	struct screenshooter_frame_listener *l;
 
@@ -189,8 +296,10 @@ weston_screenshooter_shoot(struct weston_output *output,
 	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
 
-	if (buffer->width < output->current_mode->width ||
-	    buffer->height < output->current_mode->height) {
+	if (x < 0 || y < 0 || width <= 0 || height <= 0 ||
+	    x + width > output->current_mode->width ||
+	    y + height > output->current_mode->height ||
+	    buffer->width < width || buffer->height < height) {
 		done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 		return -1;
 	}
@@ -202,8 +311,18 @@ weston_screenshooter_shoot(struct weston_output *output,
 	}
 
 	l->buffer = buffer;
+	l->x = x;
+	l->y = y;
+	l->width = width;
+	l->height = height;
 	l->done = done;
 	l->data = data;
+
+	/* The pixels arrive a frame or two later, the client may destroy
+	 * the buffer in the meantime. */
+	l->buffer_destroy_listener.notify = screenshooter_buffer_destroyed;
+	wl_signal_add(&buffer->destroy_signal, &l->buffer_destroy_listener);
+
 	l->listener.notify = screenshooter_frame_notify;
 	wl_signal_add(&output->frame_signal, &l->listener);
 	output->disable_planes++;
@@ -212,6 +331,17 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+WL_EXPORT int
+weston_screenshooter_shoot(struct weston_output *output,
+			   struct weston_buffer *buffer,
+			   weston_screenshooter_done_func_t done, void *data)
+{
+	return weston_screenshooter_shoot_region(output, buffer, 0, 0,
+						 output->current_mode->width,
+						 output->current_mode->height,
+						 done, data);
+}
+
 static void
 screenshooter_done(void *data, enum weston_screenshooter_outcome outcome)
 {
@@ -248,8 +378,30 @@ screenshooter_shoot(struct wl_client *client,
 	weston_screenshooter_shoot(output, buffer, screenshooter_done, resource);
 }
 
+static void
+screenshooter_shoot_region(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *output_resource,
+			   struct wl_resource *buffer_resource,
+			   int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct weston_output *output =
+		wl_resource_get_user_data(output_resource);
+	struct weston_buffer *buffer =
+		weston_buffer_from_resource(buffer_resource);
+
+	if (buffer == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	weston_screenshooter_shoot_region(output, buffer, x, y, width, height,
+					  screenshooter_done, resource);
+}
+
 struct screenshooter_interface screenshooter_implementation = {
-	screenshooter_shoot
+	screenshooter_shoot,
+	screenshooter_shoot_region
 };
 
 static void
@@ -259,8 +411,8 @@ bind_shooter(struct wl_client *client,
 	struct screenshooter *shooter = data;
 	struct wl_resource *resource;
 
-	resource = wl_resource_create(client,
-				      &screenshooter_interface, 1, id);
+	resource = wl_resource_create(client, &screenshooter_interface,
+				      MIN(version, 2), id);
 
 	if (client != shooter->client) {
 		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
@@ -294,14 +446,79 @@ screenshooter_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 					screenshooter_exe, screenshooter_sigchld);
 }
 
+/* Frames either being read back or waiting for the encoder thread.  A
+ * frame arriving with this many in flight is dropped, and its damage is
+ * carried over to the next frame so the recording stays correct. */
+#define RECORDER_QUEUE_SIZE	4
+
+/* Frame time between keyframes, which are where decoders can seek to.
+ * A stream has them more often, as viewers that fell behind wait for
+ * the next one to catch up. */
+#define RECORDER_KEYFRAME_MSECS	10000
+#define RECORDER_STREAM_KEYFRAME_MSECS	2000
+
+/* A viewer of a streaming recorder.  Frames it has no room for in its
+ * socket buffer are skipped, and it is sent nothing but the rest of a
+ * partly sent frame until the next keyframe. */
+struct weston_recorder_viewer {
+	struct wl_list link;
+	int fd;
+	int synced;	/* sent a keyframe and every frame since */
+	void *backlog;	/* unsent tail of the last frame */
+	size_t backlog_size, backlog_sent;
+};
+
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
+	uint32_t *frame;
+	void *tmpbuf, *lz4buf;
+	size_t tmpbuf_size, lz4buf_size;
 	uint32_t total;
-	int fd;
+	int fd;		/* the file, -1 when streaming */
+	int width, height, yflip;
+	uint32_t keyframe_msecs;	/* of the last keyframe */
+	uint32_t keyframe_interval;
 	struct wl_listener frame_listener;
-	int count, destroying;
+	int count, destroying, stopped;
+	int pending;	/* frames being read back */
+	int dropped;
+	pixman_region32_t dropped_damage;
+
+	/* The diff, run-length encoding and write run on this thread,
+	 * which alone touches frame, tmpbuf and fd once started */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t queue_cond;
+
+	/* Offset and index of the frames written so far, written at
+	 * the end of the file once the thread is done */
+	uint64_t offset;
+	struct wl_array index;	/* wcap_index_entry */
+
+	/* Protected by mutex */
+	struct wl_list queue;	/* weston_recorder_frame::link */
+	int queued;		/* frames queued or being encoded */
+	int quit;
+	int need_keyframe;
+	struct wl_list joining;	/* viewers accepted since the last frame */
+
+	/* Streaming: viewers connect to listen_fd and are sent the header
+	 * right away, the encoder thread takes them over from joining */
+	int listen_fd;
+	struct wl_event_source *listen_source;
+	struct wcap_header_v2 header;
+	struct wl_list viewers;	/* encoder thread only */
+};
+
+/* A frame whose damage is being read back, encoded once the pixels
+ * arrive.  The readback covers the extents of the damage. */
+struct weston_recorder_frame {
+	struct weston_recorder *recorder;
+	struct wl_list link;
+	uint32_t msecs;
+	int keyframe;
+	pixman_region32_t damage;
+	uint32_t *pixels;	/* copy of the readback */
 };
 
 static uint32_t *
@@ -337,81 +554,218 @@ component_delta(uint32_t next, uint32_t prev)
 
 static void
 weston_recorder_destroy(struct weston_recorder *recorder);
+static void
+weston_recorder_release(struct weston_recorder *recorder);
+
+static int
+weston_recorder_reserve(void **buf, size_t *size, size_t need)
+{
+	void *p;
+
+	if (*size >= need)
+		return 0;
+
+	p = realloc(*buf, need);
+	if (p == NULL)
+		return -1;
+
+	*buf = p;
+	*size = need;
+
+	return 0;
+}
 
 static void
-weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+weston_recorder_viewer_destroy(struct weston_recorder_viewer *viewer)
 {
-	struct weston_recorder *recorder =
-		container_of(listener, struct weston_recorder, frame_listener);
-	struct weston_output *output = data;
-	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
-	pixman_box32_t *r;
-	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
+	wl_list_remove(&viewer->link);
+	close(viewer->fd);
+	free(viewer->backlog);
+	free(viewer);
+}
 
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+/* Send what is left of a partly sent frame.  Returns -1 if the viewer
+ * is gone. */
+static int
+weston_recorder_viewer_flush(struct weston_recorder_viewer *viewer)
+{
+	ssize_t n;
+
+	while (viewer->backlog_sent < viewer->backlog_size) {
+		n = send(viewer->fd,
+			 (uint8_t *) viewer->backlog + viewer->backlog_sent,
+			 viewer->backlog_size - viewer->backlog_sent,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -1;
+		viewer->backlog_sent += n;
+	}
 
-	pixman_region32_init(&damage);
-	pixman_region32_init(&transformed_damage);
-	pixman_region32_intersect(&damage, &output->region,
-				  &output->previous_damage);
-	pixman_region32_translate(&damage, -output->x, -output->y);
-	weston_transformed_region(output->width, output->height,
-				 output->transform, output->current_scale,
-				 &damage, &transformed_damage);
-	pixman_region32_fini(&damage);
+	return 0;
+}
 
-	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
-		pixman_region32_fini(&transformed_damage);
-		return;
+/* Send a frame without blocking; a part the socket had no room for is
+ * kept in the backlog.  Returns -1 if the viewer is gone. */
+static int
+weston_recorder_viewer_send(struct weston_recorder_viewer *viewer,
+			    struct iovec *v, int n, size_t size)
+{
+	struct msghdr msg;
+	ssize_t sent;
+	size_t skip, len;
+	void *p;
+	int i;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = v;
+	msg.msg_iovlen = n;
+
+	do {
+		sent = sendmsg(viewer->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (sent < 0 && errno == EINTR);
+
+	if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		viewer->synced = 0;
+		return 0;
 	}
+	if (sent < 0)
+		return -1;
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	viewer->synced = 1;
+	if ((size_t) sent == size)
+		return 0;
+
+	p = realloc(viewer->backlog, size - sent);
+	if (p == NULL)
+		return -1;
+	viewer->backlog = p;
+	viewer->backlog_size = size - sent;
+	viewer->backlog_sent = 0;
+
+	skip = sent;
+	for (i = 0, p = viewer->backlog; i < n; i++) {
+		if (skip >= v[i].iov_len) {
+			skip -= v[i].iov_len;
+			continue;
+		}
+		len = v[i].iov_len - skip;
+		memcpy(p, (uint8_t *) v[i].iov_base + skip, len);
+		p = (uint8_t *) p + len;
+		skip = 0;
+	}
+
+	return 0;
+}
+
+/* Hand a frame to each viewer that can decode it and has room for it.
+ * Returns the size of the frame. */
+static ssize_t
+weston_recorder_stream(struct weston_recorder *recorder,
+		       struct iovec *v, int n, int keyframe)
+{
+	struct weston_recorder_viewer *viewer, *next;
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		size += v[i].iov_len;
+
+	pthread_mutex_lock(&recorder->mutex);
+	wl_list_insert_list(recorder->viewers.prev, &recorder->joining);
+	wl_list_init(&recorder->joining);
+	pthread_mutex_unlock(&recorder->mutex);
+
+	wl_list_for_each_safe(viewer, next, &recorder->viewers, link) {
+		if (weston_recorder_viewer_flush(viewer) < 0) {
+			weston_recorder_viewer_destroy(viewer);
+			continue;
+		}
+
+		/* Still busy with an earlier frame: skip this one, and
+		 * the rest up to the next keyframe */
+		if (viewer->backlog_sent < viewer->backlog_size) {
+			viewer->synced = 0;
+			continue;
+		}
+
+		if (!viewer->synced && !keyframe)
+			continue;
+
+		if (weston_recorder_viewer_send(viewer, v, n, size) < 0)
+			weston_recorder_viewer_destroy(viewer);
+	}
+
+	return size;
+}
+
+static void
+weston_recorder_encode(struct weston_recorder *recorder,
+		       struct weston_recorder_frame *frame)
+{
+	static const uint8_t zero[8];
+	uint32_t *pixels = frame->pixels;
+	pixman_box32_t *r, *ext;
+	int i, j, k, n, width, height, run, stride, ext_stride, y, row;
+	uint32_t delta, prev, *d, *s, *p, next;
+	struct wcap_frame_header_v2 header;
+	struct wcap_index_entry *entry;
+	struct iovec v[3];
+	size_t area, raw_size;
+	void *payload;
+	ssize_t written;
+
+	ext = pixman_region32_extents(&frame->damage);
+	ext_stride = ext->x2 - ext->x1;
+	r = pixman_region32_rectangles(&frame->damage, &n);
+
+	/* Each run codes at least one pixel */
+	area = 0;
+	for (i = 0; i < n; i++)
+		area += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+	raw_size = n * sizeof *r + area * 4;
+
+	/* A stream has no index to seek with */
+	entry = NULL;
+	if (recorder->fd >= 0) {
+		entry = wl_array_add(&recorder->index, sizeof *entry);
+		if (entry == NULL)
+			goto fail;
+	}
+
+	if (weston_recorder_reserve(&recorder->tmpbuf, &recorder->tmpbuf_size,
+				    raw_size) < 0)
+		goto fail;
+
+	/* Keyframes are coded against black, so a decoder can start
+	 * from any of them */
+	if (frame->keyframe)
+		memset(recorder->frame, 0,
+		       recorder->width * recorder->height * 4);
+
+	memcpy(recorder->tmpbuf, r, n * sizeof *r);
+	p = (uint32_t *) ((pixman_box32_t *) recorder->tmpbuf + n);
+	stride = recorder->width;
 
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
-		else
-			y_orig = r[i].y1;
-
-		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
-		s = recorder->rect;
-		p = outbuf;
 		run = prev = 0; /* quiet gcc */
 		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				y_orig = r[i].y2 - j - 1;
-			else
-				y_orig = r[i].y1 + j;
-			d = recorder->frame + stride * y_orig + r[i].x1;
+			/* y-flipped reads come bottom row first */
+			if (recorder->yflip) {
+				y = r[i].y2 - j - 1;
+				row = ext->y2 - 1 - y;
+			} else {
+				y = r[i].y1 + j;
+				row = y - ext->y1;
+			}
+			s = pixels + ext_stride * row + r[i].x1 - ext->x1;
+			d = recorder->frame + stride * y + r[i].x1;
 
 			for (k = 0; k < width; k++) {
 				next = *s++;
@@ -428,23 +782,243 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 		}
 
 		p = output_run(p, prev, run);
+	}
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
-
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
+	header.msecs = frame->msecs;
+	header.nrects = n;
+	header.flags = frame->keyframe ? WCAP_FRAME_KEYFRAME : 0;
+	header.raw_size = (uint8_t *) p - (uint8_t *) recorder->tmpbuf;
+	header.reserved = 0;
+
+	payload = recorder->tmpbuf;
+	header.size = header.raw_size;
+#ifdef HAVE_LZ4
+	if (weston_recorder_reserve(&recorder->lz4buf, &recorder->lz4buf_size,
+				    LZ4_compressBound(header.raw_size)) < 0)
+		goto fail;
+
+	header.size = LZ4_compress_default(recorder->tmpbuf, recorder->lz4buf,
+					   header.raw_size,
+					   (int) recorder->lz4buf_size);
+	if (header.size == 0)
+		goto fail;
+	payload = recorder->lz4buf;
 #endif
+
+	v[0].iov_base = &header;
+	v[0].iov_len = sizeof header;
+	v[1].iov_base = payload;
+	v[1].iov_len = header.size;
+	v[2].iov_base = (void *) zero;
+	v[2].iov_len = WCAP_ALIGN(header.size) - header.size;
+
+	if (recorder->fd < 0) {
+		written = weston_recorder_stream(recorder, v, 3,
+						 frame->keyframe);
+	} else {
+		written = writev(recorder->fd, v, 3);
+		if (written < 0)
+			written = 0;
+
+		entry->offset = recorder->offset;
+		entry->msecs = frame->msecs;
+		entry->flags = header.flags;
+		recorder->offset += written;
+	}
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->total += written;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	return;
+
+fail:
+	/* Out of memory: the previous frame is out of sync now, so
+	 * have the compositor send a keyframe next */
+	if (entry)
+		recorder->index.size -= sizeof *entry;
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->need_keyframe = 1;
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+static void
+weston_recorder_frame_free(struct weston_recorder_frame *frame)
+{
+	pixman_region32_fini(&frame->damage);
+	free(frame->pixels);
+	free(frame);
+}
+
+static void *
+weston_recorder_thread(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_frame *frame;
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	for (;;) {
+		while (wl_list_empty(&recorder->queue) && !recorder->quit)
+			pthread_cond_wait(&recorder->queue_cond,
+					  &recorder->mutex);
+
+		/* Frames queued before stopping are still written */
+		if (wl_list_empty(&recorder->queue))
+			break;
+
+		frame = container_of(recorder->queue.next,
+				     struct weston_recorder_frame, link);
+		wl_list_remove(&frame->link);
+
+		pthread_mutex_unlock(&recorder->mutex);
+		weston_recorder_encode(recorder, frame);
+		weston_recorder_frame_free(frame);
+		pthread_mutex_lock(&recorder->mutex);
+
+		recorder->queued--;
+	}
+
+	pthread_mutex_unlock(&recorder->mutex);
+
+	return NULL;
+}
+
+static void
+weston_recorder_read_done(struct weston_output *output, void *data_pixels,
+			  void *data)
+{
+	struct weston_recorder_frame *frame = data;
+	struct weston_recorder *recorder = frame->recorder;
+	pixman_box32_t *ext;
+	size_t size;
+
+	ext = pixman_region32_extents(&frame->damage);
+	size = (ext->x2 - ext->x1) * (ext->y2 - ext->y1) * 4;
+
+	/* The pixels are only ours until we return */
+	if (data_pixels)
+		frame->pixels = malloc(size);
+
+	if (frame->pixels == NULL) {
+		weston_log("recorder: failed to read back frame\n");
+
+		/* Catch up with the next frame instead */
+		pixman_region32_union(&recorder->dropped_damage,
+				      &recorder->dropped_damage,
+				      &frame->damage);
+		recorder->dropped++;
+		if (frame->keyframe) {
+			pthread_mutex_lock(&recorder->mutex);
+			recorder->need_keyframe = 1;
+			pthread_mutex_unlock(&recorder->mutex);
+		}
+		weston_recorder_frame_free(frame);
+		goto out;
+	}
+
+	memcpy(frame->pixels, data_pixels, size);
+
+	pthread_mutex_lock(&recorder->mutex);
+	wl_list_insert(recorder->queue.prev, &frame->link);
+	recorder->queued++;
+	pthread_cond_signal(&recorder->queue_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+
+out:
+	recorder->pending--;
+	weston_recorder_release(recorder);
+}
+
+static void
+weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_recorder *recorder =
+		container_of(listener, struct weston_recorder, frame_listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_recorder_frame *frame;
+	pixman_region32_t damage;
+	pixman_box32_t *ext;
+	int y_orig, queued, need_keyframe;
+
+	frame = zalloc(sizeof *frame);
+	if (frame == NULL) {
+		weston_log("%s: out of memory\n", __func__);
+		return;
 	}
 
-	pixman_region32_fini(&transformed_damage);
+	pixman_region32_init(&damage);
+	pixman_region32_init(&frame->damage);
+	pixman_region32_intersect(&damage, &output->region,
+				  &output->previous_damage);
+	pixman_region32_translate(&damage, -output->x, -output->y);
+	weston_transformed_region(output->width, output->height,
+				 output->transform, output->current_scale,
+				 &damage, &frame->damage);
+	pixman_region32_fini(&damage);
+
+	/* Whatever changed in frames dropped since goes in this one */
+	pixman_region32_union(&frame->damage, &frame->damage,
+			      &recorder->dropped_damage);
+
+	if (!pixman_region32_not_empty(&frame->damage)) {
+		pixman_region32_fini(&frame->damage);
+		free(frame);
+		return;
+	}
+
+	pthread_mutex_lock(&recorder->mutex);
+	queued = recorder->queued;
+	need_keyframe = recorder->need_keyframe;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	/* The encoder fell behind: skip this frame rather than let the
+	 * backlog, and the memory it holds, grow */
+	if (recorder->pending + queued >= RECORDER_QUEUE_SIZE) {
+		pixman_region32_copy(&recorder->dropped_damage,
+				     &frame->damage);
+		recorder->dropped++;
+		weston_recorder_frame_free(frame);
+		goto out;
+	}
+
+	pixman_region32_clear(&recorder->dropped_damage);
+
+	frame->recorder = recorder;
+	frame->msecs = output->frame_time;
+
+	if (recorder->count == 0 || need_keyframe ||
+	    frame->msecs - recorder->keyframe_msecs >=
+	    recorder->keyframe_interval) {
+		frame->keyframe = 1;
+		pixman_region32_fini(&frame->damage);
+		pixman_region32_init_rect(&frame->damage, 0, 0,
+					  recorder->width, recorder->height);
+		recorder->keyframe_msecs = frame->msecs;
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->need_keyframe = 0;
+		pthread_mutex_unlock(&recorder->mutex);
+	}
+
+	ext = pixman_region32_extents(&frame->damage);
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
+		y_orig = output->current_mode->height - ext->y2;
+	else
+		y_orig = ext->y1;
+
+	/* Frames are delivered in order, so recorder->frame is always
+	 * the last frame encoded when the next one is. */
+	recorder->pending++;
+	weston_output_read_pixels_async(output, compositor->read_format,
+					ext->x1, y_orig,
+					ext->x2 - ext->x1, ext->y2 - ext->y1,
+					weston_recorder_read_done, frame);
+
 	recorder->count++;
 
+out:
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
 }
@@ -452,52 +1026,172 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 static void
 weston_recorder_free(struct weston_recorder *recorder)
 {
+	struct weston_recorder_viewer *viewer, *next;
+
 	if (recorder == NULL)
 		return;
-	free(recorder->rect);
+	wl_list_insert_list(&recorder->viewers, &recorder->joining);
+	wl_list_for_each_safe(viewer, next, &recorder->viewers, link)
+		weston_recorder_viewer_destroy(viewer);
+	if (recorder->listen_fd >= 0)
+		close(recorder->listen_fd);
+	pixman_region32_fini(&recorder->dropped_damage);
+	wl_array_release(&recorder->index);
+	free(recorder->lz4buf);
 	free(recorder->tmpbuf);
 	free(recorder->frame);
 	free(recorder);
 }
 
+/* Listen on unix:<path> or tcp:[<host>:]<port> */
+static int
+weston_recorder_listen(const char *address)
+{
+	struct sockaddr_un addr;
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int fd = -1, on = 1;
+
+	if (strncmp(address, "unix:", 5) == 0) {
+		memset(&addr, 0, sizeof addr);
+		addr.sun_family = AF_UNIX;
+		if (strlen(address + 5) >= sizeof addr.sun_path)
+			return -1;
+		strcpy(addr.sun_path, address + 5);
+		unlink(addr.sun_path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		if (bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+		    listen(fd, 4) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+
+	if (strncmp(address, "tcp:", 4) != 0)
+		return -1;
+
+	address += 4;
+	port = strrchr(address, ':');
+	if (port) {
+		if ((size_t) (port - address) >= sizeof host)
+			return -1;
+		memcpy(host, address, port - address);
+		host[port - address] = '\0';
+		port++;
+	} else {
+		port = address;
+	}
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(port != address ? host : NULL, port, &hints, &res) != 0)
+		return -1;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+		    listen(fd, 4) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	return fd;
+}
+
+/* A viewer joins with the header, and with the next frame, which is
+ * made a keyframe for it */
+static int
+weston_recorder_accept(int fd, uint32_t mask, void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_viewer *viewer;
+	int viewer_fd;
+
+	viewer_fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (viewer_fd < 0)
+		return 1;
+
+	viewer = zalloc(sizeof *viewer);
+	if (viewer == NULL ||
+	    send(viewer_fd, &recorder->header, sizeof recorder->header,
+		 MSG_NOSIGNAL) != sizeof recorder->header) {
+		free(viewer);
+		close(viewer_fd);
+		return 1;
+	}
+	viewer->fd = viewer_fd;
+
+	pthread_mutex_lock(&recorder->mutex);
+	wl_list_insert(&recorder->joining, &viewer->link);
+	recorder->need_keyframe = 1;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	weston_log("recorder: viewer joined the stream\n");
+	weston_output_damage(recorder->output);
+
+	return 1;
+}
+
 static void
-weston_recorder_create(struct weston_output *output, const char *filename)
+weston_recorder_create(struct weston_output *output, const char *filename,
+		       const char *stream)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
+	struct wl_event_loop *loop;
 	int stride, size;
-	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	struct wcap_header_v2 header;
 
-	recorder = malloc(sizeof *recorder);
+	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
 		weston_log("%s: out of memory\n", __func__);
 		return;
 	}
 
+	recorder->fd = -1;
+	recorder->listen_fd = -1;
+	wl_list_init(&recorder->joining);
+	wl_list_init(&recorder->viewers);
+
 	stride = output->current_mode->width;
 	size = stride * 4 * output->current_mode->height;
 	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
-	recorder->total = 0;
-	recorder->count = 0;
-	recorder->destroying = 0;
 	recorder->output = output;
-
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	recorder->width = stride;
+	recorder->height = output->current_mode->height;
+	recorder->yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	pixman_region32_init(&recorder->dropped_damage);
+	wl_array_init(&recorder->index);
+	wl_list_init(&recorder->queue);
+
+	if (recorder->frame == NULL) {
 		weston_log("%s: out of memory\n", __func__);
 		weston_recorder_free(recorder);
 		return;
 	}
 
-	if (do_yflip)
-		recorder->tmpbuf = NULL;
-	else
-		recorder->tmpbuf = malloc(size);
-
-	header.magic = WCAP_HEADER_MAGIC;
+	memset(&header, 0, sizeof header);
+	header.magic = WCAP_HEADER_MAGIC_V2;
+#ifdef HAVE_LZ4
+	header.compression = WCAP_COMPRESSION_LZ4;
+#else
+	header.compression = WCAP_COMPRESSION_NONE;
+#endif
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -513,18 +1207,56 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return;
 	}
 
-	recorder->fd = open(filename,
-			    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	header.width = output->current_mode->width;
+	header.height = output->current_mode->height;
+	recorder->header = header;
+
+	if (stream) {
+		recorder->keyframe_interval = RECORDER_STREAM_KEYFRAME_MSECS;
+		recorder->listen_fd = weston_recorder_listen(stream);
+		if (recorder->listen_fd < 0) {
+			weston_log("recorder: can't listen on %s: %m\n",
+				   stream);
+			weston_recorder_free(recorder);
+			return;
+		}
+	} else {
+		recorder->keyframe_interval = RECORDER_KEYFRAME_MSECS;
+		recorder->fd = open(filename,
+				    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				    0644);
+
+		if (recorder->fd < 0) {
+			weston_log("problem opening output file %s: %m\n",
+				   filename);
+			weston_recorder_free(recorder);
+			return;
+		}
 
-	if (recorder->fd < 0) {
-		weston_log("problem opening output file %s: %m\n", filename);
+		recorder->total += write(recorder->fd, &header, sizeof header);
+		recorder->offset = sizeof header;
+	}
+
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->queue_cond, NULL);
+	if (pthread_create(&recorder->thread, NULL,
+			   weston_recorder_thread, recorder) != 0) {
+		weston_log("recorder: failed to start encoder thread\n");
+		pthread_cond_destroy(&recorder->queue_cond);
+		pthread_mutex_destroy(&recorder->mutex);
+		if (recorder->fd >= 0)
+			close(recorder->fd);
 		weston_recorder_free(recorder);
 		return;
 	}
 
-	header.width = output->current_mode->width;
-	header.height = output->current_mode->height;
-	recorder->total += write(recorder->fd, &header, sizeof header);
+	if (recorder->listen_fd >= 0) {
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		recorder->listen_source =
+			wl_event_loop_add_fd(loop, recorder->listen_fd,
+					     WL_EVENT_READABLE,
+					     weston_recorder_accept, recorder);
+	}
 
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
@@ -532,24 +1264,81 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	weston_output_damage(output);
 }
 
+/* End the file with the frame index, which lets decoders seek */
+static void
+weston_recorder_write_index(struct weston_recorder *recorder)
+{
+	struct wcap_trailer trailer;
+	struct iovec v[2];
+
+	trailer.index_offset = recorder->offset;
+	trailer.nframes = recorder->index.size /
+		sizeof(struct wcap_index_entry);
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	v[0].iov_base = recorder->index.data;
+	v[0].iov_len = recorder->index.size;
+	v[1].iov_base = &trailer;
+	v[1].iov_len = sizeof trailer;
+	if (writev(recorder->fd, v, 2) < 0)
+		weston_log("recorder: failed to write index: %m\n");
+}
+
+/* Close the file once recording has stopped and the last frame read
+ * back has been written. */
+static void
+weston_recorder_release(struct weston_recorder *recorder)
+{
+	if (!recorder->stopped || recorder->pending > 0)
+		return;
+
+	/* Let the encoder thread drain the queue, at most
+	 * RECORDER_QUEUE_SIZE frames, and exit */
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->quit = 1;
+	pthread_cond_signal(&recorder->queue_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->thread, NULL);
+
+	pthread_cond_destroy(&recorder->queue_cond);
+	pthread_mutex_destroy(&recorder->mutex);
+
+	if (recorder->dropped > 0)
+		weston_log("recorder: %d frames dropped\n", recorder->dropped);
+
+	if (recorder->fd >= 0) {
+		weston_recorder_write_index(recorder);
+		close(recorder->fd);
+	}
+	weston_recorder_free(recorder);
+}
+
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
-	close(recorder->fd);
 	recorder->output->disable_planes--;
-	weston_recorder_free(recorder);
+	recorder->stopped = 1;
+
+	/* Viewers still connected get the frames queued up to here */
+	if (recorder->listen_source) {
+		wl_event_source_remove(recorder->listen_source);
+		recorder->listen_source = NULL;
+	}
+	weston_recorder_release(recorder);
 }
 
 static void
 recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *data)
 {
+	struct screenshooter *shooter = data;
 	struct weston_seat *ws = (struct weston_seat *) seat;
 	struct weston_compositor *ec = ws->compositor;
 	struct weston_output *output;
 	struct wl_listener *listener = NULL;
 	struct weston_recorder *recorder;
 	static const char filename[] = "capture.wcap";
+	uint32_t total;
 
 	wl_list_for_each(output, &seat->compositor->output_list, link) {
 		listener = wl_signal_get(&output->frame_signal,
@@ -562,9 +1351,13 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *da
 		recorder = container_of(listener, struct weston_recorder,
 					frame_listener);
 
+		pthread_mutex_lock(&recorder->mutex);
+		total = recorder->total;
+		pthread_mutex_unlock(&recorder->mutex);
+
 		weston_log(
 			"stopping recorder, total file size %dM, %d frames\n",
-			recorder->total / (1024 * 1024), recorder->count);
+			total / (1024 * 1024), recorder->count);
 
 		recorder->destroying = 1;
 		weston_output_schedule_repaint(recorder->output);
@@ -576,9 +1369,12 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *da
 			output = container_of(ec->output_list.next,
 					      struct weston_output, link);
 
-		weston_log("starting recorder for output %s, file %s\n",
-			   output->name, filename);
-		weston_recorder_create(output, filename);
+		weston_log("starting recorder for output %s, %s %s\n",
+			   output->name,
+			   shooter->recorder_stream ? "stream" : "file",
+			   shooter->recorder_stream ?: filename);
+		weston_recorder_create(output, filename,
+				       shooter->recorder_stream);
 	}
 }
 
@@ -589,6 +1385,7 @@ screenshooter_destroy(struct wl_listener *listener, void *data)
 		container_of(listener, struct screenshooter, destroy_listener);
 
 	wl_global_destroy(shooter->global);
+	free(shooter->recorder_stream);
 	free(shooter);
 }
 
@@ -596,6 +1393,7 @@ WL_EXPORT void
 screenshooter_create(struct weston_compositor *ec)
 {
 	struct screenshooter *shooter;
+	struct weston_config_section *section;
 
 	shooter = malloc(sizeof *shooter);
 	if (shooter == NULL)
@@ -604,8 +1402,14 @@ screenshooter_create(struct weston_compositor *ec)
 	shooter->ec = ec;
 	shooter->client = NULL;
 
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_string(section, "recorder-stream",
+					 &shooter->recorder_stream, NULL);
+
+	copy_row_swap_RB_init();
+
 	shooter->global = wl_global_create(ec->wl_display,
-					   &screenshooter_interface, 1,
+					   &screenshooter_interface, 2,
 					   shooter, bind_shooter);
 	weston_compositor_add_key_binding(ec, KEY_S, MODIFIER_SUPER,
 					  screenshooter_binding, shooter);
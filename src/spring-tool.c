@@ -22,6 +22,12 @@
 
 #include "config.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
 #include "compositor.h"
 
 WL_EXPORT void
@@ -40,6 +46,110 @@ weston_view_schedule_repaint(struct weston_view *view)
 {
 }
 
+WL_EXPORT void
+weston_output_schedule_repaint(struct weston_output *output)
+{
+}
+
+/* The integrator as it was before weston_spring_update() learned to
+ * take several steps at once, for comparison. */
+static void
+reference_update(struct weston_spring *spring, uint32_t msec)
+{
+	double force, v, current, step;
+
+	step = 0.01;
+	while (4 < msec - spring->timestamp) {
+		current = spring->current;
+		v = current - spring->previous;
+		force = spring->k * (spring->target - current) / 10.0 +
+			(spring->previous - current) - v * spring->friction;
+
+		spring->current =
+			current + (current - spring->previous) +
+			force * step * step;
+		spring->previous = current;
+		spring->timestamp += 4;
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+init_springs(struct weston_spring *springs, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		weston_spring_init(&springs[i], 300.0 + i % 700, 0.0, 1.0);
+		springs[i].friction = 400 + (i % 7) * 150;
+		springs[i].timestamp = 0;
+	}
+}
+
+/* Advance count springs for the given number of frames at ~60Hz, the way
+ * an output's animation pass does, with both integrators. */
+static int
+benchmark(int count, int frames)
+{
+	struct weston_spring *springs, *reference;
+	double start, ref_time, time_new, error, max_error = 0.0;
+	uint32_t msecs;
+	int i, f;
+
+	springs = calloc(count, sizeof *springs);
+	reference = calloc(count, sizeof *reference);
+	if (!springs || !reference) {
+		free(springs);
+		free(reference);
+		return 1;
+	}
+
+	init_springs(reference, count);
+	start = now();
+	for (f = 1; f <= frames; f++) {
+		msecs = f * 1000 / 60;
+		for (i = 0; i < count; i++)
+			reference_update(&reference[i], msecs);
+	}
+	ref_time = now() - start;
+
+	init_springs(springs, count);
+	start = now();
+	for (f = 1; f <= frames; f++) {
+		msecs = f * 1000 / 60;
+		for (i = 0; i < count; i++)
+			weston_spring_update(&springs[i], msecs);
+	}
+	time_new = now() - start;
+
+	for (i = 0; i < count; i++) {
+		error = fabs(springs[i].current - reference[i].current);
+		if (error > max_error)
+			max_error = error;
+	}
+
+	printf("%d springs, %d frames\n", count, frames);
+	printf("stepped:  %8.1f ns/update\n",
+	       ref_time * 1e9 / ((double) count * frames));
+	printf("batched:  %8.1f ns/update\n",
+	       time_new * 1e9 / ((double) count * frames));
+	printf("max deviation: %g\n", max_error);
+
+	free(springs);
+	free(reference);
+
+	return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -51,6 +161,10 @@ main(int argc, char *argv[])
 	struct weston_spring spring;
 	uint32_t time = 0;
 
+	if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+		return benchmark(argc > 2 ? atoi(argv[2]) : 1000,
+				 argc > 3 ? atoi(argv[3]) : 600);
+
 	weston_spring_init(&spring, k, current, target);
 	spring.friction = friction;
 	spring.previous = 0.48;
@@ -85,6 +85,12 @@ struct input_method_context {
 	struct wl_list link;
 
 	struct wl_resource *keyboard;
+
+	/* The keys the input method filters, all of them until it sets
+	 * consume_keys, and those of its keys currently pressed */
+	int consume_all;
+	struct wl_array consumed_keys;
+	struct wl_array pressed_keys;
 };
 
 struct text_backend {
@@ -553,17 +559,71 @@ unbind_keyboard(struct wl_resource *resource)
 	context->keyboard = NULL;
 }
 
+static uint32_t *
+key_array_find(struct wl_array *array, uint32_t key)
+{
+	uint32_t *k;
+
+	wl_array_for_each(k, array) {
+		if (*k == key)
+			return k;
+	}
+
+	return NULL;
+}
+
+/* Whether the key event goes to the input method rather than straight
+ * to the focused client */
+static int
+input_method_context_filters_key(struct input_method_context *context,
+				 uint32_t key, uint32_t state_w)
+{
+	uint32_t *k, *end;
+
+	if (state_w == WL_KEYBOARD_KEY_STATE_RELEASED) {
+		k = key_array_find(&context->pressed_keys, key);
+		if (!k)
+			return 0;
+
+		end = (uint32_t *) ((char *) context->pressed_keys.data +
+				    context->pressed_keys.size) - 1;
+		*k = *end;
+		context->pressed_keys.size -= sizeof *k;
+		return 1;
+	}
+
+	if (!context->consume_all &&
+	    !key_array_find(&context->consumed_keys, key))
+		return 0;
+
+	if (!key_array_find(&context->pressed_keys, key)) {
+		k = wl_array_add(&context->pressed_keys, sizeof *k);
+		if (k)
+			*k = key;
+	}
+
+	return 1;
+}
+
 static void
 input_method_context_grab_key(struct weston_keyboard_grab *grab,
 			      uint32_t time, uint32_t key, uint32_t state_w)
 {
 	struct weston_keyboard *keyboard = grab->keyboard;
+	struct weston_keyboard_grab *default_grab = &keyboard->default_grab;
+	struct input_method_context *context;
 	struct wl_display *display;
 	uint32_t serial;
 
 	if (!keyboard->input_method_resource)
 		return;
 
+	context = wl_resource_get_user_data(keyboard->input_method_resource);
+	if (!input_method_context_filters_key(context, key, state_w)) {
+		default_grab->interface->key(default_grab, time, key, state_w);
+		return;
+	}
+
 	display = wl_client_get_display(wl_resource_get_client(keyboard->input_method_resource));
 	serial = wl_display_next_serial(display);
 	wl_keyboard_send_key(keyboard->input_method_resource,
@@ -576,10 +636,21 @@ input_method_context_grab_modifier(struct weston_keyboard_grab *grab, uint32_t s
 				   uint32_t mods_locked, uint32_t group)
 {
 	struct weston_keyboard *keyboard = grab->keyboard;
+	struct weston_keyboard_grab *default_grab = &keyboard->default_grab;
+	struct input_method_context *context;
 
 	if (!keyboard->input_method_resource)
 		return;
 
+	/* The keys we deliver ourselves must not wait for the input
+	 * method to forward the modifiers they go with */
+	context = wl_resource_get_user_data(keyboard->input_method_resource);
+	if (!context->consume_all)
+		default_grab->interface->modifiers(default_grab, serial,
+						   mods_depressed,
+						   mods_latched,
+						   mods_locked, group);
+
 	wl_keyboard_send_modifiers(keyboard->input_method_resource,
 				   serial, mods_depressed, mods_latched,
 				   mods_locked, group);
@@ -611,6 +682,7 @@ input_method_context_grab_keyboard(struct wl_client *client,
 	wl_resource_set_implementation(cr, NULL, context, unbind_keyboard);
 
 	context->keyboard = cr;
+	context->pressed_keys.size = 0;
 
 	wl_keyboard_send_keymap(cr, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
 				keyboard->xkb_info->keymap_fd,
@@ -687,6 +759,22 @@ input_method_context_text_direction(struct wl_client *client,
 }
 
 
+static void
+input_method_context_consume_keys(struct wl_client *client,
+				  struct wl_resource *resource,
+				  struct wl_array *keys)
+{
+	struct input_method_context *context = wl_resource_get_user_data(resource);
+
+	context->consume_all = 0;
+	context->consumed_keys.size = 0;
+	if (!wl_array_add(&context->consumed_keys, keys->size)) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	memcpy(context->consumed_keys.data, keys->data, keys->size);
+}
+
 static const struct wl_input_method_context_interface input_method_context_implementation = {
 	input_method_context_destroy,
 	input_method_context_commit_string,
@@ -701,7 +789,8 @@ static const struct wl_input_method_context_interface input_method_context_imple
 	input_method_context_key,
 	input_method_context_modifiers,
 	input_method_context_language,
-	input_method_context_text_direction
+	input_method_context_text_direction,
+	input_method_context_consume_keys
 };
 
 static void
@@ -713,6 +802,8 @@ destroy_input_method_context(struct wl_resource *resource)
 		wl_resource_destroy(context->keyboard);
 	}
 
+	wl_array_release(&context->consumed_keys);
+	wl_array_release(&context->pressed_keys);
 	free(context);
 }
 
@@ -733,13 +824,17 @@ input_method_context_create(struct text_input *model,
 	binding = input_method->input_method_binding;
 	context->resource =
 		wl_resource_create(wl_resource_get_client(binding),
-				   &wl_input_method_context_interface, 1, 0);
+				   &wl_input_method_context_interface,
+				   wl_resource_get_version(binding), 0);
 	wl_resource_set_implementation(context->resource,
 				       &input_method_context_implementation,
 				       context, destroy_input_method_context);
 
 	context->model = model;
 	context->input_method = input_method;
+	context->consume_all = 1;
+	wl_array_init(&context->consumed_keys);
+	wl_array_init(&context->pressed_keys);
 	input_method->context = context;
 
 
@@ -785,7 +880,8 @@ bind_input_method(struct wl_client *client,
 	struct wl_resource *resource;
 
 	resource =
-		wl_resource_create(client, &wl_input_method_interface, 1, id);
+		wl_resource_create(client, &wl_input_method_interface,
+				   MIN(version, 2), id);
 
 	if (input_method->input_method_binding != NULL) {
 		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
@@ -924,7 +1020,7 @@ handle_seat_created(struct wl_listener *listener,
 	input_method->text_backend = text_backend;
 
 	input_method->input_method_global =
-		wl_global_create(ec->wl_display, &wl_input_method_interface, 1,
+		wl_global_create(ec->wl_display, &wl_input_method_interface, 2,
 				 input_method, bind_input_method);
 
 	input_method->destroy_listener.notify = input_method_notifier_destroy;
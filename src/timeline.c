@@ -0,0 +1,261 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+
+#include "../wcap/timeline-decode.h"
+
+#define TIMELINE_RING_SIZE	65536	/* records, power of two */
+
+struct weston_timeline {
+	struct weston_compositor *compositor;
+	struct wl_listener destroy_listener;
+
+	/* The compositor is single threaded, so a free-running head
+	 * index is all the ring needs; nothing ever waits on it. */
+	struct timeline_record *ring;
+	uint32_t head;
+};
+
+static const char * const timeline_point_names[] = {
+	[WESTON_TIMELINE_REPAINT_BEGIN] = "repaint-begin",
+	[WESTON_TIMELINE_VIEW_LIST] = "view-list",
+	[WESTON_TIMELINE_ASSIGN_PLANES] = "assign-planes",
+	[WESTON_TIMELINE_ACCUMULATE_DAMAGE] = "accumulate-damage",
+	[WESTON_TIMELINE_RENDER_BEGIN] = "render-setup",
+	[WESTON_TIMELINE_RENDER_VIEWS] = "render-views",
+	[WESTON_TIMELINE_RENDER_SWAP] = "render-swap",
+	[WESTON_TIMELINE_PAGE_FLIP_QUEUED] = "page-flip-queue",
+	[WESTON_TIMELINE_OUTPUT_REPAINT] = "output-repaint",
+	[WESTON_TIMELINE_INPUT] = "repick-input",
+	[WESTON_TIMELINE_FRAME_CALLBACKS] = "frame-callbacks",
+	[WESTON_TIMELINE_REPAINT_END] = "animations",
+	[WESTON_TIMELINE_FRAME_FINISHED] = "wait-for-vblank",
+	[WESTON_TIMELINE_GPU_FRAME] = "gpu-frame",
+	[WESTON_TIMELINE_GPU_VIEW] = "gpu-view",
+};
+
+WL_EXPORT void
+weston_timeline_point(struct weston_output *output,
+		      enum weston_timeline_point point)
+{
+	struct weston_timeline *timeline = output->compositor->timeline;
+	struct timeline_record *record;
+	struct timespec ts;
+
+	if (!timeline || !timeline->ring)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	record = &timeline->ring[timeline->head++ & (TIMELINE_RING_SIZE - 1)];
+	record->sec = ts.tv_sec;
+	record->nsec = ts.tv_nsec;
+	record->output = output->id;
+	record->point = point;
+}
+
+/* Record a stage that was measured elsewhere, like the GPU time of a
+ * frame, which only becomes known a few frames later. */
+WL_EXPORT void
+weston_timeline_duration(struct weston_output *output,
+			 enum weston_timeline_point point, uint64_t nsec)
+{
+	struct weston_timeline *timeline = output->compositor->timeline;
+	struct timeline_record *record;
+
+	if (!timeline || !timeline->ring)
+		return;
+
+	record = &timeline->ring[timeline->head++ & (TIMELINE_RING_SIZE - 1)];
+	record->sec = nsec / 1000000000;
+	record->nsec = nsec % 1000000000;
+	record->output = output->id;
+	record->point = point | TIMELINE_RECORD_DURATION;
+}
+
+static int
+timeline_start(struct weston_timeline *timeline)
+{
+	timeline->ring = malloc(TIMELINE_RING_SIZE * sizeof *timeline->ring);
+	if (!timeline->ring)
+		return -1;
+
+	timeline->head = 0;
+
+	return 0;
+}
+
+static void
+write_name(FILE *fp, uint32_t id, const char *name)
+{
+	struct timeline_name entry;
+
+	memset(&entry, 0, sizeof entry);
+	entry.id = id;
+	strncpy(entry.name, name, sizeof entry.name - 1);
+	fwrite(&entry, sizeof entry, 1, fp);
+}
+
+static int
+timeline_dump(struct weston_timeline *timeline, const char *filename)
+{
+	struct weston_compositor *compositor = timeline->compositor;
+	struct timeline_header header;
+	struct weston_output *output;
+	uint32_t first, count, i;
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (!fp)
+		return -1;
+
+	if (timeline->head > TIMELINE_RING_SIZE) {
+		first = timeline->head - TIMELINE_RING_SIZE;
+		count = TIMELINE_RING_SIZE;
+	} else {
+		first = 0;
+		count = timeline->head;
+	}
+
+	header.magic = TIMELINE_HEADER_MAGIC;
+	header.npoints = WESTON_TIMELINE_POINT_COUNT;
+	header.noutputs = wl_list_length(&compositor->output_list);
+	header.nrecords = count;
+	fwrite(&header, sizeof header, 1, fp);
+
+	for (i = 0; i < WESTON_TIMELINE_POINT_COUNT; i++)
+		write_name(fp, i, timeline_point_names[i]);
+	wl_list_for_each(output, &compositor->output_list, link)
+		write_name(fp, output->id, output->name ? output->name : "");
+
+	for (i = 0; i < count; i++)
+		fwrite(&timeline->ring[(first + i) & (TIMELINE_RING_SIZE - 1)],
+		       sizeof *timeline->ring, 1, fp);
+
+	if (fclose(fp) != 0)
+		return -1;
+
+	return 0;
+}
+
+WL_EXPORT int
+weston_timeline_start(struct weston_compositor *ec)
+{
+	struct weston_timeline *timeline = ec->timeline;
+
+	if (!timeline)
+		return -1;
+	if (timeline->ring)
+		return 0;
+
+	if (timeline_start(timeline) < 0) {
+		weston_log("failed to allocate timeline ring\n");
+		return -1;
+	}
+
+	weston_log("started timeline recording\n");
+
+	return 0;
+}
+
+WL_EXPORT int
+weston_timeline_stop(struct weston_compositor *ec, const char *filename)
+{
+	struct weston_timeline *timeline = ec->timeline;
+	int ret;
+
+	if (!timeline || !timeline->ring)
+		return -1;
+
+	ret = timeline_dump(timeline, filename);
+	if (ret < 0)
+		weston_log("failed to write timeline to %s: %m\n", filename);
+	else
+		weston_log("wrote timeline to %s\n", filename);
+
+	free(timeline->ring);
+	timeline->ring = NULL;
+
+	return ret;
+}
+
+static void
+timeline_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		 void *data)
+{
+	struct weston_timeline *timeline = data;
+	struct weston_compositor *ec = timeline->compositor;
+
+	if (!timeline->ring)
+		weston_timeline_start(ec);
+	else
+		weston_timeline_stop(ec, "timeline.wtl");
+}
+
+static void
+timeline_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_timeline *timeline =
+		container_of(listener, struct weston_timeline,
+			     destroy_listener);
+
+	timeline->compositor->timeline = NULL;
+	free(timeline->ring);
+	free(timeline);
+}
+
+WL_EXPORT void
+weston_timeline_create(struct weston_compositor *ec)
+{
+	struct weston_timeline *timeline;
+	struct weston_config_section *section;
+	int enabled;
+
+	timeline = zalloc(sizeof *timeline);
+	if (timeline == NULL)
+		return;
+
+	timeline->compositor = ec;
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "timeline", &enabled, 0);
+	if (enabled && timeline_start(timeline) < 0)
+		weston_log("failed to allocate timeline ring\n");
+
+	weston_compositor_add_debug_binding(ec, KEY_T,
+					    timeline_binding, timeline);
+
+	timeline->destroy_listener.notify = timeline_destroy;
+	wl_signal_add(&ec->destroy_signal, &timeline->destroy_listener);
+
+	ec->timeline = timeline;
+}
@@ -26,6 +26,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "compositor.h"
 #include "launcher-util.h"
@@ -38,16 +40,178 @@ static const char default_seat_name[] = "default";
 static void
 udev_seat_destroy(struct udev_seat *seat);
 
+/* A device whose fd the launcher hasn't handed over yet */
+struct udev_pending_device {
+	struct wl_list link;
+	struct udev_input *input;
+	struct udev_seat *seat;
+	struct udev_device *udev_device;
+	struct weston_device_request *request;
+};
+
+static void
+device_create(struct udev_input *input, struct udev_seat *seat,
+	      struct udev_device *udev_device, int fd,
+	      const struct evdev_probe *probe);
+static int
+udev_input_devices_ready(struct udev_input *input);
+
+static void
+udev_input_check_ready(struct udev_input *input)
+{
+	if (input->ready_pending && wl_list_empty(&input->pending_list)) {
+		input->ready_pending = 0;
+		udev_input_devices_ready(input);
+	}
+}
+
+static void
+device_opened(int fd, void *data)
+{
+	struct udev_pending_device *pending = data;
+	struct udev_input *input = pending->input;
+
+	wl_list_remove(&pending->link);
+
+	if (fd < 0)
+		weston_log("opening input device '%s' failed.\n",
+			   udev_device_get_devnode(pending->udev_device));
+	else
+		device_create(input, pending->seat, pending->udev_device, fd,
+			      NULL);
+
+	udev_device_unref(pending->udev_device);
+	free(pending);
+
+	udev_input_check_ready(input);
+}
+
+static void
+pending_device_cancel(struct udev_pending_device *pending)
+{
+	weston_launcher_cancel(pending->input->compositor->launcher,
+			       pending->request);
+	wl_list_remove(&pending->link);
+	udev_device_unref(pending->udev_device);
+	free(pending);
+}
+
+/* Returns 1 if the device will be added once the launcher has opened
+ * it, 0 if it has to be opened directly. */
+static int
+device_open_async(struct udev_input *input, struct udev_seat *seat,
+		  struct udev_device *udev_device, int flags)
+{
+	struct udev_pending_device *pending;
+
+	if (!input->async_open)
+		return 0;
+
+	pending = zalloc(sizeof *pending);
+	if (!pending)
+		return 0;
+
+	pending->input = input;
+	pending->seat = seat;
+	pending->udev_device = udev_device_ref(udev_device);
+	pending->request =
+		weston_launcher_open_async(input->compositor->launcher,
+					   udev_device_get_devnode(udev_device),
+					   flags, device_opened, pending);
+	if (!pending->request) {
+		udev_device_unref(udev_device);
+		free(pending);
+		return 0;
+	}
+
+	wl_list_insert(input->pending_list.prev, &pending->link);
+
+	return 1;
+}
+
+/* Probing a device takes a handful of ioctls, which some drivers are
+ * slow to answer.  The devices found when enumerating are opened one
+ * after another, as the launcher only handles one open at a time, then
+ * probed together on up to this many threads. */
+#define PROBE_THREADS_MAX 8
+
+struct udev_probe_job {
+	struct udev_device *udev_device;
+	struct udev_seat *seat;
+	int fd;
+	struct evdev_probe probe;
+};
+
+struct udev_probe_pool {
+	struct udev_probe_job *jobs;
+	int count;
+	int next;
+};
+
+static void *
+probe_thread(void *data)
+{
+	struct udev_probe_pool *pool = data;
+	int i;
+
+	while ((i = __atomic_fetch_add(&pool->next, 1,
+				       __ATOMIC_RELAXED)) < pool->count)
+		evdev_device_probe(pool->jobs[i].fd, &pool->jobs[i].probe);
+
+	return NULL;
+}
+
+static void
+probe_devices(struct udev_probe_job *jobs, int count)
+{
+	struct udev_probe_pool pool = { jobs, count, 0 };
+	pthread_t threads[PROBE_THREADS_MAX - 1];
+	sigset_t signals, saved;
+	int i, n;
+
+	n = count < PROBE_THREADS_MAX ? count : PROBE_THREADS_MAX;
+
+	/* Signals are for the main thread's signalfds */
+	sigfillset(&signals);
+	pthread_sigmask(SIG_BLOCK, &signals, &saved);
+	for (i = 0; i < n - 1; i++)
+		if (pthread_create(&threads[i], NULL, probe_thread, &pool))
+			break;
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	/* Without threads this probes everything itself */
+	probe_thread(&pool);
+
+	while (i--)
+		pthread_join(threads[i], NULL);
+}
+
+/* Adds the devices with their probe results, in the order found */
+static void
+create_probed_devices(struct udev_input *input, struct wl_array *jobs)
+{
+	struct udev_probe_job *job;
+
+	probe_devices(jobs->data, jobs->size / sizeof *job);
+
+	wl_array_for_each(job, jobs) {
+		device_create(input, job->seat, job->udev_device, job->fd,
+			      &job->probe);
+		udev_device_unref(job->udev_device);
+	}
+}
+
+/* With jobs, a device opened here is only probed and added by
+ * create_probed_devices(). */
 static int
-device_added(struct udev_device *udev_device, struct udev_input *input)
+device_added(struct udev_device *udev_device, struct udev_input *input,
+	     struct wl_array *jobs)
 {
+	struct udev_probe_job *job;
 	struct weston_compositor *c;
-	struct evdev_device *device;
-	struct weston_output *output;
 	const char *devnode;
-	const char *device_seat, *seat_name, *output_name;
-	const char *calibration_values;
-	int fd;
+	const char *device_seat, *seat_name;
+	int fd, flags;
 	struct udev_seat *seat;
 
 	device_seat = udev_device_get_property_value(udev_device, "ID_SEAT");
@@ -73,21 +237,61 @@ device_added(struct udev_device *udev_device, struct udev_input *input)
 	/* Use non-blocking mode so that we can loop on read on
 	 * evdev_device_data() until all events on the fd are
 	 * read.  mtdev_get() also expects this. */
-	fd = weston_launcher_open(c->launcher, devnode, O_RDWR | O_NONBLOCK);
+	flags = O_RDWR | O_NONBLOCK;
+
+	/* After a session switch, ask for all devices at once and add
+	 * them as they come in */
+	if (device_open_async(input, seat, udev_device, flags))
+		return 0;
+
+	fd = weston_launcher_open(c->launcher, devnode, flags);
 	if (fd < 0) {
 		weston_log("opening input device '%s' failed.\n", devnode);
 		return 0;
 	}
 
-	device = evdev_device_create(&seat->base, devnode, fd);
+	if (jobs) {
+		job = wl_array_add(jobs, sizeof *job);
+		if (job) {
+			job->udev_device = udev_device_ref(udev_device);
+			job->seat = seat;
+			job->fd = fd;
+			return 0;
+		}
+	}
+
+	device_create(input, seat, udev_device, fd, NULL);
+
+	return 0;
+}
+
+static void
+device_create(struct udev_input *input, struct udev_seat *seat,
+	      struct udev_device *udev_device, int fd,
+	      const struct evdev_probe *probe)
+{
+	struct weston_compositor *c = input->compositor;
+	struct evdev_device *device;
+	struct weston_output *output;
+	const char *devnode, *output_name;
+	const char *calibration_values;
+
+	devnode = udev_device_get_devnode(udev_device);
+
+	if (probe)
+		device = evdev_device_create_probed(&seat->base, devnode, fd,
+						    probe, input->thread);
+	else
+		device = evdev_device_create(&seat->base, devnode, fd,
+					     input->thread);
 	if (device == EVDEV_UNHANDLED_DEVICE) {
 		weston_launcher_close(c->launcher, fd);
 		weston_log("not using input device '%s'.\n", devnode);
-		return 0;
+		return;
 	} else if (device == NULL) {
 		weston_launcher_close(c->launcher, fd);
 		weston_log("failed to create input device '%s'.\n", devnode);
-		return 0;
+		return;
 	}
 
 	calibration_values =
@@ -133,8 +337,58 @@ device_added(struct udev_device *udev_device, struct udev_input *input)
 
 	if (input->enabled == 1)
 		weston_seat_repick(&seat->base);
+}
 
-	return 0;
+/* Devices marked WL_DEFERRED_PROBE aren't needed for the first frame,
+ * such as rear seat touch panels, so at startup they are only added
+ * once it is out. */
+static void
+udev_input_add_deferred(struct weston_compositor *c, void *data)
+{
+	struct udev_input *input = data;
+	struct udev_device **udev_device;
+	struct wl_array jobs;
+
+	wl_array_init(&jobs);
+	wl_array_for_each(udev_device, &input->deferred) {
+		if (input->udev_monitor)
+			device_added(*udev_device, input, &jobs);
+		udev_device_unref(*udev_device);
+	}
+	wl_array_release(&input->deferred);
+	wl_array_init(&input->deferred);
+
+	create_probed_devices(input, &jobs);
+	wl_array_release(&jobs);
+}
+
+static int
+device_deferred(struct udev_device *udev_device, struct udev_input *input)
+{
+	struct udev_device **p;
+	const char *deferred;
+
+	/* Only at startup, later everything is opened at once anyway */
+	if (input->async_open)
+		return 0;
+
+	deferred = udev_device_get_property_value(udev_device,
+						  "WL_DEFERRED_PROBE");
+	if (!deferred || strcmp(deferred, "1") != 0)
+		return 0;
+
+	if (input->deferred.size == 0 &&
+	    weston_compositor_defer_init(input->compositor,
+					 "deferred input devices",
+					 udev_input_add_deferred, input) < 0)
+		return 0;
+
+	p = wl_array_add(&input->deferred, sizeof *p);
+	if (!p)
+		return 0;
+	*p = udev_device_ref(udev_device);
+
+	return 1;
 }
 
 static int
@@ -144,8 +398,10 @@ udev_input_add_devices(struct udev_input *input, struct udev *udev)
 	struct udev_list_entry *entry;
 	struct udev_device *device;
 	const char *path, *sysname;
-	struct udev_seat *seat;
-	int devices_found = 0;
+	struct wl_array jobs;
+	int ret = 0;
+
+	wl_array_init(&jobs);
 
 	e = udev_enumerate_new(udev);
 	udev_enumerate_add_match_subsystem(e, "input");
@@ -155,21 +411,40 @@ udev_input_add_devices(struct udev_input *input, struct udev *udev)
 		device = udev_device_new_from_syspath(udev, path);
 
 		sysname = udev_device_get_sysname(device);
-		if (strncmp("event", sysname, 5) != 0) {
+		if (strncmp("event", sysname, 5) != 0 ||
+		    device_deferred(device, input)) {
 			udev_device_unref(device);
 			continue;
 		}
 
-		if (device_added(device, input) < 0) {
-			udev_device_unref(device);
-			udev_enumerate_unref(e);
-			return -1;
-		}
-
+		ret = device_added(device, input, &jobs);
 		udev_device_unref(device);
+		if (ret < 0)
+			break;
 	}
 	udev_enumerate_unref(e);
 
+	create_probed_devices(input, &jobs);
+	wl_array_release(&jobs);
+
+	if (ret < 0)
+		return -1;
+
+	/* Done when the last device comes in */
+	if (!wl_list_empty(&input->pending_list)) {
+		input->ready_pending = 1;
+		return 0;
+	}
+
+	return udev_input_devices_ready(input);
+}
+
+static int
+udev_input_devices_ready(struct udev_input *input)
+{
+	struct udev_seat *seat;
+	int devices_found = 0;
+
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 		evdev_notify_keyboard_focus(&seat->base, &seat->devices_list);
 
@@ -177,6 +452,9 @@ udev_input_add_devices(struct udev_input *input, struct udev *udev)
 			devices_found = 1;
 	}
 
+	if (input->deferred.size > 0)
+		devices_found = 1;
+
 	if (devices_found == 0) {
 		weston_log(
 			"warning: no input devices on entering Weston. "
@@ -197,6 +475,7 @@ evdev_udev_handler(int fd, uint32_t mask, void *data)
 	struct udev_input *input = data;
 	struct udev_device *udev_device;
 	struct evdev_device *device, *next;
+	struct udev_pending_device *pending, *pnext;
 	const char *action;
 	const char *devnode;
 	struct udev_seat *seat;
@@ -213,10 +492,16 @@ evdev_udev_handler(int fd, uint32_t mask, void *data)
 		goto out;
 
 	if (!strcmp(action, "add")) {
-		device_added(udev_device, input);
+		device_added(udev_device, input, NULL);
 	}
 	else if (!strcmp(action, "remove")) {
 		devnode = udev_device_get_devnode(udev_device);
+		wl_list_for_each_safe(pending, pnext,
+				      &input->pending_list, link)
+			if (!strcmp(udev_device_get_devnode(pending->udev_device),
+				    devnode))
+				pending_device_cancel(pending);
+		udev_input_check_ready(input);
 		wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 			wl_list_for_each_safe(device, next, &seat->devices_list, link)
 				if (!strcmp(device->devnode, devnode)) {
@@ -280,7 +565,18 @@ static void
 udev_input_remove_devices(struct udev_input *input)
 {
 	struct evdev_device *device, *next;
+	struct udev_pending_device *pending, *pnext;
 	struct udev_seat *seat;
+	struct udev_device **udev_device;
+
+	wl_list_for_each_safe(pending, pnext, &input->pending_list, link)
+		pending_device_cancel(pending);
+	input->ready_pending = 0;
+
+	/* All of them are added when reenabled */
+	wl_array_for_each(udev_device, &input->deferred)
+		udev_device_unref(*udev_device);
+	input->deferred.size = 0;
 
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 		wl_list_for_each_safe(device, next, &seat->devices_list, link) {
@@ -313,17 +609,40 @@ int
 udev_input_init(struct udev_input *input, struct weston_compositor *c, struct udev *udev,
 		const char *seat_id)
 {
+	struct weston_config_section *section;
+	int input_thread;
+
 	memset(input, 0, sizeof *input);
 	input->seat_id = strdup(seat_id);
 	input->compositor = c;
 	input->udev = udev;
 	input->udev = udev_ref(udev);
+	wl_list_init(&input->pending_list);
+	wl_array_init(&input->deferred);
+
+	section = weston_config_get_section(c->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "input-thread",
+				       &input_thread, 0);
+	if (input_thread) {
+		input->thread = evdev_input_thread_create(c);
+		if (!input->thread)
+			weston_log("failed to start the input thread, "
+				   "reading input devices directly\n");
+	}
+
 	if (udev_input_enable(input) < 0)
 		goto err;
 
+	/* Missing devices are only fatal at startup */
+	input->async_open = 1;
+
 	return 0;
 
  err:
+	udev_input_remove_devices(input);
+	wl_array_release(&input->deferred);
+	if (input->thread)
+		evdev_input_thread_destroy(input->thread);
 	free(input->seat_id);
 	return -1;
 }
@@ -335,6 +654,9 @@ udev_input_destroy(struct udev_input *input)
 	udev_input_disable(input);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
+	if (input->thread)
+		evdev_input_thread_destroy(input->thread);
+	wl_array_release(&input->deferred);
 	udev_unref(input->udev);
 	free(input->seat_id);
 }
@@ -41,7 +41,13 @@ struct udev_input {
 	struct wl_event_source *udev_monitor_source;
 	char *seat_id;
 	struct weston_compositor *compositor;
+	struct evdev_input_thread *thread;
 	int enabled;
+	int async_open;			/* reenabling after startup */
+	struct wl_list pending_list;	/* udev_pending_device::link */
+	int ready_pending;		/* enumerated devices still opening */
+	struct wl_array deferred;	/* struct udev_device *, added after
+					 * the first frame */
 };
 
 int udev_input_enable(struct udev_input *input);
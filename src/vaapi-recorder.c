@@ -54,9 +54,11 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 
 #include <pthread.h>
+#include <signal.h>
 
 #include <va/va.h>
 #include <va/va_drm.h>
@@ -89,21 +91,67 @@
 #define PROFILE_IDC_MAIN        77
 #define PROFILE_IDC_HIGH        100
 
+/* Frames handed to the recorder while this many are still waiting for
+ * the encoder are dropped, so a slow encoder never stalls the caller */
+#define RECORDER_QUEUE_SIZE	2
+
+/* Surfaces for frames uploaded from memory: one being filled by the
+ * caller while the others wait for, or are in, the encoder */
+#define RECORDER_UPLOAD_SIZE	(RECORDER_QUEUE_SIZE + 1)
+
+/* Frames between colour conversion and the output file.  The worker
+ * thread converts and submits frames to the encoder without waiting for
+ * them, and the writer thread waits for the oldest one to be encoded and
+ * writes it out, so the GPU stages and the write overlap across frames. */
+#define RECORDER_PIPELINE_DEPTH	3
+
+struct recorder_slot {
+	VASurfaceID yuv;	/* colour converted input of the encoder */
+	VABufferID coded;	/* where the encoder puts the frame */
+};
+
+/* A VA surface wrapping one of the caller's buffers.  The caller keeps
+ * it around for as long as the buffer lives, so every frame shown from
+ * that buffer is encoded without importing it again. */
+struct vaapi_recorder_buffer {
+	struct vaapi_recorder *r;	/* NULL once the recorder is gone */
+	struct wl_list link;		/* vaapi_recorder::buffers */
+	VASurfaceID surface;
+	int refcount;
+};
+
 struct vaapi_recorder {
 	int drm_fd, output_fd;
 	int width, height;
 	int frame_count;
+	int dropped_count;
+	int stream;
+	struct vaapi_recorder_config config;
 
 	int error;
 	int destroying;
-	pthread_t worker_thread;
+	pthread_t worker_thread, writer_thread;
 	pthread_mutex_t mutex;
-	pthread_cond_t input_cond;
+	pthread_cond_t input_cond;	/* input queued or pipeline room */
+	pthread_cond_t output_cond;	/* frame submitted to the encoder */
+
+	/* Protected by mutex */
+	struct wl_list buffers;
+	struct {
+		struct vaapi_recorder_buffer *buffer[RECORDER_QUEUE_SIZE];
+		int head, count;
+	} queue;
 
+	/* Created on demand by vaapi_recorder_frame_data() */
+	struct vaapi_recorder_buffer *upload[RECORDER_UPLOAD_SIZE];
+
+	/* Protected by mutex */
 	struct {
-		int valid;
-		int prime_fd, stride;
-	} input;
+		struct recorder_slot slot[RECORDER_PIPELINE_DEPTH];
+		int head, count;
+		int flushing;
+	} pipeline;
+	int force_intra;	/* a frame was lost, don't refer to it */
 
 	VADisplay va_dpy;
 
@@ -112,7 +160,6 @@ struct vaapi_recorder {
 		VAConfigID cfg;
 		VAContextID ctx;
 		VABufferID pipeline_buf;
-		VASurfaceID output;
 	} vpp;
 
 	struct {
@@ -120,10 +167,16 @@ struct vaapi_recorder {
 		VAContextID ctx;
 		VASurfaceID reference_picture[3];
 
+		VAProfile profile;
+		int profile_idc;
 		int intra_period;
-		int output_size;
+		int output_size;	/* protected by mutex */
 		int constraint_set_flag;
 
+		int idr_frame;		/* frame_count of the last IDR frame */
+		int idr_pic_id;
+		int idr_pic_flag;	/* of the frame being encoded */
+
 		struct {
 			VAEncSequenceParameterBufferH264 seq;
 			VAEncPictureParameterBufferH264 pic;
@@ -134,6 +187,8 @@ struct vaapi_recorder {
 
 static void *
 worker_thread_function(void *);
+static void *
+writer_thread_function(void *);
 
 /* bistream code used for writing the packed headers */
 
@@ -254,23 +309,48 @@ bitstream_byte_aligning(struct bitstream *bs, int bit)
 	bitstream_put_ui(bs, new_val, bit_left);
 }
 
+static unsigned int
+va_rate_control(enum vaapi_recorder_rate_control rate_control)
+{
+	switch (rate_control) {
+	case VAAPI_RECORDER_RC_CBR:
+		return VA_RC_CBR;
+	case VAAPI_RECORDER_RC_VBR:
+		return VA_RC_VBR;
+	case VAAPI_RECORDER_RC_CQP:
+	default:
+		return VA_RC_CQP;
+	}
+}
+
 static VAStatus
 encoder_create_config(struct vaapi_recorder *r)
 {
 	VAConfigAttrib attrib[2];
+	unsigned int rc;
 	VAStatus status;
 
 	/* FIXME: should check if VAEntrypointEncSlice is supported */
 
-	/* FIXME: should check if specified attributes are supported */
-
 	attrib[0].type = VAConfigAttribRTFormat;
 	attrib[0].value = VA_RT_FORMAT_YUV420;
 
+	/* Not every driver does bitrate control, so check for it */
+	rc = va_rate_control(r->config.rate_control);
 	attrib[1].type = VAConfigAttribRateControl;
-	attrib[1].value = VA_RC_CQP;
+	status = vaGetConfigAttributes(r->va_dpy, r->encoder.profile,
+				       VAEntrypointEncSlice, &attrib[1], 1);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
 
-	status = vaCreateConfig(r->va_dpy, VAProfileH264Main,
+	if (attrib[1].value == VA_ATTRIB_NOT_SUPPORTED ||
+	    !(attrib[1].value & rc)) {
+		weston_log("vaapi: rate control mode not supported\n");
+		return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+	}
+	attrib[1].value = rc;
+
+	status = vaCreateConfig(r->va_dpy, r->encoder.profile,
 				VAEntrypointEncSlice, attrib, 2,
 				&r->encoder.cfg);
 	if (status != VA_STATUS_SUCCESS)
@@ -306,13 +386,20 @@ encoder_init_seq_parameters(struct vaapi_recorder *r)
 
 	r->encoder.param.seq.level_idc = 41;
 	r->encoder.param.seq.intra_period = r->encoder.intra_period;
-	r->encoder.param.seq.max_num_ref_frames = 4;
+	r->encoder.param.seq.intra_idr_period = r->config.idr_period;
+	r->encoder.param.seq.ip_period = 1; /* no B frames */
+	r->encoder.param.seq.max_num_ref_frames =
+		r->config.low_latency ? 1 : 4;
 	r->encoder.param.seq.picture_width_in_mbs = width_in_mbs;
 	r->encoder.param.seq.picture_height_in_mbs = height_in_mbs;
 	r->encoder.param.seq.seq_fields.bits.frame_mbs_only_flag = 1;
 
-	/* Tc = num_units_in_tick / time_scale */
-	r->encoder.param.seq.time_scale = 1800;
+	if (r->config.rate_control != VAAPI_RECORDER_RC_CQP)
+		r->encoder.param.seq.bits_per_second =
+			r->config.bitrate * 1000;
+
+	/* Tc = num_units_in_tick / time_scale, two ticks per frame */
+	r->encoder.param.seq.time_scale = r->config.framerate * 30;
 	r->encoder.param.seq.num_units_in_tick = 15;
 
 	if (height_in_mbs * 16 - r->height > 0) {
@@ -349,10 +436,16 @@ encoder_init_pic_parameters(struct vaapi_recorder *r)
 {
 	VAEncPictureParameterBufferH264 *pic = &r->encoder.param.pic;
 
-	pic->pic_init_qp = 0;
+	/* Only a starting point when the driver controls the bitrate */
+	pic->pic_init_qp = r->config.qp;
 
-	/* ENTROPY_MODE_CABAC */
-	pic->pic_fields.bits.entropy_coding_mode_flag = 1;
+	/* Baseline has no CABAC */
+	if (r->config.low_latency)
+		pic->pic_fields.bits.entropy_coding_mode_flag =
+			ENTROPY_MODE_CAVLC;
+	else
+		pic->pic_fields.bits.entropy_coding_mode_flag =
+			ENTROPY_MODE_CABAC;
 
 	pic->pic_fields.bits.deblocking_filter_control_present_flag = 1;
 }
@@ -365,20 +458,28 @@ encoder_update_pic_parameters(struct vaapi_recorder *r,
 	VAStatus status;
 	VABufferID pic_param_buf;
 	VASurfaceID curr_pic, pic0;
+	int frame_num;
 
 	curr_pic = r->encoder.reference_picture[r->frame_count % 2];
 	pic0 = r->encoder.reference_picture[(r->frame_count + 1) % 2];
 
+	/* Numbering starts over at every IDR frame */
+	frame_num = r->frame_count - r->encoder.idr_frame;
+
 	pic->CurrPic.picture_id = curr_pic;
-	pic->CurrPic.TopFieldOrderCnt = r->frame_count * 2;
+	pic->CurrPic.TopFieldOrderCnt = frame_num * 2;
 	pic->ReferenceFrames[0].picture_id = pic0;
-	pic->ReferenceFrames[1].picture_id = r->encoder.reference_picture[2];
+	if (r->config.low_latency)
+		pic->ReferenceFrames[1].picture_id = VA_INVALID_ID;
+	else
+		pic->ReferenceFrames[1].picture_id =
+			r->encoder.reference_picture[2];
 	pic->ReferenceFrames[2].picture_id = VA_INVALID_ID;
 
 	pic->coded_buf = output_buf;
-	pic->frame_num = r->frame_count;
+	pic->frame_num = frame_num;
 
-	pic->pic_fields.bits.idr_pic_flag = (r->frame_count == 0);
+	pic->pic_fields.bits.idr_pic_flag = r->encoder.idr_pic_flag;
 	pic->pic_fields.bits.reference_pic_flag = 1;
 
 	status = vaCreateBuffer(r->va_dpy, r->encoder.ctx,
@@ -405,6 +506,7 @@ encoder_update_slice_parameter(struct vaapi_recorder *r, int slice_type)
 
 	r->encoder.param.slice.num_macroblocks = width_in_mbs * height_in_mbs;
 	r->encoder.param.slice.slice_type = slice_type;
+	r->encoder.param.slice.idr_pic_id = r->encoder.idr_pic_id;
 
 	r->encoder.param.slice.slice_alpha_c0_offset_div2 = 2;
 	r->encoder.param.slice.slice_beta_offset_div2 = 2;
@@ -422,16 +524,15 @@ encoder_update_slice_parameter(struct vaapi_recorder *r, int slice_type)
 }
 
 static VABufferID
-encoder_update_misc_hdr_parameter(struct vaapi_recorder *r)
+encoder_create_misc_parameter(struct vaapi_recorder *r,
+			      VAEncMiscParameterType type,
+			      const void *data, size_t size)
 {
 	VAEncMiscParameterBuffer *misc_param;
-	VAEncMiscParameterHRD *hrd;
 	VABufferID buffer;
 	VAStatus status;
 
-	int total_size =
-		sizeof(VAEncMiscParameterBuffer) +
-		sizeof(VAEncMiscParameterRateControl);
+	int total_size = sizeof(VAEncMiscParameterBuffer) + size;
 
 	status = vaCreateBuffer(r->va_dpy, r->encoder.ctx,
 				VAEncMiscParameterBufferType, total_size,
@@ -445,22 +546,95 @@ encoder_update_misc_hdr_parameter(struct vaapi_recorder *r)
 		return VA_INVALID_ID;
 	}
 
-	misc_param->type = VAEncMiscParameterTypeHRD;
-	hrd = (VAEncMiscParameterHRD *) misc_param->data;
-
-	hrd->initial_buffer_fullness = 0;
-	hrd->buffer_size = 0;
+	misc_param->type = type;
+	memcpy(misc_param->data, data, size);
 
 	vaUnmapBuffer(r->va_dpy, buffer);
 
 	return buffer;
 }
 
+/* The window the rate controller evens the bitrate out over.  At low
+ * latency that is a couple of frames, so no frame waits long behind a
+ * large one; otherwise a second. */
+static int
+encoder_rate_control_window(struct vaapi_recorder *r)
+{
+	if (r->config.low_latency)
+		return 2000 / r->config.framerate;
+	else
+		return 1000;
+}
+
+static VABufferID
+encoder_update_misc_hdr_parameter(struct vaapi_recorder *r)
+{
+	VAEncMiscParameterHRD hrd;
+
+	memset(&hrd, 0, sizeof hrd);
+
+	/* The decoder buffer holds one rate control window */
+	if (r->config.rate_control != VAAPI_RECORDER_RC_CQP) {
+		hrd.buffer_size = (uint64_t) r->config.bitrate *
+			encoder_rate_control_window(r);
+		hrd.initial_buffer_fullness = hrd.buffer_size / 2;
+	}
+
+	return encoder_create_misc_parameter(r, VAEncMiscParameterTypeHRD,
+					     &hrd, sizeof hrd);
+}
+
+static VABufferID
+encoder_update_misc_rate_control_parameter(struct vaapi_recorder *r)
+{
+	VAEncMiscParameterRateControl rc;
+
+	memset(&rc, 0, sizeof rc);
+
+	rc.bits_per_second = r->config.bitrate * 1000;
+	rc.window_size = encoder_rate_control_window(r);
+	rc.initial_qp = r->config.qp;
+
+	/* VBR may go down to half the target on easy content */
+	if (r->config.rate_control == VAAPI_RECORDER_RC_VBR)
+		rc.target_percentage = 50;
+	else
+		rc.target_percentage = 100;
+
+	return encoder_create_misc_parameter(r,
+					     VAEncMiscParameterTypeRateControl,
+					     &rc, sizeof rc);
+}
+
+static VABufferID
+encoder_update_misc_frame_rate_parameter(struct vaapi_recorder *r)
+{
+	VAEncMiscParameterFrameRate frame_rate;
+
+	memset(&frame_rate, 0, sizeof frame_rate);
+	frame_rate.framerate = r->config.framerate;
+
+	return encoder_create_misc_parameter(r,
+					     VAEncMiscParameterTypeFrameRate,
+					     &frame_rate, sizeof frame_rate);
+}
+
 static int
 setup_encoder(struct vaapi_recorder *r)
 {
 	VAStatus status;
 
+	if (r->config.low_latency) {
+		r->encoder.profile = VAProfileH264ConstrainedBaseline;
+		r->encoder.profile_idc = PROFILE_IDC_BASELINE;
+		/* Annex A.2.1 and A.2.2 */
+		r->encoder.constraint_set_flag |= (1 << 0) | (1 << 1);
+	} else {
+		r->encoder.profile = VAProfileH264Main;
+		r->encoder.profile_idc = PROFILE_IDC_MAIN;
+		r->encoder.constraint_set_flag |= (1 << 1); /* Annex A.2.2 */
+	}
+
 	status = encoder_create_config(r);
 	if (status != VA_STATUS_SUCCESS) {
 		return -1;
@@ -475,12 +649,11 @@ setup_encoder(struct vaapi_recorder *r)
 		return -1;
 	}
 
-	/* VAProfileH264Main */
-	r->encoder.constraint_set_flag |= (1 << 1); /* Annex A.2.2 */
+	/* Larger than the raw picture, since overflowing it now costs a
+	 * frame: it only shows once the next ones are in the encoder */
+	r->encoder.output_size = r->width * r->height * 3 / 2;
 
-	r->encoder.output_size = r->width * r->height;
-
-	r->encoder.intra_period = 30;
+	r->encoder.intra_period = r->config.intra_period;
 
 	encoder_init_seq_parameters(r);
 	encoder_init_pic_parameters(r);
@@ -521,11 +694,11 @@ rbsp_trailing_bits(struct bitstream *bs)
 
 static void sps_rbsp(struct bitstream *bs,
 		     VAEncSequenceParameterBufferH264 *seq,
-		     int constraint_set_flag)
+		     int profile_idc, int constraint_set_flag)
 {
 	int i;
 
-	bitstream_put_ui(bs, PROFILE_IDC_MAIN, 8);
+	bitstream_put_ui(bs, profile_idc, 8);
 
 	/* constraint_set[0-3] flag */
 	for (i = 0; i < 4; i++) {
@@ -667,7 +840,8 @@ build_packed_seq_buffer(struct vaapi_recorder *r,
 	bitstream_start(&bs);
 	nal_start_code_prefix(&bs);
 	nal_header(&bs, NAL_REF_IDC_HIGH, NAL_SPS);
-	sps_rbsp(&bs, &r->encoder.param.seq, r->encoder.constraint_set_flag);
+	sps_rbsp(&bs, &r->encoder.param.seq, r->encoder.profile_idc,
+		 r->encoder.constraint_set_flag);
 	bitstream_end(&bs);
 
 	*header_buffer = bs.buffer;
@@ -741,21 +915,18 @@ encoder_render_picture(struct vaapi_recorder *r, VASurfaceID input,
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
-	status = vaEndPicture(r->va_dpy, r->encoder.ctx);
-	if (status != VA_STATUS_SUCCESS)
-		return status;
-
-	return vaSyncSurface(r->va_dpy, input);
+	/* Mapping the coded buffer waits for the encoder */
+	return vaEndPicture(r->va_dpy, r->encoder.ctx);
 }
 
 static VABufferID
-encoder_create_output_buffer(struct vaapi_recorder *r)
+encoder_create_output_buffer(struct vaapi_recorder *r, int size)
 {
 	VABufferID output_buf;
 	VAStatus status;
 
 	status = vaCreateBuffer(r->va_dpy, r->encoder.ctx,
-				VAEncCodedBufferType, r->encoder.output_size,
+				VAEncCodedBufferType, size,
 				1, NULL, &output_buf);
 	if (status == VA_STATUS_SUCCESS)
 		return output_buf;
@@ -774,94 +945,126 @@ encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf)
 {
 	VACodedBufferSegment *segment;
 	VAStatus status;
-	int count;
+	uint8_t *data;
+	ssize_t count;
+	size_t left;
 
 	status = vaMapBuffer(r->va_dpy, output_buf, (void **) &segment);
 	if (status != VA_STATUS_SUCCESS)
 		return OUTPUT_WRITE_FATAL;
 
 	if (segment->status & VA_CODED_BUF_STATUS_SLICE_OVERFLOW_MASK) {
-		r->encoder.output_size *= 2;
 		vaUnmapBuffer(r->va_dpy, output_buf);
 		return OUTPUT_WRITE_OVERFLOW;
 	}
 
-	count = write(r->output_fd, segment->buf, segment->size);
+	/* Pipes and sockets may take a segment in several pieces */
+	data = segment->buf;
+	left = segment->size;
+	while (left > 0) {
+		count = write(r->output_fd, data, left);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			break;
+
+		data += count;
+		left -= count;
+	}
 
 	vaUnmapBuffer(r->va_dpy, output_buf);
 
-	if (count < 0)
+	if (left > 0)
 		return OUTPUT_WRITE_FATAL;
 
 	return OUTPUT_WRITE_SUCCESS;
 }
 
-static void
-encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
+/* Submit a frame to the encoder without waiting for it.  Returns the
+ * coded buffer the frame comes out in, or VA_INVALID_ID. */
+static VABufferID
+encoder_encode(struct vaapi_recorder *r, VASurfaceID input,
+	       int force_intra, int output_size)
 {
 	VABufferID output_buf = VA_INVALID_ID;
 
-	VABufferID buffers[8];
+	VABufferID buffers[12];
 	int count = 0;
-	int i, slice_type;
-	enum output_write_status ret;
+	int i, slice_type, gop_frame, idr;
+	VAStatus status;
+
+	gop_frame = r->frame_count - r->encoder.idr_frame;
+	idr = r->frame_count == 0 ||
+		(r->config.idr_period > 0 &&
+		 gop_frame >= r->config.idr_period);
+	if (idr)
+		gop_frame = 0;
 
-	if ((r->frame_count % r->encoder.intra_period) == 0)
+	if (idr || force_intra || (gop_frame % r->encoder.intra_period) == 0)
 		slice_type = SLICE_TYPE_I;
 	else
 		slice_type = SLICE_TYPE_P;
 
+	if (idr) {
+		if (r->frame_count > 0)
+			r->encoder.idr_pic_id++;
+		r->encoder.idr_frame = r->frame_count;
+	}
+	r->encoder.idr_pic_flag = idr;
+
 	buffers[count++] = encoder_update_seq_parameters(r);
 	buffers[count++] = encoder_update_misc_hdr_parameter(r);
+	if (r->config.rate_control != VAAPI_RECORDER_RC_CQP) {
+		buffers[count++] =
+			encoder_update_misc_rate_control_parameter(r);
+		buffers[count++] =
+			encoder_update_misc_frame_rate_parameter(r);
+	}
 	buffers[count++] = encoder_update_slice_parameter(r, slice_type);
 
 	for (i = 0; i < count; i++)
 		if (buffers[i] == VA_INVALID_ID)
 			goto bail;
 
-	if (r->frame_count == 0)
+	/* Streams repeat SPS and PPS with every intra frame, so that a
+	 * receiver can start decoding mid-stream */
+	if (idr || (r->stream && slice_type == SLICE_TYPE_I))
 		count += encoder_prepare_headers(r, buffers + count);
 
-	do {
-		output_buf = encoder_create_output_buffer(r);
-		if (output_buf == VA_INVALID_ID)
-			goto bail;
-
-		buffers[count++] =
-			encoder_update_pic_parameters(r, output_buf);
-		if (buffers[count - 1] == VA_INVALID_ID)
-			goto bail;
-
-		encoder_render_picture(r, input, buffers, count);
-		ret = encoder_write_output(r, output_buf);
-
-		vaDestroyBuffer(r->va_dpy, output_buf);
-		output_buf = VA_INVALID_ID;
+	output_buf = encoder_create_output_buffer(r, output_size);
+	if (output_buf == VA_INVALID_ID)
+		goto bail;
 
-		vaDestroyBuffer(r->va_dpy, buffers[--count]);
-	} while (ret == OUTPUT_WRITE_OVERFLOW);
+	buffers[count++] = encoder_update_pic_parameters(r, output_buf);
+	if (buffers[count - 1] == VA_INVALID_ID)
+		goto bail;
 
-	if (ret == OUTPUT_WRITE_FATAL)
-		r->error = errno;
+	status = encoder_render_picture(r, input, buffers, count);
+	if (status != VA_STATUS_SUCCESS)
+		goto bail;
 
 	for (i = 0; i < count; i++)
 		vaDestroyBuffer(r->va_dpy, buffers[i]);
 
 	r->frame_count++;
-	return;
+	return output_buf;
 
 bail:
 	for (i = 0; i < count; i++)
-		vaDestroyBuffer(r->va_dpy, buffers[i]);
+		if (buffers[i] != VA_INVALID_ID)
+			vaDestroyBuffer(r->va_dpy, buffers[i]);
 	if (output_buf != VA_INVALID_ID)
 		vaDestroyBuffer(r->va_dpy, output_buf);
-}
 
+	return VA_INVALID_ID;
+}
 
 static int
 setup_vpp(struct vaapi_recorder *r)
 {
+	VASurfaceID surfaces[RECORDER_PIPELINE_DEPTH];
 	VAStatus status;
+	int i;
 
 	status = vaCreateConfig(r->va_dpy, VAProfileNone,
 				VAEntrypointVideoProc, NULL, 0,
@@ -888,13 +1091,18 @@ setup_vpp(struct vaapi_recorder *r)
 	}
 
 	status = vaCreateSurfaces(r->va_dpy, VA_RT_FORMAT_YUV420,
-				  r->width, r->height, &r->vpp.output, 1,
-				  NULL, 0);
+				  r->width, r->height, surfaces,
+				  RECORDER_PIPELINE_DEPTH, NULL, 0);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("vaapi: failed to create YUV surface\n");
 		goto err_buf;
 	}
 
+	for (i = 0; i < RECORDER_PIPELINE_DEPTH; i++) {
+		r->pipeline.slot[i].yuv = surfaces[i];
+		r->pipeline.slot[i].coded = VA_INVALID_ID;
+	}
+
 	return 0;
 
 err_buf:
@@ -910,7 +1118,10 @@ err_cfg:
 static void
 vpp_destroy(struct vaapi_recorder *r)
 {
-	vaDestroySurfaces(r->va_dpy, &r->vpp.output, 1);
+	int i;
+
+	for (i = 0; i < RECORDER_PIPELINE_DEPTH; i++)
+		vaDestroySurfaces(r->va_dpy, &r->pipeline.slot[i].yuv, 1);
 	vaDestroyBuffer(r->va_dpy, r->vpp.pipeline_buf);
 	vaDestroyConfig(r->va_dpy, r->vpp.ctx);
 	vaDestroyConfig(r->va_dpy, r->vpp.cfg);
@@ -919,9 +1130,12 @@ vpp_destroy(struct vaapi_recorder *r)
 static int
 setup_worker_thread(struct vaapi_recorder *r)
 {
+	wl_list_init(&r->buffers);
 	pthread_mutex_init(&r->mutex, NULL);
 	pthread_cond_init(&r->input_cond, NULL);
+	pthread_cond_init(&r->output_cond, NULL);
 	pthread_create(&r->worker_thread, NULL, worker_thread_function, r);
+	pthread_create(&r->writer_thread, NULL, writer_thread_function, r);
 
 	return 1;
 }
@@ -939,17 +1153,93 @@ destroy_worker_thread(struct vaapi_recorder *r)
 
 	pthread_join(r->worker_thread, NULL);
 
+	/* Nothing more gets submitted, write out what is in the encoder */
+	pthread_mutex_lock(&r->mutex);
+	r->pipeline.flushing = 1;
+	pthread_cond_signal(&r->output_cond);
+	pthread_mutex_unlock(&r->mutex);
+
+	pthread_join(r->writer_thread, NULL);
+
 	pthread_mutex_destroy(&r->mutex);
 	pthread_cond_destroy(&r->input_cond);
+	pthread_cond_destroy(&r->output_cond);
 }
 
-struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
+void
+vaapi_recorder_config_init(struct vaapi_recorder_config *config)
+{
+	memset(config, 0, sizeof *config);
+
+	config->rate_control = VAAPI_RECORDER_RC_CQP;
+	config->bitrate = 8000;
+	config->qp = 0;
+	config->framerate = 60;
+	config->intra_period = 30;
+	config->idr_period = 0;
+	config->low_latency = 0;
+}
+
+/* Override the settings in config with those set in a weston.ini
+ * section.  A NULL section leaves config as it is. */
+void
+vaapi_recorder_config_read(struct vaapi_recorder_config *config,
+			   struct weston_config_section *section)
+{
+	char *rate_control;
+	int value;
+
+	weston_config_section_get_string(section, "rate-control",
+					 &rate_control, NULL);
+	if (rate_control) {
+		if (strcmp(rate_control, "cqp") == 0)
+			config->rate_control = VAAPI_RECORDER_RC_CQP;
+		else if (strcmp(rate_control, "cbr") == 0)
+			config->rate_control = VAAPI_RECORDER_RC_CBR;
+		else if (strcmp(rate_control, "vbr") == 0)
+			config->rate_control = VAAPI_RECORDER_RC_VBR;
+		else
+			weston_log("vaapi: unknown rate-control \"%s\"\n",
+				   rate_control);
+		free(rate_control);
+	}
+
+	weston_config_section_get_int(section, "bitrate", &value,
+				      config->bitrate);
+	if (value > 0)
+		config->bitrate = value;
+
+	weston_config_section_get_int(section, "qp", &value, config->qp);
+	if (value >= 0 && value <= 51)
+		config->qp = value;
+
+	weston_config_section_get_int(section, "framerate", &value,
+				      config->framerate);
+	if (value > 0)
+		config->framerate = value;
+
+	weston_config_section_get_int(section, "intra-period", &value,
+				      config->intra_period);
+	if (value > 0)
+		config->intra_period = value;
+
+	weston_config_section_get_int(section, "idr-period", &value,
+				      config->idr_period);
+	if (value >= 0)
+		config->idr_period = value;
+
+	weston_config_section_get_bool(section, "low-latency", &value,
+				       config->low_latency);
+	config->low_latency = value;
+}
+
+static struct vaapi_recorder *
+recorder_create(int drm_fd, int width, int height, int output_fd, int stream,
+		const struct vaapi_recorder_config *config)
 {
 	struct vaapi_recorder *r;
 	VAStatus status;
 	int major, minor;
-	int flags;
 
 	r = calloc(1, sizeof *r);
 	if (!r)
@@ -958,25 +1248,27 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 	r->width = width;
 	r->height = height;
 	r->drm_fd = drm_fd;
+	r->output_fd = output_fd;
+	r->stream = stream;
+
+	if (config)
+		r->config = *config;
+	else
+		vaapi_recorder_config_init(&r->config);
 
 	if (setup_worker_thread(r) < 0)
 		goto err_free;
 
-	flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
-	r->output_fd = open(filename, flags, 0644);
-	if (r->output_fd < 0)
-		goto err_thread;
-
 	r->va_dpy = vaGetDisplayDRM(drm_fd);
 	if (!r->va_dpy) {
 		weston_log("failed to create VA display\n");
-		goto err_fd;
+		goto err_thread;
 	}
 
 	status = vaInitialize(r->va_dpy, &major, &minor);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("vaapi: failed to initialize display\n");
-		goto err_fd;
+		goto err_thread;
 	}
 
 	if (setup_vpp(r) < 0) {
@@ -994,8 +1286,6 @@ err_vpp:
 	vpp_destroy(r);
 err_va_dpy:
 	vaTerminate(r->va_dpy);
-err_fd:
-	close(r->output_fd);
 err_thread:
 	destroy_worker_thread(r);
 err_free:
@@ -1004,11 +1294,85 @@ err_free:
 	return NULL;
 }
 
+struct vaapi_recorder *
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename,
+		      const struct vaapi_recorder_config *config)
+{
+	struct vaapi_recorder *r;
+	int flags, fd;
+
+	flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	fd = open(filename, flags, 0644);
+	if (fd < 0)
+		return NULL;
+
+	r = recorder_create(drm_fd, width, height, fd, 0, config);
+	if (!r)
+		close(fd);
+
+	return r;
+}
+
+/* Like vaapi_recorder_create(), but writes a raw H.264 elementary stream
+ * to an already open pipe, socket or file that the recorder takes over
+ * on success.  The stream is made to be joined at any intra frame.
+ * The fd should be blocking: the encoder thread waits for the reader,
+ * and frames queued meanwhile are dropped rather than stall the caller.
+ * Once the reader goes away vaapi_recorder_frame() fails with EPIPE. */
+struct vaapi_recorder *
+vaapi_recorder_create_for_fd(int drm_fd, int width, int height, int fd,
+			     const struct vaapi_recorder_config *config)
+{
+	return recorder_create(drm_fd, width, height, fd, 1, config);
+}
+
+static void
+buffer_unref_locked(struct vaapi_recorder_buffer *buffer)
+{
+	if (--buffer->refcount > 0)
+		return;
+
+	if (buffer->r) {
+		vaDestroySurfaces(buffer->r->va_dpy, &buffer->surface, 1);
+		wl_list_remove(&buffer->link);
+	}
+
+	free(buffer);
+}
+
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r)
 {
+	struct vaapi_recorder_buffer *buffer, *next;
+	int i;
+
+	/* Don't wait for a stalled reader to take the frame being written */
+	if (r->stream)
+		shutdown(r->output_fd, SHUT_RDWR);
+
 	destroy_worker_thread(r);
 
+	while (r->queue.count > 0) {
+		buffer_unref_locked(r->queue.buffer[r->queue.head]);
+		r->queue.head = (r->queue.head + 1) % RECORDER_QUEUE_SIZE;
+		r->queue.count--;
+	}
+
+	/* The caller may still hold on to some buffers, leave them behind
+	 * as empty shells for it to unref. */
+	wl_list_for_each_safe(buffer, next, &r->buffers, link) {
+		vaDestroySurfaces(r->va_dpy, &buffer->surface, 1);
+		wl_list_init(&buffer->link);
+		buffer->r = NULL;
+	}
+
+	for (i = 0; i < RECORDER_UPLOAD_SIZE; i++)
+		if (r->upload[i])
+			buffer_unref_locked(r->upload[i]);
+
+	weston_log("[libva recorder] %d frames encoded, %d dropped\n",
+		   r->frame_count, r->dropped_count);
+
 	encoder_destroy(r);
 	vpp_destroy(r);
 
@@ -1060,7 +1424,8 @@ create_surface_from_fd(struct vaapi_recorder *r, int prime_fd,
 }
 
 static VAStatus
-convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
+convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface,
+		   VASurfaceID yuv_surface)
 {
 	VAProcPipelineParameterBuffer *pipeline_param;
 	VAStatus status;
@@ -1082,7 +1447,7 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
-	status = vaBeginPicture(r->va_dpy, r->vpp.ctx, r->vpp.output);
+	status = vaBeginPicture(r->va_dpy, r->vpp.ctx, yuv_surface);
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
@@ -1098,52 +1463,75 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	return status;
 }
 
-static void
-recorder_frame(struct vaapi_recorder *r)
+static int
+recorder_frame(struct vaapi_recorder *r, struct vaapi_recorder_buffer *buffer,
+	       struct recorder_slot *slot, int force_intra, int output_size)
 {
-	VASurfaceID rgb_surface;
 	VAStatus status;
 
-	status = create_surface_from_fd(r, r->input.prime_fd,
-					r->input.stride, &rgb_surface);
-	if (status != VA_STATUS_SUCCESS) {
-		weston_log("[libva recorder] "
-			   "failed to create surface from bo\n");
-		return;
-	}
-
-	close(r->input.prime_fd);
-
-	status = convert_rgb_to_yuv(r, rgb_surface);
+	status = convert_rgb_to_yuv(r, buffer->surface, slot->yuv);
+	if (status == VA_STATUS_SUCCESS)
+		/* The caller may reuse its buffer once we unref it */
+		status = vaSyncSurface(r->va_dpy, slot->yuv);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
 			   "color space conversion failed\n");
-		return;
+		return -1;
 	}
 
-	encoder_encode(r, r->vpp.output);
+	slot->coded = encoder_encode(r, slot->yuv, force_intra, output_size);
+	if (slot->coded == VA_INVALID_ID)
+		return -1;
 
-	vaDestroySurfaces(r->va_dpy, &rgb_surface, 1);
+	return 0;
 }
 
 static void *
 worker_thread_function(void *data)
 {
 	struct vaapi_recorder *r = data;
+	struct vaapi_recorder_buffer *buffer;
+	struct recorder_slot *slot;
+	int force_intra, output_size, ret;
 
 	pthread_mutex_lock(&r->mutex);
 
 	while (!r->destroying) {
-		if (!r->input.valid)
+		/* If the thread is awaken by destroy_worker_thread(),
+		 * there might not be any input.  With the pipeline full,
+		 * leave the input queued so that the caller drops frames
+		 * rather than us. */
+		if (r->queue.count == 0 ||
+		    r->pipeline.count == RECORDER_PIPELINE_DEPTH) {
 			pthread_cond_wait(&r->input_cond, &r->mutex);
+			continue;
+		}
 
-		/* If the thread is awaken by destroy_worker_thread(),
-		 * there might not be valid input */
-		if (!r->input.valid)
+		buffer = r->queue.buffer[r->queue.head];
+		r->queue.head = (r->queue.head + 1) % RECORDER_QUEUE_SIZE;
+		r->queue.count--;
+
+		slot = &r->pipeline.slot[(r->pipeline.head +
+					  r->pipeline.count) %
+					 RECORDER_PIPELINE_DEPTH];
+		force_intra = r->force_intra;
+		r->force_intra = 0;
+		output_size = r->encoder.output_size;
+
+		/* Let the compositor queue more frames while encoding */
+		pthread_mutex_unlock(&r->mutex);
+		ret = recorder_frame(r, buffer, slot, force_intra, output_size);
+		pthread_mutex_lock(&r->mutex);
+
+		buffer_unref_locked(buffer);
+
+		if (ret < 0) {
+			r->force_intra |= force_intra;
 			continue;
+		}
 
-		recorder_frame(r);
-		r->input.valid = 0;
+		r->pipeline.count++;
+		pthread_cond_signal(&r->output_cond);
 	}
 
 	pthread_mutex_unlock(&r->mutex);
@@ -1151,10 +1539,117 @@ worker_thread_function(void *data)
 	return NULL;
 }
 
+static void *
+writer_thread_function(void *data)
+{
+	struct vaapi_recorder *r = data;
+	struct recorder_slot *slot;
+	enum output_write_status ret;
+	sigset_t sigpipe;
+	int error;
+
+	/* A reader closing a stream should fail the write, not kill us */
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+	pthread_mutex_lock(&r->mutex);
+
+	for (;;) {
+		if (r->pipeline.count == 0) {
+			if (r->pipeline.flushing)
+				break;
+			pthread_cond_wait(&r->output_cond, &r->mutex);
+			continue;
+		}
+
+		slot = &r->pipeline.slot[r->pipeline.head];
+
+		/* Mapping the frame waits for the encoder, let the worker
+		 * submit the next ones meanwhile */
+		pthread_mutex_unlock(&r->mutex);
+		ret = encoder_write_output(r, slot->coded);
+		error = errno;
+		vaDestroyBuffer(r->va_dpy, slot->coded);
+		slot->coded = VA_INVALID_ID;
+		pthread_mutex_lock(&r->mutex);
+
+		if (ret == OUTPUT_WRITE_OVERFLOW) {
+			/* The following frames refer to this one, which is
+			 * lost now: restart from an intra frame */
+			r->encoder.output_size *= 2;
+			r->force_intra = 1;
+			r->dropped_count++;
+		} else if (ret == OUTPUT_WRITE_FATAL) {
+			r->error = error;
+		}
+
+		r->pipeline.head = (r->pipeline.head + 1) %
+			RECORDER_PIPELINE_DEPTH;
+		r->pipeline.count--;
+		pthread_cond_signal(&r->input_cond);
+	}
+
+	pthread_mutex_unlock(&r->mutex);
+
+	return NULL;
+}
+
+struct vaapi_recorder_buffer *
+vaapi_recorder_import(struct vaapi_recorder *r, int prime_fd, int stride)
+{
+	struct vaapi_recorder_buffer *buffer;
+	VAStatus status;
+
+	buffer = calloc(1, sizeof *buffer);
+	if (!buffer)
+		return NULL;
+
+	status = create_surface_from_fd(r, prime_fd, stride, &buffer->surface);
+	if (status != VA_STATUS_SUCCESS) {
+		weston_log("[libva recorder] "
+			   "failed to create surface from bo\n");
+		free(buffer);
+		return NULL;
+	}
+
+	buffer->r = r;
+	buffer->refcount = 1;
+
+	pthread_mutex_lock(&r->mutex);
+	wl_list_insert(&r->buffers, &buffer->link);
+	pthread_mutex_unlock(&r->mutex);
+
+	return buffer;
+}
+
 int
-vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
+vaapi_recorder_buffer_is_valid(struct vaapi_recorder *r,
+			       struct vaapi_recorder_buffer *buffer)
+{
+	return buffer->r == r;
+}
+
+void
+vaapi_recorder_buffer_unref(struct vaapi_recorder_buffer *buffer)
 {
-	int ret = 0;
+	struct vaapi_recorder *r = buffer->r;
+
+	if (!r) {
+		buffer_unref_locked(buffer);
+		return;
+	}
+
+	pthread_mutex_lock(&r->mutex);
+	buffer_unref_locked(buffer);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+int
+vaapi_recorder_frame(struct vaapi_recorder *r,
+		     struct vaapi_recorder_buffer *buffer)
+{
+	int ret = 0, tail;
 
 	pthread_mutex_lock(&r->mutex);
 
@@ -1164,13 +1659,16 @@ vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
 		goto unlock;
 	}
 
-	/* The mutex is never released while encoding, so this point should
-	 * never be reached if input.valid is true. */
-	assert(!r->input.valid);
+	/* The encoder fell behind, skip this frame rather than wait */
+	if (r->queue.count == RECORDER_QUEUE_SIZE) {
+		r->dropped_count++;
+		goto unlock;
+	}
 
-	r->input.prime_fd = prime_fd;
-	r->input.stride = stride;
-	r->input.valid = 1;
+	tail = (r->queue.head + r->queue.count) % RECORDER_QUEUE_SIZE;
+	r->queue.buffer[tail] = buffer;
+	r->queue.count++;
+	buffer->refcount++;
 	pthread_cond_signal(&r->input_cond);
 
 unlock:
@@ -1178,3 +1676,125 @@ unlock:
 
 	return ret;
 }
+
+static struct vaapi_recorder_buffer *
+create_upload_buffer(struct vaapi_recorder *r)
+{
+	struct vaapi_recorder_buffer *buffer;
+	VASurfaceAttrib va_attrib;
+	VAStatus status;
+
+	buffer = calloc(1, sizeof *buffer);
+	if (!buffer)
+		return NULL;
+
+	va_attrib.type = VASurfaceAttribPixelFormat;
+	va_attrib.flags = VA_SURFACE_ATTRIB_SETTABLE;
+	va_attrib.value.type = VAGenericValueTypeInteger;
+	va_attrib.value.value.i = VA_FOURCC_BGRX;
+
+	status = vaCreateSurfaces(r->va_dpy, VA_RT_FORMAT_RGB32,
+				  r->width, r->height, &buffer->surface, 1,
+				  &va_attrib, 1);
+	if (status != VA_STATUS_SUCCESS) {
+		weston_log("[libva recorder] "
+			   "failed to create upload surface\n");
+		free(buffer);
+		return NULL;
+	}
+
+	buffer->r = r;
+	buffer->refcount = 1;
+
+	pthread_mutex_lock(&r->mutex);
+	wl_list_insert(&r->buffers, &buffer->link);
+	pthread_mutex_unlock(&r->mutex);
+
+	return buffer;
+}
+
+static int
+upload_pixels(struct vaapi_recorder *r, struct vaapi_recorder_buffer *buffer,
+	      const void *data, int stride)
+{
+	const uint8_t *src = data;
+	uint8_t *dst;
+	VAImage image;
+	VAStatus status;
+	int y;
+
+	status = vaDeriveImage(r->va_dpy, buffer->surface, &image);
+	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	status = vaMapBuffer(r->va_dpy, image.buf, (void **) &dst);
+	if (status != VA_STATUS_SUCCESS) {
+		vaDestroyImage(r->va_dpy, image.image_id);
+		return -1;
+	}
+
+	dst += image.offsets[0];
+	for (y = 0; y < r->height; y++)
+		memcpy(dst + y * image.pitches[0], src + y * stride,
+		       r->width * 4);
+
+	vaUnmapBuffer(r->va_dpy, image.buf);
+	vaDestroyImage(r->va_dpy, image.image_id);
+
+	return 0;
+}
+
+/* Encode a frame from XRGB8888 pixels in memory, for callers that have
+ * no dma-buf to import.  The pixels are copied before returning.  Like
+ * vaapi_recorder_frame(), the frame is dropped if the encoder is behind. */
+int
+vaapi_recorder_frame_data(struct vaapi_recorder *r,
+			  const void *data, int stride)
+{
+	struct vaapi_recorder_buffer *buffer = NULL;
+	int i;
+
+	pthread_mutex_lock(&r->mutex);
+
+	if (r->error) {
+		errno = r->error;
+		pthread_mutex_unlock(&r->mutex);
+		return -1;
+	}
+
+	/* Skip the upload too when the frame would be dropped anyway */
+	if (r->queue.count == RECORDER_QUEUE_SIZE) {
+		r->dropped_count++;
+		pthread_mutex_unlock(&r->mutex);
+		return 0;
+	}
+
+	for (i = 0; i < RECORDER_UPLOAD_SIZE; i++) {
+		/* Only referenced by us, not queued nor being encoded */
+		if (r->upload[i] && r->upload[i]->refcount == 1) {
+			buffer = r->upload[i];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&r->mutex);
+
+	for (i = 0; i < RECORDER_UPLOAD_SIZE && !buffer; i++) {
+		if (!r->upload[i]) {
+			r->upload[i] = create_upload_buffer(r);
+			buffer = r->upload[i];
+			if (!buffer)
+				return -1;
+		}
+	}
+
+	/* With more surfaces than queue slots one is always idle */
+	assert(buffer);
+
+	if (upload_pixels(r, buffer, data, stride) < 0) {
+		weston_log("[libva recorder] failed to upload frame\n");
+		return -1;
+	}
+
+	return vaapi_recorder_frame(r, buffer);
+}
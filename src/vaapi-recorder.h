@@ -24,12 +24,53 @@
 #define _VAAPI_RECORDER_H_
 
 struct vaapi_recorder;
+struct vaapi_recorder_buffer;
+struct weston_config_section;
 
+enum vaapi_recorder_rate_control {
+	VAAPI_RECORDER_RC_CQP,	/* constant quantizer, no bitrate target */
+	VAAPI_RECORDER_RC_CBR,
+	VAAPI_RECORDER_RC_VBR
+};
+
+struct vaapi_recorder_config {
+	enum vaapi_recorder_rate_control rate_control;
+	int bitrate;		/* target in kbit/s, CBR and VBR only */
+	int qp;			/* quantizer for CQP, 0 - 51 */
+	int framerate;		/* nominal frames per second */
+	int intra_period;	/* frames between intra frames */
+	int idr_period;		/* frames between IDR frames, 0 for the first only */
+	int low_latency;	/* constrained baseline, one reference frame */
+};
+
+void
+vaapi_recorder_config_init(struct vaapi_recorder_config *config);
+void
+vaapi_recorder_config_read(struct vaapi_recorder_config *config,
+			   struct weston_config_section *section);
+
+struct vaapi_recorder *
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename,
+		      const struct vaapi_recorder_config *config);
 struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename);
+vaapi_recorder_create_for_fd(int drm_fd, int width, int height, int fd,
+			     const struct vaapi_recorder_config *config);
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r);
+
+struct vaapi_recorder_buffer *
+vaapi_recorder_import(struct vaapi_recorder *r, int prime_fd, int stride);
+int
+vaapi_recorder_buffer_is_valid(struct vaapi_recorder *r,
+			       struct vaapi_recorder_buffer *buffer);
+void
+vaapi_recorder_buffer_unref(struct vaapi_recorder_buffer *buffer);
+
+int
+vaapi_recorder_frame(struct vaapi_recorder *r,
+		     struct vaapi_recorder_buffer *buffer);
 int
-vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride);
+vaapi_recorder_frame_data(struct vaapi_recorder *r,
+			  const void *data, int stride);
 
 #endif /* _VAAPI_RECORDER_H_ */
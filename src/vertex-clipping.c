@@ -25,6 +25,12 @@
 
 #include "vertex-clipping.h"
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 float
 float_difference(float a, float b)
 {
@@ -313,3 +319,107 @@ clip_transformed(struct clip_context *ctx,
 
 	return n;
 }
+
+/* A rectangle whose edges are parallel to the axes, which is what an
+ * untransformed, scaled or 90 degree rotated surface rect becomes.  Its
+ * intersection with a box is just its corners clamped to the box. */
+static int
+polygon_is_axis_aligned(const struct polygon8 *p)
+{
+	if (p->n != 4)
+		return 0;
+
+	return (p->x[0] == p->x[3] && p->x[1] == p->x[2] &&
+		p->y[0] == p->y[1] && p->y[2] == p->y[3]) ||
+	       (p->x[0] == p->x[1] && p->x[2] == p->x[3] &&
+		p->y[0] == p->y[3] && p->y[1] == p->y[2]);
+}
+
+static void
+clip_box_aligned(const struct polygon8 *surf, const struct clip_box *box,
+		 struct polygon8 *out)
+{
+#if defined(__SSE__)
+	__m128 x = _mm_loadu_ps(surf->x);
+	__m128 y = _mm_loadu_ps(surf->y);
+
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(box->x1)),
+		       _mm_set1_ps(box->x2));
+	y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(box->y1)),
+		       _mm_set1_ps(box->y2));
+	_mm_storeu_ps(out->x, x);
+	_mm_storeu_ps(out->y, y);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t x = vld1q_f32(surf->x);
+	float32x4_t y = vld1q_f32(surf->y);
+
+	x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(box->x1)),
+		      vdupq_n_f32(box->x2));
+	y = vminq_f32(vmaxq_f32(y, vdupq_n_f32(box->y1)),
+		      vdupq_n_f32(box->y2));
+	vst1q_f32(out->x, x);
+	vst1q_f32(out->y, y);
+#else
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		out->x[i] = clip(surf->x[i], box->x1, box->x2);
+		out->y[i] = clip(surf->y[i], box->y1, box->y2);
+	}
+#endif
+	out->n = 4;
+}
+
+/* Clips the convex polygon surf against each of the boxes, leaving the
+ * piece inside boxes[i] in out[i], with out[i].n set to 0 where there
+ * is none.  The bounding box and the shape of surf are worked out once
+ * for all the boxes.  Returns the number of non-empty pieces. */
+int
+clip_boxes(const struct polygon8 *surf,
+	   const struct clip_box *boxes, int nboxes,
+	   struct polygon8 *out)
+{
+	struct clip_context ctx;
+	struct polygon8 polygon;
+	float min_x, max_x, min_y, max_y;
+	int i, aligned, count = 0;
+
+	min_x = max_x = surf->x[0];
+	min_y = max_y = surf->y[0];
+	for (i = 1; i < surf->n; i++) {
+		min_x = min(min_x, surf->x[i]);
+		max_x = max(max_x, surf->x[i]);
+		min_y = min(min_y, surf->y[i]);
+		max_y = max(max_y, surf->y[i]);
+	}
+
+	aligned = polygon_is_axis_aligned(surf);
+
+	for (i = 0; i < nboxes; i++) {
+		const struct clip_box *box = &boxes[i];
+
+		out[i].n = 0;
+		if (min_x >= box->x2 || max_x <= box->x1 ||
+		    min_y >= box->y2 || max_y <= box->y1)
+			continue;
+
+		if (aligned) {
+			clip_box_aligned(surf, box, &out[i]);
+		} else {
+			ctx.clip.x1 = box->x1;
+			ctx.clip.y1 = box->y1;
+			ctx.clip.x2 = box->x2;
+			ctx.clip.y2 = box->y2;
+			polygon = *surf;
+			out[i].n = clip_transformed(&ctx, &polygon,
+						    out[i].x, out[i].y);
+			if (out[i].n < 3)
+				out[i].n = 0;
+		}
+
+		if (out[i].n > 0)
+			count++;
+	}
+
+	return count;
+}
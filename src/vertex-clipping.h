@@ -28,6 +28,11 @@ struct polygon8 {
 	int n;
 };
 
+struct clip_box {
+	float x1, y1;
+	float x2, y2;
+};
+
 struct clip_context {
 	struct {
 		float x;
@@ -58,6 +63,11 @@ int
 clip_transformed(struct clip_context *ctx,
 		 struct polygon8 *surf,
 		 float *ex,
-		 float *ey);\
+		 float *ey);
+
+int
+clip_boxes(const struct polygon8 *surf,
+	   const struct clip_box *boxes, int nboxes,
+	   struct polygon8 *out);
 
 #endif
@@ -62,6 +62,59 @@ typedef EGLBoolean (EGLAPIENTRYP PFNEGLQUERYWAYLANDBUFFERWL) (EGLDisplay dpy, st
 #define EGL_BUFFER_AGE_EXT              0x313D
 #endif
 
+#ifndef EGL_KHR_partial_update
+#define EGL_KHR_partial_update 1
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLSETDAMAGEREGIONKHRPROC) (EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint n_rects);
+#endif
+
+#ifndef EGL_EXT_image_dma_buf_import
+#define EGL_LINUX_DMA_BUF_EXT				0x3270
+#define EGL_LINUX_DRM_FOURCC_EXT			0x3271
+#define EGL_DMA_BUF_PLANE0_FD_EXT			0x3272
+#define EGL_DMA_BUF_PLANE0_OFFSET_EXT			0x3273
+#define EGL_DMA_BUF_PLANE0_PITCH_EXT			0x3274
+#define EGL_DMA_BUF_PLANE1_FD_EXT			0x3275
+#define EGL_DMA_BUF_PLANE1_OFFSET_EXT			0x3276
+#define EGL_DMA_BUF_PLANE1_PITCH_EXT			0x3277
+#define EGL_DMA_BUF_PLANE2_FD_EXT			0x3278
+#define EGL_DMA_BUF_PLANE2_OFFSET_EXT			0x3279
+#define EGL_DMA_BUF_PLANE2_PITCH_EXT			0x327A
+#endif
+
+#ifndef EGL_EXT_image_dma_buf_import_modifiers
+#define EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT		0x3443
+#define EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT		0x3444
+#define EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT		0x3445
+#define EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT		0x3446
+#define EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT		0x3447
+#define EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT		0x3448
+#endif
+
+#ifndef EGL_KHR_fence_sync
+#define EGL_KHR_fence_sync 1
+typedef void *EGLSyncKHR;
+typedef khronos_utime_nanoseconds_t EGLTimeKHR;
+#define EGL_SYNC_FENCE_KHR				0x30F9
+#define EGL_CONDITION_SATISFIED_KHR			0x30F6
+#define EGL_NO_SYNC_KHR					((EGLSyncKHR)0)
+typedef EGLSyncKHR (EGLAPIENTRYP PFNEGLCREATESYNCKHRPROC) (EGLDisplay dpy, EGLenum type, const EGLint *attrib_list);
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLDESTROYSYNCKHRPROC) (EGLDisplay dpy, EGLSyncKHR sync);
+typedef EGLint (EGLAPIENTRYP PFNEGLCLIENTWAITSYNCKHRPROC) (EGLDisplay dpy, EGLSyncKHR sync, EGLint flags, EGLTimeKHR timeout);
+#endif
+
+#ifndef EGL_KHR_wait_sync
+#define EGL_KHR_wait_sync 1
+typedef EGLint (EGLAPIENTRYP PFNEGLWAITSYNCKHRPROC) (EGLDisplay dpy, EGLSyncKHR sync, EGLint flags);
+#endif
+
+#ifndef EGL_ANDROID_native_fence_sync
+#define EGL_ANDROID_native_fence_sync 1
+#define EGL_SYNC_NATIVE_FENCE_ANDROID			0x3144
+#define EGL_SYNC_NATIVE_FENCE_FD_ANDROID		0x3145
+#define EGL_NO_NATIVE_FENCE_FD_ANDROID			-1
+typedef EGLint (EGLAPIENTRYP PFNEGLDUPNATIVEFENCEFDANDROIDPROC) (EGLDisplay dpy, EGLSyncKHR sync);
+#endif
+
 #ifndef EGL_WAYLAND_Y_INVERTED_WL
 #define EGL_WAYLAND_Y_INVERTED_WL		0x31DB /* eglQueryWaylandBufferWL attribute */
 #endif
@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <poll.h>
 #include <errno.h>
+#include <time.h>
 
 #include <error.h>
 #include <getopt.h>
@@ -45,6 +46,7 @@
 #include <linux/vt.h>
 #include <linux/major.h>
 #include <linux/kd.h>
+#include <linux/input.h>
 
 #include <pwd.h>
 #include <grp.h>
@@ -68,6 +70,13 @@
 
 #define MAX_ARGV_SIZE 256
 
+/* Devices opened for the compositor, kept for restarting it */
+#define MAX_KEPT_FDS 256
+
+/* A compositor crashing more often than this isn't restarted */
+#define RESTART_MAX 5
+#define RESTART_INTERVAL 60	/* seconds */
+
 #ifdef HAVE_LIBDRM
 
 #include <xf86drm.h>
@@ -104,6 +113,26 @@ struct weston_launch {
 	pid_t child;
 	int verbose;
 	char *new_user;
+
+	/* Restarting the compositor when it crashes.  The DRM and input
+	 * fds it opened stay open here, and the next compositor gets the
+	 * same ones back when it asks for the device, so it starts out
+	 * DRM master with the CRTCs still showing the last frame. */
+	int restart;
+	int restarts;
+	time_t restart_time;
+	int generation;		/* of the running compositor */
+	int inactive;		/* our VT is switched away */
+	int argc;
+	char **argv;
+
+	struct {
+		int fd;
+		dev_t rdev;
+		int flags;
+		int generation;	/* of the compositor that got it last */
+	} kept[MAX_KEPT_FDS];
+	int num_kept;
 };
 
 union cmsg_data { unsigned char b[4]; int fd; };
@@ -285,10 +314,62 @@ send_reply(struct weston_launch *wl, int reply)
 	return len;
 }
 
+static void
+remove_kept_fd(struct weston_launch *wl, int i)
+{
+	wl->kept[i] = wl->kept[--wl->num_kept];
+}
+
+/* Returns the fd a previous compositor had for the device, if it's
+ * still good, for the new one to pick up where that one left. */
+static int
+take_kept_fd(struct weston_launch *wl, const char *path, int flags)
+{
+	struct stat s;
+	int i, version;
+
+	if (stat(path, &s) < 0)
+		return -1;
+
+	for (i = 0; i < wl->num_kept; i++) {
+		if (wl->kept[i].rdev != s.st_rdev ||
+		    wl->kept[i].flags != flags ||
+		    wl->kept[i].generation == wl->generation)
+			continue;
+
+		/* The device may have gone away and its number reused */
+		if (major(s.st_rdev) == INPUT_MAJOR &&
+		    ioctl(wl->kept[i].fd, EVIOCGVERSION, &version) < 0) {
+			close(wl->kept[i].fd);
+			remove_kept_fd(wl, i);
+			return -1;
+		}
+
+		wl->kept[i].generation = wl->generation;
+		return wl->kept[i].fd;
+	}
+
+	return -1;
+}
+
+static void
+add_kept_fd(struct weston_launch *wl, int fd, const struct stat *s, int flags)
+{
+	if (!wl->restart || wl->num_kept == MAX_KEPT_FDS)
+		return;
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	wl->kept[wl->num_kept].fd = fd;
+	wl->kept[wl->num_kept].rdev = s->st_rdev;
+	wl->kept[wl->num_kept].flags = flags;
+	wl->kept[wl->num_kept].generation = wl->generation;
+	wl->num_kept++;
+}
+
 static int
 handle_open(struct weston_launch *wl, struct msghdr *msg, ssize_t len)
 {
-	int fd = -1, ret = -1;
+	int fd = -1, ret = -1, kept = 0;
 	char control[CMSG_SPACE(sizeof(fd))];
 	struct cmsghdr *cmsg;
 	struct stat s;
@@ -304,13 +385,23 @@ handle_open(struct weston_launch *wl, struct msghdr *msg, ssize_t len)
 	/* Ensure path is null-terminated */
 	((char *) message)[len-1] = '\0';
 
-	fd = open(message->path, message->flags);
+	if (wl->restart)
+		fd = take_kept_fd(wl, message->path, message->flags);
+	if (fd >= 0)
+		kept = 1;
+	else
+		fd = open(message->path, message->flags);
 	if (fd < 0) {
 		fprintf(stderr, "Error opening device %s: %m\n",
 			message->path);
 		goto err0;
 	}
 
+	if (kept) {
+		fstat(fd, &s);
+		goto err0;
+	}
+
 	if (fstat(fd, &s) < 0) {
 		close(fd);
 		fd = -1;
@@ -347,8 +438,8 @@ err0:
 	iov.iov_len = sizeof ret;
 
 	if (wl->verbose)
-		fprintf(stderr, "weston-launch: opened %s: ret: %d, fd: %d\n",
-			message->path, ret, fd);
+		fprintf(stderr, "weston-launch: %s %s: ret: %d, fd: %d\n",
+			kept ? "reused" : "opened", message->path, ret, fd);
 	do {
 		len = sendmsg(wl->sock[0], &nmsg, 0);
 	} while (len < 0 && errno == EINTR);
@@ -356,6 +447,9 @@ err0:
 	if (len < 0)
 		return -1;
 
+	if (fd != -1 && !kept)
+		add_kept_fd(wl, fd, &s, message->flags);
+
 	if (fd != -1 && major(s.st_rdev) == DRM_MAJOR)
 		wl->drm_fd = fd;
 	if (fd != -1 && major(s.st_rdev) == INPUT_MAJOR &&
@@ -441,7 +535,7 @@ static void
 close_input_fds(struct weston_launch *wl)
 {
 	struct stat s;
-	int fd;
+	int fd, i;
 
 	for (fd = 3; fd <= wl->last_input_fd; fd++) {
 		if (fstat(fd, &s) == 0 && major(s.st_rdev) == INPUT_MAJOR) {
@@ -451,6 +545,58 @@ close_input_fds(struct weston_launch *wl)
 			close(fd);
 		}
 	}
+
+	for (i = 0; i < wl->num_kept; ) {
+		if (major(wl->kept[i].rdev) == INPUT_MAJOR)
+			remove_kept_fd(wl, i);
+		else
+			i++;
+	}
+}
+
+static void
+launch_compositor(struct weston_launch *wl, int argc, char *argv[]);
+
+/* Starts a new compositor in place of one that crashed, with the tty,
+ * DRM master and devices as the old one left them. */
+static int
+restart_compositor(struct weston_launch *wl)
+{
+	time_t now = time(NULL);
+
+	if (!wl->restart || wl->inactive)
+		return -1;
+
+	if (now - wl->restart_time > RESTART_INTERVAL) {
+		wl->restart_time = now;
+		wl->restarts = 0;
+	}
+	if (wl->restarts++ == RESTART_MAX) {
+		fprintf(stderr, "weston-launch: compositor crashed %d times "
+			"in %d seconds, not restarting it\n",
+			RESTART_MAX, RESTART_INTERVAL);
+		return -1;
+	}
+
+	close(wl->sock[0]);
+	setup_launcher_socket(wl);
+	wl->generation++;
+
+	wl->child = fork();
+	if (wl->child == -1) {
+		error(0, errno, "fork failed");
+		wl->child = 0;
+		return -1;
+	}
+
+	if (wl->child == 0)
+		launch_compositor(wl, wl->argc, wl->argv);
+
+	close(wl->sock[1]);
+	fprintf(stderr, "weston-launch: compositor crashed, "
+		"restarted it with pid %d\n", wl->child);
+
+	return 0;
 }
 
 static int
@@ -481,6 +627,8 @@ handle_signal(struct weston_launch *wl)
 				ret = 10 + WTERMSIG(status);
 			else
 				ret = 0;
+			if (WIFSIGNALED(status) && restart_compositor(wl) == 0)
+				break;
 			quit(wl, ret);
 		}
 		break;
@@ -494,11 +642,13 @@ handle_signal(struct weston_launch *wl)
 		close_input_fds(wl);
 		drmDropMaster(wl->drm_fd);
 		ioctl(wl->tty, VT_RELDISP, 1);
+		wl->inactive = 1;
 		break;
 	case SIGUSR2:
 		ioctl(wl->tty, VT_RELDISP, VT_ACKACQ);
 		drmSetMaster(wl->drm_fd);
 		send_reply(wl, WESTON_LAUNCHER_ACTIVATE);
+		wl->inactive = 0;
 		break;
 	default:
 		return -1;
@@ -663,6 +813,7 @@ help(const char *name)
 	fprintf(stderr, "Usage: %s [args...] [-- [weston args..]]\n", name);
 	fprintf(stderr, "  -u, --user      Start session as specified username\n");
 	fprintf(stderr, "  -t, --tty       Start session on alternative tty\n");
+	fprintf(stderr, "  -r, --restart   Restart weston when it crashes, keeping its devices\n");
 	fprintf(stderr, "  -v, --verbose   Be verbose\n");
 	fprintf(stderr, "  -h, --help      Display this help message\n");
 }
@@ -676,6 +827,7 @@ main(int argc, char *argv[])
 	struct option opts[] = {
 		{ "user",    required_argument, NULL, 'u' },
 		{ "tty",     required_argument, NULL, 't' },
+		{ "restart", no_argument,       NULL, 'r' },
 		{ "verbose", no_argument,       NULL, 'v' },
 		{ "help",    no_argument,       NULL, 'h' },
 		{ 0,         0,                 NULL,  0  }
@@ -683,7 +835,7 @@ main(int argc, char *argv[])
 
 	memset(&wl, 0, sizeof wl);
 
-	while ((c = getopt_long(argc, argv, "u:t::vh", opts, &i)) != -1) {
+	while ((c = getopt_long(argc, argv, "u:t::rvh", opts, &i)) != -1) {
 		switch (c) {
 		case 'u':
 			wl.new_user = optarg;
@@ -693,6 +845,9 @@ main(int argc, char *argv[])
 		case 't':
 			tty = optarg;
 			break;
+		case 'r':
+			wl.restart = 1;
+			break;
 		case 'v':
 			wl.verbose = 1;
 			break;
@@ -739,11 +894,15 @@ main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	wl.argc = argc - optind;
+	wl.argv = argv + optind;
+
 	if (wl.child == 0)
-		launch_compositor(&wl, argc - optind, argv + optind);
+		launch_compositor(&wl, wl.argc, wl.argv);
 
 	close(wl.sock[1]);
-	if (wl.tty != STDIN_FILENO)
+	/* A restarted compositor needs it again */
+	if (wl.tty != STDIN_FILENO && !wl.restart)
 		close(wl.tty);
 
 	while (1) {
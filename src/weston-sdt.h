@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_SDT_H_
+#define _WESTON_SDT_H_
+
+#include "config.h"
+
+/* Static tracepoints in the "weston" provider, for lining up compositor
+ * events with kernel and GPU activity in system wide traces.  Built
+ * with --enable-sdt they become systemtap SDT probes, a single nop each
+ * until a tracer attaches; perf (perf probe sdt_weston:...), bpftrace,
+ * systemtap and LTTng through uprobes all understand them.  Otherwise
+ * they compile to nothing.
+ *
+ * Arguments are integers or pointers; objects are identified by their
+ * address so that events on the same surface or buffer can be joined.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define WESTON_TRACE(name) \
+	DTRACE_PROBE(weston, name)
+#define WESTON_TRACE1(name, a) \
+	DTRACE_PROBE1(weston, name, a)
+#define WESTON_TRACE2(name, a, b) \
+	DTRACE_PROBE2(weston, name, a, b)
+#define WESTON_TRACE3(name, a, b, c) \
+	DTRACE_PROBE3(weston, name, a, b, c)
+#define WESTON_TRACE4(name, a, b, c, d) \
+	DTRACE_PROBE4(weston, name, a, b, c, d)
+
+#else
+
+#define WESTON_TRACE(name) do { } while (0)
+#define WESTON_TRACE1(name, a) do { } while (0)
+#define WESTON_TRACE2(name, a, b) do { } while (0)
+#define WESTON_TRACE3(name, a, b, c) do { } while (0)
+#define WESTON_TRACE4(name, a, b, c, d) do { } while (0)
+
+#endif
+
+#endif
@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <math.h>
 
 #include "compositor.h"
 #include "text-cursor-position-server-protocol.h"
@@ -110,7 +111,10 @@ zoom_area_center_from_pointer(struct weston_output *output,
 	*y -= ((((*y - offset_y) / (float) h) - 0.5) * (h * (1.0 - level)));
 }
 
-static void
+/* Recompute the zoom translation for the current level and pointer
+ * position.  This only updates trans_x/trans_y; the caller decides whether
+ * the output needs to be repainted. */
+WL_EXPORT void
 weston_output_update_zoom_transform(struct weston_output *output)
 {
 	float global_x, global_y;
@@ -153,8 +157,10 @@ weston_output_update_zoom_transform(struct weston_output *output)
 		output->zoom.trans_y = trans_min;
 }
 
+/* The level animation damages the whole output on every step, so it
+ * only needs a repaint to get going. */
 static void
-weston_zoom_transition(struct weston_output *output, wl_fixed_t x, wl_fixed_t y)
+weston_zoom_transition(struct weston_output *output)
 {
 	if (output->zoom.level != output->zoom.spring_z.current) {
 		output->zoom.spring_z.target = output->zoom.level;
@@ -162,11 +168,9 @@ weston_zoom_transition(struct weston_output *output, wl_fixed_t x, wl_fixed_t y)
 			output->zoom.animation_z.frame_counter = 0;
 			wl_list_insert(output->animation_list.prev,
 				&output->zoom.animation_z.link);
+			weston_output_schedule_repaint(output);
 		}
 	}
-
-	output->dirty = 1;
-	weston_output_damage(output);
 }
 
 WL_EXPORT void
@@ -175,6 +179,8 @@ weston_output_update_zoom(struct weston_output *output)
 	struct weston_seat *seat = weston_zoom_pick_seat(output->compositor);
 	wl_fixed_t x = seat->pointer->x;
 	wl_fixed_t y = seat->pointer->y;
+	float trans_x = output->zoom.trans_x;
+	float trans_y = output->zoom.trans_y;
 
 	zoom_area_center_from_pointer(output, &x, &y);
 
@@ -186,8 +192,100 @@ weston_output_update_zoom(struct weston_output *output)
 		output->zoom.to.y = y;
 	}
 
-	weston_zoom_transition(output, x, y);
+	weston_zoom_transition(output);
 	weston_output_update_zoom_transform(output);
+
+	/* Only a pan changes what is on screen; pointer motion while the
+	 * zoom area is pinned against an edge of the output does not. */
+	if (output->zoom.trans_x != trans_x ||
+	    output->zoom.trans_y != trans_y) {
+		output->dirty = 1;
+		weston_output_damage(output);
+	}
+}
+
+/* The part of the global coordinate space that is visible on the output
+ * at the current zoom level, as origin and magnification. */
+static void
+zoom_source_origin(struct weston_output *output,
+		   float *x, float *y, float *magnification)
+{
+	float level = output->zoom.spring_z.current;
+
+	*x = output->x + output->width / 2.0f * (level + output->zoom.trans_x);
+	*y = output->y + output->height / 2.0f * (level + output->zoom.trans_y);
+	*magnification = 1.0f / (1.0f - level);
+}
+
+/* Limit damage in global coordinates to what the zoomed output shows. */
+WL_EXPORT void
+weston_output_zoom_clip_damage(struct weston_output *output,
+			       pixman_region32_t *damage)
+{
+	float x, y, mag;
+
+	zoom_source_origin(output, &x, &y, &mag);
+	pixman_region32_intersect_rect(damage, damage,
+				       (int) floorf(x), (int) floorf(y),
+				       (int) ceilf(output->width / mag) + 1,
+				       (int) ceilf(output->height / mag) + 1);
+}
+
+/* Map a region between global coordinates and where it ends up on the
+ * zoomed output, rounding outwards.  Renderers keep their buffer damage
+ * on the output side and draw views on the global side. */
+static void
+zoom_map_region(struct weston_output *output, pixman_region32_t *src,
+		pixman_region32_t *dest, int to_output)
+{
+	pixman_box32_t *rects, *out;
+	float x, y, mag;
+	int i, n;
+
+	zoom_source_origin(output, &x, &y, &mag);
+	rects = pixman_region32_rectangles(src, &n);
+	out = malloc(n * sizeof *out);
+	if (!out) {
+		pixman_region32_copy(dest, &output->region);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (to_output) {
+			out[i].x1 = floorf(output->x + (rects[i].x1 - x) * mag);
+			out[i].y1 = floorf(output->y + (rects[i].y1 - y) * mag);
+			out[i].x2 = ceilf(output->x + (rects[i].x2 - x) * mag);
+			out[i].y2 = ceilf(output->y + (rects[i].y2 - y) * mag);
+		} else {
+			out[i].x1 = floorf(x + (rects[i].x1 - output->x) / mag);
+			out[i].y1 = floorf(y + (rects[i].y1 - output->y) / mag);
+			out[i].x2 = ceilf(x + (rects[i].x2 - output->x) / mag);
+			out[i].y2 = ceilf(y + (rects[i].y2 - output->y) / mag);
+		}
+	}
+
+	pixman_region32_fini(dest);
+	pixman_region32_init_rects(dest, out, n);
+	free(out);
+
+	if (to_output)
+		pixman_region32_intersect(dest, dest, &output->region);
+}
+
+WL_EXPORT void
+weston_output_zoom_region_to_output(struct weston_output *output,
+				    pixman_region32_t *src,
+				    pixman_region32_t *dest)
+{
+	zoom_map_region(output, src, dest, 1);
+}
+
+WL_EXPORT void
+weston_output_zoom_region_from_output(struct weston_output *output,
+				      pixman_region32_t *src,
+				      pixman_region32_t *dest)
+{
+	zoom_map_region(output, src, dest, 0);
 }
 
 static void
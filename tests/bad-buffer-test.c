@@ -43,8 +43,11 @@ create_bad_shm_buffer(struct client *client, int width, int height)
 	struct wl_buffer *buffer;
 	int fd;
 
-	fd = os_create_anonymous_file(size);
+	/* Not os_create_anonymous_file(), which may seal the file
+	 * against the truncate below */
+	fd = os_create_sealable_file();
 	assert(fd >= 0);
+	assert(ftruncate(fd, size) == 0);
 
 	pool = wl_shm_create_pool(shm, fd, size);
 	buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride,
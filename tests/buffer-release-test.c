@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "weston-test-client-helper.h"
+
+#define FRAMES 10
+
+/* Alternating between two buffers, each one must be released by the
+ * time the other one is committed after a frame: a client needs no more
+ * than double buffering when it paces itself with frame callbacks. */
+TEST(buffer_release_double_buffered)
+{
+	struct client *client;
+	struct wl_surface *surface;
+	struct wl_buffer *buffers[2];
+	struct buffer_stats stats;
+	void *pixels;
+	int i, done;
+
+	client = client_create(100, 100, 64, 64);
+	surface = client->surface->wl_surface;
+
+	for (i = 0; i < 2; i++) {
+		buffers[i] = create_shm_buffer(client, 64, 64, &pixels);
+		memset(pixels, 0x40 * (i + 1), 64 * 64 * 4);
+	}
+
+	get_buffer_stats(client, &stats);
+
+	for (i = 0; i < FRAMES; i++) {
+		wl_surface_attach(surface, buffers[i % 2], 0, 0);
+		wl_surface_damage(surface, 0, 0, 64, 64);
+		frame_callback_set(surface, &done);
+		wl_surface_commit(surface);
+		frame_callback_wait(client, &done);
+	}
+
+	get_buffer_stats(client, &stats);
+
+	fprintf(stderr, "released %u, unused %u, attach to use %u us, "
+		"use to release %u us, after repaints %u %u %u %u\n",
+		stats.released, stats.unused,
+		stats.attach_to_use_avg_usec, stats.use_to_release_avg_usec,
+		stats.release_repaints[0], stats.release_repaints[1],
+		stats.release_repaints[2], stats.release_repaints[3]);
+
+	/* The client_create() buffer and all but the last of ours */
+	assert(stats.released == FRAMES);
+	assert(stats.unused == 0);
+	assert(stats.release_repaints[2] == 0);
+	assert(stats.release_repaints[3] == 0);
+}
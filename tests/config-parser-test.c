@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
@@ -96,6 +97,36 @@ static const char t4[] =
 	"[bambam]\n"
 	"=not valid at all\n";
 
+static const char t5[] =
+	"# repeated keys and sections...\n"
+	"[jar]\n"
+	"\n"
+	"[jar]\n"
+	"lid=tin\n"
+	"lid=glass\n"
+	"\n"
+	"[jar]\n"
+	"lid=glass\n"
+	"contents=pickles\n";
+
+/* Many sections of the same name, like the ivi-launcher and output
+ * sections of a generated config */
+static char *
+make_large_config(int count)
+{
+	char *text, *p;
+	int i;
+
+	text = malloc(count * 64);
+	assert(text);
+
+	for (i = 0, p = text; i < count; i++)
+		p += sprintf(p, "[launcher]\nid=%d\npath=/bin/app-%d\n",
+			     i, i);
+
+	return text;
+}
+
 int main(int argc, char *argv[])
 {
 	struct weston_config *config;
@@ -195,6 +226,51 @@ int main(int argc, char *argv[])
 	config = run_test(t4);
 	assert(config == NULL);
 
+	config = run_test(t5);
+	assert(config);
+
+	section = weston_config_get_section(config, "jar", NULL, NULL);
+	r = weston_config_section_get_string(section, "lid", &s, NULL);
+	assert(r == -1 && errno == ENOENT && s == NULL);
+
+	section = weston_config_get_section(config, "jar", "lid", "tin");
+	r = weston_config_section_get_string(section, "lid", &s, NULL);
+	assert(r == 0 && strcmp(s, "tin") == 0);
+	free(s);
+
+	section = weston_config_get_section(config, "jar", "lid", "glass");
+	r = weston_config_section_get_string(section, "contents", &s, NULL);
+	assert(r == 0 && strcmp(s, "pickles") == 0);
+	free(s);
+
+	weston_config_destroy(config);
+
+	s = make_large_config(1000);
+	config = run_test(s);
+	free(s);
+	assert(config);
+
+	for (i = 0; i < 1000; i++) {
+		char id[16], path[32];
+
+		snprintf(id, sizeof id, "%d", i);
+		snprintf(path, sizeof path, "/bin/app-%d", i);
+		section = weston_config_get_section(config, "launcher",
+						    "id", id);
+		r = weston_config_section_get_string(section, "path", &s, NULL);
+		assert(r == 0 && strcmp(s, path) == 0);
+		free(s);
+	}
+
+	section = weston_config_get_section(config, "launcher", "id", "1000");
+	assert(section == NULL);
+
+	section = weston_config_get_section(config, "launcher", NULL, NULL);
+	r = weston_config_section_get_int(section, "id", &n, -1);
+	assert(r == 0 && n == 0);
+
+	weston_config_destroy(config);
+
 	weston_config_destroy(NULL);
 	assert(weston_config_next_section(NULL, NULL, NULL) == 0);
 
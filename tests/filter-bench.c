@@ -0,0 +1,233 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../src/filter.h"
+
+/* Replays a 1000 Hz relative motion trace through the pointer
+ * acceleration filter and reports the per event cost.  A recorded trace
+ * can be given as a file of "time dx dy" lines, time in milliseconds;
+ * without one a synthetic trace of flicks, slow drags and circles is
+ * generated. */
+
+#define PASSES 50
+
+struct motion_sample {
+	uint32_t time;
+	double dx, dy;
+};
+
+struct trace {
+	struct motion_sample *samples;
+	int count;
+	int size;
+};
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static void
+trace_add(struct trace *trace, uint32_t time, double dx, double dy)
+{
+	struct motion_sample *s;
+
+	if (trace->count == trace->size) {
+		trace->size = trace->size ? trace->size * 2 : 1024;
+		trace->samples = realloc(trace->samples,
+					 trace->size * sizeof *s);
+		if (!trace->samples)
+			abort();
+	}
+
+	s = &trace->samples[trace->count++];
+	s->time = time;
+	s->dx = dx;
+	s->dy = dy;
+}
+
+static int
+trace_load(struct trace *trace, const char *filename)
+{
+	FILE *fp;
+	unsigned int time;
+	double dx, dy;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		perror(filename);
+		return -1;
+	}
+
+	while (fscanf(fp, "%u %lf %lf", &time, &dx, &dy) == 3)
+		trace_add(trace, time, dx, dy);
+
+	fclose(fp);
+
+	return trace->count > 0 ? 0 : -1;
+}
+
+static void
+trace_generate(struct trace *trace)
+{
+	uint32_t time = 0;
+	double x = 0.0, y = 0.0, nx, ny, a;
+	int i, j;
+
+	srandom(13);
+
+	for (i = 0; i < 200; i++) {
+		/* A flick: accelerate and decelerate over 120 ms. */
+		a = (random() % 360) * M_PI / 180.0;
+		for (j = 0; j < 120; j++, time++)
+			trace_add(trace, time,
+				  cos(a) * 12.0 * sin(j * M_PI / 120),
+				  sin(a) * 12.0 * sin(j * M_PI / 120));
+
+		/* A slow, slightly jittery drag. */
+		for (j = 0; j < 300; j++, time++)
+			trace_add(trace, time,
+				  (random() % 3) - 1 + 0.3,
+				  (random() % 3) - 1);
+
+		/* A circle with 400 units radius over one second. */
+		x = 400.0;
+		y = 0.0;
+		for (j = 1; j <= 1000; j++, time++) {
+			nx = 400.0 * cos(j * 2 * M_PI / 1000);
+			ny = 400.0 * sin(j * 2 * M_PI / 1000);
+			trace_add(trace, time, nx - x, ny - y);
+			x = nx;
+			y = ny;
+		}
+
+		/* Idle long enough for the trackers to time out. */
+		time += 500;
+	}
+}
+
+static double
+linear_profile(struct weston_motion_filter *filter,
+	       void *data, double velocity, uint32_t time)
+{
+	double factor = velocity * 0.5;
+
+	if (factor > 1.0)
+		factor = 1.0;
+	else if (factor < 0.16)
+		factor = 0.16;
+
+	return factor;
+}
+
+static double
+table_profile(struct weston_motion_filter *filter,
+	      void *data, double velocity, uint32_t time)
+{
+	return accel_profile_table_lookup(data, velocity);
+}
+
+static void
+run(const char *name, const struct trace *trace,
+    accel_profile_func_t profile, void *data)
+{
+	struct weston_motion_filter *filter;
+	struct weston_motion_params motion;
+	double elapsed, distance = 0.0;
+	uint32_t base;
+	int i, pass;
+
+	filter = create_pointer_accelator_filter(profile);
+	if (!filter)
+		abort();
+
+	reset_timer();
+	for (pass = 0; pass < PASSES; pass++) {
+		/* Keep time monotonic across passes. */
+		base = pass * (trace->samples[trace->count - 1].time + 1000);
+		for (i = 0; i < trace->count; i++) {
+			motion.dx = trace->samples[i].dx;
+			motion.dy = trace->samples[i].dy;
+			weston_filter_dispatch(filter, &motion, data,
+					       base + trace->samples[i].time);
+			distance += fabs(motion.dx) + fabs(motion.dy);
+		}
+	}
+	elapsed = read_timer();
+
+	filter->interface->destroy(filter);
+
+	printf("%-8s %d events, %.1f ns/event, output distance %.0f\n",
+	       name, trace->count * PASSES,
+	       elapsed * 1e9 / (trace->count * PASSES),
+	       distance / PASSES);
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace trace;
+	struct accel_profile_table *table;
+
+	memset(&trace, 0, sizeof trace);
+
+	if (argc > 1) {
+		if (trace_load(&trace, argv[1]) < 0) {
+			fprintf(stderr, "no motion in %s\n", argv[1]);
+			return 1;
+		}
+	} else {
+		trace_generate(&trace);
+	}
+
+	table = accel_profile_table_create("0.0:0.16 0.3:0.16 2.0:1.0");
+	if (!table)
+		return 1;
+
+	run("linear", &trace, linear_profile, NULL);
+	run("table", &trace, table_profile, table);
+
+	accel_profile_table_destroy(table);
+	free(trace.samples);
+
+	return 0;
+}
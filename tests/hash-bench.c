@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../xwayland/hash.h"
+
+/* Replays the X window id churn of a long session through the
+ * xwayland window hash: windows come and go in bursts, ids are
+ * allocated from per-client ranges and never reused, and every event
+ * looks a window up, mostly ones that exist.  Reports the cost per
+ * operation for a small and a large number of live windows. */
+
+#define CLIENTS		32
+#define CLIENT_ID_SHIFT	21
+#define OPERATIONS	(2 * 1000 * 1000)
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static void
+count_func(void *element, void *data)
+{
+	(*(int *) data)++;
+}
+
+static void
+run(int live)
+{
+	struct hash_table *ht;
+	uint32_t *ids, next[CLIENTS], id;
+	double elapsed;
+	int i, j, count, found = 0, lookups = 0, churn = 0;
+
+	ht = hash_table_create();
+	ids = calloc(live, sizeof *ids);
+	if (!ht || !ids)
+		abort();
+
+	srandom(13);
+	for (i = 0; i < CLIENTS; i++)
+		next[i] = (i + 1) << CLIENT_ID_SHIFT;
+
+	for (i = 0; i < live; i++) {
+		ids[i] = next[i % CLIENTS]++;
+		hash_table_insert(ht, ids[i], &ids[i]);
+	}
+
+	reset_timer();
+	for (i = 0; i < OPERATIONS; i++) {
+		if (random() % 16 == 0) {
+			/* A burst of windows replaced, like a dialog or
+			 * a tooltip storm. */
+			for (j = 0; j < 8; j++) {
+				int k = random() % live;
+
+				hash_table_remove(ht, ids[k]);
+				ids[k] = next[random() % CLIENTS]++;
+				hash_table_insert(ht, ids[k], &ids[k]);
+				churn++;
+			}
+		} else {
+			/* Events for live windows and, now and then, for
+			 * one that's already gone. */
+			if (random() % 8 == 0)
+				id = (random() % CLIENTS + 1) <<
+					CLIENT_ID_SHIFT;
+			else
+				id = ids[random() % live];
+
+			if (hash_table_lookup(ht, id))
+				found++;
+			lookups++;
+		}
+	}
+	elapsed = read_timer();
+
+	count = 0;
+	reset_timer();
+	for (i = 0; i < 1000; i++)
+		hash_table_for_each(ht, count_func, &count);
+
+	printf("%6d live: %.1f ns/op (%d lookups, %d found, %d replaced), "
+	       "for_each %.1f us\n",
+	       live, elapsed * 1e9 / OPERATIONS, lookups, found, churn,
+	       read_timer() * 1e6 / 1000);
+
+	if (count != live * 1000)
+		fprintf(stderr, "for_each saw %d entries, expected %d\n",
+			count / 1000, live);
+
+	hash_table_destroy(ht);
+	free(ids);
+}
+
+int main(int argc, char *argv[])
+{
+	run(16);
+	run(256);
+	run(4096);
+
+	return 0;
+}
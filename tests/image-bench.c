@@ -0,0 +1,246 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../shared/pixel-convert.h"
+
+/* Runs the image loader pixel conversions over a 1920x1080 frame and
+ * compares them against the original scalar loops, both for speed and
+ * for identical output.  The premultiply input covers every alpha and
+ * color combination. */
+
+#define WIDTH	1920
+#define HEIGHT	1080
+#define PASSES	50
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static inline int
+multiply_alpha(int alpha, int color)
+{
+	int temp = (alpha * color) + 0x80;
+
+	return ((temp + (temp >> 8)) >> 8);
+}
+
+static void
+reference_premultiply(uint8_t *data, size_t len)
+{
+	uint8_t *p;
+	size_t i;
+
+	for (i = 0, p = data; i < len; i += 4, p += 4) {
+		uint8_t alpha = p[3];
+		uint32_t w;
+
+		if (alpha == 0) {
+			w = 0;
+		} else {
+			uint8_t red   = p[0];
+			uint8_t green = p[1];
+			uint8_t blue  = p[2];
+
+			if (alpha != 0xff) {
+				red   = multiply_alpha(alpha, red);
+				green = multiply_alpha(alpha, green);
+				blue  = multiply_alpha(alpha, blue);
+			}
+			w = (alpha << 24) | (red << 16) | (green << 8) | blue;
+		}
+
+		*(uint32_t *) p = w;
+	}
+}
+
+static void
+reference_expand(uint8_t *row, unsigned int width)
+{
+	uint8_t *s;
+	uint32_t *d;
+
+	s = row + (width - 1) * 3;
+	d = (uint32_t *) (row + (width - 1) * 4);
+	while (s >= row) {
+		*d = 0xff000000 | (s[0] << 16) | (s[1] << 8) | (s[2] << 0);
+		s -= 3;
+		d--;
+	}
+}
+
+static void
+fill_rgba(uint8_t *data, size_t len)
+{
+	size_t i;
+
+	/* Alpha and color walk through all 65536 pairs, with the other
+	 * two channels offset so they see different combinations. */
+	for (i = 0; i < len; i += 4) {
+		data[i + 0] = i / 4;
+		data[i + 1] = i / 4 + 85;
+		data[i + 2] = i / 4 + 170;
+		data[i + 3] = i / 1024;
+	}
+}
+
+static void
+fill_rgb(uint8_t *row, unsigned int width)
+{
+	unsigned int i;
+
+	for (i = 0; i < width * 3; i++)
+		row[i] = i * 7 + 3;
+}
+
+static int
+bench_premultiply(void)
+{
+	size_t len = WIDTH * HEIGHT * 4;
+	uint8_t *src, *a, *b;
+	double reference, vector;
+	int i, failed;
+
+	src = malloc(len);
+	a = malloc(len);
+	b = malloc(len);
+	if (!src || !a || !b)
+		abort();
+
+	fill_rgba(src, len);
+
+	reference = 0;
+	vector = 0;
+	for (i = 0; i < PASSES; i++) {
+		memcpy(a, src, len);
+		reset_timer();
+		reference_premultiply(a, len);
+		reference += read_timer();
+
+		memcpy(b, src, len);
+		reset_timer();
+		pixel_premultiply_rgba(b, len);
+		vector += read_timer();
+	}
+
+	/* Odd lengths leave a tail for the scalar loop. */
+	memcpy(a, src, len);
+	memcpy(b, src, len);
+	reference_premultiply(a, len - 4 * 7);
+	pixel_premultiply_rgba(b, len - 4 * 7);
+
+	failed = memcmp(a, b, len) != 0;
+	printf("premultiply: %.2f ms reference, %.2f ms converted%s\n",
+	       reference * 1e3 / PASSES, vector * 1e3 / PASSES,
+	       failed ? ", OUTPUT DIFFERS" : "");
+
+	free(src);
+	free(a);
+	free(b);
+
+	return failed;
+}
+
+static int
+bench_expand(void)
+{
+	size_t len = WIDTH * HEIGHT * 4;
+	uint8_t *a, *b;
+	double reference, vector;
+	unsigned int width;
+	int i, y, failed = 0;
+
+	a = malloc(len);
+	b = malloc(len);
+	if (!a || !b)
+		abort();
+
+	reference = 0;
+	vector = 0;
+	for (i = 0; i < PASSES; i++) {
+		for (y = 0; y < HEIGHT; y++)
+			fill_rgb(a + y * WIDTH * 4, WIDTH);
+		reset_timer();
+		for (y = 0; y < HEIGHT; y++)
+			reference_expand(a + y * WIDTH * 4, WIDTH);
+		reference += read_timer();
+
+		for (y = 0; y < HEIGHT; y++)
+			fill_rgb(b + y * WIDTH * 4, WIDTH);
+		reset_timer();
+		for (y = 0; y < HEIGHT; y++)
+			pixel_expand_rgb(b + y * WIDTH * 4, WIDTH);
+		vector += read_timer();
+	}
+
+	failed = memcmp(a, b, len) != 0;
+
+	/* Every short width, to cover the head left to the scalar loop. */
+	for (width = 1; width < 40; width++) {
+		fill_rgb(a, width);
+		fill_rgb(b, width);
+		reference_expand(a, width);
+		pixel_expand_rgb(b, width);
+		if (memcmp(a, b, width * 4) != 0)
+			failed = 1;
+	}
+
+	printf("expand rgb:  %.2f ms reference, %.2f ms converted%s\n",
+	       reference * 1e3 / PASSES, vector * 1e3 / PASSES,
+	       failed ? ", OUTPUT DIFFERS" : "");
+
+	free(a);
+	free(b);
+
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	int failed = 0;
+
+	failed |= bench_premultiply();
+	failed |= bench_expand();
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
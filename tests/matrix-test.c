@@ -54,6 +54,13 @@ read_timer(void)
 	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
 }
 
+enum {
+	TEST_OK,
+	TEST_NOT_INVERTIBLE_OK,
+	TEST_FAIL,
+	TEST_COUNT
+};
+
 static double
 det3x3(const float *c0, const float *c1, const float *c2)
 {
@@ -179,6 +186,82 @@ randomize_matrix(struct weston_matrix *m)
 #else
 		m->d[i] = frand();
 #endif
+	m->type = WESTON_MATRIX_TRANSFORM_OTHER;
+}
+
+/* A view-like transform: translations, scales and xy rotations */
+static void
+randomize_affine_matrix(struct weston_matrix *m)
+{
+	double angle;
+	unsigned i;
+
+	weston_matrix_init(m);
+	for (i = 0; i < 3; ++i) {
+		angle = frand() * M_PI;
+		weston_matrix_translate(m, 1000 * frand(), 1000 * frand(),
+					frand());
+		weston_matrix_scale(m, 0.5 + 2 * fabs(frand()),
+				    0.5 + 2 * fabs(frand()), 1);
+		weston_matrix_rotate_xy(m, cos(angle), sin(angle));
+	}
+}
+
+static double
+matrix_error(const struct weston_matrix *a, const struct weston_matrix *b)
+{
+	double err, errsup = 0.0;
+	unsigned i;
+
+	for (i = 0; i < 16; ++i) {
+		err = fabs(a->d[i] - b->d[i]) / (1.0 + fabs(b->d[i]));
+		if (err > errsup)
+			errsup = err;
+	}
+
+	return errsup;
+}
+
+/* Runs an affine matrix through the affine shortcuts and, marked as a
+ * general matrix, through the full 4x4 code, and compares. */
+static int
+test_affine(void)
+{
+	struct weston_matrix m, n, general, inverse, general_inverse;
+	struct weston_vector v, w;
+	double errsup;
+	unsigned i;
+
+	randomize_affine_matrix(&m);
+	randomize_affine_matrix(&n);
+
+	general = m;
+	general.type = WESTON_MATRIX_TRANSFORM_OTHER;
+	weston_matrix_multiply(&m, &n);
+	weston_matrix_multiply(&general, &n);
+	errsup = matrix_error(&m, &general);
+
+	general = m;
+	general.type = WESTON_MATRIX_TRANSFORM_OTHER;
+	if (weston_matrix_invert(&inverse, &m) < 0 ||
+	    weston_matrix_invert(&general_inverse, &general) < 0)
+		return TEST_FAIL;
+	errsup = fmax(errsup, matrix_error(&inverse, &general_inverse));
+
+	for (i = 0; i < 4; ++i)
+		v.f[i] = w.f[i] = 1000 * frand();
+	weston_matrix_transform(&m, &v);
+	weston_matrix_transform(&general, &w);
+	for (i = 0; i < 4; ++i)
+		errsup = fmax(errsup,
+			      fabs(v.f[i] - w.f[i]) / (1.0 + fabs(w.f[i])));
+
+	if (errsup < 1e-5)
+		return TEST_OK;
+
+	printf("affine test fail, error sup: %g\n", errsup);
+
+	return TEST_FAIL;
 }
 
 /* Take a matrix, compute inverse, multiply together
@@ -212,12 +295,6 @@ test_inverse(struct weston_matrix *m)
 	return errsup;
 }
 
-enum {
-	TEST_OK,
-	TEST_NOT_INVERTIBLE_OK,
-	TEST_FAIL,
-	TEST_COUNT
-};
 
 static int
 test(void)
@@ -267,17 +344,35 @@ test_loop_precision(void)
 	       counts[TEST_FAIL]);
 }
 
+static int
+test_loop_affine(void)
+{
+	int counts[TEST_COUNT] = { 0 };
+	int i;
+
+	printf("\nComparing affine shortcuts with the general code...\n");
+	for (i = 0; i < 100000; i++)
+		counts[test_affine()]++;
+
+	printf("tests: %d ok, %d failed.\n",
+	       counts[TEST_OK], counts[TEST_FAIL]);
+
+	return counts[TEST_FAIL];
+}
+
 static void __attribute__((noinline))
-test_loop_speed_matrixvector(void)
+test_loop_speed_matrixvector(unsigned int type)
 {
 	struct weston_matrix m;
 	struct weston_vector v = { { 0.5, 0.5, 0.5, 1.0 } };
 	unsigned long count = 0;
 	double t;
 
-	printf("\nRunning 3 s test on weston_matrix_transform()...\n");
+	printf("\nRunning 3 s test on weston_matrix_transform(), %s...\n",
+	       type ? "general" : "affine");
 
 	weston_matrix_init(&m);
+	m.type = type;
 
 	running = 1;
 	alarm(3);
@@ -345,21 +440,51 @@ test_loop_speed_invert(void)
 }
 
 static void __attribute__((noinline))
-test_loop_speed_invert_explicit(void)
+test_loop_speed_multiply(unsigned int type)
+{
+	struct weston_matrix m, n;
+	unsigned long count = 0;
+	double t;
+
+	printf("\nRunning 3 s test on weston_matrix_multiply(), %s...\n",
+	       type ? "general" : "affine");
+
+	randomize_affine_matrix(&n);
+	n.type = type;
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		weston_matrix_init(&m);
+		weston_matrix_multiply(&m, &n);
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu iterations in %f seconds, avg. %.1f ns/iter.\n",
+	       count, t, 1e9 * t / count);
+}
+
+static void __attribute__((noinline))
+test_loop_speed_invert_explicit(unsigned int type)
 {
 	struct weston_matrix m;
 	unsigned long count = 0;
 	double t;
 
-	printf("\nRunning 3 s test on weston_matrix_invert()...\n");
+	printf("\nRunning 3 s test on weston_matrix_invert(), %s...\n",
+	       type ? "general" : "affine");
 
 	weston_matrix_init(&m);
+	m.type = type;
 
 	running = 1;
 	alarm(3);
 	reset_timer();
 	while (running) {
 		weston_matrix_invert(&m, &m);
+		m.type = type;
 		count++;
 	}
 	t = read_timer();
@@ -373,7 +498,7 @@ int main(void)
 	struct sigaction ding;
 	struct weston_matrix M;
 	struct inverse_matrix Q;
-	int ret;
+	int ret, failed;
 	double errsup;
 	double det;
 
@@ -412,10 +537,15 @@ int main(void)
 	printf("max abs error: %g, original determinant %g\n", errsup, det);
 
 	test_loop_precision();
-	test_loop_speed_matrixvector();
+	failed = test_loop_affine();
+	test_loop_speed_matrixvector(0);
+	test_loop_speed_matrixvector(WESTON_MATRIX_TRANSFORM_OTHER);
+	test_loop_speed_multiply(0);
+	test_loop_speed_multiply(WESTON_MATRIX_TRANSFORM_OTHER);
 	test_loop_speed_inversetransform();
 	test_loop_speed_invert();
-	test_loop_speed_invert_explicit();
+	test_loop_speed_invert_explicit(0);
+	test_loop_speed_invert_explicit(WESTON_MATRIX_TRANSFORM_OTHER);
 
-	return 0;
+	return failed ? 1 : 0;
 }
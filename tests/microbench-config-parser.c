@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "weston-bench-runner.h"
+#include "../shared/config-parser.h"
+
+/* A weston.ini about the size of a busy IVI setup: many launcher and
+ * output sections with a handful of keys each. */
+#define SECTIONS	64
+#define KEYS		8
+
+static void
+write_config(char *file)
+{
+	FILE *fp;
+	int fd, i, j;
+
+	fd = mkstemp(file);
+	fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!fp)
+		abort();
+
+	fprintf(fp, "# generated by microbench\n[core]\nmodules=a.so,b.so\n");
+	for (i = 0; i < SECTIONS; i++) {
+		fprintf(fp, "\n[launcher]\n");
+		for (j = 0; j < KEYS; j++)
+			fprintf(fp, "key%d=value %d of section %d\n", j, j, i);
+		fprintf(fp, "id=%d\n", i);
+	}
+
+	fclose(fp);
+}
+
+BENCH(config_parse)
+{
+	struct weston_config *config;
+	char file[] = "/tmp/weston-microbench-XXXXXX";
+	uint64_t i;
+
+	write_config(file);
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		config = weston_config_parse(file);
+		if (!config)
+			abort();
+		weston_config_destroy(config);
+	}
+	bench_stop_timer(b);
+
+	unlink(file);
+}
+
+BENCH(config_section_lookup)
+{
+	struct weston_config *config;
+	struct weston_config_section *section;
+	char file[] = "/tmp/weston-microbench-XXXXXX";
+	uint64_t i;
+	int id;
+
+	write_config(file);
+	config = weston_config_parse(file);
+	unlink(file);
+	if (!config)
+		abort();
+
+	/* Finds the last section in the file, the worst case for a
+	 * list walk, and reads a key from it. */
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		section = weston_config_get_section(config, "launcher",
+						    "id", "63");
+		weston_config_section_get_int(section, "key7", &id, 0);
+		bench_keep(section);
+	}
+	bench_stop_timer(b);
+
+	weston_config_destroy(config);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "weston-bench-runner.h"
+#include "../src/filter.h"
+
+static double
+table_profile(struct weston_motion_filter *filter,
+	      void *data, double velocity, uint32_t time)
+{
+	return accel_profile_table_lookup(data, velocity);
+}
+
+BENCH(filter_accelerate)
+{
+	struct weston_motion_filter *filter;
+	struct weston_motion_params motion;
+	struct accel_profile_table *table;
+	uint64_t i;
+
+	table = accel_profile_table_create("0.0:0.16 0.3:0.16 2.0:1.0");
+	filter = create_pointer_accelator_filter(table_profile);
+	if (!table || !filter)
+		abort();
+
+	/* 1000 Hz motion that keeps changing speed and direction, so
+	 * the trackers never settle into a single velocity. */
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		motion.dx = (double) (i % 17) - 5.0;
+		motion.dy = (double) (i % 11) - 3.0;
+		weston_filter_dispatch(filter, &motion, table, i);
+		bench_keep(&motion);
+	}
+	bench_stop_timer(b);
+
+	filter->interface->destroy(filter);
+	accel_profile_table_destroy(table);
+}
+
+BENCH(filter_profile_lookup)
+{
+	struct accel_profile_table *table;
+	double factor;
+	uint64_t i;
+
+	table = accel_profile_table_create("0.0:0.1 0.2:0.2 0.4:0.35 "
+					   "0.7:0.5 1.0:0.7 1.5:0.85 "
+					   "2.0:1.0 4.0:1.2");
+	if (!table)
+		abort();
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		factor = accel_profile_table_lookup(table, (i % 500) * 0.01);
+		bench_keep(&factor);
+	}
+	bench_stop_timer(b);
+
+	accel_profile_table_destroy(table);
+}
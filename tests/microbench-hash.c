@@ -0,0 +1,104 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "weston-bench-runner.h"
+#include "../xwayland/hash.h"
+
+/* X window ids as the server hands them out: per-client ranges,
+ * allocated sequentially. */
+#define CLIENT_ID_SHIFT	21
+#define LIVE		1024
+
+static uint32_t
+window_id(uint64_t i)
+{
+	return ((i % 32 + 1) << CLIENT_ID_SHIFT) + i / 32;
+}
+
+static struct hash_table *
+populated_table(void)
+{
+	struct hash_table *ht;
+	uint64_t i;
+
+	ht = hash_table_create();
+	if (!ht)
+		abort();
+
+	for (i = 0; i < LIVE; i++)
+		hash_table_insert(ht, window_id(i), ht);
+
+	return ht;
+}
+
+BENCH(hash_lookup)
+{
+	struct hash_table *ht = populated_table();
+	void *data;
+	uint64_t i;
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		data = hash_table_lookup(ht, window_id(i % LIVE));
+		bench_keep(data);
+	}
+	bench_stop_timer(b);
+
+	hash_table_destroy(ht);
+}
+
+BENCH(hash_lookup_miss)
+{
+	struct hash_table *ht = populated_table();
+	void *data;
+	uint64_t i;
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		data = hash_table_lookup(ht, window_id(LIVE + i % LIVE));
+		bench_keep(data);
+	}
+	bench_stop_timer(b);
+
+	hash_table_destroy(ht);
+}
+
+BENCH(hash_replace)
+{
+	struct hash_table *ht = populated_table();
+	uint64_t i;
+
+	/* Each iteration destroys the oldest window and creates a new
+	 * one, so the live set stays at LIVE entries. */
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		hash_table_remove(ht, window_id(i));
+		hash_table_insert(ht, window_id(i + LIVE), ht);
+	}
+	bench_stop_timer(b);
+
+	hash_table_destroy(ht);
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-bench-runner.h"
+#include "../shared/image-loader.h"
+#include "../shared/pixel-convert.h"
+
+#define IMAGE_SIZE	256
+
+static const char background[] = BENCH_DATA_DIR "/background.png";
+
+BENCH(image_load_png)
+{
+	pixman_image_t *image;
+	uint64_t i;
+
+	for (i = 0; i < b->iterations; i++) {
+		image = load_image(background);
+		if (!image)
+			abort();
+		pixman_image_unref(image);
+	}
+}
+
+BENCH(image_load_png_scaled)
+{
+	pixman_image_t *image;
+	uint64_t i;
+
+	/* Scaling on load, as the desktop shell does for a background
+	 * on a smaller output. */
+	for (i = 0; i < b->iterations; i++) {
+		image = load_image_scaled(background, 320, 200, 0);
+		if (!image)
+			abort();
+		pixman_image_unref(image);
+	}
+}
+
+BENCH(image_premultiply_rgba)
+{
+	uint8_t *data, *pixels;
+	size_t len = IMAGE_SIZE * IMAGE_SIZE * 4, j;
+	uint64_t i;
+
+	/* Premultiplying in place destroys the input, so each iteration
+	 * converts a fresh copy; the copy is timed as well but is small
+	 * next to the conversion. */
+	data = malloc(len);
+	pixels = malloc(len);
+	if (!data || !pixels)
+		abort();
+	for (j = 0; j < len; j++)
+		data[j] = j * 7 + j / 1024;
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		memcpy(pixels, data, len);
+		pixel_premultiply_rgba(pixels, len);
+		bench_keep(pixels);
+	}
+	bench_stop_timer(b);
+
+	free(pixels);
+	free(data);
+}
+
+BENCH(image_expand_rgb)
+{
+	uint8_t *row;
+	uint64_t i;
+
+	row = calloc(IMAGE_SIZE, 4);
+	if (!row)
+		abort();
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		pixel_expand_rgb(row, IMAGE_SIZE);
+		bench_keep(row);
+	}
+	bench_stop_timer(b);
+
+	free(row);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <math.h>
+
+#include "weston-bench-runner.h"
+#include "../shared/matrix.h"
+
+static void
+rotation(struct weston_matrix *m, float angle)
+{
+	weston_matrix_init(m);
+	weston_matrix_rotate_xy(m, cosf(angle), sinf(angle));
+}
+
+BENCH(matrix_multiply)
+{
+	struct weston_matrix m, n;
+	uint64_t i;
+
+	/* Repeated rotation stays orthonormal, so the values neither
+	 * blow up nor go denormal over many iterations. */
+	rotation(&m, 0.3f);
+	rotation(&n, 0.01f);
+	weston_matrix_translate(&n, 0.0f, 0.0f, 0.0f);
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		weston_matrix_multiply(&m, &n);
+		bench_keep(&m);
+	}
+}
+
+BENCH(matrix_transform)
+{
+	struct weston_matrix m;
+	struct weston_vector v = { { 100.0f, 50.0f, 0.0f, 1.0f } };
+	uint64_t i;
+
+	rotation(&m, 0.01f);
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		weston_matrix_transform(&m, &v);
+		bench_keep(&v);
+	}
+}
+
+BENCH(matrix_invert_affine)
+{
+	struct weston_matrix m, inverse;
+	uint64_t i;
+
+	rotation(&m, 0.7f);
+	weston_matrix_scale(&m, 1.5f, 0.75f, 1.0f);
+	weston_matrix_translate(&m, 120.0f, -40.0f, 0.0f);
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		weston_matrix_invert(&inverse, &m);
+		bench_keep(&inverse);
+	}
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <math.h>
+
+#include "weston-bench-runner.h"
+#include "../src/vertex-clipping.h"
+
+static void
+square(struct polygon8 *p, float cx, float cy, float r, float angle)
+{
+	int i;
+
+	p->n = 4;
+	for (i = 0; i < 4; i++) {
+		p->x[i] = cx + r * cosf(angle + i * M_PI / 2);
+		p->y[i] = cy + r * sinf(angle + i * M_PI / 2);
+	}
+}
+
+static void
+set_clip(struct clip_context *ctx)
+{
+	ctx->clip.x1 = 0.0f;
+	ctx->clip.y1 = 0.0f;
+	ctx->clip.x2 = 100.0f;
+	ctx->clip.y2 = 100.0f;
+}
+
+BENCH(clip_simple_axis_aligned)
+{
+	struct clip_context ctx;
+	struct polygon8 surf;
+	float ex[8], ey[8];
+	uint64_t i;
+
+	/* Straddles the right and bottom edges of the clip box. */
+	square(&surf, 90.0f, 90.0f, 30.0f, M_PI / 4);
+	set_clip(&ctx);
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		clip_simple(&ctx, &surf, ex, ey);
+		bench_keep(ex);
+	}
+}
+
+BENCH(clip_transformed_rotated)
+{
+	struct clip_context ctx;
+	struct polygon8 surf;
+	float ex[8], ey[8];
+	uint64_t i;
+
+	/* A rotated square cut by all four edges: the octagon case. */
+	square(&surf, 50.0f, 50.0f, 60.0f, 0.3f);
+	set_clip(&ctx);
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		clip_transformed(&ctx, &surf, ex, ey);
+		bench_keep(ex);
+	}
+}
+
+BENCH(clip_boxes_16)
+{
+	struct clip_box boxes[16];
+	struct polygon8 surf, out[16];
+	uint64_t i;
+	int j;
+
+	/* A damage region of a 4x4 grid of boxes against a rotated
+	 * surface, like a repaint of a transformed view. */
+	for (j = 0; j < 16; j++) {
+		boxes[j].x1 = (j % 4) * 32.0f;
+		boxes[j].y1 = (j / 4) * 32.0f;
+		boxes[j].x2 = boxes[j].x1 + 24.0f;
+		boxes[j].y2 = boxes[j].y1 + 24.0f;
+	}
+	square(&surf, 64.0f, 64.0f, 70.0f, 0.3f);
+
+	bench_reset_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		clip_boxes(&surf, boxes, 16, out);
+		bench_keep(out);
+	}
+}
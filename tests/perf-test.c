@@ -0,0 +1,384 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Performance scenarios, run by "make check-perf" rather than "make check".
+ *
+ * Every scenario prints "perf: <scenario>.<metric> <value>" lines. With
+ * WESTON_PERF_RECORD set they are also appended to that file, which can
+ * then be used as WESTON_PERF_BASELINE for later runs: a metric that is
+ * more than WESTON_PERF_TOLERANCE percent (default 25) above its baseline
+ * value fails the scenario. All metrics are lower-is-better.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "weston-test-client-helper.h"
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+#define MOVE_SURFACES		32
+#define MOVE_FRAMES		120
+#define STORM_SUBSURFACES	16
+#define STORM_COMMITS		8
+#define STORM_FRAMES		60
+#define POINTER_MOTIONS		500
+#define REORDER_SUBSURFACES	8
+#define REORDER_FRAMES		120
+
+static int regressions;
+
+static uint32_t
+now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+compare_uint32(const void *a, const void *b)
+{
+	const uint32_t *ua = a, *ub = b;
+
+	return *ua < *ub ? -1 : *ua > *ub;
+}
+
+static int
+baseline_lookup(const char *name, double *value)
+{
+	const char *path = getenv("WESTON_PERF_BASELINE");
+	char line[256], key[128];
+	double v;
+	FILE *fp;
+	int found = 0;
+
+	if (!path)
+		return 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "perf: cannot open baseline %s: %m\n", path);
+		return 0;
+	}
+
+	while (!found && fgets(line, sizeof line, fp)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%127s %lf", key, &v) == 2 &&
+		    strcmp(key, name) == 0) {
+			*value = v;
+			found = 1;
+		}
+	}
+
+	fclose(fp);
+
+	return found;
+}
+
+/* Report one metric, record it and check it against the baseline. The
+ * slack is added to the allowed value so that metrics which sit near
+ * zero, such as heap growth, do not trip on noise. */
+static void
+perf_report(const char *scenario, const char *metric,
+	    double value, double slack)
+{
+	const char *record = getenv("WESTON_PERF_RECORD");
+	const char *tolerance = getenv("WESTON_PERF_TOLERANCE");
+	char name[128];
+	double base, limit;
+	FILE *fp;
+
+	snprintf(name, sizeof name, "%s.%s", scenario, metric);
+	printf("perf: %s %.1f\n", name, value);
+
+	if (record) {
+		fp = fopen(record, "a");
+		assert(fp && "cannot open WESTON_PERF_RECORD");
+		fprintf(fp, "%s %.1f\n", name, value);
+		fclose(fp);
+	}
+
+	if (!baseline_lookup(name, &base))
+		return;
+
+	limit = base * (1.0 + (tolerance ? atof(tolerance) : 25.0) / 100.0);
+	limit += slack;
+	if (value > limit) {
+		printf("perf: REGRESSION %s %.1f, baseline %.1f, limit %.1f\n",
+		       name, value, base, limit);
+		regressions++;
+	}
+}
+
+static void
+report_repaints(const char *scenario, const struct repaint_stats *begin,
+		const struct repaint_stats *end)
+{
+	double avg = 0;
+
+	if (end->repaints)
+		avg = (double) end->total_usec / end->repaints;
+
+	perf_report(scenario, "repaint_avg_us", avg, 50);
+	perf_report(scenario, "repaint_max_us", end->max_usec, 500);
+	perf_report(scenario, "heap_growth_kb",
+		    ((double) end->heap_bytes - begin->heap_bytes) / 1024, 256);
+}
+
+static void
+report_latencies(const char *scenario, const char *metric,
+		 uint32_t *samples, int count)
+{
+	char name[64];
+
+	qsort(samples, count, sizeof samples[0], compare_uint32);
+
+	snprintf(name, sizeof name, "%s_median_us", metric);
+	perf_report(scenario, name, samples[count / 2], 20);
+	snprintf(name, sizeof name, "%s_p99_us", metric);
+	perf_report(scenario, name, samples[count * 99 / 100], 200);
+}
+
+static void
+perf_finish(void)
+{
+	assert(regressions == 0 && "performance regression against baseline");
+}
+
+static struct wl_buffer *
+create_filled_buffer(struct client *client, int width, int height,
+		     uint8_t value)
+{
+	struct wl_buffer *buffer;
+	void *pixels;
+
+	buffer = create_shm_buffer(client, width, height, &pixels);
+	memset(pixels, value, width * height * 4);
+
+	return buffer;
+}
+
+static struct wl_subcompositor *
+get_subcompositor(struct client *client)
+{
+	struct global *g;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, "wl_subcompositor") == 0)
+			return wl_registry_bind(client->wl_registry, g->name,
+						&wl_subcompositor_interface,
+						1);
+	}
+
+	assert(0 && "no wl_subcompositor found");
+	return NULL;
+}
+
+static void
+commit_frame(struct client *client, struct wl_surface *surface)
+{
+	int done;
+
+	frame_callback_set(surface, &done);
+	wl_surface_commit(surface);
+	frame_callback_wait(client, &done);
+}
+
+TEST(perf_surfaces_move)
+{
+	struct client *client;
+	struct wl_surface *surfaces[MOVE_SURFACES];
+	struct wl_buffer *buffer;
+	struct repaint_stats begin, end;
+	int i, f, x, y;
+
+	client = client_create(0, 0, 64, 64);
+	buffer = create_filled_buffer(client, 64, 64, 0x80);
+
+	for (i = 0; i < MOVE_SURFACES; i++)
+		surfaces[i] =
+			wl_compositor_create_surface(client->wl_compositor);
+
+	get_repaint_stats(client, &begin);
+
+	for (f = 0; f < MOVE_FRAMES; f++) {
+		for (i = 0; i < MOVE_SURFACES; i++) {
+			x = (i * 97 + f * 5) % (client->output->width - 64);
+			y = (i * 53 + f * 3) % (client->output->height - 64);
+
+			/* As in move_client(), the attach is needed for
+			 * the new position to be configured. */
+			wl_test_move_surface(client->test->wl_test,
+					     surfaces[i], x, y);
+			wl_surface_attach(surfaces[i], buffer, 0, 0);
+			wl_surface_damage(surfaces[i], 0, 0, 64, 64);
+			if (i < MOVE_SURFACES - 1)
+				wl_surface_commit(surfaces[i]);
+		}
+		commit_frame(client, surfaces[MOVE_SURFACES - 1]);
+	}
+
+	get_repaint_stats(client, &end);
+	report_repaints("surfaces_move", &begin, &end);
+	perf_finish();
+}
+
+TEST(perf_subsurface_storm)
+{
+	struct client *client;
+	struct wl_subcompositor *subco;
+	struct wl_surface *parent, *child[STORM_SUBSURFACES];
+	struct wl_subsurface *sub[STORM_SUBSURFACES];
+	struct wl_buffer *buffer;
+	struct repaint_stats begin, end;
+	uint32_t roundtrips[STORM_FRAMES], start;
+	int i, c, f;
+
+	client = client_create(100, 100, 256, 256);
+	parent = client->surface->wl_surface;
+	subco = get_subcompositor(client);
+	buffer = create_filled_buffer(client, 32, 32, 0xc0);
+
+	for (i = 0; i < STORM_SUBSURFACES; i++) {
+		child[i] = wl_compositor_create_surface(client->wl_compositor);
+		sub[i] = wl_subcompositor_get_subsurface(subco, child[i],
+							 parent);
+		wl_subsurface_set_position(sub[i], (i % 4) * 64, (i / 4) * 64);
+		wl_subsurface_set_desync(sub[i]);
+		wl_surface_attach(child[i], buffer, 0, 0);
+		wl_surface_commit(child[i]);
+	}
+	commit_frame(client, parent);
+
+	get_repaint_stats(client, &begin);
+
+	for (f = 0; f < STORM_FRAMES; f++) {
+		start = now_usec();
+		for (c = 0; c < STORM_COMMITS; c++) {
+			for (i = 0; i < STORM_SUBSURFACES; i++) {
+				wl_surface_damage(child[i], 0, 0, 32, 32);
+				wl_surface_commit(child[i]);
+			}
+		}
+		client_roundtrip(client);
+		roundtrips[f] = now_usec() - start;
+
+		commit_frame(client, parent);
+	}
+
+	get_repaint_stats(client, &end);
+	report_repaints("subsurface_storm", &begin, &end);
+	report_latencies("subsurface_storm", "storm",
+			 roundtrips, ARRAY_LENGTH(roundtrips));
+	perf_finish();
+}
+
+TEST(perf_pointer_flood)
+{
+	struct client *client;
+	struct pointer *pointer;
+	struct repaint_stats begin, end;
+	uint32_t latencies[POINTER_MOTIONS], start;
+	int i, x, y;
+
+	client = client_create(100, 100, 200, 200);
+	pointer = client->input->pointer;
+	assert(pointer);
+
+	get_repaint_stats(client, &begin);
+
+	for (i = 0; i < POINTER_MOTIONS; i++) {
+		/* Consecutive targets always differ, so each request
+		 * produces a motion event. */
+		x = 10 + (i * 7) % 180;
+		y = 10 + (i * 13) % 180;
+
+		start = now_usec();
+		wl_test_move_pointer(client->test->wl_test, 100 + x, 100 + y);
+		while (pointer->x != x || pointer->y != y)
+			assert(wl_display_dispatch(client->wl_display) >= 0);
+		latencies[i] = now_usec() - start;
+	}
+
+	get_repaint_stats(client, &end);
+	report_repaints("pointer_flood", &begin, &end);
+	report_latencies("pointer_flood", "motion",
+			 latencies, ARRAY_LENGTH(latencies));
+	perf_finish();
+}
+
+/* The test layer has no restacking request of its own, so reorders are
+ * driven through overlapping sub-surfaces: each frame the bottom-most
+ * child is placed above the top-most one. */
+TEST(perf_layer_reorder)
+{
+	struct client *client;
+	struct wl_subcompositor *subco;
+	struct wl_surface *parent, *child[REORDER_SUBSURFACES];
+	struct wl_subsurface *sub[REORDER_SUBSURFACES];
+	struct wl_buffer *buffer;
+	struct repaint_stats begin, end;
+	int order[REORDER_SUBSURFACES];
+	int i, f, bottom;
+
+	client = client_create(100, 100, 256, 256);
+	parent = client->surface->wl_surface;
+	subco = get_subcompositor(client);
+
+	for (i = 0; i < REORDER_SUBSURFACES; i++) {
+		buffer = create_filled_buffer(client, 128, 128, 0x20 * i);
+		child[i] = wl_compositor_create_surface(client->wl_compositor);
+		sub[i] = wl_subcompositor_get_subsurface(subco, child[i],
+							 parent);
+		wl_subsurface_set_position(sub[i], i * 16, i * 16);
+		wl_surface_attach(child[i], buffer, 0, 0);
+		wl_surface_commit(child[i]);
+		order[i] = i;
+	}
+	commit_frame(client, parent);
+
+	get_repaint_stats(client, &begin);
+
+	for (f = 0; f < REORDER_FRAMES; f++) {
+		bottom = order[0];
+		wl_subsurface_place_above(sub[bottom],
+					  child[order[REORDER_SUBSURFACES - 1]]);
+		memmove(order, order + 1, (REORDER_SUBSURFACES - 1) *
+			sizeof order[0]);
+		order[REORDER_SUBSURFACES - 1] = bottom;
+
+		commit_frame(client, parent);
+	}
+
+	get_repaint_stats(client, &end);
+	report_repaints("layer_reorder", &begin, &end);
+	perf_finish();
+}
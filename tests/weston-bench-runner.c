@@ -0,0 +1,191 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "weston-bench-runner.h"
+
+/* Each benchmark is first calibrated by doubling the iteration count
+ * until one run takes at least MIN_RUN_TIME; this doubles as warm-up.
+ * It is then run WESTON_BENCH_RUNS times (default 7) and the median,
+ * minimum and maximum time per iteration are reported.  The process is
+ * pinned to one CPU, WESTON_BENCH_CPU or the one it started on, so that
+ * runs don't migrate between cores with different cache state. */
+
+#define MIN_RUN_TIME	0.1
+#define MAX_RUNS	64
+
+extern const struct weston_bench __start_bench_section, __stop_bench_section;
+
+static double
+timespec_diff(const struct timespec *a, const struct timespec *b)
+{
+	return (double)(a->tv_sec - b->tv_sec) +
+	       1e-9 * (a->tv_nsec - b->tv_nsec);
+}
+
+void
+bench_reset_timer(struct weston_bench_state *b)
+{
+	b->elapsed = 0.0;
+	b->running = 1;
+	clock_gettime(CLOCK_MONOTONIC, &b->begin);
+}
+
+void
+bench_stop_timer(struct weston_bench_state *b)
+{
+	struct timespec end;
+
+	if (!b->running)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	b->elapsed += timespec_diff(&end, &b->begin);
+	b->running = 0;
+}
+
+static double
+run_once(const struct weston_bench *bench, uint64_t iterations)
+{
+	struct weston_bench_state b;
+
+	memset(&b, 0, sizeof b);
+	b.iterations = iterations;
+
+	bench_reset_timer(&b);
+	bench->run(&b);
+	bench_stop_timer(&b);
+
+	return b.elapsed;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	const double *da = a, *db = b;
+
+	return *da < *db ? -1 : *da > *db;
+}
+
+static void
+run_bench(const struct weston_bench *bench, int runs)
+{
+	double ns[MAX_RUNS], median;
+	uint64_t iterations = 1;
+	int i;
+
+	while (run_once(bench, iterations) < MIN_RUN_TIME)
+		iterations *= 2;
+
+	for (i = 0; i < runs; i++)
+		ns[i] = run_once(bench, iterations) * 1e9 / iterations;
+
+	qsort(ns, runs, sizeof ns[0], compare_double);
+	median = ns[runs / 2];
+
+	printf("%-32s %12llu %12.2f %12.2f %12.2f %7.1f\n",
+	       bench->name, (unsigned long long) iterations,
+	       median, ns[0], ns[runs - 1],
+	       median > 0.0 ? (ns[runs - 1] - ns[0]) * 100.0 / median : 0.0);
+	fflush(stdout);
+}
+
+static int
+pin_cpu(void)
+{
+	const char *env = getenv("WESTON_BENCH_CPU");
+	cpu_set_t set;
+	int cpu;
+
+	cpu = env ? atoi(env) : sched_getcpu();
+	if (cpu < 0)
+		return -1;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof set, &set) < 0) {
+		fprintf(stderr, "cannot pin to cpu %d: %m\n", cpu);
+		return -1;
+	}
+
+	return cpu;
+}
+
+static int
+selected(const struct weston_bench *bench, int argc, char *argv[])
+{
+	int i;
+
+	if (argc < 2)
+		return 1;
+
+	for (i = 1; i < argc; i++)
+		if (strstr(bench->name, argv[i]))
+			return 1;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct weston_bench *bench;
+	const char *env = getenv("WESTON_BENCH_RUNS");
+	int runs = env ? atoi(env) : 7;
+	int cpu;
+
+	if (argc == 2 && (strcmp(argv[1], "--help") == 0 ||
+			  strcmp(argv[1], "-h") == 0)) {
+		fprintf(stderr, "Usage: %s [name-substring...]\n",
+			program_invocation_short_name);
+		fprintf(stderr, "Available benchmarks:\n");
+		for (bench = &__start_bench_section;
+		     bench < &__stop_bench_section; bench++)
+			fprintf(stderr, "	%s\n", bench->name);
+		return EXIT_SUCCESS;
+	}
+
+	if (runs < 1)
+		runs = 1;
+	else if (runs > MAX_RUNS)
+		runs = MAX_RUNS;
+
+	cpu = pin_cpu();
+
+	printf("# cpu %d, %d runs per benchmark, times in ns per iteration\n",
+	       cpu, runs);
+	printf("# %-30s %12s %12s %12s %12s %7s\n",
+	       "name", "iterations", "median", "min", "max", "spread%");
+
+	for (bench = &__start_bench_section;
+	     bench < &__stop_bench_section; bench++)
+		if (selected(bench, argc, argv))
+			run_bench(bench, runs);
+
+	return EXIT_SUCCESS;
+}
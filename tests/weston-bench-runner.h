@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_BENCH_RUNNER_H_
+#define _WESTON_BENCH_RUNNER_H_
+
+#include "config.h"
+
+#include <stdint.h>
+#include <time.h>
+
+struct weston_bench_state {
+	uint64_t iterations;
+	struct timespec begin;
+	double elapsed;
+	int running;
+};
+
+struct weston_bench {
+	const char *name;
+	void (*run)(struct weston_bench_state *b);
+} __attribute__ ((aligned (32)));
+
+/* A benchmark body runs its kernel b->iterations times.  The timer is
+ * running when the body is entered and is stopped when it returns;
+ * setup done in the body can be excluded with bench_reset_timer(). */
+#define BENCH(name)						\
+	static void name(struct weston_bench_state *b);		\
+								\
+	const struct weston_bench bench##name			\
+		__attribute__ ((section ("bench_section"))) =	\
+	{							\
+		#name, name					\
+	};							\
+								\
+	static void name(struct weston_bench_state *b)
+
+void
+bench_reset_timer(struct weston_bench_state *b);
+
+void
+bench_stop_timer(struct weston_bench_state *b);
+
+/* Keeps the compiler from optimizing away a result that is otherwise
+ * unused. */
+static inline void
+bench_keep(const void *p)
+{
+	__asm__ __volatile__("" : : "r" (p) : "memory");
+}
+
+#endif
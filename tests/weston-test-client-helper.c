@@ -122,6 +122,30 @@ get_n_egl_buffers(struct client *client)
 	return client->test->n_egl_buffers;
 }
 
+void
+get_repaint_stats(struct client *client, struct repaint_stats *stats)
+{
+	client->test->repaint_stats.repaints = -1;
+
+	wl_test_get_repaint_stats(client->test->wl_test);
+	client_roundtrip(client);
+
+	assert(client->test->repaint_stats.repaints != (uint32_t) -1);
+	*stats = client->test->repaint_stats;
+}
+
+void
+get_buffer_stats(struct client *client, struct buffer_stats *stats)
+{
+	client->test->buffer_stats_received = 0;
+
+	wl_test_get_buffer_stats(client->test->wl_test);
+	client_roundtrip(client);
+
+	assert(client->test->buffer_stats_received);
+	*stats = client->test->buffer_stats;
+}
+
 static void
 pointer_handle_enter(void *data, struct wl_pointer *wl_pointer,
 		     uint32_t serial, struct wl_surface *wl_surface,
@@ -359,9 +383,62 @@ test_handle_n_egl_buffers(void *data, struct wl_test *wl_test, uint32_t n)
 	test->n_egl_buffers = n;
 }
 
+static void
+test_handle_repaint_stats(void *data, struct wl_test *wl_test,
+			  uint32_t repaints, uint32_t total_usec,
+			  uint32_t max_usec, uint32_t heap_bytes)
+{
+	struct test *test = data;
+
+	test->repaint_stats.repaints = repaints;
+	test->repaint_stats.total_usec = total_usec;
+	test->repaint_stats.max_usec = max_usec;
+	test->repaint_stats.heap_bytes = heap_bytes;
+}
+
+static void
+test_handle_buffer_stats(void *data, struct wl_test *wl_test,
+			 uint32_t released, uint32_t unused,
+			 uint32_t attach_to_use_avg_usec,
+			 uint32_t attach_to_use_max_usec,
+			 uint32_t use_to_release_avg_usec,
+			 uint32_t use_to_release_max_usec,
+			 struct wl_array *release_repaints)
+{
+	struct test *test = data;
+	struct buffer_stats *stats = &test->buffer_stats;
+	size_t size = release_repaints->size;
+
+	memset(stats, 0, sizeof *stats);
+	stats->released = released;
+	stats->unused = unused;
+	stats->attach_to_use_avg_usec = attach_to_use_avg_usec;
+	stats->attach_to_use_max_usec = attach_to_use_max_usec;
+	stats->use_to_release_avg_usec = use_to_release_avg_usec;
+	stats->use_to_release_max_usec = use_to_release_max_usec;
+
+	if (size > sizeof stats->release_repaints)
+		size = sizeof stats->release_repaints;
+	memcpy(stats->release_repaints, release_repaints->data, size);
+
+	test->buffer_stats_received = 1;
+}
+
+static void
+test_handle_surface_plane(void *data, struct wl_test *wl_test,
+			  uint32_t plane)
+{
+	struct test *test = data;
+
+	test->surface_plane = plane;
+}
+
 static const struct wl_test_listener test_listener = {
 	test_handle_pointer_position,
 	test_handle_n_egl_buffers,
+	test_handle_repaint_stats,
+	test_handle_buffer_stats,
+	test_handle_surface_plane,
 };
 
 static void
@@ -49,11 +49,34 @@ struct global {
 	struct wl_list link;
 };
 
+struct repaint_stats {
+	uint32_t repaints;
+	uint32_t total_usec;
+	uint32_t max_usec;
+	uint32_t heap_bytes;
+};
+
+#define BUFFER_STATS_REPAINTS 4
+
+struct buffer_stats {
+	uint32_t released;
+	uint32_t unused;
+	uint32_t attach_to_use_avg_usec;
+	uint32_t attach_to_use_max_usec;
+	uint32_t use_to_release_avg_usec;
+	uint32_t use_to_release_max_usec;
+	uint32_t release_repaints[BUFFER_STATS_REPAINTS];
+};
+
 struct test {
 	struct wl_test *wl_test;
 	int pointer_x;
 	int pointer_y;
 	uint32_t n_egl_buffers;
+	struct repaint_stats repaint_stats;
+	struct buffer_stats buffer_stats;
+	int buffer_stats_received;
+	uint32_t surface_plane;
 };
 
 struct input {
@@ -126,6 +149,12 @@ frame_callback_wait(struct client *client, int *done);
 int
 get_n_egl_buffers(struct client *client);
 
+void
+get_repaint_stats(struct client *client, struct repaint_stats *stats);
+
+void
+get_buffer_stats(struct client *client, struct buffer_stats *stats);
+
 void
 skip(const char *fmt, ...);
 
@@ -27,6 +27,8 @@
 #include <assert.h>
 #include <signal.h>
 #include <unistd.h>
+#include <time.h>
+#include <malloc.h>
 #include "../src/compositor.h"
 #include "wayland-test-server-protocol.h"
 
@@ -39,6 +41,20 @@ struct weston_test {
 	struct weston_compositor *compositor;
 	struct weston_layer layer;
 	struct weston_process process;
+
+	struct {
+		uint32_t repaints;
+		uint64_t total_usec;
+		uint32_t max_usec;
+	} repaint_stats;
+};
+
+struct weston_test_output {
+	struct weston_test *test;
+	struct weston_output *output;
+	int (*repaint)(struct weston_output *output,
+		       pixman_region32_t *damage);
+	struct wl_listener destroy_listener;
 };
 
 struct weston_test_surface {
@@ -235,6 +251,69 @@ get_n_buffers(struct wl_client *client, struct wl_resource *resource)
 	wl_test_send_n_egl_buffers(resource, n_buffers);
 }
 
+static void
+get_repaint_stats(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	struct mallinfo info = mallinfo();
+
+	wl_test_send_repaint_stats(resource,
+				   test->repaint_stats.repaints,
+				   test->repaint_stats.total_usec,
+				   test->repaint_stats.max_usec,
+				   info.uordblks + info.hblkhd);
+
+	memset(&test->repaint_stats, 0, sizeof test->repaint_stats);
+}
+
+static void
+get_buffer_stats(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	struct weston_buffer_stats_summary summary;
+	struct wl_array repaints;
+	uint32_t *p;
+
+	weston_buffer_stats_read(test->compositor, &summary, 1);
+
+	wl_array_init(&repaints);
+	p = wl_array_add(&repaints, sizeof summary.release_repaints);
+	if (!p) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+	memcpy(p, summary.release_repaints, sizeof summary.release_repaints);
+
+	wl_test_send_buffer_stats(resource, summary.released, summary.unused,
+				  summary.attach_to_use_avg,
+				  summary.attach_to_use_max,
+				  summary.use_to_release_avg,
+				  summary.use_to_release_max,
+				  &repaints);
+
+	wl_array_release(&repaints);
+}
+
+static void
+get_surface_plane(struct wl_client *client, struct wl_resource *resource,
+		  struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct weston_view *view;
+	uint32_t plane = 0;
+
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (!view->output_mask || !view->plane)
+			continue;
+
+		plane = view->plane->type + 1;
+		break;
+	}
+
+	wl_test_send_surface_plane(resource, plane);
+}
+
 static const struct wl_test_interface test_implementation = {
 	move_surface,
 	move_pointer,
@@ -242,6 +321,9 @@ static const struct wl_test_interface test_implementation = {
 	activate_surface,
 	send_key,
 	get_n_buffers,
+	get_repaint_stats,
+	get_buffer_stats,
+	get_surface_plane,
 };
 
 static void
@@ -284,6 +366,72 @@ idle_launch_client(void *data)
 	weston_watch_process(&test->process);
 }
 
+static void
+test_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_test_output *test_output =
+		container_of(listener, struct weston_test_output,
+			     destroy_listener);
+
+	wl_list_remove(&test_output->destroy_listener.link);
+	free(test_output);
+}
+
+static int
+test_output_repaint(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct weston_test_output *test_output;
+	struct weston_test *test;
+	struct wl_listener *listener;
+	struct timespec begin, end;
+	uint32_t usec;
+	int ret;
+
+	listener = wl_signal_get(&output->destroy_signal, test_output_destroy);
+	test_output = container_of(listener, struct weston_test_output,
+				   destroy_listener);
+	test = test_output->test;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	ret = test_output->repaint(output, damage);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	usec = (end.tv_sec - begin.tv_sec) * 1000000 +
+	       (end.tv_nsec - begin.tv_nsec) / 1000;
+
+	test->repaint_stats.repaints++;
+	test->repaint_stats.total_usec += usec;
+	if (usec > test->repaint_stats.max_usec)
+		test->repaint_stats.max_usec = usec;
+
+	return ret;
+}
+
+/* Time the repaints of the outputs that exist at startup by wrapping
+ * the backend's repaint hook. Outputs hotplugged later are not timed,
+ * since some backends only set their hook after weston_output_init(). */
+static void
+test_wrap_outputs(struct weston_test *test)
+{
+	struct weston_test_output *test_output;
+	struct weston_output *output;
+
+	wl_list_for_each(output, &test->compositor->output_list, link) {
+		test_output = zalloc(sizeof *test_output);
+		if (test_output == NULL)
+			return;
+
+		test_output->test = test;
+		test_output->output = output;
+		test_output->repaint = output->repaint;
+		output->repaint = test_output_repaint;
+
+		test_output->destroy_listener.notify = test_output_destroy;
+		wl_signal_add(&output->destroy_signal,
+			      &test_output->destroy_listener);
+	}
+}
+
 WL_EXPORT int
 module_init(struct weston_compositor *ec,
 	    int *argc, char *argv[])
@@ -297,6 +445,8 @@ module_init(struct weston_compositor *ec,
 
 	test->compositor = ec;
 	weston_layer_init(&test->layer, &ec->cursor_layer.link);
+	test_wrap_outputs(test);
+	weston_buffer_stats_enable(ec);
 
 	if (wl_global_create(ec->wl_display, &wl_test_interface, 1,
 			     test, bind_test) == NULL)
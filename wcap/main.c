@@ -33,6 +33,10 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <cairo.h>
 
@@ -96,7 +100,8 @@ int clamp_uv(int u)
 }
 
 static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yv12(struct wcap_decoder *decoder, uint32_t *frame,
+		unsigned char *out)
 {
 	unsigned char *y1, *y2, *u, *v;
 	uint32_t *p1, *p2, *end;
@@ -110,7 +115,7 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 		y2 = y1 + stride0;
 		v = out + stride0 * decoder->height + stride1 * i / 2;
 		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
+		p1 = frame + decoder->width * i;
 		p2 = p1 + decoder->width;
 		end = p1 + decoder->width;
 
@@ -135,7 +140,8 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yuv444(struct wcap_decoder *decoder, uint32_t *frame,
+		  unsigned char *out)
 {
 
 	unsigned char *yp, *up, *vp;
@@ -150,7 +156,7 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 		yp = out + stride * i;
 		up = yp + (psize * 2);
 		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
+		rp = frame + decoder->width * i;
 		end = rp + decoder->width;	
 		while (rp < end) {
 			u = 0;
@@ -166,43 +172,397 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 	}
 }
 
+static int
+yuv_frame_size(struct wcap_decoder *decoder, int depth)
+{
+	if (depth == 444)
+		return decoder->width * decoder->height * 3;
+	else
+		return decoder->width * decoder->height * 3 / 2;
+}
+
+static void
+convert_to_yuv(struct wcap_decoder *decoder, uint32_t *frame,
+	       unsigned char *out, int depth)
+{
+	if (depth == 444)
+		convert_to_yuv444(decoder, frame, out);
+	else
+		convert_to_yv12(decoder, frame, out);
+}
+
 static void
 output_yuv_frame(struct wcap_decoder *decoder, int depth)
 {
 	static unsigned char *out;
 	int size;
 
-	if (depth == 444) {
-		size = decoder->width * decoder->height * 3;
-	} else {
-		size = decoder->width * decoder->height * 3 / 2;
-	}
+	size = yuv_frame_size(decoder, depth);
 	if (out == NULL)
 		out = malloc(size);
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
-	}
+	convert_to_yuv(decoder, decoder->frame, out, depth);
 
 	printf("FRAME\n");
 	fwrite(out, 1, size, stdout);
 }
 
+/* With more than one thread, yuv4mpeg2 frames are converted on worker
+ * threads while the main thread decodes the next ones and writes them
+ * out in order.  Each thread gets this many frames to work on. */
+#define SLOTS_PER_THREAD	2
+
+struct yuv_slot {
+	uint32_t *frame;
+	unsigned char *out;
+	int converted;
+};
+
+struct yuv_export {
+	struct wcap_decoder *decoder;
+	int depth, size;
+	pthread_t *threads;
+	int nthreads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct yuv_slot *slots;
+	int nslots;
+	uint64_t filled, claimed, written;
+	int quit;
+};
+
+static void *
+yuv_export_thread(void *data)
+{
+	struct yuv_export *e = data;
+	struct yuv_slot *slot;
+
+	pthread_mutex_lock(&e->mutex);
+
+	for (;;) {
+		while (e->claimed == e->filled && !e->quit)
+			pthread_cond_wait(&e->cond, &e->mutex);
+		if (e->claimed == e->filled)
+			break;
+
+		slot = &e->slots[e->claimed++ % e->nslots];
+
+		pthread_mutex_unlock(&e->mutex);
+		convert_to_yuv(e->decoder, slot->frame, slot->out, e->depth);
+		pthread_mutex_lock(&e->mutex);
+
+		slot->converted = 1;
+		pthread_cond_broadcast(&e->cond);
+	}
+
+	pthread_mutex_unlock(&e->mutex);
+
+	return NULL;
+}
+
+/* Wait for the oldest frame to be converted and write it out.  Called
+ * with the mutex held. */
+static void
+yuv_export_write_oldest(struct yuv_export *e)
+{
+	struct yuv_slot *slot = &e->slots[e->written % e->nslots];
+
+	while (!slot->converted)
+		pthread_cond_wait(&e->cond, &e->mutex);
+
+	pthread_mutex_unlock(&e->mutex);
+	printf("FRAME\n");
+	fwrite(slot->out, 1, e->size, stdout);
+	pthread_mutex_lock(&e->mutex);
+
+	slot->converted = 0;
+	e->written++;
+}
+
+static void
+yuv_export_frame(struct yuv_export *e)
+{
+	struct wcap_decoder *decoder = e->decoder;
+	struct yuv_slot *slot;
+
+	pthread_mutex_lock(&e->mutex);
+	while (e->filled - e->written == (uint64_t) e->nslots)
+		yuv_export_write_oldest(e);
+	pthread_mutex_unlock(&e->mutex);
+
+	/* No worker touches the slot until it is counted as filled */
+	slot = &e->slots[e->filled % e->nslots];
+	memcpy(slot->frame, decoder->frame,
+	       decoder->width * decoder->height * 4);
+
+	pthread_mutex_lock(&e->mutex);
+	e->filled++;
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->mutex);
+}
+
+static void
+yuv_export_init(struct yuv_export *e, struct wcap_decoder *decoder,
+		int depth, int nthreads)
+{
+	int i;
+
+	memset(e, 0, sizeof *e);
+	e->decoder = decoder;
+	e->depth = depth;
+	e->size = yuv_frame_size(decoder, depth);
+	e->nthreads = nthreads;
+	e->nslots = nthreads * SLOTS_PER_THREAD;
+	e->slots = calloc(e->nslots, sizeof *e->slots);
+	e->threads = calloc(nthreads, sizeof *e->threads);
+	if (e->slots == NULL || e->threads == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < e->nslots; i++) {
+		e->slots[i].frame =
+			malloc(decoder->width * decoder->height * 4);
+		e->slots[i].out = malloc(e->size);
+		if (e->slots[i].frame == NULL || e->slots[i].out == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_mutex_init(&e->mutex, NULL);
+	pthread_cond_init(&e->cond, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&e->threads[i], NULL, yuv_export_thread, e);
+}
+
+static void
+yuv_export_finish(struct yuv_export *e)
+{
+	int i;
+
+	pthread_mutex_lock(&e->mutex);
+	while (e->written < e->filled)
+		yuv_export_write_oldest(e);
+	e->quit = 1;
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->mutex);
+
+	for (i = 0; i < e->nthreads; i++)
+		pthread_join(e->threads[i], NULL);
+
+	pthread_cond_destroy(&e->cond);
+	pthread_mutex_destroy(&e->mutex);
+
+	for (i = 0; i < e->nslots; i++) {
+		free(e->slots[i].frame);
+		free(e->slots[i].out);
+	}
+	free(e->slots);
+	free(e->threads);
+}
+
+/* Write out the png frames first to last - 1.  The decoder is brought
+ * to the first one by seeking, so each range can be decoded on its
+ * own.  As in a full decode, each frame shows the first recorded frame
+ * at or after its tick of the replay rate. */
+static void
+write_png_range(struct wcap_decoder *decoder, uint32_t frame_time,
+		int first, int last)
+{
+	uint32_t msecs = decoder->start_msecs + first * frame_time;
+	char filename[200];
+	int i, has_frame = 1;
+
+	if (first > 0)
+		wcap_decoder_seek(decoder, msecs - decoder->start_msecs - 1);
+
+	while ((decoder->count == 0 || decoder->msecs < msecs) && has_frame)
+		has_frame = wcap_decoder_get_frame(decoder);
+
+	for (i = first; i < last && has_frame; i++) {
+		snprintf(filename, sizeof filename, "wcap-frame-%d.png", i);
+		write_png(decoder, filename);
+		fprintf(stderr, "wrote %s\n", filename);
+
+		if (i + 1 == last)
+			break;
+		msecs += frame_time;
+		while (decoder->msecs < msecs && has_frame)
+			has_frame = wcap_decoder_get_frame(decoder);
+	}
+}
+
+/* With an index, --all splits the recording at its keyframes and the
+ * threads decode the segments in parallel, each with its own decoder. */
+struct png_export {
+	const char *filename;
+	uint32_t frame_time;
+	int *starts;		/* first frame of each segment, and the end */
+	int nsegments, next;
+	pthread_mutex_t mutex;
+};
+
+static void *
+png_export_thread(void *data)
+{
+	struct png_export *e = data;
+	struct wcap_decoder *decoder;
+	int segment;
+
+	decoder = wcap_decoder_create(e->filename);
+	if (decoder == NULL) {
+		fprintf(stderr, "Creating wcap decoder failed\n");
+		return NULL;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&e->mutex);
+		segment = e->next++;
+		pthread_mutex_unlock(&e->mutex);
+
+		if (segment >= e->nsegments)
+			break;
+
+		write_png_range(decoder, e->frame_time, e->starts[segment],
+				e->starts[segment + 1]);
+	}
+
+	wcap_decoder_destroy(decoder);
+
+	return NULL;
+}
+
+static int
+png_export(struct wcap_decoder *decoder, const char *filename,
+	   int nthreads, uint32_t frame_time)
+{
+	struct wcap_index_entry *entry;
+	struct png_export e;
+	pthread_t *threads;
+	uint32_t i, last_msecs;
+	int start, nframes;
+
+	memset(&e, 0, sizeof e);
+	e.filename = filename;
+	e.frame_time = frame_time;
+
+	last_msecs = decoder->index[decoder->nframes - 1].msecs;
+	nframes = (last_msecs - decoder->start_msecs) / e.frame_time + 1;
+
+	e.starts = calloc(decoder->nframes + 2, sizeof *e.starts);
+	threads = calloc(nthreads, sizeof *threads);
+	if (e.starts == NULL || threads == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* A segment starts at the first tick after its keyframe */
+	e.starts[e.nsegments++] = 0;
+	for (i = 0; i < decoder->nframes; i++) {
+		entry = &decoder->index[i];
+		if (!(entry->flags & WCAP_FRAME_KEYFRAME))
+			continue;
+
+		start = (entry->msecs - decoder->start_msecs) /
+			e.frame_time + 1;
+		if (start > e.starts[e.nsegments - 1] && start < nframes)
+			e.starts[e.nsegments++] = start;
+	}
+	e.starts[e.nsegments] = nframes;
+
+	pthread_mutex_init(&e.mutex, NULL);
+	for (i = 0; i < (uint32_t) nthreads; i++)
+		pthread_create(&threads[i], NULL, png_export_thread, &e);
+	for (i = 0; i < (uint32_t) nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&e.mutex);
+
+	free(e.starts);
+	free(threads);
+
+	return nframes;
+}
+
+/* Connect to a recorder streaming to unix:<path> or tcp:<host>:<port> */
+static int
+connect_stream(const char *address)
+{
+	struct sockaddr_un addr;
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int fd = -1;
+
+	if (strncmp(address, "unix:", 5) == 0) {
+		memset(&addr, 0, sizeof addr);
+		addr.sun_family = AF_UNIX;
+		if (strlen(address + 5) >= sizeof addr.sun_path)
+			return -1;
+		strcpy(addr.sun_path, address + 5);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0 &&
+		    connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+			close(fd);
+			fd = -1;
+		}
+
+		return fd;
+	}
+
+	if (strncmp(address, "tcp:", 4) != 0)
+		return -1;
+
+	port = strrchr(address + 4, ':');
+	if (port == NULL || (size_t) (port - address - 4) >= sizeof host)
+		return -1;
+	memcpy(host, address + 4, port - address - 4);
+	host[port - address - 4] = '\0';
+	port++;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		return -1;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	return fd;
+}
+
 static void
 usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--rate=<num:denom>] [--start=<seconds>] [--threads=<n>]\n"
+		"\t<wcap file> | --connect=<address>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--start=<seconds>\tstart this far into the recording,\n"
+		"\t\t\t\tfrom the keyframe before it in wcap v2 files\n"
+		"\t--threads=<n>\t\tthreads to convert frames on, defaults\n"
+		"\t\t\t\tto the number of cpus\n"
+		"\t--connect=<address>\tdecode the live stream of a recorder\n"
+		"\t\t\t\tat unix:<path> or tcp:<host>:<port>\n\n");
 
 	exit(exit_code);
 }
@@ -211,10 +571,14 @@ int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
-	int num = 30, denom = 1;
+	int num = 30, denom = 1, start = 0, nthreads;
 	char filename[200];
+	const char *address = NULL;
 	char *mode;
 	uint32_t msecs, frame_time;
+	struct yuv_export yuv_export;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2-444") == 0) {
@@ -231,6 +595,12 @@ int main(int argc, char *argv[])
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
 			;
+		} else if (sscanf(argv[i], "--start=%d", &start) == 1) {
+			;
+		} else if (sscanf(argv[i], "--threads=%d", &nthreads) == 1) {
+			;
+		} else if (strncmp(argv[i], "--connect=", 10) == 0) {
+			address = argv[i] + 10;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
 		} else if (argv[i][0] == '-') {
@@ -243,14 +613,32 @@ int main(int argc, char *argv[])
 	}
 	argc = j;
 
-	if (argc != 2)
+	if (argc != (address ? 1 : 2))
 		usage(EXIT_FAILURE);
 	if (denom == 0) {
 		fprintf(stderr, "invalid rate, denom can not be 0\n");
 		exit(EXIT_FAILURE);
 	}
 
-	decoder = wcap_decoder_create(argv[1]);
+	if (address) {
+		if (start > 0) {
+			fprintf(stderr, "a live stream can't be sought\n");
+			exit(EXIT_FAILURE);
+		}
+
+		j = connect_stream(address);
+		if (j < 0) {
+			fprintf(stderr, "connecting to %s failed: %m\n",
+				address);
+			exit(EXIT_FAILURE);
+		}
+
+		/* Frames go out as they come rather than in batches */
+		nthreads = 1;
+		decoder = wcap_decoder_create_stream(j);
+	} else {
+		decoder = wcap_decoder_create(argv[1]);
+	}
 	if (decoder == NULL) {
 		fprintf(stderr, "Creating wcap decoder failed\n");
 		exit(EXIT_FAILURE);
@@ -276,10 +664,24 @@ int main(int argc, char *argv[])
 		fflush(stdout);
 	}
 
+	frame_time = 1000 * denom / num;
+
+	/* Segments of a recording with an index decode in parallel */
+	if (all && !yuv4mpeg2 && start == 0 && nthreads > 1 &&
+	    decoder->index && decoder->nframes > 0 && frame_time > 0) {
+		i = png_export(decoder, argv[1], nthreads, frame_time);
+		goto out;
+	}
+
+	if (yuv4mpeg2 && nthreads > 1)
+		yuv_export_init(&yuv_export, decoder, yuv4mpeg2, nthreads);
+
 	i = 0;
-	has_frame = wcap_decoder_get_frame(decoder);
+	if (start > 0)
+		has_frame = wcap_decoder_seek(decoder, start * 1000);
+	else
+		has_frame = wcap_decoder_get_frame(decoder);
 	msecs = decoder->msecs;
-	frame_time = 1000 * denom / num;
 	while (has_frame) {
 		if (all || i == output_frame) {
 			snprintf(filename, sizeof filename,
@@ -287,14 +689,22 @@ int main(int argc, char *argv[])
 			write_png(decoder, filename);
 			fprintf(stderr, "wrote %s\n", filename);
 		}
-		if (yuv4mpeg2)
+		if (yuv4mpeg2 && nthreads > 1)
+			yuv_export_frame(&yuv_export);
+		else if (yuv4mpeg2)
 			output_yuv_frame(decoder, yuv4mpeg2);
+		if (yuv4mpeg2 && address)
+			fflush(stdout);
 		i++;
 		msecs += frame_time;
 		while (decoder->msecs < msecs && has_frame)
 			has_frame = wcap_decoder_get_frame(decoder);
 	}
 
+	if (yuv4mpeg2 && nthreads > 1)
+		yuv_export_finish(&yuv_export);
+
+out:
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
 		decoder->width, decoder->height, i);
 
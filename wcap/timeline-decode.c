@@ -0,0 +1,282 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "timeline-decode.h"
+
+#define MAX_OUTPUTS	32	/* weston_output::id comes from a 32 bit pool */
+#define BAR_WIDTH	40
+
+struct samples {
+	uint32_t *data;		/* microseconds */
+	uint32_t count, size;
+	uint64_t sum;
+};
+
+struct output_stats {
+	const char *name;
+	int seen;
+	int in_frame;
+	uint64_t last;		/* ns of the previous point */
+	uint64_t begin;		/* ns of the repaint start */
+	struct samples interval;	/* repaint start to repaint start */
+	struct samples *stages;	/* indexed by point */
+};
+
+static void
+samples_add(struct samples *s, uint64_t ns)
+{
+	uint32_t *data;
+	uint32_t size;
+
+	if (s->count == s->size) {
+		size = s->size ? s->size * 2 : 256;
+		data = realloc(s->data, size * sizeof *data);
+		if (!data) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		s->data = data;
+		s->size = size;
+	}
+
+	s->data[s->count++] = ns / 1000;
+	s->sum += ns / 1000;
+}
+
+static int
+compare_uint32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t
+percentile(struct samples *s, int p)
+{
+	uint32_t i;
+
+	i = ((uint64_t) s->count * p) / 100;
+	if (i >= s->count)
+		i = s->count - 1;
+
+	return s->data[i];
+}
+
+static void
+print_samples(const char *name, struct samples *s)
+{
+	qsort(s->data, s->count, sizeof *s->data, compare_uint32);
+	printf("  %-20s %8u %8u %8u %8u %8u %8u\n", name, s->count,
+	       (uint32_t) (s->sum / s->count),
+	       percentile(s, 50), percentile(s, 90), percentile(s, 99),
+	       s->data[s->count - 1]);
+}
+
+static void
+print_flame(const char *name, struct samples *s, uint64_t total)
+{
+	char bar[BAR_WIDTH + 1];
+	int i, n;
+
+	n = total ? (int) (s->sum * BAR_WIDTH / total) : 0;
+	for (i = 0; i < BAR_WIDTH; i++)
+		bar[i] = i < n ? '#' : '.';
+	bar[BAR_WIDTH] = '\0';
+
+	printf("  %-20s %s %5.1f%%\n", name, bar,
+	       total ? 100.0 * s->sum / total : 0.0);
+}
+
+/* Stages recorded as durations overlap the others, so they are listed
+ * but left out of the share of time between repaints. */
+static void
+print_output(struct output_stats *o, uint32_t id,
+	     struct timeline_name *points, uint32_t npoints,
+	     const uint8_t *duration)
+{
+	uint64_t stage_sum = 0;
+	uint32_t i;
+
+	printf("output %s (id %u): %u frames\n",
+	       o->name ? o->name : "?", id, o->interval.count);
+	if (o->interval.count == 0)
+		return;
+
+	printf("  %-20s %8s %8s %8s %8s %8s %8s\n", "stage (us)",
+	       "count", "mean", "p50", "p90", "p99", "max");
+	for (i = 1; i < npoints; i++)
+		if (o->stages[i].count > 0) {
+			print_samples(points[i].name, &o->stages[i]);
+			if (!duration[i])
+				stage_sum += o->stages[i].sum;
+		}
+	print_samples("frame-interval", &o->interval);
+
+	printf("\n  share of time between repaints:\n");
+	for (i = 1; i < npoints; i++)
+		if (o->stages[i].count > 0 && !duration[i])
+			print_flame(points[i].name, &o->stages[i], stage_sum);
+	printf("\n");
+}
+
+static void *
+read_file(const char *filename, size_t *size)
+{
+	FILE *fp;
+	char *data = NULL, *p;
+	size_t len = 0, alloc = 0, n;
+
+	fp = fopen(filename, "r");
+	if (!fp)
+		return NULL;
+
+	do {
+		if (len == alloc) {
+			alloc = alloc ? alloc * 2 : 65536;
+			p = realloc(data, alloc);
+			if (!p) {
+				free(data);
+				fclose(fp);
+				errno = ENOMEM;
+				return NULL;
+			}
+			data = p;
+		}
+		n = fread(data + len, 1, alloc - len, fp);
+		len += n;
+	} while (n > 0);
+
+	fclose(fp);
+	*size = len;
+
+	return data;
+}
+
+int main(int argc, char *argv[])
+{
+	struct output_stats outputs[MAX_OUTPUTS];
+	struct timeline_header *header;
+	struct timeline_name *names, *points;
+	struct timeline_record *records, *r;
+	struct output_stats *o;
+	uint8_t *duration;
+	uint64_t ns;
+	size_t size;
+	uint32_t i, point;
+	char *data;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s TIMELINE_FILE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	data = read_file(argv[1], &size);
+	if (!data) {
+		fprintf(stderr, "failed to read %s: %m\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	header = (struct timeline_header *) data;
+	if (size < sizeof *header || header->magic != TIMELINE_HEADER_MAGIC ||
+	    size < sizeof *header +
+	    (header->npoints + header->noutputs) * sizeof *names +
+	    (uint64_t) header->nrecords * sizeof *records) {
+		fprintf(stderr, "%s is not a valid timeline file\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	names = (struct timeline_name *) (header + 1);
+	points = names;
+	records = (struct timeline_record *)
+		(names + header->npoints + header->noutputs);
+
+	duration = calloc(header->npoints, sizeof *duration);
+	if (!duration) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(outputs, 0, sizeof outputs);
+	for (i = 0; i < MAX_OUTPUTS; i++) {
+		outputs[i].stages = calloc(header->npoints,
+					   sizeof *outputs[i].stages);
+		if (!outputs[i].stages) {
+			fprintf(stderr, "out of memory\n");
+			return EXIT_FAILURE;
+		}
+	}
+	for (i = 0; i < header->noutputs; i++) {
+		names[header->npoints + i].name[TIMELINE_NAME_SIZE - 1] = '\0';
+		if (names[header->npoints + i].id < MAX_OUTPUTS)
+			outputs[names[header->npoints + i].id].name =
+				names[header->npoints + i].name;
+	}
+	for (i = 0; i < header->npoints; i++)
+		points[i].name[TIMELINE_NAME_SIZE - 1] = '\0';
+
+	for (i = 0; i < header->nrecords; i++) {
+		r = &records[i];
+		point = r->point & ~TIMELINE_RECORD_DURATION;
+		if (r->output >= MAX_OUTPUTS || point >= header->npoints)
+			continue;
+
+		o = &outputs[r->output];
+		ns = (uint64_t) r->sec * 1000000000 + r->nsec;
+		o->seen = 1;
+
+		if (r->point & TIMELINE_RECORD_DURATION) {
+			if (point > 0)
+				samples_add(&o->stages[point], ns);
+			duration[point] = 1;
+			continue;
+		}
+
+		if (r->point == 0) {
+			if (o->in_frame)
+				samples_add(&o->interval, ns - o->begin);
+			o->in_frame = 1;
+			o->begin = ns;
+		} else if (o->in_frame) {
+			samples_add(&o->stages[r->point], ns - o->last);
+		}
+
+		o->last = ns;
+	}
+
+	printf("%u records, %u outputs\n\n", header->nrecords, header->noutputs);
+	for (i = 0; i < MAX_OUTPUTS; i++)
+		if (outputs[i].seen)
+			print_output(&outputs[i], i, points, header->npoints,
+				     duration);
+
+	return EXIT_SUCCESS;
+}
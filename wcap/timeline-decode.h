@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _TIMELINE_DECODE_
+#define _TIMELINE_DECODE_
+
+#include <stdint.h>
+
+/* A timeline file is a timeline_header, then npoints + noutputs
+ * timeline_name entries (points first), then nrecords timeline_record
+ * entries in the order they were recorded.  Point 0 always marks the
+ * start of a repaint; every other point closes the stage since the
+ * previous point on the same output.  Records with
+ * TIMELINE_RECORD_DURATION set in point instead carry the length of the
+ * stage in sec and nsec, and don't take part in that ordering. */
+
+#define TIMELINE_HEADER_MAGIC	0x57544c31
+
+#define TIMELINE_NAME_SIZE	28
+
+#define TIMELINE_RECORD_DURATION	0x8000
+
+struct timeline_header {
+	uint32_t magic;
+	uint32_t npoints;
+	uint32_t noutputs;
+	uint32_t nrecords;
+};
+
+struct timeline_name {
+	uint32_t id;
+	char name[TIMELINE_NAME_SIZE];
+};
+
+struct timeline_record {
+	uint32_t sec;
+	uint32_t nsec;
+	uint16_t output;
+	uint16_t point;
+};
+
+#endif
@@ -32,19 +32,55 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include <cairo.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
 #include "wcap-decode.h"
 
-static void
+/* Add each byte of b to the same byte of a, without carrying into the
+ * next one */
+static inline uint32_t
+add_channels(uint32_t a, uint32_t b)
+{
+	return ((a & 0x7f7f7f7f) + (b & 0x7f7f7f7f)) ^ ((a ^ b) & 0x80808080);
+}
+
+/* Apply one run: add the delta to count pixels, channel by channel */
+static inline void
+apply_delta(uint32_t *d, uint32_t delta, int count)
+{
+#ifdef __SSE2__
+	__m128i vdelta = _mm_set1_epi32(delta);
+	__m128i valpha = _mm_set1_epi32(0xff000000);
+	__m128i v;
+
+	for (; count >= 4; count -= 4, d += 4) {
+		v = _mm_loadu_si128((__m128i *) d);
+		v = _mm_or_si128(_mm_add_epi8(v, vdelta), valpha);
+		_mm_storeu_si128((__m128i *) d, v);
+	}
+#endif
+
+	for (; count > 0; count--, d++)
+		*d = 0xff000000 | add_channels(*d, delta);
+}
+
+static uint32_t *
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+			      struct wcap_rectangle *rect, uint32_t *p)
 {
-	uint32_t v, *p = decoder->p, *d;
+	uint32_t v, *d, delta;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
-	unsigned char r, g, b, dr, dg, db;
+	int x, i, j, l, n, count = width * height;
 
 	d = decoder->frame + (rect->y2 - 1) * decoder->width;
 	x = rect->x1;
@@ -58,61 +94,321 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 			j = 1 << (l - 0xe0 + 7);
 		}
 
-		dr = (v >> 16);
-		dg = (v >>  8);
-		db = (v >>  0);
-		for (k = 0; k < j; k++) {
-			r = (d[x] >> 16) + dr;
-			g = (d[x] >>  8) + dg;
-			b = (d[x] >>  0) + db;
-			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
-			x++;
+		/* Runs wrap from row to row, apply them a row at a time.
+		 * Don't let a corrupt run go past the rectangle. */
+		delta = v & 0x00ffffff;
+		n = count - i;
+		i += j;
+		if (j > n)
+			j = n;
+		while (j > 0) {
+			n = rect->x2 - x;
+			if (n > j)
+				n = j;
+			apply_delta(d + x, delta, n);
+			x += n;
+			j -= n;
 			if (x == rect->x2) {
 				x = rect->x1;
 				d -= decoder->width;
 			}
 		}
-		i += j;
 	}
 
 	if (i != count)
 		printf("rle encoding longer than expected (%d expected %d)\n",
 		       i, count);
 
-	decoder->p = p;
+	return p;
 }
 
-int
-wcap_decoder_get_frame(struct wcap_decoder *decoder)
+static int
+wcap_decoder_get_frame_v1(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
-	uint32_t i;
-
-	if (decoder->p == decoder->end)
-		return 0;
+	uint32_t i, *p;
 
 	header = decoder->p;
 	decoder->msecs = header->msecs;
 	decoder->count++;
 
 	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
+	p = (uint32_t *) (rects + header->nrects);
 	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+		p = wcap_decoder_decode_rectangle(decoder, &rects[i], p);
+	decoder->p = p;
 
 	return 1;
 }
 
+/* Returns the raw payload of a version 2 frame, or NULL if corrupt */
+static void *
+wcap_decoder_uncompress(struct wcap_decoder *decoder,
+			struct wcap_frame_header_v2 *header)
+{
+	void *data = header + 1;
+#ifdef HAVE_LZ4
+	void *payload;
+#endif
+
+	switch (decoder->compression) {
+	case WCAP_COMPRESSION_NONE:
+		if (header->size != header->raw_size)
+			return NULL;
+		return data;
+#ifdef HAVE_LZ4
+	case WCAP_COMPRESSION_LZ4:
+		if (decoder->payload_size < header->raw_size) {
+			payload = realloc(decoder->payload, header->raw_size);
+			if (payload == NULL)
+				return NULL;
+			decoder->payload = payload;
+			decoder->payload_size = header->raw_size;
+		}
+		if (LZ4_decompress_safe(data, decoder->payload, header->size,
+					header->raw_size) !=
+		    (int) header->raw_size)
+			return NULL;
+		return decoder->payload;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+static int
+wcap_decoder_get_frame_v2(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 *header = decoder->p;
+	struct wcap_rectangle *rects;
+	uint32_t i, *p;
+
+	/* A recording that wasn't stopped cleanly may end mid-frame */
+	if ((size_t) (decoder->end - decoder->p) < sizeof *header ||
+	    header->size > (size_t) (decoder->end - (void *) (header + 1)))
+		return 0;
+
+	rects = wcap_decoder_uncompress(decoder, header);
+	if (rects == NULL ||
+	    header->nrects * sizeof *rects > header->raw_size) {
+		fprintf(stderr, "frame %d is corrupt\n", decoder->count);
+		return 0;
+	}
+
+	decoder->msecs = header->msecs;
+	decoder->count++;
+
+	if (header->flags & WCAP_FRAME_KEYFRAME)
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+
+	p = (uint32_t *) (rects + header->nrects);
+	for (i = 0; i < header->nrects; i++)
+		p = wcap_decoder_decode_rectangle(decoder, &rects[i], p);
+
+	decoder->p = (void *) (header + 1) + WCAP_ALIGN(header->size);
+
+	return 1;
+}
+
+/* Read all of size bytes, returns 0 at the end of the stream */
+static int
+read_full(int fd, void *data, size_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		n = read(fd, data, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		data += n;
+		size -= n;
+	}
+
+	return 1;
+}
+
+/* Read the next frame of a live stream into buf and decode it there */
+static int
+wcap_decoder_read_frame(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 header;
+	size_t size, max;
+	void *buf;
+
+	if (!read_full(decoder->fd, &header, sizeof header))
+		return 0;
+
+	/* Even a keyframe of noise doesn't code to more than this */
+	max = (size_t) decoder->width * decoder->height * 8 + 65536;
+	if (header.size > max || header.raw_size > max) {
+		fprintf(stderr, "frame %d is corrupt\n", decoder->count);
+		return 0;
+	}
+
+	size = sizeof header + WCAP_ALIGN(header.size);
+	if (decoder->buf_size < size) {
+		buf = realloc(decoder->buf, size);
+		if (buf == NULL)
+			return 0;
+		decoder->buf = buf;
+		decoder->buf_size = size;
+	}
+
+	memcpy(decoder->buf, &header, sizeof header);
+	if (!read_full(decoder->fd, decoder->buf + sizeof header,
+		       size - sizeof header))
+		return 0;
+
+	decoder->p = decoder->buf;
+	decoder->end = decoder->buf + size;
+
+	return wcap_decoder_get_frame_v2(decoder);
+}
+
+int
+wcap_decoder_get_frame(struct wcap_decoder *decoder)
+{
+	if (decoder->stream)
+		return wcap_decoder_read_frame(decoder);
+
+	if (decoder->p >= decoder->end)
+		return 0;
+
+	if (decoder->version == 1)
+		return wcap_decoder_get_frame_v1(decoder);
+	else
+		return wcap_decoder_get_frame_v2(decoder);
+}
+
+/* Find the last keyframe shown at or before target, returning its
+ * frame number in *number, or NULL if there is none. */
+static void *
+wcap_decoder_find_keyframe(struct wcap_decoder *decoder, uint32_t target,
+			   uint32_t *number)
+{
+	struct wcap_frame_header_v2 *header;
+	void *p, *key = NULL;
+	uint32_t lo, hi, mid, i;
+
+	if (decoder->index) {
+		/* Timestamps only go up, so bisect for the last frame
+		 * at or before target, then look back for a keyframe */
+		lo = 0;
+		hi = decoder->nframes;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (decoder->index[mid].msecs <= target)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (i = lo; i > 0; i--) {
+			if (decoder->index[i - 1].flags & WCAP_FRAME_KEYFRAME) {
+				*number = i - 1;
+				return decoder->map +
+					decoder->index[i - 1].offset;
+			}
+		}
+
+		return NULL;
+	}
+
+	/* Without an index, skip from frame header to frame header */
+	for (p = decoder->start, i = 0;
+	     (size_t) (decoder->end - p) >= sizeof *header;
+	     p += sizeof *header + WCAP_ALIGN(header->size), i++) {
+		header = p;
+		if (header->msecs > target)
+			break;
+		if (header->flags & WCAP_FRAME_KEYFRAME) {
+			key = p;
+			*number = i;
+		}
+	}
+
+	return key;
+}
+
+/* Decode up to the last frame at or before msecs into the recording.
+ * Version 2 files start from the keyframe before it rather than from
+ * the start.  Returns 0 if there is no frame that early. */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	uint32_t target = decoder->start_msecs + msecs;
+	uint32_t number = 0;
+	void *key = NULL;
+
+	if (decoder->stream)
+		return 0;
+
+	if (decoder->version == 2)
+		key = wcap_decoder_find_keyframe(decoder, target, &number);
+
+	/* Decoding on from the current frame beats starting over from a
+	 * keyframe before it */
+	if (decoder->count > 0 && decoder->msecs <= target &&
+	    (key == NULL || number < decoder->count)) {
+		;
+	} else if (key) {
+		decoder->p = key;
+		decoder->count = number;
+	} else {
+		decoder->p = decoder->start;
+		decoder->count = 0;
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+	}
+
+	/* Both frame header versions start with the timestamp */
+	while (decoder->p < decoder->end &&
+	       *(uint32_t *) decoder->p <= target)
+		if (!wcap_decoder_get_frame(decoder))
+			break;
+
+	return decoder->count > 0;
+}
+
+/* Use the index at the end of a version 2 file, if it is there */
+static void
+wcap_decoder_read_index(struct wcap_decoder *decoder)
+{
+	struct wcap_trailer *trailer;
+	uint64_t index_size;
+
+	if (decoder->size < sizeof(struct wcap_header_v2) + sizeof *trailer)
+		return;
+
+	trailer = decoder->map + decoder->size - sizeof *trailer;
+	if (trailer->magic != WCAP_INDEX_MAGIC)
+		return;
+
+	index_size = (uint64_t) trailer->nframes *
+		sizeof(struct wcap_index_entry);
+	if (trailer->index_offset + index_size + sizeof *trailer !=
+	    decoder->size)
+		return;
+
+	decoder->index = decoder->map + trailer->index_offset;
+	decoder->nframes = trailer->nframes;
+	decoder->end = decoder->index;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
 	struct wcap_decoder *decoder;
 	struct wcap_header *header;
+	struct wcap_header_v2 *header_v2;
 	int frame_size;
 	struct stat buf;
 
-	decoder = malloc(sizeof *decoder);
+	decoder = calloc(1, sizeof *decoder);
 	if (decoder == NULL)
 		return NULL;
 
@@ -137,16 +433,96 @@ wcap_decoder_create(const char *filename)
 	decoder->count = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
-	decoder->p = header + 1;
 	decoder->end = decoder->map + decoder->size;
 
+	switch (header->magic) {
+	case WCAP_HEADER_MAGIC:
+		decoder->version = 1;
+		decoder->start = header + 1;
+		break;
+	case WCAP_HEADER_MAGIC_V2:
+		header_v2 = decoder->map;
+		decoder->version = 2;
+		decoder->compression = header_v2->compression;
+		decoder->start = header_v2 + 1;
+		wcap_decoder_read_index(decoder);
+		break;
+	default:
+		fprintf(stderr, "not a wcap file\n");
+		goto err;
+	}
+
+#ifndef HAVE_LZ4
+	if (decoder->compression == WCAP_COMPRESSION_LZ4) {
+		fprintf(stderr, "built without lz4 support\n");
+		goto err;
+	}
+#endif
+
+	decoder->p = decoder->start;
+	if (decoder->start < decoder->end)
+		decoder->start_msecs = *(uint32_t *) decoder->start;
+
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
+	if (decoder->frame == NULL)
+		goto err;
+	memset(decoder->frame, 0, frame_size);
+
+	return decoder;
+
+err:
+	munmap(decoder->map, decoder->size);
+	close(decoder->fd);
+	free(decoder);
+	return NULL;
+}
+
+/* Decode the stream a weston recorder sends its viewers, see
+ * recorder-stream in weston.ini.  It starts with a version 2 header
+ * and a keyframe; there is no index. */
+struct wcap_decoder *
+wcap_decoder_create_stream(int fd)
+{
+	struct wcap_decoder *decoder;
+	struct wcap_header_v2 header;
+	int frame_size;
+
+	if (!read_full(fd, &header, sizeof header)) {
+		fprintf(stderr, "no wcap stream header\n");
+		return NULL;
+	}
+
+	if (header.magic != WCAP_HEADER_MAGIC_V2) {
+		fprintf(stderr, "not a wcap stream\n");
+		return NULL;
+	}
+
+#ifndef HAVE_LZ4
+	if (header.compression == WCAP_COMPRESSION_LZ4) {
+		fprintf(stderr, "built without lz4 support\n");
+		return NULL;
+	}
+#endif
+
+	decoder = calloc(1, sizeof *decoder);
+	if (decoder == NULL)
+		return NULL;
+
+	decoder->fd = fd;
+	decoder->stream = 1;
+	decoder->version = 2;
+	decoder->format = header.format;
+	decoder->compression = header.compression;
+	decoder->width = header.width;
+	decoder->height = header.height;
+
+	frame_size = header.width * header.height * 4;
+	decoder->frame = calloc(1, frame_size);
 	if (decoder->frame == NULL) {
 		free(decoder);
 		return NULL;
 	}
-	memset(decoder->frame, 0, frame_size);
 
 	return decoder;
 }
@@ -154,8 +530,11 @@ wcap_decoder_create(const char *filename)
 void
 wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
-	munmap(decoder->map, decoder->size);
+	if (decoder->map)
+		munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->buf);
+	free(decoder->payload);
 	free(decoder->frame);
 	free(decoder);
 }
@@ -45,6 +45,54 @@ struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+/* Version 2 files start with their own magic, and add keyframes,
+ * compressed frames and an index of the frames at the end. */
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57434958
+
+#define WCAP_COMPRESSION_NONE	0
+#define WCAP_COMPRESSION_LZ4	1
+
+/* Keyframes are decoded against an all 0 frame rather than the
+ * previous one, and always cover the whole frame */
+#define WCAP_FRAME_KEYFRAME	(1 << 0)
+
+/* Frames, the index and the trailer are 8 byte aligned */
+#define WCAP_ALIGN(n)		(((n) + 7) & ~7)
+
+struct wcap_header_v2 {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t width, height;
+	uint32_t compression;
+	uint32_t reserved;
+};
+
+/* Followed by size bytes of payload, padded to WCAP_ALIGN.  They
+ * decompress to raw_size bytes of nrects wcap_rectangles and then the
+ * run-length encoded pixels of each rectangle in turn. */
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	uint32_t size;
+	uint32_t raw_size;
+	uint32_t reserved;
+};
+
+struct wcap_index_entry {
+	uint64_t offset;	/* of the frame header, from the file start */
+	uint32_t msecs;
+	uint32_t flags;
+};
+
+/* Ends the file, if the recording was stopped cleanly */
+struct wcap_trailer {
+	uint64_t index_offset;
+	uint32_t nframes;
+	uint32_t magic;
+};
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
@@ -54,10 +102,31 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+
+	int version;
+	uint32_t compression;
+	void *start;			/* first frame */
+	uint32_t start_msecs;		/* of the first frame */
+
+	/* NULL for version 1 and unterminated version 2 files */
+	struct wcap_index_entry *index;
+	uint32_t nframes;
+
+	/* Decompressed payload of the current frame */
+	void *payload;
+	size_t payload_size;
+
+	/* Set for a live stream, whose frames are read into buf one at
+	 * a time as they arrive; those can't be sought */
+	int stream;
+	void *buf;
+	size_t buf_size;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
+struct wcap_decoder *wcap_decoder_create_stream(int fd);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
 #endif
@@ -52,6 +52,7 @@ struct hash_table {
 	uint32_t size_index;
 	uint32_t entries;
 	uint32_t deleted_entries;
+	int iterating;
 };
 
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
@@ -134,6 +135,7 @@ hash_table_create(void)
 	ht->table = calloc(ht->size, sizeof(*ht->table));
 	ht->entries = 0;
 	ht->deleted_entries = 0;
+	ht->iterating = 0;
 
 	if (ht->table == NULL) {
 		free(ht);
@@ -187,18 +189,37 @@ hash_table_search(struct hash_table *ht, uint32_t hash)
 	return NULL;
 }
 
+static void
+hash_table_compact(struct hash_table *ht);
+
+/**
+ * Calls func for every entry in the table.
+ *
+ * The walk stops as soon as all entries have been seen, so the empty
+ * tail of the table isn't scanned.  func may remove entries; the table
+ * is compacted once the walk is done.
+ */
 void
 hash_table_for_each(struct hash_table *ht,
 		    hash_table_iterator_func_t func, void *data)
 {
-	struct hash_entry *entry;
-	uint32_t i;
+	struct hash_entry *entry, *end;
+	uint32_t remaining;
+
+	remaining = ht->entries;
+	end = ht->table + ht->size;
 
-	for (i = 0; i < ht->size; i++) {
-		entry = ht->table + i;
-		if (entry_is_present(entry))
+	ht->iterating++;
+	for (entry = ht->table; remaining > 0 && entry != end; entry++) {
+		if (entry_is_present(entry)) {
+			remaining--;
 			func(entry->data, data);
+		}
 	}
+	ht->iterating--;
+
+	if (!ht->iterating)
+		hash_table_compact(ht);
 }
 
 void *
@@ -261,7 +282,14 @@ hash_table_insert(struct hash_table *ht, uint32_t hash, void *data)
 	if (ht->entries >= ht->max_entries) {
 		hash_table_rehash(ht, ht->size_index + 1);
 	} else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
-		hash_table_rehash(ht, ht->size_index);
+		/* Clearing out the deleted entries only buys room if
+		 * the live ones leave a good share of the table free,
+		 * otherwise a table kept near its limit by churn would
+		 * be rehashed on every insert. */
+		if (ht->entries >= ht->max_entries / 2)
+			hash_table_rehash(ht, ht->size_index + 1);
+		else
+			hash_table_rehash(ht, ht->size_index);
 	}
 
 	hash_address = hash % ht->size;
@@ -289,11 +317,36 @@ hash_table_insert(struct hash_table *ht, uint32_t hash, void *data)
 	return -1;
 }
 
+/**
+ * Shrinks the table when it has become sparse, or rehashes it at the
+ * same size when deleted entries outnumber the live ones.  Without
+ * this, window churn leaves the table full of deleted markers that
+ * every lookup has to probe past until the next insert hits the
+ * limit.
+ */
+static void
+hash_table_compact(struct hash_table *ht)
+{
+	unsigned int size_index = ht->size_index;
+
+	/* Halve while the entries would still only fill half of the
+	 * smaller table, so that a few inserts don't grow it right
+	 * back. */
+	while (size_index > 0 &&
+	       ht->entries <= hash_sizes[size_index - 1].max_entries / 2)
+		size_index--;
+
+	if (size_index != ht->size_index ||
+	    ht->deleted_entries > ht->entries)
+		hash_table_rehash(ht, size_index);
+}
+
 /**
  * This function deletes the given hash table entry.
  *
- * Note that deletion doesn't otherwise modify the table, so an iteration over
- * the table deleting entries is safe.
+ * Deletion may compact the table, except from within
+ * hash_table_for_each(), so an iteration over the table deleting
+ * entries is safe.
  */
 void
 hash_table_remove(struct hash_table *ht, uint32_t hash)
@@ -305,5 +358,8 @@ hash_table_remove(struct hash_table *ht, uint32_t hash)
 		entry->data = (void *) &deleted_data;
 		ht->entries--;
 		ht->deleted_entries++;
+
+		if (!ht->iterating)
+			hash_table_compact(ht);
 	}
 }
@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sched.h>
 
 #include "xwayland.h"
 
@@ -46,26 +47,37 @@ handle_sigusr1(int signal_number, void *data)
 	weston_wm_create(wxs, wxs->wm_fd);
 	wl_event_source_remove(wxs->sigusr1_source);
 
+	/* Done starting up, X clients may be waiting for it now */
+	if (wxs->prespawned) {
+		struct sched_param param = { 0 };
+
+		if (sched_setscheduler(wxs->process.pid,
+				       SCHED_OTHER, &param) < 0)
+			weston_log("failed to restore the X server's "
+				   "priority: %m\n");
+		wxs->prespawned = 0;
+	}
+
 	return 1;
 }
 
-static int
-weston_xserver_handle_event(int listen_fd, uint32_t mask, void *data)
+static void
+weston_xserver_spawn(struct weston_xserver *wxs)
 {
-	struct weston_xserver *wxs = data;
 	char display[8], s[8], abstract_fd[8], unix_fd[8], wm_fd[8];
 	int sv[2], wm[2], fd;
 	char *xserver = NULL;
 	struct weston_config_section *section;
+	struct sched_param param = { 0 };
 
 	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
 		weston_log("wl connection socketpair failed\n");
-		return 1;
+		return;
 	}
 
 	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, wm) < 0) {
 		weston_log("X wm connection socketpair failed\n");
-		return 1;
+		return;
 	}
 
 	wxs->process.pid = fork();
@@ -108,6 +120,11 @@ weston_xserver_handle_event(int listen_fd, uint32_t mask, void *data)
 		 * it's done with that. */
 		signal(SIGUSR1, SIG_IGN);
 
+		if (wxs->prespawned &&
+		    sched_setscheduler(0, SCHED_IDLE, &param) < 0)
+			weston_log("failed to start the X server at idle "
+				   "priority: %m\n");
+
 		if (execl(xserver,
 			  xserver,
 			  display,
@@ -140,10 +157,38 @@ weston_xserver_handle_event(int listen_fd, uint32_t mask, void *data)
 		weston_log( "failed to fork\n");
 		break;
 	}
+}
+
+static int
+weston_xserver_handle_event(int listen_fd, uint32_t mask, void *data)
+{
+	struct weston_xserver *wxs = data;
+
+	wxs->prespawned = 0;
+	weston_xserver_spawn(wxs);
 
 	return 1;
 }
 
+/* Starts the X server before any X client asks for it, once the first
+ * frame is out.  It listens on the sockets we bound, so clients
+ * connecting while it comes up wait for it as with a lazy start. */
+static void
+weston_xserver_prespawn(struct weston_compositor *compositor, void *data)
+{
+	struct weston_xserver *wxs = data;
+
+	/* A client came first, or the X server was shut down */
+	if (wxs->process.pid != 0 || !wxs->loop)
+		return;
+
+	weston_log("pre-spawning X server\n");
+	wxs->prespawned = 1;
+	weston_xserver_spawn(wxs);
+	if (wxs->process.pid <= 0)
+		wxs->prespawned = 0;
+}
+
 static void
 weston_xserver_shutdown(struct weston_xserver *wxs)
 {
@@ -345,7 +390,9 @@ module_init(struct weston_compositor *compositor,
 {
 	struct wl_display *display = compositor->wl_display;
 	struct weston_xserver *wxs;
+	struct weston_config_section *section;
 	char lockfile[256], display_name[8];
+	int prespawn;
 
 	wxs = zalloc(sizeof *wxs);
 	if (wxs == NULL)
@@ -403,5 +450,12 @@ module_init(struct weston_compositor *compositor,
 	wxs->destroy_listener.notify = weston_xserver_destroy;
 	wl_signal_add(&compositor->destroy_signal, &wxs->destroy_listener);
 
+	section = weston_config_get_section(compositor->config,
+					    "xwayland", NULL, NULL);
+	weston_config_section_get_bool(section, "prespawn", &prespawn, 0);
+	if (prespawn)
+		weston_compositor_defer_init(compositor, "xwayland",
+					     weston_xserver_prespawn, wxs);
+
 	return 0;
 }
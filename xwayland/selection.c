@@ -27,8 +27,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <xcb/xcbext.h>
+
 #include "xwayland.h"
 
+/* Upper bound for INCR chunks, however big the server lets requests be */
+#define INCR_CHUNK_SIZE_MAX (4 * 1024 * 1024)
+
 static int
 writable_callback(int fd, uint32_t mask, void *data)
 {
@@ -51,10 +56,6 @@ writable_callback(int fd, uint32_t mask, void *data)
 		return 1;
 	}
 
-	weston_log("wrote %d (chunk size %d) of %d bytes\n",
-		wm->property_start + len,
-		len, xcb_get_property_value_length(wm->property_reply));
-
 	wm->property_start += len;
 	if (len == remainder) {
 		free(wm->property_reply);
@@ -90,25 +91,59 @@ weston_wm_write_property(struct weston_wm *wm, xcb_get_property_reply_t *reply)
 					     writable_callback, wm);
 }
 
+/*
+ * Asks for the selection property without waiting for the reply, which
+ * can be megabytes: func gets it from weston_wm_selection_dispatch()
+ * once it has arrived.  Only one request is outstanding at a time.
+ */
 static void
-weston_wm_get_incr_chunk(struct weston_wm *wm)
+weston_wm_get_selection_property(struct weston_wm *wm, int delete,
+				 void (*func)(struct weston_wm *wm,
+					      xcb_get_property_reply_t *reply))
 {
 	xcb_get_property_cookie_t cookie;
-	xcb_get_property_reply_t *reply;
+
+	if (wm->selection_reply_func)
+		xcb_discard_reply(wm->conn, wm->selection_reply_sequence);
 
 	cookie = xcb_get_property(wm->conn,
-				  0, /* delete */
+				  delete,
 				  wm->selection_window,
 				  wm->atom.wl_selection,
 				  XCB_GET_PROPERTY_TYPE_ANY,
 				  0, /* offset */
 				  0x1fffffff /* length */);
 
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	wm->selection_reply_sequence = cookie.sequence;
+	wm->selection_reply_func = func;
+}
+
+void
+weston_wm_selection_dispatch(struct weston_wm *wm)
+{
+	void (*func)(struct weston_wm *wm, xcb_get_property_reply_t *reply);
+	xcb_generic_error_t *error = NULL;
+	void *reply;
 
+	if (!wm->selection_reply_func ||
+	    !xcb_poll_for_reply(wm->conn, wm->selection_reply_sequence,
+				&reply, &error))
+		return;
+
+	free(error);
+
+	func = wm->selection_reply_func;
+	wm->selection_reply_func = NULL;
+	func(wm, reply);
+}
+
+static void
+weston_wm_handle_incr_chunk(struct weston_wm *wm,
+			    xcb_get_property_reply_t *reply)
+{
 	dump_property(wm, wm->atom.wl_selection, reply);
 
-	if (xcb_get_property_value_length(reply) > 0) {
+	if (reply && xcb_get_property_value_length(reply) > 0) {
 		weston_wm_write_property(wm, reply);
 	} else {
 		weston_log("transfer complete\n");
@@ -117,6 +152,12 @@ weston_wm_get_incr_chunk(struct weston_wm *wm)
 	}
 }
 
+static void
+weston_wm_get_incr_chunk(struct weston_wm *wm)
+{
+	weston_wm_get_selection_property(wm, 0, weston_wm_handle_incr_chunk);
+}
+
 struct x11_data_source {
 	struct weston_data_source base;
 	struct weston_wm *wm;
@@ -213,22 +254,13 @@ weston_wm_get_selection_targets(struct weston_wm *wm)
 }
 
 static void
-weston_wm_get_selection_data(struct weston_wm *wm)
+weston_wm_handle_selection_data(struct weston_wm *wm,
+				xcb_get_property_reply_t *reply)
 {
-	xcb_get_property_cookie_t cookie;
-	xcb_get_property_reply_t *reply;
-
-	cookie = xcb_get_property(wm->conn,
-				  1, /* delete */
-				  wm->selection_window,
-				  wm->atom.wl_selection,
-				  XCB_GET_PROPERTY_TYPE_ANY,
-				  0, /* offset */
-				  0x1fffffff /* length */);
-
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
-
-	if (reply->type == wm->atom.incr) {
+	if (reply == NULL) {
+		weston_log("failed to get selection data\n");
+		close(wm->data_source_fd);
+	} else if (reply->type == wm->atom.incr) {
 		dump_property(wm, wm->atom.wl_selection, reply);
 		wm->incr = 1;
 		free(reply);
@@ -239,6 +271,13 @@ weston_wm_get_selection_data(struct weston_wm *wm)
 	}
 }
 
+static void
+weston_wm_get_selection_data(struct weston_wm *wm)
+{
+	weston_wm_get_selection_property(wm, 1,
+					 weston_wm_handle_selection_data);
+}
+
 static void
 weston_wm_handle_selection_notify(struct weston_wm *wm,
 				xcb_generic_event_t *event)
@@ -255,8 +294,6 @@ weston_wm_handle_selection_notify(struct weston_wm *wm,
 	}
 }
 
-static const size_t incr_chunk_size = 64 * 1024;
-
 static void
 weston_wm_send_selection_notify(struct weston_wm *wm, xcb_atom_t property)
 {
@@ -341,8 +378,8 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 	void *p;
 
 	current = wm->source_data.size;
-	if (wm->source_data.size < incr_chunk_size)
-		p = wl_array_add(&wm->source_data, incr_chunk_size);
+	if (wm->source_data.size < wm->incr_chunk_size)
+		p = wl_array_add(&wm->source_data, wm->incr_chunk_size);
 	else
 		p = (char *) wm->source_data.data + wm->source_data.size;
 	available = wm->source_data.alloc - current;
@@ -356,11 +393,8 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 		wl_array_release(&wm->source_data);
 	}
 
-	weston_log("read %d (available %d, mask 0x%x) bytes: \"%.*s\"\n",
-		len, available, mask, len, (char *) p);
-
 	wm->source_data.size = current + len;
-	if (wm->source_data.size >= incr_chunk_size) {
+	if (wm->source_data.size >= wm->incr_chunk_size) {
 		if (!wm->incr) {
 			weston_log("got %zu bytes, starting incr\n",
 				wm->source_data.size);
@@ -371,7 +405,7 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 					    wm->selection_request.property,
 					    wm->atom.incr,
 					    32, /* format */
-					    1, &incr_chunk_size);
+					    1, &wm->incr_chunk_size);
 			wm->selection_property_set = 1;
 			wm->flush_property_on_delete = 1;
 			wl_event_source_remove(wm->property_source);
@@ -416,8 +450,6 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 		close(wm->data_source_fd);
 		wm->data_source_fd = -1;
 		close(fd);
-	} else {
-		weston_log("nothing happened, buffered the bytes\n");
 	}
 
 	return 1;
@@ -679,6 +711,14 @@ weston_wm_selection_init(struct weston_wm *wm)
 
 	wm->selection_request.requestor = XCB_NONE;
 
+	/* Send each INCR chunk in one ChangeProperty request as big as
+	 * the server accepts, leaving room for the request header. */
+	wm->incr_chunk_size =
+		xcb_get_maximum_request_length(wm->conn) * 4 -
+		sizeof(xcb_change_property_request_t);
+	if (wm->incr_chunk_size > INCR_CHUNK_SIZE_MAX)
+		wm->incr_chunk_size = INCR_CHUNK_SIZE_MAX;
+
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE;
 	wm->selection_window = xcb_generate_id(wm->conn);
 	xcb_create_window(wm->conn,
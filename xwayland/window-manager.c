@@ -34,6 +34,8 @@
 #include <X11/Xcursor/Xcursor.h>
 #include <linux/input.h>
 
+#include <xcb/xcbext.h>
+
 #include "xwayland.h"
 
 #include "cairo-util.h"
@@ -115,6 +117,9 @@ struct motif_wm_hints {
 #define _NET_WM_MOVERESIZE_MOVE_KEYBOARD    10   /* move via keyboard */
 #define _NET_WM_MOVERESIZE_CANCEL           11   /* cancel operation */
 
+/* Number of properties weston_wm_window_read_properties() tracks */
+#define WM_WINDOW_PROPERTY_COUNT 11
+
 struct weston_wm_window {
 	struct weston_wm *wm;
 	xcb_window_t id;
@@ -129,6 +134,12 @@ struct weston_wm_window {
 	struct wl_event_source *repaint_source;
 	struct wl_event_source *configure_source;
 	int properties_dirty;
+	struct {
+		unsigned int sequence[WM_WINDOW_PROPERTY_COUNT];
+		xcb_get_property_reply_t *reply[WM_WINDOW_PROPERTY_COUNT];
+		uint32_t received;
+		struct wl_list link;	/* weston_wm::property_fetch_list */
+	} fetch;
 	int pid;
 	char *machine;
 	char *class;
@@ -294,6 +305,7 @@ xcb_cursor_library_load_cursor(struct weston_wm *wm, const char *file)
 	return cursor;
 }
 
+#ifdef WM_DEBUG
 void
 dump_property(struct weston_wm *wm,
 	      xcb_atom_t property, xcb_get_property_reply_t *reply)
@@ -361,6 +373,15 @@ read_and_dump_property(struct weston_wm *wm,
 
 	free(reply);
 }
+#else
+/* Looking up the atom names costs round trips, don't bother when the
+ * result isn't logged anyway. */
+void
+dump_property(struct weston_wm *wm,
+	      xcb_atom_t property, xcb_get_property_reply_t *reply)
+{
+}
+#endif
 
 /* We reuse some predefined, but otherwise useles atoms */
 #define TYPE_WM_PROTOCOLS	XCB_ATOM_CUT_BUFFER0
@@ -368,19 +389,19 @@ read_and_dump_property(struct weston_wm *wm,
 #define TYPE_NET_WM_STATE	XCB_ATOM_CUT_BUFFER2
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 
+#define F(field) offsetof(struct weston_wm_window, field)
+
+struct weston_wm_property {
+	xcb_atom_t atom;
+	xcb_atom_t type;
+	int offset;
+};
+
 static void
-weston_wm_window_read_properties(struct weston_wm_window *window)
+weston_wm_get_window_properties(struct weston_wm *wm,
+				struct weston_wm_property props[WM_WINDOW_PROPERTY_COUNT])
 {
-	struct weston_wm *wm = window->wm;
-	struct weston_shell_interface *shell_interface =
-		&wm->server->compositor->shell_interface;
-
-#define F(field) offsetof(struct weston_wm_window, field)
-	const struct {
-		xcb_atom_t atom;
-		xcb_atom_t type;
-		int offset;
-	} props[] = {
+	const struct weston_wm_property table[WM_WINDOW_PROPERTY_COUNT] = {
 		{ XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, F(class) },
 		{ XCB_ATOM_WM_NAME, XCB_ATOM_STRING, F(name) },
 		{ XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, F(transient_for) },
@@ -393,25 +414,62 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		{ wm->atom.motif_wm_hints, TYPE_MOTIF_WM_HINTS, 0 },
 		{ wm->atom.wm_client_machine, XCB_ATOM_WM_CLIENT_MACHINE, F(machine) },
 	};
+
+	memcpy(props, table, sizeof table);
+}
 #undef F
 
-	xcb_get_property_cookie_t cookie[ARRAY_LENGTH(props)];
-	xcb_get_property_reply_t *reply;
-	void *p;
-	uint32_t *xid;
-	xcb_atom_t *atom;
+/*
+ * Sends the property requests for a window without waiting for the
+ * replies.  The requests of every window created or changed in one
+ * batch of X events go out together on the flush at the end of
+ * weston_wm_handle_event(), and the replies are picked up from there
+ * as they arrive.
+ */
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_property props[WM_WINDOW_PROPERTY_COUNT];
+	xcb_get_property_cookie_t cookie;
 	uint32_t i;
 
-	if (!window->properties_dirty)
+	/* A change seen while a fetch is in flight is fetched again
+	 * once that one completes. */
+	if (!window->properties_dirty || !wl_list_empty(&window->fetch.link))
 		return;
 	window->properties_dirty = 0;
 
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
-		cookie[i] = xcb_get_property(wm->conn,
-					     0, /* delete */
-					     window->id,
-					     props[i].atom,
-					     XCB_ATOM_ANY, 0, 2048);
+	weston_wm_get_window_properties(wm, props);
+
+	for (i = 0; i < ARRAY_LENGTH(props); i++) {
+		cookie = xcb_get_property(wm->conn,
+					  0, /* delete */
+					  window->id,
+					  props[i].atom,
+					  XCB_ATOM_ANY, 0, 2048);
+		window->fetch.sequence[i] = cookie.sequence;
+		window->fetch.reply[i] = NULL;
+	}
+	window->fetch.received = 0;
+
+	wl_list_insert(wm->property_fetch_list.prev, &window->fetch.link);
+}
+
+static void
+weston_wm_window_apply_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_shell_interface *shell_interface =
+		&wm->server->compositor->shell_interface;
+	struct weston_wm_property props[WM_WINDOW_PROPERTY_COUNT];
+	xcb_get_property_reply_t *reply;
+	void *p;
+	uint32_t *xid;
+	xcb_atom_t *atom;
+	uint32_t i, j;
+
+	weston_wm_get_window_properties(wm, props);
 
 	window->decorate = !window->override_redirect;
 	window->size_hints.flags = 0;
@@ -419,7 +477,8 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	window->delete_window = 0;
 
 	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
-		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
+		reply = window->fetch.reply[i];
+		window->fetch.reply[i] = NULL;
 		if (!reply)
 			/* Bad window, typically */
 			continue;
@@ -455,12 +514,10 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 			break;
 		case TYPE_WM_PROTOCOLS:
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.wm_delete_window)
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.wm_delete_window)
 					window->delete_window = 1;
 			break;
-
-			break;
 		case TYPE_WM_NORMAL_HINTS:
 			memcpy(&window->size_hints,
 			       xcb_get_property_value(reply),
@@ -469,8 +526,8 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		case TYPE_NET_WM_STATE:
 			window->fullscreen = 0;
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.net_wm_state_fullscreen)
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.net_wm_state_fullscreen)
 					window->fullscreen = 1;
 			break;
 		case TYPE_MOTIF_WM_HINTS:
@@ -493,6 +550,99 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		frame_set_title(window->frame, window->name);
 }
 
+/*
+ * Collects the replies of an in-flight fetch, in request order.  Unless
+ * block is set, stops at the first reply that hasn't arrived yet.
+ * Returns 1 once all replies are in and have been applied.
+ */
+static int
+weston_wm_window_collect_properties(struct weston_wm_window *window,
+				    int block)
+{
+	struct weston_wm *wm = window->wm;
+	xcb_generic_error_t *error;
+	void *reply;
+	uint32_t i;
+
+	while (window->fetch.received < WM_WINDOW_PROPERTY_COUNT) {
+		i = window->fetch.received;
+		error = NULL;
+
+		if (block) {
+			reply = xcb_wait_for_reply(wm->conn,
+						   window->fetch.sequence[i],
+						   &error);
+		} else if (!xcb_poll_for_reply(wm->conn,
+					       window->fetch.sequence[i],
+					       &reply, &error)) {
+			return 0;
+		}
+
+		free(error);
+		window->fetch.reply[i] = reply;
+		window->fetch.received++;
+	}
+
+	wl_list_remove(&window->fetch.link);
+	wl_list_init(&window->fetch.link);
+
+	weston_wm_window_apply_properties(window);
+
+	return 1;
+}
+
+static void
+weston_wm_window_cancel_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	uint32_t i;
+
+	if (wl_list_empty(&window->fetch.link))
+		return;
+
+	for (i = 0; i < window->fetch.received; i++)
+		free(window->fetch.reply[i]);
+	for (; i < WM_WINDOW_PROPERTY_COUNT; i++)
+		xcb_discard_reply(wm->conn, window->fetch.sequence[i]);
+
+	wl_list_remove(&window->fetch.link);
+	wl_list_init(&window->fetch.link);
+}
+
+/* Applies whatever replies arrived since the last batch of events and
+ * sends the requests for properties that changed meanwhile. */
+static void
+weston_wm_dispatch_property_fetches(struct weston_wm *wm)
+{
+	struct weston_wm_window *window, *next;
+
+	wl_list_for_each_safe(window, next, &wm->property_fetch_list,
+			      fetch.link)
+		if (weston_wm_window_collect_properties(window, 0))
+			weston_wm_window_fetch_properties(window);
+}
+
+/*
+ * Makes the window's properties current, waiting for the replies when
+ * they are still in flight.  Used where the WM can't go on without
+ * them, such as on map.
+ */
+static void
+weston_wm_window_read_properties(struct weston_wm_window *window)
+{
+	weston_wm_window_fetch_properties(window);
+	if (wl_list_empty(&window->fetch.link))
+		return;
+
+	weston_wm_window_collect_properties(window, 1);
+
+	/* Changed while the previous fetch was in flight */
+	if (window->properties_dirty) {
+		weston_wm_window_fetch_properties(window);
+		weston_wm_window_collect_properties(window, 1);
+	}
+}
+
 static void
 weston_wm_window_get_frame_size(struct weston_wm_window *window,
 				int *width, int *height)
@@ -1059,13 +1209,17 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 		return;
 
 	window->properties_dirty = 1;
+	weston_wm_window_fetch_properties(window);
 
+#ifdef WM_DEBUG
+	/* Dumping the property costs a round trip */
 	wm_log("XCB_PROPERTY_NOTIFY: window %d, ", property_notify->window);
 	if (property_notify->state == XCB_PROPERTY_DELETE)
 		wm_log("deleted\n");
 	else
 		read_and_dump_property(wm, property_notify->window,
 				       property_notify->atom);
+#endif
 
 	if (property_notify->atom == wm->atom.net_wm_name ||
 	    property_notify->atom == XCB_ATOM_WM_NAME)
@@ -1095,6 +1249,7 @@ weston_wm_window_create(struct weston_wm *wm,
 	window->wm = wm;
 	window->id = id;
 	window->properties_dirty = 1;
+	wl_list_init(&window->fetch.link);
 	window->override_redirect = override;
 	window->width = width;
 	window->height = height;
@@ -1109,6 +1264,8 @@ weston_wm_window_create(struct weston_wm *wm,
 	free(geometry_reply);
 
 	hash_table_insert(wm->window_hash, id, window);
+
+	weston_wm_window_fetch_properties(window);
 }
 
 static void
@@ -1121,6 +1278,8 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 	if (window->cairo_surface)
 		cairo_surface_destroy(window->cairo_surface);
 
+	weston_wm_window_cancel_properties(window);
+
 	if (window->frame_id) {
 		xcb_reparent_window(wm->conn, window->id, wm->wm_window, 0, 0);
 		xcb_destroy_window(wm->conn, window->frame_id);
@@ -1789,6 +1948,9 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 		count++;
 	}
 
+	weston_wm_dispatch_property_fetches(wm);
+	weston_wm_selection_dispatch(wm);
+
 	xcb_flush(wm->conn);
 
 	return count;
@@ -2097,6 +2259,7 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 	wl_signal_add(&wxs->compositor->kill_signal,
 		      &wm->kill_listener);
 	wl_list_init(&wm->unpaired_window_list);
+	wl_list_init(&wm->property_fetch_list);
 
 	weston_wm_create_cursors(wm);
 	weston_wm_window_set_cursor(wm, wm->screen->root, XWM_CURSOR_LEFT_PTR);
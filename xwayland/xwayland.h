@@ -43,6 +43,7 @@ struct weston_xserver {
 	int display;
 	struct wl_event_source *sigusr1_source;
 	struct weston_process process;
+	int prespawned;		/* started before any X client, at idle priority */
 	struct wl_resource *resource;
 	struct wl_client *client;
 	struct weston_compositor *compositor;
@@ -70,6 +71,7 @@ struct weston_wm {
 	struct wl_listener transform_listener;
 	struct wl_listener kill_listener;
 	struct wl_list unpaired_window_list;
+	struct wl_list property_fetch_list;
 
 	xcb_window_t selection_window;
 	xcb_window_t selection_owner;
@@ -78,6 +80,10 @@ struct weston_wm {
 	struct wl_event_source *property_source;
 	xcb_get_property_reply_t *property_reply;
 	int property_start;
+	unsigned int selection_reply_sequence;
+	void (*selection_reply_func)(struct weston_wm *wm,
+				     xcb_get_property_reply_t *reply);
+	uint32_t incr_chunk_size;
 	struct wl_array source_data;
 	xcb_selection_request_event_t selection_request;
 	xcb_atom_t selection_target;
@@ -162,6 +168,8 @@ weston_wm_selection_init(struct weston_wm *wm);
 int
 weston_wm_handle_selection_event(struct weston_wm *wm,
 				 xcb_generic_event_t *event);
+void
+weston_wm_selection_dispatch(struct weston_wm *wm);
 
 struct weston_wm *
 weston_wm_create(struct weston_xserver *wxs, int fd);